@@ -31,6 +31,7 @@ typedef struct azure {
     status (*http_request)(heap h, buffer_handler bh, http_method method,
             tuple headers, buffer body);
     buffer_handler (*allocate_http_parser)(heap h, value_handler each);
+    void (*boot_milestone)(const char *name);   /* optional */
 } *azure;
 
 #undef sym
@@ -53,164 +54,191 @@ static void azure_report_retry(azure az)
         az->report_backoff <<= 1;
 }
 
-closure_function(1, 1, void, wireserver_parse_resp,
-                 azure, az,
-                 value, v)
+/* The goal state request and the health report share one keep-alive
+   connection to the wire server; if the server closes the connection
+   before the report is acknowledged, the report is retried on a new one. */
+typedef struct wireserver_session {
+    azure az;
+    buffer_handler out;
+    value_handler vh;
+    buffer_handler parser;
+    boolean health_sent;
+    boolean done;
+} *wireserver_session;
+
+static boolean wireserver_parse_goalstate(azure az, buffer content)
 {
-    azure az = bound(az);
-    buffer content = az->get(v, sym(content));
-    if (content) {
-        int index = az->buffer_strstr(content, "<ContainerId>");
-        if (index < 0)
-            goto exit;
-        buffer_consume(content, index);
-        buffer_consume(content, buffer_strchr(content, '>') + 1);
-        index = buffer_strchr(content, '<');
-        if (index < 0)
-            goto exit;
-        if (index >= sizeof(az->container_id))
-            goto exit;
-        az->buffer_read(content, az->container_id, index);
-        az->container_id[index] = '\0';
-        index = az->buffer_strstr(content, "<InstanceId>");
-        if (index < 0)
-            goto exit;
-        buffer_consume(content, index);
-        buffer_consume(content, buffer_strchr(content, '>') + 1);
-        index = buffer_strchr(content, '<');
-        if (index < 0)
-            goto exit;
-        if (index >= sizeof(az->instance_id))
-            goto exit;
-        az->buffer_read(content, az->instance_id, index);
-        az->instance_id[index] = '\0';
-        azure_report_ready(az);
-    }
-  exit:
-    az->destruct_tuple(v, true);
-    closure_finish();
+    int index = az->buffer_strstr(content, "<ContainerId>");
+    if (index < 0)
+        return false;
+    buffer_consume(content, index);
+    buffer_consume(content, buffer_strchr(content, '>') + 1);
+    index = buffer_strchr(content, '<');
+    if (index < 0)
+        return false;
+    if (index >= sizeof(az->container_id))
+        return false;
+    az->buffer_read(content, az->container_id, index);
+    az->container_id[index] = '\0';
+    index = az->buffer_strstr(content, "<InstanceId>");
+    if (index < 0)
+        return false;
+    buffer_consume(content, index);
+    buffer_consume(content, buffer_strchr(content, '>') + 1);
+    index = buffer_strchr(content, '<');
+    if (index < 0)
+        return false;
+    if (index >= sizeof(az->instance_id))
+        return false;
+    az->buffer_read(content, az->instance_id, index);
+    az->instance_id[index] = '\0';
+    return true;
 }
 
-closure_function(2, 1, status, wireserver_get_resp,
-                 azure, az, buffer_handler, out,
-                 buffer, data)
+static boolean wireserver_get(azure az, buffer_handler out)
 {
-    if (data) {
-        azure az = bound(az);
-        heap h = az->h;
-        boolean success = false;
-        value_handler vh = closure(h, wireserver_parse_resp, az);
-        if (vh != INVALID_ADDRESS) {
-            buffer_handler parser = az->allocate_http_parser(h, vh);
-            if (parser != INVALID_ADDRESS) {
-                apply(parser, data);
-                success = true;
-            }
-        }
-        apply(bound(out), 0);
-        if (!success)
-            azure_report_retry(az);
-    } else {
-        closure_finish();
-    }
-    return STATUS_OK;
+    tuple req = az->allocate_tuple();
+    if (req == INVALID_ADDRESS)
+        return false;
+    az->set(req, sym(url), alloca_wrap_cstring("/machine?comp=goalstate"));
+    az->set(req, sym(Host), alloca_wrap_cstring("168.63.129.16"));
+    az->set(req, sym(x-ms-version), alloca_wrap_cstring(AZURE_MS_VERSION));
+    status s = az->http_request(az->h, out, HTTP_REQUEST_METHOD_GET, req, 0);
+    az->deallocate_value(req);
+    if (is_ok(s))
+        return true;
+    az->timm_dealloc(s);
+    return false;
 }
 
-closure_function(1, 1, buffer_handler, wireserver_get_ch,
-                 azure, az,
-                 buffer_handler, out)
+static boolean wireserver_post_health(azure az, buffer_handler out)
 {
-    azure az = bound(az);
-    buffer_handler in = INVALID_ADDRESS;
-    if (out) {    /* connection succeeded */
-        tuple req = az->allocate_tuple();
-        if (req == INVALID_ADDRESS)
-            goto exit;
-        az->set(req, sym(url), alloca_wrap_cstring("/machine?comp=goalstate"));
-        az->set(req, sym(Host), alloca_wrap_cstring("168.63.129.16"));
-        az->set(req, sym(x-ms-version), alloca_wrap_cstring(AZURE_MS_VERSION));
-        status s = az->http_request(az->h, out, HTTP_REQUEST_METHOD_GET, req, 0);
+    tuple req = az->allocate_tuple();
+    if (req == INVALID_ADDRESS)
+        return false;
+    buffer b = az->allocate_buffer(az->h, 512);
+    if (b == INVALID_ADDRESS) {
         az->deallocate_value(req);
-        if (is_ok(s))
-            in = closure(az->h, wireserver_get_resp, az, out);
-        else
-            az->timm_dealloc(s);
+        return false;
     }
-  exit:
-    closure_finish();
-    if (in == INVALID_ADDRESS)
-        azure_report_retry(az);
-    return in;
+    az->set(req, sym(url), alloca_wrap_cstring("/machine?comp=health"));
+    az->set(req, sym(Host), alloca_wrap_cstring("168.63.129.16"));
+    az->set(req, sym(x-ms-version), alloca_wrap_cstring(AZURE_MS_VERSION));
+    az->set(req, sym(Content-Type), alloca_wrap_cstring("text/xml;charset=utf-8"));
+    az->bprintf(b, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n\
+            <Health xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\
+            xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">\n\
+              <GoalStateIncarnation>1</GoalStateIncarnation>\n\
+              <Container>\n\
+                <ContainerId>%s</ContainerId>\n\
+                <RoleInstanceList>\n\
+                  <Role>\n\
+                    <InstanceId>%s</InstanceId>\n\
+                    <Health>\n\
+                      <State>Ready</State>\n\
+                    </Health>\n\
+                  </Role>\n\
+                </RoleInstanceList>\n\
+              </Container>\n\
+            </Health>\n", az->container_id, az->instance_id);
+    status s = az->http_request(az->h, out, HTTP_REQUEST_METHOD_POST, req, b);
+    az->deallocate_value(req);
+    if (is_ok(s))
+        return true;
+    az->timm_dealloc(s);
+    return false;
+}
+
+closure_function(1, 1, void, wireserver_resp,
+                 wireserver_session, ws,
+                 value, v)
+{
+    wireserver_session ws = bound(ws);
+    azure az = ws->az;
+    buffer_handler out = ws->out;
+    boolean close = true;
+    if (!ws->health_sent) {
+        buffer content = az->get(v, sym(content));
+        if (content && wireserver_parse_goalstate(az, content) &&
+            wireserver_post_health(az, out)) {
+            ws->health_sent = true;
+            close = false;
+        }
+    } else {
+        ws->done = true;
+        if (az->boot_milestone)
+            az->boot_milestone("azure ready reported");
+    }
+    az->destruct_tuple(v, true);
+    if (close)
+        apply(out, 0);  /* may free ws */
 }
 
-closure_function(1, 1, status, wireserver_post_resp,
-                 buffer_handler, out,
+closure_function(1, 1, status, wireserver_recv,
+                 wireserver_session, ws,
                  buffer, data)
 {
-    if (data)
-        apply(bound(out), 0);
-    else
+    wireserver_session ws = bound(ws);
+    if (data) {
+        apply(ws->parser, data);
+    } else {
+        azure az = ws->az;
+        boolean done = ws->done;
+        deallocate_closure(ws->vh);
+        deallocate(az->h, ws, sizeof(*ws));
         closure_finish();
+        if (!done)
+            azure_report_retry(az);
+    }
     return STATUS_OK;
 }
 
-closure_function(1, 1, buffer_handler, wireserver_post_ch,
+closure_function(1, 1, buffer_handler, wireserver_ch,
                  azure, az,
                  buffer_handler, out)
 {
     azure az = bound(az);
+    heap h = az->h;
     buffer_handler in = INVALID_ADDRESS;
-    if (out) {    /* connection succeeded */
-        tuple req = az->allocate_tuple();
-        if (req == INVALID_ADDRESS)
-            goto exit;
-        buffer b = az->allocate_buffer(az->h, 512);
-        if (b == INVALID_ADDRESS) {
-            az->deallocate_value(req);
-            goto exit;
-        }
-        az->set(req, sym(url), alloca_wrap_cstring("/machine?comp=health"));
-        az->set(req, sym(Host), alloca_wrap_cstring("168.63.129.16"));
-        az->set(req, sym(x-ms-version), alloca_wrap_cstring(AZURE_MS_VERSION));
-        az->set(req, sym(Content-Type), alloca_wrap_cstring("text/xml;charset=utf-8"));
-        az->bprintf(b, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n\
-                <Health xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\
-                xmlns:xsd=\"http://www.w3.org/2001/XMLSchema\">\n\
-                  <GoalStateIncarnation>1</GoalStateIncarnation>\n\
-                  <Container>\n\
-                    <ContainerId>%s</ContainerId>\n\
-                    <RoleInstanceList>\n\
-                      <Role>\n\
-                        <InstanceId>%s</InstanceId>\n\
-                        <Health>\n\
-                          <State>Ready</State>\n\
-                        </Health>\n\
-                      </Role>\n\
-                    </RoleInstanceList>\n\
-                  </Container>\n\
-                </Health>\n", az->container_id, az->instance_id);
-        status s = az->http_request(az->h, out, HTTP_REQUEST_METHOD_POST, req, b);
-        az->deallocate_value(req);
-        if (is_ok(s))
-            in = closure(az->h, wireserver_post_resp, out);
-        else
-            az->timm_dealloc(s);
-    }
-  exit:
     closure_finish();
+    if (!out)   /* connection failed */
+        goto fail;
+    wireserver_session ws = allocate(h, sizeof(*ws));
+    if (ws == INVALID_ADDRESS)
+        goto fail;
+    ws->az = az;
+    ws->out = out;
+    ws->done = false;
+    value_handler vh = closure(h, wireserver_resp, ws);
+    if (vh == INVALID_ADDRESS)
+        goto fail_dealloc;
+    ws->vh = vh;
+    ws->parser = az->allocate_http_parser(h, vh);
+    if (ws->parser == INVALID_ADDRESS)
+        goto fail_vh;
+    in = closure(h, wireserver_recv, ws);
     if (in == INVALID_ADDRESS)
-        azure_report_retry(az);
+        goto fail_vh;
+
+    /* the goal state is needed only once */
+    ws->health_sent = az->instance_id[0] != '\0';
+    if (!(ws->health_sent ? wireserver_post_health(az, out) : wireserver_get(az, out))) {
+        deallocate_closure(in);
+        goto fail_vh;
+    }
     return in;
+  fail_vh:
+    deallocate_closure(vh);
+  fail_dealloc:
+    deallocate(h, ws, sizeof(*ws));
+  fail:
+    azure_report_retry(az);
+    return INVALID_ADDRESS;
 }
 
-
 static void azure_report_ready(azure az)
 {
-    connection_handler ch;
-    if (!az->instance_id[0])
-        ch = closure(az->h, wireserver_get_ch, az);
-    else
-        ch = closure(az->h, wireserver_post_ch, az);
+    connection_handler ch = closure(az->h, wireserver_ch, az);
     if (ch == INVALID_ADDRESS)
         return;
     ip_addr_t wireserver_addr = IPADDR4_INIT_BYTES(168, 63, 129, 16);
@@ -244,6 +272,7 @@ boolean azure_cloud_init(heap h, klib_get_sym get_sym)
         deallocate(h, az, sizeof(*az));
         return false;
     }
+    az->boot_milestone = get_sym("boot_milestone");
     az->h = h;
     az->container_id[0] = az->instance_id[0] = '\0';
     az->report_backoff = seconds(1);
@@ -24,25 +24,42 @@ static enum cloud cloud_detect(klib_get_sym get_sym)
     return CLOUD_UNKNOWN;
 }
 
+static int cloud_init(heap h, klib_get_sym get_sym)
+{
+    enum cloud c = cloud_detect(get_sym);
+    switch (c) {
+    case CLOUD_ERROR:
+        return KLIB_INIT_FAILED;
+    case CLOUD_AZURE:
+        if (!azure_cloud_init(h, get_sym))
+            return KLIB_INIT_FAILED;
+        break;
+    default:
+        break;
+    }
+    return KLIB_INIT_OK;
+}
+
+/* a VM resumed from a snapshot is a new instance to the cloud provider */
+closure_function(2, 0, void, cloud_init_vm_resume,
+                 heap, h, klib_get_sym, get_sym)
+{
+    cloud_init(bound(h), bound(get_sym));
+}
+
 int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
 {
     void *(*get_kernel_heaps)(void) = get_sym("get_kernel_heaps");
     boolean (*first_boot)(void) = get_sym("first_boot");
-    if (!get_kernel_heaps || !first_boot)
+    void (*register_vm_resume_notify)(thunk) = get_sym("register_vm_resume_notify");
+    if (!get_kernel_heaps || !first_boot || !register_vm_resume_notify)
         return KLIB_INIT_FAILED;
     heap h = heap_general(get_kernel_heaps());
-    if (first_boot()) {
-        enum cloud c = cloud_detect(get_sym);
-        switch (c) {
-        case CLOUD_ERROR:
-            return KLIB_INIT_FAILED;
-        case CLOUD_AZURE:
-            if (!azure_cloud_init(h, get_sym))
-                return KLIB_INIT_FAILED;
-            break;
-        default:
-            break;
-        }
-    }
+    thunk t = closure(h, cloud_init_vm_resume, h, get_sym);
+    if (t == INVALID_ADDRESS)
+        return KLIB_INIT_FAILED;
+    register_vm_resume_notify(t);
+    if (first_boot())
+        return cloud_init(h, get_sym);
     return KLIB_INIT_OK;
 }
@@ -1,11 +1,20 @@
 #include <kernel.h>
 #include <lwip.h>
+#include <ktls.h>
 
 #define _RUNTIME_H_ /* guard against double inclusion of runtime.h */
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/entropy.h>
+#include <mbedtls/gcm.h>
+#include <mbedtls/sha256.h>
 #include <mbedtls/ssl.h>
 
+/* Sessions of recent servers, offered for resumption (session ID or
+   ticket, whichever the server issued) on the next connection to the same
+   address and port, so that repeated HTTPS requests skip the full
+   handshake; the least recently used entry is replaced. */
+#define TLS_SESSION_CACHE_SIZE  8
+
 declare_closure_struct(1, 1, buffer_handler, tls_conn_handler,
                        struct tls_conn *, conn,
                        buffer_handler, out);
@@ -25,6 +34,8 @@ typedef struct tls_conn {
     buffer_handler app_in;
     closure_struct(tls_out_handler, app_out);
     buffer incoming, outgoing;
+    ip_addr_t addr;
+    u16 port;
     enum {
         tls_handshake,
         tls_open,
@@ -44,10 +55,54 @@ static struct {
     tuple (*timm_alloc)(char *name, ...);
     void (*timm_dealloc)(tuple t);
     u64 (*random_buffer)(buffer b);
+    buffer (*allocate_buffer)(heap h, bytes length);
     struct tm *(*gmtime_r)(const long *timep, struct tm *result);
+    void (*sha256_blocks)(u32 state[8], const u8 *data, u64 nblocks);
     heap h;
+    struct tls_session_entry {
+        ip_addr_t addr;
+        u16 port;
+        boolean valid;
+        u64 last_used;
+        mbedtls_ssl_session session;
+    } sessions[TLS_SESSION_CACHE_SIZE];
+    u64 session_clock;
 } tls;
 
+static struct tls_session_entry *tls_session_lookup(ip_addr_t *addr, u16 port)
+{
+    for (int i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+        struct tls_session_entry *e = &tls.sessions[i];
+        if (e->valid && (e->port == port) && ip_addr_cmp(&e->addr, addr))
+            return e;
+    }
+    return 0;
+}
+
+static void tls_session_save(tls_conn conn)
+{
+    struct tls_session_entry *e = tls_session_lookup(&conn->addr, conn->port);
+    if (!e) {
+        e = &tls.sessions[0];
+        for (int i = 1; i < TLS_SESSION_CACHE_SIZE; i++) {
+            struct tls_session_entry *c = &tls.sessions[i];
+            if (!c->valid || (e->valid && (c->last_used < e->last_used)))
+                e = c;
+        }
+    }
+    mbedtls_ssl_session_free(&e->session);
+    mbedtls_ssl_session_init(&e->session);
+    if (mbedtls_ssl_get_session(&conn->ssl, &e->session)) {
+        mbedtls_ssl_session_free(&e->session);
+        e->valid = false;
+        return;
+    }
+    ip_addr_copy(e->addr, conn->addr);
+    e->port = conn->port;
+    e->last_used = ++tls.session_clock;
+    e->valid = true;
+}
+
 static void tls_close(tls_conn conn)
 {
     if (conn->app_in) {
@@ -72,9 +127,13 @@ static int tls_send(void *ctx, const unsigned char *buf, size_t len)
     tls_conn conn = ctx;
     if (!conn->out)
         return MBEDTLS_ERR_SSL_CONN_EOF;
-    buffer b = wrap_buffer(tls.h, (void *)buf, len);
+    /* the connection references sent data until it is acknowledged, while
+       mbedtls reuses its output buffer */
+    buffer b = tls.allocate_buffer(tls.h, len);
     if (b == INVALID_ADDRESS)
         return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+    kern_funcs.memcopy(buffer_ref(b, 0), buf, len);
+    buffer_produce(b, len);
     status s = apply(conn->out, b);
     if (!is_ok(s)) {
         tls.timm_dealloc(s);
@@ -150,6 +209,7 @@ define_closure_function(1, 1, status, tls_in_handler,
         ret = mbedtls_ssl_handshake(&conn->ssl);
         if (ret == 0) {
             conn->state = tls_open;
+            tls_session_save(conn);
             conn->app_in = apply(conn->app_ch, init_closure(&conn->app_out, tls_out_handler, conn));
             conn->app_ch = 0;   /* so that it is not invoked when the connection is closed */
             if (!conn->app_in)  /* application-level error */
@@ -232,6 +292,14 @@ static int tls_connect(ip_addr_t *addr, u16 port, connection_handler ch)
         tls.rprintf("%s: cannot set up SSL context\n", __func__);
         goto err_ssl_setup;
     }
+    struct tls_session_entry *e = tls_session_lookup(addr, port);
+    if (e) {
+        /* on failure, the handshake simply starts a new session */
+        mbedtls_ssl_set_session(&conn->ssl, &e->session);
+        e->last_used = ++tls.session_clock;
+    }
+    ip_addr_copy(conn->addr, *addr);
+    conn->port = port;
     conn->app_ch = ch;
     conn->app_in = 0;
     conn->incoming = conn->outgoing = 0;
@@ -250,6 +318,40 @@ static int tls_connect(ip_addr_t *addr, u16 port, connection_handler ch)
     return ret;
 }
 
+/* AES-GCM for records sealed by the kernel (kTLS) */
+static void *ktls_gcm_key_alloc(const u8 *key, u32 key_len)
+{
+    mbedtls_gcm_context *ctx = mbedtls_calloc(1, sizeof(*ctx));
+    if (!ctx)
+        return 0;
+    mbedtls_gcm_init(ctx);
+    if (mbedtls_gcm_setkey(ctx, MBEDTLS_CIPHER_ID_AES, key, key_len * 8)) {
+        mbedtls_gcm_free(ctx);
+        mbedtls_free(ctx);
+        return 0;
+    }
+    return ctx;
+}
+
+static void ktls_gcm_key_free(void *ctx)
+{
+    mbedtls_gcm_free(ctx);
+    mbedtls_free(ctx);
+}
+
+static boolean ktls_gcm_seal(void *ctx, const u8 *nonce, const u8 *aad, u32 aad_len,
+                             u8 *data, u64 len, u8 *tag)
+{
+    return mbedtls_gcm_crypt_and_tag(ctx, MBEDTLS_GCM_ENCRYPT, len, nonce, KTLS_NONCE_SIZE,
+                                     aad, aad_len, data, data, KTLS_TAG_SIZE, tag) == 0;
+}
+
+static struct ktls_aead ktls_gcm = {
+    .key_alloc = ktls_gcm_key_alloc,
+    .key_free = ktls_gcm_key_free,
+    .seal = ktls_gcm_seal,
+};
+
 int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
 {
     tls.rprintf = get_sym("rprintf");
@@ -267,7 +369,9 @@ int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
             !(tls.timm_alloc = get_sym("timm")) ||
             !(tls.timm_dealloc = get_sym("timm_dealloc")) ||
             !(tls.random_buffer = get_sym("random_buffer")) ||
-            !(tls.gmtime_r = get_sym("gmtime_r"))) {
+            !(tls.allocate_buffer = get_sym("allocate_buffer")) ||
+            !(tls.gmtime_r = get_sym("gmtime_r")) ||
+            !(tls.sha256_blocks = get_sym("sha256_blocks"))) {
         tls.rprintf("TLS init: kernel symbols not found\n");
         return KLIB_INIT_FAILED;
     }
@@ -285,6 +389,9 @@ int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
     mbedtls_ssl_conf_rng(&tls.conf, mbedtls_ctr_drbg_random, &tls.ctr_drbg);
     add_sym(md, "tls_set_cacert", tls_set_cacert);
     add_sym(md, "tls_connect", tls_connect);
+    void (*ktls_register_aead)(ktls_aead aead) = get_sym("ktls_register_aead");
+    if (ktls_register_aead)
+        ktls_register_aead(&ktls_gcm);
     return KLIB_INIT_OK;
 }
 
@@ -324,6 +431,12 @@ int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t
     return 0;
 }
 
+int mbedtls_internal_sha256_process(mbedtls_sha256_context *ctx, const unsigned char data[64])
+{
+    tls.sha256_blocks(ctx->state, data, 1);
+    return 0;
+}
+
 struct tm *mbedtls_platform_gmtime_r(const mbedtls_time_t *tt, struct tm *tm_buf)
 {
     return tls.gmtime_r(tt, tm_buf);
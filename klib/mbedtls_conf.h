@@ -41,6 +41,16 @@ extern struct kern_funcs {
     int (*rsnprintf)(char *str, u64 size, const char *fmt, ...);
 } kern_funcs;
 
+#ifdef __x86_64__
+/* AES-NI for AES and PCLMULQDQ for GCM, selected at run time with cpuid */
+#define MBEDTLS_HAVE_ASM
+#define MBEDTLS_AESNI_C
+#endif
+
+/* SHA-256 blocks are hashed by the kernel, with the SHA extensions if the
+   cpu has them */
+#define MBEDTLS_SHA256_PROCESS_ALT
+
 #define MBEDTLS_PLATFORM_CALLOC_MACRO       mbedtls_calloc
 #define MBEDTLS_PLATFORM_FREE_MACRO         mbedtls_free
 #define MBEDTLS_PLATFORM_TIME_MACRO         kern_funcs.time_f
@@ -38,8 +38,9 @@ GIo/ikGQI31bS/6kA1ibRrLDYGCD+H1QQc7CoZDDu+8CL9IVVO5EFdkKrqeKM+2x\
 LXY2JtwE65/3YR8V3Idv7kaWKK2hJn0KCacuBKONvPi8BDAB\
 -----END CERTIFICATE-----"
 
-#define RADAR_STATS_INTERVAL    seconds(60)
-#define RADAR_STATS_BATCH_SIZE  5
+#define RADAR_STATS_DEFAULT_INTERVAL    60  /* seconds; RADAR_STATS_INTERVAL in the environment */
+#define RADAR_STATS_BATCH_SIZE          5
+#define RADAR_HIST_BUCKETS              64
 
 declare_closure_struct(0, 1, void, retry_timer_func,
     u64, overruns);
@@ -60,6 +61,13 @@ static struct telemetry {
     closure_struct(telemetry_stats, stats_func);
     u64 stats_mem_used[RADAR_STATS_BATCH_SIZE];
     int stats_count;
+    timestamp stats_interval;
+    buffer_handler stats_out;   /* kept-alive connection for stats reports */
+    boolean stats_connecting;
+    /* histogram values at the previous stats report */
+    u64 syscall_prev[RADAR_HIST_BUCKETS];
+    u64 io_cur[STORAGE_OP_COUNT][STORAGE_HIST_BUCKETS];
+    u64 io_prev[STORAGE_OP_COUNT][STORAGE_HIST_BUCKETS];
     void (*rprintf)(const char *format, ...);
     tuple (*allocate_tuple)(void);
     void (*set)(value z, void *c, void *v);
@@ -92,6 +100,8 @@ static struct telemetry {
     status (*http_request)(heap h, buffer_handler bh, http_method method,
             tuple headers, buffer body);
     int (*tls_connect)(ip_addr_t *addr, u16 port, connection_handler ch);
+    u64 *(*syscall_latency_hist)(int *nbuckets);
+    void (*net_tcp_rtt_hist)(u64 *buckets, int nbuckets);
 } telemetry;
 
 #undef sym
@@ -117,7 +127,7 @@ static void telemetry_dns_cb(const char *name, const ip_addr_t *ipaddr, void *ca
     } else {
         kfunc(rprintf)("Radar: failed to look up server hostname\n");
     }
-    deallocate_closure(ch);
+    apply(ch, 0);   /* connection failed */
 }
 
 define_closure_function(0, 1, void, retry_timer_func,
@@ -157,10 +167,20 @@ static boolean telemetry_req(const char *url, buffer data, buffer_handler bh)
     }
 }
 
-closure_function(2, 1, status, telemetry_recv,
-                 value_handler, vh, buffer_handler, out,
+closure_function(3, 1, status, telemetry_recv,
+                 value_handler, vh, buffer_handler, out, boolean, keepalive,
                  buffer, data)
 {
+    if (bound(keepalive)) {
+        /* responses to stats reports are not needed: just keep the connection
+           until the server closes it */
+        if (!data) {
+            if (telemetry.stats_out == bound(out))
+                telemetry.stats_out = 0;
+            closure_finish();
+        }
+        return STATUS_OK;
+    }
     if (data) {
         value_handler vh = bound(vh);
         if (vh) {
@@ -197,8 +217,8 @@ closure_function(2, 1, status, telemetry_recv,
                     telemetry.stats_mem_used[count] = heap_allocated(telemetry.phys);
                 telemetry_stats_send();
                 telemetry.stats_count = 0;
-                kfunc(register_timer)(CLOCK_ID_MONOTONIC, RADAR_STATS_INTERVAL, false,
-                        RADAR_STATS_INTERVAL, (timer_handler)&telemetry.stats_func);
+                kfunc(register_timer)(CLOCK_ID_MONOTONIC, telemetry.stats_interval, false,
+                        telemetry.stats_interval, (timer_handler)&telemetry.stats_func);
                 telemetry.running = true;
             } else {
                 telemetry_retry();
@@ -208,18 +228,23 @@ closure_function(2, 1, status, telemetry_recv,
     return STATUS_OK;
 }
 
-closure_function(3, 1, buffer_handler, telemetry_ch,
-                 const char *, url, buffer, data, value_handler, vh,
+closure_function(4, 1, buffer_handler, telemetry_ch,
+                 const char *, url, buffer, data, value_handler, vh, boolean, keepalive,
                  buffer_handler, out)
 {
     buffer data = bound(data);
     buffer_handler in = 0;
+    if (bound(keepalive))
+        telemetry.stats_connecting = false;
     if (out) {
         boolean success = telemetry_req(bound(url), data, out);
-        if (success)
-            in = closure(telemetry.h, telemetry_recv, bound(vh), out);
-        else
+        if (success) {
+            in = closure(telemetry.h, telemetry_recv, bound(vh), out, bound(keepalive));
+            if (bound(keepalive) && in != INVALID_ADDRESS)
+                telemetry.stats_out = out;
+        } else {
             deallocate_buffer(data);
+        }
     } else {    /* connection failed */
         deallocate_buffer(data);
         if (!telemetry.running)
@@ -229,9 +254,10 @@ closure_function(3, 1, buffer_handler, telemetry_ch,
     return in;
 }
 
-boolean telemetry_send(const char *url, buffer data, value_handler vh)
+static boolean telemetry_connect(const char *url, buffer data, value_handler vh,
+                                 boolean keepalive)
 {
-    connection_handler ch = closure(telemetry.h, telemetry_ch, url, data, vh);
+    connection_handler ch = closure(telemetry.h, telemetry_ch, url, data, vh, keepalive);
     if (ch == INVALID_ADDRESS)
         return false;
     ip_addr_t radar_addr;
@@ -248,6 +274,28 @@ boolean telemetry_send(const char *url, buffer data, value_handler vh)
     return false;
 }
 
+boolean telemetry_send(const char *url, buffer data, value_handler vh)
+{
+    return telemetry_connect(url, data, vh, false);
+}
+
+/* Stats reports share one connection, opened on first use and kept alive
+   across reports until the server closes it. A report made while that
+   connection is being opened is dropped. */
+static boolean telemetry_send_keepalive(const char *url, buffer data)
+{
+    if (telemetry.stats_out)
+        return telemetry_req(url, data, telemetry.stats_out);
+    if (telemetry.stats_connecting)
+        return false;
+    telemetry.stats_connecting = true;
+    if (!telemetry_connect(url, data, 0, true)) {
+        telemetry.stats_connecting = false;
+        return false;
+    }
+    return true;
+}
+
 static void telemetry_print_env(buffer b)
 {
     /* Assumes that the buffer already contains at least one JSON attribute
@@ -389,9 +437,28 @@ static void telemetry_boot(void)
     telemetry_retry();
 }
 
-closure_function(2, 3, void, telemetry_vh,
+static void telemetry_print_io_stats(buffer b, storage_stats st)
+{
+    static const char *ops[STORAGE_OP_COUNT] = { "read", "write", "flush" };
+    kfunc(bprintf)(b, ",\"io\":{\"inflight\":%ld", st->inflight);
+    for (int op = 0; op < STORAGE_OP_COUNT; op++) {
+        kfunc(bprintf)(b, ",\"%s\":{\"ops\":%ld,\"bytes\":%ld,\"latency\":{", ops[op],
+                       st->ops[op], st->bytes[op]);
+        boolean first = true;
+        for (int i = 0; i < STORAGE_HIST_BUCKETS; i++) {
+            if (!st->latency[op][i])
+                continue;
+            kfunc(bprintf)(b, "%s\"%d\":%ld", first ? "" : ",", i, st->latency[op][i]);
+            first = false;
+        }
+        buffer_write_cstring(b, "}}");
+    }
+    buffer_write_cstring(b, "}");
+}
+
+closure_function(2, 4, void, telemetry_vh,
                  buffer, b, int, count,
-                 u8 *, uuid, const char *, label, filesystem, fs)
+                 u8 *, uuid, const char *, label, filesystem, fs, storage_stats, st)
 {
     u64 block_size = kfunc(fs_blocksize)(fs);
     buffer b = bound(b);
@@ -400,11 +467,65 @@ closure_function(2, 3, void, telemetry_vh,
         kfunc(bprintf)(b, "%s", label);
     else
         kfunc(print_uuid)(b, uuid);
-    kfunc(bprintf)(b, "\",\"used\":%ld,\"total\":%ld}", kfunc(fs_usedblocks)(fs) * block_size,
+    kfunc(bprintf)(b, "\",\"used\":%ld,\"total\":%ld", kfunc(fs_usedblocks)(fs) * block_size,
             kfunc(fs_totalblocks)(fs) * block_size);
+    if (st) {
+        telemetry_print_io_stats(b, st);
+        for (int op = 0; op < STORAGE_OP_COUNT; op++)
+            for (int i = 0; i < STORAGE_HIST_BUCKETS; i++)
+                telemetry.io_cur[op][i] += st->latency[op][i];
+    }
+    buffer_write_cstring(b, "}");
     bound(count)++;
 }
 
+/* Non-empty buckets of a histogram as "log2":count pairs. If prev is given,
+   counts are deltas from it (restarting if the histogram has been reset) and
+   prev is updated. */
+static void telemetry_print_hist(buffer b, const char *name, u64 *cur, u64 *prev, int n)
+{
+    kfunc(bprintf)(b, "\"%s\":{", name);
+    boolean first = true;
+    for (int i = 0; i < n; i++) {
+        u64 count = cur[i];
+        if (prev) {
+            if (count >= prev[i])
+                count -= prev[i];
+            prev[i] = cur[i];
+        }
+        if (!count)
+            continue;
+        kfunc(bprintf)(b, "%s\"%d\":%ld", first ? "" : ",", i, count);
+        first = false;
+    }
+    buffer_write_cstring(b, "}");
+}
+
+/* Latency histograms aggregated over the report interval: syscalls and
+   block I/O of all volumes in log2(cycles), and the current smoothed TCP rtt
+   of established connections in log2(usecs). */
+static void telemetry_print_latency(buffer b)
+{
+    static const char *io_names[STORAGE_OP_COUNT] = { "ioRead", "ioWrite", "ioFlush" };
+    buffer_write_cstring(b, ",\"latency\":{");
+    int nbuckets;
+    u64 *syscall_hist = kfunc(syscall_latency_hist)(&nbuckets);
+    if (syscall_hist) {
+        telemetry_print_hist(b, "syscall", syscall_hist, telemetry.syscall_prev,
+                             MIN(nbuckets, RADAR_HIST_BUCKETS));
+        buffer_write_cstring(b, ",");
+    }
+    for (int op = 0; op < STORAGE_OP_COUNT; op++) {
+        telemetry_print_hist(b, io_names[op], telemetry.io_cur[op], telemetry.io_prev[op],
+                             STORAGE_HIST_BUCKETS);
+        buffer_write_cstring(b, ",");
+    }
+    u64 rtt[RADAR_HIST_BUCKETS];
+    kfunc(net_tcp_rtt_hist)(rtt, RADAR_HIST_BUCKETS);
+    telemetry_print_hist(b, "tcpRtt", rtt, 0, RADAR_HIST_BUCKETS);
+    buffer_write_cstring(b, "}");
+}
+
 static void telemetry_stats_send(void)
 {
     buffer b = kfunc(allocate_buffer)(telemetry.h, 128);
@@ -417,9 +538,12 @@ static void telemetry_stats_send(void)
         kfunc(bprintf)(b, "%ld%s", telemetry.stats_mem_used[i],
                 (i < RADAR_STATS_BATCH_SIZE - 1) ? "," : "");
     buffer_write_cstring(b, "],\"diskUsage\":[");
+    zero(telemetry.io_cur, sizeof(telemetry.io_cur));
     kfunc(storage_iterate)(stack_closure(telemetry_vh, b, 0));
-    buffer_write_cstring(b, "]}\r\n");
-    if (!telemetry_send("/api/v1/machine-stats", b, 0)) {
+    kfunc(bprintf)(b, "],\"interval\":%ld", sec_from_timestamp(telemetry.stats_interval));
+    telemetry_print_latency(b);
+    buffer_write_cstring(b, "}\r\n");
+    if (!telemetry_send_keepalive("/api/v1/machine-stats", b)) {
         kfunc(rprintf)("%s: failed to send stats\n", __func__);
         deallocate_buffer(b);
     }
@@ -509,7 +633,9 @@ int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
             !(telemetry.ipaddr_ntoa = get_sym("ipaddr_ntoa")) ||
             !(telemetry.dns_gethostbyname = get_sym("dns_gethostbyname")) ||
             !(telemetry.allocate_http_parser = get_sym("allocate_http_parser")) ||
-            !(telemetry.http_request = get_sym("http_request"))) {
+            !(telemetry.http_request = get_sym("http_request")) ||
+            !(telemetry.syscall_latency_hist = get_sym("syscall_latency_hist")) ||
+            !(telemetry.net_tcp_rtt_hist = get_sym("net_tcp_rtt_hist"))) {
         kfunc(rprintf)("Radar: kernel symbols not found\n");
         return KLIB_INIT_FAILED;
     }
@@ -524,6 +650,14 @@ int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
     telemetry.auth_header = kfunc(get)(telemetry.env, sym(RADAR_KEY));
     telemetry.retry_backoff = seconds(1);
     telemetry.running = false;
+    u64 interval = RADAR_STATS_DEFAULT_INTERVAL;
+    buffer interval_env = kfunc(get)(telemetry.env, sym(RADAR_STATS_INTERVAL));
+    if (interval_env && (!u64_from_value(interval_env, &interval) || interval == 0)) {
+        kfunc(rprintf)("Radar: invalid RADAR_STATS_INTERVAL, using %d seconds\n",
+                       RADAR_STATS_DEFAULT_INTERVAL);
+        interval = RADAR_STATS_DEFAULT_INTERVAL;
+    }
+    telemetry.stats_interval = seconds(interval);
     init_closure(&telemetry.stats_func, telemetry_stats);
     load_klib("/klib/tls", tls_handler);
     return KLIB_INIT_OK;
@@ -0,0 +1,481 @@
+#include <kernel.h>
+#include <http.h>
+#include <pagecache.h>
+#include <storage.h>
+#include <tfs/tfs.h>
+
+/* Static file server: GET and HEAD requests for paths under the directory
+   named by static_http_root are answered from the pagecache, without a
+   user-space process. The pages holding the file data are handed to the
+   connection as they are - each wrapped in a buffer that holds the page
+   reference until the data has been acknowledged, as the direct
+   connections send by reference - so the data is never copied. Responses
+   go out in request order, whatever order the reads complete in.
+
+   Symbolic links and mount points under the root are not followed, and
+   ".." is refused, so nothing outside of the root can be served. */
+
+#define STATIC_HTTP_PORT_DEFAULT    80
+
+#define STATIC_HTTP_INDEX   "index.html"
+
+declare_closure_struct(1, 1, status, static_http_recv,
+                       struct static_http_conn *, c,
+                       buffer, b);
+declare_closure_struct(1, 1, void, static_http_request,
+                       struct static_http_conn *, c,
+                       value, v);
+declare_closure_struct(1, 1, void, static_http_read_done,
+                       struct static_http_resp *, r,
+                       status, s);
+
+typedef struct static_http_conn {
+    buffer_handler out;
+    buffer_handler parser;
+    struct static_http_resp *head, *tail;   /* responses, in request order */
+    boolean closed;             /* no more sending */
+    boolean gone;               /* the connection has been closed */
+    closure_struct(static_http_recv, recv);
+    closure_struct(static_http_request, request);
+} *static_http_conn;
+
+typedef struct static_http_resp {
+    struct static_http_resp *next;
+    static_http_conn c;
+    const char *status;
+    const char *content_type;
+    u64 length;
+    sg_list sg;                 /* file data, if any */
+    boolean ready;
+    closure_struct(static_http_read_done, read_done);
+} *static_http_resp;
+
+/* Released through the buffer heap once direct.c is done with the data */
+typedef struct static_http_ref {
+    struct buffer b;
+    refcount r;
+} *static_http_ref;
+
+static struct {
+    heap h;
+    struct heap ref_heap;
+    filesystem fs;
+    tuple root;
+    void (*rprintf)(const char *format, ...);
+    void (*runtime_memcpy)(void *a, const void *b, unsigned long len);
+    void *(*get)(value z, void *c);
+    symbol (*intern)(string name);
+    symbol (*intern_u64)(u64 u);
+    void (*destruct_tuple)(tuple t, boolean recursive);
+    void (*timm_dealloc)(tuple t);
+    buffer (*allocate_buffer)(heap h, bytes s);
+    void (*bprintf)(buffer b, const char *fmt, ...);
+    buffer_handler (*allocate_http_parser)(heap h, value_handler each);
+    status (*listen_port)(heap h, u16 port, connection_handler c);
+    void (*storage_iterate)(volume_handler vh);
+    fsfile (*fsfile_from_node)(filesystem fs, tuple n);
+    sg_io (*fsfile_get_reader)(fsfile f);
+    u64 (*fsfile_get_length)(fsfile f);
+    sg_list (*allocate_sg_list)(void);
+    void (*deallocate_sg_list)(sg_list sg);
+} shttp;
+
+#define kfunc(name) shttp.name
+
+#undef sym
+#define sym(name)   sym_intern(name, shttp.intern)
+
+static const struct {
+    const char *ext;
+    const char *type;
+} static_http_types[] = {
+    { "html", "text/html" },
+    { "htm", "text/html" },
+    { "css", "text/css" },
+    { "js", "text/javascript" },
+    { "json", "application/json" },
+    { "txt", "text/plain" },
+    { "xml", "application/xml" },
+    { "svg", "image/svg+xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "ico", "image/x-icon" },
+    { "webp", "image/webp" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+};
+
+static boolean static_http_ext_is(const char *ext, bytes len, const char *s)
+{
+    bytes i;
+    for (i = 0; i < len && s[i]; i++) {
+        char c = ext[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != s[i])
+            return false;
+    }
+    return i == len && !s[i];
+}
+
+static const char *static_http_content_type(const char *name, bytes len)
+{
+    bytes dot = len;
+    while (dot > 0 && name[dot - 1] != '.')
+        dot--;
+    if (dot > 0) {
+        for (int i = 0; i < sizeof(static_http_types) / sizeof(static_http_types[0]); i++) {
+            if (static_http_ext_is(name + dot, len - dot, static_http_types[i].ext))
+                return static_http_types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+static tuple static_http_child(tuple t, const char *name, bytes len)
+{
+    tuple c = kfunc(get)(t, sym(children));
+    if (!c)
+        return 0;
+    return kfunc(get)(c, kfunc(intern)(alloca_wrap_buffer(name, len)));
+}
+
+static int static_http_hex(u8 c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Resolve the (percent-encoded) path of a request under the root; for a
+   request, a directory stands for its index. The name of the last entry
+   looked up is left in name, for the content type. */
+static tuple static_http_lookup(buffer uri, boolean index, char *name, bytes *name_len)
+{
+    tuple t = shttp.root;
+    u8 *p = buffer_ref(uri, 0);
+    bytes len = buffer_length(uri);
+    bytes n = 0;
+    for (bytes i = 0; i <= len; i++) {
+        u8 c = (i < len) ? p[i] : '?';
+        if (c == '/' || c == '?' || c == '#') {
+            if (n == 2 && name[0] == '.' && name[1] == '.')
+                return 0;
+            if (n > 0 && !(n == 1 && name[0] == '.')) {
+                t = static_http_child(t, name, n);
+                if (!t)
+                    return 0;
+                *name_len = n;
+            }
+            if (c != '/')
+                break;
+            n = 0;
+            continue;
+        }
+        if (c == '%') {
+            int hi, lo;
+            if (i + 2 >= len || (hi = static_http_hex(p[i + 1])) < 0 ||
+                (lo = static_http_hex(p[i + 2])) < 0)
+                return 0;
+            c = (hi << 4) | lo;
+            if (c == '/' || c == '\0')
+                return 0;
+            i += 2;
+        }
+        if (n == NAME_MAX)
+            return 0;
+        name[n++] = c;
+    }
+    if (index && kfunc(get)(t, sym(children))) {
+        t = static_http_child(t, STATIC_HTTP_INDEX, sizeof(STATIC_HTTP_INDEX) - 1);
+        kfunc(runtime_memcpy)(name, STATIC_HTTP_INDEX, sizeof(STATIC_HTTP_INDEX) - 1);
+        *name_len = sizeof(STATIC_HTTP_INDEX) - 1;
+    }
+    return t;
+}
+
+static void static_http_ref_dealloc(heap h, u64 a, bytes b)
+{
+    static_http_ref ref = pointer_from_u64(a);
+    refcount_release(ref->r);
+    deallocate(shttp.h, ref, sizeof(struct static_http_ref));
+}
+
+static boolean static_http_send_data(static_http_conn c, sg_list sg)
+{
+    sg_buf sgb;
+    while ((sgb = sg_list_head_remove(sg)) != INVALID_ADDRESS) {
+        static_http_ref ref;
+        if (!sgb->refcount ||
+            (ref = allocate(shttp.h, sizeof(struct static_http_ref))) == INVALID_ADDRESS) {
+            /* the data must stay referenced until acknowledged */
+            sg_buf_release(sgb);
+            kfunc(rprintf)("static_http: failed to reference file data\n");
+            return false;
+        }
+        buffer b = &ref->b;
+        b->contents = sgb->buf + sgb->offset;
+        b->start = 0;
+        b->end = b->length = sgb->size - sgb->offset;
+        b->wrapped = true;
+        b->h = &shttp.ref_heap;
+        ref->r = sgb->refcount;
+        status s = apply(c->out, b);
+        if (!is_ok(s)) {
+            kfunc(rprintf)("static_http: failed to send data: %v\n", s);
+            kfunc(timm_dealloc)(s);
+            deallocate_buffer(b);
+            return false;
+        }
+    }
+    return true;
+}
+
+static boolean static_http_send(static_http_conn c, static_http_resp r)
+{
+    buffer b = kfunc(allocate_buffer)(shttp.h, 128);
+    if (b == INVALID_ADDRESS)
+        return false;
+    kfunc(bprintf)(b, "HTTP/1.1 %s\r\n", r->status);
+    if (r->content_type)
+        kfunc(bprintf)(b, "Content-Type: %s\r\n", r->content_type);
+    kfunc(bprintf)(b, "Content-Length: %ld\r\n\r\n", r->length);
+    status s = apply(c->out, b);
+    if (!is_ok(s)) {
+        kfunc(rprintf)("static_http: failed to send header: %v\n", s);
+        kfunc(timm_dealloc)(s);
+        deallocate_buffer(b);
+        return false;
+    }
+    return !r->sg || static_http_send_data(c, r->sg);
+}
+
+static void static_http_resp_dealloc(static_http_resp r)
+{
+    if (r->sg) {
+        sg_list_release(r->sg);
+        kfunc(deallocate_sg_list)(r->sg);
+    }
+    deallocate(shttp.h, r, sizeof(struct static_http_resp));
+}
+
+static void static_http_queue(static_http_conn c, static_http_resp r)
+{
+    r->next = 0;
+    if (c->head)
+        c->tail->next = r;
+    else
+        c->head = r;
+    c->tail = r;
+}
+
+/* Send the responses that are ready, up to the first one still waiting on
+   its read. The connection, once gone and without responses, is released. */
+static void static_http_flush(static_http_conn c)
+{
+    static_http_resp r;
+    while ((r = c->head) && r->ready) {
+        /* after a failure, the stream can't be made sense of anymore */
+        if (!c->closed && !static_http_send(c, r))
+            c->closed = true;
+        c->head = r->next;
+        static_http_resp_dealloc(r);
+    }
+    if (c->gone && !c->head)
+        deallocate(shttp.h, c, sizeof(struct static_http_conn));
+}
+
+define_closure_function(1, 1, void, static_http_read_done,
+                        static_http_resp, r,
+                        status, s)
+{
+    static_http_resp r = bound(r);
+    if (!is_ok(s)) {
+        kfunc(rprintf)("static_http: read failed: %v\n", s);
+        kfunc(timm_dealloc)(s);
+        sg_list_release(r->sg);
+        kfunc(deallocate_sg_list)(r->sg);
+        r->sg = 0;
+        r->status = "500 Internal Server Error";
+        r->content_type = 0;
+        r->length = 0;
+    }
+    r->ready = true;
+    static_http_flush(r->c);
+}
+
+define_closure_function(1, 1, void, static_http_request,
+                        static_http_conn, c,
+                        value, v)
+{
+    static_http_conn c = bound(c);
+    static_http_resp r = allocate(shttp.h, sizeof(struct static_http_resp));
+    if (r == INVALID_ADDRESS) {
+        kfunc(rprintf)("static_http: failed to allocate response\n");
+        c->closed = true;
+        goto out;
+    }
+    r->c = c;
+    r->content_type = 0;
+    r->length = 0;
+    r->sg = 0;
+    r->ready = true;
+    tuple sl = kfunc(get)(v, sym(start_line));
+    buffer method = sl ? kfunc(get)(sl, kfunc(intern_u64)(0)) : 0;
+    buffer uri = sl ? kfunc(get)(sl, kfunc(intern_u64)(1)) : 0;
+    boolean head = false;
+    if (!method || !uri || buffer_length(uri) == 0 || *(u8 *)buffer_ref(uri, 0) != '/') {
+        r->status = "400 Bad Request";
+    } else if (!buffer_compare_with_cstring(method, "GET") &&
+               !(head = buffer_compare_with_cstring(method, "HEAD"))) {
+        r->status = "405 Method Not Allowed";
+    } else {
+        char name[NAME_MAX];
+        bytes name_len = 0;
+        tuple t = static_http_lookup(uri, true, name, &name_len);
+        fsfile f = t ? kfunc(fsfile_from_node)(shttp.fs, t) : 0;
+        if (!f) {
+            r->status = "404 Not Found";
+        } else {
+            r->status = "200 OK";
+            r->content_type = static_http_content_type(name, name_len);
+            r->length = kfunc(fsfile_get_length)(f);
+            if (!head && r->length > 0) {
+                r->sg = kfunc(allocate_sg_list)();
+                if (r->sg == INVALID_ADDRESS) {
+                    r->sg = 0;
+                    r->status = "503 Service Unavailable";
+                    r->content_type = 0;
+                    r->length = 0;
+                } else {
+                    r->ready = false;
+                }
+            }
+            if (!r->ready) {
+                static_http_queue(c, r);
+                apply(kfunc(fsfile_get_reader)(f), r->sg, irange(0, r->length),
+                      init_closure(&r->read_done, static_http_read_done, r));
+                goto out;
+            }
+        }
+    }
+    static_http_queue(c, r);
+    static_http_flush(c);
+  out:
+    kfunc(destruct_tuple)(v, true);
+}
+
+define_closure_function(1, 1, status, static_http_recv,
+                        static_http_conn, c,
+                        buffer, b)
+{
+    static_http_conn c = bound(c);
+    status s = apply(c->parser, b);
+    if (!b) {
+        c->closed = c->gone = true;
+        /* release the connection unless responses are still to complete */
+        static_http_flush(c);
+    }
+    return s;
+}
+
+closure_function(0, 1, buffer_handler, static_http_connection,
+                 buffer_handler, out)
+{
+    static_http_conn c = allocate(shttp.h, sizeof(struct static_http_conn));
+    if (c == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    c->out = out;
+    c->parser = kfunc(allocate_http_parser)(shttp.h,
+        (value_handler)init_closure(&c->request, static_http_request, c));
+    if (c->parser == INVALID_ADDRESS) {
+        deallocate(shttp.h, c, sizeof(struct static_http_conn));
+        return INVALID_ADDRESS;
+    }
+    c->head = c->tail = 0;
+    c->closed = c->gone = false;
+    return (buffer_handler)init_closure(&c->recv, static_http_recv, c);
+}
+
+closure_function(0, 4, void, static_http_root_fs,
+                 u8 *, uuid, const char *, label, filesystem, fs, storage_stats, st)
+{
+    if (!uuid)
+        shttp.fs = fs;
+}
+
+int init(void *md, klib_get_sym get_sym, klib_add_sym add_sym)
+{
+    shttp.rprintf = get_sym("rprintf");
+    if (!shttp.rprintf)
+        return KLIB_INIT_FAILED;
+    void *(*get_kernel_heaps)(void) = get_sym("get_kernel_heaps");
+    tuple (*get_root_tuple)(void) = get_sym("get_root_tuple");
+    if (!get_kernel_heaps || !get_root_tuple ||
+            !(shttp.runtime_memcpy = get_sym("runtime_memcpy")) ||
+            !(shttp.get = get_sym("get")) ||
+            !(shttp.intern = get_sym("intern")) ||
+            !(shttp.intern_u64 = get_sym("intern_u64")) ||
+            !(shttp.destruct_tuple = get_sym("destruct_tuple")) ||
+            !(shttp.timm_dealloc = get_sym("timm_dealloc")) ||
+            !(shttp.allocate_buffer = get_sym("allocate_buffer")) ||
+            !(shttp.bprintf = get_sym("bprintf")) ||
+            !(shttp.allocate_http_parser = get_sym("allocate_http_parser")) ||
+            !(shttp.listen_port = get_sym("listen_port")) ||
+            !(shttp.storage_iterate = get_sym("storage_iterate")) ||
+            !(shttp.fsfile_from_node = get_sym("fsfile_from_node")) ||
+            !(shttp.fsfile_get_reader = get_sym("fsfile_get_reader")) ||
+            !(shttp.fsfile_get_length = get_sym("fsfile_get_length")) ||
+            !(shttp.allocate_sg_list = get_sym("allocate_sg_list")) ||
+            !(shttp.deallocate_sg_list = get_sym("deallocate_sg_list"))) {
+        kfunc(rprintf)("static_http: kernel symbols not found\n");
+        return KLIB_INIT_FAILED;
+    }
+    tuple root = get_root_tuple();
+    if (!root)
+        return KLIB_INIT_FAILED;
+    buffer path = kfunc(get)(root, sym(static_http_root));
+    if (!path)
+        return KLIB_INIT_FAILED;
+    u64 port = STATIC_HTTP_PORT_DEFAULT;
+    value v = kfunc(get)(root, sym(static_http_port));
+    if (v && (!u64_from_value(v, &port) || port == 0 || port > U16_MAX)) {
+        kfunc(rprintf)("static_http: invalid port\n");
+        return KLIB_INIT_FAILED;
+    }
+    shttp.h = heap_general((kernel_heaps)get_kernel_heaps());
+    kfunc(storage_iterate)(stack_closure(static_http_root_fs));
+
+    /* the root is resolved like a request, from the filesystem root */
+    char name[NAME_MAX];
+    bytes name_len;
+    shttp.root = root;
+    tuple t = (buffer_length(path) > 0 && *(u8 *)buffer_ref(path, 0) == '/') ?
+        static_http_lookup(path, false, name, &name_len) : 0;
+    if (!shttp.fs || !t || !kfunc(get)(t, sym(children))) {
+        kfunc(rprintf)("static_http: invalid root directory %b\n", path);
+        return KLIB_INIT_FAILED;
+    }
+    shttp.root = t;
+    shttp.ref_heap.dealloc = static_http_ref_dealloc;
+    connection_handler ch = closure(shttp.h, static_http_connection);
+    if (ch == INVALID_ADDRESS)
+        return KLIB_INIT_FAILED;
+    status s = kfunc(listen_port)(shttp.h, port, ch);
+    if (!is_ok(s)) {
+        kfunc(rprintf)("static_http: failed to listen on port %ld: %v\n", port, s);
+        kfunc(timm_dealloc)(s);
+        deallocate_closure(ch);
+        return KLIB_INIT_FAILED;
+    }
+    kfunc(rprintf)("static_http: serving %b on port %ld\n", path, port);
+    return KLIB_INIT_OK;
+}
@@ -162,13 +162,14 @@ void pci_platform_init_bar(pci_dev dev, int bar)
     /* bars configured by BIOS; nop */
 }
 
-u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 *address, u32 *data)
+u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 target_cpu,
+                              u32 *address, u32 *data)
 {
     u64 v = allocate_interrupt();
     if (v == INVALID_PHYSICAL)
         return v;
     register_interrupt(v, h, name);
-    msi_format(address, data, v);
+    msi_format(address, data, v, target_cpu);
     return v;
 }
 
@@ -177,3 +178,9 @@ void pci_platform_deallocate_msi(pci_dev dev, u64 v)
     unregister_interrupt(v);
     deallocate_interrupt(v);
 }
+
+boolean pci_platform_retarget_msi(pci_dev dev, u32 target_cpu, u32 *address, u32 *data)
+{
+    msi_format(address, data, *data & 0xff, target_cpu);
+    return true;
+}
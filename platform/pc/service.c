@@ -223,13 +223,13 @@ static void count_processors()
 void start_secondary_cores(kernel_heaps kh)
 {
     memory_barrier();
-    count_processors();
     init_debug("init_mxcsr");
     init_mxcsr();
     init_debug("starting APs");
     allocate_apboot(heap_backed(kh), new_cpu);
-    for (int i = 1; i < present_processors; i++)
-        start_cpu(i);
+    if (present_processors > 1)
+        enable_heap_smp();
+    start_cpus(present_processors, kvm_detected());
     deallocate_apboot(heap_backed(kh));
     init_flush(heap_locked(kh));
     init_debug("started %d total processors", total_processors);
@@ -335,12 +335,16 @@ static void init_kernel_heaps(void)
                                    (heap)kh->physical, PAGESIZE, true);
     assert(kh->backed != INVALID_ADDRESS);
 
-    kh->general = allocate_mcache(&bootstrap, (heap)kh->backed, 5, MAX_MCACHE_ORDER, PAGESIZE_2M);
+    kh->general = alloc_profile_heap(&bootstrap,
+        allocate_mcache(&bootstrap, (heap)kh->backed, 5, MAX_MCACHE_ORDER, PAGESIZE_2M),
+        "general");
     assert(kh->general != INVALID_ADDRESS);
 
-    kh->locked = locking_heap_wrapper(&bootstrap,
-        allocate_mcache(&bootstrap, (heap)kh->backed, 5, MAX_MCACHE_ORDER, PAGESIZE_2M));
+    kh->locked = alloc_profile_heap(&bootstrap, locking_magazine_wrapper(&bootstrap,
+        allocate_mcache(&bootstrap, (heap)kh->backed, 5, MAX_MCACHE_ORDER, PAGESIZE_2M),
+        MAX_MCACHE_ORDER - 5 + 1, PAGESIZE_2M), "locked");
     assert(kh->locked != INVALID_ADDRESS);
+    kh->transient = kh->locked;
 }
 
 static void jump_to_virtual(u64 kernel_size, u64 *pdpt, u64 *pdt) {
@@ -383,6 +387,7 @@ static void cmdline_parse(const char *cmdline)
 // init linker set
 void init_service(u64 rdi, u64 rsi)
 {
+    boot_milestone("kernel entry");
     init_debug("init_service");
     u8 *params = pointer_from_u64(rsi);
     const char *cmdline = 0;
@@ -500,6 +505,11 @@ void detect_hypervisor(kernel_heaps kh)
 
 void detect_devices(kernel_heaps kh, storage_attach sa)
 {
+#ifdef SMP_ENABLE
+    /* drivers size per-cpu queues by present_processors at probe time */
+    count_processors();
+#endif
+
     /* Probe for PV devices */
     if (xen_detected()) {
         init_debug("probing for Xen PV network...");
@@ -537,4 +547,5 @@ void detect_devices(kernel_heaps kh, storage_attach sa)
     init_acpi(kh);
 
     init_virtio_balloon(kh);
+    init_virtio_console(kh);
 }
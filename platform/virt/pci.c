@@ -128,18 +128,50 @@ void pci_platform_init_bar(pci_dev dev, int bar_idx)
     }
 }
 
-u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 *address, u32 *data)
+/* ITS device id: the PCI requester id, on the single root complex */
+#define pci_its_devid(dev) (((dev)->bus << 8) | ((dev)->slot << 3) | (dev)->function)
+
+u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 target_cpu,
+                              u32 *address, u32 *data)
 {
     u64 v = allocate_msi_interrupt();
     if (v == INVALID_PHYSICAL)
         return v;
     register_interrupt(v, h, name);
-    msi_format(address, data, v);
+    if (gic_its_enabled()) {
+        if (!gic_its_map_msi(pci_its_devid(dev), v, target_cpu, address, data)) {
+            msg_err("failed to map MSI for %s\n", name);
+            unregister_interrupt(v);
+            deallocate_msi_interrupt(v);
+            return INVALID_PHYSICAL;
+        }
+    } else {
+        msi_format(address, data, v, target_cpu);
+    }
     return v;
 }
 
+/* with the ITS, v is the event id from the MSI data rather than the vector */
 void pci_platform_deallocate_msi(pci_dev dev, u64 v)
 {
+    if (gic_its_enabled()) {
+        int vector = gic_its_unmap_msi(pci_its_devid(dev), v);
+        if (vector < 0) {
+            msg_err("no MSI mapped for event %ld\n", v);
+            return;
+        }
+        v = vector;
+    }
     unregister_interrupt(v);
     deallocate_msi_interrupt(v);
 }
+
+/* With the ITS the event is moved to the collection of target_cpu, leaving
+   the MSI address and data as they are; without it, MSIs are routed by the
+   distributor and can't be steered. */
+boolean pci_platform_retarget_msi(pci_dev dev, u32 target_cpu, u32 *address, u32 *data)
+{
+    if (gic_its_enabled())
+        gic_its_move_msi(pci_its_devid(dev), *data, target_cpu);
+    return false;
+}
@@ -185,9 +185,28 @@ void halt(char *format, ...)
 u64 total_processors = 1;
 u64 present_processors = 1;
 
+#ifdef SMP_ENABLE
+static void new_cpu(void)
+{
+    if (platform_timer_percpu_init)
+        apply(platform_timer_percpu_init);
+    while (1)
+        kernel_sleep();
+}
+
+void start_secondary_cores(kernel_heaps kh)
+{
+    memory_barrier();
+    init_debug("starting secondary cpus\n");
+    if (present_processors > 1)
+        enable_heap_smp();
+    start_cpus(new_cpu);
+}
+#else
 void start_secondary_cores(kernel_heaps kh)
 {
 }
+#endif
 
 static void init_kernel_heaps(void)
 {
@@ -209,12 +228,15 @@ static void init_kernel_heaps(void)
     kh->backed = physically_backed(&bootstrap, (heap)kh->virtual_page, (heap)kh->physical, PAGESIZE, true);
     assert(kh->backed != INVALID_ADDRESS);
 
-    kh->general = allocate_mcache(&bootstrap, (heap)kh->backed, 5, 20, PAGESIZE_2M);
+    kh->general = alloc_profile_heap(&bootstrap,
+        allocate_mcache(&bootstrap, (heap)kh->backed, 5, 20, PAGESIZE_2M), "general");
     assert(kh->general != INVALID_ADDRESS);
 
-    kh->locked = locking_heap_wrapper(&bootstrap,
-        allocate_mcache(&bootstrap, (heap)kh->backed, 5, 20, PAGESIZE_2M));
+    kh->locked = alloc_profile_heap(&bootstrap, locking_magazine_wrapper(&bootstrap,
+        allocate_mcache(&bootstrap, (heap)kh->backed, 5, 20, PAGESIZE_2M),
+        20 - 5 + 1, PAGESIZE_2M), "locked");
     assert(kh->locked != INVALID_ADDRESS);
+    kh->transient = kh->locked;
 }
 
 static void __attribute__((noinline)) init_service_new_stack(void)
@@ -232,7 +254,9 @@ static void __attribute__((noinline)) init_service_new_stack(void)
 
 void init_setup_stack(void)
 {
+    boot_milestone("kernel entry");
     serial_set_devbase(DEVICE_BASE);
+    init_cpu_features();
     init_debug("in init_setup_stack, calling init_kernel_heaps\n");
     init_kernel_heaps();
     init_debug("allocating stack\n");
@@ -291,9 +315,15 @@ void detect_hypervisor(kernel_heaps kh)
 
 void detect_devices(kernel_heaps kh, storage_attach sa)
 {
+#ifdef SMP_ENABLE
+    /* drivers size per-cpu queues by present_processors at probe time */
+    count_processors();
+#endif
+
     /* virtio only at the moment */
     init_virtio_network(kh);
     init_virtio_blk(kh, sa);
     init_virtio_scsi(kh, sa);
     init_virtio_balloon(kh);
+    init_virtio_console(kh);
 }
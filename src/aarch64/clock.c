@@ -38,6 +38,7 @@ void init_clock(void)
 {
     __vdso_dat->clock_src = VDSO_CLOCK_SYSCALL;
     __vdso_dat->platform_has_rdtscp = 0;
+    __vdso_dat->platform_has_rdpid = 0;
 
     register_platform_clock_now(init_closure(&_clock_now, arm_clock_now), VDSO_CLOCK_PVCLOCK);
     register_platform_clock_timer(init_closure(&_deadline_timer, arm_deadline_timer),
@@ -10,23 +10,41 @@
 
 static boolean gicc_v3_iface;
 static u32 gic_intid_mask;
+static u32 gic_ppi_enabled;     /* PPIs to enable on each cpu as it starts */
+static u8 gicv2_cpu_target[MAX_CPUS];
+static u32 gicv2_iar[MAX_CPUS];  /* last acknowledge, for SGI source */
+u64 gic_redist_base[MAX_CPUS];
+
+static void its_lpi_config(int vector, boolean enable);
 
 void gic_disable_int(int irq)
 {
+    if (irq >= GIC_LPI_VECTOR_BASE) {
+        its_lpi_config(irq, false);
+        return;
+    }
     int w = irq / GICD_INTS_PER_IENABLE_REG;
     u64 a = (!gicc_v3_iface || w) ? GICD_ICENABLER(w) : GICR_ICENABLER;
     u32 x = U32_FROM_BIT(irq & (GICD_INTS_PER_IENABLE_REG - 1)); /* same as redist */
     gic_debug("irq %d, a 0x%lx, x 0x%x, before 0x%x\n", irq, a, x, mmio_read_32(a));
     mmio_write_32(a, x);
+    if (irq >= GIC_PPI_INTS_START && irq < GIC_PPI_INTS_END)
+        gic_ppi_enabled &= ~x;
 }
 
 void gic_enable_int(int irq)
 {
+    if (irq >= GIC_LPI_VECTOR_BASE) {
+        its_lpi_config(irq, true);
+        return;
+    }
     int w = irq / GICD_INTS_PER_IENABLE_REG;
     u64 a = (!gicc_v3_iface || w) ? GICD_ISENABLER(w) : GICR_ISENABLER;
     u32 x = U32_FROM_BIT(irq & (GICD_INTS_PER_IENABLE_REG - 1));
     gic_debug("irq %d, x 0x%lx, x 0x%x, before 0x%x\n", irq, a, x, mmio_read_32(a));
     mmio_write_32(a, x);
+    if (irq >= GIC_PPI_INTS_START && irq < GIC_PPI_INTS_END)
+        gic_ppi_enabled |= x;
 }
 
 void gic_clear_pending_int(int irq)
@@ -70,6 +88,45 @@ boolean gic_int_is_pending(int irq)
     return pending;
 }
 
+/* Find the redistributor of the current cpu by its affinity and take it
+   out of sleep. */
+static void init_gicr(void)
+{
+    cpuinfo ci = current_cpu();
+    u64 aff = (ci->m.mpidr & MASK(24)) |
+        (field_from_u64(ci->m.mpidr, MPIDR_AFF3) << 24);
+    u64 rd = mmio_base_addr(GIC_REDIST);
+    while (1) {
+        u64 typer = mmio_read_64(GICR_TYPER(rd));
+        if (field_from_u64(typer, GICR_TYPER_Affinity) == aff)
+            break;
+        if (typer & GICR_TYPER_Last)
+            halt("%s: no redistributor for cpu %d (mpidr 0x%lx)\n",
+                 __func__, ci->id, ci->m.mpidr);
+        rd += GICR_FRAMES_SIZE;
+    }
+    gic_debug("cpu %d, redistributor at 0x%lx\n", ci->id, rd);
+    gic_redist_base[ci->id] = rd;
+    mmio_write_32(GICR_WAKER, mmio_read_32(GICR_WAKER) & ~GICR_WAKER_ProcessorSleep);
+    while (mmio_read_32(GICR_WAKER) & GICR_WAKER_ChildrenAsleep)
+        kern_pause();
+}
+
+/* SGIs and PPIs are configured in registers banked for each cpu */
+static void init_gic_banked(void)
+{
+    if (gicc_v3_iface)
+        mmio_write_32(GICR_IGROUPR, MASK(32));
+    else
+        mmio_write_32(GICD_IGROUPR(0), MASK(32));
+    for (int i = 0; i < GIC_SPI_INTS_START; i++)
+        gic_set_int_priority(i, 0);
+    for (int i = GIC_SGI_INTS_START; i < GIC_SGI_INTS_END; i++) {
+        gic_clear_pending_int(i);
+        gic_enable_int(i);
+    }
+}
+
 static void init_gicd(void)
 {
     mmio_write_32(GICD_CTLR, GICD_CTLR_DISABLE);
@@ -86,10 +143,6 @@ static void init_gicd(void)
         mmio_write_32(GICD_IPRIORITYR(i), MASK(32));
 
     /* set all to group 1, non-secure */
-    if (gicc_v3_iface)
-        mmio_write_32(GICR_IGROUPR, MASK(32));
-    else
-        mmio_write_32(GICD_IGROUPR(0), MASK(32));
     for (int i = GIC_SPI_INTS_START / GICD_INTS_PER_IGROUP_REG;
          i < GIC_SPI_INTS_END / GICD_INTS_PER_IGROUP_REG; i++)
         mmio_write_32(GICD_IGROUPR(i), MASK(32));
@@ -127,18 +180,66 @@ static void init_gicd(void)
 
 u64 gic_dispatch_int(void)
 {
-    u64 v = (gicc_v3_iface ? read_psr_s(ICC_IAR1_EL1) : mmio_read_32(GICC_IAR)) & gic_intid_mask;
+    u64 v;
+    if (gicc_v3_iface) {
+        v = read_psr_s(ICC_IAR1_EL1);
+    } else {
+        v = mmio_read_32(GICC_IAR);
+        gicv2_iar[current_cpu()->id] = v;
+    }
+    v &= gic_intid_mask;
     gic_debug("intid %ld\n", v);
+    if (v >= GIC_LPI_INTS_START && v != INTID_NO_PENDING)
+        v = v - GIC_LPI_INTS_START + GIC_LPI_VECTOR_BASE;
     return v;
 }
 
 void gic_eoi(int irq)
 {
     gic_debug("irq %d\n", irq);
+    if (irq >= GIC_LPI_VECTOR_BASE)
+        irq = irq - GIC_LPI_VECTOR_BASE + GIC_LPI_INTS_START;
+    /* v2 SGIs are completed with the source cpu bits of the acknowledge */
+    if (!gicc_v3_iface && irq < GIC_SGI_INTS_END) {
+        u32 iar = gicv2_iar[current_cpu()->id];
+        if ((iar & gic_intid_mask) == irq)
+            irq = iar;
+    }
     gicc_write(EOIR1, irq);
 }
 
-void msi_format(u32 *address, u32 *data, int vector)
+/* SGIs go to a single cpu, named by its affinity (v3) or its cpu interface
+   number (v2). Prior stores must be visible to the target before it takes
+   the interrupt. */
+void gic_send_sgi(u64 cpu, int irq)
+{
+    asm volatile("dsb ishst" ::: "memory");
+    if (gicc_v3_iface) {
+        u64 mpidr = cpuinfo_from_id(cpu)->m.mpidr;
+        u64 v = u64_from_field(ICC_SGI1R_EL1_TargetList,
+                               U64_FROM_BIT(field_from_u64(mpidr, MPIDR_AFF0))) |
+            u64_from_field(ICC_SGI1R_EL1_Aff1, field_from_u64(mpidr, MPIDR_AFF1)) |
+            u64_from_field(ICC_SGI1R_EL1_Aff2, field_from_u64(mpidr, MPIDR_AFF2)) |
+            u64_from_field(ICC_SGI1R_EL1_Aff3, field_from_u64(mpidr, MPIDR_AFF3)) |
+            u64_from_field(ICC_SGI1R_EL1_INTID, irq);
+        write_psr_s(ICC_SGI1R_EL1, v);
+        asm volatile("isb");
+    } else {
+        mmio_write_32(GICD_SGIR,
+                      u64_from_field(GICD_SGIR_CPUTargetList, gicv2_cpu_target[cpu]) |
+                      u64_from_field(GICD_SGIR_INTID, irq));
+    }
+}
+
+/* Aff0 values that a single SGI target list can address: the virt machine
+   groups cpus into clusters of this size */
+int gic_cluster_size(void)
+{
+    return gicc_v3_iface ? 16 : 8;
+}
+
+/* SPIs are routed to the boot cpu by the distributor; target_cpu is ignored */
+void msi_format(u32 *address, u32 *data, int vector, u32 target_cpu)
 {
     *address = DEV_BASE_GIC_V2M + GIC_V2M_MSI_SETSPI_NS;
     *data = vector;
@@ -179,10 +280,333 @@ static void init_gicc(void)
     }
 }
 
+/* GICv3 ITS: MSIs written by PCI devices to GITS_TRANSLATER are translated
+   to LPIs. Each device, named by its requester id, has an interrupt
+   translation table of events; the MSI data is the event id. Each event
+   maps to an LPI and a collection, and there is a collection for each cpu,
+   so an MSI is delivered to the cpu given when it was mapped. */
+#define ITS_CMDQ_SIZE      (4 * PAGESIZE)
+#define ITS_CMD_SIZE       32
+#define ITS_DEVICE_ID_BITS 16       /* PCI requester ids */
+/* pci_teardown_msix() finds the event in the low byte of the MSI data */
+#define ITS_DEVICE_EVENTS  256
+#define ITS_DEVICE_EVENT_BITS 8
+
+typedef struct its_device {
+    u32 devid;
+    void *itt;
+    u64 events[ITS_DEVICE_EVENTS / 64];
+    u16 vector[ITS_DEVICE_EVENTS];
+} *its_device;
+
+static struct {
+    boolean enabled;
+    boolean noncoherent;        /* tables not snooped; clean after writes */
+    boolean pta;                /* collections target redistributor addresses */
+    heap h;
+    heap dma;
+    struct spinlock lock;       /* commands, devices and lpis */
+    u64 *cmdq;
+    u64 cwriter;
+    u8 *prop_table;
+    u64 itt_entry_size;
+    table devices;
+    struct {
+        its_device dev;         /* 0 if unmapped */
+        u32 event;
+        u32 cpu;
+    } lpis[GIC_LPI_NUM];
+    void *pending[MAX_CPUS];
+    u64 rdbase[MAX_CPUS];
+} its;
+
+boolean gic_its_enabled(void)
+{
+    return its.enabled;
+}
+
+static u64 its_attrs(u64 cache_shift)
+{
+    return its.noncoherent ?
+        (U64_FROM_BIT(cache_shift) * GIC_CACHE_NC) :
+        ((U64_FROM_BIT(cache_shift) * GIC_CACHE_RaWaWb) |
+         u64_from_field(GIC_BASER_Shareability, GIC_SHARE_INNER));
+}
+
+static void its_sync_memory(void *p, bytes length)
+{
+    if (its.noncoherent)
+        clean_dcache_range(p, length);
+    else
+        asm volatile("dsb ishst" ::: "memory");
+}
+
+static void *its_alloc_table(bytes size)
+{
+    void *t = allocate(its.dma, size);
+    if (t == INVALID_ADDRESS)
+        halt("%s: failed to allocate %ld bytes\n", __func__, size);
+    zero(t, size);
+    clean_dcache_range(t, size);
+    return t;
+}
+
+/* program a base register; if the shareability doesn't stick, the ITS or
+   redistributor doesn't snoop and tables must be non-cacheable */
+static void its_set_baser(u64 reg, u64 v, u64 cache_shift)
+{
+    mmio_write_64(reg, v | its_attrs(cache_shift));
+    if (!its.noncoherent &&
+        field_from_u64(mmio_read_64(reg), GIC_BASER_Shareability) == GIC_SHARE_NONE) {
+        gic_debug("reg 0x%lx not shareable, using non-cacheable tables\n", reg);
+        its.noncoherent = true;
+        mmio_write_64(reg, v | its_attrs(cache_shift));
+    }
+}
+
+/* called with its.lock held */
+static void its_command(u64 dw0, u64 dw1, u64 dw2)
+{
+    u64 next = (its.cwriter + ITS_CMD_SIZE) % ITS_CMDQ_SIZE;
+    while (mmio_read_64(GITS_CREADR) == next)
+        kern_pause();
+    u64 *cmd = its.cmdq + its.cwriter / sizeof(u64);
+    cmd[0] = dw0;
+    cmd[1] = dw1;
+    cmd[2] = dw2;
+    cmd[3] = 0;
+    its_sync_memory(cmd, ITS_CMD_SIZE);
+    its.cwriter = next;
+    mmio_write_64(GITS_CWRITER, next);
+}
+
+/* issue a SYNC for the redistributor of cpu and wait for the queue to drain */
+static void its_sync(u32 cpu)
+{
+    its_command(GITS_CMD_SYNC, 0, its.rdbase[cpu] << 16);
+    while (mmio_read_64(GITS_CREADR) != its.cwriter)
+        kern_pause();
+}
+
+#define its_devid_cmd(cmd, devid) ((cmd) | ((u64)(devid) << 32))
+
+static its_device its_get_device(u32 devid)
+{
+    its_device d = table_find(its.devices, pointer_from_u64((u64)devid + 1));
+    if (d)
+        return d;
+    d = allocate_zero(its.h, sizeof(struct its_device));
+    if (d == INVALID_ADDRESS)
+        return 0;
+    d->devid = devid;
+    /* ITT addresses are 256-byte aligned */
+    d->itt = its_alloc_table(MAX(ITS_DEVICE_EVENTS * its.itt_entry_size, 256));
+    its_command(its_devid_cmd(GITS_CMD_MAPD, devid), ITS_DEVICE_EVENT_BITS - 1,
+                GITS_BASER_Valid | (physical_from_virtual(d->itt) & MASK(52) & ~MASK(8)));
+    table_set(its.devices, pointer_from_u64((u64)devid + 1), d);
+    return d;
+}
+
+/* priority 0, with the RES1 bit */
+#define LPI_CONFIG_PRIORITY 0x02
+#define LPI_CONFIG_ENABLE   0x01
+
+static void its_lpi_config(int vector, boolean enable)
+{
+    int lpi = vector - GIC_LPI_VECTOR_BASE;
+    if (!its.enabled || lpi >= GIC_LPI_NUM)
+        return;
+    u8 *c = its.prop_table + lpi;
+    *c = LPI_CONFIG_PRIORITY | (enable ? LPI_CONFIG_ENABLE : 0);
+    its_sync_memory(c, 1);
+    u64 flags = spin_lock_irq(&its.lock);
+    if (its.lpis[lpi].dev) {
+        its_command(its_devid_cmd(GITS_CMD_INV, its.lpis[lpi].dev->devid), its.lpis[lpi].event, 0);
+        its_sync(its.lpis[lpi].cpu);
+    }
+    spin_unlock_irq(&its.lock, flags);
+}
+
+/* Map the next free event of the device to the LPI of vector, delivered to
+   target_cpu, and return the MSI address and data for it. */
+boolean gic_its_map_msi(u32 devid, int vector, u32 target_cpu, u32 *address, u32 *data)
+{
+    int lpi = vector - GIC_LPI_VECTOR_BASE;
+    assert(its.enabled && lpi >= 0 && lpi < GIC_LPI_NUM);
+    if (target_cpu >= present_processors)
+        target_cpu = 0;
+    u64 flags = spin_lock_irq(&its.lock);
+    boolean ok = false;
+    its_device d = its_get_device(devid);
+    if (!d)
+        goto out;
+    int event;
+    for (event = 0; event < ITS_DEVICE_EVENTS; event++) {
+        if (!(d->events[event / 64] & U64_FROM_BIT(event % 64)))
+            break;
+    }
+    if (event == ITS_DEVICE_EVENTS)
+        goto out;
+    d->events[event / 64] |= U64_FROM_BIT(event % 64);
+    d->vector[event] = vector;
+    its.lpis[lpi].dev = d;
+    its.lpis[lpi].event = event;
+    its.lpis[lpi].cpu = target_cpu;
+    its_command(its_devid_cmd(GITS_CMD_MAPTI, devid),
+                event | ((u64)(GIC_LPI_INTS_START + lpi) << 32), target_cpu);
+    its_command(its_devid_cmd(GITS_CMD_INV, devid), event, 0);
+    its_sync(target_cpu);
+    *address = GITS_TRANSLATER_PHYS;
+    *data = event;
+    ok = true;
+    gic_debug("devid 0x%x, event %d -> lpi %d, cpu %d\n", devid, event,
+              GIC_LPI_INTS_START + lpi, target_cpu);
+  out:
+    spin_unlock_irq(&its.lock, flags);
+    return ok;
+}
+
+/* Deliver a mapped event of the device to target_cpu. The interrupt may
+   still arrive once at the old cpu, which is harmless. */
+void gic_its_move_msi(u32 devid, u32 event, u32 target_cpu)
+{
+    if (target_cpu >= present_processors)
+        target_cpu = 0;
+    u64 flags = spin_lock_irq(&its.lock);
+    its_device d = table_find(its.devices, pointer_from_u64((u64)devid + 1));
+    if (d && event < ITS_DEVICE_EVENTS && (d->events[event / 64] & U64_FROM_BIT(event % 64))) {
+        int lpi = d->vector[event] - GIC_LPI_VECTOR_BASE;
+        u32 old_cpu = its.lpis[lpi].cpu;
+        if (old_cpu != target_cpu) {
+            its_command(its_devid_cmd(GITS_CMD_MOVI, devid), event, target_cpu);
+            its_sync(old_cpu);
+            its.lpis[lpi].cpu = target_cpu;
+            gic_debug("devid 0x%x, event %d moved to cpu %d\n", devid, event, target_cpu);
+        }
+    }
+    spin_unlock_irq(&its.lock, flags);
+}
+
+/* Unmap an event of the device and return the vector it was mapped to, or
+   -1 if it wasn't. */
+int gic_its_unmap_msi(u32 devid, u32 event)
+{
+    int vector = -1;
+    u64 flags = spin_lock_irq(&its.lock);
+    its_device d = table_find(its.devices, pointer_from_u64((u64)devid + 1));
+    if (d && event < ITS_DEVICE_EVENTS && (d->events[event / 64] & U64_FROM_BIT(event % 64))) {
+        vector = d->vector[event];
+        int lpi = vector - GIC_LPI_VECTOR_BASE;
+        its_command(its_devid_cmd(GITS_CMD_DISCARD, devid), event, 0);
+        its_sync(its.lpis[lpi].cpu);
+        its.lpis[lpi].dev = 0;
+        d->events[event / 64] &= ~U64_FROM_BIT(event % 64);
+    }
+    spin_unlock_irq(&its.lock, flags);
+    return vector;
+}
+
+/* Enable LPIs at the current cpu's redistributor and map its collection. */
+static void init_gicr_lpis(void)
+{
+    int cpu = current_cpu()->id;
+    assert(its.pending[cpu]);
+    mmio_write_64(GICR_PROPBASER, physical_from_virtual(its.prop_table) |
+                  u64_from_field(GICR_PROPBASER_IDbits, GIC_LPI_IDBITS - 1) |
+                  its_attrs(GICR_BASER_InnerCache_SHIFT));
+    mmio_write_64(GICR_PENDBASER, physical_from_virtual(its.pending[cpu]) |
+                  GICR_PENDBASER_PTZ | its_attrs(GICR_BASER_InnerCache_SHIFT));
+    asm volatile("dsb sy" ::: "memory");
+    mmio_write_32(GICR_CTLR, mmio_read_32(GICR_CTLR) | GICR_CTLR_EnableLPIs);
+    asm volatile("dsb sy" ::: "memory");
+
+    u64 rd = gic_redist_base[cpu];
+    its.rdbase[cpu] = its.pta ? (rd - DEVICE_BASE) >> 16 :
+        field_from_u64(mmio_read_64(GICR_TYPER(rd)), GICR_TYPER_Processor_Number);
+    u64 flags = spin_lock_irq(&its.lock);
+    its_command(GITS_CMD_MAPC, 0, GITS_BASER_Valid | (its.rdbase[cpu] << 16) | cpu);
+    its_sync(cpu);
+    spin_unlock_irq(&its.lock, flags);
+}
+
+/* Called on the boot cpu before starting a secondary cpu. LPI pending
+   tables must be 64KB aligned, which the backed heap gives for this size. */
+void gic_prepare_cpu(int cpu)
+{
+    if (its.enabled && !its.pending[cpu])
+        its.pending[cpu] = its_alloc_table(64 * KB);
+}
+
+static void init_its(kernel_heaps kh)
+{
+    u32 archrev = field_from_u64(mmio_read_32(GITS_PIDR2), GITS_PIDR2_ArchRev);
+    if (archrev != GITS_PIDR2_ArchRev_GICv3 && archrev != GITS_PIDR2_ArchRev_GICv4) {
+        gic_debug("no ITS\n");
+        return;
+    }
+    if (!(mmio_read_64(GICR_TYPER(_GICR_RD_BASE)) & GICR_TYPER_PLPIS)) {
+        gic_debug("redistributor does not support LPIs\n");
+        return;
+    }
+    its.h = heap_locked(kh);
+    its.dma = heap_backed(kh);
+    spin_lock_init(&its.lock);
+    mmio_write_32(GITS_CTLR, 0);
+    while (!(mmio_read_32(GITS_CTLR) & GITS_CTLR_Quiescent))
+        kern_pause();
+
+    u64 typer = mmio_read_64(GITS_TYPER);
+    its.itt_entry_size = field_from_u64(typer, GITS_TYPER_ITT_entry_size) + 1;
+    its.pta = (typer & GITS_TYPER_PTA) != 0;
+    u64 devbits = MIN(field_from_u64(typer, GITS_TYPER_Devbits) + 1, ITS_DEVICE_ID_BITS);
+
+    /* flat device and collection tables */
+    for (int n = 0; n < GITS_BASER_NUM; n++) {
+        u64 baser = mmio_read_64(GITS_BASER(n));
+        u64 type = field_from_u64(baser, GITS_BASER_Type);
+        u64 entries;
+        if (type == GITS_BASER_Type_DEVICE)
+            entries = U64_FROM_BIT(devbits);
+        else if (type == GITS_BASER_Type_COLLECTION)
+            entries = MAX_CPUS;
+        else
+            continue;
+        u64 esize = field_from_u64(baser, GITS_BASER_Entry_Size) + 1;
+        bytes size = MIN(pad(entries * esize, PAGESIZE),
+                         U64_FROM_BIT(GITS_BASER_Size_BITS) * PAGESIZE);
+        void *t = its_alloc_table(size);
+        its_set_baser(GITS_BASER(n), GITS_BASER_Valid |
+                      u64_from_field(GITS_BASER_Type, type) |
+                      u64_from_field(GITS_BASER_Entry_Size, esize - 1) |
+                      (physical_from_virtual(t) & GITS_BASER_PA_MASK) |
+                      u64_from_field(GITS_BASER_Size, size / PAGESIZE - 1),
+                      GIC_BASER_InnerCache_SHIFT);
+        gic_debug("baser %d: type %ld, %ld bytes\n", n, type, size);
+    }
+
+    its.cmdq = its_alloc_table(ITS_CMDQ_SIZE);
+    its_set_baser(GITS_CBASER, GITS_BASER_Valid |
+                  (physical_from_virtual(its.cmdq) & GITS_BASER_PA_MASK) |
+                  u64_from_field(GITS_BASER_Size, ITS_CMDQ_SIZE / PAGESIZE - 1),
+                  GIC_BASER_InnerCache_SHIFT);
+    its.cwriter = 0;
+    mmio_write_64(GITS_CWRITER, 0);
+
+    /* one configuration byte for each LPI; all start disabled */
+    its.prop_table = its_alloc_table(U64_FROM_BIT(GIC_LPI_IDBITS) - GIC_LPI_INTS_START);
+    its.devices = allocate_table(its.h, identity_key, pointer_equal);
+    assert(its.devices != INVALID_ADDRESS);
+
+    mmio_write_32(GITS_CTLR, GITS_CTLR_Enabled);
+    its.enabled = true;
+    gic_prepare_cpu(0);
+    init_gicr_lpis();
+}
+
 u16 gic_msi_vector_base;
 u16 gic_msi_vector_num;
 
-void init_gic(void)
+void init_gic(kernel_heaps kh)
 {
     u64 aa64pfr0 = read_psr(ID_AA64PFR0_EL1);
     u8 gic_iface = field_from_u64(aa64pfr0, ID_AA64PFR0_EL1_GIC);
@@ -212,6 +636,34 @@ void init_gic(void)
         gic_msi_vector_num = field_from_u64(typer, GIC_V2M_MSI_TYPER_NUM);
     }
 
+    if (gicc_v3_iface)
+        init_gicr();
+    else
+        gicv2_cpu_target[0] = mmio_read_32(GICD_ITARGETSR(0));
     init_gicd();
+    init_gic_banked();
+    init_gicc();
+    if (gicc_v3_iface)
+        init_its(kh);
+}
+
+/* Called on each secondary cpu as it starts, after cpu_init(). The SGIs and
+   the PPIs enabled by the boot cpu, such as the timer, are enabled here. */
+void init_gic_percpu(void)
+{
+    if (gicc_v3_iface)
+        init_gicr();
+    else
+        gicv2_cpu_target[current_cpu()->id] = mmio_read_32(GICD_ITARGETSR(0));
+    u32 ppis = gic_ppi_enabled;
+    init_gic_banked();
+    if (its.enabled)
+        init_gicr_lpis();
+    for (int i = GIC_PPI_INTS_START; i < GIC_PPI_INTS_END; i++) {
+        if (ppis & U32_FROM_BIT(i)) {
+            gic_clear_pending_int(i);
+            gic_enable_int(i);
+        }
+    }
     init_gicc();
 }
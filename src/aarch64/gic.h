@@ -5,6 +5,12 @@
 #define GIC_SPI_INTS_START 32
 #define GIC_SPI_INTS_END   (GIC_SPI_INTS_START + 256) /* virt */
 #define GIC_MAX_INT        GIC_SPI_INTS_END
+#define GIC_LPI_INTS_START 8192
+#define GIC_LPI_IDBITS     14   /* LPI ids below 16384 */
+#define GIC_LPI_NUM        512  /* LPIs available for MSIs */
+/* LPIs are dispatched as the vectors following the SPIs */
+#define GIC_LPI_VECTOR_BASE GIC_MAX_INT
+#define GIC_MAX_VECTOR     (GIC_LPI_VECTOR_BASE + GIC_LPI_NUM)
 #define GIC_MAX_PRIO       16
 #define GIC_TIMER_IRQ      27
 
@@ -89,7 +95,30 @@
 #define GICD_CPENDSGIR(n)           (GICD_CTLR + 0x0f10)
 #define GICD_SPENDSGIR(n)           (GICD_CTLR + 0x0f20)
 
-#define _GICR_OFFSET                (mmio_base_addr(GIC_REDIST) + 0x10000)
+/* Each cpu has its own redistributor: an RD_base frame for control and an
+   SGI_base frame, 64KB later, for its SGIs and PPIs. The GICR_ registers
+   below address those of the current cpu. */
+#define GICR_FRAMES_SIZE            0x20000
+#define _GICR_RD_BASE               (gic_redist_base[current_cpu()->id])
+#define GICR_TYPER(rd)              ((rd) + 0x0008)
+#define GICR_TYPER_Last             U64_FROM_BIT(4)
+#define GICR_TYPER_Affinity_BITS    32
+#define GICR_TYPER_Affinity_SHIFT   32
+#define GICR_CTLR                   (_GICR_RD_BASE + 0x0000)
+#define GICR_CTLR_EnableLPIs        U32_FROM_BIT(0)
+#define GICR_TYPER_PLPIS            U64_FROM_BIT(0)
+#define GICR_TYPER_Processor_Number_BITS  16
+#define GICR_TYPER_Processor_Number_SHIFT 8
+#define GICR_PROPBASER              (_GICR_RD_BASE + 0x0070)
+#define GICR_PROPBASER_IDbits_BITS  5
+#define GICR_PROPBASER_IDbits_SHIFT 0
+#define GICR_PENDBASER              (_GICR_RD_BASE + 0x0078)
+#define GICR_PENDBASER_PTZ          U64_FROM_BIT(62)
+#define GICR_WAKER                  (_GICR_RD_BASE + 0x0014)
+#define GICR_WAKER_ProcessorSleep   U32_FROM_BIT(1)
+#define GICR_WAKER_ChildrenAsleep   U32_FROM_BIT(2)
+
+#define _GICR_OFFSET                (_GICR_RD_BASE + 0x10000)
 #define GICR_IGROUPR                (_GICR_OFFSET + 0x0080)
 #define GICR_INTS_PER_IGROUP_REG    32
 #define GICR_ISENABLER              (_GICR_OFFSET + 0x0100)
@@ -110,6 +139,75 @@
 #define GICR_ICFGR_LEVEL 0
 #define GICR_ICFGR_EDGE  2
 
+#define ICC_SGI1R_EL1_TargetList_BITS  16
+#define ICC_SGI1R_EL1_TargetList_SHIFT 0
+#define ICC_SGI1R_EL1_Aff1_BITS        8
+#define ICC_SGI1R_EL1_Aff1_SHIFT       16
+#define ICC_SGI1R_EL1_INTID_BITS       4
+#define ICC_SGI1R_EL1_INTID_SHIFT      24
+#define ICC_SGI1R_EL1_Aff2_BITS        8
+#define ICC_SGI1R_EL1_Aff2_SHIFT       32
+#define ICC_SGI1R_EL1_Aff3_BITS        8
+#define ICC_SGI1R_EL1_Aff3_SHIFT       48
+
+#define GICD_SGIR_CPUTargetList_BITS  8
+#define GICD_SGIR_CPUTargetList_SHIFT 16
+#define GICD_SGIR_INTID_BITS          4
+#define GICD_SGIR_INTID_SHIFT         0
+
+/* memory attributes of tables shared with the redistributors and ITS */
+#define GIC_BASER_InnerCache_BITS    3
+#define GIC_BASER_InnerCache_SHIFT   59
+#define GIC_BASER_Shareability_BITS  2
+#define GIC_BASER_Shareability_SHIFT 10
+#define GICR_BASER_InnerCache_BITS   3      /* PROPBASER, PENDBASER */
+#define GICR_BASER_InnerCache_SHIFT  7
+#define GIC_CACHE_NC                 1
+#define GIC_CACHE_RaWaWb             7
+#define GIC_SHARE_NONE               0
+#define GIC_SHARE_INNER              1
+
+/* GICv3 Interrupt Translation Service */
+#define GITS_REG(offset)                (mmio_base_addr(GIC_ITS) + (offset))
+#define GITS_CTLR                       GITS_REG(0x0000)
+#define GITS_CTLR_Enabled               U32_FROM_BIT(0)
+#define GITS_CTLR_Quiescent             U32_FROM_BIT(31)
+#define GITS_TYPER                      GITS_REG(0x0008)
+#define GITS_TYPER_ITT_entry_size_BITS  4
+#define GITS_TYPER_ITT_entry_size_SHIFT 4
+#define GITS_TYPER_Devbits_BITS         5
+#define GITS_TYPER_Devbits_SHIFT        13
+#define GITS_TYPER_PTA                  U64_FROM_BIT(19)
+#define GITS_CBASER                     GITS_REG(0x0080)
+#define GITS_CWRITER                    GITS_REG(0x0088)
+#define GITS_CREADR                     GITS_REG(0x0090)
+#define GITS_BASER(n)                   GITS_REG(0x0100 + 8 * (n))
+#define GITS_BASER_NUM                  8
+#define GITS_BASER_Valid                U64_FROM_BIT(63)
+#define GITS_BASER_Type_BITS            3
+#define GITS_BASER_Type_SHIFT           56
+#define GITS_BASER_Type_DEVICE          1
+#define GITS_BASER_Type_COLLECTION      4
+#define GITS_BASER_Entry_Size_BITS      5
+#define GITS_BASER_Entry_Size_SHIFT     48
+#define GITS_BASER_Size_BITS            8   /* pages - 1, also for CBASER */
+#define GITS_BASER_Size_SHIFT           0
+#define GITS_BASER_PA_MASK              0x0000fffffffff000ull
+#define GITS_PIDR2                      GITS_REG(0xffe8)
+#define GITS_PIDR2_ArchRev_BITS         4
+#define GITS_PIDR2_ArchRev_SHIFT        4
+#define GITS_PIDR2_ArchRev_GICv3        3
+#define GITS_PIDR2_ArchRev_GICv4        4
+#define GITS_TRANSLATER_PHYS            (DEV_BASE_GIC_ITS + 0x10040)
+
+#define GITS_CMD_MOVI    0x01
+#define GITS_CMD_SYNC    0x05
+#define GITS_CMD_MAPD    0x08
+#define GITS_CMD_MAPC    0x09
+#define GITS_CMD_MAPTI   0x0a
+#define GITS_CMD_INV     0x0c
+#define GITS_CMD_DISCARD 0x0f
+
 /* Legacy (<v3) GICC interface */
 #define GIC_CPU_REG(offset)                  (mmio_base_addr(GIC_CPU + (offset)))
 #define GICC_CTLR                            GIC_CPU_REG(0x0000)
@@ -151,6 +249,7 @@
 
 extern u16 gic_msi_vector_base;
 extern u16 gic_msi_vector_num;
+extern u64 gic_redist_base[MAX_CPUS];
 
 void gic_disable_int(int irq);
 void gic_enable_int(int irq);
@@ -160,7 +259,16 @@ void gic_set_int_config(int irq, u32 cfg);
 boolean gic_int_is_pending(int irq);
 u64 gic_dispatch_int(void);
 void gic_eoi(int irq);
-void init_gic(void);
+void gic_send_sgi(u64 cpu, int irq);
+int gic_cluster_size(void);
+void init_gic(kernel_heaps kh);
+void gic_prepare_cpu(int cpu);
+void init_gic_percpu(void);
+
+boolean gic_its_enabled(void);
+boolean gic_its_map_msi(u32 devid, int vector, u32 target_cpu, u32 *address, u32 *data);
+void gic_its_move_msi(u32 devid, u32 event, u32 target_cpu);
+int gic_its_unmap_msi(u32 devid, u32 event);
 
 #define _GIC_SET_INTFIELD(name, type) void gic_set_int_##name(int irq, u32 v);
 _GIC_SET_INTFIELD(priority, IPRIORITY)
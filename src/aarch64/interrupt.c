@@ -278,18 +278,20 @@ void irq_handler(void)
                   ci->id, i, state_strings[ci->state], f[FRAME_EL],
                   f, f[FRAME_ELR], f[FRAME_ESR_SPSR]);
 
-        if (i >= GIC_MAX_INT)
-            halt("dispatched interrupt %d exceeds GIC_MAX_INT\n", i);
+        if (i >= GIC_MAX_VECTOR)
+            halt("dispatched interrupt %d exceeds GIC_MAX_VECTOR\n", i);
 
         if (list_empty(&handlers[i]))
             halt("no handler for interrupt %d\n", i);
 
+        u64 start = rdtsc();
         list_foreach(&handlers[i], l) {
             inthandler h = struct_from_list(l, inthandler, l);
             int_debug("   invoking handler %s (%F)\n", h->name, h->t);
             ci->state = cpu_interrupt;
             apply(h->t);
         }
+        interrupt_stats_record(ci, i, start);
 
         int_debug("   eoi %d\n", i);
         gic_eoi(i);
@@ -349,8 +351,12 @@ void register_interrupt(int vector, thunk t, const char *name)
     h->t = t;
     h->name = name;
     list_insert_before(&handlers[vector], &h->l);
+    interrupt_stats_register(vector, name);
 
-    if (!initialized) {
+    if (!initialized && vector >= GIC_LPI_VECTOR_BASE) {
+        /* LPIs are edge-triggered, with priority set in the LPI config */
+        gic_enable_int(vector);
+    } else if (!initialized) {
         gic_set_int_priority(vector, 0);
         if (vector >= gic_msi_vector_base &&
             vector < (gic_msi_vector_base + gic_msi_vector_num))
@@ -372,6 +378,7 @@ void unregister_interrupt(int vector)
         list_delete(&h->l);
         deallocate(int_general, h, sizeof(struct inthandler));
     }
+    interrupt_stats_unregister(vector);
 }
 
 extern void *exception_vectors;
@@ -388,20 +395,26 @@ closure_struct(arm_timer, _timer);
 void init_interrupts(kernel_heaps kh)
 {
     int_general = heap_locked(kh);
-    handlers = allocate_zero(int_general, GIC_MAX_INT * sizeof(handlers[0]));
+    handlers = allocate_zero(int_general, GIC_MAX_VECTOR * sizeof(handlers[0]));
     assert(handlers != INVALID_ADDRESS);
-    for (int i = 0; i < GIC_MAX_INT; i++)
+    for (int i = 0; i < GIC_MAX_VECTOR; i++)
         list_init(&handlers[i]);
+    init_interrupt_stats(int_general, GIC_MAX_VECTOR);
 
     /* set exception vector table base */
     register u64 v = u64_from_pointer(&exception_vectors);
     asm volatile("dsb sy; msr vbar_el1, %0" :: "r"(v));
 
     /* initialize interrupt controller */
-    init_gic();
+    init_gic(kh);
 
-    /* msi vector heap */
-    if (gic_msi_vector_num > 0) {
+    /* msi vector heap: LPIs translated by the ITS if present, else the SPIs
+       of the v2m frame */
+    if (gic_its_enabled()) {
+        msi_vector_heap = create_id_heap(int_general, int_general, GIC_LPI_VECTOR_BASE,
+                                         GIC_LPI_NUM, 1, false);
+        assert(msi_vector_heap != INVALID_ADDRESS);
+    } else if (gic_msi_vector_num > 0) {
         assert(gic_msi_vector_base >= GIC_SPI_INTS_START);
         msi_vector_heap = create_id_heap(int_general, int_general, gic_msi_vector_base,
                                          gic_msi_vector_num, 1, false);
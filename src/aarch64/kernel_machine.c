@@ -54,11 +54,47 @@ heap allocate_tagged_region(kernel_heaps kh, u64 tag)
     return &th->h;
 }
 
+u8 arm_lse_atomics;
+
+/* called on the boot cpu before the kernel heaps are set up */
+void init_cpu_features(void)
+{
+    arm_lse_atomics = field_from_u64(read_psr(ID_AA64ISAR0_EL1), ID_AA64ISAR0_EL1_ATOMIC) >=
+        ID_AA64ISAR0_EL1_ATOMIC_LSE;
+}
+
 void cpu_init(int cpu)
 {
     cpuinfo ci = cpuinfo_from_id(cpu);
     register u64 a = u64_from_pointer(ci);
     asm volatile("mov x18, %0; msr tpidr_el1, %0" ::"r"(a));
+    ci->m.mpidr = read_psr(MPIDR_EL1) & MPIDR_AFF_MASK;
+}
+
+/* clean and invalidate to the point of coherency, for memory read with the
+   MMU off or by devices that don't snoop */
+void clean_dcache_range(void *p, bytes length)
+{
+    u64 line = 4ull << (read_psr(CTR_EL0) >> 16 & 0xf); /* DminLine */
+    for (u64 a = u64_from_pointer(p) & ~(line - 1); a < u64_from_pointer(p) + length; a += line)
+        asm volatile("dc civac, %0" :: "r"(a) : "memory");
+    asm volatile("dsb sy" ::: "memory");
+}
+
+void send_ipi(u64 cpu, u8 vector)
+{
+    gic_send_sgi(cpu, vector);
+}
+
+void send_ipi_mask(u64 cpus, u8 vector)
+{
+    for (; cpus; cpus &= cpus - 1)
+        gic_send_sgi(lsb(cpus), vector);
+}
+
+void init_topology(kernel_heaps kh)
+{
+    /* XXX no firmware topology yet; everything is on node 0 */
 }
 
 void init_cpuinfo_machine(cpuinfo ci, heap backed)
@@ -76,9 +112,28 @@ void interrupt_exit(void)
     gic_eoi(gic_dispatch_int());
 }
 
+#define PSCI_FN_BASE          0x84000000
+#define PSCI_FN64_BASE        0xc4000000
+#define PSCI_CPU_ON           0x3
+#define PSCI_AFFINITY_INFO    0x4
+#define PSCI_SYSTEM_OFF       0x8
+
 void psci_shutdown(void)
 {
-    u32 psci_fn = 0x84000000 /* fn base */ + 0x8 /* system off */;
-    arm_hvc(psci_fn, 0, 0, 0);
+    arm_hvc(PSCI_FN_BASE + PSCI_SYSTEM_OFF, 0, 0, 0);
+}
+
+/* Start the cpu with the given affinity at the physical address entry,
+   with the MMU off and context_id in x0. Returns a PSCI status. */
+s64 psci_cpu_on(u64 mpidr, u64 entry, u64 context_id)
+{
+    return arm_hvc(PSCI_FN64_BASE + PSCI_CPU_ON, mpidr, entry, context_id);
+}
+
+/* 0 if on, 1 if off, 2 if starting, or a negative PSCI error if there is
+   no such cpu */
+s64 psci_affinity_info(u64 mpidr)
+{
+    return arm_hvc(PSCI_FN64_BASE + PSCI_AFFINITY_INFO, mpidr, 0, 0);
 }
 
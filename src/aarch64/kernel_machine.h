@@ -124,6 +124,20 @@
 #define ID_AA64ISAR0_EL1_RNDR_SHIFT       60
 #define ID_AA64ISAR0_EL1_RNDR_IMPLEMENTED 1 /* RNDR, RNDRRS MSRs */
 
+#define ID_AA64ISAR0_EL1_ATOMIC_BITS  4
+#define ID_AA64ISAR0_EL1_ATOMIC_SHIFT 20
+#define ID_AA64ISAR0_EL1_ATOMIC_LSE   2 /* ARMv8.1 LSE atomics */
+
+#define MPIDR_AFF0_BITS  8
+#define MPIDR_AFF0_SHIFT 0
+#define MPIDR_AFF1_BITS  8
+#define MPIDR_AFF1_SHIFT 8
+#define MPIDR_AFF2_BITS  8
+#define MPIDR_AFF2_SHIFT 16
+#define MPIDR_AFF3_BITS  8
+#define MPIDR_AFF3_SHIFT 32
+#define MPIDR_AFF_MASK   0xff00ffffffull
+
 #define ID_AA64PFR0_EL1_GIC_BITS                4
 #define ID_AA64PFR0_EL1_GIC_SHIFT               24
 #define ID_AA64PFR0_EL1_GIC_GICC_SYSREG_NONE    0
@@ -179,6 +193,22 @@ static inline void wait_for_interrupt(void)
     enable_interrupts();
 }
 
+/* zero a multiple of 32 bytes with stores that bypass the cache */
+static inline void zero_nontemporal(void *x, bytes length)
+{
+    for (u64 *p = x, *end = x + length; p < end; p += 4)
+        asm volatile("stnp xzr, xzr, [%0]; stnp xzr, xzr, [%0, #16]" :: "r"(p) : "memory");
+    asm volatile("dsb ishst" ::: "memory");
+}
+
+/* no monitored wait; idle polling spins instead */
+#define monitor_wait_available()    false
+
+static inline void monitor_wait(u64 *addr, u64 mask)
+{
+    enable_interrupts();
+}
+
 /* locking constructs */
 #include <lock.h>
 
@@ -234,6 +264,9 @@ struct cpuinfo_machine {
     /* Default frame and stack installed at kernel entry points (init,
        syscall) and calls to runloop. +8 */
     kernel_context kernel_context;
+
+    /* affinity fields of MPIDR_EL1, for targeting SGIs */
+    u64 mpidr;
 };
 
 typedef struct cpuinfo *cpuinfo;
@@ -264,6 +297,21 @@ static inline u64 frame_return_address(context f)
     return f[FRAME_X30];
 }
 
+static inline u64 frame_pc(context f)
+{
+    return f[FRAME_ELR];
+}
+
+static inline u64 frame_fp(context f)
+{
+    return f[FRAME_X29];
+}
+
+static inline boolean frame_is_user(context f)
+{
+    return f[FRAME_EL] == 0;
+}
+
 static inline u64 fault_address(context f)
 {
     // store in frame?
@@ -368,6 +416,18 @@ static inline void frame_set_sp(context f, u64 sp)
             rv;                                                         \
         })
 
+#define do_syscall3(sysnr, arg0, arg1, arg2) ({                         \
+            sysreturn rv;                                               \
+            register u64 _v asm ("x8") = sysnr;                         \
+            register u64 _x0 asm ("x0") = (u64)arg0;                    \
+            register u64 _x1 asm ("x1") = (u64)arg1;                    \
+            register u64 _x2 asm ("x2") = (u64)arg2;                    \
+            asm volatile ("svc 0" : "=r" (_x0) : "r" (_v),              \
+                "r" (_x0), "r" (_x1), "r" (_x2) : "memory");            \
+            rv = _x0;                                                   \
+            rv;                                                         \
+        })
+
 /* IPI */
 static inline void machine_halt(void)
 {
@@ -379,9 +439,27 @@ void deallocate_msi_interrupt(u64 v);
 u64 allocate_mmio_interrupt(void);
 void deallocate_mmio_interrupt(u64 v);
 
-void arm_hvc(u64 x0, u64 x1, u64 x2, u64 x3);
+u64 arm_hvc(u64 x0, u64 x1, u64 x2, u64 x3);
 void angel_shutdown(u64 x0);
 void psci_shutdown(void);
+s64 psci_cpu_on(u64 mpidr, u64 entry, u64 context_id);
+s64 psci_affinity_info(u64 mpidr);
+void init_cpu_features(void);
+void clean_dcache_range(void *p, bytes length);
+void count_processors(void);
+void start_cpus(void (*ap_entry_callback)());
+
+void send_ipi(u64 cpu, u8 vector);
+void send_ipi_mask(u64 cpus, u8 vector);
+
+/* no counter sampling yet; cpu_profile.c falls back to the timer */
+static inline boolean pmu_sampling_set_frequency(u64 frequency)
+{
+    return false;
+}
 
-#define send_ipi(cpu, vector)
+#define pmu_sampling_cpu_start(vector)
+#define pmu_sampling_cpu_stop()
+#define pmu_sampling_overflowed() false
+#define pmu_sampling_rearm()
 #endif /* __ASSEMBLY__ */
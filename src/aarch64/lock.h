@@ -1,6 +1,82 @@
+/* struct spinlock defined in machine.h */
+
+#if defined(KERNEL) && defined(SMP_ENABLE)
+static inline boolean spin_try(spinlock l)
+{
+    u64 old;
+    if (lse_atomics()) {
+        asm volatile(ARM_LSE "swpa %[one], %[old], %[w]"
+                     : [old]"=r"(old), [w]"+Q"(l->w) : [one]"r"(1ull) : "memory");
+    } else {
+        u32 st;
+        asm volatile("1: ldaxr %[old], %[w]\n"
+                     "cbnz %[old], 2f\n"
+                     "stxr %w[s], %[one], %[w]\n"
+                     "cbnz %w[s], 1b\n"
+                     "2:"
+                     : [old]"=&r"(old), [s]"=&r"(st), [w]"+Q"(l->w)
+                     : [one]"r"(1ull) : "memory");
+    }
+    return old == 0;
+}
+
+static inline void spin_lock(spinlock l)
+{
+    u64 tmp;
+    while (!spin_try(l)) {
+        /* Wait with the lock word in the exclusive monitor; the release
+           store of the holder clears it and wakes us from wfe. */
+        asm volatile("sevl\n"
+                     "1: wfe\n"
+                     "ldaxr %[t], %[w]\n"
+                     "cbnz %[t], 1b"
+                     : [t]"=&r"(tmp) : [w]"Q"(l->w) : "memory");
+    }
+}
+
+static inline void spin_unlock(spinlock l)
+{
+    asm volatile("stlr xzr, %[w]" : [w]"=Q"(l->w) :: "memory");
+}
+
+/* Readers and the writer each store, then load what the other stored;
+   that needs a full barrier on both sides. */
+static inline void spin_rlock(rw_spinlock l) {
+    while (1) {
+        fetch_and_add(&l->readers, 1);
+        memory_barrier();
+        if (!*(volatile word *)&l->l.w)
+            return;
+        fetch_and_add(&l->readers, -1);
+        kern_pause();
+    }
+}
+
+static inline void spin_runlock(rw_spinlock l) {
+    fetch_and_add(&l->readers, -1);
+}
+
+static inline void spin_wlock(rw_spinlock l) {
+    spin_lock(&l->l);
+    memory_barrier();
+    while (*(volatile u64 *)&l->readers)
+        kern_pause();
+}
+
+static inline void spin_wunlock(rw_spinlock l) {
+    spin_unlock(&l->l);
+}
+#else
 #define spin_try(x) (true)
 #define spin_lock(x) ((void)x)
 #define spin_unlock(x) ((void)x)
+#define spin_wlock(x) ((void)x)
+#define spin_wunlock(x) ((void)x)
+#define spin_rlock(x) ((void)x)
+#define spin_runlock(x) ((void)x)
+#endif
+
+#define lock_stats_register(l, name)
 
 static inline u64 spin_lock_irq(spinlock l)
 {
@@ -15,7 +91,39 @@ static inline void spin_unlock_irq(spinlock l, u64 flags)
     irq_restore(flags);
 }
 
+static inline u64 spin_wlock_irq(rw_spinlock l)
+{
+    u64 flags = irq_disable_save();
+    spin_wlock(l);
+    return flags;
+}
+
+static inline void spin_wunlock_irq(rw_spinlock l, u64 flags)
+{
+    spin_wunlock(l);
+    irq_restore(flags);
+}
+
+static inline u64 spin_rlock_irq(rw_spinlock l)
+{
+    u64 flags = irq_disable_save();
+    spin_rlock(l);
+    return flags;
+}
+
+static inline void spin_runlock_irq(rw_spinlock l, u64 flags)
+{
+    spin_runlock(l);
+    irq_restore(flags);
+}
+
 static inline void spin_lock_init(spinlock l)
 {
     *&l->w = 0;
 }
+
+static inline void spin_rw_lock_init(rw_spinlock l)
+{
+    spin_lock_init(&l->l);
+    l->readers = 0;
+}
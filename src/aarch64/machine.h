@@ -132,6 +132,11 @@ typedef struct spinlock {
     word w;
 } *spinlock;
 
+typedef struct rw_spinlock {
+    struct spinlock l;
+    u64 readers;
+} *rw_spinlock;
+
 /* returns -1 if x == 0, caller must check */
 static inline __attribute__((always_inline)) u64 msb(u64 x)
 {
@@ -163,35 +168,54 @@ static inline __attribute__((always_inline)) void memory_barrier(void)
     asm volatile("dmb sy" ::: "memory");
 }
 
-/* XXX something b0rked with ldset here...ordering, or asm constraints? */
+/* Atomics use the ARMv8.1 Large System Extensions (LSE) when the cpu has
+   them and load/store exclusive sequences otherwise; the two interoperate,
+   so the choice may be made at boot. Klibs and the vdso always take the
+   exclusive sequences. */
+#if defined(KERNEL) && !defined(BUILD_VDSO)
+extern u8 arm_lse_atomics;      /* boolean */
+#define lse_atomics() arm_lse_atomics
+#else
+#define lse_atomics() false
+#endif
+#define ARM_LSE ".arch_extension lse\n"
+
 static inline __attribute__((always_inline)) int atomic_test_and_set_bit(u64 *target, u64 bit)
 {
-#if 0
-    register u64 a = u64_from_pointer(target);
-    register u64 tmp, v = 1ull << bit;
-    asm volatile("ldset %0, %2, [%1]" : "=&r"(tmp) : "r"(a), "r"(v) : "memory");
-    return tmp >> bit;
-#else
     u64 mask = 1ull << bit;
-    u64 w = *target;
-    *target = w | mask;
+    u64 w, tmp;
+    u32 st;
+    if (lse_atomics()) {
+        asm volatile(ARM_LSE "ldsetal %[m], %[w], %[p]"
+                     : [w]"=r"(w), [p]"+Q"(*target) : [m]"r"(mask) : "memory");
+    } else {
+        asm volatile("1: ldaxr %[w], %[p]\n"
+                     "orr %[t], %[w], %[m]\n"
+                     "stlxr %w[s], %[t], %[p]\n"
+                     "cbnz %w[s], 1b"
+                     : [w]"=&r"(w), [t]"=&r"(tmp), [s]"=&r"(st), [p]"+Q"(*target)
+                     : [m]"r"(mask) : "memory");
+    }
     return (w & mask) != 0;
-#endif
 }
 
 static inline __attribute__((always_inline)) int atomic_test_and_clear_bit(u64 *target, u64 bit)
 {
-#if 0
-    register u64 a = u64_from_pointer(target);
-    register u64 tmp, v = 1ull << bit;
-    asm volatile("ldclr %0, %2, [%1]" : "=&r"(tmp) : "r"(a), "r"(v) : "memory");
-    return tmp >> bit;
-#else
     u64 mask = 1ull << bit;
-    u64 w = *target;
-    *target = w & ~mask;
+    u64 w, tmp;
+    u32 st;
+    if (lse_atomics()) {
+        asm volatile(ARM_LSE "ldclral %[m], %[w], %[p]"
+                     : [w]"=r"(w), [p]"+Q"(*target) : [m]"r"(mask) : "memory");
+    } else {
+        asm volatile("1: ldaxr %[w], %[p]\n"
+                     "bic %[t], %[w], %[m]\n"
+                     "stlxr %w[s], %[t], %[p]\n"
+                     "cbnz %w[s], 1b"
+                     : [w]"=&r"(w), [t]"=&r"(tmp), [s]"=&r"(st), [p]"+Q"(*target)
+                     : [m]"r"(mask) : "memory");
+    }
     return (w & mask) != 0;
-#endif
 }
 
 static inline __attribute__((always_inline)) void atomic_set_bit(u64 *target, u64 bit)
@@ -206,19 +230,49 @@ static inline __attribute__((always_inline)) void atomic_clear_bit(u64 *target,
 
 static inline __attribute__((always_inline)) word fetch_and_add(word *target, word num)
 {
-    asm volatile("prfm pstl1strm, %0" :: "Q" (*target));
-    return __sync_fetch_and_add(target, num);
+    word w, tmp;
+    u32 st;
+    if (lse_atomics()) {
+        asm volatile(ARM_LSE "ldaddal %[n], %[w], %[p]"
+                     : [w]"=r"(w), [p]"+Q"(*target) : [n]"r"(num) : "memory");
+    } else {
+        asm volatile("prfm pstl1strm, %[p]\n"
+                     "1: ldaxr %[w], %[p]\n"
+                     "add %[t], %[w], %[n]\n"
+                     "stlxr %w[s], %[t], %[p]\n"
+                     "cbnz %w[s], 1b"
+                     : [w]"=&r"(w), [t]"=&r"(tmp), [s]"=&r"(st), [p]"+Q"(*target)
+                     : [n]"r"(num) : "memory");
+    }
+    return w;
 }
 
 static inline __attribute__((always_inline)) u8 compare_and_swap_32(u32 *p, u32 old, u32 new)
 {
-    asm volatile("prfm pstl1strm, %0" :: "Q" (*p));
-    return __sync_bool_compare_and_swap(p, old, new);
+    u32 v, st;
+    if (lse_atomics()) {
+        v = old;
+        asm volatile(ARM_LSE "casal %w[v], %w[n], %[p]"
+                     : [v]"+r"(v), [p]"+Q"(*p) : [n]"r"(new) : "memory");
+    } else {
+        asm volatile("prfm pstl1strm, %[p]\n"
+                     "1: ldaxr %w[v], %[p]\n"
+                     "cmp %w[v], %w[o]\n"
+                     "b.ne 2f\n"
+                     "stlxr %w[s], %w[n], %[p]\n"
+                     "cbnz %w[s], 1b\n"
+                     "2:"
+                     : [v]"=&r"(v), [s]"=&r"(st), [p]"+Q"(*p)
+                     : [o]"r"(old), [n]"r"(new) : "memory", "cc");
+    }
+    return v == old;
 }
 
+/* Spin loops wait on values stored by other cpus, which raise no event, so
+   this must not be a wfe. */
 static inline __attribute__((always_inline)) void kern_pause(void)
 {
-    asm volatile("dsb sy; wfe" ::: "memory");
+    asm volatile("yield" ::: "memory");
 }
 
 /* XXX make names generic */
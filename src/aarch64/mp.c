@@ -0,0 +1,110 @@
+//#define MP_DEBUG
+
+#include <kernel.h>
+#include <gic.h>
+
+#ifdef MP_DEBUG
+#define mp_debug(x, ...) do {rprintf("MP:  " x, ##__VA_ARGS__);} while(0)
+#else
+#define mp_debug(x, ...)
+#endif
+
+/* Read by ap_entry in crt0.S with the MMU and caches off; the layout must
+   match the offsets used there. */
+static struct ap_boot {
+    u64 mair;
+    u64 tcr;
+    u64 ttbr0;
+    u64 ttbr1;
+    u64 sctlr;
+    u64 entry;
+    u64 stack;
+    u64 cpu;
+} ap_boot __attribute__((aligned(64)));
+
+extern void *ap_entry, *ap_entry_end, *exception_vectors, *LOAD_OFFSET;
+
+static void (*start_callback)();
+static u64 cpu_mpidr[MAX_CPUS];
+
+#define kernel_phys(p) (u64_from_pointer(p) - u64_from_pointer(&LOAD_OFFSET))
+
+/* No firmware tables are parsed yet, so look for cpus by asking PSCI about
+   each affinity the boot cpu's cluster could hold. This covers both the
+   virt machine layout (cpu in Aff0, cluster in Aff1) and that of cores
+   without multithreading (core in Aff1, Aff0 zero). */
+void count_processors(void)
+{
+    u64 boot = current_cpu()->m.mpidr;
+    u64 upper = boot & MPIDR_AFF_MASK & ~MASK(MPIDR_AFF2_SHIFT);
+    int n = gic_cluster_size();
+    cpu_mpidr[0] = boot;
+    present_processors = 1;
+    for (int aff1 = 0; aff1 < MAX_CPUS && present_processors < MAX_CPUS; aff1++) {
+        for (int aff0 = 0; aff0 < n && present_processors < MAX_CPUS; aff0++) {
+            u64 mpidr = upper | u64_from_field(MPIDR_AFF1, aff1) |
+                u64_from_field(MPIDR_AFF0, aff0);
+            if (mpidr == boot || psci_affinity_info(mpidr) < 0)
+                continue;
+            mp_debug("cpu %d: mpidr 0x%lx\n", present_processors, mpidr);
+            cpu_mpidr[present_processors++] = mpidr;
+        }
+    }
+}
+
+/* entered from ap_entry on the kernel stack of the new cpu */
+static void __attribute__((noreturn)) ap_start(u64 id)
+{
+    cpu_init(id);
+    cpuinfo ci = current_cpu();
+    set_running_frame(ci, frame_from_kernel_context(get_kernel_context(ci)));
+    register u64 v = u64_from_pointer(&exception_vectors);
+    asm volatile("dsb sy; msr vbar_el1, %0; isb" :: "r"(v));
+    init_gic_percpu();
+    mp_debug("cpu %ld started, mpidr 0x%lx\n", id, ci->m.mpidr);
+    memory_barrier();
+    fetch_and_add(&total_processors, 1);
+    start_callback();
+    while (1);
+}
+
+#define AP_START_TIMEOUT_MS 200
+
+/* Start the cpus found by count_processors() one at a time, as they share
+   ap_boot until they are on their own stacks. Cpu ids are handed out in
+   the order the cpus come up. */
+void start_cpus(void (*ap_entry_callback)())
+{
+    start_callback = ap_entry_callback;
+    u64 code = kernel_phys(&ap_entry);
+    u64 code_start = code & ~PAGEMASK;
+    u64 code_len = pad(kernel_phys(&ap_entry_end), PAGESIZE) - code_start;
+
+    /* identity map ap_entry for the instructions following MMU enable */
+    map(code_start, code_start, code_len, pageflags_exec(pageflags_memory()));
+    clean_dcache_range(&ap_entry, (void *)&ap_entry_end - (void *)&ap_entry);
+
+    ap_boot.mair = read_psr(MAIR_EL1);
+    ap_boot.tcr = read_psr(TCR_EL1);
+    ap_boot.ttbr0 = read_psr(TTBR0_EL1);
+    ap_boot.ttbr1 = read_psr(TTBR1_EL1);
+    ap_boot.sctlr = read_psr(SCTLR_EL1);
+    ap_boot.entry = u64_from_pointer(ap_start);
+
+    for (int i = 1; i < present_processors; i++) {
+        u64 nproc = total_processors;
+        ap_boot.cpu = nproc;
+        ap_boot.stack = u64_from_pointer(stack_from_kernel_context(
+                                             get_kernel_context(cpuinfo_from_id(nproc))));
+        clean_dcache_range(&ap_boot, sizeof(ap_boot));
+        gic_prepare_cpu(nproc);
+        s64 rv = psci_cpu_on(cpu_mpidr[i], code, kernel_phys(&ap_boot));
+        if (rv != 0) {
+            msg_err("cpu with mpidr 0x%lx failed to start (%ld)\n", cpu_mpidr[i], rv);
+            continue;
+        }
+        for (u64 to = 0; total_processors == nproc && to < AP_START_TIMEOUT_MS; to++)
+            kernel_delay(milliseconds(1));
+    }
+    unmap(code_start, code_len);
+}
@@ -155,6 +155,14 @@ static inline void leaf_invalidate(u64 address)
                  "tlbi vale1is, %0" :: "r"(a) : "memory");
 }
 
+/* as leaf_invalidate, but also drops cached walks through table entries */
+static inline void walk_invalidate(u64 address)
+{
+    register u64 a = (address >> PAGELOG) & MASK(55 - PAGELOG);
+    asm volatile("dsb ishst;"
+                 "tlbi vae1is, %0" :: "r"(a) : "memory");
+}
+
 static inline void post_sync(void)
 {
     asm volatile("dsb ish" ::: "memory");
@@ -173,8 +181,19 @@ void dump_ptes(void *vaddr)
 static boolean map_area(range v, u64 p, u64 flags);
 
 /* pt_lock should already be held here */
+/* table pages given up by collapsed 2M mappings, linked through their
+   first entry */
+static u64 free_table_pages;
+
 static boolean get_table_page(u64 *phys)
 {
+    if (free_table_pages) {
+        *phys = free_table_pages;
+        u64 *p = pointer_from_pteaddr(*phys);
+        free_table_pages = p[0];
+        zero(p, PAGESIZE);
+        return true;
+    }
     if (range_span(current_pt_phys) == 0) {
         page_init_debug("new table page at ");
         u64 va = allocate_u64((heap)pageheap, PAGESIZE_2M);
@@ -383,6 +402,14 @@ void page_invalidate_flush(void)
 {
 }
 
+void page_invalidate_idle(void)
+{
+}
+
+void page_invalidate_wake(void)
+{
+}
+
 void page_invalidate_sync(flush_entry f, thunk completion)
 {
     post_sync();
@@ -432,6 +459,14 @@ void unmap(u64 virtual, u64 length)
     unmap_pages(virtual, length);
 }
 
+/* TLB invalidation is broadcast in hardware, so replacing the mapping
+   (break before make) costs the other cpus nothing. */
+void remap_private_page(u64 vaddr, physical p, pageflags flags)
+{
+    unmap(vaddr, PAGESIZE);
+    map(vaddr, p, PAGESIZE, flags);
+}
+
 closure_function(0, 1, void, dealloc_phys_page,
                  range, r)
 {
@@ -529,8 +564,9 @@ closure_function(2, 3, boolean, update_pte_flags,
     return true;
 }
 
-/* Update access protection flags for any pages mapped within a given area */
-void update_map_flags(u64 vaddr, u64 length, pageflags flags)
+/* Update access protection flags for any pages mapped within a given area;
+   complete is applied once no stale translation remains */
+void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, thunk complete)
 {
     page_init_debug("update_map_flags: vaddr ");
     page_init_debug_u64(vaddr);
@@ -542,7 +578,7 @@ void update_map_flags(u64 vaddr, u64 length, pageflags flags)
 
     flush_entry fe = get_page_flush_entry();
     traverse_ptes(vaddr, length, stack_closure(update_pte_flags, flags, fe));
-    page_invalidate_sync(fe, ignore);
+    page_invalidate_sync(fe, complete);
 }
 
 /* called with lock held */
@@ -596,6 +632,92 @@ void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length)
     post_sync();
 }
 
+/* Replace a 2M block mapping covering vaddr, if any, with a table of 4K
+   pages mapping the same memory, so that part of it may be unmapped or
+   reprotected. Returns true if a mapping was split. */
+boolean split_2m_page(u64 vaddr)
+{
+    boolean split = false;
+    u64 v = vaddr & MASK(VIRTUAL_ADDRESS_BITS);
+    pagetable_lock();
+    u64 *table_ptr = table_from_vaddr(vaddr);
+    pteptr pp = 0;
+    for (int level = 0; level <= 2; level++) {
+        pp = table_ptr + ((v >> page_level_shifts_4K[level]) & _LEVEL_MASK_4K);
+        pte p = pte_from_pteptr(pp);
+        if (!pte_is_present(p))
+            goto out;
+        if (level < 2) {
+            if ((p & PAGE_L0_2_DESC_TABLE) == 0)
+                goto out;
+            table_ptr = pointer_from_pteaddr(table_from_pte(p));
+        }
+    }
+    pte block = pte_from_pteptr(pp);
+    if (block & PAGE_L0_2_DESC_TABLE)
+        goto out;
+    u64 newtable;
+    if (!get_table_page(&newtable))
+        halt("%s: ran out of page table memory\n", __func__);
+    u64 *n = pointer_from_pteaddr(newtable);
+    u64 phys = page_from_pte(block);
+    u64 flags = flags_from_pte(block) | PAGE_L3_DESC_PAGE;
+    for (int i = 0; i < PTE_ENTRIES; i++)
+        n[i] = flags | (phys + (i << PAGELOG));
+
+    /* break before make */
+    pte_set(pp, 0);
+    leaf_invalidate(vaddr & ~PAGEMASK_2M);
+    post_sync();
+    pte_set(pp, newtable | PAGE_ATTR_AF | PAGE_L0_2_DESC_TABLE | PAGE_L0_3_DESC_VALID);
+    post_sync();
+    split = true;
+  out:
+    pagetable_unlock();
+    return split;
+}
+
+/* Replace a table of 4K pages covering the 2M-aligned vaddr with a block
+   mapping of p, which must hold the same contents. If a mapping was
+   collapsed, complete is applied once the old translations are gone, after
+   which the caller may release the 4K pages. */
+boolean collapse_2m_page(u64 vaddr, physical p, pageflags flags, thunk complete)
+{
+    boolean collapsed = false;
+    u64 v = vaddr & MASK(VIRTUAL_ADDRESS_BITS);
+    pagetable_lock();
+    u64 *table_ptr = table_from_vaddr(vaddr);
+    pteptr pp = 0;
+    for (int level = 0; level <= 2; level++) {
+        pp = table_ptr + ((v >> page_level_shifts_4K[level]) & _LEVEL_MASK_4K);
+        pte e = pte_from_pteptr(pp);
+        if (!pte_is_present(e) || (e & PAGE_L0_2_DESC_TABLE) == 0)
+            goto out;
+        if (level < 2)
+            table_ptr = pointer_from_pteaddr(table_from_pte(e));
+    }
+    u64 table = table_from_pte(pte_from_pteptr(pp));
+
+    /* break before make */
+    pte_set(pp, 0);
+    for (int i = 0; i < PTE_ENTRIES; i++)
+        walk_invalidate(vaddr + (i << PAGELOG));
+    post_sync();
+    pte_set(pp, flags.w | (p & PAGE_4K_NEXT_TABLE_OR_PAGE_OUT_MASK) |
+            PAGE_ATTR_AF | PAGE_L0_3_DESC_VALID);
+    post_sync();
+
+    /* invalidation is complete here, so the table may be reused at once */
+    *(u64 *)pointer_from_pteaddr(table) = free_table_pages;
+    free_table_pages = table;
+    collapsed = true;
+  out:
+    pagetable_unlock();
+    if (collapsed)
+        apply(complete);
+    return collapsed;
+}
+
 extern void *START, *READONLY_END, *END;
 extern void *LOAD_OFFSET;
 
@@ -1,4 +1,5 @@
 #define PAGEMASK MASK(PAGELOG)
+#define PAGEMASK_2M MASK(PAGELOG_2M)
 
 #define PAGE_L0_3_DESC_VALID                      0x1
 #define PAGE_L0_2_DESC_TABLE                      0x2 /* vs block */
@@ -302,11 +303,11 @@ static inline boolean pte_is_mapping(int level, pte entry)
         level == 3;
 }
 
-/* TODO: While the cpu type used under qemu is armv8.1-a, a read of
+/* While the cpu type used under qemu is armv8.1-a, a read of
    ID_AA64MMFR1_EL1 does not indicate that hardware management of
-   dirty pages is available (e.g. HD and HA bits are zero). If we
-   can't depend on this feature, we'll need to set shared pages to
-   read-only and track dirty state via a protection exception.
+   dirty pages is available (e.g. HD and HA bits are zero). Shared
+   file pages are instead mapped read-only and their dirty state is
+   tracked via protection faults in the pagecache.
 */
 
 static inline boolean pte_is_dirty(pte entry)
@@ -320,6 +321,11 @@ static inline void pt_pte_clean(pteptr pte)
     // XXX TODO
 }
 
+static inline void pt_pte_write_protect(pteptr pte)
+{
+    *pte |= _PAGE_READONLY;
+}
+
 static inline u64 page_from_pte(pte pte)
 {
     return pte & PAGE_4K_NEXT_TABLE_OR_PAGE_OUT_MASK;
@@ -347,15 +353,26 @@ static inline void unmap_pages(u64 virtual, u64 length)
     unmap_pages_with_handler(virtual, length, 0);
 }
 
-void update_map_flags(u64 vaddr, u64 length, pageflags flags);
+void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, thunk complete);
+
+static inline void update_map_flags(u64 vaddr, u64 length, pageflags flags)
+{
+    update_map_flags_with_complete(vaddr, length, flags, ignore);
+}
+
 void zero_mapped_pages(u64 vaddr, u64 length);
+void remap_private_page(u64 vaddr, physical p, pageflags flags);
 void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length);
+boolean split_2m_page(u64 vaddr);
+boolean collapse_2m_page(u64 vaddr, physical p, pageflags flags, thunk complete);
 boolean traverse_ptes(u64 vaddr, u64 length, entry_handler eh);
 
 flush_entry get_page_flush_entry(void);
 void page_invalidate_sync(flush_entry f, thunk completion);
 void page_invalidate(flush_entry f, u64 address);
 void page_invalidate_flush(void);
+void page_invalidate_idle(void);
+void page_invalidate_wake(void);
 
 void dump_ptes(void *vaddr);
 
@@ -82,6 +82,7 @@ static void ena_free_io_irq(struct ena_adapter *);
 static void ena_disable_msix(struct ena_adapter *);
 static void ena_unmask_all_io_irqs(struct ena_adapter *);
 static int ena_up_complete(struct ena_adapter *);
+static int ena_rss_configure(struct ena_adapter *);
 static err_t ena_init(struct netif *);
 static int ena_setup_ifnet(struct ena_adapter *, struct ena_com_dev_get_features_ctx *);
 static int ena_set_queues_placement_policy(struct ena_adapter *,
@@ -460,6 +461,19 @@ static int ena_setup_rx_resources(struct ena_adapter *adapter, unsigned int qid)
     for (i = 0; i < rx_ring->ring_size; i++)
         rx_ring->free_rx_ids[i] = i;
 
+    if (!rx_ring->rx_pool) {
+        rx_ring->rx_pool = allocate_dma_pool(adapter->general, (backed_heap)adapter->contiguous,
+                                             sizeof(struct ena_rx_pbuf) + rx_ring->rx_mbuf_sz,
+                                             64, 2 * rx_ring->ring_size);
+        if (rx_ring->rx_pool == INVALID_ADDRESS) {
+            rx_ring->rx_pool = 0;
+            deallocate(adapter->general, rx_ring->free_rx_ids,
+                       sizeof(uint16_t) * rx_ring->ring_size);
+            rx_ring->free_rx_ids = NULL;
+            goto err_free_binfo;
+        }
+    }
+
     /* Reset RX statistics. */
     ena_reset_counters(&rx_ring->rx_stats, sizeof(rx_ring->rx_stats));
 
@@ -539,23 +553,43 @@ static void ena_free_all_rx_resources(struct ena_adapter *adapter)
         ena_free_rx_resources(adapter, i);
 }
 
+/* Rx buffers come from a per-ring DMA pool, with the payload following
+   the pbuf and its physical address known up front. */
+struct ena_rx_pbuf {
+    struct pbuf_custom p;
+    struct ena_ring *ring;
+    u64 phys;
+};
+
+static void ena_rx_pbuf_free(struct pbuf *p)
+{
+    struct ena_rx_pbuf *rxp = (struct ena_rx_pbuf *)p;
+    dma_pool_put(rxp->ring->rx_pool, rxp, rxp->phys);
+}
+
 static inline int ena_alloc_rx_mbuf(struct ena_adapter *adapter, struct ena_ring *rx_ring,
                                     struct ena_rx_buffer *rx_info)
 {
     struct ena_com_buf *ena_buf;
+    struct ena_rx_pbuf *rxp;
     int len = rx_ring->rx_mbuf_sz;
+    u64 phys;
 
     /* if previous allocated frag is not used */
     if (unlikely(rx_info->mbuf != NULL))
         return 0;
 
-    rx_info->mbuf = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
-    if (unlikely(rx_info->mbuf == 0)) {
+    rxp = dma_pool_get(rx_ring->rx_pool, &phys);
+    if (unlikely(rxp == INVALID_ADDRESS)) {
         rx_ring->rx_stats.mjum_alloc_fail++;
         return ENA_COM_NO_MEM;
     }
+    rxp->ring = rx_ring;
+    rxp->phys = phys;
+    rxp->p.custom_free_function = ena_rx_pbuf_free;
+    rx_info->mbuf = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &rxp->p, rxp + 1, len);
     ena_buf = &rx_info->ena_buf;
-    ena_buf->paddr = physical_from_virtual(rx_info->mbuf->payload);
+    ena_buf->paddr = phys + sizeof(*rxp);
     ena_buf->len = len;
 
     ena_trace(NULL, ENA_DBG | ENA_RSC | ENA_RXPTH,
@@ -808,6 +842,7 @@ static int ena_create_io_queues(struct ena_adapter *adapter)
     for (i = 0; i < adapter->num_io_queues; i++) {
         queue = &adapter->que[i];
         init_closure(&queue->cleanup_task, ena_cleanup_task, queue);
+        net_dim_init(&queue->dim);
     }
 
     return 0;
@@ -859,8 +894,9 @@ static void ena_handle_msix(void *arg)
     struct ena_adapter *adapter = queue->adapter;
     struct netif *netif = &adapter->ifp;
 
+    /* keep the cleanup on the cpu the queue's vector is bound to */
     if (likely(netif_is_flag_set(netif, NETIF_FLAG_UP)))
-        enqueue(runqueue, &queue->cleanup_task);
+        runqueue_push((thunk)&queue->cleanup_task);
 }
 
 static int ena_enable_msix(struct ena_adapter *adapter)
@@ -944,12 +980,15 @@ static int ena_request_io_irq(struct ena_adapter *adapter)
         return ENA_COM_INVAL;
     }
 
+    /* Queue i is bound to cpu i, which is also the cpu that transmits on it. */
     for (i = ENA_IO_IRQ_FIRST_IDX; i < adapter->msix_vecs; i++) {
+        u32 cpu = (i - ENA_IO_IRQ_FIRST_IDX) % present_processors;
         irq = &adapter->irq_tbl[i];
-        if (pci_setup_msix(adapter->pdev, irq->vector, init_closure(&irq->th, ena_irq_handler, irq),
-                           "ena_io") == INVALID_PHYSICAL)
+        if (pci_setup_msix_cpu(adapter->pdev, irq->vector,
+                               init_closure(&irq->th, ena_irq_handler, irq),
+                               "ena_io", cpu) == INVALID_PHYSICAL)
             return ENA_COM_FAULT;
-        ena_trace(NULL, ENA_INFO, "queue %d\n", i - ENA_IO_IRQ_FIRST_IDX);
+        ena_trace(NULL, ENA_INFO, "queue %d cpu %d\n", i - ENA_IO_IRQ_FIRST_IDX, cpu);
     }
 
     return 0;
@@ -1001,10 +1040,194 @@ static void ena_unmask_all_io_irqs(struct ena_adapter *adapter)
     }
 }
 
+/*********************************************************************
+ *
+ *  RSS
+ *
+ **********************************************************************/
+
+void ena_rss_key_fill(void *key, size_t size)
+{
+    static bool key_generated;
+    static uint64_t default_key[ENA_HASH_KEY_SIZE / sizeof(uint64_t)];
+
+    assert(size <= ENA_HASH_KEY_SIZE);
+    if (!key_generated) {
+        for (int i = 0; i < _countof(default_key); i++)
+            default_key[i] = random_u64();
+        key_generated = true;
+    }
+    runtime_memcpy(key, default_key, size);
+}
+
+/* Spread the indirection table over the io queues, round robin unless a
+   table was configured. Entries of a configured table beyond the current
+   queue count wrap around. */
+static int ena_rss_fill_table(struct ena_adapter *adapter)
+{
+    struct ena_com_dev *ena_dev = adapter->ena_dev;
+    uint32_t qid;
+    int rc;
+
+    for (int i = 0; i < ENA_RX_RSS_TABLE_SIZE; i++) {
+        qid = adapter->rss_table_len ? adapter->rss_table[i % adapter->rss_table_len] : i;
+        qid %= adapter->num_io_queues;
+        rc = ena_com_indirect_table_fill_entry(ena_dev, i, ENA_IO_RXQ_IDX(qid));
+        if (unlikely(rc != 0)) {
+            device_printf(adapter->pdev, "Cannot fill indirect table\n");
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* Toeplitz with a configured key, otherwise the device's CRC32 hash */
+static int ena_rss_fill_hash_function(struct ena_adapter *adapter)
+{
+    if (adapter->rss_key_set)
+        return ena_com_fill_hash_function(adapter->ena_dev, ENA_ADMIN_TOEPLITZ,
+                                          adapter->rss_key, ENA_HASH_KEY_SIZE, 0xFFFFFFFF);
+    return ena_com_fill_hash_function(adapter->ena_dev, ENA_ADMIN_CRC32, NULL,
+                                      ENA_HASH_KEY_SIZE, 0xFFFFFFFF);
+}
+
+static int ena_rss_init_default(struct ena_adapter *adapter)
+{
+    struct ena_com_dev *ena_dev = adapter->ena_dev;
+    int rc;
+
+    rc = ena_com_rss_init(ena_dev, ENA_RX_RSS_TABLE_LOG_SIZE);
+    if (unlikely(rc != 0)) {
+        device_printf(adapter->pdev, "Cannot init indirect table\n");
+        return rc;
+    }
+
+    rc = ena_rss_fill_table(adapter);
+    if (unlikely(rc != 0))
+        goto err_rss_destroy;
+
+    rc = ena_rss_fill_hash_function(adapter);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED))) {
+        device_printf(adapter->pdev, "Cannot fill hash function\n");
+        goto err_rss_destroy;
+    }
+
+    rc = ena_com_set_default_hash_ctrl(ena_dev);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED))) {
+        device_printf(adapter->pdev, "Cannot fill hash control\n");
+        goto err_rss_destroy;
+    }
+
+    return 0;
+
+err_rss_destroy:
+    ena_com_rss_destroy(ena_dev);
+    return rc;
+}
+
+/* Push the host RSS state to the device; called with io queues created, as
+   the indirection table refers to rx submission queues. */
+static int ena_rss_configure(struct ena_adapter *adapter)
+{
+    struct ena_com_dev *ena_dev = adapter->ena_dev;
+    int rc;
+
+    rc = ena_rss_fill_table(adapter);
+    if (unlikely(rc != 0))
+        return rc;
+
+    rc = ena_com_indirect_table_set(ena_dev);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED)))
+        return rc;
+
+    rc = ena_rss_fill_hash_function(adapter);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED)))
+        return rc;
+
+    rc = ena_com_set_hash_ctrl(ena_dev);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED)))
+        return rc;
+
+    return 0;
+}
+
+static boolean ena_parse_rss_key(struct ena_adapter *adapter, string key)
+{
+    if (buffer_length(key) != 2 * ENA_HASH_KEY_SIZE)
+        return false;
+    const char *hex = buffer_ref(key, 0);
+    for (int i = 0; i < ENA_HASH_KEY_SIZE; i++) {
+        int b = byte_from_hex(hex[2 * i], hex[2 * i + 1]);
+        if (b < 0)
+            return false;
+        adapter->rss_key[i] = b;
+    }
+    adapter->rss_key_set = true;
+    return true;
+}
+
+static boolean ena_parse_rss_table(struct ena_adapter *adapter, tuple tbl)
+{
+    value v;
+    u64 qid;
+    int i;
+
+    for (i = 0; (v = get(tbl, intern_u64(i))); i++) {
+        if (i == ENA_RX_RSS_TABLE_SIZE || !u64_from_value(v, &qid) ||
+            qid >= ENA_MAX_NUM_IO_QUEUES)
+            return false;
+        adapter->rss_table[i] = qid;
+    }
+    if (i == 0)
+        return false;
+    adapter->rss_table_len = i;
+    return true;
+}
+
+/* e.g. en1:(rss_key:6d5a56da255b0ec24167253d43a38fb0d0ca2bcbae7b30b477cb2da38030f20c6a42b73bbeac01fa
+             rss_table:[0 1 2 3]) */
+define_closure_function(1, 1, void, ena_config_handler,
+                        struct ena_adapter *, adapter,
+                        tuple, t)
+{
+    struct ena_adapter *adapter = bound(adapter);
+    boolean changed = false;
+
+    string key = get_string(t, sym(rss_key));
+    if (key) {
+        if (ena_parse_rss_key(adapter, key))
+            changed = true;
+        else
+            device_printf(adapter->pdev, "rss_key must be %d hex digits; ignored\n",
+                          2 * ENA_HASH_KEY_SIZE);
+    }
+
+    tuple tbl = get_tuple(t, sym(rss_table));
+    if (tbl) {
+        if (ena_parse_rss_table(adapter, tbl))
+            changed = true;
+        else
+            device_printf(adapter->pdev, "invalid rss_table; ignored\n");
+    }
+
+    if (!changed || !ENA_FLAG_ISSET(ENA_FLAG_RSS_ACTIVE, adapter))
+        return;
+    ENA_LOCK_LOCK(adapter);
+    if (ENA_FLAG_ISSET(ENA_FLAG_DEV_UP, adapter) && ena_rss_configure(adapter) != 0)
+        device_printf(adapter->pdev, "failed to apply RSS configuration\n");
+    ENA_LOCK_UNLOCK(adapter);
+}
+
 static int ena_up_complete(struct ena_adapter *adapter)
 {
     int rc;
 
+    if (likely(ENA_FLAG_ISSET(ENA_FLAG_RSS_ACTIVE, adapter))) {
+        rc = ena_rss_configure(adapter);
+        if (rc != 0)
+            return rc;
+    }
+
     rc = ena_change_mtu(adapter, adapter->ifp.mtu);
     if (unlikely(rc != 0))
         return rc;
@@ -1378,7 +1601,7 @@ int ena_up(struct ena_adapter *adapter)
      * reset and timer service will be activated afterwards.
      */
     if (ENA_FLAG_ISSET (ENA_FLAG_DEVICE_RUNNING, adapter))
-        adapter->timer_service = register_timer(runloop_timers,
+        adapter->timer_service = kern_register_timer(
             CLOCK_ID_MONOTONIC, seconds(1), false, seconds(1),
             init_closure(&adapter->timer_task, ena_timer_task, adapter));
 
@@ -1481,7 +1704,7 @@ static uint32_t ena_calc_max_io_queue_num(struct ena_adapter *adapter,
     if (ena_dev->tx_mem_queue_type == ENA_ADMIN_PLACEMENT_POLICY_DEV)
         io_tx_sq_num = get_feat_ctx->llq.max_llq_num;
 
-    max_num_io_queues = min_t(uint32_t, total_processors, ENA_MAX_NUM_IO_QUEUES);
+    max_num_io_queues = min_t(uint32_t, present_processors, ENA_MAX_NUM_IO_QUEUES);
     max_num_io_queues = min_t(uint32_t, max_num_io_queues, io_rx_num);
     max_num_io_queues = min_t(uint32_t, max_num_io_queues, io_tx_sq_num);
     max_num_io_queues = min_t(uint32_t, max_num_io_queues, io_tx_cq_num);
@@ -1679,6 +1902,13 @@ static int ena_device_init(struct ena_adapter *adapter,
         goto err_admin_init;
     }
 
+    /* learns the interrupt delay resolution, if the device moderates */
+    rc = ena_com_init_interrupt_moderation(ena_dev);
+    if (unlikely(rc != 0)) {
+        device_printf(pdev, "Cannot init interrupt moderation rc: %d\n", rc);
+        goto err_admin_init;
+    }
+
     aenq_groups = BIT (ENA_ADMIN_LINK_CHANGE) | BIT (ENA_ADMIN_FATAL_ERROR) |
             BIT (ENA_ADMIN_WARNING) | BIT (ENA_ADMIN_NOTIFICATION) | BIT (ENA_ADMIN_KEEP_ALIVE);
 
@@ -1913,7 +2143,7 @@ int ena_restore_device(struct ena_adapter *adapter)
          * caused by missing keep alive.
          */
         adapter->keep_alive_timestamp = uptime();
-        adapter->timer_service = register_timer(runloop_timers, CLOCK_ID_MONOTONIC,
+        adapter->timer_service = kern_register_timer(CLOCK_ID_MONOTONIC,
             seconds(1), false, seconds(1), (timer_handler)&adapter->timer_task);
     }
     ENA_FLAG_CLEAR_ATOMIC(ENA_FLAG_DEV_UP_BEFORE_RESET, adapter);
@@ -1979,7 +2209,11 @@ static boolean ena_attach(heap general, heap page_allocator, pci_dev d)
         return false;
     adapter->general = general;
     adapter->contiguous = page_allocator;
+    for (int i = 0; i < ENA_MAX_NUM_IO_QUEUES; i++)
+        adapter->rx_ring[i].rx_pool = 0;
     adapter->pdev = d;
+    adapter->rss_key_set = false;
+    adapter->rss_table_len = 0;
 
     ENA_LOCK_INIT(adapter);
 
@@ -2088,6 +2322,14 @@ static boolean ena_attach(heap general, heap page_allocator, pci_dev d)
 
     init_closure(&adapter->reset_task, ena_reset_task, adapter);
 
+    rc = ena_rss_init_default(adapter);
+    if (likely(rc == 0))
+        ENA_FLAG_SET_ATOMIC(ENA_FLAG_RSS_ACTIVE, adapter);
+    else if (rc != ENA_COM_UNSUPPORTED)
+        device_printf(d, "WARNING: RSS was not properly initialized, it will affect bandwidth\n");
+    netif_set_config_handler(&adapter->ifp,
+                             init_closure(&adapter->config_handler, ena_config_handler, adapter));
+
     /* Initialize statistics */
     zero(&adapter->dev_stats, sizeof(struct ena_stats_dev));
     zero(&adapter->hw_stats, sizeof(struct ena_hw_stats));
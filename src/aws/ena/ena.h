@@ -31,6 +31,7 @@
 #ifndef ENA_H
 #define ENA_H
 
+#include <net.h>
 #include "ena_com/ena_com.h"
 #include "ena_com/ena_eth_com.h"
 
@@ -197,6 +198,7 @@ struct ena_que {
     struct ena_ring *rx_ring;
     closure_struct(ena_cleanup_task, cleanup_task);
     uint32_t id;
+    struct net_dim dim;         /* rx interrupt delay, if the device moderates */
 };
 
 struct ena_calc_queue_size_ctx {
@@ -316,6 +318,9 @@ struct ena_ring {
 
     /* Used for LLQ */
     uint8_t *push_buf_intermediate_buf;
+
+    /* Rx buffers; kept across resets, for the stack may still hold some */
+    dma_pool rx_pool;
 } ____cacheline_aligned;
 
 struct ena_stats_dev {
@@ -343,6 +348,10 @@ declare_closure_struct(1, 1, void, ena_timer_task,
 declare_closure_struct(1, 0, void, ena_reset_task,
         struct ena_adapter *, adapter);
 
+declare_closure_struct(1, 1, void, ena_config_handler,
+        struct ena_adapter *, adapter,
+        tuple, t);
+
 /* Board specific private data structure */
 struct ena_adapter {
     heap general, contiguous;
@@ -374,6 +383,13 @@ struct ena_adapter {
 
     uint32_t buf_ring_size;
 
+    /* RSS settings from the interface config; defaults if unset */
+    uint8_t rss_key[ENA_HASH_KEY_SIZE];
+    bool rss_key_set;
+    uint16_t rss_table[ENA_RX_RSS_TABLE_SIZE];
+    uint32_t rss_table_len;
+    closure_struct(ena_config_handler, config_handler);
+
     ena_state_t flags;
 
     /* Queue will represent one TX and one RX ring */
@@ -62,6 +62,8 @@ void ena_cleanup(void *arg, int pending)
     struct ena_eth_io_intr_reg intr_reg;
     int qid, ena_qid;
     int txc, rxc, i;
+    uint64_t rx_packets, rx_bytes;
+    uint32_t rx_interval;
 
     if (unlikely(!netif_is_flag_set(netif, NETIF_FLAG_UP)))
         return;
@@ -77,6 +79,8 @@ void ena_cleanup(void *arg, int pending)
     tx_ring->first_interrupt = true;
     rx_ring->first_interrupt = true;
 
+    rx_packets = rx_ring->rx_stats.cnt;
+    rx_bytes = rx_ring->rx_stats.bytes;
     for (i = 0; i < CLEAN_BUDGET; ++i) {
         rxc = ena_rx_cleanup(rx_ring);
         txc = ena_tx_cleanup(tx_ring);
@@ -88,9 +92,19 @@ void ena_cleanup(void *arg, int pending)
             break;
     }
 
+    /* The device delays interrupts in units of its resolution, and only
+       by time. */
+    rx_interval = RX_IRQ_INTERVAL;
+    if (adapter->ena_dev->intr_delay_resolution != 0) {
+        net_dim_sample(&que->dim, rx_ring->rx_stats.cnt - rx_packets,
+                       rx_ring->rx_stats.bytes - rx_bytes);
+        rx_interval = net_dim_profile(&que->dim)->usecs /
+            adapter->ena_dev->intr_delay_resolution;
+    }
+
     /* Signal that work is done and unmask interrupt */
     ena_com_update_intr_reg(&intr_reg,
-    RX_IRQ_INTERVAL,
+    rx_interval,
     TX_IRQ_INTERVAL,
     true);
     ena_com_unmask_intr(io_cq, &intr_reg);
@@ -21,9 +21,32 @@
 #define RUNLOOP_TIMER_MAX_PERIOD_US     100000
 #define RUNLOOP_TIMER_MIN_PERIOD_US     1000
 
+/* thunks claimed from a global queue with a single reservation */
+#define RUNLOOP_BATCH_SIZE              32
+
+/* default bottom half budgets, in thunks per pass over the priority levels */
+#define BH_BUDGET_INTERRUPT             64
+#define BH_BUDGET_NETWORK               64
+#define BH_BUDGET_STORAGE               32
+#define BH_BUDGET_BACKGROUND            8
+
+/* bottom halves bound to a cpu, run at the network budget */
+#define CPU_BHQUEUE_SIZE                512
+
+/* default packets handled per pass by a polled receive queue */
+#define RX_POLL_BUDGET                  64
+
+/* poll-before-halt window of an idle cpu: initial and default maximum */
+#define IDLE_POLL_START_US              10
+#define IDLE_POLL_MAX_US                200
+
 /* XXX just for initial mp bringup... */
 #define MAX_CPUS 16
 
+/* NUMA nodes and node memory ranges tracked from firmware topology */
+#define MAX_NUMA_NODES 8
+#define MAX_NUMA_RANGES 32
+
 /* length of thread scheduling queue */
 #define MAX_THREADS 8192
 
@@ -34,21 +57,46 @@
 #define TFS_LOG_INITIAL_SIZE           SECTOR_SIZE
 #define TFS_LOG_DEFAULT_EXTENSION_SIZE (512*KB)
 #define TFS_LOG_FLUSH_DELAY_SECONDS 1
+/* Longest time a log commit may be held back to gather more syncing callers
+ * into the same flush; 0 starts the flush at once. */
+#define TFS_LOG_COMMIT_DELAY_US 0
 /* Minimum number of obsolete log entries needed to trigger a log compaction. */
 #define TFS_LOG_COMPACT_OBSOLETE   8192
 /* Log compaction is not triggered if the ratio between total entries and
  * obsolete entries is above the constant below. */
 #define TFS_LOG_COMPACT_RATIO   2
+/* Number of tuples copied to the new log between flushes while compacting. */
+#define TFS_LOG_COMPACT_CHUNK   256
+/* Largest amount of file data held by a compressed extent. */
+#define TFS_COMPRESS_CHUNK_SIZE (64*KB)
+/* Number of slots in the path lookup cache (must be a power of 2), and longest
+ * name that is cached. */
+#define FS_LOOKUP_CACHE_SIZE    1024
+#define FS_LOOKUP_NAME_MAX      39
 
 /* Xen stuff */
 #define XENNET_INIT_RX_BUFFERS_FACTOR 4
 #define XENNET_RX_SERVICEQUEUE_DEPTH 512
 #define XENNET_TX_SERVICEQUEUE_DEPTH 512
+/* queue pairs used at most, one per cpu up to the backend maximum */
+#define XENNET_MAX_QUEUES 8
+/* frames up to this size are copied into pages granted to the backend once */
+#define XENNET_TX_COPYBREAK 512
 
 /* mm stuff */
 #define PAGECACHE_DRAIN_CUTOFF (64 * MB)
 #define PAGECACHE_SCAN_PERIOD_SECONDS 5
 
+/* writers are throttled above the high watermark of dirty and in-flight
+   pagecache data, and released once it falls to the low watermark */
+#define PAGECACHE_DIRTY_HIGH_BYTES (64 * MB)
+#define PAGECACHE_DIRTY_LOW_BYTES (32 * MB)
+
+/* pre-zeroed pages kept per cpu for anonymous faults, refilled while idle
+   as long as free physical memory stays above the minimum */
+#define ZERO_POOL_PAGES_DEFAULT 64
+#define ZERO_POOL_MIN_FREE (32 * MB)
+
 /* don't go below this minimum amount of physical memory when inflating balloon */
 #define BALLOON_MEMORY_MINIMUM (16 * MB)
 
@@ -58,11 +106,20 @@
 /* must be large enough for vendor code that use malloc/free interface */
 #define MAX_MCACHE_ORDER 16
 
+/* per-cpu object magazines in front of the locked heaps: rounds per
+   magazine and the largest object size (as order) that is cached */
+#define HEAP_MAGAZINE_ROUNDS 32
+#define HEAP_MAGAZINE_MAX_ORDER 11
+
+/* slab size of the per-cpu arenas behind the transient heap */
+#define TRANSIENT_SLAB_SIZE (16 * KB)
+
 /* ftrace buffer size */
 #define DEFAULT_TRACE_ARRAY_SIZE        (512ULL << 20)
 
-/* on-disk log dump section */
+/* on-disk log dump section; its last sector holds the boot state record */
 #define KLOG_DUMP_SIZE  (4 * KB)
+#define KLOG_BOOT_STATE_SIZE    512
 
 /* debug parameters */
 #define FRAME_TRACE_DEPTH 32
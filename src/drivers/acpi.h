@@ -17,6 +17,8 @@
 
 /* ACPI table signatures */
 #define ACPI_SIG_MADT   0x43495041  // "APIC"
+#define ACPI_SIG_SRAT   0x54415253  // "SRAT"
+#define ACPI_SIG_SLIT   0x54494c53  // "SLIT"
 
 /* MADT controller types */
 #define ACPI_MADT_LAPIC     0
@@ -24,6 +26,14 @@
 #define ACPI_MADT_LAPICx2   9
 
 #define MADT_LAPIC_ENABLED  1
+
+/* SRAT affinity structure types */
+#define ACPI_SRAT_LAPIC     0
+#define ACPI_SRAT_MEMORY    1
+#define ACPI_SRAT_LAPICx2   2
+
+#define SRAT_AFFINITY_ENABLED   1
+
 /* ACPI table structures */
 typedef struct acpi_rsdp {
     u8 sig[8];
@@ -85,6 +95,52 @@ typedef struct acpi_ioapic {
     u32 gsi_base;
 } __attribute__((packed)) *acpi_ioapic;
 
+typedef struct acpi_srat {
+    struct acpi_header h;
+    u32 res1;
+    u64 res2;
+} __attribute__((packed)) *acpi_srat;
+
+typedef struct acpi_srat_lapic {
+    u8 type;
+    u8 length;
+    u8 domain_lo;
+    u8 apic_id;
+    u32 flags;
+    u8 sapic_eid;
+    u8 domain_hi[3];
+    u32 clock_domain;
+} __attribute__((packed)) *acpi_srat_lapic;
+
+typedef struct acpi_srat_mem {
+    u8 type;
+    u8 length;
+    u32 domain;
+    u16 res1;
+    u64 base;
+    u64 length_bytes;
+    u32 res2;
+    u32 flags;
+    u64 res3;
+} __attribute__((packed)) *acpi_srat_mem;
+
+typedef struct acpi_srat_lapic_x2 {
+    u8 type;
+    u8 length;
+    u16 res1;
+    u32 domain;
+    u32 id;
+    u32 flags;
+    u32 clock_domain;
+    u32 res2;
+} __attribute__((packed)) *acpi_srat_lapic_x2;
+
+typedef struct acpi_slit {
+    struct acpi_header h;
+    u64 localities;
+    u8 entry[0];                /* localities x localities distance matrix */
+} __attribute__((packed)) *acpi_slit;
+
 static inline boolean acpi_checksum(void *a, u8 len)
 {
     u8 *addr = a;
@@ -95,8 +151,10 @@ static inline boolean acpi_checksum(void *a, u8 len)
 }
 
 typedef closure_type(madt_handler, void, u8, void *);
+typedef closure_type(srat_handler, void, u8, void *);
 
 void init_acpi(kernel_heaps kh);
 void init_acpi_tables(kernel_heaps kh);
 void *acpi_get_table(u32 sig);
 void acpi_walk_madt(acpi_madt madt, madt_handler mh);
+void acpi_walk_srat(acpi_srat srat, srat_handler sh);
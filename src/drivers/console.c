@@ -1,4 +1,5 @@
 #include <kernel.h>
+#include <log.h>
 #include "serial.h"
 #include "console.h"
 #include "vga.h"
@@ -16,34 +17,259 @@ struct console_driver serial_console_driver = {
     .name = "serial"
 };
 
-struct console_driver *console_drivers[4] = {
+struct console_driver *console_drivers[5] = {
     &serial_console_driver,
 };
 
 static struct spinlock write_lock;
 
-void console_write(const char *s, bytes count)
+/* attached driver that took over from the serial port, if any */
+static struct console_driver *console_preferred;
+
+/* Buffered output. Each cpu appends records to its own ring with interrupts
+   disabled, and a background bottom half drains the rings in sequence
+   order to the console drivers and the klog, so writers don't wait on slow
+   devices such as the serial port. A record that doesn't fit in its ring
+   is dropped and counted; the drain reports the loss. Kernel messages,
+   including panics and fault reports, are still written synchronously,
+   after draining whatever is buffered. */
+#define CONSOLE_BUF_SIZE        (16 * KB)   /* per cpu, power of 2 */
+#define CONSOLE_RECORD_MAX      512
+#define CONSOLE_DRAIN_BUDGET    (64 * KB)   /* bytes per drain run */
+
+struct console_record {
+    u32 len;
+    u32 seq;
+};
+
+typedef struct console_buf {
+    u64 head;                   /* advanced by the owning cpu */
+    u64 tail;                   /* advanced by the drain, under write_lock */
+    u64 dropped;                /* bytes dropped for lack of space */
+    u64 dropped_reported;
+    char data[CONSOLE_BUF_SIZE];
+} *console_buf;
+
+declare_closure_struct(0, 0, void, console_drain);
+
+static console_buf *console_bufs;
+static u32 console_nbufs;
+static u64 console_seq;
+static u32 console_drain_scheduled;
+static closure_struct(console_drain, drain);
+
+static void console_write_drivers(const char *s, bytes count)
 {
-    spin_lock(&write_lock);
     for (struct console_driver **pd = console_drivers; *pd; pd++) {
         if ((*pd)->disabled)
             continue;
         (*pd)->write(*pd, s, count);
     }
+}
+
+/* drivers may hold back writes, e.g. to submit them to a device at once */
+static void console_flush_drivers(void)
+{
+    for (struct console_driver **pd = console_drivers; *pd; pd++) {
+        if (!(*pd)->disabled && (*pd)->flush)
+            (*pd)->flush(*pd);
+    }
+}
+
+static void console_buf_copy_in(console_buf cb, u64 pos, const void *src, bytes len)
+{
+    u64 off = pos & (CONSOLE_BUF_SIZE - 1);
+    bytes n = MIN(len, CONSOLE_BUF_SIZE - off);
+    runtime_memcpy(cb->data + off, src, n);
+    if (n < len)
+        runtime_memcpy(cb->data, src + n, len - n);
+}
+
+static void console_buf_copy_out(console_buf cb, u64 pos, void *dest, bytes len)
+{
+    u64 off = pos & (CONSOLE_BUF_SIZE - 1);
+    bytes n = MIN(len, CONSOLE_BUF_SIZE - off);
+    runtime_memcpy(dest, cb->data + off, n);
+    if (n < len)
+        runtime_memcpy(dest + n, cb->data, len - n);
+}
+
+static void console_buf_put(const char *s, bytes len)
+{
+    u64 flags = irq_disable_save();
+    u32 id = current_cpu()->id;
+    if (id >= console_nbufs) {
+        irq_restore(flags);
+        spin_lock(&write_lock);
+        console_write_drivers(s, len);
+        console_flush_drivers();
+        spin_unlock(&write_lock);
+        klog_write(s, len);
+        return;
+    }
+    console_buf cb = console_bufs[id];
+    bytes total = sizeof(struct console_record) + len;
+    if (cb->head - *(volatile u64 *)&cb->tail + total > CONSOLE_BUF_SIZE) {
+        cb->dropped += len;
+    } else {
+        struct console_record r = { .len = len, .seq = fetch_and_add(&console_seq, 1) };
+        console_buf_copy_in(cb, cb->head, &r, sizeof(r));
+        console_buf_copy_in(cb, cb->head + sizeof(r), s, len);
+        write_barrier();
+        cb->head += total;
+    }
+    irq_restore(flags);
+}
+
+/* called with write_lock held; returns the number of bytes drained */
+static bytes console_drain_locked(bytes budget)
+{
+    char batch[2 * CONSOLE_RECORD_MAX];
+    bytes batch_len = 0;
+    bytes drained = 0;
+    while (drained < budget) {
+        console_buf next = 0;
+        struct console_record nr;
+        for (u32 i = 0; i < console_nbufs; i++) {
+            console_buf cb = console_bufs[i];
+            if (*(volatile u64 *)&cb->head == cb->tail)
+                continue;
+            read_barrier();
+            struct console_record r;
+            console_buf_copy_out(cb, cb->tail, &r, sizeof(r));
+            if (!next || (s32)(r.seq - nr.seq) < 0) {
+                next = cb;
+                nr = r;
+            }
+        }
+        if (!next)
+            break;
+        u64 dropped = next->dropped;
+        if (dropped != next->dropped_reported || batch_len + nr.len > sizeof(batch)) {
+            console_write_drivers(batch, batch_len);
+            klog_write(batch, batch_len);
+            batch_len = 0;
+        }
+        if (dropped != next->dropped_reported) {
+            buffer b = little_stack_buffer(64);
+            bprintf(b, "[console: %ld bytes dropped]\n", dropped - next->dropped_reported);
+            console_write_drivers(buffer_ref(b, 0), buffer_length(b));
+            klog_write(buffer_ref(b, 0), buffer_length(b));
+            next->dropped_reported = dropped;
+        }
+        console_buf_copy_out(next, next->tail + sizeof(nr), batch + batch_len, nr.len);
+        batch_len += nr.len;
+        memory_barrier();
+        next->tail += sizeof(nr) + nr.len;
+        drained += nr.len;
+    }
+    if (batch_len) {
+        console_write_drivers(batch, batch_len);
+        klog_write(batch, batch_len);
+    }
+    if (drained)
+        console_flush_drivers();
+    return drained;
+}
+
+static boolean console_buffered(void)
+{
+    for (u32 i = 0; i < console_nbufs; i++) {
+        console_buf cb = console_bufs[i];
+        if (*(volatile u64 *)&cb->head != cb->tail)
+            return true;
+    }
+    return false;
+}
+
+static void console_drain_schedule(void);
+
+define_closure_function(0, 0, void, console_drain)
+{
+    console_drain_scheduled = 0;
+    memory_barrier();
+    spin_lock(&write_lock);
+    console_drain_locked(CONSOLE_DRAIN_BUDGET);
     spin_unlock(&write_lock);
+    if (console_buffered())
+        console_drain_schedule();
 }
 
-closure_function(0, 1, void, attach_console,
-                 struct console_driver *, d)
+static void console_drain_schedule(void)
+{
+    if (!compare_and_swap_32(&console_drain_scheduled, 0, 1))
+        return;
+    u64 flags = irq_disable_save();
+    if (!enqueue(bhqueues[BH_PRIO_BACKGROUND], init_closure(&drain, console_drain)))
+        console_drain_scheduled = 0;    /* picked up by the next write */
+    irq_restore(flags);
+}
+
+void console_write(const char *s, bytes count)
+{
+    spin_lock(&write_lock);
+    if (console_nbufs)
+        console_drain_locked(infinity);
+    console_write_drivers(s, count);
+    console_flush_drivers();
+    spin_unlock(&write_lock);
+}
+
+/* Output of user programs, also copied to the klog. It may be user memory,
+   so it is staged on the stack before being appended with interrupts
+   disabled. */
+void console_write_async(const char *s, bytes count)
+{
+    if (!console_nbufs || shutting_down) {
+        console_write(s, count);
+        klog_write(s, count);
+        return;
+    }
+    char chunk[CONSOLE_RECORD_MAX];
+    while (count > 0) {
+        bytes len = MIN(count, CONSOLE_RECORD_MAX);
+        runtime_memcpy(chunk, s, len);
+        console_buf_put(chunk, len);
+        s += len;
+        count -= len;
+    }
+    console_drain_schedule();
+}
+
+/* write out all buffered output now, as before shutdown */
+void console_flush(void)
+{
+    if (!console_nbufs)
+        return;
+    spin_lock(&write_lock);
+    console_drain_locked(infinity);
+    spin_unlock(&write_lock);
+}
+
+/* A preferred driver replaces the serial port for output from then on,
+   unless the serial console is enabled again in the manifest. */
+void attach_console_driver(struct console_driver *d)
 {
     struct console_driver **pd;
 
+    spin_lock(&write_lock);
     for (pd = console_drivers; *pd; pd++)
         ;
     // last console driver elem is reserved for EOL marker
     assert(pd < console_drivers + _countof(console_drivers) - 1);
 
     *pd = d;
+    if (d->preferred && !d->disabled && !console_preferred) {
+        console_preferred = d;
+        serial_console_driver.disabled = true;
+    }
+    spin_unlock(&write_lock);
+}
+
+closure_function(0, 1, void, attach_console,
+                 struct console_driver *, d)
+{
+    attach_console_driver(d);
 }
 
 void init_console(kernel_heaps kh)
@@ -54,9 +280,32 @@ void init_console(kernel_heaps kh)
     netconsole_register(kh, a);
 }
 
+/* console_sync in the root keeps user program output unbuffered */
+static void config_console_buffers(tuple root)
+{
+    if (get(root, sym(console_sync)))
+        return;
+    heap h = heap_general(get_kernel_heaps());
+    console_buf *bufs = allocate_zero(h, present_processors * sizeof(console_buf));
+    if (bufs == INVALID_ADDRESS)
+        goto fail;
+    for (u32 i = 0; i < present_processors; i++) {
+        bufs[i] = allocate_zero(h, sizeof(struct console_buf));
+        if (bufs[i] == INVALID_ADDRESS)
+            goto fail;
+    }
+    console_bufs = bufs;
+    write_barrier();
+    console_nbufs = present_processors;
+    return;
+  fail:
+    msg_err("failed to allocate console buffers; output is unbuffered\n");
+}
+
 void config_console(tuple root)
 {
     buffer b;
+    config_console_buffers(root);
     vector v = vector_from_tuple(transient, get(root, sym(consoles)));
 
     if (v == 0)
@@ -72,6 +321,9 @@ void config_console(tuple root)
                 if (!buffer_compare_with_cstring(b, (*pd)->name))
                     continue;
                 (*pd)->disabled = op == '-';
+                /* don't leave output with nowhere to go */
+                if (*pd == console_preferred && op == '-')
+                    serial_console_driver.disabled = false;
                 if ((*pd)->config)
                     (*pd)->config(*pd, root);
                 break;
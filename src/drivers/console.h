@@ -1,11 +1,16 @@
 struct console_driver {
     void (*write)(void *d, const char *s, bytes count);
+    void (*flush)(void *d);     /* optional; ends a series of writes */
     void (*config)(void *d, tuple r);
     char *name;
     boolean disabled;
+    boolean preferred;          /* takes over from the serial port */
 };
 
 typedef closure_type(console_attach, void, struct console_driver *);
 
 void init_console(kernel_heaps kh);
+void attach_console_driver(struct console_driver *d);
 void config_console(tuple root);
+void console_write_async(const char *s, bytes count);
+void console_flush(void);
@@ -3,6 +3,23 @@
 #include "console.h"
 #include "netconsole.h"
 
+/* Writes are appended to a ring of preallocated datagrams, which a bottom
+   half sends once full; a partly filled datagram goes out after
+   FLUSH_DELAY, so that bursts of output share datagrams and writers don't
+   call into the network stack. Output that finds the ring full is
+   dropped and reported with the next datagram. */
+#define MAX_PAYLOAD 1472        /* 1500 byte MTU, less IPv4 and UDP headers */
+#define NBUFS 32                /* power of 2 */
+#define FLUSH_DELAY milliseconds(5)
+#define DEFAULT_IP "10.0.2.2"
+#define DEFAULT_PORT 4444
+
+declare_closure_struct(1, 0, void, netconsole_send,
+                       struct netconsole_driver *, nd);
+declare_closure_struct(1, 1, void, netconsole_flush_timer,
+                       struct netconsole_driver *, nd,
+                       u64, overruns);
+
 typedef struct netconsole_driver {
     struct console_driver c;
     heap h;
@@ -10,29 +27,171 @@ typedef struct netconsole_driver {
     ip_addr_t dst_ip;
     u16 port;
     boolean setup;
+
+    /* datagrams [tail, head) are ready to send; head is being filled */
+    struct spinlock lock;
+    struct spinlock send_lock;  /* serializes senders */
+    struct pbuf *bufs[NBUFS];
+    void *data[NBUFS];          /* payload of each pbuf before headers */
+    u16 len[NBUFS];
+    u32 head;
+    u32 tail;
+    timestamp fill_start;       /* when the head datagram was started */
+    u64 dropped;
+    u32 send_scheduled;
+    boolean timer_armed;
+    closure_struct(netconsole_send, send);
+    closure_struct(netconsole_flush_timer, flush_timer);
 } *netconsole_driver;
 
-#define MAX_PAYLOAD 512
-#define DEFAULT_IP "10.0.2.2"
-#define DEFAULT_PORT 4444
+static boolean netconsole_alloc_buf(netconsole_driver nd, int i)
+{
+    struct pbuf *pb = pbuf_alloc(PBUF_TRANSPORT, MAX_PAYLOAD, PBUF_RAM);
+    if (pb == 0) {
+        nd->bufs[i] = 0;
+        return false;
+    }
+    nd->data[i] = pb->payload;
+    write_barrier();
+    nd->bufs[i] = pb;
+    return true;
+}
+
+static void netconsole_schedule_send(netconsole_driver nd)
+{
+    if (!compare_and_swap_32(&nd->send_scheduled, 0, 1))
+        return;
+    u64 flags = irq_disable_save();
+    if (!enqueue(bhqueues[BH_PRIO_BACKGROUND], (thunk)&nd->send))
+        nd->send_scheduled = 0;     /* picked up by the next write */
+    irq_restore(flags);
+}
+
+/* called with nd->lock held; returns true if the sender has work */
+static boolean netconsole_put(netconsole_driver nd, const char *s, bytes count)
+{
+    boolean kick = false;
+    while (count > 0) {
+        int i = nd->head & (NBUFS - 1);
+        if (nd->head - nd->tail == NBUFS || !nd->bufs[i]) {
+            nd->dropped += count;
+            kick = true;
+            break;
+        }
+        if (nd->len[i] == 0)
+            nd->fill_start = now(CLOCK_ID_MONOTONIC);
+        bytes n = MIN(count, MAX_PAYLOAD - nd->len[i]);
+        runtime_memcpy(nd->data[i] + nd->len[i], s, n);
+        nd->len[i] += n;
+        s += n;
+        count -= n;
+        if (nd->len[i] == MAX_PAYLOAD) {
+            nd->head++;
+            kick = true;
+        }
+    }
+    return kick;
+}
 
 static void netconsole_write(void *_d, const char *s, bytes count)
 {
     netconsole_driver nd = _d;
     if (!nd->setup)
         return;
-    bytes off = 0;
-    while (count > 0) {
-        bytes len = MIN(count, MAX_PAYLOAD);
-        struct pbuf *pb = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-        if (pb == 0)
-            return;
-        runtime_memcpy(pb->payload, s + off, len);
+    u64 flags = spin_lock_irq(&nd->lock);
+    boolean kick = netconsole_put(nd, s, count);
+    spin_unlock_irq(&nd->lock, flags);
+    if (kick)
+        netconsole_schedule_send(nd);
+}
+
+/* Send the ready datagrams, first closing the one being filled if it is
+   due (or force is set). Pbufs still referenced by the stack, as when
+   queued for address resolution, are replaced. */
+static void netconsole_send_ready(netconsole_driver nd, boolean force)
+{
+    spin_lock(&nd->send_lock);
+
+    /* retry replacements that failed to allocate */
+    for (int i = 0; i < NBUFS; i++) {
+        if (!nd->bufs[i])
+            netconsole_alloc_buf(nd, i);
+    }
+
+    u64 flags = spin_lock_irq(&nd->lock);
+    int i = nd->head & (NBUFS - 1);
+    boolean pending = nd->bufs[i] && nd->len[i] > 0;
+    if (pending && (force || now(CLOCK_ID_MONOTONIC) - nd->fill_start >= FLUSH_DELAY)) {
+        nd->head++;
+        pending = false;
+    }
+    u32 head = nd->head;
+    u64 dropped = nd->dropped;
+    nd->dropped = 0;
+    spin_unlock_irq(&nd->lock, flags);
+
+    for (u32 tail = nd->tail; tail != head; tail++) {
+        i = tail & (NBUFS - 1);
+        struct pbuf *pb = nd->bufs[i];
+        pb->payload = nd->data[i];
+        pb->len = pb->tot_len = nd->len[i];
         udp_sendto(nd->pcb, pb, &nd->dst_ip, nd->port);
-        pbuf_free(pb);
-        count -= len;
-        off += len;
+        if (pb->ref > 1) {
+            pbuf_free(pb);
+            netconsole_alloc_buf(nd, i);
+        }
+        nd->len[i] = 0;
+        write_barrier();
+        nd->tail = tail + 1;
+    }
+    if (dropped) {
+        buffer b = little_stack_buffer(64);
+        bprintf(b, "[netconsole: %ld bytes dropped]\n", dropped);
+        struct pbuf *pb = pbuf_alloc(PBUF_TRANSPORT, buffer_length(b), PBUF_RAM);
+        if (pb) {
+            runtime_memcpy(pb->payload, buffer_ref(b, 0), buffer_length(b));
+            udp_sendto(nd->pcb, pb, &nd->dst_ip, nd->port);
+            pbuf_free(pb);
+        }
     }
+
+    if (pending && !force && !nd->timer_armed) {
+        nd->timer_armed = true;
+        kern_register_timer(CLOCK_ID_MONOTONIC, FLUSH_DELAY, false, 0,
+                            (timer_handler)&nd->flush_timer);
+    }
+    spin_unlock(&nd->send_lock);
+}
+
+define_closure_function(1, 0, void, netconsole_send,
+                        netconsole_driver, nd)
+{
+    netconsole_driver nd = bound(nd);
+    nd->send_scheduled = 0;
+    memory_barrier();
+    netconsole_send_ready(nd, false);
+}
+
+define_closure_function(1, 1, void, netconsole_flush_timer,
+                        netconsole_driver, nd,
+                        u64, overruns)
+{
+    netconsole_driver nd = bound(nd);
+    nd->timer_armed = false;
+    netconsole_schedule_send(nd);
+}
+
+/* End of a series of writes: leave the last datagram to fill for a while,
+   unless the machine is going down. */
+static void netconsole_flush(void *_d)
+{
+    netconsole_driver nd = _d;
+    if (!nd->setup)
+        return;
+    if (shutting_down)
+        netconsole_send_ready(nd, true);
+    else
+        netconsole_schedule_send(nd);
 }
 
 static void netconsole_config(void *_d, tuple r)
@@ -72,6 +231,13 @@ static void netconsole_config(void *_d, tuple r)
         return;
     }
     nd->port = (u16)port;
+
+    for (int i = 0; i < NBUFS; i++) {
+        if (!netconsole_alloc_buf(nd, i)) {
+            msg_err("failed to allocate buffers\n");
+            return;
+        }
+    }
     nd->setup = true;
 }
 
@@ -81,8 +247,13 @@ void netconsole_register(kernel_heaps kh, console_attach a)
     netconsole_driver nd = allocate_zero(h, sizeof(struct netconsole_driver));
     assert(nd != INVALID_ADDRESS);
     nd->c.write = netconsole_write;
+    nd->c.flush = netconsole_flush;
     nd->c.name = "net";
     nd->c.disabled = true;
     nd->c.config = netconsole_config;
+    spin_lock_init(&nd->lock);
+    spin_lock_init(&nd->send_lock);
+    init_closure(&nd->send, netconsole_send, nd);
+    init_closure(&nd->flush_timer, netconsole_flush_timer, nd);
     apply(a, &nd->c);
 }
@@ -34,8 +34,8 @@
 #define NVME_AQ_IDX     0   /* admin queue index */
 #define NVME_AQ_MSIX    0   /* admin queue MSI-X slot */
 
-#define NVME_IOQ_IDX    1   /* I/O queue index and identifier */
-#define NVME_IOQ_MSIX   1   /* I/O queue MSI-X slot */
+#define NVME_IOQ_IDX    1   /* first I/O queue index and identifier */
+#define NVME_IOQ_MSIX   1   /* first I/O queue MSI-X slot */
 
 /* command Dword 0 */
 #define NVME_CID(id)    ((id) << 16)
@@ -85,6 +85,19 @@
 #define CNS_NVM_SET_LIST        4
 #define NVME_IDENTIFY_RESP_SIZE 4096
 
+/* Feature identifiers */
+#define NVME_FEAT_NUM_QUEUES    0x07
+#define NVME_FEAT_INT_COALESCE  0x08
+#define NVME_FEAT_INT_VEC_CFG   0x09
+#define NVME_INT_VEC_CD         (1 << 16)   /* coalescing disable */
+
+/* Identify Controller: Optional NVM Command Support */
+#define NVME_ONCS_DSM           (1 << 2)
+#define NVME_ONCS_WRITE_Z       (1 << 3)
+
+/* Identify Controller: Volatile Write Cache present */
+#define NVME_VWC_PRESENT        (1 << 0)
+
 /* NVM command set opcodes */
 #define NVME_OPC_FLUSH      0x00
 #define NVME_OPC_WRITE      0x01
@@ -99,6 +112,15 @@
 #define NVME_OPC_RSV_ACQ    0x11
 #define NVME_OPC_RSV_REL    0x15
 
+/* Read/Write command dword 12 */
+#define NVME_RW_FUA         (1 << 30)   /* force unit access */
+
+/* Dataset Management */
+#define NVME_DSM_AD         (1 << 2)    /* attribute: deallocate */
+
+#define NVME_DSM_MAX_BLOCKS     0xFFFFFFFFull
+#define NVME_WRITE_Z_MAX_BLOCKS U64_FROM_BIT(16)
+
 #define NVME_ASQ_ORDER  1
 #define NVME_ACQ_ORDER  1
 
@@ -164,9 +186,26 @@ typedef struct nvme_cq {
 declare_closure_struct(1, 0, void, nvme_admin_irq,
                        struct nvme *, n);
 declare_closure_struct(1, 0, void, nvme_io_irq,
-                       struct nvme *, n);
+                       struct nvme_ioq *, q);
 declare_closure_struct(1, 0, void, nvme_bh_service,
-                       struct nvme *, n);
+                       struct nvme_ioq *, q);
+
+/* An I/O submission/completion queue pair, with its own command IDs, request
+ * lists and interrupt vector; CPUs submit to the queue pair they map to. */
+typedef struct nvme_ioq {
+    struct nvme *n;
+    int idx;    /* queue identifier */
+    struct nvme_sq sq;
+    struct nvme_cq cq;
+    closure_struct(nvme_io_irq, irq);
+    struct list pending_reqs, free_reqs, done_reqs;
+    vector cmds;
+    struct list free_cmds;
+    closure_struct(nvme_bh_service, bh_service);
+    struct spinlock lock;
+    u64 inflight;       /* commands submitted and not yet completed */
+    timestamp latency;  /* moving average of request completion latency */
+} *nvme_ioq;
 
 typedef struct nvme {
     heap general, contiguous;
@@ -178,26 +217,48 @@ typedef struct nvme {
     struct nvme_cq acq; /* admin completion queue */
     closure_struct(nvme_admin_irq, admin_irq);
     thunk ac_handler;   /* admin completion handler */
+    int msix_count;
     int ioq_order;     /* I/O queue size */
-    struct nvme_sq iosq;    /* I/O submission queue */
-    struct nvme_cq iocq;    /* I/O completion queue */
-    closure_struct(nvme_io_irq, io_irq);
-    struct list pending_reqs, free_reqs, done_reqs;
-    vector cmds;
-    struct list free_cmds;
-    closure_struct(nvme_bh_service, bh_service);
-    struct spinlock lock;
+    int ioq_count;     /* number of I/O queue pairs */
+    nvme_ioq ioqs;
+    u16 oncs;               /* optional NVM commands supported */
+    boolean vwc;            /* volatile write cache present */
+    boolean admin_idle;     /* no admin command chain in progress */
+    u64 config_gen;         /* nvme_config generation last applied */
 } *nvme;
 
+/* Settings from the root tuple, common to all controllers:
+ *   nvme_poll: maximum time (in microseconds) a submitting cpu spins waiting
+ *     for completions before leaving them to the interrupt path; the window is
+ *     adapted to the observed completion latency of each queue.
+ *   nvme_coalescing: (time:<100-microsecond units> threshold:<completions>)
+ *     interrupt coalescing, enabled on every I/O queue vector. */
+static struct {
+    struct spinlock lock;
+    vector controllers;
+    timestamp poll_max;
+    u32 coalescing;     /* Interrupt Coalescing feature value */
+    u64 gen;            /* incremented on each coalescing change */
+} nvme_config;
+
+struct nvme_dsm_range {
+    u32 attributes;
+    u32 nlb;
+    u64 slba;
+} __attribute__((packed, aligned(16)));
+
 typedef struct nvme_ioreq {
     struct list l;
     u32 namespace;
-    boolean write;
+    u8 opc;
+    u32 rw_flags;       /* dword 12 flags of read and write commands */
     void *buf;
     range blocks;
     u64 pending_cmds;
     status_handler sh;
     int sc;
+    timestamp start;
+    struct nvme_dsm_range dsm;  /* Dataset Management range (a single one) */
 } *nvme_ioreq;
 
 typedef struct nvme_iocmd {
@@ -284,38 +345,38 @@ static inline void nvme_cq_doorbell(nvme n, int q_idx, nvme_cq q)
     pci_bar_write_4(&n->bar, cqhdbl, q->head);
 }
 
-static nvme_ioreq nvme_get_ioreq(nvme n)
+static nvme_ioreq nvme_get_ioreq(nvme_ioq q)
 {
     nvme_ioreq req;
-    spin_lock(&n->lock);
-    list l = list_get_next(&n->free_reqs);
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list l = list_get_next(&q->free_reqs);
     if (l) {
         list_delete(l);
         req = struct_from_list(l, nvme_ioreq, l);
     } else {
         nvme_debug("new request allocation");
-        req = allocate(n->general, sizeof(*req));
+        req = allocate(q->n->general, sizeof(*req));
     }
-    spin_unlock(&n->lock);
+    spin_unlock_irq(&q->lock, irqflags);
     return req;
 }
 
-/* Called with the lock held. */
-static nvme_iocmd nvme_get_iocmd(nvme n, boolean allocate)
+/* Called with the queue lock held. */
+static nvme_iocmd nvme_get_iocmd(nvme_ioq q, boolean allocate)
 {
-    list l = list_get_next(&n->free_cmds);
+    list l = list_get_next(&q->free_cmds);
     if (l) {
         list_delete(l);
         return struct_from_list(l, nvme_iocmd, l);
-    } else if (allocate && (vector_length(n->cmds) <= NVME_CID_MAX)) {
+    } else if (allocate && (vector_length(q->cmds) <= NVME_CID_MAX)) {
         nvme_debug("new command allocation");
-        nvme_iocmd cmd = allocate(n->general, sizeof(*cmd));
+        nvme_iocmd cmd = allocate(q->n->general, sizeof(*cmd));
         if (cmd == INVALID_ADDRESS) {
             nvme_debug("command allocation failed");
             return cmd;
         }
-        cmd->id = vector_length(n->cmds);
-        vector_push(n->cmds, cmd);
+        cmd->id = vector_length(q->cmds);
+        vector_push(q->cmds, cmd);
         return cmd;
     } else {
         nvme_debug("no available commands");
@@ -323,126 +384,290 @@ static nvme_iocmd nvme_get_iocmd(nvme n, boolean allocate)
     }
 }
 
-/* Called with the lock held. */
-static void nvme_service_pending(nvme n, boolean allocate)
+/* Called with the queue lock held. */
+static void nvme_service_pending(nvme_ioq q, boolean allocate)
 {
     boolean new_reqs = false;
     list l;
-    while ((l = list_get_next(&n->pending_reqs))) {
-        nvme_iocmd cmd = nvme_get_iocmd(n, allocate);
+    while ((l = list_get_next(&q->pending_reqs))) {
+        nvme_iocmd cmd = nvme_get_iocmd(q, allocate);
         if (cmd == INVALID_ADDRESS)
             break;
-        struct nvme_sqe *sqe = nvme_get_sqe(&n->iosq);
+        struct nvme_sqe *sqe = nvme_get_sqe(&q->sq);
         if (!sqe) {
-            list_insert_before(list_begin(&n->free_cmds), &cmd->l);
+            list_insert_before(list_begin(&q->free_cmds), &cmd->l);
             break;
         }
         new_reqs = true;
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
-        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP |
-                (req->write ? NVME_OPC_WRITE : NVME_OPC_READ);
+        zero(sqe, sizeof(*sqe));
+        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP | req->opc;
         sqe->nsid = req->namespace;
-        u64 buf_start = physical_from_virtual(req->buf);
         u64 nlb = range_span(req->blocks);
-        u64 buf_end = buf_start + nlb * SECTOR_SIZE;
-        sqe->dptr.prp1 = buf_start;
-        if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
-            sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
-            if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
-                nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
-                req->buf += nlb * SECTOR_SIZE;
+        switch (req->opc) {
+        case NVME_OPC_DS_MGMT:
+            /* the whole request, which is limited to a single range */
+            req->dsm.attributes = 0;
+            req->dsm.nlb = nlb;
+            req->dsm.slba = req->blocks.start;
+            sqe->dptr.prp1 = physical_from_virtual(&req->dsm);
+            sqe->cdw10 = 0;     /* number of ranges, minus one */
+            sqe->cdw11 = NVME_DSM_AD;
+            break;
+        case NVME_OPC_WRITE_Z:
+            nlb = MIN(nlb, NVME_WRITE_Z_MAX_BLOCKS);
+            break;
+        case NVME_OPC_FLUSH:
+            break;
+        default: {
+            u64 buf_start = physical_from_virtual(req->buf);
+            u64 buf_end = buf_start + nlb * SECTOR_SIZE;
+            sqe->dptr.prp1 = buf_start;
+            if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
+                sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
+                if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
+                    nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
+                    req->buf += nlb * SECTOR_SIZE;
+                }
             }
         }
+        }
         if (nlb == range_span(req->blocks))
             list_delete(l);
-        nvme_debug("request sectors [0x%x, 0x%x), cmd ID 0x%0x",
-                   req->blocks.start, req->blocks.start + nlb, cmd->id);
-        sqe->cdw10 = req->blocks.start;
-        sqe->cdw12 = nlb - 1;
+        nvme_debug("request sectors [0x%x, 0x%x), opcode 0x%x, queue %d, cmd ID 0x%0x",
+                   req->blocks.start, req->blocks.start + nlb, req->opc, q->idx, cmd->id);
+        if ((req->opc != NVME_OPC_DS_MGMT) && (req->opc != NVME_OPC_FLUSH)) {
+            sqe->cdw10 = req->blocks.start;
+            sqe->cdw11 = req->blocks.start >> 32;
+            sqe->cdw12 = req->rw_flags | (nlb - 1);
+        }
         cmd->req = req;
         req->pending_cmds++;
+        q->inflight++;
         req->blocks.start += nlb;
         new_reqs = true;
     }
     if (new_reqs)
-        nvme_sq_doorbell(n, NVME_IOQ_IDX, &n->iosq);
+        nvme_sq_doorbell(q->n, q->idx, &q->sq);
 }
 
-closure_function(3, 3, void, nvme_io,
-                 nvme, n, u32, namespace, boolean, write,
-                 void *, buf, range, blocks, status_handler, sh)
+static inline boolean nvme_cq_pending(nvme_cq q)
 {
-    nvme n = bound(n);
-    u32 namespace = bound(namespace);
-    boolean write = bound(write);
-    nvme_debug("[%d] %s %R", namespace, write ? "write" : "read", blocks);
-    nvme_ioreq req = nvme_get_ioreq(n);
+    return NVME_PHASE_TAG(*(volatile u32 *)&q->ring[q->head].dw3) != q->phase;
+}
+
+/* Called with the queue lock held. */
+static void nvme_ioq_service_cq(nvme_ioq q)
+{
+    boolean done_empty = list_empty(&q->done_reqs);
+    struct nvme_cqe *cqe = nvme_get_cqe(&q->cq);
+    if (!cqe)
+        return;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    do {
+        q->sq.head = NVME_SQ_HEAD(cqe->dw2);
+        nvme_iocmd cmd = vector_get(q->cmds, NVME_CMD_ID(cqe->dw3));
+        nvme_debug("  cmd ID 0x%0x complete", cmd->id);
+        nvme_ioreq req = cmd->req;
+        list_insert_before(list_begin(&q->free_cmds), &cmd->l);
+        int sc = NVME_STATUS_CODE(cqe->dw3);
+        u64 remaining = range_span(req->blocks);
+        if ((sc != NVME_SC_OK) && (remaining != 0))
+            list_delete(&req->l);   /* remove from pending list */
+        if (sc != NVME_SC_OK)
+            req->sc = sc;
+        q->inflight--;
+        boolean req_complete = !(--req->pending_cmds) && (!remaining || (sc != NVME_SC_OK));
+        if (req_complete) {
+            timestamp latency = t - req->start;
+            q->latency = q->latency ? (7 * q->latency + latency) / 8 : latency;
+            list_push_back(&q->done_reqs, &req->l);
+        }
+    } while ((cqe = nvme_get_cqe(&q->cq)));
+    nvme_cq_doorbell(q->n, q->idx, &q->cq);
+    nvme_service_pending(q, false);
+    if (done_empty && !list_empty(&q->done_reqs))
+        enqueue(bhqueue, &q->bh_service);
+}
+
+define_closure_function(1, 0, void, nvme_io_irq,
+                        nvme_ioq, q)
+{
+    nvme_ioq q = bound(q);
+    nvme_debug("%s: queue %d", __func__, q->idx);
+    spin_lock(&q->lock);
+    nvme_ioq_service_cq(q);
+    spin_unlock(&q->lock);
+}
+
+/* Spin on the completion queue until nothing is in flight or the deadline
+ * passes; whatever is still outstanding completes through the interrupt. */
+static void nvme_ioq_poll(nvme_ioq q, timestamp deadline)
+{
+    do {
+        if (nvme_cq_pending(&q->cq)) {
+            u64 irqflags = spin_lock_irq(&q->lock);
+            nvme_ioq_service_cq(q);
+            boolean idle = (q->inflight == 0);
+            spin_unlock_irq(&q->lock, irqflags);
+            if (idle)
+                return;
+        }
+        kern_pause();
+    } while (now(CLOCK_ID_MONOTONIC_RAW) < deadline);
+}
+
+static void nvme_submit(nvme n, u32 namespace, u8 opc, u32 rw_flags, void *buf, range blocks,
+                        status_handler sh)
+{
+    nvme_debug("[%d] opcode 0x%x %R", namespace, opc, blocks);
+    nvme_ioq q = &n->ioqs[current_cpu()->id % n->ioq_count];
+    nvme_ioreq req = nvme_get_ioreq(q);
     if (req == INVALID_ADDRESS) {
         apply(sh, timm("result", "request allocation failed"));
         return;
     }
     req->namespace = namespace;
-    req->write = write;
+    req->opc = opc;
+    req->rw_flags = rw_flags;
     req->buf = buf;
     req->blocks = blocks;
     req->pending_cmds = 0;
     req->sh = sh;
     req->sc = NVME_SC_OK;
-    u64 irqflags = spin_lock_irq(&n->lock);
-    list_push_back(&n->pending_reqs, &req->l);
-    nvme_service_pending(n, true);
-    spin_unlock_irq(&n->lock, irqflags);
+    timestamp start = now(CLOCK_ID_MONOTONIC_RAW);
+    req->start = start;
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list_push_back(&q->pending_reqs, &req->l);
+    nvme_service_pending(q, true);
+    spin_unlock_irq(&q->lock, irqflags);
+
+    /* Hybrid polling: only worth it while completions typically arrive within
+     * the configured window; spin for about twice the average latency. */
+    timestamp poll_max = nvme_config.poll_max;
+    if (poll_max && q->latency && (q->latency <= poll_max))
+        nvme_ioq_poll(q, start + MIN(poll_max, 2 * q->latency));
 }
 
-define_closure_function(1, 0, void, nvme_io_irq,
-                        nvme, n)
+closure_function(4, 3, void, nvme_io,
+                 nvme, n, u32, namespace, boolean, write, u32, rw_flags,
+                 void *, buf, range, blocks, status_handler, sh)
+{
+    nvme_submit(bound(n), bound(namespace), bound(write) ? NVME_OPC_WRITE : NVME_OPC_READ,
+                bound(rw_flags), buf, blocks, sh);
+}
+
+closure_function(2, 1, void, nvme_flush,
+                 nvme, n, u32, namespace,
+                 status_handler, sh)
+{
+    nvme_submit(bound(n), bound(namespace), NVME_OPC_FLUSH, 0, 0, irange(0, 0), sh);
+}
+
+/* Dataset Management (deallocate) or Write Zeroes */
+closure_function(3, 2, void, nvme_range_op,
+                 nvme, n, u32, namespace, int, opc,
+                 range, blocks, status_handler, sh)
 {
-    nvme_debug("%s", __func__);
     nvme n = bound(n);
-    spin_lock(&n->lock);
-    boolean done_empty = list_empty(&n->done_reqs);
-    struct nvme_cqe *cqe;
-    while ((cqe = nvme_get_cqe(&n->iocq))) {
-        n->iosq.head = NVME_SQ_HEAD(cqe->dw2);
-        nvme_iocmd cmd = vector_get(n->cmds, NVME_CMD_ID(cqe->dw3));
-        nvme_debug("  cmd ID 0x%0x complete", cmd->id);
-        nvme_ioreq req = cmd->req;
-        list_insert_before(list_begin(&n->free_cmds), &cmd->l);
-        int sc = NVME_STATUS_CODE(cqe->dw3);
-        u64 remaining = range_span(req->blocks);
-        if ((sc != NVME_SC_OK) && (remaining != 0))
-            list_delete(&req->l);   /* remove from pending list */
-        if (sc != NVME_SC_OK)
-            req->sc = sc;
-        boolean req_complete = !(--req->pending_cmds) && (!remaining || (sc != NVME_SC_OK));
-        if (req_complete)
-            list_push_back(&n->done_reqs, &req->l);
+    int opc = bound(opc);
+    if (opc == NVME_OPC_DS_MGMT && range_span(blocks) > NVME_DSM_MAX_BLOCKS) {
+        merge m = allocate_merge(n->general, sh);
+        sh = apply_merge(m);
+        while (range_span(blocks) > NVME_DSM_MAX_BLOCKS) {
+            nvme_submit(n, bound(namespace), opc, 0, 0,
+                        irangel(blocks.start, NVME_DSM_MAX_BLOCKS), apply_merge(m));
+            blocks.start += NVME_DSM_MAX_BLOCKS;
+        }
+        nvme_submit(n, bound(namespace), opc, 0, 0, blocks, apply_merge(m));
+        apply(sh, STATUS_OK);
+        return;
     }
-    nvme_cq_doorbell(n, NVME_IOQ_IDX, &n->iocq);
-    nvme_service_pending(n, false);
-    if (done_empty && !list_empty(&n->done_reqs))
-        enqueue(bhqueue, &n->bh_service);
-    spin_unlock(&n->lock);
+    nvme_submit(n, bound(namespace), opc, 0, 0, blocks, sh);
 }
 
 define_closure_function(1, 0, void, nvme_bh_service,
-                        nvme, n)
+                        nvme_ioq, q)
 {
-    nvme_debug("%s", __func__);
-    nvme n = bound(n);
+    nvme_ioq q = bound(q);
+    nvme_debug("%s: queue %d", __func__, q->idx);
     list l;
-    u64 irqflags = spin_lock_irq(&n->lock);
-    while ((l = list_get_next(&n->done_reqs))) {
+    u64 irqflags = spin_lock_irq(&q->lock);
+    while ((l = list_get_next(&q->done_reqs))) {
         list_delete(l);
-        spin_unlock_irq(&n->lock, irqflags);
+        spin_unlock_irq(&q->lock, irqflags);
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
         apply(req->sh, (req->sc == NVME_SC_OK) ? STATUS_OK :
                 timm("result", "NVMe status code 0x%x", req->sc));
-        irqflags = spin_lock_irq(&n->lock);
-        list_insert_before(list_begin(&n->free_reqs), l);
+        irqflags = spin_lock_irq(&q->lock);
+        list_insert_before(list_begin(&q->free_reqs), l);
+    }
+    nvme_service_pending(q, true);
+    spin_unlock_irq(&q->lock, irqflags);
+}
+
+static void nvme_set_feature(nvme n, u32 fid, u32 value)
+{
+    struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
+    assert(cmd);
+    zero(cmd, sizeof(*cmd));
+    cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_SET_FEAT;
+    cmd->cdw10 = fid;
+    cmd->cdw11 = value;
+    nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
+}
+
+static void nvme_admin_done(nvme n);
+
+/* Sets the coalescing parameters, then enables (or disables) coalescing on
+ * each I/O queue vector in turn. */
+closure_function(3, 0, void, nvme_configure_resp,
+                 nvme, n, u32, coalescing, int, index)
+{
+    nvme n = bound(n);
+    struct nvme_cqe *cqe = nvme_get_cqe(&n->acq);
+    if (!cqe)
+        return;
+    n->asq.head = NVME_SQ_HEAD(cqe->dw2);
+    int sc = NVME_STATUS_CODE(cqe->dw3);
+    nvme_cq_doorbell(n, NVME_AQ_IDX, &n->acq);
+    if (sc != NVME_SC_OK)
+        msg_err("failed to configure interrupt coalescing: status code 0x%x\n", sc);
+    int index = bound(index)++;
+    if (index < n->ioq_count) {
+        u32 cd = bound(coalescing) ? 0 : NVME_INT_VEC_CD;
+        nvme_set_feature(n, NVME_FEAT_INT_VEC_CFG, cd | (NVME_IOQ_MSIX + index));
+        return;
+    }
+    closure_finish();
+    nvme_admin_done(n);
+}
+
+/* Called with nvme_config.lock held and the admin queue idle. */
+static boolean nvme_configure(nvme n)
+{
+    u32 coalescing = nvme_config.coalescing;
+    n->ac_handler = closure(n->general, nvme_configure_resp, n, coalescing, 0);
+    if (n->ac_handler == INVALID_ADDRESS) {
+        msg_err("failed to allocate completion handler\n");
+        return false;
     }
-    nvme_service_pending(n, true);
-    spin_unlock_irq(&n->lock, irqflags);
+    nvme_debug("setting interrupt coalescing 0x%x", coalescing);
+    n->config_gen = nvme_config.gen;
+    n->admin_idle = false;
+    nvme_set_feature(n, NVME_FEAT_INT_COALESCE, coalescing);
+    return true;
+}
+
+/* Called when an admin command sequence has completed; applies any settings
+ * that changed in the meantime. */
+static void nvme_admin_done(nvme n)
+{
+    u64 irqflags = spin_lock_irq(&nvme_config.lock);
+    n->admin_idle = true;
+    if (n->config_gen != nvme_config.gen)
+        nvme_configure(n);
+    spin_unlock_irq(&nvme_config.lock, irqflags);
 }
 
 closure_function(4, 0, void, nvme_ns_attach,
@@ -451,15 +676,35 @@ closure_function(4, 0, void, nvme_ns_attach,
     nvme n = bound(n);
     u32 ns_id = bound(ns_id);
     u64 disk_size = bound(disk_size);
-    block_io r = closure(n->general, nvme_io, n, ns_id, false);
+    block_io r = closure(n->general, nvme_io, n, ns_id, false, 0);
     if (r == INVALID_ADDRESS) {
         msg_err("failed to allocate read closure\n");
         goto done;
     }
-    block_io w = closure(n->general, nvme_io, n, ns_id, true);
+    block_io w = closure(n->general, nvme_io, n, ns_id, true, 0);
     if (w != INVALID_ADDRESS) {
-        nvme_debug("attaching disk (NS ID %d, capacity %ld bytes)", ns_id, disk_size);
-        apply(bound(a), r, w, disk_size);
+        storage_ops ops = 0;
+        if ((n->oncs & (NVME_ONCS_DSM | NVME_ONCS_WRITE_Z)) || n->vwc) {
+            ops = allocate_zero(n->general, sizeof(*ops));
+            if (ops == INVALID_ADDRESS) {
+                ops = 0;
+            } else {
+                if (n->oncs & NVME_ONCS_DSM)
+                    ops->discard = closure(n->general, nvme_range_op, n, ns_id,
+                                           NVME_OPC_DS_MGMT);
+                if (n->oncs & NVME_ONCS_WRITE_Z)
+                    ops->write_zeroes = closure(n->general, nvme_range_op, n, ns_id,
+                                                NVME_OPC_WRITE_Z);
+                /* without a volatile write cache, completed writes are durable */
+                if (n->vwc) {
+                    ops->flush = closure(n->general, nvme_flush, n, ns_id);
+                    ops->write_fua = closure(n->general, nvme_io, n, ns_id, true, NVME_RW_FUA);
+                }
+            }
+        }
+        nvme_debug("attaching disk (NS ID %d, capacity %ld bytes, ONCS 0x%x, VWC %d)", ns_id,
+                   disk_size, n->oncs, n->vwc);
+        apply(bound(a), r, w, ops, disk_size);
     } else {
         msg_err("failed to allocate write closure\n");
         deallocate_closure(r);
@@ -524,6 +769,7 @@ static void nvme_ns_query_next(nvme n, u32 ns_id, u32 nn, void *ns_resp)
     } else {
         deallocate(n->contiguous, ns_resp, NVME_IDENTIFY_RESP_SIZE);
         deallocate_closure(n->ac_handler);
+        nvme_admin_done(n);
     }
 }
 
@@ -562,6 +808,7 @@ static void nvme_ns_query_next_active(nvme n, u32 *ns_list, int index, void *ns_
         deallocate(n->contiguous, ns_list, NVME_IDENTIFY_RESP_SIZE);
         deallocate(n->contiguous, ns_resp, NVME_IDENTIFY_RESP_SIZE);
         deallocate_closure(n->ac_handler);
+        nvme_admin_done(n);
     }
 }
 
@@ -579,6 +826,8 @@ closure_function(5, 0, void, nvme_ns_query_resp_active,
     }
 }
 
+static boolean nvme_get_active_namespaces(nvme n, u32 start_id, storage_attach a);
+
 closure_function(3, 0, void, nvme_identify_controller_resp,
                  nvme, n, void *, resp, storage_attach, a)
 {
@@ -594,7 +843,14 @@ closure_function(3, 0, void, nvme_identify_controller_resp,
             goto error;
         }
         u32 nn = *(u32 *)(resp + 516);  /* number of namespaces */
-        nvme_debug("controller reports %d namespace(s)", nn);
+        n->oncs = *(u16 *)(resp + 520);
+        n->vwc = (*(u8 *)(resp + 525) & NVME_VWC_PRESENT) != 0;
+        nvme_debug("controller reports %d namespace(s), ONCS 0x%x, VWC %d", nn, n->oncs, n->vwc);
+        if (n->vs >= NVME_VER(1, 1, 0)) {
+            deallocate(n->contiguous, resp, NVME_IDENTIFY_RESP_SIZE);
+            nvme_get_active_namespaces(n, 0, bound(a));
+            goto done;
+        }
         n->ac_handler = closure(n->general, nvme_ns_query_resp, n, 1, nn, resp, bound(a));
         if (n->ac_handler != INVALID_ADDRESS) {
             nvme_ns_query_next(n, 1, nn, resp);
@@ -691,10 +947,36 @@ static boolean nvme_get_active_namespaces(nvme n, u32 start_id, storage_attach a
     return true;
 }
 
-closure_function(2, 0, void, nvme_create_iosq_resp,
-                 nvme, n, storage_attach, a)
+static boolean nvme_create_iocq(nvme n, nvme_ioq q, storage_attach a);
+
+/* Called once no more I/O queue pairs are to be created; count is the number
+ * of pairs that were set up successfully. */
+static void nvme_ioqs_ready(nvme n, int count, storage_attach a)
+{
+    if (count == 0) {
+        msg_err("no I/O queues available\n");
+        return;
+    }
+    if (count < n->ioq_count) {
+        msg_err("continuing with %d I/O queue(s)\n", count);
+        n->ioq_count = count;
+    }
+    nvme_debug("%d I/O queue pair(s) created", n->ioq_count);
+    nvme_identify_controller(n, a);
+}
+
+static void nvme_ioq_created(nvme n, nvme_ioq q, storage_attach a)
+{
+    int next = q - n->ioqs + 1;
+    if ((next == n->ioq_count) || !nvme_create_iocq(n, &n->ioqs[next], a))
+        nvme_ioqs_ready(n, next, a);
+}
+
+closure_function(3, 0, void, nvme_create_iosq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a)
 {
     nvme n = bound(n);
+    nvme_ioq q = bound(q);
     storage_attach a = bound(a);
     struct nvme_cqe *cqe = nvme_get_cqe(&n->acq);
     if (cqe) {
@@ -702,90 +984,169 @@ closure_function(2, 0, void, nvme_create_iosq_resp,
         int sc = NVME_STATUS_CODE(cqe->dw3);
         nvme_cq_doorbell(n, NVME_AQ_IDX, &n->acq);
         if (sc == NVME_SC_OK) {
-            nvme_debug("I/O SQ created");
-            if (n->vs >= NVME_VER(1, 1, 0))
-                nvme_get_active_namespaces(n, 0, a);
-            else
-                nvme_identify_controller(n, a);
+            nvme_debug("I/O SQ %d created", q->idx);
+            nvme_ioq_created(n, q, a);
         } else {
-            msg_err("failed to create I/O SQ: status code 0x%x\n", sc);
+            msg_err("failed to create I/O SQ %d: status code 0x%x\n", q->idx, sc);
+            nvme_ioqs_ready(n, q - n->ioqs, a);
         }
     }
     closure_finish();
 }
 
-static boolean nvme_create_iosq(nvme n, storage_attach a)
+static boolean nvme_create_iosq(nvme n, nvme_ioq q, storage_attach a)
 {
-    if (!nvme_init_sq(n, &n->iosq, n->ioq_order)) {
+    if (!nvme_init_sq(n, &q->sq, n->ioq_order)) {
         msg_err("failed to initialize queue\n");
         return false;
     }
-    n->ac_handler = closure(n->general, nvme_create_iosq_resp, n, a);
+    n->ac_handler = closure(n->general, nvme_create_iosq_resp, n, q, a);
     if (n->ac_handler == INVALID_ADDRESS) {
         msg_err("failed to allocate completion handler\n");
-        nvme_deinit_sq(n, &n->iosq);
+        nvme_deinit_sq(n, &q->sq);
         return false;
     }
 
     /* Zero out all submission queue entries, so that when submitting an entry
      * only used fields need to be set. This relies on the fact that all I/O
      * commands use the same set of fields. */
-    zero(n->iosq.ring, U64_FROM_BIT(n->iosq.order) * sizeof(struct nvme_sqe));
+    zero(q->sq.ring, U64_FROM_BIT(q->sq.order) * sizeof(struct nvme_sqe));
 
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
     assert(cmd);
     zero(cmd, sizeof(*cmd));
     cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_CRE_IOSQ;
-    cmd->dptr.prp1 = physical_from_virtual(n->iosq.ring);
-    cmd->cdw10 = (MASK(n->ioq_order) << 16) | NVME_IOQ_IDX; /* queue size and queue ID */
-    cmd->cdw11 = (NVME_IOQ_IDX << 16) | 0x01;  /* completion queue ID, physically contiguous */
+    cmd->dptr.prp1 = physical_from_virtual(q->sq.ring);
+    cmd->cdw10 = (MASK(n->ioq_order) << 16) | q->idx; /* queue size and queue ID */
+    cmd->cdw11 = (q->idx << 16) | 0x01;  /* completion queue ID, physically contiguous */
     nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
     return true;
 }
 
-closure_function(2, 0, void, nvme_create_iocq_resp,
-                 nvme, n, storage_attach, a)
+closure_function(3, 0, void, nvme_create_iocq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a)
 {
     nvme n = bound(n);
+    nvme_ioq q = bound(q);
+    storage_attach a = bound(a);
     struct nvme_cqe *cqe = nvme_get_cqe(&n->acq);
     if (cqe) {
         n->asq.head = NVME_SQ_HEAD(cqe->dw2);
         int sc = NVME_STATUS_CODE(cqe->dw3);
         nvme_cq_doorbell(n, NVME_AQ_IDX, &n->acq);
         if (sc == NVME_SC_OK) {
-            nvme_debug("I/O CQ created");
-            nvme_create_iosq(n, bound(a));
+            nvme_debug("I/O CQ %d created", q->idx);
+            if (!nvme_create_iosq(n, q, a))
+                nvme_ioqs_ready(n, q - n->ioqs, a);
         } else {
-            msg_err("failed to create I/O CQ: status code 0x%x\n", sc);
+            msg_err("failed to create I/O CQ %d: status code 0x%x\n", q->idx, sc);
+            nvme_ioqs_ready(n, q - n->ioqs, a);
         }
     }
     closure_finish();
 }
 
-static boolean nvme_create_iocq(nvme n, storage_attach a)
+static boolean nvme_create_iocq(nvme n, nvme_ioq q, storage_attach a)
 {
-    if (!nvme_init_cq(n, &n->iocq, n->ioq_order)) {
-        msg_err("failed to initialize queue\n");
+    int i = q - n->ioqs;
+    q->n = n;
+    q->idx = NVME_IOQ_IDX + i;
+    q->cmds = allocate_vector(n->general, U64_FROM_BIT(n->ioq_order));
+    if (q->cmds == INVALID_ADDRESS) {
+        msg_err("failed to allocate command vector\n");
         return false;
     }
-    n->ac_handler = closure(n->general, nvme_create_iocq_resp, n, a);
+    list_init(&q->pending_reqs);
+    list_init(&q->free_reqs);
+    list_init(&q->done_reqs);
+    list_init(&q->free_cmds);
+    spin_lock_init(&q->lock);
+    init_closure(&q->bh_service, nvme_bh_service, q);
+    if (!nvme_init_cq(n, &q->cq, n->ioq_order)) {
+        msg_err("failed to initialize queue\n");
+        goto free_cmds;
+    }
+    n->ac_handler = closure(n->general, nvme_create_iocq_resp, n, q, a);
     if (n->ac_handler == INVALID_ADDRESS) {
         msg_err("failed to allocate completion handler\n");
-        nvme_deinit_cq(n, &n->iocq);
-        return false;
+        goto deinit_cq;
     }
-    if (pci_setup_msix(n->d, NVME_IOQ_MSIX, init_closure(&n->io_irq, nvme_io_irq, n),
-                       "nvme I/O") == INVALID_PHYSICAL) {
+
+    /* Queue pair i takes its interrupts on cpu i, which is also (one of) the
+     * cpu(s) that submit to it. */
+    if (pci_setup_msix_cpu(n->d, NVME_IOQ_MSIX + i, init_closure(&q->irq, nvme_io_irq, q),
+                           "nvme I/O", i) == INVALID_PHYSICAL) {
         msg_err("failed to allocate MSI-X vector\n");
-        return false;
+        deallocate_closure(n->ac_handler);
+        goto deinit_cq;
     }
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
     assert(cmd);
     zero(cmd, sizeof(*cmd));
     cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_CRE_IOCQ;
-    cmd->dptr.prp1 = physical_from_virtual(n->iocq.ring);
-    cmd->cdw10 = (MASK(n->ioq_order) << 16) | NVME_IOQ_IDX; /* queue size and queue ID */
-    cmd->cdw11 = (NVME_IOQ_MSIX << 16) | 0x03;  /* interrupts enabled, physically contiguous */
+    cmd->dptr.prp1 = physical_from_virtual(q->cq.ring);
+    cmd->cdw10 = (MASK(n->ioq_order) << 16) | q->idx; /* queue size and queue ID */
+    cmd->cdw11 = ((NVME_IOQ_MSIX + i) << 16) | 0x03;  /* interrupts enabled, physically contiguous */
+    nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
+    return true;
+  deinit_cq:
+    nvme_deinit_cq(n, &q->cq);
+  free_cmds:
+    deallocate_vector(q->cmds);
+    return false;
+}
+
+closure_function(2, 0, void, nvme_set_num_queues_resp,
+                 nvme, n, storage_attach, a)
+{
+    nvme n = bound(n);
+    storage_attach a = bound(a);
+    struct nvme_cqe *cqe = nvme_get_cqe(&n->acq);
+    if (!cqe)
+        return;
+    n->asq.head = NVME_SQ_HEAD(cqe->dw2);
+    int sc = NVME_STATUS_CODE(cqe->dw3);
+    u32 dw0 = cqe->dw0;
+    nvme_cq_doorbell(n, NVME_AQ_IDX, &n->acq);
+    closure_finish();
+
+    /* This completes once the runloop is up, so the processor count is final
+     * by now. */
+    int count = MIN(total_processors, n->msix_count - NVME_IOQ_MSIX);
+    if (sc == NVME_SC_OK) {
+        int nsqa = (dw0 & 0xFFFF) + 1;
+        int ncqa = (dw0 >> 16) + 1;
+        count = MIN(count, MIN(nsqa, ncqa));
+    } else {
+        msg_err("failed to set number of queues: status code 0x%x\n", sc);
+        count = 1;
+    }
+    nvme_debug("using %d I/O queue pair(s)", count);
+    n->ioqs = allocate(n->general, count * sizeof(struct nvme_ioq));
+    if (n->ioqs == INVALID_ADDRESS) {
+        msg_err("failed to allocate I/O queues\n");
+        return;
+    }
+    n->ioq_count = count;
+    if (!nvme_create_iocq(n, n->ioqs, a))
+        nvme_ioqs_ready(n, 0, a);
+}
+
+/* Ask for one I/O queue pair per cpu; the controller may grant fewer. */
+static boolean nvme_set_num_queues(nvme n, storage_attach a)
+{
+    n->ac_handler = closure(n->general, nvme_set_num_queues_resp, n, a);
+    if (n->ac_handler == INVALID_ADDRESS) {
+        msg_err("failed to allocate completion handler\n");
+        return false;
+    }
+    u32 nq = MIN(MAX_CPUS, n->msix_count - NVME_IOQ_MSIX) - 1;  /* zero-based */
+    struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
+    assert(cmd);
+    zero(cmd, sizeof(*cmd));
+    cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_SET_FEAT;
+    cmd->cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd->cdw11 = (nq << 16) | nq;   /* completion and submission queues requested */
     nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
     return true;
 }
@@ -840,9 +1201,9 @@ closure_function(3, 1, boolean, nvme_probe,
         n->ioq_order--;
     nvme_debug("new controller (version %d.%d.%d), MQES %d, I/O queue order %d",
                NVME_VS_MJR(n->vs), NVME_VS_MNR(n->vs), NVME_VS_TER(n->vs), mqes, n->ioq_order);
-    n->cmds = allocate_vector(general, NVME_CID_MAX + 1);
-    if (n->cmds == INVALID_ADDRESS) {
-        msg_err("failed to allocate request vector\n");
+    n->msix_count = pci_get_msix_count(d);
+    if (n->msix_count <= NVME_IOQ_MSIX) {
+        msg_err("insufficient MSI-X vectors (%d)\n", n->msix_count);
         goto deinit_acq;
     }
     pci_bar_write_4(&n->bar, NVME_AQA, NVME_AQA_ACQS(U64_FROM_BIT(NVME_ACQ_ORDER)) |
@@ -859,7 +1220,7 @@ closure_function(3, 1, boolean, nvme_probe,
             kernel_delay(milliseconds(1 << retries));
         } else {
             msg_err("failed to enable controller\n");
-            goto free_cmds;
+            goto deinit_acq;
         }
     }
     n->d = d;
@@ -867,18 +1228,16 @@ closure_function(3, 1, boolean, nvme_probe,
     if (pci_setup_msix(d, NVME_AQ_MSIX, init_closure(&n->admin_irq, nvme_admin_irq, n),
                        "nvme admin") == INVALID_PHYSICAL) {
         msg_err("failed to allocate MSI-X vector\n");
-        goto free_cmds;
+        goto deinit_acq;
     }
-    list_init(&n->pending_reqs);
-    list_init(&n->free_reqs);
-    list_init(&n->done_reqs);
-    list_init(&n->free_cmds);
-    spin_lock_init(&n->lock);
-    init_closure(&n->bh_service, nvme_bh_service, n);
-    if (nvme_create_iocq(n, bound(a)))
+    n->admin_idle = false;
+    n->config_gen = 0;
+    if (nvme_set_num_queues(n, bound(a))) {
+        u64 irqflags = spin_lock_irq(&nvme_config.lock);
+        vector_push(nvme_config.controllers, n);
+        spin_unlock_irq(&nvme_config.lock, irqflags);
         return true;
-  free_cmds:
-    deallocate_vector(n->cmds);
+    }
   deinit_acq:
     nvme_deinit_cq(n, &n->acq);
   deinit_asq:
@@ -888,8 +1247,51 @@ closure_function(3, 1, boolean, nvme_probe,
     return false;
 }
 
+closure_function(0, 1, boolean, nvme_poll_notify,
+                 value, v)
+{
+    u64 usecs = 0;
+    if (v && (is_tuple(v) || !u64_from_value(v, &usecs))) {
+        msg_err("invalid nvme_poll value\n");
+        return false;
+    }
+    nvme_config.poll_max = microseconds(usecs);
+    return true;
+}
+
+closure_function(0, 1, boolean, nvme_coalescing_notify,
+                 value, v)
+{
+    u64 time = 0, threshold = 0;
+    if (v) {
+        if (!is_tuple(v) || (get(v, sym(time)) && !get_u64(v, sym(time), &time)) ||
+            (get(v, sym(threshold)) && !get_u64(v, sym(threshold), &threshold)) ||
+            (time > 0xFF) || (threshold > 0x100)) {
+            msg_err("invalid nvme_coalescing value\n");
+            return false;
+        }
+    }
+    u64 irqflags = spin_lock_irq(&nvme_config.lock);
+    /* the aggregation threshold is zero-based */
+    nvme_config.coalescing = (time || threshold) ?
+        (time << 8) | (threshold ? threshold - 1 : 0) : 0;
+    nvme_config.gen++;
+    nvme n;
+    vector_foreach(nvme_config.controllers, n) {
+        if (n->admin_idle)
+            nvme_configure(n);
+    }
+    spin_unlock_irq(&nvme_config.lock, irqflags);
+    return true;
+}
+
 void init_nvme(kernel_heaps kh, storage_attach a)
 {
     heap h = heap_locked(kh);
+    spin_lock_init(&nvme_config.lock);
+    nvme_config.controllers = allocate_vector(h, 1);
+    assert(nvme_config.controllers != INVALID_ADDRESS);
+    register_root_notify(sym(nvme_poll), closure(h, nvme_poll_notify));
+    register_root_notify(sym(nvme_coalescing), closure(h, nvme_coalescing_notify));
     register_pci_driver(closure(h, nvme_probe, h, a, heap_backed(kh)));
 }
@@ -1,21 +1,32 @@
 #include <runtime.h>
 #include <http.h>
 
-#define STATE_INIT 0
-#define STATE_START_LINE 1
-#define STATE_HEADER 2
-#define STATE_VALUE 3
-#define STATE_BODY 4
+/* The parser takes each line of the start line and headers whole, found
+   with memchr rather than byte by byte, and copies the body in runs as it
+   arrives, undoing chunked transfer encoding on the way. A connection may
+   carry any number of messages, including requests pipelined in one
+   buffer; each is handed to the value handler as soon as it is complete. */
+#define STATE_START_LINE    0
+#define STATE_HEADER        1
+#define STATE_BODY          2   /* content_length bytes left */
+#define STATE_CHUNK_SIZE    3
+#define STATE_CHUNK_DATA    4   /* content_length bytes left in the chunk */
+#define STATE_CHUNK_END     5   /* CRLF after the chunk data */
+#define STATE_TRAILER       6
+
+/* longest start line or header accepted */
+#define HTTP_LINE_MAX       (8 * KB)
 
 typedef struct http_parser {
     heap h;
     vector start_line;
     int state;
-    buffer word;
-    symbol s;
+    buffer line;
+    buffer content;
     tuple header;
     value_handler each;
     u64 content_length;
+    boolean chunked;
 } *http_parser;
 
 closure_function(3, 2, boolean, each_header,
@@ -90,12 +101,11 @@ static status send_http_headers(buffer_handler out, tuple t)
     return STATUS_OK;
 }
 
+static const char http_crlf[] = "\r\n";
+
 /* consumes c, c == 0 indicates terminate */
 status send_http_chunk(buffer_handler out, buffer c)
 {
-    if (c)
-        assert(!buffer_is_wrapped(c));
-
     status s = STATUS_OK;
     buffer d = allocate_buffer(transient, 32);
     int len = c ? buffer_length(c) : 0;
@@ -104,11 +114,17 @@ status send_http_chunk(buffer_handler out, buffer c)
     if (!is_ok(s))
         goto out_fail;
 
-    if (!c)
-        c = allocate_buffer(transient, 2);
-
-    bprintf(c, "\r\n");
-    s = apply(out, c);
+    /* the chunk goes out as it is, followed by a reference to the
+       terminating CRLF */
+    if (c) {
+        s = apply(out, c);
+        if (!is_ok(s))
+            goto out_fail;
+    }
+    buffer crlf = wrap_buffer(transient, (void *)http_crlf, sizeof(http_crlf) - 1);
+    if (crlf == INVALID_ADDRESS)
+        return timm("result", "%s: failed to allocate buffer", __func__);
+    s = apply(out, crlf);
     if (!is_ok(s))
         goto out_fail;
 
@@ -133,7 +149,6 @@ status send_http_chunked_response(buffer_handler out, tuple t)
 status send_http_response(buffer_handler out, tuple t, buffer c)
 {
     if (c) {
-        assert(!buffer_is_wrapped(c));
         set(t, sym(Content-Length), aprintf(transient, "%d", buffer_length(c)));
     }
 
@@ -155,11 +170,139 @@ status send_http_response(buffer_handler out, tuple t, buffer c)
 
 static void reset_parser(http_parser p)
 {
-    p->state = STATE_INIT;
+    p->state = STATE_START_LINE;
     p->header = allocate_tuple();
-    p->word = allocate_buffer(p->h, 10);
+    p->content = allocate_buffer(p->h, 0);
     p->start_line = allocate_vector(p->h, 3);
     p->content_length = 0;
+    p->chunked = false;
+}
+
+static void http_message_complete(http_parser p)
+{
+    // XXX change from vector to tuple
+    tuple start_line = allocate_tuple();
+    for (u64 i = 0; i < vector_length(p->start_line); i++) {
+        buffer a = vector_get(p->start_line, i);
+        set(start_line, intern_u64(i), a);
+    }
+    deallocate_vector(p->start_line);
+    set(p->header, sym(start_line), start_line);
+    set(p->header, sym(content), p->content);
+    apply(p->each, p->header);
+    reset_parser(p);
+}
+
+static boolean http_header_is(buffer name, const char *s)
+{
+    bytes len = runtime_strlen(s);
+    if (buffer_length(name) != len)
+        return false;
+    for (bytes i = 0; i < len; i++) {
+        char c = byte(name, i);
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        char d = s[i];
+        if (d >= 'A' && d <= 'Z')
+            d += 'a' - 'A';
+        if (c != d)
+            return false;
+    }
+    return true;
+}
+
+static void http_trim(buffer b)
+{
+    while (buffer_length(b) && (byte(b, 0) == ' ' || byte(b, 0) == '\t'))
+        buffer_consume(b, 1);
+    while (buffer_length(b) && (byte(b, buffer_length(b) - 1) == ' ' ||
+                                byte(b, buffer_length(b) - 1) == '\t'))
+        b->end--;
+}
+
+static void http_start_line(http_parser p, buffer line)
+{
+    while (buffer_length(line)) {
+        void *sp = runtime_memchr(buffer_ref(line, 0), ' ', buffer_length(line));
+        bytes len = sp ? sp - buffer_ref(line, 0) : buffer_length(line);
+        buffer w = allocate_buffer(p->h, len);
+        buffer_write(w, buffer_ref(line, 0), len);
+        vector_push(p->start_line, w);
+        buffer_consume(line, sp ? len + 1 : len);
+    }
+}
+
+/* A blank line ends the headers; the framing they declare decides what
+   follows. */
+static status http_header_line(http_parser p, buffer line)
+{
+    if (buffer_length(line) == 0) {
+        if (p->state == STATE_TRAILER)
+            http_message_complete(p);
+        else if (p->chunked)
+            p->state = STATE_CHUNK_SIZE;
+        else if (p->content_length)
+            p->state = STATE_BODY;
+        else
+            http_message_complete(p);
+        return STATUS_OK;
+    }
+    if (p->state == STATE_TRAILER)
+        return STATUS_OK;       /* trailers are dropped */
+    void *colon = runtime_memchr(buffer_ref(line, 0), ':', buffer_length(line));
+    if (!colon)
+        return timm("result", "http_recv: malformed header line");
+    bytes name_len = colon - buffer_ref(line, 0);
+    buffer name = alloca_wrap_buffer(buffer_ref(line, 0), name_len);
+    buffer_consume(line, name_len + 1);
+    http_trim(line);
+    buffer v = allocate_buffer(p->h, buffer_length(line));
+    buffer_write(v, buffer_ref(line, 0), buffer_length(line));
+    if (http_header_is(name, "Content-Length")) {
+        if (!parse_int(alloca_wrap(v), 10, &p->content_length))
+            msg_err("failed to parse content length\n");
+    } else if (http_header_is(name, "Transfer-Encoding") &&
+               buffer_length(v) >= 7 &&
+               http_header_is(alloca_wrap_buffer(buffer_ref(v, buffer_length(v) - 7), 7),
+                              "chunked")) {
+        p->chunked = true;
+    }
+    set(p->header, intern(name), v);
+    return STATUS_OK;
+}
+
+static status http_line(http_parser p, buffer line)
+{
+    /* tolerate bare LF line endings */
+    if (buffer_length(line) && byte(line, buffer_length(line) - 1) == '\r')
+        line->end--;
+    switch (p->state) {
+    case STATE_START_LINE:
+        if (buffer_length(line) == 0)
+            return STATUS_OK;   /* stray CRLF between messages */
+        http_start_line(p, line);
+        p->state = STATE_HEADER;
+        return STATUS_OK;
+    case STATE_CHUNK_SIZE: {
+        u64 size;     /* chunk extensions are ignored */
+        if (!parse_int(line, 16, &size))
+            return timm("result", "http_recv: malformed chunk size");
+        if (size == 0) {
+            p->state = STATE_TRAILER;
+        } else {
+            p->content_length = size;
+            p->state = STATE_CHUNK_DATA;
+        }
+        return STATUS_OK;
+    }
+    case STATE_CHUNK_END:
+        if (buffer_length(line))
+            return timm("result", "http_recv: malformed chunk");
+        p->state = STATE_CHUNK_SIZE;
+        return STATUS_OK;
+    default:
+        return http_header_line(p, line);
+    }
 }
 
 // we're going to patch the connection together by looking at the
@@ -170,87 +313,56 @@ closure_function(1, 1, status, http_recv,
                  buffer, b)
 {
     http_parser p = bound(p);
-    tuple start_line;
 
     /* content may be delimited by close rather than content length */
     if (!b) {
-        if (p->state == STATE_BODY)
-            goto content_finish;
-        if (p->state == STATE_INIT)
+        if (p->state == STATE_BODY) {
+            http_message_complete(p);
+            return STATUS_OK;
+        }
+        if (p->state == STATE_START_LINE && buffer_length(p->line) == 0)
             return STATUS_OK;   /* XXX teardown */
         return timm("result", "http_recv: connection closed before finished parsing (state %d)", p->state);
     }
-    
-    for (bytes i = b->start; i < b->end; i++) {
-        char x = ((unsigned char *)b->contents)[i];
-        switch (p->state) {
-        case STATE_INIT:
-            p->state = STATE_START_LINE;
-        case STATE_START_LINE:
-            switch (x){
-            case '\r':
-                p->state = STATE_HEADER;
-            case ' ':
-                vector_push(p->start_line, p->word);
-                p->word = allocate_buffer(p->h, 0);
-                break;
-            default:
-                push_u8(p->word, x);
-            }
-            break;
-            
-        case STATE_HEADER:
-            switch(x) {
-            case ' ':
-                p->state = STATE_VALUE;
-                p->s = intern(p->word);
-                buffer_clear(p->word);
-                break;
-            case '\r':
-                p->state = STATE_BODY;
-                break;
-            case '\n':
-            case ':':
-                break;
-            default:
-                push_u8(p->word, x);
-            }
-            break;
-            
-        case STATE_VALUE:
-            if (x == '\r') {
-                if (p->s == sym(Content-Length)) {
-                    if (!parse_int(p->word, 10, &p->content_length))
-                        msg_err("failed to parse content length\n");
-                }
-                set(p->header, p->s, p->word);
-                p->word = allocate_buffer(p->h, 0);                
-                p->state = STATE_HEADER;
-            } else {
-                push_u8(p->word, x);
+
+    struct buffer whole = { .wrapped = true };
+    while (buffer_length(b)) {
+        if (p->state == STATE_BODY || p->state == STATE_CHUNK_DATA) {
+            bytes n = MIN(buffer_length(b), p->content_length);
+            buffer_write(p->content, buffer_ref(b, 0), n);
+            buffer_consume(b, n);
+            p->content_length -= n;
+            if (p->content_length == 0) {
+                if (p->state == STATE_BODY)
+                    http_message_complete(p);
+                else
+                    p->state = STATE_CHUNK_END;
             }
-            break;
-            
-        case STATE_BODY:
-            push_u8(p->word, x);            
-            --p->content_length;
+            continue;
         }
-
-        if ((p->state == STATE_BODY) && (p->content_length == 0))
-            goto content_finish;
-    }
-
-  content_finish:
-    // XXX change from vector to tuple
-    start_line = allocate_tuple();
-    for (u64 i = 0; i < vector_length(p->start_line); i++) {
-        buffer a = vector_get(p->start_line, i);
-        set(start_line, intern_u64(i), a);
+        void *nl = runtime_memchr(buffer_ref(b, 0), '\n', buffer_length(b));
+        bytes n = nl ? nl - buffer_ref(b, 0) : buffer_length(b);
+        if (buffer_length(p->line) + n > HTTP_LINE_MAX)
+            return timm("result", "http_recv: line too long");
+        buffer line;
+        if (nl && buffer_length(p->line) == 0) {
+            /* the whole line is at hand */
+            whole.contents = buffer_ref(b, 0);
+            whole.start = 0;
+            whole.end = whole.length = n;
+            line = &whole;
+        } else {
+            buffer_write(p->line, buffer_ref(b, 0), n);
+            line = p->line;
+        }
+        buffer_consume(b, nl ? n + 1 : n);
+        if (!nl)
+            break;
+        status s = http_line(p, line);
+        buffer_clear(p->line);
+        if (!is_ok(s))
+            return s;
     }
-    set(p->header, sym(start_line), start_line);
-    set(p->header, sym(content), p->word);
-    apply(p->each, p->header);
-    reset_parser(p);
     return STATUS_OK;
 }
 
@@ -261,6 +373,7 @@ buffer_handler allocate_http_parser(heap h, value_handler each)
         return INVALID_ADDRESS;
     p->h = h;
     p->each = each;
+    p->line = allocate_buffer(h, 128);
     reset_parser(p);
     return closure(h, http_recv, p);
 }
@@ -14,6 +14,11 @@ typedef enum {
 typedef closure_type(http_response, void, tuple);
 
 buffer_handler allocate_http_parser(heap h, value_handler each);
+/* Buffers passed to the functions below are consumed by the handler. The
+   direct TCP connections send them by reference, releasing each once its
+   data has been acknowledged, so a wrapped buffer - e.g. of static or
+   cached data - must wrap memory that stays valid until then. */
+
 // just format the buffer?
 status http_request(heap h, buffer_handler bh, http_method method,
                     tuple headers, buffer body);
@@ -53,7 +53,7 @@
 #define VMBUS_CHAN_POLLHZ_MIN		100	/* 10ms interval */
 #define VMBUS_CHAN_POLLHZ_MAX		1000000	/* 1us interval */
 
-#define MAXCPU      1
+#define MAXCPU      MAX_CPUS
 
 /*
  * GPA stuffs.
@@ -139,6 +139,10 @@ typedef void	(*vmbus_chan_callback_t)(struct vmbus_channel *, void *);
  * other values		Failed.  The memory passed through 'br' is no longer
  *			connected.  Callers are free to do anything with the
  *			memory passed through 'br'.
+ *
+ * The channel callback is queued to sched_queue; for bhqueue it is queued
+ * instead to the bottom half queue of the channel's cpu, which is also the
+ * cpu its interrupts are delivered to.
  */
 void		vmbus_chan_open(struct vmbus_channel *chan,
                                 int txbr_size, int rxbr_size, const void *udata, int udlen,
@@ -172,4 +176,6 @@ bool		vmbus_chan_is_revoked(const struct vmbus_channel *chan);
 int             vmbus_chan_prplist_nelem(int br_size, int prpcnt_max,
                     int dlen_max);
 void           vmbus_chan_poll_messages(struct vmbus_channel *chan);
+int            vmbus_subchan_get(struct vmbus_channel *pri_chan,
+                                 struct vmbus_channel **subchan, int subchan_cnt);
 #endif	/* !_VMBUS_H_ */
@@ -61,8 +61,8 @@ static int  hv_nv_destroy_send_buffer(netvsc_dev *net_dev);
 static void hv_nv_on_send_completion(struct hv_device *device,
                      struct vmbus_chanpkt_hdr *pkt);
 static void hv_nv_on_receive(struct hv_device *device,
-                 struct vmbus_chanpkt_hdr *pkt);
-static void hv_nv_send_receive_completion(struct hv_device *device,
+                 struct vmbus_channel *chan, struct vmbus_chanpkt_hdr *pkt);
+static void hv_nv_send_receive_completion(struct vmbus_channel *chan,
                       uint64_t tid);
 
 /*
@@ -530,18 +530,23 @@ hv_nv_connect_to_vsp(struct hv_device *device)
     net_dev = hv_nv_get_outbound_net_device(device);
 
     /*
-     * Negotiate the NVSP version.  Try NVSP v2 first.
+     * Negotiate the NVSP version, newest first.  Sub-channels need NVSP v5.
      */
-    nvsp_vers = NVSP_PROTOCOL_VERSION_2;
-    ret = hv_nv_negotiate_nvsp_protocol(device, net_dev, nvsp_vers);
-    if (ret != 0) {
-        /* NVSP v2 failed, try NVSP v1 */
-        nvsp_vers = NVSP_PROTOCOL_VERSION_1;
+    static const uint32_t nvsp_versions[] = {
+        NVSP_PROTOCOL_VERSION_5,
+        NVSP_PROTOCOL_VERSION_4,
+        NVSP_PROTOCOL_VERSION_2,
+        NVSP_PROTOCOL_VERSION_1,
+    };
+    for (int i = 0; i < _countof(nvsp_versions); i++) {
+        nvsp_vers = nvsp_versions[i];
         ret = hv_nv_negotiate_nvsp_protocol(device, net_dev, nvsp_vers);
-        if (ret != 0) {
-            /* NVSP v1 failed, return bad status */
-            return (ret);
-        }
+        if (ret == 0)
+            break;
+    }
+    if (ret != 0) {
+        /* NVSP v1 failed, return bad status */
+        return (ret);
     }
     net_dev->nvsp_version = nvsp_vers;
 
@@ -561,9 +566,13 @@ hv_nv_connect_to_vsp(struct hv_device *device)
     runtime_memset((u8 *)init_pkt, 0, sizeof(nvsp_msg));
 
     /*
-     * Updated to version 5.1, minimum, for VLAN per Haiyang
+     * Updated to version 5.1, minimum, for VLAN per Haiyang;
+     * RSS needs NDIS 6.30, which comes with NVSP v5
      */
-    ndis_version = NDIS_VERSION;
+    if (nvsp_vers >= NVSP_PROTOCOL_VERSION_5)
+        ndis_version = NDIS_VERSION_6_30;
+    else
+        ndis_version = NDIS_VERSION;
 
     init_pkt->hdr.msg_type = nvsp_msg_1_type_send_ndis_vers;
     init_pkt->msgs.vers_1_msgs.send_ndis_vers.ndis_major_vers =
@@ -635,6 +644,8 @@ hv_nv_on_device_add(struct hv_device *device, void *additional_info)
     vmbus_chan_open(device->channel,
         NETVSC_DEVICE_RING_BUFFER_SIZE, NETVSC_DEVICE_RING_BUFFER_SIZE,
         NULL, 0, hv_nv_on_channel_callback, device, runqueue);
+    net_dev->chans[0] = device->channel;
+    net_dev->num_chans = 1;
     /*
      * Connect with the NetVsp
      */
@@ -645,6 +656,61 @@ hv_nv_on_device_add(struct hv_device *device, void *additional_info)
     return (net_dev);
 }
 
+/*
+ * Net VSC open sub-channels
+ *
+ * Asks the VSP for nsubch sub-channels of the primary channel and opens
+ * those it offers.  Each channel has its own ring buffers and is drained
+ * by its own callback invocation; sends are spread over the channels by
+ * sending cpu, and the VSP spreads receives over them by RSS hash.
+ * Returns the number of sub-channels opened.
+ */
+int
+hv_nv_subchannels_open(struct hv_device *device, int nsubch)
+{
+    netvsc_dev *net_dev = hv_nv_get_outbound_net_device(device);
+    nvsp_msg *init_pkt;
+    int ret;
+
+    nsubch = MIN(nsubch, NETVSC_MAX_CHANNELS - 1);
+    if (net_dev->nvsp_version < NVSP_PROTOCOL_VERSION_5 || nsubch <= 0)
+        return (0);
+
+    init_pkt = &net_dev->channel_init_packet;
+    zero(init_pkt, sizeof(nvsp_msg));
+    init_pkt->hdr.msg_type = nvsp_msg_5_type_subchannel;
+    init_pkt->msgs.vers_5_msgs.subchannel_request.op = NVSP_SUBCHANNEL_ALLOCATE;
+    init_pkt->msgs.vers_5_msgs.subchannel_request.num_subchannels = nsubch;
+
+    hv_nv_prepare_wait_for_channel_message(net_dev);
+    ret = vmbus_chan_send(device->channel,
+        VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
+        init_pkt, sizeof(nvsp_msg), (uint64_t)init_pkt);
+    if (ret != 0)
+        return (0);
+
+    hv_nv_wait_for_channel_message(net_dev);
+
+    if (init_pkt->msgs.vers_5_msgs.subchannel_complete.status != nvsp_status_success) {
+        netvsc_debug("sub-channel allocation failed, status %d",
+            init_pkt->msgs.vers_5_msgs.subchannel_complete.status);
+        return (0);
+    }
+    nsubch = MIN(nsubch, init_pkt->msgs.vers_5_msgs.subchannel_complete.num_subchannels);
+
+    int n = vmbus_subchan_get(device->channel, &net_dev->chans[1], nsubch);
+    for (int i = 1; i <= n; i++) {
+        /* see hv_storvsc_create_subchannels() */
+        vmbus_chan_cpu_set(net_dev->chans[i], 0);
+        vmbus_chan_open(net_dev->chans[i],
+            NETVSC_DEVICE_RING_BUFFER_SIZE, NETVSC_DEVICE_RING_BUFFER_SIZE,
+            NULL, 0, hv_nv_on_channel_callback, device, runqueue);
+    }
+    net_dev->num_chans += n;
+    netvsc_debug("%d sub-channels opened", n);
+    return (n);
+}
+
 /*
  * Net VSC on send completion
  */
@@ -667,7 +733,9 @@ hv_nv_on_send_completion(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt
         || nvsp_msg_pkt->hdr.msg_type
             == nvsp_msg_1_type_send_rx_buf_complete
         || nvsp_msg_pkt->hdr.msg_type
-            == nvsp_msg_1_type_send_send_buf_complete) {
+            == nvsp_msg_1_type_send_send_buf_complete
+        || nvsp_msg_pkt->hdr.msg_type
+            == nvsp_msg_5_type_subchannel) {
         /* Copy the response back */
         runtime_memcpy(&net_dev->channel_init_packet, nvsp_msg_pkt,
             sizeof(nvsp_msg));
@@ -702,10 +770,16 @@ hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
     if (!net_dev)
         return (ENODEV);
 
+    /*
+     * Data goes out on the channel of the sending cpu; RNDIS control
+     * messages stay on the primary channel.
+     */
+    struct vmbus_channel *chan = device->channel;
     send_msg.hdr.msg_type = nvsp_msg_1_type_send_rndis_pkt;
     if (pkt->is_data_pkt) {
         /* 0 is RMC_DATA */
         send_msg.msgs.vers_1_msgs.send_rndis_pkt.chan_type = 0;
+        chan = net_dev->chans[current_cpu()->id % net_dev->num_chans];
     } else {
         /* 1 is RMC_CONTROL */
         send_msg.msgs.vers_1_msgs.send_rndis_pkt.chan_type = 1;
@@ -717,11 +791,11 @@ hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
     send_msg.msgs.vers_1_msgs.send_rndis_pkt.send_buf_section_size = 0;
 
     if (pkt->page_buf_count) {
-        ret = vmbus_chan_send_sglist(device->channel,
+        ret = vmbus_chan_send_sglist(chan,
             pkt->page_buffers, pkt->page_buf_count,
             &send_msg, sizeof(nvsp_msg), (uint64_t)pkt);
     } else {
-        ret = vmbus_chan_send(device->channel,
+        ret = vmbus_chan_send(chan,
             VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
             &send_msg, sizeof(nvsp_msg), (uint64_t)pkt);
     }
@@ -740,7 +814,8 @@ hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
  * with virtual addresses.
  */
 static void 
-hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
+hv_nv_on_receive(struct hv_device *device, struct vmbus_channel *chan,
+                 struct vmbus_chanpkt_hdr *pkt)
 {
     netvsc_dev *net_dev;
     struct vmbus_chanpkt_rxbuf *vm_xfer_page_pkt;
@@ -811,7 +886,7 @@ hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
         }
         spin_unlock_irq(&net_dev->rx_pkt_list_lock, flags);
 
-        hv_nv_send_receive_completion(device,
+        hv_nv_send_receive_completion(chan,
             vm_xfer_page_pkt->cp_hdr.cph_xactid);
 
         return;
@@ -837,6 +912,7 @@ hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
         net_vsc_pkt->xfer_page_pkt = xfer_page_pkt;
         net_vsc_pkt->compl.rx.rx_completion_context = net_vsc_pkt;
         net_vsc_pkt->device = device;
+        net_vsc_pkt->chan = chan;
         /* Save this so that we can send it back */
         net_vsc_pkt->compl.rx.rx_completion_tid =
             vm_xfer_page_pkt->cp_hdr.cph_xactid;
@@ -887,7 +963,7 @@ hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
  * Net VSC send receive completion
  */
 static void
-hv_nv_send_receive_completion(struct hv_device *device, uint64_t tid)
+hv_nv_send_receive_completion(struct vmbus_channel *chan, uint64_t tid)
 {
     nvsp_msg rx_comp_msg;
     int retries = 0;
@@ -901,7 +977,7 @@ hv_nv_send_receive_completion(struct hv_device *device, uint64_t tid)
 
 retry_send_cmplt:
     /* Send the completion */
-    ret = vmbus_chan_send(device->channel,
+    ret = vmbus_chan_send(chan,
         VMBUS_CHANPKT_TYPE_COMP, 0,
         &rx_comp_msg, sizeof(nvsp_msg), tid);
     if (ret == 0) {
@@ -964,14 +1040,14 @@ hv_nv_on_receive_completion(void *context)
 
     /* Send a receive completion for the xfer page packet */
     if (send_rx_completion)
-        hv_nv_send_receive_completion(device, tid);
+        hv_nv_send_receive_completion(packet->chan, tid);
 }
 
 /*
  * Net VSC on channel callback
  */
 static void
-hv_nv_on_channel_callback(struct vmbus_channel *context, void *hv_device)
+hv_nv_on_channel_callback(struct vmbus_channel *chan, void *hv_device)
 {
     /* Fixme:  Magic number */
     const int net_pkt_size = 2048;
@@ -989,7 +1065,7 @@ hv_nv_on_channel_callback(struct vmbus_channel *context, void *hv_device)
     do {
         struct vmbus_chanpkt_hdr *desc = (struct vmbus_chanpkt_hdr *)buffer;
         int bytes_rxed = bufferlen;
-        ret = vmbus_chan_recv_pkt(device->channel,
+        ret = vmbus_chan_recv_pkt(chan,
             desc, &bytes_rxed);
         if (ret == ENOBUFS) {
             /* Handle large packet */
@@ -1010,7 +1086,7 @@ hv_nv_on_channel_callback(struct vmbus_channel *context, void *hv_device)
             hv_nv_on_send_completion(device, desc);
             break;
         case VMBUS_CHANPKT_TYPE_RXBUF:
-            hv_nv_on_receive(device, desc);
+            hv_nv_on_receive(device, chan, desc);
             break;
         default:
             break;
@@ -50,8 +50,10 @@ typedef boolean boolean_t;
 
 #define NVSP_PROTOCOL_VERSION_1                 2
 #define NVSP_PROTOCOL_VERSION_2                 0x30002
+#define NVSP_PROTOCOL_VERSION_4                 0x40000
+#define NVSP_PROTOCOL_VERSION_5                 0x50000
 #define NVSP_MIN_PROTOCOL_VERSION               (NVSP_PROTOCOL_VERSION_1)
-#define NVSP_MAX_PROTOCOL_VERSION               (NVSP_PROTOCOL_VERSION_2)
+#define NVSP_MAX_PROTOCOL_VERSION               (NVSP_PROTOCOL_VERSION_5)
 
 #define NVSP_PROTOCOL_VERSION_CURRENT           NVSP_PROTOCOL_VERSION_2
 
@@ -126,6 +128,21 @@ typedef enum nvsp_msg_type_ {
 
 	nvsp_msg_2_type_alloc_chimney_handle,
 	nvsp_msg_2_type_alloc_chimney_handle_complete,
+
+	/*
+	 * Version 4 Messages
+	 */
+	nvsp_msg_4_type_send_vf_association,
+	nvsp_msg_4_type_switch_data_path,
+	nvsp_msg_4_type_uplink_connect_state_deprecated,
+
+	/*
+	 * Version 5 Messages
+	 */
+	nvsp_msg_5_type_oid_query_ex,
+	nvsp_msg_5_type_oid_query_ex_complete,
+	nvsp_msg_5_type_subchannel,
+	nvsp_msg_5_type_send_indirection_table,
 } nvsp_msg_type;
 
 typedef enum nvsp_status_ {
@@ -819,10 +836,33 @@ typedef union nvsp_2_msg_uber_ {
 } __packed nvsp_2_msg_uber;
 
 
+/*
+ * NvspMessage5TypeSubChannel: sent by the VSC to allocate sub-channels of
+ * the primary channel, and completed by the VSP with the number allocated.
+ */
+#define NVSP_SUBCHANNEL_ALLOCATE                1
+
+typedef struct nvsp_5_msg_subchannel_request_ {
+	uint32_t                                op;
+	uint32_t                                num_subchannels;
+} __packed nvsp_5_msg_subchannel_request;
+
+typedef struct nvsp_5_msg_subchannel_complete_ {
+	uint32_t                                status;
+	uint32_t                                num_subchannels;
+} __packed nvsp_5_msg_subchannel_complete;
+
+typedef union nvsp_5_msg_uber_ {
+	nvsp_5_msg_subchannel_request           subchannel_request;
+	nvsp_5_msg_subchannel_complete          subchannel_complete;
+} __packed nvsp_5_msg_uber;
+
+
 typedef union nvsp_all_msgs_ {
 	nvsp_msg_init_uber                      init_msgs;
 	nvsp_1_msg_uber                         vers_1_msgs;
 	nvsp_2_msg_uber                         vers_2_msgs;
+	nvsp_5_msg_uber                         vers_5_msgs;
 } __packed nvsp_all_msgs;
 
 /*
@@ -852,6 +892,9 @@ typedef struct nvsp_msg_ {
 
 #define NETVSC_RECEIVE_SG_COUNT			1
 
+/* Primary channel plus sub-channels */
+#define NETVSC_MAX_CHANNELS			16
+
 /* Preallocated receive packets */
 #define NETVSC_RECEIVE_PACKETLIST_COUNT		256
 
@@ -903,6 +946,10 @@ typedef struct netvsc_dev_ {
 	hv_bool_uint8_t				destroy;
 	/* Negotiated NVSP version */
 	uint32_t				nvsp_version;
+
+	/* Open channels; chans[0] is the primary channel */
+	struct vmbus_channel			*chans[NETVSC_MAX_CHANNELS];
+	int					num_chans;
 } netvsc_dev;
 
 
@@ -929,8 +976,12 @@ typedef struct netvsc_packet_ {
 	 */
 	struct list mylist_entry;
 	struct hv_device           *device;
+	/* Channel a received packet arrived on, to complete it there */
+	struct vmbus_channel       *chan;
 	hv_bool_uint8_t            is_data_pkt;      /* One byte */
 	uint16_t		   vlan_tci;
+	/* NDIS transmit checksum info; 0 if the checksum is complete */
+	uint32_t		   csum_info;
 	xfer_page_packet           *xfer_page_pkt;
 
 	/* Completion */
@@ -965,6 +1016,9 @@ typedef struct hn_softc {
 	struct hv_device       *hn_dev_obj;
 	netvsc_dev      *net_dev;
 
+	/* TCP checksums completed by the host */
+	boolean tx_csum;
+
 	/* lwIP */
 	struct netif *netif;
 	u16 rxbuflen;
@@ -988,5 +1042,6 @@ extern netvsc_dev *hv_nv_on_device_add(struct hv_device *device, void *additiona
 extern int  hv_nv_on_device_remove(struct hv_device *device,
 				   boolean_t destroy_channel);
 extern int  hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt);
+extern int  hv_nv_subchannels_open(struct hv_device *device, int nsubch);
 
 #endif  /* __HV_NET_VSC_H__ */
@@ -36,6 +36,7 @@
 #define NDIS_VERSION_5_0                        0x00050000
 #define NDIS_VERSION_5_1                        0x00050001
 #define NDIS_VERSION_6_0                        0x00060000
+#define NDIS_VERSION_6_30                       0x0006001e
 #define NDIS_VERSION                            (NDIS_VERSION_5_1)
 
 /*
@@ -187,6 +188,13 @@
 #define RNDIS_OID_GEN_GET_TIME_CAPS                     0x0002020F
 #define RNDIS_OID_GEN_GET_NETCARD_TIME                  0x00020210
 
+/*
+ * NDIS 6 receive side scaling and offload OIDs
+ */
+#define RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES        0x00010203
+#define RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS          0x00010204
+#define RNDIS_OID_TCP_OFFLOAD_PARAMETERS                0xFC01020C
+
 /*
  * These are connection-oriented general OIDs.
  * These replace the above OIDs for connection-oriented media.
@@ -585,6 +593,120 @@ typedef struct ndis_8021q_info_ {
 	} u1;
 } ndis_8021q_info;
 
+/*
+ * tcpip_chksum_info per-packet info of a transmitted packet
+ */
+#define NDIS_TXCSUM_INFO_IPV4                   0x00000001
+#define NDIS_TXCSUM_INFO_IPV6                   0x00000002
+#define NDIS_TXCSUM_INFO_TCPCS                  0x00000004
+#define NDIS_TXCSUM_INFO_UDPCS                  0x00000008
+#define NDIS_TXCSUM_INFO_IPCS                   0x00000010
+/* frame offset of the transport header */
+#define NDIS_TXCSUM_INFO_THOFF(off)             ((uint32_t)(off) << 16)
+
+/*
+ * Header of NDIS 6 objects passed in OID information buffers
+ */
+typedef struct ndis_object_header_ {
+    uint8_t                                 type;
+    uint8_t                                 revision;
+    uint16_t                                size;
+} ndis_object_header;
+
+#define NDIS_OBJTYPE_DEFAULT                    0x80
+#define NDIS_OBJTYPE_RSS_CAPS                   0x88
+#define NDIS_OBJTYPE_RSS_PARAMS                 0x89
+
+/*
+ * OID_GEN_RECEIVE_SCALE_CAPABILITIES
+ */
+typedef struct ndis_rss_caps_ {
+    ndis_object_header                      hdr;
+    uint32_t                                caps;
+    uint32_t                                num_msi;
+    uint32_t                                num_rx_queues;
+    /* NDIS 6.30 */
+    uint16_t                                num_indirection_entries;
+    uint16_t                                pad;
+} ndis_rss_caps;
+
+#define NDIS_RSS_CAPS_REV_2                     2
+#define NDIS_RSS_CAPS_SIZE_6_0                  offsetof(ndis_rss_caps *, num_indirection_entries)
+
+/*
+ * OID_GEN_RECEIVE_SCALE_PARAMETERS, with a Toeplitz key and an indirection
+ * table of channel indexes
+ */
+#define NDIS_RSS_PARAMS_REV_2                   2
+
+#define NDIS_HASH_FUNCTION_TOEPLITZ             0x00000001
+#define NDIS_HASH_IPV4                          0x00000100
+#define NDIS_HASH_TCP_IPV4                      0x00000200
+#define NDIS_HASH_IPV6                          0x00000400
+#define NDIS_HASH_TCP_IPV6                      0x00001000
+
+#define NDIS_HASH_KEYSIZE_TOEPLITZ              40
+#define NDIS_HASH_INDCNT                        128
+
+typedef struct ndis_rss_params_ {
+    ndis_object_header                      hdr;
+    uint16_t                                flags;
+    uint16_t                                base_cpu;
+    uint32_t                                hash_info;
+    uint16_t                                indirection_table_size;
+    uint32_t                                indirection_table_offset;
+    uint16_t                                hash_key_size;
+    uint32_t                                hash_key_offset;
+    /* NDIS 6.20 */
+    uint32_t                                processor_masks_offset;
+    uint32_t                                num_processor_masks;
+    uint32_t                                processor_masks_entry_size;
+} ndis_rss_params;
+
+typedef struct ndis_rss_params_toeplitz_ {
+    ndis_rss_params                         params;
+    uint8_t                                 key[NDIS_HASH_KEYSIZE_TOEPLITZ];
+    uint32_t                                indirection[NDIS_HASH_INDCNT];
+} ndis_rss_params_toeplitz;
+
+/*
+ * OID_TCP_OFFLOAD_PARAMETERS
+ */
+#define NDIS_OFFLOAD_PARAMS_REV_2               2   /* NDIS 6.1 */
+#define NDIS_OFFLOAD_PARAMS_REV_3               3   /* NDIS 6.30 */
+
+#define NDIS_OFFLOAD_PARAM_NOCHG                0
+#define NDIS_OFFLOAD_PARAM_OFF                  1
+#define NDIS_OFFLOAD_PARAM_TX                   2
+#define NDIS_OFFLOAD_PARAM_RX                   3
+#define NDIS_OFFLOAD_PARAM_TXRX                 4
+
+typedef struct ndis_offload_params_ {
+    ndis_object_header                      hdr;
+    uint8_t                                 ip4_csum;
+    uint8_t                                 tcp4_csum;
+    uint8_t                                 udp4_csum;
+    uint8_t                                 tcp6_csum;
+    uint8_t                                 udp6_csum;
+    uint8_t                                 lsov1;
+    uint8_t                                 ipsecv1;
+    uint8_t                                 lsov2_ip4;
+    uint8_t                                 lsov2_ip6;
+    uint8_t                                 tcp4_conn;
+    uint8_t                                 tcp6_conn;
+    uint32_t                                flags;
+    /* NDIS 6.1 */
+    uint8_t                                 ipsecv2;
+    uint8_t                                 ipsecv2_ip4;
+    /* NDIS 6.30 */
+    uint8_t                                 rsc_ip4;
+    uint8_t                                 rsc_ip6;
+    uint8_t                                 encap;
+    uint8_t                                 encap_types;
+} ndis_offload_params;
+
+#define NDIS_OFFLOAD_PARAMS_SIZE_6_1            offsetof(ndis_offload_params *, rsc_ip4)
+
 /*
  * Format of Information buffer passed in a SetRequest for the OID
  * OID_GEN_RNDIS_CONFIG_PARAMETER.
@@ -54,8 +54,11 @@ static void hv_rf_receive_indicate_status(rndis_device *device,
 static void hv_rf_receive_data(rndis_device *device, rndis_msg *message,
                    netvsc_packet *pkt);
 static int  hv_rf_query_device(rndis_device *device, uint32_t oid,
+                   void *input, uint32_t input_size,
                    void *result, uint32_t *result_size);
 static inline int hv_rf_query_device_mac(rndis_device *device);
+static int  hv_rf_set_device(rndis_device *device, uint32_t oid,
+                 void *data, uint32_t data_size);
 static int  hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter);
 static int  hv_rf_init_device(rndis_device *device);
 static int  hv_rf_open_device(rndis_device *device);
@@ -187,13 +190,25 @@ hv_rf_send_request(rndis_device *device, rndis_request *request,
 
     packet->is_data_pkt = false;
     packet->tot_data_buf_len = request->request_msg.msg_len;
-    packet->page_buf_count = 1;
+    packet->page_buf_count = 0;
 
-    packet->page_buffers[0].gpa_page =
-        hv_get_phys_addr(&request->request_msg) >> PAGELOG;
-    packet->page_buffers[0].gpa_len = request->request_msg.msg_len;
-    packet->page_buffers[0].gpa_ofs =
-        (unsigned long)&request->request_msg & (PAGESIZE - 1);
+    /*
+     * Large set requests carry their information buffer in request_ext
+     * and may straddle a page boundary; describe each page separately.
+     */
+    unsigned long va = (unsigned long)&request->request_msg;
+    uint32_t remain = request->request_msg.msg_len;
+    while (remain > 0) {
+        uint32_t ofs = va & (PAGESIZE - 1);
+        uint32_t len = MIN(remain, PAGESIZE - ofs);
+        assert(packet->page_buf_count < NETVSC_PACKET_MAXPAGE);
+        struct vmbus_gpa *gpa = &packet->page_buffers[packet->page_buf_count++];
+        gpa->gpa_page = hv_get_phys_addr((void *)va) >> PAGELOG;
+        gpa->gpa_ofs = ofs;
+        gpa->gpa_len = len;
+        va += len;
+        remain -= len;
+    }
 
     packet->compl.send.send_completion_context = request; /* packet */
     if (message_type != REMOTE_NDIS_HALT_MSG) {
@@ -396,8 +411,8 @@ hv_rf_on_receive(struct hv_device *device, netvsc_packet *pkt)
  * RNDIS filter query device
  */
 static int
-hv_rf_query_device(rndis_device *device, uint32_t oid, void *result,
-           uint32_t *result_size)
+hv_rf_query_device(rndis_device *device, uint32_t oid, void *input,
+           uint32_t input_size, void *result, uint32_t *result_size)
 {
     rndis_request *request;
     uint32_t in_result_size = *result_size;
@@ -406,8 +421,9 @@ hv_rf_query_device(rndis_device *device, uint32_t oid, void *result,
     int ret = 0;
 
     *result_size = 0;
+    assert(input_size <= sizeof(request->request_ext));
     request = hv_rndis_request(device, REMOTE_NDIS_QUERY_MSG,
-        RNDIS_MESSAGE_SIZE(rndis_query_request));
+        RNDIS_MESSAGE_SIZE(rndis_query_request) + input_size);
     if (request == NULL) {
         ret = -1;
         goto cleanup;
@@ -417,8 +433,10 @@ hv_rf_query_device(rndis_device *device, uint32_t oid, void *result,
     query = &request->request_msg.msg.query_request;
     query->oid = oid;
     query->info_buffer_offset = sizeof(rndis_query_request); 
-    query->info_buffer_length = 0;
+    query->info_buffer_length = input_size;
     query->device_vc_handle = 0;
+    if (input_size)
+        runtime_memcpy(query + 1, input, input_size);
 
     hv_request_prepare_wait(request);
     ret = hv_rf_send_request(device, request, REMOTE_NDIS_QUERY_MSG);
@@ -460,17 +478,18 @@ hv_rf_query_device_mac(rndis_device *device)
     uint32_t size = HW_MACADDR_LEN;
 
     return (hv_rf_query_device(device,
-        RNDIS_OID_802_3_PERMANENT_ADDRESS, device->hw_mac_addr, &size));
+        RNDIS_OID_802_3_PERMANENT_ADDRESS, NULL, 0, device->hw_mac_addr, &size));
 }
 
 /*
- * RNDIS filter set packet filter
- * Sends an rndis request with the new filter, then waits for a response
+ * RNDIS filter set device
+ * Sends an rndis set request for the given oid, then waits for a response
  * from the host.
  * Returns zero on success, non-zero on failure.
  */
 static int
-hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
+hv_rf_set_device(rndis_device *device, uint32_t oid, void *data,
+         uint32_t data_size)
 {
 
     rndis_request *request;
@@ -479,8 +498,9 @@ hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
     uint32_t status;
     int ret;
 
+    assert(data_size <= sizeof(request->request_ext));
     request = hv_rndis_request(device, REMOTE_NDIS_SET_MSG,
-        RNDIS_MESSAGE_SIZE(rndis_set_request) + sizeof(uint32_t));
+        RNDIS_MESSAGE_SIZE(rndis_set_request) + data_size);
     if (request == NULL) {
         ret = -1;
         goto cleanup;
@@ -488,12 +508,12 @@ hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
 
     /* Set up the rndis set */
     set = &request->request_msg.msg.set_request;
-    set->oid = RNDIS_OID_GEN_CURRENT_PACKET_FILTER;
-    set->info_buffer_length = sizeof(uint32_t);
+    set->oid = oid;
+    set->info_buffer_length = data_size;
     set->info_buffer_offset = sizeof(rndis_set_request); 
 
     runtime_memcpy((void *)((unsigned long)set + sizeof(rndis_set_request)),
-        &new_filter, sizeof(uint32_t));
+        data, data_size);
 
     hv_request_prepare_wait(request);
     ret = hv_rf_send_request(device, request, REMOTE_NDIS_SET_MSG);
@@ -522,6 +542,112 @@ cleanup:
     return (ret);
 }
 
+/*
+ * RNDIS filter set packet filter
+ */
+static int
+hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
+{
+    return (hv_rf_set_device(device, RNDIS_OID_GEN_CURRENT_PACKET_FILTER,
+        &new_filter, sizeof(uint32_t)));
+}
+
+/*
+ * RNDIS filter set offload
+ * Enables transmit TCP checksum offload; the host fills in the checksum of
+ * packets sent with a tcpip_chksum_info ppi.
+ */
+static int
+hv_rf_set_offload(rndis_device *device)
+{
+    netvsc_dev *net_dev = device->net_dev;
+    hn_softc_t *sc = net_dev->dev->device;
+    ndis_offload_params params;
+    int ret;
+
+    if (net_dev->nvsp_version < NVSP_PROTOCOL_VERSION_2)
+        return (0);
+
+    zero(&params, sizeof(params));
+    params.hdr.type = NDIS_OBJTYPE_DEFAULT;
+    if (net_dev->nvsp_version >= NVSP_PROTOCOL_VERSION_5) {
+        params.hdr.revision = NDIS_OFFLOAD_PARAMS_REV_3;
+        params.hdr.size = sizeof(params);
+    } else {
+        params.hdr.revision = NDIS_OFFLOAD_PARAMS_REV_2;
+        params.hdr.size = NDIS_OFFLOAD_PARAMS_SIZE_6_1;
+    }
+    params.tcp4_csum = NDIS_OFFLOAD_PARAM_TX;
+    params.tcp6_csum = NDIS_OFFLOAD_PARAM_TX;
+
+    ret = hv_rf_set_device(device, RNDIS_OID_TCP_OFFLOAD_PARAMETERS,
+        &params, params.hdr.size);
+    if (ret == 0)
+        sc->tx_csum = true;
+    hyperv_rndis_debug("tx checksum offload %s", ret == 0 ? "enabled" : "not available");
+    return (ret);
+}
+
+/*
+ * RNDIS filter set up receive side scaling
+ * Opens one sub-channel per additional processor (as far as the host
+ * allows) and spreads received flows over all channels with a Toeplitz
+ * hash of the IPv4/IPv6 TCP tuple.
+ */
+static int
+hv_rf_setup_rss(rndis_device *device)
+{
+    netvsc_dev *net_dev = device->net_dev;
+    ndis_rss_caps caps;
+    uint32_t caps_size = sizeof(caps);
+    int ret;
+
+    if (net_dev->nvsp_version < NVSP_PROTOCOL_VERSION_5 || present_processors < 2)
+        return (0);
+
+    zero(&caps, sizeof(caps));
+    caps.hdr.type = NDIS_OBJTYPE_RSS_CAPS;
+    caps.hdr.revision = NDIS_RSS_CAPS_REV_2;
+    caps.hdr.size = NDIS_RSS_CAPS_SIZE_6_0;
+    ret = hv_rf_query_device(device, RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES,
+        &caps, NDIS_RSS_CAPS_SIZE_6_0, &caps, &caps_size);
+    if (ret != 0 || caps_size < NDIS_RSS_CAPS_SIZE_6_0 || caps.num_rx_queues < 2) {
+        hyperv_rndis_debug("RSS not supported by host");
+        return (ret);
+    }
+
+    if (hv_nv_subchannels_open(net_dev->dev,
+                               MIN(caps.num_rx_queues, present_processors) - 1) == 0)
+        return (0);
+
+    hn_softc_t *sc = net_dev->dev->device;
+    ndis_rss_params_toeplitz *rss = allocate_zero(sc->general, sizeof(*rss));
+    assert(rss != INVALID_ADDRESS);
+    rss->params.hdr.type = NDIS_OBJTYPE_RSS_PARAMS;
+    rss->params.hdr.revision = NDIS_RSS_PARAMS_REV_2;
+    rss->params.hdr.size = sizeof(rss->params);
+    rss->params.hash_info = NDIS_HASH_FUNCTION_TOEPLITZ | NDIS_HASH_IPV4 |
+        NDIS_HASH_TCP_IPV4 | NDIS_HASH_IPV6 | NDIS_HASH_TCP_IPV6;
+    rss->params.indirection_table_size = sizeof(rss->indirection);
+    rss->params.indirection_table_offset =
+        offsetof(ndis_rss_params_toeplitz *, indirection);
+    rss->params.hash_key_size = sizeof(rss->key);
+    rss->params.hash_key_offset = offsetof(ndis_rss_params_toeplitz *, key);
+    for (int i = 0; i < sizeof(rss->key); i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(rss->key + i, &r, MIN(sizeof(u64), sizeof(rss->key) - i));
+    }
+    for (int i = 0; i < NDIS_HASH_INDCNT; i++)
+        rss->indirection[i] = i % net_dev->num_chans;
+
+    ret = hv_rf_set_device(device, RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS,
+        rss, sizeof(*rss));
+    deallocate(sc->general, rss, sizeof(*rss));
+    hyperv_rndis_debug("RSS over %d channels: %s", net_dev->num_chans,
+        ret == 0 ? "enabled" : "failed");
+    return (ret);
+}
+
 /*
  * RNDIS filter init device
  */
@@ -732,6 +858,10 @@ hv_rf_on_device_add(struct hv_device *dev, void *additl_info)
         /* TODO: shut down rndis device and the channel */
     }
 
+    /* Offloads and RSS are optional; failures leave them disabled */
+    hv_rf_set_offload(rndis_dev);
+    hv_rf_setup_rss(rndis_dev);
+
     struct netif *netif = (struct netif *)additl_info;
 
     runtime_memcpy(netif->hwaddr, rndis_dev->hw_mac_addr, sizeof(netif->hwaddr));
@@ -798,6 +928,7 @@ hv_rf_on_send(struct hv_device *device, netvsc_packet *pkt)
     rndis_per_packet_info *rppi;
     ndis_8021q_info       *rppi_vlan_info;
     uint32_t rndis_msg_size;
+    uint32_t ppi_size;
     int ret = 0;
 
     /* Add the rndis header */
@@ -808,10 +939,12 @@ hv_rf_on_send(struct hv_device *device, netvsc_packet *pkt)
     rndis_mesg = &filter_pkt->message;
     rndis_msg_size = RNDIS_MESSAGE_SIZE(rndis_packet);
 
-    if (pkt->vlan_tci != 0) {
-        rndis_msg_size += sizeof(rndis_per_packet_info) +
-            sizeof(ndis_8021q_info);
-    }
+    ppi_size = 0;
+    if (pkt->vlan_tci != 0)
+        ppi_size += sizeof(rndis_per_packet_info) + sizeof(ndis_8021q_info);
+    if (pkt->csum_info != 0)
+        ppi_size += sizeof(rndis_per_packet_info) + sizeof(uint32_t);
+    rndis_msg_size += ppi_size;
 
     rndis_mesg->ndis_msg_type = REMOTE_NDIS_PACKET_MSG;
     rndis_mesg->msg_len = pkt->tot_data_buf_len + rndis_msg_size;
@@ -834,23 +967,24 @@ hv_rf_on_send(struct hv_device *device, netvsc_packet *pkt)
     pkt->compl.send.on_send_completion = hv_rf_on_send_completion;
     pkt->compl.send.send_completion_context = filter_pkt;
 
+    if (ppi_size != 0) {
+        /* Move data offset past end of the rppi structs */
+        rndis_pkt->data_offset += ppi_size;
+
+        /* must be set when we have rppi */
+        rndis_pkt->per_pkt_info_offset = sizeof(rndis_packet);
+        rndis_pkt->per_pkt_info_length = ppi_size;
+    }
+
+    /* rppi immediately follows rndis_pkt */
+    rppi = (rndis_per_packet_info *)(rndis_pkt + 1);
+
     /*
      * If there is a VLAN tag, we need to set up some additional
      * fields so the Hyper-V infrastructure will stuff the VLAN tag
      * into the frame.
      */
     if (pkt->vlan_tci != 0) {
-        /* Move data offset past end of rppi + VLAN structs */
-        rndis_pkt->data_offset += sizeof(rndis_per_packet_info) +
-            sizeof(ndis_8021q_info);
-
-        /* must be set when we have rppi, VLAN info */
-        rndis_pkt->per_pkt_info_offset = sizeof(rndis_packet);
-        rndis_pkt->per_pkt_info_length = sizeof(rndis_per_packet_info) +
-            sizeof(ndis_8021q_info);
-
-        /* rppi immediately follows rndis_pkt */
-        rppi = (rndis_per_packet_info *)(rndis_pkt + 1);
         rppi->size = sizeof(rndis_per_packet_info) +
             sizeof(ndis_8021q_info);
         rppi->type = ieee_8021q_info;
@@ -860,6 +994,15 @@ hv_rf_on_send(struct hv_device *device, netvsc_packet *pkt)
         rppi_vlan_info = (ndis_8021q_info *)(rppi + 1);
         /* FreeBSD does not support CFI or priority */
         rppi_vlan_info->u1.s1.vlan_id = pkt->vlan_tci & 0xfff;
+        rppi = (rndis_per_packet_info *)(rppi_vlan_info + 1);
+    }
+
+    /* Ask the host to complete the transport checksum */
+    if (pkt->csum_info != 0) {
+        rppi->size = sizeof(rndis_per_packet_info) + sizeof(uint32_t);
+        rppi->type = tcpip_chksum_info;
+        rppi->per_packet_info_offset = sizeof(rndis_per_packet_info);
+        *(uint32_t *)(rppi + 1) = pkt->csum_info;
     }
 
     /*
@@ -73,6 +73,8 @@ typedef struct rndis_request_ {
 	struct vmbus_gpa		buffer;
 	/* Fixme:  We assumed a fixed size request here. */
 	rndis_msg			request_msg;
+	/* Room for information buffers that do not fit in request_msg */
+	uint8_t				request_ext[sizeof(ndis_rss_params_toeplitz)];
 	/* Fixme:  Poor man's semaphore. */
 	uint32_t			halt_complete_flag;
 } rndis_request;
@@ -97,6 +99,8 @@ typedef struct rndis_filter_packet_ {
 	pfn_on_send_rx_completion	on_completion;
 
 	rndis_msg			message;
+	/* Room for the per-packet info that follows the rndis_packet */
+	uint8_t				ppi_ext[2 * (sizeof(rndis_per_packet_info) + sizeof(uint32_t))];
 } rndis_filter_packet;
 
 
@@ -8,6 +8,7 @@
 #include <lwip/stats.h>
 #include <lwip/snmp.h>
 #include <lwip/etharp.h>
+#include <lwip/prot/ip.h>
 #include <netif/ethernet.h>
 #include "hv_net_vsc.h"
 #include "hv_rndis.h"
@@ -94,6 +95,60 @@ netvsc_xmit_completion(void *context)
     deallocate(packet->device->device->general, buf, NETVSC_NV_BUF_SIZE_NO_VLAN);
 }
 
+/*
+ * Seed the zeroed TCP checksum of an unfragmented, untagged IPv4 or IPv6
+ * (without extension headers) segment with its pseudo-header sum and return
+ * the tcpip_chksum_info asking the host to complete it, or 0 if the frame
+ * is not eligible. The headers of a TCP segment are always in its first
+ * pbuf.
+ */
+static uint32_t
+netvsc_tx_csum(uint8_t *frame, u64 len)
+{
+    if (len < SIZEOF_ETH_HDR)
+        return 0;
+    u16 type = ((struct eth_hdr *)frame)->type;
+    u64 off = SIZEOF_ETH_HDR;
+    uint8_t *ip = frame + off;
+    u16 *addrs;
+    int naddrs;
+    u64 l4len;
+    uint32_t info;
+    if (type == PP_HTONS(ETHTYPE_IP)) {
+        if (len < off + 20)
+            return 0;
+        u64 hlen = (ip[0] & 0xf) << 2;
+        u64 total = (ip[2] << 8) | ip[3];
+        if ((hlen < 20) || (total < hlen) || (ip[6] & 0x3f) || ip[7] || (ip[9] != IP_PROTO_TCP))
+            return 0;
+        l4len = total - hlen;
+        addrs = (u16 *)(ip + 12);
+        naddrs = 2 * sizeof(u32) / sizeof(u16);
+        off += hlen;
+        info = NDIS_TXCSUM_INFO_IPV4;
+    } else if (type == PP_HTONS(ETHTYPE_IPV6)) {
+        if ((len < off + 40) || (ip[6] != IP_PROTO_TCP))
+            return 0;
+        l4len = (ip[4] << 8) | ip[5];
+        addrs = (u16 *)(ip + 8);
+        naddrs = 2 * 16 / sizeof(u16);
+        off += 40;
+        info = NDIS_TXCSUM_INFO_IPV6;
+    } else {
+        return 0;
+    }
+    /* TCP checksum field is at offset 16 of the header */
+    if (off + 18 > len)
+        return 0;
+    u32 sum = lwip_htons(IP_PROTO_TCP) + lwip_htons(l4len);
+    for (int i = 0; i < naddrs; i++)
+        sum += addrs[i];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    *(u16 *)(frame + off + 16) = sum;
+    return info | NDIS_TXCSUM_INFO_TCPCS | NDIS_TXCSUM_INFO_THOFF(off);
+}
+
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
@@ -172,6 +227,8 @@ low_level_output(struct netif *netif, struct pbuf *p)
     }
 
     packet->device = hn->hn_dev_obj;
+    if (hn->tx_csum)
+        packet->csum_info = netvsc_tx_csum(p->payload, p->len);
 
     int retries = 0;
 retry_send:
@@ -237,6 +294,9 @@ vmxif_init(struct netif *netif)
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
+    hn_softc_t *hn = netif->state;
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL &
+                            ~(hn->tx_csum ? NETIF_CHECKSUM_GEN_TCP : 0));
 
     return ERR_OK;
 }
@@ -254,6 +314,7 @@ netvsc_attach(kernel_heaps kh, hv_device* device)
 
     hn->hn_dev_obj = device;
     device->device = hn;
+    hn->tx_csum = false;
 
     hn->rxbuflen = NETVSC_RX_MAXSEGSIZE;
     hn->rxbuffers = allocate_objcache(hn->general, hn->contiguous,
@@ -121,6 +121,9 @@ static u32 hv_storvsc_use_win8ext_flags = 1;
 #define HV_STORVSC_MAX_IO           512
 #define HV_STORVSC_RINGBUFFER_SIZE  (64 * PAGESIZE)
 
+/* primary channel plus sub-channels */
+#define STORVSC_MAX_CHANNELS        16
+
 #define STORVSC_MAX_IO                        \
     vmbus_chan_prplist_nelem(HV_STORVSC_RINGBUFFER_SIZE,    \
        STORVSC_DATA_SEGCNT_MAX, VSTOR_PKT_SIZE)
@@ -153,6 +156,8 @@ struct storvsc_softc {
     struct spinlock queue_lock;
 
     struct vmbus_channel        *hs_chan;
+    struct vmbus_channel        *hs_chans[STORVSC_MAX_CHANNELS];
+    int                         hs_nchans;
     struct list             hs_free_list;
     struct spinlock        hs_lock;
     struct storvsc_driver_props    *hs_drv_props;
@@ -264,6 +269,7 @@ static void hv_storvsc_on_channel_callback(struct vmbus_channel *chan, void *xsc
 static void hv_storvsc_on_iocompletion( struct storvsc_softc *sc,
                     struct vstor_packet *vstor_packet, struct hv_storvsc_request *request);
 static void hv_storvsc_connect_vsp(struct storvsc_softc *);
+static void hv_storvsc_create_subchannels(struct storvsc_softc *sc, int request_subch);
 static void storvsc_report_luns(struct storvsc_softc *sc, storage_attach a, u16 target);
 static void storvsc_test_unit_ready(struct storvsc_softc *sc, storage_attach a, u16 target, u16 lun, u16 retry_count);
 static void storvsc_action_io_queued(struct storvsc_softc *sc, struct storvsc_hcb *hcb,
@@ -326,6 +332,65 @@ static inline void hv_storvsc_wait_for_channel_message(struct hv_storvsc_request
     }
 }
 
+static void hv_storvsc_open_channel(struct storvsc_softc *sc, struct vmbus_channel *chan)
+{
+    struct vmstor_chan_props props;
+
+    zero(&props, sizeof(struct vmstor_chan_props));
+    vmbus_chan_open(
+        chan,
+        sc->hs_drv_props->drv_ringbuffer_size,
+        sc->hs_drv_props->drv_ringbuffer_size,
+        (void *)&props,
+        sizeof(struct vmstor_chan_props),
+        hv_storvsc_on_channel_callback, sc, bhqueue);
+}
+
+/**
+ * @brief request sub-channels from the host and open them
+ *
+ * Each channel has its own ring buffers and is serviced by the host
+ * independently; requests are spread over the channels by submitting CPU.
+ * Channel interrupts are delivered to CPU 0, where the VMBus synthetic
+ * interrupt controller is set up.
+ */
+static void hv_storvsc_create_subchannels(struct storvsc_softc *sc, int request_subch)
+{
+    if (request_subch <= 0)
+        return;
+    struct hv_storvsc_request *request = &sc->hs_init_req;
+    struct vstor_packet *vstor_packet = &request->vstor_packet;
+
+    zero(vstor_packet, sizeof(struct vstor_packet));
+    vstor_packet->operation = VSTOR_OPERATION_CREATE_MULTI_CHANNELS;
+    vstor_packet->flags = REQUEST_COMPLETION_FLAG;
+    vstor_packet->u.multi_channels_cnt = request_subch;
+
+    hv_storvsc_prepare_wait_for_message(request);
+    int ret = vmbus_chan_send(sc->hs_chan,
+        VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
+        vstor_packet, VSTOR_PKT_SIZE, (uint64_t)request);
+    if (ret != 0) {
+        storvsc_debug("failed to request %d sub-channels: %d", request_subch, ret);
+        return;
+    }
+
+    hv_storvsc_wait_for_channel_message(request);
+    if (vstor_packet->operation != VSTOR_OPERATION_COMPLETEIO ||
+        vstor_packet->status != 0) {
+        storvsc_debug("sub-channel creation failed, status 0x%x", vstor_packet->status);
+        return;
+    }
+
+    int n = vmbus_subchan_get(sc->hs_chan, &sc->hs_chans[1], request_subch);
+    for (int i = 1; i <= n; i++) {
+        vmbus_chan_cpu_set(sc->hs_chans[i], 0);
+        hv_storvsc_open_channel(sc, sc->hs_chans[i]);
+    }
+    sc->hs_nchans += n;
+    storvsc_debug("%d sub-channels opened", n);
+}
+
 /**
  * @brief initialize channel connection to parent partition
  *
@@ -417,9 +482,7 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
     assert(vstor_packet->status == 0);
 
 
-#ifdef STORVSC_DEBUG
     uint16_t max_subch = vstor_packet->u.chan_props.max_channel_cnt;
-    // we don't use subchannels but let's report these capabilities
     /* multi-channels feature is supported by WIN8 and above version */
     uint32_t version = vmbus_current_version;
     boolean support_multichannel = false;
@@ -430,7 +493,6 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
     }
 
     storvsc_debug("max chans %d%s", max_subch + 1, support_multichannel ? ", multi-chan capable" : "");
-#endif
     zero(vstor_packet, sizeof(struct vstor_packet));
     vstor_packet->operation = VSTOR_OPERATION_ENDINITIALIZATION;
     vstor_packet->flags = REQUEST_COMPLETION_FLAG;
@@ -445,6 +507,10 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
 
     assert(vstor_packet->operation == VSTOR_OPERATION_COMPLETEIO);
     assert(vstor_packet->status == 0);
+
+    if (support_multichannel && max_subch > 0)
+        hv_storvsc_create_subchannels(sc, MIN(max_subch, MIN(total_processors,
+                                                             STORVSC_MAX_CHANNELS) - 1));
 }
 
 /**
@@ -457,20 +523,12 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
  */
 static void hv_storvsc_connect_vsp(struct storvsc_softc *sc)
 {
-    struct vmstor_chan_props props;
-
-    zero(&props, sizeof(struct vmstor_chan_props));
-
     /*
      * Open the channel
      */
-    vmbus_chan_open(
-        sc->hs_chan,
-        sc->hs_drv_props->drv_ringbuffer_size,
-        sc->hs_drv_props->drv_ringbuffer_size,
-        (void *)&props,
-        sizeof(struct vmstor_chan_props),
-        hv_storvsc_on_channel_callback, sc, bhqueue);
+    hv_storvsc_open_channel(sc, sc->hs_chan);
+    sc->hs_chans[0] = sc->hs_chan;
+    sc->hs_nchans = 1;
 
     hv_storvsc_channel_init(sc);
 }
@@ -498,13 +556,14 @@ static int hv_storvsc_io_request(struct storvsc_softc *sc, struct hv_storvsc_req
 
     vstor_packet->operation = VSTOR_OPERATION_EXECUTESRB;
 
+    struct vmbus_channel *chan = sc->hs_chans[current_cpu()->id % sc->hs_nchans];
     int ret;
     if (request->prp_list.gpa_range.gpa_len) {
-        ret = vmbus_chan_send_prplist(sc->hs_chan,
+        ret = vmbus_chan_send_prplist(chan,
             &request->prp_list.gpa_range, request->prp_cnt,
             vstor_packet, VSTOR_PKT_SIZE, (uint64_t)request);
     } else {
-        ret = vmbus_chan_send(sc->hs_chan,
+        ret = vmbus_chan_send(chan,
             VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
             vstor_packet, VSTOR_PKT_SIZE, (uint64_t)request);
     }
@@ -614,7 +673,9 @@ static void storvsc_init_requests(struct storvsc_softc *sc)
 {
     list_init(&sc->hs_free_list);
 
-    for (int i = 0; i < sc->hs_drv_props->drv_max_ios_per_target; ++i) {
+    /* each channel has its own ring buffers to fill */
+    int nreqs = sc->hs_drv_props->drv_max_ios_per_target * sc->hs_nchans;
+    for (int i = 0; i < nreqs; ++i) {
         struct hv_storvsc_request *reqp = allocate(sc->general, sizeof(struct hv_storvsc_request));
         assert(reqp != INVALID_ADDRESS);
         reqp->softc = sc;
@@ -730,7 +791,7 @@ closure_function(5, 0, void, storvsc_read_capacity_done,
 
     block_io in = closure(s->general, storvsc_read, s);
     block_io out = closure(s->general, storvsc_write, s);
-    apply(bound(a), in, out, s->capacity);
+    apply(bound(a), in, out, 0, s->capacity);
   out:
     closure_finish();
 }
@@ -926,10 +987,10 @@ static status storvsc_attach(kernel_heaps kh, hv_device* device, storage_attach
 
     spin_lock_init(&sc->hs_lock); //hvslck
 
-    storvsc_init_requests(sc);
-
     hv_storvsc_connect_vsp(sc);
 
+    storvsc_init_requests(sc);
+
     // scan bus
     storvsc_report_luns(sc, a, 0);
 
@@ -210,6 +210,16 @@ closure_function(0, 0, timestamp, hyperv_clock_now)
     return nanoseconds(hyperv_info.hyperv_tc64() * HYPERV_TIMER_NS_FACTOR);
 }
 
+/* Secondary cpus enable their SynIC, which the event timer interrupt is
+   also delivered through, before their timer is set up. */
+closure_function(1, 0, void, hyperv_per_cpu_init,
+                 thunk, timer_init)
+{
+    if (hyperv_info.vmbus)
+        vmbus_percpu_init(hyperv_info.vmbus);
+    apply(bound(timer_init));
+}
+
 boolean
 hyperv_detect(kernel_heaps kh) {
     u32 v[4];
@@ -265,6 +275,7 @@ hyperv_detect(kernel_heaps kh) {
         halt("%s: no timer available\n", __func__);
     }
 
+    per_cpu_init = closure(hyperv_info.general, hyperv_per_cpu_init, per_cpu_init);
     register_platform_clock_timer(ct, per_cpu_init);
     list_init(&hyperv_info.vmbus_list);
     list_init(&hyperv_info.driver_list);
@@ -26,9 +26,11 @@ static const uint32_t       vmbus_version[] = {
     VMBUS_VERSION_WS2008
 };
 
+static void vmbus_chanmsg_choffer(vmbus_dev sc, const struct vmbus_message *msg);
+
 static const vmbus_chanmsg_proc_t
 vmbus_chanmsg_handlers[VMBUS_CHANMSG_TYPE_MAX] = {
-    VMBUS_CHANMSG_PROC_WAKEUP(CHOFFER),
+    VMBUS_CHANMSG_PROC(CHOFFER, vmbus_chanmsg_choffer),
     VMBUS_CHANMSG_PROC_WAKEUP(CHOFFER_DONE),
     VMBUS_CHANMSG_PROC_WAKEUP(CONNECT_RESP)
 };
@@ -102,7 +104,7 @@ vmbus_handle_intr1(vmbus_dev sc, int cpu)
 void
 vmbus_handle_intr(vmbus_dev dev)
 {
-    int cpu = 0;
+    int cpu = current_cpu()->id;
 
     /*
      * Disable preemption.
@@ -122,12 +124,24 @@ vmbus_handle_intr(vmbus_dev dev)
     irq_restore(flags);
 }
 
+/* Set up the SynIC of the current cpu: its message and event flags pages
+   and the SINTs for channel events and the event timer. */
 static void
 vmbus_synic_setup(vmbus_dev dev)
 {
-    int cpu = 0;
+    int cpu = current_cpu()->id;
     uint64_t val, orig, read_val;
     uint32_t sint;
+    u32 v[4];
+
+    /* vcpuids were assumed to follow cpu ids when channels were opened */
+    cpuid(CPUID_LEAF_HV_FEATURES, 0, v);
+    if (v[0] & CPUID_HV_MSR_VP_INDEX) {
+        u32 vcpuid = read_msr(MSR_HV_VP_INDEX);
+        if (vcpuid != VMBUS_PCPU_GET(dev, vcpuid, cpu))
+            msg_err("cpu %d has vp index %d; channel interrupts may be misrouted\n",
+                    cpu, vcpuid);
+    }
 
     /*
      * Setup the SynIC message.
@@ -356,11 +370,11 @@ again:
 }
 
 static void
-vmbus_msg_task(vmbus_dev sc, int num_messages)
+vmbus_msg_task(vmbus_dev sc, int cpu, int num_messages)
 {
     volatile struct vmbus_message *msg;
 
-    msg = VMBUS_PCPU_GET(sc, message, 0) + VMBUS_SINT_MESSAGE;
+    msg = VMBUS_PCPU_GET(sc, message, cpu) + VMBUS_SINT_MESSAGE;
     for (int i=0; !num_messages || i<num_messages; ++i) {
         if (msg->msg_type == HYPERV_MSGTYPE_NONE) {
             /* No message */
@@ -454,6 +468,23 @@ vmbus_init(vmbus_dev dev)
     return false;
 }
 
+static void
+vmbus_chanmsg_choffer(vmbus_dev sc, const struct vmbus_message *msg)
+{
+    const struct vmbus_chanmsg_choffer *offer = (const struct vmbus_chanmsg_choffer *)msg->msg_data;
+
+    /*
+     * Sub-channels are offered in response to a device-specific request
+     * sent on the primary channel, not to the channel request; attach
+     * them to their primary channel here.
+     */
+    if (offer->chm_subidx != 0) {
+        vmbus_chan_choffer_open_channel(sc, msg);
+        return;
+    }
+    vmbus_msghc_wakeup(sc, msg);
+}
+
 static void
 vmbus_chanmsg_handle(vmbus_dev sc, const struct vmbus_message *msg)
 {
@@ -474,25 +505,29 @@ vmbus_chanmsg_handle(vmbus_dev sc, const struct vmbus_message *msg)
     vmbus_chan_msgproc(sc, msg);
 }
 
-closure_function(1, 0, void, vmbus_msg_task_closure,
-                 vmbus_dev, sc)
+closure_function(2, 0, void, vmbus_msg_task_closure,
+                 vmbus_dev, sc, int, cpu)
 {
     vmbus_dev sc = bound(sc);
-    vmbus_msg_task(sc, 0);
+    vmbus_msg_task(sc, bound(cpu), 0);
 }
 
 static void
 vmbus_dma_alloc(struct vmbus_dev *dev)
 {
-    dev->vmbus_pcpu[0].message = allocate_zero(dev->contiguous, PAGESIZE);
-    assert(dev->vmbus_pcpu[0].message != INVALID_ADDRESS);
-    dev->vmbus_pcpu[0].message_dma.hv_paddr = physical_from_virtual(dev->vmbus_pcpu[0].message);
-    assert(dev->vmbus_pcpu[0].message_dma.hv_paddr != INVALID_PHYSICAL);
-
-    dev->vmbus_pcpu[0].event_flags = allocate_zero(dev->contiguous, PAGESIZE);
-    assert(dev->vmbus_pcpu[0].event_flags != INVALID_ADDRESS);
-    dev->vmbus_pcpu[0].event_flags_dma.hv_paddr = physical_from_virtual(dev->vmbus_pcpu[0].event_flags);
-    assert(dev->vmbus_pcpu[0].event_flags_dma.hv_paddr != INVALID_PHYSICAL);
+    /* each cpu's SynIC has its own message and event flags pages */
+    for (int cpu = 0; cpu < present_processors; cpu++) {
+        struct vmbus_pcpu_data *pd = &dev->vmbus_pcpu[cpu];
+        pd->message = allocate_zero(dev->contiguous, PAGESIZE);
+        assert(pd->message != INVALID_ADDRESS);
+        pd->message_dma.hv_paddr = physical_from_virtual(pd->message);
+        assert(pd->message_dma.hv_paddr != INVALID_PHYSICAL);
+
+        pd->event_flags = allocate_zero(dev->contiguous, PAGESIZE);
+        assert(pd->event_flags != INVALID_ADDRESS);
+        pd->event_flags_dma.hv_paddr = physical_from_virtual(pd->event_flags);
+        assert(pd->event_flags_dma.hv_paddr != INVALID_PHYSICAL);
+    }
 
     dev->vmbus_evtflags = allocate_zero(dev->contiguous, PAGESIZE);
     assert(dev->vmbus_evtflags != INVALID_ADDRESS);
@@ -522,7 +557,16 @@ void
 vmbus_poll_messages(vmbus_dev dev)
 {
     if (dev->poll_mode)
-        vmbus_msg_task(dev, 0);
+        vmbus_msg_task(dev, 0, 0);
+}
+
+/* Called on each secondary cpu as it starts. Events raised for the cpu's
+   channels before its SynIC was enabled are picked up here. */
+void
+vmbus_percpu_init(vmbus_dev dev)
+{
+    vmbus_synic_setup(dev);
+    vmbus_handle_intr(dev);
 }
 
 status
@@ -544,7 +588,13 @@ vmbus_attach(kernel_heaps kh, vmbus_dev *result)
     vmbus_xact_ctx_create(dev, HYPERCALL_POSTMSGIN_SIZE, VMBUS_MSG_SIZE,
         sizeof(struct vmbus_msghc));
 
-    dev->vmbus_pcpu[0].message_task = closure(dev->general, vmbus_msg_task_closure, dev);
+    /* Hyper-V numbers virtual processors in MADT order, as are cpus here;
+       this is checked against MSR_HV_VP_INDEX as each cpu starts */
+    for (int cpu = 0; cpu < present_processors; cpu++) {
+        dev->vmbus_pcpu[cpu].vcpuid = cpu;
+        dev->vmbus_pcpu[cpu].message_task = closure(dev->general, vmbus_msg_task_closure,
+                                                    dev, cpu);
+    }
 
     dev->vmbus_idtvec = allocate_interrupt();
     vmbus_debug("interrupt vector %d; registering", dev->vmbus_idtvec);
@@ -601,7 +651,7 @@ vmbus_probe_channels(vmbus_dev dev, const list driver_list, list nodes)
     /* Collect responses */
     while ( 1 ) {
         // poll only one choffer message
-        vmbus_msg_task(dev, 1);
+        vmbus_msg_task(dev, 0, 1);
         const struct vmbus_message *msg = vmbus_msghc_poll_first(dev, mh);
         if (msg == NULL) {
             kernel_delay(milliseconds(1));
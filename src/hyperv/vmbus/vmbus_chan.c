@@ -714,7 +714,10 @@ vmbus_event_flags_proc(vmbus_dev sc, volatile u64 *event_flags,
             if (chan->ch_flags & VMBUS_CHAN_FLAG_BATCHREAD)
                 vmbus_rxbr_intr_mask(&chan->ch_rxbr);
             if (!sc->poll_mode) {
-                enqueue_irqsafe(chan->sched_queue, chan->ch_tq);
+                if (chan->sched_queue == bhqueue)
+                    bhqueue_enqueue_cpu(chan->ch_cpuid, chan->ch_tq);
+                else
+                    enqueue_irqsafe(chan->sched_queue, chan->ch_tq);
             } else {
                 apply(chan->ch_tq);
             }
@@ -916,11 +919,12 @@ done:
 void
 vmbus_chan_cpu_set(struct vmbus_channel *chan, int cpu)
 {
-    assert(cpu >= 0);// && cpu < mp_ncpus);//"invalid cpu %d", cpu
+    assert(cpu >= 0);
 
-    if (chan->ch_vmbus->vmbus_version == VMBUS_VERSION_WS2008 ||
+    if (cpu >= present_processors ||
+        chan->ch_vmbus->vmbus_version == VMBUS_VERSION_WS2008 ||
         chan->ch_vmbus->vmbus_version == VMBUS_VERSION_WIN7) {
-        /* Only cpu0 is supported */
+        /* Only cpu0 is supported, or the cpu is not present */
         cpu = 0;
     }
 
@@ -935,11 +939,12 @@ static void
 vmbus_chan_cpu_default(struct vmbus_channel *chan)
 {
     /*
-     * By default, pin the channel to cpu0.  Devices having
+     * By default, pin primary channels to cpu0 and spread
+     * sub-channels over the cpus after it.  Devices having
      * special channel-cpu mapping requirement should call
-     * vmbus_chan_cpu_{set,rr}().
+     * vmbus_chan_cpu_set().
      */
-    vmbus_chan_cpu_set(chan, 0);
+    vmbus_chan_cpu_set(chan, chan->ch_subidx % present_processors);
 }
 
 struct vmbus_channel*
@@ -1058,3 +1063,31 @@ vmbus_chan_poll_messages(struct vmbus_channel *chan)
     chan->ch_vmbus->vmbus_event_proc(chan->ch_vmbus, 0);
     vmbus_poll_messages(chan->ch_vmbus);
 }
+
+/*
+ * Wait for the sub-channels of a primary channel to be offered, and
+ * return up to subchan_cnt of them; sub-channels that are not offered
+ * within VMBUS_SUBCHAN_WAIT_MS are not returned.
+ */
+int
+vmbus_subchan_get(struct vmbus_channel *pri_chan, struct vmbus_channel **subchan,
+    int subchan_cnt)
+{
+    assert(VMBUS_CHAN_ISPRIMARY(pri_chan));
+    for (int i = 0; pri_chan->ch_subchan_cnt < subchan_cnt && i < VMBUS_SUBCHAN_WAIT_MS; i++) {
+        vmbus_chan_poll_messages(pri_chan);
+        if (pri_chan->ch_subchan_cnt >= subchan_cnt)
+            break;
+        kernel_delay(milliseconds(1));
+    }
+
+    int n = 0;
+    u64 flags = spin_lock_irq(&pri_chan->ch_subchan_lock);
+    list_foreach(&pri_chan->ch_subchans, l) {
+        if (n == subchan_cnt)
+            break;
+        subchan[n++] = struct_from_list(l, struct vmbus_channel *, ch_sublink);
+    }
+    spin_unlock_irq(&pri_chan->ch_subchan_lock, flags);
+    return n;
+}
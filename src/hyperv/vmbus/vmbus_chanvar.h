@@ -141,6 +141,8 @@ struct vmbus_channel {
 
 #define VMBUS_CHAN_ISPRIMARY(chan)	((chan)->ch_subidx == 0)
 
+#define VMBUS_SUBCHAN_WAIT_MS		1000
+
 /*
  * If this flag is set, this channel's interrupt will be masked in ISR,
  * and the RX bufring will be drained before this channel's interrupt is
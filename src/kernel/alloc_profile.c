@@ -0,0 +1,391 @@
+/* Sampling allocation profiler
+
+   Heaps wrapped with alloc_profile_heap() sample allocations at a mean
+   rate of one per "period" bytes; a period of zero, the default, disables
+   sampling. The period is set at boot with the alloc_profile_period root
+   option or at runtime through /alloc_profile/period, and setting
+   /alloc_profile/reset discards the samples taken so far.
+
+   A sampled allocation is charged to a site, identified by the name of the
+   heap and the return addresses of the innermost frames of its call path,
+   and is remembered until freed so that each site keeps an estimate of its
+   live bytes. An allocation spanning n sample points counts for n periods'
+   worth of bytes, which keeps the estimates unbiased regardless of object
+   size. /alloc_profile/sites lists the sites with the most live bytes, one
+   per line: estimated live bytes, live sampled objects, estimated bytes
+   allocated since the last reset, heap name and call path.
+
+   When sampling is disabled, the wrapper's only cost is a test of the
+   period on allocation and of a small filter of sampled addresses on
+   deallocation. The tables are allocated from the backed heap on first
+   enable and have fixed sizes; samples which don't fit are dropped and
+   counted in /alloc_profile/dropped. */
+#include <kernel.h>
+#include <management.h>
+#include <symtab.h>
+
+#define ALLOC_PROFILE_DEPTH     4
+#define ALLOC_PROFILE_SITES     1024    /* power of 2 */
+#define ALLOC_PROFILE_SAMPLES   16384   /* power of 2 */
+#define ALLOC_PROFILE_FILTER_ORDER 12
+#define ALLOC_PROFILE_FILTER    U64_FROM_BIT(ALLOC_PROFILE_FILTER_ORDER)
+#define ALLOC_PROFILE_REPORT    32
+
+typedef struct aprof_heap {
+    struct heap h;
+    heap parent;
+    const char *name;
+} *aprof_heap;
+
+typedef struct alloc_profile_site {
+    const char *name;           /* null if slot is free */
+    u64 pc[ALLOC_PROFILE_DEPTH];
+    u64 live_bytes;
+    u64 live_objects;
+    u64 total_bytes;
+} *alloc_profile_site;
+
+typedef struct alloc_profile_sample {
+    u64 addr;                   /* zero if slot is free */
+    u64 weight;
+    u32 site;
+} *alloc_profile_sample;
+
+static struct alloc_profile {
+    u64 period;
+    struct spinlock lock;
+    alloc_profile_site sites;
+    alloc_profile_sample samples;
+    u16 *filter;                /* count of live samples by address hash */
+    u64 sample_count;
+    u64 dropped;
+} alloc_profile;
+
+static inline u64 alloc_profile_hash(u64 a)
+{
+    return (a >> 3) * 0x9e3779b97f4a7c15ull;
+}
+
+static inline u16 *alloc_profile_filter_slot(u64 a)
+{
+    return &alloc_profile.filter[alloc_profile_hash(a) >> (64 - ALLOC_PROFILE_FILTER_ORDER)];
+}
+
+static inline u64 alloc_profile_sample_index(u64 a)
+{
+    return alloc_profile_hash(a) & (ALLOC_PROFILE_SAMPLES - 1);
+}
+
+/* called with lock held */
+static alloc_profile_site alloc_profile_get_site(const char *name, u64 *pc, u32 *index)
+{
+    u64 h = u64_from_pointer(name);
+    for (int i = 0; i < ALLOC_PROFILE_DEPTH; i++)
+        h = alloc_profile_hash(h ^ pc[i]);
+    for (u32 n = 0; n < ALLOC_PROFILE_SITES; n++) {
+        u32 i = (h + n) & (ALLOC_PROFILE_SITES - 1);
+        alloc_profile_site s = &alloc_profile.sites[i];
+        if (!s->name) {
+            s->name = name;
+            runtime_memcpy(s->pc, pc, sizeof(s->pc));
+            *index = i;
+            return s;
+        }
+        if (s->name == name && !runtime_memcmp(s->pc, pc, sizeof(s->pc))) {
+            *index = i;
+            return s;
+        }
+    }
+    return 0;
+}
+
+static void alloc_profile_record(aprof_heap aph, u64 a, u64 weight, u64 *pc)
+{
+    u64 flags = spin_lock_irq(&alloc_profile.lock);
+    u32 si;
+    alloc_profile_site s;
+    /* keep the sample table at most 3/4 full */
+    if (alloc_profile.sample_count >= ALLOC_PROFILE_SAMPLES / 4 * 3 ||
+        !(s = alloc_profile_get_site(aph->name, pc, &si))) {
+        alloc_profile.dropped++;
+        goto out;
+    }
+    u64 i = alloc_profile_sample_index(a);
+    while (alloc_profile.samples[i].addr)
+        i = (i + 1) & (ALLOC_PROFILE_SAMPLES - 1);
+    alloc_profile_sample sp = &alloc_profile.samples[i];
+    sp->addr = a;
+    sp->weight = weight;
+    sp->site = si;
+    alloc_profile.sample_count++;
+    (*alloc_profile_filter_slot(a))++;
+    s->live_bytes += weight;
+    s->live_objects++;
+    s->total_bytes += weight;
+  out:
+    spin_unlock_irq(&alloc_profile.lock, flags);
+}
+
+/* called with lock held; linear probing with backward shift deletion */
+static void alloc_profile_sample_remove(u64 i)
+{
+    alloc_profile_sample samples = alloc_profile.samples;
+    u64 j = i;
+    while (1) {
+        j = (j + 1) & (ALLOC_PROFILE_SAMPLES - 1);
+        if (!samples[j].addr)
+            break;
+        u64 k = alloc_profile_sample_index(samples[j].addr);
+        /* leave the entry at j if its home slot lies cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        samples[i] = samples[j];
+        i = j;
+    }
+    samples[i].addr = 0;
+}
+
+static void alloc_profile_release(u64 a)
+{
+    u64 flags = spin_lock_irq(&alloc_profile.lock);
+    u16 *f = alloc_profile_filter_slot(a);
+    if (*f == 0)
+        goto out;               /* raced with reset */
+    for (u64 i = alloc_profile_sample_index(a); alloc_profile.samples[i].addr;
+         i = (i + 1) & (ALLOC_PROFILE_SAMPLES - 1)) {
+        alloc_profile_sample sp = &alloc_profile.samples[i];
+        if (sp->addr != a)
+            continue;
+        alloc_profile_site s = &alloc_profile.sites[sp->site];
+        s->live_bytes -= sp->weight;
+        s->live_objects--;
+        alloc_profile_sample_remove(i);
+        alloc_profile.sample_count--;
+        (*f)--;
+        break;
+    }
+  out:
+    spin_unlock_irq(&alloc_profile.lock, flags);
+}
+
+static u64 alloc_profile_alloc(heap h, bytes b)
+{
+    aprof_heap aph = (aprof_heap)h;
+    u64 a = allocate_u64(aph->parent, b);
+    u64 period = alloc_profile.period;
+    if (period == 0 || a == INVALID_PHYSICAL)
+        return a;
+
+    /* Racing with an interrupt on this cpu only perturbs the countdown. */
+    s64 *countdown = &current_cpu()->alloc_profile_countdown;
+    *countdown -= b;
+    if (*countdown > 0)
+        return a;
+    u64 n = 0;
+    do {
+        /* uniform intervals with a mean of one period */
+        *countdown += 1 + random_u64() % (2 * period);
+        n++;
+    } while (*countdown <= 0);
+
+    /* The first frame record is our own; its return address is our caller. */
+    u64 pc[ALLOC_PROFILE_DEPTH];
+    u64 *fp = __builtin_frame_address(0);
+    for (int i = 0; i < ALLOC_PROFILE_DEPTH; i++) {
+        if (fp && validate_virtual(fp, 2 * sizeof(u64))) {
+            pc[i] = fp[1];
+            fp = pointer_from_u64(fp[0]);
+        } else {
+            pc[i] = 0;
+            fp = 0;
+        }
+    }
+    alloc_profile_record(aph, a, n * period, pc);
+    return a;
+}
+
+static void alloc_profile_dealloc(heap h, u64 a, bytes b)
+{
+    aprof_heap aph = (aprof_heap)h;
+    if (alloc_profile.filter && *alloc_profile_filter_slot(a))
+        alloc_profile_release(a);
+    deallocate_u64(aph->parent, a, b);
+}
+
+static void alloc_profile_destroy(heap h)
+{
+    aprof_heap aph = (aprof_heap)h;
+    destroy_heap(aph->parent);
+}
+
+static bytes alloc_profile_allocated(heap h)
+{
+    return heap_allocated(((aprof_heap)h)->parent);
+}
+
+static bytes alloc_profile_total(heap h)
+{
+    return heap_total(((aprof_heap)h)->parent);
+}
+
+static value alloc_profile_management(heap h)
+{
+    return heap_management(((aprof_heap)h)->parent);
+}
+
+heap alloc_profile_heap(heap meta, heap parent, const char *name)
+{
+    aprof_heap aph = allocate(meta, sizeof(*aph));
+    if (aph == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    aph->h.alloc = alloc_profile_alloc;
+    aph->h.dealloc = alloc_profile_dealloc;
+    aph->h.destroy = alloc_profile_destroy;
+    aph->h.allocated = alloc_profile_allocated;
+    aph->h.total = alloc_profile_total;
+    aph->h.pagesize = parent->pagesize;
+    aph->h.management = parent->management ? alloc_profile_management : 0;
+    aph->parent = parent;
+    aph->name = name;
+    return &aph->h;
+}
+
+static boolean alloc_profile_set_period(u64 period)
+{
+    if (period && !alloc_profile.sites) {
+        heap h = (heap)heap_backed(get_kernel_heaps());
+        alloc_profile_site sites = allocate_zero(h, ALLOC_PROFILE_SITES *
+                                                 sizeof(struct alloc_profile_site));
+        alloc_profile_sample samples = allocate_zero(h, ALLOC_PROFILE_SAMPLES *
+                                                     sizeof(struct alloc_profile_sample));
+        u16 *filter = allocate_zero(h, ALLOC_PROFILE_FILTER * sizeof(u16));
+        if (sites == INVALID_ADDRESS || samples == INVALID_ADDRESS || filter == INVALID_ADDRESS) {
+            msg_err("failed to allocate allocation profiler tables\n");
+            return false;
+        }
+        alloc_profile.sites = sites;
+        alloc_profile.samples = samples;
+        write_barrier();
+        alloc_profile.filter = filter;
+    }
+    write_barrier();
+    alloc_profile.period = period;
+    return true;
+}
+
+closure_function(1, 0, value, alloc_profile_get_period,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), alloc_profile.period);
+}
+
+closure_function(0, 1, boolean, alloc_profile_period_notify,
+                 value, v)
+{
+    u64 period;
+    if (!v)
+        period = 0;
+    else if (is_tuple(v) || !u64_from_value(v, &period)) {
+        msg_err("invalid allocation profiler period\n");
+        return false;
+    }
+    alloc_profile_set_period(period);
+    return false;               /* value is served by alloc_profile_get_period */
+}
+
+closure_function(1, 0, value, alloc_profile_get_dropped,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), alloc_profile.dropped);
+}
+
+closure_function(0, 1, boolean, alloc_profile_reset,
+                 value, v)
+{
+    if (!alloc_profile.sites)
+        return false;
+    u64 flags = spin_lock_irq(&alloc_profile.lock);
+    zero(alloc_profile.sites, ALLOC_PROFILE_SITES * sizeof(struct alloc_profile_site));
+    zero(alloc_profile.samples, ALLOC_PROFILE_SAMPLES * sizeof(struct alloc_profile_sample));
+    zero(alloc_profile.filter, ALLOC_PROFILE_FILTER * sizeof(u16));
+    alloc_profile.sample_count = 0;
+    alloc_profile.dropped = 0;
+    spin_unlock_irq(&alloc_profile.lock, flags);
+    return false;               /* nothing to store */
+}
+
+static void alloc_profile_print_pc(buffer b, u64 pc)
+{
+    u64 offset;
+    char *name = find_elf_sym(pc, &offset, 0);
+    if (name)
+        bprintf(b, " %s+0x%lx", name, offset);
+    else
+        bprintf(b, " 0x%lx", pc);
+}
+
+closure_function(1, 0, value, alloc_profile_get_sites,
+                 value, v)
+{
+    buffer b = (buffer)bound(v);
+    buffer_clear(b);
+    if (!alloc_profile.sites)
+        return b;
+
+    /* Pick the top sites under the lock, print them without it; site slots
+       are never freed except on reset. */
+    struct alloc_profile_site top[ALLOC_PROFILE_REPORT];
+    int count = 0;
+    u64 flags = spin_lock_irq(&alloc_profile.lock);
+    for (int i = 0; i < ALLOC_PROFILE_SITES; i++) {
+        alloc_profile_site s = &alloc_profile.sites[i];
+        if (!s->name || !s->live_bytes)
+            continue;
+        int j = count < ALLOC_PROFILE_REPORT ? count++ : ALLOC_PROFILE_REPORT;
+        for (; j > 0 && top[j - 1].live_bytes < s->live_bytes; j--) {
+            if (j < ALLOC_PROFILE_REPORT)
+                top[j] = top[j - 1];
+        }
+        if (j < ALLOC_PROFILE_REPORT)
+            top[j] = *s;
+    }
+    spin_unlock_irq(&alloc_profile.lock, flags);
+
+    for (int i = 0; i < count; i++) {
+        alloc_profile_site s = &top[i];
+        bprintf(b, "%ld %ld %ld %s", s->live_bytes, s->live_objects, s->total_bytes, s->name);
+        for (int d = 0; d < ALLOC_PROFILE_DEPTH && s->pc[d]; d++)
+            alloc_profile_print_pc(b, s->pc[d]);
+        bprintf(b, "\n");
+    }
+    return b;
+}
+
+/* /alloc_profile/{period,dropped,sites,reset} */
+void init_alloc_profile_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    spin_lock_init(&alloc_profile.lock);
+    u64 period;
+    if (get_u64(root, sym(alloc_profile_period), &period) && period)
+        alloc_profile_set_period(period);
+
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    value v = value_from_u64(h, 0);
+    set(t, sym(period), v);
+    tuple_notifier_register_get_notify(n, sym(period), closure(h, alloc_profile_get_period, v));
+    tuple_notifier_register_set_notify(n, sym(period), closure(h, alloc_profile_period_notify));
+    v = value_from_u64(h, 0);
+    set(t, sym(dropped), v);
+    tuple_notifier_register_get_notify(n, sym(dropped), closure(h, alloc_profile_get_dropped, v));
+    v = allocate_buffer(h, 256);
+    assert(v != INVALID_ADDRESS);
+    set(t, sym(sites), v);
+    tuple_notifier_register_get_notify(n, sym(sites), closure(h, alloc_profile_get_sites, v));
+    tuple_notifier_register_set_notify(n, sym(reset), closure(h, alloc_profile_reset));
+    set(t, sym(no_encode), null_value);
+    set(root, sym(alloc_profile), n);
+}
@@ -117,3 +117,118 @@ backed_heap physically_backed(heap meta, heap virtual, heap physical, u64 pagesi
     b->h.management = 0;
     return b;
 }
+
+/* DMA buffer pools
+
+   A pool carves fixed-size buffers out of physically contiguous chunks
+   obtained from a backed heap, and caches the physical address of each
+   free buffer alongside it, so that getting and putting buffers takes
+   neither a page table walk nor a heap lock. Buffers are put back from
+   wherever their last reference is dropped (e.g. a pbuf freed by an
+   application thread while its queue refills on another CPU), so the free
+   list is guarded by a pool spinlock. The pool only goes back to the
+   backed heap, taking its lock, when it must grow by another chunk. */
+
+#define dma_pool_lock(p)    u64 _flags = spin_lock_irq(&(p)->lock)
+#define dma_pool_unlock(p)  spin_unlock_irq(&(p)->lock, _flags)
+
+typedef struct dma_pool_buf {
+    struct dma_pool_buf *next;
+    u64 phys;
+} *dma_pool_buf;
+
+typedef struct dma_pool_chunk {
+    struct list l;
+    void *virt;
+    u64 phys;
+} *dma_pool_chunk;
+
+struct dma_pool {
+    struct spinlock lock;
+    heap meta;
+    backed_heap backed;
+    bytes stride;
+    bytes chunksize;
+    dma_pool_buf free;
+    struct list chunks;
+};
+
+static boolean dma_pool_grow(dma_pool p)
+{
+    dma_pool_chunk c = allocate(p->meta, sizeof(*c));
+    if (c == INVALID_ADDRESS)
+        return false;
+    c->virt = alloc_map(p->backed, p->chunksize, &c->phys);
+    if (c->virt == INVALID_ADDRESS) {
+        deallocate(p->meta, c, sizeof(*c));
+        return false;
+    }
+    list_insert_before(&p->chunks, &c->l);
+    for (bytes off = p->chunksize - p->chunksize % p->stride; off > 0; off -= p->stride) {
+        dma_pool_buf b = c->virt + off - p->stride;
+        b->phys = c->phys + off - p->stride;
+        b->next = p->free;
+        p->free = b;
+    }
+    return true;
+}
+
+/* Buffers are aligned to align (a power of 2, at least 16). count buffers
+   are allocated up front, and the pool grows by as many when empty. */
+dma_pool allocate_dma_pool(heap meta, backed_heap backed, bytes size, bytes align, u64 count)
+{
+    assert(align >= sizeof(struct dma_pool_buf) && (align & (align - 1)) == 0);
+    assert(count > 0);
+    dma_pool p = allocate(meta, sizeof(*p));
+    if (p == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    p->meta = meta;
+    p->backed = backed;
+    p->stride = pad(size, align);
+    p->chunksize = pad(p->stride * count, backed->h.pagesize);
+    p->free = 0;
+    list_init(&p->chunks);
+    spin_lock_init(&p->lock);
+    if (!dma_pool_grow(p)) {
+        deallocate(meta, p, sizeof(*p));
+        return INVALID_ADDRESS;
+    }
+    return p;
+}
+
+void *dma_pool_get(dma_pool p, u64 *phys)
+{
+    dma_pool_lock(p);
+    if (!p->free && !dma_pool_grow(p)) {
+        dma_pool_unlock(p);
+        return INVALID_ADDRESS;
+    }
+    dma_pool_buf b = p->free;
+    p->free = b->next;
+    dma_pool_unlock(p);
+    *phys = b->phys;
+    return b;
+}
+
+/* phys is the address returned with the buffer by dma_pool_get() */
+void dma_pool_put(dma_pool p, void *buf, u64 phys)
+{
+    dma_pool_buf b = buf;
+    b->phys = phys;
+    dma_pool_lock(p);
+    b->next = p->free;
+    p->free = b;
+    dma_pool_unlock(p);
+}
+
+/* all buffers must have been returned */
+void destroy_dma_pool(dma_pool p)
+{
+    list_foreach(&p->chunks, l) {
+        dma_pool_chunk c = struct_from_list(l, dma_pool_chunk, l);
+        list_delete(l);
+        dealloc_unmap(p->backed, c->virt, c->phys, p->chunksize);
+        deallocate(p->meta, c, sizeof(*c));
+    }
+    deallocate(p->meta, p, sizeof(*p));
+}
@@ -0,0 +1,109 @@
+#include <kernel.h>
+
+/* Boot milestones are stamped with the cycle counter, which is usable from
+   the first instruction, and, once a platform clock is registered, with
+   the monotonic clock; the first and last clock readings calibrate cycles
+   to time for the timeline. Milestone names must be static strings. */
+
+#define BOOT_MILESTONES_MAX 64
+
+static struct boot_milestone {
+    const char *name;
+    u64 tsc;
+    timestamp t;                /* 0 if recorded before the platform clock */
+} milestones[BOOT_MILESTONES_MAX];
+
+static u64 milestone_count;
+
+void boot_milestone(const char *name)
+{
+    u64 i = fetch_and_add(&milestone_count, 1);
+    if (i >= BOOT_MILESTONES_MAX)
+        return;
+    struct boot_milestone *m = &milestones[i];
+    m->tsc = rdtsc();
+    m->t = platform_monotonic_now ? now(CLOCK_ID_MONOTONIC_RAW) : 0;
+    write_barrier();
+    m->name = name;
+}
+KLIB_EXPORT(boot_milestone);
+
+/* cycles per microsecond, or 0 if too few milestones have a clock reading */
+static u64 boot_timing_cycles_per_us(u64 count)
+{
+    struct boot_milestone *first = 0, *last = 0;
+    for (u64 i = 0; i < count; i++) {
+        struct boot_milestone *m = &milestones[i];
+        if (!m->name || !m->t)
+            continue;
+        if (!first)
+            first = m;
+        last = m;
+    }
+    if (!first || last->tsc <= first->tsc)
+        return 0;
+    u64 ns = nsec_from_timestamp(last->t - first->t);
+    return ns ? ((last->tsc - first->tsc) * THOUSAND) / ns : 0;
+}
+
+/* one line per milestone: time since the first milestone and since the
+   previous one, in microseconds if calibrated, else in cycles */
+void boot_timing_format(buffer b)
+{
+    u64 count = MIN(milestone_count, BOOT_MILESTONES_MAX);
+    if (count == 0)
+        return;
+    u64 rate = boot_timing_cycles_per_us(count);
+    u64 start = milestones[0].tsc;
+    u64 prev = start;
+    bprintf(b, "%12s %10s  (%s)\n", "total", "delta", rate ? "us" : "cycles");
+    for (u64 i = 0; i < count; i++) {
+        struct boot_milestone *m = &milestones[i];
+        if (!m->name)
+            continue;
+        u64 total = m->tsc - start;
+        u64 delta = m->tsc - prev;
+        if (rate) {
+            total /= rate;
+            delta /= rate;
+        }
+        bprintf(b, "%12ld %10ld  %s\n", total, delta, m->name);
+        prev = m->tsc;
+    }
+}
+
+void boot_timing_report(void)
+{
+    buffer b = allocate_buffer(heap_locked(get_kernel_heaps()), 1024);
+    assert(b != INVALID_ADDRESS);
+    bprintf(b, "boot timeline:\n");
+    boot_timing_format(b);
+    buffer_print(b);
+    deallocate_buffer(b);
+}
+
+closure_function(1, 0, value, boot_timeline_get,
+                 value, v)
+{
+    buffer b = (buffer)bound(v);
+    buffer_clear(b);
+    boot_timing_format(b);
+    return b;
+}
+
+/* /boot_timeline: the timeline as text, including milestones reached
+   after the program started */
+void init_boot_timing_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    value v = allocate_buffer(h, 1024);
+    assert(v != INVALID_ADDRESS);
+    set(t, sym(timeline), v);
+    tuple_notifier_register_get_notify(n, sym(timeline), closure(h, boot_timeline_get, v));
+    set(t, sym(no_encode), null_value);
+    set(root, sym(boot_timeline), n);
+}
@@ -20,6 +20,12 @@ timestamp kern_now(clock_id id)
 }
 KLIB_EXPORT_RENAME(kern_now, now);
 
+static void reorder_timers(void)
+{
+    for (int i = 0; i < total_processors; i++)
+        timer_reorder(cpuinfo_from_id(i)->timers);
+}
+
 void clock_adjust(timestamp wallclock_now, s64 temp_cal, timestamp sync_complete, s64 cal)
 {
     clock_debug("%s: wallclock_now %T, temp_cal %ld, sync_complete %T, cal %ld\n",
@@ -31,7 +37,7 @@ void clock_adjust(timestamp wallclock_now, s64 temp_cal, timestamp sync_complete
     __vdso_dat->sync_complete = sync_complete;
     __vdso_dat->cal = cal;
     clock_update_drift(here);
-    timer_reorder(runloop_timers);
+    reorder_timers();
     rtc_settimeofday(sec_from_timestamp(wallclock_now));
 }
 KLIB_EXPORT(clock_adjust);
@@ -59,8 +65,23 @@ void clock_reset_rtc(timestamp wallclock_now)
                 __func__, now(CLOCK_ID_REALTIME), wallclock_now);
     timestamp n = now(CLOCK_ID_REALTIME);
     rtc_settimeofday(sec_from_timestamp(wallclock_now));
-    pqueue_walk(runloop_timers->pq, stack_closure(timer_adjust_handler, wallclock_now - n));
-    timer_reorder(runloop_timers);
+    pqueue_element_handler adjust = stack_closure(timer_adjust_handler, wallclock_now - n);
+    for (int i = 0; i < total_processors; i++)
+        pqueue_walk(cpuinfo_from_id(i)->timers->pq, adjust);
+    reorder_timers();
     reset_clock_vdso_dat();
 }
 KLIB_EXPORT(clock_reset_rtc);
+
+/* re-read the wall clock from the RTC, e.g. after the VM was suspended */
+void clock_resync_rtc(void)
+{
+    timestamp n = now(CLOCK_ID_REALTIME);
+    reset_clock_vdso_dat();
+    timestamp wallclock_now = now(CLOCK_ID_REALTIME);
+    clock_debug("%s: was %T, now %T\n", __func__, n, wallclock_now);
+    pqueue_element_handler adjust = stack_closure(timer_adjust_handler, wallclock_now - n);
+    for (int i = 0; i < total_processors; i++)
+        pqueue_walk(cpuinfo_from_id(i)->timers->pq, adjust);
+    reorder_timers();
+}
@@ -0,0 +1,353 @@
+/* Sampling CPU profiler
+
+   Each cpu is interrupted at about "frequency" times a second, by its
+   performance counter overflowing after a number of unhalted cycles where
+   the platform provides one, else by a profiler IPI sent from a periodic
+   timer. The interrupt handler records the interrupted pc and the frame
+   pointer chain of the interrupted context: the kernel chain for a sample
+   in the kernel, followed by the user chain of the thread the kernel was
+   running for, if any, or the user chain alone for a sample in user
+   space. Samples go into a ring per cpu with no locking; the rings are
+   drained into a table of distinct stacks by the timer and on each read,
+   and samples which don't fit are dropped and counted.
+
+   The frequency is set at boot with the cpu_profile_frequency root option
+   or at runtime through /cpu_profile/frequency; zero, the default,
+   disables sampling. /cpu_profile/folded lists the stacks in the folded
+   format read by flame graph tools, root first: user frames as raw
+   addresses, then kernel frames symbolized with find_elf_sym(), and the
+   sample count. Since the interrupt is maskable, time spent with
+   interrupts disabled is charged to the point where they are next
+   enabled. */
+#include <kernel.h>
+#include <management.h>
+#include <symtab.h>
+
+#define CPU_PROFILE_DEPTH       30
+#define CPU_PROFILE_RING        1024    /* samples per cpu; power of 2 */
+#define CPU_PROFILE_STACKS      4096    /* power of 2 */
+#define CPU_PROFILE_DRAIN       seconds(1)
+#define CPU_PROFILE_MAX_FREQUENCY 10000
+
+typedef struct cpu_profile_sample {
+    u8 nkernel;
+    u8 nuser;
+    u64 pc[CPU_PROFILE_DEPTH];  /* leaf first: kernel frames, then user */
+} *cpu_profile_sample;
+
+typedef struct cpu_profile_ring {
+    u64 write_idx;              /* written by the owning cpu only */
+    u64 read_idx;               /* written by the drain only */
+    u64 generation;             /* configuration applied on this cpu */
+    struct cpu_profile_sample samples[CPU_PROFILE_RING];
+} *cpu_profile_ring;
+
+typedef struct cpu_profile_stack {
+    u64 count;                  /* zero if slot is free */
+    u8 nkernel;
+    u8 nuser;
+    u64 pc[CPU_PROFILE_DEPTH];
+} *cpu_profile_stack;
+
+declare_closure_struct(0, 0, void, cpu_profile_interrupt);
+declare_closure_struct(0, 1, void, cpu_profile_tick,
+                       u64, overruns);
+
+static struct cpu_profile {
+    u64 frequency;
+    u64 generation;
+    boolean pmu;                /* counter overflow, else timer and IPI */
+    u64 vector;
+    timer tick;
+    struct spinlock lock;       /* stacks and drain */
+    cpu_profile_ring rings;
+    cpu_profile_stack stacks;
+    u64 samples;
+    u64 dropped;
+    closure_struct(cpu_profile_interrupt, interrupt);
+    closure_struct(cpu_profile_tick, do_tick);
+} cpu_profile;
+
+/* frame of the thread the kernel is running on behalf of, if any; set by
+   the unix layer */
+context (*cpu_profile_user_frame)(void);
+
+static inline u64 cpu_profile_hash(u64 a)
+{
+    return a * 0x9e3779b97f4a7c15ull;
+}
+
+static int cpu_profile_walk(u64 *pc, int n, u64 fp)
+{
+    u64 *f = pointer_from_u64(fp);
+    while (n < CPU_PROFILE_DEPTH && f && validate_virtual(f, 2 * sizeof(u64))) {
+        if (!f[1])
+            break;
+        pc[n++] = f[1];
+        f = pointer_from_u64(f[0]);
+    }
+    return n;
+}
+
+static void cpu_profile_record(cpuinfo ci, context f)
+{
+    cpu_profile_ring r = &cpu_profile.rings[ci->id];
+    if (r->write_idx - r->read_idx >= CPU_PROFILE_RING) {
+        fetch_and_add(&cpu_profile.dropped, 1);
+        return;
+    }
+    cpu_profile_sample s = &r->samples[r->write_idx & (CPU_PROFILE_RING - 1)];
+    int n = 0;
+    s->nkernel = 0;
+    if (!frame_is_user(f)) {
+        s->pc[n++] = frame_pc(f);
+        n = cpu_profile_walk(s->pc, n, frame_fp(f));
+        s->nkernel = n;
+        f = cpu_profile_user_frame ? cpu_profile_user_frame() : 0;
+    }
+    if (f && n < CPU_PROFILE_DEPTH) {
+        s->pc[n++] = frame_pc(f);
+        n = cpu_profile_walk(s->pc, n, frame_fp(f));
+    }
+    s->nuser = n - s->nkernel;
+    write_barrier();
+    r->write_idx++;
+}
+
+static void cpu_profile_apply(cpuinfo ci)
+{
+    cpu_profile_ring r = &cpu_profile.rings[ci->id];
+    u64 generation = cpu_profile.generation;
+    read_barrier();
+    if (cpu_profile.pmu && cpu_profile.frequency)
+        pmu_sampling_cpu_start(cpu_profile.vector);
+    else
+        pmu_sampling_cpu_stop();
+    r->generation = generation;
+}
+
+define_closure_function(0, 0, void, cpu_profile_interrupt)
+{
+    cpuinfo ci = current_cpu();
+    if (!cpu_profile.rings)
+        return;
+    if (cpu_profile.rings[ci->id].generation != cpu_profile.generation) {
+        cpu_profile_apply(ci);
+        return;
+    }
+    if (!cpu_profile.frequency)
+        return;
+    if (cpu_profile.pmu) {
+        if (!pmu_sampling_overflowed())
+            return;
+        pmu_sampling_rearm();
+    }
+    cpu_profile_record(ci, get_running_frame(ci));
+}
+
+/* called with lock held; kernel frames are charged to the start of their
+   function so that samples anywhere in it share a stack */
+static void cpu_profile_add(cpu_profile_sample s)
+{
+    u64 pc[CPU_PROFILE_DEPTH];
+    int n = s->nkernel + s->nuser;
+    u64 h = s->nkernel;
+    for (int i = 0; i < n; i++) {
+        u64 offset;
+        pc[i] = s->pc[i];
+        if (i < s->nkernel && find_elf_sym(pc[i], &offset, 0))
+            pc[i] -= offset;
+        h = cpu_profile_hash(h ^ pc[i]);
+    }
+    for (u32 k = 0; k < CPU_PROFILE_STACKS; k++) {
+        cpu_profile_stack st = &cpu_profile.stacks[(h + k) & (CPU_PROFILE_STACKS - 1)];
+        if (!st->count) {
+            st->nkernel = s->nkernel;
+            st->nuser = s->nuser;
+            runtime_memcpy(st->pc, pc, n * sizeof(u64));
+        } else if (st->nkernel != s->nkernel || st->nuser != s->nuser ||
+                   runtime_memcmp(st->pc, pc, n * sizeof(u64))) {
+            continue;
+        }
+        st->count++;
+        cpu_profile.samples++;
+        return;
+    }
+    fetch_and_add(&cpu_profile.dropped, 1);
+}
+
+static void cpu_profile_drain(void)
+{
+    u64 flags = spin_lock_irq(&cpu_profile.lock);
+    for (int i = 0; i < total_processors; i++) {
+        cpu_profile_ring r = &cpu_profile.rings[i];
+        u64 w = r->write_idx;
+        read_barrier();
+        for (; r->read_idx != w; r->read_idx++)
+            cpu_profile_add(&r->samples[r->read_idx & (CPU_PROFILE_RING - 1)]);
+    }
+    spin_unlock_irq(&cpu_profile.lock, flags);
+}
+
+define_closure_function(0, 1, void, cpu_profile_tick,
+                        u64, overruns)
+{
+    if (!cpu_profile.pmu)
+        send_ipi_mask(MASK(total_processors), cpu_profile.vector);
+    cpu_profile_drain();
+}
+
+static boolean cpu_profile_set_frequency(u64 frequency)
+{
+    if (frequency && !cpu_profile.rings) {
+        heap h = (heap)heap_backed(get_kernel_heaps());
+        cpu_profile_ring rings = allocate_zero(h, MAX_CPUS * sizeof(struct cpu_profile_ring));
+        cpu_profile_stack stacks = allocate_zero(h, CPU_PROFILE_STACKS *
+                                                 sizeof(struct cpu_profile_stack));
+        if (rings == INVALID_ADDRESS || stacks == INVALID_ADDRESS) {
+            msg_err("failed to allocate cpu profiler tables\n");
+            return false;
+        }
+        cpu_profile.stacks = stacks;
+        cpu_profile.vector = allocate_ipi_interrupt();
+        register_interrupt(cpu_profile.vector, init_closure(&cpu_profile.interrupt,
+                                                            cpu_profile_interrupt),
+                           "cpu profile");
+        write_barrier();
+        cpu_profile.rings = rings;
+    }
+    if (frequency == cpu_profile.frequency)
+        return true;
+    if (cpu_profile.tick) {
+        remove_timer(cpu_profile.tick, 0);
+        cpu_profile.tick = 0;
+    }
+    cpu_profile.pmu = frequency && pmu_sampling_set_frequency(frequency);
+    cpu_profile.frequency = frequency;
+    write_barrier();
+    cpu_profile.generation++;
+    if (!cpu_profile.rings)
+        return true;
+
+    /* each cpu programs its own counter on the next profiler interrupt */
+    send_ipi_mask(MASK(total_processors), cpu_profile.vector);
+    if (frequency) {
+        timestamp t = cpu_profile.pmu ? CPU_PROFILE_DRAIN : seconds(1) / frequency;
+        cpu_profile.tick = kern_register_timer(CLOCK_ID_MONOTONIC, t, false, t,
+                                               init_closure(&cpu_profile.do_tick,
+                                                            cpu_profile_tick));
+    }
+    return true;
+}
+
+closure_function(1, 0, value, cpu_profile_get_frequency,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), cpu_profile.frequency);
+}
+
+closure_function(0, 1, boolean, cpu_profile_frequency_notify,
+                 value, v)
+{
+    u64 frequency;
+    if (!v)
+        frequency = 0;
+    else if (is_tuple(v) || !u64_from_value(v, &frequency) ||
+             frequency > CPU_PROFILE_MAX_FREQUENCY) {
+        msg_err("invalid cpu profiler frequency\n");
+        return false;
+    }
+    cpu_profile_set_frequency(frequency);
+    return false;               /* value is served by cpu_profile_get_frequency */
+}
+
+closure_function(1, 0, value, cpu_profile_get_samples,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), cpu_profile.samples);
+}
+
+closure_function(1, 0, value, cpu_profile_get_dropped,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), cpu_profile.dropped);
+}
+
+closure_function(0, 1, boolean, cpu_profile_reset,
+                 value, v)
+{
+    if (!cpu_profile.rings)
+        return false;
+    cpu_profile_drain();
+    u64 flags = spin_lock_irq(&cpu_profile.lock);
+    zero(cpu_profile.stacks, CPU_PROFILE_STACKS * sizeof(struct cpu_profile_stack));
+    cpu_profile.samples = 0;
+    cpu_profile.dropped = 0;
+    spin_unlock_irq(&cpu_profile.lock, flags);
+    return false;               /* nothing to store */
+}
+
+static void cpu_profile_print_stack(buffer b, cpu_profile_stack st)
+{
+    int n = st->nkernel + st->nuser;
+    for (int i = n - 1; i >= 0; i--) {
+        char *name = i < st->nkernel ? find_elf_sym(st->pc[i], 0, 0) : 0;
+        if (name)
+            bprintf(b, "%s", name);
+        else
+            bprintf(b, "0x%lx", st->pc[i]);
+        bprintf(b, i > 0 ? ";" : " ");
+    }
+    bprintf(b, "%ld\n", st->count);
+}
+
+closure_function(1, 0, value, cpu_profile_get_folded,
+                 value, v)
+{
+    buffer b = (buffer)bound(v);
+    buffer_clear(b);
+    if (!cpu_profile.rings)
+        return b;
+    cpu_profile_drain();
+
+    /* Stack slots are never freed except on reset, which is not expected
+       to race with a read. */
+    for (int i = 0; i < CPU_PROFILE_STACKS; i++) {
+        cpu_profile_stack st = &cpu_profile.stacks[i];
+        if (st->count)
+            cpu_profile_print_stack(b, st);
+    }
+    return b;
+}
+
+/* /cpu_profile/{frequency,samples,dropped,folded,reset} */
+void init_cpu_profile_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    spin_lock_init(&cpu_profile.lock);
+    u64 frequency;
+    if (get_u64(root, sym(cpu_profile_frequency), &frequency) && frequency)
+        cpu_profile_set_frequency(frequency);
+
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    value v = value_from_u64(h, 0);
+    set(t, sym(frequency), v);
+    tuple_notifier_register_get_notify(n, sym(frequency), closure(h, cpu_profile_get_frequency, v));
+    tuple_notifier_register_set_notify(n, sym(frequency), closure(h, cpu_profile_frequency_notify));
+    v = value_from_u64(h, 0);
+    set(t, sym(samples), v);
+    tuple_notifier_register_get_notify(n, sym(samples), closure(h, cpu_profile_get_samples, v));
+    v = value_from_u64(h, 0);
+    set(t, sym(dropped), v);
+    tuple_notifier_register_get_notify(n, sym(dropped), closure(h, cpu_profile_get_dropped, v));
+    v = allocate_buffer(h, 4096);
+    assert(v != INVALID_ADDRESS);
+    set(t, sym(folded), v);
+    tuple_notifier_register_get_notify(n, sym(folded), closure(h, cpu_profile_get_folded, v));
+    tuple_notifier_register_set_notify(n, sym(reset), closure(h, cpu_profile_reset));
+    set(t, sym(no_encode), null_value);
+    set(root, sym(cpu_profile), n);
+}
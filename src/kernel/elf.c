@@ -22,7 +22,9 @@ static char *elf_string(buffer elf, Elf64_Shdr *string_section, u64 offset)
     if (((void*)ptr) + sizeof(type) > elf_end)    \
         goto out_elf_fail;
 
-void elf_symbols(buffer elf, elf_sym_handler each)
+/* locate the symbol table and its string table; the string table is
+   checked to be null-terminated */
+boolean elf_symtab_sections(buffer elf, Elf64_Shdr **symtab, Elf64_Shdr **strtab)
 {
     char *symbol_string_name = ".strtab";
     void * elf_end = buffer_ref(elf, buffer_length(elf));
@@ -52,8 +54,27 @@ void elf_symbols(buffer elf, elf_sym_handler each)
 
     if (!symbols || !symbol_strings) {
         msg_warn("failed: symtab not found\n");
-        return;
+        return false;
     }
+    if (symbols->sh_offset + symbols->sh_size > buffer_length(elf) ||
+        symbol_strings->sh_size == 0 ||
+        symbol_strings->sh_offset + symbol_strings->sh_size > buffer_length(elf) ||
+        *(char *)buffer_ref(elf, symbol_strings->sh_offset + symbol_strings->sh_size - 1) != '\0')
+        goto out_elf_fail;
+    *symtab = symbols;
+    *strtab = symbol_strings;
+    return true;
+  out_elf_fail:
+    msg_err("failed to parse elf file, len %d; check file image consistency\n", buffer_length(elf));
+    return false;
+}
+
+void elf_symbols(buffer elf, elf_sym_handler each)
+{
+    void * elf_end = buffer_ref(elf, buffer_length(elf));
+    Elf64_Shdr *symbols, *symbol_strings;
+    if (!elf_symtab_sections(elf, &symbols, &symbol_strings))
+        return;
 
     Elf64_Sym *sym = buffer_ref(elf, symbols->sh_offset);
     for (int i = 0; i < symbols->sh_size; i+=symbols->sh_entsize) {
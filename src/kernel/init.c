@@ -46,6 +46,59 @@ closure_function(2, 3, void, offset_block_io,
     apply(k, STATUS_OK);
 }
 
+closure_function(2, 2, void, offset_block_range_op,
+                 u64, offset, block_range_op, op,
+                 range, blocks, status_handler, sh)
+{
+    u64 ds = bound(offset) >> SECTOR_OFFSET;
+    apply(bound(op), irange(blocks.start + ds, blocks.end + ds), sh);
+}
+
+static storage_ops offset_storage_ops(heap h, u64 offset, storage_ops ops)
+{
+    if (!ops)
+        return 0;
+    storage_ops o = allocate(h, sizeof(*o));
+    if (o == INVALID_ADDRESS)
+        return 0;
+    o->discard = ops->discard ? closure(h, offset_block_range_op, offset, ops->discard) : 0;
+    o->write_zeroes = ops->write_zeroes ?
+        closure(h, offset_block_range_op, offset, ops->write_zeroes) : 0;
+    o->flush = ops->flush;
+    o->write_fua = ops->write_fua ? closure(h, offset_block_io, offset, ops->write_fua) : 0;
+    if (o->discard == INVALID_ADDRESS)
+        o->discard = 0;
+    if (o->write_zeroes == INVALID_ADDRESS)
+        o->write_zeroes = 0;
+    if (o->write_fua == INVALID_ADDRESS)
+        o->write_fua = 0;
+    return o;
+}
+
+/* Device flushes of a volume are merged across callers, and FUA writes get a
+   request queue of their own so that they are never merged with plain ones. */
+static storage_ops queued_storage_ops(heap h, storage_ops ops, storage_stats st)
+{
+    if (!ops || (!ops->flush && !ops->write_fua))
+        return ops;
+    storage_ops o = allocate(h, sizeof(*o));
+    if (o == INVALID_ADDRESS)
+        return ops;
+    runtime_memcpy(o, ops, sizeof(*o));
+    if (ops->flush) {
+        o->flush = storage_flushq(h, ops->flush, st);
+        if (o->flush == INVALID_ADDRESS)
+            o->flush = ops->flush;
+    }
+    if (ops->write_fua) {
+        o->write_fua = storage_bioq(h, ops->write_fua, MAX_BLOCK_IO_SIZE >> SECTOR_OFFSET,
+                                    st, STORAGE_OP_WRITE);
+        if (o->write_fua == INVALID_ADDRESS)
+            o->write_fua = ops->write_fua;
+    }
+    return o;
+}
+
 /* stage3 */
 extern thunk create_init(kernel_heaps kh, tuple root, filesystem fs);
 extern filesystem_complete bootfs_handler(kernel_heaps kh, tuple root,
@@ -53,9 +106,10 @@ extern filesystem_complete bootfs_handler(kernel_heaps kh, tuple root,
                                           boolean ingest_kernel_syms);
 
 static tuple_notifier wrapped_root;
+static table early_root_notifys;    /* registered before the root fs was mounted */
 
-closure_function(3, 2, void, fsstarted,
-                 u8 *, mbr, block_io, r, block_io, w,
+closure_function(5, 2, void, fsstarted,
+                 u8 *, mbr, block_io, r, block_io, w, storage_ops, ops, storage_stats, st,
                  filesystem, fs, status, s)
 {
     init_debug("%s\n", __func__);
@@ -73,12 +127,23 @@ closure_function(3, 2, void, fsstarted,
 
     u8 *mbr = bound(mbr);
     root_fs = fs;
-    storage_set_root_fs(fs);
+    boot_milestone("root filesystem mounted");
+    storage_set_root_fs(fs, bound(st));
+    filesystem_set_storage_ops(fs, bound(ops));
 
     wrapped_root = tuple_notifier_wrap(filesystem_getroot(fs));
     assert(wrapped_root != INVALID_ADDRESS);
+    if (early_root_notifys) {
+        table_foreach(early_root_notifys, s, n)
+            tuple_notifier_register_set_notify(wrapped_root, s, n);
+        deallocate_table(early_root_notifys);
+        early_root_notifys = 0;
+    }
     // XXX use wrapped_root after root fs is separate
     tuple root = filesystem_getroot(root_fs);
+    u64 commit_delay;
+    if (get_u64(root, sym(log_commit_delay), &commit_delay))
+        filesystem_set_log_commit_delay(fs, microseconds(commit_delay));
     tuple mounts = get_tuple(root, sym(mounts));
     if (mounts)
         storage_set_mountpoints(mounts);
@@ -110,6 +175,11 @@ closure_function(3, 2, void, fsstarted,
     if (!get(root, booted))
         filesystem_write_eav(fs, root, booted, null_value);
     config_console(root);
+    config_bhqueues(root);
+    config_idle_poll(root);
+    config_zero_pool(root);
+    if (config_isolcpus(root))
+        pci_steer_msix();
 }
 
 /* This is very simplistic and uses a fixed drain threshold. This
@@ -164,8 +234,19 @@ tuple get_root_tuple(void)
 }
 KLIB_EXPORT(get_root_tuple);
 
+/* Drivers may register before the root filesystem is mounted; such notifiers
+   are attached (and applied to any existing value) once it is. */
 void register_root_notify(symbol s, set_value_notify n)
 {
+    if (!wrapped_root) {
+        if (!early_root_notifys) {
+            early_root_notifys = allocate_table(heap_locked(init_heaps), identity_key,
+                                                pointer_equal);
+            assert(early_root_notifys != INVALID_ADDRESS);
+        }
+        table_set(early_root_notifys, s, n);
+        return;
+    }
     // XXX to be restored when root fs tuple is separated from root tuple
     tuple_notifier_register_set_notify(wrapped_root, s, n);
 }
@@ -183,23 +264,24 @@ boolean first_boot(void)
 }
 KLIB_EXPORT(first_boot);
 
-static void rootfs_init(u8 *mbr, u64 offset,
-                        block_io r, block_io w, u64 length)
+static void rootfs_init(u8 *mbr, u64 offset, block_io r, block_io w,
+                        storage_ops ops, storage_stats st, u64 length)
 {
     init_debug("%s", __func__);
     length -= offset;
     heap h = heap_locked(init_heaps);
+    ops = offset_storage_ops(h, offset, ops);
     create_filesystem(h,
                       SECTOR_SIZE,
                       length,
                       closure(h, offset_block_io, offset, r),
                       closure(h, offset_block_io, offset, w),
                       false,
-                      closure(h, fsstarted, mbr, r, w));
+                      closure(h, fsstarted, mbr, r, w, ops, st));
 }
 
-closure_function(4, 1, void, mbr_read,
-                 u8 *, mbr, block_io, r, block_io, w, u64, length,
+closure_function(5, 1, void, mbr_read,
+                 u8 *, mbr, block_io, r, block_io, w, storage_ops, ops, u64, length,
                  status, s)
 {
     init_debug("%s", __func__);
@@ -208,29 +290,45 @@ closure_function(4, 1, void, mbr_read,
         goto out;
     }
     u8 *mbr = bound(mbr);
+    heap h = heap_locked(init_heaps);
+
+    /* Filesystem I/O goes through request queues that merge adjacent
+       requests; the kernel log dump must bypass them, as it is written
+       when bottom halves no longer run. */
+    storage_stats st = allocate_storage_stats(h);
+    block_io r = storage_bioq(h, bound(r), MAX_BLOCK_IO_SIZE >> SECTOR_OFFSET,
+                              st, STORAGE_OP_READ);
+    block_io w = storage_bioq(h, bound(w), MAX_BLOCK_IO_SIZE >> SECTOR_OFFSET,
+                              st, STORAGE_OP_WRITE);
+    if (r == INVALID_ADDRESS || w == INVALID_ADDRESS) {
+        msg_err("cannot allocate block request queues\n");
+        deallocate(h, mbr, SECTOR_SIZE);
+        goto out;
+    }
+    storage_ops ops = queued_storage_ops(h, bound(ops), st);
     struct partition_entry *rootfs_part = partition_get(mbr, PARTITION_ROOTFS);
     if (!rootfs_part) {
         u8 uuid[UUID_LEN];
         char label[VOLUME_LABEL_MAX_LEN];
         if (filesystem_probe(mbr, uuid, label))
-            volume_add(uuid, label, bound(r), bound(w), bound(length));
+            volume_add(uuid, label, r, w, ops, st, bound(length));
         else
             init_debug("unformatted storage device, ignoring");
-        deallocate(heap_locked(init_heaps), mbr, SECTOR_SIZE);
+        deallocate(h, mbr, SECTOR_SIZE);
     } else {
         /* The on-disk kernel log dump section is immediately before the first partition. */
         struct partition_entry *first_part = partition_at(mbr, 0);
         klog_disk_setup(first_part->lba_start * SECTOR_SIZE - KLOG_DUMP_SIZE, bound(r), bound(w));
 
-        rootfs_init(mbr, rootfs_part->lba_start * SECTOR_SIZE,
-                    bound(r), bound(w), bound(length));
+        rootfs_init(mbr, rootfs_part->lba_start * SECTOR_SIZE, r, w, ops, st,
+                    bound(length));
     }
   out:
     closure_finish();
 }
 
-closure_function(0, 3, void, attach_storage,
-                 block_io, r, block_io, w, u64, length)
+closure_function(0, 4, void, attach_storage,
+                 block_io, r, block_io, w, storage_ops, ops, u64, length)
 {
     heap h = heap_locked(init_heaps);
     /* Read partition table from disk */
@@ -239,7 +337,7 @@ closure_function(0, 3, void, attach_storage,
         msg_err("cannot allocate memory for MBR sector\n");
         return;
     }
-    status_handler sh = closure(h, mbr_read, mbr, r, w, length);
+    status_handler sh = closure(h, mbr_read, mbr, r, w, ops, length);
     if (sh == INVALID_ADDRESS) {
         msg_err("cannot allocate MBR read closure\n");
         deallocate(h, mbr, SECTOR_SIZE);
@@ -272,6 +370,9 @@ void kernel_runtime_init(kernel_heaps kh)
     pci_discover(); // early PCI discover to configure VGA console
     init_debug("clock");
     init_clock();
+    init_debug("init_topology");
+    init_topology(kh);
+    init_numa_heaps(kh);
     init_debug("init_kernel_contexts");
     init_kernel_contexts(backed);
 
@@ -285,6 +386,7 @@ void kernel_runtime_init(kernel_heaps kh)
     /* platform detection and early init */
     init_debug("probing for hypervisor platform");
     detect_hypervisor(kh);
+    boot_milestone("platform clock");
 
     /* RNG, stack canaries */
     init_debug("RNG");
@@ -302,6 +404,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     init_debug("detect_devices");
     detect_devices(kh, sa);
+    boot_milestone("devices detected");
 
     init_debug("pci_discover (for other devices)");
     pci_discover();
@@ -309,6 +412,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     init_debug("start_secondary_cores");
     start_secondary_cores(kh);
+    boot_milestone("secondary cores started");
 
     init_debug("starting runloop");
     runloop();
@@ -356,6 +460,7 @@ void __attribute__((noreturn)) kernel_shutdown(int status)
     shutdown_handler h;
 
     shutting_down = true;
+    console_flush();
 
     if (root_fs)
         vector_push(shutdown_completions,
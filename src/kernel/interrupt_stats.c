@@ -0,0 +1,154 @@
+/* Interrupt accounting: per-cpu delivery counts and a handler run time
+   histogram (log2 buckets of cycle counts) for each registered vector.
+
+   The architecture interrupt code calls interrupt_stats_register() and
+   interrupt_stats_unregister() alongside its own handler registration, and
+   interrupt_stats_record() after running the handlers for a vector. IPIs are
+   accounted like any other vector, so each IPI type (wakeup, flush,
+   shutdown, ...) has its own row. Results appear in /proc/interrupts and in
+   the management tree under /interrupts/<vector>. */
+#include <kernel.h>
+
+u32 interrupt_stats_vectors;
+u64 *interrupt_counts;          /* [cpu][vector] */
+u64 **interrupt_latency;        /* [vector][bucket], allocated on registration */
+
+static heap interrupt_stats_heap;
+static const char **interrupt_stats_names;
+static tuple interrupt_stats_root;
+
+static void interrupt_stats_add_management(int vector);
+
+void init_interrupt_stats(heap h, u32 nvectors)
+{
+    interrupt_stats_heap = h;
+    interrupt_counts = allocate_zero(h, MAX_CPUS * nvectors * sizeof(u64));
+    assert(interrupt_counts != INVALID_ADDRESS);
+    interrupt_latency = allocate_zero(h, nvectors * sizeof(u64 *));
+    assert(interrupt_latency != INVALID_ADDRESS);
+    interrupt_stats_names = allocate_zero(h, nvectors * sizeof(const char *));
+    assert(interrupt_stats_names != INVALID_ADDRESS);
+    interrupt_stats_vectors = nvectors;
+}
+
+/* called at initialization or with the kernel lock held; shared vectors keep
+   the name of the first handler registered */
+void interrupt_stats_register(int vector, const char *name)
+{
+    if (!interrupt_stats_vectors || vector >= interrupt_stats_vectors)
+        return;
+    if (interrupt_stats_names[vector])
+        return;
+    if (!interrupt_latency[vector]) {
+        u64 *hist = allocate_zero(interrupt_stats_heap, LOG2_HIST_BUCKETS * sizeof(u64));
+        assert(hist != INVALID_ADDRESS);
+        interrupt_latency[vector] = hist;
+    }
+    interrupt_stats_names[vector] = name;
+    if (interrupt_stats_root)
+        interrupt_stats_add_management(vector);
+}
+
+/* counts are kept, but the vector is no longer listed */
+void interrupt_stats_unregister(int vector)
+{
+    if (vector < interrupt_stats_vectors)
+        interrupt_stats_names[vector] = 0;
+}
+
+static u64 interrupt_count_total(int vector)
+{
+    u64 total = 0;
+    for (int cpu = 0; cpu < total_processors; cpu++)
+        total += interrupt_counts[cpu * interrupt_stats_vectors + vector];
+    return total;
+}
+
+/* as in Linux /proc/interrupts: a header of cpus, then a row of per-cpu
+   counts for each registered vector */
+void interrupt_stats_print(buffer b)
+{
+    bprintf(b, "    ");
+    for (int cpu = 0; cpu < total_processors; cpu++)
+        bprintf(b, "%nCPU%d", cpu < 10 ? 8 : 7, cpu);
+    bprintf(b, "\n");
+    for (int v = 0; v < interrupt_stats_vectors; v++) {
+        const char *name = interrupt_stats_names[v];
+        if (!name)
+            continue;
+        bprintf(b, "%3d:", v);
+        for (int cpu = 0; cpu < total_processors; cpu++)
+            bprintf(b, " %10ld", interrupt_counts[cpu * interrupt_stats_vectors + v]);
+        bprintf(b, "   %s\n", name);
+    }
+}
+
+closure_function(2, 0, value, interrupt_count_get,
+                 int, vector, value, v)
+{
+    return value_rewrite_u64(bound(v), interrupt_count_total(bound(vector)));
+}
+
+closure_function(2, 0, value, interrupt_cpus_get,
+                 int, vector, value, v)
+{
+    buffer b = (buffer)bound(v);
+    buffer_clear(b);
+    for (int cpu = 0; cpu < total_processors; cpu++)
+        bprintf(b, "%s%ld", cpu ? " " : "",
+                interrupt_counts[cpu * interrupt_stats_vectors + bound(vector)]);
+    return b;
+}
+
+closure_function(0, 1, boolean, interrupt_stats_reset,
+                 value, v)
+{
+    zero(interrupt_counts, MAX_CPUS * interrupt_stats_vectors * sizeof(u64));
+    for (int i = 0; i < interrupt_stats_vectors; i++) {
+        if (interrupt_latency[i])
+            zero(interrupt_latency[i], LOG2_HIST_BUCKETS * sizeof(u64));
+    }
+    return false;               /* nothing to store */
+}
+
+static void interrupt_stats_add_management(int vector)
+{
+    heap h = interrupt_stats_heap;
+    symbol k = intern_u64(vector);
+    if (get(interrupt_stats_root, k))
+        return;                 /* re-registered vector */
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    set(t, sym(name), buffer_cstring(h, interrupt_stats_names[vector]));
+    value v = value_from_u64(h, 0);
+    set(t, sym(count), v);
+    tuple_notifier_register_get_notify(n, sym(count), closure(h, interrupt_count_get, vector, v));
+    v = allocate_buffer(h, 64);
+    assert(v != INVALID_ADDRESS);
+    set(t, sym(cpus), v);
+    tuple_notifier_register_get_notify(n, sym(cpus), closure(h, interrupt_cpus_get, vector, v));
+    log2_hist_register(n, t, sym(latency), interrupt_latency[vector]);
+    set(interrupt_stats_root, k, n);
+}
+
+/* /interrupts/<vector>/{name,count,cpus,latency}, with per-cpu counts in
+   "cpus" and the handler run time histogram in "latency"; setting
+   /interrupts/reset clears all counts */
+void init_interrupt_stats_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    tuple interrupts = allocate_tuple();
+    assert(interrupts);
+    tuple_notifier n = tuple_notifier_wrap(interrupts);
+    assert(n != INVALID_ADDRESS);
+    tuple_notifier_register_set_notify(n, sym(reset), closure(h, interrupt_stats_reset));
+    set(interrupts, sym(no_encode), null_value);
+    interrupt_stats_root = interrupts;
+    for (int v = 0; v < interrupt_stats_vectors; v++) {
+        if (interrupt_stats_names[v])
+            interrupt_stats_add_management(v);
+    }
+    set(root, sym(interrupts), n);
+}
@@ -73,28 +73,40 @@ void resume_kernel_context(kernel_context c)
     cpuinfo ci = current_cpu();
     spare_kernel_context = get_kernel_context(ci);
     set_kernel_context(ci, c);
+    runloop_requeue_batches();
     frame_return(c->frame);
 }
 
 struct cpuinfo cpuinfos[MAX_CPUS];
 
-static void init_cpuinfos(heap backed)
+static void init_cpuinfos(void)
 {
     /* We're stuck with a hard limit of 64 for now due to bitmask... */
     build_assert(MAX_CPUS <= 64);
 
     /* We'd like the aps to allocate for themselves, but we don't have
-       per-cpu heaps just yet. */
+       per-cpu heaps just yet. Allocate from the cpu's node instead. */
     for (int i = 0; i < MAX_CPUS; i++) {
         cpuinfo ci = cpuinfo_from_id(i);
+        heap backed = numa_backed_heap(ci->node);
         /* state */
         set_running_frame(ci, 0);
         ci->id = i;
         ci->state = cpu_not_present;
         ci->have_kernel_lock = false;
+        ci->lockless_syscall = false;
         ci->thread_queue = allocate_queue(backed, MAX_THREADS);
+        ci->cpu_queue = allocate_deque(backed, 2048);
         ci->last_timer_update = 0;
+        ci->tickless = false;
+        ci->idle_start = 0;
+        ci->idle_poll = microseconds(IDLE_POLL_START_US);
+        ci->idle_polling = false;
+        ci->bh_batch.q = ci->rq_batch.q = 0;
+        ci->bh_batch.next = ci->bh_batch.count = 0;
+        ci->rq_batch.next = ci->rq_batch.count = 0;
         ci->frcount = 0;
+        zero(ci->sched_hist, sizeof(ci->sched_hist));
 
         init_cpuinfo_machine(ci, backed);
 
@@ -107,12 +119,63 @@ static void init_cpuinfos(heap backed)
     cpu_init(0);
 }
 
+/* The transient heap hands out objects from the arena of the current
+   cpu. An arena deallocation only looks at the slab holding the object, so
+   objects may be freed through any cpu's arena. */
+static struct heap transient_heap;
+
+static u64 transient_alloc(heap h, bytes b)
+{
+    u64 flags = irq_disable_save();
+    u64 a = allocate_u64(current_cpu()->transient, b);
+    irq_restore(flags);
+    return a;
+}
+
+static void transient_dealloc(heap h, u64 a, bytes b)
+{
+    deallocate_u64(current_cpu()->transient, a, b);
+}
+
+static bytes transient_allocated(heap h)
+{
+    bytes allocated = 0;
+    for (int i = 0; i < MAX_CPUS; i++)
+        allocated += heap_allocated(cpuinfo_from_id(i)->transient);
+    return allocated;
+}
+
+static bytes transient_total(heap h)
+{
+    bytes total = 0;
+    for (int i = 0; i < MAX_CPUS; i++)
+        total += heap_total(cpuinfo_from_id(i)->transient);
+    return total;
+}
+
+static void init_transient_heap(kernel_heaps kh)
+{
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        ci->transient = allocate_arena(heap_locked(kh), numa_backed_heap(ci->node),
+                                       TRANSIENT_SLAB_SIZE);
+        assert(ci->transient != INVALID_ADDRESS);
+    }
+    transient_heap.alloc = transient_alloc;
+    transient_heap.dealloc = transient_dealloc;
+    transient_heap.allocated = transient_allocated;
+    transient_heap.total = transient_total;
+    transient_heap.pagesize = cpuinfo_from_id(0)->transient->pagesize;
+    kh->transient = &transient_heap;
+}
+
 void init_kernel_contexts(heap backed)
 {
     spare_kernel_context = allocate_kernel_context(backed);
     assert(spare_kernel_context != INVALID_ADDRESS);
-    init_cpuinfos(backed);
+    init_cpuinfos();
     current_cpu()->state = cpu_kernel;
+    init_transient_heap(get_kernel_heaps());
 }
 
 void install_fallback_fault_handler(fault_handler h)
@@ -8,6 +8,8 @@
 
 typedef struct nanos_thread {
     thunk pause;
+    u64 affinity;               /* permitted cpus; xxx - limited to 64 like idle_cpu_mask */
+    u64 wake_cycles;            /* cycle count at wakeup, 0 once running */
 } *nanos_thread;
 
 #define cpu_not_present 0
@@ -16,16 +18,47 @@ typedef struct nanos_thread {
 #define cpu_interrupt 3
 #define cpu_user 4
 
+/* Thunks claimed with one dequeue_n() reservation. A thunk may not return
+   to the loop that claimed it (it may block a syscall or resume a suspended
+   kernel context), so batches live in cpuinfo rather than on the stack. */
+typedef struct thunk_batch {
+    thunk t[RUNLOOP_BATCH_SIZE];
+    struct queue *q;            /* claimed from */
+    u32 next;
+    u32 count;
+} *thunk_batch;
+
+/* per-cpu scheduler histograms, in log2 buckets of cycle counts (see
+   log2_hist_record()) */
+#define SCHED_HIST_WAKEUP   0   /* thread wakeup to running */
+#define SCHED_HIST_BH       1   /* bottom half run time */
+#define SCHED_HIST_RUNQUEUE 2   /* runqueue thunk run time */
+#define SCHED_HIST_COUNT    3
+
 /* per-cpu, architecture-independent invariants */
 typedef struct cpuinfo {
     struct cpuinfo_machine m;
     u32 id;
+    u32 node;                   /* NUMA node */
     int state;
     boolean have_kernel_lock;
-    queue thread_queue;
+    boolean lockless_syscall;   /* in a syscall dispatched without the kernel lock */
+    queue thread_queue;         /* runnable thread frames */
+    deque cpu_queue;            /* kernel lock work pushed by this cpu */
+    queue bh_queue;             /* bottom halves bound to this cpu */
+    timerheap timers;           /* timers armed on this cpu */
     timestamp last_timer_update;
+    boolean tickless;           /* running a thread without a preemption timer */
+    timestamp idle_start;       /* when the cpu went idle, if polling is enabled */
+    timestamp idle_poll;        /* current poll-before-halt window */
+    boolean idle_polling;       /* waking needs no ipi */
     u64 frcount;
     u64 inval_gen; /* Generation number for invalidates */
+    struct thunk_batch bh_batch;
+    struct thunk_batch rq_batch;
+    u64 sched_hist[SCHED_HIST_COUNT][LOG2_HIST_BUCKETS];
+    heap transient;             /* arena behind the transient heap */
+    s64 alloc_profile_countdown; /* bytes to next allocation sample */
 
 #ifdef CONFIG_FTRACE
     int graph_idx;
@@ -49,6 +82,27 @@ static inline cpuinfo cpuinfo_from_id(int cpu)
     return &cpuinfos[cpu];
 }
 
+/* called with interrupts disabled */
+static inline void sched_hist_record(int hist, u64 cycles)
+{
+    log2_hist_record(current_cpu()->sched_hist[hist], cycles);
+}
+
+/* interrupt accounting; see interrupt_stats.c */
+extern u32 interrupt_stats_vectors;
+extern u64 *interrupt_counts;
+extern u64 **interrupt_latency;
+
+/* called with interrupts disabled after running the handlers for vector,
+   with start the cycle count taken before them */
+static inline void interrupt_stats_record(cpuinfo ci, int vector, u64 start)
+{
+    interrupt_counts[ci->id * interrupt_stats_vectors + vector]++;
+    u64 *hist = interrupt_latency[vector];
+    if (hist)
+        log2_hist_record_atomic(hist, rdtsc() - start);
+}
+
 static inline boolean is_current_kernel_context(context f)
 {
     return f == current_cpu()->m.kernel_context->frame;
@@ -147,6 +201,7 @@ void resume_kernel_context(kernel_context c);
 void frame_return(context frame) __attribute__((noreturn));
 
 void init_interrupts(kernel_heaps kh);
+void init_topology(kernel_heaps kh);
 void msi_map_vector(int slot, int msislot, int vector);
 
 void syscall_enter(void);
@@ -170,11 +225,22 @@ void syscall_enter(void);
         return r;                                       \
     }
 
+#define _IRQSAFE_3(rtype, name, t0, t1, t2)                     \
+    static inline rtype name ## _irqsafe (t0 a0, t1 a1, t2 a2)  \
+    {                                                           \
+        u64 flags = irq_disable_save();                         \
+        rtype r = name(a0, a1, a2);                             \
+        irq_restore(flags);                                     \
+        return r;                                               \
+    }
+
 _IRQSAFE_2(boolean, enqueue, queue, void *);
 _IRQSAFE_2(boolean, enqueue_single, queue, void *);
 
 _IRQSAFE_1(void *, dequeue, queue);
 _IRQSAFE_1(void *, dequeue_single, queue);
+_IRQSAFE_3(u32, dequeue_n, queue, void **, u32);
+_IRQSAFE_3(u32, dequeue_n_single, queue, void **, u32);
 
 /* may not need irqsafe variants of these ... but it doesn't hurt to add */
 _IRQSAFE_1(u64, queue_length, queue);
@@ -183,18 +249,55 @@ _IRQSAFE_1(boolean, queue_full, queue);
 _IRQSAFE_1(void *, queue_peek, queue);
 #undef _IRQSAFE_1
 #undef _IRQSAFE_2
+#undef _IRQSAFE_3
 #endif
 
 typedef struct queue *queue;
-extern queue bhqueue;
+
+/* bottom half priority levels, highest first */
+#define BH_PRIO_INTERRUPT  0    /* resuming suspended kernel work */
+#define BH_PRIO_NETWORK    1
+#define BH_PRIO_STORAGE    2
+#define BH_PRIO_BACKGROUND 3
+#define BH_PRIO_LEVELS     4
+
+extern queue bhqueues[BH_PRIO_LEVELS];
+extern queue bhqueue;           /* storage level */
 extern queue runqueue;
-extern timerheap runloop_timers;
+
+/* Polled device work, as for NAPI-style receive. The device interrupt masks
+   further notifications and schedules the poller. Its handler then runs
+   under the kernel lock with a budget (rx_poll_budget). A handler that
+   returns true has used its budget with work left over, and runs again on
+   the next runloop pass, after threads have had their turn. Otherwise it
+   has unmasked notifications and rechecked for work that raced with that. */
+typedef closure_type(poll_handler, boolean, u32);
+
+declare_closure_struct(1, 0, void, poller_run,
+                       struct poller *, p);
+
+typedef struct poller {
+    poll_handler handler;
+    u32 scheduled;
+    closure_struct(poller_run, run);
+} *poller;
+
+extern u32 rx_poll_budget;
+void init_poller(poller p, poll_handler handler);
+void poller_schedule(poller p);
 
 backed_heap mem_debug_backed(heap m, backed_heap bh, u64 padsize);
+heap alloc_profile_heap(heap meta, heap parent, const char *name);
 
 backed_heap physically_backed(heap meta, heap virtual, heap physical, u64 pagesize,
                               boolean locking);
 void physically_backed_dealloc_virtual(backed_heap bh, u64 x, bytes length);
+
+typedef struct dma_pool *dma_pool;
+dma_pool allocate_dma_pool(heap meta, backed_heap backed, bytes size, bytes align, u64 count);
+void *dma_pool_get(dma_pool p, u64 *phys);
+void dma_pool_put(dma_pool p, void *buf, u64 phys);
+void destroy_dma_pool(dma_pool p);
 static inline void bhqueue_enqueue_irqsafe(thunk t)
 {
     /* an interrupted enqueue and competing enqueue from int handler could cause a
@@ -208,6 +311,8 @@ static inline void bhqueue_enqueue_irqsafe(thunk t)
 
 heap allocate_tagged_region(kernel_heaps kh, u64 tag);
 heap locking_heap_wrapper(heap meta, heap parent);
+heap locking_magazine_wrapper(heap meta, heap parent, int nclasses, bytes cache_pagesize);
+void enable_heap_smp(void);
 
 #endif
 
@@ -226,7 +331,7 @@ void init_clock(void);
 void process_bhqueue();
 void install_fallback_fault_handler(fault_handler h);
 
-void msi_format(u32 *address, u32 *data, int vector);
+void msi_format(u32 *address, u32 *data, int vector, u32 target_cpu);
 
 u64 allocate_ipi_interrupt(void);
 void deallocate_ipi_interrupt(u64 irq);
@@ -239,14 +344,78 @@ void register_shirq(int vector, thunk t, const char *name);
 void kern_lock(void);
 boolean kern_try_lock(void);
 void kern_unlock(void);
+boolean runqueue_push(thunk t);
+void bhqueue_enqueue_cpu(u64 cpu, thunk t);
+void runloop_requeue_batches(void);
+timer kern_register_timer(clock_id id, timestamp val, boolean absolute,
+                          timestamp interval, timer_handler n);
+timer kern_register_timer_slack(clock_id id, timestamp val, boolean absolute,
+                                timestamp interval, timestamp slack, timer_handler n);
+void config_bhqueues(tuple root);
+void config_idle_poll(tuple root);
+boolean config_isolcpus(tuple root);
+u32 housekeeping_cpu(u32 cpu);
+#ifdef LOCK_STATS
+void init_lock_stats_management(tuple root);
+#endif
+void init_sched_stats_management(tuple root);
+void init_interrupt_stats(heap h, u32 nvectors);
+void interrupt_stats_register(int vector, const char *name);
+void interrupt_stats_unregister(int vector);
+void interrupt_stats_print(buffer b);
+void init_interrupt_stats_management(tuple root);
+
+/* boot_timing.c */
+void boot_milestone(const char *name);
+void boot_timing_format(buffer b);
+void boot_timing_report(void);
+void init_boot_timing_management(tuple root);
+
+/* vm_resume.c */
+void register_vm_resume_notify(thunk t);
+void vm_resume_detected(void);
+
+void init_alloc_profile_management(tuple root);
+
+/* cpu_profile.c */
+extern context (*cpu_profile_user_frame)(void);
+void init_cpu_profile_management(tuple root);
+
+/* metrics.c */
+typedef closure_type(metrics_source, void, buffer);
+void metrics_register_source(metrics_source s);
+void init_metrics(tuple root);
+
 void init_scheduler(heap);
 void mm_service(void);
 
+/* zero_pool.c */
+u64 zero_pool_take(void);
+void zero_pool_refill(void);
+void config_zero_pool(tuple root);
+
 typedef closure_type(balloon_deflater, u64, u64);
 void mm_register_balloon_deflater(balloon_deflater deflater);
 
 kernel_heaps get_kernel_heaps(void);
 
+/* numa.c */
+extern u32 numa_node_count;
+u32 numa_node_from_domain(u32 domain);
+void numa_add_memory(u32 domain, range r);
+void numa_set_cpu_domain(int cpu, u32 domain);
+void numa_set_distance(u32 from_domain, u32 to_domain, u8 distance);
+u8 numa_distance(u32 from, u32 to);
+heap numa_physical_heap(u32 node);
+heap numa_backed_heap(u32 node);
+void init_numa_heaps(kernel_heaps kh);
+
+/* physical pages local to the running cpu */
+static inline heap heap_physical_local(void)
+{
+    return numa_physical_heap(current_cpu()->node);
+}
+
 tuple get_root_tuple(void);
 tuple get_environment(void);
 void register_root_notify(symbol s, set_value_notify n);
@@ -256,16 +425,21 @@ boolean first_boot(void);
 extern void interrupt_exit(void);
 extern char **state_strings;
 
-// static inline void schedule_frame(context f) stupid header deps
-#define schedule_frame(__f)  do { assert((__f)[FRAME_QUEUE] != INVALID_PHYSICAL); assert(enqueue_irqsafe((queue)pointer_from_u64((__f)[FRAME_QUEUE]), pointer_from_u64((__f)[FRAME_RUN]))); } while(0)
+void schedule_frame(context f);
 
 void kernel_unlock();
 
 extern u64 idle_cpu_mask;
+extern u64 isolated_cpu_mask;
 extern u64 total_processors;
 extern u64 present_processors;
 extern void xsave(context f);
 
+static inline boolean cpu_isolated(u64 cpu)
+{
+    return (isolated_cpu_mask & U64_FROM_BIT(cpu)) != 0;
+}
+
 void cpu_init(int cpu);
 void start_secondary_cores(kernel_heaps kh);
 void detect_hypervisor(kernel_heaps kh);
@@ -277,6 +451,12 @@ typedef closure_type(shutdown_handler, void, int, merge);
 extern int shutdown_vector;
 extern boolean shutting_down;
 void wakeup_or_interrupt_cpu_all();
+void interrupt_cpu(u64 cpu);
 
 typedef closure_type(halt_handler, void, int);
 extern halt_handler vm_halt;
+
+/* paravirtual vcpu hints set by the hypervisor platform, or 0 */
+extern boolean (*vcpu_preempted)(cpuinfo ci);
+extern void (*vcpu_yield_to)(cpuinfo ci);
+extern timestamp (*vcpu_steal_time)(cpuinfo ci);
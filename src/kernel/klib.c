@@ -74,27 +74,46 @@ closure_function(1, 4, u64, klib_elf_map,
     return vaddr;
 }
 
-closure_function(2, 1, status, load_klib_complete,
-                 const char *, name, klib_handler, complete,
-                 buffer, b)
+static klib klib_alloc(const char *name)
 {
     heap h = heap_general(klib_kh);
-    klib_handler complete = bound(complete);
     klib kl = allocate(h, sizeof(struct klib));
     assert(kl != INVALID_ADDRESS);
 
     kl->mappings = allocate_rangemap(h);
     assert(kl->mappings != INVALID_ADDRESS);
 
-    int namelen = MIN(runtime_strlen(bound(name)), KLIB_MAX_NAME - 1);
-    runtime_memcpy(kl->name, bound(name), namelen);
+    int namelen = MIN(runtime_strlen(name), KLIB_MAX_NAME - 1);
+    runtime_memcpy(kl->name, name, namelen);
     kl->name[namelen] = '\0';
     kl->syms = allocate_table(h, key_from_symbol, pointer_equal);
     assert(kl->syms != INVALID_ADDRESS);
+    kl->elf = 0;
+    kl->load_range = irange(0, 0);
+    return kl;
+}
+
+static void klib_run_init(klib kl, void *entry, klib_handler complete)
+{
+    klib_debug("   init entry @ %p, first word 0x%lx\n", entry, *(u64*)entry);
+    klib_init ki = (klib_init)entry;
+    int rv = ki(kl->syms, get_sym, add_sym);
+    status s = rv == KLIB_INIT_OK ? STATUS_OK :
+        timm("result", "module initialization failed with %d", rv);
+    klib_debug("   init status %v, applying completion\n", s);
+    boot_milestone("klib loaded");
+    apply(complete, kl, s);
+}
+
+closure_function(2, 1, status, load_klib_complete,
+                 const char *, name, klib_handler, complete,
+                 buffer, b)
+{
+    klib_handler complete = bound(complete);
+    klib kl = klib_alloc(bound(name));
     kl->elf = b;
 
     klib_debug("%s: klib %p, read length %ld\n", __func__, kl, buffer_length(b));
-    kl->load_range = irange(0, 0);
     walk_elf(b, stack_closure(klib_elf_walk, kl));
     u64 where = allocate_u64((heap)klib_heap, range_span(kl->load_range));
     assert(where != INVALID_PHYSICAL);
@@ -110,13 +129,7 @@ closure_function(2, 1, status, load_klib_complete,
     klib_debug("   ingesting elf symbols for debug\n");
     add_elf_syms(b, where);
 
-    klib_debug("   init entry @ %p, first word 0x%lx\n", entry, *(u64*)entry);
-    klib_init ki = (klib_init)entry;
-    int rv = ki(kl->syms, get_sym, add_sym);
-    status s = rv == KLIB_INIT_OK ? STATUS_OK :
-        timm("result", "module initialization failed with %d", rv);
-    klib_debug("   init status %v, applying completion\n", s);
-    apply(complete, kl, s);
+    klib_run_init(kl, entry, complete);
     closure_finish();
     return STATUS_OK;
 }
@@ -131,6 +144,231 @@ closure_function(1, 1, void, load_klib_failed,
     closure_finish();
 }
 
+/* Klibs are built with debug info, most of which is never needed by the
+   kernel. When the loadable segments sit at file offsets equal to their
+   addresses, as klib.lds lays them out, only the file up to the end of
+   the last segment is read, straight into the klib's memory; relocations
+   are applied in place. The symbol table, for symbolized traces, is read
+   separately once the klib is running. Other layouts are read whole. */
+#define KLIB_HEADER_READ_SIZE   PAGESIZE
+
+typedef struct klib_load {
+    const char *name;
+    klib_handler complete;
+    fsfile f;
+    u64 file_length;
+    buffer hdrs;                /* ELF and program headers */
+    Elf64_Shdr *shdrs;
+    u64 shdrs_size;
+    u64 image_size;             /* file bytes read into the image */
+    klib kl;
+    u64 where;
+} *klib_load;
+
+closure_function(1, 2, void, klib_read_complete,
+                 status_handler, sh,
+                 status, s, bytes, count)
+{
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+static boolean klib_image_mappable(klib_load ld)
+{
+    buffer b = ld->hdrs;
+    u64 len = buffer_length(b);
+    if (len < sizeof(Elf64_Ehdr))
+        return false;
+    Elf64_Ehdr *e = buffer_ref(b, 0);
+    if (e->e_phoff + (u64)e->e_phnum * e->e_phentsize > len ||
+        e->e_shentsize != sizeof(Elf64_Shdr) || e->e_shnum == 0 ||
+        e->e_shoff + (u64)e->e_shnum * e->e_shentsize > ld->file_length)
+        return false;
+    boolean base = false;
+    ld->image_size = 0;
+    foreach_phdr(e, p) {
+        if (p->p_type != PT_LOAD)
+            continue;
+        if (p->p_vaddr != p->p_offset || p->p_memsz < p->p_filesz ||
+            p->p_offset + p->p_filesz > ld->file_length)
+            return false;
+        if (p->p_vaddr == 0)
+            base = true;
+        ld->image_size = MAX(ld->image_size, p->p_offset + p->p_filesz);
+    }
+    return base;
+}
+
+static void klib_load_free(klib_load ld)
+{
+    heap h = heap_general(klib_kh);
+    deallocate_buffer(ld->hdrs);
+    if (ld->shdrs)
+        deallocate(h, ld->shdrs, ld->shdrs_size);
+    deallocate(h, ld, sizeof(struct klib_load));
+}
+
+closure_function(4, 1, void, klib_symtab_read,
+                 u64, where, void *, syms, u64, syms_size, u64, strs_size,
+                 status, s)
+{
+    void *syms = bound(syms);
+    u64 syms_size = bound(syms_size);
+    if (is_ok(s))
+        add_elf_symtab(syms, syms_size, syms + syms_size, bound(strs_size), bound(where));
+    else
+        timm_dealloc(s);
+    deallocate(heap_general(klib_kh), syms, syms_size + bound(strs_size));
+    closure_finish();
+}
+
+static void klib_read_symtab(klib_load ld)
+{
+    Elf64_Shdr *symtab = 0, *strtab = 0;
+    for (int i = 0; i < ld->shdrs_size / sizeof(Elf64_Shdr); i++) {
+        if (ld->shdrs[i].sh_type == SHT_SYMTAB) {
+            symtab = &ld->shdrs[i];
+            break;
+        }
+    }
+    if (!symtab || symtab->sh_entsize != sizeof(Elf64_Sym) ||
+        symtab->sh_link >= ld->shdrs_size / sizeof(Elf64_Shdr))
+        return;
+    strtab = &ld->shdrs[symtab->sh_link];
+    if (symtab->sh_offset + symtab->sh_size > ld->file_length ||
+        strtab->sh_offset + strtab->sh_size > ld->file_length)
+        return;
+    heap h = heap_general(klib_kh);
+    void *syms = allocate(h, symtab->sh_size + strtab->sh_size);
+    if (syms == INVALID_ADDRESS)
+        return;
+    merge m = allocate_merge(h, closure(h, klib_symtab_read, ld->where, syms,
+                                        symtab->sh_size, strtab->sh_size));
+    status_handler sh = apply_merge(m);
+    filesystem_read_linear(ld->f, syms, irangel(symtab->sh_offset, symtab->sh_size),
+                           closure(h, klib_read_complete, apply_merge(m)));
+    filesystem_read_linear(ld->f, syms + symtab->sh_size,
+                           irangel(strtab->sh_offset, strtab->sh_size),
+                           closure(h, klib_read_complete, apply_merge(m)));
+    apply(sh, STATUS_OK);
+}
+
+closure_function(1, 1, void, klib_image_read,
+                 klib_load, ld,
+                 status, s)
+{
+    klib_load ld = bound(ld);
+    klib kl = ld->kl;
+    klib_handler complete = ld->complete;
+    closure_finish();
+    if (!is_ok(s)) {
+        unload_klib(kl);
+        klib_load_free(ld);
+        apply(complete, INVALID_ADDRESS, s);
+        return;
+    }
+    u64 where = ld->where;
+    Elf64_Ehdr *e = buffer_ref(ld->hdrs, 0);
+
+    /* the read may have covered bss with other file contents */
+    foreach_phdr(e, p) {
+        if (p->p_type == PT_LOAD && p->p_memsz > p->p_filesz)
+            zero(pointer_from_u64(where + p->p_vaddr + p->p_filesz), p->p_memsz - p->p_filesz);
+    }
+
+    klib_debug("   resolving relocations\n");
+    struct buffer image = { .contents = pointer_from_u64(where), .start = 0,
+                            .end = ld->image_size, .length = ld->image_size,
+                            .wrapped = true };
+    for (int i = 0; i < ld->shdrs_size / sizeof(Elf64_Shdr); i++) {
+        Elf64_Shdr *sh = &ld->shdrs[i];
+        if (sh->sh_type == SHT_RELA && sh->sh_addr + sh->sh_size <= ld->image_size)
+            elf_apply_relocate_add(&image, sh, where);
+    }
+
+    foreach_phdr(e, p) {
+        if (p->p_type != PT_LOAD || p->p_memsz == 0)
+            continue;
+        pageflags flags = pageflags_memory();
+        if (p->p_flags & PF_X)
+            flags = pageflags_exec(flags);
+        if (p->p_flags & PF_W)
+            flags = pageflags_writable(flags);
+        u64 start = where + (p->p_vaddr & ~PAGEMASK);
+        update_map_flags(start, pad(where + p->p_vaddr + p->p_memsz, PAGESIZE) - start, flags);
+    }
+
+    klib_read_symtab(ld);
+    void *entry = pointer_from_u64(where + e->e_entry);
+    klib_load_free(ld);
+    klib_run_init(kl, entry, complete);
+}
+
+static void klib_load_image(klib_load ld)
+{
+    heap h = heap_general(klib_kh);
+    klib kl = klib_alloc(ld->name);
+    ld->kl = kl;
+    walk_elf(ld->hdrs, stack_closure(klib_elf_walk, kl));
+    u64 size = range_span(kl->load_range);
+    u64 where = allocate_u64((heap)klib_heap, size);
+    assert(where != INVALID_PHYSICAL);
+    kl->load_range = range_add(kl->load_range, where);
+    ld->where = where;
+    klib_debug("   loading klib image @ %R, reading 0x%lx bytes\n", kl->load_range,
+               ld->image_size);
+
+    /* zeroed, and writable until relocated */
+    apply(stack_closure(klib_elf_map, kl), where, INVALID_PHYSICAL, size,
+          pageflags_writable(pageflags_memory()));
+
+    ld->shdrs = allocate(h, ld->shdrs_size);
+    assert(ld->shdrs != INVALID_ADDRESS);
+    merge m = allocate_merge(h, closure(h, klib_image_read, ld));
+    status_handler sh = apply_merge(m);
+    Elf64_Ehdr *e = buffer_ref(ld->hdrs, 0);
+    filesystem_read_linear(ld->f, ld->shdrs, irangel(e->e_shoff, ld->shdrs_size),
+                           closure(h, klib_read_complete, apply_merge(m)));
+    filesystem_read_linear(ld->f, pointer_from_u64(where), irange(0, ld->image_size),
+                           closure(h, klib_read_complete, apply_merge(m)));
+    apply(sh, STATUS_OK);
+}
+
+static void klib_read_fallback(klib_load ld, tuple md, status s)
+{
+    heap h = heap_general(klib_kh);
+    const char *name = ld->name;
+    klib_handler complete = ld->complete;
+    klib_load_free(ld);
+    if (!is_ok(s)) {
+        apply(complete, INVALID_ADDRESS, s);
+        return;
+    }
+    filesystem_read_entire(klib_fs, md, heap_backed(klib_kh),
+                           closure(h, load_klib_complete, name, complete),
+                           closure(h, load_klib_failed, complete));
+}
+
+closure_function(2, 2, void, klib_headers_read,
+                 klib_load, ld, tuple, md,
+                 status, s, bytes, count)
+{
+    klib_load ld = bound(ld);
+    tuple md = bound(md);
+    closure_finish();
+    if (is_ok(s)) {
+        buffer_produce(ld->hdrs, count);
+        if (klib_image_mappable(ld)) {
+            Elf64_Ehdr *e = buffer_ref(ld->hdrs, 0);
+            ld->shdrs_size = (u64)e->e_shnum * sizeof(Elf64_Shdr);
+            klib_load_image(ld);
+            return;
+        }
+    }
+    klib_debug("   klib %s not mappable, reading whole file\n", ld->name);
+    klib_read_fallback(ld, md, s);
+}
+
 void load_klib(const char *name, klib_handler complete)
 {
     klib_debug("%s: \"%s\", complete %p (%F)\n", __func__, name, complete, complete);
@@ -142,11 +380,28 @@ void load_klib(const char *name, klib_handler complete)
     tuple md = resolve_path(klib_root, split(h, alloca_wrap_buffer(name, runtime_strlen(name)), '/'));
     if (!md) {
         apply(complete, INVALID_ADDRESS, timm("result", "unable to resolve module name \"%s\"", name));
-    } else {
+        return;
+    }
+    fsfile f = fsfile_from_node(klib_fs, md);
+    if (!f) {
         filesystem_read_entire(klib_fs, md, heap_backed(klib_kh),
                                closure(h, load_klib_complete, name, complete),
                                closure(h, load_klib_failed, complete));
+        return;
     }
+    klib_load ld = allocate(h, sizeof(struct klib_load));
+    assert(ld != INVALID_ADDRESS);
+    ld->name = name;
+    ld->complete = complete;
+    ld->f = f;
+    ld->file_length = fsfile_get_length(f);
+    ld->shdrs = 0;
+    ld->shdrs_size = 0;
+    u64 len = MIN(ld->file_length, KLIB_HEADER_READ_SIZE);
+    ld->hdrs = allocate_buffer(h, len);
+    assert(ld->hdrs != INVALID_ADDRESS);
+    filesystem_read_linear(f, buffer_ref(ld->hdrs, 0), irange(0, len),
+                           closure(h, klib_headers_read, ld, md));
 }
 KLIB_EXPORT(load_klib);
 
@@ -178,7 +433,8 @@ void unload_klib(klib kl)
     heap h = heap_general(klib_kh);
     deallocate_rangemap(kl->mappings, stack_closure(destruct_mapping, kl));
     deallocate_u64((heap)klib_heap, kl->load_range.start, range_span(kl->load_range));
-    deallocate_buffer(kl->elf);
+    if (kl->elf)
+        deallocate_buffer(kl->elf);
     deallocate_table(kl->syms);
     deallocate(h, kl, sizeof(struct klib));
     klib_debug("   unload complete\n");
@@ -265,4 +521,6 @@ void init_klib(kernel_heaps kh, void *fs, tuple config_root, tuple klib_md)
         load_klib("/klib/radar", closure(h, radar_loaded));
     load_klib("/klib/cloud_init", closure(h, klib_optional_loaded));
     load_klib("/klib/ntp", closure(h, klib_optional_loaded));
+    if (get(config_root, sym(static_http_root)))
+        load_klib("/klib/static_http", closure(h, klib_optional_loaded));
 }
@@ -17,6 +17,26 @@
 #define KVM_CPUID_FEATURES  0x40000001
 #define KVM_MSR_SYSTEM_TIME 0x4b564d01
 #define KVM_MSR_WALL_CLOCK  0x4b564d00
+#define KVM_MSR_STEAL_TIME  0x4b564d03
+#define KVM_MSR_PV_EOI_EN   0x4b564d04
+#define KVM_MSR_POLL_CONTROL 0x4b564d05
+#define KVM_MSR_ENABLED     1
+
+/* KVM_CPUID_FEATURES eax */
+#define KVM_FEATURE_STEAL_TIME      5
+#define KVM_FEATURE_PV_EOI          6
+#define KVM_FEATURE_PV_TLB_FLUSH    9
+#define KVM_FEATURE_PV_SEND_IPI     11
+#define KVM_FEATURE_POLL_CONTROL    12
+#define KVM_FEATURE_PV_SCHED_YIELD  13
+
+/* KVM_CPUID_FEATURES edx: vcpus are pinned and never preempted */
+#define KVM_HINTS_REALTIME          0
+
+#define KVM_HC_SEND_IPI     10
+#define KVM_HC_SCHED_YIELD  11
+
+static boolean kvm_present;
 
 void halt(char *format, ...)
 {
@@ -60,6 +80,146 @@ static boolean probe_kvm_pvclock(kernel_heaps kh)
     return true;
 }
 
+#ifndef BOOT
+/* Per-cpu areas registered with the hypervisor. The steal time record
+   also carries the preempted flag that lets PV TLB flush and lock
+   spinning skip vcpus that aren't running. */
+static struct kvm_pv_cpu {
+    struct kvm_steal_time st;
+    u32 pv_eoi;
+} __attribute__((aligned(64))) *kvm_pv_cpus;
+
+static u32 kvm_features;
+boolean kvm_pv_tlb_flush;
+
+#define kvm_feature(f) ((kvm_features & U64_FROM_BIT(KVM_FEATURE_ ## f)) != 0)
+
+static inline s64 kvm_hypercall(u64 nr, u64 a0, u64 a1, u64 a2, u64 a3)
+{
+    s64 ret;
+    /* KVM patches this to vmmcall on AMD hosts */
+    asm volatile("vmcall" : "=a"(ret) : "a"(nr), "b"(a0), "c"(a1), "d"(a2), "S"(a3) : "memory");
+    return ret;
+}
+
+/* One hypercall delivers an ipi to up to 128 apic ids counted from the
+   lowest one in the set. */
+static boolean kvm_send_ipi_mask(u64 cpus, u64 icr)
+{
+    u64 bitmap[2] = { 0, 0 };
+    u32 min = U32_MAX;
+    for (u32 i = 0; i < total_processors; i++) {
+        if (cpus & U64_FROM_BIT(i))
+            min = MIN(min, apic_id_map[i]);
+    }
+    for (u32 i = 0; i < total_processors; i++) {
+        if (!(cpus & U64_FROM_BIT(i)))
+            continue;
+        u32 offset = apic_id_map[i] - min;
+        if (offset >= 128)
+            return false;
+        bitmap[offset / 64] |= U64_FROM_BIT(offset & 63);
+    }
+    return kvm_hypercall(KVM_HC_SEND_IPI, bitmap[0], bitmap[1], min, icr) >= 0;
+}
+
+static boolean kvm_vcpu_preempted(cpuinfo ci)
+{
+    struct kvm_steal_time *st = ci->m.steal_time;
+    return st && (st->preempted & KVM_VCPU_PREEMPTED);
+}
+
+static void kvm_vcpu_yield_to(cpuinfo ci)
+{
+    kvm_hypercall(KVM_HC_SCHED_YIELD, apic_id_map[ci->id], 0, 0, 0);
+}
+
+static timestamp kvm_vcpu_steal_time(cpuinfo ci)
+{
+    struct kvm_steal_time *st = ci->m.steal_time;
+    u32 version;
+    u64 steal;
+    if (!st)
+        return 0;
+    /* the hypervisor makes the version odd while updating the record */
+    do {
+        version = st->version;
+        read_barrier();
+        steal = st->steal;
+        read_barrier();
+    } while ((version & 1) || version != st->version);
+    return nanoseconds(steal);
+}
+
+/* If a vcpu is preempted, have the hypervisor flush its TLB before it
+   next runs instead of interrupting it; false if it may be running. */
+boolean kvm_vcpu_defer_tlb_flush(cpuinfo ci)
+{
+    struct kvm_steal_time *st = ci->m.steal_time;
+    if (!kvm_pv_tlb_flush || !st)
+        return false;
+    u8 state = st->preempted;
+    return (state & KVM_VCPU_PREEMPTED) &&
+        __sync_bool_compare_and_swap(&st->preempted, state, state | KVM_VCPU_FLUSH_TLB);
+}
+
+/* register the per-cpu areas of the calling cpu */
+static void kvm_pv_cpu_init(void)
+{
+    cpuinfo ci = current_cpu();
+    struct kvm_pv_cpu *pv = &kvm_pv_cpus[ci->id];
+    if (kvm_feature(STEAL_TIME)) {
+        write_msr(KVM_MSR_STEAL_TIME, physical_from_virtual(&pv->st) | KVM_MSR_ENABLED);
+        ci->m.steal_time = &pv->st;
+    }
+    if (kvm_feature(PV_EOI)) {
+        pv->pv_eoi = 0;
+        write_msr(KVM_MSR_PV_EOI_EN, physical_from_virtual(&pv->pv_eoi) | KVM_MSR_ENABLED);
+        ci->m.pv_eoi = &pv->pv_eoi;
+    }
+    /* idle cpus halt without polling, so leave host-side halt polling on */
+    if (kvm_feature(POLL_CONTROL))
+        write_msr(KVM_MSR_POLL_CONTROL, 1);
+}
+
+closure_function(1, 0, void, kvm_per_cpu_init,
+                 thunk, timer_init)
+{
+    kvm_pv_cpu_init();
+    if (bound(timer_init))
+        apply(bound(timer_init));
+}
+
+static void kvm_pv_init(kernel_heaps kh)
+{
+    u32 v[4];
+    cpuid(KVM_CPUID_FEATURES, 0, v);
+    kvm_features = v[0];
+    /* with dedicated pcpus, nothing is gained by checking for preemption */
+    boolean realtime = (v[3] & U64_FROM_BIT(KVM_HINTS_REALTIME)) != 0;
+    if (!kvm_feature(STEAL_TIME) && !kvm_feature(PV_EOI))
+        return;
+    heap backed = heap_backed(kh);
+    assert(sizeof(struct kvm_pv_cpu) * MAX_CPUS <= backed->pagesize);
+    kvm_pv_cpus = allocate(backed, backed->pagesize);
+    assert(kvm_pv_cpus != INVALID_ADDRESS);
+    zero(kvm_pv_cpus, backed->pagesize);
+    if (kvm_feature(STEAL_TIME)) {
+        vcpu_steal_time = kvm_vcpu_steal_time;
+        if (!realtime) {
+            kvm_pv_tlb_flush = kvm_feature(PV_TLB_FLUSH);
+            if (kvm_feature(PV_SCHED_YIELD)) {
+                vcpu_preempted = kvm_vcpu_preempted;
+                vcpu_yield_to = kvm_vcpu_yield_to;
+            }
+        }
+    }
+    if (kvm_feature(PV_SEND_IPI))
+        apic_pv_ipi_mask = kvm_send_ipi_mask;
+    kvm_pv_cpu_init();
+}
+#endif
+
 boolean kvm_detect(kernel_heaps kh)
 {
     kvm_debug("probing for KVM...");
@@ -88,6 +248,17 @@ boolean kvm_detect(kernel_heaps kh)
         halt("%s: no timer available\n", __func__);
     }
 
+#ifndef BOOT
+    kvm_pv_init(kh);
+    if (kvm_pv_cpus)
+        per_cpu_init = closure(heap_general(kh), kvm_per_cpu_init, per_cpu_init);
+#endif
     register_platform_clock_timer(ct, per_cpu_init);
+    kvm_present = true;
     return true;
 }
+
+boolean kvm_detected(void)
+{
+    return kvm_present;
+}
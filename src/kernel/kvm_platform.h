@@ -19,3 +19,22 @@ static inline void QEMU_HALT(u8 code)
 }
 
 boolean kvm_detect(kernel_heaps kh);
+boolean kvm_detected(void);
+
+/* shared with the hypervisor through MSR_KVM_STEAL_TIME */
+struct kvm_steal_time {
+    u64 steal;                  /* ns the vcpu was runnable but not running */
+    u32 version;
+    u32 flags;
+    u8 preempted;
+    u8 u8_pad[3];
+    u32 pad[11];
+};
+
+#define KVM_VCPU_PREEMPTED  (1 << 0)
+#define KVM_VCPU_FLUSH_TLB  (1 << 1)
+
+#ifndef BOOT
+extern boolean kvm_pv_tlb_flush;
+boolean kvm_vcpu_defer_tlb_flush(cpuinfo ci);
+#endif
@@ -0,0 +1,76 @@
+/* Spinlock contention profiling, enabled by building with LOCK_STATS=1.
+
+   Locks are profiled only if registered by name with lock_stats_register();
+   locks registered under the same name share one set of counters. Results
+   appear in the management tree under /locks/<name>. */
+#include <kernel.h>
+
+#define LOCK_STATS_MAX 64
+
+static struct lock_stats lock_stats[LOCK_STATS_MAX];
+static u32 lock_stats_count;
+
+/* called at initialization or with the kernel lock held */
+void lock_stats_register(spinlock l, const char *name)
+{
+    struct lock_stats *s;
+    for (u32 i = 0; i < lock_stats_count; i++) {
+        s = &lock_stats[i];
+        if (!runtime_strcmp(s->name, name))
+            goto out;
+    }
+    if (lock_stats_count == LOCK_STATS_MAX) {
+        msg_err("too many profiled locks; not registering \"%s\"\n", name);
+        return;
+    }
+    s = &lock_stats[lock_stats_count];
+    zero(s, sizeof(*s));
+    s->name = name;
+    write_barrier();
+    lock_stats_count++;
+  out:
+    l->stats = s;
+}
+
+#define lock_stats_getter(field)                                        \
+    closure_function(2, 0, value, lock_stats_get_ ##field,              \
+                     struct lock_stats *, s, value, v)                  \
+    {                                                                   \
+        return value_rewrite_u64(bound(v), bound(s)->field);            \
+    }
+
+lock_stats_getter(acquisitions)
+lock_stats_getter(contended)
+lock_stats_getter(failed_tries)
+lock_stats_getter(spin_cycles)
+lock_stats_getter(max_hold_cycles)
+
+#define register_stat(h, s, n, t, field)                                \
+    v = value_from_u64(h, 0);                                           \
+    a = sym(field);                                                     \
+    set(t, a, v);                                                       \
+    tuple_notifier_register_get_notify(n, a, closure(h, lock_stats_get_ ##field, s, v));
+
+void init_lock_stats_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    tuple locks = allocate_tuple();
+    assert(locks);
+    for (u32 i = 0; i < lock_stats_count; i++) {
+        struct lock_stats *s = &lock_stats[i];
+        value v;
+        symbol a;
+        tuple t = allocate_tuple();
+        assert(t);
+        tuple_notifier n = tuple_notifier_wrap(t);
+        assert(n != INVALID_ADDRESS);
+        register_stat(h, s, n, t, acquisitions);
+        register_stat(h, s, n, t, contended);
+        register_stat(h, s, n, t, failed_tries);
+        register_stat(h, s, n, t, spin_cycles);
+        register_stat(h, s, n, t, max_hold_cycles);
+        set(locks, sym_this(s->name), n);
+    }
+    set(locks, sym(no_encode), null_value);
+    set(root, sym(locks), locks);
+}
@@ -1,6 +1,17 @@
 #include <kernel.h>
 #include <management.h>
 
+/* A magazine is a per-cpu stack of free objects of one size class. An
+   empty magazine is refilled, and a full one drained, by half its
+   capacity under a single acquisition of the heap lock. Magazines are
+   only touched by their own cpu with interrupts disabled. */
+typedef struct magazine {
+    u64 count;
+    u64 rounds[HEAP_MAGAZINE_ROUNDS];
+} *magazine;
+
+#define MAGAZINE_BATCH  (HEAP_MAGAZINE_ROUNDS / 2)
+
 typedef struct heaplock {
     struct heap h;
     struct spinlock lock;
@@ -8,43 +19,172 @@ typedef struct heaplock {
     heap meta;
     tuple mgmt;
     tuple parent_mgmt;
+
+    /* per-cpu magazines, MAX_CPUS x nclasses, if enabled */
+    magazine mags;
+    int nclasses;
+    bytes cache_pagesize;       /* parent objcache page size, 0 if single class */
 } *heaplock;
 
-#define lock_heap(hl) u64 _flags = spin_lock_irq(&hl->lock)
-#define unlock_heap(hl) spin_unlock_irq(&hl->lock, _flags)
+/* Until secondary cpus are started, only interrupts on the boot cpu can
+   compete for a heap, so disabling them stands in for the lock. If no
+   other cpu is ever started, the heap locks and magazines never cost an
+   atomic operation. enable_heap_smp() must be called before the first
+   secondary cpu is started, outside of any heap operation. */
+static boolean heap_smp;
+
+void enable_heap_smp(void)
+{
+    write_barrier();
+    heap_smp = true;
+    memory_barrier();
+}
+
+static inline u64 heaplock_lock(heaplock hl)
+{
+    if (!heap_smp)
+        return irq_disable_save();
+    return spin_lock_irq(&hl->lock);
+}
+
+static inline void heaplock_unlock(heaplock hl, u64 flags)
+{
+    if (!heap_smp)
+        irq_restore(flags);
+    else
+        spin_unlock_irq(&hl->lock, flags);
+}
+
+#define lock_heap(hl) u64 _flags = heaplock_lock(hl)
+#define unlock_heap(hl) heaplock_unlock(hl, _flags)
+
+static inline bytes magazine_class_size(heaplock hl, int c)
+{
+    return hl->parent->pagesize << c;
+}
+
+static inline magazine cpu_magazine(heaplock hl, int c)
+{
+    return &hl->mags[current_cpu()->id * hl->nclasses + c];
+}
+
+static int alloc_class(heaplock hl, bytes size)
+{
+    if (!hl->mags || !heap_smp || size > magazine_class_size(hl, hl->nclasses - 1))
+        return -1;
+    if (size <= hl->parent->pagesize)
+        return 0;
+    return find_order(size) - find_order(hl->parent->pagesize);
+}
+
+static int dealloc_class(heaplock hl, u64 x, bytes size)
+{
+    if (!hl->mags || !heap_smp)
+        return -1;
+    bytes max = magazine_class_size(hl, hl->nclasses - 1);
+    if (size != -1ull && size > max)
+        return -1;
+    if (!hl->cache_pagesize)
+        return 0;
+
+    /* size classes are decided by the cache the object came from */
+    heap o = objcache_from_object(x, hl->cache_pagesize);
+    if (o == INVALID_ADDRESS || o->pagesize > max)
+        return -1;
+    return find_order(o->pagesize) - find_order(hl->parent->pagesize);
+}
 
 static u64 heaplock_alloc(heap h, bytes size)
 {
     heaplock hl = (heaplock)h;
-    lock_heap(hl);
-    u64 a = allocate_u64(hl->parent, size);
-    unlock_heap(hl);
+    int c = alloc_class(hl, size);
+    if (c < 0) {
+        lock_heap(hl);
+        u64 a = allocate_u64(hl->parent, size);
+        unlock_heap(hl);
+        return a;
+    }
+
+    u64 flags = irq_disable_save();
+    magazine m = cpu_magazine(hl, c);
+    if (m->count == 0) {
+        bytes csize = magazine_class_size(hl, c);
+        spin_lock(&hl->lock);
+        while (m->count < MAGAZINE_BATCH) {
+            u64 a = allocate_u64(hl->parent, csize);
+            if (a == INVALID_PHYSICAL)
+                break;
+            m->rounds[m->count++] = a;
+        }
+        spin_unlock(&hl->lock);
+    }
+    u64 a = m->count > 0 ? m->rounds[--m->count] : INVALID_PHYSICAL;
+    irq_restore(flags);
     return a;
 }
 
+static void magazine_drain(heaplock hl, magazine m, int c, u64 n)
+{
+    bytes csize = magazine_class_size(hl, c);
+    while (n-- > 0 && m->count > 0)
+        deallocate_u64(hl->parent, m->rounds[--m->count], csize);
+}
+
 static void heaplock_dealloc(heap h, u64 x, bytes size)
 {
     heaplock hl = (heaplock)h;
-    lock_heap(hl);
-    deallocate_u64(hl->parent, x, size);
-    unlock_heap(hl);
+    int c = dealloc_class(hl, x, size);
+    if (c < 0) {
+        lock_heap(hl);
+        deallocate_u64(hl->parent, x, size);
+        unlock_heap(hl);
+        return;
+    }
+
+    u64 flags = irq_disable_save();
+    magazine m = cpu_magazine(hl, c);
+    if (m->count == HEAP_MAGAZINE_ROUNDS) {
+        spin_lock(&hl->lock);
+        magazine_drain(hl, m, c, MAGAZINE_BATCH);
+        spin_unlock(&hl->lock);
+    }
+    m->rounds[m->count++] = x;
+    irq_restore(flags);
 }
 
 /* assuming no contention on destroy */
 static void heaplock_destroy(heap h)
 {
     heaplock hl = (heaplock)h;
+    if (hl->mags) {
+        for (int i = 0; i < MAX_CPUS * hl->nclasses; i++)
+            magazine_drain(hl, &hl->mags[i], i % hl->nclasses, HEAP_MAGAZINE_ROUNDS);
+        deallocate(hl->meta, hl->mags, MAX_CPUS * hl->nclasses * sizeof(struct magazine));
+    }
     destroy_heap(hl->parent);
     deallocate(hl->meta, hl, sizeof(*hl));
 }
 
+/* objects parked in magazines are free as far as users are concerned;
+   the per-cpu counts are sampled without synchronization */
+static bytes magazine_cached(heaplock hl)
+{
+    bytes cached = 0;
+    if (hl->mags) {
+        for (int i = 0; i < MAX_CPUS * hl->nclasses; i++)
+            cached += hl->mags[i].count * magazine_class_size(hl, i % hl->nclasses);
+    }
+    return cached;
+}
+
 static bytes heaplock_allocated(heap h)
 {
     heaplock hl = (heaplock)h;
     lock_heap(hl);
     bytes count = heap_allocated(hl->parent);
     unlock_heap(hl);
-    return count;
+    bytes cached = magazine_cached(hl);
+    return count > cached ? count - cached : 0;
 }
 
 static bytes heaplock_total(heap h)
@@ -143,6 +283,33 @@ heap locking_heap_wrapper(heap meta, heap parent)
     hl->meta = meta;
     hl->mgmt = 0;
     hl->parent_mgmt = 0;
+    hl->mags = 0;
+    hl->nclasses = 0;
+    hl->cache_pagesize = 0;
     spin_lock_init(&hl->lock);
     return (heap)hl;
 }
+
+/* Locking wrapper with per-cpu magazines for either an objcache (nclasses
+   of 1, cache_pagesize of 0) or an mcache, whose caches of objects sized
+   parent pagesize << n live in pages of cache_pagesize. Only mcache
+   caches up to HEAP_MAGAZINE_MAX_ORDER are given magazines. */
+heap locking_magazine_wrapper(heap meta, heap parent, int nclasses, bytes cache_pagesize)
+{
+    heaplock hl = (heaplock)locking_heap_wrapper(meta, parent);
+    if (hl == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    if (nclasses > 1)
+        nclasses = MIN(nclasses, HEAP_MAGAZINE_MAX_ORDER - (int)find_order(parent->pagesize) + 1);
+    if (nclasses <= 0)
+        return (heap)hl;
+    bytes size = MAX_CPUS * nclasses * sizeof(struct magazine);
+    hl->mags = allocate_zero(meta, size);
+    if (hl->mags == INVALID_ADDRESS) {
+        deallocate(meta, hl, sizeof(*hl));
+        return INVALID_ADDRESS;
+    }
+    hl->nclasses = nclasses;
+    hl->cache_pagesize = cache_pagesize;
+    return (heap)hl;
+}
@@ -71,7 +71,7 @@ void klog_load(klog_dump dest, status_handler sh)
 {
     if (klog.disk_read)
         apply(klog.disk_read, dest,
-              irangel(klog.disk_offset >> SECTOR_OFFSET, KLOG_DUMP_SIZE >> SECTOR_OFFSET),
+              irangel(klog.disk_offset >> SECTOR_OFFSET, sizeof(*dest) >> SECTOR_OFFSET),
               init_closure(&klog.load_sh, klog_load_sh, dest, sh));
 }
 KLIB_EXPORT(klog_load);
@@ -97,7 +97,7 @@ void klog_save(int exit_code, status_handler sh)
     klog.dump.msgs[msg_len] = '\0';
     klog.dump.exit_code = exit_code;
     apply(klog.disk_write, &klog.dump,
-        irangel(klog.disk_offset >> SECTOR_OFFSET, KLOG_DUMP_SIZE >> SECTOR_OFFSET), sh);
+        irangel(klog.disk_offset >> SECTOR_OFFSET, sizeof(klog.dump) >> SECTOR_OFFSET), sh);
 }
 
 void klog_dump_clear(void)
@@ -110,3 +110,27 @@ void klog_dump_clear(void)
         irangel(klog.disk_offset >> SECTOR_OFFSET, 1), ignore_status);
 }
 KLIB_EXPORT(klog_dump_clear);
+
+static range klog_boot_state_sectors(void)
+{
+    return irangel((klog.disk_offset + KLOG_DUMP_SIZE - KLOG_BOOT_STATE_SIZE) >> SECTOR_OFFSET,
+                   KLOG_BOOT_STATE_SIZE >> SECTOR_OFFSET);
+}
+
+void klog_boot_state_load(void *buf, status_handler sh)
+{
+    if (!klog.disk_read) {
+        apply(sh, timm("result", "no boot disk"));
+        return;
+    }
+    apply(klog.disk_read, buf, klog_boot_state_sectors(), sh);
+}
+
+void klog_boot_state_save(void *buf, status_handler sh)
+{
+    if (!klog.disk_write) {
+        apply(sh, timm("result", "no boot disk"));
+        return;
+    }
+    apply(klog.disk_write, buf, klog_boot_state_sectors(), sh);
+}
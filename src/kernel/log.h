@@ -2,7 +2,7 @@ typedef struct klog_dump {
     u8 header[4];
     u64 boot_id;
     s32 exit_code;
-    char msgs[KLOG_DUMP_SIZE - 16]; /* total size of the struct must match KLOG_DUMP_SIZE */
+    char msgs[KLOG_DUMP_SIZE - KLOG_BOOT_STATE_SIZE - 16]; /* struct and boot state fill KLOG_DUMP_SIZE */
 } __attribute__((packed)) *klog_dump;
 
 void klog_write(const char *s, bytes count);
@@ -17,3 +17,8 @@ void klog_set_boot_id(u64 id);
 void klog_load(klog_dump dest, status_handler sh);
 void klog_save(int exit_code, status_handler sh);
 void klog_dump_clear(void);
+
+/* A sector of state kept across boots, e.g. cached DHCP leases; its format
+   is up to the user. buf must be KLOG_BOOT_STATE_SIZE bytes. */
+void klog_boot_state_load(void *buf, status_handler sh);
+void klog_boot_state_save(void *buf, status_handler sh);
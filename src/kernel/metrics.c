@@ -0,0 +1,237 @@
+#include <kernel.h>
+#include <net.h>
+#include <http.h>
+
+/* Prometheus text exposition of the management tree counters, served at
+   /metrics on the port given by the "metrics" manifest option (9100 if the
+   option isn't a number). The numeric leaves of each group below become
+   nanos_<family>_<leaf> samples, labeled with the name of the child tuple
+   they were found in. Other subsystems add families with
+   metrics_register_source().
+
+   A scrape only reads counters through the management getters and renders
+   into a single buffer, so it doesn't hold any lock beyond what the getters
+   take themselves. */
+
+//#define METRICS_DEBUG
+#ifdef METRICS_DEBUG
+#define metrics_debug(x, ...) do {rprintf("METRICS: " x, ##__VA_ARGS__);} while(0)
+#else
+#define metrics_debug(x, ...)
+#endif
+
+#define METRICS_DEFAULT_PORT    9100
+#define METRICS_NAME_MAX        128
+
+static const struct metrics_group {
+    const char *tuple;
+    const char *subtuple;       /* within tuple, or 0 */
+    const char *family;
+    const char *label;          /* 0 for the leaves of the tuple itself */
+} metrics_groups[] = {
+    { "heaps", 0, "heap", "heap" },
+    { "pagecache", 0, "pagecache", 0 },
+    { "pagecache", "volumes", "pagecache_volume", "volume" },
+    { "storage", 0, "storage", "volume" },
+    { "net", 0, "net", "proto" },
+};
+
+static struct {
+    heap h;
+    tuple root;
+    vector sources;
+} metrics;
+
+/* per-scrape: metric name -> sample lines, in order of first appearance */
+typedef struct metrics_render {
+    table samples;
+    vector names;
+} *metrics_render;
+
+void metrics_register_source(metrics_source s)
+{
+    if (!metrics.sources) {
+        metrics.sources = allocate_vector(heap_general(get_kernel_heaps()), 4);
+        assert(metrics.sources != INVALID_ADDRESS);
+    }
+    vector_push(metrics.sources, s);
+}
+
+static void metrics_write_name(buffer b, string s)
+{
+    for (bytes i = 0; i < buffer_length(s); i++) {
+        u8 c = byte(s, i);
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            c = '_';
+        push_u8(b, c);
+    }
+}
+
+static void metrics_write_label_value(buffer b, string s)
+{
+    for (bytes i = 0; i < buffer_length(s); i++) {
+        u8 c = byte(s, i);
+        if (c == '\\' || c == '"') {
+            push_u8(b, '\\');
+        } else if (c == '\n') {
+            buffer_write_cstring(b, "\\n");
+            continue;
+        }
+        push_u8(b, c);
+    }
+}
+
+/* only values that are entirely a decimal number; latency histograms and
+   other formatted strings are left out */
+static boolean metrics_value_u64(value v, u64 *n)
+{
+    if (!v || !is_string(v))
+        return false;
+    buffer b = alloca_wrap(v);
+    return parse_int(b, 10, n) && buffer_length(b) == 0;
+}
+
+static void metrics_sample(metrics_render r, const struct metrics_group *g, symbol leaf,
+                           symbol child, u64 n)
+{
+    buffer name = little_stack_buffer(METRICS_NAME_MAX);
+    bprintf(name, "nanos_%s_", g->family);
+    metrics_write_name(name, symbol_string(leaf));
+    symbol s = intern(name);
+    buffer b = table_find(r->samples, s);
+    if (!b) {
+        b = allocate_buffer(metrics.h, 256);
+        if (b == INVALID_ADDRESS)
+            return;
+        table_set(r->samples, s, b);
+        vector_push(r->names, s);
+    }
+    push_buffer(b, name);
+    if (g->label) {
+        bprintf(b, "{%s=\"", g->label);
+        metrics_write_label_value(b, symbol_string(child));
+        buffer_write_cstring(b, "\"}");
+    }
+    bprintf(b, " %ld\n", n);
+}
+
+closure_function(3, 2, boolean, metrics_each_leaf,
+                 metrics_render, r, const struct metrics_group *, g, symbol, child,
+                 value, s, value, v)
+{
+    u64 n;
+    if (is_symbol(s) && metrics_value_u64(v, &n))
+        metrics_sample(bound(r), bound(g), s, bound(child), n);
+    return true;
+}
+
+closure_function(2, 2, boolean, metrics_each_child,
+                 metrics_render, r, const struct metrics_group *, g,
+                 value, s, value, v)
+{
+    if (is_symbol(s) && is_tuple(v))
+        iterate(v, stack_closure(metrics_each_leaf, bound(r), bound(g), s));
+    return true;
+}
+
+static void metrics_render_group(metrics_render r, const struct metrics_group *g)
+{
+    tuple t = get_tuple(metrics.root, sym_this(g->tuple));
+    if (t && g->subtuple)
+        t = get_tuple(t, sym_this(g->subtuple));
+    if (!t)
+        return;
+    if (g->label)
+        iterate(t, stack_closure(metrics_each_child, r, g));
+    else
+        iterate(t, stack_closure(metrics_each_leaf, r, g, 0));
+}
+
+static buffer metrics_render_all(void)
+{
+    struct metrics_render r;
+    buffer out = allocate_buffer(metrics.h, PAGESIZE);
+    if (out == INVALID_ADDRESS)
+        return out;
+    r.samples = allocate_table(metrics.h, identity_key, pointer_equal);
+    if (r.samples == INVALID_ADDRESS)
+        goto fail;
+    r.names = allocate_vector(metrics.h, 64);
+    if (r.names == INVALID_ADDRESS) {
+        deallocate_table(r.samples);
+        goto fail;
+    }
+    for (int i = 0; i < sizeof(metrics_groups) / sizeof(metrics_groups[0]); i++)
+        metrics_render_group(&r, &metrics_groups[i]);
+    symbol s;
+    vector_foreach(r.names, s) {
+        buffer b = table_find(r.samples, s);
+        bprintf(out, "# TYPE %b untyped\n", symbol_string(s));
+        push_buffer(out, b);
+        deallocate_buffer(b);
+    }
+    deallocate_vector(r.names);
+    deallocate_table(r.samples);
+
+    if (metrics.sources) {
+        metrics_source ms;
+        vector_foreach(metrics.sources, ms)
+            apply(ms, out);
+    }
+    return out;
+  fail:
+    deallocate_buffer(out);
+    return INVALID_ADDRESS;
+}
+
+closure_function(0, 3, void, metrics_request,
+                 http_method, m, buffer_handler, out, value, v)
+{
+    status s;
+    if (m != HTTP_REQUEST_METHOD_GET) {
+        s = send_http_response(out, timm("status", "405 Method Not Allowed"),
+                               aprintf(metrics.h, "405 Method Not Allowed\r\n"));
+        goto out;
+    }
+    buffer b = metrics_render_all();
+    if (b == INVALID_ADDRESS) {
+        s = send_http_response(out, timm("status", "500 Internal Server Error"),
+                               aprintf(metrics.h, "500 Internal Server Error\r\n"));
+        goto out;
+    }
+    metrics_debug("rendered %ld bytes\n", buffer_length(b));
+    s = send_http_response(out, timm("Content-Type", "text/plain; version=0.0.4"), b);
+  out:
+    if (!is_ok(s)) {
+        msg_err("failed to send response: %v\n", s);
+        timm_dealloc(s);
+    }
+}
+
+/* metrics: the port to serve /metrics on, or any other value for the
+   default */
+void init_metrics(tuple root)
+{
+    if (!get(root, sym(metrics)))
+        return;
+    u64 port;
+    if (!get_u64(root, sym(metrics), &port))
+        port = METRICS_DEFAULT_PORT;
+    if (port == 0 || port > MASK(16)) {
+        msg_err("invalid metrics port %ld\n", port);
+        return;
+    }
+    metrics.h = heap_general(get_kernel_heaps());
+    metrics.root = root;
+    http_listener hl = allocate_http_listener(metrics.h, port);
+    assert(hl != INVALID_ADDRESS);
+    http_register_uri_handler(hl, "metrics", closure(metrics.h, metrics_request));
+    status s = listen_port(metrics.h, port, connection_handler_from_http_listener(hl));
+    if (!is_ok(s)) {
+        msg_err("failed to listen on port %ld: %v\n", port, s);
+        timm_dealloc(s);
+        deallocate_http_listener(metrics.h, hl);
+        return;
+    }
+    metrics_debug("metrics served on port %ld\n", port);
+}
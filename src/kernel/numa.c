@@ -0,0 +1,173 @@
+/* NUMA topology and node-local physical heaps
+
+   The platform reports processor and memory affinity by proximity
+   domain (on x86, from the ACPI SRAT and SLIT) in init_topology(),
+   before any per-cpu structures are allocated. Domains are numbered
+   into dense node ids in order of discovery. Without topology
+   information, everything belongs to node 0 and the node heaps are
+   simply the kernel physical and backed heaps.
+
+   A node physical heap is a view of the physical id heap restricted to
+   the ranges of its node; it falls back to any memory when the node is
+   exhausted, so allocations are node-local only on a best-effort basis.
+   Deallocations go straight to the physical id heap. */
+#include <kernel.h>
+
+//#define NUMA_DEBUG
+#ifdef NUMA_DEBUG
+#define numa_debug(x, ...) rprintf("NUMA: " x "\n", ##__VA_ARGS__)
+#else
+#define numa_debug(x, ...)
+#endif
+
+#define NUMA_DISTANCE_LOCAL     10
+#define NUMA_DISTANCE_REMOTE    20
+
+typedef struct numa_heap {
+    struct heap h;
+    id_heap physical;
+    u32 node;
+} *numa_heap;
+
+u32 numa_node_count = 1;
+static u32 numa_domains[MAX_NUMA_NODES];
+static u8 numa_distances[MAX_NUMA_NODES][MAX_NUMA_NODES];
+static boolean numa_topology;
+
+static struct numa_range {
+    range r;
+    u32 node;
+} numa_ranges[MAX_NUMA_RANGES];
+static u32 numa_range_count;
+
+static struct numa_heap numa_heaps[MAX_NUMA_NODES];
+static heap numa_physical[MAX_NUMA_NODES];
+static heap numa_backed[MAX_NUMA_NODES];
+
+u32 numa_node_from_domain(u32 domain)
+{
+    if (!numa_topology) {
+        numa_topology = true;
+        numa_domains[0] = domain;
+        return 0;
+    }
+    for (u32 n = 0; n < numa_node_count; n++) {
+        if (numa_domains[n] == domain)
+            return n;
+    }
+    if (numa_node_count == MAX_NUMA_NODES) {
+        msg_err("too many NUMA nodes; folding domain %d into node 0\n", domain);
+        return 0;
+    }
+    numa_domains[numa_node_count] = domain;
+    return numa_node_count++;
+}
+
+void numa_add_memory(u32 domain, range r)
+{
+    if (numa_range_count == MAX_NUMA_RANGES) {
+        msg_err("too many NUMA memory ranges; ignoring %R\n", r);
+        return;
+    }
+    u32 node = numa_node_from_domain(domain);
+    numa_debug("memory %R: domain %d, node %d", r, domain, node);
+    numa_ranges[numa_range_count].r = r;
+    numa_ranges[numa_range_count].node = node;
+    numa_range_count++;
+}
+
+void numa_set_cpu_domain(int cpu, u32 domain)
+{
+    u32 node = numa_node_from_domain(domain);
+    numa_debug("cpu %d: domain %d, node %d", cpu, domain, node);
+    cpuinfo_from_id(cpu)->node = node;
+}
+
+void numa_set_distance(u32 from_domain, u32 to_domain, u8 distance)
+{
+    for (u32 from = 0; from < numa_node_count; from++) {
+        if (numa_domains[from] != from_domain)
+            continue;
+        for (u32 to = 0; to < numa_node_count; to++) {
+            if (numa_domains[to] == to_domain)
+                numa_distances[from][to] = distance;
+        }
+    }
+}
+
+u8 numa_distance(u32 from, u32 to)
+{
+    assert(from < numa_node_count && to < numa_node_count);
+    u8 d = numa_distances[from][to];
+    if (d)
+        return d;
+    return from == to ? NUMA_DISTANCE_LOCAL : NUMA_DISTANCE_REMOTE;
+}
+
+static u64 numa_heap_alloc(heap h, bytes size)
+{
+    numa_heap nh = (numa_heap)h;
+    for (u32 i = 0; i < numa_range_count; i++) {
+        struct numa_range *nr = &numa_ranges[i];
+        if (nr->node != nh->node)
+            continue;
+        u64 a = id_heap_alloc_subrange(nh->physical, size, nr->r.start, nr->r.end);
+        if (a != INVALID_PHYSICAL)
+            return a;
+    }
+    return allocate_u64((heap)nh->physical, size);
+}
+
+static void numa_heap_dealloc(heap h, u64 a, bytes size)
+{
+    deallocate_u64((heap)((numa_heap)h)->physical, a, size);
+}
+
+static u64 numa_heap_allocated(heap h)
+{
+    return heap_allocated((heap)((numa_heap)h)->physical);
+}
+
+static u64 numa_heap_total(heap h)
+{
+    return heap_total((heap)((numa_heap)h)->physical);
+}
+
+heap numa_physical_heap(u32 node)
+{
+    assert(node < numa_node_count);
+    return numa_physical[node];
+}
+
+heap numa_backed_heap(u32 node)
+{
+    assert(node < numa_node_count);
+    return numa_backed[node];
+}
+
+void init_numa_heaps(kernel_heaps kh)
+{
+    id_heap physical = heap_physical(kh);
+    if (numa_node_count == 1) {
+        /* no locality to preserve: use the kernel heaps directly */
+        numa_physical[0] = (heap)physical;
+        numa_backed[0] = heap_backed(kh);
+        return;
+    }
+    for (u32 n = 0; n < numa_node_count; n++) {
+        numa_heap nh = &numa_heaps[n];
+        zero(nh, sizeof(*nh));
+        nh->h.alloc = numa_heap_alloc;
+        nh->h.dealloc = numa_heap_dealloc;
+        nh->h.allocated = numa_heap_allocated;
+        nh->h.total = numa_heap_total;
+        nh->h.pagesize = physical->h.pagesize;
+        nh->physical = physical;
+        nh->node = n;
+        numa_physical[n] = &nh->h;
+        numa_backed[n] = (heap)physically_backed(heap_general(kh), (heap)heap_virtual_page(kh),
+                                                 &nh->h, PAGESIZE, true);
+        assert(numa_backed[n] != INVALID_ADDRESS);
+    }
+    numa_debug("%d nodes", numa_node_count);
+}
@@ -35,8 +35,26 @@ typedef void *nanos_thread;
    queueing a ton with the polled ATA driver. There's only one queue globally anyhow. */
 #define MAX_PAGE_COMPLETION_VECS 16384
 
+/* upper bound on the size of a single write-back request; the storage
+   layers below split requests further as the device requires */
+#define PAGECACHE_WRITEBACK_MAX (1 * MB)
+
+/* bounds and adjustment step for the share of resident pages targeted for
+   the new list; the lower bound keeps up to 7/8 of the cache protected from
+   streaming reads */
+#define PAGECACHE_SHARE_SCALE       1024
+#define PAGECACHE_NEW_SHARE_MIN     (PAGECACHE_SHARE_SCALE / 8)
+#define PAGECACHE_NEW_SHARE_MAX     (PAGECACHE_SHARE_SCALE * 7 / 8)
+#define PAGECACHE_NEW_SHARE_STEP    (PAGECACHE_SHARE_SCALE / 64)
+
 static pagecache global_pagecache;
 
+#ifdef KERNEL
+#define pagecache_time()    now(CLOCK_ID_MONOTONIC_RAW)
+#else
+#define pagecache_time()    0
+#endif
+
 static inline u64 cache_pagesize(pagecache pc)
 {
     return U64_FROM_BIT(pc->page_order);
@@ -57,6 +75,27 @@ static inline range byte_range_from_page(pagecache pc, pagecache_page pp)
     return range_lshift(irangel(page_offset(pp), 1), pc->page_order);
 }
 
+static inline void pagecache_count_lookup(pagecache_page pp, boolean hit)
+{
+    pagecache_stats st = &pp->node->pv->stats;
+    if (hit) {
+        st->hits++;
+        if (pp->readahead) {
+            pp->readahead = false;
+            st->readahead_hits++;
+        }
+    } else {
+        st->misses++;
+    }
+}
+
+static inline void pagecache_count_io(u64 *count, u64 *bytes, u64 *time, u64 len, timestamp start)
+{
+    fetch_and_add(count, 1);
+    fetch_and_add(bytes, len);
+    fetch_and_add(time, pagecache_time() - start);
+}
+
 static inline void pagelist_enqueue(pagelist pl, pagecache_page pp)
 {
     list_insert_before(&pl->l, &pp->l);
@@ -92,15 +131,25 @@ static inline void pagecache_unlock_state(pagecache pc)
     spin_unlock(&pc->state_lock);
 }
 
-/* TODO revisit node locking */
 static inline void pagecache_lock_node(pagecache_node pn)
 {
-    spin_lock(&pn->pages_lock);
+    spin_wlock(&pn->pages_lock);
 }
 
 static inline void pagecache_unlock_node(pagecache_node pn)
 {
-    spin_unlock(&pn->pages_lock);
+    spin_wunlock(&pn->pages_lock);
+}
+
+/* for lookups only - no pages may be inserted */
+static inline void pagecache_lock_node_shared(pagecache_node pn)
+{
+    spin_rlock(&pn->pages_lock);
+}
+
+static inline void pagecache_unlock_node_shared(pagecache_node pn)
+{
+    spin_runlock(&pn->pages_lock);
 }
 
 #else
@@ -108,6 +157,8 @@ static inline void pagecache_unlock_node(pagecache_node pn)
 #define pagecache_unlock_state(pc)
 #define pagecache_lock_node(pn)
 #define pagecache_unlock_node(pn)
+#define pagecache_lock_node_shared(pn)
+#define pagecache_unlock_node_shared(pn)
 #endif
 
 static inline void change_page_state_locked(pagecache pc, pagecache_page pp, int state)
@@ -185,16 +236,20 @@ define_closure_function(2, 0, void, pagecache_service_completions,
     pagecache_completion_queue cq = bound(cq);
     assert(cq->scheduled);
     cq->scheduled = false;
-    page_completion head;
-    while ((head = dequeue(cq->q)) != INVALID_ADDRESS) {
-        list_foreach(&head->l, l) {
-            page_completion c = struct_from_list(l, page_completion, l);
-            assert(c->sh != INVALID_ADDRESS && c->sh != 0);
-            apply(c->sh, head->s);
-            list_delete(l);
-            deallocate(bound(pc)->completions, c, sizeof(*c));
+    page_completion batch[RUNLOOP_BATCH_SIZE];
+    u32 n;
+    while ((n = dequeue_n(cq->q, (void **)batch, RUNLOOP_BATCH_SIZE)) > 0) {
+        for (u32 i = 0; i < n; i++) {
+            page_completion head = batch[i];
+            list_foreach(&head->l, l) {
+                page_completion c = struct_from_list(l, page_completion, l);
+                assert(c->sh != INVALID_ADDRESS && c->sh != 0);
+                apply(c->sh, head->s);
+                list_delete(l);
+                deallocate(bound(pc)->completions, c, sizeof(*c));
+            }
+            deallocate(bound(pc)->completions, head, sizeof(*head));
         }
-        deallocate(bound(pc)->completions, head, sizeof(*head));
     }
 }
 
@@ -247,13 +302,34 @@ static void enqueue_page_completion_statelocked(pagecache pc, pagecache_page pp,
     list_push_back(l, &c->l);
 }
 
-static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
+/* A page evicted from the new list and faulted back in within the resident
+   page count would have been a hit with a larger new list, and vice versa
+   for the active list; adjust the target list sizes accordingly, ARC
+   style. Refaults within the active list size are working set pages, to be
+   activated once filled. */
+static void refault_pagelocked(pagecache pc, pagecache_page pp)
 {
-    pagecache_debug("%s: pc %p pp %p refcount %d state %d\n", __func__, pc, pp, pp->refcount.c, page_state(pp));
-    pp->kvirt = allocate(pc->contiguous, U64_FROM_BIT(pc->page_order));
-    if (pp->kvirt == INVALID_ADDRESS) {
-        return false;
+    u32 distance = (u32)pc->eviction_clock - pp->eviction;
+    u64 resident = pc->new.pages + pc->active.pages;
+    pp->workingset = false;
+    if (distance > resident)
+        return;
+    pagecache_stats st = &pp->node->pv->stats;
+    st->refaults++;
+    if (pp->evicted_active)
+        pc->new_share = MAX(pc->new_share - PAGECACHE_NEW_SHARE_STEP, PAGECACHE_NEW_SHARE_MIN);
+    else
+        pc->new_share = MIN(pc->new_share + PAGECACHE_NEW_SHARE_STEP, PAGECACHE_NEW_SHARE_MAX);
+    if (distance <= pc->active.pages) {
+        st->workingset_refaults++;
+        pp->workingset = true;
     }
+}
+
+/* give a freed page new memory at kvirt */
+static void reinit_pagelocked(pagecache pc, pagecache_page pp, void *kvirt)
+{
+    pp->kvirt = kvirt;
     assert(pp->refcount.c == 0);
     refcount_reserve(&pp->refcount);
     pp->write_count = 0;
@@ -263,35 +339,124 @@ static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
     fetch_and_add(&pc->total_pages, 1);
     change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ALLOC);
     pp->evicted = false;
+    pp->readahead = false;
+    refault_pagelocked(pc, pp);
+}
+
+static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
+{
+    pagecache_debug("%s: pc %p pp %p refcount %d state %d\n", __func__, pc, pp, pp->refcount.c, page_state(pp));
+    void *kvirt = allocate(pc->contiguous, U64_FROM_BIT(pc->page_order));
+    if (kvirt == INVALID_ADDRESS)
+        return false;
+    reinit_pagelocked(pc, pp, kvirt);
     return true;
 }
 
-closure_function(3, 1, void, pagecache_read_page_complete,
-                 pagecache, pc, pagecache_page, pp, sg_list, sg,
+static void page_filled_locked(pagecache pc, pagecache_page pp, status s)
+{
+    change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
+    if (pp->workingset) {
+        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+        pp->workingset = false;
+    }
+    pagecache_page_queue_completions_locked(pc, pp, s);
+}
+
+closure_function(4, 1, void, pagecache_read_page_complete,
+                 pagecache, pc, pagecache_page, pp, sg_list, sg, timestamp, start,
                  status, s)
 {
     pagecache pc = bound(pc);
     pagecache_page pp = bound(pp);
     assert(page_state(pp) == PAGECACHE_PAGESTATE_READING);
+    pagecache_stats st = &pp->node->pv->stats;
+    pagecache_count_io(&st->reads, &st->read_bytes, &st->read_time, cache_pagesize(pc),
+                       bound(start));
 
     if (!is_ok(s)) {
         /* TODO need policy for capturing/reporting I/O errors... */
         msg_err("error reading page 0x%lx: %v\n", page_offset(pp) << pc->page_order, s);
     }
     pagecache_lock_state(pc);
-    change_page_state_locked(bound(pc), pp, PAGECACHE_PAGESTATE_NEW);
-    pagecache_page_queue_completions_locked(pc, pp, s);
+    page_filled_locked(pc, pp, s);
     pagecache_unlock_state(pc);
     sg_list_release(bound(sg));
     deallocate_sg_list(bound(sg));
     closure_finish();
 }
 
+#ifdef KERNEL
+/* called with batch and state locks held */
+static void pagecache_apply_touches_locked(pagecache pc, pagecache_touch_batch b)
+{
+    for (int i = 0; i < b->count; i++) {
+        pagecache_page pp = b->pages[i];
+        if (pp->evicted)
+            continue;
+        switch (page_state(pp)) {
+        case PAGECACHE_PAGESTATE_ACTIVE:
+            /* move to bottom of active list */
+            list_delete(&pp->l);
+            list_insert_before(&pc->active.l, &pp->l);
+            break;
+        case PAGECACHE_PAGESTATE_NEW:
+            /* cache hit -> active */
+            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+            break;
+        }
+    }
+    b->count = 0;
+}
+
+/* Page structures stay allocated, in their node's index, after eviction, so
+   a batched page needs no reference; its state is checked on drain. */
+static void pagecache_touch_page(pagecache pc, pagecache_page pp)
+{
+    u64 flags = irq_disable_save();
+    pagecache_touch_batch b = &pc->touch_batches[current_cpu()->id];
+    spin_lock(&b->lock);
+    b->pages[b->count++] = pp;
+    if (b->count == PAGECACHE_TOUCH_BATCH) {
+        pagecache_lock_state(pc);
+        pagecache_apply_touches_locked(pc, b);
+        pagecache_unlock_state(pc);
+    }
+    spin_unlock(&b->lock);
+    irq_restore(flags);
+}
+
+/* apply pending touches of all cpus; called without state lock */
+static void pagecache_drain_touches(pagecache pc)
+{
+    for (int i = 0; i < MAX_CPUS; i++) {
+        pagecache_touch_batch b = &pc->touch_batches[i];
+        if (b->count == 0)
+            continue;
+        u64 flags = spin_lock_irq(&b->lock);
+        pagecache_lock_state(pc);
+        pagecache_apply_touches_locked(pc, b);
+        pagecache_unlock_state(pc);
+        spin_unlock_irq(&b->lock, flags);
+    }
+}
+#else
+#define pagecache_drain_touches(pc)
+#endif
+
 static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page pp, merge m, boolean bh)
 {
     pagecache_volume pv = pn->pv;
     pagecache pc = pv->pc;
 
+#ifdef KERNEL
+    /* cache hits are batched rather than taking the state lock */
+    int state = page_state(pp);
+    if (state == PAGECACHE_PAGESTATE_ACTIVE || state == PAGECACHE_PAGESTATE_NEW) {
+        pagecache_touch_page(pc, pp);
+        return true;
+    }
+#endif
     pagecache_lock_state(pc);
     pagecache_debug("%s: pn %p, pp %p, m %p, state %d\n", __func__, pn, pp, m, page_state(pp));
     switch (page_state(pp)) {
@@ -316,6 +481,7 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
             /* issue page reads */
             range r = byte_range_from_page(pc, pp);
             pagecache_debug("   pc %p, pp %p, r %R, reading...\n", pc, pp, r);
+            tracepoint(pagecache_fill, pn, page_offset(pp), 1);
             sg_list sg = allocate_sg_list();
             assert(sg != INVALID_ADDRESS);
             sg_buf sgb = sg_list_tail_add(sg, cache_pagesize(pc));
@@ -325,7 +491,7 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
             sgb->refcount = &pp->refcount;
             refcount_reserve(sgb->refcount);
             apply(pn->fs_read, sg, r,
-                  closure(pc->h, pagecache_read_page_complete, pc, pp, sg));
+                  closure(pc->h, pagecache_read_page_complete, pc, pp, sg, pagecache_time()));
         }
         return false;
     case PAGECACHE_PAGESTATE_ACTIVE:
@@ -354,9 +520,16 @@ define_closure_function(2, 0, void, pagecache_page_free,
     pagecache_debug("%s: pp %p state %d\n", __func__, pp, page_state(pp));
     assert(pp->write_count == 0);
     assert(pp->refcount.c == 0);
+    tracepoint(pagecache_evict, pp->node, page_offset(pp), 0);
 
     pagecache pc = bound(pc);
     pagecache_lock_state(pc);
+    pp->evicted_active = page_state(pp) == PAGECACHE_PAGESTATE_ACTIVE;
+    pp->eviction = pc->eviction_clock++;
+    if (pp->evicted_active)
+        pp->node->pv->stats.evictions_active++;
+    else
+        pp->node->pv->stats.evictions_new++;
     change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_FREE);
     pagecache_unlock_state(pc);
     deallocate(pc->contiguous, pp->kvirt, cache_pagesize(pc));
@@ -367,20 +540,14 @@ define_closure_function(2, 0, void, pagecache_page_free,
     pagecache_debug("%s: total pages now %ld\n", __func__, pre - 1);
 }
 
-static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
+/* insert a new page backed by the memory at p */
+static pagecache_page insert_page_nodelocked(pagecache_node pn, u64 offset, void *p)
 {
-    /* allocate - later we can look at blocks of pages at a time */
     pagecache pc = pn->pv->pc;
-    u64 pagesize = U64_FROM_BIT(pc->page_order);
-    void *p = allocate(pc->contiguous, pagesize);
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-
     pagecache_page pp = allocate(pc->h, sizeof(struct pagecache_page));
     if (pp == INVALID_ADDRESS)
-        goto fail_dealloc_contiguous;
+        return INVALID_ADDRESS;
 
-    init_rbnode(&pp->rbnode);
     init_refcount(&pp->refcount, 1, init_closure(&pp->free, pagecache_page_free, pc, pp));
     assert((offset >> PAGECACHE_PAGESTATE_SHIFT) == 0);
     pp->state_offset = ((u64)PAGECACHE_PAGESTATE_ALLOC << PAGECACHE_PAGESTATE_SHIFT) | offset;
@@ -389,17 +556,35 @@ static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
     pp->node = pn;
     pp->l.next = pp->l.prev = 0;
     pp->evicted = false;
+    pp->evicted_active = false;
+    pp->workingset = false;
+    pp->readahead = false;
+    pp->eviction = 0;
 #ifdef KERNEL
     pp->phys = physical_from_virtual(p);
 #endif
     list_init(&pp->bh_completions);
     list_init(&pp->rq_completions);
-    assert(rbtree_insert_node(&pn->pages, &pp->rbnode));
+    if (!radix_insert(&pn->pages, offset, pp)) {
+        deallocate(pc->h, pp, sizeof(struct pagecache_page));
+        return INVALID_ADDRESS;
+    }
     fetch_and_add(&pc->total_pages, 1); /* decrement happens without cache lock */
     return pp;
-  fail_dealloc_contiguous:
-    deallocate(pc->contiguous, p, pagesize);
-    return INVALID_ADDRESS;
+}
+
+static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
+{
+    /* allocate - later we can look at blocks of pages at a time */
+    pagecache pc = pn->pv->pc;
+    u64 pagesize = U64_FROM_BIT(pc->page_order);
+    void *p = allocate(pc->contiguous, pagesize);
+    if (p == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    pagecache_page pp = insert_page_nodelocked(pn, offset, p);
+    if (pp == INVALID_ADDRESS)
+        deallocate(pc->contiguous, p, pagesize);
+    return pp;
 }
 
 #ifndef PAGECACHE_READ_ONLY
@@ -411,7 +596,7 @@ static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, vector evic
             break;
 
         pagecache_page pp = struct_from_list(l, pagecache_page, l);
-        if (pp->evicted)
+        if (pp->evicted || pp->node->pinned)
             continue;
         assert(pp->refcount.c != 0);
         pagecache_debug("%s: list %s, release pp %p - %R, state %d, count %ld\n", __func__,
@@ -426,9 +611,11 @@ static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, vector evic
 
 static void balance_page_lists_locked(pagecache pc)
 {
-    /* balance active and new lists */
-    s64 dp = ((s64)pc->active.pages - (s64)pc->new.pages) / 2;
-    pagecache_debug("%s: active %ld, new %ld, dp %ld\n", __func__, pc->active.pages, pc->new.pages, dp);
+    /* balance active and new lists toward the adaptive new list share */
+    u64 new_target = (pc->active.pages + pc->new.pages) * pc->new_share / PAGECACHE_SHARE_SCALE;
+    s64 dp = (s64)new_target - (s64)pc->new.pages;
+    pagecache_debug("%s: active %ld, new %ld, share %ld, dp %ld\n", __func__, pc->active.pages,
+                    pc->new.pages, pc->new_share, dp);
     list_foreach(&pc->active.l, l) {
         if (dp <= 0)
             break;
@@ -447,9 +634,63 @@ static void balance_page_lists_locked(pagecache pc)
 
 static pagecache_page page_lookup_nodelocked(pagecache_node pn, u64 n)
 {
-    struct pagecache_page k;
-    k.state_offset = n;
-    return (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
+    return radix_lookup(&pn->pages, n);
+}
+
+/* Iterator over the pages present in a range of page offsets, taken from the
+   page index a batch at a time. Pages allocated while walking the run are
+   not returned. Called with node locked. */
+#define PAGE_RUN_BATCH  16
+
+typedef struct page_run {
+    pagecache_node pn;
+    u64 next;                   /* offset to resume the search at */
+    u64 end;
+    int count;
+    int i;
+    pagecache_page cur;
+    pagecache_page pages[PAGE_RUN_BATCH];
+} *page_run;
+
+static pagecache_page page_run_fetch(page_run r)
+{
+    if (r->i == r->count) {
+        r->i = 0;
+        r->count = radix_gang_lookup(&r->pn->pages, r->next, r->end, (void **)r->pages,
+                                     PAGE_RUN_BATCH);
+        if (r->count == 0)
+            return INVALID_ADDRESS;
+        r->next = page_offset(r->pages[r->count - 1]) + 1;
+    }
+    return r->pages[r->i++];
+}
+
+static void page_run_init(page_run r, pagecache_node pn, u64 start, u64 end)
+{
+    r->pn = pn;
+    r->next = start;
+    r->end = end;
+    r->count = r->i = 0;
+    r->cur = page_run_fetch(r);
+}
+
+/* return the page at offset pi, if present; offsets must be increasing */
+static pagecache_page page_run_take(page_run r, u64 pi)
+{
+    pagecache_page pp = r->cur;
+    if (pp == INVALID_ADDRESS || page_offset(pp) != pi)
+        return INVALID_ADDRESS;
+    r->cur = page_run_fetch(r);
+    return pp;
+}
+
+/* Trade a shared node lock for an exclusive one, so that missing pages can
+   be inserted, and restart the run at pi. */
+static void page_run_lock_exclusive(page_run r, u64 pi)
+{
+    pagecache_unlock_node_shared(r->pn);
+    pagecache_lock_node(r->pn);
+    page_run_init(r, r->pn, pi, r->end);
 }
 
 static pagecache_page page_lookup_or_alloc_nodelocked(pagecache_node pn, u64 n)
@@ -477,8 +718,65 @@ static pagecache_page touch_or_fill_page_by_num_nodelocked(pagecache_node pn, u6
     return pp;
 }
 
-closure_function(6, 1, void, pagecache_write_sg_finish,
+#ifdef KERNEL
+static inline u64 pagecache_dirty_bytes_locked(pagecache pc)
+{
+    return (pc->dirty.pages + pc->writing.pages) << pc->page_order;
+}
+
+static void pagecache_commit_dirty_pages(pagecache pc, u64 limit);
+
+/* While writers are held, write-back is kept going from its own
+   completions, a run at a time, rather than left to the scan timer. */
+static void pagecache_writeback_throttled(pagecache pc)
+{
+    pagecache_lock_state(pc);
+    boolean issue = !list_empty(&pc->throttled) && pc->dirty.pages &&
+        ((pc->writing.pages << pc->page_order) < PAGECACHE_WRITEBACK_MAX);
+    pagecache_unlock_state(pc);
+    if (issue)
+        pagecache_commit_dirty_pages(pc, PAGECACHE_WRITEBACK_MAX);
+}
+
+/* A writer is throttled by holding back its completion, and with it the
+   blocked thread, while dirty and in-flight data is above the high
+   watermark. Write-back completions release held writers once the low
+   watermark is reached. */
+static void pagecache_write_throttle(pagecache pc, status_handler completion)
+{
+    pagecache_lock_state(pc);
+    if (pagecache_dirty_bytes_locked(pc) > PAGECACHE_DIRTY_HIGH_BYTES) {
+        page_completion c = allocate(pc->completions, sizeof(*c));
+        if (c != INVALID_ADDRESS) {
+            pagecache_debug("%s: throttling completion %F\n", __func__, completion);
+            c->sh = completion;
+            list_insert_before(&pc->throttled, &c->l);
+            pagecache_unlock_state(pc);
+            pagecache_writeback_throttled(pc);
+            return;
+        }
+    }
+    pagecache_unlock_state(pc);
+    apply(completion, STATUS_OK);
+}
+
+static void pagecache_release_throttled(pagecache pc)
+{
+    pagecache_lock_state(pc);
+    if (pagecache_dirty_bytes_locked(pc) <= PAGECACHE_DIRTY_LOW_BYTES)
+        queue_completions_locked_internal(pc, &pc->throttled, &pc->rq_completions, runqueue,
+                                          STATUS_OK);
+    pagecache_unlock_state(pc);
+    pagecache_writeback_throttled(pc);
+}
+#else
+#define pagecache_write_throttle(pc, completion)    apply(completion, STATUS_OK)
+#define pagecache_release_throttled(pc)
+#endif
+
+closure_function(7, 1, void, pagecache_write_sg_finish,
                  nanos_thread, t, pagecache_node, pn, range, q, sg_list, sg, status_handler, completion, boolean, complete,
+                 timestamp, start,
                  status, s)
 {
     pagecache_node pn = bound(pn);
@@ -494,7 +792,8 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
                     sg, bound(complete), s);
 
     pagecache_lock_node(pn);
-    pagecache_page pp = page_lookup_nodelocked(pn, pi);
+    struct page_run run;
+    page_run_init(&run, pn, pi, end);
     if (!is_ok(s) || bound(complete)) {
         /* TODO: We handle storage errors after the syscall write
            completion has been applied. This means that storage
@@ -514,8 +813,12 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
         }
 
         if (bound(complete)) {
+            pagecache_stats st = &pn->pv->stats;
+            pagecache_count_io(&st->writes, &st->write_bytes, &st->write_time, range_span(q),
+                               bound(start));
             do {
-                assert(pp != INVALID_ADDRESS && page_offset(pp) == pi);
+                pagecache_page pp = page_run_take(&run, pi);
+                assert(pp != INVALID_ADDRESS);
                 pagecache_lock_state(pc);
                 assert(pp->write_count > 0);
                 if (pp->write_count-- == 1) {
@@ -526,10 +829,11 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
                 pagecache_unlock_state(pc);
                 refcount_release(&pp->refcount);
                 pi++;
-                pp = (pagecache_page)rbnode_get_next((rbnode)pp);
             } while (pi < end);
         }
         pagecache_unlock_node(pn);
+        if (bound(complete))
+            pagecache_release_throttled(pc);
         closure_finish();
         return;
     }
@@ -552,7 +856,8 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
     }
     set_current_thread(bound(t));
     do {
-        assert(pp != INVALID_ADDRESS && page_offset(pp) == pi);
+        pagecache_page pp = page_run_take(&run, pi);
+        assert(pp != INVALID_ADDRESS);
         u64 copy_len = MIN(q.end - (pi << page_order), cache_pagesize(pc)) - offset;
         u64 req_len = pad(copy_len + block_offset, U64_FROM_BIT(block_order));
         if (write_sg) {
@@ -573,16 +878,16 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
         offset = 0;
         block_offset = 0;
         pi++;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
     } while (pi < end);
     pagecache_unlock_node(pn);
 
     /* issue write */
     bound(complete) = true;
+    bound(start) = pagecache_time();
     status_handler completion = bound(completion);
     pagecache_debug("   calling fs_write, range %R, sg %p\n", r, write_sg);
     apply(pn->fs_write, write_sg, r, (status_handler)closure_self());
-    apply(completion, STATUS_OK);
+    pagecache_write_throttle(pc, completion);
 }
 
 closure_function(1, 3, void, pagecache_write_sg,
@@ -627,7 +932,7 @@ closure_function(1, 3, void, pagecache_write_sg,
 
     /* prepare pages for writing */
     merge m = allocate_merge(pc->h, closure(pc->h, pagecache_write_sg_finish,
-        get_current_thread(), pn, q, sg, completion, false));
+        get_current_thread(), pn, q, sg, completion, false, 0));
     status_handler sh = apply_merge(m);
 
     /* initiate reads for rmw start and/or end */
@@ -652,8 +957,10 @@ closure_function(1, 3, void, pagecache_write_sg,
     }
 
     /* prepare whole pages, blocking for any pending reads */
+    struct page_run run;
+    page_run_init(&run, pn, r.start, r.end);
     for (u64 pi = r.start; pi < r.end; pi++) {
-        pagecache_page pp = page_lookup_nodelocked(pn, pi);
+        pagecache_page pp = page_run_take(&run, pi);
         if (pp == INVALID_ADDRESS) {
             pp = allocate_page_nodelocked(pn, pi);
             if (pp == INVALID_ADDRESS) {
@@ -715,6 +1022,8 @@ u64 pagecache_drain(u64 drain_bytes)
 
     if ((v = allocate_vector(pc->h, DRAIN_ITER_MAX)) == INVALID_ADDRESS)
         return 0;
+    /* promote recently hit pages before choosing victims */
+    pagecache_drain_touches(pc);
     while (evicted < pages) {
         pagecache_lock_state(pc);
         u64 n = evict_pages_locked(pc, MIN(pages - evicted, DRAIN_ITER_MAX), v);
@@ -755,17 +1064,17 @@ static void pagecache_finish_pending_writes(pagecache pc, pagecache_volume pv, p
 }
 
 #ifdef KERNEL
-static void pagecache_scan(pagecache pc);
+static void pagecache_scan(pagecache pc, u64 writeback_limit);
 static void pagecache_scan_node(pagecache_node pn);
 #else
-static void pagecache_scan(pagecache pc) {}
+static void pagecache_scan(pagecache pc, u64 writeback_limit) {}
 static void pagecache_scan_node(pagecache_node pn) {}
 #endif
 
 void pagecache_sync_volume(pagecache_volume pv, status_handler complete)
 {
     pagecache_debug("%s: pv %p, complete %p (%F)\n", __func__, pv, complete, complete);
-    pagecache_scan(pv->pc);         /* commit dirty pages */
+    pagecache_scan(pv->pc, infinity);   /* commit dirty pages */
     pagecache_finish_pending_writes(pv->pc, pv, 0, complete);
 }
 
@@ -794,24 +1103,33 @@ closure_function(1, 3, void, pagecache_read_sg,
 
     merge m = allocate_merge(pc->h, completion);
     status_handler sh = apply_merge(m);
-    struct pagecache_page k;
     if (q.end > pn->length)
         q.end = pn->length;
-    k.state_offset = q.start >> pc->page_order;
+    u64 start = q.start >> pc->page_order;
     u64 end = (q.end + MASK(pc->page_order)) >> pc->page_order;
-    pagecache_lock_node(pn);
-    pagecache_page pp = (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
-    for (u64 pi = k.state_offset; pi < end; pi++) {
-        if (pp == INVALID_ADDRESS || page_offset(pp) > pi) {
+    /* cache hits are served under a shared lock */
+    boolean exclusive = false;
+    pagecache_lock_node_shared(pn);
+    struct page_run run;
+    page_run_init(&run, pn, start, end);
+    for (u64 pi = start; pi < end; pi++) {
+        pagecache_page pp = page_run_take(&run, pi);
+        if (pp == INVALID_ADDRESS && !exclusive) {
+            page_run_lock_exclusive(&run, pi);
+            exclusive = true;
+            pp = page_run_take(&run, pi);
+        }
+        if (pp == INVALID_ADDRESS) {
             pp = allocate_page_nodelocked(pn, pi);
             if (pp == INVALID_ADDRESS) {
                 pagecache_unlock_node(pn);
                 apply(apply_merge(m), timm("result", "failed to allocate pagecache_page"));
                 return;
             }
-        } else if (page_state(pp) == PAGECACHE_PAGESTATE_FREE) {
+        } else {
             pagecache_lock_state(pc);
-            realloc_pagelocked(pc, pp);
+            if (page_state(pp) == PAGECACHE_PAGESTATE_FREE)
+                realloc_pagelocked(pc, pp);
             pagecache_unlock_state(pc);
         }
 
@@ -825,10 +1143,13 @@ closure_function(1, 3, void, pagecache_read_sg,
         sgb->refcount = &pp->refcount;
         refcount_reserve(&pp->refcount);
 
-        touch_or_fill_page_nodelocked(pn, pp, m, false /* complete on runqueue */);
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pagecache_count_lookup(pp, touch_or_fill_page_nodelocked(pn, pp, m,
+                                                                 false /* complete on runqueue */));
     }
-    pagecache_unlock_node(pn);
+    if (exclusive)
+        pagecache_unlock_node(pn);
+    else
+        pagecache_unlock_node_shared(pn);
 
     /* finished issuing requests */
     apply(sh, STATUS_OK);
@@ -836,6 +1157,12 @@ closure_function(1, 3, void, pagecache_read_sg,
 
 
 #ifdef KERNEL
+/* Shared file pages are mapped read-only until written. A write fault sets
+   the page's bit in the map's written bitmap before the pte is made
+   writable, so a scan only needs to visit the pages in the bitmap: each is
+   write-protected again and its pagecache page marked dirty. Cost follows
+   the number of pages written, not the size of the mapping, and no
+   hardware dirty bit is needed. */
 closure_function(3, 3, boolean, pagecache_check_dirty_page,
                  pagecache, pc, pagecache_shared_map, sm, flush_entry, fe,
                  int, level, u64, vaddr, pteptr, entry)
@@ -844,11 +1171,10 @@ closure_function(3, 3, boolean, pagecache_check_dirty_page,
     pagecache_shared_map sm = bound(sm);
     pte old_entry = pte_from_pteptr(entry);
     if (pte_is_present(old_entry) &&
-        pte_is_mapping(level, old_entry) &&
-        pte_is_dirty(old_entry)) {
+        pte_is_mapping(level, old_entry)) {
         u64 pi = (sm->node_offset + (vaddr - sm->n.r.start)) >> PAGELOG;
-        pagecache_debug("   dirty: vaddr 0x%lx, pi 0x%lx\n", vaddr, pi);
-        pt_pte_clean(entry);
+        pagecache_debug("   written: vaddr 0x%lx, pi 0x%lx\n", vaddr, pi);
+        pt_pte_write_protect(entry);
         page_invalidate(bound(fe), vaddr);
         pagecache_page pp = page_lookup_nodelocked(sm->pn, pi);
         assert(pp != INVALID_ADDRESS);
@@ -862,8 +1188,18 @@ closure_function(3, 3, boolean, pagecache_check_dirty_page,
 
 static void pagecache_scan_shared_map(pagecache pc, pagecache_shared_map sm, flush_entry fe)
 {
-    traverse_ptes(sm->n.r.start, range_span(sm->n.r),
-                  stack_closure(pagecache_check_dirty_page, pc, sm, fe));
+    u64 pages = range_span(sm->n.r) >> PAGELOG;
+    for (u64 w = 0; w < pad(pages, 64) / 64; w++) {
+        if (!sm->written[w])
+            continue;
+        for (u64 i = w * 64; i < MIN(pages, (w + 1) * 64); i++) {
+            /* clear before protecting; a later write faults and sets it again */
+            if (!atomic_test_and_clear_bit(&sm->written[w], i & 63))
+                continue;
+            traverse_ptes(sm->n.r.start + (i << PAGELOG), PAGESIZE,
+                          stack_closure(pagecache_check_dirty_page, pc, sm, fe));
+        }
+    }
 }
 
 static void pagecache_scan_shared_mappings(pagecache pc)
@@ -890,75 +1226,147 @@ static void pagecache_scan_node(pagecache_node pn)
     page_invalidate_sync(fe, ignore);
 }
 
-closure_function(2, 1, void, pagecache_commit_complete,
-                 pagecache, pc, pagecache_page, pp,
+closure_function(4, 1, void, pagecache_commit_complete,
+                 pagecache, pc, pagecache_page, pp, u64, count, timestamp, t_start,
                  status, s)
 {
     pagecache pc = bound(pc);
     pagecache_page pp = bound(pp);
-    pagecache_debug("%s: pp %p, s %v\n", __func__, pp, s);
+    pagecache_node pn = pp->node;
+    u64 start = page_offset(pp);
+    pagecache_stats st = &pn->pv->stats;
+    u64 bytes = bound(count) << pc->page_order;
+    pagecache_count_io(&st->writes, &st->write_bytes, &st->write_time, bytes, bound(t_start));
+    fetch_and_add(&st->writeback_bytes, bytes);
+    pagecache_debug("%s: pp %p, count %ld, s %v\n", __func__, pp, bound(count), s);
     if (!is_ok(s)) {
         pagecache_debug("%s: write_error now %v\n", __func__, s);
-        pp->node->pv->write_error = s;
+        pn->pv->write_error = s;
     }
+    pagecache_lock_node_shared(pn);
+    struct page_run run;
+    page_run_init(&run, pn, start, start + bound(count));
     pagecache_lock_state(pc);
-    assert(pp->write_count > 0);
-    if (pp->write_count-- == 1) {
-        if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY)
-            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
-        pagecache_page_queue_completions_locked(pc, pp, s);
+    for (u64 pi = start; pi < start + bound(count); pi++) {
+        pp = page_run_take(&run, pi);
+        assert(pp != INVALID_ADDRESS);
+        assert(pp->write_count > 0);
+        if (pp->write_count-- == 1) {
+            if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY)
+                change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
+            pagecache_page_queue_completions_locked(pc, pp, s);
+        }
     }
     pagecache_unlock_state(pc);
+    pagecache_unlock_node_shared(pn);
+    pagecache_release_throttled(pc);
     closure_finish();
 }
 
-static void pagecache_commit_dirty_pages(pagecache pc)
+/* Dirty pages are written back in runs of contiguous pages of a node, each
+   issued as a single write. Shared mappings are scanned in address order, so
+   such runs are usually adjacent on the dirty list. At most limit bytes
+   are issued. */
+static void pagecache_commit_dirty_pages(pagecache pc, u64 limit)
 {
-    pagecache_debug("%s\n", __func__);
+    pagecache_debug("%s: limit %ld\n", __func__, limit);
+    u64 max_run = PAGECACHE_WRITEBACK_MAX >> pc->page_order;
     pagecache_lock_state(pc);
 
-    /* It might be more efficient to move these to a temporary list,
-       issue writes and then resolve on merge completion... */
-    list_foreach(&pc->dirty.l, l) {
-        pagecache_page pp = struct_from_list(l, pagecache_page, l);
+    /* pages dirtied while writes are issued are left for the next scan */
+    u64 remain = MIN(pc->dirty.pages, limit >> pc->page_order);
+    while (remain > 0 && !list_empty(&pc->dirty.l)) {
+        pagecache_page first = struct_from_list(list_begin(&pc->dirty.l), pagecache_page, l);
+        pagecache_node pn = first->node;
         sg_list sg = allocate_sg_list();
         assert(sg != INVALID_ADDRESS);
-        sg_buf sgb = sg_list_tail_add(sg, cache_pagesize(pc));
-        assert(pp->kvirt != INVALID_ADDRESS);
-        sgb->buf = pp->kvirt;
-        sgb->offset = 0;
-        sgb->size = cache_pagesize(pc);
-        sgb->refcount = &pp->refcount;
-        refcount_reserve(&pp->refcount);
-        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_WRITING);
+        pagecache_page pp = first;
+        u64 count = 0;
+        do {
+            sg_buf sgb = sg_list_tail_add(sg, cache_pagesize(pc));
+            assert(pp->kvirt != INVALID_ADDRESS);
+            sgb->buf = pp->kvirt;
+            sgb->offset = 0;
+            sgb->size = cache_pagesize(pc);
+            sgb->refcount = &pp->refcount;
+            refcount_reserve(&pp->refcount);
+            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_WRITING);
+            count++;
+            remain--;
+            if (remain == 0 || count == max_run || list_empty(&pc->dirty.l))
+                break;
+            pp = struct_from_list(list_begin(&pc->dirty.l), pagecache_page, l);
+        } while (pp->node == pn && page_offset(pp) == page_offset(first) + count);
         pagecache_unlock_state(pc);
 
-        apply(pp->node->fs_write, sg,
-              irangel(page_offset(pp) << pc->page_order, cache_pagesize(pc)),
-              closure(pc->h, pagecache_commit_complete, pc, pp));
+        tracepoint(pagecache_writeback, pn, page_offset(first), count);
+        apply(pn->fs_write, sg,
+              irangel(page_offset(first) << pc->page_order, count << pc->page_order),
+              closure(pc->h, pagecache_commit_complete, pc, first, count, pagecache_time()));
 
         pagecache_lock_state(pc);
     }
     pagecache_unlock_state(pc);
 }
 
-static void pagecache_scan(pagecache pc)
+static void pagecache_scan(pagecache pc, u64 writeback_limit)
 {
     if (pc->scan_in_progress)   /* unnecessary? */
         return;
     pc->scan_in_progress = true;
+    pagecache_drain_touches(pc);
     pagecache_scan_shared_mappings(pc);
-    pagecache_commit_dirty_pages(pc);
+    pagecache_commit_dirty_pages(pc, writeback_limit);
+    pc->scan_in_progress = false;
+}
+
+/* Completed write bytes over the last scan period, folded into a moving
+   average with a weight of 1/4 for the new sample. */
+static void pagecache_update_write_bandwidth(pagecache pc)
+{
+    u64 bytes = 0;
+    pagecache_lock_state(pc);
+    list_foreach(&pc->volumes, l)
+        bytes += struct_from_list(l, pagecache_volume, l)->stats.write_bytes;
+    pagecache_unlock_state(pc);
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    timestamp elapsed = t - pc->bw_last_time;
+    if (pc->bw_last_time && elapsed) {
+        u64 bw = ((bytes - pc->bw_last_bytes) * usec_from_timestamp(seconds(1))) /
+            MAX(usec_from_timestamp(elapsed), 1);
+        pc->write_bw = pc->write_bw ? (pc->write_bw * 3 + bw) / 4 : bw;
+    }
+    pc->bw_last_bytes = bytes;
+    pc->bw_last_time = t;
+}
+
+/* Background write-back issues about what the device completed over a scan
+   period, plus whatever is needed to get back under the low watermark, and
+   nothing while in-flight writes alone exceed the high watermark. */
+static u64 pagecache_writeback_budget(pagecache pc)
+{
+    pagecache_lock_state(pc);
+    u64 writing = pc->writing.pages << pc->page_order;
+    u64 dirty = pagecache_dirty_bytes_locked(pc);
+    pagecache_unlock_state(pc);
+    if (writing > PAGECACHE_DIRTY_HIGH_BYTES)
+        return 0;
+    u64 budget = MAX(pc->write_bw * PAGECACHE_SCAN_PERIOD_SECONDS, PAGECACHE_WRITEBACK_MAX);
+    if (dirty > PAGECACHE_DIRTY_LOW_BYTES)
+        budget = MAX(budget, dirty - PAGECACHE_DIRTY_LOW_BYTES);
+    return budget;
 }
 
 define_closure_function(1, 1, void, pagecache_scan_timer,
                         pagecache, pc,
                         u64, overruns /* ignored */)
 {
-    pagecache_scan(bound(pc));
+    pagecache pc = bound(pc);
+    pagecache_update_write_bandwidth(pc);
+    pagecache_scan(pc, pagecache_writeback_budget(pc));
 }
 
-void pagecache_node_add_shared_map(pagecache_node pn, range q /* bytes */, u64 node_offset)
+static pagecache_shared_map allocate_shared_map(pagecache_node pn, range q, u64 node_offset)
 {
     pagecache pc = pn->pv->pc;
     pagecache_shared_map sm = allocate(pc->h, sizeof(struct pagecache_shared_map));
@@ -966,18 +1374,59 @@ void pagecache_node_add_shared_map(pagecache_node pn, range q /* bytes */, u64 n
     sm->n.r = q;
     sm->pn = pn;
     sm->node_offset = node_offset;
-    pagecache_debug("%s: pn %p, q %R, node_offset 0x%lx\n", __func__, pn, q, node_offset);
-    pagecache_lock_state(pc);
+    sm->written_words = pad(range_span(q) >> PAGELOG, 64) / 64;
+    sm->written = allocate_zero(pc->h, sm->written_words * sizeof(u64));
+    assert(sm->written != INVALID_ADDRESS);
+    return sm;
+}
+
+static void insert_shared_map_statelocked(pagecache pc, pagecache_shared_map sm)
+{
     list_insert_before(&pc->shared_maps, &sm->l);
-    assert(rangemap_insert(pn->shared_maps, &sm->n));
+    assert(rangemap_insert(sm->pn->shared_maps, &sm->n));
     if (!pc->scan_timer) {
         timestamp t = seconds(PAGECACHE_SCAN_PERIOD_SECONDS);
-        pc->scan_timer = register_timer(runloop_timers, CLOCK_ID_MONOTONIC, t, false, t,
-                                        (timer_handler)&pc->do_scan_timer);
+        pc->scan_timer = kern_register_timer(CLOCK_ID_MONOTONIC, t, false, t,
+                                             (timer_handler)&pc->do_scan_timer);
     }
+}
+
+/* move written bits for pages [from, from + n) of src to [0, n) of dest */
+static void shared_map_move_written(pagecache_shared_map src, u64 from,
+                                    pagecache_shared_map dest, u64 n)
+{
+    for (u64 i = 0; i < n; i++) {
+        u64 j = from + i;
+        boolean set = (src->written[j / 64] & U64_FROM_BIT(j & 63)) != 0;
+        src->written[j / 64] &= ~U64_FROM_BIT(j & 63);
+        if (set)
+            dest->written[i / 64] |= U64_FROM_BIT(i & 63);
+        else
+            dest->written[i / 64] &= ~U64_FROM_BIT(i & 63);
+    }
+}
+
+void pagecache_node_add_shared_map(pagecache_node pn, range q /* bytes */, u64 node_offset)
+{
+    pagecache pc = pn->pv->pc;
+    pagecache_shared_map sm = allocate_shared_map(pn, q, node_offset);
+    pagecache_debug("%s: pn %p, q %R, node_offset 0x%lx\n", __func__, pn, q, node_offset);
+    pagecache_lock_state(pc);
+    insert_shared_map_statelocked(pc, sm);
+    pagecache_unlock_state(pc);
+}
+
+boolean pagecache_node_is_shared_mapped(pagecache_node pn)
+{
+    pagecache pc = pn->pv->pc;
+    pagecache_lock_state(pc);
+    boolean mapped = rangemap_first_node(pn->shared_maps) != INVALID_ADDRESS;
     pagecache_unlock_state(pc);
+    return mapped;
 }
 
+/* Write faults may record pages outside of the kernel lock, so maps are
+   edited under the state lock, with written bits following their pages. */
 closure_function(3, 1, void, close_shared_pages_intersection,
                  pagecache_node, pn, range, q, flush_entry, fe,
                  rmnode, n)
@@ -996,27 +1445,40 @@ closure_function(3, 1, void, close_shared_pages_intersection,
     pagecache_scan_shared_map(pc, sm, bound(fe));
 
     if (!head && !tail) {
+        pagecache_lock_state(pc);
         rangemap_remove_node(pn->shared_maps, n);
         list_delete(&sm->l);
-        deallocate(pc->h, sm, sizeof(struct pagecache_shared_map));
+        if (pn->released && rangemap_first_node(pn->shared_maps) == INVALID_ADDRESS)
+            pn->pinned = false;
         if (list_empty(&pc->shared_maps)) {
             pagecache_debug("   disable scan timer\n");
             remove_timer(pc->scan_timer, 0);
             pc->scan_timer = 0;
         }
+        pagecache_unlock_state(pc);
+        deallocate(pc->h, sm->written, sm->written_words * sizeof(u64));
+        deallocate(pc->h, sm, sizeof(struct pagecache_shared_map));
     } else if (head) {
-        /* truncate map at start */
+        /* truncate map at start, and create map at tail end */
+        u64 tail_offset = sm->node_offset + (ri.end - rn.start);
+        pagecache_shared_map tsm = tail ?
+            allocate_shared_map(pn, irange(ri.end, rn.end), tail_offset) : 0;
+        pagecache_lock_state(pc);
         assert(rangemap_reinsert(pn->shared_maps, n, irange(rn.start, ri.start)));
-
-        if (tail) {
-            /* create map at tail end */
-            pagecache_node_add_shared_map(pn, irange(ri.end, rn.end),
-                                          sm->node_offset + (ri.end - rn.start));
+        if (tsm) {
+            insert_shared_map_statelocked(pc, tsm);
+            shared_map_move_written(sm, (ri.end - rn.start) >> PAGELOG, tsm,
+                                    (rn.end - ri.end) >> PAGELOG);
         }
+        pagecache_unlock_state(pc);
     } else {
         /* tail only: move map start back */
+        pagecache_lock_state(pc);
         assert(rangemap_reinsert(pn->shared_maps, n, irange(ri.end, rn.end)));
         sm->node_offset += ri.end - rn.start;
+        shared_map_move_written(sm, (ri.end - rn.start) >> PAGELOG, sm,
+                                (rn.end - ri.end) >> PAGELOG);
+        pagecache_unlock_state(pc);
     }
 }
 
@@ -1038,13 +1500,53 @@ closure_function(2, 1, void, scan_shared_pages_intersection,
     pagecache_scan_shared_map(bound(pc), sm, bound(fe));
 }
 
+closure_function(1, 1, void, mark_shared_pages_written,
+                 range, q,
+                 rmnode, n)
+{
+    pagecache_shared_map sm = (pagecache_shared_map)n;
+    range ri = range_intersection(bound(q), n->r);
+    for (u64 v = ri.start; v < ri.end; v += PAGESIZE) {
+        u64 i = (v - n->r.start) >> PAGELOG;
+        atomic_set_bit(&sm->written[i / 64], i & 63);
+    }
+}
+
+/* Record the pages in q as written, ahead of making them writable. */
+void pagecache_node_shared_pages_written(pagecache_node pn, range q /* bytes */)
+{
+    pagecache pc = pn->pv->pc;
+    pagecache_debug("%s: node %p, q %R\n", __func__, pn, q);
+    pagecache_lock_state(pc);
+    rangemap_range_lookup(pn->shared_maps, q, stack_closure(mark_shared_pages_written, q));
+    pagecache_unlock_state(pc);
+}
+
+/* Write fault on a read-only page of a shared map: record the page and make
+   it writable. Safe outside of the kernel lock. If the map is going away,
+   the faulting access is simply retried. */
+void pagecache_node_shared_write_fault(pagecache_node pn, u64 vaddr, pageflags flags)
+{
+    pagecache pc = pn->pv->pc;
+    vaddr &= ~PAGEMASK;
+    pagecache_lock_state(pc);
+    pagecache_shared_map sm = (pagecache_shared_map)rangemap_lookup(pn->shared_maps, vaddr);
+    if (sm != INVALID_ADDRESS) {
+        u64 i = (vaddr - sm->n.r.start) >> PAGELOG;
+        atomic_set_bit(&sm->written[i / 64], i & 63);
+    }
+    pagecache_unlock_state(pc);
+    if (sm != INVALID_ADDRESS)
+        update_map_flags(vaddr, PAGESIZE, flags);
+}
+
 void pagecache_node_scan_and_commit_shared_pages(pagecache_node pn, range q /* bytes */)
 {
     pagecache_debug("%s: node %p, q %R\n", __func__, pn, q);
     flush_entry fe = get_page_flush_entry();
     rangemap_range_lookup(pn->shared_maps, q,
                           stack_closure(scan_shared_pages_intersection, pn->pv->pc, fe));
-    pagecache_commit_dirty_pages(pn->pv->pc);
+    pagecache_commit_dirty_pages(pn->pv->pc, infinity);
     page_invalidate_sync(fe, ignore);
 }
 
@@ -1063,6 +1565,7 @@ boolean pagecache_node_do_page_cow(pagecache_node pn, u64 node_offset, u64 vaddr
     assert(page_state(pp) != PAGECACHE_PAGESTATE_FREE);
     assert(pp->kvirt != INVALID_ADDRESS);
     assert(pp->refcount.c != 0);
+    split_2m_page(vaddr);       /* copy one page out of a folio mapping */
     unmap(vaddr, cache_pagesize(pc));
     map(vaddr, paddr, cache_pagesize(pc), flags);
     runtime_memcpy(pointer_from_u64(vaddr), pp->kvirt, cache_pagesize(pc));
@@ -1079,13 +1582,20 @@ void pagecache_node_fetch_pages(pagecache_node pn, range r)
     status_handler sh = apply_merge(m);
     if (r.end > pn->length)
         r.end = pn->length;
-    struct pagecache_page k;
-    k.state_offset = r.start >> pc->page_order;
+    u64 start = r.start >> pc->page_order;
     u64 end = (r.end + MASK(pc->page_order)) >> pc->page_order;
-    pagecache_lock_node(pn);
-    pagecache_page pp = (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
-    for (u64 pi = k.state_offset; pi < end; pi++) {
-        if (pp == INVALID_ADDRESS || page_offset(pp) > pi) {
+    boolean exclusive = false;
+    pagecache_lock_node_shared(pn);
+    struct page_run run;
+    page_run_init(&run, pn, start, end);
+    for (u64 pi = start; pi < end; pi++) {
+        pagecache_page pp = page_run_take(&run, pi);
+        if (pp == INVALID_ADDRESS && !exclusive) {
+            page_run_lock_exclusive(&run, pi);
+            exclusive = true;
+            pp = page_run_take(&run, pi);
+        }
+        if (pp == INVALID_ADDRESS) {
             pagecache_debug(" allocating page at index %ld\n", pi);
             pp = allocate_page_nodelocked(pn, pi);
             if (pp == INVALID_ADDRESS) {
@@ -1093,10 +1603,13 @@ void pagecache_node_fetch_pages(pagecache_node pn, range r)
                 break;
             }
         }
-        touch_or_fill_page_nodelocked(pn, pp, m, false /* ignored */);
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        if (!touch_or_fill_page_nodelocked(pn, pp, m, false /* ignored */))
+            pp->readahead = true;
     }
-    pagecache_unlock_node(pn);
+    if (exclusive)
+        pagecache_unlock_node(pn);
+    else
+        pagecache_unlock_node_shared(pn);
     apply(sh, STATUS_OK);
 }
 
@@ -1121,9 +1634,16 @@ void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags
                         status_handler complete, boolean bh)
 {
     pagecache pc = pn->pv->pc;
-    pagecache_lock_node(pn);
     u64 pi = node_offset >> pc->page_order;
-    pagecache_page pp = page_lookup_or_alloc_nodelocked(pn, pi);
+    boolean exclusive = false;
+    pagecache_lock_node_shared(pn);
+    pagecache_page pp = page_lookup_nodelocked(pn, pi);
+    if (pp == INVALID_ADDRESS) {
+        pagecache_unlock_node_shared(pn);
+        pagecache_lock_node(pn);
+        exclusive = true;
+        pp = page_lookup_or_alloc_nodelocked(pn, pi);
+    }
     pagecache_debug("%s: pn %p, node_offset 0x%lx, vaddr 0x%lx, flags 0x%lx, complete %F, pp %p\n",
                     __func__, pn, node_offset, vaddr, flags, complete, pp);
     if (pp == INVALID_ADDRESS) {
@@ -1134,9 +1654,12 @@ void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags
     merge m = allocate_merge(pc->h, closure(pc->h, map_page_finish,
                                             pc, pp, vaddr, flags, complete));
     status_handler k = apply_merge(m);
-    touch_or_fill_page_nodelocked(pn, pp, m, bh);
+    pagecache_count_lookup(pp, touch_or_fill_page_nodelocked(pn, pp, m, bh));
     refcount_reserve(&pp->refcount);
-    pagecache_unlock_node(pn);
+    if (exclusive)
+        pagecache_unlock_node(pn);
+    else
+        pagecache_unlock_node_shared(pn);
     apply(k, STATUS_OK);
 }
 
@@ -1144,19 +1667,313 @@ void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags
 boolean pagecache_map_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags)
 {
     boolean mapped = false;
-    pagecache_lock_node(pn);
+    pagecache_lock_node_shared(pn);
     pagecache_page pp = page_lookup_nodelocked(pn, node_offset >> pn->pv->pc->page_order);
     pagecache_debug("%s: pn %p, node_offset 0x%lx, vaddr 0x%lx, flags 0x%lx, pp %p\n",
                     __func__, pn, node_offset, vaddr, flags.w, pp);
     if (pp == INVALID_ADDRESS)
         goto out;
     if (touch_or_fill_page_nodelocked(pn, pp, 0, false /* N/A */)) {
+        pagecache_count_lookup(pp, true);
         mapped = true;
         map_page(pn->pv->pc, pp, vaddr, flags);
     }
     refcount_reserve(&pp->refcount);
   out:
+    pagecache_unlock_node_shared(pn);
+    return mapped;
+}
+
+/* Map the pages in [node_offset, node_offset + length) that are already filled
+   and have nothing mapped at the corresponding address; pages that are absent
+   or still being read are skipped rather than filled. No-alloc, like
+   pagecache_map_page_if_filled(), and the node lock is taken only once.
+   Returns the number of pages mapped. */
+u64 pagecache_map_filled_pages(pagecache_node pn, u64 node_offset, u64 vaddr, u64 length,
+                               pageflags flags)
+{
+    pagecache pc = pn->pv->pc;
+    u64 pagesize = cache_pagesize(pc);
+    u64 mapped = 0;
+    pagecache_lock_node_shared(pn);
+    for (u64 off = 0; off < length; off += pagesize) {
+        pagecache_page pp = page_lookup_nodelocked(pn, (node_offset + off) >> pc->page_order);
+        if (pp == INVALID_ADDRESS)
+            continue;
+        int state = page_state(pp);
+        if (state != PAGECACHE_PAGESTATE_ACTIVE && state != PAGECACHE_PAGESTATE_NEW)
+            continue;
+        if (physical_from_virtual(pointer_from_u64(vaddr + off)) != INVALID_PHYSICAL)
+            continue;
+        if (!touch_or_fill_page_nodelocked(pn, pp, 0, false /* N/A */))
+            continue;
+        refcount_reserve(&pp->refcount);
+        map_page(pc, pp, vaddr + off, flags);
+        mapped++;
+    }
+    pagecache_unlock_node_shared(pn);
+    pagecache_debug("%s: pn %p, node_offset 0x%lx, vaddr 0x%lx, length 0x%lx, mapped %ld\n",
+                    __func__, pn, node_offset, vaddr, length, mapped);
+    return mapped;
+}
+
+/* Huge pages
+
+   A folio is a run of 2M worth of pages at a 2M-aligned node offset,
+   backed by one 2M-aligned physically contiguous block, which may be mapped
+   with a single 2M page. Folio pages are otherwise ordinary pages that are
+   aged and freed one at a time, so the kernel mapping of the block is split
+   into 4K pages when it is allocated. A mapping holds a reference to every
+   page in the folio. */
+#define pagecache_folio_pages(pc)   U64_FROM_BIT(PAGELOG_2M - (pc)->page_order)
+
+/* called with node locked */
+static boolean folio_present_nodelocked(pagecache_node pn, u64 start)
+{
+    pagecache pc = pn->pv->pc;
+    u64 n = pagecache_folio_pages(pc);
+    struct page_run run;
+    page_run_init(&run, pn, start, start + n);
+    pagecache_page first = run.cur;
+    if (first == INVALID_ADDRESS || page_offset(first) != start ||
+        page_state(first) == PAGECACHE_PAGESTATE_FREE || (first->phys & PAGEMASK_2M))
+        return false;
+    for (u64 i = 0; i < n; i++) {
+        pagecache_page pp = page_run_take(&run, start + i);
+        if (pp == INVALID_ADDRESS || page_state(pp) == PAGECACHE_PAGESTATE_FREE ||
+            pp->phys != first->phys + (i << pc->page_order))
+            return false;
+    }
+    return true;
+}
+
+/* Back the folio at start with a new block, provided that no page in its
+   range is resident. Returns the first page, or INVALID_ADDRESS. Called
+   with node locked. */
+static pagecache_page allocate_folio_nodelocked(pagecache_node pn, u64 start)
+{
+    pagecache pc = pn->pv->pc;
+    u64 n = pagecache_folio_pages(pc);
+    struct page_run run;
+    page_run_init(&run, pn, start, start + n);
+    for (pagecache_page pp = run.cur; pp != INVALID_ADDRESS; pp = page_run_fetch(&run)) {
+        if (page_state(pp) != PAGECACHE_PAGESTATE_FREE)
+            return INVALID_ADDRESS;
+    }
+    void *p = allocate(pc->contiguous, PAGESIZE_2M);
+    if (p == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    if (physical_from_virtual(p) & PAGEMASK_2M) {
+        deallocate(pc->contiguous, p, PAGESIZE_2M);
+        return INVALID_ADDRESS;
+    }
+    split_2m_page(u64_from_pointer(p));
+    pagecache_page first = INVALID_ADDRESS;
+    page_run_init(&run, pn, start, start + n);
+    for (u64 i = 0; i < n; i++) {
+        void *kvirt = p + (i << pc->page_order);
+        pagecache_page pp = page_run_take(&run, start + i);
+        if (pp == INVALID_ADDRESS) {
+            pp = insert_page_nodelocked(pn, start + i, kvirt);
+            if (pp == INVALID_ADDRESS) {
+                /* pages set up so far are left as ordinary pages */
+                deallocate(pc->contiguous, kvirt, (n - i) << pc->page_order);
+                return INVALID_ADDRESS;
+            }
+        } else {
+            pagecache_lock_state(pc);
+            reinit_pagelocked(pc, pp, kvirt);
+            pagecache_unlock_state(pc);
+        }
+        if (i == 0)
+            first = pp;
+    }
+    return first;
+}
+
+closure_function(5, 1, void, pagecache_read_folio_complete,
+                 pagecache, pc, pagecache_page, first, u64, count, sg_list, sg, timestamp, start,
+                 status, s)
+{
+    pagecache pc = bound(pc);
+    pagecache_page pp = bound(first);
+    pagecache_node pn = pp->node;
+    u64 start = page_offset(pp);
+    pagecache_stats st = &pn->pv->stats;
+    pagecache_count_io(&st->reads, &st->read_bytes, &st->read_time,
+                       bound(count) << pc->page_order, bound(start));
+    if (!is_ok(s))
+        msg_err("error reading pages at 0x%lx: %v\n", start << pc->page_order, s);
+    pagecache_lock_node_shared(pn);
+    struct page_run run;
+    page_run_init(&run, pn, start, start + bound(count));
+    pagecache_lock_state(pc);
+    for (u64 pi = start; pi < start + bound(count); pi++) {
+        pp = page_run_take(&run, pi);
+        assert(pp != INVALID_ADDRESS && page_state(pp) == PAGECACHE_PAGESTATE_READING);
+        page_filled_locked(pc, pp, s);
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node_shared(pn);
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    closure_finish();
+}
+
+/* fill a newly allocated folio with a single read; called with node locked */
+static void fill_folio_nodelocked(pagecache_node pn, pagecache_page first, merge m, boolean bh)
+{
+    pagecache pc = pn->pv->pc;
+    u64 start = page_offset(first);
+    u64 n = pagecache_folio_pages(pc);
+    sg_list sg = allocate_sg_list();
+    assert(sg != INVALID_ADDRESS);
+    struct page_run run;
+    page_run_init(&run, pn, start, start + n);
+    pagecache_lock_state(pc);
+    for (u64 pi = start; pi < start + n; pi++) {
+        pagecache_page pp = page_run_take(&run, pi);
+        assert(pp != INVALID_ADDRESS && page_state(pp) == PAGECACHE_PAGESTATE_ALLOC);
+        enqueue_page_completion_statelocked(pc, pp, apply_merge(m), bh);
+        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_READING);
+        sg_buf sgb = sg_list_tail_add(sg, cache_pagesize(pc));
+        sgb->buf = pp->kvirt;
+        sgb->size = cache_pagesize(pc);
+        sgb->offset = 0;
+        sgb->refcount = &pp->refcount;
+        refcount_reserve(&pp->refcount);
+    }
+    pagecache_unlock_state(pc);
+    tracepoint(pagecache_fill, pn, start, n);
+    apply(pn->fs_read, sg, irangel(start << pc->page_order, PAGESIZE_2M),
+          closure(pc->h, pagecache_read_folio_complete, pc, first, n, sg, pagecache_time()));
+}
+
+/* reserve or release the mapping references on all pages of a folio;
+   called with node locked */
+static void folio_refs_nodelocked(pagecache_node pn, u64 start, boolean reserve)
+{
+    pagecache pc = pn->pv->pc;
+    u64 n = pagecache_folio_pages(pc);
+    struct page_run run;
+    page_run_init(&run, pn, start, start + n);
+    for (u64 pi = start; pi < start + n; pi++) {
+        pagecache_page pp = page_run_take(&run, pi);
+        assert(pp != INVALID_ADDRESS);
+        if (reserve)
+            refcount_reserve(&pp->refcount);
+        else
+            refcount_release(&pp->refcount);
+    }
+}
+
+/* called with lock held */
+closure_function(0, 3, boolean, pagecache_pte_unmapped,
+                 int, level, u64, vaddr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    return !pte_is_present(e) || !pte_is_mapping(level, e);
+}
+
+closure_function(5, 1, void, map_huge_page_finish,
+                 pagecache_node, pn, pagecache_page, first, u64, vaddr, pageflags, flags,
+                 status_handler, complete,
+                 status, s)
+{
+    pagecache_node pn = bound(pn);
+    pagecache_page first = bound(first);
+    u64 vaddr = bound(vaddr);
+    /* a 4K fault in the block may have been served in the meantime */
+    if (is_ok(s) && traverse_ptes(vaddr, PAGESIZE_2M, stack_closure(pagecache_pte_unmapped))) {
+        map(vaddr, first->phys, PAGESIZE_2M, bound(flags));
+    } else {
+        pagecache_lock_node_shared(pn);
+        folio_refs_nodelocked(pn, page_offset(first), false);
+        pagecache_unlock_node_shared(pn);
+    }
+    apply(bound(complete), s);
+    closure_finish();
+}
+
+/* Map the folio at node_offset (2M-aligned) at vaddr with a single 2M page,
+   allocating and filling the folio as needed. Returns false without doing
+   anything if some page in its range is already cached outside of a folio,
+   or if no 2M block is available; the caller may then map 4K pages. */
+boolean pagecache_map_huge_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags,
+                                status_handler complete, boolean bh)
+{
+    pagecache pc = pn->pv->pc;
+    u64 start = node_offset >> pc->page_order;
+    u64 n = pagecache_folio_pages(pc);
+    assert((node_offset & PAGEMASK_2M) == 0 && (vaddr & PAGEMASK_2M) == 0);
+    pagecache_lock_node(pn);
+    pagecache_page first;
+    boolean fresh = false;
+    if (folio_present_nodelocked(pn, start)) {
+        first = page_lookup_nodelocked(pn, start);
+    } else {
+        first = allocate_folio_nodelocked(pn, start);
+        if (first == INVALID_ADDRESS) {
+            pagecache_unlock_node(pn);
+            return false;
+        }
+        fresh = true;
+    }
+    pagecache_debug("%s: pn %p, node_offset 0x%lx, vaddr 0x%lx, first %p, fresh %d\n",
+                    __func__, pn, node_offset, vaddr, first, fresh);
+    merge m = allocate_merge(pc->h, closure(pc->h, map_huge_page_finish,
+                                            pn, first, vaddr, flags, complete));
+    status_handler k = apply_merge(m);
+    if (fresh) {
+        pagecache_count_lookup(first, false);
+        fill_folio_nodelocked(pn, first, m, bh);
+    } else {
+        struct page_run run;
+        page_run_init(&run, pn, start, start + n);
+        for (u64 pi = start; pi < start + n; pi++) {
+            pagecache_page pp = page_run_take(&run, pi);
+            boolean hit = touch_or_fill_page_nodelocked(pn, pp, m, bh);
+            if (pi == start)
+                pagecache_count_lookup(pp, hit);
+        }
+    }
+    folio_refs_nodelocked(pn, start, true);
     pagecache_unlock_node(pn);
+    apply(k, STATUS_OK);
+    return true;
+}
+
+/* no-alloc / no-fill path for a folio whose pages are all filled */
+boolean pagecache_map_huge_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr,
+                                          pageflags flags)
+{
+    pagecache pc = pn->pv->pc;
+    u64 start = node_offset >> pc->page_order;
+    u64 n = pagecache_folio_pages(pc);
+    boolean mapped = false;
+    pagecache_lock_node_shared(pn);
+    if (!folio_present_nodelocked(pn, start))
+        goto out;
+    struct page_run run;
+    page_run_init(&run, pn, start, start + n);
+    for (u64 pi = start; pi < start + n; pi++) {
+        int state = page_state(page_run_take(&run, pi));
+        if (state == PAGECACHE_PAGESTATE_ALLOC || state == PAGECACHE_PAGESTATE_READING)
+            goto out;
+    }
+    page_run_init(&run, pn, start, start + n);
+    for (u64 pi = start; pi < start + n; pi++) {
+        pagecache_page pp = page_run_take(&run, pi);
+        touch_or_fill_page_nodelocked(pn, pp, 0, false /* N/A */);
+        refcount_reserve(&pp->refcount);
+        if (pi == start) {
+            pagecache_count_lookup(pp, true);
+            map(vaddr, pp->phys, PAGESIZE_2M, flags);
+        }
+    }
+    mapped = true;
+  out:
+    pagecache_unlock_node_shared(pn);
     return mapped;
 }
 
@@ -1171,16 +1988,21 @@ closure_function(4, 3, boolean, pagecache_unmap_page_nodelocked,
         pagecache_debug("   vaddr 0x%lx, pi 0x%lx\n", vaddr, pi);
         pte_set(entry, 0);
         page_invalidate(bound(fe), vaddr);
+        pagecache pc = bound(pn)->pv->pc;
+        u64 phys = page_from_pte(old_entry);
+        if (pte_map_size(level, old_entry) == PAGESIZE_2M) {
+            /* folio */
+            folio_refs_nodelocked(bound(pn), pi, false);
+            return true;
+        }
         pagecache_page pp = page_lookup_nodelocked(bound(pn), pi);
         assert(pp != INVALID_ADDRESS);
-        u64 phys = page_from_pte(old_entry);
         if (phys == pp->phys) {
             /* shared or cow */
             assert(pp->refcount.c >= 1);
             refcount_release(&pp->refcount);
         } else {
             /* private copy: free physical page */
-            pagecache pc = bound(pn)->pv->pc;
             deallocate_u64(pc->physical, phys, cache_pagesize(pc));
         }
     }
@@ -1200,22 +2022,6 @@ void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node
 }
 #endif
 
-closure_function(1, 1, boolean, pagecache_page_print_key,
-                 pagecache, pc,
-                 rbnode, n)
-{
-    rprintf(" 0x%lx", page_offset((pagecache_page)n) << cache_pagesize(bound(pc)));
-    return true;
-}
-
-closure_function(0, 2, int, pagecache_page_compare,
-                 rbnode, a, rbnode, b)
-{
-    u64 oa = page_offset((pagecache_page)a);
-    u64 ob = page_offset((pagecache_page)b);
-    return oa == ob ? 0 : (oa < ob ? -1 : 1);
-}
-
 void pagecache_set_node_length(pagecache_node pn, u64 length)
 {
     pn->length = length;
@@ -1226,6 +2032,25 @@ u64 pagecache_get_node_length(pagecache_node pn)
     return pn->length;
 }
 
+/* true if any page within q is resident or being filled */
+boolean pagecache_node_range_cached(pagecache_node pn, range q /* bytes */)
+{
+    pagecache pc = pn->pv->pc;
+    boolean cached = false;
+    struct page_run run;
+    pagecache_lock_node_shared(pn);
+    page_run_init(&run, pn, q.start >> pc->page_order,
+                  (q.end + MASK(pc->page_order)) >> pc->page_order);
+    for (pagecache_page pp = run.cur; pp != INVALID_ADDRESS; pp = page_run_fetch(&run)) {
+        if (page_state(pp) != PAGECACHE_PAGESTATE_FREE) {
+            cached = true;
+            break;
+        }
+    }
+    pagecache_unlock_node_shared(pn);
+    return cached;
+}
+
 void pagecache_deallocate_node(pagecache_node pn)
 {
     /* TODO: We probably need to add a refcount to the node with a
@@ -1264,11 +2089,10 @@ pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io
         return INVALID_ADDRESS;
     }
 #ifdef KERNEL
-    spin_lock_init(&pn->pages_lock);
+    spin_rw_lock_init(&pn->pages_lock);
 #endif
     list_insert_before(&pv->nodes, &pn->l);
-    init_rbtree(&pn->pages, closure(h, pagecache_page_compare),
-                closure(h, pagecache_page_print_key, pv->pc));
+    init_radix_tree(&pn->pages, h);
     pn->length = 0;
     pn->cache_read = closure(h, pagecache_read_sg, pn);
 #ifndef PAGECACHE_READ_ONLY
@@ -1279,14 +2103,77 @@ pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io
     pn->fs_read = fs_read;
     pn->fs_write = fs_write;
     pn->fs_reserve = fs_reserve;
+    pn->pinned = false;
+    pn->released = false;
     return pn;
 }
 
+#ifndef PAGECACHE_READ_ONLY
+closure_function(0, 3, void, pagecache_unbacked_read,
+                 sg_list, sg, range, q, status_handler, sh)
+{
+    sg_zero_fill(sg, range_span(q));
+    apply(sh, STATUS_OK);
+}
+
+closure_function(0, 3, void, pagecache_unbacked_write,
+                 sg_list, sg, range, q, status_handler, sh)
+{
+    if (sg) {
+        sg_list_release(sg);
+        deallocate_sg_list(sg);
+    }
+    apply(sh, STATUS_OK);
+}
+
+/* A node without backing storage, e.g. for memfd: pages are filled with
+   zeros, and writeback just returns them to the new list, where they are
+   skipped by eviction for as long as the node is pinned. */
+pagecache_node pagecache_allocate_unbacked_node(pagecache_volume pv)
+{
+    heap h = pv->pc->h;
+    sg_io fs_read = closure(h, pagecache_unbacked_read);
+    if (fs_read == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    sg_io fs_write = closure(h, pagecache_unbacked_write);
+    if (fs_write == INVALID_ADDRESS)
+        goto fail_read;
+    pagecache_node pn = pagecache_allocate_node(pv, fs_read, fs_write, 0);
+    if (pn == INVALID_ADDRESS)
+        goto fail_write;
+    pn->pinned = true;
+    return pn;
+  fail_write:
+    deallocate_closure(fs_write);
+  fail_read:
+    deallocate_closure(fs_read);
+    return INVALID_ADDRESS;
+}
+
+/* The owner is done with an unbacked node; its pages become reclaimable
+   once the last shared mapping of the node is closed. The node itself is
+   leaked, as with pagecache_deallocate_node(). */
+void pagecache_release_unbacked_node(pagecache_node pn)
+{
+    pagecache_lock_state(pn->pv->pc);
+    pn->released = true;
+    if (rangemap_first_node(pn->shared_maps) == INVALID_ADDRESS)
+        pn->pinned = false;
+    pagecache_unlock_state(pn->pv->pc);
+}
+#endif
+
 void *pagecache_get_zero_page(void)
 {
     return global_pagecache->zero_page;
 }
 
+/* for I/O buffers outside of the cache */
+heap pagecache_get_contiguous_heap(void)
+{
+    return global_pagecache->contiguous;
+}
+
 int pagecache_get_page_order(void)
 {
     return global_pagecache->page_order;
@@ -1297,6 +2184,136 @@ u64 pagecache_get_occupancy(void)
     return global_pagecache->total_pages << pagecache_get_page_order();
 }
 
+#ifdef KERNEL
+/* pv is 0 for totals over all volumes */
+static u64 pagecache_stat_sum(pagecache_volume pv, u64 offset)
+{
+    if (pv)
+        return *(u64 *)((void *)&pv->stats + offset);
+    u64 sum = 0;
+    pagecache_lock_state(global_pagecache);
+    list_foreach(&global_pagecache->volumes, l)
+        sum += *(u64 *)((void *)&struct_from_list(l, pagecache_volume, l)->stats + offset);
+    pagecache_unlock_state(global_pagecache);
+    return sum;
+}
+
+closure_function(3, 0, value, pagecache_get_counter,
+                 pagecache_volume, pv, u64, offset, value, v)
+{
+    return value_rewrite_u64(bound(v), pagecache_stat_sum(bound(pv), bound(offset)));
+}
+
+/* average latency in microseconds */
+closure_function(4, 0, value, pagecache_get_latency,
+                 pagecache_volume, pv, u64, count_offset, u64, time_offset, value, v)
+{
+    u64 count = pagecache_stat_sum(bound(pv), bound(count_offset));
+    u64 time = pagecache_stat_sum(bound(pv), bound(time_offset));
+    return value_rewrite_u64(bound(v), count ? usec_from_timestamp(time) / count : 0);
+}
+
+closure_function(1, 0, value, pagecache_get_dirty_bytes,
+                 value, v)
+{
+    pagecache pc = global_pagecache;
+    return value_rewrite_u64(bound(v), (pc->dirty.pages + pc->writing.pages) << pc->page_order);
+}
+
+closure_function(1, 0, value, pagecache_get_write_bandwidth,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), global_pagecache->write_bw);
+}
+
+closure_function(1, 0, value, pagecache_get_new_share,
+                 value, v)
+{
+    /* percent */
+    return value_rewrite_u64(bound(v), global_pagecache->new_share * 100 / PAGECACHE_SHARE_SCALE);
+}
+
+#define register_counter(h, pv, n, t, field)                                \
+    v = value_from_u64(h, 0);                                               \
+    a = sym(field);                                                         \
+    set(t, a, v);                                                           \
+    tuple_notifier_register_get_notify(n, a, closure(h, pagecache_get_counter, pv,   \
+        offsetof(pagecache_stats, field), v));
+
+#define register_latency(h, pv, n, t, name, count, time)                    \
+    v = value_from_u64(h, 0);                                               \
+    a = sym(name);                                                          \
+    set(t, a, v);                                                           \
+    tuple_notifier_register_get_notify(n, a, closure(h, pagecache_get_latency, pv,   \
+        offsetof(pagecache_stats, count), offsetof(pagecache_stats, time), v));
+
+static tuple_notifier pagecache_stats_tuple(heap h, pagecache_volume pv, tuple t)
+{
+    value v;
+    symbol a;
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    register_counter(h, pv, n, t, hits);
+    register_counter(h, pv, n, t, misses);
+    register_counter(h, pv, n, t, readahead_hits);
+    register_counter(h, pv, n, t, evictions_new);
+    register_counter(h, pv, n, t, evictions_active);
+    register_counter(h, pv, n, t, refaults);
+    register_counter(h, pv, n, t, workingset_refaults);
+    register_counter(h, pv, n, t, reads);
+    register_counter(h, pv, n, t, read_bytes);
+    register_counter(h, pv, n, t, writes);
+    register_counter(h, pv, n, t, write_bytes);
+    register_counter(h, pv, n, t, writeback_bytes);
+    register_latency(h, pv, n, t, read_latency_us, reads, read_time);
+    register_latency(h, pv, n, t, write_latency_us, writes, write_time);
+    return n;
+}
+
+static void pagecache_register_volume_management(pagecache_volume pv)
+{
+    pagecache pc = pv->pc;
+    tuple t = allocate_tuple();
+    assert(t);
+    pv->mgmt_name = intern_u64(pc->mgmt_volume_count++);
+    set(pc->mgmt_volumes, pv->mgmt_name, pagecache_stats_tuple(pc->h, pv, t));
+}
+
+/* /pagecache: totals and cache-wide state, with per-volume counters under
+   /pagecache/volumes/<n> */
+void init_pagecache_management(tuple root)
+{
+    pagecache pc = global_pagecache;
+    heap h = pc->h;
+    value v;
+    symbol a;
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = pagecache_stats_tuple(h, 0, t);
+    v = value_from_u64(h, 0);
+    a = sym(dirty_bytes);
+    set(t, a, v);
+    tuple_notifier_register_get_notify(n, a, closure(h, pagecache_get_dirty_bytes, v));
+    v = value_from_u64(h, 0);
+    a = sym(write_bandwidth);
+    set(t, a, v);
+    tuple_notifier_register_get_notify(n, a, closure(h, pagecache_get_write_bandwidth, v));
+    v = value_from_u64(h, 0);
+    a = sym(new_share_percent);
+    set(t, a, v);
+    tuple_notifier_register_get_notify(n, a, closure(h, pagecache_get_new_share, v));
+
+    pc->mgmt_volumes = allocate_tuple();
+    assert(pc->mgmt_volumes);
+    list_foreach(&pc->volumes, l)
+        pagecache_register_volume_management(struct_from_list(l, pagecache_volume, l));
+    set(pc->mgmt_volumes, sym(no_encode), null_value);
+    set(t, sym(volumes), pc->mgmt_volumes);
+    set(t, sym(no_encode), null_value);
+    set(root, sym(pagecache), n);
+}
+#endif
+
 pagecache_volume pagecache_allocate_volume(u64 length, int block_order)
 {
     pagecache pc = global_pagecache;
@@ -1304,17 +2321,31 @@ pagecache_volume pagecache_allocate_volume(u64 length, int block_order)
     if (pv == INVALID_ADDRESS)
         return pv;
     pv->pc = pc;
-    list_insert_before(&pc->volumes, &pv->l);
     list_init(&pv->nodes);
     pv->length = length;
     pv->block_order = block_order;
     pv->write_error = STATUS_OK;
+    zero(&pv->stats, sizeof(pv->stats));
+    pagecache_lock_state(pc);
+    list_insert_before(&pc->volumes, &pv->l);
+    pagecache_unlock_state(pc);
+#ifdef KERNEL
+    pv->mgmt_name = 0;
+    if (pc->mgmt_volumes)
+        pagecache_register_volume_management(pv);
+#endif
     return pv;
 }
 
 void pagecache_dealloc_volume(pagecache_volume pv)
 {
+#ifdef KERNEL
+    if (pv->mgmt_name)
+        set(pv->pc->mgmt_volumes, pv->mgmt_name, 0);
+#endif
+    pagecache_lock_state(pv->pc);
     list_delete(&pv->l);
+    pagecache_unlock_state(pv->pc);
     deallocate(pv->pc->h, pv, sizeof(*pv));
 }
 
@@ -1350,11 +2381,16 @@ void init_pagecache(heap general, heap contiguous, heap physical, u64 pagesize)
 
 #ifdef KERNEL
     pc->completions =
-        locking_heap_wrapper(general, allocate_objcache(general, contiguous,
-                                                        sizeof(struct page_completion),
-                                                        PAGESIZE));
+        locking_magazine_wrapper(general, allocate_objcache(general, contiguous,
+                                                            sizeof(struct page_completion),
+                                                            PAGESIZE), 1, 0);
     assert(pc->completions != INVALID_ADDRESS);
     spin_lock_init(&pc->state_lock);
+    lock_stats_register(&pc->state_lock, "pagecache_state");
+    for (int i = 0; i < MAX_CPUS; i++) {
+        spin_lock_init(&pc->touch_batches[i].lock);
+        pc->touch_batches[i].count = 0;
+    }
 #else
     pc->completions = general;
 #endif
@@ -1363,6 +2399,8 @@ void init_pagecache(heap general, heap contiguous, heap physical, u64 pagesize)
     page_list_init(&pc->active);
     page_list_init(&pc->writing);
     page_list_init(&pc->dirty);
+    pc->eviction_clock = 0;
+    pc->new_share = PAGECACHE_SHARE_SCALE / 2;
     list_init(&pc->volumes);
     list_init(&pc->shared_maps);
 
@@ -1373,6 +2411,12 @@ void init_pagecache(heap general, heap contiguous, heap physical, u64 pagesize)
     pc->scan_in_progress = false;
     pc->scan_timer = 0;
     init_closure(&pc->do_scan_timer, pagecache_scan_timer, pc);
+    list_init(&pc->throttled);
+    pc->write_bw = 0;
+    pc->bw_last_bytes = 0;
+    pc->bw_last_time = 0;
+    pc->mgmt_volumes = 0;
+    pc->mgmt_volume_count = 0;
 #endif
     global_pagecache = pc;
 }
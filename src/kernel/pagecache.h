@@ -8,6 +8,8 @@ void pagecache_set_node_length(pagecache_node pn, u64 length);
 
 u64 pagecache_get_node_length(pagecache_node pn);
 
+boolean pagecache_node_range_cached(pagecache_node pn, range q /* bytes */);
+
 void pagecache_node_finish_pending_writes(pagecache_node pn, status_handler complete);
 
 void pagecache_sync_node(pagecache_node pn, status_handler complete);
@@ -15,6 +17,7 @@ void pagecache_sync_node(pagecache_node pn, status_handler complete);
 void pagecache_sync_volume(pagecache_volume pv, status_handler complete);
 
 void *pagecache_get_zero_page(void);
+heap pagecache_get_contiguous_heap(void);
 
 int pagecache_get_page_order(void);
 
@@ -26,6 +29,9 @@ pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io
 
 void pagecache_deallocate_node(pagecache_node pn);
 
+pagecache_node pagecache_allocate_unbacked_node(pagecache_volume pv);
+void pagecache_release_unbacked_node(pagecache_node pn);
+
 sg_io pagecache_node_get_reader(pagecache_node pn);
 
 sg_io pagecache_node_get_writer(pagecache_node pn);
@@ -33,9 +39,13 @@ sg_io pagecache_node_get_writer(pagecache_node pn);
 #ifdef KERNEL
 void pagecache_node_add_shared_map(pagecache_node pn , range v /* bytes */, u64 node_offset);
 
+boolean pagecache_node_is_shared_mapped(pagecache_node pn);
+
 void pagecache_node_close_shared_pages(pagecache_node pn, range q /* bytes */, flush_entry fe);
 
 void pagecache_node_scan_and_commit_shared_pages(pagecache_node pn, range q /* bytes */);
+void pagecache_node_shared_pages_written(pagecache_node pn, range q /* bytes */);
+void pagecache_node_shared_write_fault(pagecache_node pn, u64 vaddr, pageflags flags);
 
 boolean pagecache_node_do_page_cow(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags);
 
@@ -45,8 +55,18 @@ void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags
                         status_handler complete, boolean bh);
 
 boolean pagecache_map_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags);
+u64 pagecache_map_filled_pages(pagecache_node pn, u64 node_offset, u64 vaddr, u64 length,
+                               pageflags flags);
+
+boolean pagecache_map_huge_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags,
+                                status_handler complete, boolean bh);
+
+boolean pagecache_map_huge_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr,
+                                          pageflags flags);
 
 void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node_offset);
+
+void init_pagecache_management(tuple root);
 #endif
 
 
@@ -26,6 +26,19 @@ typedef struct pagecache_completion_queue {
     closure_struct(pagecache_service_completions, service);
 } *pagecache_completion_queue;
 
+/* Per-cpu buffer of cache hits on new or active pages, applied to the page
+   lists once full so that hits take the state lock once per batch; sized
+   to fill two cachelines */
+#define PAGECACHE_TOUCH_BATCH   14
+
+typedef struct pagecache_touch_batch {
+#ifdef KERNEL
+    struct spinlock lock;       /* held by the owning cpu, or when draining */
+#endif
+    u64 count;
+    struct pagecache_page *pages[PAGECACHE_TOUCH_BATCH];
+} *pagecache_touch_batch;
+
 typedef struct pagecache {
     word total_pages;
     int page_order;
@@ -46,6 +59,16 @@ typedef struct pagecache {
     struct pagelist active;
     struct pagelist writing;
     struct pagelist dirty;     /* phase 2 */
+
+    /* Refault tracking: a page freed by eviction records the eviction clock,
+       and a refault within the number of resident pages is taken as a sign
+       that the list it was evicted from was too small. new_share is the
+       target share of the new list, in units of 1/PAGECACHE_SHARE_SCALE. */
+    u64 eviction_clock;
+    u64 new_share;
+#ifdef KERNEL
+    struct pagecache_touch_batch touch_batches[MAX_CPUS];
+#endif
     struct list volumes;
     struct list shared_maps;
 
@@ -55,8 +78,38 @@ typedef struct pagecache {
     boolean scan_in_progress;
     timer scan_timer;
     closure_struct(pagecache_scan_timer, do_scan_timer);
+#ifdef KERNEL
+    struct list throttled;      /* write completions held back by dirty throttling */
+
+    /* write bandwidth estimate in bytes per second, sampled by the scan timer */
+    u64 write_bw;
+    u64 bw_last_bytes;
+    timestamp bw_last_time;
+
+    tuple mgmt_volumes;
+    u64 mgmt_volume_count;
+#endif
 } *pagecache;
 
+/* Per-volume counters, exported under /pagecache in the management tree.
+   Lookup counters are updated without locking and are approximate. */
+typedef struct pagecache_stats {
+    u64 hits;
+    u64 misses;
+    u64 readahead_hits;         /* first hit on a page filled by read-ahead */
+    u64 evictions_new;
+    u64 evictions_active;
+    u64 refaults;
+    u64 workingset_refaults;
+    u64 reads;                  /* page fills */
+    u64 read_bytes;
+    u64 read_time;
+    u64 writes;
+    u64 write_bytes;
+    u64 write_time;
+    u64 writeback_bytes;        /* dirty shared pages written back */
+} *pagecache_stats;
+
 typedef struct pagecache_volume {
     struct list l;              /* volumes list */
     pagecache pc;
@@ -64,18 +117,23 @@ typedef struct pagecache_volume {
     u64 length;                 /* end of volume */
     int block_order;
     status write_error;         /* pending error from a previous write */
+    struct pagecache_stats stats;
+#ifdef KERNEL
+    symbol mgmt_name;           /* entry under /pagecache/volumes, if registered */
+#endif
 } *pagecache_volume;
 
 typedef struct pagecache_node {
     struct list l;              /* volume-wide node list */
     pagecache_volume pv;
 
-    /* pages_lock covers traversal, insertions and removals - consider
-       changing to a rw lock or semaphore */
+    /* pages_lock covers the page index: lookups and traversal take it
+       shared, insertions take it exclusive; page state is covered by the
+       cache state_lock */
 #ifdef KERNEL
-    struct spinlock pages_lock;
+    struct rw_spinlock pages_lock;
 #endif
-    struct rbtree pages;
+    struct radix_tree pages;    /* page index, keyed by page offset */
     rangemap shared_maps;       /* shared mappings associated with this node */
     u64 length;
 
@@ -84,6 +142,8 @@ typedef struct pagecache_node {
     sg_io fs_read;
     sg_io fs_write;
     pagecache_node_reserve fs_reserve;
+    boolean pinned;             /* unbacked node in use: pages are never evicted */
+    boolean released;           /* unbacked node closed: unpinned once no longer shared-mapped */
 } *pagecache_node;
 
 typedef struct pagecache_shared_map {
@@ -91,6 +151,8 @@ typedef struct pagecache_shared_map {
     struct list l;              /* pc->shared_maps */
     pagecache_node pn;
     u64 node_offset;            /* file offset of va.start */
+    u64 *written;               /* pages made writable since the last scan */
+    u64 written_words;
 } *pagecache_shared_map;
 
 #define PAGECACHE_PAGESTATE_SHIFT   61
@@ -110,22 +172,24 @@ declare_closure_struct(2, 0, void, pagecache_page_free,
                        pagecache, pc, pagecache_page, pp);
 
 struct pagecache_page {
-    struct rbnode rbnode;
-    struct refcount refcount;   /* 24 */
-    u64 state_offset;           /* 40 - state and offset in pages */
-    void *kvirt;                /* 48 */
-    int write_count;            /* 56 */
-    int pad0;                   /* 60 */
+    struct refcount refcount;   /* 0 */
+    u64 state_offset;           /* 16 - state and offset in pages */
+    void *kvirt;                /* 24 */
+    int write_count;            /* 32 */
+    u32 eviction;               /* 36 - eviction clock when last evicted */
+    pagecache_node node;        /* 40 */
+    struct list l;              /* 48 */
     /* end of first cacheline */
 
-    pagecache_node node;
-    struct list l;
     u64 phys;                   /* physical address */
     struct list bh_completions; /* default for non-kernel use */
     struct list rq_completions; /* kernel only */
 
     closure_struct(pagecache_page_free, free);
     boolean evicted;
+    boolean evicted_active;     /* last evicted from the active list */
+    boolean workingset;         /* refaulted within the working set: activate on fill */
+    boolean readahead;          /* filled by read-ahead, not yet hit */
 };
 
 static inline void pagecache_release_page(pagecache_page pp)
@@ -12,6 +12,18 @@
 static vector devices;
 static vector drivers;
 static heap virtual_page;
+static heap pci_heap;
+
+/* MSI-X vectors set up, with the cpu requested by the driver, so that they
+   can be steered again when the set of isolated cpus changes */
+typedef struct pci_msix_target {
+    struct list l;
+    pci_dev dev;
+    int slot;
+    u32 cpu;
+} *pci_msix_target;
+
+static struct list msix_targets;
 
 static u32 pci_bar_len(pci_dev dev, int bar)
 {
@@ -154,14 +166,24 @@ u64 pci_msix_table_slot_addr(pci_dev dev, int msi_slot)
     return pci_msix_table_addr(dev) + (msi_slot * sizeof(u32) * 4);
 }
 
-u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name)
+u64 pci_setup_msix_cpu(pci_dev dev, int msi_slot, thunk h, const char *name, u32 target_cpu)
 {
-    pci_debug("%s: msi %d: %s\n", __func__, msi_slot, name);
+    pci_debug("%s: msi %d: %s, cpu %d\n", __func__, msi_slot, name, target_cpu);
 
+    pci_msix_target t = allocate(pci_heap, sizeof(*t));
+    if (t == INVALID_ADDRESS)
+        return INVALID_PHYSICAL;
     u32 address, data;
-    u64 vector = pci_platform_allocate_msi(dev, h, name, &address, &data);
-    if (vector == INVALID_PHYSICAL)
+    u64 vector = pci_platform_allocate_msi(dev, h, name, housekeeping_cpu(target_cpu),
+                                           &address, &data);
+    if (vector == INVALID_PHYSICAL) {
+        deallocate(pci_heap, t, sizeof(*t));
         return vector;
+    }
+    t->dev = dev;
+    t->slot = msi_slot;
+    t->cpu = target_cpu;
+    list_push_back(&msix_targets, &t->l);
 
     u64 slot_addr = pci_msix_table_slot_addr(dev, msi_slot);
     pci_debug("   vector %d, address 0x%x, data 0x%x, table slot addr 0x%lx\n",
@@ -173,6 +195,11 @@ u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name)
     return vector;
 }
 
+u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name)
+{
+    return pci_setup_msix_cpu(dev, msi_slot, h, name, 0);
+}
+
 void pci_teardown_msix(pci_dev dev, int msi_slot)
 {
     u64 slot_addr = pci_msix_table_slot_addr(dev, msi_slot);
@@ -180,6 +207,35 @@ void pci_teardown_msix(pci_dev dev, int msi_slot)
     pci_debug("%s: table slot addr 0x%lx, msi %d: int %d\n", __func__, slot_addr, msi_slot, v);
     mmio_write_32(slot_addr + (sizeof(u32) * 3), 1); /* set Masked bit to 1 */
     pci_platform_deallocate_msi(dev, v);
+    list_foreach(&msix_targets, l) {
+        pci_msix_target t = struct_from_list(l, pci_msix_target, l);
+        if (t->dev == dev && t->slot == msi_slot) {
+            list_delete(l);
+            deallocate(pci_heap, t, sizeof(*t));
+            break;
+        }
+    }
+}
+
+/* Move MSI-X vectors off isolated cpus, or back to the cpus requested for
+   them, with each table entry masked while it is rewritten. */
+void pci_steer_msix(void)
+{
+    list_foreach(&msix_targets, l) {
+        pci_msix_target t = struct_from_list(l, pci_msix_target, l);
+        u64 slot_addr = pci_msix_table_slot_addr(t->dev, t->slot);
+        u32 address = mmio_read_32(slot_addr);
+        u32 data = mmio_read_32(slot_addr + sizeof(u32) * 2);
+        if (!pci_platform_retarget_msi(t->dev, housekeeping_cpu(t->cpu), &address, &data))
+            continue;
+        u32 ctrl = mmio_read_32(slot_addr + sizeof(u32) * 3);
+        mmio_write_32(slot_addr + (sizeof(u32) * 3), ctrl | 1);
+        mmio_write_32(slot_addr + (sizeof(u32) * 0), address);
+        mmio_write_32(slot_addr + (sizeof(u32) * 2), data);
+        mmio_write_32(slot_addr + (sizeof(u32) * 3), ctrl);
+        pci_debug("%s: slot addr 0x%lx, cpu %d -> address 0x%x, data 0x%x\n", __func__,
+                  slot_addr, t->cpu, address, data);
+    }
 }
 
 void pci_disable_msix(pci_dev dev)
@@ -209,32 +265,16 @@ static int pci_dev_find(pci_dev dev)
     return -1;
 }
 
-static void pci_probe_bus(int bus);
+static void pci_scan_bus(int bus);
 
-static void pci_probe_device(pci_dev dev)
+/* record a device, descending into bridges */
+static void pci_scan_device(pci_dev dev)
 {
     u16 vendor = pci_get_vendor(dev);
     if (vendor == 0xffff)
         return;
     pci_debug("%s: %02x:%02x:%x: %04x:%04x\n",
         __func__, dev->bus, dev->slot, dev->function, vendor, pci_get_device(dev));
-    pci_dev pcid;
-    int dev_index = pci_dev_find(dev);
-    if (dev_index < 0) {
-        pci_dev new_dev = allocate(devices->h, sizeof(*new_dev));
-        if (new_dev == INVALID_ADDRESS) {
-            msg_err("cannot allocate memory for PCI device\n");
-            return;
-        }
-        *new_dev = *dev;
-        new_dev->driver = 0;
-        vector_push(devices, new_dev);
-        pcid = new_dev;
-    } else {
-        pcid = vector_get(devices, dev_index);
-        if (pcid->driver)
-            return;
-    }
 
     // PCI-PCI bridge
     u8 class = pci_get_class(dev);
@@ -244,42 +284,82 @@ static void pci_probe_device(pci_dev dev)
         pci_debug("%s: %02x:%02x:%x: %04x:%04x: class %02x:%02x: secondary bus %02x\n",
             __func__, dev->bus, dev->slot, dev->function, vendor, pci_get_device(dev),
             class, subclass, secbus);
-        pci_probe_bus(secbus);
+        pci_scan_bus(secbus);
         return;
     }
 
-    // probe drivers
+    if (pci_dev_find(dev) >= 0)
+        return;
+    pci_dev new_dev = allocate(devices->h, sizeof(*new_dev));
+    if (new_dev == INVALID_ADDRESS) {
+        msg_err("cannot allocate memory for PCI device\n");
+        return;
+    }
+    *new_dev = *dev;
+    new_dev->driver = 0;
+    new_dev->probe_deferred = false;
+    vector_push(devices, new_dev);
+}
+
+static void pci_probe_drivers(pci_dev dev)
+{
     struct pci_driver *d;
     vector_foreach(drivers, d) {
         pci_debug(" driver %p / %F\n", d, d->probe);
-        if (apply(d->probe, pcid)) {
+        if (apply(d->probe, dev)) {
             pci_debug("  dev %02x:%02x:%x: attached to %F\n", dev->bus, dev->slot, dev->function,
                       d->probe);
-            pcid->driver = d;
+            dev->driver = d;
+            boot_milestone("pci driver attached");
             break;
         }
     }
 }
 
 static void
-pci_probe_bus(int bus)
+pci_scan_bus(int bus)
 {
     pci_debug("%s: probing bus %02x\n", __func__, bus);
     for (int i = 0; i <= PCI_SLOTMAX; i++) {
         struct pci_dev _dev = { .bus = bus, .slot = i, .function = 0 };
         pci_dev dev = &_dev;
-        pci_probe_device(dev);
+        pci_scan_device(dev);
 
         // check multifunction devices
         if (pci_get_hdrtype(dev) & PCIM_MFDEV) {
             for (int f = 1; f <= PCI_FUNCMAX; f++) {
                 dev->function = f;
-                pci_probe_device(dev);
+                pci_scan_device(dev);
             }
         }
     }
 }
 
+/* Storage devices are probed first, as the root volume is behind one of
+   them, followed by the network, display and console devices that must be
+   up before the program starts. Probes of any other devices (memory balloon, ACPI
+   power management...) wait until the program has been started, and then
+   run from the runqueue. */
+#define PCI_PROBE_STORAGE   0
+#define PCI_PROBE_EARLY     1
+#define PCI_PROBE_DEFERRED  2
+
+static boolean probes_deferred = true;
+
+static int pci_probe_order(pci_dev dev)
+{
+    switch (pci_get_class(dev)) {
+    case PCIC_STORAGE:
+        return PCI_PROBE_STORAGE;
+    case PCIC_NETWORK:
+    case PCIC_DISPLAY:
+    case PCIC_SIMPLECOMM:
+        return PCI_PROBE_EARLY;
+    default:
+        return probes_deferred ? PCI_PROBE_DEFERRED : PCI_PROBE_EARLY;
+    }
+}
+
 /*
  * See https://wiki.osdev.org/PCI#Enumerating_PCI_Buses
  */
@@ -291,7 +371,7 @@ void pci_discover()
     if ((pci_get_hdrtype(dev) & PCIM_MFDEV) == 0) {
         pci_debug("%s: single\n", __func__);
         // single PCI host controller
-        pci_probe_bus(0);
+        pci_scan_bus(0);
     } else {
         // multiple PCI host controllers
         for (int f = 1; f < 8; f++) {
@@ -300,7 +380,48 @@ void pci_discover()
             pci_debug("%s: %02x:%02x:%x: %04x:%04x\n",
                  __func__, dev->bus, dev->slot, dev->function, vendor, pci_get_device(dev));
             if (vendor != 0xffff)
-                pci_probe_bus(f);
+                pci_scan_bus(f);
+        }
+    }
+
+    pci_dev d;
+    for (int order = PCI_PROBE_STORAGE; order < PCI_PROBE_DEFERRED; order++) {
+        vector_foreach(devices, d) {
+            if (!d->driver && !d->probe_deferred && pci_probe_order(d) == order)
+                pci_probe_drivers(d);
+        }
+    }
+    vector_foreach(devices, d) {
+        if (!d->driver && pci_probe_order(d) == PCI_PROBE_DEFERRED) {
+            pci_debug("%s: %02x:%02x:%x: probe deferred\n", __func__, d->bus, d->slot, d->function);
+            d->probe_deferred = true;
+        }
+    }
+}
+
+closure_function(1, 0, void, pci_deferred_probe,
+                 pci_dev, dev)
+{
+    pci_dev dev = bound(dev);
+    if (!dev->driver)
+        pci_probe_drivers(dev);
+    closure_finish();
+}
+
+/* called once the program has started */
+void pci_probe_deferred(void)
+{
+    probes_deferred = false;
+    pci_dev d;
+    vector_foreach(devices, d) {
+        if (!d->probe_deferred)
+            continue;
+        d->probe_deferred = false;
+        thunk t = closure(devices->h, pci_deferred_probe, d);
+        if (t == INVALID_ADDRESS || !runqueue_push(t)) {
+            if (t != INVALID_ADDRESS)
+                deallocate_closure(t);
+            pci_probe_drivers(d);
         }
     }
 }
@@ -311,4 +432,6 @@ void init_pci(kernel_heaps kh)
     virtual_page = (heap)heap_virtual_page(kh);
     devices = allocate_vector(heap_general(kh), 8);
     drivers = allocate_vector(heap_general(kh), 8);
+    pci_heap = heap_general(kh);
+    list_init(&msix_targets);
 }
@@ -47,11 +47,15 @@
 #define PCIS_STORAGE_NVM 0x08
 #define PCIPI_STORAGE_NVME  0x02
 
+#define PCIC_NETWORK 0x02
+
 #define PCIC_DISPLAY 0x03
 
 #define PCIC_BRIDGE 0x06
 #define PCIS_BRIDGE_PCI 0x04
 
+#define PCIC_SIMPLECOMM 0x07
+
 typedef struct pci_dev *pci_dev;
 
 typedef closure_type(pci_probe, boolean, pci_dev); // bus slot func
@@ -74,6 +78,7 @@ struct pci_dev {
     int slot;
     int function;
     pci_driver driver;
+    boolean probe_deferred;
     struct pci_bar msix_bar;
 };
 
@@ -140,8 +145,10 @@ static inline u8 pci_get_hdrtype(pci_dev dev)
 
 void pci_bar_init(pci_dev dev, struct pci_bar *b, int bar, bytes offset, bytes length);
 void pci_platform_init_bar(pci_dev dev, int bar);
-u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 *address, u32 *data);
+u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 target_cpu,
+                              u32 *address, u32 *data);
 void pci_platform_deallocate_msi(pci_dev dev, u64 v);
+boolean pci_platform_retarget_msi(pci_dev dev, u32 target_cpu, u32 *address, u32 *data);
 
 u8 pci_bar_read_1(struct pci_bar *b, u64 offset);
 void pci_bar_write_1(struct pci_bar *b, u64 offset, u8 val);
@@ -163,12 +170,15 @@ u32 pci_find_cap(pci_dev dev, u8 cap);
 u32 pci_find_next_cap(pci_dev dev, u8 cap, u32 cp);
 
 void pci_discover();
+void pci_probe_deferred(void);
 void pci_set_bus_master(pci_dev dev);
 int pci_get_msix_count(pci_dev dev);
 int pci_enable_msix(pci_dev dev);
 void pci_enable_io_and_memory(pci_dev dev);
 u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name);
+u64 pci_setup_msix_cpu(pci_dev dev, int msi_slot, thunk h, const char *name, u32 target_cpu);
 void pci_teardown_msix(pci_dev dev, int msi_slot);
+void pci_steer_msix(void);
 void pci_disable_msix(pci_dev dev);
 void pci_setup_non_msi_irq(pci_dev dev, thunk h, const char *name);
 
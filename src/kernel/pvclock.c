@@ -12,6 +12,13 @@ u64 pvclock_now_ns(void)
 
 closure_function(0, 0, timestamp, pvclock_now)
 {
+    /* set by the hypervisor when the VM was paused, including for a
+       snapshot, and left for the guest to clear */
+    if (vclock->flags & PVCLOCK_GUEST_STOPPED) {
+        u8 flags = __sync_fetch_and_and(&vclock->flags, ~PVCLOCK_GUEST_STOPPED);
+        if (flags & PVCLOCK_GUEST_STOPPED)
+            vm_resume_detected();
+    }
     return nanoseconds(pvclock_now_ns());
 }
 
@@ -9,6 +9,8 @@ struct pvclock_vcpu_time_info {
     u8    pad[2];
 } __attribute__((__packed__));
 
+#define PVCLOCK_GUEST_STOPPED   (1 << 1)
+
 struct pvclock_wall_clock {
     u32   version;
     u32   sec;
@@ -24,21 +24,48 @@ int shutdown_vector;
 boolean shutting_down;
 
 queue runqueue;                 /* kernel space from ?*/
-queue bhqueue;                  /* kernel from interrupt */
-timerheap runloop_timers;
+queue bhqueues[BH_PRIO_LEVELS]; /* kernel from interrupt */
+queue bhqueue;
+static queue pollqueue;         /* pollers deferred to the next pass */
+u32 rx_poll_budget = RX_POLL_BUDGET;
 u64 idle_cpu_mask;              /* xxx - limited to 64 aps. consider merging with bitmask */
-timestamp last_timer_update;
+u64 isolated_cpu_mask;          /* cpus reserved for threads pinned to them */
 
 static timestamp runloop_timer_min;
 static timestamp runloop_timer_max;
+static timestamp idle_poll_max;
+static boolean idle_monitor_wait;
+
+static const char *bh_prio_names[BH_PRIO_LEVELS] = {
+    "interrupt", "network", "storage", "background",
+};
+static u32 bh_budget[BH_PRIO_LEVELS] = {
+    BH_BUDGET_INTERRUPT, BH_BUDGET_NETWORK, BH_BUDGET_STORAGE, BH_BUDGET_BACKGROUND,
+};
 
 static struct spinlock kernel_lock;
+static cpuinfo kernel_lock_owner;
+
+boolean (*vcpu_preempted)(cpuinfo ci);
+void (*vcpu_yield_to)(cpuinfo ci);
+timestamp (*vcpu_steal_time)(cpuinfo ci);
 
 void kern_lock()
 {
     cpuinfo ci = current_cpu();
     assert(ci->state != cpu_interrupt);
-    spin_lock(&kernel_lock);
+    if (vcpu_preempted) {
+        /* rather than spin on a holder whose vcpu the hypervisor has
+           descheduled, donate our timeslice to it */
+        while (!spin_try(&kernel_lock)) {
+            cpuinfo owner = kernel_lock_owner;
+            if (owner && vcpu_preempted(owner))
+                vcpu_yield_to(owner);
+        }
+    } else {
+        spin_lock(&kernel_lock);
+    }
+    kernel_lock_owner = ci;
     ci->have_kernel_lock = true;
 }
 
@@ -48,6 +75,7 @@ boolean kern_try_lock()
     assert(ci->state != cpu_interrupt);
     if (!spin_try(&kernel_lock))
         return false;
+    kernel_lock_owner = ci;
     ci->have_kernel_lock = true;
     return true;
 }
@@ -56,17 +84,70 @@ void kern_unlock()
 {
     cpuinfo ci = current_cpu();
     assert(ci->state != cpu_interrupt);
+    /* syscalls dispatched without the lock share the common exit paths;
+       anything else releasing a lock it does not hold is a bug */
+    if (!ci->have_kernel_lock) {
+        assert(ci->lockless_syscall);
+        return;
+    }
     ci->have_kernel_lock = false;
+    kernel_lock_owner = 0;
     spin_unlock(&kernel_lock);
 }
 
 timer kern_register_timer(clock_id id, timestamp val, boolean absolute,
             timestamp interval, timer_handler n)
 {
-    return register_timer(runloop_timers, id, val, absolute, interval, n);
+    return register_timer(current_cpu()->timers, id, val, absolute, interval, n);
 }
 KLIB_EXPORT(kern_register_timer);
 
+/* for timers that may fire up to slack late, e.g. coarse timeouts */
+timer kern_register_timer_slack(clock_id id, timestamp val, boolean absolute,
+                                timestamp interval, timestamp slack, timer_handler n)
+{
+    return register_timer_slack(current_cpu()->timers, id, val, absolute, interval, slack, n);
+}
+KLIB_EXPORT(kern_register_timer_slack);
+
+/* Queue kernel lock work on the current cpu. The cpu that pushed the work
+   runs it first when it next holds the kernel lock; other lock holders
+   steal it once their own queues are drained. Falls back to the global
+   runqueue if the local deque is full. */
+boolean runqueue_push(thunk t)
+{
+    u64 flags = irq_disable_save();
+    boolean r = deque_push(current_cpu()->cpu_queue, t) || enqueue(runqueue, t);
+    irq_restore(flags);
+    return r;
+}
+
+define_closure_function(1, 0, void, poller_run,
+                        poller, p)
+{
+    poller p = bound(p);
+    /* notifications are masked until the handler finds no more work */
+    p->scheduled = false;
+    if (apply(p->handler, rx_poll_budget)) {
+        p->scheduled = true;
+        assert(enqueue(pollqueue, (thunk)&p->run));
+    }
+}
+
+void init_poller(poller p, poll_handler handler)
+{
+    p->handler = handler;
+    p->scheduled = false;
+    init_closure(&p->run, poller_run, p);
+}
+
+/* may be called from interrupt context */
+void poller_schedule(poller p)
+{
+    if (compare_and_swap_32(&p->scheduled, false, true))
+        assert(enqueue(runqueue, (thunk)&p->run));
+}
+
 static void run_thunk(thunk t)
 {
     sched_debug(" run: %F state: %s\n", t, state_strings[current_cpu()->state]);
@@ -76,18 +157,60 @@ static void run_thunk(thunk t)
     //    halt("handler returned %d", cpustate);
 }
 
-/* called with kernel lock held */
-static inline boolean update_timer(void)
+static void run_thunk_timed(thunk t, int hist)
 {
-    timestamp next = timer_check(runloop_timers);
-    if (last_timer_update && next == last_timer_update)
-        return false;
-    s64 delta = next - now(CLOCK_ID_MONOTONIC_RAW);
+    u64 start = rdtsc();
+    run_thunk(t);
+    sched_hist_record(hist, rdtsc() - start);
+}
+
+/* Arm this cpu's platform timer for the earliest expiry on its heap, with
+   slack, unless it is already due to fire by then; timers whose slack
+   windows overlap are thus serviced on one interrupt. Other cpus only touch the heap, under
+   the kernel lock, to reorder it for a clock adjustment, so this may be
+   called without the lock; that way expired timers left unserviced for want
+   of the lock get retried after runloop_timer_min. */
+static inline void update_timer(cpuinfo ci)
+{
+    timestamp next = timer_check(ci->timers);
+    if (next == infinity) {
+        /* no timers pending: leave the platform timer alone */
+        sched_debug("timer heap empty, not arming platform timer\n");
+        return;
+    }
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    s64 delta = next - here;
     timestamp timeout = delta > (s64)runloop_timer_min ? MIN(delta, runloop_timer_max) : runloop_timer_min;
+    if ((s64)(ci->last_timer_update - here) > 0 && ci->last_timer_update <= here + timeout)
+        return;
     sched_debug("set platform timer: delta %lx, timeout %lx\n", delta, timeout);
-    last_timer_update = current_cpu()->last_timer_update = next + timeout - delta;
+    ci->last_timer_update = here + timeout;
     runloop_timer(timeout);
-    return true;
+}
+
+/* Preemption slice for a thread about to run on ci. Zero means no other
+   frame is competing for this cpu, in which case no timer is armed at all;
+   otherwise the maximum slice is divided among the waiting frames, counting
+   those queued on busy cpus that this cpu could steal. */
+static timestamp runloop_slice(cpuinfo ci)
+{
+    u64 local = queue_length(ci->thread_queue);
+    u64 remote = 0, busy = 0;
+    /* an isolated cpu neither steals nor is stolen from */
+    if (cpu_isolated(ci->id))
+        return local ? MAX(runloop_timer_max / (local + 1), runloop_timer_min) : 0;
+    for (int cpu = 0; cpu < total_processors; cpu++) {
+        cpuinfo cpui = cpuinfo_from_id(cpu);
+        if (cpui == ci || ((idle_cpu_mask | isolated_cpu_mask) & U64_FROM_BIT(cpu)))
+            continue;
+        busy++;
+        remote += queue_length(cpui->thread_queue);
+    }
+    /* idle cpus will pick up remote frames before we do */
+    u64 depth = MAX(local, idle_cpu_mask ? 0 : remote / (busy + 1));
+    if (depth == 0)
+        return 0;
+    return MAX(runloop_timer_max / (depth + 1), runloop_timer_min);
 }
 
 static inline void sched_thread_pause(void)
@@ -101,6 +224,58 @@ static inline void sched_thread_pause(void)
     }
 }
 
+/* Before halting, an idle cpu polls for a wakeup with interrupts enabled,
+   flagging itself in idle_polling so that wakeup_cpu() can skip the ipi:
+   a wakeup arriving soon after costs neither an ipi nor a halt exit and
+   re-entry under a hypervisor. As with KVM halt polling, the window adapts
+   to the idle periods seen: it grows while wakeups come after it but within
+   idle_poll_max, and shrinks when the cpu stays idle beyond that. Where
+   MONITOR/MWAIT is available the cpu instead waits on idle_cpu_mask for as
+   long as it stays idle. */
+static void idle_poll_adapt(cpuinfo ci)
+{
+    timestamp idle = now(CLOCK_ID_MONOTONIC_RAW) - ci->idle_start;
+    timestamp poll = ci->idle_poll;
+    ci->idle_start = 0;
+    if (idle <= poll)
+        return;
+    if (idle > idle_poll_max) {
+        poll /= 2;
+        if (poll < microseconds(IDLE_POLL_START_US))
+            poll = 0;
+    } else {
+        poll = poll ? MIN(poll * 2, idle_poll_max) : microseconds(IDLE_POLL_START_US);
+    }
+    sched_debug("idle %T, poll window %T\n", idle, poll);
+    ci->idle_poll = poll;
+}
+
+/* Returns true if woken without an interrupt. */
+NOTRACE static boolean idle_poll(cpuinfo ci)
+{
+    u64 bit = U64_FROM_BIT(ci->id);
+    if (!idle_monitor_wait && !ci->idle_poll)
+        return false;
+    ci->idle_polling = true;
+    memory_barrier();
+    if (idle_monitor_wait) {
+        while (idle_cpu_mask & bit) {
+            disable_interrupts();
+            monitor_wait(&idle_cpu_mask, bit);
+        }
+    } else {
+        timestamp deadline = ci->idle_start + ci->idle_poll;
+        enable_interrupts();
+        while ((*(volatile u64 *)&idle_cpu_mask & bit) &&
+               now(CLOCK_ID_MONOTONIC_RAW) < deadline)
+            kern_pause();
+    }
+    disable_interrupts();
+    ci->idle_polling = false;
+    memory_barrier();
+    return !(idle_cpu_mask & bit);
+}
+
 NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
 {
     // we're going to cover up this race by checking the state in the interrupt
@@ -109,6 +284,14 @@ NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
     sched_debug("sleep\n");
     ci->state = cpu_idle;
     atomic_set_bit(&idle_cpu_mask, ci->id);
+    page_invalidate_idle();
+    if (idle_poll_max && !shutting_down) {
+        ci->idle_start = now(CLOCK_ID_MONOTONIC_RAW);
+        if (idle_poll(ci)) {
+            page_invalidate_wake();
+            runloop();
+        }
+    }
 
     while (1) {
         wait_for_interrupt();
@@ -117,38 +300,124 @@ NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
 
 void wakeup_or_interrupt_cpu_all()
 {
-    cpuinfo ci = current_cpu();
-    for (int i = 0; i < total_processors; i++) {
-        if (i != ci->id) {
-            atomic_clear_bit(&idle_cpu_mask, i);
-            send_ipi(i, wakeup_vector);
-        }
-    }
+    u64 cpus = MASK(total_processors) & ~U64_FROM_BIT(current_cpu()->id);
+    for (u64 m = cpus; m; m &= m - 1)
+        atomic_clear_bit(&idle_cpu_mask, lsb(m));
+    send_ipi_mask(cpus, wakeup_vector);
+}
+
+/* force a kernel entry on a running cpu */
+void interrupt_cpu(u64 cpu)
+{
+    send_ipi(cpu, wakeup_vector);
 }
 
+/* A polling cpu notices the cleared bit by itself; see idle_poll(). */
 static void wakeup_cpu(u64 cpu)
 {
     if (atomic_test_and_clear_bit(&idle_cpu_mask, cpu)) {
+        memory_barrier();
+        if (cpuinfo_from_id(cpu)->idle_polling)
+            return;
         sched_debug("waking up CPU %d\n", cpu);
         send_ipi(cpu, wakeup_vector);
     }
 }
 
-static thunk migrate_to_self(thunk t, u64 cpu_mask)
+/* cpus a thread frame may run on; isolated cpus only take threads whose
+   affinity names nothing else */
+static inline u64 frame_cpu_mask(context f)
+{
+    nanos_thread nt = pointer_from_u64(f[FRAME_THREAD]);
+    u64 mask = nt ? nt->affinity & MASK(total_processors) : 0;
+    if (!mask)
+        mask = MASK(total_processors);
+    return (mask & ~isolated_cpu_mask) ? mask & ~isolated_cpu_mask : mask;
+}
+
+static inline boolean frame_allowed_on(context f, u64 cpu)
+{
+    return (frame_cpu_mask(f) & U64_FROM_BIT(cpu)) != 0;
+}
+
+static int thread_queue_cpu(queue q)
+{
+    for (int cpu = 0; cpu < total_processors; cpu++) {
+        if (cpuinfo_from_id(cpu)->thread_queue == q)
+            return cpu;
+    }
+    return -1;
+}
+
+/* Queue a thread frame on the cpu it last ran on, unless the thread's
+   affinity no longer permits it; in that case an idle permitted cpu is
+   preferred over a busy one. */
+void schedule_frame(context f)
+{
+    assert(f[FRAME_QUEUE] != INVALID_PHYSICAL);
+    queue q = pointer_from_u64(f[FRAME_QUEUE]);
+    u64 mask = frame_cpu_mask(f);
+    int cpu = thread_queue_cpu(q);
+    boolean moved = false;
+    if (cpu < 0 || !(mask & U64_FROM_BIT(cpu))) {
+        u64 idle = mask & idle_cpu_mask;
+        cpu = lsb(idle ? idle : mask);
+        q = cpuinfo_from_id(cpu)->thread_queue;
+        f[FRAME_QUEUE] = u64_from_pointer(q);
+        moved = true;
+        sched_debug("frame %p placed on CPU %d by affinity\n", f, cpu);
+    }
+    assert(enqueue_irqsafe(q, f));
+    if (cpu == current_cpu()->id)
+        return;
+    cpuinfo cpui = cpuinfo_from_id(cpu);
+    if (moved || cpu_isolated(cpu))
+        wakeup_cpu(cpu);
+    else if (cpui->tickless && cpui->state == cpu_user)
+        /* no preemption timer there; kick it to notice the new frame */
+        send_ipi(cpu, wakeup_vector);
+}
+
+/* Take a frame from another cpu's thread queue if the thread may run here;
+   a frame that is pinned elsewhere is put back. */
+static context steal_frame(cpuinfo ci, cpuinfo victim)
+{
+    context f = dequeue(victim->thread_queue);
+    if (f != INVALID_ADDRESS && !frame_allowed_on(f, ci->id)) {
+        assert(enqueue(victim->thread_queue, f));
+        f = INVALID_ADDRESS;
+    }
+    return f;
+}
+
+static context dequeue_own_frame(cpuinfo ci)
+{
+    context f;
+    while ((f = dequeue(ci->thread_queue)) != INVALID_ADDRESS) {
+        if (frame_allowed_on(f, ci->id))
+            break;
+        /* affinity changed after the frame was queued */
+        schedule_frame(f);
+    }
+    return f;
+}
+
+static context migrate_to_self(cpuinfo ci, context f, u64 cpu_mask)
 {
     while (cpu_mask) {
         u64 cpu = lsb(cpu_mask);
         cpuinfo cpui = cpuinfo_from_id(cpu);
-        if (t == INVALID_ADDRESS) {
-            t = dequeue(cpui->thread_queue);
-            if (t != INVALID_ADDRESS)
+        if (f == INVALID_ADDRESS && !cpu_isolated(cpu)) {
+            f = steal_frame(ci, cpui);
+            if (f != INVALID_ADDRESS)
                 sched_debug("migrating thread from idle CPU %d to self\n", cpu);
         }
-        if ((t != INVALID_ADDRESS) && !queue_empty(cpui->thread_queue))
+        /* anything left is either surplus or pinned to that cpu */
+        if (!queue_empty(cpui->thread_queue))
             wakeup_cpu(cpu);
         cpu_mask &= ~U64_FROM_BIT(cpu);
     }
-    return t;
+    return f;
 }
 
 static void migrate_from_self(cpuinfo ci, u64 cpu_mask)
@@ -156,64 +425,222 @@ static void migrate_from_self(cpuinfo ci, u64 cpu_mask)
     while (cpu_mask) {
         u64 cpu = lsb(cpu_mask);
         cpuinfo cpui = cpuinfo_from_id(cpu);
-        thunk t;
+        context f;
         if (!queue_empty(cpui->thread_queue)) {
             wakeup_cpu(cpu);
-        } else if ((t = dequeue(ci->thread_queue)) != INVALID_ADDRESS) {
-            sched_debug("migrating thread from self to idle CPU %d\n", cpu);
-            enqueue(cpui->thread_queue, t);
-            wakeup_cpu(cpu);
+        } else if ((f = dequeue(ci->thread_queue)) != INVALID_ADDRESS) {
+            if (!frame_allowed_on(f, cpu)) {
+                assert(enqueue(ci->thread_queue, f));
+            } else {
+                sched_debug("migrating thread from self to idle CPU %d\n", cpu);
+                f[FRAME_QUEUE] = u64_from_pointer(cpui->thread_queue);
+                enqueue(cpui->thread_queue, f);
+                wakeup_cpu(cpu);
+            }
         }
         cpu_mask &= ~U64_FROM_BIT(cpu);
     }
 }
 
+/* called with kernel lock held */
+static boolean steal_kernel_work(cpuinfo ci)
+{
+    boolean stolen = false;
+    for (u64 cpu = ci->id + 1; ; cpu++) {
+        if (cpu == total_processors)
+            cpu = 0;
+        if (cpu == ci->id)
+            break;
+        deque dq = cpuinfo_from_id(cpu)->cpu_queue;
+        thunk t;
+        while ((t = deque_steal(dq)) != INVALID_ADDRESS) {
+            sched_debug("stealing kernel work from CPU %d\n", cpu);
+            run_thunk_timed(t, SCHED_HIST_RUNQUEUE);
+            stolen = true;
+        }
+    }
+    return stolen;
+}
+
+/* Drain up to budget thunks from q into this cpu's batch, one dequeue_n()
+   reservation per batch, and return true if the budget ran out first. The
+   batch is looked up again after each thunk, as a thunk that suspended on a
+   kernel page fault may be resumed on another cpu. */
+static boolean run_batched(queue q, boolean bh, u32 budget)
+{
+    while (1) {
+        cpuinfo ci = current_cpu();
+        thunk_batch b = bh ? &ci->bh_batch : &ci->rq_batch;
+        if (b->next < b->count) {
+            run_thunk_timed(b->t[b->next++], bh ? SCHED_HIST_BH : SCHED_HIST_RUNQUEUE);
+            continue;
+        }
+        if (budget == 0)
+            return true;
+        b->next = 0;
+        b->q = q;
+        b->count = dequeue_n(q, (void **)b->t, MIN(budget, RUNLOOP_BATCH_SIZE));
+        if (b->count == 0)
+            return false;
+        budget -= b->count;
+    }
+}
+
+/* Visit the bottom half levels in priority order, running each up to its
+   budget, until all are empty; a burst in one level thus holds up the
+   others by at most one budget's worth of work. Bottom halves bound to this
+   cpu go ahead of the shared levels below interrupt. */
+static void run_bhqueues(void)
+{
+    boolean more;
+    if (cpu_isolated(current_cpu()->id)) {
+        /* the shared levels are left to housekeeping cpus */
+        while (run_batched(current_cpu()->bh_queue, true, bh_budget[BH_PRIO_NETWORK]));
+        return;
+    }
+    do {
+        more = run_batched(bhqueues[BH_PRIO_INTERRUPT], true, bh_budget[BH_PRIO_INTERRUPT]);
+        more |= run_batched(current_cpu()->bh_queue, true, bh_budget[BH_PRIO_NETWORK]);
+        for (int prio = BH_PRIO_INTERRUPT + 1; prio < BH_PRIO_LEVELS; prio++)
+            more |= run_batched(bhqueues[prio], true, bh_budget[prio]);
+    } while (more);
+}
+
+/* Queue a bottom half to run on the given cpu, e.g. the cpu a device queue
+   interrupts, so that its state stays in that cpu's cache. Falls back to
+   the shared storage level if the cpu's queue is full. Work meant for an
+   isolated cpu goes to its housekeeping cpu instead. */
+void bhqueue_enqueue_cpu(u64 cpu, thunk t)
+{
+    cpu = housekeeping_cpu(cpu);
+    u64 flags = irq_disable_save();
+    if (!enqueue(cpuinfo_from_id(cpu)->bh_queue, t))
+        assert(enqueue(bhqueue, t));
+    else if (cpu != current_cpu()->id)
+        wakeup_cpu(cpu);
+    irq_restore(flags);
+}
+
+/* Give back the unrun part of a batch, keeping whatever doesn't fit. */
+static void requeue_batch(thunk_batch b)
+{
+    while (b->next < b->count && enqueue(b->q, b->t[b->next]))
+        b->next++;
+    if (b->next == b->count)
+        b->next = b->count = 0;
+}
+
+/* Called when control leaves a thunk without returning to the runloop
+   that claimed it, so that the rest of its batch isn't held up behind it. */
+void runloop_requeue_batches(void)
+{
+    cpuinfo ci = current_cpu();
+    requeue_batch(&ci->bh_batch);
+    requeue_batch(&ci->rq_batch);
+}
+
+/* An isolated cpu leaves shared work to the housekeeping cpus; make sure
+   one of them gets to it soon, even if all are running tickless. */
+static void kick_housekeeping(void)
+{
+    boolean pending = !queue_empty(runqueue);
+    for (int prio = 0; !pending && prio < BH_PRIO_LEVELS; prio++)
+        pending = !queue_empty(bhqueues[prio]);
+    if (!pending)
+        return;
+    u64 idle = idle_cpu_mask & ~isolated_cpu_mask;
+    if (idle) {
+        wakeup_cpu(lsb(idle));
+        return;
+    }
+    u32 cpu = housekeeping_cpu(current_cpu()->id);
+    cpuinfo cpui = cpuinfo_from_id(cpu);
+    if (cpui->tickless && cpui->state == cpu_user)
+        send_ipi(cpu, wakeup_vector);
+}
+
 // should we ever be in the user frame here? i .. guess so?
 NOTRACE void __attribute__((noreturn)) runloop_internal()
 {
     cpuinfo ci = current_cpu();
     thunk t;
-    boolean timer_updated = false;
+    context f;
+    boolean repoll = false;
 
     sched_thread_pause();
     disable_interrupts();
-    sched_debug("runloop from %s b:%d r:%d t:%d i:%x%s\n", state_strings[ci->state],
-                queue_length(bhqueue), queue_length(runqueue), queue_length(ci->thread_queue),
-                idle_cpu_mask, ci->have_kernel_lock ? " locked" : "");
+    sched_debug("runloop from %s b:%d r:%d c:%d t:%d i:%x%s\n", state_strings[ci->state],
+                queue_length(bhqueue), queue_length(runqueue), deque_length(ci->cpu_queue),
+                queue_length(ci->thread_queue), idle_cpu_mask, ci->have_kernel_lock ? " locked" : "");
     ci->state = cpu_kernel;
+    ci->lockless_syscall = false;
+    if (ci->idle_start) {
+        /* interrupted while polling: pair with the check in wakeup_cpu() */
+        ci->idle_polling = false;
+        memory_barrier();
+        idle_poll_adapt(ci);
+    }
     /* Make sure TLB entries are appropriately flushed before doing any work */
     page_invalidate_flush();
 
-    /* bhqueue is for operations outside the realm of the kernel lock,
+    /* a thunk that blocked left the rest of its batch behind; let any cpu
+       holding the kernel lock have it */
+    requeue_batch(&ci->rq_batch);
+
+    /* bottom halves are operations outside the realm of the kernel lock,
        e.g. storage I/O completions */
-    while ((t = dequeue(bhqueue)) != INVALID_ADDRESS)
-        run_thunk(t);
+    run_bhqueues();
 
     if (kern_try_lock()) {
         /* invoke expired timer callbacks */
         ci->state = cpu_kernel;
-        timer_service(runloop_timers, now(CLOCK_ID_MONOTONIC_RAW));
+        timer_service(ci->timers, now(CLOCK_ID_MONOTONIC_RAW));
+
+        if (cpu_isolated(ci->id)) {
+            /* only work pushed from here; the rest is left to others */
+            while ((t = deque_pop(ci->cpu_queue)) != INVALID_ADDRESS)
+                run_thunk_timed(t, SCHED_HIST_RUNQUEUE);
+            kern_unlock();
+            ci = current_cpu();
+            kick_housekeeping();
+            goto unlocked;
+        }
+
+        /* local work first, then the global queue, then whatever other
+           cpus have left behind */
+        do {
+            while ((t = deque_pop(current_cpu()->cpu_queue)) != INVALID_ADDRESS)
+                run_thunk_timed(t, SCHED_HIST_RUNQUEUE);
+            run_batched(runqueue, false, U32_MAX);
+        } while (steal_kernel_work(current_cpu()));
+        ci = current_cpu();
 
-        while ((t = dequeue(runqueue)) != INVALID_ADDRESS)
-            run_thunk(t);
+        /* pollers that used up their budget go again on the next pass */
+        while ((t = dequeue(pollqueue)) != INVALID_ADDRESS) {
+            assert(enqueue(runqueue, t));
+            repoll = true;
+        }
 
         /* should be a list of per-runloop checks - also low-pri background */
         mm_service();
-        timer_updated = update_timer();
         kern_unlock();
     }
+  unlocked:
+    update_timer(ci);
 
     if (!shutting_down) {
-        t = dequeue(ci->thread_queue);
-        if (t == INVALID_ADDRESS) {
+        f = dequeue_own_frame(ci);
+        if (cpu_isolated(ci->id)) {
+            /* no balancing to or from here */
+        } else if (f == INVALID_ADDRESS) {
             if (idle_cpu_mask) {
                 /* Try to steal a thread from an idle CPU (so that it doesn't
                  * have to be woken up), and wake up CPUs that have a non-empty
                  * thread queue). */
-                t = migrate_to_self(t, idle_cpu_mask & ~MASK(ci->id + 1));
-                t = migrate_to_self(t, idle_cpu_mask & MASK(ci->id));
+                f = migrate_to_self(ci, f, idle_cpu_mask & ~MASK(ci->id + 1));
+                f = migrate_to_self(ci, f, idle_cpu_mask & MASK(ci->id));
             }
-            if (t == INVALID_ADDRESS) {
+            if (f == INVALID_ADDRESS) {
                 /* No threads found in idle CPUs: try to steal a thread from a
                  * CPU that is currently running another thread. */
                 for (u64 cpu = ci->id + 1; ; cpu++) {
@@ -222,9 +649,9 @@ NOTRACE void __attribute__((noreturn)) runloop_internal()
                     if (cpu == ci->id)
                         break;
                     cpuinfo cpui = cpuinfo_from_id(cpu);
-                    if (cpui->state == cpu_user) {
-                        t = dequeue(cpui->thread_queue);
-                        if (t != INVALID_ADDRESS) {
+                    if (cpui->state == cpu_user && !cpu_isolated(cpu)) {
+                        f = steal_frame(ci, cpui);
+                        if (f != INVALID_ADDRESS) {
                             sched_debug("migrating thread from CPU %d to self\n", cpu);
                             break;
                         }
@@ -234,27 +661,183 @@ NOTRACE void __attribute__((noreturn)) runloop_internal()
         } else if (idle_cpu_mask) {
             /* Wake up idle CPUs that have a non-empty thread queue, and if our
              * thread queue is non-empty, migrate our threads to idle CPUs. */
-            migrate_from_self(ci, idle_cpu_mask & ~MASK(ci->id + 1));
-            migrate_from_self(ci, idle_cpu_mask & MASK(ci->id));
+            u64 idle = idle_cpu_mask & ~isolated_cpu_mask;
+            migrate_from_self(ci, idle & ~MASK(ci->id + 1));
+            migrate_from_self(ci, idle & MASK(ci->id));
         }
-        if (t != INVALID_ADDRESS) {
-            if (!timer_updated && (total_processors > 1)) {
+        if (f != INVALID_ADDRESS) {
+            timestamp slice = runloop_slice(ci);
+            /* come back soon for pending polls */
+            if (repoll)
+                slice = slice ? MIN(slice, runloop_timer_min) : runloop_timer_min;
+            ci->tickless = slice == 0;
+            if (slice) {
                 timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
                 s64 timeout = ci->last_timer_update - here;
-                if ((timeout < 0) || (timeout > runloop_timer_max)) {
-                    sched_debug("setting CPU scheduler timer\n");
-                    runloop_timer(runloop_timer_max);
-                    ci->last_timer_update = here + runloop_timer_max;
+                if ((timeout < 0) || (timeout > slice)) {
+                    sched_debug("setting CPU scheduler timer, slice %T\n", slice);
+                    runloop_timer(slice);
+                    ci->last_timer_update = here + slice;
                 }
             }
-            run_thunk(t);
+            run_thunk(pointer_from_u64(f[FRAME_RUN]));
         }
     }
 
     sched_thread_pause();
+    /* nothing else to do: run the pending polls right away */
+    if (repoll)
+        send_ipi(ci->id, wakeup_vector);
+    else if (!shutting_down)
+        zero_pool_refill();
     kernel_sleep();
 }    
 
+/* e.g. idle_poll:50, the maximum poll-before-halt window in microseconds;
+   0 disables idle polling */
+void config_idle_poll(tuple root)
+{
+    value v = get(root, sym(idle_poll));
+    if (v) {
+        u64 us;
+        if (is_tuple(v) || !u64_from_value(v, &us) || us > RUNLOOP_TIMER_MIN_PERIOD_US) {
+            msg_err("invalid idle_poll\n");
+            return;
+        }
+        idle_poll_max = microseconds(us);
+    }
+    idle_monitor_wait = idle_poll_max && monitor_wait_available();
+}
+
+/* The cpu that takes interrupts and bound bottom halves meant for the
+   given cpu: the cpu itself unless it is isolated, else one of the
+   housekeeping cpus, spread by cpu number. */
+u32 housekeeping_cpu(u32 cpu)
+{
+    if (cpu >= total_processors || !cpu_isolated(cpu))
+        return cpu;
+    u64 hk = MASK(total_processors) & ~isolated_cpu_mask;
+    for (int n = cpu % __builtin_popcountll(hk); n > 0; n--)
+        hk &= hk - 1;
+    return lsb(hk);
+}
+
+/* e.g. isolcpus:1-3,5, the cpus to reserve for threads whose affinity is
+   confined to them: no other threads, shared kernel work or device
+   interrupts are placed there. The boot cpu can't be isolated. Returns
+   true if any cpu was isolated. */
+boolean config_isolcpus(tuple root)
+{
+    string s = get_string(root, sym(isolcpus));
+    if (!s)
+        return false;
+    buffer b = alloca_wrap(s);
+    u64 mask = 0;
+    while (buffer_length(b)) {
+        u64 first, last;
+        if (!parse_int(b, 10, &first))
+            goto fail;
+        last = first;
+        if (buffer_length(b) && peek_char(b) == '-') {
+            pop_u8(b);
+            if (!parse_int(b, 10, &last) || last < first)
+                goto fail;
+        }
+        if (first == 0 || last >= total_processors)
+            goto fail;
+        mask |= MASK(last + 1) & ~MASK(first);
+        if (buffer_length(b) && pop_u8(b) != ',')
+            goto fail;
+    }
+    isolated_cpu_mask = mask;
+    return mask != 0;
+  fail:
+    msg_err("invalid isolcpus \"%b\"\n", s);
+    return false;
+}
+
+/* e.g. bh_budget:(network:128 background:4) rx_poll_budget:128 */
+void config_bhqueues(tuple root)
+{
+    value v = get(root, sym(rx_poll_budget));
+    if (v) {
+        u64 budget;
+        if (is_tuple(v) || !u64_from_value(v, &budget) || budget == 0 || budget > U32_MAX)
+            msg_err("invalid rx_poll_budget\n");
+        else
+            rx_poll_budget = budget;
+    }
+    tuple budgets = get_tuple(root, sym(bh_budget));
+    if (!budgets)
+        return;
+    for (int prio = 0; prio < BH_PRIO_LEVELS; prio++) {
+        value v = get(budgets, sym_this(bh_prio_names[prio]));
+        if (!v)
+            continue;
+        u64 budget;
+        if (is_tuple(v) || !u64_from_value(v, &budget) || budget == 0 || budget > U32_MAX) {
+            msg_err("invalid %s bottom half budget\n", bh_prio_names[prio]);
+            continue;
+        }
+        bh_budget[prio] = budget;
+    }
+}
+
+static const char *sched_hist_names[SCHED_HIST_COUNT] = {
+    "wakeup_latency", "bh_runtime", "runqueue_runtime",
+};
+
+closure_function(2, 0, value, sched_steal_time_get,
+                 cpuinfo, ci, value, v)
+{
+    buffer b = (buffer)bound(v);
+    buffer_clear(b);
+    bprintf(b, "%ld", nsec_from_timestamp(vcpu_steal_time(bound(ci))));
+    return b;
+}
+
+closure_function(0, 1, boolean, sched_hist_reset,
+                 value, v)
+{
+    for (int i = 0; i < total_processors; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        zero(ci->sched_hist, sizeof(ci->sched_hist));
+    }
+    return false;               /* nothing to store */
+}
+
+/* /sched/<cpu>/<histogram>, and /sched/<cpu>/steal_time in ns if the
+   hypervisor reports it; setting /sched/reset clears the histograms */
+void init_sched_stats_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    tuple sched = allocate_tuple();
+    assert(sched);
+    tuple_notifier sn = tuple_notifier_wrap(sched);
+    assert(sn != INVALID_ADDRESS);
+    for (int cpu = 0; cpu < total_processors; cpu++) {
+        tuple t = allocate_tuple();
+        assert(t);
+        tuple_notifier n = tuple_notifier_wrap(t);
+        assert(n != INVALID_ADDRESS);
+        for (int hist = 0; hist < SCHED_HIST_COUNT; hist++)
+            log2_hist_register(n, t, sym_this(sched_hist_names[hist]),
+                               cpuinfo_from_id(cpu)->sched_hist[hist]);
+        if (vcpu_steal_time) {
+            value v = allocate_buffer(h, 24);
+            assert(v != INVALID_ADDRESS);
+            set(t, sym(steal_time), v);
+            tuple_notifier_register_get_notify(n, sym(steal_time),
+                                               closure(h, sched_steal_time_get,
+                                                       cpuinfo_from_id(cpu), v));
+        }
+        set(sched, intern_u64(cpu), n);
+    }
+    tuple_notifier_register_set_notify(sn, sym(reset), closure(h, sched_hist_reset));
+    set(sched, sym(no_encode), null_value);
+    set(root, sym(sched), sn);
+}
+
 closure_function(0, 0, void, global_shutdown)
 {
     machine_halt();
@@ -263,8 +846,10 @@ closure_function(0, 0, void, global_shutdown)
 void init_scheduler(heap h)
 {
     spin_lock_init(&kernel_lock);
+    lock_stats_register(&kernel_lock, "kernel");
     runloop_timer_min = microseconds(RUNLOOP_TIMER_MIN_PERIOD_US);
     runloop_timer_max = microseconds(RUNLOOP_TIMER_MAX_PERIOD_US);
+    idle_poll_max = microseconds(IDLE_POLL_MAX_US);
     wakeup_vector = allocate_ipi_interrupt();
 
     register_interrupt(wakeup_vector, ignore, "wakeup ipi");
@@ -273,8 +858,19 @@ void init_scheduler(heap h)
     assert(wakeup_vector != INVALID_PHYSICAL);
     /* scheduling queues init */
     runqueue = allocate_queue(h, 2048);
-    bhqueue = allocate_queue(h, 2048);
-    runloop_timers = allocate_timerheap(h, "runloop");
-    assert(runloop_timers != INVALID_ADDRESS);
+    pollqueue = allocate_queue(h, 256);
+    assert(pollqueue != INVALID_ADDRESS);
+    for (int prio = 0; prio < BH_PRIO_LEVELS; prio++) {
+        bhqueues[prio] = allocate_queue(h, 2048);
+        assert(bhqueues[prio] != INVALID_ADDRESS);
+    }
+    bhqueue = bhqueues[BH_PRIO_STORAGE];
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        ci->timers = allocate_timerheap(h, "runloop");
+        assert(ci->timers != INVALID_ADDRESS);
+        ci->bh_queue = allocate_queue(h, CPU_BHQUEUE_SIZE);
+        assert(ci->bh_queue != INVALID_ADDRESS);
+    }
     shutting_down = false;
 }
@@ -3,6 +3,7 @@
 #include <tfs.h>
 #include <unix.h>
 #include <net.h>
+#include <pci.h>
 #include <http.h>
 #include <gdb.h>
 #include <storage.h>
@@ -10,42 +11,18 @@
 #include <virtio/virtio.h>
 
 closure_function(2, 0, void, program_start,
-                 buffer, elf, process, kp)
+                 tuple, program, process, kp)
 {
-    exec_elf(bound(elf), bound(kp));
+    exec_program(bound(kp), bound(program));
+    pci_probe_deferred();
     closure_finish();
 }
 
-closure_function(3, 1, status, read_program_complete,
-                 heap, h, process, kp, tuple, root,
-                 buffer, b)
+closure_function(1, 0, void, storage_ready,
+                 thunk, start)
 {
-    tuple root = bound(root);
-    if (get(root, sym(trace))) {
-        rprintf("read program complete: %p ", root);
-        rprintf("gitversion: %s ", gitversion);
-
-        /* XXX - disable this until we can be assured that print_root
-           won't go haywire on a large manifest... */
-#if 0
-        buffer b = allocate_buffer(transient, 64);
-        print_tuple(b, root, 0);
-        buffer_print(b);
-        deallocate_buffer(b);
-        rprintf("\n");
-#endif
-       
-    }
-    storage_when_ready(closure(bound(h), program_start, b, bound(kp)));
+    net_when_ready(bound(start));
     closure_finish();
-    return STATUS_OK;
-}
-
-closure_function(0, 1, void, read_program_fail,
-                 status, s)
-{
-    closure_finish();
-    halt("read program failed %v\n", s);
 }
 
 /* http debug test */
@@ -120,11 +97,24 @@ closure_function(3, 0, void, startup,
 	halt("unable to initialize unix instance; halt\n");
     }
     heap general = heap_general(kh);
-    buffer_handler pg = closure(general, read_program_complete, general, kp, root);
 
     /* register root tuple with management and kick off interfaces, if any */
     init_management_root(root);
     init_kernel_heaps_management(root);
+    boot_milestone("management initialized");
+    init_boot_timing_management(root);
+    init_sched_stats_management(root);
+    init_interrupt_stats_management(root);
+    init_alloc_profile_management(root);
+    init_cpu_profile_management(root);
+    init_pagecache_management(root);
+    init_storage_management(root);
+    init_net_management(root);
+    init_filesystem_log_management(fs, root);
+#ifdef LOCK_STATS
+    init_lock_stats_management(root);
+#endif
+    init_metrics(root);
 #if 0
     http_listener hl = allocate_http_listener(general, 9090);
     assert(hl != INVALID_ADDRESS);
@@ -143,7 +133,13 @@ closure_function(3, 0, void, startup,
     if (get(root, sym(exec_protection)))
         set(pro, sym(exec), null_value);  /* set executable flag */
     init_network_iface(root);
-    filesystem_read_entire(fs, pro, heap_backed(kh), pg, closure(general, read_program_fail));
+    boot_milestone("network interfaces configured");
+    if (get(root, sym(trace))) {
+        rprintf("program: %p ", pro);
+        rprintf("gitversion: %s\n", gitversion);
+    }
+    thunk start = closure(general, program_start, pro, kp);
+    storage_when_ready(closure(general, storage_ready, start));
     closure_finish();
 }
 
@@ -9,6 +9,8 @@ typedef struct volume {
     u8 uuid[UUID_LEN];
     char label[VOLUME_LABEL_MAX_LEN];
     block_io r, w;
+    storage_ops ops;
+    storage_stats stats;
     u64 size;
     boolean mounting;
     filesystem fs;
@@ -18,6 +20,8 @@ typedef struct volume {
 static struct {
     heap h;
     filesystem root_fs;
+    storage_stats root_stats;
+    tuple mgmt;
     struct list volumes;
     tuple mounts;
     thunk mount_complete;
@@ -36,6 +40,445 @@ static struct {
 #define storage_lock()      u64 _irqflags = spin_lock_irq(&storage.lock)
 #define storage_unlock()    spin_unlock_irq(&storage.lock, _irqflags)
 
+/* Block I/O request queue (bioq)
+
+   A bioq sits between a filesystem and a driver's block_io. Requests are
+   plugged until the storage bottom half runs, so that a burst of
+   submissions (pagecache writeback, readahead) can be merged into larger
+   device requests. Two requests merge when both their block ranges and
+   their buffers, virtually and physically, are adjacent, up to max_blocks.
+   At most max_depth (merged) requests are in flight to the device; the
+   rest stay queued and can still absorb new submissions.
+
+   If a merged request fails, its constituent requests are resubmitted
+   one by one so that each completion gets its own status. */
+
+#define BIOQ_MAX_DEPTH      128
+#define BIOQ_PLUG_MAX       64  /* unplug right away past this many pending requests */
+
+typedef struct bioq *bioq;
+
+declare_closure_struct(2, 1, void, bioq_req_complete,
+                       bioq, q, struct bioq_req *, req,
+                       status, s);
+
+typedef struct bioq_req {
+    struct list l;              /* pending list, or chain of merged requests */
+    struct list merged;         /* requests merged into this one */
+    void *buf;                  /* as submitted */
+    range blocks;
+    void *xbuf;                 /* extent including merged requests */
+    range xblocks;
+    u64 start;                  /* cycle count at dispatch */
+    status_handler sh;
+    boolean nomerge;
+    closure_struct(bioq_req_complete, complete);
+} *bioq_req;
+
+declare_closure_struct(1, 0, void, bioq_unplug,
+                       bioq, q);
+declare_closure_struct(1, 3, void, bioq_submit,
+                       bioq, q,
+                       void *, buf, range, blocks, status_handler, sh);
+
+struct bioq {
+    heap h;
+    block_io io;
+    u64 max_blocks;
+    storage_stats stats;
+    int op;
+    struct list pending;
+    u64 npending;
+    u64 inflight;
+    u64 max_depth;
+    boolean plugged;
+    struct spinlock lock;
+    closure_struct(bioq_unplug, unplug);
+    closure_struct(bioq_submit, submit);
+};
+
+#define bioq_lock(q)      u64 _irqflags = spin_lock_irq(&(q)->lock)
+#define bioq_unlock(q)    spin_unlock_irq(&(q)->lock, _irqflags)
+
+/* true if the extent of b can be appended to that of a */
+static boolean bioq_adjacent(bioq_req a, bioq_req b)
+{
+    if (a->xblocks.end != b->xblocks.start)
+        return false;
+    void *end = a->xbuf + (range_span(a->xblocks) << SECTOR_OFFSET);
+    return (end == b->xbuf) &&
+        (physical_from_virtual(end - 1) + 1 == physical_from_virtual(b->xbuf));
+}
+
+/* called with lock held */
+static boolean bioq_merge(bioq q, bioq_req r)
+{
+    list_foreach(&q->pending, e) {
+        bioq_req p = struct_from_list(e, bioq_req, l);
+        if (p->nomerge || range_span(p->xblocks) + range_span(r->xblocks) > q->max_blocks)
+            continue;
+        if (bioq_adjacent(p, r)) {
+            p->xblocks.end = r->xblocks.end;
+        } else if (bioq_adjacent(r, p)) {
+            p->xblocks.start = r->xblocks.start;
+            p->xbuf = r->xbuf;
+        } else {
+            continue;
+        }
+        storage_debug("bioq %p: merged %R into %R", q, r->blocks, p->xblocks);
+        list_push_back(&p->merged, &r->l);
+        return true;
+    }
+    return false;
+}
+
+static void bioq_dispatch(bioq q);
+
+static void bioq_queue(bioq q, bioq_req r)
+{
+    boolean unplug = false, schedule = false;
+    bioq_lock(q);
+    if (r->nomerge || !bioq_merge(q, r)) {
+        list_push_back(&q->pending, &r->l);
+        q->npending++;
+    }
+    if (q->npending >= BIOQ_PLUG_MAX) {
+        unplug = true;
+    } else if (!q->plugged) {
+        q->plugged = schedule = true;
+    }
+    bioq_unlock(q);
+    if (unplug)
+        bioq_dispatch(q);
+    else if (schedule)
+        bhqueue_enqueue_irqsafe((thunk)&q->unplug);
+}
+
+static void bioq_req_free(bioq q, bioq_req r)
+{
+    deallocate(q->h, r, sizeof(*r));
+}
+
+define_closure_function(2, 1, void, bioq_req_complete,
+                        bioq, q, bioq_req, req,
+                        status, s)
+{
+    bioq q = bound(q);
+    bioq_req r = bound(req);
+    storage_debug("bioq %p: complete %R, status %v", q, r->xblocks, s);
+    tracepoint(block_complete, q->op, r->xblocks.start, range_span(r->xblocks));
+    if (q->stats)
+        storage_stats_record(q->stats, q->op, range_span(r->xblocks) << SECTOR_OFFSET, r->start);
+    bioq_lock(q);
+    q->inflight--;
+    bioq_unlock(q);
+    if (!list_empty(&r->merged)) {
+        if (is_ok(s)) {
+            list_foreach(&r->merged, e) {
+                bioq_req m = struct_from_list(e, bioq_req, l);
+                list_delete(e);
+                apply(m->sh, STATUS_OK);
+                bioq_req_free(q, m);
+            }
+        } else {
+            /* retry each original request on its own */
+            timm_dealloc(s);
+            list_foreach(&r->merged, e) {
+                bioq_req m = struct_from_list(e, bioq_req, l);
+                list_delete(e);
+                m->nomerge = true;
+                bioq_queue(q, m);
+            }
+            r->xbuf = r->buf;
+            r->xblocks = r->blocks;
+            r->nomerge = true;
+            bioq_queue(q, r);
+            return;
+        }
+    }
+    apply(r->sh, s);
+    bioq_req_free(q, r);
+    bioq_dispatch(q);
+}
+
+static void bioq_dispatch(bioq q)
+{
+    struct list l;
+    list_init(&l);
+    bioq_lock(q);
+    q->plugged = false;
+    while (q->inflight < q->max_depth && !list_empty(&q->pending)) {
+        list e = list_get_next(&q->pending);
+        list_delete(e);
+        list_push_back(&l, e);
+        q->npending--;
+        q->inflight++;
+    }
+    bioq_unlock(q);
+    list_foreach(&l, e) {
+        bioq_req r = struct_from_list(e, bioq_req, l);
+        list_delete(e);
+        storage_debug("bioq %p: dispatch %R", q, r->xblocks);
+        tracepoint(block_submit, q->op, r->xblocks.start, range_span(r->xblocks));
+        if (q->stats) {
+            fetch_and_add(&q->stats->inflight, 1);
+            r->start = rdtsc();
+        }
+        apply(q->io, r->xbuf, r->xblocks,
+              init_closure(&r->complete, bioq_req_complete, q, r));
+    }
+}
+
+define_closure_function(1, 0, void, bioq_unplug,
+                        bioq, q)
+{
+    bioq_dispatch(bound(q));
+}
+
+define_closure_function(1, 3, void, bioq_submit,
+                        bioq, q,
+                        void *, buf, range, blocks, status_handler, sh)
+{
+    bioq q = bound(q);
+    bioq_req r = allocate(q->h, sizeof(*r));
+    if (r == INVALID_ADDRESS) {
+        apply(sh, timm("result", "cannot allocate block request"));
+        return;
+    }
+    list_init(&r->merged);
+    r->xbuf = r->buf = buf;
+    r->xblocks = r->blocks = blocks;
+    r->sh = sh;
+    r->nomerge = range_span(blocks) >= q->max_blocks;
+    bioq_queue(q, r);
+}
+
+/* If st is non-zero, device requests are accounted to it as op. */
+block_io storage_bioq(heap h, block_io io, u64 max_blocks, storage_stats st, int op)
+{
+    bioq q = allocate(h, sizeof(*q));
+    if (q == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    q->h = h;
+    q->io = io;
+    q->max_blocks = max_blocks;
+    q->stats = st;
+    q->op = op;
+    list_init(&q->pending);
+    q->npending = 0;
+    q->inflight = 0;
+    q->max_depth = BIOQ_MAX_DEPTH;
+    q->plugged = false;
+    spin_lock_init(&q->lock);
+    init_closure(&q->unplug, bioq_unplug, q);
+    return init_closure(&q->submit, bioq_submit, q);
+}
+
+/* Device cache flush queue (flushq)
+
+   A flush covers the writes completed before it is issued, so a caller
+   arriving while one is in flight cannot join it. Such callers are gathered
+   into the next flush, issued as soon as the one in flight completes: there
+   is at most one flush outstanding per device however many callers are
+   waiting for durability. */
+
+typedef struct flushq *flushq;
+
+typedef struct flushq_waiter {
+    struct list l;
+    status_handler sh;
+} *flushq_waiter;
+
+declare_closure_struct(1, 1, void, flushq_complete,
+                       flushq, q,
+                       status, s);
+declare_closure_struct(1, 1, void, flushq_submit,
+                       flushq, q,
+                       status_handler, sh);
+
+struct flushq {
+    heap h;
+    block_flush flush;
+    storage_stats stats;
+    struct list waiting;        /* for the next flush */
+    struct list issued;         /* completed by the flush in flight */
+    boolean busy;
+    u64 start;                  /* cycle count at issue */
+    struct spinlock lock;
+    closure_struct(flushq_complete, complete);
+    closure_struct(flushq_submit, submit);
+};
+
+/* called with lock held and the queue idle */
+static boolean flushq_start(flushq q)
+{
+    if (list_empty(&q->waiting))
+        return false;
+    list_move(&q->issued, &q->waiting);
+    q->busy = true;
+    return true;
+}
+
+static void flushq_issue(flushq q)
+{
+    storage_debug("flushq %p: issue", q);
+    tracepoint(block_submit, STORAGE_OP_FLUSH, 0, 0);
+    if (q->stats) {
+        fetch_and_add(&q->stats->inflight, 1);
+        q->start = rdtsc();
+    }
+    apply(q->flush, (status_handler)&q->complete);
+}
+
+define_closure_function(1, 1, void, flushq_complete,
+                        flushq, q,
+                        status, s)
+{
+    flushq q = bound(q);
+    storage_debug("flushq %p: complete, status %v", q, s);
+    tracepoint(block_complete, STORAGE_OP_FLUSH, 0, 0);
+    if (q->stats)
+        storage_stats_record(q->stats, STORAGE_OP_FLUSH, 0, q->start);
+    struct list l;
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list_move(&l, &q->issued);
+    q->busy = false;
+    boolean next = flushq_start(q);
+    spin_unlock_irq(&q->lock, irqflags);
+    if (next)
+        flushq_issue(q);
+    list_foreach(&l, e) {
+        flushq_waiter w = struct_from_list(e, flushq_waiter, l);
+        list_delete(e);
+        apply(w->sh, s);
+        deallocate(q->h, w, sizeof(*w));
+    }
+}
+
+define_closure_function(1, 1, void, flushq_submit,
+                        flushq, q,
+                        status_handler, sh)
+{
+    flushq q = bound(q);
+    flushq_waiter w = allocate(q->h, sizeof(*w));
+    if (w == INVALID_ADDRESS) {
+        apply(sh, timm("result", "cannot allocate flush request"));
+        return;
+    }
+    w->sh = sh;
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list_push_back(&q->waiting, &w->l);
+    boolean issue = !q->busy && flushq_start(q);
+    spin_unlock_irq(&q->lock, irqflags);
+    if (issue)
+        flushq_issue(q);
+}
+
+/* If st is non-zero, device flushes are accounted to it. */
+block_flush storage_flushq(heap h, block_flush flush, storage_stats st)
+{
+    flushq q = allocate(h, sizeof(*q));
+    if (q == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    q->h = h;
+    q->flush = flush;
+    q->stats = st;
+    list_init(&q->waiting);
+    list_init(&q->issued);
+    q->busy = false;
+    spin_lock_init(&q->lock);
+    init_closure(&q->complete, flushq_complete, q);
+    return init_closure(&q->submit, flushq_submit, q);
+}
+
+storage_stats allocate_storage_stats(heap h)
+{
+    storage_stats st = allocate_zero(h, sizeof(*st));
+    return (st == INVALID_ADDRESS) ? 0 : st;
+}
+
+/* Account a completed device request issued at cycle count start. Updates
+   are atomic, as requests of a volume complete on any cpu. */
+void storage_stats_record(storage_stats st, int op, u64 bytes, u64 start)
+{
+    log2_hist_record_atomic(st->latency[op], rdtsc() - start);
+    fetch_and_add(&st->ops[op], 1);
+    fetch_and_add(&st->bytes[op], bytes);
+    fetch_and_add(&st->inflight, -1ull);
+}
+
+static const char *storage_op_names[STORAGE_OP_COUNT] = {
+    "read", "write", "flush",
+};
+
+closure_function(2, 0, value, storage_get_stat,
+                 u64 *, p, value, v)
+{
+    return value_rewrite_u64(bound(v), *bound(p));
+}
+
+static void storage_register_stat(heap h, tuple_notifier n, tuple t, symbol a, u64 *p)
+{
+    value v = value_from_u64(h, 0);
+    assert(v != INVALID_ADDRESS);
+    set(t, a, v);
+    tuple_notifier_register_get_notify(n, a, closure(h, storage_get_stat, p, v));
+}
+
+static tuple_notifier storage_stats_tuple(heap h, storage_stats st)
+{
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    buffer name = little_stack_buffer(32);
+    for (int op = 0; op < STORAGE_OP_COUNT; op++) {
+        buffer_clear(name);
+        bprintf(name, "%ss", storage_op_names[op]);
+        storage_register_stat(h, n, t, intern(name), &st->ops[op]);
+        if (op != STORAGE_OP_FLUSH) {
+            buffer_clear(name);
+            bprintf(name, "%s_bytes", storage_op_names[op]);
+            storage_register_stat(h, n, t, intern(name), &st->bytes[op]);
+        }
+        buffer_clear(name);
+        bprintf(name, "%s_latency", storage_op_names[op]);
+        log2_hist_register(n, t, intern(name), st->latency[op]);
+    }
+    storage_register_stat(h, n, t, sym(inflight), &st->inflight);
+    return n;
+}
+
+/* called with storage lock held */
+static void storage_register_volume_management(volume v)
+{
+    if (!v->stats)
+        return;
+    buffer name = little_stack_buffer(VOLUME_LABEL_MAX_LEN + 2 * UUID_LEN + 8);
+    if (v->label[0])
+        bprintf(name, "%s", v->label);
+    else
+        print_uuid(name, v->uuid);
+    set(storage.mgmt, intern(name), storage_stats_tuple(storage.h, v->stats));
+}
+
+/* /storage/<volume>: per-volume device request counts, bytes and latency
+   histograms, and the number of requests in flight; the root volume is
+   /storage/root */
+void init_storage_management(tuple root)
+{
+    storage.mgmt = allocate_tuple();
+    assert(storage.mgmt);
+    storage_lock();
+    if (storage.root_stats)
+        set(storage.mgmt, sym(root), storage_stats_tuple(storage.h, storage.root_stats));
+    list_foreach(&storage.volumes, e)
+        storage_register_volume_management(struct_from_list(e, volume, l));
+    storage_unlock();
+    set(storage.mgmt, sym(no_encode), null_value);
+    set(root, sym(storage), storage.mgmt);
+}
+
 /* Called with mutex locked. */
 // XXX this won't work with wrapped root...
 static volume storage_get_volume(tuple root)
@@ -66,8 +509,10 @@ static void storage_check_if_ready(void)
         storage.mount_complete = 0;
     }
     storage_unlock();
-    if (complete)
+    if (complete) {
+        boot_milestone("storage ready");
         apply(complete);
+    }
 }
 
 static boolean volume_match(symbol s, volume v)
@@ -98,6 +543,7 @@ closure_function(2, 2, void, volume_link,
         set(mount, sym(root), volume_root);
         set(mount, sym(no_encode), null_value); /* non-persistent entry */
         set(mount_dir, sym(mount), mount);
+        filesystem_set_storage_ops(fs, v->ops);
         v->fs = fs;
         v->mount_dir = mount_dir;
         storage_debug("volume mounted, mount directory %p, root %p", mount_dir,
@@ -138,14 +584,17 @@ void init_volumes(heap h)
     storage.h = h;
     list_init(&storage.volumes);
     storage.root_fs = 0;
+    storage.root_stats = 0;
+    storage.mgmt = 0;
     storage.mounts = 0;
     storage.mount_complete = 0;
     spin_lock_init(&storage.lock);
 }
 
-void storage_set_root_fs(filesystem root_fs)
+void storage_set_root_fs(filesystem root_fs, storage_stats st)
 {
     storage.root_fs = root_fs;
+    storage.root_stats = st;
 }
 
 closure_function(0, 2, boolean, storage_set_mountpoints_each,
@@ -184,7 +633,8 @@ closure_function(1, 2, boolean, volume_add_mount_each,
     return true;
 }
 
-boolean volume_add(u8 *uuid, char *label, block_io r, block_io w, u64 size)
+boolean volume_add(u8 *uuid, char *label, block_io r, block_io w, storage_ops ops,
+                   storage_stats st, u64 size)
 {
     storage_debug("new volume (%ld bytes)", size);
     volume v = allocate(storage.h, sizeof(*v));
@@ -194,12 +644,16 @@ boolean volume_add(u8 *uuid, char *label, block_io r, block_io w, u64 size)
     runtime_memcpy(v->label, label, VOLUME_LABEL_MAX_LEN);
     v->r = r;
     v->w = w;
+    v->ops = ops;
+    v->stats = st;
     v->size = size;
     v->mounting = false;
     v->fs = 0;
     v->mount_dir = 0;
     storage_lock();
     list_push_back(&storage.volumes, &v->l);
+    if (storage.mgmt)
+        storage_register_volume_management(v);
     if (storage.mounts)
         iterate(storage.mounts, stack_closure(volume_add_mount_each, v));
     storage_unlock();
@@ -258,12 +712,12 @@ tuple storage_get_mountpoint(tuple root)
 
 void storage_iterate(volume_handler vh)
 {
-    apply(vh, 0, "root", storage.root_fs);
+    apply(vh, 0, "root", storage.root_fs, storage.root_stats);
     storage_lock();
     list_foreach(&storage.volumes, e) {
         volume v = struct_from_list(e, volume, l);
         if (v->fs)
-            apply(vh, v->uuid, v->label, v->fs);
+            apply(vh, v->uuid, v->label, v->fs, v->stats);
     }
     storage_unlock();
 }
@@ -1,82 +1,174 @@
 #include <kernel.h>
 #include <elf64.h>
 
-/* really this should be an instance... */
-static heap general;
-static rangemap elf_symtable;
-
-typedef struct elfsym {
-    struct rmnode node;
-    char * name;
-} *elfsym;
+/* Symbol tables are kept in their packed ELF form: add_elf_syms() copies
+   only the .symtab and .strtab sections of an image. The address-sorted
+   index used to look up a symbol is built for each image on the first
+   lookup, so symbols that are never printed cost nothing at boot. */
+
+static heap symtab_heap;
+static struct spinlock symtab_lock;
+static struct list elf_symtables;
+
+typedef struct elf_symtable {
+    struct list l;
+    u64 load_offset;
+    Elf64_Sym *syms;
+    u64 nsyms;
+    char *strs;
+    u64 strs_len;
+    u32 *index;                 /* syms sorted by address; 0 until first lookup */
+    u64 nindex;
+} *elf_symtable;
+
+static boolean elf_sym_wanted(elf_symtable st, Elf64_Sym *s)
+{
+    int type = ELF64_ST_TYPE(s->st_info);
+    return s->st_value != 0 && s->st_size != 0 && s->st_name != 0 &&
+        s->st_name < st->strs_len && st->strs[s->st_name] != '\0' &&
+        (type == STT_FUNC || type == STT_OBJECT);
+}
 
-static inline elfsym allocate_elfsym(range r, char * name)
+static inline boolean elf_sym_before(elf_symtable st, u32 a, u32 b)
 {
-    elfsym es = allocate(general, sizeof(struct elfsym));
-    assert(es != INVALID_ADDRESS);
-    rmnode_init(&es->node, r);
-    int bytes = runtime_strlen(name) + 1;
-    es->name = allocate(general, bytes);
-    assert(es->name != INVALID_ADDRESS);
-    runtime_memcpy(es->name, name, bytes);
-    return es;
+    return st->syms[a].st_value < st->syms[b].st_value;
 }
 
-closure_function(1, 4, void, elf_symtable_add,
-                 u64, load_offset,
-                 char *, name, u64, a, u64, len, u8, info)
+static void elf_symtable_sift(elf_symtable st, u64 root, u64 n)
 {
-    int type = ELF64_ST_TYPE(info);
-
-    /* store bind info? */
-    if (a == 0 || len == 0 || !name || name[0] == '\0' ||
-	(type != STT_FUNC && type != STT_OBJECT))
-	return;
-
-    assert(elf_symtable);
-
-    range r = irangel(a + bound(load_offset), len);
-    boolean match = rangemap_range_intersects(elf_symtable, r);
-    if (match) {
-#ifdef ELF_SYMTAB_DEBUG
-	msg_err("\"%s\" %R would overlap in rangemap; skipping\n", name, r);
-#endif
-	return;
+    u32 *x = st->index;
+    while (2 * root + 1 < n) {
+        u64 child = 2 * root + 1;
+        if (child + 1 < n && elf_sym_before(st, x[child], x[child + 1]))
+            child++;
+        if (!elf_sym_before(st, x[root], x[child]))
+            return;
+        u32 t = x[root];
+        x[root] = x[child];
+        x[child] = t;
+        root = child;
     }
+}
 
-    elfsym es = allocate_elfsym(r, name);
-    if (!rangemap_insert(elf_symtable, &es->node)) {
-        /* shouldn't ever happen, so bark if it does */
-        msg_err("unable to add symbol \"%s\" of range %R to map; skipping\n",
-                name, r);
+static boolean elf_symtable_build_index(elf_symtable st)
+{
+    u64 n = 0;
+    for (u64 i = 0; i < st->nsyms; i++)
+        if (elf_sym_wanted(st, &st->syms[i]))
+            n++;
+    if (n == 0)
+        return false;
+    u32 *x = allocate(symtab_heap, n * sizeof(u32));
+    if (x == INVALID_ADDRESS)
+        return false;
+    n = 0;
+    for (u64 i = 0; i < st->nsyms; i++)
+        if (elf_sym_wanted(st, &st->syms[i]))
+            x[n++] = i;
+
+    /* heapsort by address */
+    st->index = x;
+    for (u64 i = n / 2; i > 0; i--)
+        elf_symtable_sift(st, i - 1, n);
+    for (u64 i = n - 1; i > 0; i--) {
+        u32 t = x[0];
+        x[0] = x[i];
+        x[i] = t;
+        elf_symtable_sift(st, 0, i);
     }
+    st->nindex = n;
+    return true;
 }
 
-char * find_elf_sym(u64 a, u64 *offset, u64 *len)
+/* last symbol starting at or below a, if it covers a */
+static Elf64_Sym *elf_symtable_lookup(elf_symtable st, u64 a)
 {
-    if (!elf_symtable)
+    if (!st->index && !elf_symtable_build_index(st))
         return 0;
-
-    elfsym es = (elfsym)rangemap_lookup(elf_symtable, a);
-    if (es == INVALID_ADDRESS)
+    if (a < st->load_offset)
+        return 0;
+    u64 v = a - st->load_offset;
+    u64 lo = 0, hi = st->nindex;
+    while (lo < hi) {
+        u64 mid = lo + (hi - lo) / 2;
+        if (st->syms[st->index[mid]].st_value <= v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
         return 0;
-    range r = range_from_rmnode(&es->node);
+    Elf64_Sym *s = &st->syms[st->index[lo - 1]];
+    return v < s->st_value + s->st_size ? s : 0;
+}
 
-    if (offset)
-        *offset = a - r.start;
+char * find_elf_sym(u64 a, u64 *offset, u64 *len)
+{
+    if (!symtab_heap)
+        return 0;
 
-    if (len)
-        *len = r.end - r.start;
+    char *name = 0;
+    u64 flags = spin_lock_irq(&symtab_lock);
+    list_foreach(&elf_symtables, l) {
+        elf_symtable st = struct_from_list(l, elf_symtable, l);
+        Elf64_Sym *s = elf_symtable_lookup(st, a);
+        if (!s)
+            continue;
+        if (offset)
+            *offset = a - (s->st_value + st->load_offset);
+        if (len)
+            *len = s->st_size;
+        name = st->strs + s->st_name;
+        break;
+    }
+    spin_unlock_irq(&symtab_lock, flags);
+    return name;
+}
 
-    return es->name;
+void add_elf_symtab(void *syms, u64 syms_size, char *strs, u64 strs_size, u64 load_offset)
+{
+    if (!symtab_heap) {
+        rputs("can't add ELF symbols; symtab not initialized\n");
+        return;
+    }
+    if (strs_size == 0 || strs[strs_size - 1] != '\0')
+        return;
+    elf_symtable st = allocate(symtab_heap, sizeof(struct elf_symtable));
+    if (st == INVALID_ADDRESS)
+        goto alloc_fail;
+    st->syms = allocate(symtab_heap, syms_size);
+    if (st->syms == INVALID_ADDRESS)
+        goto alloc_fail_st;
+    st->strs = allocate(symtab_heap, strs_size);
+    if (st->strs == INVALID_ADDRESS)
+        goto alloc_fail_syms;
+    runtime_memcpy(st->syms, syms, syms_size);
+    runtime_memcpy(st->strs, strs, strs_size);
+    st->nsyms = syms_size / sizeof(Elf64_Sym);
+    st->strs_len = strs_size;
+    st->load_offset = load_offset;
+    st->index = 0;
+    st->nindex = 0;
+    u64 flags = spin_lock_irq(&symtab_lock);
+    list_push_back(&elf_symtables, &st->l);
+    spin_unlock_irq(&symtab_lock, flags);
+    return;
+  alloc_fail_syms:
+    deallocate(symtab_heap, st->syms, syms_size);
+  alloc_fail_st:
+    deallocate(symtab_heap, st, sizeof(struct elf_symtable));
+  alloc_fail:
+    msg_err("failed to allocate symbol table\n");
 }
 
 void add_elf_syms(buffer b, u64 load_offset)
 {
-    if (elf_symtable)
-	elf_symbols(b, stack_closure(elf_symtable_add, load_offset));
-    else
-	rputs("can't add ELF symbols; symtab not initialized\n");
+    Elf64_Shdr *symtab, *strtab;
+    if (!elf_symtab_sections(b, &symtab, &strtab) ||
+        symtab->sh_entsize != sizeof(Elf64_Sym))
+        return;
+    add_elf_symtab(buffer_ref(b, symtab->sh_offset), symtab->sh_size,
+                   buffer_ref(b, strtab->sh_offset), strtab->sh_size, load_offset);
 }
 
 void print_u64_with_sym(u64 a)
@@ -100,6 +192,7 @@ void print_u64_with_sym(u64 a)
 
 void init_symtab(kernel_heaps kh)
 {
-    general = heap_general(kh);
-    elf_symtable = allocate_rangemap(general);
+    symtab_heap = heap_locked(kh);
+    spin_lock_init(&symtab_lock);
+    list_init(&elf_symtables);
 }
@@ -1,4 +1,6 @@
 void init_symtab(kernel_heaps kh);
 void add_elf_syms(buffer b, u64 load_offset);
+/* syms holds Elf64_Sym entries; both tables are copied */
+void add_elf_symtab(void *syms, u64 syms_size, char *strs, u64 strs_size, u64 load_offset);
 char * find_elf_sym(u64 a, u64 *offset, u64 *len);
 void print_u64_with_sym(u64 a);
@@ -14,6 +14,7 @@
 #ifndef BUILD_VDSO
 VVAR_DEF(struct vdso_dat_struct, vdso_dat) = {
     .platform_has_rdtscp = 0,
+    .platform_has_rdpid = 0,
     .rtc_offset = 0,
     .pvclock_offset = 0,
     .clock_src = VDSO_CLOCK_SYSCALL
@@ -107,16 +108,67 @@ vdso_now(clock_id id)
 }
 
 #ifdef __x86_64__
-VDSO int
-vdso_getcpu(unsigned *cpu, unsigned *node)
+/* TSC_AUX holds the cpu id, with the node in the upper bits */
+static inline int
+vdso_read_tsc_aux(u64 *aux)
 {
+    if (__vdso_dat->platform_has_rdpid) {
+        /* rdpid %rax, encoded for assemblers that lack it */
+        asm volatile(".byte 0xf3, 0x0f, 0xc7, 0xf8" : "=a" (*aux));
+        return 0;
+    }
     if (__vdso_dat->platform_has_rdtscp) {
-        if (cpu)
-            asm volatile("rdtscp" : "=c" (*cpu) :: "eax", "edx");
-        if (node)
-            *node = 0;
+        u32 a;
+        asm volatile("rdtscp" : "=c" (a) :: "eax", "edx");
+        *aux = a;
         return 0;
     }
     return -1;
 }
+
+VDSO int
+vdso_getcpu(unsigned *cpu, unsigned *node)
+{
+    u64 aux;
+    if (vdso_read_tsc_aux(&aux) < 0)
+        return -1;
+    if (cpu)
+        *cpu = aux & 0xfff;
+    if (node)
+        *node = (aux >> 12) & 0xfffff;
+    return 0;
+}
+
+/* The thread executing this owns the cputime slot of its cpu; a migration
+ * while reading shows up as a change of cpu or of the slot sequence.
+ */
+VDSO timestamp
+vdso_thread_cputime(void)
+{
+    vdso_now_fn now_fn = vdso_get_now_fn(__vdso_dat->clock_src);
+    u64 aux, cpu;
+    u64 seq;
+    timestamp base, start, t;
+
+    if (vdso_read_tsc_aux(&aux) < 0)
+        return VDSO_NO_NOW;
+    while (1) {
+        cpu = aux & 0xfff;
+        if (cpu >= MAX_CPUS)
+            return VDSO_NO_NOW;
+        volatile struct vdso_cputime *ct = &__vdso_dat->cputime[cpu];
+        seq = ct->seq;
+        read_barrier();
+        base = ct->base;
+        start = ct->start;
+        t = now_fn();
+        if (t == VDSO_NO_NOW)
+            return VDSO_NO_NOW;
+        read_barrier();
+        vdso_read_tsc_aux(&aux);
+        if (!(seq & 1) && (seq == ct->seq) && ((aux & 0xfff) == cpu))
+            break;
+    }
+    return (seq == 0 || t < start) ? VDSO_NO_NOW : base + (t - start);
+}
 #endif
@@ -6,12 +6,24 @@
 
 #include <unix_internal.h>
 
+/* the ChaCha20 core is compiled into the vdso as static functions */
+#define CHACHA_EMBED
+#include <crypto/chacha.c>
+
+#define __vdso_dat (&(VVAR_REF(vdso_dat)))
+
 static sysreturn
 fallback_clock_gettime(clockid_t clk_id, struct timespec * tp)
 {
     return do_syscall(SYS_clock_gettime, clk_id, tp);
 }
 
+static sysreturn
+fallback_clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    return do_syscall(SYS_clock_getres, clk_id, res);
+}
+
 static sysreturn
 fallback_gettimeofday(struct timeval * tv, void * tz)
 {
@@ -35,7 +47,13 @@ fallback_time(time_t * t)
 static sysreturn
 do_vdso_clock_gettime(clockid_t clk_id, struct timespec * tp)
 {
-    timestamp ts = vdso_now(clk_id);
+    timestamp ts;
+#ifdef __x86_64__
+    if (clk_id == CLOCK_THREAD_CPUTIME_ID)
+        ts = vdso_thread_cputime();
+    else
+#endif
+        ts = vdso_now(clk_id);
     if (ts == VDSO_NO_NOW)
         return fallback_clock_gettime(clk_id, tp);
 
@@ -43,6 +61,29 @@ do_vdso_clock_gettime(clockid_t clk_id, struct timespec * tp)
     return 0;
 }
 
+static sysreturn
+do_vdso_clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    switch (clk_id) {
+    case CLOCK_REALTIME:
+    case CLOCK_MONOTONIC:
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_REALTIME_COARSE:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_BOOTTIME:
+        /* all clocks are read from the same nanosecond source */
+        if (res) {
+            res->tv_sec = 0;
+            res->tv_nsec = 1;
+        }
+        return 0;
+    default:
+        return fallback_clock_getres(clk_id, res);
+    }
+}
+
 static sysreturn
 do_vdso_gettimeofday(struct timeval * tv, void * tz)
 {
@@ -80,6 +121,128 @@ do_vdso_time(time_t * t)
 }
 
 
+/* getrandom from a per-thread ChaCha20 state in user memory, following the
+ * Linux vgetrandom interface: the C library learns the state size and how
+ * to map it by calling with opaque_len ~0, then passes one state per
+ * thread. A state is keyed from the getrandom syscall and rekeyed whenever
+ * the kernel generation changes or after VDSO_RNG_RESEED_BYTES. Each batch
+ * of keystream starts with the key for the next one (fast key erasure), and
+ * bytes are cleared from the batch as they are handed out.
+ */
+#define VDSO_RNG_BATCH_SIZE     (8 * CHACHA_BLOCKLEN)
+#define VDSO_RNG_KEYBYTES       32
+#define VDSO_RNG_RESEED_BYTES   (1ull << 20)
+
+struct vdso_rng_state {
+    u8 batch[VDSO_RNG_BATCH_SIZE];
+    u8 key[VDSO_RNG_KEYBYTES];
+    u64 generation;
+    u64 numbytes;
+    u32 pos;
+    u8 keyed;
+    u8 in_use;
+};
+
+struct vgetrandom_opaque_params {
+    u32 size_of_opaque_state;
+    u32 mmap_prot;
+    u32 mmap_flags;
+    u32 reserved[13];
+};
+
+static sysreturn
+fallback_getrandom(void *buf, u64 len, unsigned int flags)
+{
+    return do_syscall3(SYS_getrandom, buf, len, flags);
+}
+
+static void
+vdso_rng_wipe(volatile u8 *p, u64 len)
+{
+    for (u64 i = 0; i < len; i++)
+        p[i] = 0;
+}
+
+static void
+vdso_rng_refill(struct vdso_rng_state *s)
+{
+    struct chacha_ctx ctx;
+    u64 iv = 0, ctr = 0;
+    chacha_keysetup(&ctx, s->key, VDSO_RNG_KEYBYTES * 8);
+    chacha_ivsetup(&ctx, (u8 *)&iv, (u8 *)&ctr);
+    vdso_rng_wipe(s->batch, VDSO_RNG_BATCH_SIZE);
+    chacha_encrypt_bytes(&ctx, s->batch, s->batch, VDSO_RNG_BATCH_SIZE);
+    for (int i = 0; i < VDSO_RNG_KEYBYTES; i++) {
+        s->key[i] = s->batch[i];
+        s->batch[i] = 0;
+    }
+    s->pos = VDSO_RNG_KEYBYTES;
+    vdso_rng_wipe((u8 *)&ctx, sizeof(ctx));
+}
+
+static sysreturn
+do_vdso_getrandom(void *buf, u64 len, unsigned int flags, void *opaque_state,
+                  u64 opaque_len)
+{
+    struct vdso_rng_state *s = opaque_state;
+
+    if (opaque_len == -1ull && !buf && !len && !flags) {
+        struct vgetrandom_opaque_params *params = opaque_state;
+        params->size_of_opaque_state = sizeof(*s);
+        params->mmap_prot = PROT_READ | PROT_WRITE;
+        params->mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        for (int i = 0; i < sizeof(params->reserved) / sizeof(params->reserved[0]); i++)
+            params->reserved[i] = 0;
+        return 0;
+    }
+    if (!s || opaque_len != sizeof(*s) ||
+        (flags & ~(GRND_NONBLOCK | GRND_RANDOM | GRND_INSECURE)))
+        return fallback_getrandom(buf, len, flags);
+    u64 generation = __vdso_dat->rng_generation;
+    if (generation == 0)
+        return fallback_getrandom(buf, len, flags);
+    if (!len)
+        return 0;
+
+    /* a signal handler interrupting us on this thread takes the syscall */
+    if (s->in_use)
+        return fallback_getrandom(buf, len, flags);
+    s->in_use = 1;
+    compiler_barrier();
+
+    if (!s->keyed || s->generation != generation || s->numbytes >= VDSO_RNG_RESEED_BYTES) {
+        if (do_syscall3(SYS_getrandom, s->key, VDSO_RNG_KEYBYTES, 0) != VDSO_RNG_KEYBYTES) {
+            compiler_barrier();
+            s->in_use = 0;
+            return fallback_getrandom(buf, len, flags);
+        }
+        s->generation = generation;
+        s->keyed = 1;
+        s->numbytes = 0;
+        s->pos = VDSO_RNG_BATCH_SIZE;
+    }
+
+    u8 *p = buf;
+    u64 remain = len;
+    while (remain) {
+        if (s->pos == VDSO_RNG_BATCH_SIZE)
+            vdso_rng_refill(s);
+        u64 n = MIN(remain, VDSO_RNG_BATCH_SIZE - s->pos);
+        u8 *q = s->batch + s->pos;
+        for (u64 i = 0; i < n; i++) {
+            p[i] = q[i];
+            q[i] = 0;
+        }
+        s->pos += n;
+        p += n;
+        remain -= n;
+    }
+    s->numbytes += len;
+    compiler_barrier();
+    s->in_use = 0;
+    return len;
+}
+
 /* --------------------------------------------------------------------- */
 /* Below are the full set of visible functions exported through the VDSO */
 /*              Everything above must be marked static                   */
@@ -97,6 +260,18 @@ clock_gettime(clockid_t clk_id, struct timespec * tp)
     return do_vdso_clock_gettime(clk_id, tp);
 }
 
+sysreturn
+__vdso_clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    return do_vdso_clock_getres(clk_id, res);
+}
+
+sysreturn
+clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    return do_vdso_clock_getres(clk_id, res);
+}
+
 sysreturn
 __vdso_gettimeofday(struct timeval * tv, void * tz)
 {
@@ -133,6 +308,12 @@ time(time_t * t)
     return do_vdso_time(t);
 }
 
+sysreturn
+__vdso_getrandom(void *buf, u64 len, unsigned int flags, void *opaque_state, u64 opaque_len)
+{
+    return do_vdso_getrandom(buf, len, flags, opaque_state, opaque_len);
+}
+
 #ifdef __aarch64__
 sysreturn __vdso_rt_sigreturn(void)
 {
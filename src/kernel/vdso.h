@@ -4,6 +4,16 @@
 
 #define VDSO_NO_NOW (timestamp)-1
 
+/* CPU time of the user thread running on a cpu: base plus the monotonic raw
+ * time elapsed since start. The sequence count is odd while an update is in
+ * progress.
+ */
+struct vdso_cputime {
+    u64 seq;
+    timestamp base;
+    timestamp start;
+} __attribute((packed));
+
 /* An instance of this struct is shared between kernel and userspace
  * Make sure there are no pointers embedded in it
  */
@@ -17,6 +27,9 @@ struct vdso_dat_struct {
     s64 last_drift; /* last calculated drift from monotonic raw to monotonic */
     timestamp last_raw; /* time at which last_drift has been calculated */
     u8 platform_has_rdtscp;
+    u8 platform_has_rdpid;
+    u64 rng_generation; /* changes whenever the kernel random generators are rekeyed */
+    struct vdso_cputime cputime[MAX_CPUS];
 } __attribute((packed));
 
 /* VDSO accessible variables */
@@ -27,3 +40,4 @@ struct pvclock_vcpu_time_info;
 VDSO u64 vdso_pvclock_now_ns(volatile struct pvclock_vcpu_time_info *);
 VDSO timestamp vdso_now(clock_id id);
 VDSO int vdso_getcpu(unsigned *cpu, unsigned *node);
+VDSO timestamp vdso_thread_cputime(void);
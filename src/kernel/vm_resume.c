@@ -0,0 +1,46 @@
+#include <kernel.h>
+
+/* A VM resumed from a snapshot, possibly many times over, or one that was
+   paused by the hypervisor must not keep state tied to the original
+   instance: the random generator key, the wall clock offset, network
+   leases and neighbor caches, and the cloud instance identity. Platforms
+   call vm_resume_detected() when they learn of a resume, e.g. from the
+   pvclock guest stopped flag; the random generator and the wall clock are
+   handled here, and other subsystems register their own notifiers. */
+
+declare_closure_struct(0, 0, void, vm_resume_run);
+
+static vector vm_resume_notifies;
+static u32 vm_resume_pending;
+static closure_struct(vm_resume_run, vm_resume);
+
+void register_vm_resume_notify(thunk t)
+{
+    if (!vm_resume_notifies) {
+        vm_resume_notifies = allocate_vector(heap_general(get_kernel_heaps()), 4);
+        assert(vm_resume_notifies != INVALID_ADDRESS);
+    }
+    vector_push(vm_resume_notifies, t);
+}
+KLIB_EXPORT(register_vm_resume_notify);
+
+define_closure_function(0, 0, void, vm_resume_run)
+{
+    vm_resume_pending = 0;
+    boot_milestone("vm resumed");
+    random_reseed();
+    clock_resync_rtc();
+    if (vm_resume_notifies) {
+        thunk t;
+        vector_foreach(vm_resume_notifies, t)
+            apply(t);
+    }
+}
+
+/* safe from any context; the notifiers run from the runqueue */
+void vm_resume_detected(void)
+{
+    if (!compare_and_swap_32(&vm_resume_pending, 0, 1))
+        return;
+    runqueue_push(init_closure(&vm_resume, vm_resume_run));
+}
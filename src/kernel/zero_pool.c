@@ -0,0 +1,107 @@
+#include <kernel.h>
+
+/* Pre-zeroed pages for anonymous faults. Each cpu keeps a pool of physical
+   pages, zeroed with non-temporal stores when the cpu has nothing else to
+   run, and hands them to faults taken on that cpu, which can then map a
+   page without zeroing it on the faulting thread's path. Pages are zeroed
+   through a window that only its cpu ever touches, so moving the window
+   from one page to the next invalidates just the local TLB. The pools are
+   not refilled while free physical memory is short. */
+
+/* pages zeroed per pass, bounding the delay to work arriving meanwhile */
+#define ZERO_POOL_REFILL_BATCH  8
+
+typedef struct zero_pool {
+    u64 window;
+    boolean window_mapped;
+    u32 count;
+    u64 pages[0];
+} *zero_pool;
+
+static zero_pool *zero_pools;
+static u32 zero_pool_size;
+
+/* Returns a zeroed physical page local to the running cpu, or
+   INVALID_PHYSICAL if its pool is empty. */
+u64 zero_pool_take(void)
+{
+    if (!zero_pools)
+        return INVALID_PHYSICAL;
+    u64 flags = irq_disable_save();
+    zero_pool zp = zero_pools[current_cpu()->id];
+    u64 p = zp->count ? zp->pages[--zp->count] : INVALID_PHYSICAL;
+    irq_restore(flags);
+    return p;
+}
+
+/* called from the runloop, with interrupts disabled, when no thread is
+   ready to run */
+void zero_pool_refill(void)
+{
+    if (!zero_pools)
+        return;
+    zero_pool zp = zero_pools[current_cpu()->id];
+    if (zp->count == zero_pool_size ||
+        heap_free((heap)heap_physical(get_kernel_heaps())) < ZERO_POOL_MIN_FREE)
+        return;
+    heap phys = heap_physical_local();
+    pageflags flags = pageflags_writable(pageflags_noexec(pageflags_memory()));
+    for (int i = 0; i < ZERO_POOL_REFILL_BATCH && zp->count < zero_pool_size; i++) {
+        u64 p = allocate_u64(phys, PAGESIZE);
+        if (p == INVALID_PHYSICAL)
+            break;
+        if (zp->window_mapped) {
+            remap_private_page(zp->window, p, flags);
+        } else {
+            map(zp->window, p, PAGESIZE, flags);
+            zp->window_mapped = true;
+        }
+        zero_nontemporal(pointer_from_u64(zp->window), PAGESIZE);
+        zp->pages[zp->count++] = p;
+    }
+}
+
+/* e.g. zero_pool:256, the number of pre-zeroed pages kept per cpu;
+   0 disables the pools */
+void config_zero_pool(tuple root)
+{
+    u64 pages = ZERO_POOL_PAGES_DEFAULT;
+    value v = get(root, sym(zero_pool));
+    if (v && (is_tuple(v) || !u64_from_value(v, &pages) || pages > U32_MAX)) {
+        msg_err("invalid zero_pool\n");
+        return;
+    }
+    if (pages == 0)
+        return;
+    kernel_heaps kh = get_kernel_heaps();
+    heap h = heap_general(kh);
+    zero_pool *pools = allocate_zero(h, total_processors * sizeof(zero_pool));
+    if (pools == INVALID_ADDRESS)
+        goto nomem;
+    for (int i = 0; i < total_processors; i++) {
+        zero_pool zp = allocate(h, sizeof(struct zero_pool) + pages * sizeof(u64));
+        if (zp == INVALID_ADDRESS)
+            goto nomem;
+        zp->window = allocate_u64((heap)heap_virtual_page(kh), PAGESIZE);
+        if (zp->window == INVALID_PHYSICAL) {
+            deallocate(h, zp, sizeof(struct zero_pool) + pages * sizeof(u64));
+            goto nomem;
+        }
+        zp->window_mapped = false;
+        zp->count = 0;
+        pools[i] = zp;
+    }
+    zero_pool_size = pages;
+    memory_barrier();
+    zero_pools = pools;
+    return;
+  nomem:
+    msg_err("failed to allocate zero page pools\n");
+    if (pools != INVALID_ADDRESS) {
+        for (int i = 0; i < total_processors && pools[i]; i++) {
+            deallocate_u64((heap)heap_virtual_page(kh), pools[i]->window, PAGESIZE);
+            deallocate(h, pools[i], sizeof(struct zero_pool) + pages * sizeof(u64));
+        }
+        deallocate(h, pools, total_processors * sizeof(zero_pool));
+    }
+}
@@ -31,10 +31,16 @@ typedef struct direct_conn {
     err_t pending_err;          /* lwIP */
 } *direct_conn;
 
-/* suppose this could store a completion if a client needs it */
+/* Buffers are handed to lwIP by reference, as PBUF_REF segments chained
+   into the outgoing TCP segments, so a buffer stays on the send queue until
+   all of it has been acknowledged. Wrapped buffers may thus reference
+   memory owned elsewhere, such as static or cached data, which must stay
+   valid until the buffer is released. */
 typedef struct qbuf {
     struct list l;
     buffer b;
+    bytes written;              /* handed to lwIP */
+    bytes acked;
 } *qbuf;
 
 static void direct_conn_dealloc(direct_conn dc);
@@ -65,9 +71,19 @@ static void direct_dealloc(direct d)
     deallocate(d->h, d, sizeof(struct direct));
 }
 
+static void qbuf_release(direct_conn dc, qbuf q)
+{
+    if (q->b)
+        deallocate_buffer(q->b);
+    list_delete(&q->l);
+    deallocate(dc->d->h, q, sizeof(struct qbuf));
+}
+
 static status direct_conn_closed(direct_conn dc)
 {
     status s = apply(dc->receive_bh, 0);
+    list_foreach(&dc->sendq_head, l)
+        qbuf_release(dc, struct_from_list(l, qbuf, l));
     direct d = dc->d;
     boolean client = (dc->p == d->p);
     if (!client)
@@ -83,8 +99,6 @@ static status direct_conn_closed(direct_conn dc)
 static void direct_conn_send_internal(direct_conn dc, qbuf q)
 {
     direct_debug("dc %p\n", dc);
-    list next;
-
     /* It appears TCP_EVENT_SENT is only called from tcp_input. If in
        the future it could ever be invoked as a result of a call to
        tcp_write or tcp_output, this will need to be revised to avoid
@@ -92,47 +106,66 @@ static void direct_conn_send_internal(direct_conn dc, qbuf q)
     spin_lock(&dc->send_lock);
     if (q)
         list_insert_before(&dc->sendq_head, &q->l);
-    while ((next = list_get_next(&dc->sendq_head))) {
+    boolean written = false, close = false;
+    list_foreach(&dc->sendq_head, next) {
         qbuf q = struct_from_list(next, qbuf, l);
         if (!q->b) {
-            /* close connection - should check error, but would need status handler... */
-            direct_debug("connection close by sender\n");
-            tcp_arg(dc->p, 0);
-            tcp_close(dc->p);
-            list_delete(&q->l);
-            deallocate(dc->d->h, q, sizeof(struct qbuf));
-            direct_conn_closed(dc);
+            /* close once everything queued before has been acknowledged */
+            if (next == list_begin(&dc->sendq_head)) {
+                qbuf_release(dc, q);
+                close = true;
+            }
             break;
         }
+        if (q->written == buffer_length(q->b))
+            continue;
 
         int avail = tcp_sndbuf(dc->p);
         if (avail == 0)
             break;
 
-        int write_len = MIN(avail, buffer_length(q->b));
-        /* Fix interface: can send with PSH flag clear
-           (TCP_WRITE_FLAG_MORE) if we know more data is on the way... */
-        direct_debug("write %p, len %d\n", buffer_ref(q->b, 0), write_len);
-        err_t err = tcp_write(dc->p, buffer_ref(q->b, 0), write_len, TCP_WRITE_FLAG_COPY);
+        int write_len = MIN(avail, buffer_length(q->b) - q->written);
+        boolean more = write_len < buffer_length(q->b) - q->written ||
+            next->next != list_end(&dc->sendq_head);
+        direct_debug("write %p, len %d\n", buffer_ref(q->b, q->written), write_len);
+        err_t err = tcp_write(dc->p, buffer_ref(q->b, q->written), write_len,
+                              more ? TCP_WRITE_FLAG_MORE : 0);
         if (err == ERR_MEM)
             break;
-
-        err = tcp_output(dc->p);
-        if (err != ERR_OK) {
+        q->written += write_len;
+        written = true;
+        direct_debug("remaining %d\n", buffer_length(q->b) - q->written);
+    }
+    if (written) {
+        err_t err = tcp_output(dc->p);
+        if (err != ERR_OK)
             msg_err("tcp_output failed with %d\n", err);
-            break;
-        }
-
-        buffer_consume(q->b, write_len);
-        direct_debug("remaining %d\n", buffer_length(q->b));
+    }
+    spin_unlock(&dc->send_lock);
+    if (close) {
+        /* close connection - should check error, but would need status handler... */
+        direct_debug("connection close by sender\n");
+        tcp_arg(dc->p, 0);
+        tcp_sent(dc->p, 0);
+        tcp_close(dc->p);
+        direct_conn_closed(dc);
+    }
+}
 
-        /* pop off qbuf if work finished, else loop around to attempt to send more */
-        if (!q->b || buffer_length(q->b) == 0) {
-            if (q->b)
-                deallocate_buffer(q->b);
-            list_delete(&q->l);
-            deallocate(dc->d->h, q, sizeof(struct qbuf));
-        }
+/* release buffers whose data has been acknowledged */
+static void direct_conn_acked(direct_conn dc, u16 len)
+{
+    spin_lock(&dc->send_lock);
+    list_foreach(&dc->sendq_head, l) {
+        qbuf q = struct_from_list(l, qbuf, l);
+        if (len == 0 || !q->b)
+            break;
+        bytes n = MIN(len, q->written - q->acked);
+        q->acked += n;
+        len -= n;
+        if (q->acked < buffer_length(q->b))
+            break;
+        qbuf_release(dc, q);
     }
     spin_unlock(&dc->send_lock);
 }
@@ -140,6 +173,7 @@ static void direct_conn_send_internal(direct_conn dc, qbuf q)
 static err_t direct_conn_sent(void *arg, struct tcp_pcb *pcb, u16 len)
 {
     assert(arg);
+    direct_conn_acked((direct_conn)arg, len);
     direct_conn_send_internal((direct_conn)arg, 0);
     return ERR_OK;
 }
@@ -151,6 +185,10 @@ define_closure_function(1, 1, status, direct_conn_send,
     direct_debug("dc %p, b %p, len %ld\n", bound(dc), b, b ? buffer_length(b) : 0);
     status s = STATUS_OK;
     direct_conn dc = bound(dc);
+    if (b && buffer_length(b) == 0) {
+        deallocate_buffer(b);
+        return s;
+    }
 
     /* enqueue qbuf, even if !b */
     qbuf q = allocate(dc->d->h, sizeof(struct qbuf));
@@ -159,6 +197,7 @@ define_closure_function(1, 1, status, direct_conn_send,
     } else {
         /* queue even if b == 0 (acts as close connection command) */
         q->b = b;
+        q->written = q->acked = 0;
         direct_conn_send_internal(dc, q);
     }
     return s;
@@ -278,6 +317,7 @@ status listen_port(heap h, u16 port, connection_handler c)
     d->p = tcp_listen(d->p);
     tcp_err(d->p, direct_listen_err);
     tcp_accept(d->p, direct_accept);
+    net_tcp_timer_needed();
     return s;
   fail_dealloc:
     direct_dealloc(d);
@@ -287,6 +327,7 @@ status listen_port(heap h, u16 port, connection_handler c)
         timm_append(s, "lwip_error", "%d", err);
     return s;
 }
+KLIB_EXPORT(listen_port);
 
 static err_t direct_connect_complete(void* arg, struct tcp_pcb* pcb, err_t err)
 {
@@ -313,6 +354,7 @@ status direct_connect(heap h, ip_addr_t *addr, u16 port, connection_handler ch)
     tcp_err(d->p, direct_connect_err);
     err_t err = tcp_connect(d->p, addr, port, direct_connect_complete);
     if (err == ERR_OK) {
+        net_tcp_timer_needed();
         return STATUS_OK;
     } else {
         direct_dealloc(d);
@@ -0,0 +1,233 @@
+#include <unix_internal.h>
+#include <net_system_structs.h>
+#include <ktls.h>
+
+#define KTLS_HEADER_SIZE        5
+#define KTLS_EXPLICIT_IV_SIZE   8   /* TLS 1.2 only */
+#define KTLS_SALT_SIZE          4
+#define KTLS_SEQ_SIZE           8
+
+struct ktls {
+    heap h;
+    void *key;                  /* cipher context; 0 until TLS_TX is set */
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 gcm128;
+        struct tls12_crypto_info_aes_gcm_256 gcm256;
+    } crypto;                   /* iv and rec_seq are those of the next record */
+    u32 crypto_len;
+    u8 *iv, *salt, *rec_seq;
+};
+
+static ktls_aead ktls_cipher;
+
+void ktls_register_aead(ktls_aead aead)
+{
+    ktls_cipher = aead;
+}
+KLIB_EXPORT(ktls_register_aead);
+
+boolean ktls_available(void)
+{
+    return ktls_cipher != 0;
+}
+
+ktls allocate_ktls(heap h)
+{
+    ktls k = allocate_zero(h, sizeof(struct ktls));
+    if (k == INVALID_ADDRESS)
+        return k;
+    k->h = h;
+    return k;
+}
+
+void deallocate_ktls(ktls k)
+{
+    if (k->key)
+        ktls_cipher->key_free(k->key);
+    zero(&k->crypto, sizeof(k->crypto));
+    deallocate(k->h, k, sizeof(struct ktls));
+}
+
+int ktls_set_tx(ktls k, void *info, u32 len)
+{
+    if (k->key)
+        return -EBUSY;
+    if (len < sizeof(struct tls_crypto_info))
+        return -EINVAL;
+    struct tls_crypto_info *ci = info;
+    if (ci->version != TLS_1_2_VERSION && ci->version != TLS_1_3_VERSION)
+        return -EINVAL;
+    u8 *key;
+    u32 key_len;
+    switch (ci->cipher_type) {
+    case TLS_CIPHER_AES_GCM_128:
+        if (len != sizeof(k->crypto.gcm128))
+            return -EINVAL;
+        runtime_memcpy(&k->crypto, info, len);
+        k->iv = k->crypto.gcm128.iv;
+        k->salt = k->crypto.gcm128.salt;
+        k->rec_seq = k->crypto.gcm128.rec_seq;
+        key = k->crypto.gcm128.key;
+        key_len = sizeof(k->crypto.gcm128.key);
+        break;
+    case TLS_CIPHER_AES_GCM_256:
+        if (len != sizeof(k->crypto.gcm256))
+            return -EINVAL;
+        runtime_memcpy(&k->crypto, info, len);
+        k->iv = k->crypto.gcm256.iv;
+        k->salt = k->crypto.gcm256.salt;
+        k->rec_seq = k->crypto.gcm256.rec_seq;
+        key = k->crypto.gcm256.key;
+        key_len = sizeof(k->crypto.gcm256.key);
+        break;
+    default:
+        return -EINVAL;
+    }
+    k->key = ktls_cipher->key_alloc(key, key_len);
+    if (!k->key) {
+        zero(&k->crypto, sizeof(k->crypto));
+        return -ENOMEM;
+    }
+    k->crypto_len = len;
+    return 0;
+}
+
+/* As in Linux, the iv and sequence number returned are those of the next
+   record. */
+int ktls_get_tx(ktls k, void *info, u32 *len)
+{
+    if (!k->key)
+        return -EBUSY;
+    *len = MIN(*len, k->crypto_len);
+    runtime_memcpy(info, &k->crypto, *len);
+    return 0;
+}
+
+boolean ktls_tx_ready(ktls k)
+{
+    return k->key != 0;
+}
+
+static boolean ktls_is_tls13(ktls k)
+{
+    return k->crypto.info.version == TLS_1_3_VERSION;
+}
+
+/* bytes preceding the plaintext in a record */
+static u32 ktls_prefix(ktls k)
+{
+    return KTLS_HEADER_SIZE + (ktls_is_tls13(k) ? 0 : KTLS_EXPLICIT_IV_SIZE);
+}
+
+/* bytes a record adds to its plaintext, including the inner content type
+   of TLS 1.3 */
+u32 ktls_overhead(ktls k)
+{
+    return ktls_prefix(k) + (ktls_is_tls13(k) ? 1 : 0) + KTLS_TAG_SIZE;
+}
+
+/* plaintext that fits in avail bytes of send buffer, in records no
+   smaller than a writer waits for */
+u64 ktls_plaintext_avail(ktls k, u64 avail)
+{
+    u64 full = KTLS_MAX_PLAINTEXT + ktls_overhead(k);
+    u64 n = (avail / full) * KTLS_MAX_PLAINTEXT;
+    avail %= full;
+    if (avail >= ktls_overhead(k) + KTLS_MIN_RECORD)
+        n += avail - ktls_overhead(k);
+    return n;
+}
+
+define_closure_function(1, 0, void, ktls_record_free,
+                        struct ktls_record *, r)
+{
+    ktls_record r = bound(r);
+    deallocate(r->h, r, sizeof(struct ktls_record) + r->len);
+}
+
+/* A record for len bytes of plaintext, to be copied to
+   ktls_record_payload() before sealing. The caller holds the initial
+   reference. */
+ktls_record ktls_record_alloc(ktls k, u32 len)
+{
+    assert(len <= KTLS_MAX_PLAINTEXT);
+    u32 wire_len = len + ktls_overhead(k);
+    ktls_record r = allocate(k->h, sizeof(struct ktls_record) + wire_len);
+    if (r == INVALID_ADDRESS)
+        return r;
+    r->h = k->h;
+    r->len = wire_len;
+    init_refcount(&r->r, 1, init_closure(&r->free, ktls_record_free, r));
+    return r;
+}
+
+u8 *ktls_record_payload(ktls k, ktls_record r)
+{
+    return r->data + ktls_prefix(k);
+}
+
+static void ktls_seq_add(u8 *seq, u32 size, int n)
+{
+    for (int i = size - 1; i >= 0; i--) {
+        u8 prev = seq[i];
+        seq[i] += n;
+        if (n > 0 ? seq[i] > prev : seq[i] < prev)
+            break;
+    }
+}
+
+/* Frame and seal the plaintext in the record, consuming a sequence
+   number. TLS 1.2 records carry the iv as their explicit nonce and
+   authenticate the sequence number and header fields; TLS 1.3 records hide
+   the content type after the data, authenticate the header and derive the
+   nonce from the sequence number. */
+boolean ktls_seal(ktls k, ktls_record r, u32 len, u8 type)
+{
+    u8 nonce[KTLS_NONCE_SIZE];
+    u8 aad[KTLS_SEQ_SIZE + KTLS_HEADER_SIZE];
+    u8 *hdr = r->data;
+    u8 *payload = ktls_record_payload(k, r);
+    u32 aad_len;
+    runtime_memcpy(nonce, k->salt, KTLS_SALT_SIZE);
+    runtime_memcpy(nonce + KTLS_SALT_SIZE, k->iv, KTLS_EXPLICIT_IV_SIZE);
+    u32 body_len = r->len - KTLS_HEADER_SIZE;
+    hdr[1] = TLS_1_2_VERSION >> 8;
+    hdr[2] = TLS_1_2_VERSION & 0xff;
+    hdr[3] = body_len >> 8;
+    hdr[4] = body_len & 0xff;
+    if (ktls_is_tls13(k)) {
+        hdr[0] = KTLS_TYPE_APPLICATION_DATA;
+        payload[len++] = type;
+        for (int i = 0; i < KTLS_SEQ_SIZE; i++)
+            nonce[KTLS_NONCE_SIZE - KTLS_SEQ_SIZE + i] ^= k->rec_seq[i];
+        runtime_memcpy(aad, hdr, KTLS_HEADER_SIZE);
+        aad_len = KTLS_HEADER_SIZE;
+    } else {
+        hdr[0] = type;
+        runtime_memcpy(hdr + KTLS_HEADER_SIZE, k->iv, KTLS_EXPLICIT_IV_SIZE);
+        runtime_memcpy(aad, k->rec_seq, KTLS_SEQ_SIZE);
+        aad[KTLS_SEQ_SIZE] = type;
+        aad[KTLS_SEQ_SIZE + 1] = TLS_1_2_VERSION >> 8;
+        aad[KTLS_SEQ_SIZE + 2] = TLS_1_2_VERSION & 0xff;
+        aad[KTLS_SEQ_SIZE + 3] = len >> 8;
+        aad[KTLS_SEQ_SIZE + 4] = len & 0xff;
+        aad_len = sizeof(aad);
+    }
+    if (!ktls_cipher->seal(k->key, nonce, aad, aad_len, payload, len, payload + len))
+        return false;
+    ktls_seq_add(k->rec_seq, KTLS_SEQ_SIZE, 1);
+    if (!ktls_is_tls13(k))
+        ktls_seq_add(k->iv, KTLS_EXPLICIT_IV_SIZE, 1);
+    return true;
+}
+
+/* Give back the sequence number of the last record sealed, which never
+   reached the transmit queue; as its ciphertext was never seen, the nonce
+   may be used again. */
+void ktls_unseal(ktls k)
+{
+    ktls_seq_add(k->rec_seq, KTLS_SEQ_SIZE, -1);
+    if (!ktls_is_tls13(k))
+        ktls_seq_add(k->iv, KTLS_EXPLICIT_IV_SIZE, -1);
+}
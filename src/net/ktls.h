@@ -0,0 +1,78 @@
+/* In-kernel TLS transmit (TCP_ULP "tls"). Once user space has completed a
+   handshake and installed the transmit traffic keys with
+   setsockopt(SOL_TLS, TLS_TX), data written to the socket goes out as TLS
+   records, sealed with AES-GCM on the way from the source buffer (or the
+   pagecache pages of a sendfile()) to the transmit queue. The cipher is
+   registered at run time by the tls klib, so kTLS is only offered with that
+   klib loaded. Receive keys (TLS_RX) are not supported. */
+
+#define KTLS_NONCE_SIZE     12
+#define KTLS_TAG_SIZE       16
+#define KTLS_MAX_PLAINTEXT  (16 * KB)
+
+/* smallest record made for lack of send buffer space; less than this and
+   the writer waits for acknowledgments instead */
+#define KTLS_MIN_RECORD     KB
+
+#define KTLS_TYPE_APPLICATION_DATA  23
+
+/* setsockopt(SOL_TLS, TLS_TX) argument, as in linux/tls.h */
+struct tls_crypto_info {
+    u16 version;
+    u16 cipher_type;
+};
+
+struct tls12_crypto_info_aes_gcm_128 {
+    struct tls_crypto_info info;
+    u8 iv[8];
+    u8 key[16];
+    u8 salt[4];
+    u8 rec_seq[8];
+};
+
+struct tls12_crypto_info_aes_gcm_256 {
+    struct tls_crypto_info info;
+    u8 iv[8];
+    u8 key[32];
+    u8 salt[4];
+    u8 rec_seq[8];
+};
+
+typedef struct ktls_aead {
+    /* returns a cipher context for the key, or 0 */
+    void *(*key_alloc)(const u8 *key, u32 key_len);
+    void (*key_free)(void *ctx);
+    /* encrypts len bytes of data in place and stores the tag */
+    boolean (*seal)(void *ctx, const u8 *nonce, const u8 *aad, u32 aad_len,
+                    u8 *data, u64 len, u8 *tag);
+} *ktls_aead;
+
+void ktls_register_aead(ktls_aead aead);
+
+typedef struct ktls *ktls;
+
+declare_closure_struct(1, 0, void, ktls_record_free,
+                       struct ktls_record *, r);
+
+/* A sealed record, referenced by the transmit queue until acknowledged
+   where the route takes data in place. */
+typedef struct ktls_record {
+    struct refcount r;
+    heap h;
+    u32 len;                    /* length on the wire */
+    closure_struct(ktls_record_free, free);
+    u8 data[0];
+} *ktls_record;
+
+boolean ktls_available(void);
+ktls allocate_ktls(heap h);
+void deallocate_ktls(ktls k);
+int ktls_set_tx(ktls k, void *info, u32 len);
+int ktls_get_tx(ktls k, void *info, u32 *len);
+boolean ktls_tx_ready(ktls k);
+u32 ktls_overhead(ktls k);
+u64 ktls_plaintext_avail(ktls k, u64 avail);
+ktls_record ktls_record_alloc(ktls k, u32 len);
+u8 *ktls_record_payload(ktls k, ktls_record r);
+boolean ktls_seal(ktls k, ktls_record r, u32 len, u8 type);
+void ktls_unseal(ktls k);
@@ -25,4 +25,7 @@ struct netif *netif_get_default(void);
 u16 ifflags_from_netif(struct netif *netif);
 void netif_name_cpy(char *dest, struct netif *netif);
 
+typedef closure_type(netif_config_handler, void, tuple);
+void netif_set_config_handler(struct netif *netif, netif_config_handler h);
+
 #define netif_is_loopback(netif)    (((netif)->name[0] == 'l') && ((netif)->name[1] == 'o'))
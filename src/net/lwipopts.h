@@ -2,6 +2,25 @@
 #define LWIP_SOCKET 0
 #define LWIP_NETCONN 0
 #define ARP_QUEUEING 1
+
+/* Neighbor tables sized for guests talking to hundreds of hosts on one
+   subnet; the lwIP defaults of 10 entries thrash there. The tables are
+   static in lwIP, so their sizes are build options (-DARP_TABLE_SIZE=...).
+   Lookups are linear, but each pcb keeps the index of its neighbor entry
+   (LWIP_NETIF_HWADDRHINT), so established flows skip the search. */
+#ifndef ARP_TABLE_SIZE
+#define ARP_TABLE_SIZE 256
+#endif
+#ifndef LWIP_ND6_NUM_NEIGHBORS
+#define LWIP_ND6_NUM_NEIGHBORS 256
+#endif
+#ifndef LWIP_ND6_NUM_DESTINATIONS
+#define LWIP_ND6_NUM_DESTINATIONS 256
+#endif
+#define LWIP_NETIF_HWADDRHINT 1
+#define ARP_QUEUE_LEN 16        /* packets held per unresolved address */
+#define MEMP_NUM_ARP_QUEUE 256
+#define MEMP_NUM_ND6_QUEUE 256
 //#define LWIP_DEBUG
 #ifdef LWIP_DEBUG
 #define LWIP_PLATFORM_DIAG(x) do {lwip_debug x;} while(0)
@@ -50,13 +69,17 @@
 
 #define LWIP_WND_SCALE 1
 #define TCP_MSS 1460            /* Assuming ethernet; may want to derive this */
-#define TCP_WND 65535
-#define TCP_SND_BUF 65535
+/* Largest per-socket receive window and send buffer; sockets start smaller
+   and grow (see netsyscall.c) */
+#define TCP_WND (4 * 1024 * 1024)
+#define TCP_SND_BUF (4 * 1024 * 1024)
+#define TCP_SNDLOWAT 32767      /* lwIP requires this to fit in 16 bits */
 #define TCP_SND_QUEUELEN TCP_SNDQUEUELEN_OVERFLOW
 #define TCP_OVERSIZE TCP_MSS
 #define TCP_QUEUE_OOSEQ 1
+#define LWIP_TCP_PCB_NUM_EXT_ARGS 1   /* page references of zero-copy sends */
 
-#define TCP_RCV_SCALE 0         /* XXX check */
+#define TCP_RCV_SCALE 7         /* to advertise TCP_WND */
 #define TCP_LISTEN_BACKLOG 1
 #define LWIP_DHCP 1
 // would prefer to set this dynamically...also,
@@ -66,6 +89,13 @@
 #define DHCP_DOES_ARP_CHECK 0
 #define LWIP_NETIF_LOOPBACK 1
 #define LWIP_NETIF_HOSTNAME 1
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1  /* for checksum offload */
+#define MIB2_STATS 1                    /* for /proc/net/snmp and management */
+
+/* Not an lwIP option: netif flag for drivers whose transmit path walks pbuf
+   payloads page by page and so can take zero-copy sends from user memory. */
+#define NETIF_FLAG_TX_PAGES 0x80U
+/* hot memp types are served from per-type pools by the memp_malloc() wrapper (net.c) */
 #define MEMP_MEM_MALLOC 1
 typedef unsigned long size_t;
 #define LWIP_NETIF_EXT_STATUS_CALLBACK  1
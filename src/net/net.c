@@ -1,6 +1,8 @@
 #include <kernel.h>
+#include <log.h>
 #include <lwip.h>
 #include <lwip/priv/tcp_priv.h>
+#include <lwip/memp.h>
 
 /* Network interface flags */
 #define IFF_UP          (1 << 0)
@@ -11,6 +13,41 @@
 #define IFF_MULTICAST   (1 << 12)
 
 static heap lwip_heap;
+static table netif_config_handlers;
+
+/* Dedicated pools for the hot memp types. MEMP_MEM_MALLOC stays enabled,
+   so other memp types come from lwip_heap through mem_malloc(). lwIP has no
+   hook that passes the memp type to an allocator, so memp_malloc() and
+   memp_free() are wrapped at link time (see the platform Makefiles) and
+   requests for these types are served from their own pool. */
+typedef struct net_pool {
+    const char *name;
+    memp_t type;
+    bytes objsize;
+    heap cache;                 /* objcache */
+    heap h;                     /* per-cpu magazines over cache */
+    u64 limit;                  /* max objects in use, 0 for no limit */
+    u64 inuse;
+    u64 hwm;
+    u64 failed;
+} *net_pool;
+
+static struct net_pool net_pools[] = {
+    { "pbuf", MEMP_PBUF },
+    { "pbuf_pool", MEMP_PBUF_POOL },
+    { "tcp_pcb", MEMP_TCP_PCB },
+    { "tcp_pcb_listen", MEMP_TCP_PCB_LISTEN },
+    { "tcp_seg", MEMP_TCP_SEG },
+    { "udp_pcb", MEMP_UDP_PCB },
+};
+
+#define NET_TX_BATCH_FLUSHES    8
+
+static struct net_tx_batch {
+    int depth;
+    int nflushes;
+    thunk flushes[NET_TX_BATCH_FLUSHES];
+} net_tx_batches[MAX_CPUS];
 
 /* Pretty silly. LWIP offers lwip_cyclic_timers for use elsewhere, but
    says to use LWIP_ARRAYSIZE(), which isn't possible with an
@@ -26,7 +63,6 @@ struct net_lwip_timer {
 };
 
 static struct net_lwip_timer net_lwip_timers[] = {
-    {TCP_TMR_INTERVAL, tcp_tmr, "tcp"},
     {IP_TMR_INTERVAL, ip_reass_tmr, "ip"},
     {ARP_TMR_INTERVAL, etharp_tmr, "arp"},
     {DHCP_COARSE_TIMER_MSECS, dhcp_coarse_tmr, "dhcp coarse"},
@@ -37,6 +73,23 @@ static struct net_lwip_timer net_lwip_timers[] = {
     {DHCP6_TIMER_MSECS, dhcp6_tmr, "dhcp6"},
 };
 
+#ifdef CONFIG_FTRACE
+/* lwIP has no hook on retransmission, so retransmitted segments are traced
+   from the MIB2 counter whenever a timer has run; fast retransmits show up
+   at the next tick */
+static void net_trace_retransmits(void)
+{
+    static u32 last_retrans;
+    u32 total = lwip_stats.mib2.tcpretranssegs;
+    if (total != last_retrans) {
+        tracepoint(tcp_retransmit, total - last_retrans, total, 0);
+        last_retrans = total;
+    }
+}
+#else
+#define net_trace_retransmits()
+#endif
+
 closure_function(2, 1, void, dispatch_lwip_timer,
                  lwip_cyclic_timer_handler, handler, const char *, name,
                  u64, overruns /* ignored */)
@@ -45,6 +98,189 @@ closure_function(2, 1, void, dispatch_lwip_timer,
     lwip_debug("dispatching timer for %s\n", bound(name));
 #endif
     bound(handler)();
+    net_trace_retransmits();
+}
+
+void net_tx_batch_begin(void)
+{
+    net_tx_batches[current_cpu()->id].depth++;
+}
+
+void net_tx_batch_end(void)
+{
+    struct net_tx_batch *b = &net_tx_batches[current_cpu()->id];
+    assert(b->depth > 0);
+    if (--b->depth > 0)
+        return;
+    for (int i = 0; i < b->nflushes; i++)
+        apply(b->flushes[i]);
+    b->nflushes = 0;
+}
+
+boolean net_tx_defer(thunk flush)
+{
+    struct net_tx_batch *b = &net_tx_batches[current_cpu()->id];
+    if (b->depth == 0)
+        return false;
+    for (int i = 0; i < b->nflushes; i++) {
+        if (b->flushes[i] == flush)
+            return true;
+    }
+    if (b->nflushes == NET_TX_BATCH_FLUSHES)
+        return false;
+    b->flushes[b->nflushes++] = flush;
+    return true;
+}
+
+/* as in Linux net_dim, for completion-based moderation */
+const struct net_dim_profile net_dim_profiles[NET_DIM_PROFILES] = {
+    {1, 256}, {8, 128}, {64, 64}, {128, 256}, {256, 256},
+};
+
+#define NET_DIM_IDLE_PPMS   10  /* below this, latency matters more */
+#define NET_DIM_PARK_LIMIT  8   /* periods parked before probing left */
+
+enum {
+    NET_DIM_WORSE, NET_DIM_SAME, NET_DIM_BETTER,
+};
+
+void net_dim_init(net_dim d)
+{
+    zero(d, sizeof(*d));
+    d->start = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+/* differences under 10% are noise */
+static boolean net_dim_differ(u32 a, u32 b)
+{
+    return 10 * (u64)(a > b ? a - b : b - a) > MAX(a, b);
+}
+
+/* Throughput decides, then packet rate; with both unchanged, fewer
+   interrupts is better. */
+static int net_dim_compare(net_dim d, u32 ppms, u32 bpms, u32 epms)
+{
+    if (net_dim_differ(bpms, d->bpms))
+        return bpms > d->bpms ? NET_DIM_BETTER : NET_DIM_WORSE;
+    if (net_dim_differ(ppms, d->ppms))
+        return ppms > d->ppms ? NET_DIM_BETTER : NET_DIM_WORSE;
+    if (net_dim_differ(epms, d->epms))
+        return epms < d->epms ? NET_DIM_BETTER : NET_DIM_WORSE;
+    return NET_DIM_SAME;
+}
+
+boolean net_dim_sample(net_dim d, u64 packets, u64 bytes)
+{
+    d->packets += packets;
+    d->bytes += bytes;
+    if (++d->events < NET_DIM_EVENTS)
+        return false;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    u64 us = usec_from_timestamp(t - d->start);
+    if (us == 0)
+        return false;
+    u32 ppms = d->packets * 1000 / us;
+    u32 bpms = d->bytes * 1000 / us;
+    u32 epms = (u64)d->events * 1000 / us;
+    u8 prev = d->profile;
+    if (ppms < NET_DIM_IDLE_PPMS) {
+        d->profile = 0;
+        d->step = 0;
+    } else {
+        switch (net_dim_compare(d, ppms, bpms, epms)) {
+        case NET_DIM_BETTER:
+            if (d->step == 0)
+                d->step = 1;
+            break;
+        case NET_DIM_WORSE:
+            d->step = d->step ? -d->step : -1;
+            break;
+        default:
+            if (d->step != 0 || ++d->parked < NET_DIM_PARK_LIMIT) {
+                d->step = 0;
+                break;
+            }
+            d->step = -1;
+            break;
+        }
+        int next = d->profile + d->step;
+        if (next < 0 || next >= NET_DIM_PROFILES) {
+            d->step = 0;
+            d->parked = 0;
+        } else {
+            d->profile = next;
+        }
+    }
+    if (d->profile != prev)
+        d->parked = 0;
+    d->ppms = ppms;
+    d->bpms = bpms;
+    d->epms = epms;
+    d->packets = d->bytes = 0;
+    d->events = 0;
+    d->start = t;
+    return d->profile != prev;
+}
+
+/* The TCP timer walks every PCB, so it runs only while there are PCBs
+   that need it: active and TIME_WAIT ones, and listeners, whose incoming
+   connections become active inside lwIP without passing through our code.
+   Code that connects or listens calls net_tcp_timer_needed(). lwIP calls
+   its own tcp_timer_needed() hook only with its built-in timers.
+
+   lwIP itself runs under the kernel lock, but the timer may be needed from
+   a cpu other than the one servicing it, so starting and stopping it is
+   serialized by its own lock. A PCB is linked before the timer is asked
+   for, so the handler either sees it or the timer is started anew. */
+static timer net_tcp_timer;
+static struct spinlock net_tcp_timer_lock;
+
+static boolean net_tcp_timer_idle(void)
+{
+    return !tcp_active_pcbs && !tcp_tw_pcbs && !tcp_listen_pcbs.listen_pcbs;
+}
+
+closure_function(0, 1, void, net_tcp_timer_handler,
+                 u64, overruns)
+{
+    tcp_tmr();
+    u64 flags = spin_lock_irq(&net_tcp_timer_lock);
+    if (net_tcp_timer && net_tcp_timer_idle()) {
+        remove_timer(net_tcp_timer, 0);
+        net_tcp_timer = 0;
+    }
+    spin_unlock_irq(&net_tcp_timer_lock, flags);
+}
+
+/* log2(usecs) histogram of the smoothed round trip time of established
+   connections; lwIP measures it in slow timer ticks, so sub-tick rtts land
+   in bucket 0 */
+void net_tcp_rtt_hist(u64 *buckets, int nbuckets)
+{
+    zero(buckets, nbuckets * sizeof(u64));
+    for (struct tcp_pcb *pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (pcb->state != ESTABLISHED)
+            continue;
+        u64 us = (u64)MAX(pcb->sa >> 3, 0) * TCP_SLOW_INTERVAL * THOUSAND;
+        buckets[us ? MIN(msb(us), nbuckets - 1) : 0]++;
+    }
+}
+KLIB_EXPORT(net_tcp_rtt_hist);
+
+void net_tcp_timer_needed(void)
+{
+    u64 flags = spin_lock_irq(&net_tcp_timer_lock);
+    if (!net_tcp_timer) {
+        timestamp interval = milliseconds(TCP_TMR_INTERVAL);
+        net_tcp_timer = kern_register_timer_slack(CLOCK_ID_MONOTONIC_RAW, interval, false,
+                                                  interval, interval >> 4,
+                                                  closure(lwip_heap, net_tcp_timer_handler));
+        if (net_tcp_timer == INVALID_ADDRESS) {
+            msg_err("failed to register tcp timer\n");
+            net_tcp_timer = 0;
+        }
+    }
+    spin_unlock_irq(&net_tcp_timer_lock, flags);
 }
 
 void sys_timeouts_init(void)
@@ -53,8 +289,10 @@ void sys_timeouts_init(void)
     for (int i = 0; i < n; i++) {
         struct net_lwip_timer * t = (struct net_lwip_timer *)&net_lwip_timers[i];
         timestamp interval = milliseconds(t->interval_ms);
-        register_timer(runloop_timers, CLOCK_ID_MONOTONIC_RAW, interval, false, interval,
-                       closure(lwip_heap, dispatch_lwip_timer, t->handler, t->name));
+        /* periodic protocol timers tolerate a few percent of jitter */
+        kern_register_timer_slack(CLOCK_ID_MONOTONIC_RAW, interval, false, interval,
+                                  interval >> 4,
+                                  closure(lwip_heap, dispatch_lwip_timer, t->handler, t->name));
 #ifdef LWIP_DEBUG
         lwip_debug("registered %s timer with period of %ld ms\n", t->name, t->interval_ms);
 #endif
@@ -68,6 +306,51 @@ void lwip_debug(char * format, ...)
     log_vprintf("LWIP", format, &a);
 }
 
+static net_pool net_pool_by_type[MEMP_MAX];
+
+static void *net_pool_alloc(net_pool p)
+{
+    u64 n = fetch_and_add(&p->inuse, 1) + 1;
+    if (p->limit && n > p->limit) {
+        fetch_and_add(&p->inuse, -1);
+        fetch_and_add(&p->failed, 1);
+        return 0;
+    }
+    /* sampled, so an unsynchronized update will do */
+    if (n > p->hwm)
+        p->hwm = n;
+    void *x = allocate(p->h, p->objsize);
+    if (x == INVALID_ADDRESS) {
+        fetch_and_add(&p->inuse, -1);
+        fetch_and_add(&p->failed, 1);
+        return 0;
+    }
+    zero(x, p->objsize);
+    return x;
+}
+
+void *__real_memp_malloc(memp_t type);
+void __real_memp_free(memp_t type, void *mem);
+
+void *__wrap_memp_malloc(memp_t type)
+{
+    net_pool np = net_pool_by_type[type];
+    return np ? net_pool_alloc(np) : __real_memp_malloc(type);
+}
+
+void __wrap_memp_free(memp_t type, void *mem)
+{
+    net_pool np = net_pool_by_type[type];
+    if (!np) {
+        __real_memp_free(type, mem);
+        return;
+    }
+    if (mem) {
+        deallocate(np->h, mem, np->objsize);
+        fetch_and_add(&np->inuse, -1);
+    }
+}
+
 void *lwip_allocate(u64 size)
 {
     /* To maintain the malloc/free interface with mcache, allocations must stay
@@ -83,14 +366,241 @@ void lwip_deallocate(void *x)
     deallocate(lwip_heap, x, -1ull);
 }
 
+void net_pool_stats(buffer b)
+{
+    for (int i = 0; i < _countof(net_pools); i++) {
+        net_pool p = &net_pools[i];
+        bprintf(b, "%s: objsize %ld inuse %ld hwm %ld limit %ld failed %ld\n",
+                p->name, p->objsize, p->inuse, p->hwm, p->limit, p->failed);
+    }
+}
+
+static void init_net_pools(heap h, heap backed)
+{
+    for (int i = 0; i < _countof(net_pools); i++) {
+        net_pool p = &net_pools[i];
+        p->objsize = pad(memp_pools[p->type]->size, 16);
+        p->cache = allocate_objcache(h, backed, p->objsize, PAGESIZE_2M);
+        assert(p->cache != INVALID_ADDRESS);
+        p->h = locking_magazine_wrapper(h, p->cache, 1, 0);
+        assert(p->h != INVALID_ADDRESS);
+        net_pool_by_type[p->type] = p;
+    }
+}
+
+/* Fast DHCP, enabled by the root option dhcp_fast: an interface configured
+   by DHCP first requests the address it was bound to in the previous boot,
+   as cached in the boot state sector of the boot disk, and retransmits on
+   a shortened schedule until the first IPv4 address is assigned. A NAK or
+   an unanswered request falls back to discovery. */
+#define DHCP_LEASE_MAGIC        "DHCP"
+#define DHCP_LEASE_CACHE_MAX    16
+#define DHCP_FAST_TICK_MSECS    (DHCP_FINE_TIMER_MSECS / 4)
+#define DHCP_FAST_TICKS         (10000 / DHCP_FAST_TICK_MSECS)
+
+typedef struct dhcp_lease_cache {
+    u8 magic[4];
+    u32 count;
+    struct dhcp_cached_lease {
+        u8 hwaddr[6];
+        u8 pad[2];
+        u32 addr;               /* network byte order */
+    } leases[DHCP_LEASE_CACHE_MAX];
+} __attribute__((packed)) *dhcp_lease_cache;
+
+declare_closure_struct(0, 1, void, dhcp_lease_cache_loaded,
+                       status, s);
+declare_closure_struct(0, 1, void, dhcp_fast_tick,
+                       u64, overruns);
+
+static struct {
+    boolean enabled;
+    boolean loaded;
+    u64 ticks;
+    closure_struct(dhcp_lease_cache_loaded, loaded_sh);
+    closure_struct(dhcp_fast_tick, tick);
+} dhcp_fast;
+
+static u8 dhcp_lease_sector[KLOG_BOOT_STATE_SIZE] __attribute__((aligned(KLOG_BOOT_STATE_SIZE)));
+
+build_assert(sizeof(struct dhcp_lease_cache) <= KLOG_BOOT_STATE_SIZE);
+
+/* set once any interface has an IPv4 address */
+static boolean net_ipv4_ready;
+
+static struct dhcp_cached_lease *dhcp_cached_lease(struct netif *n, boolean create)
+{
+    dhcp_lease_cache c = (dhcp_lease_cache)dhcp_lease_sector;
+    if (n->hwaddr_len != sizeof(c->leases[0].hwaddr))
+        return 0;
+    for (u32 i = 0; i < c->count; i++) {
+        if (!runtime_memcmp(c->leases[i].hwaddr, n->hwaddr, n->hwaddr_len))
+            return &c->leases[i];
+    }
+    if (!create)
+        return 0;
+    /* replace the oldest entry once full */
+    if (c->count == DHCP_LEASE_CACHE_MAX) {
+        runtime_memcpy(&c->leases[0], &c->leases[1],
+                       (DHCP_LEASE_CACHE_MAX - 1) * sizeof(c->leases[0]));
+        c->count--;
+    }
+    struct dhcp_cached_lease *l = &c->leases[c->count++];
+    runtime_memcpy(l->hwaddr, n->hwaddr, n->hwaddr_len);
+    l->addr = 0;
+    return l;
+}
+
+static void dhcp_lease_record(struct netif *n)
+{
+    if (!dhcp_fast.loaded || !dhcp_supplied_address(n))
+        return;
+    u32 addr = ip4_addr_get_u32(netif_ip4_addr(n));
+    struct dhcp_cached_lease *l = dhcp_cached_lease(n, true);
+    if (!l || l->addr == addr)
+        return;
+    l->addr = addr;
+    klog_boot_state_save(dhcp_lease_sector, ignore_status);
+}
+
+define_closure_function(0, 1, void, dhcp_lease_cache_loaded,
+                        status, s)
+{
+    dhcp_lease_cache c = (dhcp_lease_cache)dhcp_lease_sector;
+    if (!is_ok(s)) {
+        timm_dealloc(s);
+        return;
+    }
+    if (runtime_memcmp(c->magic, DHCP_LEASE_MAGIC, sizeof(c->magic)) ||
+        c->count > DHCP_LEASE_CACHE_MAX) {
+        zero(c, sizeof(dhcp_lease_sector));
+        runtime_memcpy(c->magic, DHCP_LEASE_MAGIC, sizeof(c->magic));
+    }
+    boot_milestone("dhcp lease cache loaded");
+    dhcp_fast.loaded = true;
+    struct netif *n;
+    for (int i = 1; (n = netif_get_by_index(i)); i++) {
+        struct dhcp *d = netif_dhcp_data(n);
+        if (!d || netif_is_loopback(n))
+            continue;
+        if (dhcp_supplied_address(n)) {
+            dhcp_lease_record(n);
+            continue;
+        }
+        struct dhcp_cached_lease *l = dhcp_cached_lease(n, false);
+        if (!l || !l->addr ||
+            (d->state != DHCP_STATE_INIT && d->state != DHCP_STATE_SELECTING))
+            continue;
+        ip4_addr_set_u32(&d->offered_ip_addr, l->addr);
+        d->state = DHCP_STATE_REBOOTING;
+        if (netif_is_link_up(n))
+            dhcp_network_changed(n);
+    }
+}
+
+/* extra fine timer ticks while no address is assigned */
+define_closure_function(0, 1, void, dhcp_fast_tick,
+                        u64, overruns /* ignored */)
+{
+    if (net_ipv4_ready || dhcp_fast.ticks-- == 0)
+        return;
+    dhcp_fine_tmr();
+    kern_register_timer(CLOCK_ID_MONOTONIC_RAW, milliseconds(DHCP_FAST_TICK_MSECS), false, 0,
+                        (timer_handler)&dhcp_fast.tick);
+}
+
+static void dhcp_fast_start(void)
+{
+    dhcp_fast.enabled = true;
+    dhcp_fast.ticks = DHCP_FAST_TICKS;
+    klog_boot_state_load(dhcp_lease_sector,
+                         init_closure(&dhcp_fast.loaded_sh, dhcp_lease_cache_loaded));
+    kern_register_timer(CLOCK_ID_MONOTONIC_RAW, milliseconds(DHCP_FAST_TICK_MSECS), false, 0,
+                        init_closure(&dhcp_fast.tick, dhcp_fast_tick));
+}
+
+/* After a VM resume the address lease may be held by another instance of
+   the same snapshot, and neighbors may have moved. */
+closure_function(0, 0, void, net_vm_resume)
+{
+    struct netif *n;
+    for (int i = 1; (n = netif_get_by_index(i)); i++) {
+        if (netif_is_loopback(n))
+            continue;
+        etharp_cleanup_netif(n);
+        if (dhcp_supplied_address(n))
+            dhcp_renew(n);
+        else if (!ip4_addr_isany(netif_ip4_addr(n)))
+            etharp_gratuitous(n);
+    }
+}
+
+/* Holding the program start for the network, root option network_wait */
+#define NETWORK_WAIT_DEFAULT_SECS   30
+
+declare_closure_struct(0, 1, void, network_wait_timeout,
+                       u64, overruns);
+
+static struct {
+    u64 timeout;                /* seconds, 0 if not waiting */
+    u32 pending;
+    thunk complete;
+    closure_struct(network_wait_timeout, timeout_handler);
+} network_wait;
+
+static boolean network_wait_release(void)
+{
+    if (!compare_and_swap_32(&network_wait.pending, 1, 0))
+        return false;
+    runqueue_push(network_wait.complete);
+    return true;
+}
+
+define_closure_function(0, 1, void, network_wait_timeout,
+                        u64, overruns /* ignored */)
+{
+    if (network_wait_release()) {
+        boot_milestone("network wait timed out");
+        rprintf("NET: no IPv4 address after %ld seconds; starting program\n",
+                network_wait.timeout);
+    }
+}
+
+void net_when_ready(thunk complete)
+{
+    if (!network_wait.timeout || net_ipv4_ready) {
+        apply(complete);
+        return;
+    }
+    network_wait.complete = complete;
+    write_barrier();
+    network_wait.pending = 1;
+    memory_barrier();
+    if (net_ipv4_ready) {
+        network_wait_release();
+        return;
+    }
+    kern_register_timer(CLOCK_ID_MONOTONIC_RAW, seconds(network_wait.timeout), false, 0,
+                        init_closure(&network_wait.timeout_handler, network_wait_timeout));
+}
+
 static void lwip_ext_callback(struct netif* netif, netif_nsc_reason_t reason,
                               const netif_ext_callback_args_t* args)
 {
     char ifname[4];
     netif_name_cpy(ifname, netif);
     if (reason & LWIP_NSC_IPV4_ADDRESS_CHANGED) {
+        boot_milestone("ipv4 address assigned");
         u8 *n = (u8 *)&netif->ip_addr;
         rprintf("%s: assigned %d.%d.%d.%d\n", ifname, n[0], n[1], n[2], n[3]);
+        if (!netif_is_loopback(netif) && !ip4_addr_isany(netif_ip4_addr(netif))) {
+            net_ipv4_ready = true;
+            memory_barrier();
+            if (network_wait_release())
+                boot_milestone("network ready");
+        }
+        if (dhcp_fast.enabled)
+            dhcp_lease_record(netif);
     }
     if ((reason & LWIP_NSC_IPV6_ADDR_STATE_CHANGED) &&
             (netif_ip6_addr_state(netif, args->ipv6_addr_state_changed.addr_index) & IP6_ADDR_VALID))
@@ -254,10 +764,141 @@ static boolean get_static_ip6_config(tuple t, struct netif *n, const char *ifnam
     return false;
 }
 
+/* Drivers attach before the root tuple is loaded; a handler registered here
+   receives the interface's config tuple once it is. */
+void netif_set_config_handler(struct netif *netif, netif_config_handler h)
+{
+    table_set(netif_config_handlers, netif, h);
+}
+
+static void net_snmp_proto(buffer b, const char *name, struct stats_proto *p)
+{
+    bprintf(b, "%s: Xmit Recv Fw Drop ChkErr LenErr MemErr RtErr ProtErr OptErr Err\n", name);
+    bprintf(b, "%s: %d %d %d %d %d %d %d %d %d %d %d\n", name, p->xmit, p->recv, p->fw,
+            p->drop, p->chkerr, p->lenerr, p->memerr, p->rterr, p->proterr, p->opterr, p->err);
+}
+
+/* MIB-II counters in the layout of Linux /proc/net/snmp, followed by lwIP's
+   own per-protocol counters */
+void net_snmp(buffer b)
+{
+    struct stats_mib2 *m = &lwip_stats.mib2;
+    bprintf(b, "Ip: Forwarding DefaultTTL InReceives InHdrErrors InAddrErrors ForwDatagrams "
+            "InUnknownProtos InDiscards InDelivers OutRequests OutDiscards OutNoRoutes "
+            "ReasmReqds ReasmOKs ReasmFails FragOKs FragFails FragCreates\n");
+    bprintf(b, "Ip: %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d\n",
+            IP_FORWARD ? 1 : 2, IP_DEFAULT_TTL, m->ipinreceives, m->ipinhdrerrors,
+            m->ipinaddrerrors, m->ipforwdatagrams, m->ipinunknownprotos, m->ipindiscards,
+            m->ipindelivers, m->ipoutrequests, m->ipoutdiscards, m->ipoutnoroutes,
+            m->ipreasmreqds, m->ipreasmoks, m->ipreasmfails, m->ipfragoks, m->ipfragfails,
+            m->ipfragcreates);
+    bprintf(b, "Tcp: ActiveOpens PassiveOpens AttemptFails EstabResets InSegs OutSegs "
+            "RetransSegs InErrs OutRsts InCsumErrors\n");
+    bprintf(b, "Tcp: %d %d %d %d %d %d %d %d %d %d\n", m->tcpactiveopens, m->tcppassiveopens,
+            m->tcpattemptfails, m->tcpestabresets, m->tcpinsegs, m->tcpoutsegs,
+            m->tcpretranssegs, m->tcpinerrs, m->tcpoutrsts, lwip_stats.tcp.chkerr);
+    bprintf(b, "Udp: InDatagrams NoPorts InErrors OutDatagrams InCsumErrors MemErrors\n");
+    bprintf(b, "Udp: %d %d %d %d %d %d\n", m->udpindatagrams, m->udpnoports, m->udpinerrors,
+            m->udpoutdatagrams, lwip_stats.udp.chkerr, lwip_stats.udp.memerr);
+    net_snmp_proto(b, "Link", &lwip_stats.link);
+    net_snmp_proto(b, "IpLwip", &lwip_stats.ip);
+    net_snmp_proto(b, "TcpLwip", &lwip_stats.tcp);
+    net_snmp_proto(b, "UdpLwip", &lwip_stats.udp);
+}
+
+closure_function(2, 0, value, net_get_counter,
+                 STAT_COUNTER *, c, value, v)
+{
+    return value_rewrite_u64(bound(v), *bound(c));
+}
+
+#define register_counter(h, n, t, name, counter)                            \
+    v = value_from_u64(h, 0);                                               \
+    a = sym(name);                                                          \
+    set(t, a, v);                                                           \
+    tuple_notifier_register_get_notify(n, a, closure(h, net_get_counter, &(counter), v));
+
+static tuple_notifier net_proto_tuple(heap h, struct stats_proto *p, tuple t)
+{
+    value v;
+    symbol a;
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    register_counter(h, n, t, xmit, p->xmit);
+    register_counter(h, n, t, recv, p->recv);
+    register_counter(h, n, t, drop, p->drop);
+    register_counter(h, n, t, chkerr, p->chkerr);
+    register_counter(h, n, t, lenerr, p->lenerr);
+    register_counter(h, n, t, memerr, p->memerr);
+    register_counter(h, n, t, err, p->err);
+    set(t, sym(no_encode), null_value);
+    return n;
+}
+
+/* /net: per-protocol counters under /net/<link|ip|tcp|udp> */
+void init_net_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    struct stats_mib2 *m = &lwip_stats.mib2;
+    tuple_notifier n;
+    value v;
+    symbol a;
+    tuple net = allocate_tuple();
+    assert(net);
+
+    tuple t = allocate_tuple();
+    assert(t);
+    set(net, sym(link), net_proto_tuple(h, &lwip_stats.link, t));
+
+    t = allocate_tuple();
+    assert(t);
+    n = net_proto_tuple(h, &lwip_stats.ip, t);
+    register_counter(h, n, t, in_discards, m->ipindiscards);
+    register_counter(h, n, t, in_hdr_errors, m->ipinhdrerrors);
+    register_counter(h, n, t, out_no_routes, m->ipoutnoroutes);
+    set(net, sym(ip), n);
+
+    t = allocate_tuple();
+    assert(t);
+    n = net_proto_tuple(h, &lwip_stats.tcp, t);
+    register_counter(h, n, t, in_segs, m->tcpinsegs);
+    register_counter(h, n, t, out_segs, m->tcpoutsegs);
+    register_counter(h, n, t, retrans_segs, m->tcpretranssegs);
+    register_counter(h, n, t, active_opens, m->tcpactiveopens);
+    register_counter(h, n, t, passive_opens, m->tcppassiveopens);
+    register_counter(h, n, t, estab_resets, m->tcpestabresets);
+    register_counter(h, n, t, out_rsts, m->tcpoutrsts);
+    set(net, sym(tcp), n);
+
+    t = allocate_tuple();
+    assert(t);
+    n = net_proto_tuple(h, &lwip_stats.udp, t);
+    register_counter(h, n, t, no_ports, m->udpnoports);
+    register_counter(h, n, t, in_errors, m->udpinerrors);
+    set(net, sym(udp), n);
+
+    set(net, sym(no_encode), null_value);
+    set(root, sym(net), net);
+}
+
 void init_network_iface(tuple root) {
     struct netif *n;
     struct netif *default_iface = 0;
     boolean trace = get(root, sym(trace)) != 0;
+    boolean fast = get(root, sym(dhcp_fast)) != 0;
+    boolean dhcp_started = false;
+
+    if (get(root, sym(network_wait))) {
+        if (!get_u64(root, sym(network_wait), &network_wait.timeout) || !network_wait.timeout)
+            network_wait.timeout = NETWORK_WAIT_DEFAULT_SECS;
+    }
+
+    /* per-pool object limits, e.g. lwip_pools:(tcp_pcb:65536) */
+    tuple pools = get_tuple(root, sym(lwip_pools));
+    if (pools) {
+        for (int i = 0; i < _countof(net_pools); i++)
+            get_u64(pools, sym_this(net_pools[i].name), &net_pools[i].limit);
+    }
 
     /* NETIF_FOREACH traverses interfaces in reverse order...so go by index */
     for (int i = 1; (n = netif_get_by_index(i)); i++) {
@@ -292,6 +933,10 @@ void init_network_iface(tuple root) {
                 rprintf("NET: setting interface %s as default\n", ifname);
                 default_iface = n;
             }
+
+            netif_config_handler ch = table_find(netif_config_handlers, n);
+            if (ch)
+                apply(ch, t);
         }
 
         n->output_ip6 = ethip6_output;
@@ -304,6 +949,7 @@ void init_network_iface(tuple root) {
             if (trace)
                 rprintf("NET: starting DHCP for interface %s\n", ifname);
             dhcp_start(n);
+            dhcp_started = true;
         }
         if (!t || !get_static_ip6_config(t, n, ifname, trace)) {
             if (trace)
@@ -317,6 +963,11 @@ void init_network_iface(tuple root) {
     } else {
         rprintf("NET: no network interface found\n");
     }
+    if (dhcp_started) {
+        boot_milestone("dhcp started");
+        if (fast)
+            dhcp_fast_start();
+    }
 }
 
 extern void lwip_init();
@@ -326,7 +977,12 @@ void init_net(kernel_heaps kh)
     heap h = heap_general(kh);
     heap backed = heap_backed(kh);
     lwip_heap = allocate_mcache(h, backed, 5, MAX_LWIP_ALLOC_ORDER, PAGESIZE_2M);
+    init_net_pools(h, backed);
+    spin_lock_init(&net_tcp_timer_lock);
+    netif_config_handlers = allocate_table(h, identity_key, pointer_equal);
+    assert(netif_config_handlers != INVALID_ADDRESS);
     lwip_init();
+    register_vm_resume_notify(closure(h, net_vm_resume));
     NETIF_DECLARE_EXT_CALLBACK(netif_callback);
     netif_add_ext_callback(&netif_callback, lwip_ext_callback);
 }
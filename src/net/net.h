@@ -3,4 +3,63 @@
 
 void init_net(kernel_heaps kh);
 void init_network_iface(tuple root);
+
+/* Runs complete once an interface has an IPv4 address if the root option
+   network_wait is set, else right away. A numeric network_wait is the
+   timeout in seconds, after which complete runs regardless. */
+void net_when_ready(thunk complete);
 status listen_port(heap h, u16 port, connection_handler c);
+
+/* starts the lwIP TCP timer, which stops itself once no PCB needs it */
+void net_tcp_timer_needed(void);
+void net_tcp_rtt_hist(u64 *buckets, int nbuckets);
+
+/* one line per dedicated lwIP memory pool: size, usage and high-water mark */
+void net_pool_stats(buffer b);
+
+/* /proc/net/snmp contents */
+void net_snmp(buffer b);
+void init_net_management(tuple root);
+
+/* Transmit batching: while a batch is open on the current cpu, a driver may
+   queue frames without notifying the device, provided net_tx_defer()
+   accepts its flush thunk; each such thunk runs once when the batch ends. */
+void net_tx_batch_begin(void);
+void net_tx_batch_end(void);
+boolean net_tx_defer(thunk flush);
+
+/* Dynamic interrupt moderation. A driver reports the packets and bytes each
+   interrupt of a queue has handled; every NET_DIM_EVENTS interrupts, the
+   rates over the period are compared with the previous period's and the
+   queue steps along a ladder of moderation profiles, toward longer delays
+   while that raises throughput or cuts interrupts for the same traffic,
+   back when it does not. Light traffic takes the lowest-latency profile. */
+#define NET_DIM_EVENTS      64
+#define NET_DIM_PROFILES    5
+
+struct net_dim_profile {
+    u16 usecs;                  /* interrupt delay */
+    u16 packets;                /* or as many completions, if sooner */
+};
+
+typedef struct net_dim {
+    timestamp start;
+    u64 packets, bytes;
+    u32 events;
+    u32 ppms, bpms, epms;       /* rates of the previous period, per ms */
+    u8 profile;
+    s8 step;                    /* direction, or 0 while parked */
+    u8 parked;                  /* periods without a change */
+} *net_dim;
+
+extern const struct net_dim_profile net_dim_profiles[NET_DIM_PROFILES];
+
+void net_dim_init(net_dim d);
+
+/* returns true if the queue should move to another profile */
+boolean net_dim_sample(net_dim d, u64 packets, u64 bytes);
+
+static inline const struct net_dim_profile *net_dim_profile(net_dim d)
+{
+    return &net_dim_profiles[d->profile];
+}
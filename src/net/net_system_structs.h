@@ -38,13 +38,17 @@ enum protocol_type {
 
 #define MSG_OOB         0x00000001
 #define MSG_DONTROUTE   0x00000004
+#define MSG_CTRUNC      0x00000008
 #define MSG_PROBE       0x00000010
 #define MSG_TRUNC       0x00000020
 #define MSG_DONTWAIT    0x00000040
 #define MSG_EOR         0x00000080
 #define MSG_CONFIRM     0x00000800
+#define MSG_ERRQUEUE    0x00002000
 #define MSG_NOSIGNAL    0x00004000
 #define MSG_MORE        0x00008000
+#define MSG_WAITFORONE  0x00010000
+#define MSG_ZEROCOPY    0x04000000
 
 // tuplify
 #define SOCK_NONBLOCK 00004000
@@ -76,6 +80,25 @@ enum protocol_type {
 #define TCP_CC_INFO		26	/* Get Congestion Control (optional) info */
 #define TCP_SAVE_SYN		27	/* Record SYN headers for new connections */
 #define TCP_SAVED_SYN		28	/* Get SYN headers recorded for connection */
+#define TCP_ULP			31	/* Attach a ULP to a TCP connection */
+
+#define UDP_SEGMENT		103	/* Set GSO segmentation size */
+#define UDP_GRO			104	/* This socket can receive UDP GRO packets */
+
+#define SOL_TLS         282
+
+/* SOL_TLS options */
+#define TLS_TX                  1
+#define TLS_RX                  2
+
+/* SOL_TLS control message types */
+#define TLS_SET_RECORD_TYPE     1
+
+#define TLS_1_2_VERSION         0x0303
+#define TLS_1_3_VERSION         0x0304
+
+#define TLS_CIPHER_AES_GCM_128  51
+#define TLS_CIPHER_AES_GCM_256  52
 
 #define SHUT_RD   0
 #define SHUT_WR   1
@@ -8,7 +8,9 @@
 #include <unix_internal.h>
 #include <lwip.h>
 #include <lwip/udp.h>
+#include <lwip/priv/tcp_priv.h>
 #include <net_system_structs.h>
+#include <ktls.h>
 #include <socket.h>
 
 //#define NETSYSCALL_DEBUG
@@ -94,6 +96,113 @@ struct linger {
     int l_linger;
 };
 
+#define TCPI_OPT_TIMESTAMPS     1
+#define TCPI_OPT_SACK           2
+#define TCPI_OPT_WSCALE         4
+
+struct tcp_info {
+    u8 tcpi_state;
+    u8 tcpi_ca_state;
+    u8 tcpi_retransmits;
+    u8 tcpi_probes;
+    u8 tcpi_backoff;
+    u8 tcpi_options;
+    u8 tcpi_snd_wscale : 4, tcpi_rcv_wscale : 4;
+    u8 tcpi_delivery_rate_app_limited : 1, tcpi_fastopen_client_fail : 2;
+
+    u32 tcpi_rto;
+    u32 tcpi_ato;
+    u32 tcpi_snd_mss;
+    u32 tcpi_rcv_mss;
+
+    u32 tcpi_unacked;
+    u32 tcpi_sacked;
+    u32 tcpi_lost;
+    u32 tcpi_retrans;
+    u32 tcpi_fackets;
+
+    u32 tcpi_last_data_sent;
+    u32 tcpi_last_ack_sent;
+    u32 tcpi_last_data_recv;
+    u32 tcpi_last_ack_recv;
+
+    u32 tcpi_pmtu;
+    u32 tcpi_rcv_ssthresh;
+    u32 tcpi_rtt;
+    u32 tcpi_rttvar;
+    u32 tcpi_snd_ssthresh;
+    u32 tcpi_snd_cwnd;
+    u32 tcpi_advmss;
+    u32 tcpi_reordering;
+
+    u32 tcpi_rcv_rtt;
+    u32 tcpi_rcv_space;
+
+    u32 tcpi_total_retrans;
+
+    u64 tcpi_pacing_rate;
+    u64 tcpi_max_pacing_rate;
+    u64 tcpi_bytes_acked;
+    u64 tcpi_bytes_received;
+    u32 tcpi_segs_out;
+    u32 tcpi_segs_in;
+
+    u32 tcpi_notsent_bytes;
+    u32 tcpi_min_rtt;
+    u32 tcpi_data_segs_in;
+    u32 tcpi_data_segs_out;
+
+    u64 tcpi_delivery_rate;
+
+    u64 tcpi_busy_time;
+    u64 tcpi_rwnd_limited;
+    u64 tcpi_sndbuf_limited;
+
+    u32 tcpi_delivered;
+    u32 tcpi_delivered_ce;
+
+    u64 tcpi_bytes_sent;
+    u64 tcpi_bytes_retrans;
+    u32 tcpi_dsack_dups;
+    u32 tcpi_reord_seen;
+
+    u32 tcpi_rcv_ooopack;
+
+    u32 tcpi_snd_wnd;
+};
+
+struct cmsghdr {
+    u64 cmsg_len;
+    int cmsg_level;
+    int cmsg_type;
+};
+
+struct sock_extended_err {
+    u32 ee_errno;
+    u8 ee_origin;
+    u8 ee_type;
+    u8 ee_code;
+    u8 ee_pad;
+    u32 ee_info;
+    u32 ee_data;
+};
+
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+
+/* MSG_ZEROCOPY sends awaiting acknowledgment, per socket; further sends
+   fail with ENOBUFS until completions are reaped */
+#define ZEROCOPY_PENDING_MAX    64
+
+/* flags the pending entry of a send that fell back to copying */
+#define ZEROCOPY_PENDING_COPIED U64_FROM_BIT(32)
+
+enum zerocopy_mode {
+    ZEROCOPY_NONE = 0,
+    ZEROCOPY_USER,      /* tcp_write() references the pinned user buffer */
+    ZEROCOPY_COPIED,    /* data copied, but completion is still reported */
+};
+
 // xxx - what is the difference between IN_CONNECTION and open
 // nothing seems to track whether the tcp state is actually
 // connected
@@ -120,25 +229,105 @@ typedef struct netsock {
     queue incoming;
     err_t lwip_error;           /* lwIP error code; ERR_OK if normal */
     u8 ipv6only:1;
+    u8 zerocopy:1;              /* SO_ZEROCOPY */
+    u8 reuseport:1;             /* SO_REUSEPORT */
     union {
 	struct {
 	    struct tcp_pcb *lw;
 	    enum tcp_socket_state state; // half open?
+	    /* MSG_ZEROCOPY sends not yet acknowledged, as the sequence
+	       number following each, in the order they were written */
+	    queue zc_pending;
+	    u32 zc_next;            /* id of the next MSG_ZEROCOPY send */
+	    u32 zc_lo, zc_hi;       /* completed ids not yet reported */
+	    boolean zc_ready;
+	    boolean zc_copied;
+	    struct netsock_txrefs *txrefs;
+	    ktls tls;               /* TCP_ULP "tls" */
+	    struct pbuf *rx_tail;   /* last pbuf put on incoming */
+	    struct netsock *lo_peer;    /* other end of a local connection */
+	    u32 lo_queued;          /* bytes put on incoming by lo_peer */
+	    /* SO_RCVBUF and SO_SNDBUF, as the pcb receive window and send
+	       buffer space; a reduction larger than what is free at the time
+	       is taken as data is consumed or acknowledged */
+	    u32 rcvbuf, sndbuf;
+	    u32 rcv_deficit, snd_deficit;
+	    boolean rcvbuf_lock;    /* set by the application; not auto-tuned */
+	    boolean sndbuf_lock;
+	    boolean rcv_pressure;   /* window was half used; grow if drained */
+	    boolean nodelay;        /* TCP_NODELAY */
+	    boolean cork;           /* TCP_CORK */
+	    struct netsock_reuseport *rp;
+	    u32 backlog;            /* accept queue limit when listening */
 	} tcp;
 	struct {
 	    struct udp_pcb *lw;
 	    enum udp_socket_state state;
+	    u16 gso_size;           /* UDP_SEGMENT */
+	    boolean gro;            /* UDP_GRO */
 	} udp;
     } info;
 } *netsock;
 
+/* Pages referenced by segments of scatter-gather writes (i.e. pagecache
+   pages from sendfile()) are held until the data is acknowledged. The list
+   is attached to the pcb, which can outlive the socket, so that what is
+   still held when lwIP frees the pcb is released then. */
+struct netsock_txref {
+    u32 seq;                    /* sequence number following the data */
+    refcount r;
+};
+
+typedef struct netsock_txrefs {
+    heap h;
+    netsock s;                  /* cleared when the socket is closed */
+    buffer b;                   /* struct netsock_txref, in sequence order */
+} *netsock_txrefs;
+
+static u8 netsock_txrefs_id;
+
+/* The user buffer of a MSG_ZEROCOPY send, pinned and referenced in place
+   at its kernel alias (see pin_user_pages()) until the pcb no longer holds
+   its data. */
+declare_closure_struct(1, 0, void, netsock_zcpin_free,
+                       struct netsock_zcpin *, zp);
+
+typedef struct netsock_zcpin {
+    struct refcount r;
+    heap h;
+    void *alias;
+    u64 len;
+    closure_struct(netsock_zcpin_free, free);
+} *netsock_zcpin;
+
+/* TCP sockets bound with SO_REUSEPORT to the same address and port form a
+   group sharing one pcb, as lwIP refuses duplicate listeners; each incoming
+   connection is handed to one listening member of the group. */
+typedef struct netsock_reuseport {
+    struct list l;              /* in netsock_reuseport_groups */
+    heap h;
+    int domain;
+    ip_addr_t addr;
+    u16 port;
+    struct tcp_pcb *lw;
+    boolean listening;
+    vector members;             /* netsock */
+} *netsock_reuseport;
+
+static struct list netsock_reuseport_groups;
+static u64 netsock_accept_cpus;     /* cpus that have received connections */
+
 static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
 static sysreturn netsock_listen(struct sock *sock, int backlog);
 static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
+static sysreturn netsock_connect_io(struct sock *sock, struct sockaddr *addr,
+        socklen_t addrlen, thread t, boolean bh, io_completion completion);
 static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
         socklen_t *addrlen, int flags);
+static sysreturn netsock_accept4_io(struct sock *sock, struct sockaddr *addr,
+        socklen_t *addrlen, int flags, thread t, boolean bh, io_completion completion);
 static sysreturn netsock_getsockname(struct sock *sock, struct sockaddr *addr, socklen_t *addrlen);
 static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
         int flags, struct sockaddr *dest_addr, socklen_t addrlen);
@@ -146,8 +335,14 @@ static sysreturn netsock_recvfrom(struct sock *sock, void *buf, u64 len,
         int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 static sysreturn netsock_sendmsg(struct sock *sock, const struct msghdr *msg,
                                  int flags);
+static sysreturn netsock_sendmsg_io(struct sock *sock, const struct msghdr *msg,
+                                    int flags, thread t, boolean bh,
+                                    io_completion completion);
 static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
                                  int flags);
+static sysreturn netsock_recvmsg_io(struct sock *sock, struct msghdr *msg,
+                                    int flags, thread t, boolean bh,
+                                    io_completion completion);
 
 static thunk net_loop_poll;
 static boolean net_loop_poll_queued;
@@ -174,6 +369,58 @@ static netsock get_netsock(struct sock *sock)
     return (netsock)sock;
 }
 
+/* the kTLS state of a socket with transmit keys installed, else 0 */
+static inline ktls netsock_tls_tx(netsock s)
+{
+    return (s->info.tcp.tls && ktls_tx_ready(s->info.tcp.tls)) ? s->info.tcp.tls : 0;
+}
+
+/* Data written on a connection between two sockets of this kernel is put
+   directly on the receive queue of the other end, in chunks far larger than
+   a segment, rather than going through lwIP and the loopback interface.
+   Neither pcb sees these bytes, so sequence numbers stay consistent; the
+   bypass is only taken while the writer has nothing queued in lwIP, which
+   keeps the byte stream (and a FIN after it) in order. The reader's receive
+   window, less what it has yet to read of such data, limits the writer. */
+#define NETSOCK_LOOPBACK_CHUNK  (32 * KB)
+
+static inline boolean netsock_tcp_can_receive(struct tcp_pcb *lw)
+{
+    return lw->state == ESTABLISHED || lw->state == FIN_WAIT_1 || lw->state == FIN_WAIT_2;
+}
+
+static boolean netsock_loopback_ready(netsock s)
+{
+    netsock peer = s->info.tcp.lo_peer;
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if (!peer || !lw || s->info.tcp.state != TCP_SOCK_OPEN ||
+        peer->info.tcp.state != TCP_SOCK_OPEN || !peer->info.tcp.lw)
+        return false;
+    return (lw->state == ESTABLISHED || lw->state == CLOSE_WAIT) && !lw->unsent &&
+        !lw->unacked && netsock_tcp_can_receive(peer->info.tcp.lw) &&
+        !peer->info.tcp.lw->refused_data;
+}
+
+static u64 netsock_loopback_space(netsock peer)
+{
+    u64 used = (u64)peer->info.tcp.lo_queued + peer->info.tcp.rcv_deficit;
+    u32 wnd = peer->info.tcp.lw->rcv_wnd;
+    return wnd > used ? wnd - used : 0;
+}
+
+/* On a kTLS socket, this is the plaintext that fits in records. */
+static u64 netsock_tx_avail(struct sock *sock)
+{
+    netsock s = (netsock)sock;
+    if (s->info.tcp.state != TCP_SOCK_OPEN)
+        return 0;
+    u64 avail = tcp_sndbuf(s->info.tcp.lw);
+    ktls k = netsock_tls_tx(s);
+    if (k)
+        return ktls_plaintext_avail(k, avail);
+    return netsock_loopback_ready(s) ? netsock_loopback_space(s->info.tcp.lo_peer) : avail;
+}
+
 closure_function(1, 1, u32, socket_events,
                  netsock, s,
                  thread, t /* ignore */)
@@ -188,8 +435,9 @@ closure_function(1, 1, u32, socket_events,
             return in ? EPOLLIN : 0;
         } else if (s->info.tcp.state == TCP_SOCK_OPEN) {
             return (in ? EPOLLIN | EPOLLRDNORM : 0) |
+                (s->info.tcp.zc_ready ? EPOLLERR : 0) |
                 (s->info.tcp.lw->state == ESTABLISHED ?
-                (tcp_sndbuf(s->info.tcp.lw) ? EPOLLOUT | EPOLLWRNORM : 0) :
+                (netsock_tx_avail(&s->sock) ? EPOLLOUT | EPOLLWRNORM : 0) :
                 EPOLLIN | EPOLLHUP);
         } else {
             return 0;
@@ -353,15 +601,247 @@ static inline void pbuf_consume(struct pbuf *p, u64 length)
     p->payload += length;
 }
 
+/* Socket buffer sizes; the defaults can be set in the manifest with
+   tcp_rcvbuf and tcp_sndbuf. The receive window can grow no larger than
+   TCP_WND, which window scaling lets lwIP advertise. */
+#define NETSOCK_BUF_MIN         (2 * TCP_MSS)
+#define NETSOCK_RCVBUF_DEFAULT  (4 * 65535)
+#define NETSOCK_SNDBUF_DEFAULT  65535
+#define NETSOCK_RCVBUF_MAX      TCP_WND
+#define NETSOCK_SNDBUF_MAX      TCP_SND_BUF
+
+static u32 netsock_rcvbuf_default = NETSOCK_RCVBUF_DEFAULT;
+static u32 netsock_sndbuf_default = NETSOCK_SNDBUF_DEFAULT;
+
+/* tcp_recved() takes a 16-bit length */
+static void netsock_rcv_wnd_open(struct tcp_pcb *lw, u32 len)
+{
+    while (len > 0) {
+        u16 n = MIN(len, 0xffff);
+        tcp_recved(lw, n);
+        len -= n;
+    }
+}
+
+static void netsock_set_rcvbuf(netsock s, u64 size)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    size = MAX(MIN(size, NETSOCK_RCVBUF_MAX), NETSOCK_BUF_MIN);
+    /* until established, the size is only recorded */
+    if (lw && s->info.tcp.state == TCP_SOCK_OPEN) {
+        /* the peer did not take a scaled window */
+        if (!(lw->flags & TF_WND_SCALE))
+            size = MIN(size, 0xffff);
+        if (size > s->info.tcp.rcvbuf) {
+            u32 grow = size - s->info.tcp.rcvbuf;
+            u32 d = MIN(grow, s->info.tcp.rcv_deficit);
+            s->info.tcp.rcv_deficit -= d;
+            netsock_rcv_wnd_open(lw, grow - d);
+        } else {
+            /* the announced right edge is kept by lwIP */
+            u32 shrink = s->info.tcp.rcvbuf - size;
+            u32 d = MIN(shrink, lw->rcv_wnd);
+            lw->rcv_wnd -= d;
+            s->info.tcp.rcv_deficit += shrink - d;
+        }
+    }
+    s->info.tcp.rcvbuf = size;
+}
+
+static void netsock_set_sndbuf(netsock s, u64 size)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    size = MAX(MIN(size, NETSOCK_SNDBUF_MAX), NETSOCK_BUF_MIN);
+    if (lw && s->info.tcp.state == TCP_SOCK_OPEN) {
+        if (size > s->info.tcp.sndbuf) {
+            u32 grow = size - s->info.tcp.sndbuf;
+            u32 d = MIN(grow, s->info.tcp.snd_deficit);
+            s->info.tcp.snd_deficit -= d;
+            lw->snd_buf += grow - d;
+        } else {
+            u32 shrink = s->info.tcp.sndbuf - size;
+            u32 d = MIN(shrink, lw->snd_buf);
+            lw->snd_buf -= d;
+            s->info.tcp.snd_deficit += shrink - d;
+        }
+    }
+    s->info.tcp.sndbuf = size;
+}
+
+/* lwIP sizes the window when the connection is established, enlarging it
+   if scaling was negotiated; bring the pcb to the socket's sizes then. */
+static void netsock_tcp_established(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u32 rcvbuf = s->info.tcp.rcvbuf;
+    u32 sndbuf = s->info.tcp.sndbuf;
+    s->info.tcp.rcvbuf = lw->rcv_wnd;
+    s->info.tcp.sndbuf = lw->snd_buf;
+    s->info.tcp.rcv_deficit = s->info.tcp.snd_deficit = 0;
+    netsock_set_rcvbuf(s, rcvbuf);
+    netsock_set_sndbuf(s, sndbuf);
+}
+
+/* Return consumed data to the receive window, first settling any reduction
+   of SO_RCVBUF. If the application drains a window that was at least half
+   used, it is keeping up and the sender is limited by the window, so the
+   window doubles unless SO_RCVBUF was set explicitly. */
+static void netsock_tcp_recved(netsock s, u32 len)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u32 d = MIN(len, s->info.tcp.rcv_deficit);
+    s->info.tcp.rcv_deficit -= d;
+    if (lw)
+        netsock_rcv_wnd_open(lw, len - d);
+}
+
+static void netsock_rcvbuf_drained(netsock s)
+{
+    if (s->info.tcp.rcv_pressure && !s->info.tcp.rcvbuf_lock &&
+        s->info.tcp.rcvbuf < NETSOCK_RCVBUF_MAX)
+        netsock_set_rcvbuf(s, 2 * (u64)s->info.tcp.rcvbuf);
+    s->info.tcp.rcv_pressure = false;
+}
+
+/* On acknowledgment, settle any reduction of SO_SNDBUF and, unless it was
+   set explicitly, keep the send buffer at twice the congestion window. */
+static void netsock_tcp_acked(netsock s, struct tcp_pcb *lw)
+{
+    u32 d = MIN(lw->snd_buf, s->info.tcp.snd_deficit);
+    lw->snd_buf -= d;
+    s->info.tcp.snd_deficit -= d;
+    u64 want = 2 * (u64)lw->cwnd;
+    if (!s->info.tcp.sndbuf_lock && s->info.tcp.sndbuf < want &&
+        s->info.tcp.sndbuf < NETSOCK_SNDBUF_MAX)
+        netsock_set_sndbuf(s, want);
+}
+
+/* A chunk of data written through the loopback bypass, recognized by the
+   reader so that it is not returned to the lwIP receive window. */
+struct netsock_lo_pbuf {
+    struct pbuf_custom p;       /* must be first */
+    heap h;
+    u32 size;
+};
+
+static void netsock_lo_pbuf_free(struct pbuf *p)
+{
+    struct netsock_lo_pbuf *lp = (struct netsock_lo_pbuf *)p;
+    deallocate(lp->h, lp, sizeof(*lp) + lp->size);
+}
+
+static inline boolean netsock_is_lo_pbuf(struct pbuf *p)
+{
+    return (p->flags & PBUF_FLAG_IS_CUSTOM) &&
+        ((struct pbuf_custom *)p)->custom_free_function == netsock_lo_pbuf_free;
+}
+
+static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+
+/* Called on each end once the connection is established; the pair is
+   linked when the other end of the connection is found to be a socket here
+   too. An accepted pcb is only recognized once it has its own socket. */
+static void netsock_loopback_link(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    for (struct tcp_pcb *p = tcp_active_pcbs; p; p = p->next) {
+        if (p == lw || p->local_port != lw->remote_port || p->remote_port != lw->local_port ||
+            !ip_addr_cmp(&p->local_ip, &lw->remote_ip) ||
+            !ip_addr_cmp(&p->remote_ip, &lw->local_ip))
+            continue;
+        netsock peer = p->callback_arg;
+        if (p->recv != tcp_input_lower || !peer || peer->info.tcp.lw != p ||
+            peer->info.tcp.state != TCP_SOCK_OPEN || peer->info.tcp.lo_peer)
+            return;
+        net_debug("sock %d, peer sock %d\n", s->sock.fd, peer->sock.fd);
+        s->info.tcp.lo_peer = peer;
+        peer->info.tcp.lo_peer = s;
+        return;
+    }
+}
+
+static void netsock_loopback_unlink(netsock s)
+{
+    netsock peer = s->info.tcp.lo_peer;
+    if (!peer)
+        return;
+    s->info.tcp.lo_peer = 0;
+    peer->info.tcp.lo_peer = 0;
+    /* a writer waiting for the reader now goes through lwIP */
+    wakeup_sock(peer, WAKEUP_SOCK_TX);
+}
+
+/* Put up to n bytes of buf on the peer's receive queue, as far as its
+   window and queue allow; returns the length queued. */
+static u64 netsock_loopback_write(netsock s, void *buf, u64 n)
+{
+    netsock peer = s->info.tcp.lo_peer;
+    u64 written = 0;
+    n = MIN(n, netsock_loopback_space(peer));
+    while (written < n && !queue_full(peer->incoming)) {
+        u32 len = MIN(n - written, NETSOCK_LOOPBACK_CHUNK);
+        struct netsock_lo_pbuf *lp = allocate(peer->sock.h, sizeof(*lp) + len);
+        if (lp == INVALID_ADDRESS)
+            break;
+        lp->h = peer->sock.h;
+        lp->size = len;
+        lp->p.custom_free_function = netsock_lo_pbuf_free;
+        struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &lp->p, lp + 1, len);
+        runtime_memcpy(p->payload, buf + written, len);
+        assert(enqueue(peer->incoming, p));
+        peer->info.tcp.rx_tail = p;
+        written += len;
+    }
+    if (written > 0) {
+        peer->info.tcp.lo_queued += written;
+        tracepoint(tcp_recv, peer->sock.fd, written, 0);
+        wakeup_sock(peer, WAKEUP_SOCK_RX);
+    }
+    return written;
+}
+
 struct udp_entry {
     struct pbuf * pbuf;
     ip_addr_t raddr;
     u16 rport;
 };
 
+#define NETSOCK_UDP_MAX_SEGMENTS    64  /* UDP_MAX_SEGMENTS in Linux */
+
+/* UDP_GRO: appends the queued datagrams that follow one of size seg from the
+   same sender, as long as they fit and are no larger; a smaller one ends the
+   train. */
+static u64 netsock_udp_gro(netsock s, ip_addr_t *raddr, u16 rport, u64 seg,
+                           void *dest, u64 length, int *segs)
+{
+    u64 xfer = 0;
+    struct udp_entry *e;
+    while (*segs < NETSOCK_UDP_MAX_SEGMENTS &&
+           (e = queue_peek(s->incoming)) != INVALID_ADDRESS) {
+        u64 len = e->pbuf->tot_len;
+        if (len == 0 || len > seg || len > length || e->rport != rport ||
+            !ip_addr_cmp(&e->raddr, raddr))
+            break;
+        pbuf_copy_partial(e->pbuf, dest, len, 0);
+        assert(dequeue(s->incoming) == e);
+        pbuf_free(e->pbuf);
+        deallocate(s->sock.h, e, sizeof(struct udp_entry));
+        dest += len;
+        length -= len;
+        xfer += len;
+        (*segs)++;
+        if (len < seg)
+            break;
+    }
+    return xfer;
+}
+
+/* If gro_seg is given, UDP_GRO may coalesce datagrams, and their segment
+   size is returned there. */
 static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                                        u64 length, struct sockaddr * src_addr,
-                                       socklen_t * addrlen, io_completion completion, u64 flags)
+                                       socklen_t * addrlen, u16 *gro_seg,
+                                       io_completion completion, u64 flags)
 {
     /* called with corresponding blockq lock held */
     sysreturn rv = 0;
@@ -413,6 +893,13 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
     }
 
     u64 xfer_total = 0;
+    boolean gro = gro_seg && s->sock.type == SOCK_DGRAM && s->info.udp.gro;
+    struct udp_entry first;
+    u64 first_len = 0;
+    if (gro) {
+        first = *(struct udp_entry *)p;
+        first_len = first.pbuf->tot_len;
+    }
 
     /* TCP: consume multiple buffers to fill request, if available. */
     do {
@@ -428,8 +915,12 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                 length -= xfer;
                 xfer_total += xfer;
                 dest = (char *) dest + xfer;
-                if (s->sock.type == SOCK_STREAM)
-                    tcp_recved(s->info.tcp.lw, xfer);
+                if (s->sock.type == SOCK_STREAM) {
+                    if (netsock_is_lo_pbuf(cur_buf))
+                        s->info.tcp.lo_queued -= xfer;
+                    else
+                        netsock_tcp_recved(s, xfer);
+                }
             }
             if (cur_buf->len == 0)
                 cur_buf = cur_buf->next;
@@ -441,11 +932,28 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                 deallocate(s->sock.h, p, sizeof(struct udp_entry));
             pbuf_free(pbuf);
             p = queue_peek(s->incoming);
-            if (p == INVALID_ADDRESS)
+            if (p == INVALID_ADDRESS) {
                 fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLIN condition */
+                if (s->sock.type == SOCK_STREAM)
+                    netsock_rcvbuf_drained(s);
+            }
         }
     } while(s->sock.type == SOCK_STREAM && length > 0 && p != INVALID_ADDRESS); /* XXX simplify expression */
 
+    /* the writer of a local connection is limited by what is left unread */
+    if (s->sock.type == SOCK_STREAM && s->info.tcp.lo_peer)
+        wakeup_sock(s->info.tcp.lo_peer, WAKEUP_SOCK_TX);
+
+    if (gro && xfer_total == first_len && p != INVALID_ADDRESS) {
+        int segs = 1;
+        xfer_total += netsock_udp_gro(s, &first.raddr, first.rport, first_len, dest, length,
+                                      &segs);
+        if (segs > 1)
+            *gro_seg = first_len;
+        if (queue_empty(s->incoming))
+            fdesc_notify_events(&s->sock.f);
+    }
+
     rv = xfer_total;
   out:
     net_debug("   completion %p, rv %ld\n", completion, rv);
@@ -457,14 +965,15 @@ closure_function(7, 1, sysreturn, sock_read_bh,
                  netsock, s, thread, t, void *, dest, u64, length, struct sockaddr *, src_addr, socklen_t *, addrlen, io_completion, completion,
                  u64, flags)
 {
-    sysreturn rv = sock_read_bh_internal(bound(s), bound(t), bound(dest), bound(length), bound(src_addr), bound(addrlen), bound(completion), flags);
+    sysreturn rv = sock_read_bh_internal(bound(s), bound(t), bound(dest), bound(length), bound(src_addr), bound(addrlen), 0, bound(completion), flags);
     if (rv != BLOCKQ_BLOCK_REQUIRED)
         closure_finish();
     return rv;
 }
 
 static void recvmsg_complete_internal(netsock s, struct msghdr * msg, void * dest, u64 length,
-                                      thread t, sysreturn rv)
+                                      u16 gro_seg, io_completion completion, thread t,
+                                      sysreturn rv)
 {
     s64 offset = 0;
     int iv = 0;
@@ -477,28 +986,52 @@ static void recvmsg_complete_internal(netsock s, struct msghdr * msg, void * des
         iv++;
     }
     deallocate(s->sock.h, dest, length);
-    msg->msg_controllen = 0;
     msg->msg_flags = 0;
-    apply(syscall_io_complete, t, rv);
+    if (rv > 0 && gro_seg) {
+        struct {
+            struct cmsghdr hdr;
+            int gso_size;
+        } cm;
+        zero(&cm, sizeof(cm));
+        cm.hdr.cmsg_len = sizeof(cm.hdr) + sizeof(cm.gso_size);
+        cm.hdr.cmsg_level = IPPROTO_UDP;
+        cm.hdr.cmsg_type = UDP_GRO;
+        cm.gso_size = gro_seg;
+        if (msg->msg_control && msg->msg_controllen >= sizeof(cm)) {
+            runtime_memcpy(msg->msg_control, &cm, sizeof(cm));
+            msg->msg_controllen = sizeof(cm);
+        } else {
+            msg->msg_flags |= MSG_CTRUNC;
+            msg->msg_controllen = 0;
+        }
+    } else {
+        msg->msg_controllen = 0;
+    }
+    apply(completion, t, rv);
 }
 
-closure_function(4, 2, void, recvmsg_complete,
-                 netsock, s, struct msghdr *, msg, void *, dest, u64, length,
+closure_function(6, 2, void, recvmsg_complete,
+                 netsock, s, struct msghdr *, msg, void *, dest, u64, length, u16, gro_seg,
+                 io_completion, completion,
                  thread, t, sysreturn, rv)
 {
-    recvmsg_complete_internal(bound(s), bound(msg), bound(dest), bound(length), t, rv);
+    recvmsg_complete_internal(bound(s), bound(msg), bound(dest), bound(length), bound(gro_seg),
+                              bound(completion), t, rv);
     closure_finish();
 }
 
-closure_function(5, 1, sysreturn, recvmsg_bh,
+closure_function(6, 1, sysreturn, recvmsg_bh,
                  netsock, s, thread, t, void *, dest, u64, length, struct msghdr *, msg,
+                 io_completion, completion,
                  u64, flags)
 {
     io_completion completion = closure(bound(s)->sock.h, recvmsg_complete,
                                        bound(s), bound(msg), bound(dest),
-                                       bound(length));
+                                       bound(length), 0, bound(completion));
     sysreturn rv = sock_read_bh_internal(bound(s), bound(t), bound(dest), bound(length), bound(msg)->msg_name,
-                                         &bound(msg)->msg_namelen, completion, flags);
+                                         &bound(msg)->msg_namelen,
+                                         &closure_member(recvmsg_complete, completion, gro_seg),
+                                         completion, flags);
     if (rv != BLOCKQ_BLOCK_REQUIRED)
         closure_finish();
     return rv;
@@ -520,8 +1053,156 @@ closure_function(1, 6, sysreturn, socket_read,
     return blockq_check(s->sock.rxbq, t, ba, bh);
 }
 
+/* Zero-copy transmit leaves pbufs pointing at pinned user pages, which are
+   only physically contiguous within a page; drivers that can take those set
+   NETIF_FLAG_TX_PAGES. Loopback output copies the data anyway. */
+static boolean netsock_zerocopy_route(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    struct netif *n = ip_route(&lw->local_ip, &lw->remote_ip);
+    return n && ((n->flags & NETIF_FLAG_TX_PAGES) || netif_is_loopback(n));
+}
+
+/* Data up to seq is no longer referenced by the pcb once acknowledged and
+   no queued segment starts before it: lwIP only frees whole segments, and
+   retransmits one that was acknowledged in part whole. */
+static boolean netsock_tcp_released(struct tcp_pcb *lw, u32 seq)
+{
+    if ((s32)(lw->lastack - seq) < 0)
+        return false;
+    struct tcp_seg *seg = lw->unacked ? lw->unacked : lw->unsent;
+    return !seg || (s32)(lwip_ntohl(seg->tcphdr->seqno) - seq) >= 0;
+}
+
+/* release references to data the pcb no longer holds, or all of them
+   without a pcb */
+static void netsock_txrefs_release(netsock_txrefs tr, struct tcp_pcb *lw)
+{
+    while (buffer_length(tr->b) >= sizeof(struct netsock_txref)) {
+        struct netsock_txref *e = buffer_ref(tr->b, 0);
+        if (lw && !netsock_tcp_released(lw, e->seq))
+            break;
+        refcount_release(e->r);
+        buffer_consume(tr->b, sizeof(struct netsock_txref));
+    }
+}
+
+static void netsock_txrefs_destroyed(u8 id, void *data)
+{
+    netsock_txrefs tr = data;
+    netsock_txrefs_release(tr, 0);
+    if (tr->s)
+        tr->s->info.tcp.txrefs = 0;
+    deallocate_buffer(tr->b);
+    deallocate(tr->h, tr, sizeof(*tr));
+}
+
+static const struct tcp_ext_arg_callbacks netsock_txrefs_callbacks = {
+    .destroy = netsock_txrefs_destroyed,
+};
+
+define_closure_function(1, 0, void, netsock_zcpin_free,
+                        netsock_zcpin, zp)
+{
+    netsock_zcpin zp = bound(zp);
+    unpin_user_pages(zp->alias, zp->len);
+    deallocate(zp->h, zp, sizeof(*zp));
+}
+
+/* The caller holds the initial reference. Returns 0 if the buffer cannot be
+   pinned, e.g. because part of it was never touched or it maps a file. */
+static netsock_zcpin netsock_zcpin_alloc(netsock s, process p, void *buf, u64 len)
+{
+    netsock_zcpin zp = allocate(s->sock.h, sizeof(*zp));
+    if (zp == INVALID_ADDRESS)
+        return 0;
+    zp->alias = pin_user_pages(p, buf, len);
+    if (zp->alias == INVALID_ADDRESS) {
+        deallocate(s->sock.h, zp, sizeof(*zp));
+        return 0;
+    }
+    zp->h = s->sock.h;
+    zp->len = len;
+    init_refcount(&zp->r, 1, init_closure(&zp->free, netsock_zcpin_free, zp));
+    return zp;
+}
+
+/* make room to record one more reference ahead of a tcp_write() */
+static netsock_txrefs netsock_txrefs_reserve(netsock s)
+{
+    netsock_txrefs tr = s->info.tcp.txrefs;
+    if (!tr) {
+        tr = allocate(s->sock.h, sizeof(*tr));
+        if (tr == INVALID_ADDRESS)
+            return 0;
+        tr->b = allocate_buffer(s->sock.h, 16 * sizeof(struct netsock_txref));
+        if (tr->b == INVALID_ADDRESS) {
+            deallocate(s->sock.h, tr, sizeof(*tr));
+            return 0;
+        }
+        tr->h = s->sock.h;
+        tr->s = s;
+        tcp_ext_arg_set_callbacks(s->info.tcp.lw, netsock_txrefs_id, &netsock_txrefs_callbacks);
+        tcp_ext_arg_set(s->info.tcp.lw, netsock_txrefs_id, tr);
+        s->info.tcp.txrefs = tr;
+    }
+    return buffer_extend(tr->b, sizeof(struct netsock_txref)) ? tr : 0;
+}
+
+/* Move MSG_ZEROCOPY sends the pcb no longer holds (or all of them, once
+   the pcb is gone) to the range reported on the error queue. */
+static void netsock_zerocopy_complete(netsock s, boolean all)
+{
+    queue q = s->info.tcp.zc_pending;
+    void *p;
+    while ((p = queue_peek(q)) != INVALID_ADDRESS) {
+        u64 v = u64_from_pointer(p);
+        if (!all && !netsock_tcp_released(s->info.tcp.lw, (u32)v))
+            break;
+        u32 id = s->info.tcp.zc_next - queue_length(q);
+        dequeue_single(q);
+        if (!s->info.tcp.zc_ready) {
+            s->info.tcp.zc_lo = id;
+            s->info.tcp.zc_copied = false;
+            s->info.tcp.zc_ready = true;
+        }
+        s->info.tcp.zc_hi = id;
+        if (v & ZEROCOPY_PENDING_COPIED)
+            s->info.tcp.zc_copied = true;
+    }
+}
+
+/* Nagle stays on in lwIP while corked, so that the output lwIP does on its
+   own (on acknowledgments and timers) holds back a partial segment too. */
+static void netsock_tcp_nagle_update(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if (!lw || s->info.tcp.state == TCP_SOCK_LISTENING)
+        return;
+    if (s->info.tcp.nodelay && !s->info.tcp.cork)
+        tcp_nagle_disable(lw);
+    else
+        tcp_nagle_enable(lw);
+}
+
+/* With TCP_CORK or MSG_MORE, output is deferred until a full segment is
+   queued. */
+static err_t netsock_tcp_output(netsock s, boolean more)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if ((more || s->info.tcp.cork) && (u32)(lw->snd_lbb - lw->snd_nxt) < lw->mss)
+        return ERR_OK;
+    return tcp_output(lw);
+}
+
+static err_t netsock_tls_write(netsock s, void *buf, sg_list sg, u64 remain, boolean more,
+                               u8 type, u64 *written);
+
+/* tls_type is the TLS record type of the data on a kTLS socket, with 0 for
+   application data */
 static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
-                                              u64 remain, io_completion completion, u64 flags)
+                                              u64 remain, enum zerocopy_mode zc, boolean more,
+                                              u8 tls_type, io_completion completion, u64 flags)
 {
     sysreturn rv = 0;
     err_t err = get_lwip_error(s);
@@ -544,6 +1225,18 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
         goto out;
     }
 
+    if (zc == ZEROCOPY_NONE && !netsock_tls_tx(s) && netsock_loopback_ready(s)) {
+        u64 n = netsock_loopback_write(s, buf, remain);
+        if (n == 0)
+            goto full;
+        net_debug(" loopback write of %ld bytes\n", n);
+        tracepoint(tcp_send, s->sock.fd, n, 0);
+        rv = n;
+        if (n < remain)
+            fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLOUT condition */
+        goto out;
+    }
+
     /* Note that the actual transmit window size is truncated to 16
        bits here (and tcp_write() doesn't accept more than 2^16
        anyway), so even if we have a large transmit window due to
@@ -562,27 +1255,72 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
         }
     }
 
-    /* Figure actual length and flags */
+    if (zc != ZEROCOPY_NONE) {
+        if (!s->info.tcp.zc_pending) {
+            s->info.tcp.zc_pending = allocate_queue(s->sock.h, ZEROCOPY_PENDING_MAX);
+            if (s->info.tcp.zc_pending == INVALID_ADDRESS) {
+                s->info.tcp.zc_pending = 0;
+                rv = -ENOMEM;
+                goto out;
+            }
+        }
+        if (queue_full(s->info.tcp.zc_pending)) {
+            rv = -ENOBUFS;
+            goto out;
+        }
+        /* data of a kTLS socket is sealed into a copy */
+        if (zc == ZEROCOPY_USER && (netsock_tls_tx(s) || !netsock_zerocopy_route(s)))
+            zc = ZEROCOPY_COPIED;
+    }
+
     u64 n;
-    u8 apiflags = TCP_WRITE_FLAG_COPY;
-    if (avail < remain) {
-        n = avail;
-        apiflags |= TCP_WRITE_FLAG_MORE;
+    if (netsock_tls_tx(s)) {
+        err = netsock_tls_write(s, buf, 0, remain, more, tls_type, &n);
     } else {
-        n = remain;
+        /* Figure actual length and flags */
+        n = MIN(avail, remain);
+        netsock_zcpin zp = 0;
+        netsock_txrefs tr = 0;
+        if (zc == ZEROCOPY_USER) {
+            zp = netsock_zcpin_alloc(s, t->p, buf, n);
+            tr = zp ? netsock_txrefs_reserve(s) : 0;
+            if (!tr) {
+                if (zp)
+                    refcount_release(&zp->r);
+                zp = 0;
+                zc = ZEROCOPY_COPIED;
+            }
+        }
+        u8 apiflags = zp ? 0 : TCP_WRITE_FLAG_COPY;
+        if (n < remain || more || s->info.tcp.cork)
+            apiflags |= TCP_WRITE_FLAG_MORE;
+
+        /* XXX need to pore over lwIP error conditions here */
+        err = tcp_write(s->info.tcp.lw, zp ? zp->alias : buf, n, apiflags);
+        if (zp) {
+            if (err == ERR_OK) {
+                struct netsock_txref *e = buffer_ref(tr->b, buffer_length(tr->b));
+                e->seq = s->info.tcp.lw->snd_lbb;
+                e->r = &zp->r;
+                refcount_reserve(e->r);
+                buffer_produce(tr->b, sizeof(struct netsock_txref));
+            }
+            refcount_release(&zp->r);
+        }
     }
-
-    /* XXX need to pore over lwIP error conditions here */
-    err = tcp_write(s->info.tcp.lw, buf, n, apiflags);
     if (err == ERR_OK) {
-        /* XXX prob add a flag to determine whether to continuously
-           post data, e.g. if used by send/sendto... */
-        err = tcp_output(s->info.tcp.lw);
+        if (zc != ZEROCOPY_NONE) {
+            u64 v = s->info.tcp.lw->snd_lbb | (zc == ZEROCOPY_COPIED ? ZEROCOPY_PENDING_COPIED : 0);
+            enqueue_single(s->info.tcp.zc_pending, pointer_from_u64(v));
+            s->info.tcp.zc_next++;
+        }
+        err = netsock_tcp_output(s, more);
         if (err == ERR_OK) {
             net_debug(" tcp_write and tcp_output successful for %ld bytes\n", n);
+            tracepoint(tcp_send, s->sock.fd, n, 0);
             netsock_check_loop();
             rv = n;
-            if (n == avail) {
+            if (n == avail || n < remain) {
                 fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLOUT condition */
             }
         } else {
@@ -604,38 +1342,218 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
     return rv;
 }
 
-closure_function(5, 1, sysreturn, socket_write_tcp_bh,
-                 netsock, s, thread, t, void *, buf, u64, remain, io_completion, completion,
+closure_function(8, 1, sysreturn, socket_write_tcp_bh,
+                 netsock, s, thread, t, void *, buf, u64, remain, enum zerocopy_mode, zc,
+                 boolean, more, u8, tls_type, io_completion, completion,
                  u64, flags)
 {
-    sysreturn rv = socket_write_tcp_bh_internal(bound(s), bound(t), bound(buf), bound(remain), bound(completion), flags);
+    sysreturn rv = socket_write_tcp_bh_internal(bound(s), bound(t), bound(buf), bound(remain),
+                                                bound(zc), bound(more), bound(tls_type),
+                                                bound(completion), flags);
     if (rv != BLOCKQ_BLOCK_REQUIRED)
         closure_finish();
     return rv;
 }
 
-static sysreturn socket_write_udp(netsock s, void *source, u64 length,
-                                  struct sockaddr *dest_addr, socklen_t addrlen)
+/* copy n bytes from the head of sg without consuming them */
+static void netsock_sg_peek(void *dest, sg_list sg, u64 n)
 {
-    ip_addr_t ipaddr;
-    u16 port;
-    if (dest_addr) {
-        sysreturn ret = sockaddr_to_addrport(s->sock.domain, dest_addr, addrlen,
-            &ipaddr, &port);
-        if (ret)
-            return ret;
-        /* If this is an an IPv4 mapped address then this socket
-           is dual-stack, so convert the address to IPv4 to encourage
-           LwIP to use that transport
-        */
-        if (s->sock.domain == AF_INET6 && !s->ipv6only &&
-                ip6_addr_isipv4mappedipv6(ip_2_ip6(&ipaddr))) {
-            unmap_ipv4_mapped_ipv6(ip_2_ip4(&ipaddr), ip_2_ip6(&ipaddr));
-            IP_SET_TYPE_VAL(ipaddr, IPADDR_TYPE_V4);
+    for (u64 off = 0; n > 0; off += sizeof(struct sg_buf)) {
+        sg_buf sgb = buffer_ref(sg->b, off);
+        u64 len = MIN(n, sgb->size - sgb->offset);
+        runtime_memcpy(dest, sgb->buf + sgb->offset, len);
+        dest += len;
+        n -= len;
+    }
+}
+
+static void netsock_sg_consume(sg_list sg, u64 n)
+{
+    while (n > 0) {
+        sg_buf sgb = sg_list_head_peek(sg);
+        u64 len = MIN(n, sgb->size - sgb->offset);
+        sgb->offset += len;
+        n -= len;
+        if (sgb->offset == sgb->size) {
+            sg_list_head_remove(sg);
+            sg_buf_release(sgb);
         }
     }
+}
+
+/* Seal data from buf, or from the head of sg, into TLS records and queue
+   as many as the send buffer takes. A record is queued whole or not at
+   all, and only the data of queued records is consumed from sg. Where the
+   route allows it (see netsock_zerocopy_route()), records are referenced
+   in place until acknowledged, so that the sealed copy of the data is the
+   only one made. */
+static err_t netsock_tls_write(netsock s, void *buf, sg_list sg, u64 remain, boolean more,
+                               u8 type, u64 *written)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    ktls k = s->info.tcp.tls;
+    u32 overhead = ktls_overhead(k);
+    boolean inplace = netsock_zerocopy_route(s);
     err_t err = ERR_OK;
+    u64 done = 0;
+    if (!type)
+        type = KTLS_TYPE_APPLICATION_DATA;
+    while (done < remain) {
+        u64 avail = tcp_sndbuf(lw);
+        u64 n = MIN(remain - done, KTLS_MAX_PLAINTEXT);
+        if (avail < overhead + MIN(n, KTLS_MIN_RECORD)) {
+            err = ERR_MEM;
+            break;
+        }
+        n = MIN(n, avail - overhead);
+        ktls_record r = ktls_record_alloc(k, n);
+        if (r == INVALID_ADDRESS) {
+            err = ERR_MEM;
+            break;
+        }
+        if (sg)
+            netsock_sg_peek(ktls_record_payload(k, r), sg, n);
+        else
+            runtime_memcpy(ktls_record_payload(k, r), buf + done, n);
+        if (!ktls_seal(k, r, n, type)) {
+            refcount_release(&r->r);
+            err = ERR_VAL;
+            break;
+        }
+        netsock_txrefs tr = inplace ? netsock_txrefs_reserve(s) : 0;
+        u8 apiflags = tr ? 0 : TCP_WRITE_FLAG_COPY;
+        if (done + n < remain || more || s->info.tcp.cork)
+            apiflags |= TCP_WRITE_FLAG_MORE;
+        err = tcp_write(lw, r->data, r->len, apiflags);
+        if (err == ERR_OK && tr) {
+            struct netsock_txref *e = buffer_ref(tr->b, buffer_length(tr->b));
+            e->seq = lw->snd_lbb;
+            e->r = &r->r;
+            refcount_reserve(e->r);
+            buffer_produce(tr->b, sizeof(struct netsock_txref));
+        }
+        refcount_release(&r->r);
+        if (err != ERR_OK) {
+            ktls_unseal(k);
+            break;
+        }
+        if (sg)
+            netsock_sg_consume(sg, n);
+        done += n;
+    }
+    *written = done;
+    return done ? ERR_OK : err;
+}
+
+/* Write as much of the sg list as the send buffer takes. Buffers holding a
+   reference to their page are written in place when the route allows it
+   (see netsock_zerocopy_route()); others are copied. Written bytes are
+   consumed from the list. */
+static sysreturn socket_write_tcp_sg_bh_internal(netsock s, thread t, sg_list sg,
+                                                 u64 remain, io_completion completion, u64 flags)
+{
+    sysreturn rv = 0;
+    err_t err = get_lwip_error(s);
+    net_debug("fd %d, thread %ld, sg %p, remain %ld, flags 0x%lx, lwip err %d\n",
+              s->sock.fd, t->tid, sg, remain, flags, err);
+
+    if (err != ERR_OK) {
+        rv = lwip_to_errno(err);
+        goto out;
+    }
+    if (s->info.tcp.state != TCP_SOCK_OPEN) {
+        rv = -ENOTCONN;
+        goto out;
+    }
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u64 avail = tcp_sndbuf(lw);
+    u64 written = 0;
+    boolean tls = netsock_tls_tx(s) != 0;
+    if (tls) {
+        err = netsock_tls_write(s, 0, sg, remain, false, 0, &written);
+        if (written < remain)
+            avail = 0;
+    }
+    boolean inplace = avail > 0 && netsock_zerocopy_route(s);
+    sg_buf sgb;
+    while (!tls && written < remain && avail > 0 &&
+           (sgb = sg_list_head_peek(sg)) != INVALID_ADDRESS) {
+        u64 n = MIN(MIN(sgb->size - sgb->offset, remain - written), avail);
+        netsock_txrefs tr = (inplace && sgb->refcount) ? netsock_txrefs_reserve(s) : 0;
+        u8 apiflags = tr ? 0 : TCP_WRITE_FLAG_COPY;
+        if (written + n < remain || s->info.tcp.cork)
+            apiflags |= TCP_WRITE_FLAG_MORE;
+        err = tcp_write(lw, sgb->buf + sgb->offset, n, apiflags);
+        if (err != ERR_OK)
+            break;
+        if (tr) {
+            struct netsock_txref *e = buffer_ref(tr->b, buffer_length(tr->b));
+            e->seq = lw->snd_lbb;
+            e->r = sgb->refcount;
+            refcount_reserve(e->r);
+            buffer_produce(tr->b, sizeof(struct netsock_txref));
+        }
+        sgb->offset += n;
+        written += n;
+        avail -= n;
+        if (sgb->offset == sgb->size) {
+            sg_list_head_remove(sg);
+            sg_buf_release(sgb);
+        }
+    }
+
+    if (written == 0) {
+        if (err != ERR_OK && err != ERR_MEM) {
+            net_debug(" tcp_write() lwip error: %d\n", err);
+            rv = lwip_to_errno(err);
+            goto out;
+        }
+        if ((flags & BLOCKQ_ACTION_BLOCKED) == 0 &&
+                (s->sock.f.flags & SOCK_NONBLOCK)) {
+            net_debug(" send buf full and non-blocking, return EAGAIN\n");
+            rv = -EAGAIN;
+            goto out;
+        }
+        net_debug(" send buf full, sleep\n");
+        return BLOCKQ_BLOCK_REQUIRED;
+    }
+    err = netsock_tcp_output(s, false);
+    if (err == ERR_OK) {
+        net_debug(" tcp_write and tcp_output successful for %ld bytes\n", written);
+        tracepoint(tcp_send, s->sock.fd, written, 0);
+        netsock_check_loop();
+        rv = written;
+        if (avail == 0)
+            fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLOUT condition */
+    } else {
+        net_debug(" tcp_output() lwip error: %d\n", err);
+        rv = lwip_to_errno(err);
+    }
+  out:
+    net_debug("   completion %p, rv %ld\n", completion, rv);
+    blockq_handle_completion(s->sock.txbq, flags, completion, t, rv);
+    return rv;
+}
+
+closure_function(5, 1, sysreturn, socket_write_tcp_sg_bh,
+                 netsock, s, thread, t, sg_list, sg, u64, remain, io_completion, completion,
+                 u64, flags)
+{
+    sysreturn rv = socket_write_tcp_sg_bh_internal(bound(s), bound(t), bound(sg), bound(remain),
+                                                   bound(completion), flags);
+    if (rv != BLOCKQ_BLOCK_REQUIRED)
+        closure_finish();
+    return rv;
+}
 
+static sysreturn netsock_udp_send(netsock s, void *source, u64 length, ip_addr_t *ipaddr,
+                                  u16 port)
+{
     /* XXX check how much we can queue, maybe make udp bh */
     /* XXX check if remote endpoint set? let LWIP check? */
     struct pbuf * pbuf = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
@@ -645,8 +1563,9 @@ static sysreturn socket_write_udp(netsock s, void *source, u64 length,
         return -ENOBUFS;
     }
     runtime_memcpy(pbuf->payload, source, length);
-    if (dest_addr)
-        err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
+    err_t err;
+    if (ipaddr)
+        err = udp_sendto(s->info.udp.lw, pbuf, ipaddr, port);
     else
         err = udp_send(s->info.udp.lw, pbuf);
     pbuf_free(pbuf);
@@ -654,13 +1573,81 @@ static sysreturn socket_write_udp(netsock s, void *source, u64 length,
         net_debug("lwip error %d\n", err);
         return lwip_to_errno(err);
     }
+    return 0;
+}
+
+/* With a segment size (UDP_SEGMENT), the buffer goes out as a train of
+   datagrams of that size, handed to the driver as one transmit batch. */
+static sysreturn socket_write_udp(netsock s, void *source, u64 length, u16 gso_size,
+                                  struct sockaddr *dest_addr, socklen_t addrlen)
+{
+    ip_addr_t ipaddr;
+    u16 port = 0;
+    if (dest_addr) {
+        sysreturn ret = sockaddr_to_addrport(s->sock.domain, dest_addr, addrlen,
+            &ipaddr, &port);
+        if (ret)
+            return ret;
+        /* If this is an an IPv4 mapped address then this socket
+           is dual-stack, so convert the address to IPv4 to encourage
+           LwIP to use that transport
+        */
+        if (s->sock.domain == AF_INET6 && !s->ipv6only &&
+                ip6_addr_isipv4mappedipv6(ip_2_ip6(&ipaddr))) {
+            unmap_ipv4_mapped_ipv6(ip_2_ip4(&ipaddr), ip_2_ip6(&ipaddr));
+            IP_SET_TYPE_VAL(ipaddr, IPADDR_TYPE_V4);
+        }
+    }
+    ip_addr_t *dest = dest_addr ? &ipaddr : 0;
+    sysreturn rv = 0;
+    if (gso_size == 0 || length <= gso_size) {
+        rv = netsock_udp_send(s, source, length, dest, port);
+    } else {
+        if ((length + gso_size - 1) / gso_size > NETSOCK_UDP_MAX_SEGMENTS)
+            return -EINVAL;
+        net_tx_batch_begin();
+        for (u64 off = 0; off < length; off += gso_size) {
+            rv = netsock_udp_send(s, source + off, MIN(gso_size, length - off), dest, port);
+            if (rv < 0)
+                break;
+        }
+        net_tx_batch_end();
+    }
+    if (rv < 0)
+        return rv;
     netsock_check_loop();
     return length;
 }
 
+/* Returns the data of the first control message of msg with the given
+   level and type and at least len bytes of data, or 0. */
+static void *netsock_cmsg_find(const struct msghdr *msg, int level, int type, u64 len)
+{
+    u64 off = 0;
+    while (msg->msg_control && off + sizeof(struct cmsghdr) <= msg->msg_controllen) {
+        struct cmsghdr *c = msg->msg_control + off;
+        if (c->cmsg_len < sizeof(*c) || off + c->cmsg_len > msg->msg_controllen)
+            break;
+        if (c->cmsg_level == level && c->cmsg_type == type && c->cmsg_len >= sizeof(*c) + len)
+            return c + 1;
+        off += pad(c->cmsg_len, sizeof(u64));
+    }
+    return 0;
+}
+
+/* Returns the segment size of a UDP_SEGMENT control message, if msg has one. */
+static boolean netsock_cmsg_udp_segment(const struct msghdr *msg, u16 *gso_size)
+{
+    u16 *v = netsock_cmsg_find(msg, IPPROTO_UDP, UDP_SEGMENT, sizeof(u16));
+    if (!v)
+        return false;
+    *gso_size = *v;
+    return true;
+}
+
 static sysreturn socket_write_internal(struct sock *sock, void *source,
-                                       u64 length,
-                                       struct sockaddr *dest_addr, socklen_t addrlen,
+                                       u64 length, enum zerocopy_mode zc, boolean more,
+                                       u8 tls_type, struct sockaddr *dest_addr, socklen_t addrlen,
                                        thread t, boolean bh, io_completion completion)
 {
     netsock s = (netsock) sock;
@@ -677,10 +1664,10 @@ static sysreturn socket_write_internal(struct sock *sock, void *source,
             goto out;
         }
         blockq_action ba = closure(sock->h, socket_write_tcp_bh, s, t,
-                                   source, length, completion);
+                                   source, length, zc, more, tls_type, completion);
         return blockq_check(sock->txbq, t, ba, bh);
     } else if (sock->type == SOCK_DGRAM) {
-        rv = socket_write_udp(s, source, length, dest_addr, addrlen);
+        rv = socket_write_udp(s, source, length, s->info.udp.gso_size, dest_addr, addrlen);
     } else {
 	msg_err("socket type %d unsupported\n", sock->type);
 	rv = -EINVAL;
@@ -698,7 +1685,24 @@ closure_function(1, 6, sysreturn, socket_write,
     struct sock *s = (struct sock *) bound(s);
     net_debug("sock %d, type %d, thread %ld, source %p, length %ld, offset %ld\n",
 	      s->fd, s->type, t->tid, source, length, offset);
-    return socket_write_internal(s, source, length, 0, 0, t, bh, completion);
+    return socket_write_internal(s, source, length, ZEROCOPY_NONE, false, 0, 0, 0, t, bh,
+                                 completion);
+}
+
+closure_function(1, 6, sysreturn, socket_sg_write,
+                 netsock, s,
+                 sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
+{
+    netsock s = bound(s);
+    net_debug("sock %d, thread %ld, sg %p, length %ld\n", s->sock.fd, t->tid, sg, length);
+    if (s->info.tcp.state != TCP_SOCK_OPEN)
+        return io_complete(completion, t, -EPIPE);
+    if (length == 0)
+        return io_complete(completion, t, 0);
+    blockq_action ba = closure(s->sock.h, socket_write_tcp_sg_bh, s, t, sg, length, completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
+    return blockq_check(s->sock.txbq, t, ba, bh);
 }
 
 closure_function(1, 2, sysreturn, netsock_ioctl,
@@ -815,7 +1819,82 @@ closure_function(1, 2, sysreturn, netsock_ioctl,
     }
 }
 
-#define SOCK_QUEUE_LEN 128
+#define SOCK_QUEUE_LEN 128
+
+/* listen() backlogs are capped at somaxconn, which the manifest can set.
+   lwIP's own listen backlog then only counts connections still in the
+   handshake, up to tcp_max_syn_backlog; established connections wait in
+   the socket's accept queue instead of holding a slot there. */
+#define NETSOCK_SOMAXCONN_DEFAULT       4096
+#define NETSOCK_SOMAXCONN_MAX           65535
+#define NETSOCK_SYN_BACKLOG_MAX         0xff    /* lwIP backlog is 8 bits */
+
+static u32 netsock_somaxconn = NETSOCK_SOMAXCONN_DEFAULT;
+static u8 netsock_syn_backlog = NETSOCK_SYN_BACKLOG_MAX;
+static u64 netsock_listen_overflows;
+static u64 netsock_listen_drops;
+
+static netsock_reuseport netsock_reuseport_find(int domain, ip_addr_t *addr, u16 port)
+{
+    list_foreach(&netsock_reuseport_groups, l) {
+        netsock_reuseport g = struct_from_list(l, netsock_reuseport, l);
+        if (g->domain == domain && g->port == port && ip_addr_cmp(&g->addr, addr))
+            return g;
+    }
+    return 0;
+}
+
+/* s has just bound its pcb */
+static boolean netsock_reuseport_create(netsock s)
+{
+    heap h = s->sock.h;
+    netsock_reuseport g = allocate(h, sizeof(*g));
+    if (g == INVALID_ADDRESS)
+        return false;
+    g->members = allocate_vector(h, 4);
+    if (g->members == INVALID_ADDRESS) {
+        deallocate(h, g, sizeof(*g));
+        return false;
+    }
+    g->h = h;
+    g->domain = s->sock.domain;
+    ip_addr_copy(g->addr, s->info.tcp.lw->local_ip);
+    g->port = s->info.tcp.lw->local_port;
+    g->lw = s->info.tcp.lw;
+    g->listening = false;
+    vector_push(g->members, s);
+    list_insert_before(&netsock_reuseport_groups, &g->l);
+    s->info.tcp.rp = g;
+    return true;
+}
+
+/* s gives up its own, unbound pcb for the group's */
+static void netsock_reuseport_join(netsock_reuseport g, netsock s)
+{
+    tcp_close(s->info.tcp.lw);
+    s->info.tcp.lw = g->lw;
+    s->info.tcp.rp = g;
+    vector_push(g->members, s);
+}
+
+/* Returns true if other members still use the pcb. */
+static boolean netsock_reuseport_leave(netsock s)
+{
+    netsock_reuseport g = s->info.tcp.rp;
+    for (int i = 0; i < vector_length(g->members); i++) {
+        if (vector_get(g->members, i) == s) {
+            vector_delete(g->members, i);
+            break;
+        }
+    }
+    s->info.tcp.rp = 0;
+    if (vector_length(g->members) > 0)
+        return true;
+    list_delete(&g->l);
+    deallocate_vector(g->members);
+    deallocate(g->h, g, sizeof(*g));
+    return false;
+}
 
 closure_function(1, 2, sysreturn, socket_close,
                  netsock, s,
@@ -829,7 +1908,10 @@ closure_function(1, 2, sysreturn, socket_close,
          * prevent any lwIP callback that might be called after tcp_close() from
          * using a stale reference to the socket structure, set the callback
          * argument to NULL. */
-        if (s->info.tcp.lw) {
+        netsock_loopback_unlink(s);
+        if (s->info.tcp.rp && netsock_reuseport_leave(s)) {
+            /* the pcb stays with the rest of the group */
+        } else if (s->info.tcp.lw) {
             tcp_close(s->info.tcp.lw);
             tcp_arg(s->info.tcp.lw, 0);
             netsock_check_loop();
@@ -840,6 +1922,16 @@ closure_function(1, 2, sysreturn, socket_close,
         break;
     }
     deallocate_queue(s->incoming);
+    if (s->sock.type == SOCK_STREAM) {
+        if (s->info.tcp.zc_pending)
+            deallocate_queue(s->info.tcp.zc_pending);
+        /* page references stay with the pcb until it is freed */
+        if (s->info.tcp.txrefs)
+            s->info.tcp.txrefs->s = 0;
+        if (s->info.tcp.tls)
+            deallocate_ktls(s->info.tcp.tls);
+        deallocate_closure(s->sock.f.sg_write);
+    }
     deallocate_closure(s->sock.f.read);
     deallocate_closure(s->sock.f.write);
     deallocate_closure(s->sock.f.close);
@@ -881,7 +1973,12 @@ static sysreturn netsock_shutdown(struct sock *sock, int how)
         tcp_shutdown(s->info.tcp.lw, shut_rx, shut_tx);
         if (shut_rx && shut_tx) {
             /* Shutting down both TX and RX is equivalent to calling
-             * tcp_close(), so the pcb should not be referenced anymore. */
+             * tcp_close(), so the pcb should not be referenced anymore.
+             * Zero-copy sends can no longer be tracked; report them so
+             * their completions are not waited on forever. Their pins go
+             * with the pcb, along with the other transmit references. */
+            if (s->info.tcp.zc_pending)
+                netsock_zerocopy_complete(s, true);
             s->info.tcp.lw = 0;
             s->info.tcp.state = TCP_SOCK_UNDEFINED;
         }
@@ -968,8 +2065,14 @@ static int allocate_sock(process p, int af, int type, u32 flags, netsock *rs)
     s->sock.recvfrom = netsock_recvfrom;
     s->sock.sendmsg = netsock_sendmsg;
     s->sock.recvmsg = netsock_recvmsg;
+    s->sock.connect_io = netsock_connect_io;
+    s->sock.accept4_io = netsock_accept4_io;
+    s->sock.sendmsg_io = netsock_sendmsg_io;
+    s->sock.recvmsg_io = netsock_recvmsg_io;
     s->sock.shutdown = netsock_shutdown;
     s->ipv6only = 0;
+    s->zerocopy = 0;
+    s->reuseport = 0;
     set_lwip_error(s, ERR_OK);
     *rs = s;
     return fd;
@@ -989,6 +2092,24 @@ static int allocate_tcp_sock(process p, int af, struct tcp_pcb *pcb, u32 flags)
     if (fd >= 0) {
 	s->info.tcp.lw = pcb;
 	s->info.tcp.state = TCP_SOCK_CREATED;
+	s->info.tcp.zc_pending = 0;
+	s->info.tcp.zc_next = 0;
+	s->info.tcp.zc_ready = false;
+	s->info.tcp.txrefs = 0;
+	s->info.tcp.tls = 0;
+	s->info.tcp.rx_tail = 0;
+	s->info.tcp.lo_peer = 0;
+	s->info.tcp.lo_queued = 0;
+	s->info.tcp.rcvbuf = netsock_rcvbuf_default;
+	s->info.tcp.sndbuf = netsock_sndbuf_default;
+	s->info.tcp.rcv_deficit = s->info.tcp.snd_deficit = 0;
+	s->info.tcp.rcvbuf_lock = s->info.tcp.sndbuf_lock = false;
+	s->info.tcp.rcv_pressure = false;
+	s->info.tcp.nodelay = s->info.tcp.cork = false;
+	s->info.tcp.rp = 0;
+	s->info.tcp.backlog = 0;
+	s->sock.f.sg_write = closure(s->sock.h, socket_sg_write, s);
+	s->sock.tx_avail = netsock_tx_avail;
     }
     return fd;
 }
@@ -1000,6 +2121,8 @@ static int allocate_udp_sock(process p, int af, struct udp_pcb *pcb, u32 flags)
     if (fd >= 0) {
 	s->info.udp.lw = pcb;
 	s->info.udp.state = UDP_SOCK_CREATED;
+	s->info.udp.gso_size = 0;
+	s->info.udp.gro = false;
 	udp_recv(pcb, udp_input_lower, s);
     }
     return fd;
@@ -1074,10 +2197,20 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
 
     /* A null pbuf indicates connection closed. */
     if (p) {
-        if (!enqueue(s->incoming, p)) {
+        tracepoint(tcp_recv, s->sock.fd, p->tot_len, 0);
+        /* With a large window, small segments can outnumber the queue
+           entries; append to the last pbuf, which a full queue still holds. */
+        if (queue_full(s->incoming) && s->info.tcp.rx_tail) {
+            pbuf_cat(s->info.tcp.rx_tail, p);
+        } else if (enqueue(s->incoming, p)) {
+            s->info.tcp.rx_tail = p;
+        } else {
 	    msg_err("incoming queue full\n");
             return ERR_BUF;     /* XXX verify */
         }
+        if (2 * (u64)(s->info.tcp.rcvbuf - MIN(pcb->rcv_wnd, s->info.tcp.rcvbuf)) >=
+            s->info.tcp.rcvbuf)
+            s->info.tcp.rcv_pressure = true;
     }
     wakeup_sock(s, WAKEUP_SOCK_RX);
 
@@ -1102,8 +2235,18 @@ static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
     if (sock->type == SOCK_STREAM) {
 	if (s->info.tcp.lw->local_port != 0)
 	    return -EINVAL;	/* already bound */
+        if (s->reuseport && port != 0) {
+            netsock_reuseport g = netsock_reuseport_find(s->sock.domain, &ipaddr, port);
+            if (g) {
+                net_debug("joining reuseport group, pcb %p, port %d\n", g->lw, port);
+                netsock_reuseport_join(g, s);
+                return 0;
+            }
+        }
 	net_debug("calling tcp_bind, pcb %p, port %d\n", s->info.tcp.lw, port);
 	err = tcp_bind(s->info.tcp.lw, &ipaddr, port);
+        if (err == ERR_OK && s->reuseport && !netsock_reuseport_create(s))
+            return -ENOMEM;     /* still bound, but alone */
     } else if (sock->type == SOCK_DGRAM) {
         if (s->info.udp.lw->local_port != 0)
             return -EINVAL; /* already bound */
@@ -1141,6 +2284,10 @@ static void lwip_tcp_conn_err(void * z, err_t err) {
     /* Don't try to use the pcb, it may have been deallocated already. */
     s->info.tcp.lw = 0;
 
+    /* the pcb's segments are gone along with any user buffer references */
+    if (s->info.tcp.zc_pending)
+        netsock_zerocopy_complete(s, true);
+
     wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
 }
 
@@ -1151,12 +2298,17 @@ static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
     }
     netsock s = (netsock)arg;
     net_debug("fd %d, pcb %p, len %d\n", s->sock.fd, pcb, len);
+    if (s->info.tcp.zc_pending)
+        netsock_zerocopy_complete(s, false);
+    if (s->info.tcp.txrefs)
+        netsock_txrefs_release(s->info.tcp.txrefs, pcb);
+    netsock_tcp_acked(s, pcb);
     wakeup_sock(s, WAKEUP_SOCK_TX);
     return ERR_OK;
 }
 
-closure_function(2, 1, sysreturn, connect_tcp_bh,
-                 netsock, s, thread, t,
+closure_function(3, 1, sysreturn, connect_tcp_bh,
+                 netsock, s, thread, t, io_completion, completion,
                  u64, flags)
 {
     sysreturn rv = 0;
@@ -1185,8 +2337,9 @@ closure_function(2, 1, sysreturn, connect_tcp_bh,
     }
     assert(s->info.tcp.state == TCP_SOCK_OPEN);
   out:
+    blockq_handle_completion(s->sock.txbq, flags, bound(completion), t, rv);
     closure_finish();
-    return syscall_return(t, rv);
+    return rv;
 }
 
 static err_t connect_tcp_complete(void* arg, struct tcp_pcb* tpcb, err_t err)
@@ -1202,26 +2355,31 @@ static err_t connect_tcp_complete(void* arg, struct tcp_pcb* tpcb, err_t err)
    }
    assert(s->info.tcp.state == TCP_SOCK_IN_CONNECTION);
    s->info.tcp.state = TCP_SOCK_OPEN; /* XXX state handling needs fixing; this could indicate an error as well */
+   if (err == ERR_OK) {
+       netsock_tcp_established(s);
+       netsock_loopback_link(s);
+   }
    set_lwip_error(s, err);
    wakeup_sock(s, WAKEUP_SOCK_TX);
    return ERR_OK;
 }
 
 static inline sysreturn connect_tcp(netsock s, const ip_addr_t* address,
-                                    unsigned short port)
+                                    unsigned short port, thread t, boolean bh,
+                                    io_completion completion)
 {
     net_debug("sock %d, tcp state %d, port %d\n", s->sock.fd,
             s->info.tcp.state, port);
     switch (s->info.tcp.state) {
     case TCP_SOCK_IN_CONNECTION:
     case TCP_SOCK_ABORTING_CONNECTION:
-        return -EALREADY;
+        return io_complete(completion, t, -EALREADY);
     case TCP_SOCK_OPEN:
-        return -EISCONN;
+        return io_complete(completion, t, -EISCONN);
     case TCP_SOCK_CREATED:
         break;
     default:
-        return -EINVAL;
+        return io_complete(completion, t, -EINVAL);
     }
     struct tcp_pcb * lw = s->info.tcp.lw;
     tcp_arg(lw, s);
@@ -1232,15 +2390,16 @@ static inline sysreturn connect_tcp(netsock s, const ip_addr_t* address,
     set_lwip_error(s, ERR_OK);
     err_t err = tcp_connect(lw, address, port, connect_tcp_complete);
     if (err != ERR_OK)
-        return lwip_to_errno(err);
+        return io_complete(completion, t, lwip_to_errno(err));
+    net_tcp_timer_needed();
     netsock_check_loop();
 
-    return blockq_check(s->sock.txbq, current,
-                        closure(s->sock.h, connect_tcp_bh, s, current), false);
+    return blockq_check(s->sock.txbq, t,
+                        closure(s->sock.h, connect_tcp_bh, s, t, completion), bh);
 }
 
-static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
-        socklen_t addrlen)
+static sysreturn netsock_connect_io(struct sock *sock, struct sockaddr *addr,
+        socklen_t addrlen, thread t, boolean bh, io_completion completion)
 {
     err_t err = ERR_OK;
     netsock s = (netsock) sock;
@@ -1249,7 +2408,7 @@ static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
     sysreturn ret = sockaddr_to_addrport(s->sock.domain, addr, addrlen, &ipaddr,
         &port);
     if (ret)
-        return ret;
+        return io_complete(completion, t, ret);
     if (s->sock.type == SOCK_STREAM) {
         if (s->info.tcp.state == TCP_SOCK_IN_CONNECTION) {
             err = ERR_ALREADY;
@@ -1258,17 +2417,29 @@ static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
         } else if (s->info.tcp.state == TCP_SOCK_LISTENING) {
             msg_warn("attempt to connect on listening socket fd = %d; ignored\n", sock->fd);
             err = ERR_ARG;
+        } else if (s->info.tcp.rp && vector_length(s->info.tcp.rp->members) > 1) {
+            /* the shared pcb can't become one member's connection */
+            return io_complete(completion, t, -EADDRINUSE);
         } else {
-            return connect_tcp(s, &ipaddr, port);
+            if (s->info.tcp.rp)
+                netsock_reuseport_leave(s);
+            return connect_tcp(s, &ipaddr, port, t, bh, completion);
         }
     } else if (s->sock.type == SOCK_DGRAM) {
 	/* Set remote endpoint */
 	err = udp_connect(s->info.udp.lw, &ipaddr, port);
     } else {
 	msg_err("can't connect on socket type %d\n", s->sock.type);
-	return -EINVAL;
+	return io_complete(completion, t, -EINVAL);
     }
-    return lwip_to_errno(err);
+    return io_complete(completion, t, lwip_to_errno(err));
+}
+
+static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
+        socklen_t addrlen)
+{
+    return netsock_connect_io(sock, addr, addrlen, current, false,
+                              syscall_io_complete);
 }
 
 sysreturn connect(int sockfd, struct sockaddr *addr, socklen_t addrlen)
@@ -1300,8 +2471,8 @@ static sysreturn sendto_prepare(struct sock *sock, int flags)
 	return -EOPNOTSUPP;
     }
 
-    if (flags & MSG_MORE)
-	msg_warn("MSG_MORE unimplemented; ignored\n");
+    if ((flags & MSG_MORE) && sock->type != SOCK_STREAM)
+	msg_warn("MSG_MORE unimplemented for datagrams; ignored\n");
 
     if (flags & MSG_NOSIGNAL)
 	msg_warn("MSG_NOSIGNAL unimplemented; ignored\n");
@@ -1312,6 +2483,14 @@ static sysreturn sendto_prepare(struct sock *sock, int flags)
     return 0;
 }
 
+/* MSG_ZEROCOPY is only honored on stream sockets with SO_ZEROCOPY set, as
+   in Linux; otherwise it is ignored. */
+static boolean sendto_zerocopy(struct sock *sock, int flags)
+{
+    return (flags & MSG_ZEROCOPY) && sock->type == SOCK_STREAM &&
+        ((netsock)sock)->zerocopy;
+}
+
 static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
         int flags, struct sockaddr *dest_addr, socklen_t addrlen)
 {
@@ -1319,8 +2498,9 @@ static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
     if (rv < 0) {
         return set_syscall_return(current, rv);
     }
-    return socket_write_internal(sock, buf, len, dest_addr, addrlen, current, false,
-            syscall_io_complete);
+    return socket_write_internal(sock, buf, len,
+            sendto_zerocopy(sock, flags) ? ZEROCOPY_USER : ZEROCOPY_NONE,
+            (flags & MSG_MORE) != 0, 0, dest_addr, addrlen, current, false, syscall_io_complete);
 }
 
 sysreturn sendto(int sockfd, void *buf, u64 len, int flags,
@@ -1373,33 +2553,75 @@ static sysreturn sendmsg_prepare(struct sock *s, const struct msghdr *msg,
 }
 
 static void sendmsg_complete_internal(struct sock *s, void * buf, u64 len,
-                                      thread t, sysreturn rv)
+                                      io_completion completion, thread t, sysreturn rv)
 {
     deallocate(s->h, buf, len);
-    apply(syscall_io_complete, t, rv);
+    apply(completion, t, rv);
 }
 
-closure_function(3, 2, void, sendmsg_complete,
-                 struct sock *, s, void *, buf, u64, len,
+closure_function(4, 2, void, sendmsg_complete,
+                 struct sock *, s, void *, buf, u64, len, io_completion, completion,
                  thread, t, sysreturn, rv)
 {
-    sendmsg_complete_internal(bound(s), bound(buf), bound(len), t, rv);
+    sendmsg_complete_internal(bound(s), bound(buf), bound(len), bound(completion), t, rv);
     closure_finish();
 }
 
-static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg,
-                                 int flags)
+static sysreturn netsock_sendmsg_io(struct sock *s, const struct msghdr *msg,
+                                    int flags, thread t, boolean bh,
+                                    io_completion completion)
 {
     void *buf;
     u64 len;
     sysreturn rv;
-
+    enum zerocopy_mode zc = ZEROCOPY_NONE;
+    u8 tls_type = 0;
+
+    /* e.g. a TLS alert, sent in a record of its own type */
+    if (s->type == SOCK_STREAM && netsock_tls_tx((netsock)s)) {
+        u8 *type = netsock_cmsg_find(msg, SOL_TLS, TLS_SET_RECORD_TYPE, sizeof(u8));
+        if (type)
+            tls_type = *type;
+    }
+    if (sendto_zerocopy(s, flags)) {
+        /* a single buffer can be referenced in place; gathering several
+           would need a copy anyway */
+        if (msg->msg_iovlen == 1) {
+            rv = sendto_prepare(s, flags);
+            if (rv < 0 || msg->msg_iov[0].iov_len == 0)
+                return io_complete(completion, t, rv);
+            return socket_write_internal(s, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len,
+                ZEROCOPY_USER, (flags & MSG_MORE) != 0, tls_type, msg->msg_name, msg->msg_namelen,
+                t, bh, completion);
+        }
+        zc = ZEROCOPY_COPIED;
+    }
+    u16 gso_size;
+    if (s->type == SOCK_DGRAM && netsock_cmsg_udp_segment(msg, &gso_size)) {
+        rv = sendmsg_prepare(s, msg, flags, &buf, &len);
+        if (rv > 0) {
+            rv = socket_write_udp((netsock)s, buf, len, gso_size, msg->msg_name,
+                                  msg->msg_namelen);
+            deallocate(s->h, buf, len);
+        }
+        return io_complete(completion, t, rv);
+    }
     rv = sendmsg_prepare(s, msg, flags, &buf, &len);
     if (rv <= 0)
-        return set_syscall_return(current, rv);
-    io_completion completion = closure(s->h, sendmsg_complete, s, buf, len);
-    return socket_write_internal(s, buf, len, msg->msg_name, msg->msg_namelen,
-        current, false, completion);
+        return io_complete(completion, t, rv);
+    io_completion c = closure(s->h, sendmsg_complete, s, buf, len, completion);
+    if (c == INVALID_ADDRESS) {
+        deallocate(s->h, buf, len);
+        return io_complete(completion, t, -ENOMEM);
+    }
+    return socket_write_internal(s, buf, len, zc, (flags & MSG_MORE) != 0, tls_type,
+        msg->msg_name, msg->msg_namelen, t, bh, c);
+}
+
+static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg,
+                                 int flags)
+{
+    return netsock_sendmsg_io(s, msg, flags, current, false, syscall_io_complete);
 }
 
 sysreturn sendmsg(int sockfd, const struct msghdr *msg, int flags)
@@ -1434,7 +2656,9 @@ closure_function(7, 1, sysreturn, sendmmsg_tcp_bh,
 
     io_completion completion = closure(s->sock.h, sendmmsg_buf_complete, s, buf,
             len);
-    sysreturn rv = socket_write_tcp_bh_internal(s, t, buf, len, completion, bqflags | BLOCKQ_ACTION_BLOCKED);
+    sysreturn rv = socket_write_tcp_bh_internal(s, t, buf, len, ZEROCOPY_NONE,
+                                                (bound(flags) & MSG_MORE) != 0, 0, completion,
+                                                bqflags | BLOCKQ_ACTION_BLOCKED);
 
     while (true) {
         if (rv == BLOCKQ_BLOCK_REQUIRED) {
@@ -1454,7 +2678,9 @@ closure_function(7, 1, sysreturn, sendmmsg_tcp_bh,
                 bound(flags), &buf, &len);
         if (rv > 0) {
             completion = closure(s->sock.h, sendmmsg_buf_complete, s, buf, len);
-            rv = socket_write_tcp_bh_internal(s, t, buf, len, completion, bqflags | BLOCKQ_ACTION_BLOCKED);
+            rv = socket_write_tcp_bh_internal(s, t, buf, len, ZEROCOPY_NONE,
+                                              (bound(flags) & MSG_MORE) != 0, 0, completion,
+                                              bqflags | BLOCKQ_ACTION_BLOCKED);
         }
     }
 
@@ -1484,6 +2710,10 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
             return -EFAULT;
     }
 
+    /* datagrams go out as one batch per device queue */
+    boolean batch = sock->type == SOCK_DGRAM;
+    if (batch)
+        net_tx_batch_begin();
     for (sock->msg_count = 0; sock->msg_count < vlen; sock->msg_count++) {
         struct msghdr *msg_hdr = &msgvec[sock->msg_count].msg_hdr;
 
@@ -1506,8 +2736,12 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
             rv = blockq_check(sock->txbq, current, ba, false);
             break;
         case SOCK_DGRAM:
-            rv = socket_write_udp(s, buf, len, msg_hdr->msg_name,
+        {
+            u16 gso_size = s->info.udp.gso_size;
+            netsock_cmsg_udp_segment(msg_hdr, &gso_size);
+            rv = socket_write_udp(s, buf, len, gso_size, msg_hdr->msg_name,
                 msg_hdr->msg_namelen);
+        }
             break;
         }
         deallocate(sock->h, buf, len);
@@ -1516,6 +2750,8 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
         }
         msgvec[sock->msg_count].msg_len = rv;
     }
+    if (batch)
+        net_tx_batch_end();
     if (sock->msg_count > 0) {
         rv = sock->msg_count;
     }
@@ -1554,30 +2790,77 @@ sysreturn recvfrom(int sockfd, void * buf, u64 len, int flags,
     return sock->recvfrom(sock, buf, len, flags, src_addr, addrlen);
 }
 
-static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
-                                 int flags)
+/* The error queue only carries MSG_ZEROCOPY completions: one notification
+   covering the range of send ids completed since the last read. */
+static sysreturn netsock_recv_errqueue(netsock s, struct msghdr *msg)
+{
+    if (s->sock.type != SOCK_STREAM || !s->info.tcp.zc_ready)
+        return -EAGAIN;
+    struct {
+        struct cmsghdr hdr;
+        struct sock_extended_err ee;
+    } cm;
+    zero(&cm, sizeof(cm));
+    cm.hdr.cmsg_len = sizeof(cm);
+    if (s->sock.domain == AF_INET6) {
+        cm.hdr.cmsg_level = IPPROTO_IPV6;
+        cm.hdr.cmsg_type = IPV6_RECVERR;
+    } else {
+        cm.hdr.cmsg_level = SOL_IP;
+        cm.hdr.cmsg_type = IP_RECVERR;
+    }
+    cm.ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+    if (s->info.tcp.zc_copied)
+        cm.ee.ee_code = SO_EE_CODE_ZEROCOPY_COPIED;
+    cm.ee.ee_info = s->info.tcp.zc_lo;
+    cm.ee.ee_data = s->info.tcp.zc_hi;
+    s->info.tcp.zc_ready = false;
+    msg->msg_flags = MSG_ERRQUEUE;
+    if (msg->msg_control && msg->msg_controllen >= sizeof(cm)) {
+        runtime_memcpy(msg->msg_control, &cm, sizeof(cm));
+        msg->msg_controllen = sizeof(cm);
+    } else {
+        msg->msg_flags |= MSG_CTRUNC;
+        msg->msg_controllen = 0;
+    }
+    fdesc_notify_events(&s->sock.f);    /* reset a triggered EPOLLERR condition */
+    return 0;
+}
+
+static sysreturn netsock_recvmsg_io(struct sock *sock, struct msghdr *msg,
+                                    int flags, thread t, boolean bh,
+                                    io_completion completion)
 {
     u64 total_len;
     u8 *buf;
     netsock s = (netsock) sock;
 
+    if (flags & MSG_ERRQUEUE)
+        return io_complete(completion, t, netsock_recv_errqueue(s, msg));
     if ((sock->type == SOCK_STREAM) && (s->info.tcp.state != TCP_SOCK_OPEN)) {
-        return set_syscall_error(current, (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : ENOTCONN);
+        return io_complete(completion, t,
+                           (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : -ENOTCONN);
     }
     total_len = 0;
     for (int i = 0; i < msg->msg_iovlen; i++) {
         total_len += msg->msg_iov[i].iov_len;
     }
     if (total_len == 0) {
-        return 0;
+        return io_complete(completion, t, 0);
     }
     buf = allocate(sock->h, total_len);
     if (buf == INVALID_ADDRESS) {
-        return set_syscall_error(current, ENOMEM);
+        return io_complete(completion, t, -ENOMEM);
     }
-    blockq_action ba = closure(sock->h, recvmsg_bh, s, current, buf, total_len,
-            msg);
-    return blockq_check(sock->rxbq, current, ba, false);
+    blockq_action ba = closure(sock->h, recvmsg_bh, s, t, buf, total_len,
+            msg, completion);
+    return blockq_check(sock->rxbq, t, ba, bh);
+}
+
+static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
+                                 int flags)
+{
+    return netsock_recvmsg_io(sock, msg, flags, current, false, syscall_io_complete);
 }
 
 sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
@@ -1592,6 +2875,98 @@ sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
     return s->recvmsg(s, msg, flags);
 }
 
+/* Copies one datagram into msg's iovecs, truncating it as recvmsg() does. */
+static u64 recvmmsg_copy_dgram(netsock s, struct udp_entry *e, struct msghdr *msg)
+{
+    struct pbuf *p = e->pbuf;
+    u64 off = 0;
+    for (int i = 0; i < msg->msg_iovlen && off < p->tot_len; i++) {
+        u64 len = MIN(msg->msg_iov[i].iov_len, p->tot_len - off);
+        pbuf_copy_partial(p, msg->msg_iov[i].iov_base, len, off);
+        off += len;
+    }
+    if (msg->msg_name)
+        addrport_to_sockaddr(s->sock.domain, &e->raddr, e->rport, msg->msg_name,
+                             &msg->msg_namelen);
+    msg->msg_controllen = 0;
+    msg->msg_flags = (off < p->tot_len) ? MSG_TRUNC : 0;
+    return off;
+}
+
+/* Waits for the first datagram only, then takes as many more as are already
+   queued: as if MSG_WAITFORONE were always given. */
+closure_function(5, 1, sysreturn, recvmmsg_bh,
+                 netsock, s, thread, t, struct mmsghdr *, msgvec, unsigned int, vlen, int, flags,
+                 u64, bqflags)
+{
+    netsock s = bound(s);
+    thread t = bound(t);
+    struct mmsghdr *msgvec = bound(msgvec);
+    sysreturn rv;
+
+    err_t err = get_lwip_error(s);
+    if (err != ERR_OK) {
+        rv = lwip_to_errno(err);
+        goto out;
+    }
+
+    if (bqflags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+
+    unsigned int n = 0;
+    struct udp_entry *e;
+    while (n < bound(vlen) && (e = dequeue(s->incoming)) != INVALID_ADDRESS) {
+        msgvec[n].msg_len = recvmmsg_copy_dgram(s, e, &msgvec[n].msg_hdr);
+        pbuf_free(e->pbuf);
+        deallocate(s->sock.h, e, sizeof(struct udp_entry));
+        n++;
+    }
+    if (n == 0) {
+        if ((s->sock.f.flags & SOCK_NONBLOCK) || (bound(flags) & MSG_DONTWAIT)) {
+            rv = -EAGAIN;
+            goto out;
+        }
+        return BLOCKQ_BLOCK_REQUIRED;
+    }
+    if (queue_empty(s->incoming))
+        fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLIN condition */
+    rv = n;
+  out:
+    syscall_return(t, rv);
+    closure_finish();
+    return rv;
+}
+
+/* As on Linux, the timeout is only checked once a datagram has been received;
+   since the call then returns with what is queued, it never expires. */
+sysreturn recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                   int flags, struct timespec *timeout)
+{
+    struct sock *sock = resolve_socket(current->p, sockfd);
+    netsock s = get_netsock(sock);
+    if (!s || sock->type != SOCK_DGRAM)
+        return -EOPNOTSUPP;
+
+    net_debug("sock %d, flags 0x%x, vlen %d\n", sock->fd, flags, vlen);
+    if (flags & ~(MSG_DONTWAIT | MSG_WAITFORONE))
+        return -EINVAL;
+    if (timeout && !validate_user_memory(timeout, sizeof(struct timespec), false))
+        return -EFAULT;
+    if (!validate_user_memory(msgvec, vlen * sizeof(struct mmsghdr), true))
+        return -EFAULT;
+    for (int i = 0; i < vlen; i++) {
+        if (!validate_msghdr(&msgvec[i].msg_hdr, true))
+            return -EFAULT;
+    }
+    if (vlen == 0)
+        return 0;
+
+    blockq_action ba = closure(sock->h, recvmmsg_bh, s, current, msgvec, vlen, flags);
+    return blockq_check(sock->rxbq, current, ba, false);
+}
+
 static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
 {
     if (!z) {
@@ -1600,38 +2975,119 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     netsock s = z;
 
     if (err == ERR_MEM) {
+        netsock_listen_drops++;
         set_lwip_error(s, err);
         wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
         return err;               /* lwIP doesn't care */
     }
 
+    if (queue_length(s->incoming) > s->info.tcp.backlog) {
+        net_debug("accept queue overflow, sock %d\n", s->sock.fd);
+        netsock_listen_overflows++;
+        netsock_listen_drops++;
+        return ERR_BUF;         /* lwIP will do tcp_abort */
+    }
+
     /* XXX such a thing as nonblock inherited from listen socket? */
     int fd = allocate_tcp_sock(s->p, s->sock.domain, lw, 0);
-    if (fd < 0)
+    if (fd < 0) {
+        netsock_listen_drops++;
 	return ERR_MEM;
+    }
 
     // XXX - what if this has been closed in the meantime?
     // refcnt
 
     net_debug("new fd %d, pcb %p\n", fd, lw);
-    netsock sn = vector_get(s->p->files, fd);
+    netsock sn = resolve_fd_noret(s->p, fd);
     sn->info.tcp.state = TCP_SOCK_OPEN;
     sn->sock.fd = fd;
+    sn->zerocopy = s->zerocopy;
+    sn->info.tcp.rcvbuf = s->info.tcp.rcvbuf;
+    sn->info.tcp.sndbuf = s->info.tcp.sndbuf;
+    sn->info.tcp.rcvbuf_lock = s->info.tcp.rcvbuf_lock;
+    sn->info.tcp.sndbuf_lock = s->info.tcp.sndbuf_lock;
+    netsock_tcp_established(sn);
+    sn->info.tcp.nodelay = s->info.tcp.nodelay;
+    sn->info.tcp.cork = s->info.tcp.cork;
+    netsock_tcp_nagle_update(sn);
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, sn);
     tcp_recv(lw, tcp_input_lower);
     tcp_err(lw, lwip_tcp_conn_err);
     tcp_sent(lw, lwip_tcp_sent);
-    if (!enqueue(s->incoming, sn)) {
-        msg_err("queue overrun; shouldn't happen with lwIP listen backlog\n");
-        return ERR_BUF;         /* lwIP will do tcp_abort */
+    netsock_loopback_link(sn);
+    /* the queue was sized for the backlog in netsock_listen() */
+    assert(enqueue(s->incoming, sn));
+    wakeup_sock(s, WAKEUP_SOCK_RX);
+    return ERR_OK;
+}
+
+/* Connections are spread over the listening members by the cpu that
+   received them once more than one cpu has (as with a multiqueue NIC
+   steering flows), and by flow hash otherwise. */
+static netsock netsock_reuseport_select(netsock_reuseport g, struct tcp_pcb *lw)
+{
+    netsock m;
+    int n = 0;
+    vector_foreach(g->members, m) {
+        if (m->info.tcp.state == TCP_SOCK_LISTENING)
+            n++;
+    }
+    if (n == 0)
+        return 0;
+    u64 cpu = current_cpu()->id;
+    u64 bit = U64_FROM_BIT(cpu & 63);
+    netsock_accept_cpus |= bit;
+    u32 k = 0;
+    if (netsock_accept_cpus & ~bit) {
+        k = cpu;
+    } else if (lw) {
+        k = lw->remote_port;
+        if (IP_IS_V4(&lw->remote_ip)) {
+            k ^= ip4_addr_get_u32(ip_2_ip4(&lw->remote_ip));
+        } else {
+            for (int i = 0; i < 4; i++)
+                k ^= ip_2_ip6(&lw->remote_ip)->addr[i];
+        }
+        k *= 0x9e3779b1;
+        k ^= k >> 16;
+    }
+    k %= n;
+    vector_foreach(g->members, m) {
+        if (m->info.tcp.state == TCP_SOCK_LISTENING && k-- == 0)
+            break;
     }
+    return m;
+}
 
-    /* consume a slot in the lwIP listen backlog */
-    tcp_backlog_delayed(lw);
+static err_t accept_tcp_reuseport(void *z, struct tcp_pcb *lw, err_t err)
+{
+    if (!z)
+        return ERR_CLSD;
+    netsock s = netsock_reuseport_select(z, lw);
+    if (!s)
+        return ERR_CLSD;
+    return accept_tcp_from_lwip(s, lw, err);
+}
 
-    wakeup_sock(s, WAKEUP_SOCK_RX);
-    return ERR_OK;
+/* Like Linux, a backlog of n lets n + 1 connections wait for accept(). */
+static boolean netsock_set_backlog(netsock s, int backlog)
+{
+    if (backlog < 0 || backlog > netsock_somaxconn)
+        backlog = netsock_somaxconn;
+    if (backlog + 1 > _queue_size(s->incoming)) {
+        queue q = allocate_queue(s->sock.h, backlog + 1);
+        if (q == INVALID_ADDRESS)
+            return false;
+        void *p;
+        while ((p = dequeue(s->incoming)) != INVALID_ADDRESS)
+            assert(enqueue(q, p));
+        deallocate_queue(s->incoming);
+        s->incoming = q;
+    }
+    s->info.tcp.backlog = backlog;
+    return true;
 }
 
 static sysreturn netsock_listen(struct sock *sock, int backlog)
@@ -1639,11 +3095,35 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
     netsock s = (netsock) sock;
     if (s->sock.type != SOCK_STREAM)
 	return -EOPNOTSUPP;
-    backlog = MAX(backlog, SOCK_QUEUE_LEN);
-    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
+    if (!netsock_set_backlog(s, backlog))
+        return -ENOMEM;
+    /* any one accept waiter can take a new connection */
+    blockq_set_exclusive(s->sock.rxbq, true);
+    netsock_reuseport g = s->info.tcp.rp;
+    if (g && g->listening) {
+        /* the group's listen pcb takes connections for this member too */
+        s->info.tcp.state = TCP_SOCK_LISTENING;
+        set_lwip_error(s, ERR_OK);
+        return 0;
+    }
+    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, netsock_syn_backlog);
+    if (!lw)
+        return -ENOMEM;
+    net_tcp_timer_needed();
     s->info.tcp.lw = lw;
     s->info.tcp.state = TCP_SOCK_LISTENING;
     set_lwip_error(s, ERR_OK);
+    if (g) {
+        /* tcp_listen() replaced the pcb that members refer to */
+        netsock m;
+        vector_foreach(g->members, m)
+            m->info.tcp.lw = lw;
+        g->lw = lw;
+        g->listening = true;
+        tcp_arg(lw, g);
+        tcp_accept(lw, accept_tcp_reuseport);
+        return 0;
+    }
     tcp_arg(lw, s);
     tcp_accept(lw, accept_tcp_from_lwip);
     return 0;    
@@ -1659,8 +3139,9 @@ sysreturn listen(int sockfd, int backlog)
     return sock->listen(sock, backlog);
 }
 
-closure_function(5, 1, sysreturn, accept_bh,
+closure_function(6, 1, sysreturn, accept_bh,
                  netsock, s, thread, t, struct sockaddr *, addr, socklen_t *, addrlen, int, flags,
+                 io_completion, completion,
                  u64, bqflags)
 {
     netsock s = bound(s);
@@ -1704,31 +3185,35 @@ closure_function(5, 1, sysreturn, accept_bh,
     if (queue_length(s->incoming) == 0)
         fdesc_notify_events(&s->sock.f);
 
-    /* release slot in lwIP listen backlog */
-    tcp_backlog_accepted(child->info.tcp.lw);
-
     rv = child->sock.fd;
   out:
-    syscall_return(t, rv);
+    blockq_handle_completion(s->sock.rxbq, bqflags, bound(completion), t, rv);
 
     closure_finish();
     return rv;
 }
 
-static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags)
+static sysreturn netsock_accept4_io(struct sock *sock, struct sockaddr *addr,
+        socklen_t *addrlen, int flags, thread t, boolean bh, io_completion completion)
 {
     netsock s = (netsock) sock;
     if (sock->type != SOCK_STREAM)
-	return -EOPNOTSUPP;
+	return io_complete(completion, t, -EOPNOTSUPP);
 
     if ((s->info.tcp.state != TCP_SOCK_LISTENING) ||
             (flags & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)))
-	return set_syscall_error(current, EINVAL);
+	return io_complete(completion, t, -EINVAL);
 
-    blockq_action ba = closure(sock->h, accept_bh, s, current, addr, addrlen,
-            flags);
-    return blockq_check(sock->rxbq, current, ba, false);
+    blockq_action ba = closure(sock->h, accept_bh, s, t, addr, addrlen,
+            flags, completion);
+    return blockq_check(sock->rxbq, t, ba, bh);
+}
+
+static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
+        socklen_t *addrlen, int flags)
+{
+    return netsock_accept4_io(sock, addr, addrlen, flags, current, false,
+                              syscall_io_complete);
 }
 
 sysreturn accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
@@ -1811,6 +3296,42 @@ sysreturn setsockopt(int sockfd,
     if (!validate_user_memory(optval, optlen, false))
         return -EFAULT;
     switch (level) {
+    case SOL_SOCKET:
+        switch (optname) {
+        case SO_ZEROCOPY:
+            if (optlen != sizeof(int))
+                return -EINVAL;
+            if (s->sock.type != SOCK_STREAM)
+                return -EOPNOTSUPP;
+            s->zerocopy = *((int *)optval) != 0;
+            break;
+        case SO_REUSEPORT:
+            if (optlen != sizeof(int))
+                return -EINVAL;
+            /* membership is decided at bind time */
+            if (s->sock.type == SOCK_STREAM && s->info.tcp.lw &&
+                s->info.tcp.lw->local_port != 0)
+                return -EINVAL;
+            s->reuseport = *((int *)optval) != 0;
+            break;
+        case SO_RCVBUF:
+        case SO_SNDBUF:
+            if (optlen < sizeof(int))
+                return -EINVAL;
+            if (s->sock.type != SOCK_STREAM)
+                goto unimplemented;
+            if (optname == SO_RCVBUF) {
+                s->info.tcp.rcvbuf_lock = true;
+                netsock_set_rcvbuf(s, MAX(*((int *)optval), 0));
+            } else {
+                s->info.tcp.sndbuf_lock = true;
+                netsock_set_sndbuf(s, MAX(*((int *)optval), 0));
+            }
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
     case IPPROTO_IPV6:
         switch (optname) {
         case IPV6_V6ONLY:
@@ -1822,6 +3343,73 @@ sysreturn setsockopt(int sockfd,
             goto unimplemented;
         }
         break;
+    case IPPROTO_UDP:
+        if (s->sock.type != SOCK_DGRAM)
+            return -EOPNOTSUPP;
+        if (optlen < sizeof(int))
+            return -EINVAL;
+        switch (optname) {
+        case UDP_SEGMENT:
+            if (*((int *)optval) < 0 || *((int *)optval) > 0xffff)
+                return -EINVAL;
+            s->info.udp.gso_size = *((int *)optval);
+            break;
+        case UDP_GRO:
+            s->info.udp.gro = *((int *)optval) != 0;
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case IPPROTO_TCP:
+        if (s->sock.type != SOCK_STREAM)
+            return -EOPNOTSUPP;
+        switch (optname) {
+        case TCP_NODELAY:
+        case TCP_CORK:
+            if (optlen < sizeof(int))
+                return -EINVAL;
+            if (optname == TCP_NODELAY)
+                s->info.tcp.nodelay = *((int *)optval) != 0;
+            else
+                s->info.tcp.cork = *((int *)optval) != 0;
+            netsock_tcp_nagle_update(s);
+            /* as in Linux, pending data is pushed once nothing holds it */
+            if (s->info.tcp.state == TCP_SOCK_OPEN && s->info.tcp.lw &&
+                !s->info.tcp.cork) {
+                tcp_output(s->info.tcp.lw);
+                netsock_check_loop();
+            }
+            break;
+        case TCP_ULP:
+            /* "tls" is the only upper layer protocol */
+            if (optlen < 3 || runtime_memcmp(optval, "tls", 3) ||
+                (optlen > 3 && ((char *)optval)[3]) || !ktls_available())
+                return -ENOENT;
+            if (s->info.tcp.tls)
+                return -EEXIST;
+            if (s->info.tcp.state != TCP_SOCK_OPEN)
+                return -ENOTCONN;
+            s->info.tcp.tls = allocate_ktls(s->sock.h);
+            if (s->info.tcp.tls == INVALID_ADDRESS) {
+                s->info.tcp.tls = 0;
+                return -ENOMEM;
+            }
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_TLS:
+        if (s->sock.type != SOCK_STREAM || !s->info.tcp.tls)
+            return -ENOPROTOOPT;
+        switch (optname) {
+        case TLS_TX:
+            return ktls_set_tx(s->info.tcp.tls, optval, optlen);
+        default:
+            /* records are received and decrypted in user space */
+            return -ENOPROTOOPT;
+        }
     default:
         goto unimplemented;
     }
@@ -1832,6 +3420,70 @@ unimplemented:
     return 0;
 }
 
+/* Linux TCP states, indexed by lwIP enum tcp_state */
+static const u8 netsock_tcpi_states[] = {
+    [CLOSED] = 7,
+    [LISTEN] = 10,
+    [SYN_SENT] = 2,
+    [SYN_RCVD] = 3,
+    [ESTABLISHED] = 1,
+    [FIN_WAIT_1] = 4,
+    [FIN_WAIT_2] = 5,
+    [CLOSE_WAIT] = 8,
+    [CLOSING] = 11,
+    [LAST_ACK] = 9,
+    [TIME_WAIT] = 6,
+};
+
+/* lwIP keeps rtt estimates and the rto in slow timer ticks */
+#define netsock_tcpi_usec(ticks)    ((u32)(ticks) * TCP_SLOW_INTERVAL * THOUSAND)
+
+static void netsock_tcp_info(netsock s, struct tcp_info *ti)
+{
+    zero(ti, sizeof(*ti));
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if (!lw) {
+        ti->tcpi_state = netsock_tcpi_states[CLOSED];
+        return;
+    }
+    ti->tcpi_state = netsock_tcpi_states[lw->state];
+    if (lw->state == LISTEN) {
+        /* a tcp_pcb_listen lacks the connection state below */
+        ti->tcpi_unacked = queue_length(s->incoming);
+        ti->tcpi_sacked = s->info.tcp.backlog;
+        return;
+    }
+    ti->tcpi_retransmits = lw->nrtx;
+    ti->tcpi_backoff = lw->persist_backoff;
+#if LWIP_WND_SCALE
+    if (lw->flags & TF_WND_SCALE) {
+        ti->tcpi_options |= TCPI_OPT_WSCALE;
+        ti->tcpi_snd_wscale = lw->snd_scale;
+        ti->tcpi_rcv_wscale = lw->rcv_scale;
+    }
+#endif
+    ti->tcpi_rto = netsock_tcpi_usec(lw->rto);
+    ti->tcpi_snd_mss = lw->mss;
+    ti->tcpi_rcv_mss = lw->mss;
+    ti->tcpi_advmss = lw->mss;
+    for (struct tcp_seg *seg = lw->unacked; seg; seg = seg->next)
+        ti->tcpi_unacked++;
+    for (struct tcp_seg *seg = lw->unsent; seg; seg = seg->next)
+        ti->tcpi_notsent_bytes += seg->len;
+
+    /* sa is the smoothed rtt scaled by 8, sv the deviation scaled by 4 */
+    ti->tcpi_rtt = netsock_tcpi_usec(lw->sa >> 3);
+    ti->tcpi_rttvar = netsock_tcpi_usec(lw->sv >> 2);
+    if (lw->mss) {
+        ti->tcpi_snd_ssthresh = lw->ssthresh / lw->mss;
+        ti->tcpi_snd_cwnd = lw->cwnd / lw->mss;
+    }
+    ti->tcpi_rcv_ssthresh = lw->rcv_wnd;
+    ti->tcpi_rcv_space = lw->rcv_wnd;
+    ti->tcpi_reordering = 3;    /* dupack threshold for fast retransmit */
+    ti->tcpi_snd_wnd = lw->snd_wnd;
+}
+
 sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optlen)
 {
     struct sock *sock = resolve_socket(current->p, sockfd);
@@ -1848,6 +3500,9 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
     union {
         int val;
         struct linger linger;
+        struct tcp_info info;
+        char ulp[4];
+        struct tls12_crypto_info_aes_gcm_256 crypto;
     } ret_optval;
     int ret_optlen;
 
@@ -1864,7 +3519,11 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
             break;
         case SO_SNDBUF:
         case SO_RCVBUF:
-            ret_optval.val = 2048;  /* minimum value for this option in Linux */
+            if (s->sock.type == SOCK_STREAM)
+                ret_optval.val = optname == SO_RCVBUF ? s->info.tcp.rcvbuf :
+                    s->info.tcp.sndbuf;
+            else
+                ret_optval.val = 2048;  /* minimum value for this option in Linux */
             ret_optlen = sizeof(ret_optval.val);
             break;
         case SO_PRIORITY:
@@ -1876,6 +3535,14 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
             ret_optval.linger.l_linger = 0;
             ret_optlen = sizeof(ret_optval.linger);
             break;
+        case SO_ZEROCOPY:
+            ret_optval.val = s->zerocopy;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        case SO_REUSEPORT:
+            ret_optval.val = s->reuseport;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
         default:
             goto unimplemented;
         }
@@ -1890,6 +3557,60 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
             goto unimplemented;
         }
         break;
+    case IPPROTO_UDP:
+        if (s->sock.type != SOCK_DGRAM)
+            return -EOPNOTSUPP;
+        switch (optname) {
+        case UDP_SEGMENT:
+            ret_optval.val = s->info.udp.gso_size;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        case UDP_GRO:
+            ret_optval.val = s->info.udp.gro;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case IPPROTO_TCP:
+        if (s->sock.type != SOCK_STREAM)
+            return -EOPNOTSUPP;
+        switch (optname) {
+        case TCP_NODELAY:
+            ret_optval.val = s->info.tcp.nodelay;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        case TCP_CORK:
+            ret_optval.val = s->info.tcp.cork;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        case TCP_INFO:
+            netsock_tcp_info(s, &ret_optval.info);
+            ret_optlen = sizeof(ret_optval.info);
+            break;
+        case TCP_ULP:
+            if (s->info.tcp.tls) {
+                runtime_memcpy(ret_optval.ulp, "tls", sizeof(ret_optval.ulp));
+                ret_optlen = sizeof(ret_optval.ulp);
+            } else {
+                ret_optlen = 0;
+            }
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_TLS: {
+        if (s->sock.type != SOCK_STREAM || !s->info.tcp.tls || optname != TLS_TX)
+            return -ENOPROTOOPT;
+        u32 len = sizeof(ret_optval.crypto);
+        int rv = ktls_get_tx(s->info.tcp.tls, &ret_optval.crypto, &len);
+        if (rv)
+            return rv;
+        ret_optlen = len;
+        break;
+    }
     default:
         return -EOPNOTSUPP;
     }
@@ -1906,6 +3627,12 @@ unimplemented:
     return -ENOPROTOOPT;
 }
 
+void netsyscall_netstat(buffer b)
+{
+    bprintf(b, "TcpExt: ListenOverflows ListenDrops\n");
+    bprintf(b, "TcpExt: %ld %ld\n", netsock_listen_overflows, netsock_listen_drops);
+}
+
 void register_net_syscalls(struct syscall *map)
 {
     register_syscall(map, socket, socket);
@@ -1919,6 +3646,7 @@ void register_net_syscalls(struct syscall *map)
     register_syscall(map, sendmmsg, sendmmsg);
     register_syscall(map, recvfrom, recvfrom);
     register_syscall(map, recvmsg, recvmsg);
+    register_syscall(map, recvmmsg, recvmmsg);
     register_syscall(map, setsockopt, setsockopt);
     register_syscall(map, getsockname, getsockname);
     register_syscall(map, getpeername, getpeername);
@@ -1926,8 +3654,17 @@ void register_net_syscalls(struct syscall *map)
     register_syscall(map, shutdown, shutdown);
 }
 
-boolean netsyscall_init(unix_heaps uh)
+boolean netsyscall_init(unix_heaps uh, tuple cfg)
 {
+    u64 size;
+    if (get_u64(cfg, sym(tcp_rcvbuf), &size))
+        netsock_rcvbuf_default = MAX(MIN(size, NETSOCK_RCVBUF_MAX), NETSOCK_BUF_MIN);
+    if (get_u64(cfg, sym(tcp_sndbuf), &size))
+        netsock_sndbuf_default = MAX(MIN(size, NETSOCK_SNDBUF_MAX), NETSOCK_BUF_MIN);
+    if (get_u64(cfg, sym(somaxconn), &size))
+        netsock_somaxconn = MAX(MIN(size, NETSOCK_SOMAXCONN_MAX), 1);
+    if (get_u64(cfg, sym(tcp_max_syn_backlog), &size))
+        netsock_syn_backlog = MAX(MIN(size, NETSOCK_SYN_BACKLOG_MAX), 1);
     kernel_heaps kh = (kernel_heaps)uh;
     heap socket_cache = allocate_objcache(heap_general(kh), heap_backed(kh),
 					  sizeof(struct netsock), PAGESIZE);
@@ -1935,6 +3672,8 @@ boolean netsyscall_init(unix_heaps uh)
 	return false;
     uh->socket_cache = socket_cache;
     net_loop_poll = closure(heap_general(kh), netsock_poll);
+    netsock_txrefs_id = tcp_ext_arg_alloc_id();
+    list_init(&netsock_reuseport_groups);
     netlink_init();
     return true;
 }
@@ -7,6 +7,11 @@
 
    The bitmap length may be arbitrarily sized. The bitmap buffer is
    allocated in ALLOC_EXTEND_BITS / 8 byte increments as needed.
+
+   Searches for a free run consult the summary levels (see bitmap.h)
+   rather than the map itself: runs within a word are found by skipping
+   to words with free bits, runs of whole words by looking for runs of
+   set bits in the "entirely free" summaries, a word at a time.
 */
 
 #include <runtime.h>
@@ -88,69 +93,288 @@ boolean bitmap_range_check_and_set(bitmap b, u64 start, u64 nbits, boolean valid
 
     bitmap_extend(b, start + nbits - 1);
     u64 * mapbase = bitmap_base(b);
-    return (!validate || for_range_in_map(mapbase, start, nbits, false, !set)) &&
-        for_range_in_map(mapbase, start, nbits, true, set);
+    if (validate && !for_range_in_map(mapbase, start, nbits, false, !set))
+        return false;
+    for_range_in_map(mapbase, start, nbits, true, set);
+    if (b->summary[0] && nbits > 0)
+        bitmap_summary_update(b, start >> BITMAP_WORDLEN_LOG,
+                              ((start + nbits - 1) >> BITMAP_WORDLEN_LOG) + 1);
+    return true;
 }
 
-static inline u64 bitmap_alloc_internal(bitmap b, u64 nbits, u64 startbit, u64 endbit)
+/* summaries */
+
+#define SUMMARY_L1_SOME 0
+#define SUMMARY_L1_ALL  1
+#define SUMMARY_L2_SOME 2
+#define SUMMARY_L2_ALL  3
+
+static inline u64 *summary_base(bitmap b, int s)
 {
-    int order = find_order(nbits);
-    u64 stride = U64_FROM_BIT(order);
-    endbit = MIN(endbit, b->maxbits);
+    return buffer_ref(b->summary[s], 0);
+}
 
-    u64 bit = pad(startbit, stride);
-    if (bit + nbits > endbit)
-        return INVALID_PHYSICAL;
+static inline void summary_assign(u64 *base, u64 bit, boolean val)
+{
+    u64 mask = 1ull << (bit & BITMAP_WORDMASK);
+    u64 *w = pointer_from_bit(base, bit);
+    *w = val ? *w | mask : *w & ~mask;
+}
 
-    u64 * mapbase = bitmap_base(b);
+/* recompute summary bits for map words [start_word, end_word) */
+void bitmap_summary_update(bitmap b, u64 start_word, u64 end_word)
+{
+    if (start_word >= end_word)
+        return;
+    u64 *m = bitmap_base(b);
+    u64 *s1 = summary_base(b, SUMMARY_L1_SOME);
+    u64 *a1 = summary_base(b, SUMMARY_L1_ALL);
+    for (u64 w = start_word; w < end_word; w++) {
+        summary_assign(s1, w, m[w] != -1ull);
+        summary_assign(a1, w, m[w] == 0);
+    }
+    u64 *s2 = summary_base(b, SUMMARY_L2_SOME);
+    u64 *a2 = summary_base(b, SUMMARY_L2_ALL);
+    for (u64 j = start_word >> BITMAP_WORDLEN_LOG;
+         j <= (end_word - 1) >> BITMAP_WORDLEN_LOG; j++) {
+        summary_assign(s2, j, s1[j] != 0);
+        summary_assign(a2, j, a1[j] == -1ull);
+    }
+}
 
-    endbit -= nbits;
+static void summary_destroy(bitmap b)
+{
+    for (int i = 0; i < BITMAP_SUMMARIES; i++) {
+        if (b->summary[i])
+            deallocate_buffer(b->summary[i]);
+        b->summary[i] = 0;
+    }
+}
+
+/* new bits read as zero (full) until updated */
+static boolean summary_resize(bitmap b)
+{
+    u64 l1words = pad(b->mapbits >> BITMAP_WORDLEN_LOG, BITMAP_WORDLEN) >> BITMAP_WORDLEN_LOG;
+    u64 l1bytes = l1words << 3;
+    u64 l2bytes = pad(l1words, BITMAP_WORDLEN) >> 3;
+    return extend_total(b->summary[SUMMARY_L1_SOME], l1bytes) &&
+        extend_total(b->summary[SUMMARY_L1_ALL], l1bytes) &&
+        extend_total(b->summary[SUMMARY_L2_SOME], l2bytes) &&
+        extend_total(b->summary[SUMMARY_L2_ALL], l2bytes);
+}
 
-    if (nbits >= 64) {
-        /* multi-word */
-        while (bit <= endbit) {
-            if (bitmap_extend(b, bit + nbits))
-                mapbase = bitmap_base(b);
+static boolean summary_init(bitmap b)
+{
+    heap h = b->map ? b->map : b->meta;
+    for (int i = 0; i < BITMAP_SUMMARIES; i++) {
+        b->summary[i] = allocate_buffer(h, sizeof(u64));
+        if (b->summary[i] == INVALID_ADDRESS) {
+            b->summary[i] = 0;
+            summary_destroy(b);
+            return false;
+        }
+    }
+    if (!summary_resize(b)) {
+        summary_destroy(b);
+        return false;
+    }
+    bitmap_summary_update(b, 0, b->mapbits >> BITMAP_WORDLEN_LOG);
+    return true;
+}
 
-            if (for_range_in_map(mapbase, bit, nbits, false, false)) {
-                for_range_in_map(mapbase, bit, nbits, true, true);
-                return bit;
-            }
+/* Called on map extension. Upon failure, the summary is dropped and
+   rebuilt by the next allocation. */
+void bitmap_summary_extend(bitmap b, u64 oldbits)
+{
+    if (!summary_resize(b)) {
+        summary_destroy(b);
+        return;
+    }
+    bitmap_summary_update(b, oldbits >> BITMAP_WORDLEN_LOG, b->mapbits >> BITMAP_WORDLEN_LOG);
+}
 
-            bit += stride;
+/* first set bit in [bit, limit), else limit */
+static inline u64 next_set_bit(u64 *base, u64 bit, u64 limit)
+{
+    while (bit < limit) {
+        u64 w = *pointer_from_bit(base, bit) & (-1ull << (bit & BITMAP_WORDMASK));
+        if (w)
+            return MIN((bit & ~BITMAP_WORDMASK) + lsb(w), limit);
+        bit = (bit | BITMAP_WORDMASK) + 1;
+    }
+    return limit;
+}
+
+/* Offset of the first run of n set bits in f starting at a multiple of
+   stride no lower than lo, else BITMAP_WORDLEN. Requires n <= stride <=
+   BITMAP_WORDLEN, so that a run never crosses a word. */
+static inline u64 word_find_run(u64 f, u64 n, u64 stride, u64 lo)
+{
+    for (u64 len = 1; len < n; ) {
+        u64 s = MIN(len, n - len);
+        f &= f >> s;
+        len += s;
+    }
+    f &= (stride == BITMAP_WORDLEN ? 1 : -1ull / MASK(stride)) & (-1ull << lo);
+    return f ? lsb(f) : BITMAP_WORDLEN;
+}
+
+/* runs within a word: walk words with a free bit */
+static u64 find_run_bits(bitmap b, u64 nbits, u64 stride, u64 bit, u64 limit)
+{
+    u64 *m = bitmap_base(b);
+    u64 *s1 = summary_base(b, SUMMARY_L1_SOME);
+    u64 *s2 = summary_base(b, SUMMARY_L2_SOME);
+    u64 words = b->mapbits >> BITMAP_WORDLEN_LOG;
+    u64 l1words = pad(words, BITMAP_WORDLEN) >> BITMAP_WORDLEN_LOG;
+    u64 w = bit >> BITMAP_WORDLEN_LOG;
+    u64 lo = bit & BITMAP_WORDMASK;
+    while (w < words) {
+        u64 next = next_set_bit(s1, w, pad(w + 1, BITMAP_WORDLEN));
+        if (next == pad(w + 1, BITMAP_WORDLEN)) {
+            /* nothing free in this summary word; skip ahead by the second level */
+            u64 j = next_set_bit(s2, next >> BITMAP_WORDLEN_LOG, l1words);
+            if (j == l1words)
+                break;
+            next = next_set_bit(s1, j << BITMAP_WORDLEN_LOG, (j + 1) << BITMAP_WORDLEN_LOG);
         }
-    } else {
-        for (; bit <= endbit; bit += 64) {
-            /* get offset (for start bit, 0 otherwise) and align bit to word boundary */
-            int word_offset = bit & 63;
-            bit -= word_offset;
-            if (bitmap_extend(b, bit + 64))
-                mapbase = bitmap_base(b);
-
-            u64 mask = MASK(nbits) << word_offset;
-            u64 bw = *pointer_from_bit(mapbase, bit);
-
-            if (bw == -1ull)    /* skip full words */
-                continue;
-
-            do {
-                if (bit + word_offset > endbit)
-                    return INVALID_PHYSICAL;
-
-                if ((bw & mask) == 0) {
-                    assert(for_range_in_map(mapbase, bit + word_offset, nbits, true, true));
-                    return bit + word_offset;
-                }
-
-                mask <<= stride;
-                word_offset += stride;
-            } while (word_offset < 64);
+        if (next != w) {
+            w = next;
+            lo = 0;
+            if (w >= words)
+                break;
+        }
+        u64 off = word_find_run(~m[w], nbits, stride, lo);
+        if (off < BITMAP_WORDLEN) {
+            u64 p = (w << BITMAP_WORDLEN_LOG) + off;
+            return p <= limit ? p : INVALID_PHYSICAL;
+        }
+        w++;
+        lo = 0;
+    }
+    return INVALID_PHYSICAL;
+}
+
+/* whole free words, aligned within a first-level summary word */
+static u64 find_run_words(bitmap b, u64 nbits, u64 stride, u64 bit, u64 limit)
+{
+    u64 *m = bitmap_base(b);
+    u64 *a1 = summary_base(b, SUMMARY_L1_ALL);
+    u64 words = b->mapbits >> BITMAP_WORDLEN_LOG;
+    u64 nwords = nbits >> BITMAP_WORDLEN_LOG;
+    u64 tail = nbits & BITMAP_WORDMASK;
+    u64 wstride = stride >> BITMAP_WORDLEN_LOG;
+    u64 w = bit >> BITMAP_WORDLEN_LOG;
+    while (w < words) {
+        u64 off = word_find_run(*pointer_from_bit(a1, w), nwords, wstride, w & BITMAP_WORDMASK);
+        if (off == BITMAP_WORDLEN) {
+            w = pad(w + 1, BITMAP_WORDLEN);
+            continue;
         }
+        w = (w & ~BITMAP_WORDMASK) + off;
+        u64 p = w << BITMAP_WORDLEN_LOG;
+        if (p > limit || p + nbits > b->mapbits)
+            break;
+        if (!tail || (m[w + nwords] & MASK(tail)) == 0)
+            return p;
+        w += wstride;
     }
+    return INVALID_PHYSICAL;
+}
 
+/* whole free first-level summary words (blocks of 4096 bits) */
+static u64 find_run_blocks(bitmap b, u64 nbits, u64 stride, u64 bit, u64 limit)
+{
+    u64 *m = bitmap_base(b);
+    u64 *a1 = summary_base(b, SUMMARY_L1_ALL);
+    u64 *a2 = summary_base(b, SUMMARY_L2_ALL);
+    const int block_log = 2 * BITMAP_WORDLEN_LOG;
+    u64 nblocks = pad(b->mapbits >> BITMAP_WORDLEN_LOG, BITMAP_WORDLEN) >> BITMAP_WORDLEN_LOG;
+    u64 kblocks = nbits >> block_log;
+    u64 kwords = (nbits >> BITMAP_WORDLEN_LOG) & BITMAP_WORDMASK;
+    u64 tail = nbits & BITMAP_WORDMASK;
+    u64 bstride = stride >> block_log;
+    u64 blk = bit >> block_log;
+    while ((blk = next_set_bit(a2, blk, nblocks)) < nblocks) {
+        if (blk & (bstride - 1)) {
+            blk = pad(blk, bstride);
+            continue;
+        }
+        u64 p = blk << block_log;
+        if (p > limit || p + nbits > b->mapbits)
+            break;
+        u64 w = (blk + kblocks) << BITMAP_WORDLEN_LOG;
+        if (for_range_in_map(a2, blk, kblocks, false, true) &&
+            for_range_in_map(a1, w, kwords, false, true) &&
+            (!tail || (m[w + kwords] & MASK(tail)) == 0))
+            return p;
+        blk += bstride;
+    }
     return INVALID_PHYSICAL;
 }
 
+/* A run may begin in the free tail of the map and continue into the
+   part not yet extended, which is free by definition. */
+static u64 find_run_tail(bitmap b, u64 stride, u64 bit, u64 limit)
+{
+    u64 *m = bitmap_base(b);
+    u64 *a1 = summary_base(b, SUMMARY_L1_ALL);
+    u64 w = b->mapbits >> BITMAP_WORDLEN_LOG;
+    while (w > 0) {
+        if ((w & BITMAP_WORDMASK) == 0 &&
+            *pointer_from_bit(a1, w - BITMAP_WORDLEN) == -1ull) {
+            w -= BITMAP_WORDLEN;
+            continue;
+        }
+        if (m[w - 1] != 0)
+            break;
+        w--;
+    }
+    u64 t = w > 0 ? ((w - 1) << BITMAP_WORDLEN_LOG) + msb(m[w - 1]) + 1 : 0;
+    u64 p = MAX(pad(t, stride), bit);
+    return p <= limit ? p : INVALID_PHYSICAL;
+}
+
+static inline u64 bitmap_alloc_internal(bitmap b, u64 nbits, u64 startbit, u64 endbit)
+{
+    int order = find_order(nbits);
+    u64 stride = U64_FROM_BIT(order);
+    endbit = MIN(endbit, b->maxbits);
+
+    u64 bit = pad(startbit, stride);
+    if (bit + nbits > endbit)
+        return INVALID_PHYSICAL;
+
+    if (!b->summary[0] && !summary_init(b))
+        return INVALID_PHYSICAL;
+
+    u64 limit = endbit - nbits;
+    u64 found;
+    if (nbits < BITMAP_WORDLEN)
+        found = find_run_bits(b, nbits, stride, bit, limit);
+    else if (stride <= BITMAP_WORDLEN * BITMAP_WORDLEN)
+        found = find_run_words(b, nbits, stride, bit, limit);
+    else
+        found = find_run_blocks(b, nbits, stride, bit, limit);
+    if (found == INVALID_PHYSICAL && endbit > b->mapbits)
+        found = find_run_tail(b, stride, bit, limit);
+    if (found == INVALID_PHYSICAL)
+        return found;
+
+    if (found + nbits > b->mapbits) {
+        bitmap_extend(b, found + nbits - 1);
+        if (found + nbits > b->mapbits)
+            return INVALID_PHYSICAL;
+    }
+    u64 *mapbase = bitmap_base(b);
+    assert(for_range_in_map(mapbase, found, nbits, false, false));
+    for_range_in_map(mapbase, found, nbits, true, true);
+    if (b->summary[0])
+        bitmap_summary_update(b, found >> BITMAP_WORDLEN_LOG,
+                              ((found + nbits - 1) >> BITMAP_WORDLEN_LOG) + 1);
+    return found;
+}
+
 u64 bitmap_alloc(bitmap b, u64 nbits)
 {
     return bitmap_alloc_internal(b, nbits, 0, b->maxbits);
@@ -187,6 +411,9 @@ boolean bitmap_dealloc(bitmap b, u64 bit, u64 size)
     }
 
     for_range_in_map(mapbase, bit, size, true, false);
+    if (b->summary[0] && size > 0)
+        bitmap_summary_update(b, bit >> BITMAP_WORDLEN_LOG,
+                              ((bit + size - 1) >> BITMAP_WORDLEN_LOG) + 1);
     return true;
 }
 
@@ -201,6 +428,7 @@ static inline bitmap allocate_bitmap_internal(heap meta, u64 length)
 	length = -1ull << 6; /* don't pad to 0 */
     b->maxbits = length;
     b->mapbits = MIN(ALLOC_EXTEND_BITS, pad(b->maxbits, 64));
+    zero(b->summary, sizeof(b->summary));
     return b;
 }
 
@@ -221,6 +449,7 @@ bitmap allocate_bitmap(heap meta, heap map, u64 length)
 
 void deallocate_bitmap(bitmap b)
 {
+    summary_destroy(b);
     if (b->alloc_map)
 	deallocate_buffer(b->alloc_map);
     deallocate(b->meta, b, sizeof(struct bitmap));
@@ -240,6 +469,7 @@ bitmap bitmap_wrap(heap h, u64 * map, u64 length)
 
 void bitmap_unwrap(bitmap b)
 {
+    summary_destroy(b);
     if (b->alloc_map)
 	unwrap_buffer(b->meta, b->alloc_map);
     deallocate(b->meta, b, sizeof(struct bitmap));
@@ -276,4 +506,6 @@ void bitmap_copy(bitmap dest, bitmap src)
 	bytes len = (dest->mapbits - src->mapbits) >> 3;
 	zero(buffer_ref(dest->alloc_map, off), len);
     }
+    if (dest->summary[0])
+        bitmap_summary_update(dest, 0, dest->mapbits >> BITMAP_WORDLEN_LOG);
 }
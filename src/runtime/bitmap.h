@@ -2,12 +2,23 @@
    page are b0rked */
 #define ALLOC_EXTEND_BITS	U64_FROM_BIT(12)
 
+/* Allocation searches are guided by two summary levels, built on the
+   first allocation from the bitmap. At the first level, each bit
+   represents one map word; at the second, one first-level word:
+
+   summary[0]: map word has a free bit
+   summary[1]: map word is entirely free
+   summary[2]: summary[0] word is nonzero
+   summary[3]: summary[1] word is entirely set (4096 free bits) */
+#define BITMAP_SUMMARIES        4
+
 typedef struct bitmap {
     u64 maxbits;
     u64 mapbits;
     heap meta;
     heap map;
     buffer alloc_map;
+    buffer summary[BITMAP_SUMMARIES];
 } *bitmap;
 
 boolean bitmap_range_check_and_set(bitmap b, u64 start, u64 nbits, boolean validate, boolean set);
@@ -20,6 +31,8 @@ bitmap bitmap_wrap(heap h, u64 * map, u64 length);
 void bitmap_unwrap(bitmap b);
 bitmap bitmap_clone(bitmap b);
 void bitmap_copy(bitmap dest, bitmap src);
+void bitmap_summary_extend(bitmap b, u64 oldbits);
+void bitmap_summary_update(bitmap b, u64 start_word, u64 end_word);
 
 #define bitmap_foreach_word(b, w, offset)				\
     for (u64 offset = 0, * __wp = bitmap_base(b), w = *__wp;		\
@@ -43,7 +56,10 @@ static inline boolean bitmap_extend(bitmap b, u64 i)
     if (i >= b->mapbits) {
         u64 mapbits = pad(i + 1, ALLOC_EXTEND_BITS);
         if (extend_total(b->alloc_map, mapbits >> 3)) {
+            u64 oldbits = b->mapbits;
             b->mapbits = mapbits;
+            if (b->summary[0])
+                bitmap_summary_extend(b, oldbits);
             return true;
         }
     }
@@ -67,4 +83,6 @@ static inline void bitmap_set(bitmap b, u64 i, int val)
 	*p |= mask;
     else
 	*p &= ~mask;
+    if (b->summary[0])
+        bitmap_summary_update(b, i >> 6, (i >> 6) + 1);
 }
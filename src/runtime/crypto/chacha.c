@@ -6,7 +6,9 @@ Public domain.
 
 /* $OpenBSD: chacha.c,v 1.1 2013/11/21 00:45:44 djm Exp $ */
 
+#ifndef CHACHA_EMBED
 #include <runtime.h>
+#endif
 #include "crypto/chacha.h"
 
 #define NULL (0)
@@ -0,0 +1,28 @@
+#include <runtime.h>
+
+#define _deque_buf_offset    pad(sizeof(struct deque), DEFAULT_CACHELINE_SIZE)
+#define _deque_alloc_size(o) (_deque_buf_offset + ((1ull << (o)) * sizeof(void *)))
+
+/* will round up size to next power-of-2 */
+deque allocate_deque(heap h, u64 size)
+{
+    if (size == 0)
+        return INVALID_ADDRESS;
+    int order = find_order(size);
+    deque dq = allocate(h, _deque_alloc_size(order));
+    if (dq == INVALID_ADDRESS)
+        return dq;
+    dq->top = 0;
+    dq->bottom = 0;
+    dq->order = order;
+    dq->d = ((void *)dq) + _deque_buf_offset;
+    dq->h = h;
+    zero(dq->d, (1ull << order) * sizeof(void *));
+    write_barrier();
+    return dq;
+}
+
+void deallocate_deque(deque dq)
+{
+    deallocate(dq->h, dq, _deque_alloc_size(dq->order));
+}
@@ -0,0 +1,93 @@
+/* Work-stealing deque (Chase-Lev)
+
+   A bounded ring of pointers with a single owner and any number of
+   thieves. The owner pushes and pops at the bottom end, thieves take from
+   the top end. Owner operations are not reentrant: if they may be invoked
+   from interrupt context as well, the caller must disable interrupts
+   around them. Unlike the original algorithm, the ring is not grown when
+   full; deque_push() fails and the caller is expected to fall back to
+   another queue.
+*/
+
+typedef struct deque {
+    volatile u32 top;           /* next item to steal */
+    volatile u32 bottom;        /* next free slot for the owner */
+    void ** d;
+    heap h;
+    int order;
+} *deque;
+
+#define _deque_size(dq) (1ul << (dq)->order)
+#define _deque_idx(dq, i) ((i) & MASK((dq)->order))
+
+/* owner only */
+static inline boolean deque_push(deque dq, void *p)
+{
+    if (p == INVALID_ADDRESS)
+        return false;
+    u32 b = dq->bottom;
+    u32 t = dq->top;
+    read_barrier();
+    if (b - t >= _deque_size(dq))
+        return false;           /* full */
+    dq->d[_deque_idx(dq, b)] = p;
+    write_barrier();
+    dq->bottom = b + 1;
+    return true;
+}
+
+/* owner only; pops the most recently pushed item */
+static inline void *deque_pop(deque dq)
+{
+    u32 b = dq->bottom - 1;
+    dq->bottom = b;
+    memory_barrier();
+    u32 t = dq->top;
+    if ((s32)(b - t) < 0) {
+        dq->bottom = b + 1;     /* empty */
+        return INVALID_ADDRESS;
+    }
+    void *p = dq->d[_deque_idx(dq, b)];
+    if (b != t)
+        return p;
+
+    /* last item: race against thieves */
+    if (!compare_and_swap_32((u32 *)&dq->top, t, t + 1))
+        p = INVALID_ADDRESS;
+    dq->bottom = t + 1;
+    return p;
+}
+
+/* any cpu; takes the oldest item */
+static inline void *deque_steal(deque dq)
+{
+    u32 t, b;
+    void *p;
+    do {
+        t = dq->top;
+        memory_barrier();
+        b = dq->bottom;
+        if ((s32)(b - t) <= 0)
+            return INVALID_ADDRESS; /* empty */
+        p = dq->d[_deque_idx(dq, t)];
+        read_barrier();
+    } while (!compare_and_swap_32((u32 *)&dq->top, t, t + 1));
+    return p;
+}
+
+/* transient without the owner's cooperation */
+static inline u64 deque_length(deque dq)
+{
+    s32 n = dq->bottom - dq->top;
+    return n > 0 ? n : 0;
+}
+
+static inline boolean deque_empty(deque dq)
+{
+    return deque_length(dq) == 0;
+}
+
+/* will round up size to next power-of-2 */
+deque allocate_deque(heap h, u64 size);
+
+void deallocate_deque(deque dq);
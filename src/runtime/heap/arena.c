@@ -0,0 +1,144 @@
+/* Arena heap for short-lived objects
+
+   Objects are carved out of the current slab by advancing an offset. A
+   slab counts its live objects, plus one reference held by the arena for
+   as long as the slab is current. A deallocation drops the count of the
+   slab the object belongs to, found by aligning the address down to the
+   slab size, so it never needs to walk or take any lock. Whenever the
+   current slab is found empty, allocation simply starts over at the
+   beginning of it; a retired slab goes back to the parent when its last
+   object is freed.
+
+   Allocations are single-owner and not reentrant. Deallocations may come
+   from any context, and the slab holding an object need not belong to
+   the arena it is freed through. Objects larger than a quarter of a slab
+   are passed through to the parent. The parent must return allocations
+   aligned to the slab size and, if objects are freed concurrently with
+   allocation, must be safe to use concurrently. */
+#include <runtime.h>
+
+#define ARENA_ALIGN 8
+
+typedef struct arena *arena;
+
+typedef struct arena_slab {
+    word refcount;
+    arena a;
+} *arena_slab;
+
+struct arena {
+    struct heap h;
+    heap meta;
+    heap parent;
+    bytes slabsize;
+    arena_slab current;
+    bytes next;                 /* offset of next object in current slab */
+    bytes max_object;
+    word allocated;
+    word total;
+};
+
+#define arena_slab_header pad(sizeof(struct arena_slab), ARENA_ALIGN)
+
+static void arena_slab_release(arena_slab s)
+{
+    if (fetch_and_add(&s->refcount, -1) == 1) {
+        arena a = s->a;
+        fetch_and_add(&a->total, -a->slabsize);
+        deallocate(a->parent, s, a->slabsize);
+    }
+}
+
+static u64 arena_alloc(heap h, bytes size)
+{
+    arena a = (arena)h;
+    if (size > a->max_object) {
+        u64 r = allocate_u64(a->parent, size);
+        if (r != INVALID_PHYSICAL)
+            fetch_and_add(&a->allocated, size);
+        return r;
+    }
+    size = pad(size, ARENA_ALIGN);
+    arena_slab s = a->current;
+    if (s && s->refcount == 1) {
+        /* nothing live in the current slab: start over */
+        a->next = arena_slab_header;
+    } else if (!s || a->next + size > a->slabsize) {
+        if (s)
+            arena_slab_release(s);
+        s = allocate(a->parent, a->slabsize);
+        if (s == INVALID_ADDRESS) {
+            a->current = 0;
+            return INVALID_PHYSICAL;
+        }
+        assert((u64_from_pointer(s) & (a->slabsize - 1)) == 0);
+        s->refcount = 1;
+        s->a = a;
+        fetch_and_add(&a->total, a->slabsize);
+        a->current = s;
+        a->next = arena_slab_header;
+    }
+    u64 r = u64_from_pointer(s) + a->next;
+    a->next += size;
+    fetch_and_add(&s->refcount, 1);
+    fetch_and_add(&a->allocated, size);
+    return r;
+}
+
+static void arena_dealloc(heap h, u64 x, bytes size)
+{
+    arena a = (arena)h;
+    if (size > a->max_object) {
+        fetch_and_add(&a->allocated, -size);
+        deallocate_u64(a->parent, x, size);
+        return;
+    }
+    arena_slab s = pointer_from_u64(x & ~(a->slabsize - 1));
+    fetch_and_add(&s->a->allocated, -pad(size, ARENA_ALIGN));
+    arena_slab_release(s);
+}
+
+static bytes arena_allocated(heap h)
+{
+    return ((arena)h)->allocated;
+}
+
+static bytes arena_total(heap h)
+{
+    return ((arena)h)->total;
+}
+
+/* all objects must have been freed */
+static void arena_destroy(heap h)
+{
+    arena a = (arena)h;
+    assert(a->allocated == 0);
+    if (a->current)
+        arena_slab_release(a->current);
+    deallocate(a->meta, a, sizeof(struct arena));
+}
+
+heap allocate_arena(heap meta, heap parent, bytes slabsize)
+{
+    assert((slabsize & (slabsize - 1)) == 0);
+    assert(slabsize >= 4 * arena_slab_header);
+    arena a = allocate(meta, sizeof(struct arena));
+    if (a == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    a->h.alloc = arena_alloc;
+    a->h.dealloc = arena_dealloc;
+    a->h.destroy = arena_destroy;
+    a->h.allocated = arena_allocated;
+    a->h.total = arena_total;
+    a->h.management = 0;
+    a->h.pagesize = ARENA_ALIGN;
+    a->meta = meta;
+    a->parent = parent;
+    a->slabsize = slabsize;
+    a->current = 0;
+    a->next = 0;
+    a->max_object = slabsize / 4;
+    a->allocated = 0;
+    a->total = 0;
+    return &a->h;
+}
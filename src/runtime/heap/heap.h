@@ -40,6 +40,7 @@ heap allocate_wrapped_objcache(heap meta, heap parent, bytes objsize, bytes page
 boolean objcache_validate(heap h);
 heap objcache_from_object(u64 obj, bytes parent_pagesize);
 heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes pagesize);
+heap allocate_arena(heap meta, heap parent, bytes slabsize);
 
 // really internals
 
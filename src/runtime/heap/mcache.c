@@ -11,6 +11,13 @@
    child heaps and not the parent. malloc/calloc functions exposed to
    such code should assert that the requested size does not exceed the
    maximum size passed to allocate_mcache (1ull << max_order).
+
+   Each size class, and the parent fallback, counts its allocations,
+   failures and the bytes actually requested by callers. The management
+   tree reports these under "classes", along with the pages each cache
+   holds and the internal fragmentation, which is the share of the
+   bytes handed out that were lost to rounding up to the class size, in
+   percent.
 */
 
 //#define MCACHE_DEBUG
@@ -18,11 +25,19 @@
 #include <runtime.h>
 #include <management.h>
 
+typedef struct mcache_stats {
+    u64 allocs;
+    u64 failures;
+    u64 requested;              /* bytes asked for in successful allocations */
+} *mcache_stats;
+
 typedef struct mcache {
     struct heap h;
     heap parent;
     heap meta;
     vector caches;
+    mcache_stats stats;         /* by cache index */
+    struct mcache_stats parent_stats;
     u64 pagesize;
     u64 allocated;
     u64 parent_threshold;
@@ -43,7 +58,11 @@ u64 mcache_alloc(heap h, bytes b)
     if (b > m->parent_threshold) {
         u64 size = pad(b, m->parent->pagesize);
         u64 a = allocate_u64(m->parent, size);
-        if (a != INVALID_PHYSICAL) {
+        if (a == INVALID_PHYSICAL) {
+            m->parent_stats.failures++;
+        } else {
+            m->parent_stats.allocs++;
+            m->parent_stats.requested += b;
             m->allocated += size;
 #ifdef MCACHE_DEBUG
             rputs("fallback to parent, size ");
@@ -57,7 +76,8 @@ u64 mcache_alloc(heap h, bytes b)
     }
 
     /* Could become a binary search if search set is large... */
-    vector_foreach(m->caches, o) {
+    for (int i = 0; i < vector_length(m->caches); i++) {
+        o = vector_get(m->caches, i);
 	if (o && b <= o->pagesize) {
 #ifdef MCACHE_DEBUG
 	    rputs("match cache ");
@@ -71,8 +91,13 @@ u64 mcache_alloc(heap h, bytes b)
 		halt("failed!\n");
 #endif
 	    u64 a = allocate_u64(o, o->pagesize);
-	    if (a != INVALID_PHYSICAL)
+	    if (a != INVALID_PHYSICAL) {
 		m->allocated += o->pagesize;
+                m->stats[i].allocs++;
+                m->stats[i].requested += b;
+            } else {
+                m->stats[i].failures++;
+            }
 #ifdef MCACHE_DEBUG
 	    print_u64(a);
 	    rputs(", post validate...");
@@ -178,6 +203,8 @@ void destroy_mcache(heap h)
 	if (o)
 	    o->destroy(o);
     }
+    if (m->stats)
+        deallocate(m->meta, m->stats, vector_length(m->caches) * sizeof(struct mcache_stats));
     deallocate(m->meta, m, sizeof(struct mcache));
 }
 
@@ -216,6 +243,62 @@ closure_function(2, 0, value, mcache_get_free,
     return value_rewrite_u64(bound(v), mcache_total(h) - mcache_allocated(h));
 }
 
+enum {
+    MCACHE_STAT_ALLOCS,
+    MCACHE_STAT_FAILURES,
+    MCACHE_STAT_PAGES,
+    MCACHE_STAT_FRAGMENTATION,
+    MCACHE_STAT_COUNT
+};
+
+static const char *mcache_stat_names[MCACHE_STAT_COUNT] = {
+    "allocs", "failures", "pages", "fragmentation",
+};
+
+/* cache index -1 is the parent fallback, which has no pages or size class */
+closure_function(4, 0, value, mcache_get_class_stat,
+                 mcache, m, int, index, int, stat, value, v)
+{
+    mcache m = bound(m);
+    int index = bound(index);
+    mcache_stats st = index < 0 ? &m->parent_stats : &m->stats[index];
+    heap o = index < 0 ? 0 : vector_get(m->caches, index);
+    u64 n = 0;
+    switch (bound(stat)) {
+    case MCACHE_STAT_ALLOCS:
+        n = st->allocs;
+        break;
+    case MCACHE_STAT_FAILURES:
+        n = st->failures;
+        break;
+    case MCACHE_STAT_PAGES:
+        n = o ? heap_total(o) / m->pagesize : 0;
+        break;
+    case MCACHE_STAT_FRAGMENTATION:
+        if (o && st->allocs)
+            n = 100 - st->requested * 100 / (st->allocs * o->pagesize);
+        break;
+    }
+    return value_rewrite_u64(bound(v), n);
+}
+
+static tuple mcache_class_management(mcache m, int index)
+{
+    int nstats = index < 0 ? MCACHE_STAT_PAGES : MCACHE_STAT_COUNT;
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    for (int stat = 0; stat < nstats; stat++) {
+        value v = value_from_u64(m->meta, 0);
+        symbol s = sym_this(mcache_stat_names[stat]);
+        set(t, s, v);
+        tuple_notifier_register_get_notify(n, s, closure(m->meta, mcache_get_class_stat,
+                                                         m, index, stat, v));
+    }
+    return (tuple)n;
+}
+
 #define register_stat(m, n, t, name)                                    \
     v = value_from_u64(m->meta, 0);                                     \
     s = sym(name);                                                      \
@@ -244,6 +327,15 @@ static value mcache_management(heap h)
             set(c, intern_u64(o->pagesize), heap_management(o));
     }
     set(t, sym(caches), c);
+    c = allocate_tuple();
+    assert(c != INVALID_ADDRESS);
+    for (int i = 0; i < vector_length(m->caches); i++) {
+        o = vector_get(m->caches, i);
+        if (o)
+            set(c, intern_u64(o->pagesize), mcache_class_management(m, i));
+    }
+    set(c, sym(parent), mcache_class_management(m, -1));
+    set(t, sym(classes), c);
     m->mgmt = (tuple)n;
     return n;
 }
@@ -287,6 +379,8 @@ heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes
     m->meta = meta;
     m->parent = parent;
     m->caches = allocate_vector(meta, 1);
+    m->stats = 0;
+    zero(&m->parent_stats, sizeof(m->parent_stats));
     m->pagesize = pagesize;
     m->allocated = 0;
     m->parent_threshold = U64_FROM_BIT(max_order);
@@ -311,5 +405,12 @@ heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes
 	}
 	assert(vector_set(m->caches, i, h));
     }
+    bytes statsize = vector_length(m->caches) * sizeof(struct mcache_stats);
+    m->stats = allocate_zero(meta, statsize);
+    if (m->stats == INVALID_ADDRESS) {
+        m->stats = 0;
+        destroy_mcache((heap)m);
+        return INVALID_ADDRESS;
+    }
     return (heap)m;
 }
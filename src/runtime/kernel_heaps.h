@@ -55,6 +55,14 @@ typedef struct kernel_heaps {
        processing). While heap operations from interrupt handlers are
        generally discouraged, they should be safe on the locked heap. */
     heap locked;
+
+    /* For short-lived allocations such as I/O completion closures:
+       objects are bump-allocated from a per-cpu arena, which returns
+       memory a slab at a time once all objects in the slab are
+       freed. Safe to use from any context, including interrupt
+       handlers; an object may be freed on any cpu. Until the per-cpu
+       arenas are set up, this is the locked heap. */
+    heap transient;
 } *kernel_heaps;
 
 static inline id_heap heap_physical(kernel_heaps heaps)
@@ -86,3 +94,8 @@ static inline heap heap_locked(kernel_heaps heaps)
 {
     return heaps->locked;
 }
+
+static inline heap heap_transient(kernel_heaps heaps)
+{
+    return heaps->transient;
+}
@@ -0,0 +1,157 @@
+/* LZ4 block format
+
+   A block is a sequence of literal runs, each followed by a back-reference
+   to earlier output. Every sequence starts with a token holding the literal
+   length in its upper nibble and the match length minus LZ4_MIN_MATCH in its
+   lower nibble; a nibble value of 15 is continued with bytes of 255 ending
+   with a smaller byte. The literals come next, then the match offset as 16
+   bits little endian. The last sequence of a block has literals only.
+
+   The compressor is a greedy single-pass matcher over a hash table of the
+   last position seen for each 4-byte sequence. */
+#include <runtime.h>
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_HASH_BITS       12
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_MFLIMIT         12  /* the last match starts at least this far from the end */
+#define LZ4_LAST_LITERALS   5   /* the block always ends with this many literals */
+
+static inline u32 lz4_read32(const u8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static inline u32 lz4_hash(u32 seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static inline u8 *lz4_put_length(u8 *op, bytes len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+bytes lz4_compress_bound(bytes len)
+{
+    return len + len / 255 + 16;
+}
+
+/* Returns the compressed length, or 0 if it would exceed dest_len. */
+bytes lz4_compress(heap h, const void *src, bytes len, void *dest, bytes dest_len)
+{
+    const u8 *base = src;
+    const u8 *ip = base, *anchor = base, *iend = base + len;
+    u8 *op = dest, *oend = op + dest_len;
+
+    if (len > LZ4_MFLIMIT) {
+        u32 *table = allocate_zero(h, sizeof(u32) << LZ4_HASH_BITS);
+        if (table == INVALID_ADDRESS)
+            return 0;
+        const u8 *mflimit = iend - LZ4_MFLIMIT;
+        const u8 *matchlimit = iend - LZ4_LAST_LITERALS;
+        while (ip < mflimit) {
+            u32 seq = lz4_read32(ip);
+            u32 *slot = &table[lz4_hash(seq)];
+            const u8 *match = base + *slot;
+            *slot = ip - base;
+            if (match >= ip || ip - match > LZ4_MAX_OFFSET || lz4_read32(match) != seq) {
+                ip++;
+                continue;
+            }
+            while (ip > anchor && match > base && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+            bytes offset = ip - match;
+            const u8 *end = ip + LZ4_MIN_MATCH;
+            match += LZ4_MIN_MATCH;
+            while (end < matchlimit && *end == *match) {
+                end++;
+                match++;
+            }
+            bytes lit = ip - anchor;
+            bytes mlen = end - ip - LZ4_MIN_MATCH;
+            if (oend - op < 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1) {
+                deallocate(h, table, sizeof(u32) << LZ4_HASH_BITS);
+                return 0;
+            }
+            u8 *token = op++;
+            *token = (MIN(lit, 15) << 4) | MIN(mlen, 15);
+            if (lit >= 15)
+                op = lz4_put_length(op, lit - 15);
+            runtime_memcpy(op, anchor, lit);
+            op += lit;
+            *op++ = offset & 0xff;
+            *op++ = offset >> 8;
+            if (mlen >= 15)
+                op = lz4_put_length(op, mlen - 15);
+            anchor = ip = end;
+        }
+        deallocate(h, table, sizeof(u32) << LZ4_HASH_BITS);
+    }
+
+    bytes lit = iend - anchor;
+    if (oend - op < 1 + lit / 255 + 1 + lit)
+        return 0;
+    *op++ = MIN(lit, 15) << 4;
+    if (lit >= 15)
+        op = lz4_put_length(op, lit - 15);
+    runtime_memcpy(op, anchor, lit);
+    op += lit;
+    return op - (u8 *)dest;
+}
+
+static inline boolean lz4_get_length(const u8 **ip, const u8 *iend, bytes *len)
+{
+    u8 b;
+    do {
+        if (*ip >= iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+/* Returns the decompressed length, or -1 if the block is malformed or does not
+   fit in dest_len bytes. */
+s64 lz4_decompress(const void *src, bytes len, void *dest, bytes dest_len)
+{
+    const u8 *ip = src, *iend = ip + len;
+    u8 *op = dest, *oend = op + dest_len;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+        bytes lit = token >> 4;
+        if (lit == 15 && !lz4_get_length(&ip, iend, &lit))
+            return -1;
+        if (lit > iend - ip || lit > oend - op)
+            return -1;
+        runtime_memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend)
+            break;
+        if (iend - ip < 2)
+            return -1;
+        bytes offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op - (u8 *)dest)
+            return -1;
+        bytes mlen = token & 15;
+        if (mlen == 15 && !lz4_get_length(&ip, iend, &mlen))
+            return -1;
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > oend - op)
+            return -1;
+        /* matches may overlap their own output */
+        const u8 *match = op - offset;
+        while (mlen--)
+            *op++ = *match++;
+    }
+    return op - (u8 *)dest;
+}
@@ -143,9 +143,9 @@ define_closure_function(1, 2, boolean, each_request,
             handle_request(req, bound(out));
             timestamp t = seconds(period);
             management.timer_req = req;
-            management.t = register_timer(runloop_timers, CLOCK_ID_MONOTONIC, t, false, t,
-                                          init_closure(&management.timer_expiry, mgmt_timer_expiry,
-                                                       bound(out)));
+            management.t = kern_register_timer(CLOCK_ID_MONOTONIC, t, false, t,
+                                               init_closure(&management.timer_expiry, mgmt_timer_expiry,
+                                                            bound(out)));
             if (management.t == INVALID_ADDRESS) {
                 management.t = 0;
                 resultstr = "failed to allocate timer";
@@ -344,6 +344,33 @@ void tuple_notifier_unwrap(tuple_notifier tn)
     deallocate(management.fth, tn, sizeof(struct tuple_notifier));
 }
 
+/* replaces the contents of b with the non-empty buckets as "log2:count"
+   pairs */
+void log2_hist_print(buffer b, u64 *buckets)
+{
+    buffer_clear(b);
+    for (int i = 0; i < LOG2_HIST_BUCKETS; i++) {
+        if (buckets[i])
+            bprintf(b, "%s%d:%ld", buffer_length(b) ? " " : "", i, buckets[i]);
+    }
+}
+
+closure_function(2, 0, value, log2_hist_get,
+                 u64 *, buckets, value, v)
+{
+    log2_hist_print((buffer)bound(v), bound(buckets));
+    return bound(v);
+}
+
+/* attribute s of t (wrapped by tn) reads as the histogram in buckets */
+void log2_hist_register(tuple_notifier tn, tuple t, symbol s, u64 *buckets)
+{
+    value v = allocate_buffer(management.h, 64);
+    assert(v != INVALID_ADDRESS);
+    set(t, s, v);
+    tuple_notifier_register_get_notify(tn, s, closure(management.h, log2_hist_get, buckets, v));
+}
+
 extern void init_management_telnet(heap h, value meta);
 
 void init_management_root(tuple root)
@@ -13,3 +13,6 @@ tuple_notifier tuple_notifier_wrap(tuple parent);
 void tuple_notifier_unwrap(tuple_notifier tn);
 void tuple_notifier_register_get_notify(tuple_notifier tn, symbol s, get_value_notify n);
 void tuple_notifier_register_set_notify(tuple_notifier tn, symbol s, set_value_notify n);
+
+void log2_hist_print(buffer b, u64 *buckets);
+void log2_hist_register(tuple_notifier tn, tuple t, symbol s, u64 *buckets);
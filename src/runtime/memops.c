@@ -1,5 +1,62 @@
 #include <runtime.h>
 
+/* On x86_64, copies and fills past a length threshold use the string
+   instructions when the cpu advertises fast microcode for them: ERMS
+   (enhanced rep movsb/stosb) makes them win from a few hundred bytes,
+   FSRM (fast short rep mov) at any length. Past the last level cache
+   the microcode switches to non-temporal stores by itself. The kernel is
+   built without SSE, so no vector registers are used; the word loops
+   below remain the fallback and serve every other architecture. */
+
+u32 memops_features;
+
+#ifdef __x86_64__
+#define MEMOPS_REP_THRESHOLD    256
+
+static inline void memops_cpuid(u32 fn, u32 ecx, u32 *v)
+{
+    asm volatile("cpuid" : "=a" (v[0]), "=b" (v[1]), "=c" (v[2]), "=d" (v[3]) : "0" (fn), "2" (ecx));
+}
+
+static inline void rep_movsb(void *dst, const void *src, bytes len)
+{
+    asm volatile("rep movsb" : "+D" (dst), "+S" (src), "+c" (len) :: "memory");
+}
+
+static inline void rep_stosb(void *dst, u8 b, bytes len)
+{
+    asm volatile("rep stosb" : "+D" (dst), "+c" (len) : "a" (b) : "memory");
+}
+
+static inline boolean memops_rep(bytes len)
+{
+    return (memops_features & MEMOPS_ERMS) && len >= MEMOPS_REP_THRESHOLD;
+}
+
+/* FSRM covers movsb only */
+static inline boolean memops_rep_movsb(bytes len)
+{
+    return (memops_features & MEMOPS_FSRM) || memops_rep(len);
+}
+
+void init_memops(void)
+{
+    u32 v[4];
+    memops_cpuid(0, 0, v);
+    if (v[0] < 7)
+        return;
+    memops_cpuid(7, 0, v);
+    if (v[1] & U64_FROM_BIT(9))
+        memops_features |= MEMOPS_ERMS;
+    if (v[3] & U64_FROM_BIT(4))
+        memops_features |= MEMOPS_FSRM;
+}
+#else
+void init_memops(void)
+{
+}
+#endif
+
 /* Copy by advancing memory addresses in forward direction. */
 static inline void memcpyf_8(void *dst, const void *src, bytes len)
 {
@@ -45,6 +102,14 @@ void runtime_memcpy(void *a, const void *b, bytes len)
     unsigned long long_word1;
     unsigned long long_word2;
 
+#ifdef __x86_64__
+    /* the string instructions only copy forward */
+    if (memops_rep_movsb(len) && ((unsigned long)a < (unsigned long)b ||
+                                  (unsigned long)a >= (unsigned long)b + len)) {
+        rep_movsb(a, b, len);
+        return;
+    }
+#endif
     if ((unsigned long)a < (unsigned long)b) {
         if (len < sizeof(long)) {
             memcpyf_8(a, b, len);
@@ -127,6 +192,12 @@ KLIB_EXPORT(runtime_memcpy);
 
 void runtime_memset(u8 *a, u8 b, bytes len)
 {
+#ifdef __x86_64__
+    if (memops_rep(len)) {
+        rep_stosb(a, b, len);
+        return;
+    }
+#endif
     if (len < sizeof(long)) {
         memset_8(a, b, len);
         return;
@@ -207,3 +278,36 @@ int runtime_memcmp(const void *a, const void *b, bytes len)
     return memcmp_8(a + len - end_len, p_long_b, end_len);
 }
 KLIB_EXPORT(runtime_memcmp);
+
+#define MEMCHR_ONES     (~0ul / 0xff)
+#define MEMCHR_HIGHS    (MEMCHR_ONES << 7)
+
+/* Find the first byte equal to c, a word at a time: a word XORed with c
+   repeated in every byte has a zero byte where c is, which the borrow of
+   subtracting one from each byte exposes in that byte's top bit. */
+void *runtime_memchr(const void *a, u8 c, bytes len)
+{
+    const u8 *p = a;
+    while (len > 0 && ((unsigned long)p & (sizeof(long) - 1))) {
+        if (*p == c)
+            return (void *)p;
+        p++;
+        len--;
+    }
+    unsigned long pattern = MEMCHR_ONES * c;
+    while (len >= sizeof(long)) {
+        unsigned long w = *(unsigned long *)p ^ pattern;
+        if ((w - MEMCHR_ONES) & ~w & MEMCHR_HIGHS)
+            break;
+        p += sizeof(long);
+        len -= sizeof(long);
+    }
+    while (len > 0) {
+        if (*p == c)
+            return (void *)p;
+        p++;
+        len--;
+    }
+    return 0;
+}
+KLIB_EXPORT(runtime_memchr);
@@ -99,6 +99,46 @@ static inline void * _dequeue_common(queue q, boolean multi)
     return p;
 }
 
+/* Claim up to n consecutive items with a single reservation, amortizing
+   the atomic operation and commit wait across the batch. */
+static inline u32 _dequeue_n_common(queue q, void **buf, u32 n, boolean multi)
+{
+    u32 count, next, size = _queue_size(q);
+    union combined cc;
+
+  retry:
+    cc.w = q->cc.w;               /* cons_head, prod_tail */
+
+    count = cc.tail - cc.head;
+    if (count == 0)
+        return 0;               /* empty */
+    _queue_assert(count <= size);
+    if (count > n)
+        count = n;
+    next = cc.head + count;
+    if (multi) {
+        if (!compare_and_swap_32((u32*)&q->cons_head, cc.head, next))
+            goto retry;
+    } else {
+        q->cons_head = next;
+    }
+
+    /* retrieve data */
+    for (u32 i = 0; i < count; i++)
+        buf[i] = q->d[_queue_idx(q, cc.head + i)];
+    read_barrier();
+
+    /* multi-consumer: wait for previous dequeues to commit */
+    if (multi) {
+        while (q->cons_tail != cc.head)
+            _queue_pause();
+    }
+
+    /* commit */
+    q->cons_tail = next;
+    return count;
+}
+
 /* multi-producer by default */
 static inline boolean enqueue(queue q, void *p)
 {
@@ -120,6 +160,17 @@ static inline void *dequeue_single(queue q)
     return _dequeue_common(q, false);
 }
 
+/* returns the number of items stored in buf, zero if empty */
+static inline u32 dequeue_n(queue q, void **buf, u32 n)
+{
+    return _dequeue_n_common(q, buf, n, true);
+}
+
+static inline u32 dequeue_n_single(queue q, void **buf, u32 n)
+{
+    return _dequeue_n_common(q, buf, n, false);
+}
+
 /* results for these are clearly transient without a lock on q */
 static inline u64 queue_length(queue q)
 {
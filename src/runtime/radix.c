@@ -0,0 +1,191 @@
+/* Radix tree keyed by u64 index
+
+   Each node holds RADIX_SLOTS pointers, to child nodes or, at the leaf
+   level, to entries; a lookup is a fixed walk of t->height nodes with no
+   key comparisons. The tree grows upward as larger indices are inserted,
+   and nodes are freed as they become empty. Ranges of indices are walked
+   in order by radix_gang_lookup(), which visits each leaf once instead of
+   descending from the root for every entry.
+*/
+
+#include <runtime.h>
+
+//#define RADIX_DEBUG
+#ifdef RADIX_DEBUG
+#define radix_debug(x, ...) do {rprintf("RADIX %s: " x, __func__, ##__VA_ARGS__);} while(0)
+#else
+#define radix_debug(x, ...)
+#endif
+
+#define level_shift(level) ((level) * RADIX_ORDER)
+#define slot_index(index, level) (((index) >> level_shift(level)) & MASK(RADIX_ORDER))
+
+/* number of usable slots at a level (the topmost level may not cover a full node) */
+static inline u64 level_slots(int level)
+{
+    int shift = level_shift(level);
+    return (64 - shift >= RADIX_ORDER) ? RADIX_SLOTS : U64_FROM_BIT(64 - shift);
+}
+
+static inline boolean index_fits(int height, u64 index)
+{
+    return level_shift(height) >= 64 || (index >> level_shift(height)) == 0;
+}
+
+static radix_node allocate_radix_node(radix_tree t)
+{
+    radix_node n = allocate(t->h, sizeof(struct radix_node));
+    if (n != INVALID_ADDRESS)
+        zero(n, sizeof(struct radix_node));
+    return n;
+}
+
+static boolean node_is_empty(radix_node n)
+{
+    for (int i = 0; i < RADIX_SLOTS; i++)
+        if (n->slots[i])
+            return false;
+    return true;
+}
+
+boolean radix_insert(radix_tree t, u64 index, void *p)
+{
+    radix_debug("tree %p, index 0x%lx, p %p\n", t, index, p);
+    assert(p);
+    if (!t->root) {
+        t->root = allocate_radix_node(t);
+        if (t->root == INVALID_ADDRESS) {
+            t->root = 0;
+            return false;
+        }
+        t->height = 1;
+    }
+    while (!index_fits(t->height, index)) {
+        radix_node n = allocate_radix_node(t);
+        if (n == INVALID_ADDRESS)
+            return false;
+        n->slots[0] = t->root;
+        t->root = n;
+        t->height++;
+    }
+    radix_node n = t->root;
+    for (int level = t->height - 1; level > 0; level--) {
+        void **slot = &n->slots[slot_index(index, level)];
+        if (!*slot) {
+            radix_node c = allocate_radix_node(t);
+            if (c == INVALID_ADDRESS)
+                return false;
+            *slot = c;
+        }
+        n = *slot;
+    }
+    void **slot = &n->slots[slot_index(index, 0)];
+    if (*slot)
+        return false;
+    *slot = p;
+    t->count++;
+    return true;
+}
+
+void *radix_remove(radix_tree t, u64 index)
+{
+    radix_debug("tree %p, index 0x%lx\n", t, index);
+    if (!t->root || !index_fits(t->height, index))
+        return INVALID_ADDRESS;
+    radix_node path[RADIX_MAXHEIGHT];
+    radix_node n = t->root;
+    for (int level = t->height - 1; level > 0; level--) {
+        path[level] = n;
+        n = n->slots[slot_index(index, level)];
+        if (!n)
+            return INVALID_ADDRESS;
+    }
+    void *p = n->slots[slot_index(index, 0)];
+    if (!p)
+        return INVALID_ADDRESS;
+    n->slots[slot_index(index, 0)] = 0;
+    t->count--;
+
+    /* free nodes left empty, bottom up */
+    for (int level = 0; level < t->height && node_is_empty(n); level++) {
+        deallocate(t->h, n, sizeof(struct radix_node));
+        if (level == t->height - 1) {
+            t->root = 0;
+            t->height = 0;
+            break;
+        }
+        n = path[level + 1];
+        n->slots[slot_index(index, level + 1)] = 0;
+    }
+    return p;
+}
+
+void *radix_lookup(radix_tree t, u64 index)
+{
+    if (!t->root || !index_fits(t->height, index))
+        return INVALID_ADDRESS;
+    radix_node n = t->root;
+    for (int level = t->height - 1; level > 0; level--) {
+        n = n->slots[slot_index(index, level)];
+        if (!n)
+            return INVALID_ADDRESS;
+    }
+    void *p = n->slots[slot_index(index, 0)];
+    return p ? p : INVALID_ADDRESS;
+}
+
+static u64 gang_lookup_node(radix_node n, int level, u64 base, u64 start, u64 end,
+                            void **results, u64 max)
+{
+    int shift = level_shift(level);
+    u64 found = 0;
+    u64 i = start > base ? (start - base) >> shift : 0;
+    for (; i < level_slots(level) && found < max; i++) {
+        u64 slot_base = base + (i << shift);
+        if (slot_base >= end)
+            break;
+        void *p = n->slots[i];
+        if (!p)
+            continue;
+        if (level == 0)
+            results[found++] = p;
+        else
+            found += gang_lookup_node(p, level - 1, slot_base, start, end,
+                                      results + found, max - found);
+    }
+    return found;
+}
+
+u64 radix_gang_lookup(radix_tree t, u64 start, u64 end, void **results, u64 max)
+{
+    if (!t->root || start >= end || max == 0 || !index_fits(t->height, start))
+        return 0;
+    return gang_lookup_node(t->root, t->height - 1, 0, start, end, results, max);
+}
+
+static void destruct_node(radix_tree t, radix_node n, int level)
+{
+    if (level > 0) {
+        for (int i = 0; i < RADIX_SLOTS; i++)
+            if (n->slots[i])
+                destruct_node(t, n->slots[i], level - 1);
+    }
+    deallocate(t->h, n, sizeof(struct radix_node));
+}
+
+void destruct_radix_tree(radix_tree t)
+{
+    if (t->root)
+        destruct_node(t, t->root, t->height - 1);
+    t->root = 0;
+    t->height = 0;
+    t->count = 0;
+}
+
+void init_radix_tree(radix_tree t, heap h)
+{
+    t->root = 0;
+    t->height = 0;
+    t->count = 0;
+    t->h = h;
+}
@@ -0,0 +1,38 @@
+/* radix tree mapping u64 indices to non-null pointers */
+
+#define RADIX_ORDER     6
+#define RADIX_SLOTS     U64_FROM_BIT(RADIX_ORDER)
+#define RADIX_MAXHEIGHT ((64 + RADIX_ORDER - 1) / RADIX_ORDER)
+
+typedef struct radix_node {
+    void *slots[RADIX_SLOTS];
+} *radix_node;
+
+typedef struct radix_tree {
+    radix_node root;
+    int height;                 /* 0 for an empty tree; leaves are at height 1 */
+    u64 count;
+    heap h;
+} *radix_tree;
+
+void init_radix_tree(radix_tree t, heap h);
+
+/* Fails if an entry already exists at index or a node can't be allocated. */
+boolean radix_insert(radix_tree t, u64 index, void *p);
+
+/* Returns the removed entry, or INVALID_ADDRESS if there was none. */
+void *radix_remove(radix_tree t, u64 index);
+
+void *radix_lookup(radix_tree t, u64 index);
+
+/* Store in results, in index order, up to max entries with indices in [start, end);
+   returns the number of entries found. */
+u64 radix_gang_lookup(radix_tree t, u64 start, u64 end, void **results, u64 max);
+
+/* Free all nodes; entries themselves are left to the caller. */
+void destruct_radix_tree(radix_tree t);
+
+static inline u64 radix_get_count(radix_tree t)
+{
+    return t->count;
+}
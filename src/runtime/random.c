@@ -25,13 +25,25 @@
  *
  */
 
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
 #include <crypto/chacha.h>
 
 /*
  * Inspired by FreeBSD arc4random()
  *
  * See: https://svnweb.freebsd.org/base/head/sys/libkern/arc4random.c
+ *
+ * The kernel keeps one generator per cpu, used with interrupts disabled,
+ * so that callers on different cpus neither contend nor share keystream.
+ * Each generator is keyed on first use and rekeyed when the global
+ * generation changes (random_reseed()), after CHACHA20_RESEED_BYTES of
+ * output or after CHACHA20_RESEED_SECONDS. The generation is also
+ * published to the vdso, where it invalidates the user space getrandom
+ * states.
  */
 
 #define CHACHA20_RESEED_BYTES   65536
@@ -39,12 +51,17 @@
 #define CHACHA20_KEYBYTES       32
 #define CHACHA20_BUFFER_SIZE    64
 
+/* output produced per visit to the generator, bounding the time spent
+   with interrupts disabled */
+#define CHACHA20_CHUNK_SIZE     256
+
 struct chacha20_s {
     int numbytes;
     u64 t_reseed;
+    u64 generation;
     u8 m_buffer[CHACHA20_BUFFER_SIZE];
     struct chacha_ctx ctx;
-};
+} __attribute__((aligned(64)));
 
 extern u64 random_seed();
 
@@ -60,7 +77,6 @@ chacha20_randomstir(struct chacha20_s *chacha20, timestamp t)
     for (int i = 0; i < sizeof(key); i += sizeof(seed)) {
         seed = random_seed();
         *(u64 *) (key + i) = seed;
-        i += sizeof(seed);
     }
 
     u64 now_sec = sec_from_timestamp(t);
@@ -68,45 +84,92 @@ chacha20_randomstir(struct chacha20_s *chacha20, timestamp t)
 
     chacha_keysetup(&chacha20->ctx, key, CHACHA20_KEYBYTES*8);
     chacha_ivsetup(&chacha20->ctx, (u8 *) &now_sec, (u8 *) &now_usec);
+    zero(key, sizeof(key));
     /* Reset for next reseed cycle. */
     chacha20->t_reseed = now_sec + CHACHA20_RESEED_SECONDS;
     chacha20->numbytes = 0;
 }
 
-// should be per-CPU structure
+static u64 random_generation = 1;
+
+#ifdef KERNEL
+#define __vdso_dat (&(VVAR_REF(vdso_dat)))
+
+static struct chacha20_s chacha20inst[MAX_CPUS];
+
+#define random_lock()           irq_disable_save()
+#define random_unlock(flags)    irq_restore(flags)
+#define random_instance()       (&chacha20inst[current_cpu()->id])
+
+static void random_publish_generation(u64 generation)
+{
+    __vdso_dat->rng_generation = generation;
+}
+#else
 static struct chacha20_s chacha20inst;
 
+#define random_lock()           0
+#define random_unlock(flags)    (void)(flags)
+#define random_instance()       (&chacha20inst)
+#define random_publish_generation(generation) (void)(generation)
+#endif
+
 void init_random()
 {
     assert(CHACHA20_KEYBYTES*8 >= CHACHA_MINKEYLEN);
-    chacha20_randomstir(&chacha20inst, now(CLOCK_ID_MONOTONIC_RAW));
+    random_reseed();
 }
 
-void
-arc4rand(void *ptr, bytes len)
+/* discard the current keys, e.g. when a VM snapshot is resumed; each cpu
+   rekeys on its next use */
+void random_reseed(void)
 {
-    struct chacha20_s *chacha20 = &chacha20inst;
-    bytes length;
-    u8 *p;
+    u64 generation = fetch_and_add(&random_generation, 1) + 1;
+    random_publish_generation(generation);
+}
 
+static void chacha20_generate(struct chacha20_s *chacha20, u8 *p, bytes len)
+{
     timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
-    u64 now_sec = sec_from_timestamp(t);
-    if ((chacha20->numbytes > CHACHA20_RESEED_BYTES) || (now_sec > chacha20->t_reseed))
+    u64 generation = random_generation;
+    if ((chacha20->generation != generation) ||
+        (chacha20->numbytes > CHACHA20_RESEED_BYTES) ||
+        (sec_from_timestamp(t) > chacha20->t_reseed)) {
         chacha20_randomstir(chacha20, t);
+        chacha20->generation = generation;
+    }
 
-    p = ptr;
     while (len) {
-        length = MIN(CHACHA20_BUFFER_SIZE, len);
+        bytes length = MIN(CHACHA20_BUFFER_SIZE, len);
         chacha_encrypt_bytes(&chacha20->ctx, chacha20->m_buffer, p, length);
         p += length;
         len -= length;
         chacha20->numbytes += length;
-        if (chacha20->numbytes > CHACHA20_RESEED_BYTES) {
+        if (chacha20->numbytes > CHACHA20_RESEED_BYTES)
             chacha20_randomstir(chacha20, t);
-        }
     }
 }
 
+/* The keystream is produced into a local buffer, so that the destination,
+   which may be user memory, is never touched with interrupts disabled. */
+void
+arc4rand(void *ptr, bytes len)
+{
+    u8 chunk[CHACHA20_CHUNK_SIZE];
+    u8 *p = ptr;
+
+    while (len) {
+        bytes length = MIN(sizeof(chunk), len);
+        u64 flags = random_lock();
+        chacha20_generate(random_instance(), chunk, length);
+        random_unlock(flags);
+        runtime_memcpy(p, chunk, length);
+        p += length;
+        len -= length;
+    }
+    zero(chunk, sizeof(chunk));
+}
+
 u64 random_u64()
 {
     u64 retval;
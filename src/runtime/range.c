@@ -1,8 +1,225 @@
 #include <runtime.h>
 
+/* B+-tree: interior keys are lower bounds of the starts found under each
+   child, and a lookup descends into the last child whose bound is at or
+   below the key, so bounds only need to be set when a node is split.
+   Nodes are freed when they empty rather than merged with siblings. */
+
+static rmbt_node rmbt_allocate_node(rangemap rm, boolean leaf)
+{
+    rmbt_node x = allocate(rm->h, sizeof(struct rmbt_node));
+    if (x == INVALID_ADDRESS)
+        return x;
+    zero(x, sizeof(struct rmbt_node));
+    x->leaf = leaf;
+    return x;
+}
+
+static inline u64 rmbt_start(rmbt_node l, int i)
+{
+    return ((rmnode)l->e[i])->r.start;
+}
+
+static rmbt_node rmbt_find_leaf(rangemap rm, u64 point)
+{
+    rmbt_node x = rm->root;
+    while (!x->leaf) {
+        int i = x->count - 1;
+        while (i > 0 && x->keys[i] > point)
+            i--;
+        x = x->e[i];
+    }
+    return x;
+}
+
+static inline void rmbt_set(rmbt_node x, int i, void *e, u64 key)
+{
+    x->e[i] = e;
+    x->keys[i] = key;
+    if (x->leaf) {
+        ((rmnode)e)->b.leaf = x;
+        ((rmnode)e)->b.slot = i;
+    } else {
+        ((rmbt_node)e)->parent = x;
+    }
+}
+
+/* insert e at slot i of x, which must have room */
+static void rmbt_insert_at(rmbt_node x, int i, void *e, u64 key)
+{
+    for (int j = x->count; j > i; j--)
+        rmbt_set(x, j, x->e[j - 1], x->keys[j - 1]);
+    rmbt_set(x, i, e, key);
+    x->count++;
+}
+
+/* add child c, whose contents start at key, to parent p just after its
+   sibling */
+static boolean rmbt_insert_child(rangemap rm, rmbt_node p, rmbt_node sibling,
+                                 rmbt_node c, u64 key);
+
+/* move the upper half of full node x into a new right sibling */
+static rmbt_node rmbt_split(rangemap rm, rmbt_node x)
+{
+    rmbt_node r = rmbt_allocate_node(rm, x->leaf);
+    if (r == INVALID_ADDRESS)
+        return r;
+    int half = RMBT_FANOUT / 2;
+    for (int i = half; i < RMBT_FANOUT; i++)
+        rmbt_set(r, i - half, x->e[i], x->keys[i]);
+    r->count = RMBT_FANOUT - half;
+    x->count = half;
+    if (x->leaf) {
+        r->prev = x;
+        r->next = x->next;
+        if (x->next)
+            x->next->prev = r;
+        x->next = r;
+    }
+    u64 key = x->leaf ? rmbt_start(r, 0) : r->keys[0];
+    if (!rmbt_insert_child(rm, x->parent, x, r, key)) {
+        /* undo */
+        for (int i = 0; i < r->count; i++)
+            rmbt_set(x, half + i, r->e[i], r->keys[i]);
+        x->count = RMBT_FANOUT;
+        if (x->leaf) {
+            x->next = r->next;
+            if (r->next)
+                r->next->prev = x;
+        }
+        deallocate(rm->h, r, sizeof(struct rmbt_node));
+        return INVALID_ADDRESS;
+    }
+    return r;
+}
+
+static boolean rmbt_insert_child(rangemap rm, rmbt_node p, rmbt_node sibling,
+                                 rmbt_node c, u64 key)
+{
+    if (!p) {
+        /* new root */
+        p = rmbt_allocate_node(rm, false);
+        if (p == INVALID_ADDRESS)
+            return false;
+        rmbt_set(p, 0, sibling, 0);
+        p->count = 1;
+        rm->root = p;
+    }
+    if (p->count == RMBT_FANOUT) {
+        if (rmbt_split(rm, p) == INVALID_ADDRESS)
+            return false;
+        p = sibling->parent;
+    }
+    int i = 0;
+    while (p->e[i] != sibling)
+        i++;
+    rmbt_insert_at(p, i + 1, c, key);
+    return true;
+}
+
+static boolean rangemap_btree_insert(rangemap rm, rmnode n)
+{
+    u64 start = n->r.start;
+    if (!rm->root) {
+        rmbt_node l = rmbt_allocate_node(rm, true);
+        if (l == INVALID_ADDRESS)
+            return false;
+        rm->root = l;
+    }
+    rmbt_node l = rmbt_find_leaf(rm, start);
+    if (l->count == RMBT_FANOUT) {
+        rmbt_node r = rmbt_split(rm, l);
+        if (r == INVALID_ADDRESS)
+            return false;
+        if (start >= rmbt_start(r, 0))
+            l = r;
+    }
+    int i = l->count;
+    while (i > 0 && rmbt_start(l, i - 1) > start)
+        i--;
+    rmbt_insert_at(l, i, n, start);
+    return true;
+}
+
+/* drop the emptied node x from its parent, and the parent in turn if it
+   empties; a root left with one child is replaced by it */
+static void rmbt_remove_node(rangemap rm, rmbt_node x)
+{
+    rmbt_node p = x->parent;
+    if (x->leaf) {
+        if (x->prev)
+            x->prev->next = x->next;
+        if (x->next)
+            x->next->prev = x->prev;
+    }
+    deallocate(rm->h, x, sizeof(struct rmbt_node));
+    if (!p) {
+        rm->root = 0;
+        return;
+    }
+    int i = 0;
+    while (p->e[i] != x)
+        i++;
+    for (; i < p->count - 1; i++)
+        rmbt_set(p, i, p->e[i + 1], p->keys[i + 1]);
+    p->count--;
+    if (p->count == 0) {
+        rmbt_remove_node(rm, p);
+        return;
+    }
+    while (rm->root == p && !p->leaf && p->count == 1) {
+        rm->root = p->e[0];
+        rm->root->parent = 0;
+        deallocate(rm->h, p, sizeof(struct rmbt_node));
+        p = rm->root;
+    }
+}
+
+void rangemap_btree_remove(rangemap rm, rmnode n)
+{
+    rmbt_node l = n->b.leaf;
+    assert(l && n->b.slot < l->count && l->e[n->b.slot] == n);
+    for (int i = n->b.slot; i < l->count - 1; i++)
+        rmbt_set(l, i, l->e[i + 1], l->keys[i + 1]);
+    l->count--;
+    n->b.leaf = 0;
+    if (l->count == 0)
+        rmbt_remove_node(rm, l);
+}
+
+rmnode rangemap_btree_first(rangemap rm)
+{
+    rmbt_node x = rm->root;
+    if (!x)
+        return INVALID_ADDRESS;
+    while (!x->leaf)
+        x = x->e[0];
+    return x->e[0];
+}
+
+rmnode rangemap_btree_lookup_max_lte(rangemap rm, u64 point)
+{
+    if (!rm->root)
+        return INVALID_ADDRESS;
+    rmbt_node l = rmbt_find_leaf(rm, point);
+    int i = l->count - 1;
+    while (i >= 0 && rmbt_start(l, i) > point)
+        i--;
+    rmnode n;
+    if (i < 0) {
+        if (!l->prev)
+            return INVALID_ADDRESS;
+        n = l->prev->e[l->prev->count - 1];
+    } else {
+        n = l->e[i];
+    }
+    return n;
+}
+
 boolean rangemap_insert(rangemap rm, rmnode n)
 {
-    init_rbnode(&n->n);
+    if (!rm->btree)
+        init_rbnode(&n->n);
     rangemap_foreach_of_range(rm, curr, n) {
         if (curr->r.start >= n->r.end)
             break;
@@ -13,6 +230,8 @@ boolean rangemap_insert(rangemap rm, rmnode n)
             return false;
         }
     }
+    if (rm->btree)
+        return rangemap_btree_insert(rm, n);
     if (!rbtree_insert_node(&rm->t, &n->n)) {
         halt("scan found no intersection but rb insert failed, node %p (%R)\n",
              n, n->r);
@@ -45,12 +264,11 @@ rmnode rangemap_lookup_at_or_next(rangemap rm, u64 point)
 {
     struct rmnode k;
     k.r = irange(point, point + 1);
-    if (!rm->t.root)
-        return INVALID_ADDRESS;
-    rmnode n = (rmnode)rbtree_lookup_max_lte(&rm->t, &k.n);
+    rmnode n = rangemap_lookup_max_lte(rm, point);
     if (n == INVALID_ADDRESS) {
-        n = (rmnode)rbtree_find_first(&rm->t);
-        assert(n);              /* already checked root */
+        n = rangemap_first_node(rm);
+        if (n == INVALID_ADDRESS)
+            return n;
     }
 
     /* we use max lte because rbtree isn't aware of range ends...so we
@@ -148,10 +366,35 @@ rangemap allocate_rangemap(heap h)
     if (rm == INVALID_ADDRESS)
         return rm;
     rm->h = h;
+    rm->btree = false;
+    rm->root = 0;
     init_rbtree(&rm->t, closure(h, rmnode_compare), closure(h, print_key));
     return rm;
 }
 
+/* B+-tree nodes are allocated from h as the map grows, so an insert may
+   fail for lack of memory as well as for an overlap. */
+rangemap allocate_rangemap_btree(heap h)
+{
+    rangemap rm = allocate(h, sizeof(struct rangemap));
+    if (rm == INVALID_ADDRESS)
+        return rm;
+    rm->h = h;
+    rm->btree = true;
+    rm->root = 0;
+    zero(&rm->t, sizeof(rm->t));
+    return rm;
+}
+
+static void rmbt_destruct(rangemap rm, rmbt_node x)
+{
+    if (!x->leaf) {
+        for (int i = 0; i < x->count; i++)
+            rmbt_destruct(rm, x->e[i]);
+    }
+    deallocate(rm->h, x, sizeof(struct rmbt_node));
+}
+
 closure_function(1, 1, boolean, destruct_rmnode,
                  rmnode_handler, destructor,
                  rbnode, n)
@@ -162,7 +405,18 @@ closure_function(1, 1, boolean, destruct_rmnode,
 
 void destruct_rangemap(rangemap rm, rmnode_handler destructor)
 {
-    destruct_rbtree(&rm->t, stack_closure(destruct_rmnode, destructor));
+    if (!rm->btree) {
+        destruct_rbtree(&rm->t, stack_closure(destruct_rmnode, destructor));
+        return;
+    }
+    if (!rm->root)
+        return;
+    for (rmnode n = rangemap_first_node(rm), next; n != INVALID_ADDRESS; n = next) {
+        next = rangemap_next_node(rm, n);
+        apply(destructor, n);
+    }
+    rmbt_destruct(rm, rm->root);
+    rm->root = 0;
 }
 
 void deallocate_rangemap(rangemap rm, rmnode_handler destructor)
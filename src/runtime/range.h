@@ -1,6 +1,25 @@
+/* A rangemap is kept either in a red-black tree threaded through its
+   nodes or, if allocated with allocate_rangemap_btree(), in a B+-tree
+   whose leaves hold node pointers in order, for maps large enough that
+   following tree pointers on each lookup and step dominates. */
+
+#define RMBT_FANOUT 16
+
+typedef struct rmbt_node *rmbt_node;
+struct rmbt_node {
+    rmbt_node parent;
+    u32 count;
+    boolean leaf;
+    rmbt_node prev, next;       /* adjacent leaves */
+    u64 keys[RMBT_FANOUT];      /* interior: lower bound of each child's starts */
+    void *e[RMBT_FANOUT];       /* interior: children; leaf: rmnodes by start */
+};
+
 typedef struct rangemap {
     heap h;
     struct rbtree t;
+    boolean btree;
+    rmbt_node root;
 } *rangemap;
 
 // [start, end)
@@ -9,7 +28,13 @@ typedef struct range {
 } range;
 
 typedef struct rmnode {
-    struct rbnode n;            /* must be first */
+    union {
+        struct rbnode n;        /* must be first */
+        struct {
+            rmbt_node leaf;
+            u64 slot;
+        } b;
+    };
     range r;
 } *rmnode;
 
@@ -33,6 +58,10 @@ boolean rangemap_range_lookup_with_gaps(rangemap rm, range q, rmnode_handler nod
 boolean rangemap_range_find_gaps(rangemap rm, range q, range_handler gap_handler);
 
 rangemap allocate_rangemap(heap h);
+rangemap allocate_rangemap_btree(heap h);
+rmnode rangemap_btree_first(rangemap rm);
+rmnode rangemap_btree_lookup_max_lte(rangemap rm, u64 point);
+void rangemap_btree_remove(rangemap rm, rmnode n);
 void destruct_rangemap(rangemap rm, rmnode_handler destructor);
 void deallocate_rangemap(rangemap rm, rmnode_handler destructor);
 
@@ -69,21 +98,35 @@ static inline void rmnode_init(rmnode n, range r)
 
 static inline rmnode rangemap_prev_node(rangemap rm, rmnode n)
 {
-    return (rmnode)rbnode_get_prev(&n->n);
+    if (!rm->btree)
+        return (rmnode)rbnode_get_prev(&n->n);
+    rmbt_node l = n->b.leaf;
+    if (n->b.slot > 0)
+        return l->e[n->b.slot - 1];
+    return l->prev ? l->prev->e[l->prev->count - 1] : INVALID_ADDRESS;
 }
 
 static inline rmnode rangemap_next_node(rangemap rm, rmnode n)
 {
-    return (rmnode)rbnode_get_next(&n->n);
+    if (!rm->btree)
+        return (rmnode)rbnode_get_next(&n->n);
+    rmbt_node l = n->b.leaf;
+    if (n->b.slot + 1 < l->count)
+        return l->e[n->b.slot + 1];
+    return l->next ? l->next->e[0] : INVALID_ADDRESS;
 }
 
 static inline rmnode rangemap_first_node(rangemap rm)
 {
+    if (rm->btree)
+        return rangemap_btree_first(rm);
     return (rmnode)rbtree_find_first(&rm->t);
 }
 
 static inline rmnode rangemap_lookup_max_lte(rangemap rm, u64 point)
 {
+    if (rm->btree)
+        return rangemap_btree_lookup_max_lte(rm, point);
     struct rmnode k;
     k.r = irange(point, point + 1);
     if (!rm->t.root)
@@ -93,7 +136,10 @@ static inline rmnode rangemap_lookup_max_lte(rangemap rm, u64 point)
 
 static inline void rangemap_remove_node(rangemap rm, rmnode n)
 {
-    rbtree_remove_node(&(rm->t), &n->n);
+    if (rm->btree)
+        rangemap_btree_remove(rm, n);
+    else
+        rbtree_remove_node(&(rm->t), &n->n);
 }
 
 static inline range range_intersection(range a, range b)
@@ -141,7 +187,7 @@ static inline range range_add(range r, s64 delta)
 }
 
 #define rangemap_foreach(rm, n)                                         \
-    for (rmnode __next, (n) = (rmnode)rbtree_find_first(&rm->t);        \
+    for (rmnode __next, (n) = rangemap_first_node(rm);                  \
          __next = ((n) == INVALID_ADDRESS) ? 0 : rangemap_next_node(rm, n), \
              ((n) != INVALID_ADDRESS);                                  \
          (n) = __next)
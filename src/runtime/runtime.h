@@ -55,12 +55,20 @@ void print_frame_trace_from_here();
 
 #define build_assert(x) _Static_assert((x), "build assertion failure")
 
+/* string instruction acceleration in use; set by init_memops() */
+#define MEMOPS_ERMS 1
+#define MEMOPS_FSRM 2
+extern u32 memops_features;
+void init_memops(void);
+
 void runtime_memcpy(void *a, const void *b, bytes len);
 
 void runtime_memset(u8 *a, u8 b, bytes len);
 
 int runtime_memcmp(const void *a, const void *b, bytes len);
 
+void *runtime_memchr(const void *a, u8 c, bytes len);
+
 static inline int runtime_strlen(const char *a)
 {
     int i = 0;
@@ -79,6 +87,21 @@ static inline void console(const char *s)
 
 #define find_order(x) ((x) > 1 ? msb((x) - 1) + 1 : 0)
 
+/* log2 histograms, as kept for latencies in cycles: bucket n counts the
+   values whose most significant bit is n, and bucket 0 also counts zero */
+#define LOG2_HIST_BUCKETS 64
+
+static inline void log2_hist_record(u64 *buckets, u64 v)
+{
+    buckets[v ? msb(v) : 0]++;
+}
+
+/* for a histogram updated from more than one cpu */
+static inline void log2_hist_record_atomic(u64 *buckets, u64 v)
+{
+    fetch_and_add(&buckets[v ? msb(v) : 0], 1);
+}
+
 #define U32_FROM_BIT(x) (1ul<<(x))
 #define U64_FROM_BIT(x) (1ull<<(x))
 #define MASK32(x) (U32_FROM_BIT(x)-1)
@@ -127,6 +150,16 @@ boolean validate_virtual(void *base, u64 length);
 
 void sha256(buffer dest, buffer source);
 
+/* SHA extensions in use; set by init_sha256() */
+#define SHA256_SHA_NI 1
+extern u32 sha256_features;
+void init_sha256(void);
+void sha256_blocks(u32 state[8], const u8 *data, u64 nblocks);
+
+bytes lz4_compress_bound(bytes len);
+bytes lz4_compress(heap h, const void *src, bytes len, void *dest, bytes dest_len);
+s64 lz4_decompress(const void *src, bytes len, void *dest, bytes dest_len);
+
 #define stack_allocate __builtin_alloca
 
 typedef struct buffer *buffer;
@@ -192,8 +225,10 @@ typedef closure_type(thunk, void);
 #include <status.h>
 #include <pqueue.h>
 #include <rbtree.h>
+#include <radix.h>
 #include <range.h>
 #include <queue.h>
+#include <deque.h>
 #include <refcount.h>
 
 /* heaps that depend on above structures */
@@ -208,7 +243,18 @@ typedef closure_type(connection_handler, buffer_handler, buffer_handler);
 typedef closure_type(value_handler, void, value);
 typedef closure_type(io_status_handler, void, status, bytes);
 typedef closure_type(block_io, void, void *, range, status_handler);
-typedef closure_type(storage_attach, void, block_io, block_io, u64);
+typedef closure_type(block_range_op, void, range, status_handler);
+typedef closure_type(block_flush, void, status_handler);
+
+/* optional storage device operations, a null member being unsupported */
+typedef struct storage_ops {
+    block_range_op discard;         /* deallocate blocks (TRIM, UNMAP) */
+    block_range_op write_zeroes;    /* zero blocks without a data transfer */
+    block_flush flush;              /* commit the volatile write cache, if any */
+    block_io write_fua;             /* write through the volatile write cache */
+} *storage_ops;
+
+typedef closure_type(storage_attach, void, block_io, block_io, storage_ops, u64);
 
 #include <sg.h>
 
@@ -225,8 +271,10 @@ parser parser_feed (parser p, buffer b);
 
 // RNG
 void init_random();
+void random_reseed(void);
 u64 random_u64();
 u64 random_buffer(buffer b);
+void arc4rand(void *ptr, bytes len);
 
 typedef struct signature {
     u64 s[4];
@@ -239,6 +287,7 @@ extern status_handler ignore_status;
 extern value null_value;
 
 #include <metadata.h>
+#include <tracepoint.h>
 
 #define cstring(b, t) ({buffer_clear(t); push_buffer((t), (b)); push_u8((t), 0); (char*)(t)->contents;})
 
@@ -16,11 +16,28 @@
 static heap sg_heap;
 static struct list free_sg_lists;
 
+/* Released sg_lists are kept in per-cpu caches, which exchange batches
+   with the global free list when they run empty or full. */
+#define SG_CPU_CACHE_SIZE   32
+#define SG_CPU_CACHE_BATCH  (SG_CPU_CACHE_SIZE / 2)
+
+typedef struct sg_cpu_cache {
+    int count;
+    sg_list lists[SG_CPU_CACHE_SIZE];
+} *sg_cpu_cache;
+
 #ifdef KERNEL
+static struct sg_cpu_cache sg_cpu_caches[MAX_CPUS];
 static struct spinlock sg_spinlock;   /* for free list */
+
+#define sg_cpu_cache_lock()         irq_disable_save()
+#define sg_cpu_cache_unlock(flags)  irq_restore(flags)
+#define sg_cpu_cache()              (&sg_cpu_caches[current_cpu()->id])
+
 static inline void sg_lock_init(void)
 {
     spin_lock_init(&sg_spinlock);
+    lock_stats_register(&sg_spinlock, "sg");
 }
 
 static inline void sg_lock(void)
@@ -33,6 +50,11 @@ static inline void sg_unlock(void)
     spin_unlock(&sg_spinlock);
 }
 #else
+static struct sg_cpu_cache sg_cpu_caches;
+
+#define sg_cpu_cache_lock()         0
+#define sg_cpu_cache_unlock(flags)  (void)(flags)
+#define sg_cpu_cache()              (&sg_cpu_caches)
 #define sg_lock_init()
 #define sg_lock()
 #define sg_unlock()
@@ -62,6 +84,27 @@ u64 sg_copy_to_buf(void *target, sg_list sg, u64 n)
     return n - remain;
 }
 
+/* copy length bytes of source into sg, releasing filled buffers */
+u64 sg_copy_from_buf(void *source, sg_list sg, u64 n)
+{
+    sg_buf sgb;
+    u64 remain = n;
+
+    while (remain > 0 && (sgb = sg_list_head_peek(sg)) != INVALID_ADDRESS) {
+        assert(sgb->size > sgb->offset);
+        u64 len = MIN(remain, sgb->size - sgb->offset);
+        runtime_memcpy(sgb->buf + sgb->offset, source, len);
+        source += len;
+        sgb->offset += len;
+        remain -= len;
+        if (sgb->offset < sgb->size)
+            break;
+        sg_list_head_remove(sg);
+        sg_buf_release(sgb);
+    }
+    return n - remain;
+}
+
 u64 sg_move(sg_list dest, sg_list src, u64 n)
 {
     sg_buf ssgb;
@@ -85,6 +128,43 @@ u64 sg_move(sg_list dest, sg_list src, u64 n)
     return n - remain;
 }
 
+/* add references to up to n bytes of src, which is left as is, to dest */
+u64 sg_dup(sg_list dest, sg_list src, u64 n)
+{
+    u64 remain = n;
+    sg_buf end = buffer_ref(src->b, buffer_length(src->b));
+    for (sg_buf sgb = buffer_ref(src->b, 0); sgb < end && remain > 0; sgb++) {
+        u64 len = MIN(remain, sgb->size - sgb->offset);
+        sg_buf dsgb = sg_list_tail_add(dest, len);
+        dsgb->buf = sgb->buf;
+        dsgb->offset = sgb->offset;
+        dsgb->size = sgb->offset + len;
+        dsgb->refcount = sgb->refcount;
+        if (sgb->refcount)
+            refcount_reserve(sgb->refcount);
+        remain -= len;
+    }
+    return n - remain;
+}
+
+/* drop up to n bytes from the head of sg, releasing consumed buffers */
+u64 sg_consume(sg_list sg, u64 n)
+{
+    sg_buf sgb;
+    u64 remain = n;
+    while (remain > 0 && (sgb = sg_list_head_peek(sg)) != INVALID_ADDRESS) {
+        assert(sgb->size > sgb->offset);
+        u64 len = MIN(remain, sgb->size - sgb->offset);
+        sgb->offset += len;
+        remain -= len;
+        if (sgb->offset < sgb->size)
+            break;
+        sg_list_head_remove(sg);
+        sg_buf_release(sgb);
+    }
+    return n - remain;
+}
+
 u64 sg_zero_fill(sg_list sg, u64 n)
 {
     sg_buf sgb;
@@ -127,19 +207,44 @@ u64 sg_copy_to_buf_and_release(void *target, sg_list sg, u64 n)
     return n - remain;
 }
 
-sg_list allocate_sg_list(void)
+/* called with the cpu cache locked */
+static void sg_cpu_cache_refill(sg_cpu_cache c)
 {
     sg_lock();
-    list l = list_get_next(&free_sg_lists);
-    if (l) {
+    while (c->count < SG_CPU_CACHE_BATCH) {
+        list l = list_get_next(&free_sg_lists);
+        if (!l)
+            break;
         list_delete(l);
-        sg_unlock();
-        return struct_from_list(l, sg_list, l);
+        c->lists[c->count++] = struct_from_list(l, sg_list, l);
     }
     sg_unlock();
+}
+
+/* called with the cpu cache locked */
+static void sg_cpu_cache_drain(sg_cpu_cache c)
+{
+    sg_lock();
+    while (c->count > SG_CPU_CACHE_SIZE - SG_CPU_CACHE_BATCH)
+        list_insert_after(&free_sg_lists, &c->lists[--c->count]->l);
+    sg_unlock();
+}
+
+sg_list allocate_sg_list(void)
+{
+    u64 flags = sg_cpu_cache_lock();
+    sg_cpu_cache c = sg_cpu_cache();
+    if (c->count == 0)
+        sg_cpu_cache_refill(c);
+    if (c->count > 0) {
+        sg_list sg = c->lists[--c->count];
+        sg_cpu_cache_unlock(flags);
+        return sg;
+    }
+    sg_cpu_cache_unlock(flags);
 
     sg_list sg = allocate(sg_heap, sizeof(struct sg_list));
-    if (!sg)
+    if (sg == INVALID_ADDRESS)
         return sg;
     sg->b = allocate_buffer(sg_heap, sizeof(struct sg_buf) * DEFAULT_SG_FRAGS);
     if (sg->b == INVALID_ADDRESS) {
@@ -150,15 +255,20 @@ sg_list allocate_sg_list(void)
     sg->count = 0;
     return sg;
 }
+KLIB_EXPORT(allocate_sg_list);
 
 void deallocate_sg_list(sg_list sg)
 {
     buffer_clear(sg->b);
     sg->count = 0;
-    sg_lock();
-    list_insert_after(&free_sg_lists, &sg->l);
-    sg_unlock();
+    u64 flags = sg_cpu_cache_lock();
+    sg_cpu_cache c = sg_cpu_cache();
+    if (c->count == SG_CPU_CACHE_SIZE)
+        sg_cpu_cache_drain(c);
+    c->lists[c->count++] = sg;
+    sg_cpu_cache_unlock(flags);
 }
+KLIB_EXPORT(deallocate_sg_list);
 
 closure_function(4, 0, void, sg_wrapped_buf_release,
                  refcount, refcount, heap, backed, void *, buf, bytes, padlen)
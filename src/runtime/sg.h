@@ -30,12 +30,17 @@ typedef struct sg_list {
 
 typedef closure_type(sg_io, void, sg_list, range, status_handler);
 
+/* An sg_list is only ever modified by the current owner of its transaction
+   (a concurrent buffer_extend() would move the array under a reader anyway),
+   so count needs no atomic update. */
 static inline sg_buf sg_list_tail_add(sg_list sg, word length)
 {
-    assert(buffer_extend(sg->b, sizeof(struct sg_buf)));
-    void *sgb = buffer_ref(sg->b, buffer_length(sg->b));
-    buffer_produce(sg->b, sizeof(struct sg_buf));
-    fetch_and_add(&sg->count, length);
+    buffer b = sg->b;
+    if (b->end + sizeof(struct sg_buf) > b->length)
+        assert(buffer_extend(b, sizeof(struct sg_buf)));
+    sg_buf sgb = b->contents + b->end;
+    b->end += sizeof(struct sg_buf);
+    sg->count += length;
     return sgb;
 }
 
@@ -55,7 +60,7 @@ static inline sg_buf sg_list_head_remove(sg_list sg)
     if (buffer_length(sg->b) < sizeof(struct sg_buf))
         return INVALID_ADDRESS;
     sg_buf sgb = (sg_buf)buffer_ref(sg->b, 0);
-    fetch_and_add(&sg->count, -sgb->size);
+    sg->count -= sgb->size;
     buffer_consume(sg->b, sizeof(struct sg_buf));
     return sgb;
 }
@@ -79,6 +84,9 @@ void deallocate_sg_list(sg_list sg);
 void init_sg(heap h);
 u64 sg_copy_to_buf(void *target, sg_list sg, u64 length);
 u64 sg_copy_to_buf_and_release(void *dest, sg_list src, u64 limit);
+u64 sg_copy_from_buf(void *source, sg_list sg, u64 length);
 u64 sg_move(sg_list dest, sg_list src, u64 n);
+u64 sg_dup(sg_list dest, sg_list src, u64 n);
+u64 sg_consume(sg_list sg, u64 n);
 u64 sg_zero_fill(sg_list sg, u64 n);
 sg_io sg_wrapped_block_reader(block_io bio, int block_order, heap backed);
@@ -34,7 +34,7 @@ typedef struct {
 #define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
 
 /**************************** VARIABLES *****************************/
-static const u32 k[64] = {
+static const u32 k[64] __attribute__((aligned(16))) = {
 	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
 	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
 	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
@@ -46,7 +46,7 @@ static const u32 k[64] = {
 };
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(sha256_ctx *ctx, const u8 data[])
+static void sha256_transform_generic(u32 state[8], const u8 data[])
 {
 	u32 a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
@@ -55,14 +55,14 @@ void sha256_transform(sha256_ctx *ctx, const u8 data[])
 	for ( ; i < 64; ++i)
 		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
 
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
-	f = ctx->state[5];
-	g = ctx->state[6];
-	h = ctx->state[7];
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
 
 	for (i = 0; i < 64; ++i) {
 		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
@@ -77,16 +77,163 @@ void sha256_transform(sha256_ctx *ctx, const u8 data[])
 		a = t1 + t2;
 	}
 
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
-	ctx->state[5] += f;
-	ctx->state[6] += g;
-	ctx->state[7] += h;
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
 }
 
+u32 sha256_features;
+
+#ifdef __x86_64__
+/* The SHA extensions work on xmm registers, which the kernel is built not
+   to use; the block function therefore saves and restores every register
+   it touches instead of declaring them clobbered, and never sleeps, so an
+   interrupted context keeps its vector state through the fxsave done on
+   interrupt entry. The round structure follows Intel's reference code. */
+
+static const u8 sha256_ni_flip_mask[16] __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static inline void sha256_cpuid(u32 fn, u32 ecx, u32 *v)
+{
+	asm volatile("cpuid" : "=a" (v[0]), "=b" (v[1]), "=c" (v[2]), "=d" (v[3]) : "0" (fn), "2" (ecx));
+}
+
+static void __attribute__((noinline)) sha256_ni_blocks(u32 state[8], const u8 *data, u64 nblocks)
+{
+	u8 save[11 * 16] __attribute__((aligned(16)));
+	const u8 *end = data + nblocks * 64;
+
+	asm volatile(
+		".macro sha256_ni_4rounds i, m0, m1, m2, m3\n"
+		".if \\i < 16\n"
+		"movdqu \\i*4(%[data]), \\m0\n"
+		"pshufb %%xmm8, \\m0\n"
+		".endif\n"
+		"movdqa \\i*4(%[k]), %%xmm0\n"
+		"paddd \\m0, %%xmm0\n"
+		"sha256rnds2 %%xmm1, %%xmm2\n"
+		".if \\i >= 12 && \\i < 60\n"
+		"movdqa \\m0, %%xmm7\n"
+		"palignr $4, \\m3, %%xmm7\n"
+		"paddd %%xmm7, \\m1\n"
+		"sha256msg2 \\m0, \\m1\n"
+		".endif\n"
+		"punpckhqdq %%xmm0, %%xmm0\n"
+		"sha256rnds2 %%xmm2, %%xmm1\n"
+		".if \\i >= 4 && \\i < 52\n"
+		"sha256msg1 \\m0, \\m3\n"
+		".endif\n"
+		".endm\n"
+
+		"movdqa %%xmm0, 0*16(%[save])\n"
+		"movdqa %%xmm1, 1*16(%[save])\n"
+		"movdqa %%xmm2, 2*16(%[save])\n"
+		"movdqa %%xmm3, 3*16(%[save])\n"
+		"movdqa %%xmm4, 4*16(%[save])\n"
+		"movdqa %%xmm5, 5*16(%[save])\n"
+		"movdqa %%xmm6, 6*16(%[save])\n"
+		"movdqa %%xmm7, 7*16(%[save])\n"
+		"movdqa %%xmm8, 8*16(%[save])\n"
+		"movdqa %%xmm9, 9*16(%[save])\n"
+		"movdqa %%xmm10, 10*16(%[save])\n"
+
+		/* DCBA, HGFE -> ABEF, CDGH */
+		"movdqu 0*16(%[state]), %%xmm1\n"
+		"movdqu 1*16(%[state]), %%xmm2\n"
+		"movdqa %%xmm1, %%xmm7\n"
+		"punpcklqdq %%xmm2, %%xmm1\n"
+		"punpckhqdq %%xmm7, %%xmm2\n"
+		"pshufd $0x1b, %%xmm1, %%xmm1\n"
+		"pshufd $0xb1, %%xmm2, %%xmm2\n"
+		"movdqa (%[mask]), %%xmm8\n"
+
+		"1:\n"
+		"movdqa %%xmm1, %%xmm9\n"
+		"movdqa %%xmm2, %%xmm10\n"
+		".irp i, 0, 16, 32, 48\n"
+		"sha256_ni_4rounds (\\i + 0), %%xmm3, %%xmm4, %%xmm5, %%xmm6\n"
+		"sha256_ni_4rounds (\\i + 4), %%xmm4, %%xmm5, %%xmm6, %%xmm3\n"
+		"sha256_ni_4rounds (\\i + 8), %%xmm5, %%xmm6, %%xmm3, %%xmm4\n"
+		"sha256_ni_4rounds (\\i + 12), %%xmm6, %%xmm3, %%xmm4, %%xmm5\n"
+		".endr\n"
+		"paddd %%xmm9, %%xmm1\n"
+		"paddd %%xmm10, %%xmm2\n"
+		"add $64, %[data]\n"
+		"cmp %[end], %[data]\n"
+		"jne 1b\n"
+
+		/* ABEF, CDGH -> DCBA, HGFE */
+		"movdqa %%xmm1, %%xmm7\n"
+		"punpcklqdq %%xmm2, %%xmm1\n"
+		"punpckhqdq %%xmm7, %%xmm2\n"
+		"pshufd $0xb1, %%xmm1, %%xmm1\n"
+		"pshufd $0x1b, %%xmm2, %%xmm2\n"
+		"movdqu %%xmm2, 0*16(%[state])\n"
+		"movdqu %%xmm1, 1*16(%[state])\n"
+
+		"movdqa 0*16(%[save]), %%xmm0\n"
+		"movdqa 1*16(%[save]), %%xmm1\n"
+		"movdqa 2*16(%[save]), %%xmm2\n"
+		"movdqa 3*16(%[save]), %%xmm3\n"
+		"movdqa 4*16(%[save]), %%xmm4\n"
+		"movdqa 5*16(%[save]), %%xmm5\n"
+		"movdqa 6*16(%[save]), %%xmm6\n"
+		"movdqa 7*16(%[save]), %%xmm7\n"
+		"movdqa 8*16(%[save]), %%xmm8\n"
+		"movdqa 9*16(%[save]), %%xmm9\n"
+		"movdqa 10*16(%[save]), %%xmm10\n"
+		".purgem sha256_ni_4rounds\n"
+		: [data] "+r" (data)
+		: [state] "r" (state), [end] "r" (end), [k] "r" (k),
+		  [mask] "r" (sha256_ni_flip_mask), [save] "r" (save)
+		: "cc", "memory");
+}
+
+void init_sha256(void)
+{
+	u32 v[4];
+	sha256_cpuid(0, 0, v);
+	if (v[0] < 7)
+		return;
+	sha256_cpuid(1, 0, v);
+	/* SSSE3 and SSE4.1 */
+	if (!(v[2] & U64_FROM_BIT(9)) || !(v[2] & U64_FROM_BIT(19)))
+		return;
+	sha256_cpuid(7, 0, v);
+	if (v[1] & U64_FROM_BIT(29))
+		sha256_features |= SHA256_SHA_NI;
+}
+#else
+void init_sha256(void)
+{
+}
+#endif
+
+/* process whole 64-byte blocks, with the SHA extensions if available */
+void sha256_blocks(u32 state[8], const u8 *data, u64 nblocks)
+{
+	if (nblocks == 0)
+		return;
+#ifdef __x86_64__
+	if (sha256_features & SHA256_SHA_NI) {
+		sha256_ni_blocks(state, data, nblocks);
+		return;
+	}
+#endif
+	while (nblocks--) {
+		sha256_transform_generic(state, data);
+		data += 64;
+	}
+}
+KLIB_EXPORT(sha256_blocks);
+
 void sha256_init(sha256_ctx *ctx)
 {
 	ctx->datalen = 0;
@@ -103,17 +250,28 @@ void sha256_init(sha256_ctx *ctx)
 
 void sha256_update(sha256_ctx *ctx, const u8 data[], bytes len)
 {
-	u32 i;
-
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	if (ctx->datalen) {
+		bytes n = MIN(len, 64 - ctx->datalen);
+		runtime_memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 64)
+			return;
+		sha256_blocks(ctx->state, ctx->data, 1);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
 	}
+
+	/* whole blocks straight from the input */
+	u64 nblocks = len / 64;
+	sha256_blocks(ctx->state, data, nblocks);
+	ctx->bitlen += nblocks * 512;
+	data += nblocks * 64;
+	len -= nblocks * 64;
+
+	runtime_memcpy(ctx->data, data, len);
+	ctx->datalen = len;
 }
 
 void sha256_final(sha256_ctx *ctx, u8 hash[])
@@ -132,7 +290,7 @@ void sha256_final(sha256_ctx *ctx, u8 hash[])
 		ctx->data[i++] = 0x80;
 		while (i < 64)
 			ctx->data[i++] = 0x00;
-		sha256_transform(ctx, ctx->data);
+		sha256_blocks(ctx->state, ctx->data, 1);
 		zero(ctx->data, 56);
 	}
 
@@ -146,7 +304,7 @@ void sha256_final(sha256_ctx *ctx, u8 hash[])
 	ctx->data[58] = ctx->bitlen >> 40;
 	ctx->data[57] = ctx->bitlen >> 48;
 	ctx->data[56] = ctx->bitlen >> 56;
-	sha256_transform(ctx, ctx->data);
+	sha256_blocks(ctx->state, ctx->data, 1);
 
 	// Since this implementation uses little endian u8 ordering and SHA uses big endian,
 	// reverse all the bytes when copying the final state to the output hash.
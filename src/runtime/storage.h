@@ -71,15 +71,37 @@ static inline void partition_write(struct partition_entry *e, boolean active,
 
 struct filesystem;
 
+/* block I/O statistics of a volume, as seen at the device */
+#define STORAGE_OP_READ         0
+#define STORAGE_OP_WRITE        1
+#define STORAGE_OP_FLUSH        2
+#define STORAGE_OP_COUNT        3
+#define STORAGE_HIST_BUCKETS    LOG2_HIST_BUCKETS
+
+typedef struct storage_stats {
+    u64 ops[STORAGE_OP_COUNT];
+    u64 bytes[STORAGE_OP_COUNT];
+    u64 latency[STORAGE_OP_COUNT][STORAGE_HIST_BUCKETS];   /* log2 histograms of cycles */
+    u64 inflight;
+} *storage_stats;
+
+storage_stats allocate_storage_stats(heap h);
+void storage_stats_record(storage_stats st, int op, u64 bytes, u64 start);
+
 void init_volumes(heap h);
-void storage_set_root_fs(struct filesystem *root_fs);
+void init_storage_management(tuple root);
+void storage_set_root_fs(struct filesystem *root_fs, storage_stats st);
 void storage_set_mountpoints(tuple mounts);
-boolean volume_add(u8 *uuid, char *label, block_io r, block_io w, u64 size);
+boolean volume_add(u8 *uuid, char *label, block_io r, block_io w, storage_ops ops,
+                   storage_stats st, u64 size);
+block_io storage_bioq(heap h, block_io io, u64 max_blocks, storage_stats st, int op);
+block_flush storage_flushq(heap h, block_flush flush, storage_stats st);
 void storage_when_ready(thunk complete);
 void storage_sync(status_handler sh);
 
 struct filesystem *storage_get_fs(tuple root);
 tuple storage_get_mountpoint(tuple root);
 
-typedef closure_type(volume_handler, void, u8 *, const char *, struct filesystem *);
+typedef closure_type(volume_handler, void, u8 *, const char *, struct filesystem *,
+                     storage_stats);
 void storage_iterate(volume_handler vh);
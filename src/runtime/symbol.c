@@ -1,14 +1,102 @@
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
 
-static table symbols;
+/* Symbols are never freed, so the intern table only grows. Lookups of
+   existing symbols probe it without taking a lock; inserts and resizes
+   are serialized by a lock. A slot is set only once its symbol is
+   complete, and a grown table is published once it is filled, so a
+   reader sees either a finished symbol or an empty slot. A replaced table
+   may still be probed by a concurrent reader and is never freed. */
+
+#define SYMTAB_INITIAL_SLOTS    1024
+
+typedef struct symtab {
+    u64 slots;
+    symbol entries[0];
+} *symtab;
+
+static symtab volatile symbols;
+static u64 symbol_count;
 static heap sheap;
 static heap iheap;
 
+#ifdef KERNEL
+static struct spinlock symbol_lock;
+static inline void symbol_lock_init(void)
+{
+    spin_lock_init(&symbol_lock);
+    lock_stats_register(&symbol_lock, "symbol");
+}
+
+static inline void symbol_table_lock(void)
+{
+    spin_lock(&symbol_lock);
+}
+
+static inline void symbol_table_unlock(void)
+{
+    spin_unlock(&symbol_lock);
+}
+#else
+#define symbol_lock_init()
+#define symbol_table_lock()
+#define symbol_table_unlock()
+#endif
+
 struct symbol {
     string s;
-    key k;
+    key k;                      /* random, keys tuple attributes */
+    key hash;                   /* of the string */
 };
 
+static symtab allocate_symtab(u64 slots)
+{
+    bytes size = sizeof(struct symtab) + slots * sizeof(symbol);
+    symtab t = allocate(iheap, size);
+    if (t == INVALID_ADDRESS)
+        halt("intern: alloc fail\n");
+    zero(t, size);
+    t->slots = slots;
+    return t;
+}
+
+static void symtab_insert(symtab t, symbol s)
+{
+    u64 mask = t->slots - 1;
+    u64 i = s->hash & mask;
+    while (t->entries[i])
+        i = (i + 1) & mask;
+    write_barrier();
+    t->entries[i] = s;
+}
+
+static symbol symtab_find(symtab t, string name, key hash)
+{
+    u64 mask = t->slots - 1;
+    for (u64 i = hash & mask; ; i = (i + 1) & mask) {
+        symbol s = *(symbol volatile *)&t->entries[i];
+        if (!s)
+            return 0;
+        if (s->hash == hash && buffer_compare(s->s, name))
+            return s;
+    }
+}
+
+static symtab symtab_grow(symtab t)
+{
+    symtab n = allocate_symtab(t->slots * 2);
+    for (u64 i = 0; i < t->slots; i++) {
+        if (t->entries[i])
+            symtab_insert(n, t->entries[i]);
+    }
+    write_barrier();
+    symbols = n;
+    return n;
+}
+
 symbol intern_u64(u64 u)
 {
     buffer b = little_stack_buffer(20);
@@ -19,8 +107,13 @@ KLIB_EXPORT(intern_u64);
 
 symbol intern(string name)
 {
-    symbol s;
-    if (!(s = table_find(symbols, name))) {
+    key hash = fnv64(name);
+    symbol s = symtab_find(symbols, name, hash);
+    if (s)
+        return s;
+    symbol_table_lock();
+    symtab t = symbols;
+    if (!(s = symtab_find(t, name, hash))) {
         // shouldnt really be on transient
         buffer b = allocate_buffer(iheap, buffer_length(name));
         if (b == INVALID_ADDRESS)
@@ -31,8 +124,12 @@ symbol intern(string name)
             goto alloc_fail;
         s->k = random_u64();
         s->s = b;
-        table_set(symbols, b, s);
+        s->hash = hash;
+        if (++symbol_count > t->slots - (t->slots >> 2))
+            t = symtab_grow(t);
+        symtab_insert(t, s);
     }
+    symbol_table_unlock();
     return s;
   alloc_fail:
     halt("intern: alloc fail\n");
@@ -54,6 +151,7 @@ void init_symbols(heap h, heap init)
 {
     sheap = h;
     iheap = init;    
-    symbols = allocate_table(iheap, fnv64, buffer_compare);
+    symbol_lock_init();
+    symbols = allocate_symtab(SYMTAB_INITIAL_SLOTS);
 }
 
@@ -35,7 +35,10 @@ void table_validate(table t, char *n)
     }
 }
 
-table allocate_table(heap h, u64 (*key_function)(void *x), boolean (*equals_function)(void *x, void *y))
+/* count is a hint of the number of entries to be added, allowing them to
+   be set without resizing along the way */
+table allocate_table_sized(heap h, u64 (*key_function)(void *x),
+                           boolean (*equals_function)(void *x, void *y), int count)
 {
     table t = allocate(h, sizeof(struct table));
     if (t == INVALID_ADDRESS)
@@ -44,6 +47,8 @@ table allocate_table(heap h, u64 (*key_function)(void *x), boolean (*equals_func
     t->h = h;
     t->count = 0;
     t->buckets = 4;
+    while (t->buckets < count && t->buckets < TABLE_MAX_BUCKETS)
+        t->buckets *= 2;
     t->entries = allocate_zero(h, t->buckets * sizeof(void *));
     if (t->entries == INVALID_ADDRESS) {
         deallocate(h, t, sizeof(struct table));
@@ -54,6 +59,11 @@ table allocate_table(heap h, u64 (*key_function)(void *x), boolean (*equals_func
     return t;
 }
 
+table allocate_table(heap h, u64 (*key_function)(void *x), boolean (*equals_function)(void *x, void *y))
+{
+    return allocate_table_sized(h, key_function, equals_function, 0);
+}
+
 void deallocate_table(table t)
 {
     table_paranoia(t, "deallocate");
@@ -163,3 +173,147 @@ void table_clear(table t)
     }
     t->count = 0;
 }
+
+/* murmur3 finalizer */
+static inline key otable_mix(key k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+/* keep the load under 7/8 */
+static inline boolean otable_full(u64 slots, u64 count)
+{
+    return count >= slots - (slots >> 3);
+}
+
+static otable_slot otable_alloc_slots(heap h, u64 slots)
+{
+    otable_slot e = allocate(h, slots * sizeof(struct otable_slot));
+    if (e != INVALID_ADDRESS)
+        zero(e, slots * sizeof(struct otable_slot));
+    return e;
+}
+
+otable allocate_otable(heap h, key (*key_function)(void *x),
+                       boolean (*equals_function)(void *x, void *y), int count)
+{
+    otable t = allocate(h, sizeof(struct otable));
+    if (t == INVALID_ADDRESS)
+        return t;
+    t->h = h;
+    t->count = 0;
+    t->slots = 8;
+    while (otable_full(t->slots, count))
+        t->slots *= 2;
+    t->entries = otable_alloc_slots(h, t->slots);
+    if (t->entries == INVALID_ADDRESS) {
+        deallocate(h, t, sizeof(struct otable));
+        return INVALID_ADDRESS;
+    }
+    t->key_function = key_function;
+    t->equals_function = equals_function;
+    return t;
+}
+
+void deallocate_otable(otable t)
+{
+    deallocate(t->h, t->entries, t->slots * sizeof(struct otable_slot));
+    deallocate(t->h, t, sizeof(struct otable));
+}
+
+/* Robin Hood: an entry further from its home slot than the resident
+   takes the slot, and the resident moves on */
+static void otable_insert(otable t, key k, void *c, void *v)
+{
+    u64 mask = t->slots - 1;
+    struct otable_slot n = { .k = k, .c = c, .v = v, .dist = 0 };
+    for (u64 i = k & mask; ; i = (i + 1) & mask) {
+        otable_slot s = t->entries + i;
+        if (s->v == EMPTY) {
+            *s = n;
+            return;
+        }
+        if (s->dist < n.dist) {
+            struct otable_slot r = *s;
+            *s = n;
+            n = r;
+        }
+        n.dist++;
+    }
+}
+
+static void otable_resize(otable t, u64 slots)
+{
+    otable_slot old = t->entries;
+    u64 oldslots = t->slots;
+    t->entries = otable_alloc_slots(t->h, slots);
+    if (t->entries == INVALID_ADDRESS)
+        halt("otable_resize: allocate fail for %ld slots\n", slots);
+    t->slots = slots;
+    for (otable_slot s = old; s < old + oldslots; s++) {
+        if (s->v != EMPTY)
+            otable_insert(t, s->k, s->c, s->v);
+    }
+    deallocate(t->h, old, oldslots * sizeof(struct otable_slot));
+}
+
+static otable_slot otable_lookup(otable t, key k, void *c)
+{
+    u64 mask = t->slots - 1;
+    for (u64 i = k & mask, dist = 0; ; i = (i + 1) & mask, dist++) {
+        otable_slot s = t->entries + i;
+        /* past the point where the entry would have displaced another */
+        if (s->v == EMPTY || s->dist < dist)
+            return 0;
+        if (s->k == k && t->equals_function(s->c, c))
+            return s;
+    }
+}
+
+void *otable_find(otable t, void *c)
+{
+    otable_slot s = otable_lookup(t, otable_mix(t->key_function(c)), c);
+    return s ? s->v : EMPTY;
+}
+
+void otable_set(otable t, void *c, void *v)
+{
+    key k = otable_mix(t->key_function(c));
+    otable_slot s = otable_lookup(t, k, c);
+    if (s) {
+        if (v != EMPTY) {
+            s->v = v;
+            return;
+        }
+        /* shift the following run back over the removed slot */
+        u64 mask = t->slots - 1;
+        u64 i = s - t->entries;
+        for (u64 j = (i + 1) & mask; ; i = j, j = (j + 1) & mask) {
+            otable_slot n = t->entries + j;
+            if (n->v == EMPTY || n->dist == 0)
+                break;
+            t->entries[i] = *n;
+            t->entries[i].dist--;
+        }
+        zero(t->entries + i, sizeof(struct otable_slot));
+        t->count--;
+        return;
+    }
+    if (v == EMPTY)
+        return;
+    if (otable_full(t->slots, t->count + 1))
+        otable_resize(t, t->slots * 2);
+    otable_insert(t, k, c, v);
+    t->count++;
+}
+
+void otable_clear(otable t)
+{
+    zero(t->entries, t->slots * sizeof(struct otable_slot));
+    t->count = 0;
+}
@@ -19,6 +19,8 @@ struct table {
 };
 
 table allocate_table(heap h, key (*key_function)(void *x), boolean (*equal_function)(void *x, void *y));
+table allocate_table_sized(heap h, key (*key_function)(void *x),
+                           boolean (*equal_function)(void *x, void *y), int count);
 void deallocate_table(table t);
 void table_validate(table t, char *n);
 int table_elements(table t);
@@ -37,3 +39,42 @@ void table_clear(table t);
 
 boolean pointer_equal(void *a, void* b);
 key identity_key(void *a);
+
+/* Open-addressing table with the same interface, for hot lookups: slots
+   are stored inline in one array and placed with Robin Hood probing on a
+   mixed hash, so weak keys like aligned pointers still spread and a miss
+   stops after a few adjacent slots. Unlike table_foreach, the table must
+   not be modified within otable_foreach. */
+typedef struct otable *otable;
+
+typedef struct otable_slot {
+    key k;                      /* mixed hash */
+    void *c;
+    void *v;                    /* EMPTY if the slot is free */
+    u64 dist;                   /* distance from the home slot */
+} *otable_slot;
+
+struct otable {
+    heap h;
+    u64 slots;
+    u64 count;
+    otable_slot entries;
+    key (*key_function)(void *x);
+    boolean (*equals_function)(void *x, void *y);
+};
+
+otable allocate_otable(heap h, key (*key_function)(void *x),
+                       boolean (*equals_function)(void *x, void *y), int count);
+void deallocate_otable(otable t);
+void *otable_find(otable t, void *c);
+void otable_set(otable t, void *c, void *v);
+void otable_clear(otable t);
+
+static inline int otable_elements(otable t)
+{
+    return t->count;
+}
+
+#define otable_foreach(__t, __k, __v)                                   \
+    for (otable_slot __s = (__t)->entries; __s < (__t)->entries + (__t)->slots; __s++) \
+        for (void *__k = __s->c, *__v = __s->v; __v; __v = 0)
@@ -1,4 +1,8 @@
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
 
 //#define TIMER_DEBUG
 #ifdef TIMER_DEBUG
@@ -7,19 +11,204 @@
 #define timer_debug(x, ...)
 #endif
 
-/* The lower time expiry is the higher priority. */
+/* The lower latest expiry is the higher priority. */
 static boolean timer_compare(void *za, void *zb)
 {
-    return timer_expiry((timer)za) > timer_expiry((timer)zb);
+    return timer_expiry_late((timer)za) > timer_expiry_late((timer)zb);
 }
 
+#ifdef KERNEL
+#define timer_wheel_lock(th)            spin_lock_irq(&(th)->wheel_lock)
+#define timer_wheel_unlock(th, flags)   spin_unlock_irq(&(th)->wheel_lock, flags)
+#else
+#define timer_wheel_lock(th)            0
+#define timer_wheel_unlock(th, flags)   (void)(flags)
+#endif
+
 define_closure_function(2, 0, void, timer_free,
                         timer, t, heap, h)
 {
     deallocate(bound(h), bound(t), sizeof(struct timer));
 }
 
-timer register_timer(timerheap th, clock_id id, timestamp val, boolean absolute, timestamp interval, timer_handler n)
+/* clocks stepped along with the wall clock need their timers in the pqueue,
+   where clock_reset_rtc() can find them */
+static boolean timer_clock_coarse_ok(clock_id id)
+{
+    switch (id) {
+    case CLOCK_ID_MONOTONIC:
+    case CLOCK_ID_MONOTONIC_RAW:
+    case CLOCK_ID_MONOTONIC_COARSE:
+    case CLOCK_ID_BOOTTIME:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void timer_wheel_slot_remove(timer_wheel w, timer t)
+{
+    list_delete(&t->l);
+    struct list *slot = &w->slots[t->wheel_level][t->wheel_slot];
+    if (list_empty(slot))
+        w->occupied[t->wheel_level] &= ~U64_FROM_BIT(t->wheel_slot);
+    w->count--;
+}
+
+/* Place a timer in the slot for its expiry tick, rounded up so that it
+   never fires early. A timer already due goes to expired if given, else
+   to the next tick. Returns false if the expiry is beyond the horizon of
+   the wheel. */
+static boolean timer_wheel_insert(timer_wheel w, timer t, struct list *expired)
+{
+    timestamp expiry = timer_expiry(t);
+    if (expiry > infinity - TIMER_WHEEL_TICK)
+        return false;
+    u64 e = (expiry + TIMER_WHEEL_TICK - 1) >> TIMER_WHEEL_TICK_ORDER;
+    if (e <= w->tick) {
+        if (expired) {
+            t->wheel_state = TIMER_WHEEL_FIRING;
+            list_push_back(expired, &t->l);
+            return true;
+        }
+        e = w->tick + 1;
+    }
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        u64 shift = level * TIMER_WHEEL_SLOT_ORDER;
+        if ((e >> shift) - (w->tick >> shift) >= TIMER_WHEEL_SLOTS)
+            continue;
+        u64 slot = (e >> shift) & MASK(TIMER_WHEEL_SLOT_ORDER);
+        t->wheel_state = TIMER_WHEEL_SLOT;
+        t->wheel_level = level;
+        t->wheel_slot = slot;
+        list_push_back(&w->slots[level][slot], &t->l);
+        w->occupied[level] |= U64_FROM_BIT(slot);
+        w->count++;
+        return true;
+    }
+    return false;
+}
+
+/* the next tick at which a slot expires or is cascaded, or infinity */
+static u64 timer_wheel_next_tick(timer_wheel w)
+{
+    u64 next = infinity;
+    if (w->count == 0)
+        return next;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        u64 occupied = w->occupied[level];
+        if (!occupied)
+            continue;
+        u64 shift = level * TIMER_WHEEL_SLOT_ORDER;
+        u64 r = ((w->tick >> shift) + 1) & MASK(TIMER_WHEEL_SLOT_ORDER);
+
+        /* distance to the first occupied slot after the current one */
+        if (r)
+            occupied = (occupied >> r) | (occupied << (TIMER_WHEEL_SLOTS - r));
+        u64 t = ((w->tick >> shift) + lsb(occupied) + 1) << shift;
+        next = MIN(next, t);
+    }
+    return next;
+}
+
+static void timer_wheel_cascade(timer_wheel w, int level, u64 slot, struct list *expired)
+{
+    struct list l;
+    list_move(&l, &w->slots[level][slot]);
+    w->occupied[level] &= ~U64_FROM_BIT(slot);
+    while (!list_empty(&l)) {
+        timer t = struct_from_list(list_get_next(&l), timer, l);
+        list_delete(&t->l);
+        w->count--;
+        assert(timer_wheel_insert(w, t, expired));
+    }
+}
+
+/* move timers expiring up to tick target to expired */
+static void timer_wheel_advance(timer_wheel w, u64 target, struct list *expired)
+{
+    while (w->tick < target) {
+        u64 next = timer_wheel_next_tick(w);
+        if (next > target) {
+            w->tick = target;
+            break;
+        }
+        w->tick = next;
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            u64 shift = level * TIMER_WHEEL_SLOT_ORDER;
+            if ((next & MASK(shift)) == 0)
+                timer_wheel_cascade(w, level, (next >> shift) & MASK(TIMER_WHEEL_SLOT_ORDER),
+                                    expired);
+        }
+        u64 slot = next & MASK(TIMER_WHEEL_SLOT_ORDER);
+        struct list *l = &w->slots[0][slot];
+        while (!list_empty(l)) {
+            timer t = struct_from_list(list_get_next(l), timer, l);
+            list_delete(&t->l);
+            w->count--;
+            t->wheel_state = TIMER_WHEEL_FIRING;
+            list_push_back(expired, &t->l);
+        }
+        w->occupied[0] &= ~U64_FROM_BIT(slot);
+    }
+}
+
+static boolean timer_wheel_add(timerheap th, timer t)
+{
+    if (!th->wheel) {
+        timer_wheel w = allocate(th->h, sizeof(struct timer_wheel));
+        if (w == INVALID_ADDRESS)
+            return false;
+        w->tick = now(CLOCK_ID_MONOTONIC_RAW) >> TIMER_WHEEL_TICK_ORDER;
+        w->count = 0;
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            w->occupied[level] = 0;
+            for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                list_init(&w->slots[level][slot]);
+        }
+        write_barrier();
+        th->wheel = w;
+    }
+    u64 flags = timer_wheel_lock(th);
+    timer_wheel w = th->wheel;
+    if (w->count == 0)
+        w->tick = MAX(w->tick, now(CLOCK_ID_MONOTONIC_RAW) >> TIMER_WHEEL_TICK_ORDER);
+    boolean r = timer_wheel_insert(w, t, 0);
+    if (r)
+        t->th = th;
+    timer_wheel_unlock(th, flags);
+    return r;
+}
+
+/* called by remove_timer() for wheel timers; a timer in a slot is dropped
+   at once, while one being fired is released by timer_service() */
+void timer_wheel_remove(timer t)
+{
+    timerheap th = t->th;
+    u64 flags = timer_wheel_lock(th);
+    t->disabled = true;
+    boolean release = t->wheel_state == TIMER_WHEEL_SLOT;
+    if (release) {
+        timer_wheel_slot_remove(th->wheel, t);
+        t->wheel_state = TIMER_WHEEL_NONE;
+    }
+    timer_wheel_unlock(th, flags);
+    if (release)
+        refcount_release(&t->refcount);
+}
+KLIB_EXPORT(timer_wheel_remove);
+
+timestamp timer_wheel_next(timerheap th)
+{
+    u64 flags = timer_wheel_lock(th);
+    u64 next = timer_wheel_next_tick(th->wheel);
+    timer_wheel_unlock(th, flags);
+    return next == infinity ? infinity : next << TIMER_WHEEL_TICK_ORDER;
+}
+KLIB_EXPORT(timer_wheel_next);
+
+timer register_timer_slack(timerheap th, clock_id id, timestamp val, boolean absolute,
+                           timestamp interval, timestamp slack, timer_handler n)
 {
     timer t = allocate(th->h, sizeof(struct timer));
     if (t == INVALID_ADDRESS) {
@@ -30,15 +219,75 @@ timer register_timer(timerheap th, clock_id id, timestamp val, boolean absolute,
     t->id = id;
     t->expiry = absolute ? val : now(id) + val;
     t->interval = interval;
+    t->slack = slack;
     t->disabled = false;
+    t->wheel_state = TIMER_WHEEL_NONE;
+    t->th = 0;
     t->t = n;
 
     init_refcount(&t->refcount, 1, init_closure(&t->free, timer_free, t, th->h));
-    pqueue_insert(th->pq, t);
-    timer_debug("register timer: %p, expiry %T, interval %T, handler %p\n", t, t->expiry, interval, n);
+    if (slack < TIMER_WHEEL_TICK || !timer_clock_coarse_ok(id) || !timer_wheel_add(th, t))
+        pqueue_insert(th->pq, t);
+    timer_debug("register timer: %p, expiry %T, interval %T, slack %T, handler %p, wheel %d\n",
+                t, t->expiry, interval, slack, n, t->th != 0);
     return t;
 }
 
+timer register_timer(timerheap th, clock_id id, timestamp val, boolean absolute, timestamp interval, timer_handler n)
+{
+    return register_timer_slack(th, id, val, absolute, interval, 0, n);
+}
+
+/* apply the handler of an expired timer; returns true if it is to be rearmed */
+static boolean timer_fire(timer t, s64 delta)
+{
+    if (t->disabled)
+        return false;
+    if (t->interval) {
+        u64 overruns = delta > t->interval ? delta / t->interval + 1 : 1;
+        timer_debug("apply %p (%F), overruns %ld\n", t, t->t, overruns);
+        apply(t->t, overruns);
+        if (!t->disabled) {
+            t->expiry += t->interval * overruns;
+            return true;
+        }
+    } else {
+        timer_debug("timer expiry %T, delta %T, apply %p (%F)\n",
+                    timer_expiry(t), delta, t, t->t);
+        apply(t->t, 1);
+    }
+    return false;
+}
+
+static void timer_wheel_service(timerheap th, timestamp here)
+{
+    struct list expired;
+    list_init(&expired);
+    u64 flags = timer_wheel_lock(th);
+    timer_wheel_advance(th->wheel, here >> TIMER_WHEEL_TICK_ORDER, &expired);
+    timer_wheel_unlock(th, flags);
+    while (!list_empty(&expired)) {
+        timer t = struct_from_list(list_get_next(&expired), timer, l);
+        list_delete(&t->l);
+        if (timer_fire(t, here - timer_expiry(t))) {
+            flags = timer_wheel_lock(th);
+            boolean rearmed = !t->disabled && timer_wheel_insert(th->wheel, t, 0);
+            timer_wheel_unlock(th, flags);
+            if (rearmed)
+                continue;
+            if (!t->disabled) {
+                /* beyond the horizon */
+                t->wheel_state = TIMER_WHEEL_NONE;
+                t->th = 0;
+                pqueue_insert(th->pq, t);
+                continue;
+            }
+        }
+        t->wheel_state = TIMER_WHEEL_NONE;
+        refcount_release(&t->refcount);
+    }
+}
+
 // XXX change to support multiple timer heaps - might help us clean up
 // clocksource interface later
 
@@ -48,26 +297,16 @@ void timer_service(timerheap th, timestamp here)
     s64 delta;
 
     timer_debug("timer_service enter for heap \"%s\" at %T\n", th->name, here);
-    while ((t = pqueue_peek(th->pq)) && (delta = here - timer_expiry(t), delta >= 0)) {
+    while ((t = pqueue_peek(th->pq)) != INVALID_ADDRESS && (delta = here - timer_expiry(t), delta >= 0)) {
         pqueue_pop(th->pq);
-        if (!t->disabled) {
-            if (t->interval) {
-                u64 overruns = delta > t->interval ? delta / t->interval + 1 : 1;
-                timer_debug("apply %p (%F), overruns %ld\n", t, t->t, overruns);
-                apply(t->t, overruns);
-                if (!t->disabled) {
-                    t->expiry += t->interval * overruns;
-                    pqueue_insert(th->pq, t);
-                    continue;
-                }
-            } else {
-                timer_debug("timer expiry %T, delta %T, apply %p (%F)\n",
-                            timer_expiry(t), delta, t, t->t);
-                apply(t->t, 1);
-            }
+        if (timer_fire(t, delta)) {
+            pqueue_insert(th->pq, t);
+            continue;
         }
         refcount_release(&t->refcount);
     }
+    if (th->wheel)
+        timer_wheel_service(th, here);
 }
 
 void timer_reorder(timerheap th)
@@ -105,6 +344,10 @@ timerheap allocate_timerheap(heap h, const char *name)
     }
     th->h = h;
     th->name = name;
+    th->wheel = 0;
+#ifdef KERNEL
+    spin_lock_init(&th->wheel_lock);
+#endif
     return th;
 }
 
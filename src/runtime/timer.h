@@ -4,17 +4,53 @@ typedef closure_type(timer_handler, void, u64);
 declare_closure_struct(2, 0, void, timer_free,
                        timer, t, heap, h);
 
+/* Timers registered with a slack of at least one wheel tick, on a clock
+   that is not stepped with the wall clock, are kept in a hierarchical
+   timing wheel instead of the pqueue: insertion and removal are O(1), and
+   an expiry is late by less than a tick. Each level has 64 slots, each slot
+   spanning 64 slots of the level below; timers are cascaded down a level as
+   the wheel reaches their slot. Timers beyond the horizon of the top level,
+   about 12 days, stay in the pqueue. */
+#define TIMER_WHEEL_TICK_ORDER  22      /* about a millisecond */
+#define TIMER_WHEEL_TICK        U64_FROM_BIT(TIMER_WHEEL_TICK_ORDER)
+#define TIMER_WHEEL_SLOT_ORDER  6
+#define TIMER_WHEEL_SLOTS       U64_FROM_BIT(TIMER_WHEEL_SLOT_ORDER)
+#define TIMER_WHEEL_LEVELS      5
+
+typedef struct timer_wheel {
+    u64 tick;                   /* last tick serviced */
+    u64 count;                  /* timers in slots */
+    u64 occupied[TIMER_WHEEL_LEVELS];
+    struct list slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} *timer_wheel;
+
 typedef struct timerheap {
     heap h;
     pqueue pq;
     const char *name;
+    timer_wheel wheel;          /* allocated for the first coarse timer */
+#ifdef KERNEL
+    struct spinlock wheel_lock; /* wheel may be touched outside the kernel lock */
+#endif
 } *timerheap;
 
+enum {
+    TIMER_WHEEL_NONE = 0,       /* in the pqueue */
+    TIMER_WHEEL_SLOT,
+    TIMER_WHEEL_FIRING,
+};
+
 struct timer {
     clock_id id;
     timestamp expiry;
     timestamp interval;
+    timestamp slack;            /* may fire up to this late */
     boolean disabled;
+    u8 wheel_state;
+    u8 wheel_level;
+    u8 wheel_slot;
+    timerheap th;               /* set if held by the wheel */
+    struct list l;              /* wheel slot or expired list */
     timer_handler t;
     struct refcount refcount;
     closure_struct(timer_free, free);
@@ -38,6 +74,10 @@ static inline void runloop_timer(timestamp duration)
 
 // XXX - maybe timerheap per clocktype, or separate for proc/thread timers
 timer register_timer(timerheap th, clock_id id, timestamp val, boolean absolute, timestamp interval, timer_handler n);
+timer register_timer_slack(timerheap th, clock_id id, timestamp val, boolean absolute,
+                           timestamp interval, timestamp slack, timer_handler n);
+void timer_wheel_remove(timer t);
+timestamp timer_wheel_next(timerheap th);
 
 #if defined(KERNEL) || defined(BUILD_VDSO)
 #define __vdso_dat (&(VVAR_REF(vdso_dat)))
@@ -74,6 +114,15 @@ static inline timestamp timer_expiry(timer t)
     return expiry;
 }
 
+/* Timers in the pqueue are ordered by expiry plus slack, and the platform
+   timer is armed for that latest expiry of the root timer; when it fires,
+   every timer past its expiry in the meantime is serviced along with it. */
+static inline timestamp timer_expiry_late(timer t)
+{
+    timestamp e = timer_expiry(t);
+    return e + MIN(t->slack, infinity - e);
+}
+
 static inline void timer_get_remaining(timer t, timestamp *remain, timestamp *interval)
 {
     timestamp tnow = now(t->id);
@@ -85,24 +134,32 @@ static inline void timer_get_remaining(timer t, timestamp *remain, timestamp *in
 static inline void remove_timer(timer t, timestamp *remain)
 {
     assert(!t->disabled);
-    t->disabled = true;
     if (remain) {
         timestamp x = t->expiry;
         timestamp n = now(t->id);
         *remain = x > n ? x - n : 0;
     }
+    if (t->th)
+        timer_wheel_remove(t);  /* may free the timer */
+    else
+        t->disabled = true;
 }
 
-/* returns absolute expiry of root timer */
+/* returns latest absolute expiry of root timer, or the next wheel tick with
+   work */
 static inline timestamp timer_check(timerheap th)
 {
+    timestamp e = infinity;
     timer t;
-    if ((t = pqueue_peek(th->pq))) {
-        timestamp e = timer_expiry(t);
+    if ((t = pqueue_peek(th->pq)) != INVALID_ADDRESS) {
+        e = timer_expiry_late(t);
         /* -1ull is a valid timestamp but reserved value here */
-    	return e == infinity ? e - 1 : e;
+        if (e == infinity)
+            e--;
     }
-    return infinity;
+    if (th->wheel)
+        e = MIN(e, timer_wheel_next(th));
+    return e;
 }
 
 typedef closure_type(timer_select, boolean, timer);
@@ -150,6 +207,13 @@ TIMESTAMP_CONV_FN(nanoseconds, BILLION)
 TIMESTAMP_CONV_FN_2(picoseconds, TRILLION)
 TIMESTAMP_CONV_FN_2(femtoseconds, QUADRILLION)
 
+/* slack for a timeout of the given length, as Linux estimates for poll and
+   select: 0.1% of the timeout, up to 100ms */
+static inline timestamp timeout_slack(timestamp timeout)
+{
+    return MIN(timeout >> 10, milliseconds(100));
+}
+
 static inline timestamp truncate_seconds(timestamp t)
 {
     return t & MASK(32);
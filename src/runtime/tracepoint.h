@@ -0,0 +1,43 @@
+/* Static tracepoints. Each event is enabled individually at run time through
+   the ftrace set_event file and recorded, with up to three arguments, into
+   the ftrace ring buffers alongside the current tracer's entries; with the
+   nop tracer only the enabled events are recorded.
+
+   A disabled site costs a load and a not-taken branch. Without CONFIG_FTRACE
+   (and outside of the kernel) sites compile away entirely and their
+   arguments are not evaluated. */
+
+/* name, then the format of its arguments in the text trace */
+#define TRACEPOINTS(_)                                                  \
+    _(block_submit, "op %ld sector %ld count %ld")                      \
+    _(block_complete, "op %ld sector %ld count %ld")                    \
+    _(pagecache_fill, "node 0x%lx page %ld count %ld")                  \
+    _(pagecache_evict, "node 0x%lx page %ld")                           \
+    _(pagecache_writeback, "node 0x%lx page %ld count %ld")             \
+    _(tcp_send, "fd %ld bytes %ld")                                     \
+    _(tcp_recv, "fd %ld bytes %ld")                                     \
+    _(tcp_retransmit, "segments %ld total %ld")                         \
+    _(blockq_block, "blockq 0x%lx tid %ld timeout %ld")                 \
+    _(blockq_wake, "blockq 0x%lx tid %ld flags 0x%lx")                  \
+    _(thread_run, "tid %ld prev %ld")                                   \
+    _(thread_sleep, "tid %ld blockq 0x%lx")                             \
+    _(page_fault, "vaddr 0x%lx vmap_flags 0x%lx user %ld")
+
+#define __TRACEPOINT_ID(name, fmt) TRACEPOINT_##name,
+enum {
+    TRACEPOINTS(__TRACEPOINT_ID)
+    TRACEPOINT_COUNT
+};
+#undef __TRACEPOINT_ID
+
+#if defined(KERNEL) && defined(CONFIG_FTRACE)
+extern u8 tracepoint_enabled[TRACEPOINT_COUNT];
+void tracepoint_record(int event, u64 a0, u64 a1, u64 a2);
+
+#define tracepoint(name, a0, a1, a2) do {                                       \
+        if (__builtin_expect(tracepoint_enabled[TRACEPOINT_##name], 0))         \
+            tracepoint_record(TRACEPOINT_##name, (u64)(a0), (u64)(a1), (u64)(a2)); \
+    } while (0)
+#else
+#define tracepoint(name, a0, a1, a2) do { } while (0)
+#endif
@@ -113,6 +113,13 @@ tuple allocate_tuple(void)
 }
 KLIB_EXPORT(allocate_tuple);
 
+/* for a tuple whose number of entries is known up front */
+static tuple allocate_tuple_sized(int count)
+{
+    return tag(allocate_table_sized(theap, key_from_symbol, pointer_equal, count),
+               tag_table_tuple);
+}
+
 void destruct_tuple(tuple t, boolean recursive);
 
 closure_function(2, 2, boolean, destruct_tuple_each,
@@ -223,7 +230,7 @@ value decode_value(heap h, table dictionary, buffer source, u64 *total,
         tuple t;
     
         if (imm == immediate) {
-            t = allocate_tuple();
+            t = allocate_tuple_sized(len);
             tuple_debug("decode_value: immediate, alloced tuple %v\n", t);
             drecord(dictionary, t);
         } else {
@@ -239,8 +246,15 @@ value decode_value(heap h, table dictionary, buffer source, u64 *total,
             u64 nlen = pop_header(source, &imm, &nametype);
             symbol s;
             if (imm) {
-                buffer n = wrap_buffer(transient, buffer_ref(source, 0), nlen);
-                s = intern(n);
+                /* intern copies the name only if the symbol is new */
+                struct buffer n = {
+                    .contents = buffer_ref(source, 0),
+                    .start = 0,
+                    .end = nlen,
+                    .length = nlen,
+                    .wrapped = true,
+                };
+                s = intern(&n);
                 drecord(dictionary, s);
                 source->start += nlen;                                
             } else {
@@ -385,6 +399,52 @@ void encode_tuple(buffer dest, table dictionary, tuple t, u64 *total)
     iterate(t, stack_closure(encode_tuple_each, dest, dictionary, total));
 }
 
+closure_function(4, 2, boolean, encode_tuple_shallow_each,
+                 buffer, dest, table, dictionary, vector, children, u64 *, total,
+                 value, s, value, v)
+{
+    assert(is_symbol(s));
+    if (no_encode(v))
+        return true;
+    buffer dest = bound(dest);
+    encode_symbol(dest, bound(dictionary), s);
+    if (v && is_tuple(v)) {
+        u64 d = u64_from_pointer(table_find(bound(dictionary), v));
+        if (d) {
+            push_header(dest, reference, type_tuple, 0);
+            push_varint(dest, d);
+        } else {
+            push_header(dest, immediate, type_tuple, 0);
+            srecord(bound(dictionary), v);
+        }
+        vector_push(bound(children), v);
+    } else {
+        encode_value(dest, bound(dictionary), v, bound(total));
+    }
+    if (bound(total))
+        (*bound(total))++;
+    return true;
+}
+
+/* Like encode_tuple, but tuple values are encoded without their contents and
+   added to the children vector instead, so that a tree can be encoded one
+   tuple at a time. */
+void encode_tuple_shallow(buffer dest, table dictionary, tuple t, vector children, u64 *total)
+{
+    tuple_debug("%s: dest %p, dictionary %p, tuple %p\n", __func__, dest, dictionary, t);
+    u64 d = u64_from_pointer(table_find(dictionary, t));
+    u64 count = 0;
+    iterate(t, stack_closure(encode_tuple_count_each, &count));
+    if (d) {
+        push_header(dest, reference, type_tuple, count);
+        push_varint(dest, d);
+    } else {
+        push_header(dest, immediate, type_tuple, count);
+        srecord(dictionary, t);
+    }
+    iterate(t, stack_closure(encode_tuple_shallow_each, dest, dictionary, children, total));
+}
+
 void deallocate_value(tuple t)
 {
     value_tag tag = tagof(t);
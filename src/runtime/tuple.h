@@ -29,6 +29,7 @@ void destruct_tuple(tuple t, boolean recursive);
 void deallocate_value(tuple t);
 
 void encode_tuple(buffer dest, table dictionary, tuple t, u64 *total);
+void encode_tuple_shallow(buffer dest, table dictionary, tuple t, vector children, u64 *total);
 
 // h is for the bodies, the space for symbols and tuples are both implicit
 void *decode_value(heap h, table dictionary, buffer source, u64 *total,
@@ -27,6 +27,81 @@ static inline void report_sha256(buffer b)
 #define report_sha256(b)
 #endif
 
+#ifdef KERNEL
+/* Path lookup cache
+
+   Caches the result of looking up a name in a directory, including names
+   that are not found, so that resolving a path does not need to intern each
+   of its components. The cache is direct-mapped on a hash of the directory
+   tuple and the name. Directory entries are only changed through
+   fs_set_dir_entry() and do_mkentry(), which evict the slot of the entry;
+   the whole cache is dropped when a directory or filesystem goes away, so
+   that no entry outlives its directory tuple. The "." and ".." entries
+   change along with the directory itself and are not cached. */
+typedef struct fs_lookup_entry {
+    tuple parent;
+    tuple t;                    /* 0 if the name was not found */
+    symbol s;
+    u8 len;
+    char name[FS_LOOKUP_NAME_MAX];
+} *fs_lookup_entry;
+
+static struct fs_lookup_entry fs_lookup_cache[FS_LOOKUP_CACHE_SIZE];
+
+static boolean fs_lookup_cacheable(const char *name, bytes len)
+{
+    return (len <= FS_LOOKUP_NAME_MAX) &&
+        !((name[0] == '.') && ((len == 1) || ((len == 2) && (name[1] == '.'))));
+}
+
+static fs_lookup_entry fs_lookup_slot(tuple parent, const char *name, bytes len)
+{
+    u64 hash = 0xcbf29ce484222325 ^ u64_from_pointer(parent);
+    for (bytes i = 0; i < len; i++) {
+        hash ^= (u8)name[i];
+        hash *= 1099511628211;
+    }
+    return &fs_lookup_cache[hash & (FS_LOOKUP_CACHE_SIZE - 1)];
+}
+
+static tuple fs_lookup(tuple parent, buffer a, symbol *s)
+{
+    const char *name = buffer_ref(a, 0);
+    bytes len = buffer_length(a);
+    if (!fs_lookup_cacheable(name, len)) {
+        *s = intern(a);
+        return lookup(parent, *s);
+    }
+    fs_lookup_entry e = fs_lookup_slot(parent, name, len);
+    if ((e->parent == parent) && (e->len == len) && !runtime_memcmp(e->name, name, len)) {
+        *s = e->s;
+        return e->t;
+    }
+    *s = intern(a);
+    e->parent = parent;
+    e->t = lookup(parent, *s);
+    e->s = *s;
+    e->len = len;
+    runtime_memcpy(e->name, name, len);
+    return e->t;
+}
+
+static void fs_lookup_invalidate(tuple parent, symbol s)
+{
+    string n = symbol_string(s);
+    if (fs_lookup_cacheable(buffer_ref(n, 0), buffer_length(n)))
+        fs_lookup_slot(parent, buffer_ref(n, 0), buffer_length(n))->parent = 0;
+}
+
+static void fs_lookup_flush(void)
+{
+    zero(fs_lookup_cache, sizeof(fs_lookup_cache));
+}
+#else
+#define fs_lookup_invalidate(parent, s)
+#define fs_lookup_flush()
+#endif
+
 pagecache_volume filesystem_get_pagecache_volume(filesystem fs)
 {
     return fs->pv;
@@ -36,6 +111,7 @@ u64 fsfile_get_length(fsfile f)
 {
     return f->length;
 }
+KLIB_EXPORT(fsfile_get_length);
 
 void fsfile_set_length(fsfile f, u64 length)
 {
@@ -61,12 +137,25 @@ sg_io fsfile_get_reader(fsfile f)
 {
     return f->read;
 }
+KLIB_EXPORT(fsfile_get_reader);
 
 sg_io fsfile_get_writer(fsfile f)
 {
     return f->write;
 }
 
+/* Direct access works in whole blocks and leaves the cache untouched; the
+   caller is responsible for coherence with cached pages. */
+sg_io fsfile_get_direct_reader(fsfile f)
+{
+    return f->direct_read;
+}
+
+sg_io fsfile_get_direct_writer(fsfile f)
+{
+    return f->direct_write;
+}
+
 pagecache_node fsfile_get_cachenode(fsfile f)
 {
     return f->cache_node;
@@ -175,6 +264,8 @@ static inline extent allocate_extent(heap h, range file_blocks, range storage_bl
     e->start_block = storage_blocks.start;
     e->allocated = range_span(storage_blocks);
     e->uninited = false;
+    e->compressed = 0;
+    e->shared = false;
     return e;
 }
 
@@ -192,13 +283,160 @@ boolean filesystem_reserve_storage(filesystem fs, range blocks)
     return true;
 }
 
+/* Freed blocks are discarded if the device supports it. They stay allocated
+   until their discard has completed, so that they can't be written again in
+   the meantime, and are collected (coalescing adjacent ranges) until the log
+   has been committed, so that discarded blocks are no longer referenced by
+   the filesystem on disk. */
+static void filesystem_discard_add(filesystem fs, range blocks)
+{
+    tfs_debug("%s: blocks %R\n", __func__, blocks);
+    rmnode prev = (blocks.start > 0) ? rangemap_lookup(fs->discards, blocks.start - 1) :
+        INVALID_ADDRESS;
+    rmnode next = rangemap_lookup(fs->discards, blocks.end);
+    if (prev != INVALID_ADDRESS) {
+        range r = irange(prev->r.start, blocks.end);
+        if (next != INVALID_ADDRESS) {
+            r.end = next->r.end;
+            rangemap_remove_node(fs->discards, next);
+            deallocate(fs->h, next, sizeof(*next));
+        }
+        assert(rangemap_reinsert(fs->discards, prev, r));
+    } else if (next != INVALID_ADDRESS) {
+        assert(rangemap_reinsert(fs->discards, next, irange(blocks.start, next->r.end)));
+    } else {
+        rmnode n = allocate(fs->h, sizeof(*n));
+        if (n == INVALID_ADDRESS) {
+            id_heap_set_area(fs->storage, blocks.start, range_span(blocks), true, false);
+            return;
+        }
+        rmnode_init(n, blocks);
+        assert(rangemap_insert(fs->discards, n));
+    }
+}
+
 boolean filesystem_free_storage(filesystem fs, range blocks)
 {
-    if (fs->w)
+    if (fs->w) {
+        if (fs->discards) {
+            filesystem_discard_add(fs, blocks);
+            return true;
+        }
         return id_heap_set_area(fs->storage, blocks.start, range_span(blocks), true, false);
+    }
     return true;
 }
 
+closure_function(2, 1, void, filesystem_discard_complete,
+                 filesystem, fs, range, blocks,
+                 status, s)
+{
+    filesystem fs = bound(fs);
+    range blocks = bound(blocks);
+    if (!is_ok(s)) {
+        tfs_debug("%s: discard of %R failed: %v\n", __func__, blocks, s);
+        timm_dealloc(s);
+    }
+    if (!id_heap_set_area(fs->storage, blocks.start, range_span(blocks), true, false))
+        msg_err("failed to free discarded blocks %R\n", blocks);
+    closure_finish();
+}
+
+void filesystem_discard_flush(filesystem fs)
+{
+    if (!fs->discards)
+        return;
+    rmnode n;
+    while ((n = rangemap_first_node(fs->discards)) != INVALID_ADDRESS) {
+        range blocks = n->r;
+        rangemap_remove_node(fs->discards, n);
+        deallocate(fs->h, n, sizeof(*n));
+        status_handler sh = closure(fs->h, filesystem_discard_complete, fs, blocks);
+        if (sh == INVALID_ADDRESS) {
+            id_heap_set_area(fs->storage, blocks.start, range_span(blocks), true, false);
+            continue;
+        }
+        tfs_debug("%s: discarding %R\n", __func__, blocks);
+        apply(fs->ops->discard, blocks, sh);
+    }
+}
+
+#ifndef TFS_READ_ONLY
+/* Split the shared blocks node containing block so that a node starts there. */
+static void shared_blocks_split(filesystem fs, u64 block)
+{
+    rmnode n = rangemap_lookup(fs->shared, block);
+    if (n == INVALID_ADDRESS || n->r.start == block)
+        return;
+    shared_blocks sb = allocate(fs->h, sizeof(*sb));
+    assert(sb != INVALID_ADDRESS);
+    rmnode_init(&sb->n, irange(block, n->r.end));
+    sb->refs = ((shared_blocks)n)->refs;
+    assert(rangemap_reinsert(fs->shared, n, irange(n->r.start, block)));
+    assert(rangemap_insert(fs->shared, &sb->n));
+}
+
+/* Add delta references to storage blocks r. Blocks that are not in fs->shared
+   have a single owner, except while ingesting, where they have none yet and
+   are reserved by their first reference. Blocks are freed with their last
+   reference. */
+static void shared_storage_ref(filesystem fs, range r, s64 delta, boolean ingest)
+{
+    tfs_debug("%s: blocks %R, delta %ld%s\n", __func__, r, delta, ingest ? " (ingest)" : "");
+    shared_blocks_split(fs, r.start);
+    shared_blocks_split(fs, r.end);
+    rmnode n = rangemap_lookup_at_or_next(fs->shared, r.start);
+    u64 edge = r.start;
+    while (edge < r.end) {
+        u64 limit = (n == INVALID_ADDRESS) ? r.end : MIN(n->r.start, r.end);
+        if (edge < limit) {
+            range gap = irange(edge, limit);
+            if (delta < 0) {
+                filesystem_free_storage(fs, gap);
+            } else {
+                if (ingest && !filesystem_reserve_storage(fs, gap))
+                    msg_err("unable to reserve storage blocks %R\n", gap);
+                shared_blocks sb = allocate(fs->h, sizeof(*sb));
+                assert(sb != INVALID_ADDRESS);
+                rmnode_init(&sb->n, gap);
+                sb->refs = ingest ? delta : 1 + delta;
+                assert(rangemap_insert(fs->shared, &sb->n));
+            }
+            edge = limit;
+            continue;
+        }
+        shared_blocks sb = (shared_blocks)n;
+        n = rangemap_next_node(fs->shared, n);
+        edge = sb->n.r.end;
+        sb->refs += delta;
+        if (sb->refs <= 1 && !ingest) {
+            if (sb->refs == 0)
+                filesystem_free_storage(fs, sb->n.r);
+            rangemap_remove_node(fs->shared, &sb->n);
+            deallocate(fs->h, sb, sizeof(*sb));
+        }
+    }
+}
+
+closure_function(1, 1, void, shared_storage_busy_each,
+                 boolean *, busy,
+                 rmnode, n)
+{
+    if (((shared_blocks)n)->refs > 1)
+        *bound(busy) = true;
+}
+
+/* whether blocks of ex within the file range blocks are referred to elsewhere */
+static boolean shared_storage_busy(filesystem fs, extent ex, range blocks)
+{
+    range i = range_intersection(blocks, ex->node.r);
+    range r = irangel(ex->start_block + (i.start - ex->node.r.start), range_span(i));
+    boolean busy = false;
+    rangemap_range_lookup(fs->shared, r, stack_closure(shared_storage_busy_each, &busy));
+    return busy;
+}
+#endif
+
 void ingest_extent(fsfile f, symbol off, tuple value)
 {
     tfs_debug("ingest_extent: f %p, off %b, value %v\n", f, symbol_string(off), value);
@@ -212,6 +450,12 @@ void ingest_extent(fsfile f, symbol off, tuple value)
               file_offset, length, start_block, allocated);
 
     range storage_blocks = irangel(start_block, allocated);
+    boolean shared = get(value, sym(shared)) != 0;
+#ifndef TFS_READ_ONLY
+    if (shared)
+        shared_storage_ref(f->fs, storage_blocks, 1, true);
+    else
+#endif
     if (!filesystem_reserve_storage(f->fs, storage_blocks)) {
         /* soft error... */
         msg_err("unable to reserve storage blocks %R\n", storage_blocks);
@@ -221,8 +465,11 @@ void ingest_extent(fsfile f, symbol off, tuple value)
     if (ex == INVALID_ADDRESS)
         halt("out of memory\n");
     ex->md = value;
+    ex->shared = shared;
     if (get(value, sym(uninited)))
         ex->uninited = true;
+    if (get(value, sym(compressed)))
+        assert(ingest_parse_int(value, sym(compressed), &ex->compressed));
     assert(rangemap_insert(f->extentmap, &ex->node));
 }
 
@@ -242,7 +489,7 @@ void filesystem_storage_op(filesystem fs, sg_list sg, merge m, range blocks, blo
         if (nblocks > 0) {
             u64 block_offset = blocks.start + offset;
             range q = irangel(block_offset, nblocks);
-            assert(range_span(q) + sgb->offset < U64_FROM_BIT(fs->page_order));
+            assert(sgb->offset + (nblocks << fs->blocksize_order) <= sgb->size);
             apply(op, sgb->buf + sgb->offset, q, apply_merge(m));
             offset += nblocks;
             blocks_remain -= nblocks;
@@ -260,6 +507,10 @@ void zero_blocks(filesystem fs, range blocks, merge m)
 {
     int blocks_per_page = U64_FROM_BIT(fs->page_order - fs->blocksize_order);
     tfs_debug("%s: fs %p, blocks %R\n", __func__, fs, blocks);
+    if (fs->ops && fs->ops->write_zeroes) {
+        apply(fs->ops->write_zeroes, blocks, apply_merge(m));
+        return;
+    }
     while (range_span(blocks) > 0) {
         range r = irangel(blocks.start, MIN(range_span(blocks), blocks_per_page));
         tfs_debug("   zero %R\n", r);
@@ -268,6 +519,89 @@ void zero_blocks(filesystem fs, range blocks, merge m)
     }
 }
 
+#if !defined(BOOT) || defined(UEFI)
+closure_function(8, 1, void, read_compressed_complete,
+                 filesystem, fs, void *, data, u64, size, u64, data_length, u64, length,
+                 range, q, sg_list, dest, status_handler, sh,
+                 status, s)
+{
+    filesystem fs = bound(fs);
+    sg_list dest = bound(dest);
+    range q = bound(q);
+    if (is_ok(s)) {
+        void *out = allocate(fs->h, bound(length));
+        if (out == INVALID_ADDRESS) {
+            s = timm("result", "failed to allocate decompression buffer",
+                     "fsstatus", "%d", FS_STATUS_NOMEM);
+        } else {
+            s64 n = lz4_decompress(bound(data), bound(data_length), out, bound(length));
+            if (n < 0) {
+                s = timm("result", "corrupt compressed extent", "fsstatus", "%d", FS_STATUS_IOERR);
+            } else {
+                zero(out + n, bound(length) - n);
+                sg_copy_from_buf(out + q.start, dest, range_span(q));
+            }
+            deallocate(fs->h, out, bound(length));
+        }
+    }
+    sg_list_release(dest);
+    deallocate_sg_list(dest);
+    deallocate(fs->dma, bound(data), bound(size));
+    apply(bound(sh), s);
+    closure_finish();
+}
+#endif
+
+/* The whole of a compressed extent is read and decompressed, and the
+   requested blocks are copied to the part of the sg list they take up.
+   Of the boot loaders, only the UEFI one carries the decompressor. */
+static void read_compressed_extent(filesystem fs, sg_list sg, merge m, extent e, range i)
+{
+    u64 length = range_span(i) << fs->blocksize_order;
+#if defined(BOOT) && !defined(UEFI)
+    sg_zero_fill(sg, length);
+    apply(apply_merge(m), timm("result", "compressed extents not supported",
+                               "fsstatus", "%d", FS_STATUS_IOERR));
+#else
+    status_handler sh = apply_merge(m);
+    u64 size = pad(e->compressed, fs->dma->pagesize);
+    void *data = allocate(fs->dma, size);
+    sg_list dest = allocate_sg_list();
+    sg_list csg = allocate_sg_list();
+    if (data == INVALID_ADDRESS || dest == INVALID_ADDRESS || csg == INVALID_ADDRESS) {
+        sg_zero_fill(sg, length);
+        if (data != INVALID_ADDRESS)
+            deallocate(fs->dma, data, size);
+        if (dest != INVALID_ADDRESS)
+            deallocate_sg_list(dest);
+        if (csg != INVALID_ADDRESS)
+            deallocate_sg_list(csg);
+        apply(sh, timm("result", "failed to allocate compressed read",
+                       "fsstatus", "%d", FS_STATUS_NOMEM));
+        return;
+    }
+    sg_move(dest, sg, length);
+    range q = range_lshift(range_add(i, -e->node.r.start), fs->blocksize_order);
+    u64 pagesize = U64_FROM_BIT(fs->page_order);
+    for (u64 offset = 0; offset < size; offset += pagesize) {
+        sg_buf sgb = sg_list_tail_add(csg, MIN(pagesize, size - offset));
+        sgb->buf = data + offset;
+        sgb->size = MIN(pagesize, size - offset);
+        sgb->offset = 0;
+        sgb->refcount = 0;
+    }
+    merge cm = allocate_merge(fs->h, closure(fs->h, read_compressed_complete, fs, data, size,
+                                             e->compressed, range_span(e->node.r) << fs->blocksize_order,
+                                             q, dest, sh));
+    status_handler k = apply_merge(cm);
+    range blocks = irangel(e->start_block, pad(e->compressed, U64_FROM_BIT(fs->blocksize_order)) >>
+                           fs->blocksize_order);
+    filesystem_storage_op(fs, csg, cm, blocks, fs->r);
+    deallocate_sg_list(csg);
+    apply(k, STATUS_OK);
+#endif
+}
+
 closure_function(4, 1, void, read_extent,
                  filesystem, fs, sg_list, sg, merge, m, range, blocks,
                  rmnode, node)
@@ -281,7 +615,9 @@ closure_function(4, 1, void, read_extent,
     range blocks = irangel(e->start_block + e_offset, len);
     tfs_debug("%s: e %p, uninited %d, sg %p m %p blocks %R, i %R, len %ld, blocks %R\n",
               __func__, e, e->uninited, bound(sg), bound(m), bound(blocks), i, len, blocks);
-    if (!e->uninited) {
+    if (e->compressed) {
+        read_compressed_extent(fs, sg, bound(m), e, i);
+    } else if (!e->uninited) {
         filesystem_storage_op(fs, sg, bound(m), blocks, fs->r);
     } else {
         sg_zero_fill(sg, range_span(blocks) << fs->blocksize_order);
@@ -344,6 +680,55 @@ void filesystem_read_linear(fsfile f, void *dest, range q, io_status_handler io_
                                          dest, range_span(q), io_complete, sg));
 }
 
+#ifdef BOOT
+/* The boot loaders read each file once and never write: bypass the cache
+   and read straight into the destination buffer, in chunks as large as an
+   sg_buf can describe, so that the disk sees a few large requests rather
+   than one per cache page. */
+#define READ_ENTIRE_CHUNK_SIZE  (16 * MB)
+
+closure_function(4, 1, void, read_entire_direct_complete,
+                 sg_list, sg, buffer_handler, bh, buffer, b, status_handler, sh,
+                 status, s)
+{
+    sg_list sg = bound(sg);
+    buffer b = bound(b);
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    if (is_ok(s)) {
+        report_sha256(b);
+        apply(bound(bh), b);
+    } else {
+        deallocate_buffer(b);
+        apply(bound(sh), s);
+    }
+    closure_finish();
+}
+
+static void read_entire_direct(filesystem fs, fsfile f, buffer b, u64 length,
+                               buffer_handler c, status_handler sh)
+{
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS) {
+        deallocate_buffer(b);
+        apply(sh, timm("result", "allocation failure",
+                       "fsstatus", "%d", FS_STATUS_NOMEM));
+        return;
+    }
+    u64 size = pad(length, U64_FROM_BIT(fs->blocksize_order));
+    for (u64 offset = 0; offset < size; offset += READ_ENTIRE_CHUNK_SIZE) {
+        u64 n = MIN(READ_ENTIRE_CHUNK_SIZE, size - offset);
+        sg_buf sgb = sg_list_tail_add(sg, n);
+        sgb->buf = buffer_ref(b, offset);
+        sgb->size = n;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+    }
+    buffer_produce(b, length);
+    apply(f->direct_read, sg, irange(0, length),
+          closure(fs->h, read_entire_direct_complete, sg, c, b, sh));
+}
+#else
 closure_function(5, 1, void, read_entire_complete,
                  sg_list, sg, buffer_handler, bh, buffer, b, u64, length, status_handler, sh,
                  status, s)
@@ -361,6 +746,7 @@ closure_function(5, 1, void, read_entire_complete,
     }
     closure_finish();
 }
+#endif
 
 void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler c, status_handler sh)
 {
@@ -378,6 +764,10 @@ void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler
     if (b == INVALID_ADDRESS)
         goto alloc_fail;
 
+#ifdef BOOT
+    read_entire_direct(fs, f, b, length, c, sh);
+    return;
+#else
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         deallocate_buffer(b);
@@ -386,6 +776,7 @@ void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler
     filesystem_read_sg(f, sg, irange(0, length),
                       closure(fs->h, read_entire_complete, sg, c, b, length, sh));
     return;
+#endif
   alloc_fail:
     apply(sh, timm("result", "allocation failure",
                    "fsstatus", "%d", FS_STATUS_NOMEM));
@@ -395,6 +786,8 @@ void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler
 #ifndef TFS_READ_ONLY
 fs_status filesystem_write_tuple(filesystem fs, tuple t)
 {
+    if (fs->sealed)
+        return FS_STATUS_READONLY;
     if (log_write(fs->tl, t) && (!fs->temp_log || log_write(fs->temp_log, t)))
         return FS_STATUS_OK;
     else
@@ -403,6 +796,8 @@ fs_status filesystem_write_tuple(filesystem fs, tuple t)
 
 fs_status filesystem_write_eav(filesystem fs, tuple t, symbol a, value v)
 {
+    if (fs->sealed)
+        return FS_STATUS_READONLY;
     if (log_write_eav(fs->tl, t, a, v) &&
             (!fs->temp_log || log_write_eav(fs->temp_log, t, a, v)))
         return FS_STATUS_OK;
@@ -414,25 +809,57 @@ fs_status filesystem_write_eav(filesystem fs, tuple t, symbol a, value v)
 
    The life an extent depends on a particular allocation of contiguous
    storage space. The extent is tied to this allocated area (nominally
-   page size). Only the extent data length may be updated; the file
-   offset, block start and allocation size are immutable. As an
-   optimization, adjacent extents on the disk could be joined into
-   larger extents with only a meta update.
+   page size). The file offset and block start are immutable; the data
+   length may be updated, and so may the allocation size when the storage
+   right after the extent can be claimed, in which case the extent grows in
+   place instead of a new one being added to the file.
+
+   An extent may be allocated beyond its data, up to a preallocation size
+   given by the caller, so that successive appends can be written to it
+   with only a length update.
 
 */
 
-static fs_status create_extent(filesystem fs, range blocks, boolean uninited, extent *ex)
+/* Allocate storage at or shortly after the goal block so that the extents
+   of a file stay sequential on disk, falling back to anywhere on the volume. */
+static u64 filesystem_allocate_storage_near(filesystem fs, u64 nblocks, u64 goal)
+{
+    if (fs->w && goal != INVALID_PHYSICAL) {
+        u64 limit = goal + 2 * (MAX_EXTENT_SIZE >> fs->blocksize_order);
+        u64 start_block = id_heap_alloc_subrange(fs->storage, nblocks, goal, limit);
+        if (start_block != INVALID_PHYSICAL)
+            return start_block;
+    }
+    return filesystem_allocate_storage(fs, nblocks);
+}
+
+/* keep the log extensions ahead of data allocations */
+static boolean filesystem_reserve_log(filesystem fs)
+{
+    return filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) &&
+        filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0);
+}
+
+static fs_status create_extent(filesystem fs, range blocks, boolean uninited, u64 goal,
+                               u64 prealloc, extent *ex)
 {
     heap h = fs->h;
     u64 nblocks = MAX(range_span(blocks), MIN_EXTENT_SIZE >> fs->blocksize_order);
 
-    tfs_debug("create_extent: blocks %R, uninited %d, nblocks %ld\n", blocks, uninited, nblocks);
-    if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
-        !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0)) {
+    tfs_debug("create_extent: blocks %R, uninited %d, nblocks %ld, goal 0x%lx, prealloc %ld\n",
+              blocks, uninited, nblocks, goal, prealloc);
+    if (!filesystem_reserve_log(fs)) {
         msg_err("out of storage allocating %ld blocks\n", nblocks);
         return FS_STATUS_NOSPACE;
     }
-    u64 start_block = filesystem_allocate_storage(fs, nblocks);
+    u64 start_block = INVALID_PHYSICAL;
+    if (prealloc > nblocks) {
+        start_block = filesystem_allocate_storage_near(fs, prealloc, goal);
+        if (start_block != INVALID_PHYSICAL)
+            nblocks = prealloc;
+    }
+    if (start_block == INVALID_PHYSICAL)
+        start_block = filesystem_allocate_storage_near(fs, nblocks, goal);
     if (start_block == u64_from_pointer(INVALID_ADDRESS)) {
         /* In lieu of precise error handling up the stack, report here... */
         msg_err("out of storage allocating %ld blocks\n", nblocks);
@@ -453,7 +880,9 @@ static fs_status create_extent(filesystem fs, range blocks, boolean uninited, ex
 static void destroy_extent(filesystem fs, extent ex)
 {
     range q = irangel(ex->start_block, ex->allocated);
-    if (!filesystem_free_storage(fs, q))
+    if (ex->shared)
+        shared_storage_ref(fs, q, -1, false);
+    else if (!filesystem_free_storage(fs, q))
         msg_err("failed to mark extent at %R as free", q);
     deallocate(fs->h, ex, sizeof(*ex));
 }
@@ -482,6 +911,10 @@ static fs_status add_extent_to_file(fsfile f, extent ex)
     set(e, sym(allocated), value_from_u64(h, ex->allocated));
     if (ex->uninited)
         set(e, sym(uninited), null_value);
+    if (ex->compressed)
+        set(e, sym(compressed), value_from_u64(h, ex->compressed));
+    if (ex->shared)
+        set(e, sym(shared), null_value);
     symbol offs = intern_u64(ex->node.r.start);
     fs_status s = filesystem_write_eav(f->fs, extents, offs, e);
     if (s != FS_STATUS_OK) {
@@ -514,16 +947,18 @@ static fs_status add_extents(filesystem fs, range i, rangemap rm)
 {
     extent ex;
     fs_status fss;
+    u64 goal = INVALID_PHYSICAL;
     while (range_span(i) >= MAX_EXTENT_SIZE) {
         range r = {.start = i.start, .end = i.start + MAX_EXTENT_SIZE};
-        fss = create_extent(fs, r, true, &ex);
+        fss = create_extent(fs, r, true, goal, 0, &ex);
         if (fss != FS_STATUS_OK)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
+        goal = ex->start_block + ex->allocated;
         i.start += MAX_EXTENT_SIZE;
     }
     if (range_span(i)) {
-        fss = create_extent(fs, i, true, &ex);
+        fss = create_extent(fs, i, true, goal, 0, &ex);
         if (fss != FS_STATUS_OK)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
@@ -541,6 +976,7 @@ static u64 write_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m)
     tfs_debug("   %s: ex %p, uninited %d, sg %p, m %p, blocks %R, write %R\n",
               __func__, ex, ex->uninited, sg, m, blocks, r);
 
+    assert(!ex->compressed);
     if (sg) {
         if (ex->uninited) {
             symbol a = sym(uninited);
@@ -569,26 +1005,6 @@ static u64 write_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m)
     return i.end;
 }
 
-static fs_status fill_gap(fsfile f, sg_list sg, range blocks, merge m, u64 *edge)
-{
-    blocks = irangel(blocks.start, MIN(MAX_EXTENT_SIZE >> f->fs->blocksize_order,
-                                       range_span(blocks)));
-    tfs_debug("   %s: writing new extent blocks %R\n", __func__, blocks);
-    extent ex;
-    fs_status fss = create_extent(f->fs, blocks, false, &ex);
-    if (fss != FS_STATUS_OK)
-        return fss;
-    fss = add_extent_to_file(f, ex);
-    if (fss != FS_STATUS_OK) {
-        destroy_extent(f->fs, ex);
-        return fss;
-    }
-    if (m)
-        write_extent(f, ex, sg, blocks, m);
-    *edge = blocks.end;
-    return FS_STATUS_OK;
-}
-
 static fs_status update_extent_length(fsfile f, extent ex, u64 new_length)
 {
     value v = value_from_u64(f->fs->h, new_length);
@@ -610,6 +1026,10 @@ static fs_status update_extent_length(fsfile f, extent ex, u64 new_length)
 
 static fs_status extend(fsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *edge)
 {
+    if (ex->compressed || ex->shared) {
+        *edge = blocks.start;
+        return FS_STATUS_OK;
+    }
     u64 free = ex->allocated - range_span(ex->node.r);
     range r = irangel(ex->node.r.end, free);
     range i = range_intersection(r, blocks);
@@ -636,10 +1056,154 @@ static fs_status extend(fsfile f, extent ex, sg_list sg, range blocks, merge m,
     return s;
 }
 
+/* Claim the storage following an extent that is full, doubling its
+   allocation up to the maximum extent size. */
+static boolean grow_extent(fsfile f, extent ex, u64 nblocks)
+{
+    filesystem fs = f->fs;
+    u64 max_blocks = MAX_EXTENT_SIZE >> fs->blocksize_order;
+    if (ex->uninited || ex->compressed || ex->shared || !ex->md ||
+        range_span(ex->node.r) != ex->allocated ||
+        ex->allocated >= max_blocks || !fs->w)
+        return false;
+    u64 grow = MIN(MAX(nblocks, ex->allocated), max_blocks - ex->allocated);
+    u64 start = ex->start_block + ex->allocated;
+    if (!id_heap_set_area(fs->storage, start, grow, true, true)) {
+        grow = MIN(nblocks, max_blocks - ex->allocated);
+        if (!id_heap_set_area(fs->storage, start, grow, true, true))
+            return false;
+    }
+    value v = value_from_u64(fs->h, ex->allocated + grow);
+    if (v == INVALID_ADDRESS ||
+        filesystem_write_eav(fs, ex->md, sym(allocated), v) != FS_STATUS_OK) {
+        if (v != INVALID_ADDRESS)
+            deallocate_value(v);
+        filesystem_free_storage(fs, irangel(start, grow));
+        return false;
+    }
+    tfs_debug("   %s: ex %p, allocated %ld, grow %ld\n", __func__, ex, ex->allocated, grow);
+    ex->allocated += grow;
+    value oldval = get(ex->md, sym(allocated));
+    assert(oldval);
+    deallocate_value(oldval);
+    set(ex->md, sym(allocated), v);
+    return true;
+}
+
+static fs_status fill_gap(fsfile f, sg_list sg, range blocks, merge m, u64 *edge)
+{
+    filesystem fs = f->fs;
+    u64 max_blocks = MAX_EXTENT_SIZE >> fs->blocksize_order;
+    blocks = irangel(blocks.start, MIN(max_blocks, range_span(blocks)));
+    tfs_debug("   %s: writing new extent blocks %R\n", __func__, blocks);
+
+    /* Appending right after an extent extends it if possible, and otherwise
+       places the new extent close to it on disk. An extent at the end of the
+       file is preallocated at twice the size of the previous one, so that
+       concurrent appenders fragment logarithmically. */
+    extent prev = (extent)rangemap_lookup_max_lte(f->extentmap, blocks.start);
+    u64 goal = INVALID_PHYSICAL;
+    u64 prealloc = 0;
+    if (prev != INVALID_ADDRESS) {
+        if (prev->node.r.end == blocks.start && grow_extent(f, prev, range_span(blocks)))
+            return extend(f, prev, sg, blocks, m, edge);
+        goal = prev->start_block + prev->allocated;
+        if (rangemap_next_node(f->extentmap, &prev->node) == INVALID_ADDRESS)
+            prealloc = MIN(MAX(range_span(blocks), 2 * prev->allocated), max_blocks);
+    }
+
+    extent ex;
+    fs_status fss = create_extent(fs, blocks, false, goal, prealloc, &ex);
+    if (fss != FS_STATUS_OK)
+        return fss;
+    fss = add_extent_to_file(f, ex);
+    if (fss != FS_STATUS_OK) {
+        destroy_extent(fs, ex);
+        return fss;
+    }
+    if (m)
+        write_extent(f, ex, sg, blocks, m);
+    *edge = blocks.end;
+    return FS_STATUS_OK;
+}
+
+static fs_status add_shared_extent(fsfile f, range blocks, u64 start_block, u64 allocated)
+{
+    extent ex = allocate_extent(f->fs->h, blocks, irangel(start_block, allocated));
+    if (ex == INVALID_ADDRESS)
+        return FS_STATUS_NOMEM;
+    ex->shared = true;
+    fs_status fss = add_extent_to_file(f, ex);
+    if (fss != FS_STATUS_OK)
+        deallocate(f->fs->h, ex, sizeof(*ex));
+    return fss;
+}
+
+/* Copy on write of the blocks of a shared extent that are written or zeroed.
+   The blocks before and after them stay in extents of their own that refer
+   to the same storage. Written blocks go to a new extent, zeroed blocks
+   become a hole. */
+static fs_status unshare_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m,
+                                u64 *edge)
+{
+    filesystem fs = f->fs;
+    range r = ex->node.r;
+    range i = range_intersection(blocks, r);
+    u64 start_block = ex->start_block;
+    u64 allocated = ex->allocated;
+    tfs_debug("   %s: ex %p, node %R, blocks %R\n", __func__, ex, r, blocks);
+    remove_extent_from_file(f, ex);
+    deallocate(fs->h, ex, sizeof(*ex));
+    fs_status fss;
+    if (i.start > r.start) {
+        fss = add_shared_extent(f, irange(r.start, i.start), start_block, i.start - r.start);
+        if (fss != FS_STATUS_OK)
+            return fss;
+    }
+    if (i.end < r.end) {
+        u64 offset = i.end - r.start;
+        fss = add_shared_extent(f, irange(i.end, r.end), start_block + offset, allocated - offset);
+        if (fss != FS_STATUS_OK)
+            return fss;
+    }
+    shared_storage_ref(fs, irangel(start_block + (i.start - r.start), range_span(i)), -1, false);
+    if (sg) {
+        fss = create_extent(fs, i, false, start_block, 0, &ex);
+        if (fss != FS_STATUS_OK)
+            return fss;
+        fss = add_extent_to_file(f, ex);
+        if (fss != FS_STATUS_OK) {
+            destroy_extent(fs, ex);
+            return fss;
+        }
+        write_extent(f, ex, sg, blocks, m);
+    }
+    *edge = i.end;
+    return FS_STATUS_OK;
+}
+
+/* Compressed extents are read-only, and can only be removed as a whole. */
+closure_function(3, 1, void, check_compressed_extent,
+                 range, blocks, boolean, zero, boolean *, readonly,
+                 rmnode, n)
+{
+    if (((extent)n)->compressed && !(bound(zero) && range_contains(bound(blocks), n->r)))
+        *bound(readonly) = true;
+}
+
 static status extents_range_handler(filesystem fs, fsfile f, range blocks, sg_list sg, merge m)
 {
     tfs_debug("%s: file %p blocks %R sg %p m %p\n", __func__, f, blocks, sg, m);
 
+    if (fs->sealed)
+        return timm("result", "filesystem is sealed", "fsstatus", "%d", FS_STATUS_READONLY);
+    boolean readonly = false;
+    rangemap_range_lookup(f->extentmap, blocks,
+                          stack_closure(check_compressed_extent, blocks, m && !sg, &readonly));
+    if (readonly)
+        return timm("result", "cannot modify compressed extent",
+                    "fsstatus", "%d", FS_STATUS_READONLY);
+
     rmnode prev;            /* prior to edge, but could be extended */
     rmnode next;            /* intersecting or succeeding */
     prev = rangemap_lookup_max_lte(f->extentmap, blocks.start);
@@ -694,11 +1258,18 @@ static status extents_range_handler(filesystem fs, fsfile f, range blocks, sg_li
                 destroy_extent(fs, ex);
                 prev = INVALID_ADDRESS; /* prev isn't used in zero, but just to be safe */
             } else if (blocks.end > ex->node.r.start) {
-                /* TODO: improve write_extent to trim extent on zero */
-                if (m)
+                if (m && ex->shared && shared_storage_busy(fs, ex, blocks)) {
+                    fs_status fss = unshare_extent(f, ex, sg, blocks, m, &blocks.start);
+                    if (fss != FS_STATUS_OK)
+                        return timm("result", "unable to copy shared extent", "fsstatus", "%d",
+                                    fss);
+                    prev = INVALID_ADDRESS;
+                } else if (m) {
+                    /* TODO: improve write_extent to trim extent on zero */
                     blocks.start = write_extent(f, ex, sg, blocks, m);
-                else
+                } else {
                     blocks.start = range_intersection(blocks, ex->node.r).end;
+                }
             }
         }
         assert(blocks.start <= blocks.end); // XXX tmp
@@ -779,6 +1350,89 @@ void filesystem_write_linear(fsfile f, void *src, range q, io_status_handler io_
                                           sg, length, io_complete));
 }
 
+closure_function(4, 1, void, compressed_write_complete,
+                 heap, h, void *, buf, bytes, size, status_handler, sh,
+                 status, s)
+{
+    deallocate(bound(h), bound(buf), bound(size));
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+/* Write the contents of a new file directly to storage, one extent per
+   TFS_COMPRESS_CHUNK_SIZE bytes. A chunk is stored LZ4 compressed if that
+   saves at least a block, and as is otherwise. */
+void filesystem_write_compressed(fsfile f, void *src, u64 length, status_handler completion)
+{
+    filesystem fs = f->fs;
+    heap h = fs->h;
+    u64 block_size = U64_FROM_BIT(fs->blocksize_order);
+    merge m = allocate_merge(h, completion);
+    status_handler sh = apply_merge(m);
+    status s = STATUS_OK;
+    u64 goal = INVALID_PHYSICAL;
+    for (u64 offset = 0; offset < length; offset += TFS_COMPRESS_CHUNK_SIZE) {
+        u64 n = MIN(TFS_COMPRESS_CHUNK_SIZE, length - offset);
+        range blocks = range_rshift_pad(irangel(offset, n), fs->blocksize_order);
+        bytes size = pad(lz4_compress_bound(n), block_size);
+        u8 *buf = allocate(h, size);
+        if (buf == INVALID_ADDRESS) {
+            s = timm("result", "failed to allocate compression buffer",
+                     "fsstatus", "%d", FS_STATUS_NOMEM);
+            break;
+        }
+        u64 clen = lz4_compress(h, src + offset, n, buf, size);
+        u64 nblocks = pad(clen, block_size) >> fs->blocksize_order;
+        extent ex = INVALID_ADDRESS;
+        fs_status fss;
+        if (clen > 0 && nblocks < range_span(blocks)) {
+            u64 start_block = INVALID_PHYSICAL;
+            if (filesystem_reserve_log(fs))
+                start_block = filesystem_allocate_storage_near(fs, nblocks, goal);
+            if (start_block == INVALID_PHYSICAL) {
+                fss = FS_STATUS_NOSPACE;
+            } else {
+                ex = allocate_extent(h, blocks, irangel(start_block, nblocks));
+                if (ex == INVALID_ADDRESS) {
+                    filesystem_free_storage(fs, irangel(start_block, nblocks));
+                    fss = FS_STATUS_NOMEM;
+                } else {
+                    ex->md = 0;
+                    ex->compressed = clen;
+                    zero(buf + clen, (nblocks << fs->blocksize_order) - clen);
+                    fss = FS_STATUS_OK;
+                }
+            }
+        } else {
+            nblocks = range_span(blocks);
+            runtime_memcpy(buf, src + offset, n);
+            zero(buf + n, (nblocks << fs->blocksize_order) - n);
+            fss = create_extent(fs, blocks, false, goal, 0, &ex);
+        }
+        if (fss == FS_STATUS_OK) {
+            fss = add_extent_to_file(f, ex);
+            if (fss != FS_STATUS_OK)
+                destroy_extent(fs, ex);
+        }
+        if (fss != FS_STATUS_OK) {
+            deallocate(h, buf, size);
+            s = timm("result", "failed to write extent", "fsstatus", "%d", fss);
+            break;
+        }
+        tfs_debug("%s: blocks %R, compressed %ld, storage 0x%lx (%ld blocks)\n", __func__,
+                  blocks, ex->compressed, ex->start_block, nblocks);
+        goal = ex->start_block + ex->allocated;
+        apply(fs->w, buf, irangel(ex->start_block, nblocks),
+              closure(h, compressed_write_complete, h, buf, size, apply_merge(m)));
+    }
+    if (is_ok(s)) {
+        fs_status fss = filesystem_truncate(fs, f, length);
+        if (fss != FS_STATUS_OK)
+            s = timm("result", "unable to set file length", "fsstatus", "%d", fss);
+    }
+    apply(sh, s);
+}
+
 fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len)
 {
     value v = value_from_u64(fs->h, len);
@@ -793,22 +1447,166 @@ fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len)
     return s;
 }
 
-closure_function(3, 1, void, log_flush_completed,
+/* A range can be cloned if its extents hold plain data and the destination
+   range, which must be past the cached end of out, has no extents yet. */
+static fs_status clone_range_check(fsfile in, range blocks, fsfile out, s64 delta)
+{
+    if (rangemap_range_intersects(out->extentmap, range_add(blocks, delta)))
+        return FS_STATUS_INVAL;
+    rmnode n = rangemap_lookup_at_or_next(in->extentmap, blocks.start);
+    while (n != INVALID_ADDRESS && n->r.start < blocks.end) {
+        extent ex = (extent)n;
+        if (ex->uninited || ex->compressed || !ex->md)
+            return FS_STATUS_INVAL;
+        n = rangemap_next_node(in->extentmap, n);
+    }
+    return FS_STATUS_OK;
+}
+
+static fs_status clone_extents(fsfile in, range blocks, fsfile out, s64 delta)
+{
+    filesystem fs = in->fs;
+    rmnode n = rangemap_lookup_at_or_next(in->extentmap, blocks.start);
+    while (n != INVALID_ADDRESS && n->r.start < blocks.end) {
+        extent ex = (extent)n;
+        range i = range_intersection(blocks, n->r);
+        range storage_blocks = irangel(ex->start_block + (i.start - n->r.start), range_span(i));
+        if (!ex->shared) {
+            fs_status fss = filesystem_write_eav(fs, ex->md, sym(shared), null_value);
+            if (fss != FS_STATUS_OK)
+                return fss;
+            set(ex->md, sym(shared), null_value);
+            ex->shared = true;
+        }
+        shared_storage_ref(fs, storage_blocks, 1, false);
+        fs_status fss = add_shared_extent(out, range_add(i, delta), storage_blocks.start,
+                                          range_span(storage_blocks));
+        if (fss != FS_STATUS_OK) {
+            shared_storage_ref(fs, storage_blocks, -1, false);
+            return fss;
+        }
+        n = rangemap_next_node(in->extentmap, n);
+    }
+    return FS_STATUS_OK;
+}
+
+closure_function(6, 1, void, clone_range_synced,
+                 fsfile, in, range, blocks, fsfile, out, s64, delta, u64, end, fs_status_handler, completion,
+                 status, s)
+{
+    fsfile in = bound(in);
+    fsfile out = bound(out);
+    range blocks = bound(blocks);
+    s64 delta = bound(delta);
+    fs_status fss;
+    if (!is_ok(s)) {
+        timm_dealloc(s);
+        fss = FS_STATUS_IOERR;
+        goto out;
+    }
+    /* the files may have changed while the source was synced */
+    fss = clone_range_check(in, blocks, out, delta);
+    if (fss == FS_STATUS_OK)
+        fss = clone_extents(in, blocks, out, delta);
+    if (fss == FS_STATUS_OK && fsfile_get_length(out) < bound(end))
+        fss = filesystem_truncate(out->fs, out, bound(end));
+  out:
+    apply(bound(completion), out, fss);
+    closure_finish();
+}
+
+/* Make length bytes of out at out_offset refer to the storage of in at
+   in_offset, which is shared until either file writes to it. Offsets must be
+   page-aligned, as must the length unless the range reaches the end of in,
+   and out_offset must be at or past the end of out. Cached data of in is
+   written back first, so that the shared storage is up to date. */
+void filesystem_clone_range(fsfile in, u64 in_offset, fsfile out, u64 out_offset, u64 length,
+                            fs_status_handler completion)
+{
+    filesystem fs = in->fs;
+    u64 page_mask = MASK(fs->page_order);
+    u64 in_end = in_offset + length;
+    tfs_debug("%s: in %p, offset 0x%lx, out %p, offset 0x%lx, length 0x%lx\n", __func__,
+              in, in_offset, out, out_offset, length);
+    fs_status fss = FS_STATUS_OK;
+    if (fs->sealed) {
+        fss = FS_STATUS_READONLY;
+    } else if (out->fs != fs || in == out || length == 0 ||
+               ((in_offset | out_offset) & page_mask) ||
+               ((in_end & page_mask) && in_end < fsfile_get_length(in)) ||
+               in_end > fsfile_get_length(in) ||
+               out_offset < pad(fsfile_get_length(out), U64_FROM_BIT(fs->page_order))) {
+        fss = FS_STATUS_INVAL;
+    }
+    range blocks = range_rshift_pad(irangel(in_offset, length), fs->blocksize_order);
+    s64 delta = (s64)(out_offset >> fs->blocksize_order) - (s64)blocks.start;
+    if (fss == FS_STATUS_OK)
+        fss = clone_range_check(in, blocks, out, delta);
+    if (fss != FS_STATUS_OK) {
+        apply(completion, out, fss);
+        return;
+    }
+    status_handler sh = closure(fs->h, clone_range_synced, in, blocks, out, delta,
+                                out_offset + length, completion);
+    if (sh == INVALID_ADDRESS) {
+        apply(completion, out, FS_STATUS_NOMEM);
+        return;
+    }
+    pagecache_sync_node(in->cache_node, sh);
+}
+
+closure_function(4, 1, void, log_flush_completed,
                  filesystem, fs, status_handler, completion, boolean, sync_complete,
+                 boolean, post_flush,
                  status, s)
 {
+    filesystem fs = bound(fs);
     if (is_ok(s) && !bound(sync_complete)) {
         bound(sync_complete) = true;
-        pagecache_sync_volume(bound(fs)->pv, (status_handler)closure_self());
+        pagecache_sync_volume(fs->pv, (status_handler)closure_self());
+    } else if (is_ok(s) && bound(post_flush)) {
+        bound(post_flush) = false;
+        apply(fs->ops->flush, (status_handler)closure_self());
     } else {
         apply(bound(completion), s);
         closure_finish();
     }
 }
 
+closure_function(2, 1, void, log_flush_barrier_complete,
+                 filesystem, fs, status_handler, sh,
+                 status, s)
+{
+    if (is_ok(s))
+        log_flush(bound(fs)->tl, bound(sh));
+    else
+        apply(bound(sh), s);
+    closure_finish();
+}
+
+/* Commits the log along with the data written before the call. On a device
+   with a volatile write cache, that data is made durable by a flush issued
+   before the log writes, which then go through with FUA; lacking FUA, one
+   flush after the log writes covers both. Flushes are merged per volume
+   across concurrent callers. */
 void filesystem_flush(filesystem fs, status_handler completion)
 {
-    log_flush(fs->tl, closure(fs->h, log_flush_completed, fs, completion, false));
+    storage_ops ops = fs->ops;
+    boolean write_cache = ops && ops->flush;
+    status_handler sh = closure(fs->h, log_flush_completed, fs, completion, false,
+                                write_cache && !ops->write_fua);
+    if (write_cache && ops->write_fua)
+        apply(ops->flush, closure(fs->h, log_flush_barrier_complete, fs, sh));
+    else
+        log_flush(fs->tl, sh);
+}
+
+/* Used by mkfs once a filesystem is fully written: its metadata is stored as a
+   single blob that is ingested with one read at mount, and the filesystem
+   becomes read-only. */
+void filesystem_seal(filesystem fs, tuple root, status_handler completion)
+{
+    log_seal(fs->tl, root, closure(fs->h, log_flush_completed, fs, completion, false, false));
 }
 
 closure_function(2, 1, void, filesystem_op_complete,
@@ -851,6 +1649,10 @@ void filesystem_alloc(filesystem fs, tuple t, long offset, long len,
 {
     fsfile f = table_find(fs->files, t);
     assert(f);
+    if (fs->sealed) {
+        apply(completion, f, FS_STATUS_READONLY);
+        return;
+    }
     tuple extents = get(t, sym(extents));
     if (!extents) {
         apply(completion, f, FS_STATUS_NOENT);
@@ -952,8 +1754,10 @@ static fs_status fs_set_dir_entry(filesystem fs, tuple parent, symbol name_sym,
     }
     tuple c = children(parent);
     fs_status s = filesystem_write_eav(fs, c, name_sym, child);
-    if (s == FS_STATUS_OK)
+    if (s == FS_STATUS_OK) {
         set(c, name_sym, child);
+        fs_lookup_invalidate(parent, name_sym);
+    }
     if (child) {
         /* If this is a directory, re-add its . and .. directory entries. */
         fixup_directory(parent, child);
@@ -976,8 +1780,10 @@ fs_status do_mkentry(filesystem fs, tuple parent, const char *name, tuple entry,
         s = FS_STATUS_OK;
     }
 
-    if (s == FS_STATUS_OK)
+    if (s == FS_STATUS_OK) {
         set(c, name_sym, entry);
+        fs_lookup_invalidate(parent, name_sym);
+    }
     fixup_directory(parent, entry);
     return s;
 }
@@ -1111,6 +1917,8 @@ fs_status filesystem_delete(filesystem fs, tuple parent, symbol sym)
             destroy_extent(fs, ex);
         }
     }
+    if (children(t))
+        fs_lookup_flush();
     return fs_set_dir_entry(fs, parent, sym, 0);
 }
 
@@ -1120,6 +1928,9 @@ fs_status filesystem_rename(filesystem fs, tuple oldparent, symbol oldsym,
     tuple t = lookup(oldparent, oldsym);
     assert(t);
     symbol newchild_sym = sym_this(newname);
+    tuple replaced = lookup(newparent, newchild_sym);
+    if (replaced && children(replaced))
+        fs_lookup_flush();
     fs_status s = fs_set_dir_entry(fs, newparent, newchild_sym, t);
     if (s == FS_STATUS_OK)
         s = fs_set_dir_entry(fs, oldparent, oldsym, 0);
@@ -1141,9 +1952,95 @@ fs_status filesystem_exchange(filesystem fs, tuple parent1, symbol sym1,
     return s;
 }
 
+#ifdef KERNEL
+/* Copy a tuple into the new log, leaving out the . and .. entries of
+   directories. */
+static boolean log_rebuild_tuple(log new_tl, tuple t, vector pending)
+{
+    symbol dot = sym_this("."), dotdot = sym_this("..");
+    value d = get(t, dot), dd = get(t, dotdot);
+    if (d) {
+        set(t, dot, 0);
+        set(t, dotdot, 0);
+    }
+    boolean written = log_write_shallow(new_tl, t, pending);
+    if (d) {
+        set(t, dot, d);
+        set(t, dotdot, dd);
+    }
+    return written;
+}
+
+/* Copy the metadata tree into the new log a chunk of tuples at a time, each
+   chunk being flushed before the next is encoded so that filesystem
+   operations interleave with the rebuild. Operations in the meantime are
+   logged to both logs (see filesystem_write_eav), and a tuple copied after
+   being modified supersedes the entries logged for it. */
+closure_function(4, 1, void, log_rebuild_chunk,
+                 filesystem, fs, log, new_tl, vector, pending, status_handler, sh,
+                 status, s)
+{
+    filesystem fs = bound(fs);
+    vector pending = bound(pending);
+    tfs_debug("%s: %d pending, status %v\n", __func__, vector_length(pending), s);
+    if (is_ok(s)) {
+        for (int n = 0; n < TFS_LOG_COMPACT_CHUNK; n++) {
+            tuple t = vector_pop(pending);
+            if (!t)
+                break;
+            if (!log_rebuild_tuple(bound(new_tl), t, pending)) {
+                s = timm("result", "failed to write log");
+                break;
+            }
+            fs->log_stats.compact_copied++;
+        }
+        fs->log_stats.compact_pending = vector_length(pending);
+        if (is_ok(s) && vector_length(pending) > 0) {
+            log_flush(bound(new_tl), (status_handler)closure_self());
+            return;
+        }
+    }
+    fs->log_stats.compact_pending = 0;
+    deallocate_vector(pending);
+    if (is_ok(s))
+        log_flush(bound(new_tl), bound(sh));
+    else
+        apply(bound(sh), s);
+    closure_finish();
+}
+
+void filesystem_log_rebuild(filesystem fs, log new_tl, status_handler sh)
+{
+    tfs_debug("%s(%F)\n", __func__, sh);
+    fs->log_stats.compactions++;
+    fs->log_stats.compact_copied = 0;
+    vector pending = allocate_vector(fs->h, 64);
+    if (pending == INVALID_ADDRESS) {
+        apply(sh, timm("result", "failed to allocate vector"));
+        return;
+    }
+    /* the root must be the first tuple in the log */
+    if (!log_rebuild_tuple(new_tl, fs->root, pending)) {
+        deallocate_vector(pending);
+        apply(sh, timm("result", "failed to write log"));
+        return;
+    }
+    fs->log_stats.compact_copied++;
+    fs->temp_log = new_tl;
+    status_handler chunk = closure(fs->h, log_rebuild_chunk, fs, new_tl, pending, sh);
+    if (chunk == INVALID_ADDRESS) {
+        deallocate_vector(pending);
+        apply(sh, timm("result", "failed to allocate closure"));
+        return;
+    }
+    log_flush(new_tl, chunk);
+}
+#else
+/* mkfs: rebuild in one pass */
 void filesystem_log_rebuild(filesystem fs, log new_tl, status_handler sh)
 {
     tfs_debug("%s(%F)\n", __func__, sh);
+    fs->log_stats.compactions++;
     cleanup_directory(fs->root);
     if (log_write(new_tl, fs->root)) {
         fs->temp_log = new_tl;
@@ -1153,6 +2050,7 @@ void filesystem_log_rebuild(filesystem fs, log new_tl, status_handler sh)
     }
     fixup_directory(fs->root, fs->root);
 }
+#endif
 
 void filesystem_log_rebuild_done(filesystem fs, log new_tl)
 {
@@ -1161,6 +2059,68 @@ void filesystem_log_rebuild_done(filesystem fs, log new_tl)
     fs->temp_log = 0;
 }
 
+#ifdef KERNEL
+closure_function(3, 0, value, filesystem_get_log_counter,
+                 filesystem, fs, u64, offset, value, v)
+{
+    return value_rewrite_u64(bound(v), *(u64 *)((void *)&bound(fs)->log_stats + bound(offset)));
+}
+
+closure_function(2, 0, value, filesystem_get_compact_progress,
+                 filesystem, fs, value, v)
+{
+    /* percent of the tuples known so far, 100 when no rebuild is in progress */
+    filesystem fs = bound(fs);
+    u64 known = fs->log_stats.compact_copied + fs->log_stats.compact_pending;
+    return value_rewrite_u64(bound(v), known ? fs->log_stats.compact_copied * 100 / known : 100);
+}
+
+closure_function(2, 0, value, filesystem_get_write_amplification,
+                 filesystem, fs, value, v)
+{
+    /* total bytes logged per byte logged by operations, in percent */
+    filesystem fs = bound(fs);
+    u64 op_bytes = fs->log_stats.log_bytes;
+    u64 total = op_bytes + fs->log_stats.compact_bytes;
+    return value_rewrite_u64(bound(v), op_bytes ? total * 100 / op_bytes : 100);
+}
+
+#define register_log_counter(fs, n, t, name, field)                         \
+    v = value_from_u64(fs->h, 0);                                           \
+    a = sym(name);                                                          \
+    set(t, a, v);                                                           \
+    tuple_notifier_register_get_notify(n, a, closure(fs->h, filesystem_get_log_counter, fs, \
+        offsetof(struct filesystem_log_stats *, field), v));
+
+/* /tfs_log: metadata log volume, compaction state and mount time of the filesystem */
+void init_filesystem_log_management(filesystem fs, tuple root)
+{
+    value v;
+    symbol a;
+    tuple t = allocate_tuple();
+    assert(t);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    register_log_counter(fs, n, t, log_bytes, log_bytes);
+    register_log_counter(fs, n, t, compact_bytes, compact_bytes);
+    register_log_counter(fs, n, t, compactions, compactions);
+    register_log_counter(fs, n, t, compact_tuples_copied, compact_copied);
+    register_log_counter(fs, n, t, compact_tuples_pending, compact_pending);
+    register_log_counter(fs, n, t, replay_time_us, replay_time_us);
+    v = value_from_u64(fs->h, 0);
+    a = sym(compact_progress_percent);
+    set(t, a, v);
+    tuple_notifier_register_get_notify(n, a, closure(fs->h, filesystem_get_compact_progress, fs, v));
+    v = value_from_u64(fs->h, 0);
+    a = sym(write_amplification_percent);
+    set(t, a, v);
+    tuple_notifier_register_get_notify(n, a, closure(fs->h, filesystem_get_write_amplification,
+                                                     fs, v));
+    set(t, sym(no_encode), null_value);
+    set(root, sym(tfs_log), n);
+}
+#endif
+
 #endif /* !TFS_READ_ONLY */
 
 fsfile allocate_fsfile(filesystem fs, tuple md)
@@ -1186,7 +2146,7 @@ fsfile allocate_fsfile(filesystem fs, tuple md)
         deallocate(fs->h, f, sizeof(struct fsfile));
         return INVALID_ADDRESS;
     }
-    f->extentmap = allocate_rangemap(fs->h);
+    f->extentmap = allocate_rangemap_btree(fs->h);
     f->fs = fs;
     f->md = md;
     f->length = 0;
@@ -1194,6 +2154,8 @@ fsfile allocate_fsfile(filesystem fs, tuple md)
     f->cache_node = pn;
     f->read = pagecache_node_get_reader(pn);
     f->write = pagecache_node_get_writer(pn);
+    f->direct_read = fs_read;
+    f->direct_write = fs_write;
     return f;
 }
 
@@ -1201,6 +2163,7 @@ fsfile fsfile_from_node(filesystem fs, tuple n)
 {
     return table_find(fs->files, n);
 }
+KLIB_EXPORT(fsfile_from_node);
 
 closure_function(2, 1, void, log_complete,
                  filesystem_complete, fc, filesystem, fs,
@@ -1219,6 +2182,33 @@ closure_function(2, 1, void, log_complete,
 closure_function(0, 2, void, ignore_io,
                  status, s, bytes, length) {}
 
+u64 filesystem_get_blocksize(filesystem fs)
+{
+    return U64_FROM_BIT(fs->blocksize_order);
+}
+
+boolean filesystem_is_sealed(filesystem fs)
+{
+    return fs->sealed;
+}
+
+void filesystem_set_log_commit_delay(filesystem fs, timestamp delay)
+{
+    fs->log_commit_delay = delay;
+}
+
+void filesystem_set_storage_ops(filesystem fs, storage_ops ops)
+{
+    fs->ops = ops;
+#ifndef TFS_READ_ONLY
+    if (fs->w && ops && ops->discard && !fs->discards) {
+        fs->discards = allocate_rangemap(fs->h);
+        if (fs->discards == INVALID_ADDRESS)
+            fs->discards = 0;
+    }
+#endif
+}
+
 const char *filesystem_get_label(filesystem fs)
 {
     return fs->label;
@@ -1260,9 +2250,12 @@ void create_filesystem(heap h,
     if (!ignore_io_status)
         ignore_io_status = closure(h, ignore_io);
     fs->files = allocate_table(h, identity_key, pointer_equal);
+    fs->dma = pagecache_get_contiguous_heap();
     fs->zero_page = pagecache_get_zero_page();
     assert(fs->zero_page);
     fs->r = read;
+    fs->ops = 0;
+    fs->discards = 0;
     fs->root = 0;
     fs->page_order = pagecache_get_page_order();
     fs->size = size;
@@ -1274,10 +2267,13 @@ void create_filesystem(heap h,
     fs->w = write;
     fs->storage = create_id_heap(h, h, 0, size >> fs->blocksize_order, 1, false);
     assert(fs->storage != INVALID_ADDRESS);
+    fs->shared = allocate_rangemap(h);
+    assert(fs->shared != INVALID_ADDRESS);
     fs->temp_log = 0;
 #else
     fs->w = 0;
     fs->storage = 0;
+    fs->shared = 0;
 #endif
     if (label) {
         int label_len = runtime_strlen(label);
@@ -1288,6 +2284,9 @@ void create_filesystem(heap h,
     }
     fs->next_extend_log_offset = INVALID_PHYSICAL;
     fs->next_new_log_offset = INVALID_PHYSICAL;
+    fs->log_commit_delay = microseconds(TFS_LOG_COMMIT_DELAY_US);
+    fs->sealed = false;
+    zero(&fs->log_stats, sizeof(fs->log_stats));
     fs->tl = log_create(h, fs, label != 0, closure(h, log_complete, complete, fs));
 }
 
@@ -1300,6 +2299,20 @@ closure_function(1, 1, void, dealloc_extent_node,
     deallocate(bound(fs)->h, n, sizeof(struct extent));
 }
 
+closure_function(1, 1, void, dealloc_shared_blocks,
+                 filesystem, fs,
+                 rmnode, n)
+{
+    deallocate(bound(fs)->h, n, sizeof(struct shared_blocks));
+}
+
+closure_function(1, 1, void, dealloc_discard_node,
+                 filesystem, fs,
+                 rmnode, n)
+{
+    deallocate(bound(fs)->h, n, sizeof(*n));
+}
+
 void deallocate_fsfile(filesystem fs, fsfile f)
 {
     table_set(fs->files, f->md, 0);
@@ -1313,6 +2326,7 @@ void deallocate_fsfile(filesystem fs, fsfile f)
 void destroy_filesystem(filesystem fs)
 {
     tfs_debug("%s %p\n", __func__, fs);
+    fs_lookup_flush();
     log_destroy(fs->tl);
     pagecache_dealloc_volume(fs->pv);
     if (fs->root) {
@@ -1324,6 +2338,9 @@ void destroy_filesystem(filesystem fs)
         deallocate_fsfile(fs, v);
     }
     deallocate_table(fs->files);
+    deallocate_rangemap(fs->shared, stack_closure(dealloc_shared_blocks, fs));
+    if (fs->discards)
+        deallocate_rangemap(fs->discards, stack_closure(dealloc_discard_node, fs));
     destroy_id_heap(fs->storage);
     deallocate(fs->h, fs, sizeof(*fs));
 }
@@ -1396,10 +2413,16 @@ symbol lookup_sym(tuple parent, tuple t)
     return s;
 }
 
-static tuple lookup_follow(filesystem *fs, tuple t, symbol a, tuple *p)
+static tuple lookup_follow(filesystem *fs, tuple t, buffer name, tuple *p)
 {
+    symbol a;
     *p = t;
+#ifdef KERNEL
+    t = fs_lookup(t, name, &a);
+#else
+    a = intern(name);
     t = lookup(t, a);
+#endif
     if (!t)
         return t;
     if (fs_path_helper.lookup_follow)
@@ -1429,7 +2452,7 @@ int filesystem_resolve_cstring(filesystem *fs, tuple cwd, const char *f, tuple *
     while ((y = *f)) {
         if (y == '/') {
             if (buffer_length(a)) {
-                t = lookup_follow(fs, t, intern(a), &p);
+                t = lookup_follow(fs, t, a, &p);
                 if (!t) {
                     err = FS_STATUS_NOENT;
                     goto done;
@@ -1457,7 +2480,7 @@ int filesystem_resolve_cstring(filesystem *fs, tuple cwd, const char *f, tuple *
     }
 
     if (buffer_length(a)) {
-        t = lookup_follow(fs, t, intern(a), &p);
+        t = lookup_follow(fs, t, a, &p);
     }
     err = FS_STATUS_NOENT;
 done:
@@ -1589,7 +2612,7 @@ int file_get_path(tuple n, char *buf, u64 len)
     int cur_len = 1;
     tuple p;
     do {
-        n = lookup_follow(0, n, sym_this(".."), &p);
+        n = lookup_follow(0, n, alloca_wrap_buffer("..", 2), &p);
         assert(n);
         if (n == p) {   /* this is the root directory */
             if (cur_len == 1) {
@@ -11,6 +11,8 @@ void fsfile_set_length(fsfile f, u64 length);
 tuple fsfile_get_meta(fsfile f);
 sg_io fsfile_get_reader(fsfile f);
 sg_io fsfile_get_writer(fsfile f);
+sg_io fsfile_get_direct_reader(fsfile f);
+sg_io fsfile_get_direct_writer(fsfile f);
 pagecache_node fsfile_get_cachenode(fsfile f);
 
 extern io_status_handler ignore_io_status;
@@ -19,6 +21,12 @@ extern io_status_handler ignore_io_status;
 #define MAX_EXTENT_SIZE (1 * MB)
 
 boolean filesystem_probe(u8 *first_sector, u8 *uuid, char *label);
+u64 filesystem_get_blocksize(filesystem fs);
+void filesystem_set_log_commit_delay(filesystem fs, timestamp delay);
+void filesystem_set_storage_ops(filesystem fs, storage_ops ops);
+#ifdef KERNEL
+void init_filesystem_log_management(filesystem fs, tuple root);
+#endif
 const char *filesystem_get_label(filesystem fs);
 void filesystem_get_uuid(filesystem fs, u8 *uuid);
 
@@ -42,8 +50,11 @@ void filesystem_write_sg(fsfile f, sg_list sg, range q, status_handler completio
 /* deprecate these if we can */
 void filesystem_read_linear(fsfile f, void *dest, range q, io_status_handler completion);
 void filesystem_write_linear(fsfile f, void *src, range q, io_status_handler completion);
+void filesystem_write_compressed(fsfile f, void *src, u64 length, status_handler completion);
 
 void filesystem_flush(filesystem fs, status_handler completion);
+void filesystem_seal(filesystem fs, tuple root, status_handler completion);
+boolean filesystem_is_sealed(filesystem fs);
 
 timestamp filesystem_get_atime(filesystem fs, tuple t);
 timestamp filesystem_get_mtime(filesystem fs, tuple t);
@@ -73,6 +84,8 @@ typedef enum {
     FS_STATUS_NOTDIR,
     FS_STATUS_NOMEM,
     FS_STATUS_LINKLOOP,
+    FS_STATUS_READONLY,
+    FS_STATUS_INVAL,
 } fs_status;
 
 fs_status filesystem_write_tuple(filesystem fs, tuple t);
@@ -85,6 +98,8 @@ void filesystem_alloc(filesystem fs, tuple t, long offset, long len,
 void filesystem_dealloc(filesystem fs, tuple t, long offset, long len,
         fs_status_handler completion);
 fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len);
+void filesystem_clone_range(fsfile in, u64 in_offset, fsfile out, u64 out_offset, u64 length,
+                            fs_status_handler completion);
 
 fs_status do_mkentry(filesystem fs, tuple parent, const char *name, tuple entry,
         boolean persistent);
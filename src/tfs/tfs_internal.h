@@ -7,7 +7,9 @@
 #include <storage.h>
 #include <tfs.h>
 
-#define TFS_VERSION 0x00000004
+#define TFS_VERSION 0x00000005
+#define TFS_VERSION_MIN 0x00000004      /* oldest version that can be read */
+#define TFS_VERSION_RECORDS 0x00000005  /* compact extent records in the log */
 
 typedef struct log *log;
 
@@ -21,16 +23,29 @@ typedef struct filesystem {
     u8 uuid[UUID_LEN];
     char label[VOLUME_LABEL_MAX_LEN];
     table files; // maps tuple to fsfile
+    rangemap shared;            /* storage blocks referred to by more than one extent */
     closure_type(log, void, tuple);
     heap dma;
     void *zero_page;
     block_io r;
     block_io w;
+    storage_ops ops;
+    rangemap discards;          /* freed blocks waiting to be discarded */
     pagecache_volume pv;
     log tl;
     log temp_log;
     u64 next_extend_log_offset;
     u64 next_new_log_offset;
+    timestamp log_commit_delay;
+    boolean sealed;             /* metadata precomputed by mkfs, no log writes */
+    struct filesystem_log_stats {
+        u64 log_bytes;          /* logged by filesystem operations */
+        u64 compact_bytes;      /* logged to a log being rebuilt */
+        u64 compactions;
+        u64 compact_copied;     /* tuples copied by the last rebuild */
+        u64 compact_pending;    /* tuples left to copy */
+        u64 replay_time_us;     /* log replay at mount */
+    } log_stats;
     tuple root;
 } *filesystem;
 
@@ -42,6 +57,8 @@ typedef struct fsfile {
     tuple md;
     sg_io read;
     sg_io write;
+    sg_io direct_read;          /* storage access bypassing the cache */
+    sg_io direct_write;
 } *fsfile;
 
 typedef struct extent {
@@ -51,19 +68,30 @@ typedef struct extent {
     u64 allocated;
     tuple md;                   /* shortcut to extent meta */
     boolean uninited;
+    u64 compressed;             /* bytes of LZ4 data in storage, 0 if not compressed */
+    boolean shared;             /* storage may be shared with other extents */
 } *extent;
 
+/* reference count of a range of storage blocks, for blocks of shared extents */
+typedef struct shared_blocks {
+    struct rmnode n;            /* must be first */
+    u64 refs;
+} *shared_blocks;
+
 void ingest_extent(fsfile f, symbol foff, tuple value);
 
 log log_create(heap h, filesystem fs, boolean initialize, status_handler sh);
 boolean log_write(log tl, tuple t);
 boolean log_write_eav(log tl, tuple e, symbol a, value v);
+boolean log_write_shallow(log tl, tuple t, vector children);
 void log_flush(log tl, status_handler completion);
 void log_destroy(log tl);
+void log_seal(log tl, tuple root, status_handler sh);
 void flush(filesystem fs, status_handler);
 u64 filesystem_allocate_storage(filesystem fs, u64 nblocks);
 boolean filesystem_reserve_storage(filesystem fs, range storage_blocks);
 boolean filesystem_free_storage(filesystem fs, range storage_blocks);
+void filesystem_discard_flush(filesystem fs);
 void filesystem_storage_op(filesystem fs, sg_list sg, merge m, range blocks, block_io op);
     
 void filesystem_log_rebuild(filesystem fs, log new_tl, status_handler sh);
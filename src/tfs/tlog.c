@@ -20,6 +20,25 @@ static const char *tfs_magic = "NVMTFS";
 #define TUPLE_EXTENDED 3
 #define END_OF_SEGMENT 4
 #define LOG_EXTENSION_LINK 5
+#define LOG_SEALED_LINK 6   /* link to the single extension of a sealed filesystem */
+
+#define log_dict_next(tl) ((u64)(tl)->dictionary->count + 1)
+
+/* Starting with TFS_VERSION_RECORDS, extent metadata is logged as compact
+   records instead of generic tuple encodings. A record is told apart by its
+   first byte, as the header of a top-level tuple always has bit 6 set. */
+#define TLOG_TUPLE_TYPE_BIT 0x40
+
+/* extents container index, file offset, start block, length, allocated, flags */
+#define TLOG_RECORD_EXTENT      0x01
+/* extent index, attribute, value (no value for TLOG_EXTENT_ATTR_UNINITED) */
+#define TLOG_RECORD_EXTENT_ATTR 0x02
+
+#define TLOG_EXTENT_FLAG_UNINITED 0x01
+
+#define TLOG_EXTENT_ATTR_LENGTH     0
+#define TLOG_EXTENT_ATTR_ALLOCATED  1
+#define TLOG_EXTENT_ATTR_UNINITED   2   /* cleared */
 
 #define COMPLETION_QUEUE_SIZE 10
 
@@ -56,6 +75,7 @@ struct log {
     filesystem fs;
     table extents; // maps extent tuples to files
     table dictionary;
+    u64 version;
     u64 total_entries, obsolete_entries;
     rangemap extensions;
     log_ext current;
@@ -65,9 +85,27 @@ struct log {
 
     boolean dirty;
     boolean flushing;
+    boolean flush_pending;
     timer flush_timer;
-    vector flush_completions;
+    vector flush_completions;   /* waiting on the flush in flight */
+    vector commit_completions;  /* batched into the next flush */
+#ifdef KERNEL
+    timer commit_timer;
+    u64 flush_bytes;
+    timestamp flush_start;
+#endif
     boolean compacting;
+
+    /* read-ahead of the next extension while replaying */
+    log_ext read_ahead;
+    sg_list read_ahead_sg;
+    status read_ahead_status;
+    boolean read_ahead_done;
+    status_handler read_ahead_sh;   /* set once the extension is linked to */
+    status read_ahead_abort;
+#ifdef KERNEL
+    timestamp replay_start;
+#endif
     struct refcount refcount;
     closure_struct(log_free, free);
 };
@@ -80,19 +118,27 @@ closure_function(0, 3, void, zero_fill,
     apply(sh, STATUS_OK);
 }
 
+/* Log writes bypass the device write cache where FUA is supported, so that
+   they are durable once complete without a flush of their own. */
+static block_io log_write_op(filesystem fs)
+{
+    return (fs->ops && fs->ops->write_fua) ? fs->ops->write_fua : fs->w;
+}
+
 closure_function(3, 3, void, log_storage_op,
-                 filesystem, fs, u64, start_sector, block_io, op,
+                 filesystem, fs, u64, start_sector, boolean, write,
                  sg_list, sg, range, q, status_handler, sh)
 {
     int order = bound(fs)->blocksize_order;
+    block_io op = bound(write) ? log_write_op(bound(fs)) : bound(fs)->r;
     assert((q.start & MASK(order)) == 0);
     assert((range_span(q) & MASK(order)) == 0);
     merge m = allocate_merge(bound(fs)->h, sh);
     status_handler k = apply_merge(m);
     range blocks = range_add(range_rshift(q, order), bound(start_sector));
     tlog_debug("%s: sg %p, q %R, blocks %R, sh %F, op %F\n", __func__,
-               sg, q, blocks, sh, bound(op));
-    filesystem_storage_op(bound(fs), sg, m, blocks, bound(op));
+               sg, q, blocks, sh, op);
+    filesystem_storage_op(bound(fs), sg, m, blocks, op);
     apply(k, STATUS_OK);
 }
 
@@ -119,14 +165,14 @@ static log_ext open_log_extension(log tl, range sectors)
     if (ext->staging == INVALID_ADDRESS)
         goto fail_dealloc;
     ext->open = false;
-    sg_io r_op = tl->fs->r ? closure(tl->h, log_storage_op, tl->fs, sectors.start, tl->fs->r) :
+    sg_io r_op = tl->fs->r ? closure(tl->h, log_storage_op, tl->fs, sectors.start, false) :
         closure(tl->h, zero_fill);  /* mkfs */
-    sg_io w_op = closure(tl->h, log_storage_op, tl->fs, sectors.start, tl->fs->w);
+    sg_io w_op = closure(tl->h, log_storage_op, tl->fs, sectors.start, true);
     ext->cache_node = pagecache_allocate_node(tl->fs->pv, r_op, w_op, 0);
     if (ext->cache_node == INVALID_ADDRESS)
         goto fail_dealloc_staging;
 
-    pagecache_set_node_length(ext->cache_node, TFS_LOG_DEFAULT_EXTENSION_SIZE);
+    pagecache_set_node_length(ext->cache_node, MAX(size_bytes, TFS_LOG_DEFAULT_EXTENSION_SIZE));
     ext->sectors = sectors;
     ext->read = pagecache_node_get_reader(ext->cache_node);
     ext->write = pagecache_node_get_writer(ext->cache_node);
@@ -194,12 +240,21 @@ static log log_new(heap h, filesystem fs)
     tl->tuple_bytes_remain = 0;
     tl->dirty = false;
     tl->flushing = false;
+    tl->flush_pending = false;
     tl->flush_timer = 0;
+#ifdef KERNEL
+    tl->commit_timer = 0;
+#endif
     tl->flush_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
     if (tl->flush_completions == INVALID_ADDRESS)
         goto fail_dealloc_encoding_lengths;
+    tl->commit_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
+    if (tl->commit_completions == INVALID_ADDRESS)
+        goto fail_dealloc_flush_completions;
+    tl->version = TFS_VERSION;
     tl->total_entries = tl->obsolete_entries = 0;
     tl->extents = 0;
+    tl->read_ahead = 0;
 #ifndef TLOG_READ_ONLY
     tl->extensions = allocate_rangemap(h);
     if (tl->extensions == INVALID_ADDRESS) {
@@ -218,6 +273,8 @@ static log log_new(heap h, filesystem fs)
     }
     return tl;
   fail_dealloc_completions:
+    deallocate_vector(tl->commit_completions);
+  fail_dealloc_flush_completions:
     deallocate_vector(tl->flush_completions);
   fail_dealloc_encoding_lengths:
     deallocate_vector(tl->encoding_lengths);
@@ -310,7 +367,7 @@ static void log_extension_init(log_ext ext)
 {
     assert(!ext->open);
     assert(push_buffer(ext->staging, alloca_wrap_buffer(tfs_magic, TFS_MAGIC_BYTES)));
-    push_varint(ext->staging, TFS_VERSION);
+    push_varint(ext->staging, ext->tl->version);
     push_varint(ext->staging, range_span(ext->sectors));
     if (ext->sectors.start == 0) {
         assert(buffer_write(ext->staging, ext->tl->fs->uuid, UUID_LEN));
@@ -425,6 +482,9 @@ static inline boolean log_write_internal(log tl, merge m)
 
 static void run_flush_completions(log tl, status s)
 {
+    /* blocks freed by the committed changes can now be discarded */
+    if (is_ok(s))
+        filesystem_discard_flush(tl->fs);
     if (tl->flush_completions) {
         status_handler sh;
         vector_foreach(tl->flush_completions, sh)
@@ -433,14 +493,34 @@ static void run_flush_completions(log tl, status s)
     }
 }
 
+static void log_flush_start(log tl);
+
 closure_function(1, 1, void, log_flush_complete,
                  log, tl,
                  status, s)
 {
+    log tl = bound(tl);
+#if defined(KERNEL) && defined(TLOG_DEBUG)
+    timestamp elapsed = now(CLOCK_ID_MONOTONIC_RAW) - tl->flush_start;
+    tlog_debug("flushed %ld bytes for %d waiters in %T, %ld bytes/s\n", tl->flush_bytes,
+               vector_length(tl->flush_completions), elapsed,
+               tl->flush_bytes * MILLION / MAX(usec_from_timestamp(elapsed), 1));
+#endif
     /* would need to move these to runqueue if a flush is ever invoked from a tfs op */
-    bound(tl)->dirty = false;
-    run_flush_completions(bound(tl), s);
-    bound(tl)->flushing = false;
+    run_flush_completions(tl, s);
+    tl->flushing = false;
+    if (tl->flush_pending) {
+        tl->flush_pending = false;
+        if (tl->compacting) {
+            /* the log switch completes them instead */
+            status_handler sh;
+            vector_foreach(tl->commit_completions, sh)
+                vector_push(tl->flush_completions, sh);
+            vector_clear(tl->commit_completions);
+        } else {
+            log_flush_start(tl);
+        }
+    }
     closure_finish();
 }
 
@@ -483,22 +563,76 @@ closure_function(2, 1, void, log_switch_complete,
     closure_finish();
 }
 
+#ifdef KERNEL
+closure_function(1, 1, void, log_commit_timer_expired,
+                 log, tl,
+                 u64, overruns /* ignored */)
+{
+    bound(tl)->commit_timer = 0;
+    log_flush(bound(tl), 0);
+    closure_finish();
+}
+#endif
+
+/* Group commit: a flush carries everything logged before it started and
+   completes every caller that was waiting when it did. Callers arriving while
+   it is in flight either join it, if they have nothing new to log, or make up
+   the next batch, which is started as soon as the flush completes. An idle log
+   may also hold back a commit for up to the filesystem's commit delay so that
+   other callers can join it. */
 void log_flush(log tl, status_handler completion)
 {
     tlog_debug("%s: log %p, completion %p, dirty %d\n", __func__, tl, completion, tl->dirty);
-    if (!tl->dirty && !tl->compacting) {
+    if (tl->compacting || (tl->flushing && !tl->dirty)) {
+        if (completion)
+            vector_push(tl->flush_completions, completion);
+        return;
+    }
+    if (!tl->dirty) {
         if (completion)
             apply(completion, STATUS_OK);
         return;
     }
     if (completion)
-        vector_push(tl->flush_completions, completion);
-    if (tl->flushing || tl->compacting)
+        vector_push(tl->commit_completions, completion);
+    if (tl->flushing) {
+        tl->flush_pending = true;
+        return;
+    }
+#ifdef KERNEL
+    timestamp delay = tl->fs->log_commit_delay;
+    if (completion && delay &&
+        vector_length(tl->commit_completions) < COMPLETION_QUEUE_SIZE) {
+        if (!tl->commit_timer)
+            tl->commit_timer = kern_register_timer(CLOCK_ID_MONOTONIC_RAW, delay, false, 0,
+                                                   closure(tl->h, log_commit_timer_expired, tl));
         return;
+    }
+#endif
+    log_flush_start(tl);
+}
+
+static void log_flush_start(log tl)
+{
     if (tl->flush_timer) {
         remove_timer(tl->flush_timer, 0);
         tl->flush_timer = 0;
     }
+#ifdef KERNEL
+    if (tl->commit_timer) {
+        remove_timer(tl->commit_timer, 0);
+        tl->commit_timer = 0;
+    }
+    tl->flush_bytes = buffer_length(tl->tuple_staging);
+    tl->flush_start = now(CLOCK_ID_MONOTONIC_RAW);
+#endif
+    status_handler completion;
+    vector_foreach(tl->commit_completions, completion)
+        vector_push(tl->flush_completions, completion);
+    vector_clear(tl->commit_completions);
+
+    /* anything logged from here on goes into the next flush */
+    tl->dirty = false;
     tl->flushing = true;
     merge m = allocate_merge(tl->h, closure(tl->h, log_flush_complete, tl));
     status_handler sh = apply_merge(m);
@@ -507,7 +641,9 @@ void log_flush(log tl, status_handler completion)
         return;
     }
     flush_log_extension(tl->current, false, sh);
-    if (!tl->compacting && (tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
+    /* a log being rebuilt is not yet in use and must not be compacted itself */
+    if (!tl->compacting && tl == tl->fs->tl &&
+            (tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
             (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries)) {
         tlog_debug("%ld obsolete entries out of %ld, starting log compaction\n",
             tl->obsolete_entries, tl->total_entries);
@@ -563,9 +699,9 @@ static void log_set_dirty(log tl)
     }
     tl->dirty = true;
     assert(!tl->flush_timer);
-    tl->flush_timer = register_timer(runloop_timers, CLOCK_ID_MONOTONIC_RAW,
-                                     seconds(TFS_LOG_FLUSH_DELAY_SECONDS), false, 0,
-                                     closure(tl->h, log_flush_timer_expired, tl));
+    tl->flush_timer = kern_register_timer(CLOCK_ID_MONOTONIC_RAW,
+                                          seconds(TFS_LOG_FLUSH_DELAY_SECONDS), false, 0,
+                                          closure(tl->h, log_flush_timer_expired, tl));
 }
 #else
 /* mkfs: flush on close */
@@ -579,17 +715,147 @@ static void log_set_dirty(log tl)
 }
 #endif
 
+static void log_write_complete(log tl, u64 len)
+{
+    vector_push(tl->encoding_lengths, (void *)len);
+    if (tl == tl->fs->tl)
+        tl->fs->log_stats.log_bytes += len;
+    else
+        tl->fs->log_stats.compact_bytes += len;
+    log_set_dirty(tl);
+}
+
+static inline u64 log_dict_index(log tl, void *x)
+{
+    return u64_from_pointer(table_find(tl->dictionary, x));
+}
+
+/* An extent can be written as a record if it is new to this log and has no other
+   attributes than those of the record. */
+static boolean log_extent_fields(log tl, symbol off, value v, u64 *file_offset, u64 *start,
+                                 u64 *length, u64 *allocated)
+{
+    if (!is_tuple(v) || log_dict_index(tl, v))
+        return false;
+    tuple e = v;
+    int n = tuple_count(e);
+    if (get(e, sym(uninited)))
+        n--;
+    return (n == 3) && parse_int(alloca_wrap(symbol_string(off)), 10, file_offset) &&
+        u64_from_value(get(e, sym(offset)), start) &&
+        u64_from_value(get(e, sym(length)), length) &&
+        u64_from_value(get(e, sym(allocated)), allocated);
+}
+
+/* Encode a new extent in the extents container c, if c has already been
+   written to this log. */
+static boolean log_encode_extent(log tl, tuple c, symbol off, tuple e)
+{
+    u64 d = log_dict_index(tl, c);
+    u64 file_offset, start, length, allocated;
+    if (!d || !log_extent_fields(tl, off, e, &file_offset, &start, &length, &allocated))
+        return false;
+    buffer b = tl->tuple_staging;
+    push_u8(b, TLOG_RECORD_EXTENT);
+    push_varint(b, d);
+    push_varint(b, file_offset);
+    push_varint(b, start);
+    push_varint(b, length);
+    push_varint(b, allocated);
+    push_u8(b, get(e, sym(uninited)) ? TLOG_EXTENT_FLAG_UNINITED : 0);
+    table_set(tl->dictionary, e, pointer_from_u64(log_dict_next(tl)));
+    if (get(c, off))
+        tl->obsolete_entries++;
+    return true;
+}
+
+/* Encode an attribute update of an extent already written to this log. */
+static boolean log_encode_extent_attr(log tl, tuple e, symbol a, value v)
+{
+    u64 d = log_dict_index(tl, e);
+    u64 x = 0;
+    u8 attr;
+    if (!d || !get(e, sym(allocated)))
+        return false;
+    if (a == sym(length) && v && u64_from_value(v, &x))
+        attr = TLOG_EXTENT_ATTR_LENGTH;
+    else if (a == sym(allocated) && v && u64_from_value(v, &x))
+        attr = TLOG_EXTENT_ATTR_ALLOCATED;
+    else if (a == sym(uninited) && !v)
+        attr = TLOG_EXTENT_ATTR_UNINITED;
+    else
+        return false;
+    buffer b = tl->tuple_staging;
+    push_u8(b, TLOG_RECORD_EXTENT_ATTR);
+    push_varint(b, d);
+    push_u8(b, attr);
+    if (v)
+        push_varint(b, x);
+    if (get(e, a)) {
+        tl->obsolete_entries++;
+        if (!v)
+            tl->obsolete_entries++;
+    }
+    return true;
+}
+
+static boolean log_encode_record(log tl, tuple e, symbol a, value v)
+{
+    if (tl->version < TFS_VERSION_RECORDS)
+        return false;
+    if (v && is_tuple(v) && get(v, sym(allocated)))
+        return log_encode_extent(tl, e, a, v);
+    return log_encode_extent_attr(tl, e, a, v);
+}
+
+closure_function(2, 2, boolean, log_encode_extents_each,
+                 log, tl, boolean *, compact,
+                 value, s, value, v)
+{
+    u64 file_offset, start, length, allocated;
+    if (!log_extent_fields(bound(tl), s, v, &file_offset, &start, &length, &allocated)) {
+        *bound(compact) = false;
+        return false;
+    }
+    return true;
+}
+
+closure_function(2, 2, boolean, log_write_extents_each,
+                 log, tl, tuple, c,
+                 value, s, value, v)
+{
+    log tl = bound(tl);
+    u64 len = buffer_length(tl->tuple_staging);
+    if (!log_encode_extent(tl, bound(c), s, v))
+        return false;
+    tl->total_entries++;
+    log_write_complete(tl, buffer_length(tl->tuple_staging) - len);
+    return true;
+}
+
+/* An extents container that has already been written is rewritten as one
+   record per extent. */
+static boolean log_write_extents(log tl, tuple t)
+{
+    if (tl->version < TFS_VERSION_RECORDS || !log_dict_index(tl, t) || tuple_count(t) == 0)
+        return false;
+    boolean compact = true;
+    iterate(t, stack_closure(log_encode_extents_each, tl, &compact));
+    if (!compact)
+        return false;
+    return iterate(t, stack_closure(log_write_extents_each, tl, t));
+}
+
 boolean log_write_eav(log tl, tuple e, symbol a, value v)
 {
     tlog_debug("log_write_eav: tl %p, e %p, a %b, v %p\n", tl, e, symbol_string(a), v);
     u64 len = buffer_length(tl->tuple_staging);
     if (len >= bytes_from_sectors(tl->fs, range_span(tl->current->sectors)))
         return false;
-    encode_eav(tl->tuple_staging, tl->dictionary, e, a, v, &tl->obsolete_entries);
+    if (!log_encode_record(tl, e, a, v))
+        encode_eav(tl->tuple_staging, tl->dictionary, e, a, v, &tl->obsolete_entries);
     tl->total_entries++;
-    len = buffer_length(tl->tuple_staging) - len;
-    vector_push(tl->encoding_lengths, (void *)len);
-    log_set_dirty(tl);
+    log_write_complete(tl, buffer_length(tl->tuple_staging) - len);
     return true;
 }
 
@@ -600,12 +866,95 @@ boolean log_write(log tl, tuple t)
     if (len >= bytes_from_sectors(tl->fs, range_span(tl->current->sectors)))
         return false;
     encode_tuple(tl->tuple_staging, tl->dictionary, t, &tl->total_entries);
-    len = buffer_length(tl->tuple_staging) - len;
-    vector_push(tl->encoding_lengths, (void *)len);
-    log_set_dirty(tl);
+    log_write_complete(tl, buffer_length(tl->tuple_staging) - len);
+    return true;
+}
+
+/* Write t without the contents of its tuple values, which are pushed to
+   children to be written with later calls. */
+boolean log_write_shallow(log tl, tuple t, vector children)
+{
+    tlog_debug("log_write_shallow: tl %p, t %p\n", tl, t);
+    u64 len = buffer_length(tl->tuple_staging);
+    if (len >= bytes_from_sectors(tl->fs, range_span(tl->current->sectors)))
+        return false;
+    if (log_write_extents(tl, t))
+        return true;
+    encode_tuple_shallow(tl->tuple_staging, tl->dictionary, t, children, &tl->total_entries);
+    log_write_complete(tl, buffer_length(tl->tuple_staging) - len);
     return true;
 }
 
+closure_function(3, 1, void, log_seal_link,
+                 log, tl, range, sectors, status_handler, sh,
+                 status, s)
+{
+    log tl = bound(tl);
+    status_handler sh = bound(sh);
+    if (!is_ok(s)) {
+        apply(sh, s);
+        goto out;
+    }
+    log_ext init_ext = open_log_extension(tl, irange(0, TFS_LOG_INITIAL_SIZE >>
+                                                     tl->fs->blocksize_order));
+    if (init_ext == INVALID_ADDRESS) {
+        apply(sh, timm("result", "unable to open initial log extension"));
+        goto out;
+    }
+    log_extension_init(init_ext);
+    push_u8(init_ext->staging, LOG_SEALED_LINK);
+    push_varint(init_ext->staging, bound(sectors).start);
+    push_varint(init_ext->staging, range_span(bound(sectors)));
+    tl->fs->sealed = true;
+    flush_log_extension(init_ext, true, sh);
+  out:
+    closure_finish();
+}
+
+/* Write the whole tree under root as a single tuple in one extension, in the
+   first free storage that fits it, and point the initial extension to it.
+   The extensions of the log are left behind; nothing can be logged anymore. */
+void log_seal(log tl, tuple root, status_handler sh)
+{
+    filesystem fs = tl->fs;
+    buffer md = allocate_buffer(tl->h, PAGESIZE);
+    if (md == INVALID_ADDRESS) {
+        apply(sh, timm("result", "failed to allocate metadata buffer"));
+        return;
+    }
+    table dictionary = allocate_table(tl->h, identity_key, pointer_equal);
+    if (dictionary == INVALID_ADDRESS) {
+        apply(sh, timm("result", "failed to allocate dictionary"));
+        goto out;
+    }
+    encode_tuple(md, dictionary, root, 0);
+    deallocate_table(dictionary);
+
+    u64 length = buffer_length(md);
+    u64 nblocks = pad(TFS_EXTENSION_HEADER_BYTES + TUPLE_AVAILABLE_HEADER_SIZE + length + 1,
+                      fs_blocksize(fs)) >> fs->blocksize_order;
+    u64 start = filesystem_allocate_storage(fs, nblocks);
+    if (start == INVALID_PHYSICAL) {
+        apply(sh, timm("result", "no space for sealed metadata (%ld bytes)", length));
+        goto out;
+    }
+    range r = irangel(start, nblocks);
+    tlog_debug("%s: %ld bytes of metadata at %R\n", __func__, length, r);
+    log_ext ext = open_log_extension(tl, r);
+    if (ext == INVALID_ADDRESS) {
+        apply(sh, timm("result", "unable to open sealed log extension"));
+        goto out;
+    }
+    log_extension_init(ext);
+    push_u8(ext->staging, TUPLE_AVAILABLE);
+    push_varint(ext->staging, length);
+    push_varint(ext->staging, length);
+    assert(push_buffer(ext->staging, md));
+    flush_log_extension(ext, true, closure(tl->h, log_seal_link, tl, r, sh));
+  out:
+    deallocate_buffer(md);
+}
+
 #endif /* !TLOG_READ_ONLY */
 
 static void log_process_tuple(log tl, tuple t);
@@ -649,8 +998,81 @@ static void log_process_tuple(log tl, tuple t)
     }
 }
 
+static boolean log_parse_record(log tl, buffer b)
+{
+    u8 type = pop_u8(b);
+    tuple t = table_find(tl->dictionary, pointer_from_u64(pop_varint(b)));
+    switch (type) {
+    case TLOG_RECORD_EXTENT: {
+        u64 file_offset = pop_varint(b);
+        u64 start = pop_varint(b);
+        u64 length = pop_varint(b);
+        u64 allocated = pop_varint(b);
+        u8 flags = pop_u8(b);
+        if (!t || !is_tuple(t)) {
+            msg_err("extents container not found\n");
+            return false;
+        }
+        tuple e = allocate_tuple();
+        set(e, sym(offset), value_from_u64(tl->h, start));
+        set(e, sym(length), value_from_u64(tl->h, length));
+        set(e, sym(allocated), value_from_u64(tl->h, allocated));
+        if (flags & TLOG_EXTENT_FLAG_UNINITED)
+            set(e, sym(uninited), null_value);
+        table_set(tl->dictionary, pointer_from_u64(log_dict_next(tl)), e);
+        symbol off = intern_u64(file_offset);
+        if (get(t, off))
+            tl->obsolete_entries++;
+        set(t, off, e);
+        tlog_debug("   extent record: offset %ld, start %ld, length %ld\n",
+                   file_offset, start, length);
+        break;
+    }
+    case TLOG_RECORD_EXTENT_ATTR: {
+        u8 attr = pop_u8(b);
+        symbol a;
+        value v = 0;
+        switch (attr) {
+        case TLOG_EXTENT_ATTR_LENGTH:
+            a = sym(length);
+            v = value_from_u64(tl->h, pop_varint(b));
+            break;
+        case TLOG_EXTENT_ATTR_ALLOCATED:
+            a = sym(allocated);
+            v = value_from_u64(tl->h, pop_varint(b));
+            break;
+        case TLOG_EXTENT_ATTR_UNINITED:
+            a = sym(uninited);
+            break;
+        default:
+            msg_err("unknown extent attribute %d\n", attr);
+            return false;
+        }
+        if (!t || !is_tuple(t)) {
+            msg_err("extent not found\n");
+            return false;
+        }
+        if (get(t, a)) {
+            tl->obsolete_entries++;
+            if (!v)
+                tl->obsolete_entries++;
+        }
+        set(t, a, v);
+        break;
+    }
+    default:
+        msg_err("unknown record type 0x%x\n", type);
+        return false;
+    }
+    tl->total_entries++;
+    return true;
+}
+
 static boolean log_parse_tuple(log tl, buffer b)
 {
+    if (tl->version >= TFS_VERSION_RECORDS &&
+        !(*(u8 *)buffer_ref(b, 0) & TLOG_TUPLE_TYPE_BIT))
+        return log_parse_record(tl, b);
     tuple dv = decode_value(tl->h, tl->dictionary, b, &tl->total_entries,
         &tl->obsolete_entries);
     tlog_debug("   decoded %v\n", dv);
@@ -668,16 +1090,16 @@ static inline void log_tuple_produce(log tl, buffer b, u64 length)
     tl->tuple_bytes_remain -= length;
 }
 
-static status log_hdr_parse(buffer b, boolean first_ext, u64 *length, u8 *uuid,
-                            char *label)
+static status log_hdr_parse(buffer b, boolean first_ext, u64 *version, u64 *length,
+                            u8 *uuid, char *label)
 {
     if (runtime_memcmp(buffer_ref(b, 0), tfs_magic, TFS_MAGIC_BYTES))
         return timm("result", "tfs magic mismatch");
     buffer_consume(b, TFS_MAGIC_BYTES);
-    u64 version = pop_varint(b);
-    if (version != TFS_VERSION)
+    *version = pop_varint(b);
+    if (*version < TFS_VERSION_MIN || *version > TFS_VERSION)
         return timm("result", "tfs version mismatch (read %ld, build %ld)",
-            version, TFS_VERSION);
+            *version, TFS_VERSION);
     *length = pop_varint(b);
     if (first_ext) {
         buffer_read(b, uuid, UUID_LEN);
@@ -699,9 +1121,140 @@ closure_function(1, 2, boolean, log_read_ingest_extent,
 
 static void log_read(log tl, status_handler sh);
 
-closure_function(4, 1, void, log_read_complete,
-                 log_ext, ext, sg_list, sg, u64, length, status_handler, sh,
-                 status, read_status)
+declare_closure_function(4, 1, void, log_read_complete,
+                         log_ext, ext, sg_list, sg, u64, length, status_handler, sh,
+                         status, read_status);
+
+/* The link to the next log extension follows the tuples of the current one,
+   so it can be found by skipping over frames without decoding them. Its
+   read is then issued right away and proceeds while the current extension
+   is parsed. */
+static boolean scan_varint(buffer b, u64 *v)
+{
+    u64 out = 0;
+    u8 m;
+    do {
+        if (buffer_length(b) == 0)
+            return false;
+        m = pop_u8(b);
+        out = (out << 7) | (m & MASK(7));
+    } while (m & 0x80);
+    *v = out;
+    return true;
+}
+
+static boolean log_find_link(buffer b, range *r)
+{
+    struct buffer scan = *b;
+    u64 sector, length;
+    while (buffer_length(&scan) > 0) {
+        switch (pop_u8(&scan)) {
+        case END_OF_SEGMENT:
+            continue;
+        case LOG_EXTENSION_LINK:
+        case LOG_SEALED_LINK:
+            if (!scan_varint(&scan, &sector) || !scan_varint(&scan, &length) || length == 0)
+                return false;
+            *r = irangel(sector, length);
+            return true;
+        case TUPLE_AVAILABLE:
+            if (!scan_varint(&scan, &length))  /* total length */
+                return false;
+            /* fall through */
+        case TUPLE_EXTENDED:
+            if (!scan_varint(&scan, &length) || length > buffer_length(&scan))
+                return false;
+            buffer_consume(&scan, length);
+            continue;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+static void log_read_ahead_finish(log tl)
+{
+    log_ext ext = tl->read_ahead;
+    sg_list sg = tl->read_ahead_sg;
+    status s = tl->read_ahead_status;
+    tl->read_ahead = 0;
+    if (tl->read_ahead_abort) {
+        /* the parse failed before reaching the link */
+        timm_dealloc(s);
+        sg_list_release(sg);
+        deallocate_sg_list(sg);
+        close_log_extension(ext);
+        apply(tl->read_ahead_sh, tl->read_ahead_abort);
+        return;
+    }
+    status_handler c = closure(tl->h, log_read_complete, ext, sg,
+                               bytes_from_sectors(tl->fs, range_span(ext->sectors)),
+                               tl->read_ahead_sh);
+    if (c == INVALID_ADDRESS) {
+        timm_dealloc(s);
+        sg_list_release(sg);
+        deallocate_sg_list(sg);
+        apply(tl->read_ahead_sh, timm("result", "failed to allocate closure"));
+        return;
+    }
+    apply(c, s);
+}
+
+closure_function(1, 1, void, log_read_ahead_complete,
+                 log, tl,
+                 status, s)
+{
+    log tl = bound(tl);
+    tlog_debug("%s: status %v\n", __func__, s);
+    tl->read_ahead_status = s;
+    tl->read_ahead_done = true;
+    if (tl->read_ahead_sh)
+        log_read_ahead_finish(tl);
+    closure_finish();
+}
+
+static void log_read_ahead(log tl, buffer b)
+{
+    range r;
+    if (tl->read_ahead || !log_find_link(b, &r))
+        return;
+    tlog_debug("%s: reading ahead extension at %R\n", __func__, r);
+    log_ext ext = open_log_extension(tl, r);
+    if (ext == INVALID_ADDRESS)
+        return;
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        goto fail_close;
+    status_handler c = closure(tl->h, log_read_ahead_complete, tl);
+    if (c == INVALID_ADDRESS)
+        goto fail_dealloc_sg;
+    tl->read_ahead = ext;
+    tl->read_ahead_sg = sg;
+    tl->read_ahead_status = STATUS_OK;
+    tl->read_ahead_done = false;
+    tl->read_ahead_sh = 0;
+    tl->read_ahead_abort = 0;
+    apply(ext->read, sg, irangel(0, bytes_from_sectors(tl->fs, range_span(r))), c);
+    return;
+  fail_dealloc_sg:
+    deallocate_sg_list(sg);
+  fail_close:
+    close_log_extension(ext);
+}
+
+/* Continue with the extension read ahead once the parse reaches its link. */
+static void log_read_ahead_join(log tl, status_handler sh, status abort)
+{
+    tl->read_ahead_sh = sh;
+    tl->read_ahead_abort = abort;
+    if (tl->read_ahead_done)
+        log_read_ahead_finish(tl);
+}
+
+define_closure_function(4, 1, void, log_read_complete,
+                        log_ext, ext, sg_list, sg, u64, length, status_handler, sh,
+                        status, read_status)
 {
     log_ext ext = bound(ext);
     log tl = ext->tl;
@@ -725,15 +1278,20 @@ closure_function(4, 1, void, log_read_complete,
     tlog_debug("log_read_complete: buffer len %d, status %v\n", buffer_length(b), read_status);
     tlog_debug("-> new log extension, checking magic and version\n");
     if (!ext->open) {
+        u64 version;
         length = 0;
-        s = log_hdr_parse(b, ext->sectors.start == 0, &length, tl->fs->uuid,
+        s = log_hdr_parse(b, ext->sectors.start == 0, &version, &length, tl->fs->uuid,
             tl->fs->label);
         if (!is_ok(s))
             goto out_apply_status;
+        /* a log keeps the version it was created with until it is compacted */
+        if (ext->sectors.start == 0)
+            tl->version = version;
         /* XXX the length is really for validation...so hook it up */
         tlog_debug("%ld sectors\n", length);
         ext->open = true;
     }
+    log_read_ahead(tl, b);
 
     /* need to check bounds */
     while ((frame = pop_u8(b)) != END_OF_LOG) {
@@ -741,6 +1299,10 @@ closure_function(4, 1, void, log_read_complete,
         case END_OF_SEGMENT:
             tlog_debug("-> segment boundary\n");
             continue;
+        case LOG_SEALED_LINK:
+            tlog_debug("-> sealed filesystem\n");
+            tl->fs->sealed = true;
+            /* fall through */
         case LOG_EXTENSION_LINK:
             tlog_debug("-> extend link\n");
             sector = pop_varint(b); /* XXX need to complete the error handling here */
@@ -751,6 +1313,17 @@ closure_function(4, 1, void, log_read_complete,
             }
             range r = irangel(sector, length);
             close_log_extension(ext);
+            if (tl->read_ahead && range_equal(tl->read_ahead->sectors, r)) {
+#ifndef TLOG_READ_ONLY
+                if (!filesystem_reserve_storage(tl->fs, r)) {
+                    s = timm("result", "failed to reserve sectors %R in log extension", r);
+                    goto out_apply_status;
+                }
+#endif
+                tl->current = tl->read_ahead;
+                log_read_ahead_join(tl, sh, 0);
+                goto out;
+            }
             ext = open_log_extension(tl, r);
             if (ext == INVALID_ADDRESS) {
                 s = timm("result", "unable to open log extension");
@@ -817,6 +1390,10 @@ closure_function(4, 1, void, log_read_complete,
     assert(frame == END_OF_LOG);
     tlog_debug("-> end of log, %ld total entries (%ld obsolete)\n",
                tl->total_entries, tl->obsolete_entries);
+#ifdef KERNEL
+    tl->fs->log_stats.replay_time_us =
+        usec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - tl->replay_start);
+#endif
 
     /* the log must go on */
     *(u8*)(b->contents + b->start - 1) = END_OF_SEGMENT;
@@ -835,7 +1412,7 @@ closure_function(4, 1, void, log_read_complete,
 
     tl->fs->root = (tuple)table_find(tl->dictionary, pointer_from_u64(1));
 
-    if (tl->fs->w) {
+    if (tl->fs->w && !tl->fs->sealed) {
         /* Reverse pairs in dictionary so that we can use it for writing
            the next log segment. */
         table newdict = allocate_table(tl->h, identity_key, pointer_equal);
@@ -851,6 +1428,11 @@ closure_function(4, 1, void, log_read_complete,
   out_apply_status:
     tlog_debug("log_read_complete exit with status %v\n", s);
     buffer_clear(tl->tuple_staging);
+    if (tl->read_ahead) {
+        /* complete once the read ahead is done with */
+        log_read_ahead_join(tl, sh, is_ok(s) ? timm("result", "log link not found") : s);
+        goto out;
+    }
     apply(sh, s);
   out:
     closure_finish();
@@ -882,9 +1464,9 @@ static void log_read(log tl, status_handler sh)
 
 boolean filesystem_probe(u8 *first_sector, u8 *uuid, char *label)
 {
-    u64 len;
+    u64 version, len;
     status s = log_hdr_parse(alloca_wrap_buffer(first_sector, SECTOR_SIZE),
-        true, &len, uuid, label);
+        true, &version, &len, uuid, label);
     boolean success = is_ok(s);
     timm_dealloc(s);
     return success;
@@ -921,6 +1503,9 @@ log log_create(heap h, filesystem fs, boolean initialize, status_handler sh)
               STATUS_OK);
 #endif
     } else {
+#ifdef KERNEL
+        tl->replay_start = now(CLOCK_ID_MONOTONIC_RAW);
+#endif
         log_read(tl, sh);
     }
     return tl;
@@ -932,7 +1517,12 @@ void log_destroy(log tl)
         remove_timer(tl->flush_timer, 0);
     if (tl->extents)
         deallocate_table(tl->extents);
+#ifdef KERNEL
+    if (tl->commit_timer)
+        remove_timer(tl->commit_timer, 0);
+#endif
     deallocate_vector(tl->flush_completions);
+    deallocate_vector(tl->commit_completions);
 #ifndef TLOG_READ_ONLY
     deallocate_rangemap(tl->extensions, stack_closure(log_dealloc_ext_node,
         tl));
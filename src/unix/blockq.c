@@ -51,15 +51,18 @@
    BLOCKQ_BLOCK_REQUIRED indicates blocking required, and < 0 an error
    condition (and return).
 
-   Note also that this presently serializes requests and handles them
+   Note also that by default this serializes requests and handles them
    in that order alone. The action at the head of the queue must
    eventually return a non-zero value before any further actions in
    the queue can be handled (except for blockq_flush, used for
-   exceptions on the resource - e.g. a closed connection). Should it
-   ever become necessary to allow another waiter in the queue to
-   handle the request, we can consider making that an option and
-   moving from the queue to a CAS list for fast removal (similar to
-   the poll notify list). TBD
+   exceptions on the resource - e.g. a closed connection).
+
+   A blockq made exclusive with blockq_set_exclusive() is for waiters
+   competing for the same resource, any one of which may take it (e.g.
+   accept or pipe reads). There, blockq_wake_one() offers the wakeup to
+   the waiters in turn until one of them completes, so that a waiter
+   which cannot make progress does not hold off the others, while still
+   only one waiter is woken per event.
  */
 
 //#define BLOCKQ_DEBUG
@@ -79,6 +82,7 @@ struct blockq {
     io_completion completion;
     thread completion_thread;
     sysreturn completion_rv;
+    boolean exclusive;
 };
 
 declare_closure_struct(2, 1, void, blockq_item_timeout,
@@ -121,16 +125,20 @@ static void blockq_item_finish(blockq bq, blockq_item bi)
 
 /*
  * Apply blockq_item action with lock held
+ *
+ * Returns true if the item completed and was removed from the queue
  */
-static void blockq_apply_bi_locked(blockq bq, blockq_item bi, u64 flags)
+static boolean blockq_apply_bi_locked(blockq bq, blockq_item bi, u64 flags)
 {
     sysreturn rv;
+    boolean finished = false;
 
     blockq_debug("bq %p (\"%s\") bi %p (tid:%ld) %s %s %s\n",
                  bq, blockq_name(bq), bi, bi->t->tid,
                  (flags & BLOCKQ_ACTION_BLOCKED) ? "blocked " : "",
                  (flags & BLOCKQ_ACTION_NULLIFY) ? "nullify " : "",
                  (flags & BLOCKQ_ACTION_TIMEDOUT) ? "timedout" : "");
+    tracepoint(blockq_wake, bq, bi->t->tid, flags);
 
     thread ot = current;
     thread_resume(bi->t);
@@ -140,10 +148,13 @@ static void blockq_apply_bi_locked(blockq bq, blockq_item bi, u64 flags)
     /* If the blockq_action returns BLOCKQ_BLOCK_REQUIRED and neither
        nullify or timeout are set in flags, continue blocking. */
     if ((flags & (BLOCKQ_ACTION_NULLIFY | BLOCKQ_ACTION_TIMEDOUT)) ||
-        (rv != BLOCKQ_BLOCK_REQUIRED))
+        (rv != BLOCKQ_BLOCK_REQUIRED)) {
         blockq_item_finish(bq, bi);
+        finished = true;
+    }
     if (ot)
         thread_resume(ot);
+    return finished;
 }
 
 /*
@@ -175,6 +186,9 @@ define_closure_function(2, 1, void, blockq_item_timeout,
  * Returns thread whose bi action was applied
  * Note that there is no guarantee that the thread is actually awake
  * or the bi completed -- this just means its action was applied
+ *
+ * On an exclusive blockq, the returned thread is that of the one waiter
+ * which completed, or INVALID_ADDRESS if none could.
  */
 thread blockq_wake_one(blockq bq)
 {
@@ -186,6 +200,16 @@ thread blockq_wake_one(blockq bq)
 
     /* XXX take irqsafe spinlock */
 
+    if (bq->exclusive) {
+        list_foreach(&bq->waiters_head, l) {
+            bi = struct_from_list(l, blockq_item, l);
+            t = bi->t;
+            if (blockq_apply_bi_locked(bq, bi, BLOCKQ_ACTION_BLOCKED))
+                return t;
+        }
+        return INVALID_ADDRESS;
+    }
+
     l = list_get_next(&bq->waiters_head);
     if (!l)
         return INVALID_ADDRESS;
@@ -215,6 +239,13 @@ boolean blockq_wake_one_for_thread(blockq bq, thread t)
     return false;
 }
 
+/* a timeout may expire late by the thread's timer slack, or by the share
+   of its length that poll and select allow on Linux, whichever is more */
+static timestamp blockq_timeout_slack(thread t, timestamp remain)
+{
+    return MAX(timeout_slack(remain), nanoseconds(t->timer_slack_ns));
+}
+
 sysreturn blockq_check_timeout(blockq bq, thread t, blockq_action a, boolean in_bh,
                                clock_id clkid, timestamp timeout, boolean absolute)
 {
@@ -252,7 +283,12 @@ sysreturn blockq_check_timeout(blockq bq, thread t, blockq_action a, boolean in_
     thread_reserve(t);
 
     if (timeout > 0) {
-        bi->timeout = register_timer(runloop_timers, clkid, timeout, absolute, 0,
+        timestamp remain = timeout;
+        if (absolute) {
+            timestamp n = now(clkid);
+            remain = timeout > n ? timeout - n : 0;
+        }
+        bi->timeout = kern_register_timer_slack(clkid, timeout, absolute, 0, blockq_timeout_slack(t, remain),
             init_closure(&bi->timeout_func, blockq_item_timeout, bq, bi));
         if (bi->timeout == INVALID_ADDRESS) {
             msg_err("failed to allocate blockq timer\n");
@@ -264,6 +300,7 @@ sysreturn blockq_check_timeout(blockq bq, thread t, blockq_action a, boolean in_
     }
 
     blockq_debug("queuing bi %p, a %p, tid %d\n", bi, bi->a, bi->t->tid);
+    tracepoint(blockq_block, bq, t->tid, timeout);
     list_insert_before(&bq->waiters_head, &bi->l);
     if (!in_bh)
         t->blocked_on = bq;
@@ -334,7 +371,7 @@ int blockq_transfer_waiters(blockq dest, blockq src, int n)
             clock_id id = bi->timeout->id;
             remove_timer(bi->timeout, &remain);
             bi->timeout = remain == 0 ? 0 :
-                register_timer(runloop_timers, id, remain, false, 0,
+                kern_register_timer_slack(id, remain, false, 0, blockq_timeout_slack(bi->t, remain),
                     init_closure(&bi->timeout_func, blockq_item_timeout, dest,
                         bi));
             assert(t);
@@ -349,6 +386,11 @@ int blockq_transfer_waiters(blockq dest, blockq src, int n)
     return transferred;
 }
 
+void blockq_set_exclusive(blockq bq, boolean exclusive)
+{
+    bq->exclusive = exclusive;
+}
+
 void blockq_set_completion(blockq bq, io_completion completion, thread t, sysreturn rv)
 {
     bq->completion = completion;
@@ -372,6 +414,7 @@ blockq allocate_blockq(heap h, char * name)
     bq->completion = 0;
     bq->completion_thread = 0;
     bq->completion_rv = 0;
+    bq->exclusive = false;
     list_init(&bq->waiters_head);
 
     return bq;
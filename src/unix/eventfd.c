@@ -181,6 +181,7 @@ int do_eventfd2(unsigned int count, int flags)
         msg_err("failed to allocated blockq\n");
         goto err_read_bq;
     }
+    blockq_set_exclusive(efd->read_bq, true);
 
     efd->write_bq = allocate_blockq(h, "eventfd write");
     if (efd->write_bq == INVALID_ADDRESS) {
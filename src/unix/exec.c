@@ -35,21 +35,28 @@ static void build_exec_stack(process p, thread t, Elf64_Ehdr * e, void *start,
 {
     exec_debug("build_exec_stack start %p, tid %d, va 0x%lx\n", start, t->tid, va);
 
-    /* allocate process stack at top of first 2gb of address space */
+    /* allocate process stack at top of first 2gb of address space; keeping
+       it 2M-aligned lets it be mapped with a single large page */
     u64 stack_start = 0x80000000 - PROCESS_STACK_SIZE;
     if (aslr)
         stack_start = (stack_start - PROCESS_STACK_ASLR_RANGE) +
-            get_aslr_offset(PROCESS_STACK_ASLR_RANGE);
+            (get_aslr_offset(PROCESS_STACK_ASLR_RANGE) & ~PAGEMASK_2M);
 
+    /* an inaccessible guard page below the stack turns an overflow into a
+       fault instead of a write into whatever is mapped beneath */
+    u64 guard_start = stack_start - PAGESIZE;
 #ifdef __x86_64__
-    assert(id_heap_set_area(p->virtual32, stack_start, PROCESS_STACK_SIZE, true, true));
+    assert(id_heap_set_area(p->virtual32, guard_start, PROCESS_STACK_SIZE + PAGESIZE,
+                            true, true));
 #endif
+    assert(allocate_vmap(p->vmaps, irangel(guard_start, PAGESIZE),
+                         ivmap(0, 0, 0, 0)) != INVALID_ADDRESS);
     p->stack_map = allocate_vmap(p->vmaps, irangel(stack_start, PROCESS_STACK_SIZE),
                                  ivmap(VMAP_FLAG_WRITABLE, 0, 0, 0));
     assert(p->stack_map != INVALID_ADDRESS);
 
     u64 * s = pointer_from_u64(stack_start);
-    u64 sphys = allocate_u64((heap)heap_physical(get_kernel_heaps()), PROCESS_STACK_SIZE);
+    u64 sphys = allocate_u64(heap_physical_local(), PROCESS_STACK_SIZE);
     assert(sphys != INVALID_PHYSICAL);
 
     exec_debug("stack allocated at %p, size 0x%lx, phys 0x%lx\n", s, PROCESS_STACK_SIZE, sphys);
@@ -140,6 +147,9 @@ static void build_exec_stack(process p, thread t, Elf64_Ehdr * e, void *start,
 void start_process(thread t, void *start)
 {
     t->default_frame[SYSCALL_FRAME_PC] = u64_from_pointer(start);
+    boot_milestone("process start");
+    if (get(t->p->process_root, sym(boot_timing)) || get(t->p->process_root, sym(trace)))
+        boot_timing_report();
     if (get(t->p->process_root, sym(gdb))) {
         rputs("TODO: in-kernel gdb needs revisiting\n");
 //        init_tcp_gdb(heap_general(get_kernel_heaps()), t->p, 9090);
@@ -184,6 +194,115 @@ closure_function(3, 4, u64, exec_elf_map,
     return vaddr;
 }
 
+/* Unless the whole image is needed (for symbol ingestion), programs and
+   interpreters are mapped from the pagecache rather than read whole: only
+   the headers are read up front, the file contents of each PT_LOAD segment
+   become a private file-backed mapping that is faulted in on demand, and
+   bss is anonymous memory. The file bytes sharing a page with the start of
+   bss are read into that page before the process starts. */
+#define ELF_HEADER_READ_SIZE    (4 * PAGESIZE)
+
+/* The headers read must hold the program headers and the interpreter path,
+   and segments must be congruent with their file offsets modulo the page
+   size; anything else falls back to reading the whole file. */
+static boolean elf_headers_mappable(buffer b)
+{
+    u64 len = buffer_length(b);
+    if (len < sizeof(Elf64_Ehdr))
+        return false;
+    Elf64_Ehdr *e = buffer_ref(b, 0);
+    if (e->e_phoff + (u64)e->e_phnum * e->e_phentsize > len)
+        return false;
+    foreach_phdr(e, p) {
+        if (p->p_type == PT_INTERP && p->p_offset + p->p_filesz > len)
+            return false;
+        if (p->p_type == PT_LOAD && ((p->p_offset ^ p->p_vaddr) & PAGEMASK))
+            return false;
+    }
+    return true;
+}
+
+closure_function(3, 2, void, elf_headers_read,
+                 buffer, b, buffer_handler, bh, status_handler, sh,
+                 status, s, bytes, count)
+{
+    buffer b = bound(b);
+    if (is_ok(s)) {
+        buffer_produce(b, count);
+        apply(bound(bh), b);
+    } else {
+        deallocate_buffer(b);
+        apply(bound(sh), s);
+    }
+    closure_finish();
+}
+
+static void read_elf_headers(fsfile f, heap h, buffer_handler bh, status_handler sh)
+{
+    u64 len = MIN(fsfile_get_length(f), ELF_HEADER_READ_SIZE);
+    buffer b = allocate_buffer(h, len);
+    assert(b != INVALID_ADDRESS);
+    exec_debug("%s: reading 0x%lx bytes\n", __func__, len);
+    filesystem_read_linear(f, buffer_ref(b, 0), irange(0, len),
+                           closure(h, elf_headers_read, b, bh, sh));
+}
+
+closure_function(3, 2, void, elf_tail_read_complete,
+                 u64, vaddr, pageflags, flags, status_handler, sh,
+                 status, s, bytes, count)
+{
+    /* the page was left writable for the read */
+    if (is_ok(s))
+        update_map_flags(bound(vaddr), PAGESIZE, bound(flags));
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+static void exec_map_elf_file(process p, kernel_heaps kh, Elf64_Ehdr *e, fsfile f,
+                              u64 load_offset, u32 allowed_flags, merge m)
+{
+    pagecache_node pn = fsfile_get_cachenode(f);
+    foreach_phdr(e, ph) {
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+            continue;
+        u64 vmflags = VMAP_FLAG_MMAP;
+        if (ph->p_flags & PF_X)
+            vmflags |= VMAP_FLAG_EXEC;
+        if (ph->p_flags & PF_W)
+            vmflags |= VMAP_FLAG_WRITABLE;
+        u64 vaddr = ph->p_vaddr + load_offset;
+        u64 start = vaddr & ~PAGEMASK;
+        u64 file_end = vaddr + ph->p_filesz;
+        u64 end = pad(vaddr + ph->p_memsz, PAGESIZE);
+
+        /* a partial last page of file data is part of bss if bss follows */
+        u64 bss = ph->p_memsz > ph->p_filesz ? file_end & ~PAGEMASK : pad(file_end, PAGESIZE);
+        if (bss > start) {
+            exec_debug("%s: file map %R, offset 0x%lx, vmflags 0x%lx\n", __func__,
+                       irange(start, bss), ph->p_offset & ~PAGEMASK, vmflags);
+            assert(allocate_vmap(p->vmaps, irange(start, bss),
+                                 ivmap(vmflags | VMAP_MMAP_TYPE_FILEBACKED, allowed_flags,
+                                       ph->p_offset & ~PAGEMASK, pn)) != INVALID_ADDRESS);
+        }
+        if (end <= bss)
+            continue;
+        exec_debug("%s: bss %R, vmflags 0x%lx\n", __func__, irange(bss, end), vmflags);
+        assert(allocate_vmap(p->vmaps, irange(bss, end),
+                             ivmap(vmflags | VMAP_MMAP_TYPE_ANONYMOUS, allowed_flags,
+                                   0, 0)) != INVALID_ADDRESS);
+        if (file_end == bss)
+            continue;
+        u64 paddr = allocate_u64((heap)heap_physical(kh), PAGESIZE);
+        assert(paddr != INVALID_PHYSICAL);
+        map(bss, paddr, PAGESIZE, pageflags_writable(pageflags_memory()));
+        zero(pointer_from_u64(bss), PAGESIZE);
+        u64 offset = ph->p_offset + (bss - vaddr);
+        filesystem_read_linear(f, pointer_from_u64(bss), irange(offset, offset + (file_end - bss)),
+                               closure(heap_general(kh), elf_tail_read_complete, bss,
+                                       pageflags_from_vmflags(vmflags), apply_merge(m)));
+    }
+}
+
 closure_function(2, 1, status, load_interp_complete,
                  thread, t, kernel_heaps, kh,
                  buffer, b)
@@ -201,6 +320,78 @@ closure_function(2, 1, status, load_interp_complete,
     return STATUS_OK;
 }
 
+closure_function(2, 1, void, interp_segments_mapped,
+                 thread, t, void *, start,
+                 status, s)
+{
+    if (!is_ok(s))
+        halt("failed to read interpreter segments: %v\n", s);
+    exec_debug("starting process tid %d, start %p\n", bound(t)->tid, bound(start));
+    start_process(bound(t), bound(start));
+    closure_finish();
+}
+
+closure_function(4, 1, status, interp_headers_complete,
+                 thread, t, kernel_heaps, kh, tuple, interp, fsfile, f,
+                 buffer, b)
+{
+    thread t = bound(t);
+    kernel_heaps kh = bound(kh);
+    tuple interp = bound(interp);
+    fsfile f = bound(f);
+    heap h = heap_general(kh);
+    closure_finish();
+    if (!elf_headers_mappable(b)) {
+        exec_debug("interpreter headers not mappable, reading elf\n");
+        deallocate_buffer(b);
+        filesystem_read_entire(t->p->root_fs, interp, heap_backed(kh),
+                               closure(h, load_interp_complete, t, kh),
+                               closure(h, load_interp_fail));
+        return STATUS_OK;
+    }
+
+    u64 where = process_get_virt_range(t->p, HUGE_PAGESIZE);
+    assert(where != INVALID_PHYSICAL);
+    Elf64_Ehdr *e = buffer_ref(b, 0);
+    void *start = pointer_from_u64(e->e_entry + where);
+    merge m = allocate_merge(h, closure(h, interp_segments_mapped, t, start));
+    status_handler sh = apply_merge(m);
+    exec_map_elf_file(t->p, kh, e, f, where, 0, m);
+    deallocate_buffer(b);
+    apply(sh, STATUS_OK);
+    return STATUS_OK;
+}
+
+static void exec_load_interp(thread t, kernel_heaps kh, tuple interp, boolean map_file)
+{
+    heap h = heap_general(kh);
+    filesystem fs = t->p->root_fs;
+    fsfile f = map_file ? fsfile_from_node(fs, interp) : 0;
+    exec_debug("reading interp...\n");
+    if (f)
+        read_elf_headers(f, h, closure(h, interp_headers_complete, t, kh, interp, f),
+                         closure(h, load_interp_fail));
+    else
+        filesystem_read_entire(fs, interp, heap_backed(kh),
+                               closure(h, load_interp_complete, t, kh),
+                               closure(h, load_interp_fail));
+}
+
+closure_function(4, 1, void, exec_segments_mapped,
+                 thread, t, kernel_heaps, kh, tuple, interp, void *, entry,
+                 status, s)
+{
+    if (!is_ok(s))
+        halt("failed to read program segments: %v\n", s);
+    if (bound(interp)) {
+        exec_load_interp(bound(t), bound(kh), bound(interp), true);
+    } else {
+        exec_debug("starting process...\n");
+        start_process(bound(t), bound(entry));
+    }
+    closure_finish();
+}
+
 closure_function(1, 1, boolean, trace_notify,
                  process, p,
                  value, v)
@@ -209,7 +400,8 @@ closure_function(1, 1, boolean, trace_notify,
     return true;
 }
 
-process exec_elf(buffer ex, process kp)
+/* If f is given, ex holds only the headers and segments are mapped from f. */
+static process exec_elf_internal(buffer ex, fsfile f, process kp)
 {
     // is process md always root?
     // set cwd
@@ -226,13 +418,14 @@ process exec_elf(buffer ex, process kp)
     proc->brk = 0;
 
     exec_debug("exec_elf enter\n");
+    boot_milestone("exec");
 
     range load_range = irange(infinity, 0);
     foreach_phdr(e, p) {
         if (p->p_type == PT_INTERP) {
             char *n = (void *)e + p->p_offset;
             interp = resolve_path(root, split(heap_general(kh), alloca_wrap_buffer(n, runtime_strlen(n)), '/'));
-            if (!interp) 
+            if (!interp)
                 halt("couldn't find program interpreter %s\n", n);
         } else if (p->p_type == PT_LOAD) {
             if (p->p_vaddr < load_range.start)
@@ -268,7 +461,17 @@ process exec_elf(buffer ex, process kp)
                load_offset, load_range, range_span(load_range));
     u32 allowed_flags = proc_is_exec_protected(proc) ? 0 :
             (VMAP_FLAG_READABLE | VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC);
-    void * entry = load_elf(ex, load_offset, stack_closure(exec_elf_map, proc, kh, allowed_flags));
+    void *entry;
+    status_handler mapped = 0;
+    if (f) {
+        heap h = heap_general(kh);
+        entry = pointer_from_u64(e->e_entry + load_offset);
+        merge m = allocate_merge(h, closure(h, exec_segments_mapped, t, kh, interp, entry));
+        mapped = apply_merge(m);
+        exec_map_elf_file(proc, kh, e, f, load_offset, allowed_flags, m);
+    } else {
+        entry = load_elf(ex, load_offset, stack_closure(exec_elf_map, proc, kh, allowed_flags));
+    }
 
     u64 brk_offset = aslr ? get_aslr_offset(PROCESS_HEAP_ASLR_RANGE) : 0;
     u64 brk = pad(load_range.end, PAGESIZE) + brk_offset;
@@ -279,7 +482,7 @@ process exec_elf(buffer ex, process kp)
     assert(proc->heap_map != INVALID_ADDRESS);
     exec_debug("entry %p, brk %p (offset 0x%lx)\n", entry, proc->brk, brk_offset);
 
-    /* XXX temporarily disable because it breaks ftrace. Will need to 
+    /* XXX temporarily disable because it breaks ftrace. Will need to
        eventually deal with this for issue #1269 */
     //current_cpu()->current_thread = (nanos_thread)t;
     build_exec_stack(proc, t, e, entry, load_range.start, root, aslr);
@@ -292,16 +495,79 @@ process exec_elf(buffer ex, process kp)
 
     register_root_notify(sym(trace), closure(heap_general(kh), trace_notify, proc));
 
+    if (mapped) {
+        /* only the headers were read; the process starts once any bss
+           head pages have been filled */
+        deallocate_buffer(ex);
+        apply(mapped, STATUS_OK);
+        return proc;
+    }
+
     if (interp) {
-        exec_debug("reading interp...\n");
-        filesystem_read_entire(fs, interp, heap_backed(kh),
-                               closure(heap_general(kh), load_interp_complete, t, kh),
-                               closure(heap_general(kh), load_interp_fail));
+        exec_load_interp(t, kh, interp, false);
         return proc;
     }
 
     exec_debug("starting process...\n");
     start_process(t, entry);
-    return proc;    
+    return proc;
+}
+
+process exec_elf(buffer ex, process kp)
+{
+    return exec_elf_internal(ex, 0, kp);
 }
 
+closure_function(1, 1, status, read_program_complete,
+                 process, kp,
+                 buffer, b)
+{
+    exec_elf(b, bound(kp));
+    closure_finish();
+    return STATUS_OK;
+}
+
+closure_function(0, 1, void, read_program_fail,
+                 status, s)
+{
+    closure_finish();
+    halt("read program failed %v\n", s);
+}
+
+closure_function(3, 1, status, program_headers_complete,
+                 process, kp, tuple, program, fsfile, f,
+                 buffer, b)
+{
+    process kp = bound(kp);
+    tuple program = bound(program);
+    fsfile f = bound(f);
+    closure_finish();
+    if (!elf_headers_mappable(b)) {
+        exec_debug("program headers not mappable, reading elf\n");
+        deallocate_buffer(b);
+        kernel_heaps kh = (kernel_heaps)kp->uh;
+        heap h = heap_general(kh);
+        filesystem_read_entire(kp->root_fs, program, heap_backed(kh),
+                               closure(h, read_program_complete, kp),
+                               closure(h, read_program_fail));
+        return STATUS_OK;
+    }
+    exec_elf_internal(b, f, kp);
+    return STATUS_OK;
+}
+
+void exec_program(process kp, tuple program)
+{
+    kernel_heaps kh = (kernel_heaps)kp->uh;
+    heap h = heap_general(kh);
+    filesystem fs = kp->root_fs;
+    fsfile f = get(kp->process_root, sym(ingest_program_symbols)) ? 0 :
+        fsfile_from_node(fs, program);
+    if (f)
+        read_elf_headers(f, h, closure(h, program_headers_complete, kp, program, f),
+                         closure(h, read_program_fail));
+    else
+        filesystem_read_entire(fs, program, heap_backed(kh),
+                               closure(h, read_program_complete, kp),
+                               closure(h, read_program_fail));
+}
@@ -17,6 +17,10 @@ sysreturn sysreturn_from_fs_status(fs_status s)
         return -ENOTDIR;
     case FS_STATUS_LINKLOOP:
         return -ELOOP;
+    case FS_STATUS_READONLY:
+        return -EROFS;
+    case FS_STATUS_INVAL:
+        return -EINVAL;
     default:
         return 0;
     }
@@ -108,35 +112,73 @@ int filesystem_add_tuple(const char *path, tuple t)
         filename_from_path(path), t, true));
 }
 
-void file_readahead(file f, u64 offset, u64 len)
+void file_ra_ondemand(file_ra ra, pagecache_node pn, u64 offset, u64 len, u64 limit, u64 max)
+{
+    u64 end = offset + len;
+    u64 prev_end = ra->prev_end;
+    ra->prev_end = end;
+    if (max == 0)
+        return;
+
+    /* a read starting in the page where the previous one ended, or landing
+       in the current window, continues a sequential stream */
+    boolean sequential = (offset <= prev_end) && (offset + PAGESIZE >= prev_end);
+    boolean in_window = ra->size && (offset >= ra->start) && (offset < ra->start + ra->size);
+    if (!sequential && !in_window) {
+        ra->size = ra->async_size = 0;
+        return;
+    }
+    if (ra->size == 0) {
+        /* initial window, sized after the request */
+        ra->start = end;
+        ra->size = MIN(MAX(pad(4 * len, PAGESIZE), FILE_READAHEAD_MIN), max);
+    } else if (end > ra->start + ra->size - ra->async_size) {
+        /* crossed the async marker: submit the next window before the
+           current one is consumed */
+        ra->start = MAX(ra->start + ra->size, end);
+        ra->size = MIN((ra->size < max / 16 ? 4 : 2) * ra->size, max);
+    } else {
+        return;
+    }
+    ra->async_size = ra->size;
+    range r = irangel(ra->start, ra->size);
+    if (r.end > limit)
+        r.end = limit;
+    if (range_valid(r) && range_span(r) > 0)
+        pagecache_node_fetch_pages(pn, r);
+}
+
+static u64 file_ra_max(file f)
 {
-    u64 ra_size = 0;
+    /* read-ahead would only pull direct I/O ranges back into the cache */
+    if (f->f.flags & O_DIRECT)
+        return 0;
     switch (f->fadv) {
-    case POSIX_FADV_NORMAL:
-        ra_size = FILE_READAHEAD_DEFAULT;
-        break;
     case POSIX_FADV_RANDOM: /* no read-ahead */
-        break;
+        return 0;
     case POSIX_FADV_SEQUENTIAL:
-        ra_size = 2 * FILE_READAHEAD_DEFAULT;
-        break;
+        return 2 * FILE_READAHEAD_MAX;
+    default:
+        return FILE_READAHEAD_MAX;
     }
-    if (ra_size > 0)
-        pagecache_node_fetch_pages(fsfile_get_cachenode(f->fsf),
-            irangel(offset + len, ra_size));
 }
 
+void file_readahead(file f, u64 offset, u64 len)
+{
+    file_ra_ondemand(&f->ra, fsfile_get_cachenode(f->fsf), offset, len, infinity,
+                     file_ra_max(f));
+}
+
+/* Data is written back before the log is flushed, so that the commit, with its
+   device cache barrier, covers both the data and the metadata updated by the
+   writeback. */
 closure_function(4, 1, void, fs_sync_complete,
                  filesystem, fs, pagecache_node, pn, status_handler, sh, boolean, fs_flushed,
                  status, s)
 {
     if (is_ok(s) && !bound(fs_flushed)) {
         bound(fs_flushed) = true;
-        if (bound(pn))
-            pagecache_sync_node(bound(pn), (status_handler)closure_self());
-        else
-            pagecache_sync_volume(filesystem_get_pagecache_volume(bound(fs)),
-                (status_handler)closure_self());
+        filesystem_flush(bound(fs), (status_handler)closure_self());
         return;
     }
     apply(bound(sh), s);
@@ -152,7 +194,10 @@ static void filesystem_sync_internal(filesystem fs, pagecache_node pn,
         apply(sh, timm("result", "cannot allocate closure"));
         return;
     }
-    filesystem_flush(fs, sync_complete);
+    if (pn)
+        pagecache_sync_node(pn, sync_complete);
+    else
+        pagecache_sync_volume(filesystem_get_pagecache_volume(fs), sync_complete);
 }
 
 void filesystem_sync(filesystem fs, status_handler sh)
@@ -165,8 +210,8 @@ void filesystem_sync_node(filesystem fs, pagecache_node pn, status_handler sh)
     filesystem_sync_internal(fs, pn, sh);
 }
 
-closure_function(2, 2, void, fs_op_complete,
-                 thread, t, file, f,
+closure_function(3, 2, void, fs_op_complete,
+                 thread, t, file, f, io_completion, completion,
                  fsfile, fsf, fs_status, s)
 {
     thread t = bound(t);
@@ -174,7 +219,7 @@ closure_function(2, 2, void, fs_op_complete,
     thread_log(current, "%s: %d", __func__, ret);
 
     bound(f)->length = fsfile_get_length(fsf);
-    syscall_return(t, ret);
+    apply(bound(completion), t, ret);
     closure_finish();
 }
 
@@ -189,10 +234,11 @@ static sysreturn symlink_internal(filesystem fs, tuple cwd, const char *path,
     if ((ret != -ENOENT) || !parent) {
         return set_syscall_return(current, ret);
     }
-    if (filesystem_symlink(fs, parent, filename_from_path(path),
-        target))
+    const char *name = filename_from_path(path);
+    if (filesystem_symlink(fs, parent, name, target)) {
+        inotify_event(parent, sym_this(name), IN_CREATE, 0);
         return 0;
-    else
+    } else
         return -ENOSPC;
 }
 
@@ -300,45 +346,51 @@ sysreturn fstatfs(int fd, struct statfs *buf)
     return statfs_internal(f ? f->fs : 0, f ? file_get_meta(f) : 0, buf);
 }
 
-sysreturn fallocate(int fd, int mode, long offset, long len)
+sysreturn fallocate_internal(fdesc desc, int mode, long offset, long len,
+                             thread t, io_completion completion)
 {
-    fdesc desc = resolve_fd(current->p, fd);
     if (desc->type != FDESC_TYPE_REGULAR) {
         switch (desc->type) {
         case FDESC_TYPE_PIPE:
         case FDESC_TYPE_STDIO:
-            return -ESPIPE;
+            return io_complete(completion, t, -ESPIPE);
         default:
-            return -ENODEV;
+            return io_complete(completion, t, -ENODEV);
         }
     } else if (!fdesc_is_writable(desc)) {
-        return -EBADF;
+        return io_complete(completion, t, -EBADF);
     }
 
     heap h = heap_general(get_kernel_heaps());
     file f = (file) desc;
     filesystem fs = f->fs;
-    tuple t = fsfile_get_meta(f->fsf);
+    tuple md = fsfile_get_meta(f->fsf);
     switch (mode) {
     case 0:
     case FALLOC_FL_KEEP_SIZE:
-        filesystem_alloc(fs, t, offset, len,
+        filesystem_alloc(fs, md, offset, len,
                 mode == FALLOC_FL_KEEP_SIZE,
-                closure(h, fs_op_complete, current, f));
+                closure(h, fs_op_complete, t, f, completion));
         break;
     case FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE:
-        filesystem_dealloc(fs, t, offset, len,
-                closure(h, fs_op_complete, current, f));
+        filesystem_dealloc(fs, md, offset, len,
+                closure(h, fs_op_complete, t, f, completion));
         break;
     default:
-        set_syscall_error(current, EINVAL);
+        return io_complete(completion, t, -EINVAL);
     }
-    return thread_maybe_sleep_uninterruptible(current);
+    return 0;
 }
 
-sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
+sysreturn fallocate(int fd, int mode, long offset, long len)
 {
     fdesc desc = resolve_fd(current->p, fd);
+    fallocate_internal(desc, mode, offset, len, current, syscall_io_complete);
+    return thread_maybe_sleep_uninterruptible(current);
+}
+
+sysreturn fadvise_internal(fdesc desc, s64 off, u64 len, int advice)
+{
     if (desc->type != FDESC_TYPE_REGULAR) {
         switch (desc->type) {
         case FDESC_TYPE_PIPE:
@@ -354,6 +406,7 @@ sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
     case POSIX_FADV_RANDOM:
     case POSIX_FADV_SEQUENTIAL:
         f->fadv = advice;
+        zero(&f->ra, sizeof(f->ra));
         break;
     case POSIX_FADV_WILLNEED: {
         pagecache_node pn = fsfile_get_cachenode(f->fsf);
@@ -370,3 +423,23 @@ sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
     }
     return 0;
 }
+
+sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
+{
+    fdesc desc = resolve_fd(current->p, fd);
+    return fadvise_internal(desc, off, len, advice);
+}
+
+sysreturn readahead(int fd, s64 offset, u64 count)
+{
+    fdesc desc = resolve_fd(current->p, fd);
+    if (!fdesc_is_readable(desc))
+        return -EBADF;
+    if ((desc->type != FDESC_TYPE_REGULAR) || (offset < 0))
+        return -EINVAL;
+    file f = (file)desc;
+    if (count > infinity - offset)
+        count = infinity - offset;
+    pagecache_node_fetch_pages(fsfile_get_cachenode(f->fsf), irangel(offset, count));
+    return 0;
+}
@@ -44,6 +44,11 @@ static inline int filesystem_get_tuple(const char *path, tuple *t)
  * not to the range to be read ahead. */
 void file_readahead(file f, u64 offset, u64 len);
 
+/* Update read-ahead state after an access to [offset, offset + len) of a page
+ * cache node, growing the window on sequential access and collapsing it on
+ * random access; nothing beyond limit is read ahead. */
+void file_ra_ondemand(file_ra ra, pagecache_node pn, u64 offset, u64 len, u64 limit, u64 max);
+
 sysreturn symlink(const char *target, const char *linkpath);
 sysreturn symlinkat(const char *target, int dirfd, const char *linkpath);
 
@@ -53,6 +58,10 @@ sysreturn utimes(const char *filename, const struct timeval times[2]);
 sysreturn statfs(const char *path, struct statfs *buf);
 sysreturn fstatfs(int fd, struct statfs *buf);
 
+sysreturn fallocate_internal(fdesc desc, int mode, long offset, long len,
+                             thread t, io_completion completion);
 sysreturn fallocate(int fd, int mode, long offset, long len);
 
+sysreturn fadvise_internal(fdesc desc, s64 off, u64 len, int advice);
 sysreturn fadvise64(int fd, s64 off, u64 len, int advice);
+sysreturn readahead(int fd, s64 offset, u64 count);
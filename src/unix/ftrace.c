@@ -24,6 +24,9 @@
 /* Special context switch event */
 #define TRACE_GRAPH_SWITCH_DEPTH (unsigned short)(-1)
 
+/* Static tracepoint event */
+#define TRACE_EVENT_DEPTH (unsigned short)(-2)
+
 /* can't trace depths longer than this ... */
 #define FTRACE_RETFUNC_DEPTH 128
 
@@ -54,9 +57,9 @@ struct ftrace_tracer * current_tracer = 0;
 static http_listener ftrace_hl;
 
 struct rbuf_entry_function {
+    unsigned short depth; /* must be first */
     unsigned long ip;
     unsigned long parent_ip;
-    unsigned long ts; /* XXX only supports tsc at the moment */
     unsigned short cpu;
     int tid;
     symbol sym_name;
@@ -81,25 +84,40 @@ struct rbuf_entry_switch {
     symbol sym_name_out;
 };
 
+struct rbuf_entry_event {
+    unsigned short depth; /* must be first */
+    unsigned short cpu;
+    unsigned short event;
+    int tid;
+    u64 args[3];
+};
+
 struct rbuf_entry {
+    timestamp ts; /* XXX only supports tsc at the moment */
     union {
         struct rbuf_entry_function func;
         struct rbuf_entry_function_graph graph;
         struct rbuf_entry_switch sw;
+        struct rbuf_entry_event ev;
     };
 };
 
+/* One ring per cpu, written without locks by its own cpu only; nested
+ * events (interrupts, or functions called while recording) are dropped
+ * via the per-ring nesting count. Indices increase monotonically and are
+ * masked into the power-of-two trace array. Readers are serialized by
+ * ftrace_read_lock and merge the rings by timestamp.
+ */
 struct rbuf {
     struct rbuf_entry * trace_array;
-    struct spinlock rb_lock;
-    unsigned long count; /* current number of unconsumed items */
-    unsigned long total_written; /* total items ever written */
-    unsigned long size;
-    unsigned long read_idx;
+    unsigned long mask;         /* size - 1, or 0 if no array */
+    unsigned long write_idx;    /* written by the owning cpu only */
+    unsigned long dropped;      /* written by the owning cpu only */
+    unsigned long read_idx;     /* written by readers only */
     unsigned long local_idx;    /* index while iterating (but not consuming) */
-    unsigned long write_idx;
-    word disable_cnt;
-};
+    unsigned long reset_idx;    /* write_idx + dropped at the last reset */
+    word nesting;
+} __attribute__((aligned(64)));
 
 /* This structure is designed to simplify the process of efficiently flushing
  * buffers to userspace/http response handlers
@@ -136,7 +154,7 @@ struct ftrace_tracer {
      */
     void (*trace_fn)(unsigned long, unsigned long);
     void (*mcount_toggle)(boolean enable);
-    void (*print_header_fn)(struct ftrace_printer * p, struct rbuf * r);
+    void (*print_header_fn)(struct ftrace_printer * p);
     void (*print_entry_fn)(struct ftrace_printer * p, struct rbuf_entry * e);
 };
 
@@ -187,10 +205,14 @@ ftrace_graph_t  __ftrace_graph_entry_fn = (ftrace_graph_t)ftrace_stub;
 ftrace_graph_t __ftrace_graph_return_fn = (ftrace_graph_t)ftrace_stub;
 
 
-/* just a single rbuf for now, though this might need to be per-cpu once we
- * have smp
+static struct rbuf cpu_rbufs[MAX_CPUS];
+static int nr_rbufs;
+static struct spinlock ftrace_read_lock;
+
+/* tracing is off while nonzero; toggles mcount on the edges. Start out
+ * disabled.
  */
-static struct rbuf global_rbuf;
+static word trace_disable_cnt = 1;
 
 /*
  * helper to write a buffer to userspace, paying attention
@@ -412,110 +434,272 @@ printer_print_duration_usec(struct ftrace_printer * p, timestamp num, u16 width)
     }
 }
 
-#define rbuf_next_idx(r, idx)   (idx == r->size - 1) ? 0 : idx + 1
-#define rbuf_next_write_idx(r)  rbuf_next_idx(r, r->write_idx)
-#define rbuf_next_read_idx(r)   rbuf_next_idx(r, r->read_idx)
+#define rbuf_entry_at(r, idx)   (&(r)->trace_array[(idx) & (r)->mask])
+#define rbuf_count(r)           ((r)->write_idx - (r)->read_idx)
+#define rbuf_written(r)         ((r)->write_idx + (r)->dropped - (r)->reset_idx)
 
-/* these are nops for now, as interrupts are always disabled when
- * we're in kernel
- */
-static inline __attribute__((always_inline)) void
-rbuf_lock(struct rbuf * rbuf) {
-    spin_lock(&rbuf->rb_lock);
-}
-static inline __attribute__((always_inline)) void
-rbuf_unlock(struct rbuf * rbuf) {
-    spin_unlock(&rbuf->rb_lock);
+static inline __attribute__((always_inline)) struct rbuf *
+current_rbuf(void)
+{
+    return &cpu_rbufs[current_cpu()->id];
 }
 
+/* readers only; a writer racing with this lands after the new read_idx */
 static void
 rbuf_reset(struct rbuf * rbuf)
 {
-    rbuf->count = 0;
-    rbuf->local_idx = 0;
-    rbuf->read_idx = 0;
-    rbuf->write_idx = 0;
-    rbuf->total_written = 0;
+    unsigned long w = rbuf->write_idx;
+    rbuf->read_idx = w;
+    rbuf->local_idx = w;
+    rbuf->reset_idx = w + rbuf->dropped;
+}
+
+static void
+rbuf_reset_all(void)
+{
+    for (int i = 0; i < nr_rbufs; i++)
+        rbuf_reset(&cpu_rbufs[i]);
+}
+
+static void
+rbuf_rewind_all(void)
+{
+    for (int i = 0; i < nr_rbufs; i++)
+        cpu_rbufs[i].local_idx = cpu_rbufs[i].read_idx;
 }
 
 static int
 rbuf_init(struct rbuf * rbuf, unsigned long buffer_size_kb)
 {
     unsigned long buffer_size = buffer_size_kb << 10;
+    unsigned long size = U64_FROM_BIT(msb(buffer_size / sizeof(struct rbuf_entry)));
 
-    rbuf->size = buffer_size / sizeof(struct rbuf_entry);
-    rbuf->trace_array = allocate(rbuf_heap,
-            sizeof(struct rbuf_entry) * rbuf->size);
+    rbuf->trace_array = allocate(rbuf_heap, sizeof(struct rbuf_entry) * size);
     if (rbuf->trace_array == INVALID_ADDRESS) {
         msg_err("failed to allocate ftrace trace array\n");
+        rbuf->trace_array = 0;
         return -ENOMEM;
     }
-    spin_lock_init(&rbuf->rb_lock);
+    rbuf->mask = size - 1;
+    rbuf->write_idx = 0;
+    rbuf->dropped = 0;
+    rbuf->nesting = 0;
     rbuf_reset(rbuf);
-
-    /* start out disabled */
-    rbuf->disable_cnt = 1;
-
     return 0;
 }
 
 static inline __attribute__((always_inline)) void
-rbuf_disable(struct rbuf * rbuf)
+trace_disable(void)
 {
     /* disable mcount on first disable */
-    if (fetch_and_add(&rbuf->disable_cnt, 1) == 0)
+    if (fetch_and_add(&trace_disable_cnt, 1) == 0)
         current_tracer->mcount_toggle(false);
 }
 
 static inline __attribute__((always_inline)) void
-rbuf_enable(struct rbuf * rbuf)
+trace_enable(void)
 {
     /* enable mcount on last enable */
-    assert(rbuf->disable_cnt > 0);
-    if (fetch_and_add(&rbuf->disable_cnt, -1) == 1)
+    assert(trace_disable_cnt > 0);
+    if (fetch_and_add(&trace_disable_cnt, -1) == 1)
         current_tracer->mcount_toggle(true);
 }
 
 static inline __attribute__((always_inline)) boolean
-rbuf_enabled(struct rbuf * rbuf)
+trace_enabled(void)
 {
-    return (rbuf->disable_cnt == 0);
+    return (trace_disable_cnt == 0);
 }
 
-/* must be locked before calling */
+/* Only the owning cpu touches the nesting count, and anything nesting on
+ * it (an interrupt) unwinds before returning, so no atomics are needed.
+ */
 static inline __attribute__((always_inline)) boolean
-__rbuf_acquire_write_entry(struct rbuf * rbuf, struct rbuf_entry ** acquired)
+rbuf_enter(struct rbuf * rbuf)
 {
-    if (rbuf->count == rbuf->size - 1)
+    if (rbuf->nesting++ != 0) {
+        rbuf->nesting--;
         return false;
+    }
+    compiler_barrier();
+    return true;
+}
 
-    *acquired = &(rbuf->trace_array[rbuf->write_idx]);
-
-    rbuf->write_idx = rbuf_next_write_idx(rbuf);
-    rbuf->count++;
-    rbuf->total_written++;
-    if (rbuf->count == rbuf->size - 1)
-        ft_debug("FTRACE: buffer full\n");
+static inline __attribute__((always_inline)) void
+rbuf_exit(struct rbuf * rbuf)
+{
+    compiler_barrier();
+    rbuf->nesting--;
+}
 
-    return true;
+/* owning cpu only, within rbuf_enter(); the entry is visible to readers
+ * after __rbuf_commit_write_entry()
+ */
+static inline __attribute__((always_inline)) struct rbuf_entry *
+__rbuf_acquire_write_entry(struct rbuf * rbuf)
+{
+    if (rbuf->write_idx - rbuf->read_idx >= rbuf->mask) {
+        if (rbuf->mask && rbuf->dropped++ == 0)
+            ft_debug("cpu %d buffer full\n", current_cpu()->id);
+        return 0;
+    }
+    struct rbuf_entry * entry = rbuf_entry_at(rbuf, rbuf->write_idx);
+    entry->ts = rdtsc();
+    return entry;
 }
 
-/* must be locked before calling */
-static inline __attribute__((always_inline)) boolean
-__rbuf_acquire_read_entry(struct rbuf * rbuf, struct rbuf_entry ** acquired)
+static inline __attribute__((always_inline)) void
+__rbuf_commit_write_entry(struct rbuf * rbuf)
 {
-    if (rbuf->count == 0)
-        return false;
+    write_barrier();
+    rbuf->write_idx++;
+}
 
-    *acquired = &(rbuf->trace_array[rbuf->read_idx]);
+/* must hold ftrace_read_lock; returns the ring holding the oldest entry at
+ * or after each ring's read (destructive) or local index
+ */
+static struct rbuf *
+rbuf_next_merged(boolean destructive, struct rbuf_entry ** acquired)
+{
+    struct rbuf * oldest = 0;
+    struct rbuf_entry * oldest_entry = 0;
+
+    for (int i = 0; i < nr_rbufs; i++) {
+        struct rbuf * r = &cpu_rbufs[i];
+        unsigned long idx = destructive ? r->read_idx : r->local_idx;
+        if (idx == r->write_idx)
+            continue;
+        read_barrier();
+        struct rbuf_entry * e = rbuf_entry_at(r, idx);
+        if (!oldest || e->ts < oldest_entry->ts) {
+            oldest = r;
+            oldest_entry = e;
+        }
+    }
+    *acquired = oldest_entry;
+    return oldest;
+}
 
-    rbuf->read_idx = rbuf_next_read_idx(rbuf);
-    rbuf->count--;
+static boolean
+rbuf_all_empty(boolean destructive)
+{
+    for (int i = 0; i < nr_rbufs; i++) {
+        struct rbuf * r = &cpu_rbufs[i];
+        if ((destructive ? r->read_idx : r->local_idx) != r->write_idx)
+            return false;
+    }
     return true;
 }
 
+static void
+rbuf_totals(unsigned long * count, unsigned long * written)
+{
+    *count = *written = 0;
+    for (int i = 0; i < nr_rbufs; i++) {
+        *count += rbuf_count(&cpu_rbufs[i]);
+        *written += rbuf_written(&cpu_rbufs[i]);
+    }
+}
+
 /*** Start tracer callbacks */
 
+/* static tracepoints, see tracepoint.h */
+u8 tracepoint_enabled[TRACEPOINT_COUNT];
+
+#define __TRACEPOINT_NAME(name, fmt) #name,
+static const char * const tracepoint_names[TRACEPOINT_COUNT] = {
+    TRACEPOINTS(__TRACEPOINT_NAME)
+};
+#undef __TRACEPOINT_NAME
+
+#define __TRACEPOINT_FMT(name, fmt) fmt,
+static const char * const tracepoint_formats[TRACEPOINT_COUNT] = {
+    TRACEPOINTS(__TRACEPOINT_FMT)
+};
+#undef __TRACEPOINT_FMT
+
+/* events are recorded regardless of the current tracer, but like its own
+ * entries, not while tracing is disabled or from within another event
+ */
+NOTRACE void
+tracepoint_record(int event, u64 a0, u64 a1, u64 a2)
+{
+    cpuinfo ci = current_cpu();
+    struct rbuf * rbuf = &cpu_rbufs[ci->id];
+    struct rbuf_entry * entry;
+    struct rbuf_entry_event * ev;
+
+    if (!trace_enabled() || !rbuf_enter(rbuf))
+        return;
+
+    entry = __rbuf_acquire_write_entry(rbuf);
+    if (!entry)
+        goto out;
+
+    ev = &(entry->ev);
+    ev->depth = TRACE_EVENT_DEPTH;
+    ev->cpu = ci->id;
+    ev->event = event;
+    ev->tid = current ? current->tid : 0;
+    ev->args[0] = a0;
+    ev->args[1] = a1;
+    ev->args[2] = a2;
+
+    __rbuf_commit_write_entry(rbuf);
+out:
+    rbuf_exit(rbuf);
+}
+
+static void
+print_event(struct ftrace_printer * p, struct rbuf_entry_event * ev)
+{
+    printer_write(p, "%s: ", tracepoint_names[ev->event]);
+    printer_write(p, (char *)tracepoint_formats[ev->event],
+        ev->args[0], ev->args[1], ev->args[2]
+    );
+}
+
+static void
+print_task_prefix(struct ftrace_printer * p, char * name, int tid,
+                  unsigned short cpu, timestamp ts)
+{
+    printer_write(p, " ");
+    printer_print_right_adjusted(p, name, TRACE_TASK_WIDTH);
+    printer_write(p, "-%d", tid);
+
+    /* pad with spaces as needed */
+    {
+        int blanks;
+
+        for (blanks = (tid) ? TRACE_PID_WIDTH : TRACE_PID_WIDTH-1;
+             tid > 0;
+             tid /= 10)
+        {
+            blanks--;
+        }
+
+        while (blanks-- > 0)
+            printer_write(p, " ");
+    }
+
+    /* CPU number */
+    printer_write(p, " [%03d] ", cpu);
+
+    /* timestamp */
+    printer_write(p, " %ld: ", ts);
+}
+
+/* the only entries written under the nop tracer */
+static void
+event_print_entry(struct ftrace_printer * p, struct rbuf_entry * entry)
+{
+    struct rbuf_entry_event * ev = &(entry->ev);
+
+    print_task_prefix(p, "tid", ev->tid, ev->cpu, entry->ts);
+    print_event(p, ev);
+    printer_write(p, "\n");
+}
+
 /* nop tracer */
 NOTRACE static void
 nop_toggle(boolean enable)
@@ -526,13 +710,16 @@ nop_toggle(boolean enable)
 }
 
 static void
-nop_print_header(struct ftrace_printer * p, struct rbuf * rbuf)
+nop_print_header(struct ftrace_printer * p)
 {
+    unsigned long count, written;
+
     printer_write(p, "# tracer: nop\n");
     printer_write(p, "#\n");
+    rbuf_totals(&count, &written);
     printer_write(p,
         "# entries-in-buffer/entries-written: %ld/%ld    #P:%d\n",
-        global_rbuf.count, global_rbuf.total_written, 1
+        count, written, nr_rbufs
     );
     printer_write(p, "#\n");
     printer_write(p, "#           TASK-PID   CPU#     TIMESTAMP  FUNCTION\n");
@@ -542,27 +729,25 @@ nop_print_header(struct ftrace_printer * p, struct rbuf * rbuf)
 NOTRACE static void
 function_trace(unsigned long ip, unsigned long parent_ip)
 {
+    struct rbuf * rbuf = current_rbuf();
     struct rbuf_entry * entry;
     struct rbuf_entry_function * func;
 
-    /* disable any more events while we're in here */
-    rbuf_disable(&global_rbuf);
+    /* drop any events raised while we're in here */
+    if (!trace_enabled() || !rbuf_enter(rbuf))
+        return;
 
-    rbuf_lock(&global_rbuf);
-    if (!__rbuf_acquire_write_entry(&global_rbuf, &entry)) {
-        rbuf_unlock(&global_rbuf);
-        goto drop;
-    }
+    entry = __rbuf_acquire_write_entry(rbuf);
+    if (!entry)
+        goto out;
 
     func = &(entry->func);
+    func->depth = 0;
     func->cpu = current_cpu()->id;
     func->tid = current->tid;
     func->ip = ip;
     func->parent_ip = parent_ip;
 
-    /* XXX function tracer just supports tsc for now */
-    func->ts = rdtsc();
-
     /* alloca is broken here ... */
     if (current->name[0] != '\0') {
         struct buffer b = stack_buffer_name(current->name);
@@ -571,12 +756,9 @@ function_trace(unsigned long ip, unsigned long parent_ip)
     else
         func->sym_name = 0;
 
-    rbuf_unlock(&global_rbuf);
-    rbuf_enable(&global_rbuf);
-    return;
-drop:
-    /* XXX count the drop */
-    return;
+    __rbuf_commit_write_entry(rbuf);
+out:
+    rbuf_exit(rbuf);
 }
 
 NOTRACE static void
@@ -589,14 +771,16 @@ function_toggle(boolean enable)
 }
 
 static void
-function_print_header(struct ftrace_printer * p, struct rbuf * rbuf)
-
+function_print_header(struct ftrace_printer * p)
 {
+    unsigned long count, written;
+
     printer_write(p, "# tracer: function\n");
     printer_write(p, "#\n");
+    rbuf_totals(&count, &written);
     printer_write(p,
         "# entries-in-buffer/entries-written: %ld/%ld    #P:%d\n",
-        global_rbuf.count, global_rbuf.total_written, 1
+        count, written, nr_rbufs
     );
     printer_write(p, "#\n");
     printer_write(p, "#           TASK-PID   CPU#     TIMESTAMP  FUNCTION\n");
@@ -608,35 +792,17 @@ function_print_entry(struct ftrace_printer * p, struct rbuf_entry * entry)
 {
     buffer b = little_stack_buffer(16);
     struct rbuf_entry_function * func = &(entry->func);
-    char * name = (func->sym_name)
-        ? cstring(symbol_string(func->sym_name), b)
-        : "tid";
-
-    printer_write(p, " ");
-    printer_print_right_adjusted(p, name, TRACE_TASK_WIDTH);
-    printer_write(p, "-%d", func->tid);
-
-    /* pad with spaces as needed */
-    {
-        int tid, blanks;
 
-        for (tid = func->tid,
-             blanks = (tid) ? TRACE_PID_WIDTH : TRACE_PID_WIDTH-1;
-             tid > 0;
-             tid /= 10)
-        {
-            blanks--;
-        }
-
-        while (blanks-- > 0)
-            printer_write(p, " ");
+    if (func->depth == TRACE_EVENT_DEPTH) {
+        event_print_entry(p, entry);
+        return;
     }
 
-    /* CPU number */
-    printer_write(p, " [%03d] ", func->cpu);
+    char * name = (func->sym_name)
+        ? cstring(symbol_string(func->sym_name), b)
+        : "tid";
 
-    /* timestamp */
-    printer_write(p, " %ld: ", func->ts);
+    print_task_prefix(p, name, func->tid, func->cpu, entry->ts);
 
     /* function and parent */
     printer_print_sym(p, func->ip);
@@ -647,19 +813,18 @@ function_print_entry(struct ftrace_printer * p, struct rbuf_entry * entry)
 }
 
 /*
- * This must always called with rbuf already disabled
+ * This must always be called within rbuf_enter() on the current cpu's rbuf
  */
 NOTRACE static void
 function_graph_trace_switch(thread out, thread in)
 {
+    struct rbuf * rbuf = current_rbuf();
     struct rbuf_entry * entry;
     struct rbuf_entry_switch * sw;
 
-    rbuf_lock(&global_rbuf);
-    if (!__rbuf_acquire_write_entry(&global_rbuf, &entry)) {
-        rbuf_unlock(&global_rbuf);
-        goto drop;
-    }
+    entry = __rbuf_acquire_write_entry(rbuf);
+    if (!entry)
+        return;
 
     sw = &(entry->sw);
     sw->depth = TRACE_GRAPH_SWITCH_DEPTH;
@@ -679,27 +844,22 @@ function_graph_trace_switch(thread out, thread in)
     } else
         sw->sym_name_out = 0;
 
-    rbuf_unlock(&global_rbuf);
-    return;
-drop:
-    /* XXX count the drop */
-    return;
+    __rbuf_commit_write_entry(rbuf);
 }
 
 /*
- * This must always called with rbuf already disabled
+ * This must always be called within rbuf_enter() on the current cpu's rbuf
  */
 NOTRACE static void
 function_graph_trace_entry(struct ftrace_graph_entry * stack_entry)
 {
+    struct rbuf * rbuf = current_rbuf();
     struct rbuf_entry * entry;
     struct rbuf_entry_function_graph * graph;
 
-    rbuf_lock(&global_rbuf);
-    if (!__rbuf_acquire_write_entry(&global_rbuf, &entry)) {
-        rbuf_unlock(&global_rbuf);
-        goto drop;
-    }
+    entry = __rbuf_acquire_write_entry(rbuf);
+    if (!entry)
+        return;
 
     graph = &(entry->graph);
     graph->ip = stack_entry->func;
@@ -709,27 +869,22 @@ function_graph_trace_entry(struct ftrace_graph_entry * stack_entry)
     graph->has_child = 1;
     graph->tid = stack_entry->tid;
 
-    rbuf_unlock(&global_rbuf);
-    return;
-drop:
-    /* XXX count the drop */
-    return;
+    __rbuf_commit_write_entry(rbuf);
 }
 
 /*
- * This must always called with rbuf already disabled
+ * This must always be called within rbuf_enter() on the current cpu's rbuf
  */
 NOTRACE static void
 function_graph_trace_return(struct ftrace_graph_entry * stack_entry)
 {
+    struct rbuf * rbuf = current_rbuf();
     struct rbuf_entry * entry;
     struct rbuf_entry_function_graph * graph;
 
-    rbuf_lock(&global_rbuf);
-    if (!__rbuf_acquire_write_entry(&global_rbuf, &entry)) {
-        rbuf_unlock(&global_rbuf);
-        goto drop;
-    }
+    entry = __rbuf_acquire_write_entry(rbuf);
+    if (!entry)
+        return;
 
     graph = &(entry->graph);
     graph->depth = stack_entry->depth;
@@ -740,11 +895,7 @@ function_graph_trace_return(struct ftrace_graph_entry * stack_entry)
     graph->flush = graph->has_child; //stack_entry->flush;
     graph->tid = stack_entry->tid;
 
-    rbuf_unlock(&global_rbuf);
-    return;
-drop:
-    /* XXX count the drop */
-    return;
+    __rbuf_commit_write_entry(rbuf);
 }
 
 NOTRACE static void
@@ -796,6 +947,13 @@ function_graph_print_entry(struct ftrace_printer * p,
         return;
     }
 
+    if (graph->depth == TRACE_EVENT_DEPTH) {
+        printer_write(p, " %d)               |  /* ", entry->ev.cpu);
+        print_event(p, &(entry->ev));
+        printer_write(p, " */\n");
+        return;
+    }
+
     printer_write(p, " %d) ", graph->cpu);
 
     /* duration */
@@ -837,44 +995,47 @@ function_graph_print_entry(struct ftrace_printer * p,
     printer_write(p, "\n");
 }
 
+/* must hold ftrace_read_lock */
 static boolean
-ftrace_print_rbuf_destructive(struct ftrace_printer * p, struct rbuf * rbuf,
+ftrace_print_rbuf_destructive(struct ftrace_printer * p,
                               struct ftrace_tracer * tracer)
 {
     struct rbuf_entry * entry;
+    struct rbuf * rbuf;
 
-    while (__rbuf_acquire_read_entry(rbuf, &entry)) {
+    while ((rbuf = rbuf_next_merged(true, &entry))) {
         tracer->print_entry_fn(p, entry);
+
+        /* done with the entry before its slot is handed back */
+        memory_barrier();
+        rbuf->read_idx++;
         if (printer_length(p) >= printer_size(p))
             break;
     }
 
-    return rbuf->count > 0;     /* more */
+    return !rbuf_all_empty(true);     /* more */
 }
 
+/* must hold ftrace_read_lock */
 static boolean
-ftrace_print_rbuf_nondestructive(struct ftrace_printer * p, struct rbuf * rbuf,
+ftrace_print_rbuf_nondestructive(struct ftrace_printer * p,
                                  struct ftrace_tracer * tracer)
 {
     struct rbuf_entry * entry;
-    unsigned long idx;
-
-    idx = rbuf->local_idx;
-    while (idx != rbuf->write_idx) {
-        entry = &(rbuf->trace_array[idx]);
-        idx  = rbuf_next_idx(rbuf, idx);
+    struct rbuf * rbuf;
 
+    while ((rbuf = rbuf_next_merged(false, &entry))) {
         tracer->print_entry_fn(p, entry);
+        rbuf->local_idx++;
         if (printer_length(p) >= printer_size(p))
             break;
     }
 
-    rbuf->local_idx = idx;
-    return idx != rbuf->write_idx; /* more */
+    return !rbuf_all_empty(false); /* more */
 }
 
 static void
-function_graph_print_header(struct ftrace_printer * p, struct rbuf * rbuf)
+function_graph_print_header(struct ftrace_printer * p)
 {
     printer_write(p, "# tracer: function_graph\n");
     printer_write(p, "#\n");
@@ -883,20 +1044,19 @@ function_graph_print_header(struct ftrace_printer * p, struct rbuf * rbuf)
 }
 
 static boolean
-ftrace_print_rbuf(struct ftrace_printer * p, struct rbuf * rbuf,
-                  struct ftrace_tracer * tracer)
+ftrace_print_rbuf(struct ftrace_printer * p, struct ftrace_tracer * tracer)
 {
     if (p->flags & TRACE_FLAG_HEADER)
         if (tracer->print_header_fn)
-            tracer->print_header_fn(p, rbuf);
+            tracer->print_header_fn(p);
 
     if (!tracer->print_entry_fn)
         return false;
 
     if (p->flags & TRACE_FLAG_DESTRUCTIVE)
-        return ftrace_print_rbuf_destructive(p, rbuf, tracer);
+        return ftrace_print_rbuf_destructive(p, tracer);
     else
-        return ftrace_print_rbuf_nondestructive(p, rbuf, tracer);
+        return ftrace_print_rbuf_nondestructive(p, tracer);
 }
 
 #define FTRACE_TRACER(_name, _mcount_toggle, _header_fn, _entry_fn)\
@@ -909,7 +1069,7 @@ ftrace_print_rbuf(struct ftrace_printer * p, struct rbuf * rbuf,
 static struct ftrace_tracer
 tracer_list[] = {
     /* nop must be first */
-    FTRACE_TRACER("nop", nop_toggle, nop_print_header, 0
+    FTRACE_TRACER("nop", nop_toggle, nop_print_header, event_print_entry
     ),
     FTRACE_TRACER("function", function_toggle, function_print_header,
         function_print_entry
@@ -1005,13 +1165,15 @@ FTRACE_FN(current_tracer, put)(struct ftrace_printer * p)
 
         if (runtime_strcmp(tracer->name, str) == 0) {
             if (tracer != current_tracer) {
-                rbuf_disable(&global_rbuf);
+                trace_disable();
 
-                /* clear the rbuf */
-                rbuf_reset(&global_rbuf);
+                /* clear the rbufs */
+                spin_lock(&ftrace_read_lock);
+                rbuf_reset_all();
+                spin_unlock(&ftrace_read_lock);
                 current_tracer = tracer;
 
-                rbuf_enable(&global_rbuf);
+                trace_enable();
             }
             ret = 0;
             goto out;
@@ -1095,8 +1257,8 @@ FTRACE_FN(trace, init)(struct ftrace_printer * p, u64 flags)
     if (printer_init(p, flags | TRACE_FLAG_HEADER))
         return -ENOMEM;
 
-    rbuf_disable(&global_rbuf);
-    global_rbuf.local_idx = global_rbuf.read_idx;
+    trace_disable();
+    rbuf_rewind_all();
     trace_is_open = true;
 
     return 0;
@@ -1108,8 +1270,7 @@ FTRACE_FN(trace, deinit)(struct ftrace_printer * p)
     assert(trace_is_open);
     trace_is_open = false;
     printer_deinit(p);
-    global_rbuf.local_idx = -1ull;
-    rbuf_enable(&global_rbuf);
+    trace_enable();
     return 0;
 }
 
@@ -1130,12 +1291,12 @@ FTRACE_FN(trace, get)(struct ftrace_printer * p)
 {
     sysreturn rv = 0;
 
-    rbuf_lock(&global_rbuf);
+    spin_lock(&ftrace_read_lock);
     {
-        if (ftrace_print_rbuf(p, &global_rbuf, current_tracer))
+        if (ftrace_print_rbuf(p, current_tracer))
             rv = 1;             /* more to print */
     }
-    rbuf_unlock(&global_rbuf);
+    spin_unlock(&ftrace_read_lock);
 
     return rv;
 }
@@ -1144,11 +1305,11 @@ static sysreturn
 FTRACE_FN(trace, put)(struct ftrace_printer * p)
 {
     /* writes clear the trace buffer */
-    rbuf_lock(&global_rbuf);
+    spin_lock(&ftrace_read_lock);
     {
-        rbuf_reset(&global_rbuf);
+        rbuf_reset_all();
     }
-    rbuf_unlock(&global_rbuf);
+    spin_unlock(&ftrace_read_lock);
 
     return 0;
 }
@@ -1291,7 +1452,7 @@ FTRACE_FN(trace_pipe, init)(struct ftrace_printer * p, u64 flags)
     if (printer_init(p, flags | TRACE_FLAG_DESTRUCTIVE))
         return -ENOMEM;
 
-    global_rbuf.local_idx = global_rbuf.read_idx;
+    rbuf_rewind_all();
     trace_pipe_is_open = true;
     return 0;
 }
@@ -1302,7 +1463,6 @@ FTRACE_FN(trace_pipe, deinit)(struct ftrace_printer * p)
     assert(trace_pipe_is_open);
     trace_pipe_is_open = false;
     printer_deinit(p);
-    global_rbuf.local_idx = -1ull;
     return 0;
 }
 
@@ -1315,14 +1475,14 @@ FTRACE_FN(trace_pipe, get)(struct ftrace_printer * p)
 {
     sysreturn rv = 0;
 
-    rbuf_disable(&global_rbuf);
-    rbuf_lock(&global_rbuf);
+    trace_disable();
+    spin_lock(&ftrace_read_lock);
     {
-        if (ftrace_print_rbuf(p, &global_rbuf, current_tracer))
+        if (ftrace_print_rbuf(p, current_tracer))
             rv = 1;             /* more to print */
     }
-    rbuf_unlock(&global_rbuf);
-    rbuf_enable(&global_rbuf);
+    spin_unlock(&ftrace_read_lock);
+    trace_enable();
 
     return rv;
 }
@@ -1369,16 +1529,273 @@ u32
 FTRACE_FN(trace_pipe, events)(file f)
 {
     u32 mask = 0;
-    rbuf_lock(&global_rbuf);
+    spin_lock(&ftrace_read_lock);
     {
-        if (global_rbuf.count != 0)
+        if (!rbuf_all_empty(true))
             mask |= EPOLLIN;
     }
-    rbuf_unlock(&global_rbuf);
+    spin_unlock(&ftrace_read_lock);
 
     return mask;
 }
 
+/*
+ * trace_raw callbacks
+ *
+ * Like trace, but the merged ring contents are read out as fixed-size binary
+ * records (see tools/trace-utilities/trace-to-chrome.py) instead of text.
+ * Records are encoded straight into the reader's buffer, so a file read is a
+ * single copy out of the rings with no formatting or symbol lookups;
+ * addresses are resolved on the host against the kernel ELF.
+ *
+ * The stream is a struct ftrace_raw_header followed by records in timestamp
+ * order. Record timestamps are raw tsc values; the two (tsc, ns) pairs in the
+ * header, taken at ftrace_init and at open, let the reader convert them.
+ */
+#define FTRACE_RAW_MAGIC        0x4352544e /* "NTRC" */
+#define FTRACE_RAW_VERSION      1
+
+#define FTRACE_RAW_FUNCTION     1 /* ip called from arg */
+#define FTRACE_RAW_GRAPH_ENTRY  2 /* ip entered, has children */
+#define FTRACE_RAW_GRAPH_RETURN 3 /* ip returned after arg ns */
+#define FTRACE_RAW_GRAPH_LEAF   4 /* ip returned after arg ns, no children */
+#define FTRACE_RAW_SWITCH       5 /* tid arg switched out for tid */
+#define FTRACE_RAW_EVENT        6 /* tracepoint depth, args ip, arg, arg2 */
+
+struct ftrace_raw_header {
+    u32 magic;
+    u16 version;
+    u16 record_size;
+    u32 nr_cpus;
+    u32 tracer;                 /* index into available_tracers */
+    u64 tsc_init, ns_init;
+    u64 tsc_open, ns_open;
+    u64 dropped;                /* events lost to full rings so far */
+} __attribute__((packed));
+
+struct ftrace_raw_record {
+    u64 ts;
+    u64 ip;
+    u64 arg;
+    u32 tid;
+    u16 cpu;
+    u8 type;
+    u8 depth;
+    u64 arg2;
+} __attribute__((packed));
+
+static u64 raw_tsc_init, raw_ns_init;
+static struct ftrace_raw_header trace_raw_header;
+static struct ftrace_printer trace_raw_printer;
+static boolean trace_raw_is_open = false;
+static u64 trace_raw_offset;   /* stream offset of the next unread record */
+
+static void
+ftrace_raw_encode(struct ftrace_raw_record * r, struct rbuf_entry * entry)
+{
+    r->ts = entry->ts;
+    r->arg2 = 0;
+    if (entry->ev.depth == TRACE_EVENT_DEPTH) {
+        r->ip = entry->ev.args[0];
+        r->arg = entry->ev.args[1];
+        r->arg2 = entry->ev.args[2];
+        r->tid = entry->ev.tid;
+        r->cpu = entry->ev.cpu;
+        r->type = FTRACE_RAW_EVENT;
+        r->depth = entry->ev.event;
+        return;
+    }
+
+    if (current_tracer == &tracer_list[FTRACE_FUNCTION_IDX]) {
+        r->ip = entry->func.ip;
+        r->arg = entry->func.parent_ip;
+        r->tid = entry->func.tid;
+        r->cpu = entry->func.cpu;
+        r->type = FTRACE_RAW_FUNCTION;
+        r->depth = 0;
+        return;
+    }
+
+    struct rbuf_entry_function_graph * graph = &(entry->graph);
+    if (graph->depth == TRACE_GRAPH_SWITCH_DEPTH) {
+        r->ip = 0;
+        r->arg = entry->sw.tid_out;
+        r->tid = entry->sw.tid_in;
+        r->cpu = entry->sw.cpu;
+        r->type = FTRACE_RAW_SWITCH;
+        r->depth = 0;
+        return;
+    }
+
+    r->ip = graph->ip;
+    r->tid = graph->tid;
+    r->cpu = graph->cpu;
+    r->depth = graph->depth;
+    if (graph->duration == UNTIMED) {
+        r->arg = 0;
+        r->type = FTRACE_RAW_GRAPH_ENTRY;
+    } else {
+        r->arg = nsec_from_timestamp(graph->duration);
+        r->type = graph->has_child ? FTRACE_RAW_GRAPH_RETURN :
+            FTRACE_RAW_GRAPH_LEAF;
+    }
+}
+
+static void
+ftrace_raw_fill_header(struct ftrace_raw_header * h)
+{
+    unsigned long dropped = 0;
+
+    for (int i = 0; i < nr_rbufs; i++)
+        dropped += cpu_rbufs[i].dropped;
+
+    h->magic = FTRACE_RAW_MAGIC;
+    h->version = FTRACE_RAW_VERSION;
+    h->record_size = sizeof(struct ftrace_raw_record);
+    h->nr_cpus = nr_rbufs;
+    h->tracer = current_tracer - tracer_list;
+    h->tsc_init = raw_tsc_init;
+    h->ns_init = raw_ns_init;
+    h->tsc_open = rdtsc();
+    h->ns_open = nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW));
+    h->dropped = dropped;
+}
+
+static sysreturn
+FTRACE_FN(trace_raw, init)(struct ftrace_printer * p, u64 flags)
+{
+    if (trace_raw_is_open)
+        return -EBUSY;
+
+    if (printer_init(p, flags | TRACE_FLAG_HEADER))
+        return -ENOMEM;
+
+    trace_disable();
+    rbuf_rewind_all();
+    ftrace_raw_fill_header(&trace_raw_header);
+    trace_raw_offset = sizeof(trace_raw_header);
+    trace_raw_is_open = true;
+
+    return 0;
+}
+
+static sysreturn
+FTRACE_FN(trace_raw, deinit)(struct ftrace_printer * p)
+{
+    assert(trace_raw_is_open);
+    trace_raw_is_open = false;
+    printer_deinit(p);
+    trace_enable();
+    return 0;
+}
+
+sysreturn
+FTRACE_FN(trace_raw, open)(file f)
+{
+    return FTRACE_FN(trace_raw, init)(&trace_raw_printer, TRACE_FLAG_FILE);
+}
+
+sysreturn
+FTRACE_FN(trace_raw, close)(file f)
+{
+    return FTRACE_FN(trace_raw, deinit)(&trace_raw_printer);
+}
+
+/* http: append the header on the first chunk, then whole records up to the
+ * printer size
+ */
+static sysreturn
+FTRACE_FN(trace_raw, get)(struct ftrace_printer * p)
+{
+    struct ftrace_raw_record r;
+    struct rbuf_entry * entry;
+    struct rbuf * rbuf;
+    sysreturn rv = 0;
+
+    if (p->flags & TRACE_FLAG_HEADER)
+        buffer_write(printer_buffer(p), &trace_raw_header,
+            sizeof(trace_raw_header));
+
+    spin_lock(&ftrace_read_lock);
+    while ((rbuf = rbuf_next_merged(false, &entry))) {
+        if (printer_length(p) + sizeof(r) > printer_size(p)) {
+            rv = 1;             /* more to send */
+            break;
+        }
+        ftrace_raw_encode(&r, entry);
+        buffer_write(printer_buffer(p), &r, sizeof(r));
+        rbuf->local_idx++;
+        trace_raw_offset += sizeof(r);
+    }
+    spin_unlock(&ftrace_read_lock);
+
+    return rv;
+}
+
+/* The rings are walked non-destructively, so reads at increasing offsets
+ * just continue from the last record; moving back rewinds to the start.
+ * A record straddling the end of the user buffer is re-encoded by the next
+ * read.
+ */
+sysreturn
+FTRACE_FN(trace_raw, read)(file f, void * buf, u64 length, u64 offset)
+{
+    const u64 rsize = sizeof(struct ftrace_raw_record);
+    struct ftrace_raw_record r;
+    struct rbuf_entry * entry;
+    struct rbuf * rbuf;
+    u64 written = 0;
+
+    if (offset < sizeof(trace_raw_header)) {
+        written = MIN(length, sizeof(trace_raw_header) - offset);
+        runtime_memcpy(buf, (void *)&trace_raw_header + offset, written);
+        offset += written;
+    }
+
+    spin_lock(&ftrace_read_lock);
+    if (offset < trace_raw_offset) {
+        rbuf_rewind_all();
+        trace_raw_offset = sizeof(trace_raw_header);
+    }
+    while (written < length && (rbuf = rbuf_next_merged(false, &entry))) {
+        u64 skip = offset - trace_raw_offset;
+        if (skip >= rsize) {
+            /* seeked past this record */
+            rbuf->local_idx++;
+            trace_raw_offset += rsize;
+            continue;
+        }
+        u64 n = MIN(rsize - skip, length - written);
+        if (skip == 0 && n == rsize) {
+            ftrace_raw_encode(buf + written, entry);
+        } else {
+            ftrace_raw_encode(&r, entry);
+            runtime_memcpy(buf + written, (void *)&r + skip, n);
+        }
+        written += n;
+        offset += n;
+        if (skip + n < rsize)
+            break;
+        rbuf->local_idx++;
+        trace_raw_offset += rsize;
+    }
+    spin_unlock(&ftrace_read_lock);
+
+    return written;
+}
+
+sysreturn
+FTRACE_FN(trace_raw, write)(file f, void * buf, u64 length, u64 offset)
+{
+    return -EINVAL;
+}
+
+u32
+FTRACE_FN(trace_raw, events)(file f)
+{
+    return EPOLLIN;
+}
+
 /*
  * tracing_on callbacks
  */
@@ -1405,9 +1822,9 @@ FTRACE_FN(tracing_on, put)(struct ftrace_printer * p)
 
     if (old != tracing_on) {
         if (tracing_on)
-            rbuf_enable(&global_rbuf);
+            trace_enable();
         else
-            rbuf_disable(&global_rbuf);
+            trace_disable();
     }
 
     return 0;
@@ -1463,6 +1880,149 @@ FTRACE_FN(tracing_on, events)(file f)
     return EPOLLIN | EPOLLOUT;
 }
 
+/*
+ * available_events / set_event callbacks
+ *
+ * Writes to set_event take a whitespace separated list of event names to
+ * enable; a name prefixed with '!' is disabled instead, and '*' stands for
+ * all events (so "!*" disables everything). Reads list the enabled events.
+ */
+static sysreturn
+FTRACE_FN(available_events, get)(struct ftrace_printer * p)
+{
+    for (int i = 0; i < TRACEPOINT_COUNT; i++)
+        printer_write(p, "%s\n", tracepoint_names[i]);
+    return 0;
+}
+
+sysreturn
+FTRACE_FN(available_events, read)(file f, void * buf, u64 length, u64 offset)
+{
+    sysreturn ret;
+    struct ftrace_printer p;
+
+    if (printer_init(&p, TRACE_FLAG_FILE))
+        return -ENOMEM;
+
+    ret = FTRACE_FN(available_events, get)(&p);
+    if (ret != 0)
+        return ret;
+
+    ret = printer_flush_user(&p, buf, length, offset);
+    printer_deinit(&p);
+    return ret;
+}
+
+sysreturn
+FTRACE_FN(available_events, write)(file f, void * buf, u64 length, u64 offset)
+{
+    return -EINVAL;
+}
+
+u32
+FTRACE_FN(available_events, events)(file f)
+{
+    return EPOLLIN;
+}
+
+static sysreturn
+FTRACE_FN(set_event, get)(struct ftrace_printer * p)
+{
+    for (int i = 0; i < TRACEPOINT_COUNT; i++) {
+        if (tracepoint_enabled[i])
+            printer_write(p, "%s\n", tracepoint_names[i]);
+    }
+    return 0;
+}
+
+static boolean
+set_event_token(char * str, int len)
+{
+    boolean enable = true;
+    boolean found = false;
+
+    if (len > 0 && str[0] == '!') {
+        enable = false;
+        str++;
+        len--;
+    }
+    if (len == 0)
+        return false;
+
+    for (int i = 0; i < TRACEPOINT_COUNT; i++) {
+        const char * name = tracepoint_names[i];
+        if ((len == 1 && str[0] == '*') ||
+            (runtime_strlen(name) == len && runtime_memcmp(name, str, len) == 0)) {
+            tracepoint_enabled[i] = enable;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static sysreturn
+FTRACE_FN(set_event, put)(struct ftrace_printer * p)
+{
+    char * str = (char *)buffer_ref(printer_buffer(p), 0);
+    int len = printer_length(p);
+    int start = 0;
+
+    /* apply all the valid names, but fail if there were any others */
+    sysreturn rv = 0;
+    for (int i = 0; i <= len; i++) {
+        if (i < len && str[i] != ' ' && str[i] != '\t' && str[i] != '\n' &&
+            str[i] != '\0')
+            continue;
+        if (i > start && !set_event_token(str + start, i - start))
+            rv = -EINVAL;
+        start = i + 1;
+    }
+    return rv;
+}
+
+sysreturn
+FTRACE_FN(set_event, read)(file f, void * buf, u64 length, u64 offset)
+{
+    sysreturn ret;
+    struct ftrace_printer p;
+
+    if (printer_init(&p, TRACE_FLAG_FILE))
+        return -ENOMEM;
+
+    ret = FTRACE_FN(set_event, get)(&p);
+    if (ret != 0)
+        return ret;
+
+    ret = printer_flush_user(&p, buf, length, offset);
+    printer_deinit(&p);
+    return ret;
+}
+
+sysreturn
+FTRACE_FN(set_event, write)(file f, void * buf, u64 length, u64 offset)
+{
+    sysreturn ret;
+    struct ftrace_printer p;
+
+    if (printer_init(&p, TRACE_FLAG_FILE))
+        return -ENOMEM;
+
+    assert(buffer_write(printer_buffer(&p), buf, length));
+    ret = FTRACE_FN(set_event, put)(&p);
+    printer_deinit(&p);
+
+    if (ret != 0)
+        return ret;
+
+    return length;
+}
+
+u32
+FTRACE_FN(set_event, events)(file f)
+{
+    return EPOLLIN | EPOLLOUT;
+}
+
 #define _INIT(name)     FTRACE_FN(name, init)
 #define _DEINIT(name)   FTRACE_FN(name, deinit)
 #define _GET(name)      FTRACE_FN(name, get)
@@ -1492,6 +2052,12 @@ routine_list[] = {
     FTRACE_ROUTINE(
         "tracing_on", 0, 0, _GET(tracing_on), _PUT(tracing_on), 0
     ),
+    FTRACE_ROUTINE(
+        "available_events", 0, 0, _GET(available_events), 0, 0
+    ),
+    FTRACE_ROUTINE(
+        "set_event", 0, 0, _GET(set_event), _PUT(set_event), 0
+    ),
     FTRACE_ROUTINE(
         "trace", _INIT(trace), _DEINIT(trace), _GET(trace), _PUT(trace),
         &trace_printer
@@ -1499,6 +2065,10 @@ routine_list[] = {
     FTRACE_ROUTINE(
         "trace_pipe", _INIT(trace_pipe), _DEINIT(trace_pipe), _GET(trace_pipe),
         0, &trace_pipe_printer
+    ),
+    FTRACE_ROUTINE(
+        "trace_raw", _INIT(trace_raw), _DEINIT(trace_raw), _GET(trace_raw),
+        0, &trace_raw_printer
     )
 };
 #define FTRACE_NR_ROUTINES (sizeof(routine_list) / sizeof(struct ftrace_routine))
@@ -1636,7 +2206,7 @@ __ftrace_send_http_chunk_internal(struct ftrace_routine * routine, struct ftrace
         goto send_http_chunk_failed;
 
     /* XXX re-enable tracing --- ideally this would move to a completion handler */
-    rbuf_enable(&global_rbuf);
+    trace_enable();
 
     return false;
 
@@ -1656,7 +2226,7 @@ closure_function(4, 1, void, __ftrace_send_http_chunk,
     if (__ftrace_send_http_chunk_internal(bound(routine), bound(p),
             bound(local_printer), bound(out)))
     {
-        register_timer(runloop_timers, CLOCK_ID_MONOTONIC, SEND_HTTP_CHUNK_INTERVAL_MS, false, 0, (timer_handler)closure_self());
+        kern_register_timer(CLOCK_ID_MONOTONIC, SEND_HTTP_CHUNK_INTERVAL_MS, false, 0, (timer_handler)closure_self());
     } else {
         closure_finish();
     }
@@ -1696,24 +2266,29 @@ __ftrace_do_http_method(buffer_handler out, struct ftrace_routine * routine,
     printer_set_size(p, TRACE_PRINTER_MAX_SIZE);
 
     /* XXX disable any more tracing while we're spooling this out ... */
-    rbuf_disable(&global_rbuf);
+    trace_disable();
 
     /* get/put */
     if (is_put) {
-        printer_write(p, buffer_ref(put_data, 0));
+        if (put_data)
+            buffer_write(printer_buffer(p), buffer_ref(put_data, 0),
+                buffer_length(put_data));
+        push_u8(printer_buffer(p), 0);
         ret = routine->put_fn(p);
+        if (routine->deinit_fn) {
+            /* deinit without init? */
+            assert(routine->init_fn);
+            (void)routine->deinit_fn(p);
+        }
+        trace_enable();
         if (ret != 0) {
-            if (routine->deinit_fn) {
-                /* deinit without init? */
-                assert(routine->init_fn);
-                (void)routine->deinit_fn(p);
-            }
-
             if (local_printer)
-                printer_deinit(p);
-
+                deallocate_buffer(printer_buffer(p));
             goto internal_err;
         }
+
+        /* the response takes the (emptied) printer buffer */
+        buffer_clear(printer_buffer(p));
         ftrace_send_http_response(out, printer_buffer(p));
     } else {
         ftrace_send_http_chunked_response(out);
@@ -1721,7 +2296,7 @@ __ftrace_do_http_method(buffer_handler out, struct ftrace_routine * routine,
         {
             timer_handler t = closure(ftrace_heap, __ftrace_send_http_chunk, routine,
                 p, local_printer, out);
-            register_timer(runloop_timers, CLOCK_ID_MONOTONIC, SEND_HTTP_CHUNK_INTERVAL_MS, false, 0, t);
+            kern_register_timer(CLOCK_ID_MONOTONIC, SEND_HTTP_CHUNK_INTERVAL_MS, false, 0, t);
         }
     }
 
@@ -1772,11 +2347,10 @@ closure_function(0, 3, void, ftrace_http_request,
         break;
 
     case HTTP_REQUEST_METHOD_PUT:
-        /* XXX: no PUT support yet */
-        if (1 || !routine->put_fn)
+        if (!routine->put_fn)
             goto no_method;
 
-        ftrace_do_http_put(handler, routine, 0);
+        ftrace_do_http_put(handler, routine, get(val, sym(content)));
         break;
 
     no_method:
@@ -1832,7 +2406,17 @@ ftrace_init(unix_heaps uh, filesystem fs)
     if (ret != 0)
         return ret;
 
-    rbuf_init(&global_rbuf, DEFAULT_TRACE_ARRAY_SIZE_KB);
+    /* split the trace array space among the present cpus */
+    nr_rbufs = MAX(1, MIN(present_processors, MAX_CPUS));
+    for (int i = 0; i < nr_rbufs; i++) {
+        ret = rbuf_init(&cpu_rbufs[i], DEFAULT_TRACE_ARRAY_SIZE_KB / nr_rbufs);
+        if (ret != 0)
+            return ret;
+    }
+    spin_lock_init(&ftrace_read_lock);
+    lock_stats_register(&ftrace_read_lock, "ftrace_read");
+    raw_tsc_init = rdtsc();
+    raw_ns_init = nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW));
 
     /* nop tracer */
     current_tracer = &(tracer_list[0]);
@@ -1872,7 +2456,11 @@ ftrace_cpu_init(cpuinfo ci)
 NOTRACE void
 ftrace_cpu_deinit(cpuinfo ci)
 {
-    rbuf_disable(&global_rbuf);
+    struct rbuf * rbuf = current_rbuf();
+    boolean record;
+
+    trace_disable();
+    record = rbuf_enter(rbuf);
     timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
     while (ci->graph_idx > 0) {
         struct ftrace_graph_entry * stack_ent =
@@ -1880,7 +2468,8 @@ ftrace_cpu_deinit(cpuinfo ci)
         stack_ent->return_ts = t;
         if (ci->graph_idx == 0)
         stack_ent->flush = 1;
-        function_graph_trace_return(stack_ent);
+        if (record)
+            function_graph_trace_return(stack_ent);
     }
 
     deallocate(ftrace_heap, ci->graph_stack,
@@ -1890,7 +2479,9 @@ ftrace_cpu_deinit(cpuinfo ci)
     ci->graph_idx = FTRACE_THREAD_DISABLE_IDX;
     ci->graph_stack = 0;
 
-    rbuf_enable(&global_rbuf);
+    if (record)
+        rbuf_exit(rbuf);
+    trace_enable();
 }
 
 /*
@@ -1900,31 +2491,38 @@ ftrace_cpu_deinit(cpuinfo ci)
 NOTRACE void
 ftrace_thread_switch(thread out, thread in)
 {
-    if (!rbuf_enabled(&global_rbuf) ||
+    cpuinfo ci = current_cpu();
+    struct rbuf * rbuf = &cpu_rbufs[ci->id];
+    boolean record;
+
+    if (!trace_enabled() ||
         (current_tracer != &tracer_list[FTRACE_FUNCTION_GRAPH_IDX]))
     {
-        current_cpu()->graph_idx = 0;
+        ci->graph_idx = 0;
         return;
     }
 
-    rbuf_disable(&global_rbuf);
+    record = rbuf_enter(rbuf);
 
     /* complete any outstanding function calls for outgoing thread */
     timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
-    cpuinfo ci = current_cpu();
     while (ci->graph_idx > 0) {
         struct ftrace_graph_entry * stack_ent =
                 &(ci->graph_stack[--ci->graph_idx]);
         stack_ent->return_ts = t;
         if (ci->graph_idx == 0)
         stack_ent->flush = 1; //(out != in); /* just controls a printing option */
-        function_graph_trace_return(stack_ent);
+        if (record)
+            function_graph_trace_return(stack_ent);
     }
+    if (!record)
+        return;
+
     /* generate a ctx switch event */
     if (out != in)
         function_graph_trace_switch(out, in);
 
-    rbuf_enable(&global_rbuf);
+    rbuf_exit(rbuf);
 }
 
 /* defined in src/x86_64/ftrace.s */
@@ -1961,12 +2559,15 @@ prepare_ftrace_return(unsigned long self, unsigned long * parent,
     unsigned long old;
     int depth;
     cpuinfo ci = current_cpu();
+    struct rbuf * rbuf = &cpu_rbufs[ci->id];
 
-    if (!rbuf_enabled(&global_rbuf) ||
+    if (!trace_enabled() ||
         (ci->graph_idx == FTRACE_THREAD_DISABLE_IDX))
         return;
 
-    rbuf_disable(&global_rbuf);
+    /* nothing called from here on gets interposed */
+    if (!rbuf_enter(rbuf))
+        return;
 
     if (ci->graph_idx == FTRACE_RETFUNC_DEPTH) {
         /* We could just drop it, but let's yell because a call stack this long
@@ -2006,7 +2607,7 @@ prepare_ftrace_return(unsigned long self, unsigned long * parent,
         }
     }
 
-    rbuf_enable(&global_rbuf);
+    rbuf_exit(rbuf);
 }
 
 /* easier to catch with gdb when this has its own function */
@@ -2024,8 +2625,10 @@ ftrace_return_to_handler(unsigned long frame_pointer)
     struct ftrace_graph_entry * stack_ent;
     unsigned long retaddr;
     cpuinfo ci = current_cpu();
+    struct rbuf * rbuf = &cpu_rbufs[ci->id];
 
-    rbuf_disable(&global_rbuf);
+    /* the return must be unwound even if it can't be recorded */
+    boolean record = rbuf_enter(rbuf);
 
     /* restore and decrement depth */
     stack_ent = &(ci->graph_stack[--ci->graph_idx]);
@@ -2041,10 +2644,11 @@ ftrace_return_to_handler(unsigned long frame_pointer)
     /* it's possible the current tracer changed after we modified some return
      * addresses, and one of those returns is hitting now ...
      */
-    if (current_tracer == &tracer_list[FTRACE_FUNCTION_GRAPH_IDX])
-        function_graph_trace_return(stack_ent);
-
-    rbuf_enable(&global_rbuf);
+    if (record) {
+        if (current_tracer == &tracer_list[FTRACE_FUNCTION_GRAPH_IDX])
+            function_graph_trace_return(stack_ent);
+        rbuf_exit(rbuf);
+    }
     return retaddr;
 }
 
@@ -2053,6 +2657,6 @@ void
 ftrace_enable(void)
 {
     current_tracer = &(tracer_list[FTRACE_FUNCTION_GRAPH_IDX]);
-    rbuf_enable(&global_rbuf);
+    trace_enable();
     tracing_on = true;
 }
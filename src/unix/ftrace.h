@@ -62,16 +62,22 @@ ftrace_close_nop(file f)
     FTRACE_SPECIAL_FILE(current_tracer),\
     FTRACE_SPECIAL_FILE(trace_clock),\
     FTRACE_SPECIAL_FILE(tracing_on),\
+    FTRACE_SPECIAL_FILE(available_events),\
+    FTRACE_SPECIAL_FILE(set_event),\
     /* files with open/close callbacks */\
     FTRACE_SPECIAL_FILE_OC(trace),\
-    FTRACE_SPECIAL_FILE_OC(trace_pipe)\
+    FTRACE_SPECIAL_FILE_OC(trace_pipe),\
+    FTRACE_SPECIAL_FILE_OC(trace_raw)\
 
 FTRACE_SPECIAL_PROTOTYPES(available_tracers);
 FTRACE_SPECIAL_PROTOTYPES(current_tracer);
 FTRACE_SPECIAL_PROTOTYPES(trace_clock);
 FTRACE_SPECIAL_PROTOTYPES(trace_pipe);
 FTRACE_SPECIAL_PROTOTYPES(trace);
+FTRACE_SPECIAL_PROTOTYPES(trace_raw);
 FTRACE_SPECIAL_PROTOTYPES(tracing_on);
+FTRACE_SPECIAL_PROTOTYPES(available_events);
+FTRACE_SPECIAL_PROTOTYPES(set_event);
 
 int ftrace_init(unix_heaps uh, filesystem fs);
 void ftrace_deinit(void);
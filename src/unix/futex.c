@@ -1,49 +1,168 @@
 #include <unix_internal.h>
 
+/* Futexes live in a fixed-size, per-process hash table with a lock per
+   bucket. A futex only exists while it has users (its waiters, and the
+   operations in progress on it), so that waking an address nobody waits on
+   costs a single bucket lookup and the table never grows. */
+#define FUTEX_HASH_BITS 8
+
+struct futex_bucket {
+    struct spinlock lock;
+    struct list futexes;
+};
+
+declare_closure_struct(1, 0, void, futex_reclaim,
+                       struct futex *, f);
+
 struct futex {
-    heap h;
+    struct list l;
+    u64 key;
+    struct futex_bucket *b;
+    u64 users;
+    boolean reclaiming;
+    blockq bq;
+    struct list waiters;    /* in blockq order */
+    closure_struct(futex_reclaim, reclaim);
+};
+
+declare_closure_struct(1, 1, sysreturn, futex_bh,
+                       struct futex_waiter *, w,
+                       u64, flags);
+
+/* Follows its blockq item when requeued. A PI waiter is handed the lock
+   when woken; a waiter that belongs to a futex_waitv group is a proxy for
+   its thread, which blocks on its own blockq. */
+struct futex_waiter {
+    struct list l;
+    struct futex *f;
+    thread t;
+    boolean blocked;
+    boolean pi;
+    boolean requeue_pi;
+    boolean owner;      /* PI lock handed to this waiter */
+    timestamp timeout;
+    struct futex_waitv_group *group;
+    int index;
+    struct list gl;
+    closure_struct(futex_bh, bh);
+};
+
+declare_closure_struct(1, 1, sysreturn, futex_waitv_bh,
+                       struct futex_waitv_group *, g,
+                       u64, flags);
+declare_closure_struct(1, 0, void, futex_waitv_wake,
+                       struct futex_waitv_group *, g);
+
+struct futex_waitv_group {
+    thread t;
     blockq bq;
+    int woken;
+    boolean timeout;
+    u64 refcount;       /* the waiting thread, proxies and a pending wake */
+    struct list waiters;
+    closure_struct(futex_waitv_bh, bh);
+    closure_struct(futex_waitv_wake, wake);
 };
 
-static u64 futex_key_function(void *x)
+static struct futex_bucket *futex_bucket(process p, u64 key)
 {
-    return u64_from_pointer(x);
+    return &p->futices[(key * 0x9e3779b97f4a7c15ull) >> (64 - FUTEX_HASH_BITS)];
 }
 
-static boolean futex_key_equal(void *a, void *b)
+static void futex_free(struct futex *f)
 {
-    return a == b;
+    deallocate_blockq(f->bq);
+    deallocate(heap_general(get_kernel_heaps()), f, sizeof(struct futex));
 }
 
-static struct futex * soft_create_futex(process p, u64 key)
+define_closure_function(1, 0, void, futex_reclaim,
+                        struct futex *, f)
 {
-    heap h = heap_general(get_kernel_heaps());
-    struct futex * f;
-
-    // XXX make this all atomic wrt p->futices
-
-    f = table_find(p->futices, pointer_from_u64(key));
-    if (f)
-        return f;
+    struct futex *f = bound(f);
+    u64 flags = spin_lock_irq(&f->b->lock);
+    f->reclaiming = false;
+    boolean release = (f->users == 0);
+    if (release)
+        list_delete(&f->l);
+    spin_unlock_irq(&f->b->lock, flags);
+    if (release)
+        futex_free(f);
+}
 
-    f = allocate(h, sizeof(struct futex));
+/* called with the bucket lock held */
+static struct futex *futex_create(struct futex_bucket *b, u64 key)
+{
+    heap h = heap_general(get_kernel_heaps());
+    struct futex *f = allocate(h, sizeof(struct futex));
     if (f == INVALID_ADDRESS) {
         msg_err("failed to allocate futex\n");
         return f;
     }
-
-    f->h = h;
-    f->bq = allocate_blockq(f->h, "futex");
+    f->bq = allocate_blockq(h, "futex");
     if (f->bq == INVALID_ADDRESS) {
         msg_err("failed to allocate futex blockq\n");
-        deallocate(f->h, f, sizeof(struct futex));
+        deallocate(h, f, sizeof(struct futex));
         return INVALID_ADDRESS;
     }
+    f->key = key;
+    f->b = b;
+    f->users = 0;
+    f->reclaiming = false;
+    list_init(&f->waiters);
+    init_closure(&f->reclaim, futex_reclaim, f);
+    list_push_back(&b->futexes, &f->l);
+    return f;
+}
 
-    table_set(p->futices, pointer_from_u64(key), f);
+/* Returns the futex for key with a user reference held, 0 if there is none
+   and create is false, or INVALID_ADDRESS if it can't be created. */
+static struct futex *futex_get(process p, u64 key, boolean create)
+{
+    struct futex_bucket *b = futex_bucket(p, key);
+    struct futex *f = 0;
+    u64 flags = spin_lock_irq(&b->lock);
+    list_foreach(&b->futexes, l) {
+        struct futex *e = struct_from_list(l, struct futex *, l);
+        if (e->key == key) {
+            f = e;
+            break;
+        }
+    }
+    if (!f && create)
+        f = futex_create(b, key);
+    if (f && (f != INVALID_ADDRESS))
+        f->users++;
+    spin_unlock_irq(&b->lock, flags);
     return f;
 }
 
+/* The last user frees the futex, unless it is a waiter leaving from within a
+   blockq action: the blockq is still in use then, and the futex is reclaimed
+   from the runqueue. */
+static void futex_put(struct futex *f, boolean deferred)
+{
+    boolean release = false;
+    boolean reclaim = false;
+    u64 flags = spin_lock_irq(&f->b->lock);
+    if ((--f->users == 0) && !f->reclaiming) {
+        if (deferred) {
+            reclaim = f->reclaiming = true;
+        } else {
+            release = true;
+            list_delete(&f->l);
+        }
+    }
+    spin_unlock_irq(&f->b->lock, flags);
+    if (release) {
+        futex_free(f);
+    } else if (reclaim && !runqueue_push((thunk)&f->reclaim)) {
+        /* leave it to the next user */
+        flags = spin_lock_irq(&f->b->lock);
+        f->reclaiming = false;
+        spin_unlock_irq(&f->b->lock, flags);
+    }
+}
+
 static thread futex_wake_one(struct futex * f)
 {
     thread w;
@@ -74,18 +193,82 @@ static int futex_wake_many(struct futex * f, int val)
     return nr_woken;
 }
 
-boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
+/* wake up to 'val' waiters on key, if it has any */
+static int futex_wake_key(process p, u64 key, int val)
 {
-    struct futex * f;
+    struct futex *f = futex_get(p, key, false);
+    if (!f)
+        return 0;
+    int woken = futex_wake_many(f, val);
+    futex_put(f, false);
+    return woken;
+}
 
-    f = table_find(p->futices, (void *)uaddr);
+boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
+{
+    struct futex *f = futex_get(p, u64_from_pointer(uaddr), false);
     if (!f)
         return false;
 
     futex_wake_many(f, val);
+    futex_put(f, false);
     return true;
 }
 
+/* Move up to n waiters from one futex to another, along with their blockq
+   items; the caller holds a user reference on both futexes. */
+static int futex_requeue(struct futex *from, struct futex *to, int n, boolean pi)
+{
+    struct futex_bucket *b1 = from->b, *b2 = to->b;
+    if (b1 > b2) {
+        b1 = to->b;
+        b2 = from->b;
+    }
+    u64 flags = spin_lock_irq(&b1->lock);
+    if (b2 != b1)
+        spin_lock(&b2->lock);
+    int moved = 0;
+    list_foreach(&from->waiters, l) {
+        if ((moved >= n) || (from == to))
+            break;
+        struct futex_waiter *w = struct_from_list(l, struct futex_waiter *, l);
+        list_delete(&w->l);
+        list_push_back(&to->waiters, &w->l);
+        w->f = to;
+        if (pi)
+            w->pi = true;
+        moved++;
+    }
+    from->users -= moved;
+    to->users += moved;
+    if (b2 != b1)
+        spin_unlock(&b2->lock);
+    spin_unlock_irq(&b1->lock, flags);
+    if (moved)
+        blockq_transfer_waiters(to->bq, from->bq, moved);
+    return moved;
+}
+
+static void futex_waitv_put(struct futex_waitv_group *g)
+{
+    if (fetch_and_add(&g->refcount, -1) == 1) {
+        thread_release(g->t);
+        deallocate(heap_general(get_kernel_heaps()), g, sizeof(*g));
+    }
+}
+
+/* nullify the proxies still queued, then drop the thread's reference */
+static void futex_waitv_finish(struct futex_waitv_group *g)
+{
+    while (!list_empty(&g->waiters)) {
+        struct futex_waiter *w = struct_from_list(list_get_next(&g->waiters),
+                                                  struct futex_waiter *, gl);
+        if (!blockq_flush_thread(w->f->bq, g->t))
+            break;
+    }
+    futex_waitv_put(g);
+}
+
 /*
  * futex_bh is invoked either by the bh processor in response
  * to timeout/signal delivery/etc., or by another thread in sys_futex
@@ -96,34 +279,411 @@ boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
  *  -EINTR: if we're being nullified
  *  0: thread woken up
  */
-closure_function(4, 1, sysreturn, futex_bh,
-                 struct futex *, f, thread, t, boolean, blocked, timestamp, timeout,
-                 u64, flags)
+define_closure_function(1, 1, sysreturn, futex_bh,
+                        struct futex_waiter *, w,
+                        u64, flags)
 {
-    thread t = bound(t);
+    struct futex_waiter *w = bound(w);
+    thread t = w->t;
     sysreturn rv;
 
     if (flags & BLOCKQ_ACTION_NULLIFY)
-        rv = bound(timeout) ? -EINTR : -ERESTARTSYS;
+        rv = w->timeout ? -EINTR : -ERESTARTSYS;
     else if (flags & BLOCKQ_ACTION_TIMEDOUT)
         rv = -ETIMEDOUT;
-    else if (!bound(blocked)) {
-        thread_log(t, "%s: struct futex: %p, blocking", __func__, bound(f));
-        bound(blocked) = true;
+    else if (!w->blocked) {
+        /* a PI lock released before this waiter could block is taken
+           directly, and futex_queue cleans up */
+        if (w->pi && !w->owner) {
+            u32 *uaddr = pointer_from_u64(w->f->key);
+            u32 val = *(volatile u32 *)uaddr;
+            if (!(val & FUTEX_TID_MASK) && compare_and_swap_32(uaddr, val, val | t->tid))
+                w->owner = true;
+        }
+        if (w->owner)
+            return 0;
+        thread_log(t, "%s: struct futex: %p, blocking", __func__, w->f);
+        w->blocked = true;
         return BLOCKQ_BLOCK_REQUIRED;
     } else
         rv = 0; /* no timer expire + not us --> actual wakeup */
 
-    thread_log(t, "%s: struct futex: %p, flags 0x%lx, rv %ld", __func__, bound(f), flags, rv);
-    closure_finish();
+    struct futex *f = w->f;
+    struct futex_waitv_group *g = w->group;
+    thread_log(t, "%s: struct futex: %p, flags 0x%lx, rv %ld", __func__, f, flags, rv);
+    u64 irqflags = spin_lock_irq(&f->b->lock);
+    list_delete(&w->l);
+    spin_unlock_irq(&f->b->lock, irqflags);
+    boolean wake = false;
+    if (g) {
+        list_delete(&w->gl);
+        if ((rv == 0) && (g->woken < 0)) {
+            g->woken = w->index;
+            wake = true;
+        }
+    }
+    deallocate(heap_general(get_kernel_heaps()), w, sizeof(*w));
+    futex_put(f, true);
+    if (!g)
+        return syscall_return(t, rv);
+
+    /* The group is completed from the runqueue: completing it here would
+       flush the other proxies, possibly from this very blockq. */
+    if (wake) {
+        thunk th = (thunk)&g->wake;
+        fetch_and_add(&g->refcount, 1);
+        if (!runqueue_push(th))
+            apply(th);
+    }
+    futex_waitv_put(g);
+    return rv;
+}
+
+/* Queues a waiter for t on f. If uaddr is given, the waiter is only queued
+   if it still holds val, compared in the same bucket lock section, and 0 is
+   returned otherwise. */
+static struct futex_waiter *futex_waiter_add(struct futex *f, thread t, timestamp ts,
+                                             int *uaddr, int val)
+{
+    struct futex_waiter *w = allocate(heap_general(get_kernel_heaps()), sizeof(*w));
+    if (w == INVALID_ADDRESS)
+        return w;
+    w->f = f;
+    w->t = t;
+    w->blocked = false;
+    w->pi = w->requeue_pi = w->owner = false;
+    w->timeout = ts;
+    w->group = 0;
+    init_closure(&w->bh, futex_bh, w);
+    u64 flags = spin_lock_irq(&f->b->lock);
+    if (uaddr && (*(volatile int *)uaddr != val)) {
+        spin_unlock_irq(&f->b->lock, flags);
+        deallocate(heap_general(get_kernel_heaps()), w, sizeof(*w));
+        return 0;
+    }
+    list_push_back(&f->waiters, &w->l);
+    spin_unlock_irq(&f->b->lock, flags);
+    return w;
+}
+
+static void futex_waiter_remove(struct futex_waiter *w)
+{
+    struct futex *f = w->f;
+    u64 flags = spin_lock_irq(&f->b->lock);
+    list_delete(&w->l);
+    spin_unlock_irq(&f->b->lock, flags);
+    deallocate(heap_general(get_kernel_heaps()), w, sizeof(*w));
+}
+
+/* Blocks the current thread on f, whose user reference passes to the
+   waiter, as long as uaddr (if given) holds val; only returns if the waiter
+   could not be queued. */
+static sysreturn futex_queue(struct futex *f, int *uaddr, int val, boolean pi,
+                             boolean requeue_pi, clock_id clkid, timestamp ts, boolean absolute)
+{
+    struct futex_waiter *w = futex_waiter_add(f, current, ts, uaddr, val);
+    if (w == INVALID_ADDRESS || !w) {
+        futex_put(f, false);
+        return set_syscall_error(current, w ? ENOMEM : EAGAIN);
+    }
+    w->pi = pi;
+    w->requeue_pi = requeue_pi;
+
+    // if we resume we are woken up
+    set_syscall_return(current, 0);
+
+    sysreturn rv = blockq_check_timeout(f->bq, current, (blockq_action)&w->bh,
+                                        false, clkid, ts, absolute);
+    futex_waiter_remove(w);
+    futex_put(f, false);
+    return rv;
+}
+
+static sysreturn futex_wait(int *uaddr, int val, clock_id clkid, timestamp ts,
+                            boolean absolute, boolean requeue_pi)
+{
+    /* fault the word in here; it is compared under the bucket lock */
+    (void)*(volatile int *)uaddr;
+
+    struct futex *f = futex_get(current->p, u64_from_pointer(uaddr), true);
+    if (f == INVALID_ADDRESS)
+        return set_syscall_error(current, ENOMEM);
+    return futex_queue(f, uaddr, val, false, requeue_pi, clkid, ts, absolute);
+}
+
+/* The first PI waiter of f, which is next in line for the lock; more is set
+   if there are other waiters. Called with the bucket lock held. */
+static struct futex_waiter *futex_pi_next(struct futex *f, boolean *more)
+{
+    struct futex_waiter *next = 0;
+    *more = false;
+    list_foreach(&f->waiters, l) {
+        struct futex_waiter *w = struct_from_list(l, struct futex_waiter *, l);
+        if (next) {
+            *more = true;
+            break;
+        }
+        if (w->pi)
+            next = w;
+        else
+            *more = true;
+    }
+    return next;
+}
+
+/* The lock word holds the owner's TID. There are no thread priorities to
+   boost here, so ownership is handed over to waiters in FIFO order. */
+static sysreturn futex_lock_pi(u32 *uaddr, boolean try, timestamp ts)
+{
+    process p = current->p;
+    u32 tid = current->tid;
+    struct futex *f = futex_get(p, u64_from_pointer(uaddr), !try);
+    if (f == INVALID_ADDRESS)
+        return set_syscall_error(current, ENOMEM);
+    sysreturn rv;
+    while (true) {
+        u32 val = *(volatile u32 *)uaddr;
+        u32 owner = val & FUTEX_TID_MASK;
+        if (owner == tid) {
+            rv = -EDEADLK;
+            break;
+        }
+        boolean dead = owner && (thread_from_tid(p, owner) == INVALID_ADDRESS);
+        if (!owner || (dead && (val & FUTEX_OWNER_DIED))) {
+            if (compare_and_swap_32(uaddr, val,
+                                    tid | (val & (FUTEX_OWNER_DIED | FUTEX_WAITERS)))) {
+                rv = 0;
+                break;
+            }
+            continue;
+        }
+        if (dead) {
+            rv = -ESRCH;
+            break;
+        }
+        if (try) {
+            rv = -EAGAIN;
+            break;
+        }
+        if (!(val & FUTEX_WAITERS) && !compare_and_swap_32(uaddr, val, val | FUTEX_WAITERS))
+            continue;
+        return futex_queue(f, 0, 0, true, false, CLOCK_ID_REALTIME, ts, true);
+    }
+    if (f)
+        futex_put(f, false);
+    return set_syscall_return(current, rv);
+}
+
+/* Releases a PI lock owned by tid, handing it to the next waiter if any;
+   extra (FUTEX_OWNER_DIED) is added to the new lock word. */
+static sysreturn futex_pi_release(process p, u32 *uaddr, u32 tid, u32 extra)
+{
+    struct futex *f = futex_get(p, u64_from_pointer(uaddr), false);
+    if (f == INVALID_ADDRESS)
+        f = 0;
+
+    /* the bucket lock keeps new waiters from missing the release */
+    u64 flags = f ? spin_lock_irq(&f->b->lock) : 0;
+    boolean more = false;
+    struct futex_waiter *next = f ? futex_pi_next(f, &more) : 0;
+    thread t = next ? next->t : 0;
+    u32 newval = t ? (t->tid | (more ? FUTEX_WAITERS : 0) | extra) : extra;
+    sysreturn rv = 0;
+    while (true) {
+        u32 val = *(volatile u32 *)uaddr;
+        if ((val & FUTEX_TID_MASK) != tid) {
+            rv = -EPERM;
+            t = 0;
+            break;
+        }
+        if (compare_and_swap_32(uaddr, val, newval)) {
+            if (next)
+                next->owner = true;
+            break;
+        }
+    }
+    if (f) {
+        spin_unlock_irq(&f->b->lock, flags);
+        if (t)
+            blockq_wake_one_for_thread(f->bq, t);
+        futex_put(f, false);
+    }
+    return rv;
+}
+
+/* Wakes the first waiter on uaddr by taking the PI lock at uaddr2 for it, if
+   the lock is free, and moves up to nr_requeue other waiters to uaddr2. */
+static sysreturn futex_cmp_requeue_pi(u32 *uaddr, u32 *uaddr2, int nr_requeue)
+{
+    process p = current->p;
+    struct futex *f = futex_get(p, u64_from_pointer(uaddr), false);
+    if (!f)
+        return 0;
+    struct futex *f2 = futex_get(p, u64_from_pointer(uaddr2), true);
+    if (f2 == INVALID_ADDRESS) {
+        futex_put(f, false);
+        return -ENOMEM;
+    }
+    int woken = 0;
+    thread top = 0;
+    boolean more = false;
+    u64 flags = spin_lock_irq(&f->b->lock);
+    if (!list_empty(&f->waiters)) {
+        struct futex_waiter *w = struct_from_list(list_get_next(&f->waiters),
+                                                  struct futex_waiter *, l);
+        if (w->requeue_pi)
+            top = w->t;
+        more = (w->l.next != &f->waiters) || !list_empty(&f2->waiters);
+    }
+    spin_unlock_irq(&f->b->lock, flags);
+    if (top) {
+        u32 val = *(volatile u32 *)uaddr2;
+        if (!(val & FUTEX_TID_MASK) &&
+            compare_and_swap_32(uaddr2, val, top->tid | (val & FUTEX_OWNER_DIED) |
+                                (more ? FUTEX_WAITERS : 0))) {
+            blockq_wake_one_for_thread(f->bq, top);
+            woken = 1;
+        }
+    }
+    int requeued = 0;
+    if ((nr_requeue > 0) && !list_empty(&f->waiters)) {
+        u32 val;
+        do {
+            val = *(volatile u32 *)uaddr2;
+        } while (!(val & FUTEX_WAITERS) &&
+                 !compare_and_swap_32(uaddr2, val, val | FUTEX_WAITERS));
+        requeued = futex_requeue(f, f2, nr_requeue, true);
+    }
+    futex_put(f2, false);
+    futex_put(f, false);
+    return woken + requeued;
+}
+
+define_closure_function(1, 0, void, futex_waitv_wake,
+                        struct futex_waitv_group *, g)
+{
+    struct futex_waitv_group *g = bound(g);
+    blockq_wake_one_for_thread(g->bq, g->t);
+    futex_waitv_put(g);
+}
+
+define_closure_function(1, 1, sysreturn, futex_waitv_bh,
+                        struct futex_waitv_group *, g,
+                        u64, flags)
+{
+    struct futex_waitv_group *g = bound(g);
+    thread t = g->t;
+    sysreturn rv;
+
+    if (flags & BLOCKQ_ACTION_NULLIFY)
+        rv = g->timeout ? -EINTR : -ERESTARTSYS;
+    else if (flags & BLOCKQ_ACTION_TIMEDOUT)
+        rv = -ETIMEDOUT;
+    else if (g->woken < 0)
+        return BLOCKQ_BLOCK_REQUIRED;
+    else
+        rv = g->woken;
+    thread_log(t, "%s: flags 0x%lx, rv %ld", __func__, flags, rv);
+    futex_waitv_finish(g);
     return syscall_return(t, rv);
 }
 
+sysreturn futex_waitv(struct futex_waitv *waiters, unsigned int nr_futexes, unsigned int flags,
+                      struct timespec *timeout, clockid_t clockid)
+{
+    if (flags || (nr_futexes == 0) || (nr_futexes > FUTEX_WAITV_MAX))
+        return -EINVAL;
+    if (!validate_user_memory(waiters, sizeof(*waiters) * nr_futexes, false))
+        return -EFAULT;
+    timestamp ts = 0;
+    clock_id clkid = CLOCK_ID_MONOTONIC;
+    if (timeout) {
+        if (!validate_user_memory(timeout, sizeof(*timeout), false))
+            return -EFAULT;
+        if (clockid == CLOCK_REALTIME)
+            clkid = CLOCK_ID_REALTIME;
+        else if (clockid != CLOCK_MONOTONIC)
+            return -EINVAL;
+        ts = time_from_timespec(timeout);
+    }
+    for (unsigned int i = 0; i < nr_futexes; i++) {
+        struct futex_waitv *fw = &waiters[i];
+        if ((fw->flags & ~(FUTEX2_SIZE_MASK | FUTEX2_PRIVATE)) ||
+            ((fw->flags & FUTEX2_SIZE_MASK) != FUTEX2_SIZE_U32) || fw->__reserved ||
+            (fw->uaddr & (sizeof(u32) - 1)))
+            return -EINVAL;
+        if (!validate_user_memory(pointer_from_u64(fw->uaddr), sizeof(u32), false))
+            return -EFAULT;
+    }
+
+    heap h = heap_general(get_kernel_heaps());
+    struct futex_waitv_group *g = allocate(h, sizeof(*g));
+    if (g == INVALID_ADDRESS)
+        return -ENOMEM;
+    thread_reserve(current);
+    g->t = current;
+    g->bq = current->thread_bq;
+    g->woken = -1;
+    g->timeout = timeout != 0;
+    g->refcount = 1;
+    list_init(&g->waiters);
+    init_closure(&g->wake, futex_waitv_wake, g);
+
+    /* queue a proxy on each futex, as long as each still holds its value */
+    sysreturn rv = 0;
+    for (unsigned int i = 0; (i < nr_futexes) && (rv == 0); i++) {
+        u32 *uaddr = pointer_from_u64(waiters[i].uaddr);
+        if (*(volatile u32 *)uaddr != (u32)waiters[i].val) {
+            rv = -EAGAIN;
+            break;
+        }
+        struct futex *f = futex_get(current->p, u64_from_pointer(uaddr), true);
+        if (f == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            break;
+        }
+        struct futex_waiter *w = futex_waiter_add(f, current, 0, 0, 0);
+        if (w == INVALID_ADDRESS) {
+            futex_put(f, false);
+            rv = -ENOMEM;
+            break;
+        }
+        w->group = g;
+        w->index = i;
+        list_push_back(&g->waiters, &w->gl);
+        fetch_and_add(&g->refcount, 1);
+        if (blockq_check(f->bq, current, (blockq_action)&w->bh, true) != BLOCKQ_BLOCK_REQUIRED) {
+            list_delete(&w->gl);
+            fetch_and_add(&g->refcount, -1);
+            futex_waiter_remove(w);
+            futex_put(f, false);
+            rv = -ENOMEM;
+        }
+    }
+    if (rv) {
+        futex_waitv_finish(g);
+        return rv;
+    }
+    if (g->woken >= 0) {
+        rv = g->woken;
+        futex_waitv_finish(g);
+        return rv;
+    }
+    rv = blockq_check_timeout(g->bq, current, init_closure(&g->bh, futex_waitv_bh, g),
+                              false, clkid, ts, true);
+
+    /* only reached if the thread could not be queued */
+    futex_waitv_finish(g);
+    return rv;
+}
+
 static timestamp get_timeout_timestamp(int futex_op, u64 val2)
 {
     switch (futex_op) {
     case FUTEX_WAIT:
     case FUTEX_WAIT_BITSET:
+    case FUTEX_LOCK_PI:
+    case FUTEX_WAIT_REQUEUE_PI:
         return (val2) 
             ? time_from_timespec((struct timespec *)pointer_from_u64(val2)) 
             : 0;
@@ -137,17 +697,12 @@ static boolean futex_verbose;
 sysreturn futex(int *uaddr, int futex_op, int val,
                 u64 val2, int *uaddr2, int val3)
 {
-    struct futex * f;
     timestamp ts;
     int op;
 
     if (!validate_user_memory(uaddr, sizeof(int), false))
         return set_syscall_error(current, EFAULT);
 
-    f = soft_create_futex(current->p, u64_from_pointer(uaddr));
-    if (f == INVALID_ADDRESS)
-        return set_syscall_error(current, ENOMEM);
-    
     op = futex_op & 127; // chuck the private bit
     ts = get_timeout_timestamp(op, val2);
     clock_id clkid = (futex_op & FUTEX_CLOCK_REALTIME) ? CLOCK_ID_REALTIME :
@@ -159,22 +714,15 @@ sysreturn futex(int *uaddr, int futex_op, int val,
             thread_log(current, "futex_wait [%ld %p %d] %d 0x%ld",
                 current->tid, uaddr, *uaddr, val, val2);
 
-        if (*uaddr != val)
-            return set_syscall_error(current, EAGAIN);
-
-        // if we resume we are woken up
-        set_syscall_return(current, 0);
-
-        return blockq_check_timeout(f->bq, current, 
-                                    closure(f->h, futex_bh, f, current, false, ts),
-                                    false, clkid, ts, false);
+        return futex_wait(uaddr, val, clkid, ts, false, false);
     }
 
     case FUTEX_WAKE: {
         if (futex_verbose)
             thread_log(current, "futex_wake [%ld %p %d] %d",
                 current->tid, uaddr, *uaddr, val);
-        return set_syscall_return(current, futex_wake_many(f, val));
+        return set_syscall_return(current,
+                                  futex_wake_key(current->p, u64_from_pointer(uaddr), val));
     }
 
     case FUTEX_CMP_REQUEUE: {
@@ -190,17 +738,24 @@ sysreturn futex(int *uaddr, int futex_op, int val,
         if (*uaddr != val3)
             return set_syscall_error(current, EAGAIN);
 
+        struct futex *f = futex_get(current->p, u64_from_pointer(uaddr), false);
+        if (!f)
+            return set_syscall_return(current, 0);
         woken = futex_wake_many(f, val);
 
         requeued = 0;
-        if (val2 > 0) {
-            struct futex * new = soft_create_futex(current->p, u64_from_pointer(uaddr2));
-            if (new == INVALID_ADDRESS)
+        if ((val2 > 0) && !list_empty(&f->waiters)) {
+            struct futex * new = futex_get(current->p, u64_from_pointer(uaddr2), true);
+            if (new == INVALID_ADDRESS) {
+                futex_put(f, false);
                 return set_syscall_error(current, ENOMEM);
-            int requeued = blockq_transfer_waiters(new->bq, f->bq, val2);
+            }
+            requeued = futex_requeue(f, new, MIN(val2, S32_MAX), false);
+            futex_put(new, false);
             if (futex_verbose)
                 thread_log(current, " awoken: %d, re-queued %d", woken, requeued);
         }
+        futex_put(f, false);
 
         return set_syscall_return(current, woken + requeued);
     }
@@ -230,7 +785,7 @@ sysreturn futex(int *uaddr, int futex_op, int val,
         case FUTEX_OP_XOR:   *uaddr2 ^= oparg; break;
         }
 
-        wake1 = futex_wake_many(f, val);
+        wake1 = futex_wake_key(current->p, u64_from_pointer(uaddr), val);
         
         c = 0;
         switch (cmp) {
@@ -243,14 +798,8 @@ sysreturn futex(int *uaddr, int futex_op, int val,
         }
         
         wake2 = 0;
-        if (c) {
-            struct futex * f2 = 
-                soft_create_futex(current->p, u64_from_pointer(uaddr2));
-            if (f2 == INVALID_ADDRESS)
-                return set_syscall_error(current, ENOMEM);
-
-            wake2 = futex_wake_many(f2, val2);
-        }
+        if (c)
+            wake2 = futex_wake_key(current->p, u64_from_pointer(uaddr2), val2);
 
         return set_syscall_return(current, wake1 + wake2);
     }
@@ -260,22 +809,54 @@ sysreturn futex(int *uaddr, int futex_op, int val,
             thread_log(current, "futex_wait_bitset [%ld %p %d] %d 0x%ld %d",
                 current->tid, uaddr, *uaddr, val, val2, val3);
 
-        if (*uaddr != val)
-            return set_syscall_error(current, EAGAIN);
-
-        set_syscall_return(current, 0);
-        return blockq_check_timeout(f->bq, current, 
-                                    closure(f->h, futex_bh, f, current, false, ts),
-                                    false, clkid, ts, true);
+        return futex_wait(uaddr, val, clkid, ts, true, false);
     }
 
     case FUTEX_REQUEUE: rprintf("futex_requeue not implemented\n"); break;
     case FUTEX_WAKE_BITSET: rprintf("futex_wake_bitset not implemented\n"); break;
-    case FUTEX_LOCK_PI: rprintf("futex_lock_pi not implemented\n"); break;
-    case FUTEX_TRYLOCK_PI: rprintf("futex_trylock_pi not implemented\n"); break;
-    case FUTEX_UNLOCK_PI: rprintf("futex_unlock_pi not implemented\n"); break;
-    case FUTEX_CMP_REQUEUE_PI: rprintf("futex_cmp_requeue_pi not implemented\n"); break;
-    case FUTEX_WAIT_REQUEUE_PI: rprintf("futex_wait_requeue_pi not implemented\n"); break;
+    case FUTEX_LOCK_PI:
+    case FUTEX_TRYLOCK_PI: {
+        if (futex_verbose)
+            thread_log(current, "futex_lock_pi [%ld %p %d] try %d",
+                current->tid, uaddr, *uaddr, op == FUTEX_TRYLOCK_PI);
+        if (!validate_user_memory(uaddr, sizeof(u32), true))
+            return set_syscall_error(current, EFAULT);
+        return futex_lock_pi((u32 *)uaddr, op == FUTEX_TRYLOCK_PI, ts);
+    }
+
+    case FUTEX_UNLOCK_PI: {
+        if (futex_verbose)
+            thread_log(current, "futex_unlock_pi [%ld %p %d]",
+                current->tid, uaddr, *uaddr);
+        if (!validate_user_memory(uaddr, sizeof(u32), true))
+            return set_syscall_error(current, EFAULT);
+        return set_syscall_return(current, futex_pi_release(current->p, (u32 *)uaddr,
+                                                            current->tid, 0));
+    }
+
+    case FUTEX_WAIT_REQUEUE_PI: {
+        if (futex_verbose)
+            thread_log(current, "futex_wait_requeue_pi [%ld %p %d] %d 0x%ld %p",
+                current->tid, uaddr, *uaddr, val, val2, uaddr2);
+        if (uaddr == uaddr2)
+            return set_syscall_error(current, EINVAL);
+        return futex_wait(uaddr, val, clkid, ts, true, true);
+    }
+
+    case FUTEX_CMP_REQUEUE_PI: {
+        if (futex_verbose)
+            thread_log(current, "futex_cmp_requeue_pi [%ld %p %d] %p %d",
+                current->tid, uaddr, *uaddr, uaddr2, val3);
+        if ((val != 1) || (uaddr == uaddr2))
+            return set_syscall_error(current, EINVAL);
+        if (!validate_user_memory(uaddr2, sizeof(u32), true))
+            return set_syscall_error(current, EFAULT);
+        if (*uaddr != val3)
+            return set_syscall_error(current, EAGAIN);
+        return set_syscall_return(current, futex_cmp_requeue_pi((u32 *)uaddr, (u32 *)uaddr2,
+                                                                MIN(val2, S32_MAX)));
+    }
+
     default: rprintf("futex op %d not implemented\n", op); break;
     }
 
@@ -293,15 +874,18 @@ void
 init_futices(process p)
 {
     heap h = heap_general(&p->uh->kh);
-    p->futices = allocate_table(h, futex_key_function, futex_key_equal);
+    p->futices = allocate(h, sizeof(struct futex_bucket) * U64_FROM_BIT(FUTEX_HASH_BITS));
     if (p->futices == INVALID_ADDRESS)
         halt("failed to allocate futex table\n");
+    for (int i = 0; i < U64_FROM_BIT(FUTEX_HASH_BITS); i++) {
+        spin_lock_init(&p->futices[i].lock);
+        list_init(&p->futices[i].futexes);
+    }
     register_root_notify(sym(futex_trace), closure(h, futex_trace_notify));
 }
 
 /* robust mutex handling */
 
-#define FUTEX_OWNER_DIED	0x40000000
 #define FUTEX_KEY_ADDR(x, o)    ((int *)((u8 *)(x) + (o)))
 
 typedef struct robust_list {
@@ -314,7 +898,28 @@ typedef struct robust_list_head {
     void *list_op_pending;
 } *robust_list_head;
 
-void wake_robust_list(process p, void *head)
+/* A PI lock owned by the dying thread goes straight to its next waiter;
+   other robust futexes wake one waiter to observe FUTEX_OWNER_DIED. */
+static void robust_futex_release(process p, u32 tid, int *uaddr)
+{
+    u32 val = *(volatile u32 *)uaddr;
+    if (((val & FUTEX_TID_MASK) == tid) && (val & FUTEX_WAITERS)) {
+        struct futex *f = futex_get(p, u64_from_pointer(uaddr), false);
+        if (f && (f != INVALID_ADDRESS)) {
+            boolean more;
+            u64 flags = spin_lock_irq(&f->b->lock);
+            boolean pi = futex_pi_next(f, &more) != 0;
+            spin_unlock_irq(&f->b->lock, flags);
+            futex_put(f, false);
+            if (pi && (futex_pi_release(p, (u32 *)uaddr, tid, FUTEX_OWNER_DIED) == 0))
+                return;
+        }
+    }
+    *uaddr |= FUTEX_OWNER_DIED;
+    futex_wake_many_by_uaddr(p, uaddr, 1);
+}
+
+void wake_robust_list(process p, u32 tid, void *head)
 {
     struct robust_list_head *h = head;
     struct robust_list *l;
@@ -328,10 +933,8 @@ void wake_robust_list(process p, void *head)
      * to let threads acquire multiple locks without blocking */
     if (h->list_op_pending) {
         uaddr = FUTEX_KEY_ADDR(h->list_op_pending, h->futex_offset);
-        if (validate_process_memory(p, uaddr, sizeof(*uaddr), true)) {
-            *uaddr |= FUTEX_OWNER_DIED;
-            futex_wake_many_by_uaddr(p, uaddr, 1);
-        }
+        if (validate_process_memory(p, uaddr, sizeof(*uaddr), true))
+            robust_futex_release(p, tid, uaddr);
     }
 
     for (l = h->list; (void *)l != (void *)h; l = l->next) {
@@ -340,8 +943,7 @@ void wake_robust_list(process p, void *head)
             break;
         if (!validate_process_memory(p, uaddr, sizeof(*uaddr), true))
             break;
-        *uaddr |= FUTEX_OWNER_DIED;
-        futex_wake_many_by_uaddr(p, uaddr, 1);
+        robust_futex_release(p, tid, uaddr);
     }
 }
 
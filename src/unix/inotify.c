@@ -0,0 +1,533 @@
+#include <unix_internal.h>
+#include <filesystem.h>
+
+/* inotify: watches attach an entry to the notify_set of the watched node,
+   kept in a table of watched nodes keyed by tuple. Filesystem syscalls
+   report events on a node (and on its parent directory, with the name of
+   the entry) through inotify_event(); each watch whose mask matches queues
+   an event on its instance, which wakes readers and pollers of the inotify
+   descriptor. Events with a name and cookie are dispatched one at a time
+   under inotify_lock, with the name and cookie passed to the handlers in
+   inotify_cur. */
+
+//#define INOTIFY_DEBUG
+#ifdef INOTIFY_DEBUG
+#define inotify_debug(x, ...) do {rprintf("INOTIFY: " x, ##__VA_ARGS__);} while(0)
+#else
+#define inotify_debug(x, ...)
+#endif
+
+#define INOTIFY_MAX_QUEUED_EVENTS   16384
+
+typedef struct inotify {
+    struct fdesc f;             /* must be first */
+    heap h;
+    struct spinlock lock;       /* covers the event queue */
+    struct list events;
+    u64 event_count;
+    u64 event_bytes;
+    struct list watches;        /* covered by inotify_lock */
+    int next_wd;
+    blockq bq;
+} *inotify;
+
+/* a watched node */
+typedef struct inotify_node {
+    tuple n;
+    notify_set ns;
+    int watches;
+} *inotify_node;
+
+declare_closure_struct(1, 2, boolean, inotify_watch_handler,
+                       struct inotify_watch *, w,
+                       u64, events, thread, t);
+
+typedef struct inotify_watch {
+    struct list l;              /* inotify->watches */
+    inotify in;
+    inotify_node node;
+    notify_entry ne;
+    int wd;
+    u32 mask;
+    boolean fired;              /* IN_ONESHOT watch removed after dispatch */
+    closure_struct(inotify_watch_handler, handler);
+} *inotify_watch;
+
+typedef struct inotify_qevent {
+    struct list l;
+    struct inotify_event ev;    /* followed by the padded name */
+} *inotify_qevent;
+
+static struct spinlock inotify_lock;
+static table inotify_nodes;
+static heap inotify_heap;
+u64 inotify_watch_count;        /* read without the lock to skip unwatched events */
+
+static struct {
+    symbol name;
+    u32 cookie;
+    vector oneshots;
+} inotify_cur;
+
+static inline u64 qevent_size(inotify_qevent qe)
+{
+    return sizeof(struct inotify_qevent) + qe->ev.len;
+}
+
+/* Called with inotify_lock held. As in Linux, an event identical to the
+   last one queued is dropped, and a full queue ends with a single
+   IN_Q_OVERFLOW event. */
+static void inotify_queue_event(inotify in, int wd, u32 mask, u32 cookie, symbol name)
+{
+    u32 len = 0;
+    string s = 0;
+    if (name) {
+        s = symbol_string(name);
+        len = pad(buffer_length(s) + 1, sizeof(struct inotify_event));
+    }
+    spin_lock(&in->lock);
+    if (!list_empty(&in->events)) {
+        inotify_qevent last = struct_from_list(in->events.prev, inotify_qevent, l);
+        if (last->ev.mask == IN_Q_OVERFLOW)
+            goto out;
+        if (last->ev.wd == wd && last->ev.mask == mask && last->ev.cookie == cookie &&
+            ((!s && !last->ev.len) ||
+             (s && last->ev.len == len &&
+              !runtime_memcmp(last->ev.name, buffer_ref(s, 0), buffer_length(s)))))
+            goto out;
+    }
+    if (in->event_count >= INOTIFY_MAX_QUEUED_EVENTS) {
+        wd = -1;
+        mask = IN_Q_OVERFLOW;
+        cookie = 0;
+        s = 0;
+        len = 0;
+    }
+    inotify_qevent qe = allocate(in->h, sizeof(struct inotify_qevent) + len);
+    if (qe == INVALID_ADDRESS)
+        goto out;
+    qe->ev.wd = wd;
+    qe->ev.mask = mask;
+    qe->ev.cookie = cookie;
+    qe->ev.len = len;
+    if (s) {
+        zero(qe->ev.name, len);
+        runtime_memcpy(qe->ev.name, buffer_ref(s, 0), buffer_length(s));
+    }
+    list_insert_before(&in->events, &qe->l);
+    in->event_count++;
+    in->event_bytes += sizeof(struct inotify_event) + len;
+    spin_unlock(&in->lock);
+    blockq_wake_one(in->bq);
+    notify_dispatch(in->f.ns, EPOLLIN);
+    return;
+  out:
+    spin_unlock(&in->lock);
+}
+
+static void inotify_node_put_locked(inotify_node node)
+{
+    if (--node->watches > 0)
+        return;
+    table_set(inotify_nodes, node->n, 0);
+    deallocate_notify_set(node->ns);
+    deallocate(inotify_heap, node, sizeof(*node));
+}
+
+static void inotify_watch_free_locked(inotify_watch w)
+{
+    list_delete(&w->l);
+    inotify_watch_count--;
+    deallocate(w->in->h, w, sizeof(*w));
+}
+
+/* Called with inotify_lock held, from notify_dispatch() of events on the
+   watched node, or with NOTIFY_EVENTS_RELEASE when the watch is removed. */
+define_closure_function(1, 2, boolean, inotify_watch_handler,
+                        struct inotify_watch *, w,
+                        u64, events, thread, t)
+{
+    inotify_watch w = bound(w);
+    if (events == NOTIFY_EVENTS_RELEASE) {
+        inotify_queue_event(w->in, w->wd, IN_IGNORED, 0, 0);
+        inotify_watch_free_locked(w);
+        return false;
+    }
+    if (!(events & IN_ALL_EVENTS) || w->fired)
+        return false;
+    inotify_queue_event(w->in, w->wd, events, inotify_cur.cookie, inotify_cur.name);
+    if (w->mask & IN_ONESHOT) {
+        w->fired = true;
+        vector_push(inotify_cur.oneshots, w);
+    }
+    return true;
+}
+
+static void inotify_remove_watch_locked(inotify_watch w)
+{
+    inotify_node node = w->node;
+    notify_remove(node->ns, w->ne, true);
+    inotify_node_put_locked(node);
+}
+
+static void inotify_dispatch_locked(tuple n, u32 mask, u32 cookie, symbol name)
+{
+    inotify_node node = table_find(inotify_nodes, n);
+    if (!node)
+        return;
+    inotify_debug("%s: node %p, mask 0x%x, cookie %d, name %b\n", __func__, n, mask, cookie,
+                  name ? symbol_string(name) : 0);
+    inotify_cur.name = name;
+    inotify_cur.cookie = cookie;
+    notify_dispatch(node->ns, mask);
+    inotify_cur.name = 0;
+    inotify_cur.cookie = 0;
+    inotify_watch w;
+    while ((w = vector_pop(inotify_cur.oneshots)))
+        inotify_remove_watch_locked(w);
+}
+
+/* Report an event on entry name of directory parent. */
+void inotify_event(tuple parent, symbol name, u32 mask, u32 cookie)
+{
+    if (!inotify_watch_count)
+        return;
+    u64 flags = spin_lock_irq(&inotify_lock);
+    inotify_dispatch_locked(parent, mask, cookie, name);
+    spin_unlock_irq(&inotify_lock, flags);
+}
+
+/* Report an event on node n, and on its entry in directory parent if that
+   is watched and still holds n. */
+void inotify_node_event(tuple parent, tuple n, u32 mask)
+{
+    if (!inotify_watch_count)
+        return;
+    if (is_dir(n))
+        mask |= IN_ISDIR;
+    u64 flags = spin_lock_irq(&inotify_lock);
+    inotify_dispatch_locked(n, mask, 0, 0);
+    if (parent && table_find(inotify_nodes, parent)) {
+        symbol name = lookup_sym(parent, n);
+        if (name)
+            inotify_dispatch_locked(parent, mask, 0, name);
+    }
+    spin_unlock_irq(&inotify_lock, flags);
+}
+
+void inotify_file_event(file f, u32 mask)
+{
+    if (inotify_watch_count)
+        inotify_node_event(f->parent, file_get_meta(f), mask);
+}
+
+/* Node n is gone: report IN_DELETE_SELF (or IN_MOVE_SELF for a node
+   replaced by a rename), then remove its watches, each with IN_IGNORED. */
+void inotify_node_deleted(tuple n)
+{
+    if (!inotify_watch_count)
+        return;
+    u64 flags = spin_lock_irq(&inotify_lock);
+    inotify_node node = table_find(inotify_nodes, n);
+    if (node) {
+        inotify_dispatch_locked(n, IN_DELETE_SELF, 0, 0);
+        node = table_find(inotify_nodes, n);    /* oneshot watches may be gone */
+        if (node) {
+            node->watches = 1;
+            notify_release(node->ns);
+            inotify_node_put_locked(node);
+        }
+    }
+    spin_unlock_irq(&inotify_lock, flags);
+}
+
+/* Entry oldname of oldparent, node n, is now in newparent, replacing node
+   replaced if not null. The two halves of the move share a cookie. */
+void inotify_rename(tuple oldparent, symbol oldname, tuple newparent, tuple n, tuple replaced)
+{
+    static word next_cookie;
+    if (!inotify_watch_count)
+        return;
+    u32 isdir = is_dir(n) ? IN_ISDIR : 0;
+    u32 cookie = fetch_and_add(&next_cookie, 1) + 1;
+    symbol newname = lookup_sym(newparent, n);
+    u64 flags = spin_lock_irq(&inotify_lock);
+    inotify_dispatch_locked(oldparent, IN_MOVED_FROM | isdir, cookie, oldname);
+    if (newname)
+        inotify_dispatch_locked(newparent, IN_MOVED_TO | isdir, cookie, newname);
+    inotify_dispatch_locked(n, IN_MOVE_SELF, 0, 0);
+    spin_unlock_irq(&inotify_lock, flags);
+    if (replaced)
+        inotify_node_deleted(replaced);
+}
+
+closure_function(5, 1, sysreturn, inotify_read_bh,
+                 inotify, in, thread, t, void *, buf, u64, length, io_completion, completion,
+                 u64, flags)
+{
+    inotify in = bound(in);
+    sysreturn rv;
+
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+    spin_lock(&in->lock);
+    if (list_empty(&in->events)) {
+        spin_unlock(&in->lock);
+        if (in->f.flags & O_NONBLOCK) {
+            rv = -EAGAIN;
+            goto out;
+        }
+        return BLOCKQ_BLOCK_REQUIRED;
+    }
+    u64 count = 0;
+    list_foreach(&in->events, l) {
+        inotify_qevent qe = struct_from_list(l, inotify_qevent, l);
+        u64 n = sizeof(struct inotify_event) + qe->ev.len;
+        if (count + n > bound(length))
+            break;
+        runtime_memcpy(bound(buf) + count, &qe->ev, n);
+        count += n;
+        list_delete(l);
+        in->event_count--;
+        in->event_bytes -= n;
+        deallocate(in->h, qe, qevent_size(qe));
+    }
+    spin_unlock(&in->lock);
+    rv = count ? count : -EINVAL;   /* buffer too small for the next event */
+  out:
+    blockq_handle_completion(in->bq, flags, bound(completion), bound(t), rv);
+    closure_finish();
+    return rv;
+}
+
+closure_function(1, 6, sysreturn, inotify_read,
+                 inotify, in,
+                 void *, buf, u64, length, u64, offset_arg, thread, t, boolean, bh, io_completion, completion)
+{
+    inotify in = bound(in);
+    blockq_action ba = closure(in->h, inotify_read_bh, in, t, buf, length, completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
+    return blockq_check(in->bq, t, ba, bh);
+}
+
+closure_function(1, 6, sysreturn, inotify_write,
+                 inotify, in,
+                 void *, buf, u64, length, u64, offset_arg, thread, t, boolean, bh, io_completion, completion)
+{
+    return io_complete(completion, t, -EINVAL);
+}
+
+closure_function(1, 1, u32, inotify_events,
+                 inotify, in,
+                 thread, t /* ignore */)
+{
+    return list_empty(&bound(in)->events) ? 0 : EPOLLIN;
+}
+
+closure_function(1, 2, sysreturn, inotify_ioctl,
+                 inotify, in,
+                 unsigned long, request, vlist, ap)
+{
+    inotify in = bound(in);
+    switch (request) {
+    case FIONREAD: {
+        int *nbytes = varg(ap, int *);
+        if (!validate_user_memory(nbytes, sizeof(int), true))
+            return -EFAULT;
+        *nbytes = in->event_bytes;
+        return 0;
+    }
+    default:
+        return ioctl_generic(&in->f, request, ap);
+    }
+}
+
+closure_function(1, 2, sysreturn, inotify_close,
+                 inotify, in,
+                 thread, t, io_completion, completion)
+{
+    inotify in = bound(in);
+    u64 flags = spin_lock_irq(&inotify_lock);
+    list_foreach(&in->watches, l) {
+        inotify_watch w = struct_from_list(l, inotify_watch, l);
+        inotify_node node = w->node;
+        notify_remove(node->ns, w->ne, false);
+        inotify_watch_free_locked(w);
+        inotify_node_put_locked(node);
+    }
+    spin_unlock_irq(&inotify_lock, flags);
+    list_foreach(&in->events, l) {
+        inotify_qevent qe = struct_from_list(l, inotify_qevent, l);
+        list_delete(l);
+        deallocate(in->h, qe, qevent_size(qe));
+    }
+    deallocate_blockq(in->bq);
+    deallocate_closure(in->f.read);
+    deallocate_closure(in->f.write);
+    deallocate_closure(in->f.events);
+    deallocate_closure(in->f.ioctl);
+    deallocate_closure(in->f.close);
+    release_fdesc(&in->f);
+    deallocate(in->h, in, sizeof(*in));
+    return io_complete(completion, t, 0);
+}
+
+sysreturn inotify_init1(int flags)
+{
+    thread_log(current, "%s: flags 0x%x", __func__, flags);
+    if (flags & ~(IN_NONBLOCK | IN_CLOEXEC))
+        return -EINVAL;
+    heap h = heap_locked(get_kernel_heaps());
+    if (!inotify_heap) {
+        u64 irqflags = spin_lock_irq(&inotify_lock);
+        if (!inotify_heap) {
+            inotify_nodes = allocate_table(h, identity_key, pointer_equal);
+            inotify_cur.oneshots = allocate_vector(h, 4);
+            if (inotify_nodes == INVALID_ADDRESS || inotify_cur.oneshots == INVALID_ADDRESS) {
+                spin_unlock_irq(&inotify_lock, irqflags);
+                return -ENOMEM;
+            }
+            inotify_heap = h;
+        }
+        spin_unlock_irq(&inotify_lock, irqflags);
+    }
+    inotify in = allocate(h, sizeof(*in));
+    if (in == INVALID_ADDRESS)
+        return -ENOMEM;
+    in->bq = allocate_blockq(h, "inotify");
+    if (in->bq == INVALID_ADDRESS) {
+        deallocate(h, in, sizeof(*in));
+        return -ENOMEM;
+    }
+    init_fdesc(h, &in->f, FDESC_TYPE_INOTIFY);
+    in->f.flags = O_RDONLY | flags;
+    in->f.read = closure(h, inotify_read, in);
+    in->f.write = closure(h, inotify_write, in);
+    in->f.events = closure(h, inotify_events, in);
+    in->f.ioctl = closure(h, inotify_ioctl, in);
+    in->f.close = closure(h, inotify_close, in);
+    in->h = h;
+    spin_lock_init(&in->lock);
+    list_init(&in->events);
+    in->event_count = 0;
+    in->event_bytes = 0;
+    list_init(&in->watches);
+    in->next_wd = 1;
+    u64 fd = allocate_fd(current->p, in);
+    if (fd == INVALID_PHYSICAL) {
+        apply(in->f.close, 0, io_completion_ignore);
+        return -EMFILE;
+    }
+    return fd;
+}
+
+sysreturn inotify_init(void)
+{
+    return inotify_init1(0);
+}
+
+static inotify_watch inotify_find_watch_locked(inotify in, tuple n, int wd)
+{
+    list_foreach(&in->watches, l) {
+        inotify_watch w = struct_from_list(l, inotify_watch, l);
+        if (n ? w->node->n == n : w->wd == wd)
+            return w;
+    }
+    return 0;
+}
+
+sysreturn inotify_add_watch(int fd, const char *pathname, u32 mask)
+{
+    if (!validate_user_string(pathname))
+        return -EFAULT;
+    thread_log(current, "%s: fd %d, path \"%s\", mask 0x%x", __func__, fd, pathname, mask);
+    inotify in = resolve_fd(current->p, fd);
+    if (in->f.type != FDESC_TYPE_INOTIFY)
+        return -EINVAL;
+    if (!(mask & IN_ALL_EVENTS) || ((mask & IN_MASK_ADD) && (mask & IN_MASK_CREATE)))
+        return -EINVAL;
+    filesystem fs = current->p->cwd_fs;
+    tuple n;
+    int ret = (mask & IN_DONT_FOLLOW) ?
+        resolve_cstring(&fs, current->p->cwd, pathname, &n, 0) :
+        resolve_cstring_follow(&fs, current->p->cwd, pathname, &n, 0);
+    if (ret)
+        return ret;
+    if ((mask & IN_ONLYDIR) && !is_dir(n))
+        return -ENOTDIR;
+
+    sysreturn rv;
+    u32 events = (mask & IN_ALL_EVENTS) | IN_ISDIR;
+    u64 flags = spin_lock_irq(&inotify_lock);
+    inotify_watch w = inotify_find_watch_locked(in, n, 0);
+    if (w) {
+        if (mask & IN_MASK_CREATE) {
+            rv = -EEXIST;
+        } else {
+            if (mask & IN_MASK_ADD)
+                mask |= w->mask;
+            w->mask = mask;
+            notify_entry_update_eventmask(w->ne, (mask & IN_ALL_EVENTS) | IN_ISDIR);
+            rv = w->wd;
+        }
+        goto out;
+    }
+    rv = -ENOMEM;
+    inotify_node node = table_find(inotify_nodes, n);
+    if (!node) {
+        node = allocate(inotify_heap, sizeof(*node));
+        if (node == INVALID_ADDRESS)
+            goto out;
+        node->ns = allocate_notify_set(inotify_heap);
+        if (node->ns == INVALID_ADDRESS) {
+            deallocate(inotify_heap, node, sizeof(*node));
+            goto out;
+        }
+        node->n = n;
+        node->watches = 0;
+        table_set(inotify_nodes, n, node);
+    }
+    node->watches++;
+    w = allocate(in->h, sizeof(*w));
+    if (w == INVALID_ADDRESS) {
+        inotify_node_put_locked(node);
+        goto out;
+    }
+    w->ne = notify_add(node->ns, events, init_closure(&w->handler, inotify_watch_handler, w));
+    if (w->ne == INVALID_ADDRESS) {
+        deallocate(in->h, w, sizeof(*w));
+        inotify_node_put_locked(node);
+        goto out;
+    }
+    w->in = in;
+    w->node = node;
+    w->wd = in->next_wd++;
+    w->mask = mask;
+    w->fired = false;
+    list_insert_before(&in->watches, &w->l);
+    inotify_watch_count++;
+    rv = w->wd;
+  out:
+    spin_unlock_irq(&inotify_lock, flags);
+    return rv;
+}
+
+sysreturn inotify_rm_watch(int fd, int wd)
+{
+    thread_log(current, "%s: fd %d, wd %d", __func__, fd, wd);
+    inotify in = resolve_fd(current->p, fd);
+    if (in->f.type != FDESC_TYPE_INOTIFY)
+        return -EINVAL;
+    sysreturn rv = -EINVAL;
+    u64 flags = spin_lock_irq(&inotify_lock);
+    inotify_watch w = inotify_find_watch_locked(in, 0, wd);
+    if (w) {
+        inotify_remove_watch_locked(w);
+        rv = 0;
+    }
+    spin_unlock_irq(&inotify_lock, flags);
+    return rv;
+}
@@ -1,7 +1,14 @@
+#include <net_system_structs.h>
 #include <unix_internal.h>
+#include <filesystem.h>
+#include <socket.h>
 
+#define IORING_SETUP_SQPOLL     (1 << 1)
+#define IORING_SETUP_SQ_AFF     (1 << 2)
 #define IORING_SETUP_CQSIZE     (1 << 3)
 
+#define IORING_SQ_NEED_WAKEUP   (1 << 0)
+
 #define IORING_FEAT_SINGLE_MMAP     (1 << 0)
 #define IORING_FEAT_RW_CUR_POS      (1 << 3)
 
@@ -11,16 +18,35 @@
 
 #define IORING_TIMEOUT_ABS  (1 << 0)
 
+#define IORING_POLL_ADD_MULTI   (1 << 0)
+#define IORING_ACCEPT_MULTISHOT (1 << 0)
+
+#define IORING_CQE_F_BUFFER         (1 << 0)
+#define IORING_CQE_F_MORE           (1 << 1)
+#define IORING_CQE_BUFFER_SHIFT     16
+
+#define IORING_FSYNC_DATASYNC   (1 << 0)
+
 #define IORING_ENTER_GETEVENTS  (1 << 0)
+#define IORING_ENTER_SQ_WAKEUP  (1 << 1)
 
 #define IO_URING_OP_SUPPORTED   (1 << 0)
 
 #define IOUR_SQ_ENTRIES_MAX 0x40000000UL
 #define IOUR_CQ_ENTRIES_MAX (2 * IOUR_SQ_ENTRIES_MAX)
 #define IOUR_FILES_MAX      0x8000
+#define IOUR_PBUF_RING_MAX  0x8000
+
+/* SQ poller tick and default idle time (Linux uses one second when
+ * sq_thread_idle is zero) */
+#define IOUR_SQPOLL_INTERVAL    microseconds(100)
+#define IOUR_SQPOLL_IDLE_MS     1000
 
 #define IOSQE_FIXED_FILE    (1 << 0)
+#define IOSQE_IO_DRAIN      (1 << 1)
+#define IOSQE_IO_LINK       (1 << 2)
 #define IOSQE_ASYNC         (1 << 4)
+#define IOSQE_BUFFER_SELECT (1 << 5)
 
 //#define IOUR_DEBUG
 #ifdef IOUR_DEBUG
@@ -46,10 +72,15 @@ struct io_uring_sqe {
         u32 sync_range_flags;
         u32 msg_flags;
         u32 timeout_flags;
+        u32 accept_flags;
+        u32 open_flags;
+        u32 statx_flags;
+        u32 fadvise_advice;
     };
     u64 user_data;
     union{
         u16 buf_index;
+        u16 buf_group;
         u64 __pad2[3];
     };
 };
@@ -85,6 +116,15 @@ enum iour_enter_opcode {
     IORING_OP_STATX,
     IORING_OP_READ,
     IORING_OP_WRITE,
+    IORING_OP_FADVISE,
+    IORING_OP_MADVISE,
+    IORING_OP_SEND,
+    IORING_OP_RECV,
+    IORING_OP_OPENAT2,
+    IORING_OP_EPOLL_CTL,
+    IORING_OP_SPLICE,
+    IORING_OP_PROVIDE_BUFFERS,
+    IORING_OP_REMOVE_BUFFERS,
     IORING_OP_LAST,
 };
 
@@ -98,6 +138,8 @@ enum iour_register_opcode {
     IORING_REGISTER_FILES_UPDATE,
     IORING_REGISTER_EVENTFD_ASYNC,
     IORING_REGISTER_PROBE,
+    IORING_REGISTER_PBUF_RING = 22,
+    IORING_UNREGISTER_PBUF_RING,
 };
 
 struct io_uring_files_update {
@@ -106,6 +148,35 @@ struct io_uring_files_update {
     s32 *fds;
 };
 
+struct io_uring_buf {
+    u64 addr;
+    u32 len;
+    u16 bid;
+    u16 resv;
+};
+
+/* the tail, written by the application, overlays the resv field of the first
+ * buffer */
+struct io_uring_buf_ring {
+    union {
+        struct {
+            u64 resv1;
+            u32 resv2;
+            u16 resv3;
+            u16 tail;
+        };
+        struct io_uring_buf bufs[0];
+    };
+};
+
+struct io_uring_buf_reg {
+    u64 ring_addr;
+    u32 ring_entries;
+    u16 bgid;
+    u16 pad;
+    u64 resv[3];
+};
+
 struct io_uring_probe_op {
     u8 op;
     u8 resv;
@@ -136,6 +207,10 @@ declare_closure_struct(1, 2, sysreturn, iour_close,
                        struct io_uring *, iour,
                        thread, t, io_completion, completion);
 
+declare_closure_struct(1, 1, void, iour_sqpoll,
+                       struct io_uring *, iour,
+                       u64, overruns);
+
 typedef struct io_uring {
     struct fdesc f;    /* must be first */
     heap h;
@@ -160,9 +235,28 @@ typedef struct io_uring {
     boolean eventfd_async;
     struct list pollers;
     struct list timers;
+    struct list bgroups;
     u32 cq_timeouts;
     u64 noncancelable_ops;
 
+    /* SQPOLL: submissions are picked up by a periodic kernel timer running on
+     * behalf of sq_thread; an armed poller counts as a non-cancelable op. */
+    thread sq_thread;
+    timer sq_timer;
+    timestamp sq_idle;
+    timestamp sq_last_active;
+    boolean closed;
+    closure_struct(iour_sqpoll, sqpoll);
+
+    /* Requests taken from the SQ and not yet completed (IOSQE_IO_DRAIN waits
+     * for this to reach zero), and the groups of linked or drained requests
+     * that are waiting for a completion (links), are ready to continue
+     * (ready) or are waiting behind a drain (deferred). */
+    u64 inflight;
+    struct list links;
+    struct list ready;
+    struct list deferred;
+
     /* When true, the io_uring context is being shut down in the background,
      * i.e. no thread is blocked on close() and the context will be deallocated
      * when its last non-cancelable operation is completed. This can happen if
@@ -173,18 +267,69 @@ typedef struct io_uring {
     io_completion shutdown_completion;
 } *io_uring;
 
-declare_closure_struct(2, 2, void, iour_poll_notify,
+declare_closure_struct(2, 2, boolean, iour_poll_notify,
                        io_uring, iour, struct iour_poll *, p,
                        u64, events, thread, t);
 
+declare_closure_struct(2, 0, void, iour_bsel_read,
+                       io_uring, iour, struct iour_poll *, p);
+
+/* A poll request, or a buffer-select read waiting for its file to become
+ * readable: the buffer is only picked once there is data to put in it. */
 typedef struct iour_poll {
     struct list l;
     u64 user_data;
     fdesc f;
     notify_entry ne;
+    boolean multishot;
+    boolean bsel;
+    u16 bgid;
+    u32 len;
+    u64 offset;
+    thread t;
     closure_struct(iour_poll_notify, handler);
+    closure_struct(iour_bsel_read, read);
 } *iour_poll;
 
+/* buffer added with IORING_OP_PROVIDE_BUFFERS */
+typedef struct iour_pbuf {
+    struct list l;
+    u64 addr;
+    u32 len;
+    u16 bid;
+} *iour_pbuf;
+
+/* Buffer group, made of either provided buffers or a ring registered with
+ * IORING_REGISTER_PBUF_RING (whose tail the application advances as it hands
+ * buffers back). */
+typedef struct iour_bgroup {
+    struct list l;
+    u16 bgid;
+    struct list bufs;
+    struct io_uring_buf_ring *ring;
+    u32 ring_mask;
+    u16 ring_head;
+} *iour_bgroup;
+
+declare_closure_struct(1, 2, void, iour_accept_complete,
+                       struct iour_accept *, a,
+                       thread, t, sysreturn, rv);
+declare_closure_struct(1, 0, void, iour_accept_rearm,
+                       struct iour_accept *, a);
+
+/* multishot accept, re-armed after each accepted connection */
+typedef struct iour_accept {
+    io_uring iour;
+    fdesc f;
+    thread t;
+    u64 user_data;
+    struct sockaddr *addr;
+    socklen_t *addrlen;
+    int flags;
+    closure_struct(iour_accept_complete, complete);
+    closure_struct(iour_accept_rearm, rearm);
+} *iour_accept;
+
 declare_closure_struct(2, 1, void, iour_timeout,
                        io_uring, iour, struct iour_timer *, t,
                        u64, overruns);
@@ -197,6 +342,26 @@ typedef struct iour_timer {
     closure_struct(iour_timeout, handler);
 } *iour_timer;
 
+/* copy of an SQE whose submission has been put off */
+typedef struct iour_sqe {
+    struct list l;
+    struct io_uring_sqe sqe;
+} *iour_sqe;
+
+/* A linked chain, whose members are started one at a time as each
+ * predecessor completes successfully (and canceled after a failure), or a
+ * group held back by IOSQE_IO_DRAIN. While a member is in flight the group
+ * is on the links list, matched to the member's completion by user_data. */
+typedef struct iour_link {
+    struct list l;
+    struct list sqes;
+    unsigned int count;
+    u64 user_data;
+    thread t;
+    boolean drain;
+    boolean failed;
+} *iour_link;
+
 /* Mmapped region layout:
  * - Region 1
  *   - struct io_rings
@@ -221,6 +386,41 @@ typedef struct iour_timer {
 #define iour_lock(iour)     u64 _irqflags = spin_lock_irq(&(iour)->lock)
 #define iour_unlock(iour)   spin_unlock_irq(&(iour)->lock, _irqflags)
 
+static boolean iour_sqpoll_start(io_uring iour);
+
+static void iour_link_free(io_uring iour, iour_link c)
+{
+    list_foreach(&c->sqes, l) {
+        iour_sqe s = struct_from_list(l, iour_sqe, l);
+        deallocate(iour->h, s, sizeof(*s));
+    }
+    thread_release(c->t);
+    deallocate(iour->h, c, sizeof(*c));
+}
+
+static void iour_link_free_list(io_uring iour, struct list *head)
+{
+    list_foreach(head, l)
+        iour_link_free(iour, struct_from_list(l, iour_link, l));
+}
+
+static void iour_bgroup_free(io_uring iour, iour_bgroup g)
+{
+    list_foreach(&g->bufs, l) {
+        iour_pbuf b = struct_from_list(l, iour_pbuf, l);
+        deallocate(iour->h, b, sizeof(*b));
+    }
+    deallocate(iour->h, g, sizeof(*g));
+}
+
+static void iour_poll_free(io_uring iour, iour_poll p)
+{
+    if (p->t)
+        thread_release(p->t);
+    fdesc_put(p->f);
+    deallocate(iour->h, p, sizeof(*p));
+}
+
 static void iour_release(io_uring iour)
 {
     iour_debug("completion %p", iour->shutdown_completion);
@@ -232,6 +432,13 @@ static void iour_release(io_uring iour)
     }
     if (iour->buf_count)
         deallocate(iour->h, iour->bufs, sizeof(struct iovec) * iour->buf_count);
+    if (iour->sq_thread)
+        thread_release(iour->sq_thread);
+    iour_link_free_list(iour, &iour->links);
+    iour_link_free_list(iour, &iour->ready);
+    iour_link_free_list(iour, &iour->deferred);
+    list_foreach(&iour->bgroups, l)
+        iour_bgroup_free(iour, struct_from_list(l, iour_bgroup, l));
     u64 alloc_size = IOUR_ALLOC_SIZE(iour);
     unmap(u64_from_pointer(iour->user_rings), alloc_size);
     release_fdesc(&iour->f);
@@ -293,11 +500,12 @@ define_closure_function(1, 2, sysreturn, iour_close,
     list_foreach(&deleted_items, l) {
         iour_poll poller = struct_from_list(l, iour_poll, l);
         notify_remove(poller->f->ns, poller->ne, false);
-        fdesc_put(poller->f);
-        deallocate(iour->h, poller, sizeof(*poller));
+        iour_poll_free(iour, poller);
     }
 
     irqflags = spin_lock_irq(&iour->lock);
+    /* an armed SQ poller disarms itself on its next tick */
+    iour->closed = true;
     if (iour->eventfd) {
         fdesc_put(iour->eventfd);
         iour->eventfd = 0;
@@ -349,7 +557,10 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
     iour_debug("entries %d, flags 0x%x, CQ entries %d", entries, params->flags,
                params->cq_entries);
     if ((entries == 0) || (entries > IOUR_SQ_ENTRIES_MAX) ||
-            (params->flags & ~IORING_SETUP_CQSIZE) || params->resv[0] ||
+            (params->flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF |
+                               IORING_SETUP_CQSIZE)) ||
+            ((params->flags & IORING_SETUP_SQ_AFF) &&
+             !(params->flags & IORING_SETUP_SQPOLL)) || params->resv[0] ||
             params->resv[1] || params->resv[2] || params->resv[3])
         return -EINVAL;
     params->sq_entries = U64_FROM_BIT(find_order(entries));
@@ -402,10 +613,18 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
     iour->eventfd = 0;
     list_init(&iour->pollers);
     list_init(&iour->timers);
+    list_init(&iour->bgroups);
     iour->cq_timeouts = 0;
     iour->noncancelable_ops = 0;
     iour->shutdown = false;
     iour->shutdown_completion = 0;
+    iour->sq_thread = 0;
+    iour->sq_timer = 0;
+    iour->closed = false;
+    iour->inflight = 0;
+    list_init(&iour->links);
+    list_init(&iour->ready);
+    list_init(&iour->deferred);
     ret = allocate_fd(current->p, iour);
     if (ret == INVALID_PHYSICAL) {
         ret = -EMFILE;
@@ -414,6 +633,17 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
     iour_debug("fd %d", ret);
     init_fdesc(h, &iour->f, FDESC_TYPE_IORING);
     iour->f.close = init_closure(&iour->close, iour_close, iour);
+    if (params->flags & IORING_SETUP_SQPOLL) {
+        /* sq_thread_cpu is only a hint; the poller runs wherever the timer
+         * fires, submitting on behalf of the thread that set up the ring */
+        iour->sq_idle = milliseconds(params->sq_thread_idle ?
+                                     params->sq_thread_idle : IOUR_SQPOLL_IDLE_MS);
+        thread_reserve(current);
+        iour->sq_thread = current;
+        iour_lock(iour);
+        iour_sqpoll_start(iour);
+        iour_unlock(iour);
+    }
     params->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
     params->sq_off.head = offsetof(io_rings, sq_head);
     params->sq_off.tail = offsetof(io_rings, sq_tail);
@@ -473,8 +703,8 @@ simple_closure_function(1, 2, void, iour_efd_complete,
     closure_finish();
 }
 
-static void iour_complete_locked(io_uring iour, u64 user_data, s32 res,
-                                 boolean async)
+static void iour_post_locked(io_uring iour, u64 user_data, s32 res,
+                             u32 cflags, boolean async)
 {
     io_rings rings = iour->rings;
     iour_debug("user_data %ld, res %d, CQ tail %d", user_data, res,
@@ -483,7 +713,7 @@ static void iour_complete_locked(io_uring iour, u64 user_data, s32 res,
         struct io_uring_cqe *cqe = &iour->cqes[rings->cq_tail & iour->cq_mask];
         cqe->user_data = user_data;
         cqe->res = res;
-        cqe->flags = 0;
+        cqe->flags = cflags;
         write_barrier();
         rings->cq_tail++;
     } else {
@@ -501,11 +731,99 @@ static void iour_complete_locked(io_uring iour, u64 user_data, s32 res,
     }
 }
 
-static void iour_complete(io_uring iour, u64 user_data, s32 res,
-                          boolean async, boolean noncancelable)
+/* A CQE flagged with IORING_CQE_F_MORE is not the last one for its request,
+ * which stays in flight. */
+static void iour_complete_locked(io_uring iour, u64 user_data, s32 res,
+                                 u32 cflags, boolean async)
+{
+    iour_post_locked(iour, user_data, res, cflags, async);
+    if (cflags & IORING_CQE_F_MORE)
+        return;
+    iour->inflight--;
+    list_foreach(&iour->links, l) {
+        iour_link c = struct_from_list(l, iour_link, l);
+        if (c->user_data == user_data) {
+            list_delete(l);
+            c->failed = (res < 0);
+            list_push_back(&iour->ready, l);
+            break;
+        }
+    }
+}
+
+/* called with the io_uring lock held */
+static void iour_link_cancel_locked(io_uring iour, iour_link c)
+{
+    list_foreach(&c->sqes, l) {
+        iour_sqe s = struct_from_list(l, iour_sqe, l);
+        iour_post_locked(iour, s->sqe.user_data, -ECANCELED, 0, false);
+        iour->inflight--;
+    }
+}
+
+static boolean iour_submit(io_uring iour, thread t, struct io_uring_sqe *sqe);
+
+/* Submits the next member of c; c stays on the links list, waiting for the
+ * completion of that member, until its last member is submitted. */
+static void iour_link_start(io_uring iour, iour_link c)
+{
+    iour_sqe s = struct_from_list(list_get_next(&c->sqes), iour_sqe, l);
+    list_delete(&s->l);
+    c->count--;
+    thread t = c->t;
+    thread_reserve(t);
+    boolean last = list_empty(&c->sqes);
+    if (last) {
+        iour_link_free(iour, c);
+    } else {
+        iour_lock(iour);
+        c->user_data = s->sqe.user_data;
+        list_push_back(&iour->links, &c->l);
+        iour_unlock(iour);
+    }
+    iour_submit(iour, t, &s->sqe);
+    deallocate(iour->h, s, sizeof(*s));
+    thread_release(t);
+}
+
+/* Continues linked chains whose last started member has completed, and
+ * starts deferred groups once the requests ahead of them allow it. */
+static void iour_advance(io_uring iour)
+{
+    while (true) {
+        iour_link c = 0;
+        iour_lock(iour);
+        if (!list_empty(&iour->ready)) {
+            c = struct_from_list(list_get_next(&iour->ready), iour_link, l);
+            list_delete(&c->l);
+        } else if (!list_empty(&iour->deferred)) {
+            iour_link d = struct_from_list(list_get_next(&iour->deferred),
+                                           iour_link, l);
+            if (!d->drain || (iour->inflight == 0)) {
+                list_delete(&d->l);
+                iour->inflight += d->count;
+                c = d;
+            }
+        }
+        boolean cancel = c && (c->failed || iour->closed);
+        if (cancel)
+            iour_link_cancel_locked(iour, c);
+        iour_unlock(iour);
+        if (!c)
+            return;
+        if (cancel)
+            iour_link_free(iour, c);
+        else
+            iour_link_start(iour, c);
+    }
+}
+
+static void iour_complete_flags(io_uring iour, u64 user_data, s32 res,
+                                u32 cflags, boolean async,
+                                boolean noncancelable)
 {
     iour_lock(iour);
-    iour_complete_locked(iour, user_data, res, async);
+    iour_complete_locked(iour, user_data, res, cflags, async);
     if (noncancelable) {
         if ((fetch_and_add(&iour->noncancelable_ops, -1) == 1) &&
                 iour->shutdown) {
@@ -522,7 +840,7 @@ check_timers:
             list_delete(l);
             list_push_back(&deleted_timers, l);
             iour->cq_timeouts++;
-            iour_complete_locked(iour, iour_tim->user_data, 0, async);
+            iour_complete_locked(iour, iour_tim->user_data, 0, 0, async);
 
             /* Increment the target of any remaining timers, to compensate the
              * CQ tail increment due to the just completed timeout, then go
@@ -535,6 +853,7 @@ check_timers:
         }
     }
     blockq bq = iour->bq;
+    boolean advance = !list_empty(&iour->ready) || !list_empty(&iour->deferred);
     iour_unlock(iour);
     list_foreach(&deleted_timers, l) {
         iour_timer iour_tim = struct_from_list(l, iour_timer, l);
@@ -543,17 +862,28 @@ check_timers:
     }
     if (bq)
         blockq_wake_one(bq);
+    if (advance)
+        iour_advance(iour);
+}
+
+static void iour_complete(io_uring iour, u64 user_data, s32 res,
+                          boolean async, boolean noncancelable)
+{
+    iour_complete_flags(iour, user_data, res, 0, async, noncancelable);
 }
 
 static void iour_complete_timeout(io_uring iour, u64 user_data)
 {
     iour_lock(iour);
     iour->cq_timeouts++;
-    iour_complete_locked(iour, user_data, -ETIME, true);
+    iour_complete_locked(iour, user_data, -ETIME, 0, true);
     blockq bq = iour->bq;
+    boolean advance = !list_empty(&iour->ready) || !list_empty(&iour->deferred);
     iour_unlock(iour);
     if (bq)
         blockq_wake_one(bq);
+    if (advance)
+        iour_advance(iour);
 }
 
 closure_function(3, 2, void, iour_rw_complete,
@@ -568,8 +898,8 @@ closure_function(3, 2, void, iour_rw_complete,
 static void iour_iov(io_uring iour, fdesc f, boolean write, struct iovec *iov,
                      u32 len, u64 off, u64 user_data)
 {
-    io_completion completion = closure(iour->h, iour_rw_complete, iour, f,
-        user_data);
+    io_completion completion = closure(heap_transient(get_kernel_heaps()), iour_rw_complete,
+                                       iour, f, user_data);
     if (completion == INVALID_ADDRESS) {
         fdesc_put(f);
         iour_complete(iour, user_data, -ENOMEM, false, false);
@@ -579,8 +909,9 @@ static void iour_iov(io_uring iour, fdesc f, boolean write, struct iovec *iov,
     }
 }
 
-static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
-                    u64 offset, u64 user_data)
+/* fixed: addr is within a registered (prefaulted) buffer */
+static void iour_rw(io_uring iour, thread t, fdesc f, boolean write, boolean fixed,
+                    void *addr, u32 len, u64 offset, u64 user_data)
 {
     iour_debug("%s at %p, len %d, offset %ld", write ? "write" : "read", addr,
             len, offset);
@@ -593,7 +924,8 @@ static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
             (!write && !fdesc_is_readable(f))) {
         err = -EBADF;
     } else {
-        completion = closure(iour->h, iour_rw_complete, iour, f, user_data);
+        completion = closure(heap_transient(get_kernel_heaps()), iour_rw_complete, iour, f,
+                             user_data);
         if (completion == INVALID_ADDRESS)
             err = -ENOMEM;
     }
@@ -602,43 +934,253 @@ static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
         iour_complete(iour, user_data, err, false, false);
     } else {
         fetch_and_add(&iour->noncancelable_ops, 1);
-        apply(op, addr, len, offset, current, true, completion);
+        if (fixed)
+            file_fixed_io(f, write, addr, len, offset, t, true, completion);
+        else
+            apply(op, addr, len, offset, t, true, completion);
+    }
+}
+
+/* fsync, or fallocate (with mode, offset and length) */
+static void iour_fs_op(io_uring iour, thread t, fdesc f, boolean alloc,
+                       int mode, u64 offset, u64 len, u64 user_data)
+{
+    io_completion completion = closure(heap_transient(get_kernel_heaps()),
+                                       iour_rw_complete, iour, f, user_data);
+    if (completion == INVALID_ADDRESS) {
+        fdesc_put(f);
+        iour_complete(iour, user_data, -ENOMEM, false, false);
+        return;
+    }
+    fetch_and_add(&iour->noncancelable_ops, 1);
+    if (alloc)
+        fallocate_internal(f, mode, offset, len, t, completion);
+    else
+        fsync_internal(f, t, completion);
+}
+
+/* Socket operations complete like reads and writes; f must be a socket
+ * implementing the operation. Returns 0 if the request has been completed
+ * with an error instead. */
+static io_completion iour_sock_prepare(io_uring iour, fdesc f, boolean supported,
+                                       u64 user_data)
+{
+    s32 err;
+    if (f->type != FDESC_TYPE_SOCKET) {
+        err = -ENOTSOCK;
+    } else if (!supported) {
+        err = -EOPNOTSUPP;
+    } else {
+        io_completion completion = closure(heap_transient(get_kernel_heaps()),
+                                           iour_rw_complete, iour, f, user_data);
+        if (completion != INVALID_ADDRESS) {
+            fetch_and_add(&iour->noncancelable_ops, 1);
+            return completion;
+        }
+        err = -ENOMEM;
+    }
+    fdesc_put(f);
+    iour_complete(iour, user_data, err, false, false);
+    return 0;
+}
+
+/* header for SEND and RECV with flags, which go through sendmsg/recvmsg */
+typedef struct iour_msg {
+    struct msghdr msg;
+    struct iovec iov;
+} *iour_msg;
+
+closure_function(4, 2, void, iour_msg_complete,
+                 io_uring, iour, fdesc, f, u64, user_data, iour_msg, m,
+                 thread, t, sysreturn, rv)
+{
+    io_uring iour = bound(iour);
+    deallocate(iour->h, bound(m), sizeof(struct iour_msg));
+    fdesc_put(bound(f));
+    iour_complete(iour, bound(user_data), rv, true, true);
+    closure_finish();
+}
+
+static void iour_sock_msg(io_uring iour, thread t, fdesc f, boolean send,
+                          struct msghdr *msg, iour_msg m, int flags,
+                          u64 user_data)
+{
+    iour_debug("%s, flags 0x%x", send ? "send" : "recv", flags);
+    struct sock *s = (struct sock *)f;
+    boolean supported = (f->type == FDESC_TYPE_SOCKET) &&
+            (send ? s->sendmsg_io != 0 : s->recvmsg_io != 0);
+    io_completion completion;
+    if (m && supported) {
+        completion = closure(heap_transient(get_kernel_heaps()), iour_msg_complete,
+                             iour, f, user_data, m);
+        if (completion == INVALID_ADDRESS) {
+            deallocate(iour->h, m, sizeof(*m));
+            fdesc_put(f);
+            iour_complete(iour, user_data, -ENOMEM, false, false);
+            return;
+        }
+        fetch_and_add(&iour->noncancelable_ops, 1);
+    } else {
+        if (m)
+            deallocate(iour->h, m, sizeof(*m));
+        completion = iour_sock_prepare(iour, f, supported, user_data);
+        if (!completion)
+            return;
+    }
+    if (send)
+        s->sendmsg_io(s, msg, flags, t, true, completion);
+    else
+        s->recvmsg_io(s, msg, flags, t, true, completion);
+}
+
+/* called with the io_uring lock held */
+static iour_bgroup iour_bgroup_find(io_uring iour, u16 bgid)
+{
+    list_foreach(&iour->bgroups, l) {
+        iour_bgroup g = struct_from_list(l, iour_bgroup, l);
+        if (g->bgid == bgid)
+            return g;
+    }
+    return 0;
+}
+
+/* Takes the next buffer from a group; called with the io_uring lock held. */
+static boolean iour_buf_select_locked(io_uring iour, u16 bgid, u64 *addr,
+                                      u32 *len, u16 *bid)
+{
+    iour_bgroup g = iour_bgroup_find(iour, bgid);
+    if (!g)
+        return false;
+    if (g->ring) {
+        struct io_uring_buf_ring *br = g->ring;
+        if (g->ring_head == *(volatile u16 *)&br->tail)
+            return false;
+        read_barrier();
+        struct io_uring_buf *buf = &br->bufs[g->ring_head & g->ring_mask];
+        *addr = buf->addr;
+        *len = buf->len;
+        *bid = buf->bid;
+        g->ring_head++;
+        return true;
+    }
+    if (list_empty(&g->bufs))
+        return false;
+    iour_pbuf b = struct_from_list(list_get_next(&g->bufs), iour_pbuf, l);
+    list_delete(&b->l);
+    *addr = b->addr;
+    *len = b->len;
+    *bid = b->bid;
+    deallocate(iour->h, b, sizeof(*b));
+    return true;
+}
+
+closure_function(4, 2, void, iour_bsel_complete,
+                 io_uring, iour, fdesc, f, u64, user_data, u32, cflags,
+                 thread, t, sysreturn, rv)
+{
+    fdesc_put(bound(f));
+    iour_complete_flags(bound(iour), bound(user_data), rv, bound(cflags), true,
+                        true);
+    closure_finish();
+}
+
+/* Runs outside of the notify dispatch that found the file readable, holding a
+ * non-cancelable op reference. As in Linux, the CQE reports the selected
+ * buffer even if the read fails, so that the application can recycle it. */
+define_closure_function(2, 0, void, iour_bsel_read,
+                        io_uring, iour, iour_poll, p)
+{
+    io_uring iour = bound(iour);
+    iour_poll p = bound(p);
+    u64 addr;
+    u32 len;
+    u16 bid;
+    iour_lock(iour);
+    boolean selected = iour_buf_select_locked(iour, p->bgid, &addr, &len, &bid);
+    iour_unlock(iour);
+    s32 err = 0;
+    u32 cflags = 0;
+    io_completion completion = 0;
+    if (!selected) {
+        err = -ENOBUFS;
+    } else {
+        cflags = IORING_CQE_F_BUFFER | (bid << IORING_CQE_BUFFER_SHIFT);
+        if (p->len && (p->len < len))
+            len = p->len;
+        if (!validate_user_memory(pointer_from_u64(addr), len, true)) {
+            err = -EFAULT;
+        } else {
+            completion = closure(heap_transient(get_kernel_heaps()),
+                                 iour_bsel_complete, iour, p->f, p->user_data,
+                                 cflags);
+            if (completion == INVALID_ADDRESS)
+                err = -ENOMEM;
+        }
+    }
+    iour_debug("user_data %ld, err %d", p->user_data, err);
+    u64 user_data = p->user_data;
+    if (err) {
+        iour_poll_free(iour, p);
+        iour_complete_flags(iour, user_data, err, cflags, true, true);
+        return;
     }
+    thread t = p->t;
+    fdesc f = p->f;
+    u64 offset = p->offset;
+    deallocate(iour->h, p, sizeof(*p));
+    apply(f->read, pointer_from_u64(addr), len, offset, t, true, completion);
+    thread_release(t);
 }
 
-define_closure_function(2, 2, void, iour_poll_notify,
+define_closure_function(2, 2, boolean, iour_poll_notify,
                         io_uring, iour, iour_poll, p,
                         u64, events, thread, t)
 {
     if (!events)
-        return;
+        return false;
     io_uring iour = bound(iour);
     iour_poll p = bound(p);
     iour_lock(iour);
     boolean found = list_find(&iour->pollers, &p->l);
+    boolean more = false;
+    u64 user_data = 0;
     if (found) {
-        list_delete(&p->l);
+        /* a multishot poller stays armed (and may be removed concurrently as
+         * soon as the lock is dropped) */
+        more = p->multishot;
+        user_data = p->user_data;
+        if (!more) {
+            list_delete(&p->l);
+            if (p->bsel)
+                fetch_and_add(&iour->noncancelable_ops, 1);
+        }
     }
     iour_unlock(iour);
-    if (found) {
-        iour_debug("user_data %ld, events %ld", p->user_data, events);
-        iour_complete(iour, p->user_data, events, true, false);
-        notify_remove(p->f->ns, p->ne, false);
-        fdesc_put(p->f);
-        deallocate(iour->h, p, sizeof(*p));
+    if (!found)
+        return false;
+    iour_debug("user_data %ld, events %ld", user_data, events);
+    if (more) {
+        iour_complete_flags(iour, user_data, events, IORING_CQE_F_MORE, true,
+                            false);
+        return true;
+    }
+    notify_remove(p->f->ns, p->ne, false);
+    if (p->bsel) {
+        if (!runqueue_push((thunk)&p->read)) {
+            iour_poll_free(iour, p);
+            iour_complete(iour, user_data, -ENOMEM, true, true);
+        }
+    } else {
+        iour_complete(iour, user_data, events, true, false);
+        iour_poll_free(iour, p);
     }
+    return true;
 }
 
-static void iour_poll_add(io_uring iour, fdesc f, u16 events, u64 user_data)
+static void iour_poll_arm(io_uring iour, thread t, fdesc f, u16 events,
+                          iour_poll p)
 {
     s32 err = 0;
-    iour_poll p = allocate(iour->h, sizeof(*p));
-    if (p == INVALID_ADDRESS) {
-        err = -ENOMEM;
-        goto done;
-    }
-    p->user_data = user_data;
-    p->f = f;
     iour_lock(iour);
     list_push_back(&iour->pollers, &p->l);
     p->ne = notify_add(f->ns, events | EPOLLERR | EPOLLHUP,
@@ -646,17 +1188,71 @@ static void iour_poll_add(io_uring iour, fdesc f, u16 events, u64 user_data)
     if (p->ne == INVALID_ADDRESS) {
         err = -ENOMEM;
         list_delete(&p->l);
-        deallocate(iour->h, p, sizeof(*p));
     }
     iour_unlock(iour);
-done:
     if (!err) {
         if (f->events)
             /* Check if poll events are already present. */
-            notify_dispatch_for_thread(f->ns, apply(f->events, current),
-                current);
-    } else
+            notify_dispatch_for_thread(f->ns, apply(f->events, t), t);
+    } else {
+        iour_complete(iour, p->user_data, err, false, false);
+        iour_poll_free(iour, p);
+    }
+}
+
+static iour_poll iour_poll_alloc(io_uring iour, fdesc f, u64 user_data)
+{
+    iour_poll p = allocate(iour->h, sizeof(*p));
+    if (p == INVALID_ADDRESS) {
+        iour_complete(iour, user_data, -ENOMEM, false, false);
+        return 0;
+    }
+    zero(p, sizeof(*p));
+    p->user_data = user_data;
+    p->f = f;
+    return p;
+}
+
+static void iour_poll_add(io_uring iour, thread t, fdesc f, u16 events,
+                          boolean multishot, u64 user_data)
+{
+    iour_poll p = iour_poll_alloc(iour, f, user_data);
+    if (!p) {
+        fdesc_put(f);
+        return;
+    }
+    p->multishot = multishot;
+    iour_poll_arm(iour, t, f, events, p);
+}
+
+/* Read (or receive) into a buffer taken from group bgid when f becomes
+ * readable. */
+static void iour_bsel_add(io_uring iour, thread t, fdesc f, u16 bgid, u32 len,
+                          u64 offset, u64 user_data)
+{
+    s32 err = 0;
+    if (!f->read)
+        err = -EOPNOTSUPP;
+    else if (!fdesc_is_readable(f))
+        err = -EBADF;
+    if (err) {
+        fdesc_put(f);
         iour_complete(iour, user_data, err, false, false);
+        return;
+    }
+    iour_poll p = iour_poll_alloc(iour, f, user_data);
+    if (!p) {
+        fdesc_put(f);
+        return;
+    }
+    p->bsel = true;
+    p->bgid = bgid;
+    p->len = len;
+    p->offset = offset;
+    thread_reserve(t);
+    p->t = t;
+    init_closure(&p->read, iour_bsel_read, iour, p);
+    iour_poll_arm(iour, t, f, EPOLLIN, p);
 }
 
 static void iour_poll_remove(io_uring iour, u64 addr, u64 user_data)
@@ -677,13 +1273,149 @@ static void iour_poll_remove(io_uring iour, u64 addr, u64 user_data)
         iour_complete(iour, addr, -ECANCELED, false, false);
         res = 0;
         notify_remove(p->f->ns, p->ne, false);
-        fdesc_put(p->f);
-        deallocate(iour->h, p, sizeof(*p));
+        iour_poll_free(iour, p);
     } else
         res = -ENOENT;
     iour_complete(iour, user_data, res, false, false);
 }
 
+static s32 iour_provide_buffers(io_uring iour, u64 addr, u32 len, u32 nbufs,
+                                u32 bid, u16 bgid)
+{
+    iour_debug("addr 0x%lx, len %d, nbufs %d, bid %d, bgid %d", addr, len,
+               nbufs, bid, bgid);
+    if ((nbufs == 0) || (nbufs > U16_MAX))
+        return -EINVAL;
+    if (bid + nbufs > U16_MAX + 1)
+        return -E2BIG;
+    if (!validate_user_memory(pointer_from_u64(addr), (u64)len * nbufs, true))
+        return -EFAULT;
+    s32 res = 0;
+    iour_lock(iour);
+    iour_bgroup g = iour_bgroup_find(iour, bgid);
+    if (!g) {
+        g = allocate(iour->h, sizeof(*g));
+        if (g == INVALID_ADDRESS) {
+            res = -ENOMEM;
+            goto out;
+        }
+        g->bgid = bgid;
+        list_init(&g->bufs);
+        g->ring = 0;
+        list_push_back(&iour->bgroups, &g->l);
+    } else if (g->ring) {
+        res = -EINVAL;
+        goto out;
+    }
+    for (u32 i = 0; i < nbufs; i++) {
+        iour_pbuf b = allocate(iour->h, sizeof(*b));
+        if (b == INVALID_ADDRESS) {
+            if (i == 0)
+                res = -ENOMEM;
+            break;
+        }
+        b->addr = addr;
+        b->len = len;
+        b->bid = bid + i;
+        list_push_back(&g->bufs, &b->l);
+        addr += len;
+    }
+  out:
+    iour_unlock(iour);
+    return res;
+}
+
+static s32 iour_remove_buffers(io_uring iour, u32 nbufs, u16 bgid)
+{
+    if ((nbufs == 0) || (nbufs > U16_MAX))
+        return -EINVAL;
+    s32 res = 0;
+    iour_lock(iour);
+    iour_bgroup g = iour_bgroup_find(iour, bgid);
+    if (!g) {
+        res = -ENOENT;
+    } else if (g->ring) {
+        res = -EINVAL;
+    } else {
+        while ((res < nbufs) && !list_empty(&g->bufs)) {
+            iour_pbuf b = struct_from_list(list_get_next(&g->bufs), iour_pbuf,
+                                           l);
+            list_delete(&b->l);
+            deallocate(iour->h, b, sizeof(*b));
+            res++;
+        }
+    }
+    iour_unlock(iour);
+    return res;
+}
+
+define_closure_function(1, 0, void, iour_accept_rearm,
+                        iour_accept, a)
+{
+    iour_accept a = bound(a);
+    struct sock *s = (struct sock *)a->f;
+    s->accept4_io(s, a->addr, a->addrlen, a->flags, a->t, true,
+                  (io_completion)&a->complete);
+}
+
+/* Each accepted connection is posted with IORING_CQE_F_MORE; the socket is
+ * re-armed from the runqueue rather than from within the completion, which
+ * may run inside the socket's blockq wakeup. The first failure, or closing
+ * the ring, ends the request. */
+define_closure_function(1, 2, void, iour_accept_complete,
+                        iour_accept, a,
+                        thread, t, sysreturn, rv)
+{
+    iour_accept a = bound(a);
+    io_uring iour = a->iour;
+    u64 user_data = a->user_data;
+    if ((rv >= 0) && !iour->closed) {
+        iour_complete_flags(iour, user_data, rv, IORING_CQE_F_MORE, true,
+                            false);
+        if (runqueue_push((thunk)&a->rearm))
+            return;
+        rv = -ENOMEM;
+    }
+    fdesc_put(a->f);
+    thread_release(a->t);
+    deallocate(iour->h, a, sizeof(*a));
+    iour_complete(iour, user_data, rv, true, true);
+}
+
+static void iour_accept_multishot(io_uring iour, thread t, fdesc f,
+                                  struct sockaddr *addr, socklen_t *addrlen,
+                                  int flags, u64 user_data)
+{
+    struct sock *s = (struct sock *)f;
+    s32 err;
+    if (f->type != FDESC_TYPE_SOCKET) {
+        err = -ENOTSOCK;
+    } else if (!s->accept4_io) {
+        err = -EOPNOTSUPP;
+    } else {
+        iour_accept a = allocate(iour->h, sizeof(*a));
+        if (a != INVALID_ADDRESS) {
+            a->iour = iour;
+            a->f = f;
+            thread_reserve(t);
+            a->t = t;
+            a->user_data = user_data;
+            a->addr = addr;
+            a->addrlen = addrlen;
+            a->flags = flags;
+            init_closure(&a->complete, iour_accept_complete, a);
+            init_closure(&a->rearm, iour_accept_rearm, a);
+            fetch_and_add(&iour->noncancelable_ops, 1);
+            s->accept4_io(s, addr, addrlen, flags, t, true,
+                          (io_completion)&a->complete);
+            return;
+        }
+        err = -ENOMEM;
+    }
+    fdesc_put(f);
+    iour_complete(iour, user_data, err, false, false);
+}
+
 define_closure_function(2, 1, void, iour_timeout,
                         io_uring, iour, iour_timer, t,
                         u64, overruns)
@@ -728,7 +1460,7 @@ static void iour_timeout_add(io_uring iour, struct timespec *ts, u32 flags,
     iour_debug("target %ld", iour_tim->target);
 
     list_push_back(&iour->timers, &iour_tim->l);
-    iour_tim->t = register_timer(runloop_timers, CLOCK_ID_MONOTONIC,
+    iour_tim->t = kern_register_timer(CLOCK_ID_MONOTONIC,
         time_from_timespec(ts), flags & IORING_TIMEOUT_ABS, 0,
         init_closure(&iour_tim->handler, iour_timeout, iour, iour_tim));
     if (iour_tim->t == INVALID_ADDRESS) {
@@ -774,7 +1506,7 @@ closure_function(2, 2, void, iour_close_complete,
     closure_finish();
 }
 
-static int iour_register_files_update(io_uring iour, int *fds,
+static int iour_register_files_update(io_uring iour, process p, int *fds,
                                       unsigned int count, unsigned int offset)
 {
     iour_debug("count %d, offset %d", count, offset);
@@ -793,7 +1525,7 @@ static int iour_register_files_update(io_uring iour, int *fds,
             if (fds[i] == -1)
                 f = 0;
             else {
-                f = fdesc_get(current->p, fds[i]);
+                f = fdesc_get(p, fds[i]);
                 if (!f) {
                     iour_debug("invalid fd %d", fds[i]);
                     ret = -EBADF;
@@ -817,25 +1549,41 @@ static int iour_register_files_update(io_uring iour, int *fds,
     return ret;
 }
 
-static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
+static boolean iour_submit(io_uring iour, thread t, struct io_uring_sqe *sqe)
 {
     iour_debug("opcode %d, flags 0x%x, user_data %ld", sqe->opcode, sqe->flags,
         sqe->user_data);
     fdesc f = 0;
     s32 res;
-    if (sqe->flags & ~(IOSQE_FIXED_FILE | IOSQE_ASYNC)) {
+    if (sqe->flags & ~(IOSQE_FIXED_FILE | IOSQE_IO_DRAIN | IOSQE_IO_LINK |
+                       IOSQE_ASYNC | IOSQE_BUFFER_SELECT)) {
         /* non-supported flags */
         res = -EINVAL;
         goto complete;
     }
+    boolean bsel = (sqe->flags & IOSQE_BUFFER_SELECT) != 0;
+    if (bsel && (sqe->opcode != IORING_OP_READ) &&
+            (sqe->opcode != IORING_OP_RECV)) {
+        res = -EINVAL;
+        goto complete;
+    }
     switch(sqe->opcode) {
     case IORING_OP_READV:
     case IORING_OP_WRITEV:
     case IORING_OP_READ_FIXED:
     case IORING_OP_WRITE_FIXED:
     case IORING_OP_POLL_ADD:
+    case IORING_OP_FSYNC:
+    case IORING_OP_FALLOCATE:
+    case IORING_OP_FADVISE:
+    case IORING_OP_SENDMSG:
+    case IORING_OP_RECVMSG:
+    case IORING_OP_ACCEPT:
+    case IORING_OP_CONNECT:
     case IORING_OP_READ:
     case IORING_OP_WRITE:
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
         if (sqe->flags & IOSQE_FIXED_FILE) {
             iour_lock(iour);
             int fd = sqe->fd;
@@ -846,7 +1594,7 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
             }
             iour_unlock(iour);
         } else
-            f = fdesc_get(current->p, sqe->fd);
+            f = fdesc_get(t->p, sqe->fd);
         if (!f) {
             res = -EBADF;
             goto complete;
@@ -895,19 +1643,21 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
                 res = -EFAULT;
             } else {
                 iour_unlock(iour);
-                iour_rw(iour, f, write, buf, len, sqe->off, sqe->user_data);
+                iour_rw(iour, t, f, write, true, buf, len, sqe->off,
+                        sqe->user_data);
                 return true;
             }
         }
         iour_unlock(iour);
         goto complete;
     case IORING_OP_POLL_ADD:
-        if (sqe->ioprio || sqe->off || sqe->addr || sqe->len ||
-                sqe->buf_index) {
+        if (sqe->ioprio || sqe->off || sqe->addr ||
+                (sqe->len & ~IORING_POLL_ADD_MULTI) || sqe->buf_index) {
             res = -EINVAL;
             goto complete;
         }
-        iour_poll_add(iour, f, sqe->poll_events, sqe->user_data);
+        iour_poll_add(iour, t, f, sqe->poll_events,
+                      (sqe->len & IORING_POLL_ADD_MULTI) != 0, sqe->user_data);
         break;
     case IORING_OP_POLL_REMOVE:
         if (sqe->ioprio || sqe->off || sqe->len || sqe->poll_events ||
@@ -946,12 +1696,12 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
         }
         int fd = sqe->fd;
         if ((sqe->flags & IOSQE_FIXED_FILE) ||
-                !(f = fdesc_get(current->p, fd)) || (f == &iour->f)) {
+                !(f = fdesc_get(t->p, fd)) || (f == &iour->f)) {
             res = -EBADF;
             goto complete;
         }
         iour_debug("closing fd %d", fd);
-        deallocate_fd(current->p, fd);
+        deallocate_fd(t->p, fd);
         if (fetch_and_add(&f->refcnt, -2) == 2) {
             io_completion completion = closure(iour->h, iour_close_complete,
                 iour, sqe->user_data);
@@ -969,12 +1719,15 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
             res = -EINVAL;
             goto complete;
         }
-        res = iour_register_files_update(iour, (int *)sqe->addr, sqe->len,
-            sqe->off);
+        res = iour_register_files_update(iour, t->p, (int *)sqe->addr,
+            sqe->len, sqe->off);
         goto complete;
     case IORING_OP_READ:
     case IORING_OP_WRITE:
-        if (sqe->buf_index) {
+        if (bsel) {
+            iour_bsel_add(iour, t, f, sqe->buf_group, sqe->len, sqe->off,
+                          sqe->user_data);
+        } else if (sqe->buf_index) {
             res = -EINVAL;
             goto complete;
         } else {
@@ -986,9 +1739,174 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
                 res = -EFAULT;
                 goto complete;
             }
-            iour_rw(iour, f, write, buf, len, sqe->off, sqe->user_data);
+            iour_rw(iour, t, f, write, false, buf, len, sqe->off,
+                    sqe->user_data);
+        }
+        break;
+    case IORING_OP_FSYNC:
+        if (sqe->ioprio || sqe->addr || sqe->buf_index ||
+                (sqe->fsync_flags & ~IORING_FSYNC_DATASYNC)) {
+            res = -EINVAL;
+            goto complete;
+        }
+        /* the whole file is synced, regardless of the requested range */
+        iour_fs_op(iour, t, f, false, 0, 0, 0, sqe->user_data);
+        break;
+    case IORING_OP_FALLOCATE:
+        if (sqe->ioprio || sqe->buf_index || sqe->rw_flags) {
+            res = -EINVAL;
+            goto complete;
         }
+        iour_fs_op(iour, t, f, true, sqe->len, sqe->off, sqe->addr,
+                   sqe->user_data);
         break;
+    case IORING_OP_FADVISE:
+        if (sqe->ioprio || sqe->addr || sqe->buf_index) {
+            res = -EINVAL;
+            goto complete;
+        }
+        res = fadvise_internal(f, sqe->off, sqe->len, sqe->fadvise_advice);
+        goto complete;
+    case IORING_OP_MADVISE:
+        if (sqe->ioprio || sqe->off || sqe->buf_index) {
+            res = -EINVAL;
+            goto complete;
+        }
+        res = madvise_internal(t->p, pointer_from_u64(sqe->addr), sqe->len,
+                               sqe->fadvise_advice);
+        goto complete;
+    case IORING_OP_OPENAT:
+    case IORING_OP_STATX:
+        if (sqe->ioprio || sqe->buf_index) {
+            res = -EINVAL;
+            goto complete;
+        }
+        if (t != current) {
+            /* path lookups need the submitter's syscall context, which the
+             * SQ poller doesn't have */
+            res = -EOPNOTSUPP;
+            goto complete;
+        }
+        if (sqe->opcode == IORING_OP_OPENAT)
+            res = openat(sqe->fd, pointer_from_u64(sqe->addr),
+                         sqe->open_flags, sqe->len);
+        else
+            res = statx_internal(sqe->fd, pointer_from_u64(sqe->addr),
+                                 sqe->statx_flags, pointer_from_u64(sqe->off));
+        goto complete;
+    case IORING_OP_SENDMSG:
+    case IORING_OP_RECVMSG: {
+        if (sqe->ioprio || sqe->buf_index) {
+            res = -EINVAL;
+            goto complete;
+        }
+        struct msghdr *msg = pointer_from_u64(sqe->addr);
+        boolean send = sqe->opcode == IORING_OP_SENDMSG;
+        if (!validate_msghdr(msg, !send)) {
+            res = -EFAULT;
+            goto complete;
+        }
+        iour_sock_msg(iour, t, f, send, msg, 0, sqe->msg_flags, sqe->user_data);
+        break;
+    }
+    case IORING_OP_SEND:
+    case IORING_OP_RECV: {
+        if (sqe->ioprio || sqe->off || (sqe->buf_index && !bsel) ||
+                (bsel && sqe->msg_flags)) {
+            res = -EINVAL;
+            goto complete;
+        }
+        void *buf = pointer_from_u64(sqe->addr);
+        u32 len = sqe->len;
+        boolean send = sqe->opcode == IORING_OP_SEND;
+        if (!bsel && !validate_user_memory(buf, len, !send)) {
+            res = -EFAULT;
+            goto complete;
+        }
+        if (f->type != FDESC_TYPE_SOCKET) {
+            res = -ENOTSOCK;
+            goto complete;
+        }
+        if (bsel) {
+            iour_bsel_add(iour, t, f, sqe->buf_group, len, 0, sqe->user_data);
+            break;
+        }
+        if (!sqe->msg_flags) {
+            /* plain socket reads and writes are equivalent */
+            iour_rw(iour, t, f, send, false, buf, len, 0, sqe->user_data);
+            break;
+        }
+        iour_msg m = allocate(iour->h, sizeof(*m));
+        if (m == INVALID_ADDRESS) {
+            res = -ENOMEM;
+            goto complete;
+        }
+        zero(&m->msg, sizeof(m->msg));
+        m->iov.iov_base = buf;
+        m->iov.iov_len = len;
+        m->msg.msg_iov = &m->iov;
+        m->msg.msg_iovlen = 1;
+        iour_sock_msg(iour, t, f, send, &m->msg, m, sqe->msg_flags, sqe->user_data);
+        break;
+    }
+    case IORING_OP_ACCEPT: {
+        if ((sqe->ioprio & ~IORING_ACCEPT_MULTISHOT) || sqe->len ||
+                sqe->buf_index) {
+            res = -EINVAL;
+            goto complete;
+        }
+        struct sockaddr *addr = pointer_from_u64(sqe->addr);
+        socklen_t *addrlen = pointer_from_u64(sqe->off);
+        if (addr && (!validate_user_memory(addrlen, sizeof(socklen_t), true) ||
+                     !validate_user_memory(addr, *addrlen, true))) {
+            res = -EFAULT;
+            goto complete;
+        }
+        if (sqe->ioprio & IORING_ACCEPT_MULTISHOT) {
+            iour_accept_multishot(iour, t, f, addr, addrlen, sqe->accept_flags,
+                                  sqe->user_data);
+            break;
+        }
+        struct sock *s = (struct sock *)f;
+        io_completion c = iour_sock_prepare(iour, f,
+            (f->type == FDESC_TYPE_SOCKET) && s->accept4_io, sqe->user_data);
+        if (c)
+            s->accept4_io(s, addr, addrlen, sqe->accept_flags, t, true, c);
+        break;
+    }
+    case IORING_OP_CONNECT: {
+        if (sqe->ioprio || sqe->len || sqe->buf_index || sqe->rw_flags) {
+            res = -EINVAL;
+            goto complete;
+        }
+        struct sockaddr *addr = pointer_from_u64(sqe->addr);
+        socklen_t addrlen = sqe->off;
+        if (!validate_user_memory(addr, addrlen, false)) {
+            res = -EFAULT;
+            goto complete;
+        }
+        struct sock *s = (struct sock *)f;
+        io_completion c = iour_sock_prepare(iour, f,
+            (f->type == FDESC_TYPE_SOCKET) && s->connect_io, sqe->user_data);
+        if (c)
+            s->connect_io(s, addr, addrlen, t, true, c);
+        break;
+    }
+    case IORING_OP_PROVIDE_BUFFERS:
+        if (sqe->ioprio || sqe->rw_flags) {
+            res = -EINVAL;
+            goto complete;
+        }
+        res = iour_provide_buffers(iour, sqe->addr, sqe->len, sqe->fd, sqe->off,
+                                   sqe->buf_group);
+        goto complete;
+    case IORING_OP_REMOVE_BUFFERS:
+        if (sqe->ioprio || sqe->addr || sqe->len || sqe->off || sqe->rw_flags) {
+            res = -EINVAL;
+            goto complete;
+        }
+        res = iour_remove_buffers(iour, sqe->fd, sqe->buf_group);
+        goto complete;
     default:
         iour_complete(iour, sqe->user_data, -EINVAL, false, false);
         return false;
@@ -1001,6 +1919,178 @@ complete:
     return true;
 }
 
+/* Returns the next SQE, 0 if the SQ is empty, or INVALID_ADDRESS if the SQ
+ * entry has an invalid index (and has been dropped). */
+static struct io_uring_sqe *iour_sq_next(io_uring iour)
+{
+    io_rings rings = iour->rings;
+    if (rings->sq_head >= rings->sq_tail)
+        return 0;
+    u32 sqe_index = iour->sq_array[rings->sq_head & iour->sq_mask];
+    rings->sq_head++;
+    if (sqe_index < iour->sq_entries)
+        return &iour->sqes[sqe_index];
+    iour_debug("sqe dropped: index %d, entries %d", sqe_index,
+        iour->sq_entries);
+    rings->sq_dropped++;
+    return INVALID_ADDRESS;
+}
+
+static boolean iour_link_add(io_uring iour, iour_link c,
+                             struct io_uring_sqe *sqe)
+{
+    iour_sqe s = allocate(iour->h, sizeof(*s));
+    if (s == INVALID_ADDRESS)
+        return false;
+    runtime_memcpy(&s->sqe, sqe, sizeof(*sqe));
+    list_push_back(&c->sqes, &s->l);
+    c->count++;
+    return true;
+}
+
+/* Takes a linked chain (or a single request, if deferred) starting with sqe
+ * off the SQ; returns the number of SQ entries consumed. */
+static unsigned int iour_submit_group(io_uring iour, thread t,
+                                      struct io_uring_sqe *sqe, boolean defer,
+                                      unsigned int max)
+{
+    unsigned int consumed = 1;
+    iour_link c = allocate(iour->h, sizeof(*c));
+    if (c == INVALID_ADDRESS) {
+        iour_lock(iour);
+        iour->inflight++;
+        iour_unlock(iour);
+        iour_complete(iour, sqe->user_data, -ENOMEM, false, false);
+        return consumed;
+    }
+    list_init(&c->sqes);
+    c->count = 0;
+    thread_reserve(t);
+    c->t = t;
+    c->drain = (sqe->flags & IOSQE_IO_DRAIN) != 0;
+    c->failed = false;
+    while (true) {
+        if (!iour_link_add(iour, c, sqe)) {
+            iour_lock(iour);
+            iour->inflight++;
+            iour_unlock(iour);
+            iour_complete(iour, sqe->user_data, -ENOMEM, false, false);
+            c->failed = true;
+        }
+        /* a chain is cut short by the end of the submission, as in Linux */
+        if (!(sqe->flags & IOSQE_IO_LINK) || (consumed == max))
+            break;
+        sqe = iour_sq_next(iour);
+        if (!sqe || (sqe == INVALID_ADDRESS))
+            break;
+        consumed++;
+    }
+    iour_lock(iour);
+    if (defer && !c->failed) {
+        list_push_back(&iour->deferred, &c->l);
+        c = 0;
+    } else {
+        iour->inflight += c->count;
+        if (c->failed)
+            iour_link_cancel_locked(iour, c);
+    }
+    iour_unlock(iour);
+    if (!c)
+        iour_advance(iour);
+    else if (c->failed)
+        iour_link_free(iour, c);
+    else
+        iour_link_start(iour, c);
+    return consumed;
+}
+
+static unsigned int iour_submit_sq(io_uring iour, thread t, unsigned int to_submit)
+{
+    read_barrier();
+    iour_debug("SQ head %d, SQ tail %d", iour->rings->sq_head,
+               iour->rings->sq_tail);
+    unsigned int submitted = 0;
+    while (submitted < to_submit) {
+        struct io_uring_sqe *sqe = iour_sq_next(iour);
+        if (!sqe || (sqe == INVALID_ADDRESS))
+            break;
+        iour_lock(iour);
+        boolean defer = (sqe->flags & IOSQE_IO_DRAIN) ||
+                !list_empty(&iour->deferred);
+        if (!defer && !(sqe->flags & IOSQE_IO_LINK))
+            iour->inflight++;
+        iour_unlock(iour);
+        if (defer || (sqe->flags & IOSQE_IO_LINK)) {
+            submitted += iour_submit_group(iour, t, sqe, defer,
+                                           to_submit - submitted);
+        } else {
+            submitted++;
+            if (!iour_submit(iour, t, sqe))
+                break;
+        }
+    }
+    return submitted;
+}
+
+define_closure_function(1, 1, void, iour_sqpoll,
+                        io_uring, iour,
+                        u64, overruns)
+{
+    io_uring iour = bound(iour);
+    timestamp here = now(CLOCK_ID_MONOTONIC);
+    if (!iour->closed) {
+        if (iour_submit_sq(iour, iour->sq_thread, iour->sq_entries) > 0) {
+            iour->sq_last_active = here;
+            return;
+        }
+        if (here - iour->sq_last_active < iour->sq_idle)
+            return;
+    }
+    iour_lock(iour);
+    if (!iour->closed) {
+        /* Publish NEED_WAKEUP before the final look at the tail, so that a
+         * submitter either sees the flag or has its entries picked up here. */
+        iour->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
+        memory_barrier();
+        if (iour->rings->sq_head != iour->rings->sq_tail) {
+            iour->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+            iour_unlock(iour);
+            return;
+        }
+    }
+    iour_debug("poller idle");
+    remove_timer(iour->sq_timer, 0);
+    iour->sq_timer = 0;
+    boolean release = (fetch_and_add(&iour->noncancelable_ops, -1) == 1) &&
+            iour->shutdown;
+    blockq bq = iour->bq;
+    iour_unlock(iour);
+    if (release)
+        iour_release(iour);
+    else if (bq)
+        blockq_wake_one(bq);
+}
+
+/* called with the io_uring lock held */
+static boolean iour_sqpoll_start(io_uring iour)
+{
+    if (iour->sq_timer || iour->closed)
+        return true;
+    iour->sq_last_active = now(CLOCK_ID_MONOTONIC);
+    iour->sq_timer = kern_register_timer(CLOCK_ID_MONOTONIC,
+        IOUR_SQPOLL_INTERVAL, false, IOUR_SQPOLL_INTERVAL,
+        init_closure(&iour->sqpoll, iour_sqpoll, iour));
+    if (iour->sq_timer == INVALID_ADDRESS) {
+        /* leave NEED_WAKEUP set so that the next submitter retries */
+        iour->sq_timer = 0;
+        iour->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
+        return false;
+    }
+    fetch_and_add(&iour->noncancelable_ops, 1);
+    iour->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+    return true;
+}
+
 simple_closure_function(7, 1, sysreturn, iour_getevents_bh,
                         io_uring, iour, sysreturn, submitted, unsigned int, min_complete, unsigned int, timeouts, boolean, sig_set, thread, t, io_completion, completion,
                         u64, flags)
@@ -1046,7 +2136,7 @@ sysreturn io_uring_enter(int fd, unsigned int to_submit,
         to_submit, min_complete, flags, sig);
     io_uring iour = iour_from_fd(current->p, fd);
     sysreturn rv;
-    if (flags & ~IORING_ENTER_GETEVENTS) {
+    if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP)) {
         rv = -EINVAL;
         goto out;
     }
@@ -1062,25 +2152,23 @@ sysreturn io_uring_enter(int fd, unsigned int to_submit,
             goto out;
         }
     }
-    io_rings rings = iour->rings;
-    read_barrier();
-    iour_debug("SQ head %d, SQ tail %d", rings->sq_head, rings->sq_tail);
     unsigned int submitted;
-    for (submitted = 0; submitted < to_submit;) {
-        if (rings->sq_head >= rings->sq_tail)
-            break;
-        u32 sqe_index = iour->sq_array[rings->sq_head & iour->sq_mask];
-        rings->sq_head++;
-        if (sqe_index < iour->sq_entries) {
-            submitted++;
-            if (!iour_submit(iour, &iour->sqes[sqe_index]))
-                break;
-        } else {
-            iour_debug("sqe dropped: index %d, entries %d", sqe_index,
-                iour->sq_entries);
-            iour->rings->sq_dropped++;
-            break;
+    if (iour->sq_thread) {
+        /* the poller owns the SQ; only restart it if it went idle */
+        if (flags & IORING_ENTER_SQ_WAKEUP) {
+            iour_lock(iour);
+            boolean started = iour_sqpoll_start(iour);
+            iour_unlock(iour);
+            if (!started) {
+                if (bh)
+                    deallocate_closure(bh);
+                rv = -ENOMEM;
+                goto out;
+            }
         }
+        submitted = to_submit;
+    } else {
+        submitted = iour_submit_sq(iour, current, to_submit);
     }
     rv = submitted;
     if (flags & IORING_ENTER_GETEVENTS) {
@@ -1110,6 +2198,11 @@ static sysreturn iour_register_buffers(io_uring iour, struct iovec *bufs,
 {
     if ((count == 0) || (count > IOV_MAX))
         return -EINVAL;
+
+    /* fault the buffers in now (outside the lock) rather than on each fixed
+     * request */
+    for (unsigned int i = 0; i < count; i++)
+        fixed_buffer_prefault(bufs[i].iov_base, bufs[i].iov_len);
     sysreturn ret;
     iour_lock(iour);
     if (iour->buf_count)
@@ -1235,6 +2328,60 @@ static sysreturn iour_unregister_eventfd(io_uring iour)
     return ret;
 }
 
+static sysreturn iour_register_pbuf_ring(io_uring iour,
+                                        struct io_uring_buf_reg *reg)
+{
+    iour_debug("ring 0x%lx, entries %d, bgid %d", reg->ring_addr,
+               reg->ring_entries, reg->bgid);
+    u32 entries = reg->ring_entries;
+    if (reg->pad || reg->resv[0] || reg->resv[1] || reg->resv[2] ||
+            (entries == 0) || (entries > IOUR_PBUF_RING_MAX) ||
+            (entries & (entries - 1)) || (reg->ring_addr & MASK(PAGELOG)))
+        return -EINVAL;
+    struct io_uring_buf_ring *br = pointer_from_u64(reg->ring_addr);
+    if (!validate_user_memory(br, entries * sizeof(struct io_uring_buf), false))
+        return -EFAULT;
+    sysreturn ret = 0;
+    iour_lock(iour);
+    if (iour_bgroup_find(iour, reg->bgid)) {
+        ret = -EEXIST;
+    } else {
+        iour_bgroup g = allocate(iour->h, sizeof(*g));
+        if (g == INVALID_ADDRESS) {
+            ret = -ENOMEM;
+        } else {
+            g->bgid = reg->bgid;
+            list_init(&g->bufs);
+            g->ring = br;
+            g->ring_mask = entries - 1;
+            g->ring_head = 0;
+            list_push_back(&iour->bgroups, &g->l);
+        }
+    }
+    iour_unlock(iour);
+    return ret;
+}
+
+static sysreturn iour_unregister_pbuf_ring(io_uring iour,
+                                          struct io_uring_buf_reg *reg)
+{
+    if (reg->pad || reg->resv[0] || reg->resv[1] || reg->resv[2])
+        return -EINVAL;
+    sysreturn ret = 0;
+    iour_lock(iour);
+    iour_bgroup g = iour_bgroup_find(iour, reg->bgid);
+    if (!g) {
+        ret = -ENOENT;
+    } else if (!g->ring) {
+        ret = -EINVAL;
+    } else {
+        list_delete(&g->l);
+        iour_bgroup_free(iour, g);
+    }
+    iour_unlock(iour);
+    return ret;
+}
+
 static sysreturn iour_register_probe(struct io_uring_probe *probe,
                                      unsigned int op_count)
 {
@@ -1257,7 +2404,21 @@ static sysreturn iour_register_probe(struct io_uring_probe *probe,
             probe->ops[IORING_OP_CLOSE].flags =
             probe->ops[IORING_OP_FILES_UPDATE].flags =
             probe->ops[IORING_OP_READ].flags =
-            probe->ops[IORING_OP_WRITE].flags = IO_URING_OP_SUPPORTED;
+            probe->ops[IORING_OP_WRITE].flags =
+            probe->ops[IORING_OP_SENDMSG].flags =
+            probe->ops[IORING_OP_RECVMSG].flags =
+            probe->ops[IORING_OP_ACCEPT].flags =
+            probe->ops[IORING_OP_CONNECT].flags =
+            probe->ops[IORING_OP_SEND].flags =
+            probe->ops[IORING_OP_RECV].flags =
+            probe->ops[IORING_OP_FSYNC].flags =
+            probe->ops[IORING_OP_FALLOCATE].flags =
+            probe->ops[IORING_OP_OPENAT].flags =
+            probe->ops[IORING_OP_STATX].flags =
+            probe->ops[IORING_OP_FADVISE].flags =
+            probe->ops[IORING_OP_MADVISE].flags =
+            probe->ops[IORING_OP_PROVIDE_BUFFERS].flags =
+            probe->ops[IORING_OP_REMOVE_BUFFERS].flags = IO_URING_OP_SUPPORTED;
     return 0;
 }
 
@@ -1293,7 +2454,8 @@ sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
         else if (fu->resv)
             rv = -EINVAL;
         else
-            rv = iour_register_files_update(iour, fu->fds, nr_args, fu->offset);
+            rv = iour_register_files_update(iour, current->p, fu->fds, nr_args,
+                                            fu->offset);
         break;
     }
     case IORING_UNREGISTER_FILES:
@@ -1327,6 +2489,19 @@ sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
             rv = iour_register_probe(probe, nr_args);
         break;
     }
+    case IORING_REGISTER_PBUF_RING:
+    case IORING_UNREGISTER_PBUF_RING: {
+        struct io_uring_buf_reg *reg = (struct io_uring_buf_reg *)arg;
+        if (!validate_user_memory(reg, sizeof(*reg), false))
+            rv = -EFAULT;
+        else if (nr_args != 1)
+            rv = -EINVAL;
+        else if (opcode == IORING_REGISTER_PBUF_RING)
+            rv = iour_register_pbuf_ring(iour, reg);
+        else
+            rv = iour_unregister_pbuf_ring(iour, reg);
+        break;
+    }
     default:
         rv = -EINVAL;
         break;
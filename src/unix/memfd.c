@@ -0,0 +1,277 @@
+#include <unix_internal.h>
+
+/* Memory file descriptors (memfd_create): files with no name in the
+   filesystem and no backing storage. Data lives in the pages of an unbacked
+   pagecache node, so shared mappings are handled by the same shared map
+   machinery as regular files. Pages stay resident until the last descriptor
+   is closed and the last shared mapping of the file is gone. */
+
+#define MEMFD_NAME_MAX  249     /* as in Linux, excluding the "memfd:" prefix */
+
+#define MEMFD_SEALS_ALL (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | \
+                         F_SEAL_FUTURE_WRITE)
+
+typedef struct memfd {
+    struct file f;              /* must be first; offset and length used by lseek */
+    heap h;
+    pagecache_node node;
+    u32 seals;
+} *memfd;
+
+static pagecache_volume memfd_volume;
+
+boolean memfd_init(unix_heaps uh)
+{
+    memfd_volume = pagecache_allocate_volume(infinity, PAGELOG);
+    return memfd_volume != INVALID_ADDRESS;
+}
+
+closure_function(7, 1, void, memfd_read_complete,
+                 memfd, mfd, thread, t, sg_list, sg, void *, dest, u64, limit, boolean, is_file_offset, io_completion, completion,
+                 status, s)
+{
+    thread_log(bound(t), "%s: status %v", __func__, s);
+    thread_resume(bound(t));
+    sysreturn rv;
+    if (is_ok(s)) {
+        u64 count = sg_copy_to_buf_and_release(bound(dest), bound(sg), bound(limit));
+        if (bound(is_file_offset))
+            bound(mfd)->f.offset += count;
+        rv = count;
+    } else {
+        sg_list_release(bound(sg));
+        deallocate_sg_list(bound(sg));
+        rv = -EIO;
+    }
+    apply(bound(completion), bound(t), rv);
+    closure_finish();
+}
+
+closure_function(1, 6, sysreturn, memfd_read,
+                 memfd, mfd,
+                 void *, dest, u64, length, u64, offset_arg, thread, t, boolean, bh, io_completion, completion)
+{
+    memfd mfd = bound(mfd);
+    boolean is_file_offset = offset_arg == infinity;
+    u64 offset = is_file_offset ? mfd->f.offset : offset_arg;
+    thread_log(t, "%s: mfd %p, dest %p, offset %ld, length %ld, file length %ld",
+               __func__, mfd, dest, offset, length, mfd->f.length);
+    if (offset >= mfd->f.length)
+        return io_complete(completion, t, 0);
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
+    status_handler sh = closure(mfd->h, memfd_read_complete, mfd, t, sg, dest, length,
+                                is_file_offset, completion);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        return io_complete(completion, t, -ENOMEM);
+    }
+    apply(pagecache_node_get_reader(mfd->node), sg, irangel(offset, length), sh);
+    return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
+}
+
+closure_function(6, 1, void, memfd_write_complete,
+                 memfd, mfd, thread, t, sg_list, sg, u64, length, boolean, is_file_offset, io_completion, completion,
+                 status, s)
+{
+    memfd mfd = bound(mfd);
+    thread_log(bound(t), "%s: mfd %p, status %v", __func__, mfd, s);
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    sysreturn rv;
+    if (is_ok(s)) {
+        mfd->f.length = pagecache_get_node_length(mfd->node);
+        if (bound(is_file_offset))
+            mfd->f.offset += bound(length);
+        rv = bound(length);
+    } else {
+        rv = -EIO;
+    }
+    apply(bound(completion), bound(t), rv);
+    closure_finish();
+}
+
+closure_function(1, 6, sysreturn, memfd_write,
+                 memfd, mfd,
+                 void *, src, u64, length, u64, offset_arg, thread, t, boolean, bh, io_completion, completion)
+{
+    memfd mfd = bound(mfd);
+    boolean is_file_offset = offset_arg == infinity;
+    u64 offset = is_file_offset ? mfd->f.offset : offset_arg;
+    thread_log(t, "%s: mfd %p, src %p, offset %ld, length %ld, file length %ld",
+               __func__, mfd, src, offset, length, mfd->f.length);
+    if (mfd->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE))
+        return io_complete(completion, t, -EPERM);
+    if ((mfd->seals & F_SEAL_GROW) && offset + length > mfd->f.length)
+        return io_complete(completion, t, -EPERM);
+    if (length == 0)
+        return io_complete(completion, t, 0);
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
+    sg_buf sgb = sg_list_tail_add(sg, length);
+    if (sgb == INVALID_ADDRESS)
+        goto nomem;
+    sgb->buf = src;
+    sgb->size = length;
+    sgb->offset = 0;
+    sgb->refcount = 0;
+    status_handler sh = closure(mfd->h, memfd_write_complete, mfd, t, sg, length,
+                                is_file_offset, completion);
+    if (sh == INVALID_ADDRESS)
+        goto nomem;
+    apply(pagecache_node_get_writer(mfd->node), sg, irangel(offset, length), sh);
+    return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
+  nomem:
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    return io_complete(completion, t, -ENOMEM);
+}
+
+closure_function(1, 1, u32, memfd_events,
+                 memfd, mfd,
+                 thread, t /* ignore */)
+{
+    return EPOLLIN | EPOLLOUT;
+}
+
+closure_function(1, 2, sysreturn, memfd_close,
+                 memfd, mfd,
+                 thread, t, io_completion, completion)
+{
+    memfd mfd = bound(mfd);
+    pagecache_release_unbacked_node(mfd->node);
+    deallocate_closure(mfd->f.f.read);
+    deallocate_closure(mfd->f.f.write);
+    deallocate_closure(mfd->f.f.events);
+    deallocate_closure(mfd->f.f.close);
+    release_fdesc(&mfd->f.f);
+    deallocate(mfd->h, mfd, sizeof(*mfd));
+    return io_complete(completion, t, 0);
+}
+
+sysreturn memfd_create(const char *name, unsigned int flags)
+{
+    if (!validate_user_string(name))
+        return -EFAULT;
+    thread_log(current, "%s: name \"%s\", flags 0x%x", __func__, name, flags);
+    /* huge pages are used where possible anyway, so MFD_HUGETLB is accepted */
+    if (flags & ~(MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB))
+        return -EINVAL;
+    if (runtime_strlen(name) > MEMFD_NAME_MAX)
+        return -EINVAL;
+
+    heap h = heap_general(get_kernel_heaps());
+    memfd mfd = allocate_zero(h, sizeof(*mfd));
+    if (mfd == INVALID_ADDRESS)
+        return -ENOMEM;
+    mfd->node = pagecache_allocate_unbacked_node(memfd_volume);
+    if (mfd->node == INVALID_ADDRESS) {
+        deallocate(h, mfd, sizeof(*mfd));
+        return -ENOMEM;
+    }
+    init_fdesc(h, &mfd->f.f, FDESC_TYPE_MEMFD);
+    mfd->f.f.flags = O_RDWR | ((flags & MFD_CLOEXEC) ? O_CLOEXEC : 0);
+    mfd->f.f.read = closure(h, memfd_read, mfd);
+    mfd->f.f.write = closure(h, memfd_write, mfd);
+    mfd->f.f.events = closure(h, memfd_events, mfd);
+    mfd->f.f.close = closure(h, memfd_close, mfd);
+    mfd->h = h;
+    mfd->seals = (flags & MFD_ALLOW_SEALING) ? 0 : F_SEAL_SEAL;
+    u64 fd = allocate_fd(current->p, mfd);
+    if (fd == INVALID_PHYSICAL) {
+        apply(mfd->f.f.close, 0, io_completion_ignore);
+        return -EMFILE;
+    }
+    return fd;
+}
+
+pagecache_node memfd_get_cachenode(fdesc f)
+{
+    return ((memfd)f)->node;
+}
+
+/* Shared mappings of a write-sealed file may not be made writable. */
+u32 memfd_perms(process p, fdesc f, boolean shared)
+{
+    u32 perms = anon_perms(p);
+    if (shared && (((memfd)f)->seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)))
+        perms &= ~ACCESS_PERM_WRITE;
+    return perms;
+}
+
+closure_function(3, 1, void, memfd_shrink_complete,
+                 thread, t, memfd, mfd, u64, length,
+                 status, s)
+{
+    memfd mfd = bound(mfd);
+    sysreturn rv;
+    if (is_ok(s)) {
+        pagecache_set_node_length(mfd->node, bound(length));
+        mfd->f.length = bound(length);
+        rv = 0;
+    } else {
+        rv = -EIO;
+    }
+    syscall_return(bound(t), rv);
+    closure_finish();
+}
+
+/* Growing only extends the node, whose new pages are filled with zeros. The
+   cached contents of a truncated range are zeroed, so that they don't
+   reappear if the file grows again; the pages themselves stay resident until
+   the file is released. */
+sysreturn memfd_truncate(fdesc f, long length)
+{
+    memfd mfd = (memfd)f;
+    thread_log(current, "%s: mfd %p, length %ld, file length %ld", __func__, mfd, length,
+               mfd->f.length);
+    if (length < 0)
+        return -EINVAL;
+    u64 old_length = mfd->f.length;
+    if (length == old_length)
+        return 0;
+    if (mfd->seals & (length < old_length ? F_SEAL_SHRINK : F_SEAL_GROW))
+        return -EPERM;
+    if (length > old_length) {
+        pagecache_set_node_length(mfd->node, length);
+        mfd->f.length = length;
+        return 0;
+    }
+    truncate_file_maps(current->p, mfd->node, length);
+    range q = irange(length, old_length);
+    if (!pagecache_node_range_cached(mfd->node, q)) {
+        pagecache_set_node_length(mfd->node, length);
+        mfd->f.length = length;
+        return 0;
+    }
+    status_handler sh = closure(mfd->h, memfd_shrink_complete, current, mfd, length);
+    if (sh == INVALID_ADDRESS)
+        return -ENOMEM;
+    apply(pagecache_node_get_writer(mfd->node), 0, q, sh);
+    return thread_maybe_sleep_uninterruptible(current);
+}
+
+/* As in Linux, a write seal cannot be added while the file has shared
+   mappings, which could be (or be made) writable. */
+sysreturn memfd_add_seals(fdesc f, u32 seals)
+{
+    memfd mfd = (memfd)f;
+    thread_log(current, "%s: mfd %p, seals 0x%x, current 0x%x", __func__, mfd, seals,
+               mfd->seals);
+    if (seals & ~MEMFD_SEALS_ALL)
+        return -EINVAL;
+    if (!fdesc_is_writable(f) || (mfd->seals & F_SEAL_SEAL))
+        return -EPERM;
+    if ((seals & F_SEAL_WRITE) && !(mfd->seals & F_SEAL_WRITE) &&
+        pagecache_node_is_shared_mapped(mfd->node))
+        return -EBUSY;
+    mfd->seals |= seals;
+    return 0;
+}
+
+sysreturn memfd_get_seals(fdesc f)
+{
+    return ((memfd)f)->seals;
+}
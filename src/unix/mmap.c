@@ -1,4 +1,5 @@
 #include <unix_internal.h>
+#include <filesystem.h>
 
 //#define PF_DEBUG
 #ifdef PF_DEBUG
@@ -7,8 +8,14 @@
 #define pf_debug(x, ...)
 #endif
 
-#define vmap_lock(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock)
-#define vmap_unlock(p) spin_unlock_irq(&(p)->vmap_lock, _savedflags)
+/* Changes to the vmaps are bracketed by increments of p->vmap_seq, so that
+   a fault can validate the thread's cached vmap without taking the lock. */
+#define vmap_lock(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock); \
+    (p)->vmap_seq++; write_barrier()
+#define vmap_unlock(p) write_barrier(); (p)->vmap_seq++; \
+    spin_unlock_irq(&(p)->vmap_lock, _savedflags)
+#define vmap_lock_read(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock)
+#define vmap_unlock_read(p) spin_unlock_irq(&(p)->vmap_lock, _savedflags)
 
 typedef struct vmap_heap {
     struct heap h;  /* must be first */
@@ -16,6 +23,47 @@ typedef struct vmap_heap {
     boolean randomize;
 } *vmap_heap;
 
+/* If enabled with the "transparent_hugepages" option or for a vmap with
+   MADV_HUGEPAGE advice, an anonymous fault is served with a whole 2M page
+   when the aligned 2M block around the fault lies within the vmap and has
+   nothing mapped yet, falling back to a 4K page when no contiguous
+   physical memory is available. MADV_NOHUGEPAGE opts a vmap out. Huge mappings
+   are split into 4K pages before an unmap, protection change or move that
+   covers them only in part. */
+static boolean transparent_hugepages;
+
+/* Likewise, with the "file_hugepages" option or MADV_HUGEPAGE advice, a
+   fault in a private read-only file mapping is served with a 2M pagecache
+   folio when the aligned 2M block around the fault lies within both the
+   vmap and the file, starts at a 2M-aligned file offset and has nothing
+   mapped yet. Otherwise, or if the range is already cached in 4K pages,
+   the fault maps a 4K page. */
+static boolean file_hugepages;
+
+/* Anonymous memory that was faulted in 4K at a time, e.g. because the 2M
+   block was partly mapped or no contiguous memory was free at the time, is
+   promoted to 2M pages in the background under the same policy. Every
+   "hugepage_scan_interval" milliseconds (default 1000; zero disables), up
+   to HUGEPAGE_SCAN_RANGES aligned 2M blocks of eligible vmaps are examined,
+   and the first one with all of its 4K pages present is collapsed. */
+#define HUGEPAGE_SCAN_INTERVAL_DEFAULT  1000
+#define HUGEPAGE_SCAN_RANGES            16
+
+/* On a file-backed fault, up to "fault_around" pages (default 16) in the
+   aligned window around the faulting page that are already in the pagecache
+   are mapped along with it. Zero disables. */
+#define FAULT_AROUND_PAGES_DEFAULT  16
+static u64 fault_around_pages;
+
+/* The top "stack_prefault" bytes (default 32K) of a thread stack - an
+   anonymous private mapping made with MAP_STACK or MAP_GROWSDOWN - and of a
+   signal stack are mapped up front with one physically contiguous chunk,
+   sparing a new thread a fault for each page it first touches. When a
+   thread stack is unmapped with its top chunk intact, the chunk is kept
+   for the next stack of the process. Zero disables. */
+#define STACK_PREFAULT_DEFAULT      (32 * KB)
+static u64 stack_prefault;
+
 /* kernel frame return must happen from runloop, not a bh completion service */
 closure_function(1, 0, void, kernel_frame_return,
                  kernel_context, kc)
@@ -38,7 +86,7 @@ closure_function(0, 1, void, kernel_demand_pf_complete,
     if (faulting_kernel_context) {
         init_closure(&do_kernel_frame_return, kernel_frame_return, faulting_kernel_context);
         faulting_kernel_context = 0;
-        enqueue_irqsafe(bhqueue, (thunk)&do_kernel_frame_return);
+        enqueue_irqsafe(bhqueues[BH_PRIO_INTERRUPT], (thunk)&do_kernel_frame_return);
     }
     kernel_demand_page_completed = true;
 }
@@ -57,23 +105,687 @@ define_closure_function(3, 1, void, thread_demand_file_page_complete,
     refcount_release(&bound(t)->refcount);
 }
 
+/* called with lock held */
+closure_function(0, 3, boolean, pte_unmapped,
+                 int, level, u64, vaddr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    return !pte_is_present(e) || !pte_is_mapping(level, e);
+}
+
+static boolean file_huge_page_eligible(vmap vm, u64 vaddr, u64 *vbase, u64 *node_base)
+{
+    if ((vm->flags & (VMAP_FLAG_NOHUGEPAGE | VMAP_FLAG_WRITABLE | VMAP_FLAG_SHARED)) ||
+        !(file_hugepages || (vm->flags & VMAP_FLAG_HUGEPAGE)))
+        return false;
+    u64 v = vaddr & ~PAGEMASK_2M;
+    if (!range_contains(vm->node.r, irangel(v, PAGESIZE_2M)))
+        return false;
+    u64 offset = vm->node_offset + (v - vm->node.r.start);
+    if ((offset & PAGEMASK_2M) ||
+        offset + PAGESIZE_2M > pagecache_get_node_length(vm->cache_node) ||
+        !traverse_ptes(v, PAGESIZE_2M, stack_closure(pte_unmapped)))
+        return false;
+    *vbase = v;
+    *node_base = offset;
+    return true;
+}
+
+static void file_fault_around(vmap vm, u64 page_addr, pageflags flags)
+{
+    if (!fault_around_pages)
+        return;
+    u64 window = fault_around_pages * PAGESIZE;
+    u64 start = MAX(page_addr - (page_addr % window), vm->node.r.start);
+    u64 end = MIN(start + window, vm->node.r.end);
+    u64 limit = vm->node.r.start - vm->node_offset +
+        pad(pagecache_get_node_length(vm->cache_node), PAGESIZE);
+    end = MIN(end, limit);
+    u64 node_start = vm->node_offset + (start - vm->node.r.start);
+    if (start < page_addr)
+        pagecache_map_filled_pages(vm->cache_node, node_start, start, page_addr - start, flags);
+    if (page_addr + PAGESIZE < end)
+        pagecache_map_filled_pages(vm->cache_node, node_start + (page_addr + PAGESIZE - start),
+                                   page_addr + PAGESIZE, end - page_addr - PAGESIZE, flags);
+}
+
 define_closure_function(5, 0, void, thread_demand_file_page,
                         thread, t, vmap, vm, u64, node_offset, u64, page_addr, pageflags, flags)
 {
     vmap vm = bound(vm);
     pagecache_node pn = vm->cache_node;
-    pagecache_map_page(pn, bound(node_offset), bound(page_addr), bound(flags),
-                       (status_handler)&bound(t)->demand_file_page_complete,
+    status_handler complete = (status_handler)&bound(t)->demand_file_page_complete;
+    u64 vbase, node_base;
+    if (file_huge_page_eligible(vm, bound(page_addr), &vbase, &node_base) &&
+        pagecache_map_huge_page(pn, node_base, vbase, bound(flags), complete,
+                                false /* complete on runqueue */))
+        return;                 /* read-ahead would break up the next folio */
+    pagecache_map_page(pn, bound(node_offset), bound(page_addr), bound(flags), complete,
                        false /* complete on runqueue */);
-    range ra = irange(bound(node_offset) + PAGESIZE,
-        vm->node_offset + range_span(vm->node.r));
-    if (range_valid(ra)) {
-        if (range_span(ra) > FILE_READAHEAD_DEFAULT)
-            ra.end = ra.start + FILE_READAHEAD_DEFAULT;
-        pagecache_node_fetch_pages(pn, ra);
+    file_ra_ondemand(&vm->ra, pn, bound(node_offset), PAGESIZE,
+                     vm->node_offset + range_span(vm->node.r), FILE_READAHEAD_MAX);
+    file_fault_around(vm, bound(page_addr), bound(flags));
+}
+
+static boolean anon_hugepage_allowed(vmap vm)
+{
+    return !(vm->flags & VMAP_FLAG_NOHUGEPAGE) &&
+        (transparent_hugepages || (vm->flags & VMAP_FLAG_HUGEPAGE));
+}
+
+boolean map_anonymous_huge_page(u64 vaddr, vmap vm, pageflags flags)
+{
+    if (!anon_hugepage_allowed(vm))
+        return false;
+    u64 vbase = vaddr & ~PAGEMASK_2M;
+    if (!range_contains(vm->node.r, irangel(vbase, PAGESIZE_2M)) ||
+        !traverse_ptes(vbase, PAGESIZE_2M, stack_closure(pte_unmapped)))
+        return false;
+    u64 paddr = allocate_u64(heap_physical_local(), PAGESIZE_2M);
+    if (paddr == INVALID_PHYSICAL)
+        return false;
+    map_and_zero(vbase, paddr, PAGESIZE_2M, flags);
+    return true;
+}
+
+/* User memory that I/O reaches outside of the process mappings - by DMA, or
+   from the network stack until a send is acknowledged - is pinned for the
+   duration. The pinned pages are mapped at a kernel alias, which the I/O
+   uses in place of the user address, and each physical page carries a pin
+   count: an unmap leaves a pinned page to be freed by its last unpin, and a
+   huge page collapse skips a block holding pinned pages. Only anonymous
+   mappings and the heap, stack and program segments can be pinned; file
+   mappings are left to the pagecache. Pins are taken under the vmap lock. */
+#define PIN_FREED   1   /* unmapped while pinned */
+#define PIN_ONE     2
+
+static struct spinlock pin_lock;
+static table pinned_pages;      /* physical page -> pins * PIN_ONE | PIN_FREED */
+
+/* called with pin_lock held */
+static inline u64 page_pins(u64 paddr)
+{
+    return u64_from_pointer(table_find(pinned_pages, pointer_from_u64(paddr)));
+}
+
+static boolean phys_range_pinned(u64 paddr, u64 length)
+{
+    boolean pinned = false;
+    u64 flags = spin_lock_irq(&pin_lock);
+    if (table_elements(pinned_pages) > 0) {
+        for (u64 p = paddr; p < paddr + length && !pinned; p += PAGESIZE)
+            pinned = page_pins(p) != 0;
+    }
+    spin_unlock_irq(&pin_lock, flags);
+    return pinned;
+}
+
+/* called with the page table lock held, so pinned pages only have their
+   existing entries updated */
+closure_function(0, 1, void, free_user_phys,
+                 range, r)
+{
+    id_heap phys = heap_physical(get_kernel_heaps());
+    u64 flags = spin_lock_irq(&pin_lock);
+    if (table_elements(pinned_pages) == 0) {
+        spin_unlock_irq(&pin_lock, flags);
+        if (!id_heap_set_area(phys, r.start, range_span(r), true, false))
+            msg_err("some of physical range %R not allocated in heap\n", r);
+        return;
+    }
+    for (u64 p = r.start; p < r.end; p += PAGESIZE) {
+        u64 pins = page_pins(p);
+        if (pins)
+            table_set(pinned_pages, pointer_from_u64(p), pointer_from_u64(pins | PIN_FREED));
+        else if (!id_heap_set_area(phys, p, PAGESIZE, true, false))
+            msg_err("physical page 0x%lx not allocated in heap\n", p);
+    }
+    spin_unlock_irq(&pin_lock, flags);
+}
+
+/* Like unmap_and_free_phys(), but pinned pages are freed by their last
+   unpin instead. */
+void unmap_and_free_user_phys(u64 vaddr, u64 length)
+{
+    unmap_pages_with_handler(vaddr, length, stack_closure(free_user_phys));
+}
+
+static void unpin_page(u64 paddr)
+{
+    u64 flags = spin_lock_irq(&pin_lock);
+    u64 pins = page_pins(paddr);
+    assert(pins >= PIN_ONE);
+    pins -= PIN_ONE;
+    table_set(pinned_pages, pointer_from_u64(paddr), pins >= PIN_ONE ? pointer_from_u64(pins) : 0);
+    spin_unlock_irq(&pin_lock, flags);
+    if (pins == PIN_FREED &&
+        !id_heap_set_area(heap_physical(get_kernel_heaps()), paddr, PAGESIZE, true, false))
+        msg_err("physical page 0x%lx not allocated in heap\n", paddr);
+}
+
+/* The pins are dropped only once the alias is gone, and not from an unmap
+   handler, as removing a table entry may release heap pages while the page
+   table lock is held. */
+#define UNPIN_BATCH 64
+
+static void unpin_alias(u64 alias, u64 len)
+{
+    u64 pages[UNPIN_BATCH];
+    u64 end = alias + len;
+    while (alias < end) {
+        int n;
+        for (n = 0; n < UNPIN_BATCH && alias + n * PAGESIZE < end; n++)
+            pages[n] = physical_from_virtual(pointer_from_u64(alias + n * PAGESIZE));
+        unmap(alias, n * PAGESIZE);
+        for (int i = 0; i < n; i++)
+            unpin_page(pages[i]);
+        alias += n * PAGESIZE;
+    }
+}
+
+closure_function(1, 1, void, pin_vmap_check,
+                 boolean *, pinnable,
+                 rmnode, n)
+{
+    vmap vm = (vmap)n;
+    if ((vm->flags & VMAP_FLAG_MMAP) &&
+        (vm->flags & VMAP_MMAP_TYPE_MASK) != VMAP_MMAP_TYPE_ANONYMOUS)
+        *bound(pinnable) = false;
+}
+
+closure_function(0, 1, void, pin_vmap_gap,
+                 range, q)
+{
+}
+
+/* Pins the pages of [addr, addr + length), which must all be present, and
+   returns the kernel alias of addr, or INVALID_ADDRESS if the range cannot
+   be pinned. */
+void *pin_user_pages(process p, void *addr, u64 length)
+{
+    u64 start = u64_from_pointer(addr) & ~PAGEMASK;
+    u64 len = pad(u64_from_pointer(addr) + length, PAGESIZE) - start;
+    heap vh = (heap)heap_virtual_page(get_kernel_heaps());
+    u64 alias = allocate_u64(vh, len);
+    if (alias == INVALID_PHYSICAL)
+        return INVALID_ADDRESS;
+    pageflags flags = pageflags_writable(pageflags_noexec(pageflags_memory()));
+    boolean pinnable = true;
+    u64 off = 0;
+    vmap_lock_read(p);
+    range q = irangel(start, len);
+    if (rangemap_range_find_gaps(p->vmaps, q, stack_closure(pin_vmap_gap)))
+        pinnable = false;
+    else
+        rangemap_range_lookup(p->vmaps, q, stack_closure(pin_vmap_check, &pinnable));
+    for (; pinnable && off < len; off += PAGESIZE) {
+        u64 paddr = physical_from_virtual(pointer_from_u64(start + off));
+        if (paddr == INVALID_PHYSICAL)
+            break;
+        u64 irqflags = spin_lock_irq(&pin_lock);
+        table_set(pinned_pages, pointer_from_u64(paddr),
+                  pointer_from_u64(page_pins(paddr) + PIN_ONE));
+        spin_unlock_irq(&pin_lock, irqflags);
+        map(alias + off, paddr, PAGESIZE, flags);
+    }
+    vmap_unlock_read(p);
+    if (off < len) {
+        unpin_alias(alias, off);
+        deallocate_u64(vh, alias, len);
+        return INVALID_ADDRESS;
+    }
+    return pointer_from_u64(alias + (u64_from_pointer(addr) & PAGEMASK));
+}
+
+/* Drops the pins taken by pin_user_pages() for the same length, given the
+   alias it returned. */
+void unpin_user_pages(void *alias, u64 length)
+{
+    u64 start = u64_from_pointer(alias) & ~PAGEMASK;
+    u64 len = pad(u64_from_pointer(alias) + length, PAGESIZE) - start;
+    unpin_alias(start, len);
+    deallocate_u64((heap)heap_virtual_page(get_kernel_heaps()), start, len);
+}
+
+/* MAP_POPULATE, MAP_LOCKED and mlock() prefault a range up front: anonymous
+   memory is mapped directly, with 2M pages for aligned blocks that have
+   nothing mapped yet, while a file range is fetched with one sequential
+   read and then faulted in from the kernel, waiting on the fills. Running
+   out of physical memory leaves the remainder to demand paging. */
+static void populate_anonymous(range q, u64 vmflags)
+{
+    pageflags flags = pageflags_from_vmflags(vmflags);
+    u64 v = q.start;
+    while (v < q.end) {
+        if (!(vmflags & VMAP_FLAG_NOHUGEPAGE) && !(v & PAGEMASK_2M) &&
+            v + PAGESIZE_2M <= q.end &&
+            traverse_ptes(v, PAGESIZE_2M, stack_closure(pte_unmapped))) {
+            u64 paddr = allocate_u64(heap_physical_local(), PAGESIZE_2M);
+            if (paddr != INVALID_PHYSICAL) {
+                map_and_zero(v, paddr, PAGESIZE_2M, flags);
+                v += PAGESIZE_2M;
+                continue;
+            }
+        }
+        if (physical_from_virtual(pointer_from_u64(v)) == INVALID_PHYSICAL) {
+            u64 paddr = allocate_u64(heap_physical_local(), PAGESIZE);
+            if (paddr == INVALID_PHYSICAL)
+                return;
+            map_and_zero(v, paddr, PAGESIZE, flags);
+        }
+        v += PAGESIZE;
+    }
+}
+
+/* called with the vmap lock held */
+static void prefault_stack_top(process p, range q, u64 vmflags)
+{
+    u64 len = MIN(stack_prefault, range_span(q));
+    if (len == 0)
+        return;
+    range top = irange(q.end - len, q.end);
+    if (len == stack_prefault &&
+        traverse_ptes(top.start, len, stack_closure(pte_unmapped))) {
+        u64 paddr = p->stack_cache_count > 0 ? p->stack_cache[--p->stack_cache_count] :
+            allocate_u64(heap_physical_local(), len);
+        if (paddr != INVALID_PHYSICAL) {
+            map_and_zero(top.start, paddr, len, pageflags_from_vmflags(vmflags));
+            return;
+        }
+    }
+    populate_anonymous(top, vmflags);
+}
+
+/* Take the top chunk of an unmapped thread stack into the process cache if
+   it is still backed by one contiguous allocation. Called with the vmap
+   lock held; r is left to be unmapped below the chunk. */
+static void stack_cache_put(process p, range *r)
+{
+    if (!stack_prefault || range_span(*r) < stack_prefault ||
+        p->stack_cache_count >= PROCESS_STACK_CACHE_SIZE)
+        return;
+    u64 start = r->end - stack_prefault;
+    u64 paddr = physical_from_virtual(pointer_from_u64(start));
+    if (paddr == INVALID_PHYSICAL)
+        return;
+    for (u64 off = PAGESIZE; off < stack_prefault; off += PAGESIZE) {
+        if (physical_from_virtual(pointer_from_u64(start + off)) != paddr + off)
+            return;
+    }
+    if (phys_range_pinned(paddr, stack_prefault))
+        return;
+    unmap(start, stack_prefault);
+    p->stack_cache[p->stack_cache_count++] = paddr;
+    r->end = start;
+}
+
+void prefault_user_stack(process p, u64 base, u64 length)
+{
+    range q = irange(pad(base, PAGESIZE), (base + length) & ~PAGEMASK);
+    if (!stack_prefault || q.end <= q.start)
+        return;
+    vmap_lock(p);
+    vmap vm = (vmap)rangemap_lookup(p->vmaps, q.end - 1);
+    if (vm != INVALID_ADDRESS &&
+        (vm->flags & (VMAP_MMAP_TYPE_MASK | VMAP_FLAG_SHARED | VMAP_FLAG_WRITABLE)) ==
+        (VMAP_MMAP_TYPE_ANONYMOUS | VMAP_FLAG_WRITABLE))
+        prefault_stack_top(p, range_intersection(q, vm->node.r), vm->flags);
+    vmap_unlock(p);
+}
+
+/* called under the kernel lock from a syscall, without the vmap lock */
+static void populate_file(pagecache_node node, u64 node_offset, range q, boolean nonblock)
+{
+    u64 limit = pad(pagecache_get_node_length(node), PAGESIZE);
+    if (node_offset >= limit)
+        return;
+    q.end = MIN(q.end, q.start + (limit - node_offset));
+    pagecache_node_fetch_pages(node, irangel(node_offset, range_span(q)));
+    if (nonblock)
+        return;
+    for (u64 v = q.start; v < q.end; v += PAGESIZE)
+        (void)*(volatile u8 *)pointer_from_u64(v);
+}
+
+void split_huge_mappings(range q)
+{
+    if (q.start & PAGEMASK_2M)
+        split_2m_page(q.start);
+    if (q.end & PAGEMASK_2M)
+        split_2m_page(q.end);
+}
+
+/* called with lock held */
+closure_function(1, 3, boolean, count_huge_page,
+                 u64 *, count,
+                 int, level, u64, vaddr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if (pte_is_present(e) && pte_map_size(level, e) == PAGESIZE_2M)
+        (*bound(count))++;
+    return true;
+}
+
+u64 process_anon_huge_pages(process p)
+{
+    u64 count = 0;
+    vmap_lock_read(p);
+    rangemap_foreach(p->vmaps, n) {
+        vmap vm = (vmap)n;
+        if ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS ||
+            vm == p->heap_map)
+            traverse_ptes(n->r.start, range_span(n->r), stack_closure(count_huge_page, &count));
+    }
+    vmap_unlock_read(p);
+    return count;
+}
+
+/* A collapse whose 4K pages are not already a 2M-aligned physical block
+   copies them to a new 2M page. The block is write-protected first, and the
+   copy starts once the write protection has reached all cpus; a write to
+   the block meanwhile aborts the collapse, and the writer's page is made
+   writable again. A block with pinned pages is not copied, since I/O may
+   still reach the old pages. Only one collapse is in progress at a time. */
+enum {
+    COLLAPSE_IDLE,
+    COLLAPSE_PROTECTED,     /* waiting for the write protection to land */
+    COLLAPSE_INSTALLING,    /* copying, or waiting for the old pages to go */
+    COLLAPSE_ABORTED,
+};
+
+static struct spinlock collapse_lock;
+static int collapse_state;
+static struct list collapse_waiters;    /* user writers held off by a copy */
+static process collapse_process;
+static u64 collapse_vaddr;
+static u64 collapse_vmflags;
+static u64 collapse_seq;
+static u64 collapse_paddr;
+static u64 collapse_pages[PAGESIZE_2M / PAGESIZE];
+static u64 collapse_window;
+static u64 collapse_cursor;
+static u64 hugepage_scan_interval;
+
+static struct {
+    u64 copied;
+    u64 in_place;
+    u64 aborted;
+    u64 alloc_failed;
+} collapse_stats;
+
+static void collapse_set_state(int state)
+{
+    struct list waiters;
+    u64 flags = spin_lock_irq(&collapse_lock);
+    collapse_state = state;
+    list_move(&waiters, &collapse_waiters);
+    spin_unlock_irq(&collapse_lock, flags);
+    list_foreach(&waiters, l) {
+        thread t = struct_from_list(l, thread, collapse_wait);
+        list_delete(l);
+        schedule_frame(thread_frame(t));
+        refcount_release(&t->refcount);
     }
 }
 
+/* called with lock held */
+closure_function(2, 3, boolean, collapse_gather,
+                 u64 *, count, boolean *, contiguous,
+                 int, level, u64, vaddr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if (!pte_is_present(e) || !pte_is_mapping(level, e))
+        return true;
+    if (pte_map_size(level, e) != PAGESIZE)
+        return false;
+    u64 i = (vaddr & PAGEMASK_2M) >> PAGELOG;
+    u64 paddr = page_from_pte(e);
+    if (paddr != collapse_pages[0] + (i << PAGELOG))
+        *bound(contiguous) = false;
+    collapse_pages[i] = paddr;
+    (*bound(count))++;
+    return true;
+}
+
+/* Records the 4K pages mapping the block at vbase, returning false unless
+   all of them are present. */
+static boolean collapse_gather_pages(u64 vbase, boolean *contiguous)
+{
+    u64 count = 0;
+    collapse_pages[0] = physical_from_virtual(pointer_from_u64(vbase));
+    if (collapse_pages[0] == INVALID_PHYSICAL)
+        return false;
+    *contiguous = (collapse_pages[0] & PAGEMASK_2M) == 0;
+    return traverse_ptes(vbase, PAGESIZE_2M,
+                         stack_closure(collapse_gather, &count, contiguous)) &&
+        count == PAGESIZE_2M / PAGESIZE;
+}
+
+static boolean collapse_pages_pinned(void)
+{
+    boolean pinned = false;
+    u64 flags = spin_lock_irq(&pin_lock);
+    if (table_elements(pinned_pages) > 0) {
+        for (int i = 0; i < PAGESIZE_2M / PAGESIZE && !pinned; i++)
+            pinned = page_pins(collapse_pages[i]) != 0;
+    }
+    spin_unlock_irq(&pin_lock, flags);
+    return pinned;
+}
+
+/* called with lock held */
+closure_function(1, 3, boolean, collapse_match,
+                 u64 *, count,
+                 int, level, u64, vaddr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if (!pte_is_present(e) || !pte_is_mapping(level, e))
+        return true;
+    if (pte_map_size(level, e) != PAGESIZE ||
+        page_from_pte(e) != collapse_pages[(vaddr & PAGEMASK_2M) >> PAGELOG])
+        return false;
+    (*bound(count))++;
+    return true;
+}
+
+/* Returns true if the block is still mapped by the pages recorded when the
+   collapse started, under a vmap that has not changed since. */
+static boolean collapse_unchanged(process p)
+{
+    if (p->vmap_seq == collapse_seq)
+        return true;
+    vmap vm = (vmap)rangemap_lookup(p->vmaps, collapse_vaddr);
+    if (vm == INVALID_ADDRESS || vm->flags != collapse_vmflags ||
+        !range_contains(vm->node.r, irangel(collapse_vaddr, PAGESIZE_2M)))
+        return false;
+    u64 count = 0;
+    return traverse_ptes(collapse_vaddr, PAGESIZE_2M, stack_closure(collapse_match, &count)) &&
+        count == PAGESIZE_2M / PAGESIZE;
+}
+
+/* Restore the protection of what is left of the block after an abort. */
+closure_function(0, 1, void, collapse_restore_vmap,
+                 rmnode, n)
+{
+    vmap vm = (vmap)n;
+    if ((vm->flags & VMAP_MMAP_TYPE_MASK) != VMAP_MMAP_TYPE_ANONYMOUS)
+        return;
+    range q = range_intersection(n->r, irangel(collapse_vaddr, PAGESIZE_2M));
+    update_map_flags(q.start, range_span(q), pageflags_from_vmflags(vm->flags));
+}
+
+static void collapse_abort(process p)
+{
+    rangemap_range_lookup(p->vmaps, irangel(collapse_vaddr, PAGESIZE_2M),
+                          stack_closure(collapse_restore_vmap));
+    deallocate_u64(heap_physical_local(), collapse_paddr, PAGESIZE_2M);
+    collapse_stats.aborted++;
+    collapse_set_state(COLLAPSE_IDLE);
+}
+
+/* The old translations are gone; the old pages may be released. This may
+   run with the flush lock held, so it must not invalidate anything. */
+closure_function(0, 0, void, collapse_done)
+{
+    if (collapse_paddr == INVALID_PHYSICAL) {
+        collapse_stats.in_place++;
+    } else {
+        heap phys = (heap)heap_physical(get_kernel_heaps());
+        for (int i = 0; i < PAGESIZE_2M / PAGESIZE; i++)
+            deallocate_u64(phys, collapse_pages[i], PAGESIZE);
+        collapse_stats.copied++;
+    }
+    collapse_set_state(COLLAPSE_IDLE);
+}
+
+static closure_struct(collapse_done, do_collapse_done);
+
+closure_function(0, 0, void, collapse_install)
+{
+    process p = collapse_process;
+    u64 flags = spin_lock_irq(&collapse_lock);
+    boolean aborted = collapse_state == COLLAPSE_ABORTED;
+    if (!aborted)
+        collapse_state = COLLAPSE_INSTALLING;
+    spin_unlock_irq(&collapse_lock, flags);
+
+    /* pins are taken under the vmap lock, so none can appear during the copy */
+    vmap_lock_read(p);
+    if (aborted || !collapse_unchanged(p) || collapse_pages_pinned())
+        goto abort;
+    map(collapse_window, collapse_paddr, PAGESIZE_2M,
+        pageflags_writable(pageflags_noexec(pageflags_memory())));
+    runtime_memcpy(pointer_from_u64(collapse_window), pointer_from_u64(collapse_vaddr),
+                   PAGESIZE_2M);
+    unmap(collapse_window, PAGESIZE_2M);
+    if (!collapse_2m_page(collapse_vaddr, collapse_paddr, pageflags_from_vmflags(collapse_vmflags),
+                          (thunk)&do_collapse_done))
+        goto abort;
+    vmap_unlock_read(p);
+    return;
+  abort:
+    collapse_abort(p);
+    vmap_unlock_read(p);
+}
+
+static closure_struct(collapse_install, do_collapse_install);
+
+/* Runs once the write protection is in effect everywhere, possibly with the
+   flush lock held, so the copy is left to the runqueue. */
+closure_function(0, 0, void, collapse_protected)
+{
+    runqueue_push((thunk)&do_collapse_install);
+}
+
+static closure_struct(collapse_protected, do_collapse_protected);
+
+/* called with the vmap lock held */
+static boolean collapse_start(process p, vmap vm, u64 vbase)
+{
+    boolean contiguous;
+    if (!collapse_gather_pages(vbase, &contiguous))
+        return false;
+    collapse_vaddr = vbase;
+    collapse_vmflags = vm->flags;
+    if (contiguous) {
+        /* writes need not be held off, as the pages stay in place */
+        collapse_paddr = INVALID_PHYSICAL;
+        collapse_set_state(COLLAPSE_INSTALLING);
+        if (!collapse_2m_page(vbase, collapse_pages[0], pageflags_from_vmflags(vm->flags),
+                              (thunk)&do_collapse_done))
+            collapse_set_state(COLLAPSE_IDLE);
+        return true;
+    }
+    if (collapse_pages_pinned())
+        return false;
+    collapse_paddr = allocate_u64(heap_physical_local(), PAGESIZE_2M);
+    if (collapse_paddr == INVALID_PHYSICAL) {
+        collapse_stats.alloc_failed++;
+        return true;
+    }
+    collapse_seq = p->vmap_seq;
+    collapse_set_state(COLLAPSE_PROTECTED);
+    update_map_flags_with_complete(vbase, PAGESIZE_2M,
+                                   pageflags_readonly(pageflags_from_vmflags(vm->flags)),
+                                   (thunk)&do_collapse_protected);
+    return true;
+}
+
+static boolean collapse_eligible(vmap vm)
+{
+    return (vm->flags & (VMAP_FLAG_MMAP | VMAP_MMAP_TYPE_MASK | VMAP_FLAG_WRITABLE |
+                         VMAP_FLAG_SHARED)) ==
+        (VMAP_FLAG_MMAP | VMAP_MMAP_TYPE_ANONYMOUS | VMAP_FLAG_WRITABLE) &&
+        anon_hugepage_allowed(vm);
+}
+
+closure_function(0, 1, void, hugepage_scan_timer,
+                 u64, overruns /* ignored */)
+{
+    process p = collapse_process;
+    if (collapse_state != COLLAPSE_IDLE)
+        return;
+    vmap_lock_read(p);
+    u64 v = collapse_cursor;
+    vmap vm = (vmap)rangemap_lookup_at_or_next(p->vmaps, v);
+    for (int budget = HUGEPAGE_SCAN_RANGES; budget > 0 && vm != INVALID_ADDRESS; ) {
+        u64 vbase = MAX(pad(vm->node.r.start, PAGESIZE_2M), pad(v, PAGESIZE_2M));
+        if (!collapse_eligible(vm) || vbase + PAGESIZE_2M > vm->node.r.end) {
+            vm = (vmap)rangemap_next_node(p->vmaps, &vm->node);
+            continue;
+        }
+        v = vbase + PAGESIZE_2M;
+        budget--;
+        if (collapse_start(p, vm, vbase))
+            break;
+    }
+    collapse_cursor = vm == INVALID_ADDRESS ? 0 : v;
+    vmap_unlock_read(p);
+}
+
+static closure_struct(hugepage_scan_timer, do_hugepage_scan_timer);
+
+/* A write fault on a writable anonymous vmap can only follow the write
+   protection of a collapse. The collapse is aborted unless its copy is
+   already underway, in which case a user writer sleeps until the collapse
+   is over. A kernel-mode writer cannot be suspended here, as the only
+   kernel context slot is kept for page fills, and faults again until the
+   2M page is in place. */
+boolean anon_collapse_write_fault(u64 vaddr, vmap vm, context frame)
+{
+    u64 flags = spin_lock_irq(&collapse_lock);
+    if (collapse_state != COLLAPSE_IDLE &&
+        point_in_range(irangel(collapse_vaddr, PAGESIZE_2M), vaddr)) {
+        if (collapse_state == COLLAPSE_INSTALLING) {
+            if (is_current_kernel_context(frame)) {
+                spin_unlock_irq(&collapse_lock, flags);
+                return true;
+            }
+            thread t = current;
+            refcount_reserve(&t->refcount);
+            list_push_back(&collapse_waiters, &t->collapse_wait);
+            spin_unlock_irq(&collapse_lock, flags);
+
+            /* suspending */
+            context f = frame_from_kernel_context(get_kernel_context(current_cpu()));
+            f[FRAME_FULL] = false;
+            runloop();
+        }
+        collapse_state = COLLAPSE_ABORTED;
+    }
+    spin_unlock_irq(&collapse_lock, flags);
+    update_map_flags(vaddr & ~PAGEMASK, PAGESIZE, pageflags_from_vmflags(vm->flags));
+    return true;
+}
+
+void hugepage_collapse_stats(buffer b)
+{
+    bprintf(b, "thp_collapse_alloc %ld\n", collapse_stats.copied);
+    bprintf(b, "thp_collapse_alloc_failed %ld\n", collapse_stats.alloc_failed);
+    bprintf(b, "thp_collapse_in_place %ld\n", collapse_stats.in_place);
+    bprintf(b, "thp_collapse_aborted %ld\n", collapse_stats.aborted);
+}
+
 boolean do_demand_page(u64 vaddr, vmap vm, context frame)
 {
     cpuinfo ci = current_cpu();
@@ -91,21 +803,30 @@ boolean do_demand_page(u64 vaddr, vmap vm, context frame)
 
     int mmap_type = vm->flags & VMAP_MMAP_TYPE_MASK;
     if (mmap_type == VMAP_MMAP_TYPE_ANONYMOUS) {
-        u64 paddr = allocate_u64((heap)heap_physical(get_kernel_heaps()), PAGESIZE);
-        if (paddr == INVALID_PHYSICAL) {
-            msg_err("cannot get physical page; OOM\n");
-            return false;
+        pageflags flags = pageflags_from_vmflags(vm->flags);
+        if (map_anonymous_huge_page(vaddr, vm, flags)) {
+            pf_debug("   mapped 2M page at 0x%lx\n", vaddr & ~PAGEMASK_2M);
+            count_minor_fault();
+            return true;
+        }
+        u64 paddr = zero_pool_take();
+        if (paddr != INVALID_PHYSICAL) {
+            map(vaddr & ~MASK(PAGELOG), paddr, PAGESIZE, flags);
+        } else {
+            paddr = allocate_u64(heap_physical_local(), PAGESIZE);
+            if (paddr == INVALID_PHYSICAL) {
+                msg_err("cannot get physical page; OOM\n");
+                return false;
+            }
+            map_and_zero(vaddr & ~MASK(PAGELOG), paddr, PAGESIZE, flags);
         }
-
-        map_and_zero(vaddr & ~MASK(PAGELOG), paddr, PAGESIZE, pageflags_from_vmflags(vm->flags));
         count_minor_fault();
     } else if (mmap_type == VMAP_MMAP_TYPE_FILEBACKED) {
         u64 page_addr = vaddr & ~PAGEMASK;
         u64 node_offset = vm->node_offset + (page_addr - vm->node.r.start);
-        boolean shared = (vm->flags & VMAP_FLAG_SHARED) != 0;
-        pageflags flags = pageflags_from_vmflags(vm->flags);
-        if (!shared)
-            flags = pageflags_readonly(flags); /* cow */
+        /* private pages are copied on write; shared pages are write-protected
+           until written, for dirty tracking */
+        pageflags flags = pageflags_readonly(pageflags_from_vmflags(vm->flags));
 
         pf_debug("   node %p (start 0x%lx), offset 0x%lx\n",
                  vm->cache_node, vm->node.r.start, node_offset);
@@ -126,18 +847,28 @@ boolean do_demand_page(u64 vaddr, vmap vm, context frame)
             return true;
         }
 
+        u64 vbase, node_base;
+        boolean huge = file_huge_page_eligible(vm, vaddr, &vbase, &node_base);
         if (in_kernel) {
             /* Kernel-mode page faults are exclusively for faulting-in user pages within the confines
                of a syscall (under the kernel lock). As such, we are free to set up an asynchronous page
                fill, allocate memory, etc. */
             assert(!faulting_kernel_context);
-            assert(this_cpu_has_kernel_lock());
+            /* a syscall dispatched without the kernel lock must take it
+               before suspending on a page fill */
+            if (!this_cpu_has_kernel_lock())
+                kern_lock();
             kernel_demand_page_completed = false;
-            pagecache_map_page(vm->cache_node, node_offset, page_addr, flags,
-                               (status_handler)&do_kernel_demand_pf_complete,
-                               true /* complete on bhqueue */);
+            if (!(huge && pagecache_map_huge_page(vm->cache_node, node_base, vbase, flags,
+                                                  (status_handler)&do_kernel_demand_pf_complete,
+                                                  true /* complete on bhqueue */)))
+                pagecache_map_page(vm->cache_node, node_offset, page_addr, flags,
+                                   (status_handler)&do_kernel_demand_pf_complete,
+                                   true /* complete on bhqueue */);
             if (kernel_demand_page_completed) {
                 pf_debug("   immediate completion\n");
+                if (!huge)
+                    file_fault_around(vm, page_addr, flags);
                 count_minor_fault();
                 return true;
             }
@@ -146,8 +877,15 @@ boolean do_demand_page(u64 vaddr, vmap vm, context frame)
         } else {
             /* A user fault can happen outside of the kernel lock. We can try to touch an existing
                page, but we can't allocate anything, fill a page or start a storage operation. */
+            if (huge && pagecache_map_huge_page_if_filled(vm->cache_node, node_base, vbase,
+                                                          flags)) {
+                pf_debug("   mapped 2M page at 0x%lx\n", vbase);
+                count_minor_fault();
+                return true;
+            }
             if (pagecache_map_page_if_filled(vm->cache_node, node_offset, page_addr, flags)) {
                 pf_debug("   immediate completion\n");
+                file_fault_around(vm, page_addr, flags);
                 count_minor_fault();
                 return true;
             }
@@ -158,7 +896,7 @@ boolean do_demand_page(u64 vaddr, vmap vm, context frame)
             init_closure(&t->demand_file_page, thread_demand_file_page, t, vm,
                          node_offset, page_addr, flags);
             init_closure(&t->demand_file_page_complete, thread_demand_file_page_complete, t, frame, vaddr);
-            enqueue(runqueue, &t->demand_file_page);
+            runqueue_push((thunk)&t->demand_file_page);
         }
         count_major_fault();
 
@@ -178,23 +916,44 @@ static inline vmap vmap_from_vaddr_locked(process p, u64 vaddr)
     return (vmap)rangemap_lookup(p->vmaps, vaddr);
 }
 
+/* Faults from a thread tend to land in the vmap of its previous fault, so
+   the thread keeps that vmap along with the vmap_seq it was found under. As
+   long as the sequence is unchanged and even, the vmap can be neither
+   modified nor freed, and the lookup needs no lock. */
 vmap vmap_from_vaddr(process p, u64 vaddr)
 {
-    vmap_lock(p);
+    thread t = current;
+    boolean cache = t && t->p == p;
+    if (cache && t->vmap_cache) {
+        u64 seq = p->vmap_seq;
+        read_barrier();
+        if (!(seq & 1) && seq == t->vmap_cache_seq) {
+            vmap vm = t->vmap_cache;
+            boolean hit = point_in_range(vm->node.r, vaddr);
+            read_barrier();
+            if (hit && p->vmap_seq == seq)
+                return vm;
+        }
+    }
+    vmap_lock_read(p);
     vmap vm = vmap_from_vaddr_locked(p, vaddr);
-    vmap_unlock(p);
+    if (cache && vm != INVALID_ADDRESS) {
+        t->vmap_cache = vm;
+        t->vmap_cache_seq = p->vmap_seq;
+    }
+    vmap_unlock_read(p);
     return vm;
 }
 
 void vmap_iterator(process p, vmap_handler vmh)
 {
-    vmap_lock(p);
+    vmap_lock_read(p);
     vmap vm = (vmap) rangemap_first_node(p->vmaps);
     while (vm != INVALID_ADDRESS) {
         apply(vmh, vm);
         vm = (vmap) rangemap_next_node(p->vmaps, &vm->node);
     }
-    vmap_unlock(p);
+    vmap_unlock_read(p);
 }
 
 closure_function(0, 1, void, vmap_validate_range_gap,
@@ -206,10 +965,10 @@ closure_function(0, 1, void, vmap_validate_range_gap,
 boolean vmap_validate_range(process p, range q)
 {
     boolean valid;
-    vmap_lock(p);
+    vmap_lock_read(p);
     valid = !rangemap_range_find_gaps(p->vmaps, q,
                              stack_closure(vmap_validate_range_gap));
-    vmap_unlock(p);
+    vmap_unlock_read(p);
     return valid;
 }
 
@@ -241,6 +1000,7 @@ vmap allocate_vmap(rangemap rm, range q, struct vmap k)
     vm->allowed_flags = k.allowed_flags;
     vm->node_offset = k.node_offset;
     vm->cache_node = k.cache_node;
+    zero(&vm->ra, sizeof(vm->ra));
     if (!rangemap_insert(rm, &vm->node)) {
         deallocate(rm->h, vm, sizeof(struct vmap));
         return INVALID_ADDRESS;
@@ -314,121 +1074,6 @@ boolean adjust_process_heap(process p, range new)
     return inserted;
 }
 
-sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void * new_address)
-{
-    process p = current->p;
-    u64 old_addr = u64_from_pointer(old_address);
-    sysreturn rv;
-
-    thread_log(current, "mremap: old_address %p, old_size 0x%lx, new_size 0x%lx, flags 0x%x, "
-               "new_address %p", old_address, old_size, new_size, flags, new_address);
-
-    if ((flags & MREMAP_MAYMOVE) == 0) {
-        msg_err("only supporting MREMAP_MAYMOVE yet\n");
-        return -ENOMEM;
-    }
-
-    if ((flags & MREMAP_FIXED)) {
-        msg_err("no support for MREMAP_FIXED yet\n");
-        return -ENOMEM;
-    }
-
-    if ((old_addr & MASK(PAGELOG)) ||
-        (flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED)) ||
-        new_size == 0)
-        return -EINVAL;
-
-    heap vh = p->virtual;
-    id_heap physical = heap_physical(get_kernel_heaps());
-
-    old_size = pad(old_size, vh->pagesize);
-    if (new_size <= old_size)
-        return sysreturn_from_pointer(old_address);
-
-    /* begin locked portion...no direct returns */
-    vmap_lock(p);
-
-    /* verify we have a single vmap for the old address range */
-    vmap old_vm = vmap_from_vaddr_locked(p, old_addr);
-    if ((old_vm == INVALID_ADDRESS) ||
-        !range_contains(old_vm->node.r, irange(old_addr, old_addr + old_size))) {
-        rv = -EFAULT;
-        goto unlock_out;
-    }
-
-    if (old_vm->flags & VMAP_FLAG_PREALLOC) {
-        /* Remapping pre-allocated memory regions is not supported. */
-        rv = -EINVAL;
-        goto unlock_out;
-    }
-
-    /* XXX should determine if we're extending a virtual32 allocation...
-     * - for now only let the user move anon mmaps
-     */
-    u64 match = VMAP_FLAG_MMAP | VMAP_MMAP_TYPE_ANONYMOUS;
-    if ((old_vm->flags & match) != match) {
-        msg_err("mremap only supports anon mmap regions at the moment\n");
-        rv = -EINVAL;
-        goto unlock_out;
-    }
-
-    /* remove old mapping, preserving attributes */
-    u64 vmflags = old_vm->flags;
-
-    /* new virtual allocation */
-    u64 maplen = pad(new_size, vh->pagesize);
-    u64 vnew = process_get_virt_range(p, maplen);
-    if (vnew == (u64)INVALID_ADDRESS) {
-        msg_err("failed to allocate virtual memory, size %ld\n", maplen);
-        rv = -ENOMEM;
-        goto unlock_out;
-    }
-
-    /* create new vm with old attributes */
-    if (allocate_vmap(p->vmaps, irange(vnew, vnew + maplen), *old_vm) == INVALID_ADDRESS) {
-        msg_err("failed to allocate vmap\n");
-        rv = -ENOMEM;
-        goto unlock_out;
-    }
-
-    /* balance of physical allocation */
-    u64 dlen = maplen - old_size;
-    u64 dphys = allocate_u64((heap)physical, dlen);
-    if (dphys == INVALID_PHYSICAL) {
-        msg_err("failed to allocate physical memory, size %ld\n", dlen);
-        rv = -ENOMEM;
-        goto unlock_out;
-    }
-    thread_log(current, "   new physical pages at 0x%lx, size %ld", dphys, dlen);
-
-    /* we're moving the vmap to a new address region, so we can safely remove
-     * the old node entirely */
-    rangemap_remove_node(p->vmaps, &old_vm->node);
-
-    /*
-     * XXX : if we decide to handle MREMAP_FIXED, we'll need to be careful about
-     * making sure destination address ranges are unmapped before mapping over them
-     * here
-     */
-
-    /* remap existing portion */
-    thread_log(current, "   remapping existing portion at 0x%lx (old_addr 0x%lx, size 0x%lx)",
-               vnew, old_addr, old_size);
-    remap_pages(vnew, old_addr, old_size);
-
-    /* map new portion and zero */
-    pageflags mapflags = pageflags_from_vmflags(vmflags);
-    thread_log(current, "   mapping and zeroing new portion at 0x%lx, page flags 0x%lx",
-               vnew + old_size, mapflags.w);
-    map(vnew + old_size, dphys, dlen, mapflags);
-    zero(pointer_from_u64(vnew + old_size), dlen);
-    vmap_unlock(p);
-    return sysreturn_from_pointer(vnew);
-  unlock_out:
-    vmap_unlock(p);
-    return rv;
-}
-
 closure_function(3, 3, boolean, mincore_fill_vec,
                  u64, base, u64, nr_pgs, u8 *, vec,
                  int, level, u64, addr, pteptr, entry)
@@ -529,14 +1174,15 @@ closure_function(2, 1, void, vmap_update_protections_validate,
 */
 
 /* refactor with vmap_remove_intersection? might be better as-is. */
-closure_function(4, 1, void, vmap_update_protections_intersection,
-                 heap, h, rangemap, pvmap, range, q, u32, newflags,
+closure_function(5, 1, void, vmap_update_flags_intersection,
+                 heap, h, rangemap, pvmap, range, q, u32, newflags, u32, mask,
                  rmnode, node)
 {
     rangemap pvmap = bound(pvmap);
 
-    u32 newflags = bound(newflags);
     vmap match = (vmap)node;
+    /* only flags under mask are changed */
+    u32 newflags = (match->flags & ~bound(mask)) | bound(newflags);
     if (newflags == match->flags)
         return;
 
@@ -547,9 +1193,6 @@ closure_function(4, 1, void, vmap_update_protections_intersection,
     boolean head = ri.start > rn.start;
     boolean tail = ri.end < rn.end;
 
-    /* protection flags only */
-    newflags = (match->flags & ~(VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC)) | newflags;
-
     if (!head && !tail) {
         /* key (range) remains the same, no need to reinsert */
         match->flags = newflags;
@@ -593,6 +1236,18 @@ closure_function(0, 1, void, vmap_update_protections_gap,
     thread_log(current, "   found gap [0x%lx, 0x%lx)", r.start, r.end);
 }
 
+/* shared file pages that become writable must be recorded as written for
+   dirty tracking */
+closure_function(1, 1, void, vmap_shared_pages_written,
+                 range, q,
+                 rmnode, n)
+{
+    vmap vm = (vmap)n;
+    if ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED &&
+        (vm->flags & VMAP_FLAG_SHARED))
+        pagecache_node_shared_pages_written(vm->cache_node, range_intersection(bound(q), n->r));
+}
+
 static sysreturn vmap_update_protections(heap h, rangemap pvmap, range q, u32 newflags)
 {
     assert((q.start & MASK(PAGELOG)) == 0);
@@ -613,9 +1268,14 @@ static sysreturn vmap_update_protections(heap h, rangemap pvmap, range q, u32 ne
     else if (prot_violation)
         return -EACCES;
 
-    rmnode_handler nh = stack_closure(vmap_update_protections_intersection, h, pvmap, q, newflags);
+    rmnode_handler nh = stack_closure(vmap_update_flags_intersection, h, pvmap, q, newflags,
+                                      VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC);
     rangemap_range_lookup(pvmap, q, nh);
 
+    split_huge_mappings(q);
+
+    if (newflags & VMAP_FLAG_WRITABLE)
+        rangemap_range_lookup(pvmap, q, stack_closure(vmap_shared_pages_written, q));
     update_map_flags(q.start, range_span(q), pageflags_from_vmflags(newflags));
     return 0;
 }
@@ -642,6 +1302,14 @@ sysreturn mprotect(void * addr, u64 len, int prot)
     process p = current->p;
     vmap_lock(p);
     sysreturn result = vmap_update_protections(h, p->vmaps, irangel(where, padlen), new_vmflags);
+    if (result == 0 && (new_vmflags & VMAP_FLAG_WRITABLE) && stack_prefault) {
+        /* a stack mapped without access and then opened up below its guard */
+        vmap vm = (vmap)rangemap_lookup(p->vmaps, where + padlen - 1);
+        if (vm != INVALID_ADDRESS && (vm->flags & VMAP_FLAG_STACK) &&
+            vm->node.r.end == where + padlen)
+            prefault_stack_top(p, range_intersection(irangel(where, padlen), vm->node.r),
+                               vm->flags);
+    }
     vmap_unlock(p);
     return result;
 }
@@ -737,7 +1405,11 @@ static void vmap_unmap_page_range(process p, vmap k)
     u64 len = range_span(r);
     switch (type) {
     case VMAP_MMAP_TYPE_ANONYMOUS:
-        unmap_and_free_phys(r.start, len);
+        if (k->flags & VMAP_FLAG_STACK) {
+            stack_cache_put(p, &r);
+            len = range_span(r);
+        }
+        unmap_and_free_user_phys(r.start, len);
         break;
     case VMAP_MMAP_TYPE_FILEBACKED:
         pagecache_node_unmap_pages(k->cache_node, r, k->node_offset);
@@ -761,18 +1433,147 @@ closure_function(1, 1, void, vmap_unmap,
 static void process_unmap_range(process p, range q)
 {
     vmap_lock(p);
+    split_huge_mappings(q);
     vmap_handler vh = stack_closure(vmap_unmap, p);
     rangemap_range_lookup(p->vmaps, q, stack_closure(vmap_remove_intersection,
                                                      p->vmaps, q, vh, false));
     vmap_unlock(p);
 }
 
+sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void * new_address)
+{
+    process p = current->p;
+    u64 old_addr = u64_from_pointer(old_address);
+    sysreturn rv;
+
+    thread_log(current, "mremap: old_address %p, old_size 0x%lx, new_size 0x%lx, flags 0x%x, "
+               "new_address %p", old_address, old_size, new_size, flags, new_address);
+
+    if ((flags & MREMAP_MAYMOVE) == 0) {
+        msg_err("only supporting MREMAP_MAYMOVE yet\n");
+        return -ENOMEM;
+    }
+
+    if ((flags & MREMAP_FIXED)) {
+        msg_err("no support for MREMAP_FIXED yet\n");
+        return -ENOMEM;
+    }
+
+    if ((old_addr & MASK(PAGELOG)) ||
+        (flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED)) ||
+        new_size == 0)
+        return -EINVAL;
+
+    heap vh = p->virtual;
+    old_size = pad(old_size, vh->pagesize);
+    u64 maplen = pad(new_size, vh->pagesize);
+    if (maplen < old_size) {
+        process_unmap_range(p, irange(old_addr + maplen, old_addr + old_size));
+        return sysreturn_from_pointer(old_address);
+    }
+    if (maplen == old_size)
+        return sysreturn_from_pointer(old_address);
+
+    /* begin locked portion...no direct returns */
+    vmap_lock(p);
+
+    /* verify we have a single vmap for the old address range */
+    vmap old_vm = vmap_from_vaddr_locked(p, old_addr);
+    if ((old_vm == INVALID_ADDRESS) ||
+        !range_contains(old_vm->node.r, irange(old_addr, old_addr + old_size))) {
+        rv = -EFAULT;
+        goto unlock_out;
+    }
+
+    if (old_vm->flags & VMAP_FLAG_PREALLOC) {
+        /* Remapping pre-allocated memory regions is not supported. */
+        rv = -EINVAL;
+        goto unlock_out;
+    }
+
+    /* anonymous and file-backed mmaps, private or shared, can be moved */
+    u64 type = old_vm->flags & VMAP_MMAP_TYPE_MASK;
+    if (!(old_vm->flags & VMAP_FLAG_MMAP) ||
+        (type != VMAP_MMAP_TYPE_ANONYMOUS && type != VMAP_MMAP_TYPE_FILEBACKED)) {
+        msg_err("mremap only supports anonymous and file-backed mmap regions\n");
+        rv = -EINVAL;
+        goto unlock_out;
+    }
+
+    struct vmap k = ivmap(old_vm->flags, old_vm->allowed_flags,
+                          old_vm->node_offset + (old_addr - old_vm->node.r.start),
+                          old_vm->cache_node);
+    boolean shared = (type == VMAP_MMAP_TYPE_FILEBACKED) && (k.flags & VMAP_FLAG_SHARED);
+
+    /* grow in place if the vmap ends here and the space after it is free */
+    range ext = irange(old_addr + old_size, old_addr + maplen);
+    if (ext.start == old_vm->node.r.end && old_addr >= PROCESS_VIRTUAL_HEAP_START &&
+        ext.end <= PROCESS_VIRTUAL_HEAP_LIMIT && !rangemap_range_intersects(p->vmaps, ext)) {
+        thread_log(current, "   extending in place to 0x%lx", ext.end);
+        assert(rangemap_reinsert(p->vmaps, &old_vm->node,
+                                 irange(old_vm->node.r.start, ext.end)));
+        if (shared)
+            pagecache_node_add_shared_map(k.cache_node, ext, k.node_offset + old_size);
+        vmap_unlock(p);
+        return sysreturn_from_pointer(old_address);
+    }
+
+    /* new virtual allocation */
+    u64 vnew = process_get_virt_range(p, maplen);
+    if (vnew == (u64)INVALID_ADDRESS) {
+        msg_err("failed to allocate virtual memory, size %ld\n", maplen);
+        rv = -ENOMEM;
+        goto unlock_out;
+    }
+
+    /* create new vm with old attributes */
+    if (allocate_vmap(p->vmaps, irange(vnew, vnew + maplen), k) == INVALID_ADDRESS) {
+        msg_err("failed to allocate vmap\n");
+        rv = -ENOMEM;
+        goto unlock_out;
+    }
+
+    /* Cut the moved range out of the old vmap, leaving any head or tail in
+       place. The dirty pages of a shared mapping are scanned before its
+       record moves to the new range. */
+    range q = irangel(old_addr, old_size);
+    rangemap_range_lookup(p->vmaps, q, stack_closure(vmap_remove_intersection,
+                                                     p->vmaps, q, 0, true));
+    struct vmap old_k = k;
+    old_k.node.r = q;
+    vmap_return_virtual(p, &old_k);
+    if (shared) {
+        flush_entry fe = get_page_flush_entry();
+        pagecache_node_close_shared_pages(k.cache_node, q, fe);
+        page_invalidate_sync(fe, ignore);
+        pagecache_node_add_shared_map(k.cache_node, irangel(vnew, maplen), k.node_offset);
+    }
+
+    /* Move the existing page table entries rather than refaulting; mapped
+       pagecache pages keep their references, and the grown portion is left
+       to demand paging. */
+    thread_log(current, "   remapping existing portion at 0x%lx (old_addr 0x%lx, size 0x%lx)",
+               vnew, old_addr, old_size);
+    if ((vnew ^ old_addr) & PAGEMASK_2M) {
+        /* 2M mappings can't be moved to a misaligned address */
+        for (u64 v = old_addr & ~PAGEMASK_2M; v < old_addr + old_size; v += PAGESIZE_2M)
+            split_2m_page(v);
+    } else {
+        split_huge_mappings(q);
+    }
+    remap_pages(vnew, old_addr, old_size);
+    vmap_unlock(p);
+    return sysreturn_from_pointer(vnew);
+  unlock_out:
+    vmap_unlock(p);
+    return rv;
+}
+
 /* don't truncate vmap; just unmap truncated pages */
-void truncate_file_maps(process p, fsfile f, u64 new_length)
+void truncate_file_maps(process p, pagecache_node pn, u64 new_length)
 {
     vmap_lock(p);
     u64 padlen = pad(new_length, PAGESIZE);
-    pagecache_node pn = fsfile_get_cachenode(f);
     rangemap_foreach(p->vmaps, n) {
         vmap vm = (vmap)n;
         /* an invalidate would be preferable to a sync... */
@@ -804,6 +1605,7 @@ static void vmap_paint(heap h, process p, u64 where, u64 len, u32 vmflags,
     rangemap pvmap = p->vmaps;
 
     vmap_lock(p);
+    split_huge_mappings(q);
     vmap_handler vh = stack_closure(vmap_unmap, p);
     rangemap_range_lookup(pvmap, q, stack_closure(vmap_remove_intersection, pvmap, q, vh, true));
     rangemap_range_find_gaps(pvmap, q, stack_closure(vmap_paint_gap, h, pvmap, q,
@@ -897,6 +1699,178 @@ static sysreturn msync(void *addr, u64 length, int flags)
     return have_gap ? -ENOMEM : 0;
 }
 
+static sysreturn populate_range(range q, boolean check_only)
+{
+    process p = current->p;
+    u64 v = q.start;
+    while (v < q.end) {
+        vmap vm = vmap_from_vaddr(p, v);
+        if (vm == INVALID_ADDRESS)
+            return -ENOMEM;
+        range r = irange(v, MIN(q.end, vm->node.r.end));
+        v = r.end;
+        if (check_only || !(vm->flags & VMAP_FLAG_MMAP))
+            continue;
+        switch (vm->flags & VMAP_MMAP_TYPE_MASK) {
+        case VMAP_MMAP_TYPE_ANONYMOUS:
+            populate_anonymous(r, vm->flags);
+            break;
+        case VMAP_MMAP_TYPE_FILEBACKED:
+            populate_file(vm->cache_node, vm->node_offset + (r.start - vm->node.r.start), r,
+                          false);
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+static sysreturn mlock2(const void *addr, u64 length, int flags)
+{
+    thread_log(current, "%s: addr %p, length 0x%lx, flags 0x%x", __func__, addr, length, flags);
+    if (flags & ~MLOCK_ONFAULT)
+        return -EINVAL;
+    u64 start = u64_from_pointer(addr) & ~PAGEMASK;
+    u64 end = pad(u64_from_pointer(addr) + length, PAGESIZE);
+    if (end <= start)
+        return 0;
+
+    /* pages are never swapped out, so locking only needs to prefault */
+    return populate_range(irange(start, end), (flags & MLOCK_ONFAULT) != 0);
+}
+
+static sysreturn mlock(const void *addr, u64 length)
+{
+    return mlock2(addr, length, 0);
+}
+
+closure_function(2, 1, void, madvise_validate,
+                 int, advice, boolean *, invalid,
+                 rmnode, n)
+{
+    vmap vm = (vmap)n;
+    int type = vm->flags & VMAP_MMAP_TYPE_MASK;
+    process p = current->p;
+
+    /* MADV_FREE applies to private anonymous memory only */
+    if (bound(advice) == MADV_FREE &&
+        ((vm->flags & VMAP_FLAG_SHARED) ||
+         ((vm->flags & VMAP_FLAG_MMAP) ? type != VMAP_MMAP_TYPE_ANONYMOUS :
+          vm != p->heap_map && vm != p->stack_map)))
+        *bound(invalid) = true;
+}
+
+closure_function(3, 1, void, madvise_hugepage,
+                 heap, h, range, q, u32, newflags,
+                 rmnode, n)
+{
+    /* heap and stack vmaps must stay whole, so leave them as they are */
+    if ((((vmap)n)->flags & VMAP_FLAG_MMAP) == 0)
+        return;
+    apply(stack_closure(vmap_update_flags_intersection, bound(h), current->p->vmaps,
+                        bound(q), bound(newflags), VMAP_FLAG_HUGEPAGE | VMAP_FLAG_NOHUGEPAGE), n);
+}
+
+/* called with vmap lock held */
+closure_function(2, 1, void, madvise_vmap,
+                 range, q, int, advice,
+                 rmnode, n)
+{
+    process p = current->p;
+    vmap vm = (vmap)n;
+    range ri = range_intersection(bound(q), n->r);
+    u64 node_offset = vm->node_offset + (ri.start - n->r.start);
+    int type = vm->flags & VMAP_MMAP_TYPE_MASK;
+    thread_log(current, "   %s: vmap %R, flags 0x%lx, advice %d", __func__, n->r, vm->flags,
+               bound(advice));
+
+    if (bound(advice) == MADV_WILLNEED) {
+        if ((vm->flags & VMAP_FLAG_MMAP) && type == VMAP_MMAP_TYPE_FILEBACKED)
+            pagecache_node_fetch_pages(vm->cache_node, irangel(node_offset, range_span(ri)));
+        return;
+    }
+
+    /* MADV_DONTNEED or MADV_FREE: drop the pages; later accesses see zeros
+       for anonymous memory and the file contents for a file mapping */
+    if ((vm->flags & VMAP_FLAG_MMAP) == 0) {
+        /* not demand paged, so just clear the anonymous heap and stack */
+        if (vm == p->heap_map || vm == p->stack_map)
+            zero_mapped_pages(ri.start, range_span(ri));
+        return;
+    }
+    switch (type) {
+    case VMAP_MMAP_TYPE_ANONYMOUS:
+        /* shared anonymous memory keeps its contents */
+        if ((vm->flags & VMAP_FLAG_SHARED) == 0)
+            unmap_and_free_user_phys(ri.start, range_span(ri));
+        break;
+    case VMAP_MMAP_TYPE_FILEBACKED:
+        pagecache_node_unmap_pages(vm->cache_node, ri, node_offset);
+        break;
+    }
+}
+
+sysreturn madvise_internal(process p, void *addr, u64 length, int advice)
+{
+    u64 where = u64_from_pointer(addr);
+    if (where & MASK(PAGELOG))
+        return -EINVAL;
+    switch (advice) {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+    case MADV_DONTFORK:
+    case MADV_DOFORK:
+    case MADV_MERGEABLE:
+    case MADV_UNMERGEABLE:
+    case MADV_DONTDUMP:
+    case MADV_DODUMP:
+        return 0;
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+    case MADV_FREE:
+    case MADV_HUGEPAGE:
+    case MADV_NOHUGEPAGE:
+        break;
+    default:
+        return -EINVAL;
+    }
+    u64 len = pad(length, PAGESIZE);
+    if (len == 0)
+        return 0;
+    range q = irangel(where, len);
+
+    sysreturn rv = 0;
+    boolean invalid = false;
+    vmap_lock(p);
+    rangemap_range_lookup(p->vmaps, q, stack_closure(madvise_validate, advice, &invalid));
+    if (invalid) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (rangemap_range_find_gaps(p->vmaps, q, stack_closure(vmap_update_protections_gap)))
+        rv = -ENOMEM;
+    if (advice == MADV_HUGEPAGE || advice == MADV_NOHUGEPAGE) {
+        u32 newflags = advice == MADV_HUGEPAGE ? VMAP_FLAG_HUGEPAGE : VMAP_FLAG_NOHUGEPAGE;
+        heap h = heap_general(get_kernel_heaps());
+        rangemap_range_lookup(p->vmaps, q, stack_closure(madvise_hugepage, h, q, newflags));
+        goto out;
+    }
+    if (advice != MADV_WILLNEED)
+        split_huge_mappings(q);
+    rangemap_range_lookup(p->vmaps, q, stack_closure(madvise_vmap, q, advice));
+  out:
+    vmap_unlock(p);
+    return rv;
+}
+
+static sysreturn madvise(void *addr, u64 length, int advice)
+{
+    thread_log(current, "madvise: addr %p, length 0x%lx, advice %d", addr, length, advice);
+    return madvise_internal(current->p, addr, length, advice);
+}
+
 static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 offset)
 {
     process p = current->p;
@@ -921,12 +1895,15 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
         vmflags |= VMAP_FLAG_WRITABLE;
 
     /* TODO: assert for unsupported:
-       MAP_GROWSDOWN
        MAP_UNINITIALIZED
-       MAP_LOCKED
-       MAP_NONBLOCK
-       MAP_POPULATE
     */
+    /* MAP_GROWSDOWN maps don't grow, but are treated as stacks */
+    boolean stack = (flags & (MAP_STACK | MAP_GROWSDOWN)) && (flags & MAP_ANONYMOUS) &&
+        !(vmflags & VMAP_FLAG_SHARED);
+    if (stack)
+        vmflags |= VMAP_FLAG_STACK;
+    boolean populate = (flags & (MAP_POPULATE | MAP_LOCKED)) &&
+        (prot & (PROT_READ | PROT_WRITE | PROT_EXEC));
 
     boolean fixed = (flags & MAP_FIXED) != 0;
     u64 where = fixed ? u64_from_pointer(addr) : 0; /* Don't really try to honor a hint, only fixed. */
@@ -971,6 +1948,10 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
             if (!(vmflags & VMAP_FLAG_SHARED))
                 allowed_flags |= VMAP_FLAG_WRITABLE;
             break;
+        case FDESC_TYPE_MEMFD:
+            vmap_mmap_type = VMAP_MMAP_TYPE_FILEBACKED;
+            allowed_flags = memfd_perms(p, desc, (vmflags & VMAP_FLAG_SHARED) != 0);
+            break;
         case FDESC_TYPE_IORING:
             vmap_mmap_type = VMAP_MMAP_TYPE_IORING;
             allowed_flags = VMAP_FLAG_WRITABLE | VMAP_FLAG_READABLE;
@@ -1009,6 +1990,10 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
     case VMAP_MMAP_TYPE_ANONYMOUS:
         thread_log(current, "   anonymous, specified target 0x%lx", where);
         vmap_paint(h, p, where, len, vmflags, allowed_flags, 0, 0);
+        if (populate)
+            populate_anonymous(irangel(where, len), vmflags);
+        else if (stack && (vmflags & VMAP_FLAG_WRITABLE))
+            prefault_user_stack(p, where, len);
         break;
     case VMAP_MMAP_TYPE_IORING:
         thread_log(current, "   fd %d: io_uring", fd);
@@ -1023,17 +2008,26 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
         }
         break;
     case VMAP_MMAP_TYPE_FILEBACKED:
-        thread_log(current, "   fd %d: file-backed (regular)", fd);
+        thread_log(current, "   fd %d: file-backed (%s)", fd,
+                   desc->type == FDESC_TYPE_MEMFD ? "memfd" : "regular");
         file f = (file)desc;
         if (offset & PAGEMASK) {
             ret = -EINVAL;
         } else {
-            assert(f->fsf);
-            pagecache_node node = fsfile_get_cachenode(f->fsf);
+            pagecache_node node;
+            if (desc->type == FDESC_TYPE_MEMFD) {
+                node = memfd_get_cachenode(desc);
+            } else {
+                assert(f->fsf);
+                node = fsfile_get_cachenode(f->fsf);
+            }
             thread_log(current, "   associated with cache node %p @ offset 0x%lx", node, offset);
             if (vmflags & VMAP_FLAG_SHARED)
                 pagecache_node_add_shared_map(node, irangel(where, len), offset);
             vmap_paint(h, p, where, len, vmflags, allowed_flags, node, offset);
+            if (populate)
+                populate_file(node, offset, irangel(where, len),
+                              (flags & (MAP_NONBLOCK | MAP_LOCKED)) == MAP_NONBLOCK);
         }
         break;
     default:
@@ -1113,11 +2107,12 @@ bytes vmh_total(struct heap *h)
     return PROCESS_VIRTUAL_HEAP_LIMIT;
 }
 
-void mmap_process_init(process p, boolean aslr)
+void mmap_process_init(process p, tuple root, boolean aslr)
 {
     kernel_heaps kh = &p->uh->kh;
     heap h = heap_general(kh);
     spin_lock_init(&p->vmap_lock);
+    p->vmap_seq = 0;
     p->vareas = allocate_rangemap(h);
     p->vmaps = allocate_rangemap(h);
     assert(p->vareas != INVALID_ADDRESS && p->vmaps != INVALID_ADDRESS);
@@ -1131,6 +2126,36 @@ void mmap_process_init(process p, boolean aslr)
     vmh->p = p;
     vmh->randomize = aslr;
     p->virtual = &vmh->h;
+    transparent_hugepages = get(root, sym(transparent_hugepages)) != 0;
+    file_hugepages = get(root, sym(file_hugepages)) != 0;
+    if (!get_u64(root, sym(fault_around), &fault_around_pages))
+        fault_around_pages = FAULT_AROUND_PAGES_DEFAULT;
+    if (get_u64(root, sym(stack_prefault), &stack_prefault))
+        stack_prefault = pad(stack_prefault, PAGESIZE);
+    else
+        stack_prefault = STACK_PREFAULT_DEFAULT;
+    p->stack_cache_count = 0;
+    spin_lock_init(&pin_lock);
+    pinned_pages = allocate_table(heap_locked(kh), identity_key, pointer_equal);
+    assert(pinned_pages != INVALID_ADDRESS);
+    if (!get_u64(root, sym(hugepage_scan_interval), &hugepage_scan_interval))
+        hugepage_scan_interval = HUGEPAGE_SCAN_INTERVAL_DEFAULT;
+    if (hugepage_scan_interval) {
+        collapse_window = allocate_u64((heap)heap_virtual_page(kh), PAGESIZE_2M);
+        if (collapse_window != INVALID_PHYSICAL) {
+            spin_lock_init(&collapse_lock);
+            collapse_state = COLLAPSE_IDLE;
+            list_init(&collapse_waiters);
+            collapse_process = p;
+            collapse_cursor = 0;
+            init_closure(&do_collapse_done, collapse_done);
+            init_closure(&do_collapse_install, collapse_install);
+            init_closure(&do_collapse_protected, collapse_protected);
+            timestamp t = milliseconds(hugepage_scan_interval);
+            kern_register_timer(CLOCK_ID_MONOTONIC, t, false, t,
+                                init_closure(&do_hugepage_scan_timer, hugepage_scan_timer));
+        }
+    }
 
     /* zero page is off-limits */
     add_varea(p, 0, PAGESIZE,
@@ -1175,5 +2200,7 @@ void register_mmap_syscalls(struct syscall *map)
     register_syscall(map, msync, msync);
     register_syscall(map, munmap, munmap);
     register_syscall(map, mprotect, mprotect);
-    register_syscall(map, madvise, syscall_ignore);
+    register_syscall(map, madvise, madvise);
+    register_syscall(map, mlock, mlock);
+    register_syscall(map, mlock2, mlock2);
 }
@@ -1,14 +1,33 @@
 #include <unix_internal.h>
 
+/* Entries are grouped in buckets of a common event mask, so that a
+   dispatch only visits the handlers interested in the events. Edge-triggered
+   entries are kept in buckets of their own, as they need to see falling
+   edges (events outside of their mask) too. A bucket left empty during a
+   dispatch is kept until the dispatch completes. */
+typedef struct notify_bucket {
+    u64 eventmask;
+    boolean edge;
+    struct list entries;
+    struct list l;
+} *notify_bucket;
+
 struct notify_entry {
     u64 eventmask;
     event_handler eh;
+    boolean exclusive;
+    boolean edge;
+    notify_set s;
+    notify_bucket b;
     struct list l;
 };
 
 struct notify_set {
     heap h;
-    struct list entries;
+    struct list buckets;
+    u64 eventmask_union;        /* of all entries */
+    u32 edge_buckets;
+    u32 dispatching;
 };
 
 notify_set allocate_notify_set(heap h)
@@ -17,7 +36,10 @@ notify_set allocate_notify_set(heap h)
     if (s == INVALID_ADDRESS)
         return s;
     s->h = h;
-    list_init(&s->entries);
+    list_init(&s->buckets);
+    s->eventmask_union = 0;
+    s->edge_buckets = 0;
+    s->dispatching = 0;
     return s;
 }
 
@@ -27,21 +49,85 @@ void deallocate_notify_set(notify_set s)
     deallocate(s->h, s, sizeof(struct notify_set));
 }
 
+static void notify_bucket_free(notify_set s, notify_bucket b)
+{
+    list_delete(&b->l);
+    if (b->edge)
+        s->edge_buckets--;
+    deallocate(s->h, b, sizeof(struct notify_bucket));
+}
+
+static void notify_set_update(notify_set s)
+{
+    u64 u = 0;
+    list_foreach(&s->buckets, l) {
+        notify_bucket b = struct_from_list(l, notify_bucket, l);
+        if (list_empty(&b->entries)) {
+            if (!s->dispatching)
+                notify_bucket_free(s, b);
+            continue;
+        }
+        u |= b->eventmask;
+    }
+    s->eventmask_union = u;
+}
+
+/* Move the entry to the bucket matching its mask and edge flag; returns
+   false if a new bucket could not be allocated, leaving the entry where it
+   was. */
+static boolean notify_entry_rebucket(notify_entry n, u64 eventmask, boolean edge)
+{
+    notify_set s = n->s;
+    notify_bucket b = 0;
+    list_foreach(&s->buckets, l) {
+        notify_bucket nb = struct_from_list(l, notify_bucket, l);
+        if (nb->eventmask == eventmask && nb->edge == edge) {
+            b = nb;
+            break;
+        }
+    }
+    if (!b) {
+        b = allocate(s->h, sizeof(struct notify_bucket));
+        if (b == INVALID_ADDRESS)
+            return false;
+        b->eventmask = eventmask;
+        b->edge = edge;
+        list_init(&b->entries);
+        list_insert_before(&s->buckets, &b->l);
+        if (edge)
+            s->edge_buckets++;
+    }
+    if (n->b)
+        list_delete(&n->l);
+    list_insert_before(&b->entries, &n->l);
+    n->b = b;
+    n->eventmask = eventmask;
+    n->edge = edge;
+    notify_set_update(s);
+    return true;
+}
+
 notify_entry notify_add(notify_set s, u64 eventmask, event_handler eh)
 {
     // XXX make cache
     notify_entry n = allocate(s->h, sizeof(struct notify_entry));
     if (n == INVALID_ADDRESS)
         return n;
-    n->eventmask = eventmask;
     n->eh = eh;
-    list_insert_before(&s->entries, &n->l);
+    n->exclusive = false;
+    n->s = s;
+    n->b = 0;
+    if (!notify_entry_rebucket(n, eventmask, false)) {
+        deallocate(s->h, n, sizeof(struct notify_entry));
+        return INVALID_ADDRESS;
+    }
     return n;
 }
 
 void notify_remove(notify_set s, notify_entry e, boolean release)
 {
     list_delete(&e->l);
+    notify_set_update(s);
     if (release)
         apply(e->eh, NOTIFY_EVENTS_RELEASE, 0);
     deallocate(s->h, e, sizeof(struct notify_entry));
@@ -50,29 +136,66 @@ void notify_remove(notify_set s, notify_entry e, boolean release)
 // XXX poll waiters too
 void notify_entry_update_eventmask(notify_entry n, u64 eventmask)
 {
-    n->eventmask = eventmask;
+    if (!notify_entry_rebucket(n, eventmask, n->edge)) {
+        /* keep dispatching to the old bucket, with the new mask applied */
+        n->eventmask = eventmask;
+        n->s->eventmask_union |= eventmask;
+    }
 }
 
-u64 notify_get_eventmask_union(notify_set s)
+void notify_entry_set_exclusive(notify_entry n, boolean exclusive)
 {
-    u64 u = 0;
-    list_foreach(&s->entries, l) {
-        notify_entry n = struct_from_list(l, notify_entry, l);
-        u |= n->eventmask;
+    n->exclusive = exclusive;
+}
+
+void notify_entry_set_edge(notify_entry n, boolean edge)
+{
+    if (!notify_entry_rebucket(n, n->eventmask, edge)) {
+        /* fall back on an existing bucket that sees every event */
+        n->edge = edge;
+        if (edge && !n->b->edge) {
+            n->b->edge = true;
+            n->s->edge_buckets++;
+        }
     }
-    return u;
+}
+
+u64 notify_get_eventmask_union(notify_set s)
+{
+    return s->eventmask_union;
 }
 
 void notify_dispatch_for_thread(notify_set s, u64 events, thread t)
 {
-    list_foreach(&s->entries, l) {
-        notify_entry n = struct_from_list(l, notify_entry, l);
+    /* falling edges still go to edge-triggered entries */
+    if (!(events & s->eventmask_union) && !s->edge_buckets)
+        return;
+    boolean woken = false;
+    s->dispatching++;
+    list_foreach(&s->buckets, bl) {
+        notify_bucket b = struct_from_list(bl, notify_bucket, l);
+        if (!(events & b->eventmask) && !b->edge)
+            continue;
+        list_foreach(&b->entries, l) {
+            notify_entry n = struct_from_list(l, notify_entry, l);
 
-        /* no guarantee that a transition is represented here; event
-           handler needs to keep track itself if edge trigger is used */
-        assert(n->eh);
-        apply(n->eh, events & n->eventmask, t);
+            /* no guarantee that a transition is represented here; event
+               handler needs to keep track itself if edge trigger is used */
+            assert(n->eh);
+            u64 e = events & n->eventmask;
+            if (!e && !n->edge)
+                continue;
+            if (n->exclusive && e) {
+                if (woken)
+                    continue;
+                woken = apply(n->eh, e, t);
+            } else {
+                apply(n->eh, e, t);
+            }
+        }
     }
+    if (--s->dispatching == 0)
+        notify_set_update(s);
 }
 
 void notify_dispatch(notify_set s, u64 events)
@@ -82,10 +205,15 @@ void notify_dispatch(notify_set s, u64 events)
 
 void notify_release(notify_set s)
 {
-    list_foreach(&s->entries, l) {
-        notify_entry n = struct_from_list(l, notify_entry, l);
-        apply(n->eh, NOTIFY_EVENTS_RELEASE, 0);
-        list_delete(l);
-        deallocate(s->h, n, sizeof(struct notify_entry));
+    list_foreach(&s->buckets, bl) {
+        notify_bucket b = struct_from_list(bl, notify_bucket, l);
+        list_foreach(&b->entries, l) {
+            notify_entry n = struct_from_list(l, notify_entry, l);
+            apply(n->eh, NOTIFY_EVENTS_RELEASE, 0);
+            list_delete(l);
+            deallocate(s->h, n, sizeof(struct notify_entry));
+        }
+        notify_bucket_free(s, b);
     }
+    s->eventmask_union = 0;
 }
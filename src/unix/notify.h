@@ -1,9 +1,10 @@
 typedef struct notify_set *notify_set;
 typedef struct notify_entry *notify_entry;
 
-/* notify handlers receive event changes, including falling edges,
-   which are relevant only for waiters on thread t if t is nonzero */
-typedef closure_type(event_handler, void, u64 events, thread t);
+/* notify handlers receive event changes, which are relevant only for
+   waiters on thread t if t is nonzero; they return true if the events woke
+   a waiter */
+typedef closure_type(event_handler, boolean, u64 events, thread t);
 
 /* NOTIFY_EVENTS_RELEASE is a special value of events to signal to the
    event_handler that a notify_set is being deallocated.
@@ -21,6 +22,15 @@ void notify_remove(notify_set s, notify_entry e, boolean release);
 
 void notify_entry_update_eventmask(notify_entry n, u64 eventmask);
 
+/* Of the exclusive entries in a set, events are dispatched in turn only
+   until one of them wakes a waiter. */
+void notify_entry_set_exclusive(notify_entry n, boolean exclusive);
+
+/* Edge-triggered entries see every dispatch, including those with no
+   events in their mask, so that falling edges can be tracked; other
+   entries are only dispatched events of interest. */
+void notify_entry_set_edge(notify_entry n, boolean edge);
+
 u64 notify_get_eventmask_union(notify_set s);
 
 void notify_dispatch(notify_set s, u64 events);
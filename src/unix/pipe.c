@@ -7,7 +7,6 @@
 #define pipe_debug(x, ...)
 #endif
 
-#define INITIAL_PIPE_DATA_SIZE  100
 #define PIPE_MIN_CAPACITY       PAGESIZE
 #define DEFAULT_PIPE_MAX_SIZE   (16 * PAGESIZE) /* see pipe(7) */
 #define PIPE_READ               0
@@ -17,6 +16,20 @@ typedef struct pipe *pipe;
 
 typedef struct pipe_file *pipe_file;
 
+/* A page holding data written into a pipe. Data is appended to the page at
+   the tail of the pipe while there is room; readers, and other pipes the
+   data is spliced or teed to, hold references to it. */
+typedef struct pipe_page *pipe_page;
+
+declare_closure_struct(1, 0, void, pipe_page_free,
+                       pipe_page, pp);
+
+struct pipe_page {
+    void *data;
+    struct refcount refcount;
+    closure_struct(pipe_page_free, free);
+};
+
 struct pipe_file {
     struct fdesc f;       /* must be first */
     int fd;
@@ -30,18 +43,70 @@ struct pipe {
     heap h;
     u64 ref_cnt;
     u64 max_size;
-    buffer data;
+    sg_list data;       /* references to the pages holding pipe data */
+    u64 length;         /* bytes of data in the pipe */
+    pipe_page tail;     /* page being appended to, referenced by the pipe */
 };
 
-#define BUFFER_DEBUG(BUF,LENGTH) do { \
-    pipe_debug("%s:%d - requested %d -- contents %p start/end %d/%d  -- len %d %d\n", \
-        __func__, __LINE__, \
-        (LENGTH), \
-        (BUF)->contents, \
-        (BUF)->start, \
-        (BUF)->end, \
-        (BUF)->length, buffer_length((BUF))); \
-} while(0)
+define_closure_function(1, 0, void, pipe_page_free,
+                        pipe_page, pp)
+{
+    pipe_page pp = bound(pp);
+    kernel_heaps kh = get_kernel_heaps();
+    deallocate(heap_backed(kh), pp->data, PAGESIZE);
+    deallocate(heap_general(kh), pp, sizeof(*pp));
+}
+
+static pipe_page pipe_page_alloc(void)
+{
+    kernel_heaps kh = get_kernel_heaps();
+    pipe_page pp = allocate(heap_general(kh), sizeof(*pp));
+    if (pp == INVALID_ADDRESS)
+        return pp;
+    pp->data = allocate(heap_backed(kh), PAGESIZE);
+    if (pp->data == INVALID_ADDRESS) {
+        deallocate(heap_general(kh), pp, sizeof(*pp));
+        return INVALID_ADDRESS;
+    }
+    init_refcount(&pp->refcount, 1, init_closure(&pp->free, pipe_page_free, pp));
+    return pp;
+}
+
+static inline sg_buf pipe_tail_buf(pipe p)
+{
+    bytes len = buffer_length(p->data->b);
+    return len ? buffer_ref(p->data->b, len - sizeof(struct sg_buf)) : INVALID_ADDRESS;
+}
+
+/* copy up to length bytes from src to the end of the pipe */
+static u64 pipe_copy_in(pipe p, void *src, u64 length)
+{
+    u64 copied = 0;
+    while (copied < length) {
+        sg_buf sgb = pipe_tail_buf(p);
+        if (sgb == INVALID_ADDRESS || !p->tail || sgb->refcount != &p->tail->refcount ||
+            sgb->size == PAGESIZE) {
+            pipe_page pp = pipe_page_alloc();
+            if (pp == INVALID_ADDRESS)
+                break;
+            if (p->tail)
+                refcount_release(&p->tail->refcount);
+            p->tail = pp;
+            sgb = sg_list_tail_add(p->data, 0);
+            sgb->buf = pp->data;
+            sgb->size = sgb->offset = 0;
+            sgb->refcount = &pp->refcount;
+            refcount_reserve(&pp->refcount);
+        }
+        u64 n = MIN(length - copied, PAGESIZE - sgb->size);
+        runtime_memcpy(sgb->buf + sgb->size, src + copied, n);
+        sgb->size += n;
+        fetch_and_add(&p->data->count, n);
+        copied += n;
+    }
+    p->length += copied;
+    return copied;
+}
 
 boolean pipe_init(unix_heaps uh)
 {
@@ -98,8 +163,12 @@ static void pipe_release(pipe p)
 {
     if (!p->ref_cnt || (fetch_and_add(&p->ref_cnt, -1) == 1)) {
         pipe_debug("%s(%p): deallocating pipe\n", __func__, p);
-        if (p->data != INVALID_ADDRESS)
-            deallocate_buffer(p->data);
+        if (p->data != INVALID_ADDRESS) {
+            sg_list_release(p->data);
+            deallocate_sg_list(p->data);
+        }
+        if (p->tail)
+            refcount_release(&p->tail->refcount);
 
         pipe_file_release(&(p->files[PIPE_READ]));
         pipe_file_release(&(p->files[PIPE_WRITE]));
@@ -115,6 +184,7 @@ static inline void pipe_dealloc_end(pipe p, pipe_file pf)
             pipe_notify_writer(pf, EPOLLHUP);
             pipe_debug("%s(%p): writer notified\n", __func__, p);
             deallocate_closure(pf->f.read);
+            deallocate_closure(pf->f.sg_read);
             deallocate_closure(pf->f.close);
             deallocate_closure(pf->f.events);
         }
@@ -122,6 +192,7 @@ static inline void pipe_dealloc_end(pipe p, pipe_file pf)
             pipe_notify_reader(pf, EPOLLIN | EPOLLHUP);
             pipe_debug("%s(%p): reader notified\n", __func__, p);
             deallocate_closure(pf->f.write);
+            deallocate_closure(pf->f.sg_write);
             deallocate_closure(pf->f.close);
             deallocate_closure(pf->f.events);
         }
@@ -138,20 +209,20 @@ closure_function(1, 2, sysreturn, pipe_close,
     return io_complete(completion, t, 0);
 }
 
-closure_function(5, 1, sysreturn, pipe_read_bh,
-                 pipe_file, pf, thread, t, void *, dest, u64, length, io_completion, completion,
+closure_function(6, 1, sysreturn, pipe_read_bh,
+                 pipe_file, pf, thread, t, void *, dest, sg_list, sg, u64, length, io_completion, completion,
                  u64, flags)
 {
     pipe_file pf = bound(pf);
-    int rv;
+    pipe p = pf->pipe;
+    sysreturn rv;
 
     if (flags & BLOCKQ_ACTION_NULLIFY) {
         rv = -ERESTARTSYS;
         goto out;
     }
 
-    buffer b = pf->pipe->data;
-    rv = MIN(buffer_length(b), bound(length));
+    rv = MIN(p->length, bound(length));
     if (rv == 0) {
         if (pf->pipe->files[PIPE_WRITE].fd == -1)
             goto out;
@@ -162,15 +233,16 @@ closure_function(5, 1, sysreturn, pipe_read_bh,
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
-    buffer_read(b, bound(dest), rv);
+    /* a reader into an sg list takes references to the pipe pages */
+    if (bound(dest))
+        assert(sg_copy_to_buf(bound(dest), p->data, rv) == rv);
+    else
+        assert(sg_move(bound(sg), p->data, rv) == rv);
+    p->length -= rv;
     pipe_notify_writer(pf, EPOLLOUT);
 
-    // If we have consumed all of the buffer, reset it. This might prevent future writes to allocte new buffer
-    // in buffer_write/buffer_extend. Can improve things until a proper circular buffer is available
-    if (buffer_length(b) == 0) {
-        buffer_clear(b);
+    if (p->length == 0)
         notify_dispatch(pf->f.ns, 0); /* for edge trigger */
-    }
   out:
     blockq_handle_completion(pf->bq, flags, bound(completion), bound(t), rv);
     closure_finish();
@@ -186,13 +258,29 @@ closure_function(1, 6, sysreturn, pipe_read,
     if (length == 0)
         return io_complete(completion, t, 0);
 
-    blockq_action ba = closure(pf->pipe->h, pipe_read_bh, pf, t, dest, length,
+    blockq_action ba = closure(pf->pipe->h, pipe_read_bh, pf, t, dest, 0, length,
+                               completion);
+    return blockq_check(pf->bq, t, ba, bh);
+}
+
+closure_function(1, 6, sysreturn, pipe_sg_read,
+                 pipe_file, pf,
+                 sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
+{
+    pipe_file pf = bound(pf);
+
+    if (length == 0)
+        return io_complete(completion, t, 0);
+
+    blockq_action ba = closure(pf->pipe->h, pipe_read_bh, pf, t, 0, sg, length,
                                completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
     return blockq_check(pf->bq, t, ba, bh);
 }
 
-closure_function(5, 1, sysreturn, pipe_write_bh,
-                 pipe_file, pf, thread, t, void *, dest, u64, length, io_completion, completion,
+closure_function(6, 1, sysreturn, pipe_write_bh,
+                 pipe_file, pf, thread, t, void *, dest, sg_list, sg, u64, length, io_completion, completion,
                  u64, flags)
 {
     sysreturn rv = 0;
@@ -205,8 +293,7 @@ closure_function(5, 1, sysreturn, pipe_write_bh,
 
     u64 length = bound(length);
     pipe p = pf->pipe;
-    buffer b = p->data;
-    u64 avail = p->max_size - buffer_length(b);
+    u64 avail = p->max_size - MIN(p->length, p->max_size);
 
     if (avail == 0) {
         if (pf->pipe->files[PIPE_READ].fd == -1) {
@@ -220,9 +307,19 @@ closure_function(5, 1, sysreturn, pipe_write_bh,
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
+    /* data from an sg list is not copied; the pipe takes page references */
     u64 real_length = MIN(length, avail);
-    assert(buffer_write(b, bound(dest), real_length));
-    if (avail == length)
+    if (bound(dest)) {
+        real_length = pipe_copy_in(p, bound(dest), real_length);
+        if (real_length == 0) {
+            rv = -ENOMEM;
+            goto out;
+        }
+    } else {
+        real_length = sg_move(p->data, bound(sg), real_length);
+        p->length += real_length;
+    }
+    if (avail == real_length)
         notify_dispatch(pf->f.ns, 0); /* for edge trigger */
 
     pipe_notify_reader(pf, EPOLLIN);
@@ -242,18 +339,110 @@ closure_function(1, 6, sysreturn, pipe_write,
         return io_complete(completion, t, 0);
 
     pipe_file pf = bound(pf);
-    blockq_action ba = closure(pf->pipe->h, pipe_write_bh, pf, t, dest, length,
+    blockq_action ba = closure(pf->pipe->h, pipe_write_bh, pf, t, dest, 0, length,
+            completion);
+    return blockq_check(pf->bq, t, ba, bh);
+}
+
+closure_function(1, 6, sysreturn, pipe_sg_write,
+                 pipe_file, pf,
+                 sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
+{
+    if (length == 0)
+        return io_complete(completion, t, 0);
+
+    pipe_file pf = bound(pf);
+    blockq_action ba = closure(pf->pipe->h, pipe_write_bh, pf, t, 0, sg, length,
             completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
     return blockq_check(pf->bq, t, ba, bh);
 }
 
+/* Waits for data in the input pipe or for room in the output pipe, moving
+   between the two blockqs as needed. */
+closure_function(6, 1, sysreturn, pipe_tee_bh,
+                 pipe_file, in, pipe_file, out, thread, t, u64, length, boolean, nonblock,
+                 blockq, bq,
+                 u64, flags)
+{
+    pipe_file in = bound(in);
+    pipe_file out = bound(out);
+    pipe pi = in->pipe;
+    pipe po = out->pipe;
+    blockq bq = bound(bq);
+    blockq wait;
+    sysreturn rv;
+
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+    if (pi->length == 0) {
+        if (pi->files[PIPE_WRITE].fd == -1) {
+            rv = 0;
+            goto out;
+        }
+        wait = in->bq;
+    } else if (po->length >= po->max_size) {
+        wait = out->bq;
+    } else {
+        u64 n = MIN(MIN(bound(length), pi->length), po->max_size - po->length);
+        rv = sg_dup(po->data, pi->data, n);
+        po->length += rv;
+        if (po->length >= po->max_size)
+            notify_dispatch(out->f.ns, 0); /* for edge trigger */
+        pipe_notify_reader(out, EPOLLIN);
+        goto out;
+    }
+    if (bound(nonblock)) {
+        rv = -EAGAIN;
+        goto out;
+    }
+    if (!(flags & BLOCKQ_ACTION_BLOCKED) || (wait == bq))
+        return BLOCKQ_BLOCK_REQUIRED;
+
+    /* leave this blockq for the other one */
+    bound(bq) = wait;
+    rv = blockq_check(wait, bound(t), (blockq_action)closure_self(), true);
+    if (rv == BLOCKQ_BLOCK_REQUIRED) {
+        bound(t)->blocked_on = wait;
+        return 0;
+    }
+    if (rv != -EAGAIN)
+        return rv;      /* completed on the other blockq */
+    rv = -ENOMEM;
+  out:
+    blockq_handle_completion(bq, flags, syscall_io_complete, bound(t), rv);
+    closure_finish();
+    return rv;
+}
+
+/* tee(2): duplicate data from one pipe to another without consuming it */
+sysreturn pipe_tee(fdesc in, fdesc out, u64 len, boolean nonblock)
+{
+    pipe_file pin = (pipe_file)in;
+    pipe_file pout = (pipe_file)out;
+    if (pin->pipe == pout->pipe)
+        return -EINVAL;
+    if (len == 0)
+        return 0;
+    blockq bq = (pin->pipe->length == 0 ||
+                 pout->pipe->length < pout->pipe->max_size) ? pin->bq : pout->bq;
+    blockq_action ba = closure(pin->pipe->h, pipe_tee_bh, pin, pout, current, len,
+                               nonblock || (in->flags & O_NONBLOCK), bq);
+    if (ba == INVALID_ADDRESS)
+        return -ENOMEM;
+    return blockq_check(bq, current, ba, false);
+}
+
 closure_function(1, 1, u32, pipe_read_events,
                  pipe_file, pf,
                  thread, t /* ignore */)
 {
     pipe_file pf = bound(pf);
     assert(pf->f.read);
-    u32 events = buffer_length(pf->pipe->data) ? EPOLLIN : 0;
+    u32 events = pf->pipe->length ? EPOLLIN : 0;
     if (pf->pipe->files[PIPE_WRITE].fd == -1)
         events |= EPOLLIN | EPOLLHUP;
     return events;
@@ -265,7 +454,7 @@ closure_function(1, 1, u32, pipe_write_events,
 {
     pipe_file pf = bound(pf);
     assert(pf->f.write);
-    u32 events = buffer_length(pf->pipe->data) < pf->pipe->max_size ? EPOLLOUT : 0;
+    u32 events = pf->pipe->length < pf->pipe->max_size ? EPOLLOUT : 0;
     if (pf->pipe->files[PIPE_READ].fd == -1)
         events |= EPOLLHUP;
     return events;
@@ -291,6 +480,8 @@ int do_pipe2(int fds[2], int flags)
 
     pipe->h = heap_general((kernel_heaps)uh);
     pipe->data = INVALID_ADDRESS;
+    pipe->length = 0;
+    pipe->tail = 0;
     pipe->proc = current->p;
 
     pipe->files[PIPE_READ].fd = -1;
@@ -304,7 +495,7 @@ int do_pipe2(int fds[2], int flags)
     pipe->ref_cnt = 0;
     pipe->max_size = DEFAULT_PIPE_MAX_SIZE;
 
-    pipe->data = allocate_buffer(pipe->h, INITIAL_PIPE_DATA_SIZE);
+    pipe->data = allocate_sg_list();
     if (pipe->data == INVALID_ADDRESS) {
         msg_err("failed to allocate pipe's data buffer\n");
         goto err;
@@ -322,6 +513,7 @@ int do_pipe2(int fds[2], int flags)
         }
 
         reader->f.read = closure(pipe->h, pipe_read, reader);
+        reader->f.sg_read = closure(pipe->h, pipe_sg_read, reader);
         reader->f.close = closure(pipe->h, pipe_close, reader);
         reader->f.events = closure(pipe->h, pipe_read_events, reader);
         reader->f.flags = (flags & O_NONBLOCK) | O_RDONLY;
@@ -331,6 +523,7 @@ int do_pipe2(int fds[2], int flags)
             msg_err("failed to allocate blockq\n");
             goto err;
         }
+        blockq_set_exclusive(reader->bq, true);
     }
 
     /* init writer */
@@ -345,6 +538,7 @@ int do_pipe2(int fds[2], int flags)
         }
 
         writer->f.write = closure(pipe->h, pipe_write, writer);
+        writer->f.sg_write = closure(pipe->h, pipe_sg_write, writer);
         writer->f.close = closure(pipe->h, pipe_close, writer);
         writer->f.events = closure(pipe->h, pipe_write_events, writer);
         writer->f.flags = (flags & O_NONBLOCK) | O_WRONLY;
@@ -370,9 +564,9 @@ int pipe_set_capacity(fdesc f, int capacity)
     pipe p = pf->pipe;
     if (capacity < PIPE_MIN_CAPACITY)
         capacity = PIPE_MIN_CAPACITY;
-    if (capacity < buffer_length(p->data))
+    if (capacity < p->length)
         return -EBUSY;
-    p->max_size = buffer_set_capacity(p->data, (bytes)capacity);
+    p->max_size = pad(capacity, PAGESIZE);
     return (int)p->max_size;
 }
 
@@ -381,3 +575,21 @@ int pipe_get_capacity(fdesc f)
     pipe_file pf = (pipe_file)f;
     return (int)pf->pipe->max_size;
 }
+
+/* Give back data that a splice took from the pipe but could not pass on,
+   ahead of anything written since. */
+void pipe_unread(fdesc f, sg_list sg, u64 length)
+{
+    pipe_file pf = (pipe_file)f;
+    pipe p = pf->pipe;
+    u64 n = sg_move(sg, p->data, p->length);
+    assert(n == p->length);
+    p->length = sg_move(p->data, sg, length + n);
+    pipe_notify_reader(pf, EPOLLIN);
+}
+
+u64 pipe_write_avail(fdesc f)
+{
+    pipe p = ((pipe_file)f)->pipe;
+    return p->max_size - MIN(p->length, p->max_size);
+}
@@ -7,6 +7,9 @@
 #define epoll_debug(x, ...)
 #endif
 
+#define epoll_lock(e)   u64 _irqflags = spin_lock_irq(&(e)->lock)
+#define epoll_unlock(e) spin_unlock_irq(&(e)->lock, _irqflags)
+
 typedef struct epollfd *epollfd;
 
 declare_closure_struct(1, 0, void, epollfd_free,
@@ -23,6 +26,8 @@ typedef struct epollfd {
     epoll e;
     boolean registered;
     boolean zombie;		/* freed or masked by oneshot */
+    boolean ready;              /* linked on epoll ready list (or being collected) */
+    struct list ready_l;
     notify_entry notify_handle;
 } *epollfd;
 
@@ -66,7 +71,9 @@ declare_closure_struct(1, 0, void, epoll_free,
 /* we call it an epoll, but these structs are used for select and poll too */
 struct epoll {
     struct fdesc f;             /* must be first */
+    struct spinlock lock;       /* blocked_head, ready_head and epollfd ready state */
     struct list blocked_head;   /* an epoll_blocked per thread (in epoll_wait)  */
+    struct list ready_head;     /* epollfds with events pending collection */
     struct refcount refcount;
     closure_struct(epoll_free, free);
     heap h;
@@ -93,7 +100,9 @@ static epoll epoll_alloc_internal(void)
     if (e == INVALID_ADDRESS)
 	return e;
 
+    spin_lock_init(&e->lock);
     list_init(&e->blocked_head);
+    list_init(&e->ready_head);
     init_refcount(&e->refcount, 1, init_closure(&e->free, epoll_free, e));
     e->h = heap_general(get_kernel_heaps());
     e->events = allocate_vector(e->h, 8);
@@ -144,6 +153,7 @@ static epollfd alloc_epollfd(epoll e, int fd, u32 eventmask, u64 data)
     reset_epollfd(efd, eventmask, data);
     init_refcount(&efd->refcount, 1, init_closure(&efd->free, epollfd_free, efd));
     efd->registered = false;
+    efd->ready = false;
     assert(vector_set(e->events, fd, efd));
     bitmap_set(e->fds, fd, 1);
     if (fd >= e->nfds)
@@ -152,6 +162,30 @@ static epollfd alloc_epollfd(epoll e, int fd, u32 eventmask, u64 data)
     return efd;
 }
 
+/* Notifications arrive from any context (e.g. lwIP), so the ready and
+   blocked lists are only touched under the epoll lock. */
+static void epollfd_set_ready(epollfd efd)
+{
+    epoll e = efd->e;
+    epoll_lock(e);
+    if (!efd->ready) {
+        list_push_back(&e->ready_head, &efd->ready_l);
+        efd->ready = true;
+    }
+    epoll_unlock(e);
+}
+
+static void epollfd_clear_ready(epollfd efd)
+{
+    epoll e = efd->e;
+    epoll_lock(e);
+    if (efd->ready) {
+        list_delete(&efd->ready_l);
+        efd->ready = false;
+    }
+    epoll_unlock(e);
+}
+
 static void unregister_epollfd(epollfd efd)
 {
     fdesc f = resolve_fd_noret(current->p, efd->fd);
@@ -172,6 +206,7 @@ static void release_epollfd(epollfd efd)
     assert(vector_set(e->events, fd, 0));
     bitmap_set(e->fds, fd, 0);
     efd->zombie = true;
+    epollfd_clear_ready(efd);
     if (efd->registered)
         unregister_epollfd(efd);
     refcount_release(&efd->refcount); /* alloc */
@@ -264,9 +299,12 @@ define_closure_function(1, 0, void, epoll_blocked_free,
 static void epoll_blocked_release(epoll_blocked w)
 {
     epoll_debug("w %p\n", w);
+    epoll e = w->e;
+    epoll_lock(e);
     assert(!list_empty(&w->blocked_list));
     list_delete(&w->blocked_list);
     list_init(&w->blocked_list);
+    epoll_unlock(e);
     refcount_release(&w->refcount);
 }
 
@@ -290,55 +328,140 @@ static inline u32 report_from_notify_events(epollfd efd, u64 notify_events)
     return edge_detect ? ~efd->lastevents & events : events;
 }
 
-closure_function(1, 2, void, epoll_wait_notify,
+/* Wake a blocked waiter to collect from the ready list, rotating waiters
+   to the back so that successive events spread across threads. Waiters
+   which are already running will collect on their own. A thread-specific
+   event only wakes a waiter on that thread. The wakeup runs the waiter's
+   collection synchronously, so it is made without the epoll lock; each
+   waiter present on entry is tried at most once. */
+static boolean epoll_wake(epoll e, thread t)
+{
+    int n = 0;
+    epoll_lock(e);
+    list_foreach(&e->blocked_head, l)
+        n++;
+    while (n-- > 0) {
+        list l = list_get_next(&e->blocked_head);
+        if (!l)
+            break;
+        epoll_blocked w = struct_from_list(l, epoll_blocked, blocked_list);
+        list_delete(l);
+        list_push_back(&e->blocked_head, l);
+        if (t && t != w->t)
+            continue;
+        refcount_reserve(&w->refcount);
+        epoll_unlock(e);
+        boolean woken = blockq_wake_one(w->t->thread_bq) != INVALID_ADDRESS;
+        refcount_release(&w->refcount);
+        if (woken)
+            return true;
+        _irqflags = spin_lock_irq(&e->lock);
+    }
+    epoll_unlock(e);
+    return false;
+}
+
+closure_function(1, 2, boolean, epoll_wait_notify,
                  epollfd, efd,
                  u64, notify_events,
                  thread, t)
 {
     epollfd efd = bound(efd);
-    list l = list_get_next(&efd->e->blocked_head);
 
     /* only path to freedom - even fd removals trigger release */
     if (notify_events == NOTIFY_EVENTS_RELEASE) {
         epoll_debug("efd->fd %d unregistered\n", efd->fd);
         efd->registered = false;
+        epollfd_clear_ready(efd);
         closure_finish();
-        return;
+        return false;
     }
 
-    epoll_blocked w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
     u32 events = (u32)notify_events;
     u32 report = report_from_notify_events(efd, events);
     assert(efd->registered);
-    epoll_debug("efd->fd %d, events 0x%x, report 0x%x, blocked %p, zombie %d\n",
-                efd->fd, events, report, w, efd->zombie);
-
-    /* XXX need to do some work to properly dole out to multiple epoll_waits (threads)... */
-    if (report == 0 || !w || efd->zombie)
-        return;
+    epoll_debug("efd->fd %d, events 0x%x, report 0x%x, zombie %d\n",
+                efd->fd, events, report, efd->zombie);
 
-    if (t && t != w->t)
-        return;
+    if (report == 0 || efd->zombie)
+        return false;
 
-    if (!w->user_events || (w->user_events->length - w->user_events->end) <= 0) {
-        /* XXX here we should advance to the next blocked head, probably */
-        epoll_debug("   user_events null or full\n");
-        return;
-    }
+    /* events are recomputed when collected; just queue the efd */
+    epollfd_set_ready(efd);
+    return epoll_wake(efd->e, t);
+}
 
-    struct epoll_event *e = buffer_ref(w->user_events, w->user_events->end);
-    e->data = efd->data;
-    e->events = report;
-    w->user_events->end += sizeof(struct epoll_event);
-    epoll_debug("   epoll_event %p, data 0x%lx, events 0x%x\n", e, e->data, e->events);
+/* Copy out events for ready epollfds into the waiter's buffer. Level
+   triggered entries which still report events stay on the ready list, so
+   that the next wait checks them again; all others are dropped until
+   notified anew.
+
+   The ready list is taken over as a whole, and fd events are read without
+   the epoll lock, as event handlers may take locks of their own. An entry
+   is marked not ready before its events are read, so that a notification
+   arriving meanwhile queues it again - for the next collection, as it is
+   not on the list being walked. */
+static int epoll_collect(epoll_blocked w)
+{
+    epoll e = w->e;
+    buffer b = w->user_events;
+    struct list collect, requeue;
+    list l;
+
+    list_init(&requeue);
+    epoll_lock(e);
+    list_move(&collect, &e->ready_head);
+    while ((b->length - b->end) >= sizeof(struct epoll_event) &&
+           (l = list_get_next(&collect))) {
+        epollfd efd = struct_from_list(l, epollfd, ready_l);
+        list_delete(l);
+        efd->ready = false;
+        if (efd->zombie || !efd->registered)
+            continue;
+        refcount_reserve(&efd->refcount);
+        epoll_unlock(e);
+
+        u32 report = apply(efd->f->events, w->t) & efd->eventmask;
+        if (efd->eventmask & EPOLLET)
+            report &= ~efd->lastevents;
+        if (report == 0) {
+            refcount_release(&efd->refcount);
+            _irqflags = spin_lock_irq(&e->lock);
+            continue;
+        }
 
-    /* XXX check this */
-    if (efd->eventmask & EPOLLONESHOT)
-        efd->zombie = true;
+        struct epoll_event *ev = buffer_ref(b, b->end);
+        ev->data = efd->data;
+        ev->events = report;
+        b->end += sizeof(struct epoll_event);
+        epoll_debug("   fd %d, data 0x%lx, events 0x%x\n", efd->fd, ev->data, ev->events);
+
+        /* now that we've reported these events, update last */
+        efd->lastevents |= report;
+        if (efd->eventmask & EPOLLONESHOT)
+            efd->zombie = true;
+        _irqflags = spin_lock_irq(&e->lock);
+        if (!(efd->eventmask & (EPOLLONESHOT | EPOLLET)) && !efd->ready && !efd->zombie) {
+            list_push_back(&requeue, &efd->ready_l);
+            efd->ready = true;
+        }
+        epoll_unlock(e);
+        refcount_release(&efd->refcount);
+        _irqflags = spin_lock_irq(&e->lock);
+    }
 
-    /* now that we've reported these events, update last */
-    efd->lastevents |= report;
-    blockq_wake_one(w->t->thread_bq);
+    /* leftovers go to another waiter, if any */
+    while (!list_empty(&collect))
+        list_insert_after(&e->ready_head, list_pop_back(&collect));
+    boolean pending = !list_empty(&e->ready_head);
+    while ((l = list_get_next(&requeue))) {
+        list_delete(l);
+        list_push_back(&e->ready_head, l);
+    }
+    epoll_unlock(e);
+    if (pending)
+        epoll_wake(e, 0);
+    return user_event_count(w);
 }
 
 static epoll_blocked alloc_epoll_blocked(epoll e)
@@ -354,7 +477,9 @@ static epoll_blocked alloc_epoll_blocked(epoll e)
     thread_reserve(w->t);
     w->e = e;
     refcount_reserve(&e->refcount);
+    epoll_lock(e);
     list_insert_after(&e->blocked_head, &w->blocked_list); /* push */
+    epoll_unlock(e);
     return w;
 }
 
@@ -378,18 +503,17 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     thread t = bound(t);
     epoll_blocked w = bound(w);
     timestamp timeout = bound(timeout);
-    int eventcount = user_event_count(w);
 
-    epoll_debug("w %p on tid %d, timeout %ld, flags 0x%lx, event count %d\n",
-                w, t->tid, timeout, flags, eventcount);
+    epoll_debug("w %p on tid %d, timeout %ld, flags 0x%lx\n", w, t->tid, timeout, flags);
 
-    if (!timeout || (flags & BLOCKQ_ACTION_TIMEDOUT) || eventcount) {
-        rv = eventcount;
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = (timeout == infinity) ? -ERESTARTSYS : -EINTR;
         goto out_wakeup;
     }
 
-    if (flags & BLOCKQ_ACTION_NULLIFY) {
-        rv = (timeout == infinity) ? -ERESTARTSYS : -EINTR;
+    int eventcount = epoll_collect(w);
+    if (!timeout || (flags & BLOCKQ_ACTION_TIMEDOUT) || eventcount) {
+        rv = eventcount;
         goto out_wakeup;
     }
 
@@ -405,12 +529,18 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
 }
 
 /* Depending on the epoll flags given, we may:
-   - notify all waiters on a match (default)
-   - notify on a match only once until condition is reset (EPOLLET)
-   - notify once before removing the registration, handled upstream (EPOLLONESHOT)
-   - notify only one matching waiter, even across multiple epoll instances (EPOLLEXCLUSIVE)
-     - XXX Not implemented; will require tracking reported events on a per fd - not per
-           registration - basis.
+   - report a match on every wait while the condition holds (default)
+   - report a match only once until condition is reset (EPOLLET)
+   - report once before masking the registration (EPOLLONESHOT)
+   - wake only one waiter, even across multiple epoll instances (EPOLLEXCLUSIVE);
+     this is resolved by the notify set, which stops dispatching to exclusive
+     entries once one of them has woken a waiter
+
+   Only fds on the ready list are examined when collecting, so copying out
+   scales with the number of ready fds rather than the number registered.
+   Registered fds are still polled once on entry, as some event transitions
+   are not notified (e.g. changes in lwIP internal state) and must be
+   picked up here.
 */
 sysreturn epoll_wait(int epfd,
                      struct epoll_event *events,
@@ -431,8 +561,8 @@ sysreturn epoll_wait(int epfd,
     w->user_events->end = 0;
 
     bitmap_foreach_set(e->fds, fd) {
-	epollfd efd = vector_get(e->events, fd);
-	assert(efd);
+        epollfd efd = vector_get(e->events, fd);
+        assert(efd);
         assert(efd->fd == fd);
 
         if (efd->zombie)
@@ -467,22 +597,6 @@ static epollfd epollfd_from_fd(epoll e, int fd)
     return efd;
 }
 
-static void epollfd_update(epollfd efd, fdesc f)
-{
-    /* It may seem excessive to perform a check for all
-       waiters. However, thanks to thread-specific fd events (thanks
-       in turn to signalfd), we could have independent events for
-       multiple threads that require waking - even on the same fd. */
-
-    /* XXX take lock */
-    list_foreach(&efd->e->blocked_head, l) {
-        epoll_blocked w = struct_from_list(l, epoll_blocked, blocked_list);
-        epoll_debug("   posting check for blocked waiter (tid %d)\n", w->t->tid);
-        check_fdesc(efd, f, w->t);
-    }
-    /* XXX release lock */
-}
-
 static sysreturn epoll_add_fd(epoll e, int fd, u32 events, u64 data)
 {
     epollfd efd = epollfd_from_fd(e, fd);
@@ -500,13 +614,18 @@ static sysreturn epoll_add_fd(epoll e, int fd, u32 events, u64 data)
         assert(efd != INVALID_ADDRESS);
     } else {
         reset_epollfd(efd, events, data);
+        efd->f = resolve_fd_noret(current->p, fd);
+        assert(efd->f);
     }
-    fdesc f = resolve_fd_noret(current->p, efd->fd);
-    assert(f);
     register_epollfd(efd, closure(e->h, epoll_wait_notify, efd));
-
-    /* apply check(s) for any current waiters */
-    epollfd_update(efd, f);
+    if (events & EPOLLEXCLUSIVE)
+        notify_entry_set_exclusive(efd->notify_handle, true);
+    if (events & EPOLLET)
+        notify_entry_set_edge(efd->notify_handle, true);
+
+    /* events already pending are found at collection time */
+    epollfd_set_ready(efd);
+    epoll_wake(e, 0);
     return 0;
 }
 
@@ -532,10 +651,17 @@ sysreturn epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
         return set_syscall_error(current, EFAULT);
     }
 
-    /* EPOLLEXCLUSIVE not yet implemented */
-    if (event && (event->events & EPOLLEXCLUSIVE)) {
-        msg_err("add: EPOLLEXCLUSIVE not supported\n");
-        return set_syscall_error(current, EINVAL);
+    /* EPOLLEXCLUSIVE may only be given on add, and only with wakeup events */
+    if (op != EPOLL_CTL_DEL && (event->events & EPOLLEXCLUSIVE)) {
+        if (op != EPOLL_CTL_ADD ||
+            (event->events & ~(EPOLLEXCLUSIVE | EPOLLIN | EPOLLOUT | EPOLLERR |
+                               EPOLLHUP | EPOLLWAKEUP | EPOLLET)))
+            return set_syscall_error(current, EINVAL);
+    }
+    if (op == EPOLL_CTL_MOD) {
+        epollfd efd = epollfd_from_fd(e, fd);
+        if (efd != INVALID_ADDRESS && (efd->eventmask & EPOLLEXCLUSIVE))
+            return set_syscall_error(current, EINVAL);
     }
 
     if ((f->type == FDESC_TYPE_REGULAR) || (f->type == FDESC_TYPE_DIRECTORY)) {
@@ -568,7 +694,7 @@ sysreturn epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
 #define POLLFDMASK_WRITE	(EPOLLOUT | EPOLLHUP | EPOLLERR)
 #define POLLFDMASK_EXCEPT	(EPOLLPRI)
 
-closure_function(1, 2, void, select_notify,
+closure_function(1, 2, boolean, select_notify,
                  epollfd, efd,
                  u64, notify_events,
                  thread, t)
@@ -580,7 +706,7 @@ closure_function(1, 2, void, select_notify,
         epoll_debug("efd->fd %d unregistered\n", efd->fd);
         efd->registered = false;
         closure_finish();
-        return;
+        return false;
     }
 
     epoll_blocked w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
@@ -589,10 +715,10 @@ closure_function(1, 2, void, select_notify,
 	    efd->fd, events, w, efd->zombie);
 
     if (efd->zombie || !w || efd->fd >= w->nfds)
-        return;
+        return false;
 
     if (t && t != w->t)
-        return;
+        return false;
 
     assert(w->epoll_type == EPOLL_TYPE_SELECT);
     int count = 0;
@@ -613,7 +739,9 @@ closure_function(1, 2, void, select_notify,
         fetch_and_add(&w->retcount, count);
         epoll_debug("   event on %d, events 0x%x\n", efd->fd, events);
         blockq_wake_one(w->t->thread_bq);
+        return true;
     }
+    return false;
 }
 
 closure_function(3, 1, sysreturn, select_bh,
@@ -810,7 +938,7 @@ sysreturn select(int nfds,
 }
 #endif
 
-closure_function(1, 2, void, poll_notify,
+closure_function(1, 2, boolean, poll_notify,
                  epollfd, efd,
                  u64, notify_events,
                  thread, t)
@@ -822,7 +950,7 @@ closure_function(1, 2, void, poll_notify,
         epoll_debug("efd->fd %d unregistered\n", efd->fd);
         efd->registered = false;
         closure_finish();
-        return;
+        return false;
     }
 
     epoll_blocked w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
@@ -832,16 +960,17 @@ closure_function(1, 2, void, poll_notify,
     assert(efd->registered);
 
     if (events == 0 || !w || efd->zombie)
-        return;
+        return false;
 
     if (t && t != w->t)
-        return;
+        return false;
 
     struct pollfd *pfd = buffer_ref(w->poll_fds, efd->data * sizeof(struct pollfd));
     fetch_and_add(&w->poll_retcount, 1);
     pfd->revents = events;
     epoll_debug("   event on %d (%d), events 0x%x\n", efd->fd, pfd->fd, pfd->revents);
     blockq_wake_one(w->t->thread_bq);
+    return true;
 }
 
 closure_function(3, 1, sysreturn, poll_bh,
@@ -269,6 +269,22 @@ static inline void signalfd_dispatch(thread t, u64 pending)
     notify_dispatch_for_thread(t->signalfds, pending, t);
 }
 
+/* A thread running in user mode on another cpu would only see a new signal
+   at its next kernel entry, which may be a timer tick away; interrupt it so
+   that the handler is set up as it is rescheduled. */
+static void signal_kick_thread(thread t)
+{
+    u64 self = current_cpu()->id;
+    for (u64 i = 0; i < total_processors; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        if (i != self && ci->state == cpu_user &&
+            get_kernel_context(ci)->frame[FRAME_THREAD] == u64_from_pointer(&t->thrd)) {
+            interrupt_cpu(i);
+            return;
+        }
+    }
+}
+
 void deliver_signal_to_thread(thread t, struct siginfo *info)
 {
     int sig = info->si_signo;
@@ -294,6 +310,7 @@ void deliver_signal_to_thread(thread t, struct siginfo *info)
 
     if (thread_is_runnable(t)) {
         sig_debug("... thread runnable, no interrupt\n");
+        signal_kick_thread(t);
         return;
     }
 
@@ -392,7 +409,7 @@ static void check_syscall_restart(thread t, sigaction sa)
         if (sa->sa_flags & SA_RESTART) {
             sig_debug("restarting syscall\n");
             syscall_restart_arch_fixup(t);
-            enqueue_irqsafe(runqueue, &t->deferred_syscall);
+            runqueue_push((thunk)&t->deferred_syscall);
             kern_unlock();
             runloop();
         } else {
@@ -613,6 +630,7 @@ sysreturn sigaltstack(const stack_t *ss, stack_t *oss)
             }
             t->signal_stack = ss->ss_sp;
             t->signal_stack_length = ss->ss_size;
+            prefault_user_stack(t->p, u64_from_pointer(ss->ss_sp), ss->ss_size);
         }
     }
     return 0;
@@ -929,7 +947,7 @@ closure_function(1, 2, sysreturn, signalfd_close,
     return io_complete(completion, t, 0);
 }
 
-closure_function(1, 2, void, signalfd_notify,
+closure_function(1, 2, boolean, signalfd_notify,
                  signal_fd, sfd,
                  u64, events,
                  thread, t)
@@ -938,14 +956,16 @@ closure_function(1, 2, void, signalfd_notify,
     if (events == NOTIFY_EVENTS_RELEASE) {
         sig_debug("%d released\n", sfd->fd);
         closure_finish();
+        return false;
     }
 
     if ((events & sfd->mask) == 0) {
         sig_debug("%d spurious notify\n", sfd->fd);
-        return;
+        return false;
     }
     blockq_wake_one_for_thread(sfd->bq, t);
     notify_dispatch_for_thread(sfd->f.ns, EPOLLIN, t);
+    return true;
 }
 
 static void signalfd_update_siginterest(thread t)
@@ -1091,6 +1111,41 @@ static void default_signal_action(thread t, queued_signal qs)
     halt(fate);
 }
 
+/* rt_sigreturn on syscall entry, without the kernel lock: when no signal is
+   pending, restore the interrupted context and return true, so that the
+   caller can resume it directly rather than through the runqueue. As in
+   rt_sigreturn, the restart of an interrupted syscall is decided on the
+   restored context; a restart does not return. Restoring the ucontext from
+   a file-backed page may leave the kernel lock taken, on another cpu. */
+boolean rt_sigreturn_direct(thread t)
+{
+    if (!t->dispatch_sigstate || !t->active_signo ||
+        (sigstate_get_pending(&t->signals) | sigstate_get_pending(&t->p->signals)))
+        return false;
+
+    struct rt_sigframe *frame = get_rt_sigframe(t);
+    sigaction sa = sigaction_from_sig(t, t->active_signo);
+    t->active_signo = 0;
+    sigstate_thread_restore(t);
+    if (sa->sa_flags & SA_SIGINFO)
+        restore_ucontext(&(frame->uc), t->default_frame);
+    ftrace_thread_noreturn(t);
+    set_thread_frame(t, t->default_frame);
+    if (get_syscall_return(t) == -ERESTARTSYS) {
+        if (sa->sa_flags & SA_RESTART) {
+            sig_debug("restarting syscall\n");
+            syscall_restart_arch_fixup(t);
+            runqueue_push((thunk)&t->deferred_syscall);
+            if (this_cpu_has_kernel_lock())
+                kern_unlock();
+            runloop();
+        }
+        sig_debug("interrupted syscall\n");
+        set_syscall_return(t, -EINTR);
+    }
+    return true;
+}
+
 /* return true if t->sighandler_frame should be scheduled to run */
 boolean dispatch_signals(thread t)
 {
@@ -6,8 +6,12 @@
 declare_closure_struct(1, 0, void, sharedbuf_free,
     struct sharedbuf *, shb);
 
+/* A sharedbuf either owns a copy of written data or, for whole pages
+   handed over from an sg write, wraps the source memory and holds a
+   reference to it. */
 typedef struct sharedbuf {
     buffer b;
+    refcount ref;               /* source reference if wrapped */
     struct refcount refcount;
     closure_struct(sharedbuf_free, free);
 } *sharedbuf;
@@ -34,6 +38,8 @@ static inline void sharedbuf_deallocate(sharedbuf shb)
 {
     heap h = shb->b->h;
     deallocate_buffer(shb->b);
+    if (shb->ref)
+        refcount_release(shb->ref);
     deallocate(h, shb, sizeof(*shb));
 }
 
@@ -53,6 +59,24 @@ static inline sharedbuf sharedbuf_allocate(heap h, u64 len)
         deallocate(h, shb, sizeof(*shb));
         return INVALID_ADDRESS;
     }
+    shb->ref = 0;
+    init_closure(&shb->free, sharedbuf_free, shb);
+    init_refcount(&shb->refcount, 1, (thunk)&shb->free);
+    return shb;
+}
+
+/* takes over a reference to ref */
+static inline sharedbuf sharedbuf_wrap(heap h, void *data, u64 len, refcount ref)
+{
+    sharedbuf shb = allocate(h, sizeof(*shb));
+    if (shb == INVALID_ADDRESS)
+        return shb;
+    shb->b = wrap_buffer(h, data, len);
+    if (shb->b == INVALID_ADDRESS) {
+        deallocate(h, shb, sizeof(*shb));
+        return INVALID_ADDRESS;
+    }
+    shb->ref = ref;
     init_closure(&shb->free, sharedbuf_free, shb);
     init_refcount(&shb->refcount, 1, (thunk)&shb->free);
     return shb;
@@ -195,6 +219,42 @@ static sysreturn unixsock_write_check(unixsock s, u64 len)
     return 1;   /* any value > 0 will do */
 }
 
+/* A full page of a referenced sg buffer is passed to the reader as is. */
+static inline boolean unixsock_sg_shareable(sg_buf sgb)
+{
+    return sgb->refcount && (u64_from_pointer(sgb->buf + sgb->offset) & PAGEMASK) == 0 &&
+        sgb->size - sgb->offset >= UNIXSOCK_BUF_MAX_SIZE;
+}
+
+/* length of data to copy from the head of sg, up to the next shareable page */
+static u64 unixsock_sg_copy_len(sg_list sg, u64 max)
+{
+    u64 len = 0;
+    sg_buf end = buffer_ref(sg->b, buffer_length(sg->b));
+    for (sg_buf sgb = buffer_ref(sg->b, 0); sgb < end && len < max; sgb++) {
+        if (len > 0 && unixsock_sg_shareable(sgb))
+            break;
+        len += sgb->size - sgb->offset;
+    }
+    return MIN(len, max);
+}
+
+static sharedbuf unixsock_sg_share(heap h, sg_list sg)
+{
+    sg_buf sgb = sg_list_head_peek(sg);
+    sharedbuf shb = sharedbuf_wrap(h, sgb->buf + sgb->offset, UNIXSOCK_BUF_MAX_SIZE,
+                                   sgb->refcount);
+    if (shb == INVALID_ADDRESS)
+        return shb;
+    refcount_reserve(sgb->refcount);
+    sgb->offset += UNIXSOCK_BUF_MAX_SIZE;
+    if (sgb->offset == sgb->size) {
+        sg_list_head_remove(sg);
+        sg_buf_release(sgb);
+    }
+    return shb;
+}
+
 static sysreturn unixsock_write_to(void *src, sg_list sg, u64 length,
                                    unixsock dest)
 {
@@ -205,14 +265,26 @@ static sysreturn unixsock_write_to(void *src, sg_list sg, u64 length,
     sysreturn rv = 0;
     do {
         u64 xfer = MIN(UNIXSOCK_BUF_MAX_SIZE, length);
-        sharedbuf shb = sharedbuf_allocate(dest->sock.h, xfer);
+        sharedbuf shb;
+        sg_buf sgb = src ? INVALID_ADDRESS : sg_list_head_peek(sg);
+        boolean share = (sgb != INVALID_ADDRESS) && (dest->sock.type == SOCK_STREAM) &&
+            (xfer == UNIXSOCK_BUF_MAX_SIZE) && unixsock_sg_shareable(sgb);
+        if (share) {
+            shb = unixsock_sg_share(dest->sock.h, sg);
+        } else {
+            if (!src && (dest->sock.type == SOCK_STREAM))
+                xfer = unixsock_sg_copy_len(sg, xfer);
+            shb = sharedbuf_allocate(dest->sock.h, xfer);
+        }
         if (shb == INVALID_ADDRESS) {
             if (rv == 0) {
                 rv = -ENOMEM;
             }
             break;
         }
-        if (src) {
+        if (share) {
+            /* nothing to copy */
+        } else if (src) {
             assert(buffer_write(shb->b, src, xfer));
             src = (u8 *) src + xfer;
         } else {
@@ -304,6 +376,15 @@ closure_function(1, 6, sysreturn, unixsock_sg_write,
     return blockq_check(s->sock.txbq, t, ba, bh);
 }
 
+static u64 unixsock_tx_avail(struct sock *sock)
+{
+    unixsock s = (unixsock)sock;
+    if (!s->peer)
+        return 0;
+    queue q = s->peer->data;
+    return (_queue_size(q) - queue_length(q)) * UNIXSOCK_BUF_MAX_SIZE;
+}
+
 closure_function(1, 1, u32, unixsock_events,
                  unixsock, s,
                  thread, t /* ignore */)
@@ -436,6 +517,7 @@ static sysreturn unixsock_listen(struct sock *sock, int backlog)
             s->conn_q = 0;
             return -ENOMEM;
         }
+        blockq_set_exclusive(sock->rxbq, true);
     }
     return 0;
 }
@@ -679,6 +761,7 @@ static unixsock unixsock_alloc(heap h, int type, u32 flags)
     s->sock.recvfrom = unixsock_recvfrom;
     s->sock.sendmsg = unixsock_sendmsg;
     s->sock.recvmsg = unixsock_recvmsg;
+    s->sock.tx_avail = unixsock_tx_avail;
     s->fs_entry = 0;
     s->local_addr.sun_family = AF_UNIX;
     s->local_addr.sun_path[0] = '\0';
@@ -45,6 +45,19 @@ struct sock {
             int flags);
     sysreturn (*recvmsg)(struct sock *sock, struct msghdr *msg, int flags);
     sysreturn (*shutdown)(struct sock *sock, int how);
+    u64 (*tx_avail)(struct sock *sock);  /* optional: bytes writable without blocking */
+
+    /* optional: forms of the above that complete through an io_completion on
+     * behalf of thread t (as file_io does), for asynchronous callers */
+    sysreturn (*connect_io)(struct sock *sock, struct sockaddr *addr,
+            socklen_t addrlen, thread t, boolean bh, io_completion completion);
+    sysreturn (*accept4_io)(struct sock *sock, struct sockaddr *addr,
+            socklen_t *addrlen, int flags, thread t, boolean bh,
+            io_completion completion);
+    sysreturn (*sendmsg_io)(struct sock *sock, const struct msghdr *msg,
+            int flags, thread t, boolean bh, io_completion completion);
+    sysreturn (*recvmsg_io)(struct sock *sock, struct msghdr *msg, int flags,
+            thread t, boolean bh, io_completion completion);
 };
 
 static inline int socket_init(process p, heap h, int domain, int type, u32 flags,
@@ -82,6 +82,94 @@ static u32 maps_events(file f)
     return EPOLLIN;
 }
 
+static sysreturn meminfo_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(256);
+    heap phys = (heap)heap_physical(get_kernel_heaps());
+    u64 total = heap_total(phys);
+    bprintf(b, "MemTotal:       %8ld kB\n", total >> 10);
+    bprintf(b, "MemFree:        %8ld kB\n", (total - heap_allocated(phys)) >> 10);
+    bprintf(b, "AnonHugePages:  %8ld kB\n",
+            (process_anon_huge_pages(current->p) * PAGESIZE_2M) >> 10);
+    bprintf(b, "Hugepagesize:   %8ld kB\n", PAGESIZE_2M >> 10);
+    if (offset >= buffer_length(b))
+        return 0;
+    length = MIN(length, buffer_length(b) - offset);
+    runtime_memcpy(dest, buffer_ref(b, offset), length);
+    return length;
+}
+
+static sysreturn vmstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(256);
+    hugepage_collapse_stats(b);
+    if (offset >= buffer_length(b))
+        return 0;
+    length = MIN(length, buffer_length(b) - offset);
+    runtime_memcpy(dest, buffer_ref(b, offset), length);
+    return length;
+}
+
+static u32 meminfo_events(file f)
+{
+    return EPOLLIN;
+}
+
+static sysreturn netstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(256);
+    netsyscall_netstat(b);
+    if (offset >= buffer_length(b))
+        return 0;
+    length = MIN(length, buffer_length(b) - offset);
+    runtime_memcpy(dest, buffer_ref(b, offset), length);
+    return length;
+}
+
+static u32 netstat_events(file f)
+{
+    return EPOLLIN;
+}
+
+static sysreturn net_pools_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(512);
+    net_pool_stats(b);
+    if (offset >= buffer_length(b))
+        return 0;
+    length = MIN(length, buffer_length(b) - offset);
+    runtime_memcpy(dest, buffer_ref(b, offset), length);
+    return length;
+}
+
+static sysreturn snmp_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(2048);
+    net_snmp(b);
+    if (offset >= buffer_length(b))
+        return 0;
+    length = MIN(length, buffer_length(b) - offset);
+    runtime_memcpy(dest, buffer_ref(b, offset), length);
+    return length;
+}
+
+static sysreturn interrupts_read(file f, void *dest, u64 length, u64 offset)
+{
+    heap h = heap_general(get_kernel_heaps());
+    buffer b = allocate_buffer(h, 1024);
+    if (b == INVALID_ADDRESS)
+        return -ENOMEM;
+    interrupt_stats_print(b);
+    if (offset >= buffer_length(b)) {
+        deallocate_buffer(b);
+        return 0;
+    }
+    length = MIN(length, buffer_length(b) - offset);
+    runtime_memcpy(dest, buffer_ref(b, offset), length);
+    deallocate_buffer(b);
+    return length;
+}
+
 static sysreturn cpu_online_read(file f, void *dest, u64 length, u64 offset)
 {
     buffer b = little_stack_buffer(16);
@@ -100,6 +188,12 @@ static special_file special_files[] = {
     { "/dev/urandom", .read = urandom_read, .write = 0, .events = urandom_events },
     { "/dev/null", .read = null_read, .write = null_write, .events = null_events },
     { "/proc/self/maps", .read = maps_read, .events = maps_events, },
+    { "/proc/meminfo", .read = meminfo_read, .events = meminfo_events, },
+    { "/proc/vmstat", .read = vmstat_read, .events = meminfo_events, },
+    { "/proc/net/netstat", .read = netstat_read, .events = netstat_events, },
+    { "/proc/net/pools", .read = net_pools_read, .events = netstat_events, },
+    { "/proc/net/snmp", .read = snmp_read, .events = netstat_events, },
+    { "/proc/interrupts", .read = interrupts_read, .events = meminfo_events, },
     { "/sys/devices/system/cpu/online", .read = cpu_online_read, .write = null_write, .events = cpu_online_events },
     FTRACE_SPECIAL_FILES
 };
@@ -1,5 +1,6 @@
 #include <unix_internal.h>
 #include <filesystem.h>
+#include <socket.h>
 #include <storage.h>
 
 // lifted from linux UAPI
@@ -21,6 +22,21 @@ typedef struct syscall_stat {
 
 static struct syscall_stat stats[SYS_MAX];
 boolean do_syscall_stats;
+static boolean syscall_summary;
+
+/* log2(cycles) latency histograms, kept per syscall for the threads within
+   [tid_min, tid_max] when syscall_latency is configured */
+typedef struct syscall_hist {
+    u64 total[LOG2_HIST_BUCKETS];       /* entry to completion */
+    u64 blocked[LOG2_HIST_BUCKETS];     /* time spent not running */
+} *syscall_hist;
+
+static syscall_hist hists;
+static u64 hist_tid_min, hist_tid_max;
+
+/* entry to completion latency of all syscalls and threads, collected once
+   requested through syscall_latency_hist() */
+static u64 *hist_all;
 
 sysreturn close(int fd);
 
@@ -131,7 +147,7 @@ define_closure_function(2, 2, void, iov_op_each_complete,
     } else {
         if (p->file_offset != infinity)
             p->file_offset += rv;
-        enqueue_irqsafe(runqueue, &p->bh);
+        runqueue_push((thunk)&p->bh);
     }
     return;
   out_complete:
@@ -390,13 +406,58 @@ out_complete:
     closure_finish();
 }
 
-/* Should be determined more intelligently based on available
-   buffering on output side, modulated by link capacity
-   (e.g. bandwidth delay product). Right now assuming the common mode
-   is tcp output with 64kB max window size... */
+/* Sockets that take scatter-gather writes are handed the buffers of the
+   read as they are, rather than written to buffer by buffer. For regular
+   files these are pagecache pages, which a tcp socket can transmit from
+   directly. */
+closure_function(6, 2, void, sendfile_sg_bh,
+                 fdesc, in, fdesc, out, int *, offset, sg_list, sg, bytes, count, bytes, readlen,
+                 thread, t, sysreturn, rv)
+{
+    thread_log(t, "%s: count %ld, readlen %ld, rv %ld", __func__, bound(count), bound(readlen), rv);
+    if (bound(readlen) == 0) {
+        if (rv > 0) {
+            /* read complete */
+            thread_resume(t);
+            bound(readlen) = rv;
+            if (bound(offset))
+                *bound(offset) += rv;
+            apply(bound(out)->sg_write, bound(sg), rv, 0, t, true, (io_completion)closure_self());
+            return;
+        }
+    } else if (rv < (sysreturn)bound(readlen)) {
+        /* give back what was read but not written */
+        s64 rewind = bound(readlen) - MAX(rv, 0);
+        if (bound(offset))
+            *bound(offset) -= rewind;
+        else if (bound(in)->type == FDESC_TYPE_REGULAR)
+            ((file)bound(in))->offset -= rewind;
+        thread_log(t, "   rewound %ld bytes", rewind);
+    }
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    syscall_return(t, rv);
+    closure_finish();
+}
 
+/* Upper bound of a read for outputs with no better measure of how much they
+   can take. */
 #define SENDFILE_READ_MAX (64 * KB)
 
+/* Size a read to what a socket can take without blocking, so that data is
+   neither read far ahead of the send window nor read just to be rewound.
+   At least a page is read, so that a full send buffer still leaves a
+   write to block on. */
+static u64 sendfile_read_max(fdesc out)
+{
+    if (out->type == FDESC_TYPE_SOCKET) {
+        struct sock *s = (struct sock *)out;
+        if (s->tx_avail)
+            return MAX(s->tx_avail(s), PAGESIZE);
+    }
+    return SENDFILE_READ_MAX;
+}
+
 /* requires infile to have sg_read method - so sendfile from special files isn't supported */
 static sysreturn sendfile(int out_fd, int in_fd, int *offset, bytes count)
 {
@@ -415,13 +476,446 @@ static sysreturn sendfile(int out_fd, int in_fd, int *offset, bytes count)
     if (sg == INVALID_ADDRESS)
         return set_syscall_error(current, ENOMEM);
 
-    u64 n = MIN(count, SENDFILE_READ_MAX);
-    io_completion read_complete = closure(heap_general(get_kernel_heaps()), sendfile_bh, infile, outfile,
-                                          offset, sg, 0, n, 0, 0, false);
+    u64 n = MIN(count, sendfile_read_max(outfile));
+    io_completion read_complete;
+    if (outfile->type == FDESC_TYPE_SOCKET && outfile->sg_write)
+        read_complete = closure(heap_transient(get_kernel_heaps()), sendfile_sg_bh, infile,
+                                outfile, offset, sg, n, 0);
+    else
+        read_complete = closure(heap_transient(get_kernel_heaps()), sendfile_bh, infile,
+                                outfile, offset, sg, 0, n, 0, 0, false);
     apply(infile->sg_read, sg, n, offset ? *offset : infinity, current, false, read_complete);
     return get_syscall_return(current);
 }
 
+#define COPY_FILE_RANGE_CHUNK (64 * KB)
+
+/* Pagecache to pagecache copy between regular files, a chunk at a time. A
+   zero readlen means that a read has just completed. */
+closure_function(9, 2, void, copy_file_range_bh,
+                 file, in, s64 *, off_in, file, out, s64 *, off_out, u64, in_offset, u64, out_offset,
+                 u64, remain, sg_list, sg, u64, readlen,
+                 thread, t, sysreturn, rv)
+{
+    file in = bound(in);
+    file out = bound(out);
+    sg_list sg = bound(sg);
+    thread_log(t, "%s: remain %ld, readlen %ld, rv %ld", __func__, bound(remain),
+               bound(readlen), rv);
+    u64 copied = bound(in_offset) - (bound(off_in) ? *bound(off_in) : in->offset);
+    if (rv <= 0)
+        goto out_complete;
+    if (bound(readlen) == 0) {
+        bound(readlen) = rv;
+        apply(out->f.sg_write, sg, rv, bound(out_offset), t, true, (io_completion)closure_self());
+        return;
+    }
+    sg_list_release(sg);
+    bound(in_offset) += rv;
+    bound(out_offset) += rv;
+    bound(remain) -= rv;
+    copied += rv;
+    if (bound(remain) > 0 && rv == bound(readlen)) {
+        bound(readlen) = 0;
+        apply(in->f.sg_read, sg, MIN(bound(remain), COPY_FILE_RANGE_CHUNK), bound(in_offset),
+              t, true, (io_completion)closure_self());
+        return;
+    }
+  out_complete:
+    if (copied > 0) {
+        if (bound(off_in))
+            *bound(off_in) += copied;
+        else
+            in->offset += copied;
+        if (bound(off_out))
+            *bound(off_out) += copied;
+        else
+            out->offset += copied;
+        rv = copied;
+    }
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    syscall_return(t, rv);
+    closure_finish();
+}
+
+static void copy_file_range_copy(thread t, file in, s64 *off_in, file out, s64 *off_out,
+                                 u64 in_offset, u64 out_offset, u64 len)
+{
+    heap h = heap_general(get_kernel_heaps());
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS) {
+        syscall_return(t, -ENOMEM);
+        return;
+    }
+    io_completion c = closure(h, copy_file_range_bh, in, off_in, out, off_out, in_offset,
+                              out_offset, len, sg, 0);
+    if (c == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        syscall_return(t, -ENOMEM);
+        return;
+    }
+    apply(in->f.sg_read, sg, MIN(len, COPY_FILE_RANGE_CHUNK), in_offset, t, true, c);
+}
+
+/* Extents are shared if the range allows it, and data is copied otherwise. */
+closure_function(8, 2, void, copy_file_range_cloned,
+                 thread, t, file, in, s64 *, off_in, file, out, s64 *, off_out, u64, in_offset,
+                 u64, out_offset, u64, len,
+                 fsfile, fsf, fs_status, fss)
+{
+    thread t = bound(t);
+    file in = bound(in);
+    file out = bound(out);
+    thread_log(t, "%s: status %d", __func__, fss);
+    if (fss == FS_STATUS_OK) {
+        out->length = fsfile_get_length(out->fsf);
+        if (bound(off_in))
+            *bound(off_in) += bound(len);
+        else
+            in->offset += bound(len);
+        if (bound(off_out))
+            *bound(off_out) += bound(len);
+        else
+            out->offset += bound(len);
+        syscall_return(t, bound(len));
+    } else if (fss == FS_STATUS_READONLY) {
+        syscall_return(t, -EROFS);
+    } else {
+        copy_file_range_copy(t, in, bound(off_in), out, bound(off_out), bound(in_offset),
+                             bound(out_offset), bound(len));
+    }
+    closure_finish();
+}
+
+static sysreturn copy_file_range(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len,
+                                 unsigned int flags)
+{
+    thread_log(current, "%s: in %d, off_in %p, out %d, off_out %p, len %ld, flags 0x%x",
+               __func__, fd_in, off_in, fd_out, off_out, len, flags);
+    if (flags)
+        return -EINVAL;
+    if ((off_in && !validate_user_memory(off_in, sizeof(*off_in), true)) ||
+        (off_out && !validate_user_memory(off_out, sizeof(*off_out), true)))
+        return -EFAULT;
+    fdesc fin = resolve_fd(current->p, fd_in);
+    fdesc fout = resolve_fd(current->p, fd_out);
+    if (!fdesc_is_readable(fin) || !fdesc_is_writable(fout) || (fout->flags & O_APPEND))
+        return -EBADF;
+    if (fin->type != FDESC_TYPE_REGULAR || fout->type != FDESC_TYPE_REGULAR)
+        return -EINVAL;
+    file in = (file)fin;
+    file out = (file)fout;
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0))
+        return -EINVAL;
+    u64 in_offset = off_in ? *off_in : in->offset;
+    u64 out_offset = off_out ? *off_out : out->offset;
+    if (in_offset >= in->length || len == 0)
+        return 0;
+    len = MIN(len, in->length - in_offset);
+    if (in->fsf == out->fsf && ranges_intersect(irangel(in_offset, len),
+                                                irangel(out_offset, len)))
+        return -EINVAL;
+    fs_status_handler c = closure(heap_general(get_kernel_heaps()), copy_file_range_cloned,
+                                  current, in, off_in, out, off_out, in_offset, out_offset, len);
+    if (c == INVALID_ADDRESS)
+        return -ENOMEM;
+    filesystem_clone_range(in->fsf, in_offset, out->fsf, out_offset, len, c);
+    return thread_maybe_sleep_uninterruptible(current);
+}
+
+/* Bounce buffer for splice ends without sg methods. It is page-backed so
+   that an sg writer (e.g. a unix socket) may hold on to its pages. */
+typedef struct splice_buf *splice_buf;
+
+declare_closure_struct(1, 0, void, splice_buf_free,
+                       splice_buf, sb);
+
+struct splice_buf {
+    heap h;
+    void *data;
+    u64 size;
+    struct refcount refcount;
+    closure_struct(splice_buf_free, free);
+};
+
+define_closure_function(1, 0, void, splice_buf_free,
+                        splice_buf, sb)
+{
+    splice_buf sb = bound(sb);
+    deallocate(sb->h, sb->data, sb->size);
+    deallocate(heap_general(get_kernel_heaps()), sb, sizeof(*sb));
+}
+
+static splice_buf allocate_splice_buf(u64 size)
+{
+    kernel_heaps kh = get_kernel_heaps();
+    splice_buf sb = allocate(heap_general(kh), sizeof(*sb));
+    if (sb == INVALID_ADDRESS)
+        return sb;
+    sb->h = heap_backed(kh);
+    sb->size = pad(size, PAGESIZE);
+    sb->data = allocate(sb->h, sb->size);
+    if (sb->data == INVALID_ADDRESS) {
+        deallocate(heap_general(kh), sb, sizeof(*sb));
+        return INVALID_ADDRESS;
+    }
+    init_refcount(&sb->refcount, 1, init_closure(&sb->free, splice_buf_free, sb));
+    return sb;
+}
+
+/* A read from the input is followed by a write of what was read to the
+   output. Data read but not written is given back: a seekable input is
+   rewound, and a pipe gets back the pages it was read from, which are kept
+   referenced in the keep list until the write completes. A zero readlen
+   means that the read has just completed. */
+closure_function(9, 2, void, splice_bh,
+                 fdesc, in, s64 *, off_in, fdesc, out, s64 *, off_out, sg_list, sg, sg_list, keep,
+                 splice_buf, sb, u64, readlen, u64, written,
+                 thread, t, sysreturn, rv)
+{
+    fdesc out = bound(out);
+    sg_list sg = bound(sg);
+    sg_list keep = bound(keep);
+    splice_buf sb = bound(sb);
+    thread_log(t, "%s: readlen %ld, written %ld, rv %ld", __func__, bound(readlen),
+               bound(written), rv);
+    if (bound(readlen) == 0) {
+        if (rv <= 0)
+            goto out_complete;
+        thread_resume(t);
+        bound(readlen) = rv;
+        if (bound(off_in))
+            *bound(off_in) += rv;
+        if (keep)
+            sg_dup(keep, sg, rv);
+        if (out->sg_write) {
+            if (sb) {
+                for (u64 off = 0; off < rv; off += PAGESIZE) {
+                    sg_buf sgb = sg_list_tail_add(sg, MIN(PAGESIZE, rv - off));
+                    sgb->buf = sb->data + off;
+                    sgb->size = MIN(PAGESIZE, rv - off);
+                    sgb->offset = 0;
+                    sgb->refcount = &sb->refcount;
+                    refcount_reserve(&sb->refcount);
+                }
+            }
+            apply(out->sg_write, sg, rv, bound(off_out) ? *bound(off_out) : infinity, t, true,
+                  (io_completion)closure_self());
+            return;
+        }
+        if (!sb) {
+            sb = bound(sb) = allocate_splice_buf(rv);
+            if (sb == INVALID_ADDRESS) {
+                bound(sb) = 0;
+                rv = -ENOMEM;
+                goto out_rewind;
+            }
+            sg_copy_to_buf(sb->data, sg, rv);
+        }
+        apply(out->write, sb->data, rv, bound(off_out) ? *bound(off_out) : infinity, t, true,
+              (io_completion)closure_self());
+        return;
+    }
+    if (rv > 0) {
+        bound(written) += rv;
+        if (bound(off_out))
+            *bound(off_out) += rv;
+        if (!out->sg_write && bound(written) < bound(readlen)) {
+            u64 written = bound(written);
+            apply(out->write, sb->data + written, bound(readlen) - written,
+                  bound(off_out) ? *bound(off_out) : infinity, t, true,
+                  (io_completion)closure_self());
+            return;
+        }
+    }
+  out_rewind:
+    if (bound(written) < bound(readlen)) {
+        s64 rewind = bound(readlen) - bound(written);
+        if (bound(off_in)) {
+            *bound(off_in) -= rewind;
+        } else if (keep) {
+            sg_consume(keep, bound(written));
+            pipe_unread(bound(in), keep, rewind);
+        } else {
+            ((file)bound(in))->offset -= rewind;
+        }
+        thread_log(t, "   rewound %ld bytes", rewind);
+    }
+    if (bound(written) > 0)
+        rv = bound(written);
+  out_complete:
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    if (keep) {
+        sg_list_release(keep);
+        deallocate_sg_list(keep);
+    }
+    if (sb)
+        refcount_release(&sb->refcount);
+    syscall_return(t, rv);
+    closure_finish();
+}
+
+/* bytes the output can take without blocking, if known */
+static u64 splice_write_max(fdesc out)
+{
+    if (out->type == FDESC_TYPE_PIPE)
+        return pipe_write_avail(out);
+    if (out->type == FDESC_TYPE_SOCKET) {
+        struct sock *s = (struct sock *)out;
+        if (s->tx_avail)
+            return s->tx_avail(s);
+    }
+    return SENDFILE_READ_MAX;
+}
+
+/* Not limited to pipes: a regular file or a pipe may be spliced to any
+   output with a write or sg_write method. Other inputs cannot take back
+   data that the output does not accept, so they are not supported. Between
+   sg methods (files, pipes and unix sockets) no data is copied here. */
+static sysreturn splice(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len,
+                        unsigned int flags)
+{
+    thread_log(current, "%s: in %d, off_in %p, out %d, off_out %p, len %ld, flags 0x%x",
+               __func__, fd_in, off_in, fd_out, off_out, len, flags);
+    if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT))
+        return -EINVAL;
+    if ((off_in && !validate_user_memory(off_in, sizeof(*off_in), true)) ||
+        (off_out && !validate_user_memory(off_out, sizeof(*off_out), true)))
+        return -EFAULT;
+    fdesc fin = resolve_fd(current->p, fd_in);
+    fdesc fout = resolve_fd(current->p, fd_out);
+    if (!fdesc_is_readable(fin) || !fdesc_is_writable(fout))
+        return -EBADF;
+    if ((off_in && fin->type != FDESC_TYPE_REGULAR) ||
+        (off_out && fout->type != FDESC_TYPE_REGULAR))
+        return -ESPIPE;
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0))
+        return -EINVAL;
+    if ((fin->type != FDESC_TYPE_REGULAR && fin->type != FDESC_TYPE_PIPE) ||
+        !(fin->sg_read || fin->read) || !(fout->sg_write || fout->write))
+        return -EINVAL;
+    if (len == 0)
+        return 0;
+
+    u64 n = MIN(len, splice_write_max(fout));
+    if (n == 0) {
+        if ((fout->flags & O_NONBLOCK) || (flags & SPLICE_F_NONBLOCK))
+            return -EAGAIN;
+        n = MIN(len, PAGESIZE);
+    }
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return -ENOMEM;
+    sg_list keep = 0;
+    splice_buf sb = 0;
+    if (fin->type == FDESC_TYPE_PIPE) {
+        keep = allocate_sg_list();
+        if (keep == INVALID_ADDRESS) {
+            keep = 0;
+            goto out_dealloc;
+        }
+    }
+    if (!fin->sg_read) {
+        sb = allocate_splice_buf(n);
+        if (sb == INVALID_ADDRESS) {
+            sb = 0;
+            goto out_dealloc;
+        }
+    }
+    io_completion c = closure(heap_general(get_kernel_heaps()), splice_bh, fin, off_in, fout,
+                              off_out, sg, keep, sb, 0, 0);
+    if (c == INVALID_ADDRESS)
+        goto out_dealloc;
+    u64 offset = off_in ? *off_in : infinity;
+    if (fin->sg_read)
+        apply(fin->sg_read, sg, n, offset, current, false, c);
+    else
+        apply(fin->read, sb->data, n, offset, current, false, c);
+    return get_syscall_return(current);
+  out_dealloc:
+    if (sb)
+        refcount_release(&sb->refcount);
+    if (keep)
+        deallocate_sg_list(keep);
+    deallocate_sg_list(sg);
+    return -ENOMEM;
+}
+
+static sysreturn tee(int fd_in, int fd_out, u64 len, unsigned int flags)
+{
+    thread_log(current, "%s: in %d, out %d, len %ld, flags 0x%x", __func__, fd_in, fd_out, len,
+               flags);
+    if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT))
+        return -EINVAL;
+    fdesc fin = resolve_fd(current->p, fd_in);
+    fdesc fout = resolve_fd(current->p, fd_out);
+    if (!fdesc_is_readable(fin) || !fdesc_is_writable(fout))
+        return -EBADF;
+    if (fin->type != FDESC_TYPE_PIPE || fout->type != FDESC_TYPE_PIPE)
+        return -EINVAL;
+    return pipe_tee(fin, fout, len, (flags & SPLICE_F_NONBLOCK) != 0);
+}
+
+/* User pages are not pinned for the pipe to reference, so vmsplice copies
+   like writev (or readv, for the read end of a pipe); SPLICE_F_GIFT has no
+   effect. */
+static sysreturn vmsplice(int fd, struct iovec *iov, u64 nr_segs, unsigned int flags)
+{
+    thread_log(current, "%s: fd %d, iov %p, nr_segs %ld, flags 0x%x", __func__, fd, iov, nr_segs,
+               flags);
+    if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT))
+        return -EINVAL;
+    fdesc f = resolve_fd(current->p, fd);
+    if (f->type != FDESC_TYPE_PIPE)
+        return -EBADF;
+    boolean write = fdesc_is_writable(f);
+    if (!validate_iovec(iov, nr_segs, !write))
+        return -EFAULT;
+    if (flags & SPLICE_F_NONBLOCK) {
+        u64 avail = write ? pipe_write_avail(f) : (apply(f->events, current) & EPOLLIN);
+        if (!avail)
+            return -EAGAIN;
+    }
+    iov_op(f, write, iov, nr_segs, infinity, true, syscall_io_complete);
+    return thread_maybe_sleep_uninterruptible(current);
+}
+
+closure_function(2, 2, void, file_clone_complete,
+                 thread, t, file, f,
+                 fsfile, fsf, fs_status, fss)
+{
+    if (fss == FS_STATUS_OK)
+        bound(f)->length = fsfile_get_length(fsf);
+    syscall_return(bound(t), sysreturn_from_fs_status(fss));
+    closure_finish();
+}
+
+/* FICLONE: share the whole of src_fd with the file f, which must be empty. */
+static sysreturn file_clone(fdesc f, int src_fd)
+{
+    fdesc src = resolve_fd(current->p, src_fd);
+    if (!fdesc_is_readable(src) || !fdesc_is_writable(f) || (f->flags & O_APPEND))
+        return -EBADF;
+    if (src->type != FDESC_TYPE_REGULAR || f->type != FDESC_TYPE_REGULAR)
+        return -EINVAL;
+    file in = (file)src;
+    file out = (file)f;
+    if (in->fs != out->fs)
+        return -EXDEV;
+    if (out->length > 0)
+        return -EINVAL;
+    if (in->length == 0)
+        return 0;
+    fs_status_handler c = closure(heap_general(get_kernel_heaps()), file_clone_complete,
+                                  current, out);
+    if (c == INVALID_ADDRESS)
+        return -ENOMEM;
+    filesystem_clone_range(in->fsf, 0, out->fsf, 0, in->length, c);
+    return thread_maybe_sleep_uninterruptible(current);
+}
+
 static void begin_file_read(thread t, file f)
 {
     if ((f->length > 0) && !(f->f.flags & O_NOATIME)) {
@@ -429,6 +923,247 @@ static void begin_file_read(thread t, file f)
     }
 }
 
+static void begin_file_write(thread t, file f, u64 len)
+{
+    if (len > 0)
+        filesystem_update_mtime(f->fs, fsfile_get_meta(f->fsf));
+}
+
+static void file_write_complete_internal(thread t, file f, u64 len,
+                                         boolean is_file_offset,
+                                         io_completion completion, status s)
+{
+    sysreturn rv;
+    if (is_ok(s)) {
+        /* if regular file, update length */
+        if (f->fsf)
+            f->length = fsfile_get_length(f->fsf);
+        if (is_file_offset)
+            f->offset += len;
+        if (len > 0)
+            inotify_file_event(f, IN_MODIFY);
+        rv = len;
+    } else {
+        rv = sysreturn_from_fs_status_value(s);
+    }
+    apply(completion, t, rv);
+}
+
+/* O_DIRECT transfers go straight between user memory and storage. They must
+   be aligned to the filesystem block size, and ranges with pages in the
+   cache are served through the cache instead, which keeps them coherent
+   with cached data. User pages are faulted in up front and pinned for the
+   duration of the transfer, which runs on their kernel alias, described one
+   page at a time as block drivers expect physically contiguous buffers. */
+static boolean file_direct_io_aligned(file f, void *buf, u64 offset, u64 length)
+{
+    u64 mask = filesystem_get_blocksize(f->fs) - 1;
+    return ((u64_from_pointer(buf) | offset | length) & mask) == 0;
+}
+
+static boolean file_range_cached(file f, u64 offset, u64 length)
+{
+    return pagecache_node_range_cached(fsfile_get_cachenode(f->fsf), irangel(offset, length));
+}
+
+static void file_direct_touch(volatile u8 *v, boolean read)
+{
+    if (read)
+        *v = *v;            /* storage writes to this page: force a private, writable copy */
+    else
+        (void)*v;
+}
+
+/* Fixed buffers (io_uring registered buffers) are faulted in once, when
+   registered; I/O on them then only checks that each page is still mapped,
+   so that it never takes a fault, e.g. when submitted by the SQ poller. */
+void fixed_buffer_prefault(void *buf, u64 length)
+{
+    if (length == 0)
+        return;
+    u64 p = u64_from_pointer(buf);
+    u64 end = p + length;
+    for (p &= ~PAGEMASK; p < end; p += PAGESIZE)
+        file_direct_touch(pointer_from_u64(MAX(p, u64_from_pointer(buf))), true);
+}
+
+/* describes the pinned buffer at alias one page at a time */
+static sg_list file_direct_sg(void *alias, u64 length)
+{
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return sg;
+    u64 p = u64_from_pointer(alias);
+    u64 end = p + length;
+    while (p < end) {
+        u64 n = MIN(end, (p & ~PAGEMASK) + PAGESIZE) - p;
+        sg_buf sgb = sg_list_tail_add(sg, n);
+        if (sgb == INVALID_ADDRESS) {
+            sg_list_release(sg);
+            deallocate_sg_list(sg);
+            return INVALID_ADDRESS;
+        }
+        sgb->buf = pointer_from_u64(p);
+        sgb->size = n;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+        p += n;
+    }
+    return sg;
+}
+
+/* the buffer was pinned for count rounded up to whole blocks */
+static void file_direct_io_finish(thread t, file f, void *alias, u64 count,
+                                  boolean is_file_offset, boolean write,
+                                  io_completion completion, status s)
+{
+    unpin_user_pages(alias, pad(count, filesystem_get_blocksize(f->fs)));
+    if (write) {
+        file_write_complete_internal(t, f, count, is_file_offset, completion, s);
+    } else {
+        sysreturn rv;
+        if (is_ok(s)) {
+            if (is_file_offset)
+                f->offset += count;
+            rv = count;
+        } else {
+            rv = sysreturn_from_fs_status_value(s);
+        }
+        apply(completion, t, rv);
+    }
+}
+
+closure_function(8, 1, void, file_direct_cache_complete,
+                 thread, t, file, f, sg_list, sg, void *, alias, u64, count,
+                 boolean, is_file_offset, boolean, write, io_completion, completion,
+                 status, s)
+{
+    sg_list sg = bound(sg);
+    thread_log(bound(t), "%s: f %p, status %v", __func__, bound(f), s);
+    if (!bound(write) && is_ok(s))
+        sg_copy_to_buf_and_release(bound(alias), sg, bound(count));
+    else
+        sg_list_release(sg);
+    deallocate_sg_list(sg);
+    file_direct_io_finish(bound(t), bound(f), bound(alias), bound(count),
+                          bound(is_file_offset), bound(write), bound(completion), s);
+    closure_finish();
+}
+
+/* Pages of the range may have been brought into the cache while the
+   transfer was in flight, by a buffered read or a fault on a mapping of the
+   file. Those may hold stale data (or, for a read, newer dirty data), so the
+   transfer is repeated through the cache, still on the pinned buffer. */
+static boolean file_direct_cache_recheck(thread t, file f, void *alias, u64 offset,
+                                         u64 count, boolean is_file_offset, boolean write,
+                                         io_completion completion)
+{
+    if (!file_range_cached(f, offset, count))
+        return false;
+    heap h = heap_general(get_kernel_heaps());
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return false;
+    if (write) {
+        sg_buf sgb = sg_list_tail_add(sg, count);
+        if (sgb == INVALID_ADDRESS)
+            goto fail;
+        sgb->buf = alias;
+        sgb->size = count;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+    }
+    status_handler sh = closure(h, file_direct_cache_complete, t, f, sg, alias, count,
+                                is_file_offset, write, completion);
+    if (sh == INVALID_ADDRESS)
+        goto fail;
+    thread_log(t, "%s: f %p, offset %ld, count %ld cached during transfer", __func__, f,
+               offset, count);
+    range q = irangel(offset, count);
+    if (write)
+        apply(f->fs_write, sg, q, sh);
+    else
+        apply(f->fs_read, sg, q, sh);
+    return true;
+  fail:
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    return false;
+}
+
+closure_function(9, 1, void, file_direct_io_complete,
+                 thread, t, file, f, sg_list, sg, void *, alias, u64, offset, u64, count,
+                 boolean, is_file_offset, boolean, write, io_completion, completion,
+                 status, s)
+{
+    thread t = bound(t);
+    file f = bound(f);
+    u64 count = bound(count);
+    io_completion completion = bound(completion);
+    thread_log(t, "%s: f %p, %s count %ld, status %v", __func__, f,
+               bound(write) ? "write" : "read", count, s);
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    if (!is_ok(s) || !file_direct_cache_recheck(t, f, bound(alias), bound(offset), count,
+                                                bound(is_file_offset), bound(write), completion))
+        file_direct_io_finish(t, f, bound(alias), count, bound(is_file_offset), bound(write),
+                              completion, s);
+    closure_finish();
+}
+
+/* Returns false, having started nothing, if buf cannot be pinned (it is not
+   in anonymous memory, say); the caller then takes the buffered path. */
+static boolean file_direct_io(file f, void *buf, u64 length, u64 offset, boolean is_file_offset,
+                              boolean write, boolean prefaulted, thread t, boolean bh,
+                              io_completion completion, sysreturn *rv)
+{
+    heap h = heap_general(get_kernel_heaps());
+    u64 count = length;
+    if (!write) {
+        /* whole blocks are read; only the part within the file is reported */
+        count = MIN(length, f->length - offset);
+        length = pad(count, filesystem_get_blocksize(f->fs));
+    }
+    thread_log(t, "%s: f %p, buf %p, offset %ld, length %ld, %s", __func__, f, buf,
+               offset, length, write ? "write" : "read");
+    if (!prefaulted) {
+        u64 p = u64_from_pointer(buf);
+        for (u64 end = p + length; p < end; p = (p & ~PAGEMASK) + PAGESIZE)
+            file_direct_touch(pointer_from_u64(p), !write);
+    }
+    void *alias = pin_user_pages(t->p, buf, length);
+    if (alias == INVALID_ADDRESS) {
+        if (!prefaulted)
+            return false;
+        *rv = io_complete(completion, t, -EFAULT);
+        return true;
+    }
+    sg_list sg = file_direct_sg(alias, length);
+    if (sg == INVALID_ADDRESS)
+        goto nomem;
+    status_handler sh = closure(h, file_direct_io_complete, t, f, sg, alias, offset, count,
+                                is_file_offset, write, completion);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        goto nomem;
+    }
+    range q = irangel(offset, length);
+    if (write) {
+        begin_file_write(t, f, length);
+        apply(fsfile_get_direct_writer(f->fsf), sg, q, sh);
+    } else {
+        begin_file_read(t, f);
+        apply(fsfile_get_direct_reader(f->fsf), sg, q, sh);
+    }
+    /* possible direct return in top half */
+    *rv = bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
+    return true;
+  nomem:
+    unpin_user_pages(alias, length);
+    *rv = io_complete(completion, t, -ENOMEM);
+    return true;
+}
+
 closure_function(7, 1, void, file_read_complete,
                  thread, t, sg_list, sg, void *, dest, u64, limit, file, f, boolean, is_file_offset, io_completion, completion,
                  status, s)
@@ -466,9 +1201,16 @@ closure_function(2, 6, sysreturn, file_read,
     if (f->f.type == FDESC_TYPE_SPECIAL) {
         return spec_read(f, dest, length, offset, t, bh, completion);
     }
+    if ((f->f.flags & O_DIRECT) && !file_direct_io_aligned(f, dest, offset, length))
+        return io_complete(completion, t, -EINVAL);
     if (offset >= f->length) {
         return io_complete(completion, t, 0);
     }
+    sysreturn rv;
+    if ((f->f.flags & O_DIRECT) && !file_range_cached(f, offset, length) &&
+        file_direct_io(f, dest, length, offset, is_file_offset, false, false, t, bh,
+                       completion, &rv))
+        return rv;
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         thread_log(t, "   unable to allocate sg list");
@@ -528,30 +1270,6 @@ closure_function(2, 6, sysreturn, file_sg_read,
     return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
 }
 
-static void begin_file_write(thread t, file f, u64 len)
-{
-    if (len > 0)
-        filesystem_update_mtime(f->fs, fsfile_get_meta(f->fsf));
-}
-
-static void file_write_complete_internal(thread t, file f, u64 len,
-                                         boolean is_file_offset,
-                                         io_completion completion, status s)
-{
-    sysreturn rv;
-    if (is_ok(s)) {
-        /* if regular file, update length */
-        if (f->fsf)
-            f->length = fsfile_get_length(f->fsf);
-        if (is_file_offset)
-            f->offset += len;
-        rv = len;
-    } else {
-        rv = sysreturn_from_fs_status_value(s);
-    }
-    apply(completion, t, rv);
-}
-
 closure_function(6, 1, void, file_write_complete,
                  thread, t, file, f, sg_list, sg, u64, length, boolean, is_file_offset, io_completion, completion,
                  status, s)
@@ -580,6 +1298,17 @@ closure_function(2, 6, sysreturn, file_write,
     if (f->f.type == FDESC_TYPE_SPECIAL) {
         return spec_write(f, src, length, offset, t, bh, completion);
     }
+    if (f->f.flags & O_DIRECT) {
+        if (!file_direct_io_aligned(f, src, offset, length))
+            return io_complete(completion, t, -EINVAL);
+        if (length == 0)
+            return io_complete(completion, t, 0);
+        sysreturn rv;
+        if (!file_range_cached(f, offset, length) &&
+            file_direct_io(f, src, length, offset, is_file_offset, true, false, t, bh,
+                           completion, &rv))
+            return rv;
+    }
 
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
@@ -645,6 +1374,29 @@ closure_function(2, 6, sysreturn, file_sg_write,
     return io_complete(completion, t, rv);
 }
 
+/* Read or write on a buffer set up with fixed_buffer_prefault(). O_DIRECT
+   transfers go straight between storage and the buffer; everything else
+   (including buffered reads, which copy once out of the page cache) takes
+   the regular path. */
+sysreturn file_fixed_io(fdesc desc, boolean write, void *buf, u64 length, u64 offset_arg,
+                        thread t, boolean bh, io_completion completion)
+{
+    if ((desc->type == FDESC_TYPE_REGULAR) && (desc->flags & O_DIRECT)) {
+        file f = (file)desc;
+        boolean is_file_offset = offset_arg == infinity;
+        u64 offset = is_file_offset ? f->offset : offset_arg;
+        if ((length > 0) && (write || (offset < f->length)) &&
+            file_direct_io_aligned(f, buf, offset, length) &&
+            !file_range_cached(f, offset, length)) {
+            sysreturn rv;
+            file_direct_io(f, buf, length, offset, is_file_offset, write, true, t, bh,
+                           completion, &rv);
+            return rv;
+        }
+    }
+    return apply(write ? desc->write : desc->read, buf, length, offset_arg, t, bh, completion);
+}
+
 closure_function(2, 2, sysreturn, file_close,
                  file, f, fsfile, fsf,
                  thread, t, io_completion, completion)
@@ -657,6 +1409,10 @@ closure_function(2, 2, sysreturn, file_close,
     }
         
     if (ret == 0) {
+        inotify_file_event(f, (f->f.flags & O_ACCMODE) == O_RDONLY ?
+                           IN_CLOSE_NOWRITE : IN_CLOSE_WRITE);
+        if (f->f.type != FDESC_TYPE_REGULAR && f->dirents)
+            deallocate_vector(f->dirents);
         deallocate_closure(f->f.read);
         deallocate_closure(f->f.write);
         deallocate_closure(f->f.sg_read);
@@ -754,9 +1510,10 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
             n = filesystem_creat(fs, parent, filename_from_path(name));
             if (n) {
                 filesystem_update_mtime(fs, parent);
+                inotify_node_event(parent, n, IN_CREATE);
                 ret = 0;
             } else {
-                ret = -ENOMEM;
+                ret = filesystem_is_sealed(fs) ? -EROFS : -ENOMEM;
             }
         }
     }
@@ -783,6 +1540,8 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
 
     int type = file_type_from_tuple(n);
     if (type == FDESC_TYPE_REGULAR) {
+        if ((flags & O_ACCMODE) != O_RDONLY && filesystem_is_sealed(fs))
+            return -EROFS;
         fsf = fsfile_from_node(fs, n);
         assert(fsf);
         length = fsfile_get_length(fsf);
@@ -817,9 +1576,12 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
         f->fs_write = fsfile_get_writer(fsf);
         assert(f->fs_write);
         f->fadv = POSIX_FADV_NORMAL;
+        zero(&f->ra, sizeof(f->ra));
     } else {
         f->meta = n;
+        f->dirents = 0;
     }
+    f->parent = parent;
     f->length = length;
     f->offset = (flags & O_APPEND) ? length : 0;
 
@@ -834,6 +1596,7 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
         }
     }
 
+    inotify_file_event(f, IN_OPEN);
     thread_log(current, "   fd %d, length %ld, offset %ld", fd, f->length, f->offset);
     return fd;
 }
@@ -869,7 +1632,7 @@ sysreturn dup2(int oldfd, int newfd)
     if (newfd != oldfd) {
         fdesc newf = fdesc_get(current->p, newfd);
         if (newf) {
-            assert(vector_set(current->p->files, newfd, f));
+            replace_fd(current->p, newfd, f);
             if (fetch_and_add(&newf->refcnt, -2) == 2)
                 apply(newf->close, current, io_completion_ignore);
         } else {
@@ -910,6 +1673,7 @@ static sysreturn mkdir_internal(filesystem fs, tuple cwd, const char *pathname,
         return -ENAMETOOLONG;
     if (filesystem_mkdir(fs, parent, (char *)buffer_ref(b, 0))) {
         filesystem_update_mtime(fs, parent);
+        inotify_event(parent, sym_this((char *)buffer_ref(b, 0)), IN_CREATE | IN_ISDIR, 0);
         return 0;
     } else {
         return -ENOSPC;
@@ -957,71 +1721,68 @@ sysreturn creat(const char *pathname, int mode)
 
 sysreturn getrandom(void *buf, u64 buflen, unsigned int flags)
 {
-    heap h = heap_general(get_kernel_heaps());
-    buffer b;
+    if (flags & ~(GRND_NONBLOCK | GRND_RANDOM | GRND_INSECURE))
+        return set_syscall_error(current, EINVAL);
 
     if (!buflen)
-        return set_syscall_error(current, EINVAL);
+        return 0;
 
     if (!validate_user_memory(buf, buflen, true))
         return set_syscall_error(current, EFAULT);
 
-    if (flags & ~(GRND_NONBLOCK | GRND_RANDOM))
-        return set_syscall_error(current, EINVAL);
+    arc4rand(buf, buflen);
+    return buflen;
+}
 
-    b = wrap_buffer(h, buf, buflen);
-    return random_buffer(b);
+/* Directory entries are read from a snapshot of the names in the
+   directory, taken when it is read from offset 0 (on open and after a
+   rewind), so that each call costs only the entries it returns. The file
+   offset is the index of the next name in the snapshot. Entries removed
+   since are skipped, while those created since appear after a rewind, as
+   POSIX permits. */
+closure_function(1, 2, boolean, dir_snapshot_each,
+                 vector, names,
+                 value, k, value, v)
+{
+    assert(is_symbol(k));
+    vector_push(bound(names), k);
+    return true;
 }
 
-static int try_write_dirent(tuple root, struct linux_dirent *dirp, char *p,
-        int *read_sofar, int *written_sofar, u64 *f_offset,
-        unsigned int *count, int ft)
+static vector dir_snapshot(file f, tuple c)
 {
-    int len = runtime_strlen(p);
-    *read_sofar += len;
-    if (*read_sofar > *f_offset) {
-        int reclen = sizeof(struct linux_dirent) + len + 3;
-        // include this element in the getdents output
-        if (reclen > *count) {
-            // can't include, there's no space
-            *read_sofar -= len;
-            return -1;
-        } else {
-            tuple n;
-            resolve_cstring(0, root, p, &n, 0);
-            // include the entry in the buffer
-            runtime_memset((u8*)dirp, 0, reclen);
-            dirp->d_ino = u64_from_pointer(n);
-            dirp->d_reclen = reclen;
-            runtime_memcpy(dirp->d_name, p, len + 1);
-            dirp->d_off = dirp->d_reclen; // XXX: in the future, pad this.
-            dirp->d_name[len + 2] = 0; /* some zero padding */
-            ((char *)dirp)[dirp->d_reclen - 1] = ft;
-
-            // advance dirp
-            *written_sofar += reclen;
-            *count -= reclen;
-            return reclen;
+    if (f->dirents && f->offset != 0)
+        return f->dirents;
+    if (f->dirents) {
+        vector_clear(f->dirents);
+    } else {
+        f->dirents = allocate_vector(heap_general(get_kernel_heaps()), 64);
+        if (f->dirents == INVALID_ADDRESS) {
+            f->dirents = 0;
+            return INVALID_ADDRESS;
         }
     }
-    return 0;
+    iterate(c, stack_closure(dir_snapshot_each, f->dirents));
+    return f->dirents;
 }
 
-closure_function(6, 2, boolean, getdents_each,
-                 file, f, struct linux_dirent **, dirp, int *, read_sofar, int *, written_sofar, unsigned int *, count, int *, r,
-                 value, k, value, v)
+static int write_dirent(tuple root, struct linux_dirent *dirp, char *p, u64 next,
+                        unsigned int count, int ft)
 {
-    assert(is_symbol(k));
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    char *p = cstring(symbol_string(k), tmpbuf);
-    *bound(r) = try_write_dirent(file_get_meta(bound(f)), *bound(dirp), p,
-                                 bound(read_sofar), bound(written_sofar), &bound(f)->offset, bound(count),
-                                 dt_from_tuple(v));
-    if (*bound(r) < 0)
-        return false;
-
-    *bound(dirp) = (struct linux_dirent *)(((char *)*bound(dirp)) + *bound(r));
-    return true;
+    int len = runtime_strlen(p);
+    int reclen = sizeof(struct linux_dirent) + len + 3;
+    if (reclen > count)
+        return -1;
+    tuple n;
+    resolve_cstring(0, root, p, &n, 0);
+    runtime_memset((u8*)dirp, 0, reclen);
+    dirp->d_ino = u64_from_pointer(n);
+    dirp->d_reclen = reclen;
+    runtime_memcpy(dirp->d_name, p, len + 1);
+    dirp->d_off = next;
+    dirp->d_name[len + 2] = 0; /* some zero padding */
+    ((char *)dirp)[dirp->d_reclen - 1] = ft;
+    return reclen;
 }
 
 sysreturn getdents(int fd, struct linux_dirent *dirp, unsigned int count)
@@ -1032,67 +1793,49 @@ sysreturn getdents(int fd, struct linux_dirent *dirp, unsigned int count)
     tuple c = children(file_get_meta(f));
     if (!c)
         return -ENOTDIR;
+    vector names = dir_snapshot(f, c);
+    if (names == INVALID_ADDRESS)
+        return -ENOMEM;
 
-    int r = 0;
-    int read_sofar = 0, written_sofar = 0;
-    iterate(c, stack_closure(getdents_each, f, &dirp, &read_sofar, &written_sofar, &count, &r));
+    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
+    int r = 0, written_sofar = 0;
+    for (; f->offset < vector_length(names); f->offset++) {
+        symbol k = vector_get(names, f->offset);
+        value v = get(c, k);
+        if (!v)
+            continue;
+        r = write_dirent(file_get_meta(f), dirp, cstring(symbol_string(k), tmpbuf),
+                         f->offset + 1, count, dt_from_tuple(v));
+        if (r < 0)
+            break;
+        dirp = (struct linux_dirent *)(((char *)dirp) + r);
+        written_sofar += r;
+        count -= r;
+    }
     filesystem_update_atime(f->fs, file_get_meta(f));
-    f->offset = read_sofar;
     if (r < 0 && written_sofar == 0)
         return -EINVAL;
 
     return written_sofar;
 }
 
-static int try_write_dirent64(tuple root, struct linux_dirent64 *dirp, char *p,
-        int *read_sofar, int *written_sofar, u64 *f_offset,
-        unsigned int *count, int ft)
+static int write_dirent64(tuple root, struct linux_dirent64 *dirp, char *p, u64 next,
+                          unsigned int count, int ft)
 {
     int len = runtime_strlen(p);
-    *read_sofar += len;
-    if (*read_sofar > *f_offset) {
-        int reclen = sizeof(struct linux_dirent64) + len + 3;
-        // include this element in the getdents output
-        if (reclen > *count) {
-            // can't include, there's no space
-            *read_sofar -= len;
-            return -1;
-        } else {
-            tuple n;
-            resolve_cstring(0, root, p, &n, 0);
-            // include the entry in the buffer
-            runtime_memset((u8*)dirp, 0, reclen);
-            dirp->d_ino = u64_from_pointer(n);
-            dirp->d_reclen = reclen;
-            runtime_memcpy(dirp->d_name, p, len + 1);
-            dirp->d_off = dirp->d_reclen; // XXX: in the future, pad this.
-            dirp->d_name[len + 2] = 0; /* some zero padding */
-            dirp->d_type = ft;
-
-            // advance dirp
-            *written_sofar += reclen;
-            *count -= reclen;
-            return reclen;
-        }
-    }
-    return 0;
-}
-
-closure_function(6, 2, boolean, getdents64_each,
-                 file, f, struct linux_dirent64 **, dirp, int *, read_sofar, int *, written_sofar, unsigned int *, count, int *, r,
-                 value, k, value, v)
-{
-    assert(is_symbol(k));
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    char *p = cstring(symbol_string(k), tmpbuf);
-    *bound(r) = try_write_dirent64(file_get_meta(bound(f)), *bound(dirp), p,
-                                   bound(read_sofar), bound(written_sofar), &bound(f)->offset, bound(count),
-                                   dt_from_tuple(v));
-    if (*bound(r) < 0)
-        return false;
-
-    *bound(dirp) = (struct linux_dirent64 *)(((char *)*bound(dirp)) + *bound(r));
-    return true;
+    int reclen = sizeof(struct linux_dirent64) + len + 3;
+    if (reclen > count)
+        return -1;
+    tuple n;
+    resolve_cstring(0, root, p, &n, 0);
+    runtime_memset((u8*)dirp, 0, reclen);
+    dirp->d_ino = u64_from_pointer(n);
+    dirp->d_reclen = reclen;
+    runtime_memcpy(dirp->d_name, p, len + 1);
+    dirp->d_off = next;
+    dirp->d_name[len + 2] = 0; /* some zero padding */
+    dirp->d_type = ft;
+    return reclen;
 }
 
 sysreturn getdents64(int fd, struct linux_dirent64 *dirp, unsigned int count)
@@ -1103,12 +1846,26 @@ sysreturn getdents64(int fd, struct linux_dirent64 *dirp, unsigned int count)
     tuple c = children(file_get_meta(f));
     if (!c)
         return -ENOTDIR;
+    vector names = dir_snapshot(f, c);
+    if (names == INVALID_ADDRESS)
+        return -ENOMEM;
 
-    int r = 0;
-    int read_sofar = 0, written_sofar = 0;
-    iterate(c, stack_closure(getdents64_each, f, &dirp, &read_sofar, &written_sofar, &count, &r));
+    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
+    int r = 0, written_sofar = 0;
+    for (; f->offset < vector_length(names); f->offset++) {
+        symbol k = vector_get(names, f->offset);
+        value v = get(c, k);
+        if (!v)
+            continue;
+        r = write_dirent64(file_get_meta(f), dirp, cstring(symbol_string(k), tmpbuf),
+                           f->offset + 1, count, dt_from_tuple(v));
+        if (r < 0)
+            break;
+        dirp = (struct linux_dirent64 *)(((char *)dirp) + r);
+        written_sofar += r;
+        count -= r;
+    }
     filesystem_update_atime(f->fs, file_get_meta(f));
-    f->offset = read_sofar;
     if (r < 0 && written_sofar == 0)
         return -EINVAL;
 
@@ -1163,9 +1920,13 @@ static sysreturn truncate_internal(filesystem fs, file f, tuple t, long length)
         return 0;
     fs_status s = filesystem_truncate(fs, fsf, length);
     if (s == FS_STATUS_OK) {
-        truncate_file_maps(current->p, fsf, length);
-        if (f)
+        truncate_file_maps(current->p, fsfile_get_cachenode(fsf), length);
+        if (f) {
             f->length = length;
+            inotify_file_event(f, IN_MODIFY);
+        } else {
+            inotify_node_event(0, t, IN_MODIFY);
+        }
         filesystem_update_mtime(fs, t);
     }
     return sysreturn_from_fs_status(s);
@@ -1191,10 +1952,12 @@ sysreturn ftruncate(int fd, long length)
 {
     thread_log(current, "%s %d %d", __func__, fd, length);
     file f = resolve_fd(current->p, fd);
-    if (!(f->f.flags & (O_RDWR | O_WRONLY)) ||
-            (f->f.type != FDESC_TYPE_REGULAR)) {
+    if (!(f->f.flags & (O_RDWR | O_WRONLY)))
+        return set_syscall_error(current, EINVAL);
+    if (f->f.type == FDESC_TYPE_MEMFD)
+        return memfd_truncate(&f->f, length);
+    if (f->f.type != FDESC_TYPE_REGULAR)
         return set_syscall_error(current, EINVAL);
-    }
     return truncate_internal(f->fs, f, file_get_meta(f), length);
 }
 
@@ -1226,25 +1989,44 @@ sysreturn syncfs(int fd)
     return sync();
 }
 
-sysreturn fsync(int fd)
+closure_function(2, 1, void, fsync_complete,
+                 thread, t, io_completion, completion,
+                 status, s)
+{
+    thread t = bound(t);
+    thread_log(t, "%s: status %v", __func__, s);
+    apply(bound(completion), t, is_ok(s) ? 0 : -EIO);
+    closure_finish();
+}
+
+sysreturn fsync_internal(fdesc f, thread t, io_completion completion)
 {
-    fdesc f = resolve_fd(current->p, fd);
     switch (f->type) {
-    case FDESC_TYPE_REGULAR:
+    case FDESC_TYPE_REGULAR: {
         assert(((file)f)->fsf);
+        status_handler sh = closure(heap_general(get_kernel_heaps()),
+                                    fsync_complete, t, completion);
+        if (sh == INVALID_ADDRESS)
+            return io_complete(completion, t, -ENOMEM);
         filesystem_sync_node(((file)f)->fs,
-                             fsfile_get_cachenode(((file)f)->fsf),
-                             closure(heap_general(get_kernel_heaps()),
-                                 sync_complete, current));
-        return thread_maybe_sleep_uninterruptible(current);
+                             fsfile_get_cachenode(((file)f)->fsf), sh);
+        return 0;
+    }
     case FDESC_TYPE_DIRECTORY:
     case FDESC_TYPE_SYMLINK:
-        return 0;
+        return io_complete(completion, t, 0);
     default:
-        return -EINVAL;
+        return io_complete(completion, t, -EINVAL);
     }
 }
 
+sysreturn fsync(int fd)
+{
+    fdesc f = resolve_fd(current->p, fd);
+    fsync_internal(f, current, syscall_io_complete);
+    return thread_maybe_sleep_uninterruptible(current);
+}
+
 sysreturn fdatasync(int fd)
 {
     return fsync(fd);
@@ -1334,6 +2116,9 @@ static void fill_stat(int type, filesystem fs, tuple n, struct stat *s)
     case FDESC_TYPE_SYMLINK:
         s->st_mode = S_IFLNK;
         break;
+    case FDESC_TYPE_MEMFD:
+        s->st_mode = S_IFREG | 0777;
+        break;
     }
     s->st_ino = u64_from_pointer(n);
     if (type == FDESC_TYPE_REGULAR) {
@@ -1357,12 +2142,8 @@ static void fill_stat(int type, filesystem fs, tuple n, struct stat *s)
             s->st_ino, s->st_mode, s->st_size);
 }
 
-static sysreturn fstat(int fd, struct stat *s)
+static void fstat_internal(fdesc f, struct stat *s)
 {
-    thread_log(current, "fd %d, stat %p", fd, s);
-    if (!validate_user_memory(s, sizeof(struct stat), true))
-        return -EFAULT;
-    fdesc f = resolve_fd(current->p, fd);
     filesystem fs;
     tuple n;
     switch (f->type) {
@@ -1379,32 +2160,52 @@ static sysreturn fstat(int fd, struct stat *s)
         break;
     }
     fill_stat(f->type, fs, n, s);
+    if (f->type == FDESC_TYPE_MEMFD) {
+        s->st_ino = u64_from_pointer(f);
+        s->st_size = ((file)f)->length;
+        s->st_blocks = pad(s->st_size, PAGESIZE) >> SECTOR_OFFSET;
+        s->st_blksize = PAGESIZE;
+    }
+}
+
+static sysreturn fstat(int fd, struct stat *s)
+{
+    thread_log(current, "fd %d, stat %p", fd, s);
+    if (!validate_user_memory(s, sizeof(struct stat), true))
+        return -EFAULT;
+    fdesc f = resolve_fd(current->p, fd);
+    fstat_internal(f, s);
     return 0;
 }
 
-static sysreturn stat_internal(filesystem fs, tuple cwd, const char *name, boolean follow,
+static int stat_lookup(filesystem fs, tuple cwd, const char *name, boolean follow,
         struct stat *buf)
 {
     tuple n;
     int ret;
 
-    if (!validate_user_string(name) ||
-        !validate_user_memory(buf, sizeof(struct stat), true))
-        return -EFAULT;
-
     if (!follow) {
         ret = resolve_cstring(&fs, cwd, name, &n, 0);
     } else {
         ret = resolve_cstring_follow(&fs, cwd, name, &n, 0);
     }
-    if (ret) {
-        return set_syscall_return(current, ret);
-    }
+    if (ret)
+        return ret;
 
     fill_stat(file_type_from_tuple(n), fs, n, buf);
     return 0;
 }
 
+static sysreturn stat_internal(filesystem fs, tuple cwd, const char *name, boolean follow,
+        struct stat *buf)
+{
+    if (!validate_user_string(name) ||
+        !validate_user_memory(buf, sizeof(struct stat), true))
+        return -EFAULT;
+
+    return set_syscall_return(current, stat_lookup(fs, cwd, name, follow, buf));
+}
+
 #ifdef __x86_64__
 static sysreturn stat(const char *name, struct stat *buf)
 {
@@ -1435,6 +2236,42 @@ static sysreturn newfstatat(int dfd, const char *name, struct stat *s, int flags
     return stat_internal(fs, n, name, !(flags & AT_SYMLINK_NOFOLLOW), s);
 }
 
+/* Only the basic stats that stat() provides are reported. */
+sysreturn statx_internal(int dirfd, const char *name, int flags, struct statx *buf)
+{
+    struct stat st;
+    if (!validate_user_string(name) ||
+        !validate_user_memory(buf, sizeof(struct statx), true))
+        return -EFAULT;
+    if (flags & AT_EMPTY_PATH) {
+        fdesc f = resolve_fd(current->p, dirfd);
+        fstat_internal(f, &st);
+    } else {
+        filesystem fs;
+        tuple n = resolve_dir(fs, dirfd, name);
+        int ret = stat_lookup(fs, n, name, !(flags & AT_SYMLINK_NOFOLLOW), &st);
+        if (ret)
+            return ret;
+    }
+    zero(buf, sizeof(struct statx));
+    buf->stx_mask = STATX_BASIC_STATS;
+    buf->stx_blksize = st.st_blksize;
+    buf->stx_nlink = st.st_nlink;
+    buf->stx_uid = st.st_uid;
+    buf->stx_gid = st.st_gid;
+    buf->stx_mode = st.st_mode;
+    buf->stx_ino = st.st_ino;
+    buf->stx_size = st.st_size;
+    buf->stx_blocks = st.st_blocks;
+    buf->stx_atime.tv_sec = st.st_atime;
+    buf->stx_atime.tv_nsec = st.st_atime_nsec;
+    buf->stx_mtime.tv_sec = st.st_mtime;
+    buf->stx_mtime.tv_nsec = st.st_mtime_nsec;
+    buf->stx_ctime.tv_sec = st.st_ctime;
+    buf->stx_ctime.tv_nsec = st.st_ctime_nsec;
+    return 0;
+}
+
 sysreturn lseek(int fd, s64 offset, int whence)
 {
     thread_log(current, "%s: fd %d offset %ld whence %s",
@@ -1580,32 +2417,53 @@ static sysreturn getcwd(char *buf, u64 length)
     return cwd_len;
 }
 
+static boolean brk_map(u64 start, u64 end)
+{
+    /* XXX no exec configurable? */
+    pageflags flags = pageflags_writable(pageflags_noexec(pageflags_user(pageflags_memory())));
+    u64 len;
+    for (u64 v = start; v < end; v += len) {
+        len = MIN(end, (v & ~PAGEMASK_2M) + PAGESIZE_2M) - v;
+        if (len == PAGESIZE_2M && map_anonymous_huge_page(v, current->p->heap_map, flags))
+            continue;
+        u64 phys = allocate_u64(heap_physical_local(), len);
+        if (phys == INVALID_PHYSICAL) {
+            unmap_and_free_phys(start, v - start);
+            return false;
+        }
+        // people shouldn't depend on this
+        map_and_zero(v, phys, len, flags);
+    }
+    return true;
+}
+
 static sysreturn brk(void *x)
 {
     process p = current->p;
-    kernel_heaps kh = get_kernel_heaps();
 
     if (x) {
         if (p->brk > x) {
             /* on failure, return the current break */
             if (u64_from_pointer(x) < p->heap_base)
                 goto fail;
+            range r = irange(pad(u64_from_pointer(x), PAGESIZE),
+                             pad(u64_from_pointer(p->brk), PAGESIZE));
             p->brk = x;
             assert(adjust_process_heap(p, irange(p->heap_base, u64_from_pointer(x))));
-            // free
+            if (range_span(r)) {
+                split_huge_mappings(r);
+                unmap_and_free_user_phys(r.start, range_span(r));
+            }
         } else if (p->brk < x) {
             // I guess assuming we're aligned
-            u64 alloc = pad(u64_from_pointer(x), PAGESIZE) - pad(u64_from_pointer(p->brk), PAGESIZE);
+            u64 start = pad(u64_from_pointer(p->brk), PAGESIZE);
+            u64 alloc = pad(u64_from_pointer(x), PAGESIZE) - start;
             assert(adjust_process_heap(p, irange(p->heap_base, u64_from_pointer(p->brk) + alloc)));
-            u64 phys = allocate_u64((heap)heap_physical(kh), alloc);
-            if (phys == INVALID_PHYSICAL)
+            if (!brk_map(start, start + alloc)) {
+                assert(adjust_process_heap(p, irange(p->heap_base, u64_from_pointer(p->brk))));
                 goto fail;
-            /* XXX no exec configurable? */
-            pageflags flags = pageflags_writable(pageflags_noexec(pageflags_user(pageflags_memory())));
-            map(u64_from_pointer(p->brk), phys, alloc, flags);
-            // people shouldn't depend on this
-            zero(p->brk, alloc);
-            p->brk += alloc;         
+            }
+            p->brk += alloc;
         }
     }
   fail:
@@ -1662,10 +2520,13 @@ static sysreturn unlink_internal(filesystem fs, tuple cwd, const char *pathname)
     if (is_dir(n)) {
         return set_syscall_error(current, EISDIR);
     }
-    fs_status s = filesystem_delete(fs, parent,
-        lookup_sym(parent, n));
-    if (s == FS_STATUS_OK)
+    symbol name = lookup_sym(parent, n);
+    fs_status s = filesystem_delete(fs, parent, name);
+    if (s == FS_STATUS_OK) {
         filesystem_update_mtime(fs, parent);
+        inotify_event(parent, name, IN_DELETE, 0);
+        inotify_node_deleted(n);
+    }
     return sysreturn_from_fs_status(s);
 }
 
@@ -1702,10 +2563,13 @@ static sysreturn rmdir_internal(filesystem fs, tuple cwd, const char *pathname)
     if (notempty)
         return set_syscall_error(current, ENOTEMPTY);
 
-    fs_status s = filesystem_delete(fs, parent,
-        lookup_sym(parent, n));
-    if (s == FS_STATUS_OK)
+    symbol name = lookup_sym(parent, n);
+    fs_status s = filesystem_delete(fs, parent, name);
+    if (s == FS_STATUS_OK) {
         filesystem_update_mtime(fs, parent);
+        inotify_event(parent, name, IN_DELETE | IN_ISDIR, 0);
+        inotify_node_deleted(n);
+    }
     return sysreturn_from_fs_status(s);
 }
 
@@ -1785,11 +2649,13 @@ static sysreturn rename_internal(filesystem oldfs, tuple oldwd,
     }
     if ((newparent == oldparent) && (new == old))
         return 0;
-    fs_status s = filesystem_rename(oldfs, oldparent,
-        lookup_sym(oldparent, old), newparent, filename_from_path(newpath));
+    symbol oldname = lookup_sym(oldparent, old);
+    fs_status s = filesystem_rename(oldfs, oldparent, oldname, newparent,
+                                    filename_from_path(newpath));
     if (s == FS_STATUS_OK) {
         filesystem_update_mtime(oldfs, oldparent);
         filesystem_update_mtime(newfs, newparent);
+        inotify_rename(oldparent, oldname, newparent, old, ret ? 0 : new);
     }
     return sysreturn_from_fs_status(s);
 }
@@ -1850,11 +2716,14 @@ sysreturn renameat2(int olddirfd, const char *oldpath, int newdirfd,
             return -EXDEV;
         if ((newparent == oldparent) && (new == old))
             return 0;
-        fs_status s = filesystem_exchange(oldfs, oldparent,
-            lookup_sym(oldparent, old), newparent, lookup_sym(newparent, new));
+        symbol oldname = lookup_sym(oldparent, old);
+        symbol newname = lookup_sym(newparent, new);
+        fs_status s = filesystem_exchange(oldfs, oldparent, oldname, newparent, newname);
         if (s == FS_STATUS_OK) {
             filesystem_update_mtime(oldfs, oldparent);
             filesystem_update_mtime(newfs, newparent);
+            inotify_rename(oldparent, oldname, newparent, old, 0);
+            inotify_rename(newparent, newname, oldparent, new, 0);
         }
         return sysreturn_from_fs_status(s);
     }
@@ -1939,6 +2808,18 @@ sysreturn fcntl(int fd, int cmd, s64 arg)
         } else {
             return -EINVAL;
         }
+    case F_ADD_SEALS:
+        if (f->type == FDESC_TYPE_MEMFD) {
+            return memfd_add_seals(f, (u32)arg);
+        } else {
+            return -EINVAL;
+        }
+    case F_GET_SEALS:
+        if (f->type == FDESC_TYPE_MEMFD) {
+            return memfd_get_seals(f);
+        } else {
+            return -EINVAL;
+        }
     default:
         return set_syscall_error(current, ENOSYS);
     }
@@ -1962,6 +2843,8 @@ sysreturn ioctl_generic(fdesc f, unsigned long request, vlist ap)
     case FIONCLEX:
     case FIOCLEX:
         return 0;
+    case FICLONE:
+        return file_clone(f, varg(ap, int));
     default:
         return -ENOSYS;
     }
@@ -2042,14 +2925,28 @@ sysreturn eventfd2(unsigned int count, int flags)
     return do_eventfd2(count, flags);
 }
 
+/* These run without the kernel lock, so the target is reserved while still
+   in the thread tree; exit_thread removes it from there before dropping its
+   own reference. The caller releases it with thread_release(). */
 static thread lookup_thread(int pid)
 {
     thread t;
-    if (pid== 0) {
+    if (pid == 0) {
         t = current;
+        thread_reserve(t);
     } else {
-        if ((t = thread_from_tid(current->p, pid)) == INVALID_ADDRESS)
-            return 0;
+        process p = current->p;
+        struct thread tk;
+        tk.tid = pid;
+        spin_lock(&p->threads_lock);
+        rbnode n = rbtree_lookup(p->threads, &tk.n);
+        if (n != INVALID_ADDRESS) {
+            t = struct_from_field(n, thread, n);
+            thread_reserve(t);
+        } else {
+            t = 0;
+        }
+        spin_unlock(&p->threads_lock);
     }
     return t;
 }
@@ -2058,11 +2955,22 @@ sysreturn sched_setaffinity(int pid, u64 cpusetsize, cpu_set_t *mask)
 {
     if (!validate_user_memory(mask, sizeof(mask->mask[0]), false))
         return set_syscall_error(current, EFAULT);
+    if (!mask || cpusetsize < sizeof(mask->mask[0]))
+        return set_syscall_error(current, EINVAL);
+    u64 affinity = mask->mask[0] & MASK(total_processors);
+    if (!affinity)
+        return set_syscall_error(current, EINVAL);
     thread t;
-    if (!(t = lookup_thread(pid)) ||
-        (!mask || cpusetsize < sizeof(mask->mask[0])))
-            return set_syscall_error(current, EINVAL);                
-    runtime_memcpy(&t->affinity, mask, sizeof(mask->mask[0]));
+    if (!(t = lookup_thread(pid)))
+        return set_syscall_error(current, EINVAL);
+    t->thrd.affinity = affinity;
+    boolean self = t == current;
+    thread_release(t);
+
+    /* move off a cpu that is no longer permitted; the scheduler picks the
+       new one and any queued frames of t are redirected on dequeue */
+    if (self && !(affinity & U64_FROM_BIT(current_cpu()->id)))
+        thread_yield();         /* noreturn */
     return 0;
 }
 
@@ -2070,14 +2978,91 @@ sysreturn sched_getaffinity(int pid, u64 cpusetsize, cpu_set_t *mask)
 {
     if (!validate_user_memory(mask, sizeof(mask->mask[0]), true))
         return set_syscall_error(current, EFAULT);
+    if (!mask || cpusetsize < sizeof(mask->mask[0]))
+        return set_syscall_error(current, EINVAL);
     thread t;
-    if (!(t = lookup_thread(pid)) ||
-        (!mask || cpusetsize < sizeof(mask->mask[0])))
-            return set_syscall_error(current, EINVAL);                    
-    runtime_memcpy(mask, &t->affinity, sizeof(mask->mask[0]));        
+    if (!(t = lookup_thread(pid)))
+        return set_syscall_error(current, EINVAL);
+    mask->mask[0] = t->thrd.affinity & MASK(total_processors);
+    thread_release(t);
     return sizeof(mask->mask[0]);
 }
 
+/* There is only one process, so every other cpu running a user thread is
+   running a thread of the caller. An expedited membarrier sends an IPI to
+   each such cpu and waits until it has taken the interrupt, whose entry and
+   return order its memory accesses and serialize its instruction stream, or
+   has otherwise left user mode, which does the same. */
+static u64 membarrier_vector;
+static u64 membarrier_pending;
+
+closure_function(0, 0, void, membarrier_ipi)
+{
+    memory_barrier();
+    atomic_clear_bit(&membarrier_pending, current_cpu()->id);
+}
+
+static void membarrier_expedited(void)
+{
+    u64 self = current_cpu()->id;
+    u64 targets = 0;
+    memory_barrier();
+    for (int i = 0; i < total_processors; i++) {
+        if (i == self || cpuinfo_from_id(i)->state != cpu_user)
+            continue;
+        atomic_set_bit(&membarrier_pending, i);
+        targets |= U64_FROM_BIT(i);
+    }
+    send_ipi_mask(targets, membarrier_vector);
+    while (targets) {
+        u64 i = lsb(targets);
+        if (!(membarrier_pending & U64_FROM_BIT(i)) || cpuinfo_from_id(i)->state != cpu_user)
+            targets &= ~U64_FROM_BIT(i);
+        else
+            kern_pause();
+    }
+    memory_barrier();
+}
+
+#define MEMBARRIER_SUPPORTED (MEMBARRIER_CMD_GLOBAL | MEMBARRIER_CMD_GLOBAL_EXPEDITED |     \
+                              MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED |                    \
+                              MEMBARRIER_CMD_PRIVATE_EXPEDITED |                            \
+                              MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED |                   \
+                              MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE |                  \
+                              MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE)
+
+sysreturn membarrier(int cmd, unsigned int flags, int cpu_id)
+{
+    process p = current->p;
+    if (flags)
+        return -EINVAL;
+    switch (cmd) {
+    case MEMBARRIER_CMD_QUERY:
+        return MEMBARRIER_SUPPORTED;
+    case MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED:
+    case MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED:
+    case MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE:
+        /* each registration command is one bit above its command */
+        atomic_set_bit(&p->membarrier_registered, msb(cmd) - 1);
+        return 0;
+    case MEMBARRIER_CMD_PRIVATE_EXPEDITED:
+    case MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE:
+        if (!(p->membarrier_registered & cmd))
+            return -EPERM;
+        /* fall through */
+    case MEMBARRIER_CMD_GLOBAL:
+        membarrier_expedited();
+        return 0;
+    case MEMBARRIER_CMD_GLOBAL_EXPEDITED:
+        /* only registered processes are targeted, and there is just this one */
+        if (p->membarrier_registered & MEMBARRIER_CMD_GLOBAL_EXPEDITED)
+            membarrier_expedited();
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
 sysreturn capget(cap_user_header_t hdrp, cap_user_data_t datap)
 {
     if (datap) {
@@ -2105,6 +3090,11 @@ sysreturn prctl(int option, u64 arg2, u64 arg3, u64 arg4, u64 arg5)
             return -EFAULT;
         runtime_memcpy((void *) arg2, current->name, sizeof(current->name));
         break;
+    case PR_SET_TIMERSLACK:
+        current->timer_slack_ns = arg2 ? arg2 : THREAD_TIMER_SLACK_DEFAULT_NS;
+        break;
+    case PR_GET_TIMERSLACK:
+        return current->timer_slack_ns;
     }
 
     return 0;
@@ -2139,9 +3129,8 @@ sysreturn getcpu(unsigned int *cpu, unsigned int *node, void *tcache)
         return -EFAULT;
     if (cpu)
         *cpu = ci->id;
-    /* XXX to do */
     if (node)
-        *node = 0;
+        *node = ci->node;
     return 0;
 }
 
@@ -2165,6 +3154,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, mkdir, mkdir);
     register_syscall(map, pipe, pipe);
     register_syscall(map, eventfd, eventfd);
+    register_syscall(map, inotify_init, inotify_init);
     register_syscall(map, creat, creat);
     register_syscall(map, utime, utime);
     register_syscall(map, utimes, utimes);
@@ -2177,11 +3167,16 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, fallocate, fallocate);
     register_syscall(map, faccessat, faccessat);
     register_syscall(map, fadvise64, fadvise64);
+    register_syscall(map, readahead, readahead);
     register_syscall(map, fstat, fstat);
     register_syscall(map, newfstatat, newfstatat);
     register_syscall(map, readv, readv);
     register_syscall(map, writev, writev);
     register_syscall(map, sendfile, sendfile);
+    register_syscall(map, copy_file_range, copy_file_range);
+    register_syscall(map, splice, splice);
+    register_syscall(map, tee, tee);
+    register_syscall(map, vmsplice, vmsplice);
     register_syscall(map, truncate, truncate);
     register_syscall(map, ftruncate, ftruncate);
     register_syscall(map, fdatasync, fdatasync);
@@ -2202,14 +3197,14 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, renameat, renameat);
     register_syscall(map, renameat2, renameat2);
     register_syscall(map, close, close);
-    register_syscall(map, sched_yield, sched_yield);
+    register_syscall_nolock(map, sched_yield, sched_yield);
     register_syscall(map, brk, brk);
-    register_syscall(map, uname, uname);
+    register_syscall_nolock(map, uname, uname);
     register_syscall(map, getrlimit, getrlimit);
     register_syscall(map, setrlimit, setrlimit);
     register_syscall(map, prlimit64, prlimit64);
-    register_syscall(map, getrusage, getrusage);
-    register_syscall(map, getpid, getpid);
+    register_syscall_direct(map, getrusage, getrusage);
+    register_syscall_direct(map, getpid, getpid);
     register_syscall(map, exit_group, exit_group);
     register_syscall(map, exit, (sysreturn (*)())exit);
     register_syscall(map, getdents64, getdents64);
@@ -2218,12 +3213,17 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, pipe2, pipe2);
     register_syscall(map, socketpair, socketpair);
     register_syscall(map, eventfd2, eventfd2);
+    register_syscall(map, memfd_create, memfd_create);
+    register_syscall(map, inotify_init1, inotify_init1);
+    register_syscall(map, inotify_add_watch, inotify_add_watch);
+    register_syscall(map, inotify_rm_watch, inotify_rm_watch);
     register_syscall(map, chdir, chdir);
     register_syscall(map, fchdir, fchdir);
-    register_syscall(map, sched_getaffinity, sched_getaffinity);
-    register_syscall(map, sched_setaffinity, sched_setaffinity);
-    register_syscall(map, getuid, syscall_ignore);
-    register_syscall(map, geteuid, syscall_ignore);
+    register_syscall_nolock(map, sched_getaffinity, sched_getaffinity);
+    register_syscall_nolock(map, sched_setaffinity, sched_setaffinity);
+    register_syscall_nolock(map, membarrier, membarrier);
+    register_syscall_nolock(map, getuid, syscall_ignore);
+    register_syscall_nolock(map, geteuid, syscall_ignore);
     register_syscall(map, setgroups, syscall_ignore);
     register_syscall(map, setuid, syscall_ignore);
     register_syscall(map, setgid, syscall_ignore);
@@ -2237,11 +3237,9 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, io_uring_setup, io_uring_setup);
     register_syscall(map, io_uring_enter, io_uring_enter);
     register_syscall(map, io_uring_register, io_uring_register);
-    register_syscall(map, getcpu, getcpu);
+    register_syscall_direct(map, getcpu, getcpu);
 }
 
-#define SYSCALL_F_NOTRACE 0x1
-
 struct syscall {
     void *handler;
     const char *name;
@@ -2267,7 +3265,39 @@ void count_syscall(thread t, sysreturn rv)
         us = t->syscall_time;
     fetch_and_add(&ss->usecs, us);
     t->syscall_time = 0;
+    if (!hists && !hist_all)
+        return;
+    u64 cycles = rdtsc();
+    u64 total = cycles - t->syscall_start_cycles;
+    if (hist_all)
+        log2_hist_record_atomic(hist_all, total);
+    if (hists && t->tid >= hist_tid_min && t->tid <= hist_tid_max) {
+        syscall_hist sh = &hists[ss - stats];
+        u64 run = t->syscall_run_cycles;
+        if (t->syscall_enter_ts)
+            run += cycles - t->syscall_enter_cycles;
+        log2_hist_record_atomic(sh->total, total);
+        log2_hist_record_atomic(sh->blocked, total > run ? total - run : 0);
+    }
+}
+
+/* Returns the log2(cycles) histogram of all syscall latencies, with its
+   number of buckets in *nbuckets, and starts collecting it on first use. */
+u64 *syscall_latency_hist(int *nbuckets)
+{
+    if (!hist_all) {
+        u64 *h = allocate_zero(heap_general(get_kernel_heaps()),
+                               LOG2_HIST_BUCKETS * sizeof(u64));
+        if (h == INVALID_ADDRESS)
+            return 0;
+        hist_all = h;
+        write_barrier();
+        do_syscall_stats = true;
+    }
+    *nbuckets = LOG2_HIST_BUCKETS;
+    return hist_all;
 }
+KLIB_EXPORT(syscall_latency_hist);
 
 static boolean debugsyscalls;
 
@@ -2291,6 +3321,8 @@ void syscall_debug(context f)
         assert(t->last_syscall == -1);
         t->last_syscall = call;
         t->syscall_enter_ts = now(CLOCK_ID_MONOTONIC_RAW);
+        t->syscall_start_cycles = t->syscall_enter_cycles = rdtsc();
+        t->syscall_run_cycles = 0;
     }
     struct syscall *s = t->p->syscalls + call;
     if (debugsyscalls) {
@@ -2398,6 +3430,8 @@ closure_function(0, 2, void, print_syscall_stats_cfn,
 
     if (status != 0)
         return;
+    if (!syscall_summary)
+        goto hist;
     rprintf("\n" HDR_FMT SEPARATOR, "% time", "seconds", "usecs/call", "calls", "errors", "syscall");
     for (int i = 0; i < SYS_MAX; i++) {
         ss = &stats[i];
@@ -2413,21 +3447,108 @@ closure_function(0, 2, void, print_syscall_stats_cfn,
             ROUNDED_IDIV(ss->usecs, ss->calls), ss->calls, ss->errors, _linux_syscalls[ss - stats].name);
     }
     rprintf(SEPARATOR SUM_FMT, "100.00", print_usecs(tbuf, tot_usecs), 0, tot_calls, tot_errs, "total");
+  hist:
     deallocate_pqueue(pq);
+    if (!hists)
+        return;
+    buffer b = little_stack_buffer(512);
+    rprintf("\nsyscall latency, log2(cycles):count\n");
+    for (int i = 0; i < SYS_MAX; i++) {
+        if (stats[i].calls == 0)
+            continue;
+        log2_hist_print(b, hists[i].total);
+        rprintf("%-18s total   %b\n", _linux_syscalls[i].name, b);
+        log2_hist_print(b, hists[i].blocked);
+        rprintf("%-18s blocked %b\n", "", b);
+    }
 }
 
 static boolean syscall_defer;
 
+static inline boolean syscall_needs_lock(process p, u64 call)
+{
+    if (call >= sizeof(_linux_syscalls) / sizeof(_linux_syscalls[0]))
+        return true;
+    return (p->syscalls[call].flags & SYSCALL_F_NOLOCK) == 0;
+}
+
+/* Syscalls registered as direct neither block nor need the kernel lock; they
+   are run on the entry path and return straight to the user frame, leaving
+   the thread on this cpu. Tracing and stats take the regular path. A handler
+   that faults on a file-backed user page is suspended under the kernel lock
+   and may be resumed on another cpu, holding the lock; it then leaves
+   through the scheduler like any other syscall. */
+static void syscall_direct(context f, u64 call)
+{
+    if (call >= sizeof(_linux_syscalls) / sizeof(_linux_syscalls[0]))
+        return;
+    thread t = current;
+    struct syscall *s = t->p->syscalls + call;
+    if (!(s->flags & SYSCALL_F_DIRECT) || debugsyscalls || do_syscall_stats || shutting_down)
+        return;
+    if (sigstate_get_pending(&t->signals) | sigstate_get_pending(&t->p->signals))
+        return;
+    cpuinfo ci = current_cpu();
+    ci->state = cpu_kernel;
+    thread_enter_system(t);
+    sysreturn (*h)(u64, u64, u64, u64, u64, u64) = s->handler;
+    sysreturn rv = h(f[SYSCALL_FRAME_ARG0], f[SYSCALL_FRAME_ARG1], f[SYSCALL_FRAME_ARG2],
+                     f[SYSCALL_FRAME_ARG3], f[SYSCALL_FRAME_ARG4], f[SYSCALL_FRAME_ARG5]);
+    set_syscall_return(t, rv);
+    ci = current_cpu();
+    if (ci->have_kernel_lock) {
+        schedule_frame(f);
+        kern_unlock();
+        runloop();
+    }
+    ci->state = cpu_user;
+    thread_enter_user(t);
+    frame_return(f);
+}
+
+/* Returning from a signal handler with nothing else to do resumes the
+   interrupted frame from here, sparing the trip through the kernel lock and
+   the runqueue taken by the regular rt_sigreturn. */
+static void syscall_sigreturn_direct(u64 call)
+{
+    if (call != SYS_rt_sigreturn || debugsyscalls || do_syscall_stats || shutting_down)
+        return;
+    thread t = current;
+    thread_enter_system(t);
+    if (!rt_sigreturn_direct(t))
+        return;
+    cpuinfo ci = current_cpu();
+    context f = thread_frame(t);
+    if (ci->have_kernel_lock) {
+        schedule_frame(f);
+        kern_unlock();
+        runloop();
+    }
+    f[FRAME_QUEUE] = u64_from_pointer(ci->thread_queue);
+    thread_frame_restore_tls(f);
+    thread_frame_restore_fpsimd(f);
+    ci->state = cpu_user;
+    thread_enter_user(t);
+    frame_return(f);
+}
+
 // some validation can be moved up here
 static void syscall_schedule(context f)
 {
+    syscall_direct(f, f[FRAME_VECTOR]);
+    syscall_sigreturn_direct(f[FRAME_VECTOR]);
+
     /* kernel context set on syscall entry */
-    if (!syscall_defer)
-        kern_lock();
-    else if (!kern_try_lock()) {
-        enqueue_irqsafe(runqueue, &current->deferred_syscall);
-        thread_pause(current);
-        runloop();
+    if (syscall_needs_lock(current->p, f[FRAME_VECTOR])) {
+        if (!syscall_defer)
+            kern_lock();
+        else if (!kern_try_lock()) {
+            runqueue_push((thunk)&current->deferred_syscall);
+            thread_pause(current);
+            runloop();
+        }
+    } else {
+        current_cpu()->lockless_syscall = true;
     }
     current_cpu()->state = cpu_kernel;
     syscall_debug(f);
@@ -2442,13 +3563,17 @@ void init_syscalls()
     syscall_io_complete = closure(h, syscall_io_complete_cfn);
     io_completion_ignore = closure(h, io_complete_ignore);
     print_syscall_stats = closure(h, print_syscall_stats_cfn);
+    membarrier_vector = allocate_ipi_interrupt();
+    assert(membarrier_vector != INVALID_PHYSICAL);
+    register_interrupt(membarrier_vector, closure(h, membarrier_ipi), "membarrier ipi");
 }
 
-void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name)
+void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name, int flags)
 {
     assert(m[n].handler == 0);
     m[n].handler = f;
     m[n].name = name;
+    m[n].flags = flags;
 }
 
 static void notrace_reset(process p)
@@ -2502,6 +3627,85 @@ closure_function(1, 1, boolean, notrace_notify,
     return true;
 }
 
+closure_function(0, 1, boolean, syscall_hist_reset,
+                 value, v)
+{
+    zero(hists, sizeof(struct syscall_hist) * SYS_MAX);
+    return false;               /* nothing to store */
+}
+
+/* /syscall_latency_stats/<syscall>/{total,blocked}; setting
+   /syscall_latency_stats/reset clears the histograms */
+static void init_syscall_hist_management(tuple root)
+{
+    heap h = heap_general(get_kernel_heaps());
+    tuple st = allocate_tuple();
+    assert(st);
+    tuple_notifier sn = tuple_notifier_wrap(st);
+    assert(sn != INVALID_ADDRESS);
+    for (int i = 0; i < SYS_MAX; i++) {
+        if (!_linux_syscalls[i].handler)
+            continue;
+        tuple t = allocate_tuple();
+        assert(t);
+        tuple_notifier n = tuple_notifier_wrap(t);
+        assert(n != INVALID_ADDRESS);
+        log2_hist_register(n, t, sym(total), hists[i].total);
+        log2_hist_register(n, t, sym(blocked), hists[i].blocked);
+        set(st, sym_this(_linux_syscalls[i].name), n);
+    }
+    tuple_notifier_register_set_notify(sn, sym(reset), closure(h, syscall_hist_reset));
+    set(st, sym(no_encode), null_value);
+    set(root, sym(syscall_latency_stats), sn);
+}
+
+#define syscall_metrics_family(b, field)                                        \
+    bprintf(b, "# TYPE nanos_syscall_" #field " counter\n");                    \
+    for (int i = 0; i < SYS_MAX; i++) {                                         \
+        if (_linux_syscalls[i].name && stats[i].calls)                          \
+            bprintf(b, "nanos_syscall_" #field "{syscall=\"%s\"} %ld\n",        \
+                    _linux_syscalls[i].name, stats[i].field);                   \
+    }
+
+closure_function(0, 1, void, syscall_metrics,
+                 buffer, b)
+{
+    syscall_metrics_family(b, calls);
+    syscall_metrics_family(b, errors);
+    syscall_metrics_family(b, usecs);
+}
+
+/* syscall_summary prints the per-syscall table at exit; syscall_latency,
+   either set or a tuple with tid_min and tid_max, adds latency histograms */
+void configure_syscall_stats(tuple root)
+{
+    syscall_summary = get(root, sym(syscall_summary)) != 0;
+    value v = get(root, sym(syscall_latency));
+    if (v) {
+        hist_tid_min = 0;
+        hist_tid_max = infinity;
+        if (is_tuple(v)) {
+            get_u64(v, sym(tid_min), &hist_tid_min);
+            get_u64(v, sym(tid_max), &hist_tid_max);
+        }
+        heap h = heap_general(get_kernel_heaps());
+        hists = allocate_zero(h, sizeof(struct syscall_hist) * SYS_MAX);
+        if (hists == INVALID_ADDRESS) {
+            msg_err("failed to allocate syscall latency histograms\n");
+            hists = 0;
+        } else {
+            init_syscall_hist_management(root);
+        }
+    }
+    if (syscall_summary || hists)
+        vector_push(shutdown_completions, print_syscall_stats);
+
+    /* the metrics endpoint exports the per-syscall counters */
+    if (get(root, sym(metrics)))
+        metrics_register_source(closure(heap_general(get_kernel_heaps()), syscall_metrics));
+    do_syscall_stats = syscall_summary || hists || get(root, sym(metrics)) != 0;
+}
+
 void configure_syscalls(process p)
 {
     heap h = heap_general(&p->uh->kh);
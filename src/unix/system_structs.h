@@ -59,6 +59,7 @@ typedef struct iovec {
 #define EMLINK          31              /* Too many links */
 #define EPIPE           32              /* Broken pipe */
 #define ERANGE          34              /* Math result not representable */
+#define EDEADLK         35              /* Resource deadlock would occur */
 #define ENAMETOOLONG    36              /* File name too long */
 
 #define ENOSYS          38              /* Invalid system call number */
@@ -107,6 +108,20 @@ typedef struct iovec {
 #define F_DUPFD_CLOEXEC (F_LINUX_SPECIFIC_BASE + 6)
 #define F_SETPIPE_SZ    (F_LINUX_SPECIFIC_BASE + 7)
 #define F_GETPIPE_SZ    (F_LINUX_SPECIFIC_BASE + 8)
+#define F_ADD_SEALS     (F_LINUX_SPECIFIC_BASE + 9)
+#define F_GET_SEALS     (F_LINUX_SPECIFIC_BASE + 10)
+
+/* Types of seals for F_ADD_SEALS and F_GET_SEALS */
+#define F_SEAL_SEAL         0x0001  /* prevent further seals from being set */
+#define F_SEAL_SHRINK       0x0002  /* prevent file from shrinking */
+#define F_SEAL_GROW         0x0004  /* prevent file from growing */
+#define F_SEAL_WRITE        0x0008  /* prevent writes */
+#define F_SEAL_FUTURE_WRITE 0x0010  /* prevent future writes while mapped */
+
+/* memfd_create flags */
+#define MFD_CLOEXEC         0x0001
+#define MFD_ALLOW_SEALING   0x0002
+#define MFD_HUGETLB         0x0004
 
 /* Values for 'mode' argument of access/faccessat syscalls */
 #define F_OK    0x0
@@ -130,6 +145,7 @@ struct flock {
 #define FIONBIO         0x5421
 #define FIONCLEX        0x5450
 #define FIOCLEX         0x5451
+#define FICLONE         0x40049409
 
 #define AT_NULL         0               /* End of vector */
 #define AT_IGNORE       1               /* Entry should be ignored */
@@ -165,12 +181,35 @@ struct flock {
 #define MAP_ANONYMOUS       0x20
 #define MREMAP_MAYMOVE      1
 #define MREMAP_FIXED        2
+#define MAP_GROWSDOWN       0x0100
+#define MAP_LOCKED          0x2000
+#define MAP_POPULATE        0x8000
+#define MAP_NONBLOCK        0x10000
 #define MAP_STACK           0x20000
 
+#define MLOCK_ONFAULT   0x01
+
 #define PROT_READ       0x1
 #define PROT_WRITE      0x2
 #define PROT_EXEC       0x4
 
+/* madvise */
+#define MADV_NORMAL      0
+#define MADV_RANDOM      1
+#define MADV_SEQUENTIAL  2
+#define MADV_WILLNEED    3
+#define MADV_DONTNEED    4
+#define MADV_FREE        8
+#define MADV_REMOVE      9
+#define MADV_DONTFORK    10
+#define MADV_DOFORK      11
+#define MADV_MERGEABLE   12
+#define MADV_UNMERGEABLE 13
+#define MADV_HUGEPAGE    14
+#define MADV_NOHUGEPAGE  15
+#define MADV_DONTDUMP    16
+#define MADV_DODUMP      17
+
 /* msync */
 #define MS_ASYNC      1
 #define MS_INVALIDATE 2
@@ -239,6 +278,22 @@ struct utimbuf {
 
 #define FUTEX_CLOCK_REALTIME    (1 << 8)
 
+#define FUTEX_WAITERS       0x80000000
+#define FUTEX_OWNER_DIED    0x40000000
+#define FUTEX_TID_MASK      0x3fffffff
+
+#define FUTEX_WAITV_MAX     128
+#define FUTEX2_SIZE_U32     0x02
+#define FUTEX2_SIZE_MASK    0x03
+#define FUTEX2_PRIVATE      128
+
+struct futex_waitv {
+    u64 val;
+    u64 uaddr;
+    u32 flags;
+    u32 __reserved;
+};
+
 #define  FUTEX_OP_SET        0  /* uaddr2 = oparg; */
 #define  FUTEX_OP_ADD        1  /* uaddr2 += oparg; */
 #define  FUTEX_OP_OR         2  /* uaddr2 |= oparg; */
@@ -629,7 +684,7 @@ struct tms {
 #define EPOLLWRBAND	0x00000200
 #define EPOLLMSG	0x00000400
 #define EPOLLRDHUP	0x00002000
-#define EPOLLEXCLUSIVE	(1u << 29)
+#define EPOLLEXCLUSIVE	(1u << 28)
 #define EPOLLWAKEUP	(1u << 29)
 #define EPOLLONESHOT	(1u << 30)
 #define EPOLLET		(1u << 31)
@@ -653,6 +708,49 @@ struct statfs {
     long f_spare[4];
 };
 
+#define STATX_TYPE          0x0001
+#define STATX_MODE          0x0002
+#define STATX_NLINK         0x0004
+#define STATX_UID           0x0008
+#define STATX_GID           0x0010
+#define STATX_ATIME         0x0020
+#define STATX_MTIME         0x0040
+#define STATX_CTIME         0x0080
+#define STATX_INO           0x0100
+#define STATX_SIZE          0x0200
+#define STATX_BLOCKS        0x0400
+#define STATX_BASIC_STATS   0x07ff
+
+struct statx_timestamp {
+    s64 tv_sec;
+    u32 tv_nsec;
+    s32 reserved;
+};
+
+struct statx {
+    u32 stx_mask;
+    u32 stx_blksize;
+    u64 stx_attributes;
+    u32 stx_nlink;
+    u32 stx_uid;
+    u32 stx_gid;
+    u16 stx_mode;
+    u16 spare0;
+    u64 stx_ino;
+    u64 stx_size;
+    u64 stx_blocks;
+    u64 stx_attributes_mask;
+    struct statx_timestamp stx_atime;
+    struct statx_timestamp stx_btime;
+    struct statx_timestamp stx_ctime;
+    struct statx_timestamp stx_mtime;
+    u32 stx_rdev_major;
+    u32 stx_rdev_minor;
+    u32 stx_dev_major;
+    u32 stx_dev_minor;
+    u64 spare2[14];
+};
+
 typedef u32 uid_t;
 typedef u32 gid_t;
 
@@ -721,7 +819,10 @@ struct io_uring_params {
 };
 
 /* Socket option levels */
+#define SOL_IP          0
 #define SOL_SOCKET      1
+#define IPPROTO_TCP     6
+#define IPPROTO_UDP     17
 #define IPPROTO_IPV6    41
 
 /* set/getsockopt optnames */
@@ -733,7 +834,12 @@ struct io_uring_params {
 #define SO_RCVBUF    8
 #define SO_PRIORITY  12
 #define SO_LINGER    13
+#define SO_REUSEPORT 15
+#define SO_ZEROCOPY  60
+
+#define IP_RECVERR      11
 
+#define IPV6_RECVERR    25
 #define IPV6_V6ONLY     26
 
 /* eventfd flags */
@@ -755,6 +861,49 @@ struct io_uring_params {
 #define SFD_NONBLOCK O_NONBLOCK
 #define SFD_CLOEXEC  O_CLOEXEC
 
+/* inotify flags */
+#define IN_NONBLOCK O_NONBLOCK
+#define IN_CLOEXEC  O_CLOEXEC
+
+/* inotify events */
+#define IN_ACCESS           0x00000001
+#define IN_MODIFY           0x00000002
+#define IN_ATTRIB           0x00000004
+#define IN_CLOSE_WRITE      0x00000008
+#define IN_CLOSE_NOWRITE    0x00000010
+#define IN_OPEN             0x00000020
+#define IN_MOVED_FROM       0x00000040
+#define IN_MOVED_TO         0x00000080
+#define IN_CREATE           0x00000100
+#define IN_DELETE           0x00000200
+#define IN_DELETE_SELF      0x00000400
+#define IN_MOVE_SELF        0x00000800
+#define IN_ALL_EVENTS       0x00000fff
+#define IN_UNMOUNT          0x00002000
+#define IN_Q_OVERFLOW       0x00004000
+#define IN_IGNORED          0x00008000
+#define IN_ONLYDIR          0x01000000
+#define IN_DONT_FOLLOW      0x02000000
+#define IN_EXCL_UNLINK      0x04000000
+#define IN_MASK_CREATE      0x10000000
+#define IN_MASK_ADD         0x20000000
+#define IN_ISDIR            0x40000000
+#define IN_ONESHOT          0x80000000
+
+struct inotify_event {
+    s32 wd;
+    u32 mask;
+    u32 cookie;
+    u32 len;
+    char name[0];
+};
+
+/* splice flags */
+#define SPLICE_F_MOVE       (1 << 0)
+#define SPLICE_F_NONBLOCK   (1 << 1)
+#define SPLICE_F_MORE       (1 << 2)
+#define SPLICE_F_GIFT       (1 << 3)
+
 /* fallocate flags */
 #define FALLOC_FL_KEEP_SIZE         0x01
 #define FALLOC_FL_PUNCH_HOLE        0x02
@@ -769,3 +918,39 @@ struct io_uring_params {
 #define POSIX_FADV_WILLNEED     3
 #define POSIX_FADV_DONTNEED     4
 #define POSIX_FADV_NOREUSE      5
+
+/* membarrier commands */
+#define MEMBARRIER_CMD_QUERY                                0
+#define MEMBARRIER_CMD_GLOBAL                               (1 << 0)
+#define MEMBARRIER_CMD_GLOBAL_EXPEDITED                     (1 << 1)
+#define MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED            (1 << 2)
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED                    (1 << 3)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED           (1 << 4)
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE          (1 << 5)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE (1 << 6)
+
+/* restartable sequences */
+#define RSEQ_FLAG_UNREGISTER    (1 << 0)
+
+#define RSEQ_CPU_ID_UNINITIALIZED       -1
+#define RSEQ_CPU_ID_REGISTRATION_FAILED -2
+
+struct rseq_cs {
+    u32 version;
+    u32 flags;
+    u64 start_ip;
+    u64 post_commit_offset;
+    u64 abort_ip;
+} __attribute__((aligned(32)));
+
+struct rseq {
+    u32 cpu_id_start;
+    u32 cpu_id;
+    u64 rseq_cs;
+    u32 flags;
+    u32 node_id;
+    u32 mm_cid;
+} __attribute__((aligned(32)));
+
+/* length of the fields in the original ABI, which is all we update */
+#define RSEQ_ORIG_SIZE  32
@@ -50,6 +50,75 @@ sysreturn arch_prctl(int code, unsigned long addr)
 }
 #endif
 
+sysreturn rseq(struct rseq *rs, u32 rseq_len, int flags, u32 sig)
+{
+    thread t = current;
+    thread_log(t, "rseq: rseq %p, len %d, flags 0x%x, sig 0x%x", rs, rseq_len, flags, sig);
+    if (flags & ~RSEQ_FLAG_UNREGISTER)
+        return -EINVAL;
+    if (flags & RSEQ_FLAG_UNREGISTER) {
+        if (t->rseq != rs || rseq_len != RSEQ_ORIG_SIZE)
+            return -EINVAL;
+        if (t->rseq_sig != sig)
+            return -EPERM;
+        rs->cpu_id_start = 0;
+        rs->cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+        t->rseq = 0;
+        return 0;
+    }
+    if (t->rseq) {
+        if (t->rseq != rs || rseq_len != RSEQ_ORIG_SIZE)
+            return -EINVAL;
+        return t->rseq_sig != sig ? -EPERM : -EBUSY;
+    }
+    if ((u64_from_pointer(rs) & (RSEQ_ORIG_SIZE - 1)) || rseq_len != RSEQ_ORIG_SIZE)
+        return -EINVAL;
+    if (!validate_user_memory(rs, rseq_len, true))
+        return -EFAULT;
+    t->rseq = rs;
+    t->rseq_sig = sig;
+    t->rseq_cpu = current_cpu()->id;
+    rs->cpu_id_start = rs->cpu_id = t->rseq_cpu;
+    rs->node_id = 0;
+    return 0;
+}
+
+/* Called before a thread returns to user mode, after having left it for a
+   syscall, a preemption or a signal: publish the cpu it now runs on and
+   abort any critical section it was in, redirecting it to the abort
+   handler. A section is never entered from a syscall, so aborting on
+   return from one costs nothing. */
+static void rseq_resume(thread t)
+{
+    struct rseq *rs = t->rseq;
+    int cpu = current_cpu()->id;
+    if (cpu != t->rseq_cpu) {
+        rs->cpu_id_start = rs->cpu_id = cpu;
+        t->rseq_cpu = cpu;
+    }
+    u64 cs = rs->rseq_cs;
+    if (!cs)
+        return;
+    struct rseq_cs *rcs = pointer_from_u64(cs);
+    if (!validate_user_memory(rcs, sizeof(*rcs), false))
+        goto fault;
+    context f = thread_frame(t);
+    if (f[SYSCALL_FRAME_PC] - rcs->start_ip >= rcs->post_commit_offset) {
+        rs->rseq_cs = 0;
+        return;
+    }
+    u32 *abort_sig = pointer_from_u64(rcs->abort_ip - sizeof(u32));
+    if (rcs->version || !validate_user_memory(abort_sig, sizeof(u32), false) ||
+        *abort_sig != t->rseq_sig)
+        goto fault;
+    thread_log(t, "rseq: abort at pc 0x%lx to 0x%lx", f[SYSCALL_FRAME_PC], rcs->abort_ip);
+    f[SYSCALL_FRAME_PC] = rcs->abort_ip;
+    rs->rseq_cs = 0;
+    return;
+  fault:
+    deliver_fault_signal(SIGSEGV, t, cs, SEGV_ACCERR);
+}
+
 #ifdef __x86_64__
 sysreturn clone(unsigned long flags, void *child_stack, int *ptid, int *ctid, unsigned long newtls)
 #elif defined(__aarch64__)
@@ -75,6 +144,8 @@ sysreturn clone(unsigned long flags, void *child_stack, int *ptid, unsigned long
         return set_syscall_error(current, EFAULT);
 
     thread t = create_thread(current->p);
+    t->thrd.affinity = current->thrd.affinity;
+    t->timer_slack_ns = current->timer_slack_ns;
     /* clone frame processor state */
     clone_frame_pstate(t->default_frame, current->default_frame);
     thread_clone_sigmask(t, current);
@@ -98,6 +169,7 @@ sysreturn clone(unsigned long flags, void *child_stack, int *ptid, unsigned long
 void register_thread_syscalls(struct syscall *map)
 {
     register_syscall(map, futex, futex);
+    register_syscall(map, futex_waitv, futex_waitv);
     register_syscall(map, set_robust_list, set_robust_list);
     register_syscall(map, get_robust_list, get_robust_list);
     register_syscall(map, clone, clone);
@@ -105,7 +177,8 @@ void register_thread_syscalls(struct syscall *map)
     register_syscall(map, arch_prctl, arch_prctl);
 #endif
     register_syscall(map, set_tid_address, set_tid_address);
-    register_syscall(map, gettid, gettid);
+    register_syscall(map, rseq, rseq);
+    register_syscall_direct(map, gettid, gettid);
 }
 
 void thread_log_internal(thread t, const char *desc, ...)
@@ -159,6 +232,7 @@ static inline void run_thread_frame(thread t)
     thread old = current;
     thread_enter_user(t);
     ftrace_thread_switch(old, t);    /* ftrace needs to know about the switch event */
+    tracepoint(thread_run, t->tid, old ? old->tid : 0, 0);
 
     /* cover wake-before-sleep situations (e.g. sched yield, fs ops that don't go to disk, etc.) */
     t->blocked_on = 0;
@@ -168,6 +242,11 @@ static inline void run_thread_frame(thread t)
         count_syscall(t, 0);
     context f = thread_frame(t);
     cpuinfo ci = current_cpu();
+    vdso_update_cputime(ci, t->utime + t->stime, t->start_time);
+    if (t->thrd.wake_cycles) {
+        sched_hist_record(SCHED_HIST_WAKEUP, rdtsc() - t->thrd.wake_cycles);
+        t->thrd.wake_cycles = 0;
+    }
     thread_frame_restore_tls(f);
     thread_frame_restore_fpsimd(f);
     frame_enable_interrupts(f);
@@ -185,6 +264,8 @@ define_closure_function(1, 0, void, run_thread,
                         thread, t)
 {
     thread t = bound(t);
+    if (t->rseq)
+        rseq_resume(t);
     dispatch_signals(t);
     current_cpu()->state = cpu_user;
     run_thread_frame(t);
@@ -199,8 +280,11 @@ define_closure_function(1, 0, void, pause_thread,
 define_closure_function(1, 0, void, run_sighandler,
                         thread, t)
 {
+    thread t = bound(t);
+    if (t->rseq)
+        rseq_resume(t);
     current_cpu()->state = cpu_user;
-    run_thread_frame(bound(t));
+    run_thread_frame(t);
 }
 
 static void setup_thread_frame(heap h, context frame, thread t)
@@ -223,6 +307,7 @@ void thread_sleep_interruptible(void)
     assert(current->blocked_on);
     thread_log(current, "sleep interruptible (on \"%s\")", blockq_name(current->blocked_on));
     ftrace_thread_switch(current, 0);
+    tracepoint(thread_sleep, current->tid, current->blocked_on, 0);
     count_syscall_save(current);
     kern_unlock();
     runloop();
@@ -235,6 +320,7 @@ void thread_sleep_uninterruptible(void)
     current->blocked_on = INVALID_ADDRESS;
     thread_log(current, "sleep uninterruptible");
     ftrace_thread_switch(current, 0);
+    tracepoint(thread_sleep, current->tid, 0, 0);
     count_syscall_save(current);
     kern_unlock();
     runloop();
@@ -260,6 +346,7 @@ void thread_wakeup(thread t)
     assert(t->blocked_on);
     t->blocked_on = 0;
     t->syscall = -1;
+    t->thrd.wake_cycles = rdtsc();
     schedule_frame(thread_frame(t));
 }
 
@@ -278,10 +365,51 @@ boolean thread_attempt_interrupt(thread t)
     return true;
 }
 
+/* Reset a frame kept with a recycled thread to the state of a newly
+   allocated one, including the extended (FPU) state. */
+static void reset_thread_frame(context f)
+{
+    u64 h = f[FRAME_HEAP];
+    zero(f, total_frame_size());
+    init_frame(f);
+    f[FRAME_HEAP] = h;
+}
+
+/* Once the last reference is gone, the thread is kept for reuse by
+   create_thread() along with its frames and blockq, which are reset here
+   rather than on the clone path. A thread with signalfds still attached
+   isn't reused, as they would follow it to the new thread. */
 define_closure_function(1, 0, void, free_thread,
                         thread, t)
 {
-    deallocate(heap_general(get_kernel_heaps()), bound(t), sizeof(struct thread));
+    thread t = bound(t);
+    process p = t->p;
+    heap h = heap_general(get_kernel_heaps());
+    if (notify_get_eventmask_union(t->signalfds) == 0) {
+        reset_thread_frame(t->default_frame);
+        reset_thread_frame(t->sighandler_frame);
+        u64 flags = spin_lock_irq(&p->thread_cache_lock);
+        if (p->thread_cache_count < PROCESS_THREAD_CACHE_SIZE) {
+            p->thread_cache[p->thread_cache_count++] = t;
+            spin_unlock_irq(&p->thread_cache_lock, flags);
+            return;
+        }
+        spin_unlock_irq(&p->thread_cache_lock, flags);
+    }
+    deallocate_frame(t->default_frame);
+    deallocate_frame(t->sighandler_frame);
+    deallocate_blockq(t->thread_bq);
+    deallocate(h, t, sizeof(struct thread));
+}
+
+static thread thread_cache_get(process p)
+{
+    thread t = 0;
+    u64 flags = spin_lock_irq(&p->thread_cache_lock);
+    if (p->thread_cache_count > 0)
+        t = p->thread_cache[--p->thread_cache_count];
+    spin_unlock_irq(&p->thread_cache_lock, flags);
+    return t;
 }
 
 define_closure_function(1, 0, void, resume_syscall, thread, t)
@@ -295,17 +423,21 @@ thread create_thread(process p)
     static int tidcount = 0;
     heap h = heap_general((kernel_heaps)p->uh);
 
-    thread t = allocate(h, sizeof(struct thread));
-    if (t == INVALID_ADDRESS)
-        goto fail;
+    thread t = thread_cache_get(p);
+    boolean recycled = t != 0;
+    if (!recycled) {
+        t = allocate(h, sizeof(struct thread));
+        if (t == INVALID_ADDRESS)
+            goto fail;
 
-    t->thread_bq = allocate_blockq(h, "thread");
-    if (t->thread_bq == INVALID_ADDRESS)
-        goto fail_bq;
+        t->thread_bq = allocate_blockq(h, "thread");
+        if (t->thread_bq == INVALID_ADDRESS)
+            goto fail_bq;
 
-    t->signalfds = allocate_notify_set(h);
-    if (t->signalfds == INVALID_ADDRESS)
-        goto fail_sfds;
+        t->signalfds = allocate_notify_set(h);
+        if (t->signalfds == INVALID_ADDRESS)
+            goto fail_sfds;
+    }
 
     t->p = p;
     t->syscall = -1;
@@ -321,22 +453,25 @@ thread create_thread(process p)
     } while (rbtree_lookup(p->threads, &t->n) != INVALID_ADDRESS);
     spin_unlock(&p->threads_lock);
     t->clear_tid = 0;
+    t->rseq = 0;
     t->name[0] = '\0';
 
-    t->default_frame = allocate_frame(h);
+    if (!recycled) {
+        t->default_frame = allocate_frame(h);
+        t->sighandler_frame = allocate_frame(h);
+    }
     init_thread_fault_handler(t);
     setup_thread_frame(h, t->default_frame, t);
     t->default_frame[FRAME_RUN] = u64_from_pointer(init_closure(&t->run_thread, run_thread, t));
     set_thread_frame(t, t->default_frame);
     
-    t->sighandler_frame = allocate_frame(h);
     t->signal_stack = 0;
     setup_thread_frame(h, t->sighandler_frame, t);
     t->sighandler_frame[FRAME_RUN] = u64_from_pointer(init_closure(&t->run_sighandler, run_sighandler, t));
 
     t->thrd.pause = init_closure(&t->pause_thread, pause_thread, t);
-    // xxx another max 64
-    t->affinity.mask[0] = MASK(total_processors);
+    t->thrd.affinity = p->affinity;
+    t->thrd.wake_cycles = 0;
     t->blocked_on = 0;
     init_sigstate(&t->signals);
     t->dispatch_sigstate = 0;
@@ -345,7 +480,10 @@ thread create_thread(process p)
     t->sysctx = false;
     t->utime = t->stime = 0;
     t->start_time = now(CLOCK_ID_MONOTONIC_RAW);
+    t->timer_slack_ns = THREAD_TIMER_SLACK_DEFAULT_NS;
     t->last_syscall = -1;
+    t->vmap_cache = 0;
+    t->robust_list = 0;
 
     // XXX sigframe
     spin_lock(&p->threads_lock);
@@ -393,20 +531,17 @@ void exit_thread(thread t)
     if (t->select_epoll)
         epoll_finish(t->select_epoll);
 
-    wake_robust_list(t->p, t->robust_list);
+    wake_robust_list(t->p, t->tid, t->robust_list);
     t->robust_list = 0;
 
+    /* the blockq and frames go with the thread struct in free_thread */
     blockq_flush(t->thread_bq);
-    deallocate_blockq(t->thread_bq);
-    t->thread_bq = INVALID_ADDRESS;
 
     t->default_frame[FRAME_RUN] = INVALID_PHYSICAL;
     t->default_frame[FRAME_QUEUE] = INVALID_PHYSICAL;
     t->sighandler_frame[FRAME_RUN] = INVALID_PHYSICAL;
     t->sighandler_frame[FRAME_QUEUE] = INVALID_PHYSICAL;
     t->default_frame[FRAME_FAULT_HANDLER] = INVALID_PHYSICAL;
-    deallocate_frame(t->default_frame);
-    deallocate_frame(t->sighandler_frame);
 
     /* replace references to thread with placeholder */
     set_current_thread((nanos_thread)dummy_thread);
@@ -448,5 +583,7 @@ void init_threads(process p)
     heap h = heap_general((kernel_heaps)p->uh);
     p->threads = allocate_rbtree(h, closure(h, thread_tid_compare), closure(h, tid_print_key));
     spin_lock_init(&p->threads_lock);
+    spin_lock_init(&p->thread_cache_lock);
+    p->thread_cache_count = 0;
     init_futices(p);
 }
@@ -3,6 +3,7 @@
 #include <gdb.h>
 #include <log.h>
 #include <filesystem.h>
+#include <drivers/console.h>
 
 //#define PF_DEBUG
 #ifdef PF_DEBUG
@@ -21,8 +22,10 @@ unix_heaps get_unix_heaps()
 
 u64 allocate_fd(process p, void *f)
 {
+    spin_lock(&p->fdesc_lock);
     u64 fd = allocate_u64((heap)p->fdallocator, 1);
     if (fd == INVALID_PHYSICAL) {
+        spin_unlock(&p->fdesc_lock);
 	msg_err("fail; maxed out\n");
 	return fd;
     }
@@ -30,11 +33,13 @@ u64 allocate_fd(process p, void *f)
         deallocate_u64((heap)p->fdallocator, fd, 1);
         fd = INVALID_PHYSICAL;
     }
+    spin_unlock(&p->fdesc_lock);
     return fd;
 }
 
 u64 allocate_fd_gte(process p, u64 min, void *f)
 {
+    spin_lock(&p->fdesc_lock);
     u64 fd = id_heap_alloc_gte(p->fdallocator, 1, min);
     if (fd == INVALID_PHYSICAL) {
         msg_err("failed\n");
@@ -45,13 +50,23 @@ u64 allocate_fd_gte(process p, u64 min, void *f)
             fd = INVALID_PHYSICAL;
         }
     }
+    spin_unlock(&p->fdesc_lock);
     return fd;
 }
 
 void deallocate_fd(process p, int fd)
 {
+    spin_lock(&p->fdesc_lock);
     assert(vector_set(p->files, fd, 0)); 
     deallocate_u64((heap)p->fdallocator, fd, 1);
+    spin_unlock(&p->fdesc_lock);
+}
+
+void replace_fd(process p, int fd, void *f)
+{
+    spin_lock(&p->fdesc_lock);
+    assert(vector_set(p->files, fd, f));
+    spin_unlock(&p->fdesc_lock);
 }
 
 void deliver_fault_signal(u32 signo, thread t, u64 vaddr, s32 si_code)
@@ -96,6 +111,15 @@ static boolean handle_protection_fault(context frame, u64 vaddr, vmap vm)
     /* vmap found, with protection violation set --> send prot violation */
     if (is_protection_fault(frame)) {
         u64 flags = VMAP_FLAG_MMAP | VMAP_FLAG_WRITABLE;
+        if (is_write_fault(frame) && (vm->flags & flags) == flags &&
+            (vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED &&
+            (vm->flags & VMAP_FLAG_SHARED)) {
+            /* first write to a clean shared page */
+            pf_debug("write to shared map: vaddr 0x%lx, node %p\n", vaddr, vm->cache_node);
+            pagecache_node_shared_write_fault(vm->cache_node, vaddr,
+                                              pageflags_from_vmflags(vm->flags));
+            return true;
+        }
         if (is_write_fault(frame) && (vm->flags & flags) == flags &&
             (vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED) {
             /* copy on write */
@@ -110,6 +134,12 @@ static boolean handle_protection_fault(context frame, u64 vaddr, vmap vm)
             }
             return true;
         }
+        if (is_write_fault(frame) && (vm->flags & flags) == flags &&
+            (vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS) {
+            /* write-protected for a huge page collapse */
+            pf_debug("write to anonymous map under collapse: vaddr 0x%lx\n", vaddr);
+            return anon_collapse_write_fault(vaddr, vm, frame);
+        }
         pf_debug("page protection violation\naddr 0x%lx, rip 0x%lx, "
                  "error %s%s%s vm->flags (%s%s %s%s)",
                  vaddr, frame_return_address(frame),
@@ -187,6 +217,7 @@ define_closure_function(1, 1, context, default_fault_handler,
             goto bug;
         }
 
+        tracepoint(page_fault, vaddr, vm->flags, user);
         if (handle_protection_fault(frame, vaddr, vm)) {
             if (is_current_kernel_context(frame)) {
                 current_cpu()->state = cpu_kernel;
@@ -259,8 +290,7 @@ closure_function(1, 2, sysreturn, std_close,
 closure_function(0, 6, sysreturn, stdout,
                  void*, d, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
 {
-    console_write(d, length);
-    klog_write(d, length);
+    console_write_async(d, length);
     if (completion)
         apply(completion, t, length);
     return length;
@@ -310,6 +340,30 @@ static boolean create_stdfiles(unix_heaps uh, process p)
     return true;
 }
 
+/* Parse a cpu list such as "0-3,6" into a mask; returns 0 if malformed. */
+static u64 parse_cpu_list(buffer list)
+{
+    u64 mask = 0;
+    buffer w = alloca_wrap(list);
+    while (buffer_length(w) > 0) {
+        u64 first, last;
+        if (!parse_int(w, 10, &first))
+            return 0;
+        last = first;
+        if (buffer_length(w) > 0 && peek_char(w) == '-') {
+            pop_u8(w);
+            if (!parse_int(w, 10, &last) || last < first)
+                return 0;
+        }
+        if (last >= MAX_CPUS)
+            return 0;
+        mask |= MASK(last + 1) & ~MASK(first);
+        if (buffer_length(w) > 0 && pop_u8(w) != ',')
+            return 0;
+    }
+    return mask;
+}
+
 process create_process(unix_heaps uh, tuple root, filesystem fs)
 {
     kernel_heaps kh = (kernel_heaps)uh;
@@ -335,7 +389,7 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
         if (aslr)
             id_heap_set_randomize(p->virtual32, true);
 #endif
-        mmap_process_init(p, aslr);
+        mmap_process_init(p, root, aslr);
         init_vdso(p);
     } else {
 #ifdef __x86_64__
@@ -348,6 +402,7 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     p->cwd = root;
     p->process_root = root;
     p->fdallocator = create_id_heap(h, h, 0, infinity, 1, false);
+    spin_lock_init(&p->fdesc_lock);
     p->files = allocate_vector(h, 64);
     zero(p->files, sizeof(p->files));
     create_stdfiles(uh, p);
@@ -361,6 +416,16 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     p->aio_ids = create_id_heap(h, h, 0, S32_MAX, 1, false);
     p->aio = allocate_vector(h, 8);
     p->trace = 0;
+    p->membarrier_registered = 0;
+    p->affinity = MASK(MAX_CPUS);
+    string cpus = get_string(root, sym(affinity));
+    if (cpus) {
+        u64 mask = parse_cpu_list(cpus);
+        if (mask)
+            p->affinity = mask;
+        else
+            msg_err("invalid cpu list in \"affinity\" option; ignoring\n");
+    }
     return p;
 }
 
@@ -464,6 +529,13 @@ timestamp thread_stime(thread t)
     return stime_updated(t);
 }
 
+/* user frame of the thread the kernel is running for, for cpu profiling */
+static context profile_user_frame(void)
+{
+    thread t = (thread)get_current_thread();
+    return (t && t != dummy_thread) ? thread_frame(t) : 0;
+}
+
 process init_unix(kernel_heaps kh, tuple root, filesystem fs)
 {
     heap h = heap_general(kh);
@@ -483,12 +555,14 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
 	goto alloc_fail;
     if (!pipe_init(uh))
 	goto alloc_fail;
+    if (!memfd_init(uh))
+	goto alloc_fail;
     if (!unix_timers_init(uh))
         goto alloc_fail;
     if (ftrace_init(uh, fs))
 	goto alloc_fail;
 #ifdef NET
-    if (!netsyscall_init(uh))
+    if (!netsyscall_init(uh, root))
         goto alloc_fail;
 #endif
     init_fs_path_helper();
@@ -501,6 +575,7 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
         context f = frame_from_kernel_context(get_kernel_context(cpuinfo_from_id(i)));
         f[FRAME_THREAD] = u64_from_pointer(dummy_thread);
     }
+    cpu_profile_user_frame = profile_user_frame;
 
     /* XXX remove once we have http PUT support */
     ftrace_enable();
@@ -531,9 +606,7 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
     register_timer_syscalls(linux_syscalls);
     register_other_syscalls(linux_syscalls);
     configure_syscalls(kernel_process);
-    do_syscall_stats = get(kernel_process->process_root, sym(syscall_summary)) != 0;
-    if (do_syscall_stats)
-        vector_push(shutdown_completions, print_syscall_stats);
+    configure_syscall_stats(kernel_process->process_root);
     return kernel_process;
   alloc_fail:
     msg_err("failed to allocate kernel objects\n");
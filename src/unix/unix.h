@@ -7,6 +7,7 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs);
 process create_process(unix_heaps uh, tuple root, filesystem fs);
 thread create_thread(process p);
 process exec_elf(buffer ex, process kernel_process);
+void exec_program(process kernel_process, tuple program);
 
 void dump_mem_stats(buffer b);
 
@@ -103,6 +103,30 @@ sysreturn times(struct tms *buf)
             CLOCKS_PER_SEC * uptime() / TIMESTAMP_SECOND);
 }
 
+sysreturn clock_getres(clockid_t clk_id, struct timespec *res)
+{
+    thread_log(current, "clock_getres: clk_id %d, res %p", clk_id, res);
+    switch (clk_id) {
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_MONOTONIC_RAW:
+    case CLOCK_BOOTTIME:
+    case CLOCK_REALTIME:
+    case CLOCK_REALTIME_COARSE:
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (res) {
+        if (!validate_user_memory(res, sizeof(struct timespec), true))
+            return -EFAULT;
+        timespec_from_time(res, nanoseconds(1));
+    }
+    return 0;
+}
+
 sysreturn clock_gettime(clockid_t clk_id, struct timespec *tp)
 {
     thread_log(current, "clock_gettime: clk_id %d, tp %p", clk_id, tp);
@@ -136,12 +160,12 @@ sysreturn clock_gettime(clockid_t clk_id, struct timespec *tp)
 void register_clock_syscalls(struct syscall *map)
 {
 #ifdef __x86_64__
-    register_syscall(map, time, sys_time);
+    register_syscall_direct(map, time, sys_time);
 #endif
-    register_syscall(map, clock_gettime, clock_gettime);
-    register_syscall(map, clock_getres, syscall_ignore);
+    register_syscall_direct(map, clock_gettime, clock_gettime);
+    register_syscall_direct(map, clock_getres, clock_getres);
     register_syscall(map, clock_nanosleep, clock_nanosleep);
-    register_syscall(map, gettimeofday, gettimeofday);
+    register_syscall_direct(map, gettimeofday, gettimeofday);
     register_syscall(map, nanosleep, nanosleep);
     register_syscall(map, times, times);
 }
@@ -14,6 +14,9 @@
 #define VMAP_FLAG_MMAP     0x0010
 #define VMAP_FLAG_SHARED   0x0020 /* vs private; same semantics as unix */
 #define VMAP_FLAG_PREALLOC 0x0040
+#define VMAP_FLAG_HUGEPAGE   0x0080
+#define VMAP_FLAG_NOHUGEPAGE 0x1000
+#define VMAP_FLAG_STACK      0x2000 /* MAP_STACK / MAP_GROWSDOWN anonymous map */
 
 #define VMAP_MMAP_TYPE_MASK       0x0f00
 #define VMAP_MMAP_TYPE_ANONYMOUS  0x0100
@@ -37,13 +40,19 @@
 
 #define PROCESS_STACK_SIZE          (2 * MB)
 
+/* freed thread stack tops kept for reuse by each process */
+#define PROCESS_STACK_CACHE_SIZE    16
+
+/* exited threads kept for reuse by each process */
+#define PROCESS_THREAD_CACHE_SIZE   32
+
 /* restrict the area in which ELF segments can be placed */
 #define PROCESS_ELF_LOAD_END        (GB) /* 1gb hard upper limit */
 
 /* range of variation for various ASLR mappings; kind of arbitrary at this point */
 #define PROCESS_PIE_LOAD_ASLR_RANGE (4 * MB)
 #define PROCESS_HEAP_ASLR_RANGE     (4 * MB)
-#define PROCESS_STACK_ASLR_RANGE    (4 * MB)
+#define PROCESS_STACK_ASLR_RANGE    (64 * MB) /* in 2M steps */
 
 /* This will change if we add support for more clocktypes */
 #define VVAR_NR_PAGES               2
@@ -55,7 +64,8 @@ typedef s64 sysreturn;
 // conditionalize
 // fix config/build, remove this include to take off network
 #include <net.h>
-boolean netsyscall_init(unix_heaps uh);
+boolean netsyscall_init(unix_heaps uh, tuple cfg);
+void netsyscall_netstat(buffer b);
 
 typedef struct process *process;
 typedef struct thread *thread;
@@ -171,6 +181,7 @@ thread blockq_wake_one(blockq bq);
 boolean blockq_wake_one_for_thread(blockq bq, thread t);
 void blockq_flush(blockq bq);
 boolean blockq_flush_thread(blockq bq, thread t);
+void blockq_set_exclusive(blockq bq, boolean exclusive);
 void blockq_set_completion(blockq bq, io_completion completion, thread t,
                            sysreturn rv);
 sysreturn blockq_check_timeout(blockq bq, thread t, blockq_action a, boolean in_bh, 
@@ -261,6 +272,11 @@ typedef struct thread {
     closure_struct(default_fault_handler, fault_handler);
     closure_struct(thread_demand_file_page, demand_file_page);
     closure_struct(thread_demand_file_page_complete, demand_file_page_complete);
+    struct list collapse_wait;      /* write held off by a huge page collapse */
+
+    /* last vmap found for this thread, valid while p->vmap_seq is unchanged */
+    struct vmap *vmap_cache;
+    u64 vmap_cache_seq;
 
     epoll select_epoll;
     int *clear_tid;
@@ -270,6 +286,12 @@ typedef struct thread {
     /* set by set_robust_list syscall */
     void *robust_list;
 
+    /* registered restartable sequence area; rseq_cpu is the cpu last
+       published to it */
+    struct rseq *rseq;
+    u32 rseq_sig;
+    int rseq_cpu;
+
     /* blockq thread is waiting on, INVALID_ADDRESS for uninterruptible */
     blockq blocked_on;
 
@@ -282,9 +304,13 @@ typedef struct thread {
     boolean sysctx;
     timestamp utime, stime;
     timestamp start_time;
+    u64 timer_slack_ns;             /* allowed lateness of sleeps and timeouts */
     int last_syscall;
     timestamp syscall_enter_ts;
     u64 syscall_time;
+    u64 syscall_start_cycles;       /* syscall entry, for latency histograms */
+    u64 syscall_enter_cycles;       /* last resumed */
+    u64 syscall_run_cycles;         /* run time before that */
 
     /* signals pending and saved state */
     struct sigstate signals;
@@ -295,7 +321,6 @@ typedef struct thread {
     u64 signal_stack_length;
 
     closure_struct(resume_syscall, deferred_syscall);
-    cpu_set_t affinity;    
 } *thread;
 
 typedef closure_type(file_io, sysreturn, void *buf, u64 length, u64 offset, thread t,
@@ -315,6 +340,8 @@ typedef closure_type(sg_file_io, sysreturn, sg_list sg, u64 length, u64 offset,
 #define FDESC_TYPE_TIMERFD     10
 #define FDESC_TYPE_SYMLINK     11
 #define FDESC_TYPE_IORING      12
+#define FDESC_TYPE_MEMFD       13
+#define FDESC_TYPE_INOTIFY     14
 
 typedef struct fdesc {
     file_io read, write;
@@ -333,6 +360,18 @@ typedef struct fdesc {
 #define IOV_MAX 1024
 
 #define FILE_READAHEAD_DEFAULT  (128 * KB)
+#define FILE_READAHEAD_MIN      (16 * KB)
+#define FILE_READAHEAD_MAX      (1 * MB)
+
+/* On-demand read-ahead state: the window [start, start + size) is the range
+   most recently submitted to the page cache; a read reaching into its last
+   async_size bytes triggers submission of the next (larger) window. */
+typedef struct file_ra {
+    u64 start;
+    u64 size;
+    u64 async_size;
+    u64 prev_end;               /* end of the previous read */
+} *file_ra;
 
 struct file {
     struct fdesc f;             /* must be first */
@@ -343,9 +382,14 @@ struct file {
             sg_io fs_read;
             sg_io fs_write;
             int fadv;           /* posix_fadvise advice */
+            struct file_ra ra;
+        };
+        struct {
+            tuple meta;         /* meta tuple for others */
+            vector dirents;     /* directory names read by getdents */
         };
-        tuple meta;             /* meta tuple for others */
     };
+    tuple parent;               /* directory the file was opened in */
     u64 offset;
     u64 length;
 };
@@ -360,6 +404,7 @@ typedef struct vmap {
     u32 allowed_flags;
     pagecache_node cache_node;
     u64 node_offset;
+    struct file_ra ra;
 } *vmap;
 
 typedef struct varea {
@@ -414,21 +459,28 @@ typedef struct process {
     id_heap           virtual32; /* for tracking low 32-bit space and MAP_32BIT maps */
 #endif
     id_heap           fdallocator;
+    struct spinlock   fdesc_lock; /* protects fdallocator and files */
     filesystem        root_fs;
     filesystem        cwd_fs;
     tuple             process_root;
     tuple             cwd;
-    table             futices;
+    struct futex_bucket *futices;
     fault_handler     handler;
     rbtree            threads;
     struct spinlock   threads_lock;
+    struct spinlock   thread_cache_lock;
+    thread            thread_cache[PROCESS_THREAD_CACHE_SIZE]; /* for create_thread() */
+    int               thread_cache_count;
     struct syscall   *syscalls;
     vector            files;
     rangemap          vareas;   /* available address space */
     struct spinlock   vmap_lock;
     rangemap          vmaps;    /* process mappings */
+    volatile u64      vmap_seq; /* odd while vmaps are being changed */
     vmap              stack_map;
     vmap              heap_map;
+    u64               stack_cache[PROCESS_STACK_CACHE_SIZE]; /* phys; under vmap_lock */
+    int               stack_cache_count;
     struct sigstate   signals;
     struct sigaction  sigactions[NSIG];
     id_heap           posix_timer_ids;
@@ -437,6 +489,8 @@ typedef struct process {
     id_heap           aio_ids;
     vector            aio;
     boolean           trace;
+    u64               affinity; /* default cpu mask for new threads */
+    u64               membarrier_registered; /* registered MEMBARRIER_CMD_* */
 } *process;
 
 typedef struct sigaction *sigaction;
@@ -569,14 +623,21 @@ static inline int fdesc_type(fdesc f)
     return f->type;
 }
 
+static inline void *fdesc_lookup(process p, int fd)
+{
+    spin_lock(&p->fdesc_lock);
+    void *f = vector_get(p->files, fd);
+    spin_unlock(&p->fdesc_lock);
+    return f;
+}
+
 static inline fdesc fdesc_get(process p, int fd)
 {
-    /* XXX To ensure atomicity, we need a mutex that protects against concurrent
-     * access to fdesc vector; the same mutex will have to be taken at every fd
-     * number allocation/deallocation. */
+    spin_lock(&p->fdesc_lock);
     fdesc f = vector_get(p->files, fd);
     if (f)
         fetch_and_add(&f->refcnt, 1);
+    spin_unlock(&p->fdesc_lock);
     return f;
 }
 
@@ -599,9 +660,14 @@ u64 allocate_fd_gte(process p, u64 min, void *f);
 
 void deallocate_fd(process p, int fd);
 
+/* Install f at an fd number that is already allocated. */
+void replace_fd(process p, int fd, void *f);
+
 void init_vdso(process p);
+void vdso_update_cputime(cpuinfo ci, timestamp base, timestamp start);
 
-void mmap_process_init(process p, boolean aslr);
+void mmap_process_init(process p, tuple root, boolean aslr);
+void prefault_user_stack(process p, u64 base, u64 length);
 
 /* This "validation" is just a simple limit check right now, but this
    could optionally expand to do more rigorous validation (e.g. vmap
@@ -693,6 +759,7 @@ static inline sigaction sigaction_from_sig(thread t, int signum)
 }
 
 boolean dispatch_signals(thread t);
+boolean rt_sigreturn_direct(thread t);
 void deliver_signal_to_thread(thread t, struct siginfo *);
 void deliver_signal_to_process(process p, struct siginfo *);
 void deliver_fault_signal(u32 signo, thread t, u64 vaddr, s32 si_code);
@@ -706,9 +773,16 @@ void setup_ucontext(struct ucontext * uctx, struct sigaction * sa,
                     struct siginfo * si, context f);
 void restore_ucontext(struct ucontext * uctx, context f);
 
-void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name);
+#define SYSCALL_F_NOTRACE 0x1
+#define SYSCALL_F_NOLOCK  0x2   /* may be dispatched without the kernel lock */
+#define SYSCALL_F_DIRECT  0x4   /* lockless, returns to user without rescheduling */
+
+void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name, int flags);
 
-#define register_syscall(m, n, f) _register_syscall(m, SYS_##n, f, #n)
+#define register_syscall(m, n, f) _register_syscall(m, SYS_##n, f, #n, 0)
+#define register_syscall_nolock(m, n, f) _register_syscall(m, SYS_##n, f, #n, SYSCALL_F_NOLOCK)
+#define register_syscall_direct(m, n, f) _register_syscall(m, SYS_##n, f, #n, \
+                                                           SYSCALL_F_NOLOCK | SYSCALL_F_DIRECT)
 
 void configure_syscalls(process p);
 boolean syscall_notrace(process p, int syscall);
@@ -721,13 +795,16 @@ static inline void count_syscall_save(thread t)
     if (do_syscall_stats && !t->syscall_complete) {
         t->syscall_time += usec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - t->syscall_enter_ts);
         t->syscall_enter_ts = 0;
+        t->syscall_run_cycles += rdtsc() - t->syscall_enter_cycles;
     }
 }
 
 static inline void count_syscall_resume(thread t)
 {
-    if (do_syscall_stats && !t->syscall_complete && t->syscall_enter_ts == 0)
+    if (do_syscall_stats && !t->syscall_complete && t->syscall_enter_ts == 0) {
         t->syscall_enter_ts = now(CLOCK_ID_MONOTONIC_RAW);
+        t->syscall_enter_cycles = rdtsc();
+    }
 }
 
 static inline void count_syscall_noreturn(thread t)
@@ -739,6 +816,8 @@ static inline void count_syscall_noreturn(thread t)
 }
 extern shutdown_handler print_syscall_stats;
 extern boolean do_syscall_stats;
+void configure_syscall_stats(tuple root);
+u64 *syscall_latency_hist(int *nbuckets);
 
 void register_file_syscalls(struct syscall *);
 void register_net_syscalls(struct syscall *);
@@ -755,16 +834,25 @@ void notify_unix_timers_of_rtc_change(void);
 
 boolean poll_init(unix_heaps uh);
 boolean pipe_init(unix_heaps uh);
+boolean memfd_init(unix_heaps uh);
 boolean unix_timers_init(unix_heaps uh);
 
 #define sysreturn_from_pointer(__x) ((s64)u64_from_pointer(__x));
 
 extern sysreturn syscall_ignore();
 boolean do_demand_page(u64 vaddr, vmap vm, context frame);
+boolean map_anonymous_huge_page(u64 vaddr, vmap vm, pageflags flags);
+void split_huge_mappings(range q);
+u64 process_anon_huge_pages(process p);
+boolean anon_collapse_write_fault(u64 vaddr, vmap vm, context frame);
+void hugepage_collapse_stats(buffer b);
+void unmap_and_free_user_phys(u64 vaddr, u64 length);
+void *pin_user_pages(process p, void *addr, u64 length);
+void unpin_user_pages(void *alias, u64 length);
 vmap vmap_from_vaddr(process p, u64 vaddr);
 void vmap_iterator(process p, vmap_handler vmh);
 boolean vmap_validate_range(process p, range q);
-void truncate_file_maps(process p, fsfile f, u64 new_length);
+void truncate_file_maps(process p, pagecache_node pn, u64 new_length);
 const char *string_from_mmap_type(int type);
 
 void thread_log_internal(thread t, const char *desc, ...);
@@ -834,7 +922,8 @@ static inline u64 iov_total_len(struct iovec *iov, int iovcnt)
     return len;
 }
 
-#define resolve_fd_noret(__p, __fd) vector_get(__p->files, __fd)
+/* The returned fdesc is not referenced; only use under the kernel lock. */
+#define resolve_fd_noret(__p, __fd) fdesc_lookup(__p, __fd)
 #define resolve_fd(__p, __fd) ({void *f ; if (!(f = resolve_fd_noret(__p, __fd))) return set_syscall_error(current, EBADF); f;})
 
 void init_syscalls();
@@ -842,9 +931,11 @@ void init_threads(process p);
 void init_futices(process p);
 
 sysreturn futex(int *uaddr, int futex_op, int val, u64 val2, int *uaddr2, int val3);
+sysreturn futex_waitv(struct futex_waitv *waiters, unsigned int nr_futexes, unsigned int flags,
+                      struct timespec *timeout, clockid_t clockid);
 sysreturn get_robust_list(int pid, void *head, u64 *len);
 sysreturn set_robust_list(void *head, u64 len);
-void wake_robust_list(process p, void *head);
+void wake_robust_list(process p, u32 tid, void *head);
 boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val);
 
 static inline boolean futex_wake_one_by_uaddr(process p, int *uaddr)
@@ -858,6 +949,14 @@ sysreturn io_getevents(aio_context_t ctx_id, long min_nr, long nr,
         struct io_event *events, struct timespec *timeout);
 sysreturn io_destroy(aio_context_t ctx_id);
 
+sysreturn fsync_internal(fdesc f, thread t, io_completion completion);
+void fixed_buffer_prefault(void *buf, u64 length);
+sysreturn file_fixed_io(fdesc desc, boolean write, void *buf, u64 length, u64 offset_arg,
+                        thread t, boolean bh, io_completion completion);
+sysreturn openat(int dirfd, const char *name, int flags, int mode);
+sysreturn statx_internal(int dirfd, const char *name, int flags, struct statx *buf);
+sysreturn madvise_internal(process p, void *addr, u64 length, int advice);
+
 sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params);
 sysreturn io_uring_mmap(fdesc desc, u64 len, pageflags mapflags, u64 offset);
 sysreturn io_uring_enter(int fd, unsigned int to_submit,
@@ -869,11 +968,31 @@ sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
 int do_pipe2(int fds[2], int flags);
 int pipe_set_capacity(fdesc f, int capacity);
 int pipe_get_capacity(fdesc f);
+u64 pipe_write_avail(fdesc f);
+void pipe_unread(fdesc f, sg_list sg, u64 length);
+sysreturn pipe_tee(fdesc in, fdesc out, u64 len, boolean nonblock);
 
 sysreturn socketpair(int domain, int type, int protocol, int sv[2]);
 
 int do_eventfd2(unsigned int count, int flags);
 
+sysreturn memfd_create(const char *name, unsigned int flags);
+pagecache_node memfd_get_cachenode(fdesc f);
+u32 memfd_perms(process p, fdesc f, boolean shared);
+sysreturn memfd_truncate(fdesc f, long length);
+sysreturn memfd_add_seals(fdesc f, u32 seals);
+sysreturn memfd_get_seals(fdesc f);
+
+sysreturn inotify_init(void);
+sysreturn inotify_init1(int flags);
+sysreturn inotify_add_watch(int fd, const char *pathname, u32 mask);
+sysreturn inotify_rm_watch(int fd, int wd);
+void inotify_event(tuple parent, symbol name, u32 mask, u32 cookie);
+void inotify_node_event(tuple parent, tuple n, u32 mask);
+void inotify_file_event(file f, u32 mask);
+void inotify_node_deleted(tuple n);
+void inotify_rename(tuple oldparent, symbol oldname, tuple newparent, tuple n, tuple replaced);
+
 void register_special_files(process p);
 sysreturn spec_open(file f);
 sysreturn spec_close(file f);
@@ -886,10 +1005,15 @@ u32 spec_events(file f);
 /* Values to pass as first argument to prctl() */
 #define PR_SET_NAME    15               /* Set process name */
 #define PR_GET_NAME    16               /* Get process name */
+#define PR_GET_TIMERSLACK   30          /* Get timer slack in nanoseconds */
+#define PR_SET_TIMERSLACK   29          /* Set timer slack; 0 restores the default */
+
+#define THREAD_TIMER_SLACK_DEFAULT_NS   50000
 
 /* getrandom(2) flags */
 #define GRND_NONBLOCK               1
 #define GRND_RANDOM                 2
+#define GRND_INSECURE               4
 
 #define SIGNAL_STACK_SIZE 8192
 
@@ -11,6 +11,19 @@ extern unsigned char vdso_raw[];
 
 #define __vdso_dat (&(VVAR_REF(vdso_dat)))
 
+/* Publish the CPU time of the thread about to run on this cpu; only the cpu
+   itself writes its slot. */
+void vdso_update_cputime(cpuinfo ci, timestamp base, timestamp start)
+{
+    struct vdso_cputime *ct = &__vdso_dat->cputime[ci->id];
+    ct->seq++;
+    write_barrier();
+    ct->base = base;
+    ct->start = start;
+    write_barrier();
+    ct->seq++;
+}
+
 void init_vdso(process p)
 {
     physical paddr;
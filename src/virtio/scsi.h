@@ -73,6 +73,8 @@ struct scsi_sense_data_extra {
 
 #define SCSI_CMD_TEST_UNIT_READY        0x00
 #define SCSI_CMD_INQUIRY                0x12
+#define SCSI_CMD_SYNCHRONIZE_CACHE_10   0x35
+#define SCSI_CMD_UNMAP                  0x42
 #define SCSI_CMD_READ_16                0x88
 #define SCSI_CMD_WRITE_16               0x8a
 #define SCSI_CMD_SERVICE_ACTION         0x9e
@@ -294,6 +296,30 @@ struct scsi_res_read_capacity_16
     u8 reserved[16];
 } __attribute__((packed));
 
+struct scsi_cdb_unmap
+{
+    u8 opcode;
+#define SU_ANCHOR               0x01
+    u8 byte2;
+    u8 reserved[4];
+    u8 group;
+    u16 length;
+    u8 control;
+} __attribute__((packed));
+
+/* parameter list with a single block descriptor */
+struct scsi_unmap_param
+{
+    u16 length;                 /* excluding this field */
+    u16 desc_length;
+    u8 reserved[4];
+    struct scsi_unmap_desc {
+        u64 addr;
+        u32 length;
+        u8 reserved[4];
+    } desc;
+} __attribute__((packed));
+
 struct scsi_cdb_report_luns
 {
     u8 opcode;
@@ -57,12 +57,19 @@ void vtdev_set_status(vtdev dev, u8 status)
 
 status virtio_alloc_virtqueue(vtdev dev, const char *name, int idx, queue sched_queue,
                               struct virtqueue **result)
+{
+    return virtio_alloc_virtqueue_cpu(dev, name, idx, sched_queue, 0, result);
+}
+
+/* target_cpu is only a hint; MMIO and INTx interrupts are not steered */
+status virtio_alloc_virtqueue_cpu(vtdev dev, const char *name, int idx, queue sched_queue,
+                                  u32 target_cpu, struct virtqueue **result)
 {
     switch (dev->transport) {
     case VTIO_TRANSPORT_MMIO:
         return vtmmio_alloc_virtqueue((vtmmio)dev, name, idx, sched_queue, result);
     case VTIO_TRANSPORT_PCI:
-        return vtpci_alloc_virtqueue((vtpci)dev, name, idx, sched_queue, result);
+        return vtpci_alloc_virtqueue_cpu((vtpci)dev, name, idx, sched_queue, target_cpu, result);
     default:
         return timm("status", "unknown transport %d", dev->transport);
     }
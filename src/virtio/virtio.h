@@ -1,5 +1,6 @@
 void init_virtio_balloon(kernel_heaps kh);
 void init_virtio_blk(kernel_heaps kh, storage_attach a);
+void init_virtio_console(kernel_heaps kh);
 void init_virtio_network(kernel_heaps kh);
 void init_virtio_scsi(kernel_heaps kh, storage_attach a);
 
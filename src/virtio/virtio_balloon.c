@@ -21,6 +21,14 @@
 #endif
 
 #define VIRTIO_BALLOON_RETRY_INTERVAL_SEC 5
+#define VIRTIO_BALLOON_REPORT_INTERVAL_SEC 2
+
+/* Maximum number of chunks handed to the device in one report. */
+#define VIRTIO_BALLOON_REPORT_CAPACITY 32
+
+/* Growth of free memory, over its lowest point since the last sweep, that
+   starts a new free page reporting sweep. */
+#define VIRTIO_BALLOON_REPORT_THRESHOLD (64 * MB)
 
 /* Virtio interface is always 4K pages. */
 #define VIRTIO_BALLOON_PAGE_ORDER PAGELOG
@@ -34,6 +42,9 @@
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST 1
 #define VIRTIO_BALLOON_F_STATS_VQ       2
 #define VIRTIO_BALLOON_F_DEFLATE_ON_OOM 4
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT 8
+#define VIRTIO_BALLOON_F_PAGE_POISON    16
+#define VIRTIO_BALLOON_F_PAGE_REPORTING 32
 
 struct virtio_balloon_stat {
 #define VIRTIO_BALLOON_S_SWAP_IN      0
@@ -55,6 +66,10 @@ struct virtio_balloon_stat {
 
 declare_closure_struct(0, 1, void, virtio_balloon_timer_task,
                        u64, overruns);
+declare_closure_struct(0, 1, void, virtio_balloon_report_task,
+                       u64, overruns);
+declare_closure_struct(0, 1, void, virtio_balloon_report_complete,
+                       u64, len);
 struct virtio_balloon {
     heap general;
     backed_heap backed;
@@ -71,6 +86,16 @@ struct virtio_balloon {
     u32 actual_pages;
     struct list in_balloon;
     struct list free;
+
+    /* free page reporting */
+    virtqueue reportq;
+    closure_struct(virtio_balloon_report_task, report_task);
+    closure_struct(virtio_balloon_report_complete, report_complete);
+    u64 report_addrs[VIRTIO_BALLOON_REPORT_CAPACITY];
+    int report_count;           /* chunks held by the device */
+    boolean report_sweeping;
+    u64 report_next;            /* sweep cursor */
+    u64 report_low;             /* lowest free memory since last sweep */
 } virtio_balloon;
 
 typedef struct balloon_page {
@@ -98,6 +123,11 @@ static inline boolean balloon_has_stats_vq(void)
     return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_STATS_VQ) != 0;
 }
 
+static inline boolean balloon_has_page_reporting(void)
+{
+    return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_PAGE_REPORTING) != 0;
+}
+
 static u64 phys_base_from_balloon_page(balloon_page bp)
 {
     return bp->addrs[0] << VIRTIO_BALLOON_PAGE_ORDER;
@@ -245,9 +275,9 @@ void virtio_balloon_update(void)
             if (!virtio_balloon.retry_timer) {
                 virtio_balloon_debug("   starting timer\n");
                 virtio_balloon.retry_timer =
-                    register_timer(runloop_timers, CLOCK_ID_MONOTONIC,
-                                   seconds(VIRTIO_BALLOON_RETRY_INTERVAL_SEC),
-                                   false, 0, (timer_handler)&virtio_balloon.timer_task);
+                    kern_register_timer(CLOCK_ID_MONOTONIC,
+                                        seconds(VIRTIO_BALLOON_RETRY_INTERVAL_SEC),
+                                        false, 0, (timer_handler)&virtio_balloon.timer_task);
             }
         }
     } else if (delta < 0) {
@@ -344,6 +374,96 @@ static void virtio_balloon_init_statsq(void)
     vqmsg_commit(vq, m, c);
 }
 
+/* Free page reporting
+
+   Chunks of free memory are taken out of the physical heap a batch at a
+   time and handed to the device, which may then discard their backing on
+   the host. The chunks go back to the heap once the device returns the
+   batch; their contents are undefined from then on, which is fine for
+   memory nobody owns. A cursor walks up the physical address space so
+   that a sweep reports each free chunk once. Since the id heap can't tell
+   us which chunks were freed after being reported, a new sweep begins
+   when free memory has grown enough over its lowest point since the last
+   sweep; a sweep continues without delay while the device keeps up. */
+static void virtio_balloon_report(void)
+{
+    virtqueue vq = virtio_balloon.reportq;
+    heap phys = (heap)virtio_balloon.physical;
+    int capacity = MIN(VIRTIO_BALLOON_REPORT_CAPACITY, virtqueue_entries(vq));
+    int n;
+    assert(virtio_balloon.report_count == 0);
+    for (n = 0; n < capacity; n++) {
+        if (heap_free(phys) < (BALLOON_MEMORY_MINIMUM + VIRTIO_BALLOON_ALLOC_SIZE))
+            break;
+        u64 a = id_heap_alloc_subrange(virtio_balloon.physical, VIRTIO_BALLOON_ALLOC_SIZE,
+                                       virtio_balloon.report_next, infinity);
+        if (a == INVALID_PHYSICAL) {
+            virtio_balloon_debug("%s: sweep done\n", __func__);
+            virtio_balloon.report_sweeping = false;
+            break;
+        }
+        virtio_balloon.report_addrs[n] = a;
+        virtio_balloon.report_next = a + VIRTIO_BALLOON_ALLOC_SIZE;
+    }
+    if (n == 0) {
+        virtio_balloon.report_sweeping = false;
+        virtio_balloon.report_low = heap_free(phys);
+        return;
+    }
+
+    virtio_balloon_verbose("%s: reporting %d chunks, next 0x%lx\n", __func__, n,
+                           virtio_balloon.report_next);
+    vqmsg m = allocate_vqmsg(vq);
+    assert(m != INVALID_ADDRESS);
+    for (int i = 0; i < n; i++)
+        vqmsg_push(vq, m, virtio_balloon.report_addrs[i], VIRTIO_BALLOON_ALLOC_SIZE, true);
+    virtio_balloon.report_count = n;
+    vqmsg_commit(vq, m, (vqfinish)&virtio_balloon.report_complete);
+}
+
+define_closure_function(0, 1, void, virtio_balloon_report_complete,
+                        u64, len)
+{
+    heap phys = (heap)virtio_balloon.physical;
+    for (int i = 0; i < virtio_balloon.report_count; i++)
+        deallocate_u64(phys, virtio_balloon.report_addrs[i], VIRTIO_BALLOON_ALLOC_SIZE);
+    virtio_balloon.report_count = 0;
+    if (virtio_balloon.report_sweeping)
+        virtio_balloon_report();
+    else
+        virtio_balloon.report_low = heap_free(phys);
+}
+
+define_closure_function(0, 1, void, virtio_balloon_report_task,
+                        u64, overruns)
+{
+    if (virtio_balloon.report_count > 0 || virtio_balloon.report_sweeping)
+        return;
+    u64 free = heap_free((heap)virtio_balloon.physical);
+    if (free < virtio_balloon.report_low)
+        virtio_balloon.report_low = free;
+    if (free - virtio_balloon.report_low < VIRTIO_BALLOON_REPORT_THRESHOLD)
+        return;
+    virtio_balloon_debug("%s: starting sweep, free %ld, low %ld\n", __func__,
+                         free, virtio_balloon.report_low);
+    virtio_balloon.report_sweeping = true;
+    virtio_balloon.report_next = 0;
+    virtio_balloon_report();
+}
+
+static void virtio_balloon_init_reporting(void)
+{
+    virtio_balloon_debug("%s\n", __func__);
+    init_closure(&virtio_balloon.report_complete, virtio_balloon_report_complete);
+    init_closure(&virtio_balloon.report_task, virtio_balloon_report_task);
+    virtio_balloon.report_count = 0;
+    virtio_balloon.report_low = 0;  /* report everything free at boot */
+    virtio_balloon.report_sweeping = false;
+    kern_register_timer(CLOCK_ID_MONOTONIC, seconds(VIRTIO_BALLOON_REPORT_INTERVAL_SEC), false,
+                        seconds(VIRTIO_BALLOON_REPORT_INTERVAL_SEC),
+                        (timer_handler)&virtio_balloon.report_task);
+}
+
 define_closure_function(0, 1, void, virtio_balloon_timer_task,
                         u64, overruns)
 {
@@ -390,6 +510,15 @@ static boolean virtio_balloon_attach(heap general, backed_heap backed, id_heap p
     } else {
         virtio_balloon.statsq = 0;
     }
+    if (balloon_has_page_reporting()) {
+        /* queue indices are assigned in order to the queues present */
+        s = virtio_alloc_virtqueue(v, "virtio balloon reportq", balloon_has_stats_vq() ? 3 : 2,
+                                   runqueue, &virtio_balloon.reportq);
+        if (!is_ok(s))
+            goto fail;
+    } else {
+        virtio_balloon.reportq = 0;
+    }
     virtio_balloon_debug("   virtqueues allocated, setting driver status OK\n");
     vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
     update_actual_pages(0);
@@ -399,6 +528,8 @@ static boolean virtio_balloon_attach(heap general, backed_heap backed, id_heap p
     mm_register_balloon_deflater(bd);
     if (balloon_has_stats_vq())
         virtio_balloon_init_statsq();
+    if (balloon_has_page_reporting())
+        virtio_balloon_init_reporting();
     return true;
   fail:
     rprintf("%s: failed to attach: %v\n", __func__, s);
@@ -416,7 +547,8 @@ closure_function(3, 1, boolean, vtpci_balloon_probe,
     virtio_balloon_debug("   attaching\n", __func__);
     vtdev v = (vtdev)attach_vtpci(bound(general), bound(backed), d,
                                   (VIRTIO_BALLOON_F_STATS_VQ |
-                                   VIRTIO_BALLOON_F_MUST_TELL_HOST));
+                                   VIRTIO_BALLOON_F_MUST_TELL_HOST |
+                                   VIRTIO_BALLOON_F_PAGE_REPORTING));
     return virtio_balloon_attach(bound(general), bound(backed), bound(physical), v);
 }
 
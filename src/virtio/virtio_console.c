@@ -0,0 +1,211 @@
+#include <kernel.h>
+#include <drivers/console.h>
+
+#include "virtio_internal.h"
+#include "virtio_mmio.h"
+#include "virtio_pci.h"
+
+//#define VIRTIO_CONSOLE_DEBUG
+#ifdef VIRTIO_CONSOLE_DEBUG
+#define virtio_console_debug(x, ...) do {rprintf("VTCON: " x, ##__VA_ARGS__);} while(0)
+#else
+#define virtio_console_debug(x, ...)
+#endif
+
+/* Console output through the transmit queue of port 0. Writes are copied
+   into a pool of DMA buffers, each of which goes to the device as a single
+   descriptor once full or at the end of a series of writes (the console
+   flush), so that a drain of buffered program output costs a kick rather
+   than a trapped access per byte as with the serial port. */
+
+#define VIRTIO_CONSOLE_FEATURES VIRTIO_F_RING_EVENT_IDX
+
+/* queues of port 0 */
+#define VIRTIO_CONSOLE_RXQ      0
+#define VIRTIO_CONSOLE_TXQ      1
+
+#define VIRTIO_CONSOLE_BUFS     16  /* at most 64 */
+#define VIRTIO_CONSOLE_BUF_SIZE (4 * KB)
+
+/* how long a write waits for the device to free a buffer before the
+   output is dropped */
+#define VIRTIO_CONSOLE_WAIT_MS  100
+
+typedef struct virtio_console {
+    struct console_driver c;    /* must be first */
+    vtdev dev;
+    virtqueue txq;
+    void *bufs;
+    u64 bufs_phys;
+    vqfinish complete[VIRTIO_CONSOLE_BUFS];
+    u64 busy;                   /* buffers held by the device; bit per buffer */
+    int cur;                    /* buffer being filled, or -1 */
+    bytes cur_len;
+    boolean queued;             /* buffers queued since the last kick */
+} *virtio_console;
+
+closure_function(2, 1, void, virtio_console_tx_complete,
+                 virtio_console, vc, int, buf,
+                 u64, len)
+{
+    __sync_fetch_and_and(&bound(vc)->busy, ~U64_FROM_BIT(bound(buf)));
+}
+
+/* Reap completions without waiting for the queue interrupt, which may not
+   come while interrupts are disabled. */
+static void virtio_console_reap(virtio_console vc)
+{
+    boolean more;
+    virtqueue_poll(vc->txq, VIRTIO_CONSOLE_BUFS, &more);
+}
+
+static void virtio_console_kick(virtio_console vc)
+{
+    if (vc->queued) {
+        virtqueue_kick(vc->txq);
+        vc->queued = false;
+    }
+}
+
+/* Returns a free buffer index or -1, waiting up to timeout for one. */
+static int virtio_console_get_buf(virtio_console vc, timestamp timeout)
+{
+    timestamp deadline = 0;
+    while (1) {
+        u64 busy = *(volatile u64 *)&vc->busy;
+        u64 avail = ~busy & MASK(VIRTIO_CONSOLE_BUFS);
+        if (avail)
+            return lsb(avail);
+        virtio_console_kick(vc);
+        virtio_console_reap(vc);
+        if (vc->busy != busy)
+            continue;
+        timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+        if (!deadline)
+            deadline = t + timeout;
+        else if (t >= deadline)
+            return -1;
+        kern_pause();
+    }
+}
+
+static void virtio_console_submit(virtio_console vc)
+{
+    int i = vc->cur;
+    vqmsg m = allocate_vqmsg(vc->txq);
+    if (m == INVALID_ADDRESS) {
+        __sync_fetch_and_and(&vc->busy, ~U64_FROM_BIT(i));
+    } else {
+        vqmsg_push(vc->txq, m, vc->bufs_phys + i * VIRTIO_CONSOLE_BUF_SIZE, vc->cur_len, false);
+        vqmsg_queue(vc->txq, m, vc->complete[i]);
+        vc->queued = true;
+    }
+    vc->cur = -1;
+}
+
+/* called with the console write lock held */
+static void virtio_console_write(void *d, const char *s, bytes count)
+{
+    virtio_console vc = d;
+    while (count > 0) {
+        if (vc->cur < 0) {
+            int i = virtio_console_get_buf(vc, milliseconds(VIRTIO_CONSOLE_WAIT_MS));
+            if (i < 0)
+                return;         /* device stalled; drop the output */
+            __sync_fetch_and_or(&vc->busy, U64_FROM_BIT(i));
+            vc->cur = i;
+            vc->cur_len = 0;
+        }
+        bytes n = MIN(count, VIRTIO_CONSOLE_BUF_SIZE - vc->cur_len);
+        runtime_memcpy(vc->bufs + vc->cur * VIRTIO_CONSOLE_BUF_SIZE + vc->cur_len, s, n);
+        vc->cur_len += n;
+        s += n;
+        count -= n;
+        if (vc->cur_len == VIRTIO_CONSOLE_BUF_SIZE)
+            virtio_console_submit(vc);
+    }
+}
+
+/* Once shutting down, wait for the device to take everything, as the
+   machine may be gone before the queue is serviced. */
+static void virtio_console_flush(void *d)
+{
+    virtio_console vc = d;
+    if (vc->cur >= 0)
+        virtio_console_submit(vc);
+    virtio_console_kick(vc);
+    if (!shutting_down)
+        return;
+    timestamp deadline = now(CLOCK_ID_MONOTONIC_RAW) + milliseconds(VIRTIO_CONSOLE_WAIT_MS);
+    while (vc->busy && now(CLOCK_ID_MONOTONIC_RAW) < deadline) {
+        virtio_console_reap(vc);
+        kern_pause();
+    }
+}
+
+static void virtio_console_attach(heap general, backed_heap backed, vtdev v)
+{
+    virtio_console_debug("%s: dev_features 0x%lx, features 0x%lx\n", __func__,
+                         v->dev_features, v->features);
+    virtio_console vc = allocate_zero(general, sizeof(struct virtio_console));
+    assert(vc != INVALID_ADDRESS);
+    vc->dev = v;
+    vc->cur = -1;
+    vc->bufs = alloc_map(backed, VIRTIO_CONSOLE_BUFS * VIRTIO_CONSOLE_BUF_SIZE, &vc->bufs_phys);
+    if (vc->bufs == INVALID_ADDRESS) {
+        msg_err("failed to allocate buffers\n");
+        goto fail;
+    }
+    for (int i = 0; i < VIRTIO_CONSOLE_BUFS; i++) {
+        vc->complete[i] = closure(general, virtio_console_tx_complete, vc, i);
+        assert(vc->complete[i] != INVALID_ADDRESS);
+    }
+    status s = virtio_alloc_virtqueue(v, "virtio console txq", VIRTIO_CONSOLE_TXQ, bhqueue,
+                                      &vc->txq);
+    if (!is_ok(s)) {
+        msg_err("failed to allocate transmit queue: %v\n", s);
+        timm_dealloc(s);
+        goto fail;
+    }
+    vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
+
+    vc->c.write = virtio_console_write;
+    vc->c.flush = virtio_console_flush;
+    vc->c.name = "virtio";
+    vc->c.preferred = true;
+    attach_console_driver(&vc->c);
+    virtio_console_debug("attached\n");
+    return;
+  fail:
+    vtdev_set_status(v, VIRTIO_CONFIG_STATUS_FAILED);
+}
+
+closure_function(2, 1, boolean, vtpci_console_probe,
+                 heap, general, backed_heap, backed,
+                 pci_dev, d)
+{
+    if (!vtpci_probe(d, VIRTIO_ID_CONSOLE))
+        return false;
+    virtio_console_debug("%s: attaching\n", __func__);
+    vtdev v = (vtdev)attach_vtpci(bound(general), bound(backed), d, VIRTIO_CONSOLE_FEATURES);
+    virtio_console_attach(bound(general), bound(backed), v);
+    return true;
+}
+
+closure_function(2, 1, void, vtmmio_console_probe,
+                 heap, general, backed_heap, backed,
+                 vtmmio, d)
+{
+    if (vtmmio_get_u32(d, VTMMIO_OFFSET_DEVID) != VIRTIO_ID_CONSOLE)
+        return;
+    virtio_console_debug("%s: attaching\n", __func__);
+    if (attach_vtmmio(bound(general), bound(backed), d, VIRTIO_CONSOLE_FEATURES))
+        virtio_console_attach(bound(general), bound(backed), &d->virtio_dev);
+}
+
+void init_virtio_console(kernel_heaps kh)
+{
+    heap h = heap_locked(kh);
+    register_pci_driver(closure(h, vtpci_console_probe, h, kh->backed));
+    vtmmio_probe_devs(stack_closure(vtmmio_console_probe, h, kh->backed));
+}
@@ -59,6 +59,9 @@ typedef closure_type(vqfinish, void, u64);
 /* Modern device */
 #define VIRTIO_F_VERSION_1 U64_FROM_BIT(32)
 
+/* Packed virtqueue layout */
+#define VIRTIO_F_RING_PACKED U64_FROM_BIT(34)
+
 typedef closure_type(vtdev_notify, void, u16 queue_index, bytes notify_offset);
 
 typedef struct vtdev {
@@ -95,6 +98,8 @@ static inline void virtio_attach(heap h, backed_heap page_allocator,
 
 status virtio_alloc_virtqueue(vtdev dev, const char *name, int idx, queue sched_queue,
                               struct virtqueue **result);
+status virtio_alloc_virtqueue_cpu(vtdev dev, const char *name, int idx, queue sched_queue,
+                                  u32 target_cpu, struct virtqueue **result);
 status virtio_register_config_change_handler(vtdev dev, thunk handler, queue sched_queue);
 
 status virtqueue_alloc(vtdev dev,
@@ -108,6 +113,8 @@ status virtqueue_alloc(vtdev dev,
                        queue sched_queue);
 
 void virtqueue_set_max_queued(virtqueue, int);
+void virtqueue_set_poller(virtqueue vq, poller p);
+int virtqueue_poll(virtqueue vq, int budget, boolean *more);
 
 /* The Host uses this in used->flags to advise the Guest: don't kick me
  * when you add a buffer.  It's unreliable, so it's simply an
@@ -129,3 +136,5 @@ vqmsg allocate_vqmsg(virtqueue vq);
 void deallocate_vqmsg(virtqueue vq, vqmsg m);
 void vqmsg_push(virtqueue vq, vqmsg m, u64 phys_addr, u32 len, boolean write);
 void vqmsg_commit(virtqueue vq, vqmsg m, vqfinish completion);
+void vqmsg_queue(virtqueue vq, vqmsg m, vqfinish completion);
+void virtqueue_kick(virtqueue vq);
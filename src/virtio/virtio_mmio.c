@@ -101,7 +101,7 @@ void vtmmio_set_status(vtmmio dev, u8 status)
 static boolean vtmmio_negotatiate_features(vtmmio dev, u64 mask)
 {
     vtdev virtio_dev = &dev->virtio_dev;
-    mask |= VIRTIO_F_VERSION_1;
+    mask |= VIRTIO_F_VERSION_1 | VIRTIO_F_RING_PACKED;
 
     vtmmio_set_u32(dev, VTMMIO_OFFSET_DEVFEATSEL, 1);
     virtio_dev->dev_features = vtmmio_get_u32(dev, VTMMIO_OFFSET_DEVFEATURES);
@@ -31,6 +31,7 @@
  */
 
 #include <kernel.h>
+#include <net.h>
 #include "lwip/opt.h"
 #include "lwip/def.h"
 #include "lwip/mem.h"
@@ -40,6 +41,7 @@
 #include "lwip/ethip6.h"
 #include "lwip/etharp.h"
 #include "lwip/dhcp.h"
+#include "lwip/prot/ip.h"
 #include "lwip/timeouts.h"
 #include "netif/ethernet.h"
 #include "virtio_internal.h"
@@ -53,80 +55,132 @@
 # define virtio_net_debug(...) do { } while(0)
 #endif // defined(VIRTIO_NET_DEBUG)
 
+/* IPv6 fixed header */
+#define VNET_IP6_HLEN       40
+
+/* receive messages kept posted when each must hold a coalesced segment */
+#define VNET_LARGE_RXMSGS   16
+
+/* max_virtqueue_pairs is the low half of the dword at this config offset */
+#define VIRTIO_NET_R_MAX_VQ_PAIRS_DWORD 8
+
+declare_closure_struct(1, 0, void, vnet_rx_refill,
+                       struct vnet_rxq *, rxq);
+declare_closure_struct(1, 1, boolean, vnet_rx_poll,
+                       struct vnet_rxq *, rxq,
+                       u32, budget);
+declare_closure_struct(1, 1, void, vnet_rx_coal_set,
+                       struct vnet_rxq *, rxq,
+                       u64, len);
+
+/* control queue command setting the notification coalescing of a receive
+   queue, or of all of them */
+struct vnet_ctrl_coal {
+    struct virtio_net_ctrl_hdr hdr;
+    struct virtio_net_ctrl_coal_vq vq;
+    u8 ack;
+};
+
+/* receive virtqueue, with the packet being merged from its buffers */
+typedef struct vnet_rxq {
+    struct vnet *vn;
+    struct virtqueue *vq;
+    struct pbuf *head;
+    u16 remain;                 /* buffers still to come for head */
+    struct virtio_net_hdr hdr;
+    int posted;                 /* receive messages with the device */
+    boolean refill_pending;
+    closure_struct(vnet_rx_refill, refill);
+    struct poller poller;       /* completions are polled, NAPI style */
+    closure_struct(vnet_rx_poll, poll);
+    struct net_dim dim;
+    u64 dim_packets, dim_bytes; /* delivered since the last poll ended */
+    struct vnet_ctrl_coal *coal;
+    u64 coal_phys;
+    u8 coal_profile;            /* as last set in the device */
+    boolean coal_pending;
+    closure_struct(vnet_rx_coal_set, coal_set);
+} *vnet_rxq;
+
+/* notification coalescing of receive queues */
+enum vnet_coal {
+    VNET_COAL_NONE,
+    VNET_COAL_GLOBAL,           /* one setting for all, driven by queue 0 */
+    VNET_COAL_VQ,               /* per queue */
+};
+
+/* control queue command enabling multiple queue pairs */
+struct vnet_ctrl_mq {
+    struct virtio_net_ctrl_hdr hdr;
+    struct virtio_net_ctrl_mq mq;
+    u8 ack;
+};
+
 typedef struct vnet {
     vtdev dev;
     u16 port;
-    heap rxbuffers;
+    dma_pool rxbuffers;         /* shared by all receive queues */
+    heap transient;             /* tx completions */
     bytes net_header_len;
     int rxbuflen;
+    int rxbufs;                 /* per receive message */
+    int rxfill;                 /* receive messages kept posted */
+    boolean mrg_rxbuf;          /* packets may span several receive buffers */
+    boolean tx_csum;            /* TCP checksums completed by the device */
+    boolean rx_csum;            /* TCP and UDP checksums verified here, not by lwIP */
+    dma_pool txhdrs;            /* headers of packets with checksum offload, all queues */
     struct netif *n;
-    struct virtqueue *txq;
-    struct virtqueue *rxq;
+    int nqueues;                /* queue pairs, one per cpu up to the device max */
+    int ntxqs;                  /* transmit queues the device has enabled */
+    struct virtqueue **txqs;    /* transmit queue i serves cpus i, i + ntxqs, ... */
+    thunk *txkicks;             /* notify the device at the end of a tx batch */
+    struct vnet_rxq *rxqs;
     struct virtqueue *ctl;
+    enum vnet_coal rx_coal;
+    struct vnet_ctrl_mq *ctrl_mq;
+    u64 ctrl_mq_phys;
     u64 empty_phys;
     void *empty; // just a mac..fix, from pre-heap days
 } *vnet;
 
+declare_closure_struct(2, 1, void, input,
+                       vnet_rxq, rxq, struct xpbuf *, x,
+                       u64, len);
+
+/* A receive buffer carries its own completion, so neither is allocated
+   per packet. */
 typedef struct xpbuf
 {
     struct pbuf_custom p;
     vnet vn;
+    u64 phys;
+    struct xpbuf *next;         /* in the same receive message */
+    closure_struct(input, complete);
 } *xpbuf;
 
 
-closure_function(1, 1, void, tx_complete,
-                 struct pbuf *, p,
+closure_function(4, 1, void, tx_complete,
+                 struct pbuf *, p, vnet, vn, void *, hdr, u64, hdr_phys,
                  u64, len)
 {
     // unfortunately we dont have control over the allocation
     // path (?)
     // free me!
     pbuf_free(bound(p));
+    if (bound(hdr))
+        dma_pool_put(bound(vn)->txhdrs, bound(hdr), bound(hdr_phys));
     closure_finish();
 }
 
-
-static err_t low_level_output(struct netif *netif, struct pbuf *p)
-{
-    vnet vn = netif->state;
-
-    vqmsg m = allocate_vqmsg(vn->txq);
-    assert(m != INVALID_ADDRESS);
-    vqmsg_push(vn->txq, m, vn->empty_phys, vn->net_header_len, false);
-
-    pbuf_ref(p);
-
-    for (struct pbuf * q = p; q != NULL; q = q->next)
-        vqmsg_push(vn->txq, m, physical_from_virtual(q->payload), q->len, false);
-
-    vqmsg_commit(vn->txq, m, closure(vn->dev->general, tx_complete, p));
-    
-    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
-    if (((u8_t *)p->payload)[0] & 1) {
-        /* broadcast or multicast packet*/
-        MIB2_STATS_NETIF_INC(netif, ifoutnucastpkts);
-    } else {
-        /* unicast packet */
-        MIB2_STATS_NETIF_INC(netif, ifoutucastpkts);
-    }
-    /* increase ifoutdiscards or ifouterrors on error */
-
-    LINK_STATS_INC(link.xmit);
-
-    return ERR_OK;
-}
-
-static void receive_buffer_release(struct pbuf *p)
+closure_function(1, 0, void, vnet_tx_kick,
+                 virtqueue, vq)
 {
-    xpbuf x  = (void *)p;
-    deallocate(x->vn->rxbuffers, x, x->vn->rxbuflen + sizeof(struct xpbuf));
+    virtqueue_kick(bound(vq));
 }
 
-static void post_receive(vnet vn);
-
-static u16 vnet_csum(u8 *buf, u64 len)
+/* ones' complement sum of buf, added to sum and folded to 16 bits */
+static u16 vnet_sum(u8 *buf, u64 len, u64 sum)
 {
-    u64 sum = 0;
     while (len >= sizeof(u64)) {
         u64 s = *(u64 *)buf;
         sum += s;
@@ -169,72 +223,387 @@ static u16 vnet_csum(u8 *buf, u64 len)
     s3 += s4;
     if (s3 < s4)
         s3++;
-    return ~s3;
+    return s3;
 }
 
-closure_function(1, 1, void, input,
-                 xpbuf, x,
-                 u64, len)
+/* transport header of an unfragmented TCP or UDP packet */
+typedef struct vnet_l4 {
+    u8 proto;
+    u16 start;          /* frame offset of the transport header */
+    u16 csum_offset;    /* of the checksum field within the transport header */
+    u16 len;            /* transport header and payload */
+    u64 sum;            /* of the pseudo-header */
+} *vnet_l4;
+
+/* Headers are looked up in the first len bytes of the frame; IPv6 extension
+   headers are not followed. */
+static boolean vnet_parse_l4(u8 *frame, u64 len, vnet_l4 l4)
+{
+    if (len < SIZEOF_ETH_HDR)
+        return false;
+    u16 type = ((struct eth_hdr *)frame)->type;
+    u64 off = SIZEOF_ETH_HDR;
+    if (type == PP_HTONS(ETHTYPE_VLAN)) {
+        if (len < off + SIZEOF_VLAN_HDR)
+            return false;
+        type = ((struct eth_vlan_hdr *)(frame + off))->tpid;
+        off += SIZEOF_VLAN_HDR;
+    }
+    u8 *ip = frame + off;
+    u16 *addrs;
+    int naddrs;
+    if (type == PP_HTONS(ETHTYPE_IP)) {
+        if (len < off + 20)
+            return false;
+        u64 hlen = (ip[0] & 0xf) << 2;
+        u64 total = (ip[2] << 8) | ip[3];
+        /* the checksum of a fragment covers the whole datagram */
+        if ((hlen < 20) || (total < hlen) || (ip[6] & 0x3f) || ip[7])
+            return false;
+        l4->proto = ip[9];
+        l4->len = total - hlen;
+        addrs = (u16 *)(ip + 12);
+        naddrs = 2 * sizeof(u32) / sizeof(u16);
+        off += hlen;
+    } else if (type == PP_HTONS(ETHTYPE_IPV6)) {
+        if (len < off + VNET_IP6_HLEN)
+            return false;
+        l4->proto = ip[6];
+        l4->len = (ip[4] << 8) | ip[5];
+        addrs = (u16 *)(ip + 8);
+        naddrs = 2 * 16 / sizeof(u16);
+        off += VNET_IP6_HLEN;
+    } else {
+        return false;
+    }
+    switch (l4->proto) {
+    case IP_PROTO_TCP:
+        l4->csum_offset = 16;
+        break;
+    case IP_PROTO_UDP:
+        l4->csum_offset = 6;
+        break;
+    default:
+        return false;
+    }
+    if (off + l4->csum_offset + sizeof(u16) > len)
+        return false;
+    l4->start = off;
+    l4->sum = lwip_htons(l4->proto) + lwip_htons(l4->len);
+    for (int i = 0; i < naddrs; i++)
+        l4->sum += addrs[i];
+    return true;
+}
+
+/* Zero-copy sends leave payloads in user pages, pinned and mapped at a
+   kernel alias for as long as lwIP holds them, which is only physically
+   contiguous within a page. */
+static void vnet_tx_push(virtqueue txq, vqmsg m, void *va, u64 len)
+{
+    while (len > 0) {
+        u64 n = MIN(len, PAGESIZE - (u64_from_pointer(va) & PAGEMASK));
+        vqmsg_push(txq, m, physical_from_virtual(va), n, false);
+        va += n;
+        len -= n;
+    }
+}
+
+static err_t low_level_output(struct netif *netif, struct pbuf *p)
+{
+    vnet vn = netif->state;
+
+    /* lwIP leaves the TCP checksum zeroed: seed it with the pseudo-header sum
+       for the device to complete. The headers of a TCP segment are always in
+       its first pbuf. */
+    struct virtio_net_hdr *hdr = 0;
+    u64 hdr_phys = vn->empty_phys;
+    struct vnet_l4 l4;
+    if (vn->tx_csum && vnet_parse_l4(p->payload, p->len, &l4) && (l4.proto == IP_PROTO_TCP)) {
+        hdr = dma_pool_get(vn->txhdrs, &hdr_phys);
+        if (hdr == INVALID_ADDRESS)
+            return ERR_MEM;
+        zero(hdr, vn->net_header_len);
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = l4.start;
+        hdr->csum_offset = l4.csum_offset;
+        *(u16 *)(p->payload + l4.start + l4.csum_offset) = vnet_sum(0, 0, l4.sum);
+    }
+
+    int txqi = current_cpu()->id % vn->ntxqs;
+    virtqueue txq = vn->txqs[txqi];
+    vqmsg m = allocate_vqmsg(txq);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(txq, m, hdr_phys, vn->net_header_len, false);
+
+    pbuf_ref(p);
+
+    for (struct pbuf * q = p; q != NULL; q = q->next)
+        vnet_tx_push(txq, m, q->payload, q->len);
+
+    vqfinish c = closure(vn->transient, tx_complete, p, vn, hdr, hdr_phys);
+    if (net_tx_defer(vn->txkicks[txqi]))
+        vqmsg_queue(txq, m, c);
+    else
+        vqmsg_commit(txq, m, c);
+    
+    MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
+    if (((u8_t *)p->payload)[0] & 1) {
+        /* broadcast or multicast packet*/
+        MIB2_STATS_NETIF_INC(netif, ifoutnucastpkts);
+    } else {
+        /* unicast packet */
+        MIB2_STATS_NETIF_INC(netif, ifoutucastpkts);
+    }
+    /* increase ifoutdiscards or ifouterrors on error */
+
+    LINK_STATS_INC(link.xmit);
+
+    return ERR_OK;
+}
+
+static void receive_buffer_release(struct pbuf *p)
+{
+    xpbuf x  = (void *)p;
+    dma_pool_put(x->vn->rxbuffers, x, x->phys);
+}
+
+static void post_receive(vnet_rxq rxq);
+
+/* ones' complement sum of len bytes of a pbuf chain, starting at offset */
+static u16 vnet_sum_pbuf(struct pbuf *p, u64 offset, u64 len, u64 sum)
+{
+    boolean odd = false;
+    for (; p && len; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        u64 n = MIN(p->len - offset, len);
+        u16 s = vnet_sum(p->payload + offset, n, 0);
+        /* a chunk starting at an odd offset has its bytes swapped */
+        if (odd)
+            s = (s << 8) | (s >> 8);
+        sum += s;
+        odd ^= n & 1;
+        len -= n;
+        offset = 0;
+    }
+    return vnet_sum(0, 0, sum);
+}
+
+/* Checksum of a received TCP or UDP packet that the device has not verified.
+   Anything else is left to lwIP, which still verifies IP and ICMP. Headers
+   are always within the first buffer of a merged packet. */
+static boolean vnet_rx_csum_valid(struct pbuf *p)
+{
+    struct vnet_l4 l4;
+    if (!vnet_parse_l4(p->payload, p->len, &l4))
+        return true;
+    if (l4.start + l4.len > p->tot_len)
+        return false;
+    if ((l4.proto == IP_PROTO_UDP) && !*(u16 *)(p->payload + l4.start + l4.csum_offset))
+        return true;    /* no checksum */
+    return vnet_sum_pbuf(p, l4.start, l4.len, l4.sum) == 0xffff;
+}
+
+static void vnet_rx_deliver(vnet vn, struct pbuf *p, struct virtio_net_hdr *hdr)
+{
+    boolean err = false;
+    if (vn->rx_csum) {
+        /* a partial checksum comes from a local sender and needs no
+           verification, as lwIP does not check TCP and UDP checksums */
+        if (!(hdr->flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID)) &&
+            !vnet_rx_csum_valid(p)) {
+            LINK_STATS_INC(link.chkerr);
+            err = true;
+        }
+    } else if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        if (hdr->csum_start + hdr->csum_offset <= p->len - sizeof(u16)) {
+            u16 csum = ~vnet_sum_pbuf(p, hdr->csum_start, p->tot_len - hdr->csum_start, 0);
+            *(u16 *)(p->payload + hdr->csum_start + hdr->csum_offset) = csum;
+        } else
+            err = true;
+    }
+    if (!err)
+        err = (vn->n->input(p, vn->n) != ERR_OK);
+    if (err)
+        pbuf_free(p);
+}
+
+define_closure_function(2, 1, void, input,
+                        vnet_rxq, rxq, struct xpbuf *, x,
+                        u64, len)
 {
     virtio_net_debug("%s: len %ld\n", __func__, len);
 
+    vnet_rxq rxq = bound(rxq);
     xpbuf x = bound(x);
     vnet vn= x->vn;
     // under what conditions does a virtio queue give us zero?
     if (x != NULL) {
-        struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)x->p.pbuf.payload;
-        boolean err = false;
-        len -= vn->net_header_len;
-        assert(len <= x->p.pbuf.len);
-        x->p.pbuf.tot_len = x->p.pbuf.len = len;
-        x->p.pbuf.payload += vn->net_header_len;
-        if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
-            if (hdr->csum_start + hdr->csum_offset <= len - sizeof(u16)) {
-                u16 csum = vnet_csum(x->p.pbuf.payload + hdr->csum_start,
-                    len - hdr->csum_start);
-                *(u16 *)(x->p.pbuf.payload + hdr->csum_start +
-                        hdr->csum_offset) = csum;
-            } else
-                err = true;
+        struct pbuf *p = &x->p.pbuf;
+        u64 room = vn->rxbuflen;
+        if (!rxq->head) {
+            struct virtio_net_hdr_mrg_rxbuf *hdr = p->payload;
+            runtime_memcpy(&rxq->hdr, &hdr->hdr, sizeof(rxq->hdr));
+            rxq->remain = (vn->mrg_rxbuf && hdr->num_buffers) ? hdr->num_buffers - 1 : 0;
+            len -= vn->net_header_len;
+            room -= vn->net_header_len;
+            p->payload += vn->net_header_len;
+        } else {
+            /* the rest of a merged packet, without a header */
+            rxq->remain--;
+        }
+        p->tot_len = p->len = MIN(len, room);
+        len -= p->len;
+        for (xpbuf n = x->next, next; n; n = next) {
+            next = n->next;
+            if (len) {
+                n->p.pbuf.tot_len = n->p.pbuf.len = MIN(len, vn->rxbuflen);
+                len -= n->p.pbuf.len;
+                pbuf_cat(p, &n->p.pbuf);
+            } else {
+                receive_buffer_release(&n->p.pbuf);
+            }
         }
-        if (!err)
-            err = (vn->n->input(&x->p.pbuf, vn->n) != ERR_OK);
-        if (err) {
-            receive_buffer_release(&x->p.pbuf);
+        assert(len == 0);
+        if (rxq->head)
+            pbuf_cat(rxq->head, p);
+        else
+            rxq->head = p;
+        if (!rxq->remain) {
+            rxq->dim_packets++;
+            rxq->dim_bytes += rxq->head->tot_len;
+            vnet_rx_deliver(vn, rxq->head, &rxq->hdr);
+            rxq->head = 0;
         }
     } else {
         rprintf("virtio null\n");
     }
-    // we need to get a signal from the device side that there was
-    // an underrun here to open up the window
-    post_receive(vn);
-    closure_finish();
+    /* refill once this batch of completions has been processed */
+    rxq->posted--;
+    if (!rxq->refill_pending) {
+        rxq->refill_pending = true;
+        assert(enqueue(runqueue, (thunk)&rxq->refill));
+    }
 }
 
 
-static void post_receive(vnet vn)
+/* Without mergeable buffers, a message chains rxbufs buffers to hold the
+   largest frame. The message is made available by the next kick. */
+static void post_receive(vnet_rxq rxq)
 {
-    xpbuf x = allocate(vn->rxbuffers, sizeof(struct xpbuf) + vn->rxbuflen);
-    assert(x != INVALID_ADDRESS);
-    x->vn = vn;
-    x->p.custom_free_function = receive_buffer_release;
-    pbuf_alloced_custom(PBUF_RAW,
-                        vn->rxbuflen,
-                        PBUF_REF,
-                        &x->p,
-                        x+1,
-                        vn->rxbuflen);
-
-    vqmsg m = allocate_vqmsg(vn->rxq);
+    vnet vn = rxq->vn;
+    vqmsg m = allocate_vqmsg(rxq->vq);
     assert(m != INVALID_ADDRESS);
-    u64 phys = physical_from_virtual(x + 1);
-    if (vtdev_is_modern(vn->dev) || (vn->dev->features & VIRTIO_F_ANY_LAYOUT)) {
-        vqmsg_push(vn->rxq, m, phys, vn->rxbuflen, true);
+    xpbuf first = 0, last = 0;
+    for (int i = 0; i < vn->rxbufs; i++) {
+        u64 phys;
+        xpbuf x = dma_pool_get(vn->rxbuffers, &phys);
+        assert(x != INVALID_ADDRESS);
+        x->vn = vn;
+        x->phys = phys;
+        x->next = 0;
+        x->p.custom_free_function = receive_buffer_release;
+        pbuf_alloced_custom(PBUF_RAW,
+                            vn->rxbuflen,
+                            PBUF_REF,
+                            &x->p,
+                            x+1,
+                            vn->rxbuflen);
+
+        phys += sizeof(struct xpbuf);
+        if (first || vtdev_is_modern(vn->dev) || (vn->dev->features & VIRTIO_F_ANY_LAYOUT)) {
+            vqmsg_push(rxq->vq, m, phys, vn->rxbuflen, true);
+        } else {
+            vqmsg_push(rxq->vq, m, phys, vn->net_header_len, true);
+            vqmsg_push(rxq->vq, m, phys + vn->net_header_len, vn->rxbuflen - vn->net_header_len, true);
+        }
+        if (last)
+            last->next = x;
+        else
+            first = x;
+        last = x;
+    }
+    vqmsg_queue(rxq->vq, m, init_closure(&first->complete, input, rxq, first));
+    rxq->posted++;
+}
+
+define_closure_function(1, 1, void, vnet_rx_coal_set,
+                        vnet_rxq, rxq,
+                        u64, len)
+{
+    vnet_rxq rxq = bound(rxq);
+    rxq->coal_pending = false;
+    if (rxq->coal->ack != VIRTIO_NET_OK) {
+        msg_err("device refused notification coalescing; disabled\n");
+        rxq->vn->rx_coal = VNET_COAL_NONE;
+    }
+}
+
+static void vnet_set_rx_coal(vnet_rxq rxq)
+{
+    vnet vn = rxq->vn;
+    struct vnet_ctrl_coal *c = rxq->coal;
+    const struct net_dim_profile *prof = net_dim_profile(&rxq->dim);
+    vqmsg m = allocate_vqmsg(vn->ctl);
+    if (m == INVALID_ADDRESS)
+        return;
+    c->hdr.class = VIRTIO_NET_CTRL_NOTF_COAL;
+    c->vq.vqn = 2 * (rxq - vn->rxqs);
+    c->vq.reserved = 0;
+    c->vq.coal.max_packets = prof->packets;
+    c->vq.coal.max_usecs = prof->usecs;
+    c->ack = VIRTIO_NET_ERR;
+    vqmsg_push(vn->ctl, m, rxq->coal_phys, sizeof(struct virtio_net_ctrl_hdr), false);
+    if (vn->rx_coal == VNET_COAL_VQ) {
+        c->hdr.cmd = VIRTIO_NET_CTRL_NOTF_COAL_VQ_SET;
+        vqmsg_push(vn->ctl, m, rxq->coal_phys + offsetof(struct vnet_ctrl_coal *, vq),
+                   sizeof(struct virtio_net_ctrl_coal_vq), false);
     } else {
-        vqmsg_push(vn->rxq, m, phys, vn->net_header_len, true);
-        vqmsg_push(vn->rxq, m, phys + vn->net_header_len, vn->rxbuflen - vn->net_header_len, true);
+        c->hdr.cmd = VIRTIO_NET_CTRL_NOTF_COAL_RX_SET;
+        vqmsg_push(vn->ctl, m, rxq->coal_phys + offsetof(struct vnet_ctrl_coal *, vq.coal),
+                   sizeof(struct virtio_net_ctrl_coal), false);
     }
-    vqmsg_commit(vn->rxq, m, closure(vn->dev->general, input, x));
+    vqmsg_push(vn->ctl, m, rxq->coal_phys + offsetof(struct vnet_ctrl_coal *, ack),
+               sizeof(u8), true);
+    rxq->coal_profile = rxq->dim.profile;
+    rxq->coal_pending = true;
+    vqmsg_commit(vn->ctl, m, init_closure(&rxq->coal_set, vnet_rx_coal_set, rxq));
+}
+
+/* A poll that ends with the queue drained stands for one interrupt. */
+static void vnet_rx_dim(vnet_rxq rxq)
+{
+    vnet vn = rxq->vn;
+    if (vn->rx_coal == VNET_COAL_GLOBAL && rxq != &vn->rxqs[0])
+        return;
+    net_dim_sample(&rxq->dim, rxq->dim_packets, rxq->dim_bytes);
+    rxq->dim_packets = rxq->dim_bytes = 0;
+    if (rxq->dim.profile != rxq->coal_profile && !rxq->coal_pending)
+        vnet_set_rx_coal(rxq);
+}
+
+define_closure_function(1, 1, boolean, vnet_rx_poll,
+                        vnet_rxq, rxq,
+                        u32, budget)
+{
+    vnet_rxq rxq = bound(rxq);
+    boolean more;
+    virtqueue_poll(rxq->vq, budget, &more);
+    if (!more && rxq->vn->rx_coal != VNET_COAL_NONE)
+        vnet_rx_dim(rxq);
+    return more;
+}
+
+define_closure_function(1, 0, void, vnet_rx_refill,
+                        vnet_rxq, rxq)
+{
+    vnet_rxq rxq = bound(rxq);
+    rxq->refill_pending = false;
+    while (rxq->posted < rxq->vn->rxfill)
+        post_receive(rxq);
+    virtqueue_kick(rxq->vq);
 }
 
 static err_t virtioif_init(struct netif *netif)
@@ -264,19 +633,60 @@ static err_t virtioif_init(struct netif *netif)
 
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
-    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
-
-    for (int i = 0; i < virtqueue_entries(vn->rxq); i++)
-        post_receive(vn);
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP |
+        NETIF_FLAG_TX_PAGES;
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL &
+                            ~((vn->tx_csum ? NETIF_CHECKSUM_GEN_TCP : 0) |
+                              (vn->rx_csum ? (NETIF_CHECKSUM_CHECK_TCP |
+                                              NETIF_CHECKSUM_CHECK_UDP) : 0)));
+
+    for (int q = 0; q < vn->nqueues; q++) {
+        thunk refill = (thunk)&vn->rxqs[q].refill;
+        apply(refill);
+    }
     
     return ERR_OK;
 }
 
+closure_function(1, 1, void, vnet_queue_pairs_set,
+                 vnet, vn,
+                 u64, len)
+{
+    vnet vn = bound(vn);
+    if (vn->ctrl_mq->ack == VIRTIO_NET_OK)
+        vn->ntxqs = vn->nqueues;
+    else
+        msg_err("device did not enable %d queue pairs\n", vn->nqueues);
+    virtio_net_debug("%s: %d transmit queue(s)\n", __func__, vn->ntxqs);
+    closure_finish();
+}
+
+/* Called once the receive queues are filled. With no steering configured,
+   the device delivers a flow's packets to the receive queue paired with the
+   transmit queue it last went out on. */
+static void vnet_set_queue_pairs(vnet vn)
+{
+    vn->ctrl_mq = alloc_map(vn->dev->contiguous, sizeof(struct vnet_ctrl_mq), &vn->ctrl_mq_phys);
+    assert(vn->ctrl_mq != INVALID_ADDRESS);
+    vn->ctrl_mq->hdr.class = VIRTIO_NET_CTRL_MQ;
+    vn->ctrl_mq->hdr.cmd = VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET;
+    vn->ctrl_mq->mq.virtqueue_pairs = vn->nqueues;
+    vn->ctrl_mq->ack = VIRTIO_NET_ERR;
+    vqmsg m = allocate_vqmsg(vn->ctl);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(vn->ctl, m, vn->ctrl_mq_phys, sizeof(struct virtio_net_ctrl_hdr), false);
+    vqmsg_push(vn->ctl, m, vn->ctrl_mq_phys + offsetof(struct vnet_ctrl_mq *, mq),
+               sizeof(struct virtio_net_ctrl_mq), false);
+    vqmsg_push(vn->ctl, m, vn->ctrl_mq_phys + offsetof(struct vnet_ctrl_mq *, ack),
+               sizeof(u8), true);
+    vqmsg_commit(vn->ctl, m, closure(vn->dev->general, vnet_queue_pairs_set, vn));
+}
+
 static void virtio_net_attach(vtdev dev)
 {
-    //u32 badness = VIRTIO_F_BAD_FEATURE | VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM |
-    //    VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 |  VIRTIO_NET_F_GUEST_ECN|
-    //    VIRTIO_NET_F_GUEST_UFO | VIRTIO_NET_F_CTRL_VLAN | VIRTIO_NET_F_MQ;
+    //u32 badness = VIRTIO_F_BAD_FEATURE |
+    //    VIRTIO_NET_F_GUEST_ECN |
+    //    VIRTIO_NET_F_GUEST_UFO | VIRTIO_NET_F_CTRL_VLAN;
 
     heap h = dev->general;
     backed_heap contiguous = dev->contiguous;
@@ -287,19 +697,119 @@ static void virtio_net_attach(vtdev dev)
     vn->net_header_len = (dev->features & VIRTIO_F_VERSION_1) ||
         (dev->features & VIRTIO_NET_F_MRG_RXBUF) != 0 ?
         sizeof(struct virtio_net_hdr_mrg_rxbuf) : sizeof(struct virtio_net_hdr);
-    vn->rxbuflen = vn->net_header_len + sizeof(struct eth_hdr) + sizeof(struct eth_vlan_hdr) + 1500;
+    vn->mrg_rxbuf = (dev->features & VIRTIO_NET_F_MRG_RXBUF) != 0;
+    boolean large_rx = (dev->features & (VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)) != 0;
+    vn->rxbufs = 1;
+    if (large_rx) {
+        /* coalesced segments span page-sized buffers; without merging, each
+           receive message must hold a whole one */
+        vn->rxbuflen = PAGESIZE - sizeof(struct xpbuf);
+        if (!vn->mrg_rxbuf)
+            vn->rxbufs = (vn->net_header_len + sizeof(struct eth_hdr) + sizeof(struct eth_vlan_hdr) +
+                          VNET_IP6_HLEN + 0xffff + vn->rxbuflen - 1) / vn->rxbuflen;
+    } else {
+        vn->rxbuflen = vn->net_header_len + sizeof(struct eth_hdr) + sizeof(struct eth_vlan_hdr) + 1500;
+    }
+    vn->tx_csum = (dev->features & VIRTIO_NET_F_CSUM) != 0;
+    vn->rx_csum = (dev->features & VIRTIO_NET_F_GUEST_CSUM) != 0;
+    virtio_net_debug("%s: checksum offload tx %d, rx %d\n", __func__, vn->tx_csum, vn->rx_csum);
+    virtio_net_debug("%s: large receive %d, mergeable buffers %d\n", __func__, large_rx, vn->mrg_rxbuf);
     virtio_net_debug("%s: net_header_len %d, rxbuflen %d\n", __func__, vn->net_header_len, vn->rxbuflen);
-    vn->rxbuffers = allocate_objcache(h, (heap)contiguous,
-				      vn->rxbuflen + sizeof(struct xpbuf), PAGESIZE_2M);
-    /* rx = 0, tx = 1, ctl = 2 by 
-       page 53 of http://docs.oasis-open.org/virtio/virtio/v1.0/cs01/virtio-v1.0-cs01.pdf */
+    vn->transient = heap_transient(get_kernel_heaps());
     vn->dev = dev;
-    virtio_alloc_virtqueue(dev, "virtio net tx", 1, runqueue, &vn->txq);
-    virtio_alloc_virtqueue(dev, "virtio net rx", 0, runqueue, &vn->rxq);
+
+    /* one queue pair per cpu if the device offers them, with each pair's
+       interrupts steered to its cpu; the control queue follows the last
+       pair the device offers, so all of its MSI-X vectors must exist */
+    int max_pairs = 1;
+    int nqueues = 1;
+    if (dev->features & VIRTIO_NET_F_MQ) {
+        max_pairs = MAX(vtdev_cfg_read_4(dev, VIRTIO_NET_R_MAX_VQ_PAIRS_DWORD) & 0xffff, 1);
+        nqueues = MIN(max_pairs, present_processors);
+        if ((dev->transport == VTIO_TRANSPORT_PCI) && ((vtpci)dev)->msix_enabled &&
+            (pci_get_msix_count(((vtpci)dev)->dev) < 2 * max_pairs + 2))
+            nqueues = 1;
+    }
+    vn->txqs = allocate(h, nqueues * sizeof(struct virtqueue *));
+    assert(vn->txqs != INVALID_ADDRESS);
+    vn->rxqs = allocate(h, nqueues * sizeof(struct vnet_rxq));
+    assert(vn->rxqs != INVALID_ADDRESS);
+    vn->txkicks = allocate(h, nqueues * sizeof(thunk));
+    assert(vn->txkicks != INVALID_ADDRESS);
+    /* rx = 2n, tx = 2n + 1, ctl = 2 * max_pairs by section 5.1.2 of
+       http://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html */
+    vn->nqueues = 0;
+    for (int i = 0; i < nqueues; i++) {
+        vnet_rxq rxq = &vn->rxqs[i];
+        status st = virtio_alloc_virtqueue_cpu(dev, "virtio net rx", 2 * i, runqueue, i, &rxq->vq);
+        if (is_ok(st))
+            st = virtio_alloc_virtqueue_cpu(dev, "virtio net tx", 2 * i + 1, runqueue, i,
+                                            &vn->txqs[i]);
+        if (!is_ok(st)) {
+            msg_err("failed to allocate queue pair %d: %v\n", i, st);
+            timm_dealloc(st);
+            break;
+        }
+        vn->txkicks[i] = closure(h, vnet_tx_kick, vn->txqs[i]);
+        rxq->vn = vn;
+        rxq->head = 0;
+        rxq->remain = 0;
+        rxq->posted = 0;
+        rxq->refill_pending = false;
+        init_closure(&rxq->refill, vnet_rx_refill, rxq);
+        init_poller(&rxq->poller, init_closure(&rxq->poll, vnet_rx_poll, rxq));
+        virtqueue_set_poller(rxq->vq, &rxq->poller);
+        net_dim_init(&rxq->dim);
+        rxq->dim_packets = rxq->dim_bytes = 0;
+        rxq->coal = 0;
+        rxq->coal_profile = 0;      /* the device starts out not coalescing */
+        rxq->coal_pending = false;
+        vn->nqueues++;
+    }
+    assert(vn->nqueues > 0);
+    vn->rx_coal = !(dev->features & VIRTIO_NET_F_CTRL_VQ) ? VNET_COAL_NONE :
+        (dev->features & VIRTIO_NET_F_VQ_NOTF_COAL) ? VNET_COAL_VQ :
+        (dev->features & VIRTIO_NET_F_NOTF_COAL) ? VNET_COAL_GLOBAL : VNET_COAL_NONE;
+    vn->ctl = 0;
+    if (vn->nqueues > 1 || vn->rx_coal != VNET_COAL_NONE) {
+        status st = virtio_alloc_virtqueue(dev, "virtio net ctl", 2 * max_pairs, runqueue, &vn->ctl);
+        if (!is_ok(st)) {
+            msg_err("failed to allocate control queue: %v\n", st);
+            timm_dealloc(st);
+            vn->ctl = 0;
+            vn->nqueues = 1;
+            vn->rx_coal = VNET_COAL_NONE;
+        }
+    }
+    for (int i = 0; vn->rx_coal != VNET_COAL_NONE && i < vn->nqueues; i++) {
+        vnet_rxq rxq = &vn->rxqs[i];
+        rxq->coal = alloc_map(contiguous, sizeof(struct vnet_ctrl_coal), &rxq->coal_phys);
+        assert(rxq->coal != INVALID_ADDRESS);
+    }
+    virtio_net_debug("%s: receive coalescing %d\n", __func__, vn->rx_coal);
+    /* until the device acknowledges more pairs, only the first is in use */
+    vn->ntxqs = 1;
+    virtio_net_debug("%s: %d queue pair(s), device max %d\n", __func__, vn->nqueues, max_pairs);
+
+    vn->rxfill = virtqueue_entries(vn->rxqs[0].vq);
+    if (vn->rxbufs > 1)
+        vn->rxfill = MIN(vn->rxfill, VNET_LARGE_RXMSGS);
+    /* buffers held by the stack are replaced as they are consumed, so
+       expect as many again outstanding as fill the rings */
+    vn->rxbuffers = allocate_dma_pool(h, contiguous, vn->rxbuflen + sizeof(struct xpbuf),
+                                      64, 2 * vn->nqueues * vn->rxfill * vn->rxbufs);
+    assert(vn->rxbuffers != INVALID_ADDRESS);
     // just need vn->net_header_len contig bytes really
     vn->empty = alloc_map(contiguous, contiguous->h.pagesize, &vn->empty_phys);
     assert(vn->empty != INVALID_ADDRESS);
     for (int i = 0; i < vn->net_header_len; i++)  ((u8 *)vn->empty)[i] = 0;
+    if (vn->tx_csum) {
+        vn->txhdrs = allocate_dma_pool(h, contiguous, vn->net_header_len, 16,
+                                       vn->nqueues * virtqueue_entries(vn->txqs[0]));
+        assert(vn->txhdrs != INVALID_ADDRESS);
+    } else {
+        vn->txhdrs = 0;
+    }
     vn->n->state = vn;
     // initialization complete
     vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
@@ -309,6 +819,8 @@ static void virtio_net_attach(vtdev dev)
               vn,
               virtioif_init,
               ethernet_input);
+    if (vn->ctl && vn->nqueues > 1)
+        vnet_set_queue_pairs(vn);
 }
 
 closure_function(2, 1, boolean, vtpci_net_probe,
@@ -318,7 +830,10 @@ closure_function(2, 1, boolean, vtpci_net_probe,
     if (!vtpci_probe(d, VIRTIO_ID_NETWORK))
         return false;
     vtpci dev = attach_vtpci(bound(general), bound(page_allocator), d,
-        VIRTIO_NET_F_MAC | VIRTIO_F_ANY_LAYOUT);
+        VIRTIO_NET_F_MAC | VIRTIO_F_ANY_LAYOUT | VIRTIO_F_RING_INDIRECT_DESC |
+        VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MRG_RXBUF |
+        VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 | VIRTIO_NET_F_CTRL_VQ |
+        VIRTIO_NET_F_MQ | VIRTIO_NET_F_NOTF_COAL | VIRTIO_NET_F_VQ_NOTF_COAL);
     virtio_net_attach(&dev->virtio_dev);
     return true;
 }
@@ -332,7 +847,10 @@ closure_function(2, 1, void, vtmmio_net_probe,
             sizeof(struct virtio_net_config)))
         return;
     if (attach_vtmmio(bound(general), bound(page_allocator), d,
-            VIRTIO_NET_F_MAC))
+            VIRTIO_NET_F_MAC | VIRTIO_F_RING_INDIRECT_DESC | VIRTIO_NET_F_CSUM |
+            VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_GUEST_TSO4 |
+            VIRTIO_NET_F_GUEST_TSO6 | VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ |
+            VIRTIO_NET_F_NOTF_COAL | VIRTIO_NET_F_VQ_NOTF_COAL))
         virtio_net_attach(&d->virtio_dev);
 }
 
@@ -55,6 +55,8 @@
 #define VIRTIO_NET_F_GUEST_ANNOUNCE 0x200000 /* Announce device on network */
 #define VIRTIO_NET_F_MQ		0x400000 /* Device supports RFS */
 #define VIRTIO_NET_F_CTRL_MAC_ADDR 0x800000 /* Set MAC address */
+#define VIRTIO_NET_F_VQ_NOTF_COAL U64_FROM_BIT(52) /* Per-virtqueue notification coalescing */
+#define VIRTIO_NET_F_NOTF_COAL	U64_FROM_BIT(53) /* Notification coalescing */
 
 #define VIRTIO_NET_S_LINK_UP	1	/* Link is up */
 
@@ -203,4 +205,28 @@ struct virtio_net_ctrl_mq {
 #define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN		1
 #define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX		0x8000
 
+/*
+ * Control notification coalescing
+ *
+ * The device delays used buffer notifications of a virtqueue until either
+ * max_usecs have passed or max_packets have been completed. RX_SET and
+ * TX_SET apply to all receive or transmit virtqueues; with
+ * VIRTIO_NET_F_VQ_NOTF_COAL, VQ_SET applies to virtqueue vqn alone.
+ */
+struct virtio_net_ctrl_coal {
+    u32 max_packets;
+    u32 max_usecs;
+} __attribute__((packed));
+
+struct virtio_net_ctrl_coal_vq {
+    u16 vqn;
+    u16 reserved;
+    struct virtio_net_ctrl_coal coal;
+} __attribute__((packed));
+
+#define VIRTIO_NET_CTRL_NOTF_COAL	6
+#define VIRTIO_NET_CTRL_NOTF_COAL_TX_SET	0
+#define VIRTIO_NET_CTRL_NOTF_COAL_RX_SET	1
+#define VIRTIO_NET_CTRL_NOTF_COAL_VQ_SET	2
+
 #endif /* _VIRTIO_NET_H */
@@ -251,6 +251,17 @@ status vtpci_alloc_virtqueue(vtpci dev,
                              int idx,
                              queue sched_queue,
                              struct virtqueue **result)
+{
+    return vtpci_alloc_virtqueue_cpu(dev, name, idx, sched_queue, 0, result);
+}
+
+/* As above, with the queue interrupt (if MSI-X) delivered to target_cpu. */
+status vtpci_alloc_virtqueue_cpu(vtpci dev,
+                                 const char *name,
+                                 int idx,
+                                 queue sched_queue,
+                                 u32 target_cpu,
+                                 struct virtqueue **result)
 {
     // allocate virtqueue
     struct virtqueue *vq;
@@ -271,7 +282,7 @@ status vtpci_alloc_virtqueue(vtpci dev,
     if (dev->msix_enabled) {
         // setup virtqueue MSI-X interrupt
         int msi_slot = idx + 1; /* 0 reserved for config change */
-        if (pci_setup_msix(dev->dev, msi_slot, handler, name) == INVALID_PHYSICAL)
+        if (pci_setup_msix_cpu(dev->dev, msi_slot, handler, name, target_cpu) == INVALID_PHYSICAL)
             return timm("status", "failed to allocate MSI-X vector");
         pci_bar_write_2(&dev->common_config, dev->regs[VTPCI_REG_QUEUE_MSIX_VECTOR], msi_slot);
         int check_idx = pci_bar_read_2(&dev->common_config, dev->regs[VTPCI_REG_QUEUE_MSIX_VECTOR]);
@@ -399,7 +410,7 @@ vtpci attach_vtpci(heap h, backed_heap page_allocator, pci_dev d, u64 feature_ma
 
     boolean is_modern = pci_get_device(d) >= VIRTIO_PCI_DEVICEID_MODERN_MIN;
     if (is_modern)
-        feature_mask |= VIRTIO_F_VERSION_1;
+        feature_mask |= VIRTIO_F_VERSION_1 | VIRTIO_F_RING_PACKED;
     virtio_pci_debug("%s: dev %x%s\n", __func__, pci_get_device(d), is_modern ? "is modern" : "");
 
     dev->dev = d;
@@ -115,8 +115,12 @@ typedef struct virtio_scsi_disk {
     u16 lun;
     u64 capacity;
     u64 block_size;
+    struct storage_ops ops;
 } *virtio_scsi_disk;
 
+/* blocks per UNMAP command, without looking up the Block Limits VPD page */
+#define VIRTIO_SCSI_UNMAP_MAX_BYTES     (1ull << 30)
+
 /*
  * Event queue
  */
@@ -192,7 +196,7 @@ static void virtio_scsi_enqueue_request(virtio_scsi s, virtio_scsi_request r,
     assert(m != INVALID_ADDRESS);
 
     vqmsg_push(vq, m, r_phys + offsetof(virtio_scsi_request, req), sizeof(r->req), false);
-    if (r->req.cdb[0] == SCSI_CMD_WRITE_16) {
+    if (r->req.cdb[0] == SCSI_CMD_WRITE_16 || r->req.cdb[0] == SCSI_CMD_UNMAP) {
         if (length > 0)
             vqmsg_push(vq, m, physical_from_virtual(buf), length, false);   // dataout
         vqmsg_push(vq, m, r_phys + offsetof(virtio_scsi_request, resp), sizeof(r->resp),
@@ -263,6 +267,52 @@ closure_function(1, 3, void, virtio_scsi_read,
     virtio_scsi_io(bound(s), SCSI_CMD_READ_16, buf, blocks, sh);
 }
 
+closure_function(1, 2, void, virtio_scsi_unmap,
+                 virtio_scsi_disk, d,
+                 range, blocks, status_handler, sh)
+{
+    virtio_scsi_disk d = bound(d);
+    virtio_scsi s = d->scsi;
+    heap h = s->v->virtio_dev.general;
+    u64 max_blocks = VIRTIO_SCSI_UNMAP_MAX_BYTES / d->block_size;
+    merge m = allocate_merge(h, sh);
+    sh = apply_merge(m);
+    while (range_span(blocks) > 0) {
+        u64 nblocks = MIN(range_span(blocks), max_blocks);
+        u64 r_phys;
+        virtio_scsi_request r = virtio_scsi_alloc_request(s, d->target, d->lun, SCSI_CMD_UNMAP,
+                                                          &r_phys);
+        struct scsi_cdb_unmap *cdb = (struct scsi_cdb_unmap *) r->req.cdb;
+        cdb->length = htobe16(sizeof(struct scsi_unmap_param));
+        struct scsi_unmap_param *p = (struct scsi_unmap_param *) r->data;
+        zero(p, sizeof(*p));
+        p->length = htobe16(sizeof(*p) - sizeof(p->length));
+        p->desc_length = htobe16(sizeof(p->desc));
+        p->desc.addr = htobe64(blocks.start);
+        p->desc.length = htobe32(nblocks);
+        virtio_scsi_debug("%s: blocks %R\n", __func__, irangel(blocks.start, nblocks));
+        virtio_scsi_enqueue_request(s, r, r_phys, r->data, r->alloc_len,
+            closure(h, virtio_scsi_io_done, apply_merge(m), r->data, r->alloc_len));
+        blocks.start += nblocks;
+    }
+    apply(sh, STATUS_OK);
+}
+
+/* whole-device SYNCHRONIZE CACHE */
+closure_function(1, 1, void, virtio_scsi_flush,
+                 virtio_scsi_disk, d,
+                 status_handler, sh)
+{
+    virtio_scsi_disk d = bound(d);
+    virtio_scsi s = d->scsi;
+    u64 r_phys;
+    virtio_scsi_request r = virtio_scsi_alloc_request(s, d->target, d->lun,
+                                                      SCSI_CMD_SYNCHRONIZE_CACHE_10, &r_phys);
+    virtio_scsi_debug("%s\n", __func__);
+    virtio_scsi_enqueue_request(s, r, r_phys, 0, 0,
+        closure(s->v->virtio_dev.general, virtio_scsi_io_done, sh, 0, 0));
+}
+
 closure_function(2, 0, void, virtio_scsi_init_done,
                  virtio_scsi_disk, d, storage_attach, a)
 {
@@ -271,7 +321,7 @@ closure_function(2, 0, void, virtio_scsi_init_done,
     heap h = s->v->virtio_dev.general;
     block_io in = closure(h, virtio_scsi_read, d);
     block_io out = closure(h, virtio_scsi_write, d);
-    apply(bound(a), in, out, d->capacity);
+    apply(bound(a), in, out, &d->ops, d->capacity);
     closure_finish();
 }
 
@@ -303,8 +353,14 @@ closure_function(3, 2, void, virtio_scsi_read_capacity_done,
     d->target = target;
     d->lun = lun;
     d->scsi = s;
-    virtio_scsi_debug("%s: target %d, lun %d, block size 0x%lx, capacity 0x%lx\n",
-        __func__, target, lun, d->block_size, d->capacity);
+    zero(&d->ops, sizeof(d->ops));
+    /* logical block provisioning management enabled: UNMAP is supported */
+    if (be16toh(res->lalba_lbp) & SRC16_LBPME_A)
+        d->ops.discard = closure(s->v->virtio_dev.general, virtio_scsi_unmap, d);
+    /* the caching mode page is not read: assume a write-back cache */
+    d->ops.flush = closure(s->v->virtio_dev.general, virtio_scsi_flush, d);
+    virtio_scsi_debug("%s: target %d, lun %d, block size 0x%lx, capacity 0x%lx, unmap %d\n",
+        __func__, target, lun, d->block_size, d->capacity, d->ops.discard != 0);
 
     enqueue_irqsafe(runqueue, closure(s->v->virtio_dev.general, virtio_scsi_init_done,
         d, bound(a)));
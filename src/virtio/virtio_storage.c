@@ -12,12 +12,22 @@
 #define virtio_blk_debug(x, ...)
 #endif
 
+/* payload of discard and write zeroes requests */
+struct virtio_blk_discard_write_zeroes {
+    u64 sector;
+    u32 num_sectors;
+#define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP  1
+    u32 flags;
+} __attribute__((packed));
+
 // this is not really a struct...fix the general encoding problem
 typedef struct virtio_blk_req {
     u32 type;
     u32 reserved;
     u64 sector;
     u8 status;
+    u8 pad[7];
+    struct virtio_blk_discard_write_zeroes dwz;
 } __attribute__((packed)) *virtio_blk_req;
 
 // device configuration offsets
@@ -41,7 +51,21 @@ struct virtio_blk_config {
        // optimal (suggested maximum) I/O size in blocks
        u32 opt_io_size;
     } topology;
-    u8 reserved;
+    u8 writeback;
+    u8 unused0;
+    u16 num_queues;
+} __attribute__((packed));
+
+/* follows struct virtio_blk_config, if VIRTIO_BLK_F_DISCARD or
+   VIRTIO_BLK_F_WRITE_ZEROES */
+struct virtio_blk_config_dwz {
+    u32 max_discard_sectors;
+    u32 max_discard_seg;
+    u32 discard_sector_alignment;
+    u32 max_write_zeroes_sectors;
+    u32 max_write_zeroes_seg;
+    u8 write_zeroes_may_unmap;
+    u8 unused1[3];
 } __attribute__((packed));
 
 #define VIRTIO_BLK_F_SIZE_MAX   U64_FROM_BIT(1)
@@ -52,6 +76,9 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_F_FLUSH      U64_FROM_BIT(9)
 #define VIRTIO_BLK_F_TOPOLOGY   U64_FROM_BIT(10)
 #define VIRTIO_BLK_F_CONFIG_WCE U64_FROM_BIT(11)
+#define VIRTIO_BLK_F_MQ         U64_FROM_BIT(12)
+#define VIRTIO_BLK_F_DISCARD    U64_FROM_BIT(13)
+#define VIRTIO_BLK_F_WRITE_ZEROES   U64_FROM_BIT(14)
 
 #define VIRTIO_BLK_R_CAPACITY_LOW		(offsetof(struct virtio_blk_config *, capacity))
 #define VIRTIO_BLK_R_CAPACITY_HIGH		(offsetof(struct virtio_blk_config *, capacity) + 4)
@@ -65,7 +92,11 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_R_TOPOLOGY_ALIGNMENT_OFFSET	(offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, alignment_offset))
 #define VIRTIO_BLK_R_TOPOLOGY_MIN_IO_SIZE	(offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, min_io_size))
 #define VIRTIO_BLK_R_TOPOLOGY_OPT_IO_SIZE	(offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, opt_io_size))
-#define VIRTIO_BLK_R_RESERVED			(offsetof(struct virtio_blk_config *, reserved))
+#define VIRTIO_BLK_R_WRITEBACK			(offsetof(struct virtio_blk_config *, writeback))
+/* num_queues is read as the upper half of the dword starting at writeback */
+#define VIRTIO_BLK_R_NUM_QUEUES_DWORD		VIRTIO_BLK_R_WRITEBACK
+#define VIRTIO_BLK_R_MAX_DISCARD_SECTORS	(sizeof(struct virtio_blk_config) + offsetof(struct virtio_blk_config_dwz *, max_discard_sectors))
+#define VIRTIO_BLK_R_MAX_WRITE_ZEROES_SECTORS	(sizeof(struct virtio_blk_config) + offsetof(struct virtio_blk_config_dwz *, max_write_zeroes_sectors))
 
 #define VIRTIO_BLK_REQ_HEADER_SIZE      16
 #define VIRTIO_BLK_REQ_STATUS_SIZE      1
@@ -73,16 +104,27 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
 #define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_T_DISCARD    11
+#define VIRTIO_BLK_T_WRITE_ZEROES   13
 
 #define VIRTIO_BLK_S_OK         0
 #define VIRTIO_BLK_S_IOERR      1
 #define VIRTIO_BLK_S_UNSUPP     2
 
+#define VIRTIO_BLK_FEATURES (VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_MQ | VIRTIO_F_RING_EVENT_IDX | \
+                             VIRTIO_F_RING_INDIRECT_DESC | VIRTIO_BLK_F_DISCARD | \
+                             VIRTIO_BLK_F_WRITE_ZEROES | VIRTIO_BLK_F_FLUSH | \
+                             VIRTIO_BLK_F_CONFIG_WCE)
+
 typedef struct storage {
     vtdev v;
-    struct virtqueue *command;
+    int nqueues;
+    struct virtqueue **queues;  /* request queue i serves cpus i, i + nqueues, ... */
     u64 capacity;
     u64 block_size;
+    u32 max_discard_sectors;        /* 0 if discard is not supported */
+    u32 max_write_zeroes_sectors;   /* 0 if write zeroes is not supported */
+    struct storage_ops ops;
 } *storage;
 
 static virtio_blk_req allocate_virtio_blk_req(storage st, u32 type, u64 sector, u64 *phys)
@@ -131,7 +173,7 @@ static inline void storage_rw_internal(storage st, boolean write, void * buf,
     u64 req_phys;
     virtio_blk_req req = allocate_virtio_blk_req(st, write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
                                                  start_sector, &req_phys);
-    virtqueue vq = st->command;
+    virtqueue vq = st->queues[current_cpu()->id % st->nqueues];
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -146,6 +188,65 @@ static inline void storage_rw_internal(storage st, boolean write, void * buf,
     apply(sh, timm("result", "%s", err));
 }
 
+/* discard or write zeroes, in requests of up to max_sectors */
+static void storage_range_op_internal(storage st, u32 type, u32 max_sectors, range sectors,
+                                      status_handler sh)
+{
+    virtio_blk_debug("%s: type %d, block range %R\n", __func__, type, sectors);
+    merge mg = allocate_merge(st->v->general, sh);
+    status_handler k = apply_merge(mg);
+    while (range_span(sectors) > 0) {
+        u64 nsectors = MIN(range_span(sectors), max_sectors);
+        u64 req_phys;
+        virtio_blk_req req = allocate_virtio_blk_req(st, type, 0, &req_phys);
+        req->dwz.sector = sectors.start;
+        req->dwz.num_sectors = nsectors;
+        req->dwz.flags = 0;
+        virtqueue vq = st->queues[current_cpu()->id % st->nqueues];
+        vqmsg m = allocate_vqmsg(vq);
+        assert(m != INVALID_ADDRESS);
+        vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
+        vqmsg_push(vq, m, req_phys + offsetof(virtio_blk_req, dwz), sizeof(req->dwz), false);
+        vqmsg_push(vq, m, req_phys + VIRTIO_BLK_REQ_HEADER_SIZE, VIRTIO_BLK_REQ_STATUS_SIZE, true);
+        vqmsg_commit(vq, m, closure(st->v->general, complete, st, apply_merge(mg), req, req_phys));
+        sectors.start += nsectors;
+    }
+    apply(k, STATUS_OK);
+}
+
+closure_function(1, 2, void, storage_discard,
+                 storage, st,
+                 range, blocks, status_handler, sh)
+{
+    storage st = bound(st);
+    storage_range_op_internal(st, VIRTIO_BLK_T_DISCARD, st->max_discard_sectors, blocks, sh);
+}
+
+closure_function(1, 2, void, storage_write_zeroes,
+                 storage, st,
+                 range, blocks, status_handler, sh)
+{
+    storage st = bound(st);
+    storage_range_op_internal(st, VIRTIO_BLK_T_WRITE_ZEROES, st->max_write_zeroes_sectors,
+                              blocks, sh);
+}
+
+closure_function(1, 1, void, storage_flush,
+                 storage, st,
+                 status_handler, sh)
+{
+    storage st = bound(st);
+    virtio_blk_debug("%s: handler %p (%F)\n", __func__, sh, sh);
+    u64 req_phys;
+    virtio_blk_req req = allocate_virtio_blk_req(st, VIRTIO_BLK_T_FLUSH, 0, &req_phys);
+    virtqueue vq = st->queues[current_cpu()->id % st->nqueues];
+    vqmsg m = allocate_vqmsg(vq);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
+    vqmsg_push(vq, m, req_phys + VIRTIO_BLK_REQ_HEADER_SIZE, VIRTIO_BLK_REQ_STATUS_SIZE, true);
+    vqmsg_commit(vq, m, closure(st->v->general, complete, st, sh, req, req_phys));
+}
+
 closure_function(1, 3, void, storage_write,
                  storage, st,
                  void *, source, range, blocks, status_handler, s)
@@ -173,13 +274,54 @@ static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
     s->capacity = (vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_LOW) |
 		   ((u64) vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_HIGH) << 32)) * s->block_size;
     virtio_blk_debug("%s: capacity 0x%lx, block size 0x%x\n", __func__, s->capacity, s->block_size);
-    virtio_alloc_virtqueue(v, "virtio blk", 0, bhqueue, &s->command);
+
+    /* one request queue per cpu if the device offers them, with each
+       queue's interrupt steered to its cpu */
+    int nqueues = 1;
+    if (v->features & VIRTIO_BLK_F_MQ) {
+        nqueues = MIN(vtdev_cfg_read_4(v, VIRTIO_BLK_R_NUM_QUEUES_DWORD) >> 16, present_processors);
+        if ((v->transport == VTIO_TRANSPORT_PCI) && ((vtpci)v)->msix_enabled)
+            nqueues = MIN(nqueues, pci_get_msix_count(((vtpci)v)->dev) - 1);
+        nqueues = MAX(nqueues, 1);
+    }
+    s->queues = allocate(general, nqueues * sizeof(struct virtqueue *));
+    assert(s->queues != INVALID_ADDRESS);
+    s->nqueues = 0;
+    for (int i = 0; i < nqueues; i++) {
+        status st = virtio_alloc_virtqueue_cpu(v, "virtio blk", i, bhqueue, i, &s->queues[i]);
+        if (!is_ok(st)) {
+            msg_err("failed to allocate request queue %d: %v\n", i, st);
+            timm_dealloc(st);
+            break;
+        }
+        s->nqueues++;
+    }
+    assert(s->nqueues > 0);
+    virtio_blk_debug("%s: %d request queue(s)\n", __func__, s->nqueues);
     // initialization complete
     vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
 
+    s->max_discard_sectors = (v->features & VIRTIO_BLK_F_DISCARD) ?
+            vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_DISCARD_SECTORS) : 0;
+    s->max_write_zeroes_sectors = (v->features & VIRTIO_BLK_F_WRITE_ZEROES) ?
+            vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_WRITE_ZEROES_SECTORS) : 0;
+    s->ops.discard = s->max_discard_sectors ? closure(general, storage_discard, s) : 0;
+    s->ops.write_zeroes = s->max_write_zeroes_sectors ?
+            closure(general, storage_write_zeroes, s) : 0;
+    virtio_blk_debug("%s: max discard sectors %d, max write zeroes sectors %d\n", __func__,
+                     s->max_discard_sectors, s->max_write_zeroes_sectors);
+
+    /* a device in writethrough mode has nothing to flush */
+    boolean writeback = (v->features & VIRTIO_BLK_F_FLUSH) &&
+            (!(v->features & VIRTIO_BLK_F_CONFIG_WCE) ||
+             (vtdev_cfg_read_4(v, VIRTIO_BLK_R_WRITEBACK) & 0xff));
+    s->ops.flush = writeback ? closure(general, storage_flush, s) : 0;
+    s->ops.write_fua = 0;
+    virtio_blk_debug("%s: writeback cache %d\n", __func__, writeback);
+
     block_io in = closure(general, storage_read, s);
     block_io out = closure(general, storage_write, s);
-    apply(a, in, out, s->capacity);
+    apply(a, in, out, &s->ops, s->capacity);
 }
 
 closure_function(3, 1, boolean, vtpci_blk_probe,
@@ -193,7 +335,7 @@ closure_function(3, 1, boolean, vtpci_blk_probe,
     virtio_blk_debug("   attaching\n");
     heap general = bound(general);
     vtdev v = (vtdev)attach_vtpci(general, bound(page_allocator), d,
-        VIRTIO_BLK_F_BLK_SIZE);
+        VIRTIO_BLK_FEATURES);
     virtio_blk_attach(general, bound(a), v);
     return true;
 }
@@ -209,7 +351,7 @@ closure_function(3, 1, void, vtmmio_blk_probe,
         return;
     virtio_blk_debug("   attaching\n");
     heap general = bound(general);
-    if (attach_vtmmio(general, bound(page_allocator), d, VIRTIO_BLK_F_BLK_SIZE))
+    if (attach_vtmmio(general, bound(page_allocator), d, VIRTIO_BLK_FEATURES))
         virtio_blk_attach(general, bound(a), (vtdev)d);
 }
 
@@ -75,6 +75,48 @@ struct vring_used {
     struct vring_used_elem ring[0];
 } __attribute__((packed));
 
+/* With VIRTIO_F_RING_EVENT_IDX, the avail ring is followed by used_event (the
+   used index past which the device should interrupt), and the used ring by
+   avail_event (the avail index past which the driver should notify). */
+#define vring_used_event(vq)    (*(volatile u16 *)((u8 *)(vq)->avail + sizeof(struct vring_avail) + \
+                                                   (vq)->entries * sizeof(u16)))
+#define vring_avail_event(vq)   (*(volatile u16 *)((u8 *)(vq)->used + sizeof(struct vring_used) + \
+                                                   (vq)->entries * sizeof(struct vring_used_elem)))
+
+static inline boolean vring_need_event(u16 event_idx, u16 new_idx, u16 old_idx)
+{
+    return (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old_idx);
+}
+
+/* Packed ring (VIRTIO_F_RING_PACKED): a single descriptor ring written by
+   both sides, with avail/used flag bits compared against wrap counters, and
+   an event suppression structure for each direction. */
+#define VRING_PACKED_DESC_F_AVAIL   (1 << 7)
+#define VRING_PACKED_DESC_F_USED    (1 << 15)
+
+struct vring_packed_desc {
+    u64 addr;
+    u32 len;
+    u16 id;
+    u16 flags;
+} __attribute__((packed));
+
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0
+#define VRING_PACKED_EVENT_FLAG_DISABLE 1
+#define VRING_PACKED_EVENT_FLAG_DESC    2   /* with EVENT_IDX */
+#define VRING_PACKED_EVENT_WRAP_SHIFT   15
+
+struct vring_packed_event {
+    u16 off_wrap;
+    u16 flags;
+} __attribute__((packed));
+
+static inline boolean vring_packed_desc_used(u16 flags, boolean wrap)
+{
+    return (!!(flags & VRING_PACKED_DESC_F_AVAIL) == wrap) &&
+        (!!(flags & VRING_PACKED_DESC_F_USED) == wrap);
+}
+
 typedef struct vqmsg {
     struct list l;              /* vq->msg_queue when queued, or chained for bh process */
     union {
@@ -98,17 +140,36 @@ typedef struct virtqueue {
     volatile struct vring_avail *avail;
     volatile struct vring_used *used;    
     u64 free_cnt;               /* atomic */
-    u16 desc_idx;               /* head of descriptor free list */
+    u16 desc_idx;               /* head of descriptor (packed: buffer id) free list */
     u16 last_used_idx;          /* irq only */
+    boolean event_idx;
+    boolean packed;
+    /* packed ring only */
+    volatile struct vring_packed_desc *pdesc;
+    volatile struct vring_packed_event *driver_event;
+    volatile struct vring_packed_event *device_event;
+    u16 *id_next;               /* buffer id free list links */
+    u16 next_avail_idx;
+    boolean avail_wrap;
+    boolean used_wrap;
+    struct vring_desc *indirect; /* indirect tables, if negotiated */
     int max_queued;
     struct list msg_queue;
     queue service_queue;
     thunk service;
     queue sched_queue;
+    poller poller;              /* if completions are polled */
     struct spinlock lock;
     vqmsg msgs[0];
 } *virtqueue;
 
+/* Messages with more than VQ_INDIRECT_MIN descriptors are placed in an
+   indirect table, taking a single ring descriptor. Each ring slot (split
+   head or packed buffer id) owns a table of VQ_INDIRECT_MAX entries in
+   vq->indirect; longer messages fall back to a direct chain. */
+#define VQ_INDIRECT_MIN        2
+#define VQ_INDIRECT_MAX        32
+
 /* Most uses here are a chain of 3 or less descriptors. */
 #define VQMSG_DEFAULT_SIZE     3
 vqmsg allocate_vqmsg(virtqueue vq)
@@ -160,20 +221,66 @@ void vqmsg_commit(virtqueue vq, vqmsg m, vqfinish completion)
     spin_unlock_irq(&vq->lock, irqflags);
 }
 
-closure_function(1, 0, void, vq_interrupt,
-                 virtqueue, vq)
+/* As vqmsg_commit, but the message is only made available to the device
+   by a later virtqueue_kick(), so that a batch is published at once. */
+void vqmsg_queue(virtqueue vq, vqmsg m, vqfinish completion)
+{
+    m->completion = completion;
+    virtqueue_debug_verbose("%s: vq %s, vqmsg %p, completion %p (%F)\n",
+                            __func__, vq->name, m, completion, completion);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    list_push_back(&vq->msg_queue, &m->l);
+    spin_unlock_irq(&vq->lock, irqflags);
+}
+
+void virtqueue_kick(virtqueue vq)
+{
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    virtqueue_fill(vq);
+    spin_unlock_irq(&vq->lock, irqflags);
+}
+
+/* ring descriptors consumed by a queued message */
+static inline u16 vqmsg_ring_slots(virtqueue vq, vqmsg m)
+{
+    return (vq->indirect && m->count > VQ_INDIRECT_MIN && m->count <= VQ_INDIRECT_MAX) ?
+        1 : m->count;
+}
+
+/* Copy m's descriptors into the indirect table owned by slot; returns the
+   table's bus address. The split layout links entries with next; in a
+   packed table entries are sequential and id is unused. */
+static physical virtqueue_fill_indirect(virtqueue vq, u16 slot, vqmsg m)
+{
+    struct vring_desc *table = vq->indirect + slot * VQ_INDIRECT_MAX;
+    for (int i = 0; i < m->count; i++) {
+        struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+        if (vq->packed) {
+            struct vring_packed_desc *d = (struct vring_packed_desc *)(table + i);
+            d->addr = src->busaddr;
+            d->len = src->len;
+            d->id = 0;
+            d->flags = src->flags;
+        } else {
+            struct vring_desc *d = table + i;
+            d->busaddr = src->busaddr;
+            d->len = src->len;
+            d->flags = src->flags;
+            d->next = i + 1;
+            if (i < m->count - 1)
+                d->flags |= VRING_DESC_F_NEXT;
+        }
+    }
+    return physical_from_virtual(table);
+}
+
+/* Called with lock held. Reaps up to budget completions; rearm asks for an
+   interrupt on the next one. */
+static int virtqueue_reap_split(virtqueue vq, list q, int budget, boolean rearm)
 {
-    // ensure we see up-to-date used->idx (updated by host)
-    memory_barrier();
-    virtqueue vq = bound(vq);
-    virtqueue_debug_verbose("%s: ENTRY: vq %s: entries %d, last_used_idx %d, used->idx %d, desc_idx %d\n",
-        __func__, vq->name, vq->entries, vq->last_used_idx, vq->used->idx, vq->desc_idx);
-    
     int processed = 0;
-    struct list q;
-    list_init(&q);
-    spin_lock(&vq->lock);
-    while (vq->last_used_idx != vq->used->idx) {
+  again:
+    while (vq->last_used_idx != vq->used->idx && processed < budget) {
         volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
         virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
             __func__, vq->name, vq->last_used_idx, uep->id, uep->len);
@@ -187,18 +294,134 @@ closure_function(1, 0, void, vq_interrupt,
             d = vq->desc + d->next;
             dcount++;
         }
-        assert(dcount == m->count);
+        assert(dcount == vqmsg_ring_slots(vq, m));
         d->next = vq->desc_idx;
         vq->desc_idx = head;
 
         vq->last_used_idx++;
         processed++;
-        fetch_and_add(&vq->free_cnt, m->count);
+        fetch_and_add(&vq->free_cnt, dcount);
         m->len = uep->len;
         vq->msgs[head] = 0;
         virtqueue_debug("add msg %p\n", m);
-        list_insert_before(&q, &m->l);
+        list_insert_before(q, &m->l);
+    }
+    if (rearm && vq->event_idx) {
+        /* ask for an interrupt on the next completion, then recheck in case
+           the device used more entries before seeing the new used_event */
+        vring_used_event(vq) = vq->last_used_idx;
+        memory_barrier();
+        if (vq->last_used_idx != vq->used->idx)
+            goto again;
     }
+    return processed;
+}
+
+/* called with lock held; as virtqueue_reap_split */
+static int virtqueue_reap_packed(virtqueue vq, list q, int budget, boolean rearm)
+{
+    int processed = 0;
+  again:
+    while (processed < budget) {
+        volatile struct vring_packed_desc *d = vq->pdesc + vq->last_used_idx;
+        if (!vring_packed_desc_used(d->flags, vq->used_wrap))
+            break;
+        /* read id and len only after seeing the used flags */
+        read_barrier();
+        u16 id = d->id;
+        vqmsg m = vq->msgs[id];
+        virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
+            __func__, vq->name, vq->last_used_idx, id, d->len);
+        assert(m);
+
+        /* the chain's descriptors are free again; recycle the buffer id */
+        u16 slots = vqmsg_ring_slots(vq, m);
+        vq->last_used_idx += slots;
+        if (vq->last_used_idx >= vq->entries) {
+            vq->last_used_idx -= vq->entries;
+            vq->used_wrap = !vq->used_wrap;
+        }
+        vq->id_next[id] = vq->desc_idx;
+        vq->desc_idx = id;
+
+        processed++;
+        fetch_and_add(&vq->free_cnt, slots);
+        m->len = d->len;
+        vq->msgs[id] = 0;
+        virtqueue_debug("add msg %p\n", m);
+        list_insert_before(q, &m->l);
+    }
+    if (rearm && vq->event_idx) {
+        vq->driver_event->off_wrap = vq->last_used_idx |
+            (vq->used_wrap << VRING_PACKED_EVENT_WRAP_SHIFT);
+        memory_barrier();
+        if (vring_packed_desc_used(vq->pdesc[vq->last_used_idx].flags, vq->used_wrap))
+            goto again;
+    }
+    return processed;
+}
+
+/* called with lock held */
+static void virtqueue_mask(virtqueue vq)
+{
+    /* with event_idx, an interrupt is only raised as the used index passes
+       used_event, which stays put while polling */
+    if (vq->packed)
+        vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    else if (!vq->event_idx)
+        vq->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+/* Called with lock held. Returns true, leaving interrupts masked, if there
+   are completions that may have been missed. */
+static boolean virtqueue_unmask(virtqueue vq)
+{
+    if (vq->packed) {
+        if (vq->event_idx) {
+            vq->driver_event->off_wrap = vq->last_used_idx |
+                (vq->used_wrap << VRING_PACKED_EVENT_WRAP_SHIFT);
+            vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+        } else {
+            vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+        }
+        memory_barrier();
+        if (!vring_packed_desc_used(vq->pdesc[vq->last_used_idx].flags, vq->used_wrap))
+            return false;
+    } else {
+        if (vq->event_idx)
+            vring_used_event(vq) = vq->last_used_idx;
+        else
+            vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+        memory_barrier();
+        if (vq->last_used_idx == vq->used->idx)
+            return false;
+    }
+    virtqueue_mask(vq);
+    return true;
+}
+
+closure_function(1, 0, void, vq_interrupt,
+                 virtqueue, vq)
+{
+    // ensure we see up-to-date used->idx (updated by host)
+    memory_barrier();
+    virtqueue vq = bound(vq);
+    virtqueue_debug_verbose("%s: ENTRY: vq %s: entries %d, last_used_idx %d, desc_idx %d\n",
+        __func__, vq->name, vq->entries, vq->last_used_idx, vq->desc_idx);
+
+    if (vq->poller) {
+        spin_lock(&vq->lock);
+        virtqueue_mask(vq);
+        spin_unlock(&vq->lock);
+        poller_schedule(vq->poller);
+        return;
+    }
+
+    struct list q;
+    list_init(&q);
+    spin_lock(&vq->lock);
+    int processed = vq->packed ? virtqueue_reap_packed(vq, &q, vq->entries, true) :
+        virtqueue_reap_split(vq, &q, vq->entries, true);
     virtqueue_fill(vq);
     virtqueue_debug("%s: EXIT: vq %s: processed %d, last_used_idx %d, desc_idx %d\n",
         __func__, vq->name, processed, vq->last_used_idx, vq->desc_idx);
@@ -234,6 +457,36 @@ closure_function(1, 0, void, virtqueue_service_vqmsgs,
     virtqueue_debug("%s exit\n", __func__);
 }
 
+/* Completions are processed by virtqueue_poll() from p, which the queue
+   interrupt schedules with further interrupts masked. */
+void virtqueue_set_poller(virtqueue vq, poller p)
+{
+    vq->poller = p;
+}
+
+/* Apply up to budget completions; returns the number applied. Once the
+   queue is found empty, interrupts are unmasked and *more set false. */
+int virtqueue_poll(virtqueue vq, int budget, boolean *more)
+{
+    struct list q;
+    list_init(&q);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    int processed = vq->packed ? virtqueue_reap_packed(vq, &q, budget, false) :
+        virtqueue_reap_split(vq, &q, budget, false);
+    virtqueue_fill(vq);
+    *more = processed == budget || virtqueue_unmask(vq);
+    spin_unlock_irq(&vq->lock, irqflags);
+
+    list_foreach(&q, p) {
+        vqmsg m = struct_from_list(p, vqmsg, l);
+        virtqueue_debug("  msg %p, completion %F, len %ld\n", m, m->completion, m->len);
+        list_delete(p);
+        apply(m->completion, m->len);
+        deallocate_vqmsg(vq, m);
+    }
+    return processed;
+}
+
 status virtqueue_alloc(vtdev dev,
                        const char *name,
                        u16 queue_index,
@@ -246,12 +499,27 @@ status virtqueue_alloc(vtdev dev,
 {
     u64 vq_alloc_size = sizeof(struct virtqueue) + size * sizeof(vqmsg);
     virtqueue vq = allocate_zero(dev->general, vq_alloc_size);
-    vq->avail_offset = size * sizeof(struct vring_desc);
-    vq->used_offset = pad(vq->avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size, align);
-    bytes alloc = vq->used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size, align);
-    
     if (vq == INVALID_ADDRESS) 
         return timm("status", "cannot allocate virtqueue");
+    vq->packed = (dev->features & VIRTIO_F_RING_PACKED) != 0;
+    bytes alloc;
+    if (vq->packed) {
+        /* descriptor ring, then driver and device event suppression areas */
+        vq->avail_offset = size * sizeof(struct vring_packed_desc);
+        vq->used_offset = vq->avail_offset + sizeof(struct vring_packed_event);
+        alloc = vq->used_offset + sizeof(struct vring_packed_event);
+        vq->id_next = allocate(dev->general, size * sizeof(u16));
+        if (vq->id_next == INVALID_ADDRESS) {
+            deallocate(dev->general, vq, vq_alloc_size);
+            return timm("status", "cannot allocate virtqueue buffer ids");
+        }
+    } else {
+        vq->avail_offset = size * sizeof(struct vring_desc);
+        vq->used_offset = pad(vq->avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size +
+                              sizeof(u16), align);
+        alloc = vq->used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size +
+                                      sizeof(u16), align);
+    }
     
     vq->dev = dev;
     vq->name = name;
@@ -261,6 +529,7 @@ status virtqueue_alloc(vtdev dev,
     vq->notify_offset = notify_offset;
     vq->entries = size;
     vq->free_cnt = size;
+    vq->event_idx = (dev->features & VIRTIO_F_RING_EVENT_IDX) != 0;
     vq->max_queued = 0;
     list_init(&vq->msg_queue);
     vq->service_queue = allocate_queue(dev->general, 512);
@@ -270,10 +539,42 @@ status virtqueue_alloc(vtdev dev,
     spin_lock_init(&vq->lock);
 
     if ((vq->ring_mem = allocate_zero(&dev->contiguous->h, alloc)) == INVALID_ADDRESS) {
+        if (vq->packed)
+            deallocate(dev->general, vq->id_next, size * sizeof(u16));
         deallocate(dev->general, vq, vq_alloc_size);
         return(timm("status", "cannot allocate memory for virtqueue ring"));
     }
 
+    /* indirect tables are an optimization; carry on without them if the
+       pool can't be allocated */
+    if (dev->features & VIRTIO_F_RING_INDIRECT_DESC) {
+        vq->indirect = allocate(&dev->contiguous->h,
+                                size * VQ_INDIRECT_MAX * sizeof(struct vring_desc));
+        if (vq->indirect == INVALID_ADDRESS) {
+            msg_err("%s: cannot allocate indirect descriptor tables\n", name);
+            vq->indirect = 0;
+        }
+    }
+
+    if (vq->packed) {
+        vq->pdesc = (struct vring_packed_desc *) vq->ring_mem;
+        vq->driver_event = (struct vring_packed_event *) (vq->ring_mem + vq->avail_offset);
+        vq->device_event = (struct vring_packed_event *) (vq->ring_mem + vq->used_offset);
+        virtqueue_debug("%s: vq %p (packed): desc %p, driver event %p, device event %p\n",
+            __func__, vq, vq->pdesc, vq->driver_event, vq->device_event);
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->id_next[i] = i + 1;
+        vq->id_next[vq->entries - 1] = VQ_RING_DESC_CHAIN_END;
+        vq->avail_wrap = vq->used_wrap = true;
+        if (vq->event_idx) {
+            vq->driver_event->off_wrap = 1 << VRING_PACKED_EVENT_WRAP_SHIFT;
+            vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+        }
+        *t = closure(dev->general, vq_interrupt, vq);
+        *vqp = vq;
+        return STATUS_OK;
+    }
+
     vq->desc = (struct vring_desc *) vq->ring_mem;
     vq->avail = (struct vring_avail *) (vq->ring_mem + vq->avail_offset);
     vq->used = (struct vring_used *) (vq->ring_mem + vq->used_offset);
@@ -316,29 +617,126 @@ u16 virtqueue_entries(virtqueue vq)
     return vq->entries;
 }
 
-static int virtqueue_notify(virtqueue vq)
+static int virtqueue_notify_packed(virtqueue vq, u16 added)
 {
-    // ensure used->flags update is visible to us
+    // ensure descriptor updates are visible to host and device event is fresh
+    memory_barrier();
+    struct vring_packed_event e = *vq->device_event;
+    int should_notify;
+    if (e.flags == VRING_PACKED_EVENT_FLAG_DESC) {
+        u16 new_idx = vq->next_avail_idx;
+        u16 old_idx = new_idx - added;
+        u16 event_idx = e.off_wrap & MASK(VRING_PACKED_EVENT_WRAP_SHIFT);
+        if ((e.off_wrap >> VRING_PACKED_EVENT_WRAP_SHIFT) != vq->avail_wrap)
+            event_idx -= vq->entries;
+        should_notify = vring_need_event(event_idx, new_idx, old_idx);
+    } else {
+        should_notify = e.flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+    }
+    if (should_notify)
+        apply(vq->dev->notify, vq->queue_index, vq->notify_offset);
+    return should_notify;
+}
+
+static int virtqueue_notify(virtqueue vq, u16 old_avail_idx)
+{
+    // ensure used->flags (or avail_event) update is visible to us
     // and updated avail->idx is visible to host
     memory_barrier();
-    int should_notify = (vq->used->flags & VRING_USED_F_NO_NOTIFY) == 0;
+    int should_notify = vq->event_idx ?
+        vring_need_event(vring_avail_event(vq), vq->avail->idx, old_avail_idx) :
+        (vq->used->flags & VRING_USED_F_NO_NOTIFY) == 0;
     if (should_notify)
         apply(vq->dev->notify, vq->queue_index, vq->notify_offset);
     return should_notify;
 }
 
+/* called with lock held */
+static void virtqueue_fill_packed(virtqueue vq)
+{
+    list n = list_get_next(&vq->msg_queue);
+    u16 added = 0;
+    volatile struct vring_packed_desc *first = 0;
+    u16 first_flags = 0;
+    while (n && n != &vq->msg_queue) {
+        vqmsg m = struct_from_list(n, vqmsg, l);
+        u16 slots = vqmsg_ring_slots(vq, m);
+        if (vq->free_cnt < slots)
+            break;
+        if (vq->max_queued > 0 && vq->entries - vq->free_cnt >= vq->max_queued)
+            break;
+
+        assert(m->completion);
+        u16 id = vq->desc_idx;
+        vq->desc_idx = vq->id_next[id];
+        vq->msgs[id] = m;
+
+        for (int i = 0; i < slots; i++) {
+            struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+            volatile struct vring_packed_desc *d = vq->pdesc + vq->next_avail_idx;
+            u16 flags = vq->avail_wrap ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED;
+            if (slots < m->count) {
+                d->addr = virtqueue_fill_indirect(vq, id, m);
+                d->len = m->count * sizeof(struct vring_packed_desc);
+                flags |= VRING_DESC_F_INDIRECT;
+            } else {
+                d->addr = src->busaddr;
+                d->len = src->len;
+                flags |= src->flags;
+                if (i < slots - 1)
+                    flags |= VRING_DESC_F_NEXT;
+            }
+            d->id = id;
+
+            /* The flags of the first descriptor added are written last,
+               making the whole batch available at once; the device does not
+               look past an unavailable descriptor. */
+            if (!first) {
+                first = d;
+                first_flags = flags;
+            } else {
+                d->flags = flags;
+            }
+            virtqueue_debug_verbose("      - idx %d, id %d, addr 0x%lx, len 0x%x, flags 0x%x\n",
+                                    vq->next_avail_idx, id, d->addr, d->len, flags);
+            if (++vq->next_avail_idx == vq->entries) {
+                vq->next_avail_idx = 0;
+                vq->avail_wrap = !vq->avail_wrap;
+            }
+        }
+        fetch_and_add(&vq->free_cnt, -slots);
+        added += slots;
+
+        list nn = list_get_next(n);
+        list_delete(n);
+        n = nn;
+    }
+
+    if (added > 0) {
+        write_barrier();
+        first->flags = first_flags;
+        virtqueue_notify_packed(vq, added);
+    }
+}
+
 /* called with lock held */
 static void virtqueue_fill(virtqueue vq)
 {
+    if (vq->packed) {
+        virtqueue_fill_packed(vq);
+        return;
+    }
     virtqueue_debug("%s: ENTRY: vq %s: entries %d, desc_idx %d, avail->idx %d, avail->flags 0x%x\n",
         __func__, vq->name, vq->entries, vq->desc_idx, vq->avail->idx, vq->avail->flags);
 
     list n = list_get_next(&vq->msg_queue);
+    u16 old_avail_idx = vq->avail->idx;
     u16 added = 0;
     while (n && n != &vq->msg_queue) {
         vqmsg m = struct_from_list(n, vqmsg, l);
         virtqueue_debug_verbose("   vqmsg %p, count %d\n", m, m->count);
-        if (vq->free_cnt < m->count) {
+        u16 slots = vqmsg_ring_slots(vq, m);
+        if (vq->free_cnt < slots) {
             virtqueue_debug_verbose("      vq %s: queue full (vq->free_cnt %ld)\n",
                 vq->name, vq->free_cnt);
             break;
@@ -354,14 +752,20 @@ static void virtqueue_fill(virtqueue vq)
         u16 head = vq->desc_idx;
         vq->msgs[head] = m;
 
-        for (int i = 0; i < m->count; i++) {
+        for (int i = 0; i < slots; i++) {
             struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
             volatile struct vring_desc *d = vq->desc + vq->desc_idx;
-            d->busaddr = src->busaddr;
-            d->len = src->len;
-            d->flags = src->flags;
-            if (i < m->count - 1)
-                d->flags |= VRING_DESC_F_NEXT;
+            if (slots < m->count) {
+                d->busaddr = virtqueue_fill_indirect(vq, head, m);
+                d->len = m->count * sizeof(struct vring_desc);
+                d->flags = VRING_DESC_F_INDIRECT;
+            } else {
+                d->busaddr = src->busaddr;
+                d->len = src->len;
+                d->flags = src->flags;
+                if (i < slots - 1)
+                    d->flags |= VRING_DESC_F_NEXT;
+            }
             vq->desc_idx = d->next;
 
             virtqueue_debug_verbose("      - desc_idx %d, vring_desc %p, busaddr 0x%lx, "
@@ -369,24 +773,25 @@ static void virtqueue_fill(virtqueue vq)
                                     d->len, d->flags, d->next);
         }
 
-        u16 avail_idx = vq->avail->idx & (vq->entries - 1);
+        u16 avail_idx = (old_avail_idx + added) & (vq->entries - 1);
         vq->avail->ring[avail_idx] = head;
         virtqueue_debug_verbose("      avail->ring[%d] = %d\n", avail_idx, head);
-        fetch_and_add(&vq->free_cnt, -m->count);
+        fetch_and_add(&vq->free_cnt, -slots);
         added++;
 
-        // ensure desc and avail ring updates above are visible before updating avail->idx
-        write_barrier();
-        vq->avail->idx++;
-
         list nn = list_get_next(n);
         list_delete(n);
         n = nn;
     }
 
+    /* publish the whole batch with a single avail->idx update and kick */
     int notified = 0;
-    if (added > 0)
-        notified = virtqueue_notify(vq);
+    if (added > 0) {
+        // ensure desc and avail ring updates above are visible before updating avail->idx
+        write_barrier();
+        vq->avail->idx = old_avail_idx + added;
+        notified = virtqueue_notify(vq, old_avail_idx);
+    }
     (void) notified;
     virtqueue_debug_verbose("   added %d, notified %d, desc_idx %d\n", added, notified, vq->desc_idx);
 }
@@ -11,7 +11,6 @@
 # define pvscsi_debug(...) do { } while(0)
 #endif // defined(PVSCSI_DEBUG)
 
-#define PVSCSI_DEFAULT_NUM_PAGES_REQ_RING 8
 #define PVSCSI_CDB_SIZE 16
 #define PVSCSI_SENSE_SIZE 256
 #define PVSCSI_RETRY_LIMIT  3
@@ -53,6 +52,7 @@ typedef struct pvscsi {
 
     u32 max_targets;
     u32 adapter_queue_size;
+    boolean use_req_call_threshold;
 
     struct list hcb_queue;
     struct spinlock queue_lock;
@@ -83,6 +83,11 @@ static void pvscsi_write_cmd(pvscsi dev, u32 cmd, void *data, u32 len)
     }
 }
 
+static inline boolean pvscsi_cmd_is_rw(u8 cdb0)
+{
+    return cdb0 == SCSI_CMD_READ_16 || cdb0 == SCSI_CMD_WRITE_16;
+}
+
 static void pvscsi_hcb_dealloc(pvscsi dev, struct pvscsi_hcb *hcb)
 {
     spin_lock(&dev->mem_lock);
@@ -116,6 +121,7 @@ static struct pvscsi_hcb *pvscsi_hcb_alloc(pvscsi dev, u16 target, u16 lun, u8 c
 }
 
 static boolean pvscsi_action_io(pvscsi dev, struct pvscsi_hcb *hcb);
+static void pvscsi_kick_io(pvscsi dev, u8 cdb0);
 
 static void pvscsi_action_io_queued(pvscsi dev, struct pvscsi_hcb *hcb, u16 target, u16 lun,
                                     void *buf, u64 length)
@@ -140,6 +146,8 @@ static void pvscsi_action_io_queued(pvscsi dev, struct pvscsi_hcb *hcb, u16 targ
 
     if (!pvscsi_action_io(dev, hcb)) {
         list_push_back(&dev->hcb_queue, &hcb->links);
+    } else {
+        pvscsi_kick_io(dev, hcb->cdb[0]);
     }
     spin_unlock(&dev->queue_lock);
 }
@@ -255,7 +263,7 @@ closure_function(5, 0, void, pvscsi_read_capacity_done,
 
     block_io in = closure(s->general, pvscsi_read, d);
     block_io out = closure(s->general, pvscsi_write, d);
-    apply(bound(a), in, out, d->capacity);
+    apply(bound(a), in, out, 0, d->capacity);
   out:
     closure_finish();
 }
@@ -420,6 +428,21 @@ closure_function(1, 0, void, intx_handler,
     pvscsi_process_cmp_ring(dev);
 }
 
+/* Returns true if the device accepted a request call threshold: it then
+   processes the request ring without a doorbell write per request, and
+   needs a kick only when the pending requests reach the threshold. */
+static boolean pvscsi_setup_req_call(pvscsi dev, u32 enable)
+{
+    pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_COMMAND, PVSCSI_CMD_SETUP_REQCALLTHRESHOLD);
+    if (pvscsi_reg_read(dev, PVSCSI_REG_OFFSET_COMMAND_STATUS) == -1)
+        return false;
+    struct pvscsi_cmd_desc_setup_req_call cmd;
+    zero(&cmd, sizeof(cmd));
+    cmd.enable = enable;
+    pvscsi_write_cmd(dev, PVSCSI_CMD_SETUP_REQCALLTHRESHOLD, &cmd, sizeof(cmd));
+    return pvscsi_reg_read(dev, PVSCSI_REG_OFFSET_COMMAND_STATUS) != 0;
+}
+
 static void *pvscsi_ring_alloc(heap h, int num_pages, void *ppn_list)
 {
     // allocate ring memory
@@ -460,6 +483,8 @@ closure_function(1, 0, void, pvscsi_rx_service_bh, pvscsi, dev)
         }
     }
 
+    /* resubmit queued requests with a single doorbell write per kind */
+    boolean kick_rw = false, kick_non_rw = false;
     spin_lock(&dev->queue_lock);
     list_foreach(&dev->hcb_queue, i) {
         assert(i);
@@ -467,7 +492,15 @@ closure_function(1, 0, void, pvscsi_rx_service_bh, pvscsi, dev)
         if (!pvscsi_action_io(dev, hcb))
             break;
         list_delete(i);
+        if (pvscsi_cmd_is_rw(hcb->cdb[0]))
+            kick_rw = true;
+        else
+            kick_non_rw = true;
     }
+    if (kick_rw)
+        pvscsi_kick_io(dev, SCSI_CMD_READ_16);
+    if (kick_non_rw)
+        pvscsi_kick_io(dev, SCSI_CMD_TEST_UNIT_READY);
     spin_unlock(&dev->queue_lock);
 }
 
@@ -505,11 +538,11 @@ static void pvscsi_attach(heap general, storage_attach a, heap page_allocator, p
     // reset
     pvscsi_write_cmd(dev, PVSCSI_CMD_ADAPTER_RESET, 0, 0);
 
-    // setup rings
+    // setup rings; the device reports the ring sizes it accepted in the rings state
     assert(pad(dev->contiguous->pagesize, PAGESIZE) == dev->contiguous->pagesize);
     struct pvscsi_cmd_desc_setup_rings cmd;
     zero((void *)&cmd, sizeof(cmd));
-    cmd.req_ring_num_pages = PVSCSI_DEFAULT_NUM_PAGES_REQ_RING;
+    cmd.req_ring_num_pages = PVSCSI_MAX_NUM_PAGES_REQ_RING;
     cmd.cmp_ring_num_pages = cmd.req_ring_num_pages;
     dev->rings_state = pvscsi_ring_alloc(dev->contiguous, 1, cmd.rings_state_ppns);
     dev->req_ring = pvscsi_ring_alloc(dev->contiguous, cmd.req_ring_num_pages, cmd.req_ring_ppns);
@@ -530,8 +563,11 @@ static void pvscsi_attach(heap general, storage_attach a, heap page_allocator, p
                       sizeof(struct pvscsi_hcb), PAGESIZE_2M);
     spin_lock_init(&dev->mem_lock);
 
-    dev->adapter_queue_size = cmd.req_ring_num_pages * PAGESIZE / sizeof(struct pvscsi_ring_req_desc);
-    dev->adapter_queue_size = MIN(dev->adapter_queue_size, PVSCSI_MAX_REQ_QUEUE_DEPTH);
+    dev->adapter_queue_size = MIN(U64_FROM_BIT(dev->rings_state->req_num_entries_log2),
+                                  PVSCSI_MAX_REQ_QUEUE_DEPTH);
+    dev->use_req_call_threshold = pvscsi_setup_req_call(dev, 1);
+    pvscsi_debug("%s: queue size %d, request call threshold %s\n", __func__,
+                 dev->adapter_queue_size, dev->use_req_call_threshold ? "enabled" : "disabled");
 
     list_init(&dev->hcb_queue);
     spin_lock_init(&dev->queue_lock);
@@ -581,8 +617,11 @@ closure_function(3, 1, boolean, pvscsi_probe,
 
 static void pvscsi_kick_io(pvscsi dev, u8 cdb0)
 {
-    if (cdb0 == SCSI_CMD_READ_16 || cdb0 == SCSI_CMD_WRITE_16) {
-        pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_KICK_RW_IO, 0);
+    if (pvscsi_cmd_is_rw(cdb0)) {
+        struct pvscsi_rings_state *s = dev->rings_state;
+        if (!dev->use_req_call_threshold ||
+            s->req_prod_idx - s->req_cons_idx >= s->req_call_threshold)
+            pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_KICK_RW_IO, 0);
     } else {
         pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_KICK_NON_RW_IO, 0);
     }
@@ -599,8 +638,6 @@ static void pvscsi_execute_ccb(pvscsi dev, struct pvscsi_hcb *hcb)
 
     memory_barrier();
     s->req_prod_idx++;
-    pvscsi_kick_io(dev, cdb0);
-    pvscsi_debug("%s: kicked\n", __func__);
 }
 
 static inline u64 pvscsi_hcb_to_context(pvscsi dev, struct pvscsi_hcb *hcb)
@@ -644,7 +681,7 @@ static boolean pvscsi_action_io(pvscsi dev, struct pvscsi_hcb *hcb)
         assert(e->data_addr != INVALID_PHYSICAL);
     }
 
-    e->vcpu_hint = 0;
+    e->vcpu_hint = current_cpu()->id;
 
     e->cdb_len = sizeof(e->cdb);
     runtime_memcpy(&e->cdb, &hcb->cdb, sizeof(e->cdb));
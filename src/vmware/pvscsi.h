@@ -80,6 +80,10 @@ struct pvscsi_cmd_desc_setup_rings {
 	u64	cmp_ring_ppns[PVSCSI_SETUP_RINGS_MAX_NUM_PAGES];
 } __attribute__((packed));
 
+struct pvscsi_cmd_desc_setup_req_call {
+	u32	enable;
+} __attribute__((packed));
+
 struct pvscsi_rings_state {
 	u32	req_prod_idx;
 	u32	req_cons_idx;
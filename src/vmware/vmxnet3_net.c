@@ -8,6 +8,7 @@
 #include "lwip/ethip6.h"
 #include "lwip/etharp.h"
 #include "lwip/dhcp.h"
+#include "lwip/prot/ip.h"
 #include <pci.h>
 #include "netif/ethernet.h"
 #include "vmxnet3.h"
@@ -25,9 +26,7 @@ typedef struct vmxnet3 {
     heap rxbuffers;
     struct spinlock rx_buflock;
     int rxbuflen;
-    thunk rx_intr_handler;
-    thunk rx_service;           /* for bhqueue processing */
-    queue rx_servicequeue;
+    struct poller rx_pollers[VMXNET3_DEF_RX_QUEUES]; /* receive is polled from the runqueue */
     struct netif *n;
 } *vmxnet3;
 
@@ -38,12 +37,24 @@ typedef struct xpbuf
     struct list l;
 } *xpbuf;
 
-static void vmxnet3_interrupts_enable(vmxnet3_pci dev)
+static void vmxnet3_rxq_intr_enable(vmxnet3_pci dev, int q)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
+    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
     pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 0);
 }
 
+static void vmxnet3_rxq_intr_disable(vmxnet3_pci dev, int q)
+{
+    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
+    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 1);
+}
+
+static void vmxnet3_interrupts_enable(vmxnet3_pci dev)
+{
+    for (int q = 0; q < dev->nrxq; q++)
+        vmxnet3_rxq_intr_enable(dev, q);
+}
+
 boolean vmxnet3_probe(pci_dev d)
 {
     if (pci_get_vendor(d) != VMXNET3_VMWARE_VENDOR_ID)
@@ -106,13 +117,22 @@ void init_vmxnet3_driver_shared(vmxnet3_pci dev)
     // vmxnet3_queues_shared_alloc()
     vmx_ds->mtu = 1500;
     vmx_ds->nrxsg_max = VMXNET3_MAX_RX_SEGS;
-    vmx_ds->ntxqueue = VMXNET3_DEF_TX_QUEUES;
-    vmx_ds->nrxqueue = VMXNET3_DEF_RX_QUEUES;
+    vmx_ds->ntxqueue = dev->ntxq;
+    vmx_ds->nrxqueue = dev->nrxq;
 
+    /* vector 0 is shared by tx and events (both masked), then one per rx queue */
     vmx_ds->automask = 0;
-    vmx_ds->nintr = 2;
+    vmx_ds->nintr = 1 + dev->nrxq;
     vmx_ds->evintr = 0;
 
+    if (dev->nrxq > 1) {
+        vmx_ds->upt_features |= UPT1_F_RSS;
+        vmx_ds->rss.version = 1;
+        vmx_ds->rss.paddr = physical_from_virtual(dev->rss);
+        assert(vmx_ds->rss.paddr != INVALID_PHYSICAL);
+        vmx_ds->rss.len = sizeof(struct vmxnet3_rss_shared);
+    }
+
     vmx_ds->rxmode = VMXNET3_RXMODE_UCAST | VMXNET3_RXMODE_MCAST | VMXNET3_RXMODE_BCAST |
         VMXNET3_RXMODE_ALLMULTI;
 
@@ -127,31 +147,94 @@ void init_vmxnet3_driver_shared(vmxnet3_pci dev)
     vmxnet3_write_cmd(dev, VMXNET3_CMD_SET_RXMODE);
 }
 
+static void vmxnet3_rss_init(vmxnet3_pci dev)
+{
+    struct vmxnet3_rss_shared *rss = dev->rss;
+    rss->hash_type = UPT1_RSS_HASH_TYPE_IPV4 | UPT1_RSS_HASH_TYPE_TCP_IPV4 |
+        UPT1_RSS_HASH_TYPE_IPV6 | UPT1_RSS_HASH_TYPE_TCP_IPV6;
+    rss->hash_func = UPT1_RSS_HASH_FUNC_TOEPLITZ;
+    rss->hash_key_size = UPT1_RSS_MAX_KEY_SIZE;
+    rss->ind_table_size = UPT1_RSS_MAX_IND_TABLE_SIZE;
+    for (int i = 0; i < UPT1_RSS_MAX_KEY_SIZE; i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(rss->hash_key + i, &r, sizeof(u64));
+    }
+    for (int i = 0; i < UPT1_RSS_MAX_IND_TABLE_SIZE; i++)
+        rss->ind_table[i] = i % dev->nrxq;
+}
+
 static void vmxnet3_interrupts_disable(vmxnet3_pci dev)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
+    for (int q = 0; q < dev->nrxq; q++)
+        vmxnet3_rxq_intr_disable(dev, q);
     struct vmxnet3_txqueue *txq = dev->vmx_txq[0];
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 1);
     pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(txq->vxtxq_intr_idx), 1);
 }
 
-static void kick_pending(vmxnet3_pci dev)
+static void kick_pending(vmxnet3_pci dev, int q)
 {
-    struct vmxnet3_txqueue* vmx_txq = dev->vmx_txq[0];
+    struct vmxnet3_txqueue* vmx_txq = dev->vmx_txq[q];
     if (vmx_txq->vxtxq_ts->npending) {
         vmx_txq->vxtxq_ts->npending = 0;
-        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_TXH(0), vmx_txq->vxtxq_cmd_ring.vxtxr_head);
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_TXH(q), vmx_txq->vxtxq_cmd_ring.vxtxr_head);
     }
 }
 
+/* Seed the TCP checksum of an outgoing frame with the pseudo-header sum and
+   return the offset of the TCP header, or 0 if the frame is not TCP. */
+static u16 vmxnet3_tx_csum(u8 *frame, u64 len)
+{
+    if (len < SIZEOF_ETH_HDR)
+        return 0;
+    u16 type = ((struct eth_hdr *)frame)->type;
+    u64 off = SIZEOF_ETH_HDR;
+    u8 *ip = frame + off;
+    u16 *addrs;
+    int naddrs;
+    u64 l4len;
+    if (type == PP_HTONS(ETHTYPE_IP)) {
+        if (len < off + 20)
+            return 0;
+        u64 hlen = (ip[0] & 0xf) << 2;
+        u64 total = (ip[2] << 8) | ip[3];
+        if ((hlen < 20) || (total < hlen) || (ip[6] & 0x3f) || ip[7] || (ip[9] != IP_PROTO_TCP))
+            return 0;
+        l4len = total - hlen;
+        addrs = (u16 *)(ip + 12);
+        naddrs = 2 * sizeof(u32) / sizeof(u16);
+        off += hlen;
+    } else if (type == PP_HTONS(ETHTYPE_IPV6)) {
+        if ((len < off + 40) || (ip[6] != IP_PROTO_TCP))
+            return 0;
+        l4len = (ip[4] << 8) | ip[5];
+        addrs = (u16 *)(ip + 8);
+        naddrs = 2 * 16 / sizeof(u16);
+        off += 40;
+    } else {
+        return 0;
+    }
+    if (off + 18 > len)
+        return 0;
+    u32 sum = lwip_htons(IP_PROTO_TCP) + lwip_htons(l4len);
+    for (int i = 0; i < naddrs; i++)
+        sum += addrs[i];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    *(u16 *)(frame + off + 16) = sum;
+    return off;
+}
+
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
     vmxnet3 vn = netif->state;
+    vmxnet3_pci dev = vn->dev;
+    int q = current_cpu()->id % dev->ntxq;
+    u16 csum_start = dev->tx_csum ? vmxnet3_tx_csum(p->payload, p->len) : 0;
 
-    err_t e = vmxnet3_isc_txd_encap(vn->dev, p);
+    err_t e = vmxnet3_isc_txd_encap(dev, q, p, csum_start);
     if (e != ERR_OK)
         return e;
-    kick_pending(vn->dev)
+    kick_pending(dev, q);
 
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -218,17 +301,18 @@ static err_t vmxif_init(struct netif *netif)
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL &
+                            ~(vn->dev->tx_csum ? NETIF_CHECKSUM_GEN_TCP : 0));
 
     return ERR_OK;
 }
 
-static void process_interrupt(vmxnet3 vn);
-
-closure_function(1, 0, void, rx_interrupt,
-                 vmxnet3, vn)
+closure_function(2, 0, void, rx_interrupt,
+                 vmxnet3, vn, int, q)
 {
     vmxnet3 vn = bound(vn);
-    process_interrupt(vn);
+    vmxnet3_rxq_intr_disable(vn->dev, bound(q));
+    poller_schedule(&vn->rx_pollers[bound(q)]);
 }
 
 static void receive_buffer_release(struct pbuf *p)
@@ -239,30 +323,36 @@ static void receive_buffer_release(struct pbuf *p)
     spin_unlock_irq(&x->vn->rx_buflock, flags);
 }
 
-closure_function(1, 0, void, vmxnet3_rx_service_bh,
-                 vmxnet3, vn)
+int vmxnet3_receive(vmxnet3 vdev, int q, struct list *l, int budget);
+
+closure_function(2, 1, boolean, vmxnet3_rx_poll,
+                 vmxnet3, vn, int, q,
+                 u32, budget)
 {
     vmxnet3 vn = bound(vn);
-    list l;
-    while ((l = (list)dequeue(vn->rx_servicequeue)) != INVALID_ADDRESS) {
-        struct list q;
-        assert(l);
-        assert(l->prev);
-        list_insert_before(l, &q); /* restore list head */
-        list_foreach(&q, i) {
-            assert(i);
-            xpbuf rxb = struct_from_list(i, xpbuf, l);
-            list_delete(i);
-            err_enum_t err = vn->n->input((struct pbuf *)rxb, vn->n);
-            if (err != ERR_OK) {
-                msg_err("vmxnet3: rx drop by stack, err %d\n", err);
-                receive_buffer_release((struct pbuf *)rxb);
-            }
+    int q = bound(q);
+    struct list pkts;
+    list_init(&pkts);
+    int npkts = vmxnet3_receive(vn, q, &pkts, budget);
+    list_foreach(&pkts, i) {
+        xpbuf rxb = struct_from_list(i, xpbuf, l);
+        list_delete(i);
+        err_enum_t err = vn->n->input((struct pbuf *)rxb, vn->n);
+        if (err != ERR_OK) {
+            msg_err("vmxnet3: rx drop by stack, err %d\n", err);
+            receive_buffer_release((struct pbuf *)rxb);
         }
     }
+    if (npkts == budget)
+        return true;
+    vmxnet3_rxq_intr_enable(vn->dev, q);
+    if (!vmxnet3_rxq_available(vn->dev, q))
+        return false;
+    vmxnet3_rxq_intr_disable(vn->dev, q);
+    return true;
 }
 
-void vmxnet3_newbuf(vmxnet3 vdev, int rid);
+void vmxnet3_newbuf(vmxnet3 vdev, int q, int rid);
 
 static void test_shared(vmxnet3 vn)
 {
@@ -291,7 +381,7 @@ static void test_shared(vmxnet3 vn)
     assert(vxtxq_ts->error == 0);
 
     struct vmxnet3_rxq_shared *vxrxq_rs = dev->vmx_rxq[0]->vxrxq_rs;
-    assert(dev->queues_shared_mem + sizeof(struct vmxnet3_txq_shared) == vxrxq_rs);
+    assert(dev->queues_shared_mem + dev->ntxq * sizeof(struct vmxnet3_txq_shared) == vxrxq_rs);
 
     assert(vxrxq_rs->update_rxhead == 0);
     assert(vxrxq_rs->cmd_ring[0] == physical_from_virtual(dev->rx_desc_mem));
@@ -318,7 +408,7 @@ static void test_shared(vmxnet3 vn)
         assert(rxr->vxrxr_desc_skips == 0);
         assert(rxr->vxrxr_refill_start == 0);
         for(int j = 0; j<rxr->vxrxr_ndesc; ++j) {
-            assert(rxr->vxrxr_rxd[j].addr == physical_from_virtual(dev->rx_pbuf[i][j]->payload));
+            assert(rxr->vxrxr_rxd[j].addr == physical_from_virtual(dev->vmx_rxq[0]->vxrxq_pbuf[i][j]->payload));
             assert(rxr->vxrxr_rxd[j].btype == (i == 0 ? VMXNET3_BTYPE_HEAD : VMXNET3_BTYPE_BODY));
             assert(rxr->vxrxr_rxd[j].dtype == 0);
             assert(rxr->vxrxr_rxd[j].len == vn->rxbuflen);
@@ -358,6 +448,9 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
     vmxnet3_write_cmd(dev, VMXNET3_CMD_DISABLE);
     vmxnet3_write_cmd(dev, VMXNET3_CMD_RESET);
 
+    dev->nrxq = dev->ntxq = MIN(present_processors, VMXNET3_DEF_RX_QUEUES);
+    dev->tx_csum = true;
+
     vmxnet3 vn = allocate(dev->general, sizeof(struct vmxnet3));
     assert(vn != INVALID_ADDRESS);
     vn->dev = dev;
@@ -373,12 +466,21 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
     dev->vmx_ds = allocate_zero(dev->contiguous, sizeof(struct vmxnet3_driver_shared));
     assert(dev->vmx_ds != INVALID_ADDRESS);
 
-    vn->rx_servicequeue = allocate_queue(dev->general, VMXNET3_RX_SERVICEQUEUE_DEPTH);
-    assert(vn->rx_servicequeue != INVALID_ADDRESS);
-    vn->rx_service = closure(dev->general, vmxnet3_rx_service_bh, vn);
+    if (dev->nrxq > 1) {
+        dev->rss = allocate_zero(dev->contiguous, sizeof(struct vmxnet3_rss_shared));
+        assert(dev->rss != INVALID_ADDRESS);
+        vmxnet3_rss_init(dev);
+    } else {
+        dev->rss = 0;
+    }
 
-    vn->rx_intr_handler = closure(dev->general, rx_interrupt, vn);
-    assert(pci_setup_msix(dev->dev, 1, vn->rx_intr_handler, "vmxnet3 rx") != INVALID_PHYSICAL);
+    /* each rx queue has its own vector and poller, steered to its own cpu */
+    for (int q = 0; q < dev->nrxq; q++) {
+        init_poller(&vn->rx_pollers[q], closure(dev->general, vmxnet3_rx_poll, vn, q));
+        thunk t = closure(dev->general, rx_interrupt, vn, q);
+        assert(pci_setup_msix_cpu(dev->dev, 1 + q, t, "vmxnet3 rx",
+                                  q % present_processors) != INVALID_PHYSICAL);
+    }
     // interrupts are not used for tx
 
     vmxnet3_tx_queues_alloc(dev);
@@ -386,9 +488,11 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
 
     vmxnet3_queues_shared_alloc(dev);
 
-    for (int i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
-        for (int idx = 0; idx < VMXNET3_MAX_RX_NDESC; idx++)
-            vmxnet3_newbuf(vn, i);
+    for (int q = 0; q < dev->nrxq; q++) {
+        for (int i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
+            for (int idx = 0; idx < VMXNET3_MAX_RX_NDESC; idx++)
+                vmxnet3_newbuf(vn, q, i);
+        }
     }
 
     vmxnet3_init_shared_data(dev);
@@ -404,8 +508,10 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
     init_vmxnet3_driver_shared(dev);
     test_shared(vn);
     vmxnet3_read_cmd(dev, VMXNET3_CMD_ENABLE);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(0), 0);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(0), 0);
+    for (int q = 0; q < dev->nrxq; q++) {
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(q), 0);
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(q), 0);
+    }
 
     netif_add(vn->n,
               0, 0, 0,
@@ -435,9 +541,9 @@ void init_vmxnet3_network(kernel_heaps kh)
     register_pci_driver(closure(h, vmxnet3_net_probe, h, heap_backed(kh)));
 }
 
-static void vmxnet3_discard(vmxnet3_pci dev, int rid, int idx)
+static void vmxnet3_discard(vmxnet3_pci dev, int q, int rid, int idx)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
+    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
     struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
     struct vmxnet3_rxdesc *rxd = &rxr->vxrxr_rxd[idx];
     rxd->gen = rxr->vxrxr_gen;
@@ -447,10 +553,10 @@ static void vmxnet3_discard(vmxnet3_pci dev, int rid, int idx)
     }
 }
 
-void vmxnet3_newbuf(vmxnet3 vdev, int rid)
+void vmxnet3_newbuf(vmxnet3 vdev, int q, int rid)
 {
     vmxnet3_pci dev = vdev->dev;
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
+    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
     struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
 
     int idx = rxr->vxrxr_refill_start;
@@ -467,7 +573,7 @@ void vmxnet3_newbuf(vmxnet3 vdev, int rid)
                         x+1,
                         vdev->rxbuflen);
 
-    dev->rx_pbuf[rid][idx] = (struct pbuf*)x;
+    rxq->vxrxq_pbuf[rid][idx] = (struct pbuf*)x;
 
     rxd->addr = physical_from_virtual(x+1);
     assert(rxd->addr != INVALID_PHYSICAL);
@@ -482,39 +588,42 @@ void vmxnet3_newbuf(vmxnet3 vdev, int rid)
     }
 }
 
-static inline void vmxnet3_newbuf_lock(vmxnet3 dev, int rid)
+static inline void vmxnet3_newbuf_lock(vmxnet3 dev, int q, int rid)
 {
-    spin_lock(&dev->rx_buflock);
-    vmxnet3_newbuf(dev, rid);
-    spin_unlock(&dev->rx_buflock);
+    u64 flags = spin_lock_irq(&dev->rx_buflock);
+    vmxnet3_newbuf(dev, q, rid);
+    spin_unlock_irq(&dev->rx_buflock, flags);
 }
 
-void vmxnet3_receive(vmxnet3 vdev, struct list *l)
+/* Collect up to budget complete packets on l; returns the number collected. */
+int vmxnet3_receive(vmxnet3 vdev, int q, struct list *l, int budget)
 {
     vmxnet3_pci dev = vdev->dev;
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
+    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
     struct vmxnet3_comp_ring *rxc = &rxq->vxrxq_comp_ring;
+    int npkts = 0;
 
-    for(;;) {
+    while (npkts < budget) {
         struct vmxnet3_rxcompdesc *rxcd = &rxc->vxcr_u.rxcd[rxc->vxcr_next];
 
         if (rxcd->gen != rxc->vxcr_gen)
             break;
         read_barrier();
 
-        assert(rxcd->qid <= 2);
+        assert(rxcd->qid < 2 * dev->nrxq);
 
         if (++rxc->vxcr_next == rxc->vxcr_ndesc) {
             rxc->vxcr_next = 0;
             rxc->vxcr_gen ^= 1;
         }
 
-        u32 rid = rxcd->qid;
+        /* completions for ring 1 of queue q carry qid q + nrxq */
+        u32 rid = rxcd->qid < dev->nrxq ? 0 : 1;
         u32 idx = rxcd->rxd_idx;
         u32 length = rxcd->len;
         struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
         struct vmxnet3_rxdesc *rxd = &rxr->vxrxr_rxd[idx];
-        struct pbuf *m = dev->rx_pbuf[rid][idx];
+        struct pbuf *m = rxq->vxrxq_pbuf[rid][idx];
 
         assert(m != NULL);
 
@@ -527,50 +636,51 @@ void vmxnet3_receive(vmxnet3 vdev, struct list *l)
         }
 
         if (rxcd->eop && rxcd->error) {
-            vmxnet3_discard(dev, rid, idx);
+            vmxnet3_discard(dev, q, rid, idx);
             goto next;
         }
 
         /* Check and handle SOP/EOP state errors */
-        if (rxcd->sop && dev->currpkt_head) {
-            receive_buffer_release(dev->currpkt_head);
-            dev->currpkt_head = dev->currpkt_tail =  NULL;
-        } else if (!rxcd->sop && !dev->currpkt_head) {
-            vmxnet3_discard(dev, rid, idx);
+        if (rxcd->sop && rxq->vxrxq_head) {
+            receive_buffer_release(rxq->vxrxq_head);
+            rxq->vxrxq_head = rxq->vxrxq_tail =  NULL;
+        } else if (!rxcd->sop && !rxq->vxrxq_head) {
+            vmxnet3_discard(dev, q, rid, idx);
             goto next;
         }
 
        if (rxcd->sop) {
             assert(rxd->btype == VMXNET3_BTYPE_HEAD);
             assert((idx % 1) == 0);
-            assert(dev->currpkt_head == NULL);
+            assert(rxq->vxrxq_head == NULL);
 
             if (length == 0) {
-                vmxnet3_discard(dev, rid, idx);
+                vmxnet3_discard(dev, q, rid, idx);
                 goto next;
             }
 
-            vmxnet3_newbuf_lock(vdev, rid);
+            vmxnet3_newbuf_lock(vdev, q, rid);
 
             m->tot_len = length;
             m->len = length;
 
-            dev->currpkt_head = dev->currpkt_tail = m;
+            rxq->vxrxq_head = rxq->vxrxq_tail = m;
         } else {
             assert(rxd->btype == VMXNET3_BTYPE_BODY);
-            assert(dev->currpkt_head != NULL);
+            assert(rxq->vxrxq_head != NULL);
 
-            vmxnet3_newbuf_lock(vdev, rid);
+            vmxnet3_newbuf_lock(vdev, q, rid);
 
             m->len = length;
-            dev->currpkt_head->tot_len += length;
-            dev->currpkt_tail->next = m;
-            dev->currpkt_tail = m;
+            rxq->vxrxq_head->tot_len += length;
+            rxq->vxrxq_tail->next = m;
+            rxq->vxrxq_tail = m;
         }
 
         if (rxcd->eop) {
-            list_insert_before(l, &((struct xpbuf*)dev->currpkt_head)->l);
-            dev->currpkt_head = dev->currpkt_tail = NULL;
+            list_insert_before(l, &((struct xpbuf*)rxq->vxrxq_head)->l);
+            rxq->vxrxq_head = rxq->vxrxq_tail = NULL;
+            npkts++;
         }
 
 next:
@@ -578,30 +688,10 @@ next:
             idx = (idx + 1) % rxr->vxrxr_ndesc;
 
             if (rid == 0)
-                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(0), idx);
+                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(q), idx);
             else
-                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(0), idx);
+                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(q), idx);
         }
     }
-
-}
-
-static void process_interrupt(vmxnet3 vn)
-{
-    vmxnet3_pci dev = vn->dev;
-    struct list q;
-    list_init(&q);
-
-    vmxnet3_interrupts_disable(dev);
-    while (vmxnet3_rxq_available(dev)) {
-        vmxnet3_receive(vn, &q);
-    }
-    vmxnet3_interrupts_enable(dev);
-    list l = list_get_next(&q);
-    if (l) {
-        /* trick: remove (local) head and queue first element */
-        list_delete(&q);
-        assert(enqueue(vn->rx_servicequeue, l));
-        enqueue(runqueue, vn->rx_service);
-    }
+    return npkts;
 }
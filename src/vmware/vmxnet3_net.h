@@ -81,14 +81,15 @@ typedef struct vmxnet3_pci {
     void *vmxnet3_mcast_table_mem;
     struct vmxnet3_txqueue *vmx_txq[VMXNET3_DEF_TX_QUEUES];
     struct vmxnet3_rxqueue *vmx_rxq[VMXNET3_DEF_RX_QUEUES];
+    int ntxq;                   /* tx queue i serves cpus i, i + ntxq, ... */
+    int nrxq;                   /* rx queues, spread by RSS */
     void *queues_shared_mem;
     struct vmxnet3_txdesc *tx_desc_mem;
-    struct pbuf *tx_pbuf[VMXNET3_MAX_TX_NDESC];
     struct vmxnet3_txcompdesc *tx_compdesc_mem;
     struct vmxnet3_rxdesc *rx_desc_mem;
-    struct pbuf *rx_pbuf[VMXNET3_RXRINGS_PERQ][VMXNET3_MAX_RX_NDESC];
     struct vmxnet3_rxcompdesc *rx_compdesc_mem;
-    struct pbuf *currpkt_head, *currpkt_tail;
+    struct vmxnet3_rss_shared *rss;
+    boolean tx_csum;            /* TCP checksums completed by the device */
 } *vmxnet3_pci;
 
 #define VMXNET3_RX_MAXSEGSIZE		((1 << 14) - 1)
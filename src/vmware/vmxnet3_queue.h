@@ -155,6 +155,28 @@ struct UPT1_RxStats {
 #define UPT1_F_VLAN	0x0004		/* VLAN tag stripping */
 #define UPT1_F_LRO	0x0008		/* Large receive offloading */
 
+/* Receive side scaling */
+#define UPT1_RSS_HASH_TYPE_NONE		0
+#define UPT1_RSS_HASH_TYPE_IPV4		1
+#define UPT1_RSS_HASH_TYPE_TCP_IPV4	2
+#define UPT1_RSS_HASH_TYPE_IPV6		4
+#define UPT1_RSS_HASH_TYPE_TCP_IPV6	8
+
+#define UPT1_RSS_HASH_FUNC_NONE		0
+#define UPT1_RSS_HASH_FUNC_TOEPLITZ	1
+
+#define UPT1_RSS_MAX_KEY_SIZE		40
+#define UPT1_RSS_MAX_IND_TABLE_SIZE	128
+
+struct vmxnet3_rss_shared {
+    u16 hash_type;
+    u16 hash_func;
+    u16 hash_key_size;
+    u16 ind_table_size;
+    u8 hash_key[UPT1_RSS_MAX_KEY_SIZE];
+    u8 ind_table[UPT1_RSS_MAX_IND_TABLE_SIZE];
+} __attribute__((packed));
+
 struct vmxnet3_txdesc {
     u64 addr;
 
@@ -340,6 +362,7 @@ struct vmxnet3_txqueue {
     struct vmxnet3_comp_ring vxtxq_comp_ring;
     struct vmxnet3_txq_shared *vxtxq_ts;
     char vxtxq_name[16];
+    struct pbuf *vxtxq_pbuf[VMXNET3_MAX_TX_NDESC];
 };
 
 struct vmxnet3_rxqueue {
@@ -350,13 +373,16 @@ struct vmxnet3_rxqueue {
     struct vmxnet3_comp_ring vxrxq_comp_ring;
     struct vmxnet3_rxq_shared *vxrxq_rs;
     char vxrxq_name[16];
+    struct pbuf *vxrxq_pbuf[VMXNET3_RXRINGS_PERQ][VMXNET3_MAX_RX_NDESC];
+    struct pbuf *vxrxq_head, *vxrxq_tail;   /* packet being assembled */
 };
 
 /*
- * The number of Rx/Tx queues this driver prefers.
+ * The number of Rx/Tx queues this driver prefers; no more than one per cpu
+ * is used.
  */
-#define VMXNET3_DEF_RX_QUEUES   1 /* 8 on FreeBSD */
-#define VMXNET3_DEF_TX_QUEUES   1 /* 8 on FreeBSD */
+#define VMXNET3_DEF_RX_QUEUES   8
+#define VMXNET3_DEF_TX_QUEUES   8
 
 //aligment
 #define VMXNET_ALIGN_MULTICAST 32
@@ -373,10 +399,10 @@ void vmxnet3_rx_queues_alloc(vmxnet3_pci vp);
 void vmxnet3_queues_shared_alloc(vmxnet3_pci vp);
 void vmxnet3_init_shared_data(vmxnet3_pci vp);
 
-int vmxnet3_isc_txd_encap(vmxnet3_pci vp, struct pbuf *p);
-void vmxnet3_isc_txd_credits_update(vmxnet3_pci vp);
+int vmxnet3_isc_txd_encap(vmxnet3_pci vp, int q, struct pbuf *p, u16 csum_start);
+void vmxnet3_isc_txd_credits_update(vmxnet3_pci vp, int q);
 
 void vmxnet3_set_interrupt_idx(vmxnet3_pci vp);
-boolean vmxnet3_rxq_available(vmxnet3_pci vp);
+boolean vmxnet3_rxq_available(vmxnet3_pci vp, int q);
 
 #endif /* _VMXNET3_QUEUE_H */
@@ -192,6 +192,14 @@ void acpi_walk_madt(acpi_madt madt, madt_handler mh)
         apply(mh, p[0], p);
 }
 
+void acpi_walk_srat(acpi_srat srat, srat_handler sh)
+{
+    u8 *p = (u8 *)(srat + 1);
+    u8 *pe = (u8 *)srat + srat->h.length;
+    for (; p < pe; p += p[1])
+        apply(sh, p[0], p);
+}
+
 void *acpi_get_table(u32 sig)
 {
     return table_find(acpi_tables, pointer_from_u64((u64)sig));
@@ -213,6 +221,99 @@ void init_acpi_tables(kernel_heaps kh)
     }
 }
 
+/* cpu ids are assigned in MADT order, as in init_apic() */
+closure_function(2, 2, void, topology_madt_handler,
+                 u32 *, apic_ids, int *, ncpus,
+                 u8, type, void *, p)
+{
+    int *ncpus = bound(ncpus);
+    u32 id;
+    switch (type) {
+    case ACPI_MADT_LAPIC:
+        if (!(((acpi_lapic)p)->flags & MADT_LAPIC_ENABLED))
+            return;
+        id = ((acpi_lapic)p)->id;
+        break;
+    case ACPI_MADT_LAPICx2:
+        if (!(((acpi_lapic_x2)p)->flags & MADT_LAPIC_ENABLED))
+            return;
+        id = ((acpi_lapic_x2)p)->id;
+        break;
+    default:
+        return;
+    }
+    if (*ncpus < MAX_CPUS)
+        bound(apic_ids)[(*ncpus)++] = id;
+}
+
+static void topology_set_cpu(u32 *apic_ids, int ncpus, u32 apic_id, u32 domain)
+{
+    for (int i = 0; i < ncpus; i++) {
+        if (apic_ids[i] == apic_id) {
+            numa_set_cpu_domain(i, domain);
+            return;
+        }
+    }
+}
+
+closure_function(2, 2, void, topology_srat_handler,
+                 u32 *, apic_ids, int, ncpus,
+                 u8, type, void *, p)
+{
+    switch (type) {
+    case ACPI_SRAT_LAPIC: {
+        acpi_srat_lapic l = p;
+        if (!(l->flags & SRAT_AFFINITY_ENABLED))
+            break;
+        u32 domain = l->domain_lo | (l->domain_hi[0] << 8) |
+            (l->domain_hi[1] << 16) | (l->domain_hi[2] << 24);
+        topology_set_cpu(bound(apic_ids), bound(ncpus), l->apic_id, domain);
+        break;
+    }
+    case ACPI_SRAT_LAPICx2: {
+        acpi_srat_lapic_x2 lx2 = p;
+        if (lx2->flags & SRAT_AFFINITY_ENABLED)
+            topology_set_cpu(bound(apic_ids), bound(ncpus), lx2->id, lx2->domain);
+        break;
+    }
+    case ACPI_SRAT_MEMORY: {
+        acpi_srat_mem m = p;
+        if ((m->flags & SRAT_AFFINITY_ENABLED) && m->length_bytes)
+            numa_add_memory(m->domain, irangel(m->base, m->length_bytes));
+        break;
+    }
+    }
+}
+
+/* Record NUMA affinity from the SRAT and node distances from the SLIT. */
+void init_topology(kernel_heaps kh)
+{
+    /* Read ACPI tables for MADT and SRAT access */
+    init_acpi_tables(kh);
+    acpi_madt madt = acpi_get_table(ACPI_SIG_MADT);
+    acpi_srat srat = acpi_get_table(ACPI_SIG_SRAT);
+    if (!madt || !srat) {
+        acpi_debug("%s: no SRAT or MADT; assuming a single node", __func__);
+        return;
+    }
+    u32 apic_ids[MAX_CPUS];
+    int ncpus = 0;
+    acpi_walk_madt(madt, stack_closure(topology_madt_handler, apic_ids, &ncpus));
+    acpi_walk_srat(srat, stack_closure(topology_srat_handler, apic_ids, ncpus));
+
+    acpi_slit slit = acpi_get_table(ACPI_SIG_SLIT);
+    if (!slit)
+        return;
+    u64 n = slit->localities;
+    if (n > slit->h.length || sizeof(*slit) + n * n > slit->h.length) {
+        msg_err("SLIT with %ld localities exceeds table length\n", n);
+        return;
+    }
+    for (u64 from = 0; from < n; from++)
+        for (u64 to = 0; to < n; to++)
+            numa_set_distance(from, to, slit->entry[from * n + to]);
+}
+
 void init_acpi(kernel_heaps kh)
 {
     heap h = heap_general(kh);
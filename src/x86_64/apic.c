@@ -39,16 +39,30 @@ static inline u32 apic_read(int reg)
     return apic_if->read(apic_if, reg);
 }
 
+boolean (*apic_pv_ipi_mask)(u64 cpus, u64 icr);
+
+void apic_ipi_mask(u64 cpus, u64 flags, u8 vector)
+{
+    if (!cpus)
+        return;
+    if (apic_pv_ipi_mask && apic_pv_ipi_mask(cpus, (flags & ~0xff) | vector))
+        return;
+    if (apic_if->ipi_mask) {
+        apic_if->ipi_mask(apic_if, cpus, flags, vector);
+        return;
+    }
+    for (int i = 0; i < total_processors; i++) {
+        if (cpus & U64_FROM_BIT(i))
+            apic_if->ipi(apic_if, apic_id_map[i], flags, vector);
+    }
+}
+
 void apic_ipi(u32 target, u64 flags, u8 vector)
 {
     /* Do not use native "all but self" destination as it is very slow
      * and may target processors not available */
     if (target == TARGET_EXCLUSIVE_BROADCAST) {
-        for (int i = 0; i < total_processors; i++) {
-            if (current_cpu()->id == i)
-                continue;
-            apic_if->ipi(apic_if, apic_id_map[i], flags, vector);
-        }
+        apic_ipi_mask(MASK(total_processors) & ~U64_FROM_BIT(current_cpu()->id), flags, vector);
         return;
     }
     apic_if->ipi(apic_if, apic_id_map[target], flags, vector);
@@ -79,16 +93,21 @@ static void calibrate_lapic_timer(void)
 
 void lapic_eoi(void)
 {
+    /* with PV EOI, the hypervisor sets bit 0 when it can complete the eoi
+       itself on the next exit, sparing us the exit for the apic write */
+    u32 *pv_eoi = current_cpu()->m.pv_eoi;
+    if (pv_eoi && (__sync_fetch_and_and(pv_eoi, ~1) & 1))
+        return;
     write_barrier();
     apic_write(APIC_EOI, 0);
     write_barrier();
 }
 
-void msi_format(u32 *address, u32 *data, int vector)
+void msi_format(u32 *address, u32 *data, int vector, u32 target_cpu)
 {
     u32 dm = 0;             // destination mode: ignored if rh == 0
     u32 rh = 0;             // redirection hint: 0 - disabled
-    u32 destination = 0;    // destination APIC
+    u32 destination = apic_id_map[target_cpu];  // destination APIC
     *address = (0xfee << 20) | (destination << 12) | (rh << 3) | (dm << 2);
 
     u32 mode = 0;           // delivery mode: 000 fixed, 001 lowest, 010 smi, 100 nmi, 101 init, 111 extint
@@ -105,6 +124,13 @@ void lapic_set_tsc_deadline_mode(u32 v)
     write_barrier();
 }
 
+/* performance counter overflow interrupt; the lvt is masked on delivery */
+void lapic_set_perf_vector(u32 v)
+{
+    assert(apic_if);
+    apic_write(APIC_LVT_PERF, v);
+}
+
 static void lapic_set_timer(timestamp interval)
 {
     /* interval * apic_timer_cal_sec / second */
@@ -54,6 +54,8 @@ typedef struct apic_iface {
     void (*write)(struct apic_iface *, int reg, u64 val);
     u64 (*read)(struct apic_iface *, int reg);       /* XXX 64 for x2? */
     void (*ipi)(struct apic_iface *, u32 target, u64 flags, u8 vector);
+    /* multicast to a mask of cpus, or 0 to send to each in turn */
+    void (*ipi_mask)(struct apic_iface *, u64 cpus, u64 flags, u8 vector);
     boolean (*detect)(struct apic_iface *, kernel_heaps kh);
     void (*per_cpu_init)(struct apic_iface *);
 } *apic_iface;
@@ -61,8 +63,10 @@ typedef struct apic_iface {
 void lapic_eoi(void);
 void init_apic(kernel_heaps kh);
 void lapic_set_tsc_deadline_mode(u32 v);
+void lapic_set_perf_vector(u32 v);
 boolean init_lapic_timer(clock_timer *ct, thunk *per_cpu_init);
 void apic_ipi(u32 target, u64 flags, u8 vector);
+void apic_ipi_mask(u64 cpus, u64 flags, u8 vector);
 void apic_per_cpu_init(void);
 void apic_enable(void);
 int cpuid_from_apicid(u8 aid);
@@ -72,6 +76,11 @@ boolean ioapic_int_is_free(unsigned int gsi);
 void ioapic_register_int(unsigned int gsi, thunk h, const char *name);
 
 extern apic_iface apic_if;
+extern int apic_id_map[MAX_CPUS];
+
+/* multicast ipi provided by the hypervisor, or 0; returns false if the
+   ipi must be sent to each cpu in turn */
+extern boolean (*apic_pv_ipi_mask)(u64 cpus, u64 icr);
 
 static inline u8 apic_id(void)
 {
@@ -13,11 +13,13 @@ thunk platform_timer_percpu_init;
 
 void init_clock(void)
 {
-    /* detect rdtscp */
+    /* detect rdtscp and rdpid */
     u32 regs[4];
     cpuid(0x80000001, 0, regs);
     __vdso_dat->clock_src = VDSO_CLOCK_SYSCALL;
     __vdso_dat->platform_has_rdtscp = (regs[3] & U64_FROM_BIT(27)) != 0;
+    cpuid(0x7, 0, regs);
+    __vdso_dat->platform_has_rdpid = (regs[2] & U64_FROM_BIT(22)) != 0;
 }
 
 /* error refers to the time (expressed in TSC cycles) it takes to read the PIT counter value. */
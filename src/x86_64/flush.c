@@ -1,5 +1,6 @@
 #include <kernel.h>
 #include <apic.h>
+#include <kvm_platform.h>
 
 #define FLUSH_THRESHOLD 32
 #define MAX_FLUSH_ENTRIES 1024
@@ -17,6 +18,16 @@ static volatile boolean service_scheduled;
 static thunk flush_service;
 static queue flush_completion_queue;
 static struct rw_spinlock flush_lock;
+static u64 flush_ipi_pending;   /* cpus with a flush ipi in flight */
+
+/* An idle cpu doesn't need to take part in a shootdown as long as it
+   flushes its whole TLB before touching any memory when it wakes up. A
+   cpu going idle becomes TLB_LAZY; an invalidation then moves it to
+   TLB_STALE and completes on its behalf instead of interrupting it, and
+   the first interrupt after wakeup flushes if the cpu was made stale. */
+#define TLB_ACTIVE  0
+#define TLB_LAZY    1
+#define TLB_STALE   2
 
 static void queue_flush_service();
 
@@ -55,6 +66,9 @@ static void _flush_handler(void)
      * greater than FLUSH_THRESHOLD, just do a full tlb flush */
     boolean full_flush = inval_gen - ci->inval_gen > FLUSH_THRESHOLD;
 
+    /* a sender finding this bit clear must interrupt us again for any
+       generation published after this point */
+    atomic_clear_bit(&flush_ipi_pending, ci->id);
     spin_rlock(&flush_lock);
     while (ci->inval_gen != inval_gen) {
         word oldgen = ci->inval_gen;
@@ -73,8 +87,8 @@ static void _flush_handler(void)
                         invalidate(f->pages[i]);
                 }
             }
-            atomic_clear_bit(&f->cpu_mask, ci->id);
-            refcount_release(&f->ref);
+            if (atomic_test_and_clear_bit(&f->cpu_mask, ci->id))
+                refcount_release(&f->ref);
         }
     }
     spin_runlock(&flush_lock);
@@ -93,6 +107,45 @@ void page_invalidate_flush()
     _flush_handler();
 }
 
+void page_invalidate_idle(void)
+{
+    current_cpu()->m.tlb_state = TLB_LAZY;
+}
+
+void page_invalidate_wake(void)
+{
+    cpuinfo ci = current_cpu();
+    if (ci->m.tlb_state == TLB_ACTIVE)
+        return;
+    if (__sync_lock_test_and_set(&ci->m.tlb_state, TLB_ACTIVE) == TLB_STALE)
+        flush_tlb();
+}
+
+/* Interrupt each other cpu that may hold stale translations, skipping idle
+   cpus and cpus that have yet to service an earlier flush ipi, which will
+   pick up this generation as well. A vcpu preempted by the hypervisor is
+   treated like an idle cpu: the hypervisor flushes its TLB before resuming
+   it. The remaining cpus are interrupted together. */
+static void flush_send_ipis(flush_entry f)
+{
+    u32 self = current_cpu()->id;
+    u64 targets = 0;
+    for (u32 i = 0; i < total_processors; i++) {
+        if (i == self)
+            continue;
+        cpuinfo ci = cpuinfo_from_id(i);
+        if (compare_and_swap_32(&ci->m.tlb_state, TLB_LAZY, TLB_STALE) ||
+            ci->m.tlb_state == TLB_STALE || kvm_vcpu_defer_tlb_flush(ci)) {
+            if (atomic_test_and_clear_bit(&f->cpu_mask, i))
+                refcount_release(&f->ref);
+            continue;
+        }
+        if (!atomic_test_and_set_bit(&flush_ipi_pending, i))
+            targets |= U64_FROM_BIT(i);
+    }
+    apic_ipi_mask(targets, 0, flush_ipi);
+}
+
 void page_invalidate(flush_entry f, u64 p)
 {
     if (initialized) {
@@ -187,7 +240,7 @@ void page_invalidate_sync(flush_entry f, thunk completion)
         f->gen = fetch_and_add((word *)&inval_gen, 1) + 1;
         spin_wunlock(&flush_lock);
 
-        apic_ipi(TARGET_EXCLUSIVE_BROADCAST, 0, flush_ipi);
+        flush_send_ipis(f);
         _flush_handler();
         irq_restore(flags);
     } else {
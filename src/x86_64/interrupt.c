@@ -3,7 +3,6 @@
 #include <region.h>
 #include <apic.h>
 #include <symtab.h>
-#include <drivers/acpi.h>
 
 //#define INT_DEBUG
 #ifdef INT_DEBUG
@@ -215,6 +214,7 @@ void common_handler()
 
     // if we were idle, we are no longer
     atomic_clear_bit(&idle_cpu_mask, ci->id);
+    page_invalidate_wake();
 
     int_debug("[%02d] # %d (%s), state %s, frame %p, rip 0x%lx, cr2 0x%lx\n",
               ci->id, i, interrupt_names[i], state_strings[ci->state],
@@ -255,7 +255,9 @@ void common_handler()
     /* invoke handler if available, else general fault handler */
     if (handlers[i]) {
         ci->state = cpu_interrupt;
+        u64 start = rdtsc();
         apply(handlers[i]);
+        interrupt_stats_record(ci, i, start);
         if (i >= INTERRUPT_VECTOR_START)
             lapic_eoi();
     } else {
@@ -320,6 +322,7 @@ void register_interrupt(int vector, thunk t, const char *name)
              __func__, vector, handlers[vector]);
     handlers[vector] = t;
     interrupt_names[vector] = name;
+    interrupt_stats_register(vector, name);
 }
 
 void unregister_interrupt(int vector)
@@ -328,6 +331,7 @@ void unregister_interrupt(int vector)
         halt("%s: no handler registered for vector %d\n", __func__, vector);
     handlers[vector] = 0;
     interrupt_names[vector] = 0;
+    interrupt_stats_unregister(vector);
 }
 
 closure_function(1, 0, void, shirq_handler,
@@ -384,9 +388,6 @@ void init_interrupts(kernel_heaps kh)
     heap general = heap_general(kh);
     cpuinfo ci = current_cpu();
 
-    /* Read ACPI tables for MADT access */
-    init_acpi_tables(kh);
-
     /* Exception handlers */
     handlers = allocate_zero(general, n_interrupt_vectors * sizeof(thunk));
     assert(handlers != INVALID_ADDRESS);
@@ -395,6 +396,7 @@ void init_interrupts(kernel_heaps kh)
     assert(interrupt_vector_heap != INVALID_ADDRESS);
 
     int_general = general;
+    init_interrupt_stats(general, n_interrupt_vectors);
 
     /* Separate stack to keep exceptions in interrupt handlers from
        trashing the interrupt stack */
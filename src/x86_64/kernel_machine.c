@@ -7,6 +7,11 @@ void send_ipi(u64 cpu, u8 vector)
     apic_ipi(cpu, 0, vector);
 }
 
+void send_ipi_mask(u64 cpus, u8 vector)
+{
+    apic_ipi_mask(cpus, 0, vector);
+}
+
 void interrupt_exit(void)
 {
     lapic_eoi();
@@ -105,8 +105,17 @@ static inline void wait_for_interrupt(void)
     asm volatile("sti; hlt" ::: "memory");
 }
 
+/* zero a multiple of 32 bytes with stores that bypass the cache */
+static inline void zero_nontemporal(void *x, bytes length)
+{
+    for (u64 *p = x, *end = x + length; p < end; p += 4)
+        asm volatile("movnti %1, (%0); movnti %1, 8(%0); movnti %1, 16(%0); movnti %1, 24(%0)"
+                     :: "r"(p), "r"(0ull) : "memory");
+    asm volatile("sfence" ::: "memory");
+}
+
 void triple_fault(void) __attribute__((noreturn));
-void start_cpu(int index);
+void start_cpus(int count, boolean fast);
 void allocate_apboot(heap stackheap, void (*ap_entry)());
 void deallocate_apboot(heap stackheap);
 void install_idt(void);
@@ -165,6 +174,27 @@ static inline void cpuid(u32 fn, u32 ecx, u32 * v)
     asm volatile("cpuid" : "=a" (v[0]), "=b" (v[1]), "=c" (v[2]), "=d" (v[3]) : "0" (fn), "2" (ecx));
 }
 
+/* MONITOR/MWAIT; hypervisors expose it when a vcpu may idle without
+   exiting */
+static inline boolean monitor_wait_available(void)
+{
+    u32 v[4];
+    cpuid(0x1, 0, v);
+    return (v[2] & (1 << 3)) != 0;
+}
+
+/* Wait for an interrupt or a write to the cacheline of *addr, unless the
+   bits of mask are already clear there. Called with interrupts disabled;
+   returns with them enabled. */
+static inline void monitor_wait(u64 *addr, u64 mask)
+{
+    asm volatile("monitor" :: "a"(addr), "c"(0), "d"(0) : "memory");
+    if (*(volatile u64 *)addr & mask)
+        asm volatile("sti; mwait" :: "a"(0), "c"(0) : "memory");
+    else
+        enable_interrupts();
+}
+
 /* syscall entry */
 
 static inline void set_syscall_handler(void *syscall_entry)
@@ -228,6 +258,13 @@ struct cpuinfo_machine {
     /* Monotonic clock timestamp when the lapic timer is supposed to fire; used to re-arm the timer
      * when it fires too early (based on what the monotonic clock source says). */
     timestamp lapic_timer_expiry;
+
+    /* TLB_* state for lazy shootdowns of idle cpus, see flush.c */
+    u32 tlb_state;
+
+    /* areas shared with the hypervisor, or 0; see kvm_platform.c */
+    u32 *pv_eoi;
+    struct kvm_steal_time *steal_time;
 };
 
 typedef struct cpuinfo *cpuinfo;
@@ -306,6 +343,21 @@ static inline u64 fault_address(context f)
     return f[FRAME_CR2];
 }
 
+static inline u64 frame_pc(context f)
+{
+    return f[FRAME_RIP];
+}
+
+static inline u64 frame_fp(context f)
+{
+    return f[FRAME_RBP];
+}
+
+static inline boolean frame_is_user(context f)
+{
+    return (f[FRAME_CS] & 3) != 0;
+}
+
 static inline boolean is_page_fault(context f)
 {
     return f[FRAME_VECTOR] == 14; // XXX defined somewhere?
@@ -339,6 +391,16 @@ static inline void frame_set_sp(context f, u64 sp)
     rv;\
 })
 
+#define do_syscall3(sysnr, rdi, rsi, rdx) ({\
+    sysreturn rv;\
+    asm volatile("syscall"\
+        : "=a" (rv)\
+        : "0" (sysnr), "D" (rdi), "S"(rsi), "d"(rdx)\
+        : "rcx", "r11", "memory"\
+    );\
+    rv;\
+})
+
 /* clocksource */
 static inline u64
 _rdtscp(void)
@@ -392,6 +454,14 @@ static inline void machine_halt(void)
 }
 
 void send_ipi(u64 cpu, u8 vector);
+void send_ipi_mask(u64 cpus, u8 vector);
+
+/* pmu.c: sampling on unhalted core cycles, for cpu_profile.c */
+boolean pmu_sampling_set_frequency(u64 frequency);
+void pmu_sampling_cpu_start(u8 vector);
+void pmu_sampling_cpu_stop(void);
+boolean pmu_sampling_overflowed(void);
+void pmu_sampling_rearm(void);
 
 u64 allocate_interrupt(void);
 void deallocate_interrupt(u64 irq);
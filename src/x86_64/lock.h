@@ -1,5 +1,15 @@
 /* struct spinlock defined in machine.h */
 
+#ifdef LOCK_STATS
+#if !defined(SMP_ENABLE) && !defined(SPIN_LOCK_DEBUG_NOSMP)
+#error "LOCK_STATS requires SMP_ENABLE or SPIN_LOCK_DEBUG_NOSMP"
+#endif
+/* raw primitives; the profiled versions are defined below */
+#define spin_try _spin_try
+#define spin_lock _spin_lock
+#define spin_unlock _spin_unlock
+#endif
+
 #if defined(KERNEL) && defined(SMP_ENABLE)
 static inline boolean spin_try(spinlock l) {
     u64 tmp = 1;
@@ -96,6 +106,84 @@ static inline void spin_wunlock(rw_spinlock l) {
 #endif
 #endif
 
+#ifdef LOCK_STATS
+#undef spin_try
+#undef spin_lock
+#undef spin_unlock
+
+/* All cycle counts are in TSC ticks. Stats may be shared by several locks
+   registered under the same name, so they are updated atomically. */
+struct lock_stats {
+    const char *name;
+    u64 acquisitions;
+    u64 contended;              /* acquisitions that had to spin */
+    u64 failed_tries;
+    u64 spin_cycles;
+    u64 max_hold_cycles;
+};
+
+void lock_stats_register(spinlock l, const char *name);
+
+static inline u64 lock_stats_cycles(void)
+{
+    u32 a, d;
+    asm volatile("rdtsc" : "=a" (a), "=d" (d));
+    return (((u64)a) | (((u64)d) << 32));
+}
+
+static inline void lock_stats_acquired(spinlock l, u64 spun)
+{
+    struct lock_stats *s = l->stats;
+    fetch_and_add(&s->acquisitions, 1);
+    if (spun) {
+        fetch_and_add(&s->contended, 1);
+        fetch_and_add(&s->spin_cycles, spun);
+    }
+    l->hold_start = lock_stats_cycles();
+}
+
+static inline boolean spin_try(spinlock l)
+{
+    if (!_spin_try(l)) {
+        if (l->stats)
+            fetch_and_add(&l->stats->failed_tries, 1);
+        return false;
+    }
+    if (l->stats)
+        lock_stats_acquired(l, 0);
+    return true;
+}
+
+static inline void spin_lock(spinlock l)
+{
+    if (!l->stats) {
+        _spin_lock(l);
+        return;
+    }
+    if (_spin_try(l)) {
+        lock_stats_acquired(l, 0);
+        return;
+    }
+    u64 start = lock_stats_cycles();
+    _spin_lock(l);
+    lock_stats_acquired(l, MAX(lock_stats_cycles() - start, 1));
+}
+
+static inline void spin_unlock(spinlock l)
+{
+    struct lock_stats *s = l->stats;
+    if (s) {
+        u64 held = lock_stats_cycles() - l->hold_start;
+        u64 max;
+        while (held > (max = s->max_hold_cycles) &&
+               !__sync_bool_compare_and_swap(&s->max_hold_cycles, max, held));
+    }
+    _spin_unlock(l);
+}
+#else
+#define lock_stats_register(l, name)
+#endif
+
 static inline u64 spin_lock_irq(spinlock l)
 {
     u64 flags = read_flags();
@@ -141,6 +229,9 @@ static inline void spin_runlock_irq(rw_spinlock l, u64 flags)
 static inline void spin_lock_init(spinlock l)
 {
     l->w = 0;
+#ifdef LOCK_STATS
+    l->stats = 0;
+#endif
 }
 
 static inline void spin_rw_lock_init(rw_spinlock l)
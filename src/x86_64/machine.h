@@ -44,6 +44,10 @@ static inline u8 tagof(void *v)
 
 typedef struct spinlock {
     word w;
+#if defined(KERNEL) && defined(LOCK_STATS)
+    struct lock_stats *stats;   /* 0 if not profiled */
+    u64 hold_start;
+#endif
 } *spinlock;
 
 typedef struct rw_spinlock {
@@ -35,8 +35,9 @@ void cpu_init(int cpu)
     u64 addr = u64_from_pointer(cpuinfo_from_id(cpu));
     write_msr(KERNEL_GS_MSR, 0); /* clear user GS */
     write_msr(GS_MSR, addr);
-    if (VVAR_REF(vdso_dat).platform_has_rdtscp)
-        write_msr(TSC_AUX_MSR, cpu);    /* used by vdso_getcpu() */
+    /* used by vdso_getcpu(); node in the upper bits, as on linux */
+    if (VVAR_REF(vdso_dat).platform_has_rdtscp || VVAR_REF(vdso_dat).platform_has_rdpid)
+        write_msr(TSC_AUX_MSR, (cpuinfo_from_id(cpu)->node << 12) | cpu);
     init_syscall_handler();
 }
 
@@ -95,15 +96,29 @@ void deallocate_apboot(heap stackheap)
 }
 
 #define AP_START_TIMEOUT_MS 200
-void start_cpu(int index) {
+
+/* Start APs 1 through count - 1 together: each step of the INIT-SIPI-SIPI
+   sequence is sent to every AP before waiting, so the delays are paid once
+   rather than per AP. The APs then serialize only on ap_lock, held while
+   on the shared boot stack until switching to their own kernel stacks.
+   Hypervisors that start a vcpu on the first SIPI (fast) need neither the
+   delays nor the second SIPI. */
+void start_cpus(int count, boolean fast)
+{
     u8 vector = (((u64)apboot) >> 12) & 0xff;
 
     int nproc = total_processors;
-    apic_ipi(index, ICR_TYPE_INIT, 0);
-    kernel_delay(milliseconds(10));
-    apic_ipi(index, ICR_TYPE_STARTUP, vector);
-    kernel_delay(microseconds(200));
-    apic_ipi(index, ICR_TYPE_STARTUP, vector);
-    for (u64 to = 0; total_processors != nproc + 1 && to < AP_START_TIMEOUT_MS; to++)
+    for (int i = 1; i < count; i++)
+        apic_ipi(i, ICR_TYPE_INIT, 0);
+    if (!fast)
+        kernel_delay(milliseconds(10));
+    for (int i = 1; i < count; i++)
+        apic_ipi(i, ICR_TYPE_STARTUP, vector);
+    if (!fast) {
+        kernel_delay(microseconds(200));
+        for (int i = 1; i < count; i++)
+            apic_ipi(i, ICR_TYPE_STARTUP, vector);
+    }
+    for (u64 to = 0; total_processors != nproc + count - 1 && to < AP_START_TIMEOUT_MS; to++)
         kernel_delay(milliseconds(1));
 }
@@ -50,7 +50,7 @@ static inline u64 boot_pteaddr_from_pointer(u64 *p)
     return u64_from_pointer(p);
 }
 #else
-static table pt_p2v;
+static otable pt_p2v;
 static range pt_initial_phys;
 
 static inline u64 *boot_pointer_from_pteaddr(u64 pa)
@@ -71,7 +71,7 @@ static inline u64 *kern_pointer_from_pteaddr(u64 pa)
     }
     u64 offset = pa & MASK(PAGELOG_2M);
     u64 p = pa & ~MASK(PAGELOG_2M);
-    u64 v = (u64)table_find(pt_p2v, (void *)p);
+    u64 v = (u64)otable_find(pt_p2v, (void *)p);
     assert(v);
     return pointer_from_u64(v + offset);
 }
@@ -399,13 +399,13 @@ closure_function(2, 3, boolean, update_pte_flags,
 }
 
 /* Update access protection flags for any pages mapped within a given area */
-void update_map_flags(u64 vaddr, u64 length, pageflags flags)
+void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, thunk complete)
 {
     flags.w &= ~_PAGE_NO_FAT;
     page_debug("vaddr 0x%lx, length 0x%lx, flags 0x%lx\n", vaddr, length, flags.w);
     flush_entry fe = get_page_flush_entry();
     traverse_ptes(vaddr, length, stack_closure(update_pte_flags, flags, fe));
-    page_invalidate_sync(fe, ignore);
+    page_invalidate_sync(fe, complete);
 }
 
 /* called with lock held */
@@ -477,6 +477,109 @@ void zero_mapped_pages(u64 vaddr, u64 length)
     traverse_ptes(vaddr, length, stack_closure(zero_page));
 }
 
+/* called with lock held */
+closure_function(2, 3, boolean, remap_private_entry,
+                 physical, p, pageflags, flags,
+                 int, level, u64, addr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    if (pte_is_present(e) && level == 4) {
+        pte_set(entry, bound(p) | (bound(flags).w & ~_PAGE_NO_FAT) | _PAGE_PRESENT);
+        asm volatile("invlpg (%0)" :: "r" (addr) : "memory");
+    }
+    return true;
+}
+
+/* Point a mapped 4K page of a window used by this cpu alone at another
+   physical page. No other cpu can hold a translation for it, so only the
+   local TLB entry is invalidated, sparing the others a shootdown. */
+void remap_private_page(u64 vaddr, physical p, pageflags flags)
+{
+    traverse_ptes(vaddr, PAGESIZE, stack_closure(remap_private_entry, p, flags));
+}
+
+/* Replace a 2M mapping covering vaddr, if any, with a table of 4K pages
+   mapping the same memory, so that part of it may be unmapped or
+   reprotected. Returns true if a mapping was split. */
+boolean split_2m_page(u64 vaddr)
+{
+    boolean split = false;
+    u64 v = vaddr & MASK(VIRTUAL_ADDRESS_BITS);
+    flush_entry fe = get_page_flush_entry();
+    pagetable_lock();
+    u64 table = pagebase;
+    u64 *pte = 0;
+    for (int level = 1; level <= 3; level++) {
+        pte = pointer_from_pteaddr(pte_lookup_phys(table, v, level_shift[level]));
+        if ((*pte & _PAGE_PRESENT) == 0)
+            goto out;
+        table = page_from_pte(*pte);
+    }
+    if ((*pte & _PAGE_2M_SIZE) == 0)
+        goto out;
+    u64 *n = allocate(pageheap, PAGESIZE);
+    if (n == INVALID_ADDRESS)
+        halt("%s: ran out of page table memory\n", __func__);
+    u64 flags = flags_from_pte(*pte) & ~_PAGE_2M_SIZE;
+    for (int i = 0; i < PTE_ENTRIES; i++)
+        n[i] = (table + (i << PAGELOG)) | flags;
+    *pte = pteaddr_from_pointer(n) | _PAGE_WRITABLE | _PAGE_USER | _PAGE_PRESENT;
+    page_invalidate(fe, vaddr & ~PAGEMASK_2M);
+    split = true;
+  out:
+    pagetable_unlock();
+    page_invalidate_sync(fe, ignore);
+    return split;
+}
+
+closure_function(2, 0, void, collapse_complete,
+                 u64 *, table, thunk, complete)
+{
+    u64 *table = bound(table);
+    if (table)
+        deallocate(pageheap, table, PAGESIZE);
+    apply(bound(complete));
+    closure_finish();
+}
+
+/* Replace a table of 4K pages covering the 2M-aligned vaddr with a 2M
+   mapping of p, which must hold the same contents. If a mapping was
+   collapsed, complete is applied once the old translations are gone, after
+   which the caller may release the 4K pages. The table page is freed along
+   with them unless it came from the initial page table region. */
+boolean collapse_2m_page(u64 vaddr, physical p, pageflags flags, thunk complete)
+{
+    boolean collapsed = false;
+    u64 v = vaddr & MASK(VIRTUAL_ADDRESS_BITS);
+    thunk c = closure(heap_locked(get_kernel_heaps()), collapse_complete, 0, complete);
+    if (c == INVALID_ADDRESS)
+        return false;
+    flush_entry fe = get_page_flush_entry();
+    pagetable_lock();
+    u64 table = pagebase;
+    u64 *pte = 0;
+    for (int level = 1; level <= 3; level++) {
+        pte = pointer_from_pteaddr(pte_lookup_phys(table, v, level_shift[level]));
+        if ((*pte & _PAGE_PRESENT) == 0 || (*pte & _PAGE_2M_SIZE))
+            goto out;
+        table = page_from_pte(*pte);
+    }
+    if (!point_in_range(pt_initial_phys, table))
+        closure_member(collapse_complete, c, table) = pointer_from_pteaddr(table);
+    *pte = p | (flags.w & ~_PAGE_NO_FAT) | _PAGE_2M_SIZE | _PAGE_PRESENT;
+    for (int i = 0; i < PTE_ENTRIES; i++)
+        page_invalidate(fe, vaddr + (i << PAGELOG));
+    collapsed = true;
+  out:
+    pagetable_unlock();
+    if (!collapsed) {
+        deallocate_closure(c);
+        c = ignore;
+    }
+    page_invalidate_sync(fe, c);
+    return collapsed;
+}
+
 /* called with lock held */
 closure_function(2, 3, boolean, unmap_page,
                  range_handler, rh, flush_entry, fe,
@@ -639,7 +742,7 @@ static u64 pt_2m_alloc(heap h, bytes size)
             halt("%s: failed to allocate 2M physical page\n", __func__);
         /* we depend the pmd already being installed to avoid an alloc here */
         map_page(pagebase, i, p, true, _PAGE_WRITABLE | _PAGE_PRESENT, 0, fe);
-        table_set(pt_p2v, (void *)p, (void *)i);
+        otable_set(pt_p2v, (void *)p, (void *)i);
     }
     page_invalidate_sync(fe, ignore);
     return v;
@@ -673,7 +776,7 @@ void init_page_tables(heap h, id_heap physical, range initial_phys)
     spin_lock_init(&pt_lock);
     phys_internal = physical;
 
-    pt_p2v = allocate_table(h, identity_key, pointer_equal);
+    pt_p2v = allocate_otable(h, identity_key, pointer_equal, 0);
     assert(pt_p2v != INVALID_ADDRESS);
 
     /* store initial boundaries for p->v lookup */
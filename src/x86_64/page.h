@@ -148,6 +148,11 @@ static inline void pt_pte_clean(pteptr pp)
     *pp &= ~_PAGE_DIRTY;
 }
 
+static inline void pt_pte_write_protect(pteptr pp)
+{
+    *pp &= ~(_PAGE_WRITABLE | _PAGE_DIRTY);
+}
+
 #ifndef physical_from_virtual
 physical physical_from_virtual(void *x);
 #endif
@@ -163,9 +168,18 @@ static inline void unmap_pages(u64 virtual, u64 length)
     unmap_pages_with_handler(virtual, length, 0);
 }
 
-void update_map_flags(u64 vaddr, u64 length, pageflags flags);
+void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, thunk complete);
+
+static inline void update_map_flags(u64 vaddr, u64 length, pageflags flags)
+{
+    update_map_flags_with_complete(vaddr, length, flags, ignore);
+}
+
 void zero_mapped_pages(u64 vaddr, u64 length);
+void remap_private_page(u64 vaddr, physical p, pageflags flags);
 void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length);
+boolean split_2m_page(u64 vaddr);
+boolean collapse_2m_page(u64 vaddr, physical p, pageflags flags, thunk complete);
 void dump_ptes(void *x);
 
 static inline void map_and_zero(u64 v, physical p, u64 length, pageflags flags)
@@ -189,6 +203,8 @@ void page_invalidate(flush_entry f, u64 p);
 void page_invalidate_sync(flush_entry f, thunk completion);
 flush_entry get_page_flush_entry();
 void page_invalidate_flush();
+void page_invalidate_idle(void);
+void page_invalidate_wake(void);
 void flush_tlb();
 void init_flush(heap);
 void *bootstrap_page_tables(heap initial);
@@ -0,0 +1,121 @@
+#include <kernel.h>
+#include <apic.h>
+
+/* Sampling with general purpose counter 0 of the architectural performance
+   monitoring interface (cpuid leaf 0xa), counting unhalted core cycles and
+   interrupting on overflow. Hypervisors often don't expose a vPMU, and AMD
+   processors don't implement leaf 0xa; cpu_profile.c then falls back to a
+   timer. */
+
+//#define PMU_DEBUG
+#ifdef PMU_DEBUG
+#define pmu_debug(x, ...) do {rprintf("PMU: " x, ##__VA_ARGS__);} while(0)
+#else
+#define pmu_debug(x, ...)
+#endif
+
+#define IA32_PMC0                   0xc1
+#define IA32_PERFEVTSEL0            0x186
+#define IA32_PERF_GLOBAL_CTRL       0x38f
+#define IA32_PERF_GLOBAL_OVF_CTRL   0x390
+
+#define PERFEVTSEL_USR  U64_FROM_BIT(16)
+#define PERFEVTSEL_OS   U64_FROM_BIT(17)
+#define PERFEVTSEL_INT  U64_FROM_BIT(20)
+#define PERFEVTSEL_EN   U64_FROM_BIT(22)
+
+/* UnHalted Core Cycles */
+#define PERFEVTSEL_CYCLES   (0x3c | PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_INT | PERFEVTSEL_EN)
+
+#define PMU_CALIBRATE_MS    10
+
+static struct {
+    u32 version;                /* 0 if unusable */
+    u32 width;                  /* counter bits */
+    u64 cycles_per_sec;
+    u64 period;
+    u8 vector;
+} pmu;
+
+static boolean pmu_detect(void)
+{
+    u32 v[4];
+    cpuid(0, 0, v);
+    if (v[0] < 0xa)
+        return false;
+    cpuid(0xa, 0, v);
+    u32 version = v[0] & 0xff;
+    u32 ncounters = (v[0] >> 8) & 0xff;
+    u32 ebx_len = (v[0] >> 24) & 0xff;
+    pmu_debug("version %d, %d counters, ebx 0x%x/%d\n", version, ncounters, v[1], ebx_len);
+
+    /* a set bit in ebx means the event is not available */
+    if (version == 0 || ncounters == 0 || ebx_len == 0 || (v[1] & 1))
+        return false;
+    pmu.width = (v[0] >> 16) & 0xff;
+    pmu.version = version;
+    return true;
+}
+
+/* core cycles are close enough to the time stamp counter for picking a
+   sampling period */
+static u64 pmu_calibrate(void)
+{
+    u64 tsc = rdtsc();
+    kernel_delay(milliseconds(PMU_CALIBRATE_MS));
+    return (rdtsc() - tsc) * (1000 / PMU_CALIBRATE_MS);
+}
+
+boolean pmu_sampling_set_frequency(u64 frequency)
+{
+    if (!pmu.version && !pmu_detect())
+        return false;
+    if (!pmu.cycles_per_sec)
+        pmu.cycles_per_sec = pmu_calibrate();
+    u64 period = pmu.cycles_per_sec / frequency;
+
+    /* writes to the counter are sign extended from 32 bits */
+    pmu.period = MAX(1, MIN(period, MASK(31)));
+    pmu_debug("%ld cycles/s, period %ld\n", pmu.cycles_per_sec, pmu.period);
+    return true;
+}
+
+static inline void pmu_load_counter(void)
+{
+    write_msr(IA32_PMC0, -pmu.period);
+}
+
+void pmu_sampling_cpu_start(u8 vector)
+{
+    pmu.vector = vector;
+    write_msr(IA32_PERFEVTSEL0, 0);
+    pmu_load_counter();
+    lapic_set_perf_vector(vector);
+    write_msr(IA32_PERFEVTSEL0, PERFEVTSEL_CYCLES);
+    if (pmu.version >= 2)
+        write_msr(IA32_PERF_GLOBAL_CTRL, read_msr(IA32_PERF_GLOBAL_CTRL) | 1);
+}
+
+void pmu_sampling_cpu_stop(void)
+{
+    if (!pmu.version)
+        return;
+    write_msr(IA32_PERFEVTSEL0, 0);
+    if (pmu.version >= 2)
+        write_msr(IA32_PERF_GLOBAL_CTRL, read_msr(IA32_PERF_GLOBAL_CTRL) & ~1ull);
+    lapic_set_perf_vector(APIC_LVT_INTMASK);
+}
+
+/* the counter counts up from -period; once past zero, its top bit is clear */
+boolean pmu_sampling_overflowed(void)
+{
+    return (read_msr(IA32_PMC0) & U64_FROM_BIT(pmu.width - 1)) == 0;
+}
+
+void pmu_sampling_rearm(void)
+{
+    pmu_load_counter();
+    if (pmu.version >= 2)
+        write_msr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    lapic_set_perf_vector(pmu.vector);
+}
@@ -226,8 +226,8 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, lchown, syscall_ignore);
     register_syscall(map, ptrace, 0);
     register_syscall(map, syslog, 0);
-    register_syscall(map, getgid, syscall_ignore);
-    register_syscall(map, getegid, syscall_ignore);
+    register_syscall_nolock(map, getgid, syscall_ignore);
+    register_syscall_nolock(map, getegid, syscall_ignore);
     register_syscall(map, setpgid, 0);
     register_syscall(map, getppid, 0);
     register_syscall(map, getpgrp, 0);
@@ -257,7 +257,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, sched_get_priority_max, 0);
     register_syscall(map, sched_get_priority_min, 0);
     register_syscall(map, sched_rr_get_interval, 0);
-    register_syscall(map, mlock, syscall_ignore);
     register_syscall(map, munlock, syscall_ignore);
     register_syscall(map, mlockall, syscall_ignore);
     register_syscall(map, munlockall, syscall_ignore);
@@ -290,7 +289,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, afs_syscall, 0);
     register_syscall(map, tuxcall, 0);
     register_syscall(map, security, 0);
-    register_syscall(map, readahead, 0);
     register_syscall(map, setxattr, 0);
     register_syscall(map, lsetxattr, 0);
     register_syscall(map, fsetxattr, 0);
@@ -330,9 +328,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, keyctl, 0);
     register_syscall(map, ioprio_set, 0);
     register_syscall(map, ioprio_get, 0);
-    register_syscall(map, inotify_init, 0);
-    register_syscall(map, inotify_add_watch, 0);
-    register_syscall(map, inotify_rm_watch, 0);
     register_syscall(map, migrate_pages, 0);
     register_syscall(map, mknodat, 0);
     register_syscall(map, fchownat, syscall_ignore);
@@ -340,17 +335,12 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, linkat, 0);
     register_syscall(map, fchmodat, syscall_ignore);
     register_syscall(map, unshare, 0);
-    register_syscall(map, splice, 0);
-    register_syscall(map, tee, 0);
     register_syscall(map, sync_file_range, 0);
-    register_syscall(map, vmsplice, 0);
     register_syscall(map, move_pages, 0);
     register_syscall(map, utimensat, 0);
-    register_syscall(map, inotify_init1, 0);
     register_syscall(map, preadv, 0);
     register_syscall(map, pwritev, 0);
     register_syscall(map, perf_event_open, 0);
-    register_syscall(map, recvmmsg, 0);
     register_syscall(map, fanotify_init, 0);
     register_syscall(map, fanotify_mark, 0);
     register_syscall(map, name_to_handle_at, 0);
@@ -364,14 +354,10 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, sched_setattr, 0);
     register_syscall(map, sched_getattr, 0);
     register_syscall(map, seccomp, 0);
-    register_syscall(map, memfd_create, 0);
     register_syscall(map, kexec_file_load, 0);
     register_syscall(map, bpf, 0);
     register_syscall(map, execveat, 0);
     register_syscall(map, userfaultfd, 0);
-    register_syscall(map, membarrier, 0);
-    register_syscall(map, mlock2, syscall_ignore);
-    register_syscall(map, copy_file_range, 0);
     register_syscall(map, preadv2, 0);
     register_syscall(map, pwritev2, 0);
     register_syscall(map, pkey_mprotect, 0);
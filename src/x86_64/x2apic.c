@@ -59,6 +59,33 @@ static void x2apic_ipi(apic_iface i, u32 target, u64 flags, u8 vector)
     x2apic_write(i, APIC_ICR, w);
 }
 
+/* In x2APIC mode logical destinations are always in cluster mode, with the
+   logical id derived from the x2APIC id: the cluster (id[19:4]) in the upper
+   16 bits and one bit for the position in the cluster (id[3:0]) below. One
+   ICR write reaches any set of cpus within a cluster. */
+#define X2APIC_CLUSTER(id)  ((id) >> 4)
+#define X2APIC_LOGICAL(id)  ((X2APIC_CLUSTER(id) << 16) | U32_FROM_BIT((id) & 0xf))
+
+static void x2apic_ipi_mask(apic_iface i, u64 cpus, u64 flags, u8 vector)
+{
+    u64 icr = (flags & ~0xff) | vector | ICR_LOGICAL;
+    while (cpus) {
+        u32 cluster = X2APIC_CLUSTER(apic_id_map[lsb(cpus)]);
+        u32 dest = 0;
+        for (u64 m = cpus; m; m &= m - 1) {
+            int cpu = lsb(m);
+            u32 id = apic_id_map[cpu];
+            if (X2APIC_CLUSTER(id) == cluster) {
+                dest |= X2APIC_LOGICAL(id);
+                cpus &= ~U64_FROM_BIT(cpu);
+            }
+        }
+        x2apic_debug("sending ipi: logical dest 0x%x, flags 0x%lx, vector %d\n",
+                     dest, flags, vector);
+        x2apic_write(i, APIC_ICR, icr | (((u64)dest) << 32));
+    }
+}
+
 static boolean detect(apic_iface i, kernel_heaps kh)
 {
     u32 v[4];
@@ -84,6 +111,7 @@ struct apic_iface x2apic_if = {
     x2apic_write,
     x2apic_read,
     x2apic_ipi,
+    x2apic_ipi_mask,
     detect,
     per_cpu_init
 };
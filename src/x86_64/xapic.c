@@ -85,6 +85,7 @@ struct apic_iface xapic_if = {
     xapic_write,
     xapic_read,
     xapic_ipi,
+    0,                          /* ipi_mask: physical destinations only */
     detect,
     0,                          /* per_cpu_init, n/a */
 };
@@ -24,6 +24,9 @@
 
 #include "xen_internal.h"
 
+#define EVTCHN_FIFO_WORDS_PER_PAGE (PAGESIZE / sizeof(event_word_t))
+#define EVTCHN_FIFO_MAX_PAGES (EVTCHN_FIFO_NR_CHANNELS / EVTCHN_FIFO_WORDS_PER_PAGE)
+
 typedef struct xen_platform_info {
     heap    h;                  /* general heap for internal use */
 
@@ -36,6 +39,21 @@ typedef struct xen_platform_info {
 
     /* event channel interface / PV interrupts */
     volatile struct shared_info *shared_info;
+    volatile struct vcpu_info *vcpu_info[MAX_CPUS];
+    u32 vcpu_id[MAX_CPUS];
+    boolean evtchn_fifo;
+
+    /* FIFO ABI: event words, and per-cpu control blocks and queue heads */
+    struct spinlock fifo_lock;  /* expanding the event array */
+    volatile event_word_t *fifo_array[EVTCHN_FIFO_MAX_PAGES];
+    u32 fifo_pages;
+    volatile evtchn_fifo_control_block_t *fifo_control[MAX_CPUS];
+    u32 fifo_head[MAX_CPUS][EVTCHN_FIFO_MAX_QUEUES];
+
+    /* 2-level ABI: ports bound to each cpu; cpu 0 takes those not bound to
+       any other, including ones without a handler */
+    u64 evtchn_2l_cpu[MAX_CPUS][EVTCHN_2L_NR_CHANNELS / 64];
+    u64 evtchn_2l_remote[EVTCHN_2L_NR_CHANNELS / 64];
 
     /* xenstore page and event channel */
     volatile struct xenstore_domain_interface *xenstore_interface;
@@ -58,7 +76,7 @@ typedef struct xen_platform_info {
     struct list driver_list;
 
     /* timer */
-    evtchn_port_t timer_evtchn;
+    evtchn_port_t timer_evtchn[MAX_CPUS];
 
     /* XXX could make generalized status */
     boolean initialized;
@@ -85,52 +103,226 @@ boolean xen_detected(void)
 
 extern u64 hypercall_page;
 
-closure_function(0, 0, void, xen_interrupt)
+static volatile event_word_t *xen_fifo_word(evtchn_port_t port)
+{
+    return xen_info.fifo_array[port / EVTCHN_FIFO_WORDS_PER_PAGE] +
+        (port % EVTCHN_FIFO_WORDS_PER_PAGE);
+}
+
+static void xen_evtchn_dispatch(evtchn_port_t port)
+{
+    thunk handler = vector_get(xen_info.evtchn_handlers, port);
+    if (handler) {
+        xenint_debug("  evtchn %d: applying handler %p", port, handler);
+        apply(handler);
+    } else {
+        /* XXX we have an issue with seemingly spurious interrupts at evtchn >= 2048... */
+        xenint_debug("  evtchn %d: spurious interrupt", port);
+        if (xen_info.evtchn_fifo)
+            __sync_fetch_and_or(xen_fifo_word(port), U32_FROM_BIT(EVTCHN_FIFO_MASKED));
+        else
+            __sync_fetch_and_or(&xen_info.shared_info->evtchn_mask[port / 64], U64_FROM_BIT(port % 64));
+    }
+}
+
+/* Take the event at the head of a queue of this cpu, returning false once
+   the queue is empty. Xen links events to the tail; the link of the event
+   taken is the new head. */
+static boolean xen_fifo_consume(int cpu, int q)
+{
+    u32 *head = &xen_info.fifo_head[cpu][q];
+    evtchn_port_t port = *head;
+    if (port == 0) {
+        /* reached the tail last time; the control block has the new head */
+        read_barrier();
+        port = xen_info.fifo_control[cpu]->head[q];
+        if (port == 0)
+            return false;
+    }
+    volatile event_word_t *w = xen_fifo_word(port);
+    event_word_t old;
+    do {
+        old = *w;
+    } while (!compare_and_swap_32((u32 *)w, old,
+                                  old & ~(U32_FROM_BIT(EVTCHN_FIFO_LINKED) | EVTCHN_FIFO_LINK_MASK)));
+    *head = old & EVTCHN_FIFO_LINK_MASK;
+    if ((old & U32_FROM_BIT(EVTCHN_FIFO_PENDING)) && !(old & U32_FROM_BIT(EVTCHN_FIFO_MASKED))) {
+        __sync_fetch_and_and(w, ~U32_FROM_BIT(EVTCHN_FIFO_PENDING));
+        xenint_debug("  fifo queue %d: port %d pending", q, port);
+        xen_evtchn_dispatch(port);
+    }
+    return *head != 0;
+}
+
+/* Queues are serviced in priority order, 0 being the highest. */
+static void xen_fifo_poll(int cpu)
+{
+    volatile evtchn_fifo_control_block_t *cb = xen_info.fifo_control[cpu];
+    u32 ready = __sync_lock_test_and_set(&cb->ready, 0);
+    while (ready) {
+        int q = lsb(ready);
+        if (!xen_fifo_consume(cpu, q))
+            ready &= ~U32_FROM_BIT(q);
+        ready |= __sync_lock_test_and_set(&cb->ready, 0);
+    }
+}
+
+/* Xen sets selector bits in the vcpu_info of the vcpu a port is bound to,
+   but the pending words are shared; other cpus' ports are left alone. */
+static void xen_2l_poll(int cpu, volatile struct vcpu_info *vci)
 {
     volatile struct shared_info *si = xen_info.shared_info;
-    volatile struct vcpu_info *vci = &xen_info.shared_info->vcpu_info[0]; /* hardwired at this point */
+    u64 l1_pending = __sync_lock_test_and_set(&vci->evtchn_pending_sel, 0); /* XXX check asm */
+    /* this may not process in the right order, or it might not matter - care later */
+    bitmap_word_foreach_set(l1_pending, bit1, i1, 0) {
+        (void)i1;
+        u64 bound = cpu == 0 ? ~xen_info.evtchn_2l_remote[bit1] :
+            xen_info.evtchn_2l_cpu[cpu][bit1];
+        u64 l2_pending = si->evtchn_pending[bit1] & ~si->evtchn_mask[bit1] & bound;
+        xenint_debug("pending 0x%lx, mask 0x%lx, masked 0x%lx",
+                     si->evtchn_pending[bit1], si->evtchn_mask[bit1], l2_pending);
+        __sync_and_and_fetch(&si->evtchn_pending[bit1], ~l2_pending);
+        u64 l2_offset = bit1 << 6;
+        bitmap_word_foreach_set(l2_pending, bit2, i2, l2_offset) {
+            (void)bit2;
+            xenint_debug("  int %d pending", i2);
+            xen_evtchn_dispatch(i2);
+        }
+    }
+}
+
+/* Each vcpu gets upcalls for the ports bound to it. */
+static void xen_upcall(void)
+{
+    int cpu = current_cpu()->id;
+    volatile struct vcpu_info *vci = xen_info.vcpu_info[cpu];
 
     xenint_debug("xen_interrupt enter");
     while (vci->evtchn_upcall_pending) {
         vci->evtchn_upcall_mask = 1;
         vci->evtchn_upcall_pending = 0;
-        u64 l1_pending = __sync_lock_test_and_set(&vci->evtchn_pending_sel, 0); /* XXX check asm */
-        /* this may not process in the right order, or it might not matter - care later */
-        bitmap_word_foreach_set(l1_pending, bit1, i1, 0) {
-            (void)i1;
-            /* TODO: any per-cpu event mask would be also applied here... */
-            u64 l2_pending = si->evtchn_pending[bit1] & ~si->evtchn_mask[bit1];
-            xenint_debug("pending 0x%lx, mask 0x%lx, masked 0x%lx",
-                         si->evtchn_pending[bit1], si->evtchn_mask[bit1], l2_pending);
-            __sync_and_and_fetch(&si->evtchn_pending[bit1], ~l2_pending);
-            u64 l2_offset = bit1 << 6;
-            bitmap_word_foreach_set(l2_pending, bit2, i2, l2_offset) {
-                (void)i2;
-                xenint_debug("  int %d pending", i2);
-                thunk handler = vector_get(xen_info.evtchn_handlers, i2);
-                if (handler) {
-                    xenint_debug("  evtchn %d: applying handler %p", i2, handler);
-                    apply(handler);
-                } else {
-                    /* XXX we have an issue with seemingly spurious interrupts at evtchn >= 2048... */
-                    xenint_debug("  evtchn %d: spurious interrupt", i2);
-                    si->evtchn_mask[bit1] |= U64_FROM_BIT(bit2);
-                }
-            }
-        }
+        if (xen_info.evtchn_fifo)
+            xen_fifo_poll(cpu);
+        else
+            xen_2l_poll(cpu, vci);
         vci->evtchn_upcall_mask = 0;
     }
     xenint_debug("xen_interrupt exit");
 }
 
+closure_function(0, 0, void, xen_interrupt)
+{
+    xen_upcall();
+}
+
+/* The FIFO ABI ops are missing from evtchn_op_t, which only matters to the
+   compat hypercall. */
+static int xen_evtchn_op(int cmd, void *arg)
+{
+    return _hypercall2(int, event_channel_op, cmd, arg);
+}
+
+/* Add event array pages until port is covered. Xen carries over the state
+   of ports already bound when a page is added. */
+static boolean xen_fifo_setup_port(evtchn_port_t port)
+{
+    boolean ok = true;
+    u64 flags = spin_lock_irq(&xen_info.fifo_lock);
+    while (port >= xen_info.fifo_pages * EVTCHN_FIFO_WORDS_PER_PAGE) {
+        if (xen_info.fifo_pages == EVTCHN_FIFO_MAX_PAGES) {
+            ok = false;
+            break;
+        }
+        void *page = allocate_zero((heap)heap_backed(get_kernel_heaps()), PAGESIZE);
+        assert(page != INVALID_ADDRESS);
+        /* a new page starts with all events masked */
+        for (int i = 0; i < EVTCHN_FIFO_WORDS_PER_PAGE; i++)
+            ((event_word_t *)page)[i] = U32_FROM_BIT(EVTCHN_FIFO_MASKED);
+        xen_info.fifo_array[xen_info.fifo_pages] = page;
+        write_barrier();
+        evtchn_expand_array_t ea;
+        ea.array_gfn = physical_from_virtual(page) >> PAGELOG;
+        int rv = xen_evtchn_op(EVTCHNOP_expand_array, &ea);
+        if (rv < 0) {
+            msg_err("failed to expand event array (rv %d)\n", rv);
+            xen_info.fifo_array[xen_info.fifo_pages] = 0;
+            deallocate((heap)heap_backed(get_kernel_heaps()), page, PAGESIZE);
+            ok = false;
+            break;
+        }
+        xen_info.fifo_pages++;
+    }
+    spin_unlock_irq(&xen_info.fifo_lock, flags);
+    return ok;
+}
+
+static boolean xen_fifo_init_cpu(int cpu)
+{
+    void *cb = allocate_zero((heap)heap_backed(get_kernel_heaps()), PAGESIZE);
+    assert(cb != INVALID_ADDRESS);
+    evtchn_init_control_t ic;
+    ic.control_gfn = physical_from_virtual(cb) >> PAGELOG;
+    ic.offset = 0;
+    ic.vcpu = xen_info.vcpu_id[cpu];
+    int rv = xen_evtchn_op(EVTCHNOP_init_control, &ic);
+    if (rv < 0) {
+        xen_debug("init_control for vcpu %d failed (rv %d)", xen_info.vcpu_id[cpu], rv);
+        deallocate((heap)heap_backed(get_kernel_heaps()), cb, PAGESIZE);
+        return false;
+    }
+    xen_info.fifo_control[cpu] = cb;
+    return true;
+}
+
+static void xen_evtchn_set_cpu(evtchn_port_t port, int cpu)
+{
+    if (xen_info.evtchn_fifo)
+        return;
+    u64 w = port / 64, b = U64_FROM_BIT(port % 64);
+    for (int i = 1; i < MAX_CPUS; i++)
+        __sync_and_and_fetch(&xen_info.evtchn_2l_cpu[i][w], ~b);
+    if (cpu == 0) {
+        __sync_and_and_fetch(&xen_info.evtchn_2l_remote[w], ~b);
+    } else {
+        __sync_or_and_fetch(&xen_info.evtchn_2l_cpu[cpu][w], b);
+        __sync_or_and_fetch(&xen_info.evtchn_2l_remote[w], b);
+    }
+}
+
+/* Ports notify vcpu0 until bound elsewhere with xen_bind_evtchn_cpu(). */
 void xen_register_evtchn_handler(evtchn_port_t evtchn, thunk handler)
 {
+    if (xen_info.evtchn_fifo)
+        assert(xen_fifo_setup_port(evtchn));
     assert(vector_set(xen_info.evtchn_handlers, evtchn, handler));
 }
 
+/* Direct a port's notifications to a cpu, so that its handler runs there. */
+int xen_bind_evtchn_cpu(evtchn_port_t evtchn, int cpu)
+{
+    if (cpu >= present_processors)
+        cpu = 0;
+    evtchn_op_t eop;
+    eop.cmd = EVTCHNOP_bind_vcpu;
+    eop.u.bind_vcpu.port = evtchn;
+    eop.u.bind_vcpu.vcpu = xen_info.vcpu_id[cpu];
+    int rv = HYPERVISOR_event_channel_op(&eop);
+    if (rv == 0)
+        xen_evtchn_set_cpu(evtchn, cpu);
+    return rv;
+}
+
 int xen_unmask_evtchn(evtchn_port_t evtchn)
 {
-    assert(evtchn > 0 && evtchn < EVTCHN_2L_NR_CHANNELS);
+    assert(evtchn > 0 && evtchn < (xen_info.evtchn_fifo ? EVTCHN_FIFO_NR_CHANNELS :
+                                   EVTCHN_2L_NR_CHANNELS));
+    if (xen_info.evtchn_fifo) {
+        /* only a pending event needs Xen to link it */
+        volatile event_word_t *w = xen_fifo_word(evtchn);
+        __sync_fetch_and_and(w, ~U32_FROM_BIT(EVTCHN_FIFO_MASKED));
+        if (!(*w & U32_FROM_BIT(EVTCHN_FIFO_PENDING)))
+            return 0;
+    }
     evtchn_op_t eop;
     eop.cmd = EVTCHNOP_unmask;
     eop.u.unmask.port = evtchn;
@@ -248,6 +440,61 @@ closure_function(0, 0, void, xen_runloop_timer_handler)
     xen_debug("%s: now %T", __func__, nanoseconds(pvclock_now_ns()));
 }
 
+/* Each vcpu has its own one-shot timer, set from that vcpu with
+   set_timer_op, and its own VIRQ_TIMER port. */
+static boolean xen_timer_init_cpu(int cpu)
+{
+    u32 vcpu = xen_info.vcpu_id[cpu];
+    /* attempt to disable periodic (tick) timer; won't work in older Xens... */
+    xen_debug("stopping periodic tick timer for vcpu %d...", vcpu);
+    int rv = HYPERVISOR_vcpu_op(VCPUOP_stop_periodic_timer, vcpu, 0);
+    if (rv < 0) {
+        msg_err("unable to stop periodic timer (rv %d)\n", rv);
+        return false;
+    }
+
+    evtchn_op_t eop;
+    eop.cmd = EVTCHNOP_bind_virq;
+    eop.u.bind_virq.virq = VIRQ_TIMER;
+    eop.u.bind_virq.vcpu = vcpu;
+    rv = HYPERVISOR_event_channel_op(&eop);
+    if (rv < 0) {
+        msg_err("failed to bind virtual timer IRQ (rv %d)\n", rv);
+        return false;
+    }
+    evtchn_port_t port = eop.u.bind_virq.port;
+    xen_info.timer_evtchn[cpu] = port;
+    xen_debug("vcpu %d timer event channel %d", vcpu, port);
+    xen_register_evtchn_handler(port, closure(xen_info.h, xen_runloop_timer_handler));
+    xen_evtchn_set_cpu(port, cpu);
+    assert(xen_unmask_evtchn(port) == 0);
+    return true;
+}
+
+/* Event channel state of the other vcpus is set up from cpu 0 ahead of
+   their start, leaving only a check of the vcpu id to each cpu. */
+static void xen_init_secondary_vcpus(void)
+{
+    for (int cpu = 1; cpu < present_processors; cpu++) {
+        if (xen_info.evtchn_fifo && !xen_fifo_init_cpu(cpu)) {
+            msg_err("failed to set up FIFO control block for vcpu %d\n", xen_info.vcpu_id[cpu]);
+            continue;
+        }
+        xen_timer_init_cpu(cpu);
+    }
+}
+
+/* Vcpu ids are taken to follow the order in which cpus are started. */
+closure_function(0, 0, void, xen_per_cpu_init)
+{
+    int cpu = current_cpu()->id;
+    u32 v[4];
+    cpuid(XEN_CPUID_LEAF(4), 0, v);
+    if ((v[0] & XEN_HVM_CPUID_VCPU_ID_PRESENT) && v[1] != xen_info.vcpu_id[cpu])
+        msg_err("cpu %d: vcpu id %d, expected %d; events will be misrouted\n",
+                cpu, v[1], xen_info.vcpu_id[cpu]);
+}
+
 boolean xen_detect(kernel_heaps kh)
 {
     u32 v[4];
@@ -392,32 +639,33 @@ boolean xen_detect(kernel_heaps kh)
         goto out_unregister_irq;
     }
 
+    /* vcpu_info of other vcpus stays in the shared info page */
+    build_assert(MAX_CPUS <= XEN_LEGACY_MAX_VCPUS);
+    for (int i = 0; i < MAX_CPUS; i++) {
+        xen_info.vcpu_id[i] = i;
+        xen_info.vcpu_info[i] = &xen_info.shared_info->vcpu_info[i];
+    }
+
     xen_info.evtchn_handlers = allocate_vector(xen_info.h, 1);
     assert(xen_info.evtchn_handlers != INVALID_ADDRESS);
 
-    /* timer setup */
-    /* attempt to disable periodic (tick) timer; won't work in older Xens... */
-    xen_debug("stopping periodic tick timer...");
-    rv = HYPERVISOR_vcpu_op(VCPUOP_stop_periodic_timer, 0 /* vcpu0 */, 0);
-    if (rv < 0) {
-        msg_err("unable to stop periodic timer (rv %d)\n", rv);
-        goto out_unregister_irq;
+    /* Prefer the FIFO ABI, which has priorities and many more ports; Xen
+       keeps the 2-level ABI if the control block can't be set up. */
+    spin_lock_init(&xen_info.fifo_lock);
+    if (xen_fifo_init_cpu(0)) {
+        xen_debug("using FIFO event channel ABI");
+        xen_info.evtchn_fifo = true;
+        if (!xen_fifo_setup_port(xen_info.xenstore_evtchn)) {
+            msg_err("failed to set up event array\n");
+            goto out_unregister_irq;
+        }
     }
-    register_platform_clock_timer(closure(xen_info.h, xen_runloop_timer), 0);
 
-    evtchn_op_t eop;
-    eop.cmd = EVTCHNOP_bind_virq;
-    eop.u.bind_virq.virq = VIRQ_TIMER;
-    eop.u.bind_virq.vcpu = 0;
-    rv = HYPERVISOR_event_channel_op(&eop);
-    if (rv < 0) {
-        msg_err("failed to bind virtual timer IRQ (rv %d)\n", rv);
+    /* timer setup */
+    if (!xen_timer_init_cpu(0))
         goto out_unregister_irq;
-    }
-    xen_info.timer_evtchn = eop.u.bind_virq.port;
-    xen_debug("timer event channel %d", xen_info.timer_evtchn);
-    xen_register_evtchn_handler(xen_info.timer_evtchn, closure(xen_info.h, xen_runloop_timer_handler));
-    assert(xen_unmask_evtchn(xen_info.timer_evtchn) == 0);
+    register_platform_clock_timer(closure(xen_info.h, xen_runloop_timer),
+                                  closure(xen_info.h, xen_per_cpu_init));
 
     /* register pvclock (feature verified above) */
     init_pvclock(xen_info.h, (struct pvclock_vcpu_time_info *)&xen_info.shared_info->vcpu_info[0].time);
@@ -854,6 +1102,8 @@ status xen_probe_devices(void)
     xen_info.device_tree = node;
     xen_debug("success; result: %v", node);
 
+    xen_init_secondary_vcpus();
+
     iterate(node, stack_closure(xen_probe_devices_each, &s));
     return s;
 }
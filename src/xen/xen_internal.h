@@ -37,6 +37,7 @@ typedef struct xen_dev {
 
 status xen_allocate_evtchn(domid_t other_id, evtchn_port_t *evtchn);
 void xen_register_evtchn_handler(evtchn_port_t evtchn, thunk handler);
+int xen_bind_evtchn_cpu(evtchn_port_t evtchn, int cpu);
 int xen_notify_evtchn(evtchn_port_t evtchn);
 int xen_unmask_evtchn(evtchn_port_t evtchn);
 
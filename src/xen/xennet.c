@@ -15,6 +15,8 @@
 #include "lwip/pbuf.h"
 #include "lwip/etharp.h"
 #include "lwip/snmp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip.h"
 #include "netif/ethernet.h"
 
 #undef memset                   /* ugh, lwIP */
@@ -36,16 +38,18 @@
 #define XENNET_TX_ID_SHIFT  5
 
 struct xennet_dev;
+struct xennet_queue;
 
 typedef struct xennet_dev *xennet_dev;
+typedef struct xennet_queue *xennet_queue;
 
 typedef struct xennet_rx_buf {
     struct pbuf_custom p;       /* must be first field */
     struct list l;              /* rx_free or bh chain */
-    xennet_dev xd;
+    xennet_queue xq;
     void * buf;                 /* virtual */
     u64 paddr;
-    u32 idx;
+    u16 flags;                  /* NETRXF_* of the packet this buffer heads */
     grant_ref_t gntref;
 } *xennet_rx_buf;
 
@@ -57,7 +61,11 @@ typedef struct xennet_tx_buf {
     u16 start_idx;
     u16 npages;
     u16 nextpage;
+    u16 flags;                  /* NETTXF_* of the first request */
     buffer pages;               /* array of xennet_txpages */
+    void *copy;                 /* page for small frames, granted for good */
+    u64 copy_paddr;
+    grant_ref_t copy_gntref;
 } *xennet_tx_buf;
 
 typedef struct xennet_tx_page {
@@ -65,16 +73,14 @@ typedef struct xennet_tx_page {
     u16 offset;
     u16 len;
     boolean end;                /* of frame */
+    boolean persistent;         /* grant kept with the tx buf */
     grant_ref_t gntref;
 } *xennet_tx_page;
-    
-struct xennet_dev {
-    struct xen_dev dev;
-    heap h;
-    heap contiguous;                /* physically */
 
-    u8 mac[ETHARP_HWADDR_LEN];
-    u16 mtu;
+/* A queue is a pair of shared rings with their own event channel. */
+struct xennet_queue {
+    xennet_dev xd;
+    int id;
     netif_rx_front_ring_t rx_ring;
     netif_tx_front_ring_t tx_ring;
 
@@ -82,13 +88,13 @@ struct xennet_dev {
     grant_ref_t tx_ring_gntref;
     grant_ref_t rx_ring_gntref;
 
-    /* lwIP */
-    struct netif *netif;
-    u16 rxbuflen;
-
     struct spinlock rx_fill_lock;
-    vector rxbufs;
+    xennet_rx_buf rx_slots[XENNET_RX_RING_SIZE];   /* posted buffer of each ring slot */
     struct list rx_free;
+    struct pbuf *rx_head;       /* packet being assembled from several slots */
+    struct pbuf *rx_tail;
+    boolean rx_extra;           /* next response is an extra info */
+    boolean rx_error;           /* drop the packet being assembled */
 
     thunk rx_service;           /* for runqueue processing */
     queue rx_servicequeue;
@@ -102,8 +108,51 @@ struct xennet_dev {
     queue tx_servicequeue;
 };
 
+struct xennet_dev {
+    struct xen_dev dev;
+    heap h;
+    heap contiguous;                /* physically */
+
+    u8 mac[ETHARP_HWADDR_LEN];
+    u16 mtu;
+    boolean tx_csum;            /* TCP checksums completed by the backend */
+
+    /* lwIP */
+    struct netif *netif;
+    u16 rxbuflen;
+
+    int nqueues;
+    xennet_queue queues[XENNET_MAX_QUEUES];
+};
+
 #define XENNET_INFORM_BACKEND_RETRIES 1024
 
+/* Ring references and event channel of a queue go in the device directory
+   for a single queue, else in its queue-N subdirectory. */
+static status xennet_inform_backend_queue(xennet_dev xnd, u32 tx_id, xennet_queue xq,
+                                          char **node)
+{
+    xen_dev xd = &xnd->dev;
+    buffer path = xd->frontend;
+    if (xnd->nqueues > 1) {
+        path = little_stack_buffer(64);
+        bprintf(path, "%b/queue-%d", xd->frontend, xq->id);
+    }
+
+    *node = "rx-ring-ref";
+    status s = xenstore_sync_printf(tx_id, path, *node, "%d", xq->rx_ring_gntref);
+    if (!is_ok(s))
+        return s;
+
+    *node = "tx-ring-ref";
+    s = xenstore_sync_printf(tx_id, path, *node, "%d", xq->tx_ring_gntref);
+    if (!is_ok(s))
+        return s;
+
+    *node = "event-channel";
+    return xenstore_sync_printf(tx_id, path, *node, "%d", xq->evtchn);
+}
+
 static status xennet_inform_backend(xennet_dev xnd)
 {
     status s = STATUS_OK;
@@ -125,13 +174,28 @@ static status xennet_inform_backend(xennet_dev xnd)
     if (!is_ok(s))
         goto abort;
 
-    node = "rx-ring-ref";
-    s = xenstore_sync_printf(tx_id, xd->frontend, node, "%d", xnd->rx_ring_gntref);
+    if (xnd->nqueues > 1) {
+        node = "multi-queue-num-queues";
+        s = xenstore_sync_printf(tx_id, xd->frontend, node, "%d", xnd->nqueues);
+        if (!is_ok(s))
+            goto abort;
+    }
+
+    for (int i = 0; i < xnd->nqueues; i++) {
+        s = xennet_inform_backend_queue(xnd, tx_id, xnd->queues[i], &node);
+        if (!is_ok(s))
+            goto abort;
+    }
+
+    /* receive packets may span several slots, and TCP ones may be
+       coalesced up to 64KB */
+    node = "feature-sg";
+    s = xenstore_sync_printf(tx_id, xd->frontend, node, "%d", 1);
     if (!is_ok(s))
         goto abort;
 
-    node = "tx-ring-ref";
-    s = xenstore_sync_printf(tx_id, xd->frontend, node, "%d", xnd->tx_ring_gntref);
+    node = "feature-gso-tcpv4";
+    s = xenstore_sync_printf(tx_id, xd->frontend, node, "%d", 1);
     if (!is_ok(s))
         goto abort;
 
@@ -145,11 +209,6 @@ static status xennet_inform_backend(xennet_dev xnd)
     if (!is_ok(s))
         goto abort;
 
-    node = "event-channel";
-    s = xenstore_sync_printf(tx_id, xd->frontend, node, "%d", xnd->evtchn);
-    if (!is_ok(s))
-        goto abort;
-
     node = "transaction end";
     s = xenstore_transaction_end(tx_id, false);
     if (!is_ok(s)) {
@@ -179,9 +238,9 @@ static inline u16 xennet_form_tx_id(xennet_tx_buf txb, int pageidx)
     return (txb->idx << XENNET_TX_ID_SHIFT) + pageidx;
 }
 
-static inline xennet_tx_buf xennet_tx_buf_from_id(xennet_dev xd, u16 id)
+static inline xennet_tx_buf xennet_tx_buf_from_id(xennet_queue xq, u16 id)
 {
-    return vector_get(xd->txbufs, id >> XENNET_TX_ID_SHIFT);
+    return vector_get(xq->txbufs, id >> XENNET_TX_ID_SHIFT);
 }
 
 static inline int xennet_tx_page_idx_from_id(u16 id)
@@ -201,31 +260,33 @@ static inline xennet_tx_page xennet_get_tx_page(xennet_tx_buf txb, int idx)
     return (xennet_tx_page)buffer_ref(txb->pages, offset);
 }
 
-static void xennet_return_txbuf(xennet_dev xd, xennet_tx_buf txb)
+static void xennet_return_txbuf(xennet_queue xq, xennet_tx_buf txb)
 {
     txb->p = 0;
     txb->frags_queued = 0;
     txb->start_idx = -1;
     txb->npages = 0;
     txb->nextpage = 0;
+    txb->flags = 0;
     vector_clear(txb->pages);
     u64 flags = irq_disable_save();
-    list_insert_before(&xd->tx_free, &txb->l);
+    list_insert_before(&xq->tx_free, &txb->l);
     irq_restore(flags);
 }
 
-static xennet_tx_buf xennet_get_txbuf(xennet_dev xd)
+static xennet_tx_buf xennet_get_txbuf(xennet_queue xq)
 {
-    u64 flags = spin_lock_irq(&xd->tx_fill_lock);
-    list l = list_get_next(&xd->tx_free);
+    xennet_dev xd = xq->xd;
+    u64 flags = spin_lock_irq(&xq->tx_fill_lock);
+    list l = list_get_next(&xq->tx_free);
     if (l) {
         list_delete(l);
-        spin_unlock_irq(&xd->tx_fill_lock, flags);
+        spin_unlock_irq(&xq->tx_fill_lock, flags);
         return struct_from_list(l, xennet_tx_buf, l);
     }
-    spin_unlock_irq(&xd->tx_fill_lock, flags);
+    spin_unlock_irq(&xq->tx_fill_lock, flags);
 
-    if (vector_length(xd->txbufs) > (0xFFFF >> XENNET_TX_ID_SHIFT))
+    if (vector_length(xq->txbufs) > (0xFFFF >> XENNET_TX_ID_SHIFT))
         return INVALID_ADDRESS;
 
     /* allocate new buffer */
@@ -238,35 +299,37 @@ static xennet_tx_buf xennet_get_txbuf(xennet_dev xd)
     txb->start_idx = -1;
     txb->npages = 0;
     txb->nextpage = 0;
+    txb->flags = 0;
     txb->pages = allocate_buffer(xd->h, sizeof(struct xennet_tx_page) * 4);
+    txb->copy = 0;
 
-    flags = spin_lock_irq(&xd->tx_fill_lock);
-    txb->idx = vector_length(xd->txbufs);
-    vector_push(xd->txbufs, txb);
-    spin_unlock_irq(&xd->tx_fill_lock, flags);
+    flags = spin_lock_irq(&xq->tx_fill_lock);
+    txb->idx = vector_length(xq->txbufs);
+    vector_push(xq->txbufs, txb);
+    spin_unlock_irq(&xq->tx_fill_lock, flags);
 
     return txb;
 }
 
-static void xennet_service_tx_ring(xennet_dev xd)
+static void xennet_service_tx_ring(xennet_queue xq)
 {
     int more;
 
     do {
-        RING_IDX cons = xd->tx_ring.rsp_cons;
-        RING_IDX prod = xd->tx_ring.sring->rsp_prod;
+        RING_IDX cons = xq->tx_ring.rsp_cons;
+        RING_IDX prod = xq->tx_ring.sring->rsp_prod;
         memory_barrier();
-        xennet_debug("%s: cons %d, prod %d", __func__, cons, prod);
+        xennet_debug("%s: queue %d, cons %d, prod %d", __func__, xq->id, cons, prod);
 
         struct list q;
         list_init(&q);
 
         /* seems unfortunate to have to take the fill lock here...but
            we don't want to risk the tx buf vector changing underneath us */
-        spin_lock(&xd->tx_fill_lock);
+        spin_lock(&xq->tx_fill_lock);
         while (cons < prod) {
-            netif_tx_response_t *tx = RING_GET_RESPONSE(&xd->tx_ring, cons);
-            xennet_tx_buf txb = xennet_tx_buf_from_id(xd, tx->id);
+            netif_tx_response_t *tx = RING_GET_RESPONSE(&xq->tx_ring, cons);
+            xennet_tx_buf txb = xennet_tx_buf_from_id(xq, tx->id);
             assert(txb);
 
             if (tx->status != NETIF_RSP_OKAY) {
@@ -281,27 +344,27 @@ static void xennet_service_tx_ring(xennet_dev xd)
             }
             cons++;
         }
-        spin_unlock(&xd->tx_fill_lock);
+        spin_unlock(&xq->tx_fill_lock);
         write_barrier();
-        xd->tx_ring.rsp_cons = cons;
+        xq->tx_ring.rsp_cons = cons;
         list l = list_get_next(&q);
         if (l) {
             /* trick: remove (local) head and queue first element */
             list_delete(&q);
-            assert(enqueue(xd->tx_servicequeue, l));
-            enqueue(runqueue, xd->tx_service);
+            assert(enqueue(xq->tx_servicequeue, l));
+            enqueue(runqueue, xq->tx_service);
         }
-        RING_FINAL_CHECK_FOR_RESPONSES(&xd->tx_ring, more);
+        RING_FINAL_CHECK_FOR_RESPONSES(&xq->tx_ring, more);
     } while (more);
 }
 
 closure_function(1, 0, void, xennet_tx_service_bh,
-                 xennet_dev, xd)
+                 xennet_queue, xq)
 {
-    xennet_dev xd = bound(xd);
-    xennet_debug("%s: dev id %d", __func__, xd->dev.if_id);
+    xennet_queue xq = bound(xq);
+    xennet_debug("%s: dev id %d, queue %d", __func__, xq->xd->dev.if_id, xq->id);
     list l;
-    while ((l = (list)dequeue(xd->tx_servicequeue)) != INVALID_ADDRESS) {
+    while ((l = (list)dequeue(xq->tx_servicequeue)) != INVALID_ADDRESS) {
         struct list q;
         list_insert_before(l, &q); /* restore list head */
         list_foreach(&q, i) {
@@ -309,19 +372,21 @@ closure_function(1, 0, void, xennet_tx_service_bh,
             list_delete(i);
             for (int j = 0; j < xennet_get_n_tx_pages(txb); j++) {
                 xennet_tx_page txp = xennet_get_tx_page(txb, j);
-                xen_revoke_page_access(txp->gntref);
+                if (!txp->persistent)
+                    xen_revoke_page_access(txp->gntref);
             }
-            pbuf_free(txb->p);
-            xennet_return_txbuf(xd, txb);
+            if (txb->p)
+                pbuf_free(txb->p);
+            xennet_return_txbuf(xq, txb);
         }
     }
     xennet_debug("%s: exit", __func__);
 }
 
 /* called with tx_fill_lock taken / irqs disabled */
-static xennet_tx_page xennet_fill_tx_request(xennet_dev xd, netif_tx_request_t *tx)
+static xennet_tx_page xennet_fill_tx_request(xennet_queue xq, netif_tx_request_t *tx)
 {
-    list l = list_get_next(&xd->tx_pending);
+    list l = list_get_next(&xq->tx_pending);
     if (!l) {
         xennet_debug("tx pending empty");
         return 0;
@@ -330,6 +395,8 @@ static xennet_tx_page xennet_fill_tx_request(xennet_dev xd, netif_tx_request_t *
     xennet_tx_page txp = xennet_get_tx_page(txb, txb->nextpage);
     tx->offset = txp->offset;
     tx->flags = txp->end ? 0 : NETTXF_more_data;
+    if (txb->nextpage == 0)
+        tx->flags |= txb->flags;
     tx->id = xennet_form_tx_id(txb, txb->nextpage);
     tx->size = txp->len;
     tx->gref = txp->gntref;
@@ -343,32 +410,32 @@ static xennet_tx_page xennet_fill_tx_request(xennet_dev xd, netif_tx_request_t *
     return txp;
 }
 
-static void xennet_populate_tx_ring(xennet_dev xd)
+static void xennet_populate_tx_ring(xennet_queue xq)
 {
-    u64 flags = spin_lock_irq(&xd->tx_fill_lock);
+    u64 flags = spin_lock_irq(&xq->tx_fill_lock);
 
-    RING_IDX prod = xd->tx_ring.req_prod_pvt;
-    RING_IDX prod_end = xd->tx_ring.rsp_cons + XENNET_TX_RING_SIZE;
-    xennet_debug("%s: prod %d, prod_end %d", __func__, prod, prod_end);
+    RING_IDX prod = xq->tx_ring.req_prod_pvt;
+    RING_IDX prod_end = xq->tx_ring.rsp_cons + XENNET_TX_RING_SIZE;
+    xennet_debug("%s: queue %d, prod %d, prod_end %d", __func__, xq->id, prod, prod_end);
 
     while (prod < prod_end) {
-        netif_tx_request_t *tx = RING_GET_REQUEST(&xd->tx_ring, prod);
-        xennet_tx_page txp = xennet_fill_tx_request(xd, tx);
+        netif_tx_request_t *tx = RING_GET_REQUEST(&xq->tx_ring, prod);
+        xennet_tx_page txp = xennet_fill_tx_request(xq, tx);
         if (!txp)
             break;
         xennet_debug("   prod %d: txp %p, offset %d, size %d, id %d, flags %x, gref %d",
                      prod, txp, tx->offset, tx->size, tx->id, tx->flags, tx->gref);
         prod++;
     }
-    xd->tx_ring.req_prod_pvt = prod;
+    xq->tx_ring.req_prod_pvt = prod;
     write_barrier();
 
     int notify;
-    RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&xd->tx_ring, notify);
+    RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&xq->tx_ring, notify);
     if (notify)
-        xen_notify_evtchn(xd->evtchn);
+        xen_notify_evtchn(xq->evtchn);
 
-    spin_unlock_irq(&xd->tx_fill_lock, flags);
+    spin_unlock_irq(&xq->tx_fill_lock, flags);
     xennet_debug("queueing done");
 }
 
@@ -393,6 +460,7 @@ static void xennet_tx_buf_add_pages(xennet_dev xd, xennet_tx_buf txb, struct pbu
             txp->paddr = physical_from_virtual(pointer_from_u64(vpage));
             assert(txp->paddr != INVALID_PHYSICAL);
             txp->gntref = xen_grant_page_access(xd->dev.backend_id, txp->paddr, true);
+            txp->persistent = false;
             txp->offset = offset;
             txp->len = txb->npages == 0 ? q->tot_len : len;     // first descriptor must have packet total length
             txp->end = false;
@@ -407,18 +475,99 @@ static void xennet_tx_buf_add_pages(xennet_dev xd, xennet_tx_buf txb, struct pbu
         txp->end = true;
 }
 
+/* Small frames are copied into a page of the tx buf that stays granted, which
+   saves a grant and its revocation per frame; the pbuf is released at once. */
+static boolean xennet_tx_buf_copy(xennet_dev xd, xennet_tx_buf txb, struct pbuf *p)
+{
+    if (!txb->copy) {
+        void *copy = allocate(xd->contiguous, PAGESIZE);
+        if (copy == INVALID_ADDRESS)
+            return false;
+        txb->copy_paddr = physical_from_virtual(copy);
+        assert(txb->copy_paddr != INVALID_PHYSICAL);
+        txb->copy_gntref = xen_grant_page_access(xd->dev.backend_id, txb->copy_paddr, true);
+        if (!txb->copy_gntref) {
+            deallocate(xd->contiguous, copy, PAGESIZE);
+            return false;
+        }
+        txb->copy = copy;
+    }
+    pbuf_copy_partial(p, txb->copy, p->tot_len, 0);
+    extend_total(txb->pages, sizeof(struct xennet_tx_page));
+    xennet_tx_page txp = xennet_get_tx_page(txb, 0);
+    txp->paddr = txb->copy_paddr;
+    txp->gntref = txb->copy_gntref;
+    txp->persistent = true;
+    txp->offset = 0;
+    txp->len = p->tot_len;
+    txp->end = true;
+    txb->npages = 1;
+    return true;
+}
+
+/* lwIP leaves the TCP checksum zeroed: seed it with the pseudo-header sum
+   for the backend to complete. The headers of a TCP segment are always in
+   its first pbuf; IPv6 extension headers are not followed. */
+static boolean xennet_tx_csum(struct pbuf *p)
+{
+    u8 *frame = p->payload;
+    if (p->len < SIZEOF_ETH_HDR)
+        return false;
+    u16 type = ((struct eth_hdr *)frame)->type;
+    u64 off = SIZEOF_ETH_HDR;
+    u8 *ip = frame + off;
+    u16 *addrs;
+    int naddrs;
+    u64 len;
+    if (type == PP_HTONS(ETHTYPE_IP)) {
+        if (p->len < off + 20)
+            return false;
+        u64 hlen = (ip[0] & 0xf) << 2;
+        u64 total = (ip[2] << 8) | ip[3];
+        if ((hlen < 20) || (total < hlen) || (ip[6] & 0x3f) || ip[7] || (ip[9] != IP_PROTO_TCP))
+            return false;
+        len = total - hlen;
+        addrs = (u16 *)(ip + 12);
+        naddrs = 2 * sizeof(u32) / sizeof(u16);
+        off += hlen;
+    } else if (type == PP_HTONS(ETHTYPE_IPV6)) {
+        if ((p->len < off + 40) || (ip[6] != IP_PROTO_TCP))
+            return false;
+        len = (ip[4] << 8) | ip[5];
+        addrs = (u16 *)(ip + 8);
+        naddrs = 2 * 16 / sizeof(u16);
+        off += 40;
+    } else {
+        return false;
+    }
+    if (off + 18 > p->len)
+        return false;
+    u32 sum = lwip_htons(IP_PROTO_TCP) + lwip_htons(len);
+    for (int i = 0; i < naddrs; i++)
+        sum += addrs[i];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    *(u16 *)(frame + off + 16) = sum;
+    return true;
+}
+
 /* enqueue tx buffer for subsequent ring processing */
 static err_t xennet_linkoutput(struct netif *netif, struct pbuf *p)
 {
     xennet_dev xd = (xennet_dev)netif->state;
-    xennet_debug("%s: id %d, pbuf %p", __func__, xd->dev.if_id, p);
+    xennet_queue xq = xd->queues[current_cpu()->id % xd->nqueues];
+    xennet_debug("%s: id %d, queue %d, pbuf %p", __func__, xd->dev.if_id, xq->id, p);
 
-    xennet_tx_buf txb = xennet_get_txbuf(xd);
+    xennet_tx_buf txb = xennet_get_txbuf(xq);
     if (txb == INVALID_ADDRESS)
         return ERR_MEM;
-    pbuf_ref(p);
-    txb->p = p;
-    xennet_tx_buf_add_pages(xd, txb, p);
+    if (xd->tx_csum && xennet_tx_csum(p))
+        txb->flags = NETTXF_csum_blank | NETTXF_data_validated;
+    if ((p->tot_len > XENNET_TX_COPYBREAK) || !xennet_tx_buf_copy(xd, txb, p)) {
+        pbuf_ref(p);
+        txb->p = p;
+        xennet_tx_buf_add_pages(xd, txb, p);
+    }
 
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -433,11 +582,11 @@ static err_t xennet_linkoutput(struct netif *netif, struct pbuf *p)
     LINK_STATS_INC(link.xmit);
 
     /* really should just be a mask of xen int or tx int if we ever split */
-    u64 flags = spin_lock_irq(&xd->tx_fill_lock);
-    list_insert_before(&xd->tx_pending, &txb->l);
-    spin_unlock_irq(&xd->tx_fill_lock, flags);
+    u64 flags = spin_lock_irq(&xq->tx_fill_lock);
+    list_insert_before(&xq->tx_pending, &txb->l);
+    spin_unlock_irq(&xq->tx_fill_lock, flags);
 
-    xennet_populate_tx_ring(xd);
+    xennet_populate_tx_ring(xq);
     return ERR_OK;
 }
 
@@ -453,7 +602,10 @@ static err_t xennet_netif_init(struct netif *netif)
     runtime_memcpy(netif->hwaddr, xd->mac, ETHARP_HWADDR_LEN);
     netif->mtu = xd->mtu;
 
-    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP |
+        NETIF_FLAG_TX_PAGES;
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL &
+                            ~(xd->tx_csum ? NETIF_CHECKSUM_GEN_TCP : 0));
 
     return ERR_OK;
 }
@@ -469,13 +621,14 @@ static err_t xennet_netif_init(struct netif *netif)
 static void xennet_return_rxbuf(struct pbuf *p);
 
 /* called from dev enable only at this point - but could also be called from bh service */
-static xennet_rx_buf xennet_alloc_rxbuf(xennet_dev xd)
+static xennet_rx_buf xennet_alloc_rxbuf(xennet_queue xq)
 {
+    xennet_dev xd = xq->xd;
     xennet_rx_buf rxb = allocate(xd->h, sizeof(struct xennet_rx_buf));
     if (rxb == INVALID_ADDRESS)
         return rxb;
-    rxb->xd = xd;
-    rxb->buf = allocate(xd->contiguous, PAGESIZE); /* XXX multiple for large mtu */
+    rxb->xq = xq;
+    rxb->buf = allocate(xd->contiguous, PAGESIZE);
     if (rxb->buf == INVALID_ADDRESS)
         goto out_dealloc_rxb;
     rxb->paddr = physical_from_virtual(rxb->buf);
@@ -487,13 +640,6 @@ static xennet_rx_buf xennet_alloc_rxbuf(xennet_dev xd)
     rxb->p.custom_free_function = xennet_return_rxbuf;
 
     /* pbuf initialized on free list enqueue */
-
-    /* locking not really necessary for init, but we're likely to add
-       to the cache at some point */
-    u64 flags = spin_lock_irq(&xd->rx_fill_lock);
-    rxb->idx = vector_length(xd->rxbufs);
-    vector_push(xd->rxbufs, rxb);
-    spin_unlock_irq(&xd->rx_fill_lock, flags);
     return rxb;
   out_free_buf:
     deallocate(xd->contiguous, rxb->buf, PAGESIZE);
@@ -503,9 +649,9 @@ static xennet_rx_buf xennet_alloc_rxbuf(xennet_dev xd)
 }
 
 /* called with lock taken */
-static xennet_rx_buf xennet_get_rxbuf(xennet_dev xd)
+static xennet_rx_buf xennet_get_rxbuf(xennet_queue xq)
 {
-    list l = list_get_next(&xd->rx_free);
+    list l = list_get_next(&xq->rx_free);
     if (!l)
         return 0;
     xennet_rx_buf rxb = struct_from_list(l, xennet_rx_buf, l);
@@ -514,117 +660,215 @@ static xennet_rx_buf xennet_get_rxbuf(xennet_dev xd)
     return rxb;
 }
 
-/* called by attach, lwIP, or netif input drop / error */
-static void xennet_return_rxbuf(struct pbuf *p)
+/* called with lock taken */
+static void xennet_put_rxbuf(xennet_rx_buf rxb)
 {
-    xennet_rx_buf rxb = (xennet_rx_buf)p;
-    xennet_dev xd = rxb->xd;
+    xennet_dev xd = rxb->xq->xd;
     pbuf_alloced_custom(PBUF_RAW,
                         xd->rxbuflen,
                         PBUF_REF,
                         &rxb->p,
                         rxb->buf,
                         xd->rxbuflen);
-
-    u64 flags = spin_lock_irq(&xd->rx_fill_lock);
-    list_insert_before(&xd->rx_free, &rxb->l);
-    spin_unlock_irq(&xd->rx_fill_lock, flags);
+    rxb->flags = 0;
+    list_insert_before(&rxb->xq->rx_free, &rxb->l);
     assert(rxb->gntref);
- }
+}
+
+/* called by attach, lwIP, or netif input drop / error */
+static void xennet_return_rxbuf(struct pbuf *p)
+{
+    xennet_rx_buf rxb = (xennet_rx_buf)p;
+    xennet_queue xq = rxb->xq;
+    u64 flags = spin_lock_irq(&xq->rx_fill_lock);
+    xennet_put_rxbuf(rxb);
+    spin_unlock_irq(&xq->rx_fill_lock, flags);
+}
 
-static void xennet_populate_rx_ring(xennet_dev xd)
+/* Responses land in the slot of their request, and extra info responses
+   carry no id, so posted buffers are tracked by ring slot. */
+static void xennet_populate_rx_ring(xennet_queue xq)
 {
-    RING_IDX prod = xd->rx_ring.req_prod_pvt;
-    RING_IDX prod_end = xd->rx_ring.rsp_cons + XENNET_RX_RING_SIZE;
+    RING_IDX prod = xq->rx_ring.req_prod_pvt;
+    RING_IDX prod_end = xq->rx_ring.rsp_cons + XENNET_RX_RING_SIZE;
 
-    xennet_debug("%s: prod %d, prod_end %d", __func__, prod, prod_end);
+    xennet_debug("%s: queue %d, prod %d, prod_end %d", __func__, xq->id, prod, prod_end);
 
-    u64 flags = spin_lock_irq(&xd->rx_fill_lock);
+    u64 flags = spin_lock_irq(&xq->rx_fill_lock);
     while (prod < prod_end) {
-        xennet_rx_buf rxb = xennet_get_rxbuf(xd);
+        xennet_rx_buf rxb = xennet_get_rxbuf(xq);
         if (!rxb) {
             /* not a ring underrun, but we still want to know if we're close */
             msg_err("xennet_get_rxbuf underrun\n");
             break;
         }
 
-        netif_rx_request_t *rx = RING_GET_REQUEST(&xd->rx_ring, prod);
-        rx->id = rxb->idx;
+        u16 slot = prod & (XENNET_RX_RING_SIZE - 1);
+        assert(!xq->rx_slots[slot]);
+        xq->rx_slots[slot] = rxb;
+        netif_rx_request_t *rx = RING_GET_REQUEST(&xq->rx_ring, prod);
+        rx->id = slot;
         rx->pad = 0;
         rx->gref = rxb->gntref;
         prod++;
     }
-    spin_unlock_irq(&xd->rx_fill_lock, flags);
-    xd->rx_ring.req_prod_pvt = prod;
+    spin_unlock_irq(&xq->rx_fill_lock, flags);
+    xq->rx_ring.req_prod_pvt = prod;
     xennet_debug("fill done");
     write_barrier();
 
     int notify;
-    RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&xd->rx_ring, notify);
+    RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(&xq->rx_ring, notify);
     if (notify)
-        xen_notify_evtchn(xd->evtchn);
+        xen_notify_evtchn(xq->evtchn);
 }
 
-static void xennet_service_rx_ring(xennet_dev xd)
+/* called with lock taken; the assembled packet goes on q, or on drop if
+   any of its slots reported an error */
+static void xennet_rx_packet_done(xennet_queue xq, struct list *q, struct list *drop)
+{
+    struct pbuf *head = xq->rx_head;
+    u16 remain = head->tot_len;
+    for (struct pbuf *p = head; p; p = p->next) {
+        p->tot_len = remain;
+        remain -= p->len;
+    }
+    list_insert_before(xq->rx_error ? drop : q, &((xennet_rx_buf)head)->l);
+    xq->rx_head = xq->rx_tail = 0;
+    xq->rx_error = false;
+}
+
+static void xennet_service_rx_ring(xennet_queue xq)
 {
     int more;
 
     do {
-        RING_IDX cons = xd->rx_ring.rsp_cons;
-        RING_IDX prod = xd->rx_ring.sring->rsp_prod;
+        RING_IDX cons = xq->rx_ring.rsp_cons;
+        RING_IDX prod = xq->rx_ring.sring->rsp_prod;
         assert(prod - cons <= XENNET_RX_RING_SIZE);
         read_barrier();
-        xennet_debug("%s: cons %d, prod %d", __func__, cons, prod);
+        xennet_debug("%s: queue %d, cons %d, prod %d", __func__, xq->id, cons, prod);
 
-        struct list q;
+        struct list q, drop;
         list_init(&q);
+        list_init(&drop);
 
-        /* again, lock unfortunately needed for rxbufs - wouldn't be
-           an issue if we could size the vector only once on init... */
-        u64 flags = spin_lock_irq(&xd->rx_fill_lock);
+        u64 flags = spin_lock_irq(&xq->rx_fill_lock);
         while (cons < prod) {
-            netif_rx_response_t *rx = RING_GET_RESPONSE(&xd->rx_ring, cons);
-            xennet_rx_buf rxb = vector_get(xd->rxbufs, rx->id);
+            netif_rx_response_t *rx = RING_GET_RESPONSE(&xq->rx_ring, cons);
+            u16 slot = cons & (XENNET_RX_RING_SIZE - 1);
+            xennet_rx_buf rxb = xq->rx_slots[slot];
             assert(rxb);
             assert(rxb->gntref != GRANT_INVALID);
-            assert(rx->status >= 0);
-            assert(rx->offset + rx->status <= PAGESIZE);
+            xq->rx_slots[slot] = 0;
+            cons++;
+
+            if (xq->rx_extra) {
+                /* the extra info overlays the response; its buffer was not used */
+                netif_extra_info_t *extra = (netif_extra_info_t *)rx;
+                xq->rx_extra = (extra->flags & XEN_NETIF_EXTRA_FLAG_MORE) != 0;
+                xennet_put_rxbuf(rxb);
+                continue;
+            }
 
             xennet_debug("   RX flags %x, status %d, offset %d\n",
                          rx->flags, rx->status, rx->offset);
+            if ((rx->status < 0) || (rx->offset + rx->status > PAGESIZE)) {
+                msg_err("%s: rx error, status %d, offset %d\n", __func__, rx->status, rx->offset);
+                xq->rx_error = true;
+                rxb->p.pbuf.len = 0;
+            } else {
 #ifdef XENNET_DEBUG_DATA
-            xennet_debug("   buf:\n%X", alloca_wrap_buffer(rxb->p.pbuf.payload,
-                                                           rx->status + rx->offset));
+                xennet_debug("   buf:\n%X", alloca_wrap_buffer(rxb->p.pbuf.payload,
+                                                               rx->status + rx->offset));
 #endif
-            rxb->p.pbuf.len = rx->status;
-            rxb->p.pbuf.tot_len = rx->status;
-            rxb->p.pbuf.payload += rx->offset;
+                rxb->p.pbuf.len = rx->status;
+                rxb->p.pbuf.payload += rx->offset;
+            }
 
-            list_insert_before(&q, &rxb->l);
-            cons++;
+            if (!xq->rx_head) {
+                rxb->flags = rx->flags;
+                rxb->p.pbuf.tot_len = rxb->p.pbuf.len;
+                xq->rx_head = xq->rx_tail = &rxb->p.pbuf;
+            } else {
+                xq->rx_tail->next = &rxb->p.pbuf;
+                xq->rx_tail = &rxb->p.pbuf;
+                xq->rx_head->tot_len += rxb->p.pbuf.len;
+            }
+            if (rx->flags & NETRXF_extra_info)
+                xq->rx_extra = true;
+            if (!(rx->flags & NETRXF_more_data))
+                xennet_rx_packet_done(xq, &q, &drop);
         }
-        spin_unlock_irq(&xd->rx_fill_lock, flags);
+        spin_unlock_irq(&xq->rx_fill_lock, flags);
         write_barrier();
-        xd->rx_ring.rsp_cons = cons;
+        xq->rx_ring.rsp_cons = cons;
+        list_foreach(&drop, i) {
+            list_delete(i);
+            pbuf_free(&struct_from_list(i, xennet_rx_buf, l)->p.pbuf);
+        }
         list l = list_get_next(&q);
         if (l) {
             /* trick: remove (local) head and queue first element */
             list_delete(&q);
             assert(l->prev);
-            assert(enqueue(xd->rx_servicequeue, l));
-            enqueue(runqueue, xd->rx_service);
+            assert(enqueue(xq->rx_servicequeue, l));
+            enqueue(runqueue, xq->rx_service);
         }
-        RING_FINAL_CHECK_FOR_RESPONSES(&xd->rx_ring, more);
+        RING_FINAL_CHECK_FOR_RESPONSES(&xq->rx_ring, more);
     } while (more);
 }
 
+/* The backend may pass on packets, coalesced TCP ones in particular, with
+   only the pseudo-header sum in the transport checksum field. */
+static void xennet_rx_complete_csum(struct pbuf *p)
+{
+    u8 *frame = p->payload;
+    if (p->len < SIZEOF_ETH_HDR)
+        return;
+    u16 type = ((struct eth_hdr *)frame)->type;
+    u16 off = SIZEOF_ETH_HDR;
+    u8 proto;
+    if (type == PP_HTONS(ETHTYPE_IP)) {
+        if (p->len < off + 20)
+            return;
+        proto = frame[off + 9];
+        off += (frame[off] & 0xf) << 2;
+    } else if (type == PP_HTONS(ETHTYPE_IPV6)) {
+        if (p->len < off + 40)
+            return;
+        proto = frame[off + 6];
+        off += 40;
+    } else {
+        return;
+    }
+    u16 csum_off;
+    if (proto == IP_PROTO_TCP)
+        csum_off = 16;
+    else if (proto == IP_PROTO_UDP)
+        csum_off = 6;
+    else
+        return;
+    if (off + csum_off + sizeof(u16) > p->len)
+        return;
+    p->payload += off;
+    p->len -= off;
+    p->tot_len -= off;
+    u16 csum = inet_chksum_pbuf(p);
+    p->payload -= off;
+    p->len += off;
+    p->tot_len += off;
+    *(u16 *)(frame + off + csum_off) = csum;
+}
+
 closure_function(1, 0, void, xennet_rx_service_bh,
-                 xennet_dev, xd)
+                 xennet_queue, xq)
 {
-    xennet_dev xd = bound(xd);
-    xennet_debug("%s: dev id %d", __func__, xd->dev.if_id);
+    xennet_queue xq = bound(xq);
+    xennet_dev xd = xq->xd;
+    xennet_debug("%s: dev id %d, queue %d", __func__, xd->dev.if_id, xq->id);
     list l;
-    while ((l = (list)dequeue(xd->rx_servicequeue)) != INVALID_ADDRESS) {
+    while ((l = (list)dequeue(xq->rx_servicequeue)) != INVALID_ADDRESS) {
         struct list q;
         assert(l);
         assert(l->prev);
@@ -633,10 +877,13 @@ closure_function(1, 0, void, xennet_rx_service_bh,
             assert(i);
             xennet_rx_buf rxb = struct_from_list(i, xennet_rx_buf, l);
             list_delete(i);
-            err_enum_t err = xd->netif->input((struct pbuf *)&rxb->p, xd->netif);
+            struct pbuf *p = &rxb->p.pbuf;
+            if (rxb->flags & NETRXF_csum_blank)
+                xennet_rx_complete_csum(p);
+            err_enum_t err = xd->netif->input(p, xd->netif);
             if (err != ERR_OK) {
                 msg_err("xennet: rx drop by stack, err %d\n", err);
-                xennet_return_rxbuf((struct pbuf *)&rxb->p);
+                pbuf_free(p);
             }
         }
     }
@@ -644,67 +891,130 @@ closure_function(1, 0, void, xennet_rx_service_bh,
 }
 
 closure_function(1, 0, void, xennet_event_handler,
-                 xennet_dev, xd)
+                 xennet_queue, xq)
 {
-    xennet_dev xd = bound(xd);
-    xennet_service_tx_ring(xd);
-    xennet_populate_tx_ring(xd);
-    xennet_service_rx_ring(xd);
-    xennet_populate_rx_ring(xd);
+    xennet_queue xq = bound(xq);
+    xennet_service_tx_ring(xq);
+    xennet_populate_tx_ring(xq);
+    xennet_service_rx_ring(xq);
+    xennet_populate_rx_ring(xq);
 }
 
-static status xennet_enable(xennet_dev xd)
+static xennet_queue xennet_alloc_queue(xennet_dev xd, int id)
 {
-    xen_dev xdev = &xd->dev;
-    status s = STATUS_OK;
-    xennet_debug("%s: dev id %d", __func__, xdev->if_id);
-
-    u64 val;
-    s = xenstore_read_u64(0, xdev->backend, "feature-rx-copy", &val);
-    if (!is_ok(s)) {
-        s = timm("result", "failed to verify presence of rx-copy feature: %v", s);
-        return s;
-    }
+    heap h = xd->h;
+    xennet_queue xq = allocate_zero(h, sizeof(struct xennet_queue));
+    assert(xq != INVALID_ADDRESS);
+    xq->xd = xd;
+    xq->id = id;
+
+    xq->txbufs = allocate_vector(h, 2 * XENNET_TX_RING_SIZE);
+    list_init(&xq->rx_free);
+    xq->rx_servicequeue = allocate_queue(h, XENNET_RX_SERVICEQUEUE_DEPTH);
+    assert(xq->rx_servicequeue != INVALID_ADDRESS);
+    xq->rx_service = closure(h, xennet_rx_service_bh, xq);
+
+    spin_lock_init(&xq->rx_fill_lock);
+    spin_lock_init(&xq->tx_fill_lock);
+    list_init(&xq->tx_pending);
+    list_init(&xq->tx_free);
+    xq->tx_servicequeue = allocate_queue(h, XENNET_TX_SERVICEQUEUE_DEPTH);
+    assert(xq->tx_servicequeue != INVALID_ADDRESS);
+    xq->tx_service = closure(h, xennet_tx_service_bh, xq);
+    return xq;
+}
 
-    if (!val) {
-        s = timm("result", "rx-copy not supported by backend");
-        return s;
-    }
+static status xennet_enable_queue(xennet_queue xq)
+{
+    xennet_dev xd = xq->xd;
+    xen_dev xdev = &xd->dev;
+    status s;
 
-    xd->rx_ring_gntref = GRANT_INVALID;
-    xd->tx_ring_gntref = GRANT_INVALID;
+    xq->rx_ring_gntref = GRANT_INVALID;
+    xq->tx_ring_gntref = GRANT_INVALID;
 
     /* allocate shared rings */
     netif_rx_sring_t *rx_ring = allocate_zero(xd->contiguous, PAGESIZE);
     netif_tx_sring_t *tx_ring = allocate_zero(xd->contiguous, PAGESIZE);
     assert(rx_ring != INVALID_ADDRESS);
     assert(tx_ring != INVALID_ADDRESS);
-    
+
     SHARED_RING_INIT(rx_ring);
-    FRONT_RING_INIT(&xd->rx_ring, rx_ring, PAGESIZE);
+    FRONT_RING_INIT(&xq->rx_ring, rx_ring, PAGESIZE);
     SHARED_RING_INIT(tx_ring);
-    FRONT_RING_INIT(&xd->tx_ring, tx_ring, PAGESIZE);
+    FRONT_RING_INIT(&xq->tx_ring, tx_ring, PAGESIZE);
 
     u64 phys = physical_from_virtual(rx_ring);
-    xd->rx_ring_gntref = xen_grant_page_access(xdev->backend_id, phys, false);
+    xq->rx_ring_gntref = xen_grant_page_access(xdev->backend_id, phys, false);
     phys = physical_from_virtual(tx_ring);
-    xd->tx_ring_gntref = xen_grant_page_access(xdev->backend_id, phys, false);
-    if (xd->rx_ring_gntref == 0 || xd->tx_ring_gntref == 0) {
-        s = timm("result", "failed to obtain grant references for rings");
-        goto out_dealloc;
-    }
+    xq->tx_ring_gntref = xen_grant_page_access(xdev->backend_id, phys, false);
+    if (xq->rx_ring_gntref == 0 || xq->tx_ring_gntref == 0)
+        return timm("result", "failed to obtain grant references for rings");
 
-    s = xen_allocate_evtchn(xdev->backend_id, &xd->evtchn);
+    s = xen_allocate_evtchn(xdev->backend_id, &xq->evtchn);
     if (!is_ok(s))
-        goto out_dealloc;
+        return s;
+
+    xen_register_evtchn_handler(xq->evtchn, closure(xd->h, xennet_event_handler, xq));
 
-    xen_register_evtchn_handler(xd->evtchn, closure(xd->h, xennet_event_handler, xd));
+    /* spread queue interrupts over the cpus */
+    int rv = xen_bind_evtchn_cpu(xq->evtchn, xq->id % present_processors);
+    if (rv < 0)
+        xennet_debug("queue %d: failed to bind evtchn %d to cpu (rv %d)", xq->id, xq->evtchn, rv);
 
-    xennet_debug("rx ring grantref %d, tx ring grantref %d, evtchn %d",
-                 xd->rx_ring_gntref, xd->tx_ring_gntref, xd->evtchn);
+    xennet_debug("queue %d: rx ring grantref %d, tx ring grantref %d, evtchn %d",
+                 xq->id, xq->rx_ring_gntref, xq->tx_ring_gntref, xq->evtchn);
 
     /* initialize rx buffers */
-    xennet_populate_rx_ring(xd);
+    xennet_populate_rx_ring(xq);
+    return STATUS_OK;
+}
+
+static status xennet_start_queue(xennet_queue xq)
+{
+    /* we're kind of always up ... start rx now */
+    xq->rx_ring.sring->rsp_event = xq->rx_ring.rsp_cons + 1;
+    write_barrier();
+    int rv = xen_unmask_evtchn(xq->evtchn);
+    if (rv < 0)
+        return timm("result", "failed to unmask event channel %d: rv %d", xq->evtchn, rv);
+    rv = xen_notify_evtchn(xq->evtchn);
+    if (rv < 0)
+        return timm("result", "failed to notify event channel %d: rv %d", xq->evtchn, rv);
+    return STATUS_OK;
+}
+
+static status xennet_enable(xennet_dev xd)
+{
+    xen_dev xdev = &xd->dev;
+    status s = STATUS_OK;
+    xennet_debug("%s: dev id %d", __func__, xdev->if_id);
+
+    u64 val;
+    s = xenstore_read_u64(0, xdev->backend, "feature-rx-copy", &val);
+    if (!is_ok(s)) {
+        s = timm("result", "failed to verify presence of rx-copy feature: %v", s);
+        return s;
+    }
+
+    if (!val) {
+        s = timm("result", "rx-copy not supported by backend");
+        return s;
+    }
+
+    /* Transmit checksum offload is on by default for IPv4 only; lwIP can
+       leave the checksum to the backend if it also takes IPv6 ones. */
+    s = xenstore_read_u64(0, xdev->backend, "feature-ipv6-csum-offload", &val);
+    if (is_ok(s))
+        xd->tx_csum = (val != 0);
+    else
+        deallocate_value(s);
+
+    for (int i = 0; i < xd->nqueues; i++) {
+        s = xennet_enable_queue(xd->queues[i]);
+        if (!is_ok(s))
+            goto out_dealloc;
+    }
 
     s = xennet_inform_backend(xd);
     if (!is_ok(s))
@@ -720,18 +1030,10 @@ static status xennet_enable(xennet_dev xd)
               xennet_netif_init,
               ethernet_input);
 
-    /* we're kind of always up ... start rx now */
-    xd->rx_ring.sring->rsp_event = xd->rx_ring.rsp_cons + 1;
-    write_barrier();
-    int rv = xen_unmask_evtchn(xd->evtchn);
-    if (rv < 0) {
-        s = timm("result", "failed to unmask event channel %d: rv %d", xd->evtchn, rv);
-        goto out_dealloc_rx_buffers;
-    }
-    rv = xen_notify_evtchn(xd->evtchn);
-    if (rv < 0) {
-        s = timm("result", "failed to notify event channel %d: rv %d", xd->evtchn, rv);
-        goto out_dealloc_rx_buffers;
+    for (int i = 0; i < xd->nqueues; i++) {
+        s = xennet_start_queue(xd->queues[i]);
+        if (!is_ok(s))
+            goto out_dealloc_rx_buffers;
     }
 
     return s;
@@ -755,6 +1057,7 @@ static status xennet_attach(kernel_heaps kh, int id, buffer frontend, tuple meta
 
     xd->h = heap_general(kh);
     xd->contiguous = heap_backed(kh);
+    xd->tx_csum = false;
 
     xd->netif = allocate(h, sizeof(struct netif));
     assert(xd->netif != INVALID_ADDRESS);
@@ -791,23 +1094,8 @@ static status xennet_attach(kernel_heaps kh, int id, buffer frontend, tuple meta
         xd->mtu = val;
 #endif
     xennet_debug("MTU %d, ring sizes: rx %d, tx %d\n", xd->mtu, XENNET_RX_RING_SIZE, XENNET_TX_RING_SIZE);
-    xd->rxbufs = allocate_vector(h, 2 * XENNET_RX_RING_SIZE);
-    xd->txbufs = allocate_vector(h, 2 * XENNET_TX_RING_SIZE);
-    /* figure rx buffer size */
-    xd->rxbuflen = sizeof(struct eth_hdr) + sizeof(struct eth_vlan_hdr) + xd->mtu;
-
-    list_init(&xd->rx_free);
-    xd->rx_servicequeue = allocate_queue(h, XENNET_RX_SERVICEQUEUE_DEPTH);
-    assert(xd->rx_servicequeue != INVALID_ADDRESS);
-    xd->rx_service = closure(h, xennet_rx_service_bh, xd);
-
-    spin_lock_init(&xd->rx_fill_lock);
-    spin_lock_init(&xd->tx_fill_lock);
-    list_init(&xd->tx_pending);
-    list_init(&xd->tx_free);
-    xd->tx_servicequeue = allocate_queue(h, XENNET_TX_SERVICEQUEUE_DEPTH);
-    assert(xd->tx_servicequeue != INVALID_ADDRESS);
-    xd->tx_service = closure(h, xennet_tx_service_bh, xd);
+    /* a receive slot may be filled up to the page (scatter-gather) */
+    xd->rxbuflen = PAGESIZE;
 
     xen_dev xdev = &xd->dev;
     s = xendev_attach(xdev, id, frontend, meta);
@@ -815,14 +1103,30 @@ static status xennet_attach(kernel_heaps kh, int id, buffer frontend, tuple meta
         goto out_dealloc_xd;
     xennet_debug("backend id %d, backend path %b", xdev->backend_id, xdev->backend);
 
+    /* one queue pair per cpu, as far as the backend goes */
+    u64 max_queues;
+    s = xenstore_read_u64(0, xdev->backend, "multi-queue-max-queues", &max_queues);
+    if (!is_ok(s)) {
+        deallocate_value(s);
+        s = STATUS_OK;
+        max_queues = 1;
+    }
+    xd->nqueues = MAX(1, MIN(MIN(max_queues, present_processors), XENNET_MAX_QUEUES));
+    xennet_debug("%d queues, backend max %ld", xd->nqueues, max_queues);
+
     /* allocate rx buffers up front */
-    for (int i = 0; i < XENNET_INIT_RX_BUFFERS_FACTOR * XENNET_RX_RING_SIZE; i++) {
-        xennet_rx_buf rxb = xennet_alloc_rxbuf(xd);
-        if (rxb == INVALID_ADDRESS) {
-            s = timm("result", "%s: unable to allocate rx buffers\n", __func__);
-            goto out_dealloc_xd;
+    int nrxbufs = MAX(2, XENNET_INIT_RX_BUFFERS_FACTOR / xd->nqueues) * XENNET_RX_RING_SIZE;
+    for (int q = 0; q < xd->nqueues; q++) {
+        xennet_queue xq = xennet_alloc_queue(xd, q);
+        xd->queues[q] = xq;
+        for (int i = 0; i < nrxbufs; i++) {
+            xennet_rx_buf rxb = xennet_alloc_rxbuf(xq);
+            if (rxb == INVALID_ADDRESS) {
+                s = timm("result", "%s: unable to allocate rx buffers\n", __func__);
+                goto out_dealloc_xd;
+            }
+            xennet_return_rxbuf((struct pbuf *)&rxb->p);
         }
-        xennet_return_rxbuf((struct pbuf *)&rxb->p);
     }
 
     s = xennet_enable(xd);
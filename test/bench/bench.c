@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <runtime.h>
+#include "bench.h"
+
+#define DEFAULT_DURATION_MS 1000
+#define DEFAULT_MAX_THREADS 8
+#define MAX_SAMPLES         (1 << 16)   /* per thread */
+
+#define fail(fmt, ...) do {                                             \
+        fprintf(stderr, "runtime_bench: " fmt "\n", ##__VA_ARGS__);     \
+        exit(EXIT_FAILURE);                                             \
+    } while (0)
+
+typedef struct bench_thread {
+    pthread_t tid;
+    bench b;
+    void *state;
+    int id;
+    u64 ops;
+    u64 start, end;
+    u64 nsamples;
+    u64 *samples;               /* ns per batch */
+} *bench_thread;
+
+static volatile boolean bench_stop;
+static pthread_barrier_t bench_barrier;
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *bench_thread_run(void *arg)
+{
+    bench_thread bt = arg;
+    pthread_barrier_wait(&bench_barrier);
+    bt->start = now_ns();
+    u64 t = bt->start;
+    while (!bench_stop) {
+        bt->b->run(bt->state, bt->id, BENCH_BATCH);
+        u64 t1 = now_ns();
+        if (bt->nsamples < MAX_SAMPLES)
+            bt->samples[bt->nsamples++] = t1 - t;
+        bt->ops += BENCH_BATCH;
+        t = t1;
+    }
+    bt->end = t;
+    return 0;
+}
+
+static int sample_compare(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(u64 *samples, u64 n, int pct)
+{
+    if (n == 0)
+        return 0;
+    u64 i = (n * pct) / 100;
+    return (double)samples[MIN(i, n - 1)] / BENCH_BATCH;
+}
+
+static void run_bench(heap h, bench b, int nthreads, u64 duration_ms)
+{
+    void *state = b->setup(h, nthreads);
+    if (!state)
+        fail("%s.%s: setup failed", b->suite, b->name);
+
+    /* warm caches and any lazily allocated structures */
+    for (int i = 0; i < nthreads; i++)
+        b->run(state, i, BENCH_BATCH * 16);
+
+    struct bench_thread threads[nthreads];
+    u64 *samples = malloc(sizeof(u64) * MAX_SAMPLES * nthreads);
+    if (!samples)
+        fail("failed to allocate samples");
+    bench_stop = false;
+    pthread_barrier_init(&bench_barrier, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; i++) {
+        bench_thread bt = &threads[i];
+        bt->b = b;
+        bt->state = state;
+        bt->id = i;
+        bt->ops = 0;
+        bt->nsamples = 0;
+        bt->samples = samples + i * MAX_SAMPLES;
+        if (pthread_create(&bt->tid, NULL, bench_thread_run, bt))
+            fail("pthread_create failed");
+    }
+    pthread_barrier_wait(&bench_barrier);
+    usleep(duration_ms * 1000);
+    bench_stop = true;
+
+    u64 ops = 0, nsamples = 0, start = infinity, end = 0;
+    for (int i = 0; i < nthreads; i++) {
+        bench_thread bt = &threads[i];
+        pthread_join(bt->tid, NULL);
+        ops += bt->ops;
+        start = MIN(start, bt->start);
+        end = MAX(end, bt->end);
+        /* compact the samples for sorting */
+        memmove(samples + nsamples, bt->samples, bt->nsamples * sizeof(u64));
+        nsamples += bt->nsamples;
+    }
+    pthread_barrier_destroy(&bench_barrier);
+    b->teardown(state);
+
+    qsort(samples, nsamples, sizeof(u64), sample_compare);
+    double secs = (end - start) / 1e9;
+    printf("{\"suite\":\"%s\",\"bench\":\"%s\",\"threads\":%d,\"ops\":%llu,\"usec\":%llu,"
+           "\"ops_per_sec\":%.1f,\"ns_per_op\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,"
+           "\"max\":%.1f}}\n", b->suite, b->name, nthreads, ops, (end - start) / 1000,
+           secs > 0 ? ops / secs : 0, percentile(samples, nsamples, 50),
+           percentile(samples, nsamples, 90), percentile(samples, nsamples, 99),
+           percentile(samples, nsamples, 100));
+    fflush(stdout);
+    free(samples);
+}
+
+/* a benchmark is selected by its suite name or suite.name */
+static boolean selected(bench b, int argc, char **argv)
+{
+    if (argc == 0)
+        return true;
+    int len = strlen(b->suite);
+    for (int i = 0; i < argc; i++) {
+        if (!strncmp(argv[i], b->suite, len) &&
+            (argv[i][len] == '\0' || (argv[i][len] == '.' && !strcmp(argv[i] + len + 1, b->name))))
+            return true;
+    }
+    return false;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-d duration-ms] [-t max-threads] [suite[.bench]...]\n"
+            "benchmarks:", prog);
+    for (bench b = benches; b->suite; b++)
+        fprintf(stderr, " %s.%s", b->suite, b->name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+    u64 duration_ms = DEFAULT_DURATION_MS;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = MAX(1, MIN(ncpus, DEFAULT_MAX_THREADS));
+    int c;
+
+    while ((c = getopt(argc, argv, "d:t:h")) != EOF) {
+        switch (c) {
+        case 'd':
+            duration_ms = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            if (max_threads < 1)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    for (bench b = benches; b->suite; b++) {
+        if (!selected(b, argc - optind, argv + optind))
+            continue;
+        if (b->threads == BENCH_MT) {
+            for (int n = 1; n <= max_threads; n *= 2)
+                run_bench(h, b, n, duration_ms);
+        } else {
+            run_bench(h, b, b->threads, duration_ms);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+/* Timing harness for runtime microbenchmarks. A benchmark's run function
+   performs the given number of operations; the harness calls it in batches
+   of BENCH_BATCH from one or more threads for a fixed duration and prints
+   a line of JSON per benchmark and thread count, with the throughput and
+   ns/op percentiles taken over the batches. */
+
+#define BENCH_BATCH 256
+
+/* run at 1, 2, 4... threads up to the -t limit */
+#define BENCH_MT    (-1)
+
+typedef struct bench {
+    const char *suite;
+    const char *name;
+    int threads;                /* 1, or BENCH_MT */
+    void *(*setup)(heap h, int threads);
+    void (*run)(void *state, int thread, u64 ops);
+    void (*teardown)(void *state);
+} *bench;
+
+/* terminated by an entry with a null suite */
+extern struct bench benches[];
+
+/* xorshift; the sequence from a given seed is the same on every run */
+static inline u64 bench_random(u64 *state)
+{
+    u64 x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
@@ -0,0 +1,681 @@
+#include <stdlib.h>
+#include <runtime.h>
+#include "bench.h"
+
+/* Runtime data structure and heap benchmarks. Outside of the kernel, the
+   runtime's spinlocks compile away, so only the lock-free queue is run
+   with multiple threads; the locking id heap variant shows the cost of the
+   locking path itself. */
+
+#define BENCH_ELEMENTS  (1 << 16)
+#define BENCH_SEED      88172645463325252ull
+
+#define bench_alloc(h, type) ({                                         \
+            type __s = allocate_zero(h, sizeof(*__s));                  \
+            __s == INVALID_ADDRESS ? 0 : __s;                           \
+        })
+
+/* queue */
+
+#define QUEUE_ORDER 10
+
+typedef struct queue_bench {
+    heap h;
+    queue q;
+} *queue_bench;
+
+static void *queue_setup(heap h, int threads)
+{
+    queue_bench qb = bench_alloc(h, queue_bench);
+    if (!qb)
+        return 0;
+    qb->h = h;
+    qb->q = allocate_queue(h, U64_FROM_BIT(QUEUE_ORDER));
+    if (qb->q == INVALID_ADDRESS)
+        return 0;
+    return qb;
+}
+
+static void queue_run_single(void *state, int thread, u64 ops)
+{
+    queue q = ((queue_bench)state)->q;
+    for (u64 i = 0; i < ops; i++) {
+        enqueue_single(q, pointer_from_u64((u64)i + 1));
+        dequeue_single(q);
+    }
+}
+
+/* every thread enqueues before it dequeues, so the queue can't fill */
+static void queue_run_multi(void *state, int thread, u64 ops)
+{
+    queue q = ((queue_bench)state)->q;
+    for (u64 i = 0; i < ops; i++) {
+        enqueue(q, pointer_from_u64((u64)i + 1));
+        dequeue(q);
+    }
+}
+
+static void queue_run_batch(void *state, int thread, u64 ops)
+{
+    queue q = ((queue_bench)state)->q;
+    void *batch[64];
+    for (u64 i = 0; i < ops; i += 64) {
+        for (int j = 0; j < 64; j++)
+            enqueue(q, pointer_from_u64((u64)j + 1));
+        dequeue_n(q, batch, 64);
+    }
+}
+
+static void queue_teardown(void *state)
+{
+    queue_bench qb = state;
+    deallocate_queue(qb->q);
+    deallocate(qb->h, qb, sizeof(*qb));
+}
+
+/* objcache */
+
+#define OBJCACHE_PAGESIZE   U64_FROM_BIT(21)
+#define OBJCACHE_OBJSIZE    64
+
+typedef struct objcache_bench {
+    heap h;
+    heap pages;
+    heap cache;
+    void *objs[BENCH_BATCH];
+} *objcache_bench;
+
+static void *objcache_setup(heap h, int threads)
+{
+    objcache_bench ob = bench_alloc(h, objcache_bench);
+    if (!ob)
+        return 0;
+    ob->h = h;
+    heap m = allocate_mmapheap(h, OBJCACHE_PAGESIZE * 16);
+    ob->pages = (heap)create_id_heap_backed(h, h, m, OBJCACHE_PAGESIZE, false);
+    ob->cache = allocate_objcache(h, ob->pages, OBJCACHE_OBJSIZE, OBJCACHE_PAGESIZE);
+    if (ob->cache == INVALID_ADDRESS)
+        return 0;
+    return ob;
+}
+
+static void objcache_run_alloc_free(void *state, int thread, u64 ops)
+{
+    heap cache = ((objcache_bench)state)->cache;
+    for (u64 i = 0; i < ops; i++)
+        deallocate(cache, allocate(cache, OBJCACHE_OBJSIZE), OBJCACHE_OBJSIZE);
+}
+
+/* a batch's worth of live objects, freed in reverse */
+static void objcache_run_churn(void *state, int thread, u64 ops)
+{
+    objcache_bench ob = state;
+    for (u64 i = 0; i < ops; i += BENCH_BATCH) {
+        for (int j = 0; j < BENCH_BATCH; j++)
+            ob->objs[j] = allocate(ob->cache, OBJCACHE_OBJSIZE);
+        for (int j = BENCH_BATCH - 1; j >= 0; j--)
+            deallocate(ob->cache, ob->objs[j], OBJCACHE_OBJSIZE);
+    }
+}
+
+static void objcache_teardown(void *state)
+{
+    objcache_bench ob = state;
+    destroy_heap(ob->cache);
+    destroy_heap(ob->pages);
+    deallocate(ob->h, ob, sizeof(*ob));
+}
+
+/* id heap */
+
+#define ID_PAGESIZE 4096
+#define ID_RUNSIZE  (512 * ID_PAGESIZE)
+
+typedef struct id_heap_bench {
+    heap h;
+    heap id;
+    u64 seed;
+} *id_heap_bench;
+
+/* a range with every other page of the first BENCH_ELEMENTS allocated, so
+   that allocations search fragmented free space */
+static void *id_heap_setup_common(heap h, boolean locking)
+{
+    id_heap_bench ib = bench_alloc(h, id_heap_bench);
+    if (!ib)
+        return 0;
+    ib->h = h;
+    ib->seed = BENCH_SEED;
+    ib->id = (heap)create_id_heap(h, h, ID_PAGESIZE, (u64)BENCH_ELEMENTS * 4 * ID_PAGESIZE,
+                                  ID_PAGESIZE, locking);
+    if (ib->id == INVALID_ADDRESS)
+        return 0;
+    for (int i = 0; i < BENCH_ELEMENTS; i++) {
+        u64 a = allocate_u64(ib->id, ID_PAGESIZE);
+        if (a == INVALID_PHYSICAL)
+            return 0;
+        if (i & 1)
+            deallocate_u64(ib->id, a, ID_PAGESIZE);
+    }
+    return ib;
+}
+
+static void *id_heap_setup(heap h, int threads)
+{
+    return id_heap_setup_common(h, false);
+}
+
+static void *id_heap_setup_locking(heap h, int threads)
+{
+    return id_heap_setup_common(h, true);
+}
+
+static void id_heap_run_alloc_free(void *state, int thread, u64 ops)
+{
+    heap id = ((id_heap_bench)state)->id;
+    for (u64 i = 0; i < ops; i++)
+        deallocate_u64(id, allocate_u64(id, ID_PAGESIZE), ID_PAGESIZE);
+}
+
+static void id_heap_run_alloc_free_multi(void *state, int thread, u64 ops)
+{
+    heap id = ((id_heap_bench)state)->id;
+    u64 a[8];
+    for (u64 i = 0; i < ops; i += 8) {
+        for (int j = 0; j < 8; j++)
+            a[j] = allocate_u64(id, ID_PAGESIZE * (j + 1));
+        for (int j = 0; j < 8; j++)
+            deallocate_u64(id, a[j], ID_PAGESIZE * (j + 1));
+    }
+}
+
+/* 2M runs, found past all of the fragmented space */
+static void id_heap_run_alloc_free_run(void *state, int thread, u64 ops)
+{
+    heap id = ((id_heap_bench)state)->id;
+    for (u64 i = 0; i < ops; i++)
+        deallocate_u64(id, allocate_u64(id, ID_RUNSIZE), ID_RUNSIZE);
+}
+
+/* single pages at or above a random point within the fragmented space */
+static void id_heap_run_alloc_gte(void *state, int thread, u64 ops)
+{
+    id_heap_bench ib = state;
+    for (u64 i = 0; i < ops; i++) {
+        u64 min = ID_PAGESIZE * (1 + bench_random(&ib->seed) % BENCH_ELEMENTS);
+        deallocate_u64(ib->id, id_heap_alloc_gte((id_heap)ib->id, ID_PAGESIZE, min),
+                       ID_PAGESIZE);
+    }
+}
+
+static void id_heap_teardown(void *state)
+{
+    id_heap_bench ib = state;
+    destroy_heap(ib->id);
+    deallocate(ib->h, ib, sizeof(*ib));
+}
+
+/* table and otable, keyed by aligned addresses */
+
+#define table_bench_key(i)  pointer_from_u64(0x100000 + (u64)(i) * 64)
+
+typedef struct table_bench {
+    heap h;
+    table t;
+    otable o;
+    u64 seed;
+} *table_bench;
+
+static void *table_setup(heap h, int threads)
+{
+    table_bench tb = bench_alloc(h, table_bench);
+    if (!tb)
+        return 0;
+    tb->h = h;
+    tb->seed = BENCH_SEED;
+    tb->t = allocate_table(h, identity_key, pointer_equal);
+    tb->o = allocate_otable(h, identity_key, pointer_equal, BENCH_ELEMENTS);
+    if (tb->t == INVALID_ADDRESS || tb->o == INVALID_ADDRESS)
+        return 0;
+    for (int i = 0; i < BENCH_ELEMENTS; i++) {
+        table_set(tb->t, table_bench_key(i), pointer_from_u64((u64)i + 1));
+        otable_set(tb->o, table_bench_key(i), pointer_from_u64((u64)i + 1));
+    }
+    return tb;
+}
+
+static void table_run_find(void *state, int thread, u64 ops)
+{
+    table_bench tb = state;
+    for (u64 i = 0; i < ops; i++)
+        table_find(tb->t, table_bench_key(bench_random(&tb->seed) % BENCH_ELEMENTS));
+}
+
+/* keys past the populated range */
+static void table_run_miss(void *state, int thread, u64 ops)
+{
+    table_bench tb = state;
+    for (u64 i = 0; i < ops; i++)
+        table_find(tb->t, table_bench_key(BENCH_ELEMENTS + bench_random(&tb->seed) % BENCH_ELEMENTS));
+}
+
+static void table_run_set_remove(void *state, int thread, u64 ops)
+{
+    table_bench tb = state;
+    for (u64 i = 0; i < ops; i++) {
+        void *k = table_bench_key(BENCH_ELEMENTS + bench_random(&tb->seed) % BENCH_ELEMENTS);
+        table_set(tb->t, k, k);
+        table_set(tb->t, k, 0);
+    }
+}
+
+static void table_run_otable_find(void *state, int thread, u64 ops)
+{
+    table_bench tb = state;
+    for (u64 i = 0; i < ops; i++)
+        otable_find(tb->o, table_bench_key(bench_random(&tb->seed) % BENCH_ELEMENTS));
+}
+
+static void table_run_otable_miss(void *state, int thread, u64 ops)
+{
+    table_bench tb = state;
+    for (u64 i = 0; i < ops; i++)
+        otable_find(tb->o, table_bench_key(BENCH_ELEMENTS + bench_random(&tb->seed) % BENCH_ELEMENTS));
+}
+
+static void table_run_otable_set_remove(void *state, int thread, u64 ops)
+{
+    table_bench tb = state;
+    for (u64 i = 0; i < ops; i++) {
+        void *k = table_bench_key(BENCH_ELEMENTS + bench_random(&tb->seed) % BENCH_ELEMENTS);
+        otable_set(tb->o, k, k);
+        otable_set(tb->o, k, 0);
+    }
+}
+
+static void table_teardown(void *state)
+{
+    table_bench tb = state;
+    deallocate_table(tb->t);
+    deallocate_otable(tb->o);
+    deallocate(tb->h, tb, sizeof(*tb));
+}
+
+/* rbtree */
+
+typedef struct rbtree_bench_node {
+    struct rbnode node;
+    u64 key;
+} *rbtree_bench_node;
+
+typedef struct rbtree_bench {
+    heap h;
+    rbtree t;
+    rbtree_bench_node nodes;
+    u64 seed;
+} *rbtree_bench;
+
+closure_function(0, 2, int, rbtree_bench_compare,
+                 rbnode, a, rbnode, b)
+{
+    u64 ka = ((rbtree_bench_node)a)->key, kb = ((rbtree_bench_node)b)->key;
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+closure_function(0, 1, boolean, rbtree_bench_print,
+                 rbnode, n)
+{
+    rprintf(" %ld", ((rbtree_bench_node)n)->key);
+    return true;
+}
+
+closure_function(0, 1, boolean, rbtree_bench_destruct,
+                 rbnode, n)
+{
+    return true;
+}
+
+static void *rbtree_setup(heap h, int threads)
+{
+    rbtree_bench rb = bench_alloc(h, rbtree_bench);
+    if (!rb)
+        return 0;
+    rb->h = h;
+    rb->seed = BENCH_SEED;
+    rb->t = allocate_rbtree(h, closure(h, rbtree_bench_compare), closure(h, rbtree_bench_print));
+    rb->nodes = allocate(h, sizeof(struct rbtree_bench_node) * BENCH_ELEMENTS);
+    if (rb->t == INVALID_ADDRESS || rb->nodes == INVALID_ADDRESS)
+        return 0;
+    for (int i = 0; i < BENCH_ELEMENTS; i++) {
+        rbtree_bench_node n = &rb->nodes[i];
+        init_rbnode(&n->node);
+        do {
+            n->key = bench_random(&rb->seed);
+        } while (!rbtree_insert_node(rb->t, &n->node));
+    }
+    return rb;
+}
+
+static void rbtree_run_lookup(void *state, int thread, u64 ops)
+{
+    rbtree_bench rb = state;
+    for (u64 i = 0; i < ops; i++)
+        rbtree_lookup(rb->t, &rb->nodes[bench_random(&rb->seed) % BENCH_ELEMENTS].node);
+}
+
+/* remove a node and insert it again with the same key */
+static void rbtree_run_remove_insert(void *state, int thread, u64 ops)
+{
+    rbtree_bench rb = state;
+    for (u64 i = 0; i < ops; i++) {
+        rbtree_bench_node n = &rb->nodes[bench_random(&rb->seed) % BENCH_ELEMENTS];
+        rbtree_remove_node(rb->t, &n->node);
+        init_rbnode(&n->node);
+        rbtree_insert_node(rb->t, &n->node);
+    }
+}
+
+static void rbtree_teardown(void *state)
+{
+    rbtree_bench rb = state;
+    deallocate_rbtree(rb->t, stack_closure(rbtree_bench_destruct));
+    deallocate(rb->h, rb->nodes, sizeof(struct rbtree_bench_node) * BENCH_ELEMENTS);
+    deallocate(rb->h, rb, sizeof(*rb));
+}
+
+/* pqueue */
+
+typedef struct pqueue_bench {
+    heap h;
+    pqueue q;
+    u64 seed;
+} *pqueue_bench;
+
+static boolean pqueue_bench_sort(void *a, void *b)
+{
+    return u64_from_pointer(a) > u64_from_pointer(b);
+}
+
+static void *pqueue_setup(heap h, int threads)
+{
+    pqueue_bench pb = bench_alloc(h, pqueue_bench);
+    if (!pb)
+        return 0;
+    pb->h = h;
+    pb->seed = BENCH_SEED;
+    pb->q = allocate_pqueue(h, pqueue_bench_sort);
+    if (pb->q == INVALID_ADDRESS)
+        return 0;
+    for (int i = 0; i < BENCH_ELEMENTS; i++)
+        pqueue_insert(pb->q, pointer_from_u64(bench_random(&pb->seed)));
+    return pb;
+}
+
+/* the queue stays at BENCH_ELEMENTS, like a timer heap in steady state */
+static void pqueue_run_pop_insert(void *state, int thread, u64 ops)
+{
+    pqueue_bench pb = state;
+    for (u64 i = 0; i < ops; i++) {
+        pqueue_pop(pb->q);
+        pqueue_insert(pb->q, pointer_from_u64(bench_random(&pb->seed)));
+    }
+}
+
+static void pqueue_teardown(void *state)
+{
+    pqueue_bench pb = state;
+    deallocate_pqueue(pb->q);
+    deallocate(pb->h, pb, sizeof(*pb));
+}
+
+/* rangemap, as a file-like map of adjacent extents */
+
+#define RANGEMAP_EXTENT 8
+#define RANGEMAP_WALK   64
+
+typedef struct rangemap_bench {
+    heap h;
+    rangemap rm;
+    struct rmnode *nodes;
+    u64 seed;
+} *rangemap_bench;
+
+closure_function(0, 1, void, rangemap_bench_node,
+                 rmnode, n)
+{
+}
+
+static void *rangemap_setup_common(heap h, boolean btree)
+{
+    rangemap_bench rb = bench_alloc(h, rangemap_bench);
+    if (!rb)
+        return 0;
+    rb->h = h;
+    rb->seed = BENCH_SEED;
+    rb->rm = btree ? allocate_rangemap_btree(h) : allocate_rangemap(h);
+    rb->nodes = allocate(h, sizeof(struct rmnode) * BENCH_ELEMENTS);
+    if (rb->rm == INVALID_ADDRESS || rb->nodes == INVALID_ADDRESS)
+        return 0;
+    for (int i = 0; i < BENCH_ELEMENTS; i++) {
+        rmnode_init(&rb->nodes[i], irangel((u64)i * RANGEMAP_EXTENT, RANGEMAP_EXTENT));
+        if (!rangemap_insert(rb->rm, &rb->nodes[i]))
+            return 0;
+    }
+    return rb;
+}
+
+static void *rangemap_setup(heap h, int threads)
+{
+    return rangemap_setup_common(h, false);
+}
+
+static void *rangemap_setup_btree(heap h, int threads)
+{
+    return rangemap_setup_common(h, true);
+}
+
+/* a point within a random extent */
+static void rangemap_run_lookup(void *state, int thread, u64 ops)
+{
+    rangemap_bench rb = state;
+    for (u64 i = 0; i < ops; i++)
+        rangemap_lookup(rb->rm, (bench_random(&rb->seed) % BENCH_ELEMENTS) * RANGEMAP_EXTENT + 3);
+}
+
+/* RANGEMAP_WALK extents from a random one on */
+static void rangemap_run_walk(void *state, int thread, u64 ops)
+{
+    rangemap_bench rb = state;
+    rmnode_handler nh = stack_closure(rangemap_bench_node);
+    for (u64 i = 0; i < ops; i++) {
+        u64 start = bench_random(&rb->seed) % (BENCH_ELEMENTS - RANGEMAP_WALK);
+        rangemap_range_lookup(rb->rm, irangel(start * RANGEMAP_EXTENT,
+                                              RANGEMAP_WALK * RANGEMAP_EXTENT), nh);
+    }
+}
+
+static void rangemap_teardown(void *state)
+{
+    rangemap_bench rb = state;
+    deallocate_rangemap(rb->rm, stack_closure(rangemap_bench_node));
+    deallocate(rb->h, rb->nodes, sizeof(struct rmnode) * BENCH_ELEMENTS);
+    deallocate(rb->h, rb, sizeof(*rb));
+}
+
+/* memops: runtime_memcpy and runtime_memset of one size, with buffers
+   aligned or misaligned (source by 1, destination by 3), through the word
+   loops or through the string instructions that this cpu supports */
+
+typedef struct memops_bench {
+    heap h;
+    u8 *src, *dst;
+    bytes len;
+    int align;
+    u32 features;               /* restored by teardown */
+} *memops_bench;
+
+static void *memops_setup_common(heap h, bytes len, boolean misaligned, boolean words)
+{
+    memops_bench mb = bench_alloc(h, memops_bench);
+    if (!mb)
+        return 0;
+    mb->h = h;
+    mb->len = len;
+    mb->align = misaligned ? 1 : 0;
+    mb->src = allocate(h, len + 64);
+    mb->dst = allocate(h, len + 64);
+    if (mb->src == INVALID_ADDRESS || mb->dst == INVALID_ADDRESS)
+        return 0;
+    runtime_memset(mb->src, 0x5a, len + 64);
+    runtime_memset(mb->dst, 0, len + 64);
+    mb->features = memops_features;
+    if (words)
+        memops_features = 0;
+    return mb;
+}
+
+#define memops_setup(len, misaligned, words)                                static void *memops_setup_##len##_##misaligned##_##words(heap h, int threads)     {                                                                           return memops_setup_common(h, len, misaligned, words);              }
+
+memops_setup(64, 0, 0)
+memops_setup(64, 1, 0)
+memops_setup(64, 0, 1)
+memops_setup(4096, 0, 0)
+memops_setup(4096, 1, 0)
+memops_setup(4096, 0, 1)
+memops_setup(65536, 0, 0)
+memops_setup(65536, 1, 0)
+memops_setup(65536, 0, 1)
+memops_setup(1048576, 0, 0)
+memops_setup(1048576, 1, 0)
+memops_setup(1048576, 0, 1)
+
+static void memops_run_memcpy(void *state, int thread, u64 ops)
+{
+    memops_bench mb = state;
+    for (u64 i = 0; i < ops; i++)
+        runtime_memcpy(mb->dst + mb->align * 3, mb->src + mb->align, mb->len);
+}
+
+static void memops_run_memset(void *state, int thread, u64 ops)
+{
+    memops_bench mb = state;
+    for (u64 i = 0; i < ops; i++)
+        runtime_memset(mb->dst + mb->align * 3, i, mb->len);
+}
+
+static void memops_teardown(void *state)
+{
+    memops_bench mb = state;
+    memops_features = mb->features;
+    deallocate(mb->h, mb->src, mb->len + 64);
+    deallocate(mb->h, mb->dst, mb->len + 64);
+    deallocate(mb->h, mb, sizeof(*mb));
+}
+
+#define memops_benches(name, len, misaligned, words)                        { "memops", "memcpy_" name, 1, memops_setup_##len##_##misaligned##_##words,       memops_run_memcpy, memops_teardown },                                 { "memops", "memset_" name, 1, memops_setup_##len##_##misaligned##_##words,       memops_run_memset, memops_teardown }
+
+/* sha256 of one message size, with the SHA extensions if this cpu has
+   them or with the portable block function */
+
+typedef struct sha256_bench {
+    heap h;
+    u8 *data;
+    bytes len;
+    buffer dest;
+    u32 features;               /* restored by teardown */
+} *sha256_bench;
+
+static void *sha256_setup_common(heap h, bytes len, boolean portable)
+{
+    sha256_bench sb = bench_alloc(h, sha256_bench);
+    if (!sb)
+        return 0;
+    sb->h = h;
+    sb->len = len;
+    sb->data = allocate(h, len);
+    sb->dest = allocate_buffer(h, 32);
+    if (sb->data == INVALID_ADDRESS || sb->dest == INVALID_ADDRESS)
+        return 0;
+    runtime_memset(sb->data, 0x5a, len);
+    sb->features = sha256_features;
+    if (portable)
+        sha256_features = 0;
+    return sb;
+}
+
+#define sha256_setup(len, portable)                                         static void *sha256_setup_##len##_##portable(heap h, int threads)       {                                                                           return sha256_setup_common(h, len, portable);                       }
+
+sha256_setup(64, 0)
+sha256_setup(64, 1)
+sha256_setup(1024, 0)
+sha256_setup(1024, 1)
+sha256_setup(65536, 0)
+sha256_setup(65536, 1)
+
+static void sha256_run(void *state, int thread, u64 ops)
+{
+    sha256_bench sb = state;
+    buffer src = alloca_wrap_buffer(sb->data, sb->len);
+    for (u64 i = 0; i < ops; i++) {
+        buffer_clear(sb->dest);
+        sha256(sb->dest, src);
+    }
+}
+
+static void sha256_teardown(void *state)
+{
+    sha256_bench sb = state;
+    sha256_features = sb->features;
+    deallocate_buffer(sb->dest);
+    deallocate(sb->h, sb->data, sb->len);
+    deallocate(sb->h, sb, sizeof(*sb));
+}
+
+struct bench benches[] = {
+    { "queue", "single", 1, queue_setup, queue_run_single, queue_teardown },
+    { "queue", "multi", BENCH_MT, queue_setup, queue_run_multi, queue_teardown },
+    { "queue", "batch", BENCH_MT, queue_setup, queue_run_batch, queue_teardown },
+    { "objcache", "alloc_free", 1, objcache_setup, objcache_run_alloc_free, objcache_teardown },
+    { "objcache", "churn", 1, objcache_setup, objcache_run_churn, objcache_teardown },
+    { "id_heap", "alloc_free", 1, id_heap_setup, id_heap_run_alloc_free, id_heap_teardown },
+    { "id_heap", "alloc_free_sizes", 1, id_heap_setup, id_heap_run_alloc_free_multi,
+      id_heap_teardown },
+    { "id_heap", "alloc_free_2m", 1, id_heap_setup, id_heap_run_alloc_free_run,
+      id_heap_teardown },
+    { "id_heap", "alloc_gte", 1, id_heap_setup, id_heap_run_alloc_gte, id_heap_teardown },
+    { "id_heap", "alloc_free_locking", 1, id_heap_setup_locking, id_heap_run_alloc_free,
+      id_heap_teardown },
+    { "table", "find", 1, table_setup, table_run_find, table_teardown },
+    { "table", "miss", 1, table_setup, table_run_miss, table_teardown },
+    { "table", "set_remove", 1, table_setup, table_run_set_remove, table_teardown },
+    { "table", "otable_find", 1, table_setup, table_run_otable_find, table_teardown },
+    { "table", "otable_miss", 1, table_setup, table_run_otable_miss, table_teardown },
+    { "table", "otable_set_remove", 1, table_setup, table_run_otable_set_remove, table_teardown },
+    { "rbtree", "lookup", 1, rbtree_setup, rbtree_run_lookup, rbtree_teardown },
+    { "rbtree", "remove_insert", 1, rbtree_setup, rbtree_run_remove_insert, rbtree_teardown },
+    { "pqueue", "pop_insert", 1, pqueue_setup, pqueue_run_pop_insert, pqueue_teardown },
+    { "rangemap", "lookup", 1, rangemap_setup, rangemap_run_lookup, rangemap_teardown },
+    { "rangemap", "walk", 1, rangemap_setup, rangemap_run_walk, rangemap_teardown },
+    { "rangemap", "btree_lookup", 1, rangemap_setup_btree, rangemap_run_lookup,
+      rangemap_teardown },
+    { "rangemap", "btree_walk", 1, rangemap_setup_btree, rangemap_run_walk, rangemap_teardown },
+    memops_benches("64", 64, 0, 0),
+    memops_benches("64_misaligned", 64, 1, 0),
+    memops_benches("64_words", 64, 0, 1),
+    memops_benches("4k", 4096, 0, 0),
+    memops_benches("4k_misaligned", 4096, 1, 0),
+    memops_benches("4k_words", 4096, 0, 1),
+    memops_benches("64k", 65536, 0, 0),
+    memops_benches("64k_misaligned", 65536, 1, 0),
+    memops_benches("64k_words", 65536, 0, 1),
+    memops_benches("1m", 1048576, 0, 0),
+    memops_benches("1m_misaligned", 1048576, 1, 0),
+    memops_benches("1m_words", 1048576, 0, 1),
+    { "sha256", "64", 1, sha256_setup_64_0, sha256_run, sha256_teardown },
+    { "sha256", "64_portable", 1, sha256_setup_64_1, sha256_run, sha256_teardown },
+    { "sha256", "1k", 1, sha256_setup_1024_0, sha256_run, sha256_teardown },
+    { "sha256", "1k_portable", 1, sha256_setup_1024_1, sha256_run, sha256_teardown },
+    { "sha256", "64k", 1, sha256_setup_65536_0, sha256_run, sha256_teardown },
+    { "sha256", "64k_portable", 1, sha256_setup_65536_1, sha256_run, sha256_teardown },
+    { 0 },
+};
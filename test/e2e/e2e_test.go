@@ -1,7 +1,18 @@
 package e2e
 
-import "testing"
+import (
+	"os"
+	"testing"
+)
 
 func TestE2E(t *testing.T) {
 	RunE2ETests(t)
 }
+
+// TestPerf runs the performance tier; set NANOS_PERF to enable it
+func TestPerf(t *testing.T) {
+	if os.Getenv("NANOS_PERF") == "" {
+		t.Skip("NANOS_PERF not set")
+	}
+	RunPerfTests(t)
+}
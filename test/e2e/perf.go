@@ -0,0 +1,394 @@
+package e2e
+
+import (
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"net"
+	"os"
+	"os/exec"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+)
+
+// Performance tier: each workload boots an image with 1, 2, 4 and 8 vCPUs
+// and drives it from the host with wrk, iperf3 or memtier_benchmark.
+// Results are written as JSON to $PERF_RESULTS and, if $PERF_BASELINE
+// names a results file from an earlier run, compared against it; a metric
+// that is worse than the baseline by more than $PERF_TOLERANCE percent
+// fails the test. Workloads whose load generator isn't installed are
+// skipped.
+
+const (
+	perfDefaultVCPUs     = "1,2,4,8"
+	perfDefaultDuration  = 10 // seconds
+	perfDefaultTolerance = 10 // percent
+	perfBootTimeout      = 60 * time.Second
+)
+
+type perfResult struct {
+	Workload       string  `json:"workload"`
+	VCPUs          int     `json:"vcpus"`
+	Metric         string  `json:"metric"`
+	Value          float64 `json:"value"`
+	HigherIsBetter bool    `json:"higher_is_better"`
+}
+
+type perfWorkload struct {
+	name string
+	dir  string
+	pkg  string // ops package, or
+	elf  string // host program, looked up in PATH, with Args from config.json
+	tool string // host load generator
+	port int
+	run  func(t *testing.T, duration int) ([]perfResult, error)
+}
+
+func perfEnv(name string, def string) string {
+	if v := os.Getenv(name); v != "" {
+		return v
+	}
+	return def
+}
+
+func perfEnvInt(t *testing.T, name string, def int) int {
+	v := os.Getenv(name)
+	if v == "" {
+		return def
+	}
+	n, err := strconv.Atoi(v)
+	if err != nil {
+		t.Fatalf("invalid %s: %v", name, err)
+	}
+	return n
+}
+
+// writes config.json with RunConfig.CPUs set to vcpus as perf-config.json
+func perfConfig(vcpus int) (string, error) {
+	data, err := ioutil.ReadFile("config.json")
+	if err != nil {
+		return "", err
+	}
+	var config map[string]interface{}
+	if err = json.Unmarshal(data, &config); err != nil {
+		return "", err
+	}
+	rc, ok := config["RunConfig"].(map[string]interface{})
+	if !ok {
+		rc = map[string]interface{}{}
+		config["RunConfig"] = rc
+	}
+	rc["CPUs"] = vcpus
+	if data, err = json.MarshalIndent(config, "", "  "); err != nil {
+		return "", err
+	}
+	const name = "perf-config.json"
+	return name, ioutil.WriteFile(name, data, 0644)
+}
+
+func waitForPort(port int, timeout time.Duration) error {
+	deadline := time.Now().Add(timeout)
+	addr := fmt.Sprintf("127.0.0.1:%d", port)
+	for time.Now().Before(deadline) {
+		conn, err := net.DialTimeout("tcp", addr, time.Second)
+		if err == nil {
+			conn.Close()
+			return nil
+		}
+		time.Sleep(500 * time.Millisecond)
+	}
+	return fmt.Errorf("nothing listening on %s after %v", addr, timeout)
+}
+
+// stdout of a load generator; stderr is included in the error
+func runTool(name string, args ...string) (string, error) {
+	out, err := exec.Command(name, args...).Output()
+	if err != nil {
+		if ee, ok := err.(*exec.ExitError); ok {
+			err = fmt.Errorf("%v: %s", err, ee.Stderr)
+		}
+		return string(out), fmt.Errorf("%s %s: %v", name, strings.Join(args, " "), err)
+	}
+	return string(out), nil
+}
+
+// wrk reports latencies as e.g. 512.00us, 1.25ms or 2.01s
+func parseWrkLatency(s string) (float64, error) {
+	units := []struct {
+		suffix string
+		usecs  float64
+	}{{"us", 1}, {"ms", 1000}, {"s", 1000000}}
+	for _, u := range units {
+		if strings.HasSuffix(s, u.suffix) {
+			v, err := strconv.ParseFloat(strings.TrimSuffix(s, u.suffix), 64)
+			return v * u.usecs, err
+		}
+	}
+	return 0, fmt.Errorf("unknown latency %q", s)
+}
+
+// Requests/sec and the --latency distribution, in usecs
+func parseWrk(workload string, out string) ([]perfResult, error) {
+	var results []perfResult
+	inDistribution := false
+	for _, line := range strings.Split(out, "\n") {
+		fields := strings.Fields(line)
+		switch {
+		case len(fields) == 2 && fields[0] == "Requests/sec:":
+			v, err := strconv.ParseFloat(fields[1], 64)
+			if err != nil {
+				return nil, err
+			}
+			results = append(results, perfResult{Workload: workload, Metric: "requests_per_sec",
+				Value: v, HigherIsBetter: true})
+		case strings.HasPrefix(strings.TrimSpace(line), "Latency Distribution"):
+			inDistribution = true
+		case inDistribution && len(fields) == 2 && strings.HasSuffix(fields[0], "%"):
+			v, err := parseWrkLatency(fields[1])
+			if err != nil {
+				return nil, err
+			}
+			results = append(results, perfResult{Workload: workload,
+				Metric: "latency_p" + strings.TrimSuffix(fields[0], "%") + "_us", Value: v})
+		default:
+			inDistribution = false
+		}
+	}
+	if len(results) == 0 {
+		return nil, fmt.Errorf("no results in wrk output:\n%s", out)
+	}
+	return results, nil
+}
+
+func wrkWorkload(workload string, port int, extra ...string) func(*testing.T, int) ([]perfResult, error) {
+	return func(t *testing.T, duration int) ([]perfResult, error) {
+		args := append([]string{"-t", "4", "-c", "64", "-d", fmt.Sprintf("%ds", duration), "--latency"},
+			extra...)
+		out, err := runTool("wrk", append(args, fmt.Sprintf("http://127.0.0.1:%d/", port))...)
+		if err != nil {
+			t.Log(out)
+			return nil, err
+		}
+		return parseWrk(workload, out)
+	}
+}
+
+type iperfReport struct {
+	End struct {
+		SumReceived struct {
+			BitsPerSecond float64 `json:"bits_per_second"`
+		} `json:"sum_received"`
+		Sum struct {
+			Seconds     float64 `json:"seconds"`
+			Packets     float64 `json:"packets"`
+			LostPercent float64 `json:"lost_percent"`
+		} `json:"sum"`
+	} `json:"end"`
+	Error string `json:"error"`
+}
+
+func iperfWorkload(workload string, port int, udp bool) func(*testing.T, int) ([]perfResult, error) {
+	return func(t *testing.T, duration int) ([]perfResult, error) {
+		args := []string{"-c", "127.0.0.1", "-p", strconv.Itoa(port), "-t", strconv.Itoa(duration), "-J"}
+		if udp {
+			// small datagrams at an unlimited rate, for packets per second
+			args = append(args, "-u", "-b", "0", "-l", "64")
+		} else {
+			args = append(args, "-P", "4")
+		}
+		out, err := runTool("iperf3", args...)
+		var r iperfReport
+		if jerr := json.Unmarshal([]byte(out), &r); jerr != nil {
+			t.Log(out)
+			if err == nil {
+				err = jerr
+			}
+			return nil, err
+		}
+		if r.Error != "" {
+			return nil, fmt.Errorf("iperf3: %s", r.Error)
+		}
+		if !udp {
+			return []perfResult{{Workload: workload, Metric: "bits_per_sec",
+				Value: r.End.SumReceived.BitsPerSecond, HigherIsBetter: true}}, nil
+		}
+		if r.End.Sum.Seconds == 0 {
+			return nil, fmt.Errorf("iperf3: empty udp report")
+		}
+		received := r.End.Sum.Packets * (100 - r.End.Sum.LostPercent) / 100
+		return []perfResult{
+			{Workload: workload, Metric: "packets_per_sec", Value: received / r.End.Sum.Seconds,
+				HigherIsBetter: true},
+			{Workload: workload, Metric: "lost_percent", Value: r.End.Sum.LostPercent},
+		}, nil
+	}
+}
+
+// the Totals row of the summary table: ops/sec, hits/sec, misses/sec and
+// average latency in msecs lead the row in every version
+func memtierWorkload(workload string, port int) func(*testing.T, int) ([]perfResult, error) {
+	return func(t *testing.T, duration int) ([]perfResult, error) {
+		out, err := runTool("memtier_benchmark", "-s", "127.0.0.1", "-p", strconv.Itoa(port),
+			"--protocol=redis", "--test-time", strconv.Itoa(duration), "-t", "4", "-c", "16",
+			"--hide-histogram")
+		if err != nil {
+			t.Log(out)
+			return nil, err
+		}
+		for _, line := range strings.Split(out, "\n") {
+			fields := strings.Fields(line)
+			if len(fields) < 5 || fields[0] != "Totals" {
+				continue
+			}
+			ops, err := strconv.ParseFloat(fields[1], 64)
+			if err != nil {
+				return nil, err
+			}
+			latency, err := strconv.ParseFloat(fields[4], 64)
+			if err != nil {
+				return nil, err
+			}
+			return []perfResult{
+				{Workload: workload, Metric: "ops_per_sec", Value: ops, HigherIsBetter: true},
+				{Workload: workload, Metric: "latency_avg_us", Value: latency * 1000},
+			}, nil
+		}
+		return nil, fmt.Errorf("no Totals in memtier_benchmark output:\n%s", out)
+	}
+}
+
+var perfWorkloads = []perfWorkload{
+	{name: "http_rps", dir: "nginx_1.15.6", pkg: "nginx_1.15.6", tool: "wrk", port: 8084,
+		run: wrkWorkload("http_rps", 8084)},
+	{name: "http_connection_rate", dir: "nginx_1.15.6", pkg: "nginx_1.15.6", tool: "wrk", port: 8084,
+		run: wrkWorkload("http_connection_rate", 8084, "-H", "Connection: close")},
+	{name: "tcp_bulk", dir: "iperf3", elf: "iperf3", tool: "iperf3", port: 5201,
+		run: iperfWorkload("tcp_bulk", 5201, false)},
+	{name: "udp_pps", dir: "iperf3", elf: "iperf3", tool: "iperf3", port: 5201,
+		run: iperfWorkload("udp_pps", 5201, true)},
+	{name: "redis", dir: "redis_5.0.5", pkg: "redis_5.0.5", tool: "memtier_benchmark", port: 6379,
+		run: memtierWorkload("redis", 6379)},
+}
+
+func runPerfWorkload(t *testing.T, w perfWorkload, vcpus int, duration int) []perfResult {
+	if _, err := exec.LookPath(w.tool); err != nil {
+		t.Skipf("%s not installed", w.tool)
+	}
+	var execcmd string
+	dir, err := os.Getwd()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.Chdir(dir)
+	if err = os.Chdir(dir + "/" + w.dir); err != nil {
+		t.Fatal(err)
+	}
+	config, err := perfConfig(vcpus)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.Remove(config)
+	if w.elf != "" {
+		elf, err := exec.LookPath(w.elf)
+		if err != nil {
+			t.Skipf("%s not installed", w.elf)
+		}
+		execcmd = fmt.Sprintf("ops run %s -c %s", elf, config)
+	} else {
+		execcmd = fmt.Sprintf("ops pkg load %s -c %s", w.pkg, config)
+	}
+	p, buffer, err := AsyncCmdStart(execcmd)
+	defer KillProcess(p)
+	if err != nil {
+		t.Logf("Output: %v", buffer)
+		t.Fatal(err)
+	}
+	if err = waitForPort(w.port, perfBootTimeout); err != nil {
+		t.Logf("Output: %v", buffer)
+		t.Fatal(err)
+	}
+	results, err := w.run(t, duration)
+	if err != nil {
+		t.Logf("Output: %v", buffer)
+		t.Fatal(err)
+	}
+	for i := range results {
+		results[i].VCPUs = vcpus
+		t.Logf("%s: %.1f", results[i].Metric, results[i].Value)
+	}
+	return results
+}
+
+func comparePerfBaseline(t *testing.T, results []perfResult, path string, tolerance float64) {
+	data, err := ioutil.ReadFile(path)
+	if err != nil {
+		if os.IsNotExist(err) {
+			t.Logf("no baseline at %s", path)
+			return
+		}
+		t.Fatal(err)
+	}
+	var baseline []perfResult
+	if err = json.Unmarshal(data, &baseline); err != nil {
+		t.Fatalf("%s: %v", path, err)
+	}
+	base := make(map[string]perfResult)
+	for _, r := range baseline {
+		base[fmt.Sprintf("%s/%d/%s", r.Workload, r.VCPUs, r.Metric)] = r
+	}
+	for _, r := range results {
+		key := fmt.Sprintf("%s/%d/%s", r.Workload, r.VCPUs, r.Metric)
+		b, ok := base[key]
+		if !ok || b.Value == 0 {
+			continue
+		}
+		change := (r.Value - b.Value) * 100 / b.Value
+		if !r.HigherIsBetter {
+			change = -change
+		}
+		if change < -tolerance {
+			t.Errorf("%s regressed: %.1f, baseline %.1f (%.1f%%)", key, r.Value, b.Value, change)
+		} else {
+			t.Logf("%s: %.1f, baseline %.1f (%+.1f%%)", key, r.Value, b.Value, change)
+		}
+	}
+}
+
+// RunPerfTests runs each workload at each vCPU count
+func RunPerfTests(t *testing.T) {
+	var vcpus []int
+	for _, s := range strings.Split(perfEnv("PERF_VCPUS", perfDefaultVCPUs), ",") {
+		n, err := strconv.Atoi(strings.TrimSpace(s))
+		if err != nil || n < 1 {
+			t.Fatalf("invalid PERF_VCPUS entry %q", s)
+		}
+		vcpus = append(vcpus, n)
+	}
+	duration := perfEnvInt(t, "PERF_DURATION", perfDefaultDuration)
+	tolerance := perfEnvInt(t, "PERF_TOLERANCE", perfDefaultTolerance)
+
+	var results []perfResult
+	for _, w := range perfWorkloads {
+		for _, n := range vcpus {
+			w, n := w, n
+			t.Run(fmt.Sprintf("%s/%dcpu", w.name, n), func(t *testing.T) {
+				results = append(results, runPerfWorkload(t, w, n, duration)...)
+			})
+		}
+	}
+
+	data, err := json.MarshalIndent(results, "", "  ")
+	if err != nil {
+		t.Fatal(err)
+	}
+	path := perfEnv("PERF_RESULTS", "perf-results.json")
+	if err = ioutil.WriteFile(path, data, 0644); err != nil {
+		t.Fatal(err)
+	}
+	t.Logf("results written to %s", path)
+	if baseline := os.Getenv("PERF_BASELINE"); baseline != "" {
+		comparePerfBaseline(t, results, baseline, float64(tolerance))
+	}
+}
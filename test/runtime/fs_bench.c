@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Filesystem and storage benchmarks. Each result is printed as a line of
+   JSON, prefixed with "fs_bench: " so that results can be picked out of the
+   console output and compared between releases. */
+
+#define BENCH_FILE      "fs_bench.dat"
+#define BENCH_DIR       "fs_bench.dir"
+
+#define DEFAULT_FILE_SIZE   (64ull << 20)
+#define DEFAULT_SMALL_FILES 1000
+#define DEFAULT_DIR_ENTRIES 100000
+#define RANDOM_OPS          4096
+
+#define fail(fmt, ...) do {                                 \
+        fprintf(stderr, "fs_bench: " fmt ": %s\n", ##__VA_ARGS__, strerror(errno)); \
+        exit(EXIT_FAILURE);                                 \
+    } while (0)
+
+static uint64_t file_size = DEFAULT_FILE_SIZE;
+static int small_files = DEFAULT_SMALL_FILES;
+static int dir_entries = DEFAULT_DIR_ENTRIES;
+static char *buf;
+
+static const size_t block_sizes[] = { 4 << 10, 64 << 10, 1 << 20 };
+#define N_BLOCK_SIZES (sizeof(block_sizes) / sizeof(block_sizes[0]))
+#define MAX_BLOCK_SIZE (1 << 20)
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *bench, size_t block_size, uint64_t ops, uint64_t bytes,
+                   uint64_t ns)
+{
+    double secs = ns / 1e9;
+    printf("fs_bench: {\"bench\":\"%s\",\"block_size\":%zu,\"ops\":%lu,\"bytes\":%lu,"
+           "\"usec\":%lu,\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f}\n",
+           bench, block_size, ops, bytes, ns / 1000, secs > 0 ? ops / secs : 0,
+           secs > 0 ? bytes / secs / (1 << 20) : 0);
+    fflush(stdout);
+}
+
+/* xorshift, so that random offsets are the same on every run */
+static uint64_t rand_state = 88172645463325252ull;
+
+static uint64_t next_rand(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state;
+}
+
+static void full_write(int fd, const char *p, size_t n, off_t offset)
+{
+    while (n > 0) {
+        ssize_t rv = pwrite(fd, p, n, offset);
+        if (rv <= 0)
+            fail("write at %ld", offset);
+        p += rv;
+        n -= rv;
+        offset += rv;
+    }
+}
+
+static void full_read(int fd, char *p, size_t n, off_t offset)
+{
+    while (n > 0) {
+        ssize_t rv = pread(fd, p, n, offset);
+        if (rv <= 0)
+            fail("read at %ld", offset);
+        p += rv;
+        n -= rv;
+        offset += rv;
+    }
+}
+
+static void bench_seq_write(void)
+{
+    for (int i = 0; i < N_BLOCK_SIZES; i++) {
+        size_t bs = block_sizes[i];
+        unlink(BENCH_FILE);
+        int fd = open(BENCH_FILE, O_CREAT | O_RDWR, 0644);
+        if (fd < 0)
+            fail("open " BENCH_FILE);
+        uint64_t start = now_ns();
+        for (uint64_t off = 0; off < file_size; off += bs)
+            full_write(fd, buf, bs, off);
+        if (fsync(fd) < 0)
+            fail("fsync");
+        report("seq_write", bs, file_size / bs, file_size, now_ns() - start);
+        close(fd);
+    }
+}
+
+/* Creates the benchmark file if it isn't there yet. */
+static int open_bench_file(void)
+{
+    struct stat st;
+    if (stat(BENCH_FILE, &st) < 0 || st.st_size < file_size) {
+        int fd = open(BENCH_FILE, O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0)
+            fail("open " BENCH_FILE);
+        for (uint64_t off = 0; off < file_size; off += MAX_BLOCK_SIZE)
+            full_write(fd, buf, MAX_BLOCK_SIZE, off);
+        if (fsync(fd) < 0)
+            fail("fsync");
+        close(fd);
+    }
+    int fd = open(BENCH_FILE, O_RDWR);
+    if (fd < 0)
+        fail("open " BENCH_FILE);
+    return fd;
+}
+
+static void bench_seq_read(void)
+{
+    int fd = open_bench_file();
+    for (int i = 0; i < N_BLOCK_SIZES; i++) {
+        size_t bs = block_sizes[i];
+        uint64_t start = now_ns();
+        for (uint64_t off = 0; off < file_size; off += bs)
+            full_read(fd, buf, bs, off);
+        report("seq_read", bs, file_size / bs, file_size, now_ns() - start);
+    }
+    close(fd);
+}
+
+static void bench_random(int write)
+{
+    int fd = open_bench_file();
+    for (int i = 0; i < N_BLOCK_SIZES - 1; i++) {
+        size_t bs = block_sizes[i];
+        uint64_t blocks = file_size / bs;
+        uint64_t start = now_ns();
+        for (int n = 0; n < RANDOM_OPS; n++) {
+            off_t off = (next_rand() % blocks) * bs;
+            if (write)
+                full_write(fd, buf, bs, off);
+            else
+                full_read(fd, buf, bs, off);
+        }
+        if (write && fsync(fd) < 0)
+            fail("fsync");
+        report(write ? "rand_write" : "rand_read", bs, RANDOM_OPS, RANDOM_OPS * bs,
+               now_ns() - start);
+    }
+    close(fd);
+}
+
+static void bench_rand_read(void)
+{
+    bench_random(0);
+}
+
+static void bench_rand_write(void)
+{
+    bench_random(1);
+}
+
+/* create, write and fsync small files one after another */
+static void bench_small_fsync(void)
+{
+    char name[64];
+    size_t bs = block_sizes[0];
+    if (mkdir(BENCH_DIR ".small", 0755) < 0 && errno != EEXIST)
+        fail("mkdir");
+    uint64_t start = now_ns();
+    for (int i = 0; i < small_files; i++) {
+        snprintf(name, sizeof(name), BENCH_DIR ".small/%d", i);
+        int fd = open(name, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (fd < 0)
+            fail("open %s", name);
+        full_write(fd, buf, bs, 0);
+        if (fsync(fd) < 0)
+            fail("fsync %s", name);
+        close(fd);
+    }
+    report("small_fsync", bs, small_files, (uint64_t)small_files * bs, now_ns() - start);
+    for (int i = 0; i < small_files; i++) {
+        snprintf(name, sizeof(name), BENCH_DIR ".small/%d", i);
+        unlink(name);
+    }
+}
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static void bench_getdents(void)
+{
+    char name[64];
+    if (mkdir(BENCH_DIR, 0755) < 0 && errno != EEXIST)
+        fail("mkdir");
+    uint64_t start = now_ns();
+    for (int i = 0; i < dir_entries; i++) {
+        snprintf(name, sizeof(name), BENCH_DIR "/%08d", i);
+        int fd = open(name, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0)
+            fail("open %s", name);
+        close(fd);
+    }
+    report("create", 0, dir_entries, 0, now_ns() - start);
+
+    int fd = open(BENCH_DIR, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        fail("open " BENCH_DIR);
+    uint64_t entries = 0, bytes = 0;
+    start = now_ns();
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, MAX_BLOCK_SIZE / 16);
+        if (n < 0)
+            fail("getdents64");
+        if (n == 0)
+            break;
+        for (long off = 0; off < n; entries++) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+        }
+        bytes += n;
+    }
+    report("getdents64", MAX_BLOCK_SIZE / 16, entries, bytes, now_ns() - start);
+    close(fd);
+    if (entries < dir_entries) {
+        fprintf(stderr, "fs_bench: listed %lu entries out of %d\n", entries, dir_entries);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < dir_entries; i++) {
+        snprintf(name, sizeof(name), BENCH_DIR "/%08d", i);
+        unlink(name);
+    }
+}
+
+static void bench_mmap_read(void)
+{
+    int fd = open_bench_file();
+    uint64_t start = now_ns();
+    volatile uint64_t *p = mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        fail("mmap");
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < file_size / sizeof(uint64_t); i += 8)
+        sum += p[i];
+    report("mmap_read", sizeof(uint64_t), file_size / 64, file_size, now_ns() - start);
+    munmap((void *)p, file_size);
+    close(fd);
+    if (sum == 1)           /* keep the loads */
+        printf("\n");
+}
+
+static struct {
+    const char *name;
+    void (*run)(void);
+} benches[] = {
+    { "seq_write", bench_seq_write },
+    { "seq_read", bench_seq_read },
+    { "rand_read", bench_rand_read },
+    { "rand_write", bench_rand_write },
+    { "small_fsync", bench_small_fsync },
+    { "getdents", bench_getdents },
+    { "mmap_read", bench_mmap_read },
+};
+#define N_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s file-size-mb] [-f small-files] [-d dir-entries] [bench...]\n"
+            "benches:", prog);
+    for (int i = 0; i < N_BENCHES; i++)
+        fprintf(stderr, " %s", benches[i].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:d:")) != -1) {
+        switch (opt) {
+        case 's':
+            file_size = strtoull(optarg, 0, 0) << 20;
+            break;
+        case 'f':
+            small_files = atoi(optarg);
+            break;
+        case 'd':
+            dir_entries = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (file_size < MAX_BLOCK_SIZE)
+        usage(argv[0]);
+    buf = malloc(MAX_BLOCK_SIZE);
+    if (!buf)
+        fail("malloc");
+    for (int i = 0; i < MAX_BLOCK_SIZE; i++)
+        buf[i] = i;
+
+    for (int i = 0; i < N_BENCHES; i++) {
+        int selected = optind == argc;
+        for (int j = optind; j < argc; j++)
+            if (!strcmp(argv[j], benches[i].name))
+                selected = 1;
+        if (selected)
+            benches[i].run();
+    }
+    unlink(BENCH_FILE);
+    printf("fs_bench done\n");
+    return EXIT_SUCCESS;
+}
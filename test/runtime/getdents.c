@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
@@ -70,6 +71,48 @@ struct linux_dirent64 {
        handle_error("open"); \
 } while(0)
 
+/* entries read after a rewind match the first pass, and seeking to the
+   d_off of an entry resumes with the entry after it */
+static void test_rewind(int fd)
+{
+    char buf[BUF_SIZE * 4];
+    char second[256] = "";
+    unsigned long long first_off = 0;
+    int count = 0, nread;
+    while ((nread = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (int bpos = 0; bpos < nread; count++) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + bpos);
+            if (count == 0)
+                first_off = d->d_off;
+            else if (count == 1)
+                strncpy(second, d->d_name, sizeof(second) - 1);
+            bpos += d->d_reclen;
+        }
+    }
+    if (nread == -1)
+        handle_error("getdents64");
+    if (lseek(fd, 0, SEEK_SET) != 0)
+        handle_error("lseek");
+    int recount = 0;
+    while ((nread = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (int bpos = 0; bpos < nread; recount++)
+            bpos += ((struct linux_dirent64 *)(buf + bpos))->d_reclen;
+    }
+    if (recount != count) {
+        printf("ERROR - %d entries after rewind, %d before\n", recount, count);
+        exit(EXIT_FAILURE);
+    }
+    if (count < 2)
+        return;
+    if (lseek(fd, first_off, SEEK_SET) != first_off)
+        handle_error("lseek");
+    nread = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+    if (nread <= 0 || strcmp(((struct linux_dirent64 *)buf)->d_name, second)) {
+        printf("ERROR - seek to d_off %lld did not resume at \"%s\"\n", first_off, second);
+        exit(EXIT_FAILURE);
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -84,5 +127,8 @@ main(int argc, char *argv[])
     OPEN_DIR(dirname);
     DO_GETDENTS(SYS_getdents64, linux_dirent64, d->d_type);
     close(fd);
+    OPEN_DIR(dirname);
+    test_rewind(fd);
+    close(fd);
     exit(EXIT_SUCCESS);
 }
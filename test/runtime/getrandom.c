@@ -9,6 +9,10 @@
 
 #define BUF_LEN 128
 
+#ifndef GRND_INSECURE
+#define GRND_INSECURE 0x0004
+#endif
+
 static int hash[256];
 
  void *malloc(size_t size);
@@ -36,6 +40,24 @@ int main(int argc, char **argvp)
         return 2;
     }
 
+    r = __getrandom(buffer, 0, 0);
+    if (r != 0) {
+        printf("zero-length getrandom returned %d, errno = %d\n", r, errno);
+        return 3;
+    }
+
+    r = __getrandom(buffer, BUF_LEN, GRND_INSECURE);
+    if (r != BUF_LEN) {
+        printf("GRND_INSECURE getrandom failed: r = %d, errno = %d\n", r, errno);
+        return 4;
+    }
+
+    r = __getrandom(buffer, BUF_LEN, 0);
+    if (r != BUF_LEN) {
+        printf("didn't get enough bytes: r = %d, errno = %d\n", r, errno);
+        return 2;
+    }
+
     /* Estimate Shannon entropy by:
      *
      * 1) calculate probabilities for each value
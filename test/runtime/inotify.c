@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+#define EVENT_BUF_SIZE  4096
+
+static char evbuf[EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+static int evlen, evpos;
+
+/* Returns the next event, which must have the given wd, mask and name.
+   IN_ATTRIB events, which Linux reports for link count changes, are
+   skipped. */
+static struct inotify_event *expect_event(int ifd, int wd, uint32_t mask, const char *name)
+{
+    struct inotify_event *ev;
+    do {
+        if (evpos == evlen) {
+            evlen = read(ifd, evbuf, sizeof(evbuf));
+            test_assert(evlen > 0);
+            evpos = 0;
+        }
+        ev = (struct inotify_event *)(evbuf + evpos);
+        evpos += sizeof(*ev) + ev->len;
+    } while (ev->mask == IN_ATTRIB);
+    if (ev->wd != wd || ev->mask != mask ||
+        (name ? !ev->len || strcmp(ev->name, name) : ev->len != 0)) {
+        printf("unexpected event: wd %d, mask 0x%x, name \"%s\"; expected %d, 0x%x, \"%s\"\n",
+               ev->wd, ev->mask, ev->len ? ev->name : "", wd, mask, name ? name : "");
+        exit(EXIT_FAILURE);
+    }
+    return ev;
+}
+
+static void expect_no_event(int ifd)
+{
+    test_assert(evpos == evlen);
+    test_assert(read(ifd, evbuf, sizeof(evbuf)) == -1 && errno == EAGAIN);
+}
+
+static void test_dir_events(void)
+{
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    test_assert(ifd >= 0);
+    test_assert(fcntl(ifd, F_GETFD) == FD_CLOEXEC);
+    test_assert(mkdir("/dir", 0755) == 0);
+    int wd = inotify_add_watch(ifd, "/dir", IN_ALL_EVENTS);
+    test_assert(wd >= 0);
+    expect_no_event(ifd);
+
+    int fd = open("/dir/file", O_CREAT | O_RDWR, 0644);
+    test_assert(fd >= 0);
+    expect_event(ifd, wd, IN_CREATE, "file");
+    expect_event(ifd, wd, IN_OPEN, "file");
+    test_assert(write(fd, "x", 1) == 1);
+    test_assert(write(fd, "y", 1) == 1);    /* coalesced */
+    expect_event(ifd, wd, IN_MODIFY, "file");
+    test_assert(close(fd) == 0);
+    expect_event(ifd, wd, IN_CLOSE_WRITE, "file");
+    expect_no_event(ifd);
+
+    fd = open("/dir/file", O_RDONLY);
+    test_assert(fd >= 0);
+    test_assert(close(fd) == 0);
+    int nbytes;
+    test_assert(ioctl(ifd, FIONREAD, &nbytes) == 0 && nbytes > 0);
+    expect_event(ifd, wd, IN_OPEN, "file");
+    expect_event(ifd, wd, IN_CLOSE_NOWRITE, "file");
+
+    test_assert(mkdir("/dir/sub", 0755) == 0);
+    expect_event(ifd, wd, IN_CREATE | IN_ISDIR, "sub");
+    test_assert(rmdir("/dir/sub") == 0);
+    expect_event(ifd, wd, IN_DELETE | IN_ISDIR, "sub");
+
+    test_assert(rename("/dir/file", "/dir/file2") == 0);
+    struct inotify_event *ev = expect_event(ifd, wd, IN_MOVED_FROM, "file");
+    uint32_t cookie = ev->cookie;
+    test_assert(cookie != 0);
+    ev = expect_event(ifd, wd, IN_MOVED_TO, "file2");
+    test_assert(ev->cookie == cookie);
+
+    test_assert(unlink("/dir/file2") == 0);
+    expect_event(ifd, wd, IN_DELETE, "file2");
+    expect_no_event(ifd);
+
+    /* removal of the watch queues IN_IGNORED */
+    test_assert(inotify_rm_watch(ifd, wd) == 0);
+    expect_event(ifd, wd, IN_IGNORED, NULL);
+    test_assert(inotify_rm_watch(ifd, wd) == -1 && errno == EINVAL);
+    test_assert(rmdir("/dir") == 0);
+    expect_no_event(ifd);
+    test_assert(close(ifd) == 0);
+}
+
+static void test_self_events(void)
+{
+    int ifd = inotify_init1(IN_NONBLOCK);
+    test_assert(ifd >= 0);
+    int fd = open("/self", O_CREAT | O_RDWR, 0644);
+    test_assert(fd >= 0);
+    test_assert(close(fd) == 0);
+    int wd = inotify_add_watch(ifd, "/self", IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF);
+    test_assert(wd >= 0);
+
+    /* updating the mask of an existing watch keeps its descriptor */
+    test_assert(inotify_add_watch(ifd, "/self", IN_ATTRIB | IN_MASK_ADD) == wd);
+    test_assert(inotify_add_watch(ifd, "/self", IN_ATTRIB | IN_MASK_CREATE) == -1 &&
+                errno == EEXIST);
+    test_assert(inotify_add_watch(ifd, "/self", IN_ONLYDIR | IN_MODIFY) == -1 &&
+                errno == ENOTDIR);
+
+    test_assert(truncate("/self", 16) == 0);
+    expect_event(ifd, wd, IN_MODIFY, NULL);
+    test_assert(rename("/self", "/self2") == 0);
+    expect_event(ifd, wd, IN_MOVE_SELF, NULL);
+    test_assert(unlink("/self2") == 0);
+    expect_event(ifd, wd, IN_DELETE_SELF, NULL);
+    expect_event(ifd, wd, IN_IGNORED, NULL);
+    expect_no_event(ifd);
+    test_assert(close(ifd) == 0);
+}
+
+static void test_oneshot_and_poll(void)
+{
+    int ifd = inotify_init();
+    test_assert(ifd >= 0);
+    test_assert(mkdir("/once", 0755) == 0);
+    int wd = inotify_add_watch(ifd, "/once", IN_CREATE | IN_ONESHOT);
+    test_assert(wd >= 0);
+
+    struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+    test_assert(poll(&pfd, 1, 0) == 0);
+    test_assert(mkdir("/once/a", 0755) == 0);
+    test_assert(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN));
+    test_assert(mkdir("/once/b", 0755) == 0);
+
+    /* a buffer too small for the next event is an error */
+    char small[sizeof(struct inotify_event)];
+    test_assert(read(ifd, small, sizeof(small)) == -1 && errno == EINVAL);
+    expect_event(ifd, wd, IN_CREATE | IN_ISDIR, "a");
+    expect_event(ifd, wd, IN_IGNORED, NULL);
+    test_assert(evpos == evlen);
+    test_assert(poll(&pfd, 1, 0) == 0);
+    test_assert(close(ifd) == 0);
+
+    test_assert(inotify_init1(~(IN_NONBLOCK | IN_CLOEXEC)) == -1 && errno == EINVAL);
+    ifd = inotify_init1(0);
+    test_assert(ifd >= 0);
+    test_assert(inotify_add_watch(ifd, "/nonexistent", IN_CREATE) == -1 && errno == ENOENT);
+    test_assert(inotify_add_watch(ifd, "/once", 0) == -1 && errno == EINVAL);
+    test_assert(inotify_add_watch(0, "/once", IN_CREATE) == -1 && errno == EINVAL);
+    test_assert(close(ifd) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, NULL);
+    test_dir_events();
+    test_self_events();
+    test_oneshot_and_poll();
+    printf("inotify test passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static void test_io(void)
+{
+    char buf[8192];
+    struct stat st;
+    int fd = memfd_create("io", MFD_CLOEXEC);
+    test_assert(fd >= 0);
+    test_assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+    test_assert(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == 0);
+    test_assert(read(fd, buf, sizeof(buf)) == 0);
+    test_assert(write(fd, "memfd", 5) == 5);
+    test_assert(lseek(fd, 0, SEEK_END) == 5);
+    test_assert(pread(fd, buf, sizeof(buf), 0) == 5 && !memcmp(buf, "memfd", 5));
+
+    /* growing reads back zeros; shrinking and growing again does too */
+    test_assert(ftruncate(fd, sizeof(buf)) == 0);
+    test_assert(fstat(fd, &st) == 0 && st.st_size == sizeof(buf));
+    memset(buf, 0xff, sizeof(buf));
+    test_assert(pread(fd, buf, sizeof(buf), 0) == sizeof(buf));
+    test_assert(!memcmp(buf, "memfd", 5));
+    for (int i = 5; i < sizeof(buf); i++)
+        test_assert(buf[i] == 0);
+    test_assert(ftruncate(fd, 2) == 0);
+    test_assert(ftruncate(fd, 5) == 0);
+    test_assert(pread(fd, buf, sizeof(buf), 0) == 5 && !memcmp(buf, "me\0\0\0", 5));
+
+    /* no sealing without MFD_ALLOW_SEALING */
+    test_assert(fcntl(fd, F_GET_SEALS) == F_SEAL_SEAL);
+    test_assert(fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE) == -1 && errno == EPERM);
+    test_assert(close(fd) == 0);
+    test_assert(memfd_create("bad", 0x100) == -1 && errno == EINVAL);
+}
+
+static void test_shared_map(void)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    int fd = memfd_create("map", 0);
+    test_assert(fd >= 0);
+    test_assert(ftruncate(fd, 2 * pagesize) == 0);
+    char *a = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    test_assert(a != MAP_FAILED);
+    char *b = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    test_assert(b != MAP_FAILED && b != a);
+    strcpy(a + pagesize, "shared");
+    test_assert(!strcmp(b + pagesize, "shared"));
+    char buf[8];
+    test_assert(pread(fd, buf, 7, pagesize) == 7 && !strcmp(buf, "shared"));
+    test_assert(pwrite(fd, "write", 6, 0) == 6);
+    test_assert(!strcmp(a, "write"));
+
+    /* contents outlive the descriptor while mapped */
+    test_assert(close(fd) == 0);
+    test_assert(!strcmp(b, "write") && !strcmp(a + pagesize, "shared"));
+    test_assert(munmap(a, 2 * pagesize) == 0);
+    test_assert(munmap(b, 2 * pagesize) == 0);
+}
+
+static void test_seals(void)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    int fd = memfd_create("seals", MFD_ALLOW_SEALING);
+    test_assert(fd >= 0);
+    test_assert(fcntl(fd, F_GET_SEALS) == 0);
+    test_assert(ftruncate(fd, pagesize) == 0);
+    void *p = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, fd, 0);
+    test_assert(p != MAP_FAILED);
+    test_assert(fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE) == -1 && errno == EBUSY);
+    test_assert(munmap(p, pagesize) == 0);
+
+    test_assert(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == 0);
+    test_assert(ftruncate(fd, pagesize / 2) == -1 && errno == EPERM);
+    test_assert(ftruncate(fd, 2 * pagesize) == -1 && errno == EPERM);
+    test_assert(pwrite(fd, "x", 1, pagesize) == -1 && errno == EPERM);
+    test_assert(pwrite(fd, "x", 1, 0) == 1);
+
+    test_assert(fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SEAL) == 0);
+    test_assert(fcntl(fd, F_GET_SEALS) ==
+                (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL));
+    test_assert(pwrite(fd, "x", 1, 0) == -1 && errno == EPERM);
+    test_assert(mmap(NULL, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) == MAP_FAILED);
+    p = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, fd, 0);
+    test_assert(p != MAP_FAILED && *(char *)p == 'x');
+    test_assert(mprotect(p, pagesize, PROT_READ | PROT_WRITE) == -1);
+
+    /* private mappings may still be written */
+    char *q = mmap(NULL, pagesize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    test_assert(q != MAP_FAILED);
+    q[0] = 'y';
+    test_assert(*(char *)p == 'x');
+    test_assert(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) == -1 && errno == EPERM);
+    test_assert(munmap(p, pagesize) == 0);
+    test_assert(munmap(q, pagesize) == 0);
+    test_assert(close(fd) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, NULL);
+    test_io();
+    test_shared_map();
+    test_seals();
+    printf("memfd test passed\n");
+    return EXIT_SUCCESS;
+}
@@ -639,6 +639,49 @@ static void mincore_test(void)
     free(vec);
     free(expected);
 
+    /* test prefaulting with MAP_POPULATE and mlock */
+    {
+        int i = 0;
+
+        vec = malloc(sizeof(uint8_t) * 1024);
+        expected = malloc(sizeof(uint8_t) * 1024);
+        if (vec == NULL || expected == NULL) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < 1024; i++)
+            expected[i] = 1;
+
+        addr = mmap(NULL, PAGESIZE*1024, PROT_READ|PROT_WRITE,
+                MAP_ANONYMOUS|MAP_PRIVATE|MAP_POPULATE, -1, 0);
+        if (addr == MAP_FAILED) {
+            perror("mmap failed");
+            exit(EXIT_FAILURE);
+        }
+        printf("  performing mincore on populated anonymous mmap (0x%lx)...\n",
+            (unsigned long)addr);
+        __mincore(addr, PAGESIZE*1024, vec, expected);
+        __munmap(addr, PAGESIZE*1024);
+
+        addr = mmap(NULL, PAGESIZE*16, PROT_READ|PROT_WRITE,
+                MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+        if (addr == MAP_FAILED) {
+            perror("mmap failed");
+            exit(EXIT_FAILURE);
+        }
+        if (mlock(addr, PAGESIZE*16)) {
+            perror("mlock failed");
+            exit(EXIT_FAILURE);
+        }
+        printf("  performing mincore on mlocked anonymous mmap (0x%lx)...\n",
+            (unsigned long)addr);
+        __mincore(addr, PAGESIZE*16, vec, expected);
+        __munmap(addr, PAGESIZE*16);
+    }
+
+    free(vec);
+    free(expected);
+
     printf("** all mincore tests passed\n"); 
 }
 
@@ -732,6 +775,41 @@ void mremap_test(void)
         map_size = new_size;
     }
 
+    /* move a shared file mapping and check that its contents and dirty
+       pages follow it */
+    {
+        int fd = open("mremap_file", O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd < 0) {
+            perror("mremap file open");
+            exit(EXIT_FAILURE);
+        }
+        if (ftruncate(fd, 4 * PAGESIZE) < 0) {
+            perror("mremap file ftruncate");
+            exit(EXIT_FAILURE);
+        }
+        char *p = mmap(NULL, PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            perror("mremap file mmap");
+            exit(EXIT_FAILURE);
+        }
+        p[0] = 'a';
+        char *q = mremap(p, PAGESIZE, 4 * PAGESIZE, MREMAP_MAYMOVE);
+        if (q == MAP_FAILED) {
+            perror("mremap file mremap");
+            exit(EXIT_FAILURE);
+        }
+        q[3 * PAGESIZE] = 'b';
+        char buf[1];
+        if (q[0] != 'a' || pread(fd, buf, 1, 0) != 1 || buf[0] != 'a' ||
+            pread(fd, buf, 1, 3 * PAGESIZE) != 1 || buf[0] != 'b') {
+            fprintf(stderr, "mremap of shared file mapping lost contents\n");
+            exit(EXIT_FAILURE);
+        }
+        __munmap(q, 4 * PAGESIZE);
+        close(fd);
+        unlink("mremap_file");
+    }
+
     free(vec);
     printf("** all mremap tests passed\n");
 }
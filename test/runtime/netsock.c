@@ -11,6 +11,7 @@
 #include <sys/epoll.h>
 
 #define NETSOCK_TEST_FIO_COUNT  8
+#define NETSOCK_TEST_STREAM_LEN (4 * 1024 * 1024)
 
 #define test_assert(expr) do { \
     if (!(expr)) { \
@@ -240,6 +241,71 @@ static void netsock_test_nonblocking_connect(void)
     test_assert(close(fd) == 0);
 }
 
+/* Write a pattern in writes of varying size, then close. */
+static void *netsock_test_stream_thread(void *arg)
+{
+    int port = (long)arg;
+    int fd;
+    struct sockaddr_in addr;
+    static uint8_t buf[100000];
+    size_t off = 0, len = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    while (off < NETSOCK_TEST_STREAM_LEN) {
+        size_t n = len;
+        if (n > NETSOCK_TEST_STREAM_LEN - off)
+            n = NETSOCK_TEST_STREAM_LEN - off;
+        for (size_t i = 0; i < n; i++)
+            buf[i] = (off + i) % 251;
+        ssize_t ret = write(fd, buf, n);
+        test_assert(ret > 0);
+        off += ret;
+        len = (len * 7 + 13) % sizeof(buf) + 1;
+    }
+    test_assert(close(fd) == 0);
+    return NULL;
+}
+
+/* Data between local sockets must arrive complete and in order, followed by
+   the end of the stream. */
+static void netsock_test_loopback_stream(void)
+{
+    int fd, conn_fd;
+    struct sockaddr_in addr;
+    const int port = 1236;
+    pthread_t pt;
+    static uint8_t buf[65536];
+    size_t off = 0;
+    ssize_t ret;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(listen(fd, 1) == 0);
+    test_assert(pthread_create(&pt, NULL, netsock_test_stream_thread,
+                               (void *)(long)port) == 0);
+    conn_fd = accept(fd, NULL, NULL);
+    test_assert(conn_fd > 0);
+    while ((ret = read(conn_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < ret; i++)
+            test_assert(buf[i] == (off + i) % 251);
+        off += ret;
+    }
+    test_assert(ret == 0);
+    test_assert(off == NETSOCK_TEST_STREAM_LEN);
+    test_assert(pthread_join(pt, NULL) == 0);
+    test_assert(close(conn_fd) == 0);
+    test_assert(close(fd) == 0);
+}
+
 int main(int argc, char **argv)
 {
     setbuf(stdout, NULL);
@@ -247,6 +313,7 @@ int main(int argc, char **argv)
     netsock_test_fionread();
     netsock_test_connclosed();
     netsock_test_nonblocking_connect();
+    netsock_test_loopback_stream();
     printf("Network socket tests OK\n");
     return EXIT_SUCCESS;
 }
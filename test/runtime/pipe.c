@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include <runtime.h>
 
@@ -152,6 +153,57 @@ void blocking_test(heap h, int * fds)
     printf("blocking test passed\n");
 }
 
+/* move data between pipes with vmsplice, tee and splice */
+void splice_test(heap h)
+{
+    int p1[2], p2[2];
+    char buf[64];
+    const char msg[] = "spliced pipe data";
+    struct iovec iov = { .iov_base = (void *)msg, .iov_len = sizeof(msg) };
+    ssize_t nbytes;
+
+    if (__pipe(p1) < 0 || __pipe(p2) < 0)
+        handle_error("pipe");
+    nbytes = vmsplice(p1[1], &iov, 1, 0);
+    if (nbytes != sizeof(msg)) {
+        printf("vmsplice error (%ld)\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+    nbytes = tee(p1[0], p2[1], sizeof(msg), 0);
+    if (nbytes != sizeof(msg)) {
+        printf("tee error (%ld)\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+
+    /* the data teed is still in the first pipe */
+    nbytes = read(p2[0], buf, sizeof(buf));
+    if (nbytes != sizeof(msg) || memcmp(buf, msg, sizeof(msg))) {
+        printf("read after tee error (%ld)\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+    nbytes = splice(p1[0], 0, p2[1], 0, sizeof(msg), 0);
+    if (nbytes != sizeof(msg)) {
+        printf("splice error (%ld)\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+    memset(buf, 0, sizeof(buf));
+    nbytes = read(p2[0], buf, sizeof(buf));
+    if (nbytes != sizeof(msg) || memcmp(buf, msg, sizeof(msg))) {
+        printf("read after splice error (%ld)\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+    nbytes = tee(p1[0], p2[1], sizeof(msg), SPLICE_F_NONBLOCK);
+    if (nbytes != -1 || errno != EAGAIN) {
+        printf("tee on empty pipe error (%ld)\n", nbytes);
+        exit(EXIT_FAILURE);
+    }
+    close(p1[0]);
+    close(p1[1]);
+    close(p2[0]);
+    close(p2[1]);
+    printf("PIPE-SPLICE - SUCCESS\n");
+}
+
 int main(int argc, char **argv)
 {
     int fds[2] = {0,0};
@@ -170,6 +222,8 @@ int main(int argc, char **argv)
 
     blocking_test(h, fds);
 
+    splice_test(h);
+
     close(fds[0]);
     close(fds[1]);
     return(EXIT_SUCCESS);
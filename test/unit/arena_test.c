@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <runtime.h>
+
+#define ARENATEST_ASSERT(x)                                             \
+    do {                                                                \
+        if (!(x)) {                                                     \
+            printf("%s: assertion %s failed on line %d\n", __func__, #x, __LINE__); \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while(0)
+
+#define fail_perror(msg, ...)                                           \
+    do {                                                                \
+        printf("%s failed: " msg ", error %s (%d)\n", __func__, ##__VA_ARGS__, \
+                strerror(errno), errno);                                \
+        exit(EXIT_FAILURE);                                             \
+    } while(0)
+
+#define SLAB_SIZE       (16 * KB)
+#define N_OBJS          4096
+#define N_ITEMS         (1ull << 20)
+#define N_FREERS        4
+#define N_SLOTS         256
+
+static heap test_heap;
+static word live_slabs;
+
+/* parent heap handing out slab-aligned memory */
+static u64 slab_alloc(heap h, bytes size)
+{
+    void *p = aligned_alloc(SLAB_SIZE, pad(size, SLAB_SIZE));
+    if (!p)
+        return INVALID_PHYSICAL;
+    fetch_and_add(&live_slabs, 1);
+    return u64_from_pointer(p);
+}
+
+static void slab_dealloc(heap h, u64 a, bytes size)
+{
+    fetch_and_add(&live_slabs, -1);
+    free(pointer_from_u64(a));
+}
+
+static struct heap slab_heap = {
+    .alloc = slab_alloc,
+    .dealloc = slab_dealloc,
+    .pagesize = SLAB_SIZE,
+};
+
+static void basic_test(void)
+{
+    heap a = allocate_arena(test_heap, &slab_heap, SLAB_SIZE);
+    ARENATEST_ASSERT(a != INVALID_ADDRESS);
+    ARENATEST_ASSERT(heap_allocated(a) == 0);
+
+    /* freeing the only object resets the current slab */
+    void *p = allocate(a, 40);
+    ARENATEST_ASSERT(p != INVALID_ADDRESS);
+    deallocate(a, p, 40);
+    ARENATEST_ASSERT(allocate(a, 24) == p);
+    deallocate(a, p, 24);
+
+    /* objects are aligned, disjoint and survive other allocations */
+    u8 **objs = calloc(N_OBJS, sizeof(u8 *));
+    bytes *sizes = calloc(N_OBJS, sizeof(bytes));
+    ARENATEST_ASSERT(objs && sizes);
+    for (int i = 0; i < N_OBJS; i++) {
+        sizes[i] = 1 + random() % 256;
+        objs[i] = allocate(a, sizes[i]);
+        ARENATEST_ASSERT(objs[i] != INVALID_ADDRESS);
+        ARENATEST_ASSERT((u64_from_pointer(objs[i]) & 7) == 0);
+        memset(objs[i], i & 0xff, sizes[i]);
+    }
+    ARENATEST_ASSERT(live_slabs > 1);
+    for (int i = 0; i < N_OBJS; i++) {
+        int j = random() % N_OBJS;
+        u8 *tp = objs[i];
+        bytes ts = sizes[i];
+        objs[i] = objs[j];
+        sizes[i] = sizes[j];
+        objs[j] = tp;
+        sizes[j] = ts;
+    }
+    for (int i = 0; i < N_OBJS; i++) {
+        u8 v = *objs[i];
+        for (bytes b = 0; b < sizes[i]; b++)
+            ARENATEST_ASSERT(objs[i][b] == v);
+        deallocate(a, objs[i], sizes[i]);
+    }
+    ARENATEST_ASSERT(heap_allocated(a) == 0);
+
+    /* only the current slab should remain */
+    ARENATEST_ASSERT(live_slabs == 1);
+    ARENATEST_ASSERT(heap_total(a) == SLAB_SIZE);
+
+    /* large objects go to the parent */
+    p = allocate(a, SLAB_SIZE);
+    ARENATEST_ASSERT(p != INVALID_ADDRESS);
+    ARENATEST_ASSERT(live_slabs == 2);
+    deallocate(a, p, SLAB_SIZE);
+    ARENATEST_ASSERT(live_slabs == 1);
+
+    destroy_heap(a);
+    ARENATEST_ASSERT(live_slabs == 0);
+    free(objs);
+    free(sizes);
+}
+
+/* objects allocated by the owner are freed on other threads */
+static heap thread_arena;
+static void * volatile slots[N_SLOTS];
+static volatile boolean owner_done;
+
+static void *freer(void *arg)
+{
+    u64 i = (u64)arg;
+    while (1) {
+        /* sample before the scan, so that no item can be missed */
+        boolean done = owner_done;
+        boolean found = false;
+        for (int n = 0; n < N_SLOTS; n++, i++) {
+            void *p = __atomic_exchange_n(&slots[i % N_SLOTS], 0, __ATOMIC_ACQ_REL);
+            if (!p)
+                continue;
+            found = true;
+            ARENATEST_ASSERT(*(u64 *)p == u64_from_pointer(p));
+            deallocate(thread_arena, p, 64);
+        }
+        if (!found && done)
+            return (void *)EXIT_SUCCESS;
+    }
+}
+
+static void thread_test(void)
+{
+    pthread_t threads[N_FREERS];
+    thread_arena = allocate_arena(test_heap, &slab_heap, SLAB_SIZE);
+    ARENATEST_ASSERT(thread_arena != INVALID_ADDRESS);
+    owner_done = false;
+    write_barrier();
+    for (u64 i = 0; i < N_FREERS; i++) {
+        if (pthread_create(&threads[i], NULL, freer, (void *)(i * N_SLOTS / N_FREERS)))
+            fail_perror("pthread_create");
+    }
+
+    u64 slot = 0;
+    for (u64 n = 0; n < N_ITEMS; n++) {
+        u64 *p = allocate(thread_arena, 64);
+        ARENATEST_ASSERT(p != INVALID_ADDRESS);
+        *p = u64_from_pointer(p);
+        while (1) {
+            void *expected = 0;
+            if (__atomic_compare_exchange_n(&slots[slot++ % N_SLOTS], &expected, p, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                break;
+        }
+    }
+    owner_done = true;
+    write_barrier();
+
+    for (int i = 0; i < N_FREERS; i++) {
+        void *retval;
+        if (pthread_join(threads[i], &retval))
+            fail_perror("pthread_join");
+        ARENATEST_ASSERT(retval == (void *)EXIT_SUCCESS);
+    }
+    ARENATEST_ASSERT(heap_allocated(thread_arena) == 0);
+    ARENATEST_ASSERT(live_slabs == 1);
+    destroy_heap(thread_arena);
+    ARENATEST_ASSERT(live_slabs == 0);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, NULL);
+    test_heap = init_process_runtime();
+    basic_test();
+    thread_test();
+    return EXIT_SUCCESS;
+}
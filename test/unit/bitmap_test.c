@@ -196,9 +196,8 @@ boolean test_range_check_set(bitmap b) {
     return true;
 }
 
-boolean basic_test()
+boolean basic_test(heap h)
 {
-    heap h = init_process_runtime();
     // tests bitmap allocate
     bitmap b = test_alloc(h);
     if (b == NULL) return false;
@@ -230,9 +229,69 @@ boolean basic_test()
     return true;
 }
 
+#define SEARCH_TEST_BITS       (1ull << 16)
+#define SEARCH_TEST_MAX_ORDER  14
+#define SEARCH_TEST_ALLOCS     512
+#define SEARCH_TEST_PASSES     4096
+
+/* lowest size-aligned free run at or above start, by brute force */
+static u64 reference_alloc(bitmap b, u64 nbits, u64 start, u64 end)
+{
+    u64 stride = U64_FROM_BIT(find_order(nbits));
+    for (u64 bit = pad(start, stride); bit + nbits <= end; bit += stride) {
+        u64 i;
+        for (i = 0; i < nbits && !bitmap_get(b, bit + i); i++);
+        if (i == nbits)
+            return bit;
+    }
+    return INVALID_PHYSICAL;
+}
+
+/**
+ *  Tests that the summary-guided search of bitmap_alloc_within_range
+ *  finds the same runs as a linear search, across fragmentation and
+ *  map extension.
+ */
+boolean test_alloc_search(heap h)
+{
+    bitmap b = allocate_bitmap(h, h, SEARCH_TEST_BITS);
+    u64 bits[SEARCH_TEST_ALLOCS], sizes[SEARCH_TEST_ALLOCS];
+    zero(bits, sizeof(bits));
+    for (int pass = 0; pass < SEARCH_TEST_PASSES; pass++) {
+        int slot = rand() % SEARCH_TEST_ALLOCS;
+        if (bits[slot]) {
+            if (!bitmap_dealloc(b, bits[slot] - 1, sizes[slot])) {
+                msg_err("!!! dealloc failed for bit %ld\n", bits[slot] - 1);
+                return false;
+            }
+            bits[slot] = 0;
+            continue;
+        }
+        u64 nbits = 1 + rand() % U64_FROM_BIT(rand() % (SEARCH_TEST_MAX_ORDER + 1));
+        u64 start = (rand() & 3) ? 0 : rand() % SEARCH_TEST_BITS;
+        u64 expect = reference_alloc(b, nbits, start, SEARCH_TEST_BITS);
+        u64 bit = bitmap_alloc_within_range(b, nbits, start, SEARCH_TEST_BITS);
+        if (bit != expect) {
+            msg_err("!!! alloc of %ld bits from %ld returned %ld, expected %ld\n",
+                    nbits, start, bit, expect);
+            return false;
+        }
+        if (bit != INVALID_PHYSICAL) {
+            bits[slot] = bit + 1;
+            sizes[slot] = nbits;
+        }
+    }
+    deallocate_bitmap(b);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
-    if (!basic_test()) 
+    heap h = init_process_runtime();
+    if (!basic_test(h)) 
+        goto fail;
+
+    if (!test_alloc_search(h))
         goto fail;
 
     msg_debug("test passed\n");
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <runtime.h>
+
+#define DEQUETEST_ASSERT(x)                                             \
+    do {                                                                \
+        if (!(x)) {                                                     \
+            printf("%s: assertion %s failed on line %d\n", __func__, #x, __LINE__); \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while(0)
+
+#define fail_perror(msg, ...)                                           \
+    do {                                                                \
+        printf("%s failed: " msg ", error %s (%d)\n", __func__, ##__VA_ARGS__, \
+                strerror(errno), errno);                                \
+        exit(EXIT_FAILURE);                                             \
+    } while(0)
+
+#define DEQUE_ORDER             (8)
+#define DEQUE_SIZE              (1ull << DEQUE_ORDER)
+#define N_ITEMS                 (1ull << 20)
+#define N_THIEVES               4
+#define INVALID                 (-1ull)
+
+static heap test_heap;
+static u8 *taken;
+static volatile boolean owner_done;
+
+static void basic_test(void)
+{
+    deque dq = allocate_deque(test_heap, DEQUE_SIZE);
+    DEQUETEST_ASSERT(dq != INVALID_ADDRESS);
+    DEQUETEST_ASSERT(deque_empty(dq));
+    DEQUETEST_ASSERT((u64)deque_pop(dq) == INVALID);
+    DEQUETEST_ASSERT((u64)deque_steal(dq) == INVALID);
+
+    for (u64 i = 0; i < DEQUE_SIZE; i++)
+        DEQUETEST_ASSERT(deque_push(dq, (void *)i));
+    DEQUETEST_ASSERT(deque_length(dq) == DEQUE_SIZE);
+    DEQUETEST_ASSERT(!deque_push(dq, (void *)0));
+
+    /* owner pops newest, thief takes oldest */
+    DEQUETEST_ASSERT((u64)deque_pop(dq) == DEQUE_SIZE - 1);
+    DEQUETEST_ASSERT((u64)deque_steal(dq) == 0);
+    for (u64 i = 1; i < DEQUE_SIZE - 1; i++)
+        DEQUETEST_ASSERT((u64)deque_steal(dq) == i);
+    DEQUETEST_ASSERT(deque_empty(dq));
+    DEQUETEST_ASSERT((u64)deque_pop(dq) == INVALID);
+    DEQUETEST_ASSERT((u64)deque_steal(dq) == INVALID);
+
+    /* indices wrap around the ring */
+    for (u64 pass = 0; pass < 4 * DEQUE_SIZE; pass++) {
+        DEQUETEST_ASSERT(deque_push(dq, (void *)pass));
+        DEQUETEST_ASSERT(deque_push(dq, (void *)(pass + 1)));
+        DEQUETEST_ASSERT((u64)deque_steal(dq) == pass);
+        DEQUETEST_ASSERT((u64)deque_pop(dq) == pass + 1);
+    }
+    DEQUETEST_ASSERT(deque_empty(dq));
+    deallocate_deque(dq);
+}
+
+static void take(u64 n)
+{
+    DEQUETEST_ASSERT(n < N_ITEMS);
+    u8 v = __atomic_exchange_n(&taken[n], 1, __ATOMIC_ACQ_REL);
+    DEQUETEST_ASSERT(v == 0);
+}
+
+static void *thief(void *arg)
+{
+    deque dq = arg;
+    while (1) {
+        u64 n = (u64)deque_steal(dq);
+        if (n == INVALID) {
+            if (owner_done)
+                return (void *)EXIT_SUCCESS;
+            continue;
+        }
+        take(n);
+    }
+}
+
+static void thread_test(void)
+{
+    pthread_t threads[N_THIEVES];
+    deque dq = allocate_deque(test_heap, DEQUE_SIZE);
+    taken = calloc(N_ITEMS, 1);
+    DEQUETEST_ASSERT(taken);
+    owner_done = false;
+    write_barrier();
+    for (int i = 0; i < N_THIEVES; i++) {
+        if (pthread_create(&threads[i], NULL, thief, dq))
+            fail_perror("pthread_create");
+    }
+
+    u64 next = 0;
+    while (next < N_ITEMS) {
+        int n_push = random() % (DEQUE_SIZE / 2);
+        for (int i = 0; i < n_push && next < N_ITEMS; i++) {
+            if (!deque_push(dq, (void *)next))
+                break;
+            next++;
+        }
+        int n_pop = random() % (DEQUE_SIZE / 4);
+        for (int i = 0; i < n_pop; i++) {
+            u64 n = (u64)deque_pop(dq);
+            if (n == INVALID)
+                break;
+            take(n);
+        }
+    }
+    u64 n;
+    while ((n = (u64)deque_pop(dq)) != INVALID)
+        take(n);
+    owner_done = true;
+    write_barrier();
+
+    for (int i = 0; i < N_THIEVES; i++) {
+        void *retval;
+        if (pthread_join(threads[i], &retval))
+            fail_perror("pthread_join");
+        DEQUETEST_ASSERT(retval == (void *)EXIT_SUCCESS);
+    }
+    for (u64 i = 0; i < N_ITEMS; i++)
+        DEQUETEST_ASSERT(taken[i] == 1);
+    free(taken);
+    deallocate_deque(dq);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, NULL);
+    test_heap = init_process_runtime();
+    basic_test();
+    thread_test();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+#include <runtime.h>
+#include <http.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXIT_SUCCESS 0
+#define EXIT_FAILURE 1
+
+#define test_assert(expr) do { \
+if (expr) ; else { \
+    msg_err("%s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+    goto fail; \
+} \
+} while (0)
+
+#define MAX_MESSAGES    4
+
+static tuple messages[MAX_MESSAGES];
+static int nmessages;
+
+closure_function(0, 1, void, each_message,
+                 value, v)
+{
+    if (nmessages < MAX_MESSAGES)
+        messages[nmessages] = v;
+    nmessages++;
+}
+
+static boolean message_has(int i, symbol s, const char *value)
+{
+    buffer b = get(messages[i], s);
+    return b && buffer_compare_with_cstring(b, value);
+}
+
+static boolean start_line_has(int i, u64 n, const char *value)
+{
+    tuple sl = get(messages[i], sym(start_line));
+    buffer b = sl ? get(sl, intern_u64(n)) : 0;
+    return b && buffer_compare_with_cstring(b, value);
+}
+
+/* feed the input in pieces of the given size */
+static status parse(heap h, const char *input, bytes piece)
+{
+    buffer_handler bh = allocate_http_parser(h, stack_closure(each_message));
+    nmessages = 0;
+    bytes len = runtime_strlen(input);
+    for (bytes off = 0; off < len; off += piece) {
+        status s = apply(bh, alloca_wrap_buffer(input + off, MIN(piece, len - off)));
+        if (!is_ok(s))
+            return s;
+    }
+    return apply(bh, 0);
+}
+
+static const char pipelined[] =
+    "GET /metrics HTTP/1.1\r\nHost: a\r\n\r\n"
+    "POST /x HTTP/1.1\r\nContent-Length: 5\r\nHost:  b \r\n\r\nhello"
+    "GET / HTTP/1.1\r\n\r\n";
+
+static const char chunked[] =
+    "HTTP/1.1 200 OK\r\ntransfer-encoding: chunked\r\n\r\n"
+    "5;ext=1\r\nhello\r\n7\r\n, world\r\n0\r\nTrailer: x\r\n\r\n"
+    "HTTP/1.1 204 No Content\r\n\r\n";
+
+boolean parser_tests(heap h)
+{
+    boolean failure = true;
+    bytes pieces[] = { 1, 2, 7, 4096 };
+    for (int i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+        test_assert(is_ok(parse(h, pipelined, pieces[i])));
+        test_assert(nmessages == 3);
+        test_assert(start_line_has(0, 0, "GET") && start_line_has(0, 1, "/metrics"));
+        test_assert(message_has(0, sym(Host), "a"));
+        test_assert(start_line_has(1, 0, "POST"));
+        test_assert(message_has(1, sym(Host), "b"));
+        test_assert(message_has(1, sym(content), "hello"));
+        test_assert(start_line_has(2, 1, "/"));
+        test_assert(buffer_length(get(messages[2], sym(content))) == 0);
+
+        test_assert(is_ok(parse(h, chunked, pieces[i])));
+        test_assert(nmessages == 2);
+        test_assert(start_line_has(0, 1, "200"));
+        test_assert(message_has(0, sym(content), "hello, world"));
+        test_assert(start_line_has(1, 1, "204"));
+    }
+
+    /* incomplete messages and malformed chunks are errors */
+    status s = parse(h, "GET / HTTP/1.1\r\nHost: a\r\n", 4096);
+    test_assert(!is_ok(s));
+    timm_dealloc(s);
+    s = parse(h, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", 4096);
+    test_assert(!is_ok(s));
+    timm_dealloc(s);
+    failure = false;
+fail:
+    return failure;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (parser_tests(h)) {
+        msg_err("Test failed\n");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
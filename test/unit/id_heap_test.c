@@ -355,6 +355,69 @@ static boolean alloc_subrange_test(heap h)
     return true;
 }
 
+/* A 64GB heap of 4K pages, fragmented so that no two adjacent pages are
+   free, save for a few 2M runs at the top. Multi-page allocations then
+   have to skip over the whole fragmented space. */
+#define FRAG_TEST_PAGES     (1ull << 24)
+#define FRAG_TEST_RUNS      4
+#define FRAG_TEST_RUN_PAGES 512
+#define FRAG_TEST_SMALL     4096
+
+static boolean frag_alloc_runs(id_heap id, u64 size, u64 runs_base, u64 length)
+{
+    u64 n = (length - runs_base) / size;
+    for (u64 i = 0; i < n; i++) {
+        u64 a = allocate_u64((heap)id, size);
+        if (a < runs_base || a >= length || (a & (size - 1))) {
+            msg_err("%s: alloc of 0x%lx returned 0x%lx\n", __func__, size, a);
+            return false;
+        }
+    }
+    /* scans the whole heap */
+    u64 a = allocate_u64((heap)id, size);
+    if (a != INVALID_PHYSICAL) {
+        msg_err("%s: superfluous alloc of 0x%lx returned 0x%lx\n", __func__, size, a);
+        return false;
+    }
+    deallocate_u64((heap)id, runs_base, length - runs_base);
+    return true;
+}
+
+static boolean fragmentation_test(heap h)
+{
+    u64 length = FRAG_TEST_PAGES * PAGESIZE;
+    u64 runs_base = length - FRAG_TEST_RUNS * FRAG_TEST_RUN_PAGES * PAGESIZE;
+    id_heap id = create_id_heap(h, h, 0, length, PAGESIZE, false);
+    if (id == INVALID_ADDRESS) {
+        msg_err("cannot create heap\n");
+        return false;
+    }
+    if (!id_heap_set_area(id, 0, length, true, true)) {
+        msg_err("%s: failed to fill heap\n", __func__);
+        return false;
+    }
+    for (u64 a = PAGESIZE; a < runs_base; a += 2 * PAGESIZE)
+        deallocate_u64((heap)id, a, PAGESIZE);
+    deallocate_u64((heap)id, runs_base, length - runs_base);
+    deallocate_u64((heap)id, allocate_u64((heap)id, PAGESIZE), PAGESIZE);
+
+    if (!frag_alloc_runs(id, 64 * PAGESIZE, runs_base, length) ||
+        !frag_alloc_runs(id, FRAG_TEST_RUN_PAGES * PAGESIZE, runs_base, length))
+        return false;
+
+    for (int i = 0; i < FRAG_TEST_SMALL; i++) {
+        u64 min = (random_u64() % (runs_base / PAGESIZE)) * PAGESIZE;
+        u64 a = id_heap_alloc_gte(id, PAGESIZE, min);
+        if (a == INVALID_PHYSICAL || a < min || !(a & PAGESIZE)) {
+            msg_err("%s: page alloc from 0x%lx returned 0x%lx\n", __func__, min, a);
+            return false;
+        }
+        deallocate_u64((heap)id, a, PAGESIZE);
+    }
+    destroy_heap((heap)id);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -377,6 +440,9 @@ int main(int argc, char **argv)
     if (!alloc_subrange_test(h))
         goto fail;
 
+    if (!fragmentation_test(h))
+        goto fail;
+
     msg_debug("test passed\n");
     exit(EXIT_SUCCESS);
   fail:
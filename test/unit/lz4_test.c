@@ -0,0 +1,107 @@
+#include <runtime.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUF_SIZE    (256 * KB)
+
+#define test_assert(expr)   do { \
+    if (!(expr)) { \
+        msg_err("%s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static heap h;
+static u8 *src, *comp, *out;
+
+static bytes roundtrip(bytes len)
+{
+    bytes bound = lz4_compress_bound(len);
+    bytes clen = lz4_compress(h, src, len, comp, bound);
+    test_assert(clen > 0 && clen <= bound);
+    test_assert(lz4_decompress(comp, clen, out, len) == len);
+    test_assert(runtime_memcmp(src, out, len) == 0);
+
+    /* an output buffer one byte too short is rejected */
+    if (len > 0)
+        test_assert(lz4_decompress(comp, clen, out, len - 1) == -1);
+    return clen;
+}
+
+static void test_lengths(void)
+{
+    for (bytes len = 0; len < 300; len++) {
+        for (bytes i = 0; i < len; i++)
+            src[i] = (i / 7) & 0xff;
+        roundtrip(len);
+        for (bytes i = 0; i < len; i++)
+            src[i] = random_u64();
+        roundtrip(len);
+    }
+}
+
+static void test_patterns(void)
+{
+    /* zeros */
+    zero(src, BUF_SIZE);
+    test_assert(roundtrip(BUF_SIZE) < BUF_SIZE / 100);
+
+    /* text-like data with repetitions at varying distances */
+    const char *words[] = { "kernel ", "page ", "cache ", "extent ", "tuple ", "log ", "\n" };
+    bytes n = 0;
+    while (n < BUF_SIZE) {
+        const char *w = words[random_u64() % _countof(words)];
+        bytes l = MIN(strlen(w), BUF_SIZE - n);
+        runtime_memcpy(src + n, w, l);
+        n += l;
+    }
+    test_assert(roundtrip(BUF_SIZE) < BUF_SIZE / 2);
+
+    /* random data does not grow beyond the bound */
+    for (bytes i = 0; i < BUF_SIZE; i++)
+        src[i] = random_u64();
+    roundtrip(BUF_SIZE);
+
+    /* a compressed length limit that is too small fails */
+    test_assert(lz4_compress(h, src, BUF_SIZE, comp, BUF_SIZE / 2) == 0);
+}
+
+static void test_malformed(void)
+{
+    for (bytes i = 0; i < BUF_SIZE; i++)
+        src[i] = (i % 1000) & 0xff;
+    bytes clen = lz4_compress(h, src, BUF_SIZE, comp, lz4_compress_bound(BUF_SIZE));
+    test_assert(clen > 0);
+
+    /* truncated input never reads or writes out of bounds */
+    for (bytes l = 0; l < clen; l++)
+        test_assert(lz4_decompress(comp, l, out, BUF_SIZE) < (s64)BUF_SIZE);
+
+    /* offset pointing before the start of the output */
+    u8 bad[] = { 0x10, 'a', 0x05, 0x00 };
+    test_assert(lz4_decompress(bad, sizeof(bad), out, BUF_SIZE) == -1);
+    u8 zero_offset[] = { 0x10, 'a', 0x00, 0x00 };
+    test_assert(lz4_decompress(zero_offset, sizeof(zero_offset), out, BUF_SIZE) == -1);
+
+    /* overlapping match */
+    u8 overlap[] = { 0x1f, 'a', 0x01, 0x00, 0x01, 0x00 };
+    test_assert(lz4_decompress(overlap, sizeof(overlap), out, BUF_SIZE) == 1 + 4 + 15 + 1);
+    for (int i = 0; i < 21; i++)
+        test_assert(out[i] == 'a');
+}
+
+int main(int argc, char **argv)
+{
+    h = init_process_runtime();
+    src = malloc(BUF_SIZE);
+    comp = malloc(lz4_compress_bound(BUF_SIZE));
+    out = malloc(BUF_SIZE);
+    test_assert(src && comp && out);
+    test_lengths();
+    test_patterns();
+    test_malformed();
+    free(src);
+    free(comp);
+    free(out);
+    exit(EXIT_SUCCESS);
+}
@@ -108,15 +108,71 @@ static void test_memcmp(long *buf, unsigned long buf_size)
     test_assert(runtime_memcmp(buf, buf, buf_size * sizeof(long)) == 0);
 }
 
-int main(int argc, char *argv[])
+static void test_memchr(void)
+{
+    u8 buf[64];
+    runtime_memset(buf, 'a', sizeof(buf));
+    test_assert(runtime_memchr(buf, 'b', sizeof(buf)) == 0);
+    test_assert(runtime_memchr(buf, 'a', 0) == 0);
+    for (int start = 0; start < 9; start++) {
+        for (int i = start; i < sizeof(buf); i++) {
+            buf[i] = 'b';
+            test_assert(runtime_memchr(buf + start, 'b', sizeof(buf) - start) == buf + i);
+            test_assert(runtime_memchr(buf + start, 'b', i - start) == 0);
+            buf[i] = 0x80 | 'b';    /* matches only the byte itself */
+            test_assert(runtime_memchr(buf + start, 'b', sizeof(buf) - start) == 0);
+            buf[i] = 'a';
+        }
+    }
+    buf[10] = 0;
+    test_assert(runtime_memchr(buf, 0, sizeof(buf)) == buf + 10);
+}
+
+/* larger than most last level caches */
+#define LARGE_BUF_SIZE  (4 * MB)
+
+static void test_memcpy_large(heap h)
+{
+    u8 *src = allocate(h, LARGE_BUF_SIZE + 64);
+    u8 *dst = allocate(h, LARGE_BUF_SIZE + 64);
+    test_assert(src != INVALID_ADDRESS && dst != INVALID_ADDRESS);
+    for (long i = 0; i < LARGE_BUF_SIZE + 64; i++)
+        src[i] = i * 7;
+    for (int offset = 0; offset < 16; offset += 5) {
+        bytes len = LARGE_BUF_SIZE - offset * 3;
+        runtime_memset(dst, 0, LARGE_BUF_SIZE + 64);
+        runtime_memcpy(dst + offset, src + 3, len);
+        test_assert(runtime_memcmp(dst + offset, src + 3, len) == 0);
+        test_assert(dst[offset + len] == 0);
+        if (offset)
+            test_assert(dst[offset - 1] == 0);
+    }
+    deallocate(h, src, LARGE_BUF_SIZE + 64);
+    deallocate(h, dst, LARGE_BUF_SIZE + 64);
+}
+
+static void run_tests(heap h)
 {
     long buf1[MEM_BUF_SIZE], buf2[MEM_BUF_SIZE];
 
-    init_process_runtime();
     test_memcpy(buf1, buf2, MEM_BUF_SIZE);
     test_memcpy(buf2, buf1, MEM_BUF_SIZE);
     test_memcpy_overlap(buf1, MEM_BUF_SIZE);
     test_memset(buf1, MEM_BUF_SIZE);
     test_memcmp(buf1, MEM_BUF_SIZE);
+    test_memchr();
+    test_memcpy_large(h);
+}
+
+int main(int argc, char *argv[])
+{
+    heap h = init_process_runtime();
+    u32 features = memops_features;
+
+    memops_features = 0;
+    run_tests(h);
+    memops_features = features;
+    if (features)
+        run_tests(h);
     return 0;
 }
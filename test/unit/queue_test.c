@@ -42,6 +42,7 @@
 #define INVALID                 (-1ull)
 #define THREAD_TEST_DURATION_US (5 << 20)
 #define MAX_CONSECUTIVE_OPS     (QUEUE_SIZE / 2)
+#define MAX_BATCH               64
 
 static u64 total_overflow = 0;
 static u64 total_underrun = 0;
@@ -107,6 +108,25 @@ static void * test_child(void *arg)
         }
 
         int n_dequeue = random() % MAX_CONSECUTIVE_OPS;
+        if (random() & 1) {
+            u64 batch[MAX_BATCH];
+            queuetest_debug("dequeue batches of %d...\n", n_dequeue);
+            u32 n = dequeue_n(q, (void **)batch, n_dequeue % MAX_BATCH + 1);
+            if (n == 0) {
+                if (drain_and_exit) {
+                    queuetest_debug("finished\n");
+                    return (void *)EXIT_SUCCESS;
+                }
+                fetch_and_add((u64*)&total_underrun, 1);
+            }
+            for (u32 i = 0; i < n; i++) {
+                QUEUETEST_ASSERT(batch[i] < RESULTS_VEC_SIZE);
+                release(batch[i]);
+                fetch_and_add((u64*)&total_dequeued, 1);
+            }
+            queuetest_debug("...done\n");
+            continue;
+        }
         queuetest_debug("dequeue %d...\n", n_dequeue);
         for (int i = 0; i < n_dequeue; i++) {
             /* ...same with empty condition */
@@ -236,12 +256,49 @@ static void basic_test(boolean multi)
     deallocate_queue(q);
 }
 
+static void batch_test(boolean multi)
+{
+    queuetest_debug("%s\n", multi ? "multi" : "single");
+    u64 batch[MAX_BATCH];
+    queue q = allocate_queue(test_heap, QUEUE_SIZE);
+    QUEUETEST_ASSERT(q != INVALID_ADDRESS);
+    QUEUETEST_ASSERT((multi ? dequeue_n(q, (void **)batch, MAX_BATCH) :
+                      dequeue_n_single(q, (void **)batch, MAX_BATCH)) == 0);
+
+    /* partial and full batches, order preserved across ring wrap */
+    u64 next_in = 0, next_out = 0;
+    for (int pass = 0; pass < BASIC_TEST_RANDOM_PASSES; pass++) {
+        u64 n_enqueue = random() % (QUEUE_SIZE - queue_length(q) + 1);
+        for (u64 i = 0; i < n_enqueue; i++)
+            QUEUETEST_ASSERT(test_enqueue(q, next_in++, multi));
+        u32 want = random() % MAX_BATCH + 1;
+        u64 len = queue_length(q);
+        u32 n = multi ? dequeue_n(q, (void **)batch, want) :
+            dequeue_n_single(q, (void **)batch, want);
+        QUEUETEST_ASSERT(n == MIN(want, len));
+        QUEUETEST_ASSERT(queue_length(q) == len - n);
+        for (u32 i = 0; i < n; i++)
+            QUEUETEST_ASSERT(batch[i] == next_out++);
+    }
+    while (!queue_empty(q)) {
+        u32 n = dequeue_n(q, (void **)batch, MAX_BATCH);
+        QUEUETEST_ASSERT(n > 0 && n <= MAX_BATCH);
+        for (u32 i = 0; i < n; i++)
+            QUEUETEST_ASSERT(batch[i] == next_out++);
+    }
+    QUEUETEST_ASSERT(next_out == next_in);
+    QUEUETEST_ASSERT(dequeue_n(q, (void **)batch, MAX_BATCH) == 0);
+    deallocate_queue(q);
+}
+
 int main(int argc, char **argv)
 {
     setbuf(stdout, NULL);
     test_heap = init_process_runtime();
     basic_test(false);
     basic_test(true);
+    batch_test(false);
+    batch_test(true);
     thread_test();
     queuetest_debug("queue test passed\n");
     return EXIT_SUCCESS;
@@ -0,0 +1,177 @@
+#include <runtime.h>
+#include <stdlib.h>
+
+#define RANDOM_COUNT    4096
+#define GANG_MAX        32
+
+#define entry(i) pointer_from_u64(((i) << 1) | 1)
+
+static boolean basic_test(heap h)
+{
+    struct radix_tree t;
+    init_radix_tree(&t, h);
+    if (radix_lookup(&t, 0) != INVALID_ADDRESS) {
+        msg_err("lookup on empty tree should fail\n");
+        return false;
+    }
+
+    /* indices spanning every tree height, including the topmost partial level */
+    u64 indices[] = { 0, 1, 63, 64, 4095, 4096, 1ull << 32, (1ull << 60) + 5, -2ull };
+    int n = sizeof(indices) / sizeof(indices[0]);
+    for (int i = 0; i < n; i++) {
+        if (!radix_insert(&t, indices[i], entry(indices[i]))) {
+            msg_err("insert of index 0x%lx failed\n", indices[i]);
+            return false;
+        }
+    }
+    if (radix_insert(&t, 64, entry(64))) {
+        msg_err("duplicate insert should fail\n");
+        return false;
+    }
+    if (radix_get_count(&t) != n) {
+        msg_err("count %ld, expected %d\n", radix_get_count(&t), n);
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        if (radix_lookup(&t, indices[i]) != entry(indices[i])) {
+            msg_err("lookup of index 0x%lx failed\n", indices[i]);
+            return false;
+        }
+    }
+    if (radix_lookup(&t, 2) != INVALID_ADDRESS || radix_lookup(&t, 1ull << 33) != INVALID_ADDRESS) {
+        msg_err("lookup of absent index should fail\n");
+        return false;
+    }
+
+    /* ordered gang lookup over everything, then in small batches */
+    void *results[GANG_MAX];
+    u64 found = radix_gang_lookup(&t, 0, infinity, results, GANG_MAX);
+    if (found != n) {
+        msg_err("gang lookup found %ld, expected %d\n", found, n);
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        if (results[i] != entry(indices[i])) {
+            msg_err("gang lookup result %d out of order\n", i);
+            return false;
+        }
+    }
+    found = radix_gang_lookup(&t, 2, 4096, results, GANG_MAX);
+    if (found != 3 || results[0] != entry(63) || results[1] != entry(64) ||
+        results[2] != entry(4095)) {
+        msg_err("bounded gang lookup returned %ld entries\n", found);
+        return false;
+    }
+    int next = 0;
+    u64 start = 0;
+    while ((found = radix_gang_lookup(&t, start, infinity, results, 2)) > 0) {
+        for (int i = 0; i < found; i++, next++) {
+            if (results[i] != entry(indices[next])) {
+                msg_err("batched gang lookup mismatch at %d\n", next);
+                return false;
+            }
+        }
+        start = indices[next - 1] + 1;
+    }
+    if (next != n) {
+        msg_err("batched gang lookup found %d, expected %d\n", next, n);
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (radix_remove(&t, indices[i]) != entry(indices[i])) {
+            msg_err("remove of index 0x%lx failed\n", indices[i]);
+            return false;
+        }
+        if (radix_remove(&t, indices[i]) != INVALID_ADDRESS) {
+            msg_err("second remove of index 0x%lx should fail\n", indices[i]);
+            return false;
+        }
+    }
+    if (radix_get_count(&t) != 0 || t.root != 0) {
+        msg_err("tree not empty after removals\n");
+        return false;
+    }
+    return true;
+}
+
+static boolean random_test(heap h)
+{
+    struct radix_tree t;
+    init_radix_tree(&t, h);
+    u64 *indices = malloc(RANDOM_COUNT * sizeof(u64));
+    assert(indices);
+    for (int i = 0; i < RANDOM_COUNT; i++) {
+      redo:
+        indices[i] = random_u64() & MASK(20);
+        if (!radix_insert(&t, indices[i], entry(indices[i]))) {
+            if (radix_lookup(&t, indices[i]) == INVALID_ADDRESS) {
+                msg_err("insert of index 0x%lx failed\n", indices[i]);
+                return false;
+            }
+            goto redo;
+        }
+    }
+
+    /* walk the whole tree in order */
+    void *results[GANG_MAX];
+    u64 start = 0, total = 0, last = 0;
+    u64 found;
+    while ((found = radix_gang_lookup(&t, start, infinity, results, GANG_MAX)) > 0) {
+        for (int i = 0; i < found; i++) {
+            u64 index = u64_from_pointer(results[i]) >> 1;
+            if (total > 0 && index <= last) {
+                msg_err("gang lookup out of order: 0x%lx after 0x%lx\n", index, last);
+                return false;
+            }
+            last = index;
+            total++;
+        }
+        start = last + 1;
+    }
+    if (total != RANDOM_COUNT) {
+        msg_err("walk found %ld entries, expected %d\n", total, RANDOM_COUNT);
+        return false;
+    }
+
+    for (int i = 0; i < RANDOM_COUNT; i += 2) {
+        if (radix_remove(&t, indices[i]) != entry(indices[i])) {
+            msg_err("remove of index 0x%lx failed\n", indices[i]);
+            return false;
+        }
+    }
+    for (int i = 1; i < RANDOM_COUNT; i += 2) {
+        if (radix_lookup(&t, indices[i]) != entry(indices[i])) {
+            msg_err("lookup of index 0x%lx failed after removals\n", indices[i]);
+            return false;
+        }
+    }
+    if (radix_get_count(&t) != RANDOM_COUNT / 2) {
+        msg_err("count %ld after removals\n", radix_get_count(&t));
+        return false;
+    }
+    destruct_radix_tree(&t);
+    if (radix_lookup(&t, indices[1]) != INVALID_ADDRESS) {
+        msg_err("lookup should fail after destruct\n");
+        return false;
+    }
+    free(indices);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!basic_test(h))
+        goto fail;
+
+    if (!random_test(h))
+        goto fail;
+
+    msg_debug("test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("test failed\n");
+    exit(EXIT_FAILURE);
+}
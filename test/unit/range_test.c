@@ -136,6 +136,123 @@ boolean basic_test(heap h)
     return false;
 }
 
+closure_function(1, 1, void, count_node,
+                 u64 *, count,
+                 rmnode, n)
+{
+    (*bound(count))++;
+}
+
+/* Apply the same random inserts and removals to a red-black tree and a
+   B+-tree rangemap and check that lookups, walks and neighbor steps
+   agree. Ranges are unit slots of a grid, so some inserts overlap. */
+static boolean btree_compare_test(heap h, int n_ops, u64 grid)
+{
+    rangemap rb = allocate_rangemap(h);
+    rangemap bt = allocate_rangemap_btree(h);
+    test_node *rbn = allocate_zero(h, grid * sizeof(test_node));
+    test_node *btn = allocate_zero(h, grid * sizeof(test_node));
+    if (rb == INVALID_ADDRESS || bt == INVALID_ADDRESS ||
+        rbn == INVALID_ADDRESS || btn == INVALID_ADDRESS) {
+        msg_err("allocation failed\n");
+        return false;
+    }
+    u64 ca, cb;
+    rmnode_handler count_a = stack_closure(count_node, &ca);
+    rmnode_handler count_b = stack_closure(count_node, &cb);
+    for (int op = 0; op < n_ops; op++) {
+        u64 slot = random_u64() % grid;
+        if (!rbn[slot]) {
+            u64 span = 1 + random_u64() % 4;
+            range r = irangel(slot * 4, span);
+            test_node a = allocate_test_node(h, r, slot);
+            test_node b = allocate_test_node(h, r, slot);
+            boolean ra = rangemap_insert(rb, &a->node);
+            boolean rbt = rangemap_insert(bt, &b->node);
+            if (ra != rbt) {
+                msg_err("insert %R: rbtree %d, btree %d\n", r, ra, rbt);
+                return false;
+            }
+            if (ra) {
+                rbn[slot] = a;
+                btn[slot] = b;
+            } else {
+                deallocate(h, a, sizeof(struct test_node));
+                deallocate(h, b, sizeof(struct test_node));
+            }
+        } else if (random_u64() & 1) {
+            rangemap_remove_node(rb, &rbn[slot]->node);
+            rangemap_remove_node(bt, &btn[slot]->node);
+            deallocate(h, rbn[slot], sizeof(struct test_node));
+            deallocate(h, btn[slot], sizeof(struct test_node));
+            rbn[slot] = btn[slot] = 0;
+        }
+
+        u64 point = random_u64() % (grid * 4 + 8);
+        rmnode a = rangemap_lookup(rb, point);
+        rmnode b = rangemap_lookup(bt, point);
+        if ((a == INVALID_ADDRESS) != (b == INVALID_ADDRESS) ||
+            (a != INVALID_ADDRESS && !range_equal(a->r, b->r))) {
+            msg_err("lookup %ld mismatch\n", point);
+            return false;
+        }
+        a = rangemap_lookup_at_or_next(rb, point);
+        b = rangemap_lookup_at_or_next(bt, point);
+        if ((a == INVALID_ADDRESS) != (b == INVALID_ADDRESS) ||
+            (a != INVALID_ADDRESS && !range_equal(a->r, b->r))) {
+            msg_err("lookup_at_or_next %ld mismatch\n", point);
+            return false;
+        }
+        if (b != INVALID_ADDRESS) {
+            rmnode bp = rangemap_prev_node(bt, b);
+            rmnode ap = rangemap_prev_node(rb, a);
+            if ((ap == INVALID_ADDRESS) != (bp == INVALID_ADDRESS) ||
+                (ap != INVALID_ADDRESS && !range_equal(ap->r, bp->r))) {
+                msg_err("prev of %R mismatch\n", b->r);
+                return false;
+            }
+        }
+        range q = irangel(point, random_u64() % 64);
+        ca = cb = 0;
+        rangemap_range_lookup(rb, q, count_a);
+        rangemap_range_lookup(bt, q, count_b);
+        if (ca != cb) {
+            msg_err("range lookup %R: rbtree %ld nodes, btree %ld\n", q, ca, cb);
+            return false;
+        }
+    }
+
+    /* full walks in order */
+    rmnode b = rangemap_first_node(bt);
+    rangemap_foreach(rb, a) {
+        if (b == INVALID_ADDRESS || !range_equal(a->r, b->r)) {
+            msg_err("walk mismatch at %R\n", a->r);
+            return false;
+        }
+        b = rangemap_next_node(bt, b);
+    }
+    if (b != INVALID_ADDRESS) {
+        msg_err("btree walk has extra node %R\n", b->r);
+        return false;
+    }
+
+    /* remove during a walk */
+    rangemap_foreach(bt, n) {
+        rangemap_remove_node(bt, n);
+        btn[((test_node)n)->val] = 0;
+        deallocate(h, n, sizeof(struct test_node));
+    }
+    if (rangemap_first_node(bt) != INVALID_ADDRESS || bt->root) {
+        msg_err("btree not empty after removing all nodes\n");
+        return false;
+    }
+    deallocate_rangemap(rb, stack_closure(dealloc_test_node, h));
+    deallocate_rangemap(bt, stack_closure(dealloc_test_node, h));
+    deallocate(h, rbn, grid * sizeof(test_node));
+    deallocate(h, btn, grid * sizeof(test_node));
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -143,6 +260,10 @@ int main(int argc, char **argv)
     if (!basic_test(h))
         goto fail;
 
+    if (!btree_compare_test(h, 20000, 64) ||
+        !btree_compare_test(h, 200000, 8192))
+        goto fail;
+
     /*
       if (!random_test(h, 100, 1000))
       goto fail;
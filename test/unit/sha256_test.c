@@ -0,0 +1,94 @@
+#include <runtime.h>
+#include <stdlib.h>
+
+#define test_assert(expr)   do { \
+    if (!(expr)) { \
+        msg_err("%s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static const struct {
+    const char *msg;
+    u64 repeat;
+    const char *digest;
+} vectors[] = {
+    { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static u8 hex_nibble(char c)
+{
+    return c <= '9' ? c - '0' : c - 'a' + 10;
+}
+
+static void test_vectors(heap h)
+{
+    for (int i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        bytes len = runtime_strlen(vectors[i].msg);
+        buffer src = allocate_buffer(h, len * vectors[i].repeat + 1);
+        for (u64 r = 0; r < vectors[i].repeat; r++)
+            buffer_write(src, vectors[i].msg, len);
+        buffer dest = allocate_buffer(h, 32);
+        sha256(dest, src);
+        test_assert(buffer_length(dest) == 32);
+        u8 *d = buffer_ref(dest, 0);
+        for (int j = 0; j < 32; j++)
+            test_assert(d[j] == ((hex_nibble(vectors[i].digest[2 * j]) << 4) |
+                                 hex_nibble(vectors[i].digest[2 * j + 1])));
+        deallocate_buffer(src);
+        deallocate_buffer(dest);
+    }
+}
+
+/* the block function with and without the SHA extensions, from every
+   alignment; and sha256() over lengths around the block and padding
+   boundaries */
+static void test_compare(heap h, u32 features)
+{
+    u8 *data = allocate(h, 64 * 17 + 16);
+    test_assert(data != INVALID_ADDRESS);
+    for (int i = 0; i < 64 * 17 + 16; i++)
+        data[i] = random_u64();
+    for (int align = 0; align < 16; align++) {
+        for (u64 nblocks = 1; nblocks <= 17; nblocks += 4) {
+            u32 a[8], b[8];
+            for (int i = 0; i < 8; i++)
+                a[i] = b[i] = random_u64();
+            sha256_features = 0;
+            sha256_blocks(a, data + align, nblocks);
+            sha256_features = features;
+            sha256_blocks(b, data + align, nblocks);
+            test_assert(runtime_memcmp(a, b, sizeof(a)) == 0);
+        }
+    }
+    for (bytes len = 0; len < 300; len++) {
+        buffer src = alloca_wrap_buffer(data + (len & 15), len);
+        buffer d0 = little_stack_buffer(32);
+        buffer d1 = little_stack_buffer(32);
+        sha256_features = 0;
+        sha256(d0, src);
+        sha256_features = features;
+        sha256(d1, src);
+        test_assert(runtime_memcmp(buffer_ref(d0, 0), buffer_ref(d1, 0), 32) == 0);
+    }
+    deallocate(h, data, 64 * 17 + 16);
+}
+
+int main(int argc, char *argv[])
+{
+    heap h = init_process_runtime();
+    u32 features = sha256_features;
+
+    sha256_features = 0;
+    test_vectors(h);
+    sha256_features = features;
+    if (features) {
+        test_vectors(h);
+        test_compare(h, features);
+    }
+    return 0;
+}
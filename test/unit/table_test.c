@@ -16,10 +16,10 @@ static inline boolean anything_equals(void *a, void* b)
     return true;
 }
 
-static boolean basic_table_tests(heap h, u64 (*key_function)(void *x), u64 n_elem)
+static boolean basic_table_tests(heap h, u64 (*key_function)(void *x), u64 n_elem, int size_hint)
 {
     u64 heap_occupancy = heap_allocated(h);
-    table t = allocate_table(h, key_function, pointer_equal);
+    table t = allocate_table_sized(h, key_function, pointer_equal, size_hint);
     u64 count;
 
     table_validate(t, "basic_table_tests: alloc");
@@ -200,6 +200,87 @@ static boolean one_elem_table_tests(heap h, u64 n_elem)
     return true;
 }
 
+static boolean basic_otable_tests(heap h, u64 (*key_function)(void *x), u64 n_elem, int size_hint)
+{
+    u64 heap_occupancy = heap_allocated(h);
+    otable t = allocate_otable(h, key_function, pointer_equal, size_hint);
+    u64 count;
+
+    if (otable_elements(t) != 0) {
+        msg_err("otable_elements() not zero on empty table\n");
+        return false;
+    }
+    otable_foreach(t, n, v) {
+        (void) n;
+        (void) v;
+        msg_err("otable_foreach() on empty table\n");
+        return false;
+    }
+
+    for (count = 0; count < n_elem; count++)
+        otable_set(t, (void *)(count << 12), (void *)(count + 1));
+
+    /* This should not add anything to the table. */
+    otable_set(t, (void *)(count << 12), 0);
+
+    count = 0;
+    otable_foreach(t, n, v) {
+        if ((u64)v != ((u64)n >> 12) + 1) {
+            msg_err("otable_foreach() invalid value %ld for name %ld\n", (u64)v, (u64)n);
+            return false;
+        }
+        count++;
+    }
+    if (count != n_elem || otable_elements(t) != n_elem) {
+        msg_err("otable_foreach() invalid iteration count %ld\n", count);
+        return false;
+    }
+
+    /* remove every other element, then check the rest are still found */
+    for (count = 0; count < n_elem; count += 2)
+        otable_set(t, (void *)(count << 12), 0);
+    for (count = 0; count < n_elem; count++) {
+        u64 v = (u64)otable_find(t, (void *)(count << 12));
+        if (v != ((count & 1) ? count + 1 : 0)) {
+            msg_err("element %ld invalid value %ld after removals\n", count, v);
+            return false;
+        }
+    }
+    if (otable_elements(t) != n_elem / 2) {
+        msg_err("invalid otable_elements() %d, should be %ld\n", otable_elements(t), n_elem / 2);
+        return false;
+    }
+
+    /* replace, then remove the rest */
+    for (count = 1; count < n_elem; count += 2)
+        otable_set(t, (void *)(count << 12), (void *)count);
+    for (count = 1; count < n_elem; count += 2) {
+        if ((u64)otable_find(t, (void *)(count << 12)) != count) {
+            msg_err("element %ld not replaced\n", count);
+            return false;
+        }
+        otable_set(t, (void *)(count << 12), 0);
+    }
+    if (otable_elements(t) != 0) {
+        msg_err("invalid otable_elements() %d, should be 0\n", otable_elements(t));
+        return false;
+    }
+
+    otable_set(t, (void *)1, (void *)1);
+    otable_clear(t);
+    if (otable_find(t, (void *)1) || otable_elements(t) != 0) {
+        msg_err("element found after otable_clear()\n");
+        return false;
+    }
+
+    deallocate_otable(t);
+    if (heap_allocated(h) != heap_occupancy) {
+        msg_err("leak: heap_allocated(h) %ld, originally %ld\n", heap_allocated(h), heap_occupancy);
+        return false;
+    }
+    return true;
+}
+
 #define BASIC_ELEM_COUNT  512
 #define STRESS_ELEM_COUNT (1ull << 20)
 
@@ -207,30 +288,44 @@ int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
 
-    if (!basic_table_tests(h, identity_key, BASIC_ELEM_COUNT)) {
+    if (!basic_table_tests(h, identity_key, BASIC_ELEM_COUNT, 0)) {
         msg_err("Identity key table test failed\n");
         goto fail;
     }
 
-    if (!basic_table_tests(h, silly_key, BASIC_ELEM_COUNT)) {
+    if (!basic_table_tests(h, silly_key, BASIC_ELEM_COUNT, 0)) {
         msg_err("Silly key table test failed\n");
         goto fail;
     }
 
-    if (!basic_table_tests(h, less_silly_key, BASIC_ELEM_COUNT)) {
+    if (!basic_table_tests(h, less_silly_key, BASIC_ELEM_COUNT, 0)) {
         msg_err("Less silly key table test failed\n");
         goto fail;
     }
 
+    if (!basic_table_tests(h, identity_key, BASIC_ELEM_COUNT, BASIC_ELEM_COUNT)) {
+        msg_err("Presized table test failed\n");
+        goto fail;
+    }
+
     if (!one_elem_table_tests(h, BASIC_ELEM_COUNT)) {
         msg_err("One-element table test failed\n");
         goto fail;
     }
 
-    if (!basic_table_tests(h, identity_key, STRESS_ELEM_COUNT)) {
+    if (!basic_table_tests(h, identity_key, STRESS_ELEM_COUNT, 0)) {
         msg_err("Stress table test failed\n");
         goto fail;
     }
+
+    if (!basic_otable_tests(h, identity_key, BASIC_ELEM_COUNT, 0) ||
+        !basic_otable_tests(h, less_silly_key, BASIC_ELEM_COUNT, 0) ||
+        !basic_otable_tests(h, identity_key, BASIC_ELEM_COUNT, BASIC_ELEM_COUNT) ||
+        !basic_otable_tests(h, identity_key, STRESS_ELEM_COUNT, 0)) {
+        msg_err("Open-addressing table test failed\n");
+        goto fail;
+    }
+
     exit(EXIT_SUCCESS);
 fail:
     exit(EXIT_FAILURE);
@@ -0,0 +1,188 @@
+//#define ENABLE_MSG_DEBUG
+#include <runtime.h>
+#include <stdlib.h>
+#define EXIT_FAILURE 1
+#define EXIT_SUCCESS 0
+
+#define TIMER_TEST_COUNT    4096
+
+struct test_timer {
+    timer t;
+    timestamp expiry;
+    u64 fired;
+    boolean removed;
+    boolean periodic;
+};
+
+static timestamp test_here;
+static boolean test_late;
+
+closure_function(1, 1, void, test_timer_handler,
+                 struct test_timer *, tt,
+                 u64, overruns)
+{
+    struct test_timer *tt = bound(tt);
+    if (test_here < tt->expiry) {
+        msg_err("timer fired early: expiry %T, now %T\n", tt->expiry, test_here);
+        test_late = true;
+    }
+    tt->fired += overruns;
+}
+
+/* service the heap in steps, checking that no timer fires more than one
+   wheel tick (plus the step) late */
+static boolean service_until(timerheap th, struct test_timer *tts, int n, timestamp end,
+                             timestamp step)
+{
+    while (test_here < end) {
+        test_here += step;
+        timer_service(th, test_here);
+        for (int i = 0; i < n; i++) {
+            struct test_timer *tt = &tts[i];
+            if (tt->removed || tt->fired || tt->periodic)
+                continue;
+            if (test_here >= tt->expiry + TIMER_WHEEL_TICK + step) {
+                msg_err("timer %d not fired: expiry %T, now %T\n", i, tt->expiry, test_here);
+                return false;
+            }
+        }
+    }
+    return !test_late;
+}
+
+static boolean wheel_test(heap h)
+{
+    timerheap th = allocate_timerheap(h, "test");
+    struct test_timer *tts = allocate(h, sizeof(struct test_timer) * TIMER_TEST_COUNT);
+    test_here = now(CLOCK_ID_MONOTONIC_RAW);
+    timestamp base = test_here;
+
+    /* a mix of wheel and pqueue timers over the first two minutes */
+    for (int i = 0; i < TIMER_TEST_COUNT; i++) {
+        struct test_timer *tt = &tts[i];
+        tt->expiry = base + (random_u64() % seconds(120));
+        tt->fired = 0;
+        tt->removed = false;
+        tt->periodic = false;
+        tt->t = register_timer_slack(th, CLOCK_ID_MONOTONIC_RAW, tt->expiry, true, 0,
+                                     (i & 1) ? milliseconds(10) : 0,
+                                     closure(h, test_timer_handler, tt));
+        if (tt->t == INVALID_ADDRESS) {
+            msg_err("failed to register timer\n");
+            return false;
+        }
+    }
+    if (!th->wheel) {
+        msg_err("no wheel allocated\n");
+        return false;
+    }
+
+    /* cancel every third timer before it fires */
+    for (int i = 0; i < TIMER_TEST_COUNT; i += 3) {
+        remove_timer(tts[i].t, 0);
+        tts[i].removed = true;
+    }
+
+    if (!service_until(th, tts, TIMER_TEST_COUNT, base + seconds(121), milliseconds(7)))
+        return false;
+    for (int i = 0; i < TIMER_TEST_COUNT; i++) {
+        struct test_timer *tt = &tts[i];
+        if (tt->fired != (tt->removed ? 0 : 1)) {
+            msg_err("timer %d fired %ld times, removed %d\n", i, tt->fired, tt->removed);
+            return false;
+        }
+    }
+    if (th->wheel->count != 0) {
+        msg_err("wheel not empty: %ld timers\n", th->wheel->count);
+        return false;
+    }
+
+    /* a periodic timer in the wheel and one beyond its horizon */
+    struct test_timer *periodic = &tts[0];
+    periodic->expiry = test_here + milliseconds(100);
+    periodic->fired = 0;
+    periodic->removed = false;
+    periodic->periodic = true;
+    periodic->t = register_timer_slack(th, CLOCK_ID_MONOTONIC_RAW, periodic->expiry, true,
+                                       milliseconds(100), milliseconds(5),
+                                       closure(h, test_timer_handler, periodic));
+    struct test_timer *far = &tts[1];
+    far->expiry = test_here + seconds(30 * 24 * 3600);
+    far->fired = 0;
+    far->removed = false;
+    far->periodic = false;
+    far->t = register_timer_slack(th, CLOCK_ID_MONOTONIC_RAW, far->expiry, true, 0,
+                                  seconds(1), closure(h, test_timer_handler, far));
+    if (far->t->th) {
+        msg_err("timer beyond the horizon placed in wheel\n");
+        return false;
+    }
+    timestamp start = test_here;
+    if (!service_until(th, tts, 2, start + seconds(10), milliseconds(3)))
+        return false;
+    if (periodic->fired < 99 || periodic->fired > 100) {
+        msg_err("periodic timer fired %ld times\n", periodic->fired);
+        return false;
+    }
+    remove_timer(periodic->t, 0);
+    remove_timer(far->t, 0);
+    timer_service(th, test_here + seconds(1));
+    if (th->wheel->count != 0 || timer_wheel_next(th) != infinity) {
+        msg_err("timers left after removal\n");
+        return false;
+    }
+    return true;
+}
+
+/* a timer with slack is serviced along with an exact one due within its
+   slack window, on a single platform timer expiry */
+static boolean slack_test(heap h)
+{
+    timerheap th = allocate_timerheap(h, "slack");
+    struct test_timer tts[2];
+    test_here = now(CLOCK_ID_MONOTONIC_RAW);
+    timestamp base = test_here;
+    timestamp slack[2] = { microseconds(500), 0 };
+    for (int i = 0; i < 2; i++) {
+        struct test_timer *tt = &tts[i];
+        tt->expiry = base + microseconds(100 + i * 200);
+        tt->fired = 0;
+        tt->removed = false;
+        tt->periodic = false;
+        tt->t = register_timer_slack(th, CLOCK_ID_MONOTONIC_RAW, tt->expiry, true, 0, slack[i],
+                                     closure(h, test_timer_handler, tt));
+    }
+    if (th->wheel) {
+        msg_err("fine timers placed in wheel\n");
+        return false;
+    }
+    timestamp next = timer_check(th);
+    if (next != tts[1].expiry) {
+        msg_err("timer_check %T, expected %T\n", next, tts[1].expiry);
+        return false;
+    }
+    test_here = next;
+    timer_service(th, test_here);
+    if (tts[0].fired != 1 || tts[1].fired != 1 || test_late) {
+        msg_err("timers not coalesced: fired %ld, %ld\n", tts[0].fired, tts[1].fired);
+        return false;
+    }
+    return timer_check(th) == infinity;
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!wheel_test(h))
+        goto fail;
+
+    if (!slack_test(h))
+        goto fail;
+
+    msg_debug("timer test passed\n");
+    exit(EXIT_SUCCESS);
+  fail:
+    msg_err("timer test failed\n");
+    exit(EXIT_FAILURE);
+}
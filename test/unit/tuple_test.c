@@ -180,6 +180,61 @@ fail:
     return failure;
 }
 
+boolean encode_decode_shallow_test(heap h)
+{
+    boolean failure = true;
+
+    // a two-level tree, encoded one tuple at a time
+    tuple t3 = allocate_tuple();
+    tuple c1 = allocate_tuple();
+    tuple c2 = allocate_tuple();
+    set(t3, sym(c1), c1);
+    set(t3, sym(v), wrap_buffer_cstring(h, "100"));
+    set(c1, sym(c2), c2);
+    set(c1, sym(v), wrap_buffer_cstring(h, "200"));
+    set(c2, sym(v), wrap_buffer_cstring(h, "300"));
+
+    buffer b3 = allocate_buffer(h, 128);
+    table tdict1 = allocate_table(h, identity_key, pointer_equal);
+    vector pending = allocate_vector(h, 4);
+    u64 total_entries = 0;
+    int records = 0;
+    vector_push(pending, t3);
+    tuple t;
+    while ((t = vector_pop(pending))) {
+        encode_tuple_shallow(b3, tdict1, t, pending, &total_entries);
+        records++;
+    }
+    test_assert(records == 3);
+    test_assert(total_entries == 5);
+
+    // decode
+    total_entries = 0;
+    u64 obsolete_entries = 0;
+    table tdict2 = allocate_table(h, identity_key, pointer_equal);
+    tuple t4 = decode_value(h, tdict2, b3, &total_entries, &obsolete_entries);
+    for (int i = 1; i < records; i++)
+        test_assert(decode_value(h, tdict2, b3, &total_entries, &obsolete_entries));
+    test_assert(buffer_length(b3) == 0);
+    test_assert(total_entries == 5);
+
+    value v;
+    tuple d1 = get(t4, sym(c1));
+    test_assert(d1 && is_tuple(d1));
+    test_assert((v = get(t4, sym(v))) && buffer_compare_with_cstring(v, "100"));
+    tuple d2 = get(d1, sym(c2));
+    test_assert(d2 && is_tuple(d2));
+    test_assert((v = get(d1, sym(v))) && buffer_compare_with_cstring(v, "200"));
+    test_assert((v = get(d2, sym(v))) && buffer_compare_with_cstring(v, "300"));
+    test_assert(tuple_count(d2) == 1);
+
+    destruct_tuple(t4, true);
+    failure = false;
+fail:
+    destruct_tuple(t3, true);
+    return failure;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -190,6 +245,7 @@ int main(int argc, char **argv)
     failure |= encode_decode_test(h);
     failure |= encode_decode_reference_test(h);
     failure |= encode_decode_lengthy_test(h);
+    failure |= encode_decode_shallow_test(h);
 
     if (failure) {
         msg_err("Test failed\n");
@@ -12,8 +12,10 @@
 #include <string.h>
 #include <limits.h>
 #include <log.h>
+#include <pthread.h>
 
 #define DUMP_OPT_TREE  (1U << 0)
+#define DUMP_OPT_LIST  (1U << 1)
 
 #define TERM_COLOR_BLUE     94
 #define TERM_COLOR_CYAN     96
@@ -37,27 +39,192 @@ closure_function(2, 3, void, bread,
     apply(c, STATUS_OK);
 }
 
-closure_function(1, 1, status, write_file,
-                 buffer, path,
-                 buffer, b)
+/* Files are extracted by a pool of threads, each writing whole files from
+   their extents, read straight from the image in large pieces; the
+   threads touch no runtime state besides the decompressor. */
+#define DUMP_THREADS_MAX    16
+#define DUMP_READ_SIZE      (8 * MB)
+
+typedef struct dump_extent {
+    u64 offset;                 /* in the file, bytes */
+    u64 length;
+    u64 start;                  /* in the image, bytes */
+    u64 compressed;             /* compressed length, or 0 */
+} *dump_extent;
+
+typedef struct dump_file {
+    char *path;
+    u64 length;
+    u64 nextents;
+    struct dump_extent *extents;
+} *dump_file;
+
+static struct {
+    int fd;
+    u64 fs_offset;
+    vector files;
+    u64 next;
+    pthread_mutex_t lock;
+} dump = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void dump_fail(const char *what, const char *path)
 {
-    // openat would be nicer really
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    char *z = cstring(bound(path), tmpbuf);
-    int fd = open(z, O_CREAT|O_WRONLY, 0644);
-    ssize_t xfer, len = buffer_length(b);
-    while (len > 0) {
-        xfer = write(fd, buffer_ref(b, 0), len);
-        if (xfer < 0 && errno != EINTR) {
-            perror("file write");
-            close(fd);
-            exit(EXIT_FAILURE);
+    fprintf(stderr, "%s: %s: %s\n", what, path, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static void dump_read(void *dest, u64 length, u64 offset, const char *path)
+{
+    u64 total = 0;
+    while (total < length) {
+        ssize_t xfer = pread(dump.fd, dest + total, length - total, offset + total);
+        if (xfer < 0 && errno == EINTR)
+            continue;
+        if (xfer <= 0) {
+            if (xfer == 0)
+                errno = EIO;
+            dump_fail("image read", path);
+        }
+        total += xfer;
+    }
+}
+
+static void dump_write(int fd, void *src, u64 length, u64 offset, const char *path)
+{
+    u64 total = 0;
+    while (total < length) {
+        ssize_t xfer = pwrite(fd, src + total, length - total, offset + total);
+        if (xfer < 0 && errno == EINTR)
+            continue;
+        if (xfer < 0)
+            dump_fail("file write", path);
+        total += xfer;
+    }
+}
+
+/* Extents past the file length are cut short, and the gaps between them
+   are left as holes. */
+static void dump_extract_file(dump_file df, void *buf)
+{
+    int fd = open(df->path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0)
+        dump_fail("open", df->path);
+    if (ftruncate(fd, df->length) < 0)
+        dump_fail("truncate", df->path);
+    for (u64 i = 0; i < df->nextents; i++) {
+        dump_extent de = &df->extents[i];
+        if (de->offset >= df->length)
+            continue;
+        u64 length = MIN(de->length, df->length - de->offset);
+        if (de->compressed) {
+            void *data = malloc(de->compressed + de->length);
+            if (!data)
+                dump_fail("allocate", df->path);
+            void *out = data + de->compressed;
+            dump_read(data, de->compressed, de->start, df->path);
+            s64 n = lz4_decompress(data, de->compressed, out, de->length);
+            if (n < 0) {
+                fprintf(stderr, "corrupt compressed extent in %s\n", df->path);
+                exit(EXIT_FAILURE);
+            }
+            zero(out + n, de->length - n);
+            dump_write(fd, out, length, de->offset, df->path);
+            free(data);
+            continue;
+        }
+        for (u64 off = 0; off < length; off += DUMP_READ_SIZE) {
+            u64 n = MIN(DUMP_READ_SIZE, length - off);
+            dump_read(buf, n, de->start + off, df->path);
+            dump_write(fd, buf, n, de->offset + off, df->path);
         }
-        len -= xfer;
-        buffer_consume(b, xfer);
     }
     close(fd);
-    return STATUS_OK;
+}
+
+static void *dump_extract(void *arg)
+{
+    void *buf = malloc(DUMP_READ_SIZE);
+    if (!buf)
+        dump_fail("allocate", "read buffer");
+    while (1) {
+        pthread_mutex_lock(&dump.lock);
+        u64 i = dump.next++;
+        pthread_mutex_unlock(&dump.lock);
+        if (i >= vector_length(dump.files))
+            break;
+        dump_extract_file(vector_get(dump.files, i), buf);
+    }
+    free(buf);
+    return 0;
+}
+
+static void dump_extract_files(void)
+{
+    pthread_t threads[DUMP_THREADS_MAX];
+    long nthreads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), DUMP_THREADS_MAX);
+    nthreads = MIN(nthreads, MAX(vector_length(dump.files), 1));
+    dump.next = 0;
+    for (long t = 0; t < nthreads; t++)
+        if (pthread_create(&threads[t], 0, dump_extract, 0)) {
+            fprintf(stderr, "couldn't create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    for (long t = 0; t < nthreads; t++)
+        pthread_join(threads[t], 0);
+}
+
+closure_function(2, 2, boolean, add_file_extent,
+                 u64, blocksize_order, dump_file, df,
+                 value, k, value, v)
+{
+    dump_file df = bound(df);
+    u64 file_block, length, start_block;
+    if (!is_symbol(k) || !is_tuple(v) ||
+        !parse_int(alloca_wrap(symbol_string(k)), 10, &file_block) ||
+        !get_u64(v, sym(length), &length) || !get_u64(v, sym(offset), &start_block)) {
+        fprintf(stderr, "invalid extent in %s\n", df->path);
+        exit(EXIT_FAILURE);
+    }
+    if (get(v, sym(uninited)))
+        return true;
+    dump_extent de = &df->extents[df->nextents++];
+    u64 order = bound(blocksize_order);
+    de->offset = file_block << order;
+    de->length = length << order;
+    de->start = dump.fs_offset + (start_block << order);
+    de->compressed = 0;
+    get_u64(v, sym(compressed), &de->compressed);
+    return true;
+}
+
+closure_function(1, 2, boolean, count_each,
+                 u64 *, count,
+                 value, k, value, v)
+{
+    (*bound(count))++;
+    return true;
+}
+
+static void add_file(filesystem fs, heap h, tuple w, buffer path)
+{
+    dump_file df = allocate(h, sizeof(struct dump_file));
+    assert(df != INVALID_ADDRESS);
+    df->path = strndup(buffer_ref(path, 0), buffer_length(path));
+    assert(df->path);
+    df->length = 0;
+    get_u64(w, sym(filelength), &df->length);
+    df->nextents = 0;
+    u64 count = 0;
+    tuple extents = get_tuple(w, sym(extents));
+    if (extents)
+        iterate(extents, stack_closure(count_each, &count));
+    df->extents = allocate(h, MAX(count, 1) * sizeof(struct dump_extent));
+    assert(df->extents != INVALID_ADDRESS);
+    if (extents)
+        iterate(extents, stack_closure(add_file_extent, find_order(fs_blocksize(fs)), df));
+    vector_push(dump.files, df);
 }
 
 void readdir(filesystem fs, heap h, tuple w, buffer path);
@@ -74,19 +241,91 @@ closure_function(3, 2, boolean, readdir_each_child,
     return true;
 }
 
-// h just for extending path
-// isn't there an internal readdir?
+/* Directories are made right away; files are queued for extraction. */
 void readdir(filesystem fs, heap h, tuple w, buffer path)
 {
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
+    buffer tmpbuf = little_stack_buffer(PATH_MAX);
     tuple t = get_tuple(w, sym(children));
     if (t) {
         mkdir(cstring(path, tmpbuf), 0777);
         iterate(t, stack_closure(readdir_each_child, fs, h, path));
+    } else if (get_tuple(w, sym(extents))) {
+        add_file(fs, h, w, path);
+    }
+}
+
+static void list_entry(tuple t, buffer path);
+
+closure_function(1, 2, boolean, list_each_child,
+                 buffer, path,
+                 value, k, value, v)
+{
+    assert(is_symbol(k));
+    if (k == sym_this(".") || k == sym_this(".."))
+        return true;
+    assert(is_tuple(v));
+    buffer path = bound(path);
+    bytes len = buffer_length(path);
+    if (len != 1)
+        push_u8(path, '/');
+    push_buffer(path, symbol_string(k));
+    list_entry(v, path);
+    path->end = path->start + len;
+    return true;
+}
+
+/* Only metadata is used, so no file data is read. */
+static void list_entry(tuple t, buffer path)
+{
+    buffer tmpbuf = little_stack_buffer(PATH_MAX);
+    tuple c = children(t);
+    buffer target = get(t, sym(linktarget));
+    u64 length = 0;
+    if (c) {
+        printf("d %12s %s\n", "-", cstring(path, tmpbuf));
+        iterate(c, stack_closure(list_each_child, path));
+    } else if (target) {
+        printf("l %12s %s", "-", cstring(path, tmpbuf));
+        printf(" -> %s\n", cstring(target, tmpbuf));
     } else {
-        t = get_tuple(w, sym(extents));
-        if (t)
-            filesystem_read_entire(fs, w, h, closure(h, write_file, path), (void *)ignore);
+        get_u64(t, sym(filelength), &length);
+        printf("- %12llu %s\n", length, cstring(path, tmpbuf));
+    }
+}
+
+/* Look up a path in the image, without following symlinks. */
+static tuple lookup_path(tuple root, const char *path)
+{
+    tuple t = root;
+    while (*path) {
+        const char *end = strchr(path, '/');
+        int len = end ? end - path : strlen(path);
+        if (len > 0 && !(len == 1 && path[0] == '.')) {
+            tuple c = children(t);
+            if (!c)
+                return 0;
+            t = get_tuple(c, intern(alloca_wrap_buffer(path, len)));
+            if (!t)
+                return 0;
+        }
+        path += len;
+        if (*path)
+            path++;
+    }
+    return t;
+}
+
+/* Make the directories leading to a path. */
+static void make_parents(buffer path)
+{
+    buffer tmpbuf = little_stack_buffer(PATH_MAX);
+    char *z = cstring(path, tmpbuf);
+    for (char *p = z + 1; *p; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        mkdir(z, 0777);
+        *p = '/';
     }
 }
 
@@ -128,8 +367,8 @@ static void dump_fsentry(int indent, symbol name, tuple t)
         print_colored(indent, TERM_COLOR_WHITE, name, true);
 }
 
-closure_function(3, 2, void, fsc,
-                 heap, h, buffer, b, unsigned int, options,
+closure_function(5, 2, void, fsc,
+                 heap, h, buffer, b, unsigned int, options, char **, paths, int, npaths,
                  filesystem, fs, status, s)
 {
     heap h = bound(h);
@@ -139,26 +378,49 @@ closure_function(3, 2, void, fsc,
         exit(EXIT_FAILURE);
     }
 
-    u8 uuid[UUID_LEN];
-    filesystem_get_uuid(fs, uuid);
+    unsigned int options = bound(options);
+    int npaths = bound(npaths);
     tuple root = filesystem_getroot(fs);
-    buffer rb = allocate_buffer(h, PAGESIZE);
-    bprintf(rb, "Label: %s\n", filesystem_get_label(fs));
-    bprintf(rb, "UUID: ");
-    print_uuid(rb, uuid);
-    bprintf(rb, "\nmetadata\n");
-    print_value(rb, root, timm("indent", "0"));
-    buffer_print(rb);
-    rprintf("\n");
-    deallocate_buffer(rb);
+    if (!npaths && !(options & DUMP_OPT_LIST)) {
+        u8 uuid[UUID_LEN];
+        filesystem_get_uuid(fs, uuid);
+        buffer rb = allocate_buffer(h, PAGESIZE);
+        bprintf(rb, "Label: %s\n", filesystem_get_label(fs));
+        bprintf(rb, "UUID: ");
+        print_uuid(rb, uuid);
+        bprintf(rb, "\nmetadata\n");
+        print_value(rb, root, timm("indent", "0"));
+        buffer_print(rb);
+        rprintf("\n");
+        deallocate_buffer(rb);
+    }
 
     buffer b = bound(b);
+    dump.files = allocate_vector(h, 64);
+    for (int i = 0; i < MAX(npaths, 1); i++) {
+        const char *path = npaths ? bound(paths)[i] : "/";
+        tuple t = lookup_path(root, path);
+        if (!t) {
+            fprintf(stderr, "%s: not found in filesystem\n", path);
+            exit(EXIT_FAILURE);
+        }
+        while (*path == '/')
+            path++;
+        if (b) {
+            buffer out = b;
+            if (*path) {
+                out = aprintf(h, "%b/%s", b, path);
+                make_parents(out);
+            }
+            readdir(fs, h, t, out);
+        }
+        if (options & DUMP_OPT_LIST)
+            list_entry(t, aprintf(h, "/%s", path));
+        if (options & DUMP_OPT_TREE)
+            dump_fsentry(0, sym_this(*path ? path : "/"), t);
+    }
     if (b)
-        readdir(fs, h, root, b);
-
-    unsigned int options = bound(options);
-    if (options & DUMP_OPT_TREE)
-        dump_fsentry(0, sym_this("/"), root);
+        dump_extract_files();
 
     closure_finish();
 }
@@ -229,12 +491,16 @@ static void usage(const char *prog)
 {
     const char *p = strrchr(prog, '/');
     p = p != NULL ? p + 1 : prog;
-    fprintf(stderr, "Usage: %s [OPTION]... <fs image>\n", p);
+    fprintf(stderr, "Usage: %s [OPTION]... <fs image> [path]...\n", p);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -d <target dir>\tCopy filesystem contents from "
             "<fs image> into <target dir>\n");
+    fprintf(stderr, "  -L\t\t\tList files with their type and size, without "
+            "reading file data\n");
     fprintf(stderr, "  -t\t\t\tDisplay filesystem from <fs image> as a tree\n");
     fprintf(stderr, "  -l\t\t\tDisplay contents of crash log\n");
+    fprintf(stderr, "Given paths in the filesystem, only these are copied, listed "
+            "or displayed.\n");
     exit(EXIT_FAILURE);
 }
 
@@ -245,7 +511,7 @@ int main(int argc, char **argv)
     unsigned int options = 0;
     boolean print_klog = false;
 
-    while ((c = getopt(argc, argv, "d:tl")) != EOF) {
+    while ((c = getopt(argc, argv, "d:tlL")) != EOF) {
         switch (c) {
         case 'd':
             target_dir = alloca_wrap_buffer(optarg, runtime_strlen(optarg));
@@ -256,6 +522,9 @@ int main(int argc, char **argv)
         case 'l':
             print_klog = true;
             break;
+        case 'L':
+            options |= DUMP_OPT_LIST;
+            break;
         default:
             usage(argv[0]);
         }
@@ -274,12 +543,15 @@ int main(int argc, char **argv)
 
     heap h = init_process_runtime();
     init_pagecache(h, h, 0, PAGESIZE);
+    dump.fd = fd;
+    dump.fs_offset = get_fs_offset(fd, PARTITION_ROOTFS, false);
     create_filesystem(h,
                       SECTOR_SIZE,
                       infinity,
-                      closure(h, bread, fd, get_fs_offset(fd, PARTITION_ROOTFS, false)),
+                      closure(h, bread, fd, dump.fs_offset),
                       0, /* no write */
                       false,
-                      closure(h, fsc, h, target_dir, options));
+                      closure(h, fsc, h, target_dir, options, argv + optind + 1,
+                              argc - optind - 1));
     return EXIT_SUCCESS;
 }
@@ -11,6 +11,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <region.h>
 #include <storage.h>
@@ -198,36 +199,122 @@ buffer lookup_file(heap h, const char *target_root, buffer name, struct stat *st
     return target_name;
 }
 
-// its nice that we can append a file to any existing buffer, but harsh we have to grow the buffer
-void read_file(heap h, const char *target_root, buffer dest, buffer name)
+/* File contents are read and hashed by a pool of reader threads, ahead of
+   the main thread, which writes them to the image in worklist order. The
+   readers touch no runtime state besides the hash, as the runtime is not
+   thread-safe. */
+#define MKFS_READERS_MAX    16
+#define MKFS_READAHEAD_SIZE (256 * MB)  /* read but not yet written */
+#define MKFS_HASH_SIZE      32
+
+typedef struct mkfs_file {
+    tuple f;
+    char *path;                 /* on the host, resolved through the target root */
+    u64 length;
+    void *data;
+    u8 hash[MKFS_HASH_SIZE];
+    boolean ready;
+    fsfile fsf;                 /* once written */
+} *mkfs_file;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    mkfs_file files;
+    u64 count;
+    u64 next_read;
+    u64 next_write;
+    u64 pending;                /* bytes read ahead of the writer */
+} readers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void mkfs_read_file(mkfs_file mf)
 {
-    // mode bit metadata
-    struct stat st;
-    buffer target_name = lookup_file(h, target_root, name, &st);
-    if (target_name != NULL) {
-        //printf("%s -> %s\n", cstring(name), cstring(target_name));
-        name = target_name;
+    if (mf->length == 0)
+        return;
+    int fd = open(mf->path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "couldn't open file %s: %s\n", mf->path, strerror(errno));
+        exit(1);
+    }
+    mf->data = malloc(mf->length);
+    if (!mf->data) {
+        fprintf(stderr, "couldn't allocate memory for file %s\n", mf->path);
+        exit(1);
     }
-
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    int fd = open(cstring(name, tmpbuf), O_RDONLY);
-    if (fd < 0) halt("couldn't open file %b: %s\n", name, strerror(errno));
-    u64 size = st.st_size;
-    buffer_extend(dest, pad(st.st_size, SECTOR_SIZE));
     u64 total = 0;
-    while (total < size) {
-        int rv = read(fd, buffer_ref(dest, total), size - total);
-        if (rv < 0 && errno != EINTR) {
-            close(fd);
-            halt("read: %b: %s\n", name, strerror(errno));
+    while (total < mf->length) {
+        ssize_t rv = pread(fd, mf->data + total, mf->length - total, total);
+        if (rv < 0 && errno == EINTR)
+            continue;
+        if (rv <= 0) {
+            fprintf(stderr, "read: %s: %s\n", mf->path, rv < 0 ? strerror(errno) : "short read");
+            exit(1);
         }
         total += rv;
     }
-    dest->end += size;
     close(fd);
+    buffer hash = little_stack_buffer(MKFS_HASH_SIZE);
+    sha256(hash, alloca_wrap_buffer(mf->data, mf->length));
+    runtime_memcpy(mf->hash, buffer_ref(hash, 0), MKFS_HASH_SIZE);
+}
+
+/* Files are taken in order, and past the read-ahead limit only when all
+   that was read has been written. */
+static void *mkfs_reader(void *arg)
+{
+    pthread_mutex_lock(&readers.lock);
+    while (readers.next_read < readers.count) {
+        mkfs_file mf = &readers.files[readers.next_read];
+        if (readers.pending > 0 && readers.pending + mf->length > MKFS_READAHEAD_SIZE) {
+            pthread_cond_wait(&readers.cond, &readers.lock);
+            continue;
+        }
+        readers.next_read++;
+        readers.pending += mf->length;
+        pthread_mutex_unlock(&readers.lock);
+        mkfs_read_file(mf);
+        pthread_mutex_lock(&readers.lock);
+        mf->ready = true;
+        pthread_cond_broadcast(&readers.cond);
+    }
+    pthread_mutex_unlock(&readers.lock);
+    return 0;
+}
 
-    if (target_name != NULL)
-        deallocate_buffer(target_name);
+static mkfs_file mkfs_next_file(void)
+{
+    pthread_mutex_lock(&readers.lock);
+    mkfs_file mf = &readers.files[readers.next_write];
+    while (!mf->ready)
+        pthread_cond_wait(&readers.cond, &readers.lock);
+    pthread_mutex_unlock(&readers.lock);
+    return mf;
+}
+
+static void mkfs_release_file(mkfs_file mf)
+{
+    free(mf->data);
+    mf->data = 0;
+    pthread_mutex_lock(&readers.lock);
+    readers.next_write++;
+    readers.pending -= mf->length;
+    pthread_cond_broadcast(&readers.cond);
+    pthread_mutex_unlock(&readers.lock);
+}
+
+/* files with the same contents are equal keys */
+static key mkfs_file_key(void *x)
+{
+    return *(key *)((mkfs_file)x)->hash;
+}
+
+static boolean mkfs_file_equal(void *x, void *y)
+{
+    mkfs_file a = x, b = y;
+    return a->length == b->length && !memcmp(a->hash, b->hash, MKFS_HASH_SIZE);
 }
 
 heap malloc_allocator();
@@ -270,19 +357,6 @@ closure_function(0, 1, void, err,
     rprintf("reported error\n");
 }
 
-static buffer get_file_contents(heap h, const char *target_root, value v)
-{
-    value path = table_find((table)v, sym(host));
-    if (path) {
-        // seems like it wouldn't be to hard to arrange
-        // for this to avoid the staging copy
-        buffer dest = allocate_buffer(h, 1024);
-        read_file(h, target_root, dest, path);
-        return dest;
-    }
-    return 0;
-}
-
 static value translate(heap h, vector worklist,
                        const char *target_root, filesystem fs, value v, status_handler sh);
 
@@ -325,8 +399,91 @@ closure_function(0, 2, void, mkfs_write_handler,
     }
 }
 
-closure_function(4, 2, void, fsc,
-                 heap, h, descriptor, out, tuple, root, const char *, target_root,
+closure_function(0, 1, void, mkfs_compress_status,
+                 status, s)
+{
+    if (!is_ok(s)) {
+        rprintf("compressed write failed with %v\n", s);
+        exit(1);
+    }
+}
+
+closure_function(0, 1, void, mkfs_seal_status,
+                 status, s)
+{
+    if (!is_ok(s)) {
+        rprintf("sealing filesystem failed with %v\n", s);
+        exit(1);
+    }
+}
+
+closure_function(0, 1, void, mkfs_sync_status,
+                 status, s)
+{
+    if (!is_ok(s)) {
+        rprintf("writing file contents failed with %v\n", s);
+        exit(1);
+    }
+}
+
+closure_function(0, 2, void, mkfs_clone_status,
+                 fsfile, f, fs_status, fss)
+{
+    if (fss != FS_STATUS_OK) {
+        rprintf("cloning file contents failed with status %d\n", fss);
+        exit(1);
+    }
+}
+
+/* order of file contents in a sealed image, by host path */
+static int worklist_compare(const void *a, const void *b)
+{
+    buffer pa = get(vector_get(*(vector *)a, 1), sym(host));
+    buffer pb = get(vector_get(*(vector *)b, 1), sym(host));
+    if (!pa || !pb)
+        return !pa - !pb;
+    int len = MIN(buffer_length(pa), buffer_length(pb));
+    int r = memcmp(buffer_ref(pa, 0), buffer_ref(pb, 0), len);
+    return r ? r : (int)buffer_length(pa) - (int)buffer_length(pb);
+}
+
+/* Resolve the host files of the worklist, in order, for the readers. */
+static void mkfs_start_readers(heap h, const char *target_root, vector worklist)
+{
+    readers.files = calloc(vector_length(worklist) + 1, sizeof(struct mkfs_file));
+    assert(readers.files);
+    readers.count = readers.next_read = readers.next_write = readers.pending = 0;
+    vector i;
+    vector_foreach(worklist, i) {
+        buffer name = get(vector_get(i, 1), sym(host));
+        if (!name)
+            continue;
+        struct stat st;
+        buffer target_name = lookup_file(h, target_root, name, &st);
+        if (target_name)
+            name = target_name;
+        mkfs_file mf = &readers.files[readers.count++];
+        mf->f = vector_get(i, 0);
+        mf->path = strndup(buffer_ref(name, 0), buffer_length(name));
+        assert(mf->path);
+        mf->length = st.st_size;
+        if (target_name)
+            deallocate_buffer(target_name);
+    }
+}
+
+static void mkfs_stop_readers(void)
+{
+    for (u64 n = 0; n < readers.count; n++)
+        free(readers.files[n].path);
+    free(readers.files);
+    readers.files = 0;
+    readers.count = 0;
+}
+
+closure_function(6, 2, void, fsc,
+                 heap, h, descriptor, out, tuple, root, const char *, target_root, boolean, compress,
+                 boolean, seal,
                  filesystem, fs, status, s)
 {
     tuple root = bound(root);
@@ -349,27 +506,55 @@ closure_function(4, 2, void, fsc,
     rprintf("\n");
 
     filesystem_write_tuple(fs, md);
-    vector i;
+    if (bound(seal))
+        qsort(buffer_ref(worklist, 0), vector_length(worklist), sizeof(void *),
+              worklist_compare);
+    mkfs_start_readers(h, bound(target_root), worklist);
+    pthread_t threads[MKFS_READERS_MAX];
+    long nthreads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), MKFS_READERS_MAX);
+    for (long t = 0; t < nthreads; t++)
+        if (pthread_create(&threads[t], 0, mkfs_reader, 0))
+            halt("couldn't create reader thread: %s\n", strerror(errno));
+
+    /* Each file is written back right after its contents, so that the
+       storage of files is laid out in worklist order. Contents already
+       written are cloned instead; compressed extents cannot be shared. */
+    table written = allocate_table(h, mkfs_file_key, mkfs_file_equal);
+    status_handler sync_sh = closure(h, mkfs_sync_status);
+    fs_status_handler clone_sh = closure(h, mkfs_clone_status);
     buffer off = 0;
-    vector_foreach(worklist, i) {
-        tuple f = vector_get(i, 0);
-        buffer contents = get_file_contents(h, bound(target_root), vector_get(i, 1));
-        if (contents) {
-            if (buffer_length(contents) > 0) {
-                fsfile fsf = allocate_fsfile(fs, f);
-                filesystem_write_linear(fsf, buffer_ref(contents, 0), irangel(0, buffer_length(contents)),
-                                        ignore_io_status);
-                deallocate_buffer(contents);
+    while (readers.next_write < readers.count) {
+        mkfs_file mf = mkfs_next_file();
+        if (mf->length > 0) {
+            mf->fsf = allocate_fsfile(fs, mf->f);
+            mkfs_file dup = bound(compress) ? 0 : table_find(written, mf);
+            if (dup) {
+                filesystem_clone_range(dup->fsf, 0, mf->fsf, 0, mf->length, clone_sh);
+            } else if (bound(compress)) {
+                filesystem_write_compressed(mf->fsf, mf->data, mf->length,
+                                            closure(h, mkfs_compress_status));
             } else {
-                if (!off)
-                    off = wrap_buffer_cstring(h, "0");
-                /* make an empty file */
-                filesystem_write_eav(fs, f, sym(extents), allocate_tuple());
-                filesystem_write_eav(fs, f, sym(filelength), off);
+                filesystem_write_linear(mf->fsf, mf->data, irangel(0, mf->length),
+                                        ignore_io_status);
+                pagecache_sync_node(fsfile_get_cachenode(mf->fsf), sync_sh);
+                table_set(written, mf, mf);
             }
+        } else {
+            if (!off)
+                off = wrap_buffer_cstring(h, "0");
+            /* make an empty file */
+            filesystem_write_eav(fs, mf->f, sym(extents), allocate_tuple());
+            filesystem_write_eav(fs, mf->f, sym(filelength), off);
         }
+        mkfs_release_file(mf);
     }
+    for (long t = 0; t < nthreads; t++)
+        pthread_join(threads[t], 0);
+    deallocate_table(written);
+    mkfs_stop_readers();
     filesystem_flush(fs, ignore_status);
+    if (bound(seal))
+        filesystem_seal(fs, md, closure(h, mkfs_seal_status));
     closure_finish();
 }
 
@@ -523,7 +708,12 @@ static void usage(const char *program_name)
            "-s image-size	- specify minimum image file size; can be expressed"
            " in bytes, KB (with k or K suffix), MB (with m or M suffix), and GB"
            " (with g or G suffix)\n"
-           "-e              - create empty filesystem\n",
+           "-e              - create empty filesystem\n"
+           "-S              - seal the root filesystem: read-only, with file contents laid"
+           " out by path and metadata readable at once\n"
+           "-z              - store file contents LZ4 compressed in the root filesystem\n"
+           "-Z              - store the kernel LZ4 compressed in the boot filesystem; the"
+           " image then boots with the UEFI loader only\n",
            p, p);
 }
 
@@ -564,13 +754,25 @@ int main(int argc, char **argv)
     const char *target_root = NULL;
     long long img_size = 0;
     boolean empty_fs = false;
+    boolean compress = false;
+    boolean compress_boot = false;
+    boolean seal = false;
     const char *uefi_loader = NULL;
 
-    while ((c = getopt(argc, argv, "eb:k:l:r:s:u:")) != EOF) {
+    while ((c = getopt(argc, argv, "eb:k:l:r:s:Su:zZ")) != EOF) {
         switch (c) {
         case 'e':
             empty_fs = true;
             break;
+        case 'z':
+            compress = true;
+            break;
+        case 'Z':
+            compress_boot = true;
+            break;
+        case 'S':
+            seal = true;
+            break;
         case 'b':
             bootimg_path = optarg;
             break;
@@ -700,7 +902,7 @@ int main(int argc, char **argv)
         if (boot) {
             create_filesystem(h, SECTOR_SIZE, BOOTFS_SIZE, 0,
                               closure(h, bwrite, out, offset),
-                              "", closure(h, fsc, h, out, boot, target_root));
+                              "", closure(h, fsc, h, out, boot, target_root, compress_boot, false));
             offset += BOOTFS_SIZE;
 
             /* Remove tuple from root, so it doesn't end up in the root FS. */
@@ -716,7 +918,7 @@ int main(int argc, char **argv)
                       0, /* no read -> new fs */
                       closure(h, bwrite, out, offset),
                       label,
-                      closure(h, fsc, h, out, root, target_root));
+                      closure(h, fsc, h, out, root, target_root, compress, seal));
 
     off_t current_size = lseek(out, 0, SEEK_END);
     if (current_size < 0) {
@@ -128,6 +128,8 @@ int rv_from_fs_status(fs_status s)
         return -ENOTDIR;
     case FS_STATUS_LINKLOOP:
         return -ELOOP;
+    case FS_STATUS_READONLY:
+        return -EROFS;
     default:
         return 0;
     }
@@ -178,42 +180,262 @@ static inline tuple file_get_meta(file f)
     return f->f.type == FDESC_TYPE_REGULAR ? fsfile_get_meta(f->fsf) : f->meta;
 }
 
-closure_function(2, 3, void, bread,
-                 descriptor, d, u64, fs_offset,
-                 void *, dest, range, blocks, status_handler, c)
+/* Host-side cache of the image, in chunks of BCACHE_CHUNK_SIZE bytes kept in
+ * BCACHE_WAYS-way sets. The TFS library is not thread-safe, so its calls stay
+ * serialized by rwlock; what can go on in parallel is the block I/O, which a
+ * reader finding a chunk missing does for that chunk alone, while readahead
+ * threads load the chunks that follow it. Writes go through to the image
+ * and update the cached chunks they cover. */
+#define BCACHE_CHUNK_ORDER  18      /* 256 KB */
+#define BCACHE_CHUNK_SIZE   U64_FROM_BIT(BCACHE_CHUNK_ORDER)
+#define BCACHE_WAYS         4
+#define BCACHE_SETS         64      /* 64 MB */
+#define BCACHE_READAHEAD    8       /* chunks */
+#define BCACHE_RA_THREADS   4
+#define BCACHE_RA_QUEUE     64
+
+typedef struct bcache_chunk {
+    u64 index;                  /* offset in the image >> BCACHE_CHUNK_ORDER */
+    u64 lru;
+    int pins;
+    boolean valid;
+    boolean loading;
+    u8 *data;
+} *bcache_chunk;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    pthread_cond_t ra_pending;
+    struct bcache_chunk chunks[BCACHE_SETS][BCACHE_WAYS];
+    u64 lru_clock;
+    u64 ra_queue[BCACHE_RA_QUEUE];
+    int ra_head, ra_count;
+    u64 ra_next;                /* chunk following the last readahead */
+} bcache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .loaded = PTHREAD_COND_INITIALIZER,
+    .ra_pending = PTHREAD_COND_INITIALIZER,
+};
+
+/* Reads length bytes at offset, less at the end of the image. */
+static ssize_t image_read(void *dest, u64 length, u64 offset)
 {
     ssize_t xfer, total = 0;
-    u64 offset = bound(fs_offset) + (blocks.start << SECTOR_OFFSET);
-    u64 length = range_span(blocks) << SECTOR_OFFSET;
     while (total < length) {
-        xfer = pread(bound(d), dest + total, length - total, offset + total);
-        if (xfer < 0 && errno != EINTR) {
-            apply(c, timm("read-error", "%s", strerror(errno)));
-            return;
+        xfer = pread(dfd, dest + total, length - total, offset + total);
+        if (xfer < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
         }
+        if (xfer == 0)
+            break;
         total += xfer;
     }
-    apply(c, STATUS_OK);
+    return total;
 }
 
-closure_function(2, 3, void, bwrite,
-                 descriptor, d, u64, fs_offset,
-                 void *, src, range, blocks, status_handler, c)
+/* With bcache.lock held. A chunk is found either valid or being loaded, or
+ * a slot is claimed for loading it; the returned chunk is pinned. Returns 0
+ * if no slot can be claimed. */
+static bcache_chunk bcache_get_locked(u64 index, boolean *load)
+{
+    struct bcache_chunk *set = bcache.chunks[index % BCACHE_SETS];
+    bcache_chunk victim = 0;
+    *load = false;
+    for (int i = 0; i < BCACHE_WAYS; i++) {
+        bcache_chunk c = &set[i];
+        if ((c->valid || c->loading) && c->index == index) {
+            c->pins++;
+            c->lru = ++bcache.lru_clock;
+            return c;
+        }
+        if (!c->pins && !c->loading && (!victim || !c->valid ||
+                                        (victim->valid && c->lru < victim->lru)))
+            victim = c;
+    }
+    if (!victim)
+        return 0;
+    if (!victim->data) {
+        victim->data = malloc(BCACHE_CHUNK_SIZE);
+        if (!victim->data)
+            return 0;
+    }
+    victim->index = index;
+    victim->valid = false;
+    victim->loading = true;
+    victim->pins = 1;
+    victim->lru = ++bcache.lru_clock;
+    *load = true;
+    return victim;
+}
+
+/* Fills a claimed chunk; takes and drops bcache.lock around the read. */
+static boolean bcache_load(bcache_chunk c)
+{
+    u64 index = c->index;
+    pthread_mutex_unlock(&bcache.lock);
+    ssize_t n = image_read(c->data, BCACHE_CHUNK_SIZE, index << BCACHE_CHUNK_ORDER);
+    if (n >= 0)
+        memset(c->data + n, 0, BCACHE_CHUNK_SIZE - n);
+    pthread_mutex_lock(&bcache.lock);
+    c->loading = false;
+    c->valid = n >= 0;
+    pthread_cond_broadcast(&bcache.loaded);
+    return c->valid;
+}
+
+static void bcache_readahead_locked(u64 index)
+{
+    /* more is queued once a reader is within half the window of the end of
+       what has been read ahead */
+    u64 start = MAX(index + 1, bcache.ra_next);
+    if (start > index + BCACHE_READAHEAD / 2)
+        return;
+    u64 end = index + 1 + BCACHE_READAHEAD;
+    for (u64 i = start; i < end && bcache.ra_count < BCACHE_RA_QUEUE; i++) {
+        bcache.ra_queue[(bcache.ra_head + bcache.ra_count++) % BCACHE_RA_QUEUE] = i;
+        bcache.ra_next = i + 1;
+    }
+    pthread_cond_broadcast(&bcache.ra_pending);
+}
+
+static void *bcache_readahead_thread(void *arg)
+{
+    pthread_mutex_lock(&bcache.lock);
+    while (1) {
+        while (!bcache.ra_count)
+            pthread_cond_wait(&bcache.ra_pending, &bcache.lock);
+        u64 index = bcache.ra_queue[bcache.ra_head];
+        bcache.ra_head = (bcache.ra_head + 1) % BCACHE_RA_QUEUE;
+        bcache.ra_count--;
+        boolean load;
+        bcache_chunk c = bcache_get_locked(index, &load);
+        if (!c)
+            continue;
+        if (load)
+            bcache_load(c);
+        c->pins--;
+    }
+    return 0;
+}
+
+static void bcache_start_readahead(void)
+{
+    for (int i = 0; i < BCACHE_RA_THREADS; i++) {
+        pthread_t t;
+        if (pthread_create(&t, 0, bcache_readahead_thread, 0) == 0)
+            pthread_detach(t);
+    }
+}
+
+static int bcache_read(void *dest, u64 length, u64 offset)
+{
+    pthread_mutex_lock(&bcache.lock);
+    while (length > 0) {
+        u64 index = offset >> BCACHE_CHUNK_ORDER;
+        u64 chunk_offset = offset & (BCACHE_CHUNK_SIZE - 1);
+        u64 n = MIN(length, BCACHE_CHUNK_SIZE - chunk_offset);
+        boolean load;
+        bcache_chunk c = bcache_get_locked(index, &load);
+        if (c && load) {
+            /* a miss starts a new stream to read ahead of */
+            bcache.ra_next = index + 1;
+            bcache_readahead_locked(index);
+            bcache_load(c);
+        } else if (c) {
+            bcache_readahead_locked(index);
+            while (c->loading)
+                pthread_cond_wait(&bcache.loaded, &bcache.lock);
+        }
+        if (c && c->valid) {
+            memcpy(dest, c->data + chunk_offset, n);
+            c->pins--;
+        } else {
+            /* no room, or the chunk failed to load: read around the cache */
+            if (c)
+                c->pins--;
+            pthread_mutex_unlock(&bcache.lock);
+            ssize_t xfer = image_read(dest, n, offset);
+            if (xfer < 0)
+                return xfer;
+            memset(dest + xfer, 0, n - xfer);
+            pthread_mutex_lock(&bcache.lock);
+        }
+        dest += n;
+        offset += n;
+        length -= n;
+    }
+    pthread_mutex_unlock(&bcache.lock);
+    return 0;
+}
+
+static int bcache_write(void *src, u64 length, u64 offset)
 {
-    tfs_fuse_debug("bwrite from %p blocks %R", src, blocks);
-    ssize_t start = bound(fs_offset) + (blocks.start << SECTOR_OFFSET);
-    ssize_t size = range_span(blocks) << SECTOR_OFFSET;
+    pthread_mutex_lock(&bcache.lock);
+
+    /* chunks being loaded could otherwise end up with the old data */
+    for (u64 index = offset >> BCACHE_CHUNK_ORDER;
+         index <= (offset + length - 1) >> BCACHE_CHUNK_ORDER; index++) {
+        struct bcache_chunk *set = bcache.chunks[index % BCACHE_SETS];
+        for (int i = 0; i < BCACHE_WAYS; i++) {
+            while (set[i].loading && set[i].index == index)
+                pthread_cond_wait(&bcache.loaded, &bcache.lock);
+        }
+    }
+    int rv = 0;
     ssize_t total = 0;
-    while (total < size) {
-        ssize_t rv = pwrite(bound(d), src + total, size - total, start + total);
-        tfs_fuse_debug(" rv %d\n", rv);
-        if (rv < 0 && errno != EINTR) {
-            apply(c, timm("error", "pwrite error: %s", strerror(errno)));
-            return;
+    while (total < length) {
+        ssize_t xfer = pwrite(dfd, src + total, length - total, offset + total);
+        if (xfer < 0) {
+            if (errno == EINTR)
+                continue;
+            rv = -errno;
+            break;
         }
-        total += rv;
+        total += xfer;
+    }
+    for (u64 pos = offset; pos < offset + total; ) {
+        u64 index = pos >> BCACHE_CHUNK_ORDER;
+        u64 chunk_offset = pos & (BCACHE_CHUNK_SIZE - 1);
+        u64 n = MIN(offset + total - pos, BCACHE_CHUNK_SIZE - chunk_offset);
+        struct bcache_chunk *set = bcache.chunks[index % BCACHE_SETS];
+        for (int i = 0; i < BCACHE_WAYS; i++) {
+            if (set[i].valid && set[i].index == index)
+                memcpy(set[i].data + chunk_offset, src + (pos - offset), n);
+        }
+        pos += n;
     }
-    apply(c, STATUS_OK);
+    pthread_mutex_unlock(&bcache.lock);
+    return rv;
+}
+
+closure_function(1, 3, void, bread,
+                 u64, fs_offset,
+                 void *, dest, range, blocks, status_handler, c)
+{
+    u64 offset = bound(fs_offset) + (blocks.start << SECTOR_OFFSET);
+    u64 length = range_span(blocks) << SECTOR_OFFSET;
+    int rv = bcache_read(dest, length, offset);
+    if (rv < 0)
+        apply(c, timm("read-error", "%s", strerror(-rv)));
+    else
+        apply(c, STATUS_OK);
+}
+
+closure_function(1, 3, void, bwrite,
+                 u64, fs_offset,
+                 void *, src, range, blocks, status_handler, c)
+{
+    tfs_fuse_debug("bwrite from %p blocks %R\n", src, blocks);
+    u64 offset = bound(fs_offset) + (blocks.start << SECTOR_OFFSET);
+    u64 length = range_span(blocks) << SECTOR_OFFSET;
+    int rv = bcache_write(src, length, offset);
+    if (rv < 0)
+        apply(c, timm("error", "pwrite error: %s", strerror(-rv)));
+    else
+        apply(c, STATUS_OK);
 }
 
 static u64 get_fs_offset(descriptor fd, int part, boolean by_index, u64 *length)
@@ -624,6 +846,22 @@ out:
     return ret;
 }
 
+static void *tfs_init(struct fuse_conn_info *conn)
+{
+    /* after fuse_main() has daemonized, so that the threads survive */
+    bcache_start_readahead();
+    conn->async_read = 1;
+    conn->max_readahead = BCACHE_READAHEAD * BCACHE_CHUNK_SIZE;
+#ifdef FUSE_CAP_BIG_WRITES
+    conn->want |= FUSE_CAP_BIG_WRITES;
+#endif
+#ifdef FUSE_CAP_SPLICE_WRITE
+    /* replies to reads come from memory, so only writes gain from splice */
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+#endif
+    return 0;
+}
+
 static void tfs_destroy(void *v)
 {
     alarm(0);
@@ -932,6 +1170,7 @@ static struct fuse_operations tfs_op = {
     .readlink       = tfs_readlink,
     .write          = tfs_write,
     .create         = tfs_create,
+    .init           = tfs_init,
     .destroy        = tfs_destroy,
     .mkdir          = tfs_mkdir,
     .rename         = tfs_rename,
@@ -1001,8 +1240,8 @@ int main(int argc, char **argv)
     create_filesystem(h,
                       SECTOR_SIZE,
                       length,
-                      closure(h, bread, fd, offset),
-                      closure(h, bwrite, fd, offset),
+                      closure(h, bread, offset),
+                      closure(h, bwrite, offset),
                       false,
                       closure(h, fsc));
     fdallocator = create_id_heap(h, h, 0, infinity, 1, false);
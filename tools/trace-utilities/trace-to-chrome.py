@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+
+# Convert a binary trace_raw file into Chrome trace event JSON, which can be
+# opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+#
+# The output has:
+#   - one track per CPU with the function_graph call spans (or instant events
+#     for the function tracer) and the thread switch events
+#   - one track per thread showing when and where it ran
+#   - one track per thread with syscall spans, taken to be the functions
+#     called directly from the syscall dispatch function
+#   - static tracepoint events as instants on the CPU tracks
+
+import argparse
+import bisect
+import json
+import struct
+import subprocess
+import sys
+
+HEADER = struct.Struct("<IHHIIQQQQQ")
+RECORD = struct.Struct("<QQQIHBBQ")
+MAGIC = 0x4352544e
+VERSION = 1
+
+FUNCTION = 1
+GRAPH_ENTRY = 2
+GRAPH_RETURN = 3
+GRAPH_LEAF = 4
+SWITCH = 5
+EVENT = 6
+
+PID_CPUS = 1
+PID_THREADS = 2
+PID_SYSCALLS = 3
+
+class Symbols:
+    def __init__(self, elf):
+        self.addrs = []
+        self.names = []
+        if not elf:
+            return
+        out = subprocess.check_output(["nm", "-n", "--defined-only", elf],
+                                      universal_newlines=True)
+        for line in out.splitlines():
+            fields = line.split()
+            if len(fields) != 3 or fields[1] not in "tTwW":
+                continue
+            self.addrs.append(int(fields[0], 16))
+            self.names.append(fields[2])
+
+    def name(self, ip):
+        i = bisect.bisect_right(self.addrs, ip) - 1
+        if i < 0:
+            return "0x%x" % ip
+        return self.names[i]
+
+def read_trace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit("%s: too short for a trace_raw header" % path)
+    hdr = HEADER.unpack_from(data, 0)
+    magic, version, record_size, nr_cpus, tracer = hdr[:5]
+    tsc_init, ns_init, tsc_open, ns_open, dropped = hdr[5:]
+    if magic != MAGIC or version != VERSION:
+        sys.exit("%s: not a version %d trace_raw file" % (path, VERSION))
+    if record_size < RECORD.size:
+        sys.exit("%s: unexpected record size %d" % (path, record_size))
+    if dropped:
+        print("warning: %d events were dropped by full trace buffers" % dropped,
+              file=sys.stderr)
+    tsc_per_ns = (tsc_open - tsc_init) / float(max(ns_open - ns_init, 1))
+
+    def usec(tsc):
+        return (ns_init + (tsc - tsc_init) / tsc_per_ns) / 1000.0
+
+    records = []
+    for off in range(HEADER.size, len(data) - record_size + 1, record_size):
+        ts, ip, arg, tid, cpu, rtype, depth, arg2 = RECORD.unpack_from(data, off)
+        records.append((usec(ts), ip, arg, arg2, tid, cpu, rtype, depth))
+    return nr_cpus, records
+
+def convert(nr_cpus, records, syms, syscall_parents, event_names):
+    events = []
+
+    def meta(pid, tid, kind, name):
+        ev = {"ph": "M", "pid": pid, "name": kind, "args": {"name": name}}
+        if tid is not None:
+            ev["tid"] = tid
+        events.append(ev)
+
+    meta(PID_CPUS, None, "process_name", "CPUs")
+    meta(PID_THREADS, None, "process_name", "Threads")
+    meta(PID_SYSCALLS, None, "process_name", "Syscalls")
+    for cpu in range(nr_cpus):
+        meta(PID_CPUS, cpu, "thread_name", "cpu %d" % cpu)
+
+    # per cpu: call stack names by depth; thread running and since when
+    stacks = {}
+    running = {}
+    threads = set()
+
+    def thread_seen(tid):
+        if tid not in threads:
+            threads.add(tid)
+            meta(PID_THREADS, tid, "thread_name", "tid %d" % tid)
+            meta(PID_SYSCALLS, tid, "thread_name", "tid %d" % tid)
+
+    for ts, ip, arg, arg2, tid, cpu, rtype, depth in records:
+        if rtype == EVENT:
+            name = (event_names[depth] if depth < len(event_names)
+                    else "event %d" % depth)
+            events.append({"ph": "i", "s": "t", "pid": PID_CPUS, "tid": cpu,
+                           "ts": ts, "name": name, "cat": "tracepoint",
+                           "args": {"tid": tid, "args": [ip, arg, arg2]}})
+            continue
+
+        if rtype == SWITCH:
+            events.append({"ph": "i", "s": "t", "pid": PID_CPUS, "tid": cpu,
+                           "ts": ts, "name": "switch %d -> %d" % (arg, tid),
+                           "args": {"out": arg, "in": tid}})
+            prev = running.get(cpu)
+            if prev is not None:
+                events.append({"ph": "X", "pid": PID_THREADS, "tid": prev[0],
+                               "ts": prev[1], "dur": ts - prev[1],
+                               "name": "cpu %d" % cpu})
+            running[cpu] = None
+            if tid:
+                thread_seen(tid)
+                running[cpu] = (tid, ts)
+            continue
+
+        name = syms.name(ip)
+        if rtype == FUNCTION:
+            events.append({"ph": "i", "s": "t", "pid": PID_CPUS, "tid": cpu,
+                           "ts": ts, "name": name,
+                           "args": {"caller": syms.name(arg), "tid": tid}})
+            continue
+
+        stack = stacks.setdefault(cpu, {})
+        if rtype == GRAPH_ENTRY:
+            stack[depth] = name
+            continue
+
+        # returns carry the duration, so spans don't depend on having seen
+        # the entry (e.g. for calls already underway when tracing started)
+        dur = arg / 1000.0
+        events.append({"ph": "X", "pid": PID_CPUS, "tid": cpu, "ts": ts - dur,
+                       "dur": dur, "name": name, "args": {"tid": tid}})
+        if depth > 0 and stack.get(depth - 1) in syscall_parents:
+            thread_seen(tid)
+            events.append({"ph": "X", "pid": PID_SYSCALLS, "tid": tid,
+                           "ts": ts - dur, "dur": dur, "name": name,
+                           "cat": "syscall", "args": {"cpu": cpu}})
+        stack.pop(depth, None)
+
+    return events
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Convert a nanos trace_raw file to Chrome/Perfetto JSON")
+    parser.add_argument("trace", help="binary trace from ftrace/trace_raw")
+    parser.add_argument("-k", "--kernel",
+                        help="kernel ELF used to resolve function addresses")
+    parser.add_argument("-o", "--output", default="trace.json",
+                        help="output file (default: trace.json)")
+    parser.add_argument("--syscall-parent", action="append",
+                        default=["syscall_debug"],
+                        help="function whose callees are syscall handlers "
+                        "(default: syscall_debug; may be repeated)")
+    parser.add_argument("-e", "--events",
+                        help="contents of ftrace/available_events, used to "
+                        "name tracepoint events")
+    args = parser.parse_args()
+
+    event_names = []
+    if args.events:
+        with open(args.events) as f:
+            event_names = f.read().split()
+
+    nr_cpus, records = read_trace(args.trace)
+    events = convert(nr_cpus, records, Symbols(args.kernel),
+                     set(args.syscall_parent), event_names)
+    with open(args.output, "w") as f:
+        json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, f)
+    print("%d records -> %d events in %s" % (len(records), len(events),
+                                             args.output))
+
+if __name__ == "__main__":
+    main()